@@ -280,6 +280,7 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
 
     data->max_requests = 20;
     data->max_client_requests = 5;
+    data->max_client_queue_bytes = 8 * 1024 * 1024;
 
     data->log_buffer_size = 64;
 
@@ -334,6 +335,7 @@ daemonConfigFree(struct daemonConfig *data)
     VIR_FREE(data->unix_sock_group);
     VIR_FREE(data->unix_sock_dir);
     VIR_FREE(data->mdns_name);
+    VIR_FREE(data->rpc_stats_file);
 
     tmp = data->tls_allowed_dn_list;
     while (tmp && *tmp) {
@@ -428,6 +430,16 @@ daemonConfigLoadOptions(struct daemonConfig *data,
 
     GET_CONF_INT(conf, filename, max_requests);
     GET_CONF_INT(conf, filename, max_client_requests);
+    GET_CONF_INT(conf, filename, max_client_queue_bytes);
+
+    GET_CONF_STR(conf, filename, rpc_stats_file);
+
+    GET_CONF_INT(conf, filename, hook_workers);
+    GET_CONF_INT(conf, filename, hook_timeout);
+
+    GET_CONF_INT(conf, filename, stream_io_threads);
+
+    GET_CONF_INT(conf, filename, event_timer_slack);
 
     GET_CONF_INT(conf, filename, audit_level);
     GET_CONF_INT(conf, filename, audit_logging);
@@ -438,6 +450,7 @@ daemonConfigLoadOptions(struct daemonConfig *data,
     GET_CONF_STR(conf, filename, log_filters);
     GET_CONF_STR(conf, filename, log_outputs);
     GET_CONF_INT(conf, filename, log_buffer_size);
+    GET_CONF_INT(conf, filename, log_queue_size);
 
     GET_CONF_INT(conf, filename, keepalive_interval);
     GET_CONF_INT(conf, filename, keepalive_count);
@@ -66,11 +66,22 @@ struct daemonConfig {
 
     int max_requests;
     int max_client_requests;
+    int max_client_queue_bytes;
+
+    char *rpc_stats_file;
+
+    int hook_workers;
+    int hook_timeout;
+
+    int stream_io_threads;
+
+    int event_timer_slack;
 
     int log_level;
     char *log_filters;
     char *log_outputs;
     int log_buffer_size;
+    int log_queue_size;
 
     int audit_level;
     int audit_logging;
@@ -49,13 +49,17 @@
 #include "memory.h"
 #include "conf.h"
 #include "virnetlink.h"
+#include "virnetdev.h"
 #include "virnetserver.h"
 #include "threads.h"
+#include "viratomic.h"
 #include "remote.h"
 #include "remote_driver.h"
 #include "hooks.h"
 #include "uuid.h"
 #include "viraudit.h"
+#include "fdstream.h"
+#include "event_poll.h"
 #include "locking/lock_manager.h"
 
 #ifdef WITH_DRIVER_MODULES
@@ -106,6 +110,17 @@ virNetSASLContextPtr saslCtxt = NULL;
 virNetServerProgramPtr remoteProgram = NULL;
 virNetServerProgramPtr qemuProgram = NULL;
 
+/* Set to re-execute ourselves once the main loop quits */
+static bool execRestart = false;
+/* Clients saved before re-executing, restored once drivers are up */
+static virJSONValuePtr restartClients = NULL;
+/* Set once the drivers, and whatever they autostart, are up; use
+ * viratomic.h */
+static int stateInitDone = 0;
+
+#define LIBVIRTD_RESTART_EXEC_FILE "libvirtd-restart-exec.json"
+#define LIBVIRTD_RESTART_EXEC_ENV "LIBVIRTD_RESTART_EXEC"
+
 enum {
     VIR_DAEMON_ERR_NONE = 0,
     VIR_DAEMON_ERR_PIDFILE,
@@ -740,6 +755,15 @@ static void daemonShutdownHandler(virNetServerPtr srv,
     virNetServerQuit(srv);
 }
 
+static void daemonExecRestartHandler(virNetServerPtr srv,
+                                     siginfo_t *sig ATTRIBUTE_UNUSED,
+                                     void *opaque ATTRIBUTE_UNUSED)
+{
+    VIR_INFO("Restarting in place on SIGUSR1");
+    execRestart = true;
+    virNetServerQuit(srv);
+}
+
 static void daemonReloadHandler(virNetServerPtr srv ATTRIBUTE_UNUSED,
                                 siginfo_t *sig ATTRIBUTE_UNUSED,
                                 void *opaque ATTRIBUTE_UNUSED)
@@ -751,7 +775,47 @@ static void daemonReloadHandler(virNetServerPtr srv ATTRIBUTE_UNUSED,
             VIR_WARN("Error while reloading drivers");
 }
 
-static int daemonSetupSignals(virNetServerPtr srv)
+static void daemonStatsHandler(virNetServerPtr srv,
+                               siginfo_t *sig ATTRIBUTE_UNUSED,
+                               void *opaque)
+{
+    const char *path = opaque;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *content = NULL;
+    char *tmp = NULL;
+
+    if (virNetServerFormatStats(srv, &buf) < 0 ||
+        virHookFormatStats(&buf) < 0 ||
+        virEventPollFormatStats(&buf) < 0)
+        goto cleanup;
+    content = virBufferContentAndReset(&buf);
+
+    /* Replace the file at once, so readers never see a partial dump */
+    if (virAsprintf(&tmp, "%s.new", path) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (virFileWriteStr(tmp, content ? content : "", 0644) < 0) {
+        virReportSystemError(errno,
+                             _("cannot write RPC statistics to '%s'"), tmp);
+        goto cleanup;
+    }
+
+    if (rename(tmp, path) < 0) {
+        virReportSystemError(errno,
+                             _("cannot rename '%s' to '%s'"), tmp, path);
+        unlink(tmp);
+    }
+
+cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(content);
+    VIR_FREE(tmp);
+}
+
+static int daemonSetupSignals(virNetServerPtr srv,
+                              struct daemonConfig *config)
 {
     if (virNetServerAddSignalHandler(srv, SIGINT, daemonShutdownHandler, NULL) < 0)
         return -1;
@@ -761,6 +825,14 @@ static int daemonSetupSignals(virNetServerPtr srv)
         return -1;
     if (virNetServerAddSignalHandler(srv, SIGHUP, daemonReloadHandler, NULL) < 0)
         return -1;
+    if (virNetServerAddSignalHandler(srv, SIGUSR1, daemonExecRestartHandler, NULL) < 0)
+        return -1;
+    if (config->rpc_stats_file) {
+        virNetServerProgramEnableStats();
+        if (virNetServerAddSignalHandler(srv, SIGUSR2, daemonStatsHandler,
+                                         config->rpc_stats_file) < 0)
+            return -1;
+    }
     return 0;
 }
 
@@ -863,6 +935,20 @@ static void daemonRunStateInit(void *opaque)
         goto cleanup;
     }
 
+    /* Clients kept across a restart need the drivers to be back */
+    if (restartClients) {
+        if (virNetServerAddClientsPostExecRestart(srv, restartClients,
+                                                  remoteClientNewPostExecRestart) < 0) {
+            virErrorPtr err = virGetLastError();
+            VIR_ERROR(_("Unable to restore clients after restart: %s"),
+                      err ? err->message : _("unknown error"));
+            kill(getpid(), SIGTERM);
+            goto cleanup;
+        }
+        virJSONValueFree(restartClients);
+        restartClients = NULL;
+    }
+
 #ifdef HAVE_DBUS
     /* Tie the non-priviledged libvirtd to the session/shutdown lifecycle */
     if (!virNetServerIsPrivileged(srv)) {
@@ -884,6 +970,7 @@ static void daemonRunStateInit(void *opaque)
 #endif
     /* Only now accept clients from network */
     virNetServerUpdateServices(srv, true);
+    virAtomicIntSet(&stateInitDone, 1);
 cleanup:
     daemonInhibitCallback(false, srv);
     virObjectUnref(srv);
@@ -1050,6 +1137,233 @@ enum {
     OPT_VERSION = 129
 };
 
+static char *
+daemonGetExecRestartMagic(void)
+{
+    char *ret;
+
+    if (virAsprintf(&ret, "%lld",
+                    (long long int)getpid()) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    return ret;
+}
+
+
+/*
+ * Restore the server saved by daemonPreExecRestart, if we were just
+ * re-executed. Its clients are only restored by daemonRunStateInit.
+ *
+ * Returns 1 if the server was restored, 0 if there was nothing to
+ * restore, -1 on error
+ */
+static int
+daemonPostExecRestart(const char *run_dir,
+                      virNetServerPtr *srv)
+{
+    const char *gotmagic;
+    char *wantmagic = NULL;
+    char *path = NULL;
+    char *state = NULL;
+    virJSONValuePtr object = NULL;
+    virJSONValuePtr child;
+    int ret = -1;
+
+    VIR_DEBUG("Running post-restart exec");
+
+    if (virAsprintf(&path, "%s/%s", run_dir, LIBVIRTD_RESTART_EXEC_FILE) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (!virFileExists(path)) {
+        VIR_DEBUG("No restart file %s present", path);
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virFileReadAll(path,
+                       1024 * 1024 * 10, /* 10 MB */
+                       &state) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Loading state %s", state);
+
+    if (!(object = virJSONValueFromString(state)))
+        goto cleanup;
+
+    if (!(gotmagic = virJSONValueObjectGetString(object, "magic"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing magic data in JSON document"));
+        goto cleanup;
+    }
+
+    if (!(wantmagic = daemonGetExecRestartMagic()))
+        goto cleanup;
+
+    if (STRNEQ(gotmagic, wantmagic)) {
+        VIR_WARN("Found restart exec file with old magic %s vs wanted %s",
+                 gotmagic, wantmagic);
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!(child = virJSONValueObjectGet(object, "server"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing server data from JSON file"));
+        goto cleanup;
+    }
+
+    if (virJSONValueObjectRemoveKey(object, "clients", &restartClients) != 1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing clients data from JSON file"));
+        goto cleanup;
+    }
+
+    if (!(*srv = virNetServerNewPostExecRestart(child,
+                                                remoteClientInitHook,
+                                                remoteClientNewPostExecRestart,
+                                                remoteClientPreExecRestart,
+                                                remoteClientFreeFunc,
+                                                NULL)))
+        goto cleanup;
+
+    ret = 1;
+
+cleanup:
+    if (ret < 0) {
+        virJSONValueFree(restartClients);
+        restartClients = NULL;
+    }
+    unlink(path);
+    VIR_FREE(path);
+    VIR_FREE(wantmagic);
+    VIR_FREE(state);
+    virJSONValueFree(object);
+    return ret;
+}
+
+
+/*
+ * Save the server with its clients and re-execute ourselves, from
+ * @binary, the absolute path to our executable found at startup.
+ * The listening and client sockets are inherited, so clients stay
+ * connected across an upgrade of the daemon.
+ *
+ * Nothing else survives, so this is refused while the drivers are
+ * still starting up, autostart included, or have background work
+ * running.
+ *
+ * Only returns if the state could not be saved, in which case the
+ * daemon carries on as before.
+ */
+static int
+daemonPreExecRestart(virNetServerPtr srv,
+                     const char *run_dir,
+                     char *binary,
+                     char **argv)
+{
+    virJSONValuePtr object;
+    virJSONValuePtr child;
+    virJSONValuePtr clients = NULL;
+    char *path = NULL;
+    char *state = NULL;
+    char *magic;
+    char *argv0 = argv[0];
+    int ret = -1;
+
+    VIR_DEBUG("Running pre-restart exec");
+
+    if (!binary) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot find the daemon binary to restart"));
+        return -1;
+    }
+
+    if (!virAtomicIntGet(&stateInitDone)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("drivers are still starting up"));
+        return -1;
+    }
+
+    if (virStatePreExecRestart() < 0)
+        return -1;
+
+    if (!(object = virJSONValueNewObject()))
+        goto cleanup;
+
+    if (!(child = virNetServerPreExecRestart(srv)))
+        goto cleanup;
+
+    /* Clients are restored separately, once the drivers are up */
+    if (virJSONValueObjectRemoveKey(child, "clients", &clients) != 1 ||
+        virJSONValueObjectAppend(object, "clients", clients) < 0) {
+        virJSONValueFree(clients);
+        virJSONValueFree(child);
+        goto cleanup;
+    }
+
+    if (virJSONValueObjectAppend(object, "server", child) < 0) {
+        virJSONValueFree(child);
+        goto cleanup;
+    }
+
+    if (!(magic = daemonGetExecRestartMagic()))
+        goto cleanup;
+
+    if (virJSONValueObjectAppendString(object, "magic", magic) < 0) {
+        VIR_FREE(magic);
+        goto cleanup;
+    }
+    VIR_FREE(magic);
+
+    if (!(state = virJSONValueToString(object, true)))
+        goto cleanup;
+
+    VIR_DEBUG("Saving state %s", state);
+
+    if (virAsprintf(&path, "%s/%s", run_dir, LIBVIRTD_RESTART_EXEC_FILE) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (virFileWriteStr(path, state, 0600) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to save state file %s"), path);
+        goto cleanup;
+    }
+
+    /* We are in the background already */
+    if (setenv(LIBVIRTD_RESTART_EXEC_ENV, "1", 1) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to set restart environment"));
+        unlink(path);
+        goto cleanup;
+    }
+
+    /* So that the next restart finds us again */
+    argv[0] = binary;
+    if (execv(binary, argv) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to restart self"));
+        argv[0] = argv0;
+        unsetenv(LIBVIRTD_RESTART_EXEC_ENV);
+        unlink(path);
+        goto cleanup;
+    }
+
+    abort(); /* This should be impossible to reach */
+
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(state);
+    virJSONValueFree(object);
+    return ret;
+}
+
+
 #define MAX_LISTEN 5
 int main(int argc, char **argv) {
     virNetServerPtr srv = NULL;
@@ -1067,8 +1381,11 @@ int main(int argc, char **argv) {
     struct daemonConfig *config;
     bool privileged = geteuid() == 0 ? true : false;
     bool implicit_conf = false;
+    bool restarted = false;
     char *run_dir = NULL;
+    char *binary = NULL;
     mode_t old_umask;
+    int rv;
 
     struct option opts[] = {
         { "verbose", no_argument, &verbose, 1},
@@ -1250,7 +1567,19 @@ int main(int argc, char **argv) {
     VIR_DEBUG("Decided on socket paths '%s' and '%s'",
               sock_file, NULLSTR(sock_file_ro));
 
-    if (godaemon) {
+    /* Set when re-executing ourselves, when we are daemonized already */
+    if (getenv(LIBVIRTD_RESTART_EXEC_ENV)) {
+        restarted = true;
+        unsetenv(LIBVIRTD_RESTART_EXEC_ENV);
+    }
+
+    /* Restarting in place needs to find us again, from another
+     * working directory if we daemonize */
+    if (!(binary = virFindFileInPath(argv[0])))
+        VIR_WARN("Cannot find the daemon binary %s, it won't be able "
+                 "to restart in place", argv[0]);
+
+    if (godaemon && !restarted) {
         char ebuf[1024];
 
         if (chdir("/") < 0) {
@@ -1266,6 +1595,14 @@ int main(int argc, char **argv) {
         }
     }
 
+    /* The writer thread must only be started once we have forked
+     * into the background, as it would not survive the fork */
+    if (config->log_queue_size > 0 &&
+        virLogStartWriter(config->log_queue_size * 1024ULL) < 0) {
+        VIR_ERROR(_("Failed to start log writer thread"));
+        goto cleanup;
+    }
+
     /* Ensure the rundir exists (on tmpfs on some systems) */
     if (privileged) {
         run_dir = strdup(LOCALSTATEDIR "/run/libvirt");
@@ -1307,7 +1644,15 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
-    if (!(srv = virNetServerNew(config->min_workers,
+    if ((rv = daemonPostExecRestart(run_dir, &srv)) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
+    /* rv == 1 means the server and its sockets were restored
+     * from the saved state, so only create them otherwise */
+    if (rv == 0 &&
+        !(srv = virNetServerNew(config->min_workers,
                                 config->max_workers,
                                 config->prio_workers,
                                 config->max_clients,
@@ -1316,13 +1661,18 @@ int main(int argc, char **argv) {
                                 !!config->keepalive_required,
                                 config->mdns_adv ? config->mdns_name : NULL,
                                 remoteClientInitHook,
-                                NULL,
+                                remoteClientPreExecRestart,
                                 remoteClientFreeFunc,
                                 NULL))) {
         ret = VIR_DAEMON_ERR_INIT;
         goto cleanup;
     }
 
+    if (config->max_client_queue_bytes > 0)
+        virNetServerSetClientQueueLimit(srv, config->max_client_queue_bytes);
+
+    virEventPollSetTimerSlack(config->event_timer_slack);
+
     /* Beyond this point, nothing should rely on using
      * getuid/geteuid() == 0, for privilege level checks.
      */
@@ -1369,7 +1719,7 @@ int main(int argc, char **argv) {
                                  timeout);
     }
 
-    if ((daemonSetupSignals(srv)) < 0) {
+    if ((daemonSetupSignals(srv, config)) < 0) {
         ret = VIR_DAEMON_ERR_SIGNAL;
         goto cleanup;
     }
@@ -1387,11 +1737,22 @@ int main(int argc, char **argv) {
     virAuditLog(config->audit_logging);
 
     /* setup the hooks if any */
-    if (virHookInitialize() < 0) {
+    if (virHookInitialize() < 0 ||
+        virHookSetup(config->hook_workers, config->hook_timeout) < 0) {
         ret = VIR_DAEMON_ERR_HOOKS;
         goto cleanup;
     }
 
+    if (config->stream_io_threads < 0) {
+        VIR_ERROR(_("stream_io_threads must not be negative"));
+        ret = VIR_DAEMON_ERR_CONFIG;
+        goto cleanup;
+    }
+    if (virFDStreamSetIOThreads(config->stream_io_threads) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
     /* Disable error func, now logging is setup */
     virSetErrorFunc(NULL, daemonErrorHandler);
     virSetErrorLogPriorityFunc(daemonErrorLogFilter);
@@ -1404,7 +1765,8 @@ int main(int argc, char **argv) {
     virHookCall(VIR_HOOK_DRIVER_DAEMON, "-", VIR_HOOK_DAEMON_OP_START,
                 0, "start", NULL, NULL);
 
-    if (daemonSetupNetworking(srv, config,
+    if (rv == 0 &&
+        daemonSetupNetworking(srv, config,
                               sock_file, sock_file_ro,
                               ipsock, privileged) < 0) {
         ret = VIR_DAEMON_ERR_NETWORK;
@@ -1430,8 +1792,10 @@ int main(int argc, char **argv) {
     }
 
 #if defined(__linux__) && defined(NETLINK_ROUTE)
-    /* Register the netlink event service for NETLINK_ROUTE */
-    if (virNetlinkEventServiceStart(NETLINK_ROUTE, 0) < 0) {
+    /* Register the netlink event service for NETLINK_ROUTE, listening
+     * to link changes to keep the interface state cache current */
+    if (virNetlinkEventServiceStart(NETLINK_ROUTE, RTNLGRP_LINK) < 0 ||
+        virNetDevLinkCacheStart() < 0) {
         ret = VIR_DAEMON_ERR_NETWORK;
         goto cleanup;
     }
@@ -1448,6 +1812,16 @@ int main(int argc, char **argv) {
     /* Run event loop. */
     virNetServerRun(srv);
 
+    while (execRestart) {
+        execRestart = false;
+        if (daemonPreExecRestart(srv, run_dir, binary, argv) < 0) {
+            virErrorPtr err = virGetLastError();
+            VIR_ERROR(_("Unable to restart in place, carrying on: %s"),
+                      err ? err->message : _("unknown error"));
+            virNetServerRun(srv);
+        }
+    }
+
     ret = 0;
 
     virHookCall(VIR_HOOK_DRIVER_DAEMON, "-", VIR_HOOK_DAEMON_OP_SHUTDOWN,
@@ -1478,7 +1852,9 @@ cleanup:
     VIR_FREE(pid_file);
     VIR_FREE(remote_config_file);
     VIR_FREE(run_dir);
+    VIR_FREE(binary);
 
+    virLogStopWriter();
     daemonConfigFree(config);
 
     return ret;
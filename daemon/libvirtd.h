@@ -44,6 +44,16 @@ typedef struct daemonClientStream daemonClientStream;
 typedef daemonClientStream *daemonClientStreamPtr;
 typedef struct daemonClientPrivate daemonClientPrivate;
 typedef daemonClientPrivate *daemonClientPrivatePtr;
+typedef struct daemonClientDomainEvent daemonClientDomainEvent;
+typedef daemonClientDomainEvent *daemonClientDomainEventPtr;
+
+/* An event registration restricted to a single domain */
+struct daemonClientDomainEvent {
+    int eventID;
+    virDomainPtr dom;
+    /* -1 while a registration for all domains covers this one */
+    int callbackID;
+};
 
 /* Stores the per-client connection state */
 struct daemonClientPrivate {
@@ -51,6 +61,8 @@ struct daemonClientPrivate {
     virMutex lock;
 
     int domainEventCallbackID[VIR_DOMAIN_EVENT_ID_LAST];
+    daemonClientDomainEventPtr domainEvents;
+    size_t ndomainEvents;
 
 # if HAVE_SASL
     virNetSASLSessionPtr sasl;
@@ -61,9 +73,13 @@ struct daemonClientPrivate {
      * called, it will be set back to NULL if that succeeds.
      */
     virConnectPtr conn;
+    /* The flags conn was opened with */
+    unsigned int connFlags;
 
     daemonClientStreamPtr streams;
     bool keepalive_supported;
+    /* Client grants credit for the stream data sent to it */
+    bool streamCredit;
 };
 
 # if HAVE_SASL
@@ -653,16 +653,11 @@ static virConnectDomainEventGenericCallback domainEventCallbacks[] = {
 verify(ARRAY_CARDINALITY(domainEventCallbacks) == VIR_DOMAIN_EVENT_ID_LAST);
 
 /*
- * You must hold lock for at least the client
- * We don't free stuff here, merely disconnect the client's
- * network socket & resources.
- * We keep the libvirt connection open until any async
- * jobs have finished, then clean it up elsewhere
+ * Drop the client's event registrations and close its
+ * libvirt connection
  */
-void remoteClientFreeFunc(void *data)
+static void remoteClientCloseConnection(struct daemonClientPrivate *priv)
 {
-    struct daemonClientPrivate *priv = data;
-
     /* Deregister event delivery callback */
     if (priv->conn) {
         int i;
@@ -676,8 +671,32 @@ void remoteClientFreeFunc(void *data)
             priv->domainEventCallbackID[i] = -1;
         }
 
+        for (i = 0 ; i < priv->ndomainEvents ; i++) {
+            if (priv->domainEvents[i].callbackID != -1)
+                virConnectDomainEventDeregisterAny(priv->conn,
+                                                   priv->domainEvents[i].callbackID);
+            virDomainFree(priv->domainEvents[i].dom);
+        }
+        VIR_FREE(priv->domainEvents);
+        priv->ndomainEvents = 0;
+
         virConnectClose(priv->conn);
+        priv->conn = NULL;
     }
+}
+
+/*
+ * You must hold lock for at least the client
+ * We don't free stuff here, merely disconnect the client's
+ * network socket & resources.
+ * We keep the libvirt connection open until any async
+ * jobs have finished, then clean it up elsewhere
+ */
+void remoteClientFreeFunc(void *data)
+{
+    struct daemonClientPrivate *priv = data;
+
+    remoteClientCloseConnection(priv);
 
     VIR_FREE(priv);
 }
@@ -715,6 +734,237 @@ void *remoteClientInitHook(virNetServerClientPtr client,
     return priv;
 }
 
+
+/*
+ * Restore the state saved by remoteClientPreExecRestart. This is
+ * called once the drivers are initialized again, so the connection
+ * and its event registrations can be set up straight away. If they
+ * can't be restored any more, the client is kept without connection
+ * and only gets errors until it reconnects.
+ */
+void *remoteClientNewPostExecRestart(virNetServerClientPtr client,
+                                     virJSONValuePtr object,
+                                     void *opaque)
+{
+    struct daemonClientPrivate *priv;
+    virJSONValuePtr events;
+    const char *uri;
+    int n;
+    int i;
+
+    if (!(priv = remoteClientInitHook(client, opaque)))
+        return NULL;
+
+    if (virJSONValueObjectGetBoolean(object, "keepalive_supported",
+                                     &priv->keepalive_supported) < 0 ||
+        virJSONValueObjectGetBoolean(object, "streamCredit",
+                                     &priv->streamCredit) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing client data in JSON document"));
+        goto error;
+    }
+
+    if (!(uri = virJSONValueObjectGetString(object, "uri")))
+        return priv;
+
+    if (virJSONValueObjectGetNumberUint(object, "connFlags",
+                                        &priv->connFlags) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing connFlags data in JSON document"));
+        goto error;
+    }
+
+    priv->conn =
+        priv->connFlags & VIR_CONNECT_RO
+        ? virConnectOpenReadOnly(uri)
+        : virConnectOpen(uri);
+    if (!priv->conn) {
+        virErrorPtr err = virGetLastError();
+        VIR_WARN("Unable to reopen connection to %s for client %p: %s",
+                 uri, client, err ? err->message : _("unknown error"));
+        return priv;
+    }
+
+    if ((events = virJSONValueObjectGet(object, "events"))) {
+        n = virJSONValueArraySize(events);
+        for (i = 0 ; i < n ; i++) {
+            int eventID;
+
+            if (virJSONValueGetNumberInt(virJSONValueArrayGet(events, i),
+                                         &eventID) < 0 ||
+                eventID < 0 || eventID >= VIR_DOMAIN_EVENT_ID_LAST) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("Malformed events data in JSON document"));
+                goto error;
+            }
+
+            if ((priv->domainEventCallbackID[eventID] =
+                 virConnectDomainEventRegisterAny(priv->conn, NULL, eventID,
+                                                  domainEventCallbacks[eventID],
+                                                  client, NULL)) < 0) {
+                priv->domainEventCallbackID[eventID] = -1;
+                goto drop;
+            }
+        }
+    }
+
+    if ((events = virJSONValueObjectGet(object, "domainEvents"))) {
+        n = virJSONValueArraySize(events);
+        for (i = 0 ; i < n ; i++) {
+            virJSONValuePtr child = virJSONValueArrayGet(events, i);
+            daemonClientDomainEvent ev = { .callbackID = -1 };
+            unsigned char uuid[VIR_UUID_BUFLEN];
+            const char *uuidstr;
+
+            if (!child ||
+                virJSONValueObjectGetNumberInt(child, "eventID",
+                                               &ev.eventID) < 0 ||
+                ev.eventID < 0 || ev.eventID >= VIR_DOMAIN_EVENT_ID_LAST ||
+                !(uuidstr = virJSONValueObjectGetString(child, "uuid")) ||
+                virUUIDParse(uuidstr, uuid) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("Malformed domainEvents data in JSON document"));
+                goto error;
+            }
+
+            /* The domain may have gone away in the meantime */
+            if (!(ev.dom = virDomainLookupByUUID(priv->conn, uuid))) {
+                VIR_DEBUG("Dropping event %d for missing domain %s",
+                          ev.eventID, uuidstr);
+                continue;
+            }
+
+            if (priv->domainEventCallbackID[ev.eventID] == -1 &&
+                (ev.callbackID =
+                 virConnectDomainEventRegisterAny(priv->conn, ev.dom,
+                                                  ev.eventID,
+                                                  domainEventCallbacks[ev.eventID],
+                                                  client, NULL)) < 0) {
+                virDomainFree(ev.dom);
+                goto drop;
+            }
+
+            if (VIR_APPEND_ELEMENT(priv->domainEvents,
+                                   priv->ndomainEvents, ev) < 0) {
+                virReportOOMError();
+                if (ev.callbackID != -1)
+                    virConnectDomainEventDeregisterAny(priv->conn,
+                                                       ev.callbackID);
+                virDomainFree(ev.dom);
+                goto error;
+            }
+        }
+    }
+
+    return priv;
+
+drop:
+    VIR_WARN("Unable to restore events of client %p, dropping its "
+             "connection to %s", client, uri);
+    remoteClientCloseConnection(priv);
+    return priv;
+
+error:
+    remoteClientFreeFunc(priv);
+    return NULL;
+}
+
+
+/*
+ * Save the state of the client connection, so that it can be
+ * restored by remoteClientNewPostExecRestart after libvirtd has
+ * re-executed itself.
+ */
+virJSONValuePtr remoteClientPreExecRestart(virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                                           void *opaque)
+{
+    struct daemonClientPrivate *priv = opaque;
+    virJSONValuePtr object = NULL;
+    virJSONValuePtr events;
+    char *uri = NULL;
+    int i;
+
+    virMutexLock(&priv->lock);
+
+    /* Data in flight on a stream can't be carried over */
+    if (priv->streams) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Unable to save client state with active streams"));
+        goto error;
+    }
+
+    if (!(object = virJSONValueNewObject()))
+        goto no_memory;
+
+    if (virJSONValueObjectAppendBoolean(object, "keepalive_supported",
+                                        priv->keepalive_supported) < 0 ||
+        virJSONValueObjectAppendBoolean(object, "streamCredit",
+                                        priv->streamCredit) < 0)
+        goto no_memory;
+
+    if (!priv->conn)
+        goto done;
+
+    if (!(uri = virConnectGetURI(priv->conn)))
+        goto error;
+
+    if (virJSONValueObjectAppendString(object, "uri", uri) < 0 ||
+        virJSONValueObjectAppendNumberUint(object, "connFlags",
+                                           priv->connFlags) < 0)
+        goto no_memory;
+
+    if (!(events = virJSONValueNewArray()) ||
+        virJSONValueObjectAppend(object, "events", events) < 0) {
+        virJSONValueFree(events);
+        goto no_memory;
+    }
+    for (i = 0 ; i < VIR_DOMAIN_EVENT_ID_LAST ; i++) {
+        virJSONValuePtr child;
+
+        if (priv->domainEventCallbackID[i] == -1)
+            continue;
+
+        if (!(child = virJSONValueNewNumberInt(i)) ||
+            virJSONValueArrayAppend(events, child) < 0) {
+            virJSONValueFree(child);
+            goto no_memory;
+        }
+    }
+
+    if (!(events = virJSONValueNewArray()) ||
+        virJSONValueObjectAppend(object, "domainEvents", events) < 0) {
+        virJSONValueFree(events);
+        goto no_memory;
+    }
+    for (i = 0 ; i < priv->ndomainEvents ; i++) {
+        virJSONValuePtr child;
+        char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+        virUUIDFormat(priv->domainEvents[i].dom->uuid, uuidstr);
+        if (!(child = virJSONValueNewObject()) ||
+            virJSONValueObjectAppendNumberInt(child, "eventID",
+                                              priv->domainEvents[i].eventID) < 0 ||
+            virJSONValueObjectAppendString(child, "uuid", uuidstr) < 0 ||
+            virJSONValueArrayAppend(events, child) < 0) {
+            virJSONValueFree(child);
+            goto no_memory;
+        }
+    }
+
+done:
+    VIR_FREE(uri);
+    virMutexUnlock(&priv->lock);
+    return object;
+
+no_memory:
+    virReportOOMError();
+error:
+    VIR_FREE(uri);
+    virJSONValueFree(object);
+    virMutexUnlock(&priv->lock);
+    return NULL;
+}
+
 /*----- Functions. -----*/
 
 static int
@@ -759,6 +1009,7 @@ remoteDispatchOpen(virNetServerPtr server,
 
     if (priv->conn == NULL)
         goto cleanup;
+    priv->connFlags = flags;
 
     rv = 0;
 
@@ -1091,11 +1342,283 @@ remoteDispatchConnectListAllDomains(virNetServerPtr server ATTRIBUTE_UNUSED,
 cleanup:
     if (rv < 0)
         virNetMessageSaveError(rerr);
-    if (doms) {
-        for (i = 0; i < ndomains; i++)
-            virDomainFree(doms[i]);
-        VIR_FREE(doms);
-    }
+    if (doms) {
+        for (i = 0; i < ndomains; i++)
+            virDomainFree(doms[i]);
+        VIR_FREE(doms);
+    }
+    return rv;
+}
+
+static int
+remoteDispatchConnectListAllDomainsFiltered(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                            virNetServerClientPtr client,
+                                            virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                            virNetMessageErrorPtr rerr,
+                                            remote_connect_list_all_domains_filtered_args *args,
+                                            remote_connect_list_all_domains_filtered_ret *ret)
+{
+    virDomainPtr *doms = NULL;
+    virTypedParameterPtr filters = NULL;
+    int nfilters = 0;
+    int ndomains = 0;
+    int i;
+    int rv = -1;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if ((filters = remoteDeserializeTypedParameters(args->filters.filters_val,
+                                                    args->filters.filters_len,
+                                                    REMOTE_CONNECT_LIST_ALL_DOMAINS_FILTERS_MAX,
+                                                    &nfilters)) == NULL &&
+        args->filters.filters_len)
+        goto cleanup;
+
+    if ((ndomains = virConnectListAllDomainsFiltered(priv->conn,
+                                                     args->need_results ? &doms : NULL,
+                                                     filters, nfilters,
+                                                     args->flags)) < 0)
+        goto cleanup;
+
+    if (doms && ndomains) {
+        if (VIR_ALLOC_N(ret->domains.domains_val, ndomains) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        ret->domains.domains_len = ndomains;
+
+        for (i = 0; i < ndomains; i++)
+            make_nonnull_domain(ret->domains.domains_val + i, doms[i]);
+    } else {
+        ret->domains.domains_len = 0;
+        ret->domains.domains_val = NULL;
+    }
+
+    ret->ret = ndomains;
+
+    rv = 0;
+
+cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virTypedParameterArrayClear(filters, nfilters);
+    VIR_FREE(filters);
+    if (doms) {
+        for (i = 0; i < ndomains; i++)
+            virDomainFree(doms[i]);
+        VIR_FREE(doms);
+    }
+    return rv;
+}
+
+static int
+remoteDispatchConnectGetAllDomainStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                       virNetServerClientPtr client,
+                                       virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                       virNetMessageErrorPtr rerr,
+                                       remote_connect_get_all_domain_stats_args *args,
+                                       remote_connect_get_all_domain_stats_ret *ret)
+{
+    int rv = -1;
+    int i;
+    virDomainStatsRecordPtr *retStats = NULL;
+    int nrecords = 0;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if ((nrecords = virConnectGetAllDomainStats(priv->conn,
+                                                args->stats,
+                                                &retStats,
+                                                args->flags)) < 0)
+        goto cleanup;
+
+    if (nrecords > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of domain stats records is %d, "
+                         "which exceeds max limit: %d"),
+                       nrecords, REMOTE_DOMAIN_LIST_MAX);
+        goto cleanup;
+    }
+
+    if (nrecords) {
+        if (VIR_ALLOC_N(ret->retStats.retStats_val, nrecords) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        ret->retStats.retStats_len = nrecords;
+
+        for (i = 0; i < nrecords; i++) {
+            remote_domain_stats_record *dst = ret->retStats.retStats_val + i;
+
+            make_nonnull_domain(&dst->dom, retStats[i]->dom);
+
+            if (remoteSerializeTypedParameters(retStats[i]->params,
+                                               retStats[i]->nparams,
+                                               &dst->params.params_val,
+                                               &dst->params.params_len,
+                                               VIR_TYPED_PARAM_STRING_OKAY) < 0)
+                goto cleanup;
+        }
+    } else {
+        ret->retStats.retStats_len = 0;
+        ret->retStats.retStats_val = NULL;
+    }
+
+    rv = 0;
+
+cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virDomainStatsRecordListFree(retStats);
+    return rv;
+}
+
+static int
+remoteDispatchConnectGetListGeneration(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                       virNetServerClientPtr client,
+                                       virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                       virNetMessageErrorPtr rerr,
+                                       remote_connect_get_list_generation_args *args,
+                                       remote_connect_get_list_generation_ret *ret)
+{
+    int rv = -1;
+    unsigned long long generation;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (virConnectGetListGeneration(priv->conn, args->type,
+                                    &generation, args->flags) < 0)
+        goto cleanup;
+
+    ret->generation = generation;
+    rv = 0;
+
+cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    return rv;
+}
+
+static void
+remoteFreeDomainList(virDomainPtr *list)
+{
+    size_t i;
+
+    if (!list)
+        return;
+
+    for (i = 0; list[i]; i++)
+        virDomainFree(list[i]);
+    VIR_FREE(list);
+}
+
+/* Returns the domains of @doms as a NULL terminated list */
+static virDomainPtr *
+remoteGetDomainList(virConnectPtr conn,
+                    remote_nonnull_domain *doms,
+                    u_int ndoms)
+{
+    virDomainPtr *list = NULL;
+    u_int i;
+
+    if (VIR_ALLOC_N(list, ndoms + 1) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    for (i = 0; i < ndoms; i++) {
+        if (!(list[i] = get_nonnull_domain(conn, doms[i]))) {
+            remoteFreeDomainList(list);
+            return NULL;
+        }
+    }
+
+    return list;
+}
+
+static int
+remoteDispatchDomainListFSFreeze(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                 virNetServerClientPtr client,
+                                 virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                 virNetMessageErrorPtr rerr,
+                                 remote_domain_list_fs_freeze_args *args,
+                                 remote_domain_list_fs_freeze_ret *ret)
+{
+    int rv = -1;
+    int frozen;
+    virDomainPtr *doms = NULL;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (!(doms = remoteGetDomainList(priv->conn, args->doms.doms_val,
+                                     args->doms.doms_len)))
+        goto cleanup;
+
+    if ((frozen = virDomainListFSFreeze(doms, args->timeout,
+                                        args->flags)) < 0)
+        goto cleanup;
+
+    ret->ret = frozen;
+    rv = 0;
+
+cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    remoteFreeDomainList(doms);
+    return rv;
+}
+
+static int
+remoteDispatchDomainListFSThaw(virNetServerPtr server ATTRIBUTE_UNUSED,
+                               virNetServerClientPtr client,
+                               virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                               virNetMessageErrorPtr rerr,
+                               remote_domain_list_fs_thaw_args *args,
+                               remote_domain_list_fs_thaw_ret *ret)
+{
+    int rv = -1;
+    int thawed;
+    virDomainPtr *doms = NULL;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (!(doms = remoteGetDomainList(priv->conn, args->doms.doms_val,
+                                     args->doms.doms_len)))
+        goto cleanup;
+
+    if ((thawed = virDomainListFSThaw(doms, args->timeout,
+                                      args->flags)) < 0)
+        goto cleanup;
+
+    ret->ret = thawed;
+    rv = 0;
+
+cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    remoteFreeDomainList(doms);
     return rv;
 }
 
@@ -3131,6 +3654,85 @@ cleanup:
 /***************************
  * Register / deregister events
  ***************************/
+
+/*
+ * priv->lock must be held
+ *
+ * Find the registration of @eventID restricted to domain @uuid
+ */
+static int
+remoteFindDomainEvent(struct daemonClientPrivate *priv,
+                      int eventID,
+                      const unsigned char *uuid)
+{
+    int i;
+
+    for (i = 0 ; i < priv->ndomainEvents ; i++) {
+        if (priv->domainEvents[i].eventID == eventID &&
+            memcmp(priv->domainEvents[i].dom->uuid, uuid,
+                   VIR_UUID_BUFLEN) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/*
+ * priv->lock must be held
+ *
+ * A registration of @eventID for all domains now exists, drop the
+ * ones restricted to a single domain so events are not sent twice
+ */
+static void
+remoteSuspendDomainEvents(struct daemonClientPrivate *priv,
+                          int eventID)
+{
+    int i;
+
+    for (i = 0 ; i < priv->ndomainEvents ; i++) {
+        daemonClientDomainEventPtr ev = &priv->domainEvents[i];
+
+        if (ev->eventID != eventID || ev->callbackID == -1)
+            continue;
+
+        if (virConnectDomainEventDeregisterAny(priv->conn,
+                                               ev->callbackID) < 0)
+            VIR_WARN("Failed to deregister event %d for domain %s",
+                     eventID, ev->dom->name);
+        ev->callbackID = -1;
+    }
+}
+
+/*
+ * priv->lock must be held
+ *
+ * The registration of @eventID for all domains is about to go away,
+ * restore the ones restricted to a single domain
+ */
+static void
+remoteResumeDomainEvents(virNetServerClientPtr client,
+                         struct daemonClientPrivate *priv,
+                         int eventID)
+{
+    int i;
+
+    for (i = 0 ; i < priv->ndomainEvents ; i++) {
+        daemonClientDomainEventPtr ev = &priv->domainEvents[i];
+
+        if (ev->eventID != eventID || ev->callbackID != -1)
+            continue;
+
+        if ((ev->callbackID =
+             virConnectDomainEventRegisterAny(priv->conn, ev->dom, eventID,
+                                              domainEventCallbacks[eventID],
+                                              client, NULL)) < 0) {
+            VIR_WARN("Failed to register event %d for domain %s",
+                     eventID, ev->dom->name);
+            ev->callbackID = -1;
+        }
+    }
+}
+
 static int
 remoteDispatchDomainEventsRegister(virNetServerPtr server ATTRIBUTE_UNUSED,
                                    virNetServerClientPtr client ATTRIBUTE_UNUSED,
@@ -3163,6 +3765,7 @@ remoteDispatchDomainEventsRegister(virNetServerPtr server ATTRIBUTE_UNUSED,
         goto cleanup;
 
     priv->domainEventCallbackID[VIR_DOMAIN_EVENT_ID_LIFECYCLE] = callbackID;
+    remoteSuspendDomainEvents(priv, VIR_DOMAIN_EVENT_ID_LIFECYCLE);
 
     rv = 0;
 
@@ -3196,9 +3799,13 @@ remoteDispatchDomainEventsDeregister(virNetServerPtr server ATTRIBUTE_UNUSED,
         goto cleanup;
     }
 
+    remoteResumeDomainEvents(client, priv, VIR_DOMAIN_EVENT_ID_LIFECYCLE);
+
     if (virConnectDomainEventDeregisterAny(priv->conn,
-                                           priv->domainEventCallbackID[VIR_DOMAIN_EVENT_ID_LIFECYCLE]) < 0)
+                                           priv->domainEventCallbackID[VIR_DOMAIN_EVENT_ID_LIFECYCLE]) < 0) {
+        remoteSuspendDomainEvents(priv, VIR_DOMAIN_EVENT_ID_LIFECYCLE);
         goto cleanup;
+    }
 
     priv->domainEventCallbackID[VIR_DOMAIN_EVENT_ID_LIFECYCLE] = -1;
 
@@ -3358,6 +3965,7 @@ remoteDispatchDomainEventsRegisterAny(virNetServerPtr server ATTRIBUTE_UNUSED,
         goto cleanup;
 
     priv->domainEventCallbackID[args->eventID] = callbackID;
+    remoteSuspendDomainEvents(priv, args->eventID);
 
     rv = 0;
 
@@ -3400,8 +4008,12 @@ remoteDispatchDomainEventsDeregisterAny(virNetServerPtr server ATTRIBUTE_UNUSED,
         goto cleanup;
     }
 
-    if (virConnectDomainEventDeregisterAny(priv->conn, callbackID) < 0)
+    remoteResumeDomainEvents(client, priv, args->eventID);
+
+    if (virConnectDomainEventDeregisterAny(priv->conn, callbackID) < 0) {
+        remoteSuspendDomainEvents(priv, args->eventID);
         goto cleanup;
+    }
 
     priv->domainEventCallbackID[args->eventID] = -1;
 
@@ -3414,6 +4026,117 @@ cleanup:
     return rv;
 }
 
+
+static int
+remoteDispatchDomainEventsRegisterDomain(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                         virNetServerClientPtr client,
+                                         virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                         virNetMessageErrorPtr rerr,
+                                         remote_domain_events_register_domain_args *args)
+{
+    daemonClientDomainEvent ev = { .callbackID = -1 };
+    int rv = -1;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    virMutexLock(&priv->lock);
+
+    if (args->eventID >= VIR_DOMAIN_EVENT_ID_LAST ||
+        args->eventID < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, _("unsupported event ID %d"), args->eventID);
+        goto cleanup;
+    }
+
+    if (!(ev.dom = get_nonnull_domain(priv->conn, args->dom)))
+        goto cleanup;
+
+    if (remoteFindDomainEvent(priv, args->eventID, ev.dom->uuid) >= 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("domain event %d already registered for domain %s"),
+                       args->eventID, ev.dom->name);
+        goto cleanup;
+    }
+
+    /* Filtering happens in the driver, so events of other domains never
+     * reach remoteRelayDomainEvent* for this registration */
+    ev.eventID = args->eventID;
+    if (priv->domainEventCallbackID[args->eventID] == -1 &&
+        (ev.callbackID = virConnectDomainEventRegisterAny(priv->conn,
+                                                          ev.dom,
+                                                          args->eventID,
+                                                          domainEventCallbacks[args->eventID],
+                                                          client, NULL)) < 0)
+        goto cleanup;
+
+    if (VIR_APPEND_ELEMENT(priv->domainEvents, priv->ndomainEvents, ev) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    rv = 0;
+
+cleanup:
+    if (rv < 0) {
+        virNetMessageSaveError(rerr);
+        if (ev.callbackID >= 0)
+            virConnectDomainEventDeregisterAny(priv->conn, ev.callbackID);
+        if (ev.dom)
+            virDomainFree(ev.dom);
+    }
+    virMutexUnlock(&priv->lock);
+    return rv;
+}
+
+
+static int
+remoteDispatchDomainEventsDeregisterDomain(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                           virNetServerClientPtr client,
+                                           virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                           virNetMessageErrorPtr rerr,
+                                           remote_domain_events_deregister_domain_args *args)
+{
+    daemonClientDomainEventPtr ev;
+    int idx;
+    int rv = -1;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    virMutexLock(&priv->lock);
+
+    if ((idx = remoteFindDomainEvent(priv, args->eventID,
+                                     (unsigned char *) args->uuid)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("domain event %d not registered"), args->eventID);
+        goto cleanup;
+    }
+    ev = &priv->domainEvents[idx];
+
+    if (ev->callbackID != -1 &&
+        virConnectDomainEventDeregisterAny(priv->conn, ev->callbackID) < 0)
+        goto cleanup;
+
+    virDomainFree(ev->dom);
+    VIR_DELETE_ELEMENT(priv->domainEvents, idx, priv->ndomainEvents);
+
+    rv = 0;
+
+cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virMutexUnlock(&priv->lock);
+    return rv;
+}
+
 static int
 qemuDispatchMonitorCommand(virNetServerPtr server ATTRIBUTE_UNUSED,
                            virNetServerClientPtr client ATTRIBUTE_UNUSED,
@@ -3737,6 +4460,20 @@ static int remoteDispatchSupportsFeature(
 
     switch (args->feature) {
     case VIR_DRV_FEATURE_FD_PASSING:
+    case VIR_DRV_FEATURE_REMOTE_EVENT_FILTER:
+        supported = 1;
+        break;
+
+    case VIR_DRV_FEATURE_PROGRAM_COMPRESSION:
+        /* Asking means the client can decompress our replies */
+        supported = virNetServerClientEnableCompression(client) ? 1 : 0;
+        break;
+
+    case VIR_DRV_FEATURE_STREAM_CREDIT:
+        /* Asking means the client will grant credit on new streams */
+        virMutexLock(&priv->lock);
+        priv->streamCredit = true;
+        virMutexUnlock(&priv->lock);
         supported = 1;
         break;
 
@@ -3757,6 +4494,84 @@ cleanup:
 }
 
 
+static int
+remoteDispatchConnectOpenShmRing(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                 virNetServerClientPtr client,
+                                 virNetMessagePtr msg,
+                                 virNetMessageErrorPtr rerr,
+                                 remote_connect_open_shm_ring_args *args)
+{
+    int rv = -1;
+    int fds[VIR_NET_SHM_RING_FD_LAST];
+    size_t nfds = 0;
+    uid_t callerUid;
+    gid_t callerGid;
+    pid_t callerPid;
+    virNetShmRingPtr ring = NULL;
+    unsigned int flags = args->flags;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    virCheckFlagsGoto(0, cleanup);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    /* The client keeps the memory file open, and could truncate it
+     * to have us killed by SIGBUS, so only clients running as the
+     * same user as the daemon get a ring */
+    if (virNetServerClientGetUNIXIdentity(client, &callerUid, &callerGid,
+                                          &callerPid) < 0)
+        goto cleanup;
+
+    if (callerUid != geteuid()) {
+        virReportError(VIR_ERR_OPERATION_DENIED, "%s",
+                       _("shared memory rings are only available to clients "
+                         "running as the daemon's user"));
+        goto cleanup;
+    }
+
+    /* The ring bypasses any SASL SSF layer on the socket */
+    if (virNetServerClientGetAuth(client) == REMOTE_AUTH_SASL) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("shared memory rings cannot be used with SASL"));
+        goto cleanup;
+    }
+
+    if (msg->nfds != VIR_NET_SHM_RING_FD_LAST) {
+        virReportError(VIR_ERR_RPC,
+                       _("expected %d file descriptors for shared memory ring, got %zu"),
+                       VIR_NET_SHM_RING_FD_LAST, msg->nfds);
+        goto cleanup;
+    }
+
+    for (nfds = 0 ; nfds < VIR_NET_SHM_RING_FD_LAST ; nfds++) {
+        if ((fds[nfds] = virNetMessageDupFD(msg, nfds)) < 0)
+            goto cleanup;
+    }
+
+    ring = virNetShmRingNewServer(fds, nfds, args->size);
+    nfds = 0;
+    if (!ring)
+        goto cleanup;
+
+    if (virNetServerClientSetShmRing(client, ring, msg->header.serial) < 0)
+        goto cleanup;
+
+    rv = 0;
+
+cleanup:
+    while (nfds > 0)
+        VIR_FORCE_CLOSE(fds[--nfds]);
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virObjectUnref(ring);
+    return rv;
+}
+
+
 static int
 remoteDispatchDomainOpenGraphics(virNetServerPtr server ATTRIBUTE_UNUSED,
                                  virNetServerClientPtr client ATTRIBUTE_UNUSED,
@@ -4240,6 +5055,46 @@ cleanup:
     return rv;
 }
 
+static int
+remoteDispatchStorageVolGetJobInfo(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                   virNetServerClientPtr client,
+                                   virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                   virNetMessageErrorPtr rerr,
+                                   remote_storage_vol_get_job_info_args *args,
+                                   remote_storage_vol_get_job_info_ret *ret)
+{
+    virStorageVolPtr vol = NULL;
+    virStorageVolJobInfo tmp;
+    int rv = -1;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (!(vol = get_nonnull_storage_vol(priv->conn, args->vol)))
+        goto cleanup;
+
+    rv = virStorageVolGetJobInfo(vol, &tmp, args->flags);
+    if (rv <= 0)
+        goto cleanup;
+
+    ret->type = tmp.type;
+    ret->processed = tmp.processed;
+    ret->total = tmp.total;
+    ret->found = 1;
+    rv = 0;
+
+cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    if (vol)
+        virStorageVolFree(vol);
+    return rv;
+}
+
 static int
 remoteDispatchConnectListAllNetworks(virNetServerPtr server ATTRIBUTE_UNUSED,
                                      virNetServerClientPtr client,
@@ -4294,6 +5149,112 @@ cleanup:
     return rv;
 }
 
+static int
+remoteDispatchNetworkGetDHCPLeases(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                   virNetServerClientPtr client,
+                                   virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                   virNetMessageErrorPtr rerr,
+                                   remote_network_get_dhcp_leases_args *args,
+                                   remote_network_get_dhcp_leases_ret *ret)
+{
+    int rv = -1;
+    int i;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+    virNetworkDHCPLeasePtr *leases = NULL;
+    virNetworkPtr net = NULL;
+    int nleases = 0;
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (!(net = get_nonnull_network(priv->conn, args->net)))
+        goto cleanup;
+
+    if ((nleases = virNetworkGetDHCPLeases(net,
+                                           args->mac ? *args->mac : NULL,
+                                           args->need_results ? &leases : NULL,
+                                           args->flags)) < 0)
+        goto cleanup;
+
+    if (nleases > REMOTE_NETWORK_DHCP_LEASES_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of leases is %d, which exceeds max limit: %d"),
+                       nleases, REMOTE_NETWORK_DHCP_LEASES_MAX);
+        goto cleanup;
+    }
+
+    if (leases && nleases) {
+        if (VIR_ALLOC_N(ret->leases.leases_val, nleases) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        ret->leases.leases_len = nleases;
+
+        /* The strings are moved into the reply, which the RPC layer
+         * frees once it has been serialized */
+        for (i = 0; i < nleases; i++) {
+            virNetworkDHCPLeasePtr lease = leases[i];
+            remote_network_dhcp_lease *dst = ret->leases.leases_val + i;
+
+            dst->expirytime = lease->expirytime;
+            dst->type = lease->type;
+            dst->prefix = lease->prefix;
+
+            dst->iface = lease->iface;
+            lease->iface = NULL;
+            dst->ipaddr = lease->ipaddr;
+            lease->ipaddr = NULL;
+
+            if ((lease->mac && VIR_ALLOC(dst->mac) < 0) ||
+                (lease->iaid && VIR_ALLOC(dst->iaid) < 0) ||
+                (lease->hostname && VIR_ALLOC(dst->hostname) < 0) ||
+                (lease->clientid && VIR_ALLOC(dst->clientid) < 0)) {
+                virReportOOMError();
+                goto cleanup;
+            }
+
+            if (dst->mac) {
+                *dst->mac = lease->mac;
+                lease->mac = NULL;
+            }
+            if (dst->iaid) {
+                *dst->iaid = lease->iaid;
+                lease->iaid = NULL;
+            }
+            if (dst->hostname) {
+                *dst->hostname = lease->hostname;
+                lease->hostname = NULL;
+            }
+            if (dst->clientid) {
+                *dst->clientid = lease->clientid;
+                lease->clientid = NULL;
+            }
+        }
+    } else {
+        ret->leases.leases_len = 0;
+        ret->leases.leases_val = NULL;
+    }
+
+    ret->ret = nleases;
+
+    rv = 0;
+
+cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    if (leases) {
+        for (i = 0; i < nleases; i++)
+            virNetworkDHCPLeaseFree(leases[i]);
+        VIR_FREE(leases);
+    }
+    if (net)
+        virNetworkFree(net);
+    return rv;
+}
+
 static int
 remoteDispatchConnectListAllInterfaces(virNetServerPtr server ATTRIBUTE_UNUSED,
                                        virNetServerClientPtr client,
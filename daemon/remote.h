@@ -36,6 +36,11 @@ extern virNetServerProgramProc qemuProcs[];
 extern size_t qemuNProcs;
 
 void remoteClientFreeFunc(void *data);
+void *remoteClientNewPostExecRestart(virNetServerClientPtr client,
+                                     virJSONValuePtr object,
+                                     void *opaque);
+virJSONValuePtr remoteClientPreExecRestart(virNetServerClientPtr client,
+                                           void *opaque);
 void *remoteClientInitHook(virNetServerClientPtr client,
                            void *opaque);
 
@@ -29,12 +29,19 @@
 #include "logging.h"
 #include "virnetserverclient.h"
 #include "virterror_internal.h"
+#include "viratomic.h"
 
 #define VIR_FROM_THIS VIR_FROM_STREAMS
 
 struct daemonClientStream {
     daemonClientPrivatePtr priv;
-    int refs;
+    int refs; /* atomic */
+
+    /* Stream callbacks may run in an I/O thread while the messages
+     * they queue are finished by the main loop, which can't take
+     * priv->lock. This lock protects the fields both sides use,
+     * tx, recvEOF and events, and nests inside priv->lock */
+    virMutex lock;
 
     virNetServerProgramPtr prog;
 
@@ -42,13 +49,21 @@ struct daemonClientStream {
     int procedure;
     int serial;
 
-    unsigned int recvEOF : 1;
+    bool recvEOF;
     unsigned int closed : 1;
+    unsigned int transmit : 1;
+    /* Only send as much data as the client has granted credit for */
+    unsigned int credit : 1;
 
     int filterID;
 
     virNetMessagePtr rx;
     int tx;
+    int events; /* last events requested from the stream */
+
+    /* Data bytes sent to the client so far, and the most it accepts */
+    unsigned long long txBytes;
+    unsigned long long txLimit;
 
     daemonClientStreamPtr next;
 };
@@ -70,16 +85,23 @@ daemonStreamHandleAbort(virNetServerClientPtr client,
 
 
 
+/*
+ * Must be called with priv->lock held
+ */
 static void
 daemonStreamUpdateEvents(daemonClientStream *stream)
 {
     int newEvents = 0;
+
+    virMutexLock(&stream->lock);
     if (stream->rx)
         newEvents |= VIR_STREAM_EVENT_WRITABLE;
     if (stream->tx && !stream->recvEOF)
         newEvents |= VIR_STREAM_EVENT_READABLE;
 
+    stream->events = newEvents;
     virStreamEventUpdateCallback(stream->st, newEvents);
+    virMutexUnlock(&stream->lock);
 }
 
 /*
@@ -87,7 +109,9 @@ daemonStreamUpdateEvents(daemonClientStream *stream)
  * This simply re-enables TX of further data.
  *
  * The idea is to stop the daemon growing without bound due to
- * fast stream, but slow client
+ * fast stream, but slow client. Clients granting credit bound
+ * the data in flight themselves, so several packets may be queued
+ * for them and TX is only limited by the credit.
  */
 static void
 daemonStreamMessageFinished(virNetMessagePtr msg ATTRIBUTE_UNUSED,
@@ -97,8 +121,17 @@ daemonStreamMessageFinished(virNetMessagePtr msg ATTRIBUTE_UNUSED,
     VIR_DEBUG("stream=%p proc=%d serial=%d",
               stream, msg->header.proc, msg->header.serial);
 
-    stream->tx = 1;
-    daemonStreamUpdateEvents(stream);
+    /* rx only changes under priv->lock, so the cached
+     * events are still right about it */
+    virMutexLock(&stream->lock);
+    if (!stream->credit)
+        stream->tx = 1;
+    if (stream->tx && !stream->recvEOF &&
+        !(stream->events & VIR_STREAM_EVENT_READABLE)) {
+        stream->events |= VIR_STREAM_EVENT_READABLE;
+        virStreamEventUpdateCallback(stream->st, stream->events);
+    }
+    virMutexUnlock(&stream->lock);
 
     daemonFreeClientStream(NULL, stream);
 }
@@ -187,8 +220,10 @@ daemonStreamEvent(virStreamPtr st, int events, void *opaque)
         (events & VIR_STREAM_EVENT_HANGUP)) {
         virNetMessagePtr msg;
         events &= ~(VIR_STREAM_EVENT_HANGUP);
+        virMutexLock(&stream->lock);
         stream->tx = 0;
-        stream->recvEOF = 1;
+        stream->recvEOF = true;
+        virMutexUnlock(&stream->lock);
         if (!(msg = virNetMessageNew(false))) {
             daemonRemoveClientStream(client, stream);
             virNetServerClientClose(client);
@@ -196,7 +231,7 @@ daemonStreamEvent(virStreamPtr st, int events, void *opaque)
         }
         msg->cb = daemonStreamMessageFinished;
         msg->opaque = stream;
-        stream->refs++;
+        virAtomicIntInc(&stream->refs);
         if (virNetServerProgramSendStreamData(remoteProgram,
                                               client,
                                               msg,
@@ -255,6 +290,50 @@ cleanup:
 }
 
 
+/*
+ * Process a credit packet from the client, allowing more data
+ * to be sent to it.
+ *
+ * Returns VIR_NET_SERVER_CLIENT_FILTER_DONE, or -1 if the packet
+ * is invalid
+ */
+static int
+daemonStreamHandleCredit(daemonClientStream *stream,
+                         virNetMessagePtr msg)
+{
+    virNetStreamCredit data;
+
+    memset(&data, 0, sizeof(data));
+
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetStreamCredit,
+                                   &data) < 0)
+        return -1;
+
+    if (!stream->credit) {
+        VIR_WARN("unexpected credit for stream proc=%d serial=%d",
+                 stream->procedure, stream->serial);
+        return -1;
+    }
+
+    VIR_DEBUG("stream=%p sent=%llu limit=%llu new limit=%llu",
+              stream, stream->txBytes, stream->txLimit,
+              (unsigned long long)data.limit);
+
+    /* Credit packets may overtake each other, never take any back */
+    if (data.limit > stream->txLimit)
+        stream->txLimit = data.limit;
+
+    if (stream->transmit && stream->txBytes < stream->txLimit) {
+        virMutexLock(&stream->lock);
+        stream->tx = 1;
+        virMutexUnlock(&stream->lock);
+    }
+    daemonStreamUpdateEvents(stream);
+
+    return VIR_NET_SERVER_CLIENT_FILTER_DONE;
+}
+
+
 /*
  * @client: a locked client object
  *
@@ -273,7 +352,9 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 
     virMutexLock(&stream->priv->lock);
 
-    if (msg->header.type != VIR_NET_STREAM)
+    if (msg->header.type != VIR_NET_STREAM &&
+        msg->header.type != VIR_NET_STREAM_HOLE &&
+        msg->header.type != VIR_NET_STREAM_CREDIT)
         goto cleanup;
 
     if (!virNetServerProgramMatches(stream->prog, msg))
@@ -283,6 +364,12 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
         msg->header.serial != stream->serial)
         goto cleanup;
 
+    /* Credit must not wait behind data queued for the stream */
+    if (msg->header.type == VIR_NET_STREAM_CREDIT) {
+        ret = daemonStreamHandleCredit(stream, msg);
+        goto cleanup;
+    }
+
     VIR_DEBUG("Incoming client=%p, rx=%p, serial=%d, proc=%d, status=%d",
               client, stream->rx, msg->header.proc,
               msg->header.serial, msg->header.status);
@@ -322,6 +409,13 @@ daemonCreateClientStream(virNetServerClientPtr client,
         return NULL;
     }
 
+    if (virMutexInit(&stream->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        VIR_FREE(stream);
+        return NULL;
+    }
+
     stream->refs = 1;
     stream->priv = priv;
     stream->prog = virObjectRef(prog);
@@ -348,8 +442,7 @@ int daemonFreeClientStream(virNetServerClientPtr client,
     if (!stream)
         return 0;
 
-    stream->refs--;
-    if (stream->refs)
+    if (!virAtomicIntDecAndTest(&stream->refs))
         return 0;
 
     VIR_DEBUG("client=%p, proc=%d, serial=%d",
@@ -376,6 +469,7 @@ int daemonFreeClientStream(virNetServerClientPtr client,
     }
 
     virStreamFree(stream->st);
+    virMutexDestroy(&stream->lock);
     VIR_FREE(stream);
 
     return ret;
@@ -413,10 +507,19 @@ int daemonAddClientStream(virNetServerClientPtr client,
         return -1;
     }
 
-    if (transmit)
+    virMutexLock(&priv->lock);
+
+    if (transmit) {
+        stream->transmit = 1;
+        virMutexLock(&stream->lock);
         stream->tx = 1;
+        virMutexUnlock(&stream->lock);
+    }
 
-    virMutexLock(&priv->lock);
+    if (priv->streamCredit) {
+        stream->credit = 1;
+        stream->txLimit = VIR_NET_STREAM_CREDIT_WINDOW;
+    }
     stream->next = priv->streams;
     priv->streams = stream;
 
@@ -542,6 +645,49 @@ daemonStreamHandleWriteData(virNetServerClientPtr client,
 }
 
 
+/*
+ * Process a hole packet from the client, skipping over
+ * the equivalent run of zeros in the stream.
+ *
+ * Returns 0 if the hole was processed or an error RPC
+ * was sent, -1 upon fatal error
+ */
+static int
+daemonStreamHandleHole(virNetServerClientPtr client,
+                       daemonClientStream *stream,
+                       virNetMessagePtr msg)
+{
+    virNetStreamHole data;
+    int ret;
+
+    VIR_DEBUG("client=%p, stream=%p, proc=%d, serial=%d",
+              client, stream, msg->header.proc, msg->header.serial);
+
+    memset(&data, 0, sizeof(data));
+
+    ret = virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                     &data);
+    if (ret == 0)
+        ret = virStreamSendHole(stream->st, data.length, data.flags);
+
+    if (ret < 0) {
+        virNetMessageError rerr;
+
+        memset(&rerr, 0, sizeof(rerr));
+
+        VIR_INFO("Stream hole failed");
+        stream->closed = 1;
+        return virNetServerProgramSendReplyError(stream->prog,
+                                                 client,
+                                                 msg,
+                                                 &rerr,
+                                                 &msg->header);
+    }
+
+    return 0;
+}
+
+
 /*
  * Process a finish handshake from the client.
  *
@@ -646,7 +792,10 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
             break;
 
         case VIR_NET_CONTINUE:
-            ret = daemonStreamHandleWriteData(client, stream, msg);
+            if (msg->header.type == VIR_NET_STREAM_HOLE)
+                ret = daemonStreamHandleHole(client, stream, msg);
+            else
+                ret = daemonStreamHandleWriteData(client, stream, msg);
             break;
 
         case VIR_NET_ERROR:
@@ -690,7 +839,8 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
 /*
  * Invoked when a stream is signalled as having data
  * available to read. This reads up to one message
- * worth of data, and then queues that for transmission
+ * worth of data, straight into the payload of the
+ * message that is then queued for transmission
  * to the client.
  *
  * Returns 0 if data was queued for TX, or a error RPC
@@ -701,12 +851,14 @@ static int
 daemonStreamHandleRead(virNetServerClientPtr client,
                        daemonClientStream *stream)
 {
+    virNetMessagePtr msg;
     char *buffer;
     size_t bufferLen = VIR_NET_MESSAGE_PAYLOAD_MAX;
+    int tx;
     int ret;
 
-    VIR_DEBUG("client=%p, stream=%p tx=%d closed=%d",
-              client, stream, stream->tx, stream->closed);
+    VIR_DEBUG("client=%p, stream=%p closed=%d",
+              client, stream, stream->closed);
 
     /* We might have had an event pending before we shut
      * down the stream, so if we're marked as closed,
@@ -717,53 +869,95 @@ daemonStreamHandleRead(virNetServerClientPtr client,
 
     /* Shouldn't ever be called unless we're marked able to
      * transmit, but doesn't hurt to check */
-    if (!stream->tx)
+    virMutexLock(&stream->lock);
+    tx = stream->tx;
+    virMutexUnlock(&stream->lock);
+    if (!tx)
         return 0;
 
-    if (VIR_ALLOC_N(buffer, bufferLen) < 0)
+    if (stream->credit) {
+        /* Keep several packets in flight within the credit */
+        if (bufferLen > VIR_NET_STREAM_CREDIT_WINDOW / 4)
+            bufferLen = VIR_NET_STREAM_CREDIT_WINDOW / 4;
+        if (bufferLen > stream->txLimit - stream->txBytes)
+            bufferLen = stream->txLimit - stream->txBytes;
+    }
+
+    if (!(msg = virNetMessageNew(false)))
         return -1;
 
-    ret = virStreamRecv(stream->st, buffer, bufferLen);
-    if (ret == -2) {
-        /* Should never get this, since we're only called when we know
-         * we're readable, but hey things change... */
-        ret = 0;
-    } else if (ret < 0) {
-        virNetMessagePtr msg;
-        virNetMessageError rerr;
+    if (virNetServerProgramPrepareStreamData(remoteProgram,
+                                             msg,
+                                             stream->procedure,
+                                             stream->serial,
+                                             bufferLen,
+                                             &buffer) < 0) {
+        virNetMessageFree(msg);
+        return -1;
+    }
 
-        memset(&rerr, 0, sizeof(rerr));
+    ret = virStreamRecvFlags(stream->st, buffer, bufferLen,
+                             VIR_STREAM_RECV_STOP_AT_HOLE);
+    if (ret == -3) {
+        /* Only sparse streams ever stop at a hole, and they are
+         * only set up when the client asked for one */
+        long long length;
+
+        if (virStreamRecvHole(stream->st, &length, 0) < 0) {
+            virNetMessageError rerr;
+
+            memset(&rerr, 0, sizeof(rerr));
 
-        if (!(msg = virNetMessageNew(false)))
-            ret = -1;
-        else
             ret = virNetServerProgramSendStreamError(remoteProgram,
                                                      client,
                                                      msg,
                                                      &rerr,
                                                      stream->procedure,
                                                      stream->serial);
-    } else {
-        virNetMessagePtr msg;
-        stream->tx = 0;
-        if (ret == 0)
-            stream->recvEOF = 1;
-        if (!(msg = virNetMessageNew(false)))
-            ret = -1;
-
-        if (msg) {
+        } else {
+            /* Holes carry no data, so they don't use up credit */
+            virMutexLock(&stream->lock);
+            stream->tx = stream->credit;
+            virMutexUnlock(&stream->lock);
             msg->cb = daemonStreamMessageFinished;
             msg->opaque = stream;
-            stream->refs++;
-            ret = virNetServerProgramSendStreamData(remoteProgram,
+            virAtomicIntInc(&stream->refs);
+            ret = virNetServerProgramSendStreamHole(remoteProgram,
                                                     client,
                                                     msg,
                                                     stream->procedure,
                                                     stream->serial,
-                                                    buffer, ret);
+                                                    length);
         }
+    } else if (ret == -2) {
+        /* Should never get this, since we're only called when we know
+         * we're readable, but hey things change... */
+        virNetMessageFree(msg);
+        ret = 0;
+    } else if (ret < 0) {
+        virNetMessageError rerr;
+
+        memset(&rerr, 0, sizeof(rerr));
+
+        ret = virNetServerProgramSendStreamError(remoteProgram,
+                                                 client,
+                                                 msg,
+                                                 &rerr,
+                                                 stream->procedure,
+                                                 stream->serial);
+    } else {
+        stream->txBytes += ret;
+        virMutexLock(&stream->lock);
+        stream->tx = stream->credit && stream->txBytes < stream->txLimit;
+        if (ret == 0)
+            stream->recvEOF = true;
+        virMutexUnlock(&stream->lock);
+
+        msg->cb = daemonStreamMessageFinished;
+        msg->opaque = stream;
+        virAtomicIntInc(&stream->refs);
+        ret = virNetServerProgramSendPreparedStreamData(client, msg, ret);
     }
 
-    VIR_FREE(buffer);
     return ret;
 }
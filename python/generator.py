@@ -418,6 +418,7 @@ skip_impl = (
     'virNodeGetMemoryStats',
     'virDomainGetBlockJobInfo',
     'virDomainMigrateGetMaxSpeed',
+    'virDomainMigrateGetCompressionCache',
     'virDomainBlockStatsFlags',
     'virDomainSetBlockIoTune',
     'virDomainGetBlockIoTune',
@@ -473,10 +474,24 @@ skip_function = (
     'virStreamSendAll', # Pure python libvirt-override-virStream.py
     'virStreamRecv', # overridden in libvirt-override-virStream.py
     'virStreamSend', # overridden in libvirt-override-virStream.py
+    'virStreamRecvFlags', # needs a hand-written wrapper
+    'virStreamRecvHole', # needs a hand-written wrapper
 
     'virConnectUnregisterCloseCallback', # overriden in virConnect.py
     'virConnectRegisterCloseCallback', # overriden in virConnect.py
 
+    'virConnectGetAllDomainStats', # overridden in virConnect.py
+    'virDomainAttachDevices', # needs a hand-written wrapper
+    'virConnectGetListGeneration', # needs a hand-written wrapper
+    'virDomainStatsRecordListFree', # only needed by C callers
+    'virNetworkGetDHCPLeases', # needs a hand-written wrapper
+    'virNetworkDHCPLeaseFree', # only needed by C callers
+    'virDomainGetInfoAsync', # needs a hand-written wrapper
+    'virStorageVolGetJobInfo', # needs a hand-written wrapper
+    'virDomainListFSFreeze', # needs a hand-written wrapper
+    'virDomainListFSThaw', # needs a hand-written wrapper
+    'virConnectListAllDomainsFiltered', # needs a hand-written wrapper
+
     # 'Ref' functions have no use for bindings users.
     "virConnectRef",
     "virDomainRef",
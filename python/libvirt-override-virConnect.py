@@ -216,6 +216,20 @@
 
         return retlist
 
+    def getAllDomainStats(self, stats = 0, flags = 0):
+        """Query statistics for all domains matching the flags with a
+        single call, and return a list of (domain object, dictionary of
+        statistics) tuples"""
+        ret = libvirtmod.virConnectGetAllDomainStats(self._o, stats, flags)
+        if ret is None:
+            raise libvirtError("virConnectGetAllDomainStats() failed", conn=self)
+
+        retlist = list()
+        for domptr, domstats in ret:
+            retlist.append((virDomain(self, _obj=domptr), domstats))
+
+        return retlist
+
     def listAllStoragePools(self, flags):
         """Returns a list of storage pool objects"""
         ret = libvirtmod.virConnectListAllStoragePools(self._o, flags)
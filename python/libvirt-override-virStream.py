@@ -70,6 +70,9 @@
                         opaque): # extra data passed to recvAll as opaque
                 fd = opaque
                 return os.read(fd, nbytes)
+
+        The handler may return any object supporting the buffer
+        protocol, such as a string, bytearray or memoryview.
         """
         while True:
             try:
@@ -81,7 +84,7 @@
                     pass
                 raise e
 
-            if got == "":
+            if len(got) == 0:
                 break
 
             ret = self.send(got)
@@ -89,6 +92,39 @@
                 raise libvirtError("cannot use sendAll with "
                                    "nonblocking stream")
 
+    def recvAllFD(self, fd):
+        """Receive the entire data stream and write it to the file
+        descriptor fd. The data is copied without calling back into
+        Python, which makes this much cheaper than recvAll for large
+        transfers. The stream must be blocking."""
+        ret = libvirtmod.virStreamRecvFD(self._o, fd)
+        if ret == -1: raise libvirtError ('virStreamRecvAll() failed')
+        return ret
+
+    def sendAllFD(self, fd):
+        """Send the entire contents of the file descriptor fd, up to
+        end of file, to the stream. The data is copied without calling
+        back into Python, which makes this much cheaper than sendAll
+        for large transfers. The stream must be blocking."""
+        ret = libvirtmod.virStreamSendFD(self._o, fd)
+        if ret == -1: raise libvirtError ('virStreamSendAll() failed')
+        return ret
+
+    def recvInto(self, buf):
+        """Reads a series of bytes from the stream into buf, which
+        may be any writable object supporting the buffer protocol,
+        such as a bytearray or a memoryview of one, without an
+        intermediate copy. At most len(buf) bytes are read.
+
+        On success, the number of bytes received is returned, 0
+        meaning end of stream. On failure, an exception is raised. If
+        the stream is a NONBLOCK stream and the request would block,
+        integer -2 is returned.
+        """
+        ret = libvirtmod.virStreamRecvInto(self._o, buf)
+        if ret == -1: raise libvirtError ('virStreamRecv() failed')
+        return ret
+
     def recv(self, nbytes):
         """Reads a series of bytes from the stream. This method may
         block the calling application for an arbitrary amount
@@ -119,6 +155,10 @@
         Errors are not guaranteed to be reported synchronously
         with the call, but may instead be delayed until a
         subsequent call.
+
+        data may be any object supporting the buffer protocol, such
+        as a string, bytearray or memoryview; it is sent without
+        being copied.
         """
         ret = libvirtmod.virStreamSend(self._o, data, len(data))
         if ret == -1: raise libvirtError ('virStreamSend() failed')
@@ -556,8 +556,10 @@ libvirt_virDomainMemoryStats(PyObject *self ATTRIBUTE_UNUSED, PyObject *args) {
         return NULL;
     domain = (virDomainPtr) PyvirDomain_Get(pyobj_domain);
 
+    LIBVIRT_BEGIN_ALLOW_THREADS;
     nr_stats = virDomainMemoryStats(domain, stats,
                                     VIR_DOMAIN_MEMORY_STAT_NR, 0);
+    LIBVIRT_END_ALLOW_THREADS;
     if (nr_stats == -1)
         return VIR_PY_NONE;
 
@@ -2126,6 +2128,70 @@ cleanup:
     return py_retval;
 }
 
+static PyObject *
+libvirt_virConnectGetAllDomainStats(PyObject *self ATTRIBUTE_UNUSED,
+                                    PyObject *args)
+{
+    PyObject *pyobj_conn;
+    PyObject *py_retval = NULL;
+    PyObject *tuple;
+    PyObject *tmp;
+    virConnectPtr conn;
+    virDomainStatsRecordPtr *records = NULL;
+    int nrecords;
+    int i;
+    unsigned int stats;
+    unsigned int flags;
+
+    if (!PyArg_ParseTuple(args, (char *)"Oii:virConnectGetAllDomainStats",
+                          &pyobj_conn, &stats, &flags))
+        return NULL;
+    conn = (virConnectPtr) PyvirConnect_Get(pyobj_conn);
+
+    LIBVIRT_BEGIN_ALLOW_THREADS;
+    nrecords = virConnectGetAllDomainStats(conn, stats, &records, flags);
+    LIBVIRT_END_ALLOW_THREADS;
+    if (nrecords < 0)
+        return VIR_PY_NONE;
+
+    /* Build the (domain, stats) tuples for all records in one pass,
+     * without calling back into libvirt */
+    if (!(py_retval = PyList_New(nrecords)))
+        goto cleanup;
+
+    for (i = 0; i < nrecords; i++) {
+        if (!(tuple = PyTuple_New(2)) ||
+            PyList_SetItem(py_retval, i, tuple) < 0) {
+            Py_XDECREF(tuple);
+            goto error;
+        }
+
+        if (!(tmp = libvirt_virDomainPtrWrap(records[i]->dom)) ||
+            PyTuple_SetItem(tuple, 0, tmp) < 0) {
+            Py_XDECREF(tmp);
+            goto error;
+        }
+        /* python steals the pointer */
+        records[i]->dom = NULL;
+
+        if (!(tmp = getPyVirTypedParameter(records[i]->params,
+                                           records[i]->nparams)) ||
+            PyTuple_SetItem(tuple, 1, tmp) < 0) {
+            Py_XDECREF(tmp);
+            goto error;
+        }
+    }
+
+cleanup:
+    virDomainStatsRecordListFree(records);
+    return py_retval;
+
+error:
+    Py_DECREF(py_retval);
+    py_retval = NULL;
+    goto cleanup;
+}
+
 static PyObject *
 libvirt_virConnectListDefinedDomains(PyObject *self ATTRIBUTE_UNUSED,
                                      PyObject *args) {
@@ -4378,7 +4444,11 @@ libvirt_virDomainGetDiskErrors(PyObject *self ATTRIBUTE_UNUSED,
 
     domain = (virDomainPtr) PyvirDomain_Get(pyobj_domain);
 
-    if ((count = virDomainGetDiskErrors(domain, NULL, 0, 0)) < 0)
+    LIBVIRT_BEGIN_ALLOW_THREADS;
+    count = virDomainGetDiskErrors(domain, NULL, 0, 0);
+    LIBVIRT_END_ALLOW_THREADS;
+
+    if (count < 0)
         return VIR_PY_NONE;
     ndisks = count;
 
@@ -6192,8 +6262,8 @@ libvirt_virStreamRecv(PyObject *self ATTRIBUTE_UNUSED,
                       PyObject *args)
 {
     PyObject *pyobj_stream;
+    PyObject *py_retval;
     virStreamPtr stream;
-    char *buf = NULL;
     int ret;
     int nbytes;
 
@@ -6204,21 +6274,55 @@ libvirt_virStreamRecv(PyObject *self ATTRIBUTE_UNUSED,
     }
     stream = PyvirStream_Get(pyobj_stream);
 
-    if (VIR_ALLOC_N(buf, nbytes+1 > 0 ? nbytes+1 : 1) < 0)
-        return VIR_PY_NONE;
+    if (nbytes < 0)
+        nbytes = 0;
+
+    /* Receive straight into the string returned to the caller */
+    if (!(py_retval = PyString_FromStringAndSize(NULL, nbytes)))
+        return NULL;
 
     LIBVIRT_BEGIN_ALLOW_THREADS;
-    ret = virStreamRecv(stream, buf, nbytes);
+    ret = virStreamRecv(stream, PyString_AS_STRING(py_retval), nbytes);
     LIBVIRT_END_ALLOW_THREADS;
 
-    buf[ret > -1 ? ret : 0] = '\0';
-    DEBUG("StreamRecv ret=%d strlen=%d\n", ret, (int) strlen(buf));
+    DEBUG("StreamRecv ret=%d\n", ret);
 
-    if (ret == -2)
-        return libvirt_intWrap(ret);
-    if (ret < 0)
+    if (ret < 0) {
+        Py_DECREF(py_retval);
+        if (ret == -2)
+            return libvirt_intWrap(ret);
         return VIR_PY_NONE;
-    return libvirt_charPtrSizeWrap((char *) buf, (Py_ssize_t) ret);
+    }
+    if (ret != nbytes && _PyString_Resize(&py_retval, ret) < 0)
+        return NULL;
+    return py_retval;
+}
+
+static PyObject *
+libvirt_virStreamRecvInto(PyObject *self ATTRIBUTE_UNUSED,
+                          PyObject *args)
+{
+    PyObject *pyobj_stream;
+    virStreamPtr stream;
+    Py_buffer buf;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, (char *) "Ow*:virStreamRecvInto",
+                          &pyobj_stream, &buf)) {
+        DEBUG("%s failed to parse tuple\n", __FUNCTION__);
+        return NULL;
+    }
+    stream = PyvirStream_Get(pyobj_stream);
+
+    LIBVIRT_BEGIN_ALLOW_THREADS;
+    ret = virStreamRecv(stream, buf.buf, MIN(buf.len, INT_MAX));
+    LIBVIRT_END_ALLOW_THREADS;
+
+    PyBuffer_Release(&buf);
+
+    DEBUG("StreamRecvInto ret=%d\n", ret);
+
+    return libvirt_intWrap(ret);
 }
 
 static PyObject *
@@ -6228,28 +6332,101 @@ libvirt_virStreamSend(PyObject *self ATTRIBUTE_UNUSED,
     PyObject *py_retval;
     PyObject *pyobj_stream;
     virStreamPtr stream;
-    char *data;
-    int datalen;
+    Py_buffer data;
     int ret;
     int nbytes;
 
-    if (!PyArg_ParseTuple(args, (char *) "Oz#i:virStreamRecv",
-                          &pyobj_stream, &data, &datalen, &nbytes)) {
+    /* Accept anything supporting the buffer protocol, such as a string,
+     * bytearray or memoryview, without copying it */
+    if (!PyArg_ParseTuple(args, (char *) "Os*i:virStreamSend",
+                          &pyobj_stream, &data, &nbytes)) {
         DEBUG("%s failed to parse tuple\n", __FUNCTION__);
         return VIR_PY_INT_FAIL;
     }
     stream = PyvirStream_Get(pyobj_stream);
 
+    if (nbytes < 0 || nbytes > data.len)
+        nbytes = MIN(data.len, INT_MAX);
+
     LIBVIRT_BEGIN_ALLOW_THREADS;
-    ret = virStreamSend(stream, data, nbytes);
+    ret = virStreamSend(stream, data.buf, nbytes);
     LIBVIRT_END_ALLOW_THREADS;
 
+    PyBuffer_Release(&data);
+
     DEBUG("StreamSend ret=%d\n", ret);
 
     py_retval = libvirt_intWrap(ret);
     return py_retval;
 }
 
+static int
+libvirt_virStreamSourceFD(virStreamPtr st ATTRIBUTE_UNUSED,
+                          char *data,
+                          size_t nbytes,
+                          void *opaque)
+{
+    int *fd = opaque;
+
+    return saferead(*fd, data, nbytes);
+}
+
+static int
+libvirt_virStreamSinkFD(virStreamPtr st ATTRIBUTE_UNUSED,
+                        const char *data,
+                        size_t nbytes,
+                        void *opaque)
+{
+    int *fd = opaque;
+
+    return safewrite(*fd, data, nbytes);
+}
+
+/* Copy a file descriptor to a stream, or a stream to a file descriptor,
+ * entirely in C and without holding the GIL, rather than calling a
+ * Python handler for every chunk */
+static PyObject *
+libvirt_virStreamSendFD(PyObject *self ATTRIBUTE_UNUSED,
+                        PyObject *args)
+{
+    PyObject *pyobj_stream;
+    virStreamPtr stream;
+    int fd;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, (char *) "Oi:virStreamSendFD",
+                          &pyobj_stream, &fd))
+        return NULL;
+    stream = PyvirStream_Get(pyobj_stream);
+
+    LIBVIRT_BEGIN_ALLOW_THREADS;
+    ret = virStreamSendAll(stream, libvirt_virStreamSourceFD, &fd);
+    LIBVIRT_END_ALLOW_THREADS;
+
+    return libvirt_intWrap(ret);
+}
+
+static PyObject *
+libvirt_virStreamRecvFD(PyObject *self ATTRIBUTE_UNUSED,
+                        PyObject *args)
+{
+    PyObject *pyobj_stream;
+    virStreamPtr stream;
+    int fd;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, (char *) "Oi:virStreamRecvFD",
+                          &pyobj_stream, &fd))
+        return NULL;
+    stream = PyvirStream_Get(pyobj_stream);
+
+    LIBVIRT_BEGIN_ALLOW_THREADS;
+    ret = virStreamRecvAll(stream, libvirt_virStreamSinkFD, &fd);
+    LIBVIRT_END_ALLOW_THREADS;
+
+    return libvirt_intWrap(ret);
+}
+
 static PyObject *
 libvirt_virDomainSendKey(PyObject *self ATTRIBUTE_UNUSED,
                          PyObject *args)
@@ -6322,6 +6499,32 @@ libvirt_virDomainMigrateGetMaxSpeed(PyObject *self ATTRIBUTE_UNUSED, PyObject *a
     return py_retval;
 }
 
+static PyObject *
+libvirt_virDomainMigrateGetCompressionCache(PyObject *self ATTRIBUTE_UNUSED,
+                                            PyObject *args) {
+    PyObject *pyobj_domain;
+    virDomainPtr domain;
+    unsigned int flags = 0;
+    unsigned long long cacheSize;
+    int rc;
+
+    if (!PyArg_ParseTuple(args,
+                          (char *) "Oi:virDomainMigrateGetCompressionCache",
+                          &pyobj_domain, &flags))
+        return VIR_PY_NONE;
+
+    domain = (virDomainPtr) PyvirDomain_Get(pyobj_domain);
+
+    LIBVIRT_BEGIN_ALLOW_THREADS;
+    rc = virDomainMigrateGetCompressionCache(domain, &cacheSize, flags);
+    LIBVIRT_END_ALLOW_THREADS;
+
+    if (rc < 0)
+        return VIR_PY_NONE;
+
+    return libvirt_ulonglongWrap(cacheSize);
+}
+
 static PyObject *
 libvirt_virDomainBlockPeek(PyObject *self ATTRIBUTE_UNUSED,
                            PyObject *args) {
@@ -6603,6 +6806,7 @@ static PyMethodDef libvirtMethods[] = {
     {(char *) "virConnectListDomainsID", libvirt_virConnectListDomainsID, METH_VARARGS, NULL},
     {(char *) "virConnectListDefinedDomains", libvirt_virConnectListDefinedDomains, METH_VARARGS, NULL},
     {(char *) "virConnectListAllDomains", libvirt_virConnectListAllDomains, METH_VARARGS, NULL},
+    {(char *) "virConnectGetAllDomainStats", libvirt_virConnectGetAllDomainStats, METH_VARARGS, NULL},
     {(char *) "virConnectDomainEventRegister", libvirt_virConnectDomainEventRegister, METH_VARARGS, NULL},
     {(char *) "virConnectDomainEventDeregister", libvirt_virConnectDomainEventDeregister, METH_VARARGS, NULL},
     {(char *) "virConnectDomainEventRegisterAny", libvirt_virConnectDomainEventRegisterAny, METH_VARARGS, NULL},
@@ -6612,6 +6816,9 @@ static PyMethodDef libvirtMethods[] = {
     {(char *) "virStreamEventAddCallback", libvirt_virStreamEventAddCallback, METH_VARARGS, NULL},
     {(char *) "virStreamRecv", libvirt_virStreamRecv, METH_VARARGS, NULL},
     {(char *) "virStreamSend", libvirt_virStreamSend, METH_VARARGS, NULL},
+    {(char *) "virStreamRecvInto", libvirt_virStreamRecvInto, METH_VARARGS, NULL},
+    {(char *) "virStreamSendFD", libvirt_virStreamSendFD, METH_VARARGS, NULL},
+    {(char *) "virStreamRecvFD", libvirt_virStreamRecvFD, METH_VARARGS, NULL},
     {(char *) "virDomainGetInfo", libvirt_virDomainGetInfo, METH_VARARGS, NULL},
     {(char *) "virDomainGetState", libvirt_virDomainGetState, METH_VARARGS, NULL},
     {(char *) "virDomainGetControlInfo", libvirt_virDomainGetControlInfo, METH_VARARGS, NULL},
@@ -6702,6 +6909,7 @@ static PyMethodDef libvirtMethods[] = {
     {(char *) "virDomainGetBlockIoTune", libvirt_virDomainGetBlockIoTune, METH_VARARGS, NULL},
     {(char *) "virDomainSendKey", libvirt_virDomainSendKey, METH_VARARGS, NULL},
     {(char *) "virDomainMigrateGetMaxSpeed", libvirt_virDomainMigrateGetMaxSpeed, METH_VARARGS, NULL},
+    {(char *) "virDomainMigrateGetCompressionCache", libvirt_virDomainMigrateGetCompressionCache, METH_VARARGS, NULL},
     {(char *) "virDomainBlockPeek", libvirt_virDomainBlockPeek, METH_VARARGS, NULL},
     {(char *) "virDomainMemoryPeek", libvirt_virDomainMemoryPeek, METH_VARARGS, NULL},
     {(char *) "virDomainGetDiskErrors", libvirt_virDomainGetDiskErrors, METH_VARARGS, NULL},
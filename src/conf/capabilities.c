@@ -72,6 +72,7 @@ virCapabilitiesFreeHostNUMACell(virCapsHostNUMACellPtr cell)
         return;
 
     VIR_FREE(cell->cpus);
+    VIR_FREE(cell->pageinfo);
     VIR_FREE(cell);
 }
 
@@ -273,6 +274,47 @@ virCapabilitiesAddHostNUMACell(virCapsPtr caps,
 }
 
 
+/**
+ * virCapabilitiesAddHostNUMACellPages:
+ * @caps: capabilities to extend
+ * @num: ID number of a NUMA cell registered earlier
+ * @size: page size in KiB
+ * @total: number of pages of @size in the pool of the cell
+ * @avail: number of those pages which are still free
+ *
+ * Records the state of a huge page pool of a host NUMA cell
+ */
+int
+virCapabilitiesAddHostNUMACellPages(virCapsPtr caps,
+                                    int num,
+                                    unsigned int size,
+                                    unsigned long long total,
+                                    unsigned long long avail)
+{
+    virCapsHostNUMACellPtr cell = NULL;
+    size_t i;
+
+    for (i = 0 ; i < caps->host.nnumaCell ; i++) {
+        if (caps->host.numaCell[i]->num == num) {
+            cell = caps->host.numaCell[i];
+            break;
+        }
+    }
+
+    if (!cell)
+        return -1;
+
+    if (VIR_EXPAND_N(cell->pageinfo, cell->npageinfo, 1) < 0)
+        return -1;
+
+    cell->pageinfo[cell->npageinfo - 1].size = size;
+    cell->pageinfo[cell->npageinfo - 1].total = total;
+    cell->pageinfo[cell->npageinfo - 1].avail = avail;
+
+    return 0;
+}
+
+
 /**
  * virCapabilitiesSetHostCPU:
  * @caps: capabilities to extend
@@ -679,108 +721,123 @@ virCapabilitiesDefaultGuestEmulator(virCapsPtr caps,
 }
 
 
-/**
- * virCapabilitiesFormatXML:
- * @caps: capabilities to format
- *
- * Convert the capabilities object into an XML representation
- *
- * Returns the XML document as a string
- */
-char *
-virCapabilitiesFormatXML(virCapsPtr caps)
+static void
+virCapabilitiesFormatHostBuf(virBufferPtr buf, virCapsPtr caps)
 {
-    virBuffer xml = VIR_BUFFER_INITIALIZER;
-    int i, j, k;
+    int i, j;
     char host_uuid[VIR_UUID_STRING_BUFLEN];
 
-    virBufferAddLit(&xml, "<capabilities>\n\n");
-    virBufferAddLit(&xml, "  <host>\n");
+    virBufferAddLit(buf, "  <host>\n");
     if (virUUIDIsValid(caps->host.host_uuid)) {
         virUUIDFormat(caps->host.host_uuid, host_uuid);
-        virBufferAsprintf(&xml,"    <uuid>%s</uuid>\n", host_uuid);
+        virBufferAsprintf(buf,"    <uuid>%s</uuid>\n", host_uuid);
     }
-    virBufferAddLit(&xml, "    <cpu>\n");
+    virBufferAddLit(buf, "    <cpu>\n");
     if (caps->host.arch)
-        virBufferAsprintf(&xml, "      <arch>%s</arch>\n",
+        virBufferAsprintf(buf, "      <arch>%s</arch>\n",
                           virArchToString(caps->host.arch));
 
     if (caps->host.nfeatures) {
-        virBufferAddLit(&xml, "      <features>\n");
+        virBufferAddLit(buf, "      <features>\n");
         for (i = 0 ; i < caps->host.nfeatures ; i++) {
-            virBufferAsprintf(&xml, "        <%s/>\n",
+            virBufferAsprintf(buf, "        <%s/>\n",
                               caps->host.features[i]);
         }
-        virBufferAddLit(&xml, "      </features>\n");
+        virBufferAddLit(buf, "      </features>\n");
     }
 
-    virBufferAdjustIndent(&xml, 6);
-    virCPUDefFormatBuf(&xml, caps->host.cpu, 0);
-    virBufferAdjustIndent(&xml, -6);
+    virBufferAdjustIndent(buf, 6);
+    virCPUDefFormatBuf(buf, caps->host.cpu, 0);
+    virBufferAdjustIndent(buf, -6);
 
-    virBufferAddLit(&xml, "    </cpu>\n");
+    virBufferAddLit(buf, "    </cpu>\n");
 
     /* The PM query was successful. */
     if (caps->host.powerMgmt) {
         /* The host supports some PM features. */
         unsigned int pm = caps->host.powerMgmt;
-        virBufferAddLit(&xml, "    <power_management>\n");
+        virBufferAddLit(buf, "    <power_management>\n");
         while (pm) {
             int bit = ffs(pm) - 1;
-            virBufferAsprintf(&xml, "      <%s/>\n",
+            virBufferAsprintf(buf, "      <%s/>\n",
                               virCapsHostPMTargetTypeToString(bit));
             pm &= ~(1U << bit);
         }
-        virBufferAddLit(&xml, "    </power_management>\n");
+        virBufferAddLit(buf, "    </power_management>\n");
     } else {
         /* The host does not support any PM feature. */
-        virBufferAddLit(&xml, "    <power_management/>\n");
+        virBufferAddLit(buf, "    <power_management/>\n");
     }
 
     if (caps->host.offlineMigrate) {
-        virBufferAddLit(&xml, "    <migration_features>\n");
+        virBufferAddLit(buf, "    <migration_features>\n");
         if (caps->host.liveMigrate)
-            virBufferAddLit(&xml, "      <live/>\n");
+            virBufferAddLit(buf, "      <live/>\n");
         if (caps->host.nmigrateTrans) {
-            virBufferAddLit(&xml, "      <uri_transports>\n");
+            virBufferAddLit(buf, "      <uri_transports>\n");
             for (i = 0 ; i < caps->host.nmigrateTrans ; i++) {
-                virBufferAsprintf(&xml, "        <uri_transport>%s</uri_transport>\n",
+                virBufferAsprintf(buf, "        <uri_transport>%s</uri_transport>\n",
                                       caps->host.migrateTrans[i]);
             }
-            virBufferAddLit(&xml, "      </uri_transports>\n");
+            virBufferAddLit(buf, "      </uri_transports>\n");
         }
-        virBufferAddLit(&xml, "    </migration_features>\n");
+        virBufferAddLit(buf, "    </migration_features>\n");
     }
 
     if (caps->host.nnumaCell) {
-        virBufferAddLit(&xml, "    <topology>\n");
-        virBufferAsprintf(&xml, "      <cells num='%zu'>\n",
+        virBufferAddLit(buf, "    <topology>\n");
+        virBufferAsprintf(buf, "      <cells num='%zu'>\n",
                           caps->host.nnumaCell);
         for (i = 0 ; i < caps->host.nnumaCell ; i++) {
-            virBufferAsprintf(&xml, "        <cell id='%d'>\n",
+            virBufferAsprintf(buf, "        <cell id='%d'>\n",
                               caps->host.numaCell[i]->num);
-            virBufferAsprintf(&xml, "          <cpus num='%d'>\n",
+            virBufferAsprintf(buf, "          <cpus num='%d'>\n",
                               caps->host.numaCell[i]->ncpus);
             for (j = 0 ; j < caps->host.numaCell[i]->ncpus ; j++)
-                virBufferAsprintf(&xml, "            <cpu id='%d'/>\n",
+                virBufferAsprintf(buf, "            <cpu id='%d'/>\n",
                                   caps->host.numaCell[i]->cpus[j]);
-            virBufferAddLit(&xml, "          </cpus>\n");
-            virBufferAddLit(&xml, "        </cell>\n");
+            virBufferAddLit(buf, "          </cpus>\n");
+            for (j = 0 ; j < caps->host.numaCell[i]->npageinfo ; j++) {
+                virCapsHostNUMACellPageInfoPtr info =
+                    &caps->host.numaCell[i]->pageinfo[j];
+                virBufferAsprintf(buf, "          <pages unit='KiB' size='%u' "
+                                  "free='%llu'>%llu</pages>\n",
+                                  info->size, info->avail, info->total);
+            }
+            virBufferAddLit(buf, "        </cell>\n");
         }
-        virBufferAddLit(&xml, "      </cells>\n");
-        virBufferAddLit(&xml, "    </topology>\n");
+        virBufferAddLit(buf, "      </cells>\n");
+        virBufferAddLit(buf, "    </topology>\n");
     }
 
     for (i = 0; i < caps->host.nsecModels; i++) {
-        virBufferAddLit(&xml, "    <secmodel>\n");
-        virBufferAsprintf(&xml, "      <model>%s</model>\n",
+        virBufferAddLit(buf, "    <secmodel>\n");
+        virBufferAsprintf(buf, "      <model>%s</model>\n",
                           caps->host.secModels[i].model);
-        virBufferAsprintf(&xml, "      <doi>%s</doi>\n",
+        virBufferAsprintf(buf, "      <doi>%s</doi>\n",
                           caps->host.secModels[i].doi);
-        virBufferAddLit(&xml, "    </secmodel>\n");
+        virBufferAddLit(buf, "    </secmodel>\n");
     }
 
-    virBufferAddLit(&xml, "  </host>\n\n");
+    virBufferAddLit(buf, "  </host>\n\n");
+}
+
+/**
+ * virCapabilitiesFormatXML:
+ * @caps: capabilities to format
+ *
+ * Convert the capabilities object into an XML representation
+ *
+ * Returns the XML document as a string
+ */
+char *
+virCapabilitiesFormatXML(virCapsPtr caps)
+{
+    virBuffer xml = VIR_BUFFER_INITIALIZER;
+    int i, j, k;
+
+    virBufferAddLit(&xml, "<capabilities>\n\n");
+    virCapabilitiesFormatHostBuf(&xml, caps);
 
 
     for (i = 0 ; i < caps->nguests ; i++) {
@@ -864,6 +921,32 @@ virCapabilitiesFormatXML(virCapsPtr caps)
     return virBufferContentAndReset(&xml);
 }
 
+/**
+ * virCapabilitiesFormatHostXML:
+ * @caps: capabilities to format
+ *
+ * Convert just the host part of the capabilities object into an XML
+ * representation, leaving out the guests.
+ *
+ * Returns the XML document as a string
+ */
+char *
+virCapabilitiesFormatHostXML(virCapsPtr caps)
+{
+    virBuffer xml = VIR_BUFFER_INITIALIZER;
+
+    virBufferAddLit(&xml, "<capabilities>\n\n");
+    virCapabilitiesFormatHostBuf(&xml, caps);
+    virBufferAddLit(&xml, "</capabilities>\n");
+
+    if (virBufferError(&xml)) {
+        virBufferFreeAndReset(&xml);
+        return NULL;
+    }
+
+    return virBufferContentAndReset(&xml);
+}
+
 extern void
 virCapabilitiesSetMacPrefix(virCapsPtr caps,
                             const unsigned char prefix[VIR_MAC_PREFIX_BUFLEN])
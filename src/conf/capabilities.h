@@ -84,12 +84,22 @@ struct _virCapsGuest {
     virCapsGuestFeaturePtr *features;
 };
 
+typedef struct _virCapsHostNUMACellPageInfo virCapsHostNUMACellPageInfo;
+typedef virCapsHostNUMACellPageInfo *virCapsHostNUMACellPageInfoPtr;
+struct _virCapsHostNUMACellPageInfo {
+    unsigned int size;          /* page size in KiB */
+    unsigned long long total;   /* pages in the pool of the cell */
+    unsigned long long avail;   /* pages not yet handed out */
+};
+
 typedef struct _virCapsHostNUMACell virCapsHostNUMACell;
 typedef virCapsHostNUMACell *virCapsHostNUMACellPtr;
 struct _virCapsHostNUMACell {
     int num;
     int ncpus;
     int *cpus;
+    size_t npageinfo;
+    virCapsHostNUMACellPageInfoPtr pageinfo;
 };
 
 typedef struct _virCapsHostSecModel virCapsHostSecModel;
@@ -203,6 +213,13 @@ virCapabilitiesAddHostNUMACell(virCapsPtr caps,
                                int ncpus,
                                const int *cpus);
 
+extern int
+virCapabilitiesAddHostNUMACellPages(virCapsPtr caps,
+                                    int num,
+                                    unsigned int size,
+                                    unsigned long long total,
+                                    unsigned long long avail);
+
 
 extern int
 virCapabilitiesSetHostCPU(virCapsPtr caps,
@@ -269,5 +286,8 @@ virCapabilitiesDefaultGuestEmulator(virCapsPtr caps,
 extern char *
 virCapabilitiesFormatXML(virCapsPtr caps);
 
+extern char *
+virCapabilitiesFormatHostXML(virCapsPtr caps);
+
 
 #endif /* __VIR_CAPABILITIES_H */
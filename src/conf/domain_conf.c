@@ -25,6 +25,7 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <strings.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -46,12 +47,16 @@
 #include "virfile.h"
 #include "bitmap.h"
 #include "count-one-bits.h"
+#include "intprops.h"
 #include "secret_conf.h"
 #include "netdev_vport_profile_conf.h"
 #include "netdev_bandwidth_conf.h"
 #include "netdev_vlan_conf.h"
 #include "device_conf.h"
 #include "bitmap.h"
+#include "viratomic.h"
+#include "threadpool.h"
+#include "virstring.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -59,6 +64,11 @@
  * verify that it doesn't overflow an unsigned int when shifting */
 verify(VIR_DOMAIN_VIRT_LAST <= 32);
 
+/* Bumped by every domain state change. Domains don't know which list
+ * they are in, so this is shared by all lists and folded into each
+ * list's own generation by virDomainObjListGetGeneration */
+static int virDomainObjStateGeneration;
+
 /* Private flags used internally by virDomainSaveStatus and
  * virDomainLoadStatus. */
 typedef enum {
@@ -699,30 +709,88 @@ static int virDomainObjOnceInit(void)
 VIR_ONCE_GLOBAL_INIT(virDomainObj)
 
 void
-virBlkioDeviceWeightArrayClear(virBlkioDeviceWeightPtr deviceWeights,
-                               int ndevices)
+virBlkioDeviceArrayClear(virBlkioDevicePtr devices,
+                         int ndevices)
 {
     int i;
 
     for (i = 0; i < ndevices; i++)
-        VIR_FREE(deviceWeights[i].path);
+        VIR_FREE(devices[i].path);
+}
+
+void
+virBlkioThrottleGroupArrayClear(virBlkioThrottleGroupPtr groups,
+                                int ngroups)
+{
+    int i, j;
+
+    for (i = 0; i < ngroups; i++) {
+        for (j = 0; j < groups[i].npaths; j++)
+            VIR_FREE(groups[i].paths[j]);
+        VIR_FREE(groups[i].paths);
+    }
+}
+
+/* Parse one of the throttle limits shared by <device> and
+ * <throttlegroup>.  Returns 1 if @node was a throttle element,
+ * 0 if it was something else and -1 on error. */
+static int
+virDomainBlkioThrottleParseXML(xmlNodePtr node,
+                               unsigned int *riops,
+                               unsigned int *wiops,
+                               unsigned long long *rbps,
+                               unsigned long long *wbps)
+{
+    char *c = NULL;
+    int ret = -1;
+
+    if (!xmlStrEqual(node->name, BAD_CAST "read_iops_sec") &&
+        !xmlStrEqual(node->name, BAD_CAST "write_iops_sec") &&
+        !xmlStrEqual(node->name, BAD_CAST "read_bytes_sec") &&
+        !xmlStrEqual(node->name, BAD_CAST "write_bytes_sec"))
+        return 0;
+
+    c = (char *)xmlNodeGetContent(node);
+    if (xmlStrEqual(node->name, BAD_CAST "read_iops_sec"))
+        ret = virStrToLong_ui(c, NULL, 10, riops);
+    else if (xmlStrEqual(node->name, BAD_CAST "write_iops_sec"))
+        ret = virStrToLong_ui(c, NULL, 10, wiops);
+    else if (xmlStrEqual(node->name, BAD_CAST "read_bytes_sec"))
+        ret = virStrToLong_ull(c, NULL, 10, rbps);
+    else
+        ret = virStrToLong_ull(c, NULL, 10, wbps);
+
+    if (ret < 0) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("could not parse %s %s"),
+                       (const char *)node->name, NULLSTR(c));
+        VIR_FREE(c);
+        return -1;
+    }
+
+    VIR_FREE(c);
+    return 1;
 }
 
 /**
- * virDomainBlkioDeviceWeightParseXML
+ * virDomainBlkioDeviceParseXML
  *
  * this function parses a XML node:
  *
  *   <device>
  *     <path>/fully/qualified/device/path</path>
  *     <weight>weight</weight>
+ *     <read_bytes_sec>bps</read_bytes_sec>
+ *     <write_bytes_sec>bps</write_bytes_sec>
+ *     <read_iops_sec>iops</read_iops_sec>
+ *     <write_iops_sec>iops</write_iops_sec>
  *   </device>
  *
- * and fills a virBlkioDeviceWeight struct.
+ * and fills a virBlkioDevice struct.
  */
 static int
-virDomainBlkioDeviceWeightParseXML(xmlNodePtr root,
-                                   virBlkioDeviceWeightPtr dw)
+virDomainBlkioDeviceParseXML(xmlNodePtr root,
+                             virBlkioDevicePtr dev)
 {
     char *c;
     xmlNodePtr node;
@@ -730,24 +798,31 @@ virDomainBlkioDeviceWeightParseXML(xmlNodePtr root,
     node = root->children;
     while (node) {
         if (node->type == XML_ELEMENT_NODE) {
-            if (xmlStrEqual(node->name, BAD_CAST "path") && !dw->path) {
-                dw->path = (char *)xmlNodeGetContent(node);
+            if (xmlStrEqual(node->name, BAD_CAST "path") && !dev->path) {
+                dev->path = (char *)xmlNodeGetContent(node);
             } else if (xmlStrEqual(node->name, BAD_CAST "weight")) {
                 c = (char *)xmlNodeGetContent(node);
-                if (virStrToLong_ui(c, NULL, 10, &dw->weight) < 0) {
+                if (virStrToLong_ui(c, NULL, 10, &dev->weight) < 0) {
                     virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                    _("could not parse weight %s"),
                                    c);
                     VIR_FREE(c);
-                    VIR_FREE(dw->path);
+                    VIR_FREE(dev->path);
                     return -1;
                 }
                 VIR_FREE(c);
+            } else if (virDomainBlkioThrottleParseXML(node,
+                                                      &dev->riops,
+                                                      &dev->wiops,
+                                                      &dev->rbps,
+                                                      &dev->wbps) < 0) {
+                VIR_FREE(dev->path);
+                return -1;
             }
         }
         node = node->next;
     }
-    if (!dw->path) {
+    if (!dev->path) {
         virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
                        _("missing per-device path"));
         return -1;
@@ -756,7 +831,116 @@ virDomainBlkioDeviceWeightParseXML(xmlNodePtr root,
     return 0;
 }
 
+/**
+ * virDomainBlkioThrottleGroupParseXML
+ *
+ * this function parses a XML node:
+ *
+ *   <throttlegroup>
+ *     <path>/fully/qualified/device/path</path>
+ *     <path>/another/device/path</path>
+ *     <read_bytes_sec>bps</read_bytes_sec>
+ *     ...
+ *   </throttlegroup>
+ *
+ * and fills a virBlkioThrottleGroup struct.
+ */
+static int
+virDomainBlkioThrottleGroupParseXML(xmlNodePtr root,
+                                    virBlkioThrottleGroupPtr group)
+{
+    xmlNodePtr node;
+
+    for (node = root->children; node; node = node->next) {
+        if (node->type != XML_ELEMENT_NODE)
+            continue;
+
+        if (xmlStrEqual(node->name, BAD_CAST "path")) {
+            char *path = (char *)xmlNodeGetContent(node);
+
+            if (!path ||
+                VIR_APPEND_ELEMENT(group->paths, group->npaths, path) < 0) {
+                VIR_FREE(path);
+                virReportOOMError();
+                return -1;
+            }
+        } else if (virDomainBlkioThrottleParseXML(node,
+                                                  &group->riops,
+                                                  &group->wiops,
+                                                  &group->rbps,
+                                                  &group->wbps) < 0) {
+            return -1;
+        }
+    }
+
+    if (!group->npaths) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("missing throttle group path"));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Lower *@cur to @limit if @limit is set and stricter. */
+#define VIR_BLKIO_THROTTLE_MIN(cur, limit)              \
+    do {                                                \
+        if ((limit) && (!*(cur) || (limit) < *(cur)))   \
+            *(cur) = (limit);                           \
+    } while (0)
+
+/**
+ * virBlkioDeviceGetThrottle:
+ *
+ * Compute the throttle limits to program for the host block device
+ * @path of @def: the per-device limits, tightened by an equal share of
+ * the limits of each throttle group listing @path.  The kernel only
+ * throttles per device, so dividing the group budget statically is
+ * what keeps the sum of all members within it.  A value of 0 means
+ * unlimited.
+ */
+void
+virBlkioDeviceGetThrottle(virDomainDefPtr def,
+                          const char *path,
+                          unsigned int *riops,
+                          unsigned int *wiops,
+                          unsigned long long *rbps,
+                          unsigned long long *wbps)
+{
+    int i, j;
+
+    *riops = *wiops = 0;
+    *rbps = *wbps = 0;
+
+    for (i = 0; i < def->blkio.ndevices; i++) {
+        if (STREQ(def->blkio.devices[i].path, path)) {
+            *riops = def->blkio.devices[i].riops;
+            *wiops = def->blkio.devices[i].wiops;
+            *rbps = def->blkio.devices[i].rbps;
+            *wbps = def->blkio.devices[i].wbps;
+            break;
+        }
+    }
+
+    for (i = 0; i < def->blkio.ngroups; i++) {
+        virBlkioThrottleGroupPtr group = &def->blkio.groups[i];
+        size_t n = group->npaths;
+
+        for (j = 0; j < n; j++) {
+            if (STREQ(group->paths[j], path))
+                break;
+        }
+        if (j == n)
+            continue;
 
+        /* round down, but never turn a limit into "unlimited" */
+        VIR_BLKIO_THROTTLE_MIN(riops, MAX(group->riops / n, !!group->riops));
+        VIR_BLKIO_THROTTLE_MIN(wiops, MAX(group->wiops / n, !!group->wiops));
+        VIR_BLKIO_THROTTLE_MIN(rbps, MAX(group->rbps / n, !!group->rbps));
+        VIR_BLKIO_THROTTLE_MIN(wbps, MAX(group->wbps / n, !!group->wbps));
+    }
+}
+#undef VIR_BLKIO_THROTTLE_MIN
 
 static void
 virDomainObjListDataFree(void *payload, const void *name ATTRIBUTE_UNUSED)
@@ -765,33 +949,335 @@ virDomainObjListDataFree(void *payload, const void *name ATTRIBUTE_UNUSED)
     virObjectUnref(obj);
 }
 
+static void
+virDomainObjListMetaSetFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virHashFree(payload);
+}
+
 int virDomainObjListInit(virDomainObjListPtr doms)
 {
-    doms->objs = virHashCreate(50, virDomainObjListDataFree);
-    if (!doms->objs)
+    if (virMutexInit(&doms->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize domain list mutex"));
+        return -1;
+    }
+
+    if (virMutexInit(&doms->metaLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize domain list mutex"));
+        virMutexDestroy(&doms->lock);
+        return -1;
+    }
+
+    if (!(doms->objs = virHashCreate(50, virDomainObjListDataFree)) ||
+        !(doms->objsName = virHashCreate(50, NULL)) ||
+        !(doms->objsID = virHashCreate(50, NULL)) ||
+        !(doms->objsMeta = virHashCreate(50, virDomainObjListMetaSetFree))) {
+        virHashFree(doms->objsID);
+        virHashFree(doms->objsName);
+        virHashFree(doms->objs);
+        doms->objsID = doms->objsName = doms->objs = NULL;
+        virMutexDestroy(&doms->metaLock);
+        virMutexDestroy(&doms->lock);
         return -1;
+    }
     return 0;
 }
 
 
 void virDomainObjListDeinit(virDomainObjListPtr doms)
 {
+    if (!doms->objs)
+        return;
+    virHashFree(doms->objsMeta);
+    virHashFree(doms->objsID);
+    virHashFree(doms->objsName);
     virHashFree(doms->objs);
+    doms->objsMeta = doms->objsID = doms->objsName = doms->objs = NULL;
+    virStringFreeList(doms->metaURIs);
+    doms->metaURIs = NULL;
+    virMutexDestroy(&doms->metaLock);
+    virMutexDestroy(&doms->lock);
+}
+
+
+/*
+ * Add @obj, whose def must not change name while it is listed,
+ * to all indexes of @doms. The list lock must be held.
+ */
+static void virDomainObjListRemoveLocked(virDomainObjListPtr doms,
+                                         virDomainObjPtr dom);
+
+static int
+virDomainObjListAddLocked(virDomainObjListPtr doms,
+                          virDomainObjPtr obj)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    virDomainObjPtr old;
+
+    virUUIDFormat(obj->def->uuid, uuidstr);
+
+    /* A domain with the same UUID may still be listed because its
+     * undefine is waiting for the list lock; finish removing it */
+    if ((old = virHashLookup(doms->objs, uuidstr))) {
+        virObjectRef(old);
+        virDomainObjLock(old);
+        if (old->removing)
+            virDomainObjListRemoveLocked(doms, old);
+        virDomainObjUnlock(old);
+        virObjectUnref(old);
+    }
+
+    if (virHashAddEntry(doms->objs, uuidstr, obj) < 0)
+        return -1;
+
+    if (virHashUpdateEntry(doms->objsName, obj->def->name, obj) < 0) {
+        /* don't let the uuid table free the caller's object */
+        ignore_value(virHashSteal(doms->objs, uuidstr));
+        return -1;
+    }
+
+    virDomainObjListUpdateMetadataIndex(doms, obj);
+    virAtomicIntInc(&doms->generation);
+    return 0;
+}
+
+
+/*
+ * Add @obj, a new domain object built by the caller rather than by
+ * virDomainAssignDef, to @doms. It may already be locked, as nobody
+ * else can be waiting on it yet. The list takes over the caller's
+ * reference on success.
+ */
+int
+virDomainObjListAdd(virDomainObjListPtr doms,
+                    virDomainObjPtr obj)
+{
+    int ret;
+
+    virMutexLock(&doms->lock);
+    ret = virDomainObjListAddLocked(doms, obj);
+    virMutexUnlock(&doms->lock);
+    return ret;
+}
+
+
+/*
+ * Returns a counter which changes whenever a domain is added to or
+ * removed from @doms, or any domain changes state. It only ever
+ * grows while the process runs, so callers can tell that nothing
+ * they would list has changed by comparing two values.
+ */
+unsigned long long
+virDomainObjListGetGeneration(virDomainObjListPtr doms)
+{
+    return (unsigned long long)(unsigned int)virAtomicIntGet(&doms->generation) +
+        (unsigned int)virAtomicIntGet(&virDomainObjStateGeneration);
+}
+
+
+/* Return the first element of the <metadata> of @def in the namespace
+ * whose URI is the first @urilen characters of @uri, or NULL */
+static xmlNodePtr
+virDomainDefFindMetadata(virDomainDefPtr def,
+                         const char *uri,
+                         size_t urilen)
+{
+    xmlNodePtr node;
+
+    if (!def->metadata)
+        return NULL;
+
+    for (node = def->metadata->children; node; node = node->next) {
+        if (node->type == XML_ELEMENT_NODE &&
+            node->ns && node->ns->href &&
+            strlen((const char *) node->ns->href) == urilen &&
+            STREQLEN((const char *) node->ns->href, uri, urilen))
+            return node;
+    }
+
+    return NULL;
 }
 
 
+static int
+virDomainObjListMetaRemoveOne(const void *payload,
+                              const void *name ATTRIBUTE_UNUSED,
+                              const void *data)
+{
+    virHashTablePtr set = (virHashTablePtr) payload;
+
+    ignore_value(virHashRemoveEntry(set, data));
+    return virHashSize(set) == 0;
+}
+
+
+/*
+ * Index @obj, whose lock must be held, under the current text of its
+ * metadata elements in the indexed namespaces, dropping whatever it
+ * was indexed under before. metaLock must be held.
+ *
+ * Should that fail, the index is disabled rather than left missing
+ * @obj, and searches go back to checking every domain.
+ */
+static void
+virDomainObjListMetaUpdateLocked(virDomainObjListPtr doms,
+                                 virDomainObjPtr obj,
+                                 bool remove)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    int i;
+
+    virUUIDFormat(obj->def->uuid, uuidstr);
+    virHashRemoveSet(doms->objsMeta, virDomainObjListMetaRemoveOne, uuidstr);
+
+    if (remove || !doms->metaURIs)
+        return;
+
+    for (i = 0; doms->metaURIs[i]; i++) {
+        const char *uri = doms->metaURIs[i];
+        virHashTablePtr set;
+        xmlNodePtr node;
+        xmlChar *text;
+        char *key = NULL;
+
+        if (!(node = virDomainDefFindMetadata(obj->def, uri, strlen(uri))))
+            continue;
+
+        if (!(text = xmlNodeGetContent(node)) ||
+            virAsprintf(&key, "%s %s", uri, (const char *) text) < 0)
+            goto error;
+        xmlFree(text);
+
+        if (!(set = virHashLookup(doms->objsMeta, key))) {
+            if (!(set = virHashCreate(10, NULL)) ||
+                virHashAddEntry(doms->objsMeta, key, set) < 0) {
+                virHashFree(set);
+                VIR_FREE(key);
+                goto error;
+            }
+        }
+        VIR_FREE(key);
+
+        if (virHashUpdateEntry(set, uuidstr, obj) < 0)
+            goto error;
+    }
+    return;
+
+error:
+    VIR_WARN("Unable to index metadata of domain %s, disabling the index",
+             obj->def->name);
+    virResetLastError();
+    virStringFreeList(doms->metaURIs);
+    doms->metaURIs = NULL;
+    virHashRemoveAll(doms->objsMeta);
+}
+
+
+/*
+ * Keep an index of the domains of @doms by the text content of their
+ * <metadata> elements in the namespaces @uris, a NULL terminated list,
+ * or none if @uris is NULL. virConnectListAllDomainsFiltered uses it
+ * to find the domains matching VIR_CONNECT_LIST_DOMAINS_FILTER_METADATA_VALUE
+ * filters without checking every domain.
+ *
+ * Domains are indexed as they are added and their definition replaced
+ * by virDomainAssignDef; drivers changing the definition of a domain
+ * in any other way must call virDomainObjListUpdateMetadataIndex.
+ */
+int
+virDomainObjListSetMetadataIndex(virDomainObjListPtr doms,
+                                 const char *const *uris)
+{
+    char **copy = NULL;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
+    size_t n = 0;
+    int i;
+
+    if (uris) {
+        while (uris[n])
+            n++;
+        if (VIR_ALLOC_N(copy, n + 1) < 0)
+            goto no_memory;
+        for (i = 0; i < n; i++) {
+            if (!(copy[i] = strdup(uris[i])))
+                goto no_memory;
+        }
+    }
+
+    virMutexLock(&doms->metaLock);
+    virStringFreeList(doms->metaURIs);
+    doms->metaURIs = copy;
+    virHashRemoveAll(doms->objsMeta);
+    virMutexUnlock(&doms->metaLock);
+    copy = NULL;
+
+    if (virDomainObjListCollect(doms, &vms, &nvms, 0) < 0)
+        return -1;
+
+    for (i = 0; i < nvms; i++) {
+        virDomainObjLock(vms[i]);
+        virDomainObjListUpdateMetadataIndex(doms, vms[i]);
+        virDomainObjUnlock(vms[i]);
+        virObjectUnref(vms[i]);
+    }
+    VIR_FREE(vms);
+
+    return 0;
+
+no_memory:
+    virReportOOMError();
+    virStringFreeList(copy);
+    return -1;
+}
+
+
+/* Reindex the metadata of @obj, whose lock must be held, after its
+ * definition changed, see virDomainObjListSetMetadataIndex */
+void
+virDomainObjListUpdateMetadataIndex(virDomainObjListPtr doms,
+                                    virDomainObjPtr obj)
+{
+    virMutexLock(&doms->metaLock);
+    virDomainObjListMetaUpdateLocked(doms, obj, false);
+    virMutexUnlock(&doms->metaLock);
+}
+
+
+static int
+virDomainObjListIDCacheMatch(const void *payload,
+                             const void *name ATTRIBUTE_UNUSED,
+                             const void *data)
+{
+    return payload == data;
+}
+
+
+struct virDomainObjListSearchIDData {
+    virHashTablePtr cache;
+    int id;
+};
+
+/* Besides looking for the wanted ID, re-record every running domain
+ * seen on the way, so a single miss refills the whole ID cache */
 static int virDomainObjListSearchID(const void *payload,
                                     const void *name ATTRIBUTE_UNUSED,
                                     const void *data)
 {
     virDomainObjPtr obj = (virDomainObjPtr)payload;
-    const int *id = data;
+    const struct virDomainObjListSearchIDData *search = data;
+    char idstr[INT_BUFSIZE_BOUND(int)];
     int want = 0;
 
     virDomainObjLock(obj);
-    if (virDomainObjIsActive(obj) &&
-        obj->def->id == *id)
-        want = 1;
+    if (virDomainObjIsActive(obj) && !obj->removing) {
+        snprintf(idstr, sizeof(idstr), "%d", obj->def->id);
+        ignore_value(virHashUpdateEntry(search->cache, idstr, obj));
+        if (obj->def->id == search->id)
+            want = 1;
+    }
     virDomainObjUnlock(obj);
     return want;
 }
@@ -800,15 +1286,35 @@ virDomainObjPtr virDomainFindByID(const virDomainObjListPtr doms,
                                   int id)
 {
     virDomainObjPtr obj;
-    obj = virHashSearch(doms->objs, virDomainObjListSearchID, &id);
+    struct virDomainObjListSearchIDData search = { doms->objsID, id };
+    char idstr[INT_BUFSIZE_BOUND(int)];
+
+    snprintf(idstr, sizeof(idstr), "%d", id);
+
+    virMutexLock(&doms->lock);
+    if ((obj = virHashLookup(doms->objsID, idstr))) {
+        virDomainObjLock(obj);
+        if (virDomainObjIsActive(obj) && !obj->removing &&
+            obj->def->id == id)
+            goto cleanup;
+        virDomainObjUnlock(obj);
+    }
+
+    /* The cache is stale, drop it and rebuild it from scratch */
+    virHashRemoveAll(doms->objsID);
+    obj = virHashSearch(doms->objs, virDomainObjListSearchID, &search);
     if (obj)
         virDomainObjLock(obj);
+
+cleanup:
+    virMutexUnlock(&doms->lock);
     return obj;
 }
 
 
-virDomainObjPtr virDomainFindByUUID(const virDomainObjListPtr doms,
-                                    const unsigned char *uuid)
+static virDomainObjPtr
+virDomainFindByUUIDLocked(const virDomainObjListPtr doms,
+                          const unsigned char *uuid)
 {
     char uuidstr[VIR_UUID_STRING_BUFLEN];
     virDomainObjPtr obj;
@@ -816,32 +1322,42 @@ virDomainObjPtr virDomainFindByUUID(const virDomainObjListPtr doms,
     virUUIDFormat(uuid, uuidstr);
 
     obj = virHashLookup(doms->objs, uuidstr);
-    if (obj)
+    if (obj) {
         virDomainObjLock(obj);
+        if (obj->removing) {
+            virDomainObjUnlock(obj);
+            obj = NULL;
+        }
+    }
     return obj;
 }
 
-static int virDomainObjListSearchName(const void *payload,
-                                      const void *name ATTRIBUTE_UNUSED,
-                                      const void *data)
+virDomainObjPtr virDomainFindByUUID(const virDomainObjListPtr doms,
+                                    const unsigned char *uuid)
 {
-    virDomainObjPtr obj = (virDomainObjPtr)payload;
-    int want = 0;
+    virDomainObjPtr obj;
 
-    virDomainObjLock(obj);
-    if (STREQ(obj->def->name, (const char *)data))
-        want = 1;
-    virDomainObjUnlock(obj);
-    return want;
+    virMutexLock(&doms->lock);
+    obj = virDomainFindByUUIDLocked(doms, uuid);
+    virMutexUnlock(&doms->lock);
+    return obj;
 }
 
 virDomainObjPtr virDomainFindByName(const virDomainObjListPtr doms,
                                     const char *name)
 {
     virDomainObjPtr obj;
-    obj = virHashSearch(doms->objs, virDomainObjListSearchName, name);
-    if (obj)
+
+    virMutexLock(&doms->lock);
+    obj = virHashLookup(doms->objsName, name);
+    if (obj) {
         virDomainObjLock(obj);
+        if (obj->removing) {
+            virDomainObjUnlock(obj);
+            obj = NULL;
+        }
+    }
+    virMutexUnlock(&doms->lock);
     return obj;
 }
 
@@ -1036,6 +1552,7 @@ void virDomainFSDefFree(virDomainFSDefPtr def)
 
     VIR_FREE(def->src);
     VIR_FREE(def->dst);
+    VIR_FREE(def->fstype);
     virDomainDeviceInfoClear(&def->info);
 
     VIR_FREE(def);
@@ -1634,6 +2151,9 @@ void virDomainDefFree(virDomainDefPtr def)
     if (!def)
         return;
 
+    virHashFree(def->diskIndex);
+    virHashFree(def->netIndex);
+
     /* hostdevs must be freed before nets (or any future "intelligent
      * hostdevs") because the pointer to the hostdev is really
      * pointing into the middle of the higher level device's object,
@@ -1730,9 +2250,12 @@ void virDomainDefFree(virDomainDefPtr def)
     VIR_FREE(def->description);
     VIR_FREE(def->title);
 
-    virBlkioDeviceWeightArrayClear(def->blkio.devices,
-                                   def->blkio.ndevices);
+    virBlkioDeviceArrayClear(def->blkio.devices,
+                             def->blkio.ndevices);
     VIR_FREE(def->blkio.devices);
+    virBlkioThrottleGroupArrayClear(def->blkio.groups,
+                                    def->blkio.ngroups);
+    VIR_FREE(def->blkio.groups);
 
     virDomainWatchdogDefFree(def->watchdog);
 
@@ -1748,7 +2271,17 @@ void virDomainDefFree(virDomainDefPtr def)
 
     virDomainVcpuPinDefFree(def->cputune.emulatorpin);
 
+    virDomainVcpuPinDefArrayFree(def->cputune.iothreadpin,
+                                 def->cputune.niothreadpin);
+
     virBitmapFree(def->numatune.memory.nodemask);
+    for (i = 0; i < def->numatune.nmem_nodes; i++)
+        virBitmapFree(def->numatune.mem_nodes[i].nodemask);
+    VIR_FREE(def->numatune.mem_nodes);
+
+    for (i = 0; i < def->mem.nhugepages; i++)
+        virBitmapFree(def->mem.hugepages[i].nodemask);
+    VIR_FREE(def->mem.hugepages);
 
     virSysinfoDefFree(def->sysinfo);
 
@@ -1759,6 +2292,8 @@ void virDomainDefFree(virDomainDefPtr def)
 
     xmlFreeNode(def->metadata);
 
+    VIR_FREE(def->xmlCache);
+
     VIR_FREE(def);
 }
 
@@ -1846,23 +2381,25 @@ virDomainObjPtr virDomainAssignDef(virCapsPtr caps,
                                    bool live)
 {
     virDomainObjPtr domain;
-    char uuidstr[VIR_UUID_STRING_BUFLEN];
 
-    if ((domain = virDomainFindByUUID(doms, def->uuid))) {
+    virMutexLock(&doms->lock);
+    if ((domain = virDomainFindByUUIDLocked(doms, def->uuid))) {
         virDomainObjAssignDef(domain, def, live);
-        return domain;
+        virDomainObjListUpdateMetadataIndex(doms, domain);
+        goto cleanup;
     }
 
     if (!(domain = virDomainObjNew(caps)))
-        return NULL;
+        goto cleanup;
     domain->def = def;
 
-    virUUIDFormat(def->uuid, uuidstr);
-    if (virHashAddEntry(doms->objs, uuidstr, domain) < 0) {
+    if (virDomainObjListAddLocked(doms, domain) < 0) {
         VIR_FREE(domain);
-        return NULL;
+        goto cleanup;
     }
 
+cleanup:
+    virMutexUnlock(&doms->lock);
     return domain;
 }
 
@@ -1976,19 +2513,51 @@ cleanup:
 }
 
 /*
- * The caller must hold a lock on the driver owning 'doms',
- * and must also have locked 'dom', to ensure no one else
- * is either waiting for 'dom' or still using it
+ * Drop @dom, whose lock must be held along with the list lock, from
+ * every index of @doms. Nothing is done if @dom is no longer listed,
+ * for instance because a new domain with the same UUID replaced it.
  */
-void virDomainRemoveInactive(virDomainObjListPtr doms,
+static void
+virDomainObjListRemoveLocked(virDomainObjListPtr doms,
                              virDomainObjPtr dom)
 {
     char uuidstr[VIR_UUID_STRING_BUFLEN];
     virUUIDFormat(dom->def->uuid, uuidstr);
 
+    if (virHashLookup(doms->objs, uuidstr) != dom)
+        return;
+
+    if (virHashLookup(doms->objsName, dom->def->name) == dom)
+        virHashRemoveEntry(doms->objsName, dom->def->name);
+    virHashRemoveSet(doms->objsID, virDomainObjListIDCacheMatch, dom);
+    virMutexLock(&doms->metaLock);
+    virDomainObjListMetaUpdateLocked(doms, dom, true);
+    virMutexUnlock(&doms->metaLock);
+    if (virHashRemoveEntry(doms->objs, uuidstr) == 0)
+        virAtomicIntInc(&doms->generation);
+}
+
+/*
+ * The caller must have locked 'dom', which is returned unlocked
+ * and must not be used again. Since the list lock has to be
+ * acquired before 'dom' is locked, 'dom' is briefly released;
+ * it is marked as being removed first, so that lookups made in
+ * the meantime skip it rather than hand out a domain that is
+ * half way through being undefined.
+ */
+void virDomainRemoveInactive(virDomainObjListPtr doms,
+                             virDomainObjPtr dom)
+{
+    dom->removing = 1;
+    virObjectRef(dom);
     virDomainObjUnlock(dom);
 
-    virHashRemoveEntry(doms->objs, uuidstr);
+    virMutexLock(&doms->lock);
+    virDomainObjLock(dom);
+    virDomainObjListRemoveLocked(doms, dom);
+    virDomainObjUnlock(dom);
+    virObjectUnref(dom);
+    virMutexUnlock(&doms->lock);
 }
 
 
@@ -3611,6 +4180,7 @@ virDomainDiskDefParseXML(virCapsPtr caps,
     char *ioeventfd = NULL;
     char *event_idx = NULL;
     char *copy_on_read = NULL;
+    char *iothread = NULL;
     char *mirror = NULL;
     char *mirrorFormat = NULL;
     bool mirroring = false;
@@ -3848,6 +4418,7 @@ virDomainDiskDefParseXML(virCapsPtr caps,
                 ioeventfd = virXMLPropString(cur, "ioeventfd");
                 event_idx = virXMLPropString(cur, "event_idx");
                 copy_on_read = virXMLPropString(cur, "copy_on_read");
+                iothread = virXMLPropString(cur, "iothread");
             } else if (!mirror && xmlStrEqual(cur->name, BAD_CAST "mirror") &&
                        !(flags & VIR_DOMAIN_XML_INACTIVE)) {
                 char *ready;
@@ -4265,9 +4836,24 @@ virDomainDiskDefParseXML(virCapsPtr caps,
         def->copy_on_read = cor;
     }
 
-    if (devaddr) {
-        if (virDomainParseLegacyDeviceAddress(devaddr,
-                                              &def->info.addr.pci) < 0) {
+    if (iothread) {
+        if (def->bus != VIR_DOMAIN_DISK_BUS_VIRTIO) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("disk iothread is supported only for virtio bus"));
+            goto error;
+        }
+
+        if (virStrToLong_ui(iothread, NULL, 10, &def->iothread) < 0 ||
+            def->iothread == 0) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                           _("invalid disk iothread '%s'"), iothread);
+            goto error;
+        }
+    }
+
+    if (devaddr) {
+        if (virDomainParseLegacyDeviceAddress(devaddr,
+                                              &def->info.addr.pci) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("Unable to parse devaddr parameter '%s'"),
                            devaddr);
@@ -4393,6 +4979,7 @@ cleanup:
     VIR_FREE(ioeventfd);
     VIR_FREE(event_idx);
     VIR_FREE(copy_on_read);
+    VIR_FREE(iothread);
     VIR_FREE(devaddr);
     VIR_FREE(serial);
     virStorageEncryptionFree(encryption);
@@ -4950,6 +5537,7 @@ virDomainNetDefParseXML(virCapsPtr caps,
     char *model = NULL;
     char *backend = NULL;
     char *txmode = NULL;
+    char *queues = NULL;
     char *ioeventfd = NULL;
     char *event_idx = NULL;
     char *filter = NULL;
@@ -5063,6 +5651,7 @@ virDomainNetDefParseXML(virCapsPtr caps,
                 txmode = virXMLPropString(cur, "txmode");
                 ioeventfd = virXMLPropString(cur, "ioeventfd");
                 event_idx = virXMLPropString(cur, "event_idx");
+                queues = virXMLPropString(cur, "queues");
             } else if (xmlStrEqual(cur->name, BAD_CAST "filterref")) {
                 if (filter) {
                     virReportError(VIR_ERR_XML_ERROR, "%s",
@@ -5352,6 +5941,17 @@ virDomainNetDefParseXML(virCapsPtr caps,
             }
             def->driver.virtio.event_idx = idx;
         }
+        if (queues) {
+            unsigned int q;
+            if (virStrToLong_ui(queues, NULL, 10, &q) < 0 || q == 0) {
+                virReportError(VIR_ERR_XML_ERROR,
+                               _("malformed interface <driver queues='%s'>"),
+                               queues);
+                goto error;
+            }
+            if (q > 1)
+                def->driver.virtio.queues = q;
+        }
     }
 
     def->linkstate = VIR_DOMAIN_NET_INTERFACE_LINK_STATE_DEFAULT;
@@ -5405,6 +6005,7 @@ cleanup:
     VIR_FREE(txmode);
     VIR_FREE(ioeventfd);
     VIR_FREE(event_idx);
+    VIR_FREE(queues);
     VIR_FREE(filter);
     VIR_FREE(type);
     VIR_FREE(internal);
@@ -8101,14 +8702,107 @@ virDomainHostdevFind(virDomainDefPtr def,
     return *found ? i : -1;
 }
 
+/*
+ * Guests with many disks or NICs get a hash from name to array index
+ * for virDomainDiskIndexByName and virDomainNetFindIdx. Some drivers
+ * still edit the device arrays directly, so the index is only a hint:
+ * it is dropped whenever the array length changes, every hit is checked
+ * against the array, and anything it cannot answer falls back to the
+ * linear scan.
+ */
+#define VIR_DOMAIN_DEVICE_INDEX_MIN 16
+#define VIR_DOMAIN_DEVICE_INDEX_AMBIGUOUS ((void *)(intptr_t)-1)
+
+static int
+virDomainDeviceIndexAdd(virHashTablePtr table, const char *key, size_t i)
+{
+    void *cur = virHashLookup(table, key);
+
+    if (!cur)
+        return virHashAddEntry(table, key, (void *)(intptr_t)(i + 1));
+    if (cur != VIR_DOMAIN_DEVICE_INDEX_AMBIGUOUS)
+        return virHashUpdateEntry(table, key,
+                                  VIR_DOMAIN_DEVICE_INDEX_AMBIGUOUS);
+    return 0;
+}
+
+/* Returns the array index stored for @key, -1 if the key is missing
+ * or -2 if it is shared by several devices */
+static int
+virDomainDeviceIndexLookup(virHashTablePtr table, const char *key)
+{
+    void *hit = virHashLookup(table, key);
+
+    if (!hit)
+        return -1;
+    if (hit == VIR_DOMAIN_DEVICE_INDEX_AMBIGUOUS)
+        return -2;
+    return (intptr_t)hit - 1;
+}
+
+static void
+virDomainDiskIndexInvalidate(virDomainDefPtr def)
+{
+    virHashFree(def->diskIndex);
+    def->diskIndex = NULL;
+}
+
+/* Disks are indexed by target and, for local images, by source path;
+ * the leading slash keeps the two from colliding */
+static virHashTablePtr
+virDomainDiskIndexGet(virDomainDefPtr def)
+{
+    virHashTablePtr table;
+    size_t i;
+
+    if (def->ndisks < VIR_DOMAIN_DEVICE_INDEX_MIN)
+        return NULL;
+    if (def->diskIndex && def->diskIndexCount == def->ndisks)
+        return def->diskIndex;
+
+    virDomainDiskIndexInvalidate(def);
+    if (!(table = virHashCreate(def->ndisks * 2, NULL)))
+        return NULL;
+
+    for (i = 0; i < def->ndisks; i++) {
+        virDomainDiskDefPtr disk = def->disks[i];
+
+        if (virDomainDeviceIndexAdd(table, disk->dst, i) < 0 ||
+            (disk->src && disk->src[0] == '/' &&
+             virDomainDeviceIndexAdd(table, disk->src, i) < 0)) {
+            virHashFree(table);
+            return NULL;
+        }
+    }
+
+    def->diskIndex = table;
+    def->diskIndexCount = def->ndisks;
+    return table;
+}
+
 int
 virDomainDiskIndexByName(virDomainDefPtr def, const char *name,
                          bool allow_ambiguous)
 {
     virDomainDiskDefPtr vdisk;
+    bool missed = false;
     int i;
     int candidate = -1;
 
+    if (virDomainDiskIndexGet(def)) {
+        i = virDomainDeviceIndexLookup(def->diskIndex, name);
+        if (i >= 0) {
+            vdisk = def->disks[i];
+            if (*name != '/' ? STREQ(vdisk->dst, name)
+                             : STREQ_NULLABLE(vdisk->src, name))
+                return i;
+            /* A disk was changed in place, start over */
+            virDomainDiskIndexInvalidate(def);
+        } else {
+            missed = i == -1;
+        }
+    }
+
     /* We prefer the <target dev='name'/> name (it's shorter, required
      * for all disks, and should be unambiguous), but also support
      * <source file='name'/> (if unambiguous).  Assume dst if there is
@@ -8116,17 +8810,24 @@ virDomainDiskIndexByName(virDomainDefPtr def, const char *name,
     for (i = 0; i < def->ndisks; i++) {
         vdisk = def->disks[i];
         if (*name != '/') {
-            if (STREQ(vdisk->dst, name))
+            if (STREQ(vdisk->dst, name)) {
+                if (missed)
+                    virDomainDiskIndexInvalidate(def);
                 return i;
+            }
         } else if (vdisk->src &&
                    STREQ(vdisk->src, name)) {
-            if (allow_ambiguous)
-                return i;
-            if (candidate >= 0)
+            if (candidate >= 0 && !allow_ambiguous)
                 return -1;
             candidate = i;
+            if (allow_ambiguous)
+                break;
         }
     }
+
+    /* Found by the scan but not the index, so the index is stale */
+    if (missed && candidate >= 0)
+        virDomainDiskIndexInvalidate(def);
     return candidate;
 }
 
@@ -8185,6 +8886,8 @@ void virDomainDiskInsertPreAlloced(virDomainDefPtr def,
     if (insertAt == -1)
         insertAt = def->ndisks;
 
+    virDomainDiskIndexInvalidate(def);
+
     if (insertAt < def->ndisks)
         memmove(def->disks + insertAt + 1,
                 def->disks + insertAt,
@@ -8200,6 +8903,8 @@ virDomainDiskRemove(virDomainDefPtr def, size_t i)
 {
     virDomainDiskDefPtr disk = def->disks[i];
 
+    virDomainDiskIndexInvalidate(def);
+
     if (def->ndisks > 1) {
         memmove(def->disks + i,
                 def->disks + i + 1,
@@ -8237,8 +8942,46 @@ virDomainHasDiskMirror(virDomainObjPtr vm)
     return false;
 }
 
+static void
+virDomainNetIndexInvalidate(virDomainDefPtr def)
+{
+    virHashFree(def->netIndex);
+    def->netIndex = NULL;
+}
+
+/* NICs are indexed by MAC address */
+static virHashTablePtr
+virDomainNetIndexGet(virDomainDefPtr def)
+{
+    virHashTablePtr table;
+    char macstr[VIR_MAC_STRING_BUFLEN];
+    size_t i;
+
+    if (def->nnets < VIR_DOMAIN_DEVICE_INDEX_MIN)
+        return NULL;
+    if (def->netIndex && def->netIndexCount == def->nnets)
+        return def->netIndex;
+
+    virDomainNetIndexInvalidate(def);
+    if (!(table = virHashCreate(def->nnets, NULL)))
+        return NULL;
+
+    for (i = 0; i < def->nnets; i++) {
+        virMacAddrFormat(&def->nets[i]->mac, macstr);
+        if (virDomainDeviceIndexAdd(table, macstr, i) < 0) {
+            virHashFree(table);
+            return NULL;
+        }
+    }
+
+    def->netIndex = table;
+    def->netIndexCount = def->nnets;
+    return table;
+}
+
 int virDomainNetInsert(virDomainDefPtr def, virDomainNetDefPtr net)
 {
+    virDomainNetIndexInvalidate(def);
     if (VIR_REALLOC_N(def->nets, def->nnets + 1) < 0)
         return -1;
     def->nets[def->nnets]  = net;
@@ -8263,6 +9006,27 @@ virDomainNetFindIdx(virDomainDefPtr def, virDomainNetDefPtr net)
     int ii, matchidx = -1;
     bool PCIAddrSpecified = virDomainDeviceAddressIsValid(&net->info,
                                                           VIR_DOMAIN_DEVICE_ADDRESS_TYPE_PCI);
+    virHashTablePtr table;
+    char macstr[VIR_MAC_STRING_BUFLEN];
+    bool missed = false;
+
+    /* A MAC address held by just one NIC decides the answer alone */
+    if ((table = virDomainNetIndexGet(def))) {
+        virMacAddrFormat(&net->mac, macstr);
+        if ((ii = virDomainDeviceIndexLookup(table, macstr)) == -1) {
+            /* Only stale if the scan below finds it */
+            missed = true;
+        } else if (ii >= 0) {
+            if (!virMacAddrCmp(&def->nets[ii]->mac, &net->mac)) {
+                if (PCIAddrSpecified &&
+                    !virDevicePCIAddressEqual(&def->nets[ii]->info.addr.pci,
+                                              &net->info.addr.pci))
+                    return -1;
+                return ii;
+            }
+            virDomainNetIndexInvalidate(def);
+        }
+    }
 
     for (ii = 0 ; ii < def->nnets ; ii++) {
         if (virMacAddrCmp(&def->nets[ii]->mac, &net->mac))
@@ -8292,6 +9056,9 @@ virDomainNetFindIdx(virDomainDefPtr def, virDomainNetDefPtr net)
             matchidx = ii;
         }
     }
+
+    if (missed && matchidx >= 0)
+        virDomainNetIndexInvalidate(def);
     return matchidx;
 }
 
@@ -8300,6 +9067,8 @@ virDomainNetRemove(virDomainDefPtr def, size_t i)
 {
     virDomainNetDefPtr net = def->nets[i];
 
+    virDomainNetIndexInvalidate(def);
+
     if (net->type == VIR_DOMAIN_NET_TYPE_HOSTDEV) {
         /* hostdev net devices are normally also be in the hostdevs
          * array, but might have already been removed by the time we
@@ -8722,6 +9491,255 @@ error:
     goto cleanup;
 }
 
+/* Parse the XML definition for an iothreadpin, which has the form of
+ *
+ *   <iothreadpin iothread='1' cpuset='0'/>
+ *
+ * The iothread id is stored in the vcpuid field and must refer to
+ * one of the @iothreads declared by <iothreads>.
+ */
+static virDomainVcpuPinDefPtr
+virDomainIOThreadPinDefParseXML(const xmlNodePtr node,
+                                xmlXPathContextPtr ctxt,
+                                unsigned int iothreads)
+{
+    virDomainVcpuPinDefPtr def;
+    xmlNodePtr oldnode = ctxt->node;
+    unsigned int iothreadid;
+    char *tmp = NULL;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    ctxt->node = node;
+
+    if (virXPathUInt("string(./@iothread)", ctxt, &iothreadid) < 0) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing or invalid iothread id for iothreadpin"));
+        goto error;
+    }
+
+    if (iothreadid == 0 || iothreadid > iothreads) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("iothread id %u must be between 1 and %u"),
+                       iothreadid, iothreads);
+        goto error;
+    }
+
+    def->vcpuid = iothreadid;
+
+    if (!(tmp = virXMLPropString(node, "cpuset"))) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing cpuset for iothreadpin"));
+        goto error;
+    }
+
+    if (virBitmapParse(tmp, 0, &def->cpumask, VIR_DOMAIN_CPUMASK_LEN) < 0)
+        goto error;
+
+cleanup:
+    VIR_FREE(tmp);
+    ctxt->node = oldnode;
+    return def;
+
+error:
+    virDomainVcpuPinDefFree(def);
+    def = NULL;
+    goto cleanup;
+}
+
+/* Parse one huge page size of <memoryBacking>, which has the form of
+ *
+ *   <page size='1' unit='GiB' nodeset='0-1'/>
+ *
+ * The size defaults to KiB, the optional nodeset lists guest NUMA cells.
+ */
+static int
+virDomainHugePageParseXML(xmlNodePtr node,
+                          virDomainHugePagePtr hugepage)
+{
+    char *size = NULL;
+    char *unit = NULL;
+    char *nodeset = NULL;
+    unsigned long long bytes;
+    int ret = -1;
+
+    if (!(size = virXMLPropString(node, "size"))) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("missing size for hugepage"));
+        goto cleanup;
+    }
+
+    unit = virXMLPropString(node, "unit");
+
+    if (virStrToLong_ull(size, NULL, 10, &bytes) < 0 ||
+        virScaleInteger(&bytes, unit, 1024, ULLONG_MAX) < 0 ||
+        bytes < 1024) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("invalid hugepage size '%s'"), size);
+        goto cleanup;
+    }
+
+    hugepage->size = bytes / 1024;
+
+    if ((nodeset = virXMLPropString(node, "nodeset")) &&
+        virBitmapParse(nodeset, 0, &hugepage->nodemask,
+                       VIR_DOMAIN_CPUMASK_LEN) < 0)
+        goto cleanup;
+
+    ret = 0;
+cleanup:
+    VIR_FREE(size);
+    VIR_FREE(unit);
+    VIR_FREE(nodeset);
+    return ret;
+}
+
+/* Parse the binding of one guest NUMA cell to host nodes, which has
+ * the form of
+ *
+ *   <memnode cellid='0' mode='strict' nodeset='1'/>
+ */
+static int
+virDomainNumatuneMemNodeParseXML(virDomainDefPtr def,
+                                 xmlNodePtr node)
+{
+    virDomainNumatuneMemNodePtr mem_node;
+    char *cellid = NULL;
+    char *mode = NULL;
+    char *nodeset = NULL;
+    unsigned int cell;
+    int ret = -1;
+
+    if (!(cellid = virXMLPropString(node, "cellid")) ||
+        virStrToLong_ui(cellid, NULL, 10, &cell) < 0 ||
+        cell >= def->maxvcpus) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("invalid cellid '%s' for memnode"),
+                       NULLSTR(cellid));
+        goto cleanup;
+    }
+
+    if (cell >= def->numatune.nmem_nodes &&
+        VIR_EXPAND_N(def->numatune.mem_nodes, def->numatune.nmem_nodes,
+                     cell + 1 - def->numatune.nmem_nodes) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    mem_node = &def->numatune.mem_nodes[cell];
+
+    if (mem_node->nodemask) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("duplicate memnode for cellid %u"), cell);
+        goto cleanup;
+    }
+
+    if ((mode = virXMLPropString(node, "mode")) &&
+        (mem_node->mode = virDomainNumatuneMemModeTypeFromString(mode)) < 0) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Unsupported NUMA memory tuning mode '%s'"), mode);
+        goto cleanup;
+    }
+
+    if (!(nodeset = virXMLPropString(node, "nodeset"))) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("missing nodeset for memnode of cellid %u"), cell);
+        goto cleanup;
+    }
+
+    if (virBitmapParse(nodeset, 0, &mem_node->nodemask,
+                       VIR_DOMAIN_CPUMASK_LEN) < 0)
+        goto cleanup;
+
+    ret = 0;
+cleanup:
+    VIR_FREE(cellid);
+    VIR_FREE(mode);
+    VIR_FREE(nodeset);
+    return ret;
+}
+
+/* Check <memnode> and hugepage nodesets against the guest NUMA cells,
+ * which are only known once <cpu> has been parsed. */
+static int
+virDomainDefCheckNUMACells(virDomainDefPtr def)
+{
+    size_t ncells = def->cpu ? def->cpu->ncells : 0;
+    virBitmapPtr seen = NULL;
+    bool haveDefault = false;
+    size_t i;
+    ssize_t cell;
+    int ret = -1;
+
+    for (i = 0; i < def->numatune.nmem_nodes; i++) {
+        if (def->numatune.mem_nodes[i].nodemask && i >= ncells) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("memnode cellid %zu is not a guest NUMA cell"),
+                           i);
+            goto cleanup;
+        }
+    }
+
+    if (!(seen = virBitmapNew(VIR_DOMAIN_CPUMASK_LEN))) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0; i < def->mem.nhugepages; i++) {
+        virBitmapPtr nodemask = def->mem.hugepages[i].nodemask;
+
+        if (!nodemask) {
+            if (haveDefault) {
+                virReportError(VIR_ERR_XML_ERROR, "%s",
+                               _("only one hugepage size may omit nodeset"));
+                goto cleanup;
+            }
+            haveDefault = true;
+            continue;
+        }
+
+        cell = -1;
+        while ((cell = virBitmapNextSetBit(nodemask, cell)) >= 0) {
+            bool dup;
+
+            if ((size_t) cell >= ncells) {
+                virReportError(VIR_ERR_XML_ERROR,
+                               _("hugepage nodeset refers to guest NUMA "
+                                 "cell %zd which does not exist"), cell);
+                goto cleanup;
+            }
+
+            if (virBitmapGetBit(seen, cell, &dup) < 0 || dup) {
+                virReportError(VIR_ERR_XML_ERROR,
+                               _("guest NUMA cell %zd has more than one "
+                                 "hugepage size"), cell);
+                goto cleanup;
+            }
+            ignore_value(virBitmapSetBit(seen, cell));
+        }
+    }
+
+    ret = 0;
+cleanup:
+    virBitmapFree(seen);
+    return ret;
+}
+
+bool
+virDomainNumatuneHasMemNodes(virDomainNumatuneDefPtr numatune)
+{
+    size_t i;
+
+    for (i = 0; i < numatune->nmem_nodes; i++) {
+        if (numatune->mem_nodes[i].nodemask)
+            return true;
+    }
+
+    return false;
+}
+
 /*
  * Return the vcpupin related with the vcpu id on SUCCESS, or
  * NULL on failure.
@@ -8817,18 +9835,143 @@ cleanup:
 }
 
 
-static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
-                                            xmlDocPtr xml,
-                                            xmlNodePtr root,
-                                            xmlXPathContextPtr ctxt,
-                                            unsigned int expectedVirtTypes,
-                                            unsigned int flags)
+/* Children of <devices> we know how to parse, in parsing order */
+enum virDomainDevicesNode {
+    VIR_DOMAIN_DEVICES_NODE_DISK,
+    VIR_DOMAIN_DEVICES_NODE_CONTROLLER,
+    VIR_DOMAIN_DEVICES_NODE_LEASE,
+    VIR_DOMAIN_DEVICES_NODE_FILESYSTEM,
+    VIR_DOMAIN_DEVICES_NODE_INTERFACE,
+    VIR_DOMAIN_DEVICES_NODE_SMARTCARD,
+    VIR_DOMAIN_DEVICES_NODE_PARALLEL,
+    VIR_DOMAIN_DEVICES_NODE_SERIAL,
+    VIR_DOMAIN_DEVICES_NODE_CONSOLE,
+    VIR_DOMAIN_DEVICES_NODE_CHANNEL,
+    VIR_DOMAIN_DEVICES_NODE_INPUT,
+    VIR_DOMAIN_DEVICES_NODE_GRAPHICS,
+    VIR_DOMAIN_DEVICES_NODE_SOUND,
+    VIR_DOMAIN_DEVICES_NODE_VIDEO,
+    VIR_DOMAIN_DEVICES_NODE_HOSTDEV,
+    VIR_DOMAIN_DEVICES_NODE_WATCHDOG,
+    VIR_DOMAIN_DEVICES_NODE_MEMBALLOON,
+    VIR_DOMAIN_DEVICES_NODE_HUB,
+    VIR_DOMAIN_DEVICES_NODE_REDIRDEV,
+    VIR_DOMAIN_DEVICES_NODE_REDIRFILTER,
+
+    VIR_DOMAIN_DEVICES_NODE_LAST
+};
+
+static const char *const virDomainDevicesNodeNames[] = {
+    [VIR_DOMAIN_DEVICES_NODE_DISK] = "disk",
+    [VIR_DOMAIN_DEVICES_NODE_CONTROLLER] = "controller",
+    [VIR_DOMAIN_DEVICES_NODE_LEASE] = "lease",
+    [VIR_DOMAIN_DEVICES_NODE_FILESYSTEM] = "filesystem",
+    [VIR_DOMAIN_DEVICES_NODE_INTERFACE] = "interface",
+    [VIR_DOMAIN_DEVICES_NODE_SMARTCARD] = "smartcard",
+    [VIR_DOMAIN_DEVICES_NODE_PARALLEL] = "parallel",
+    [VIR_DOMAIN_DEVICES_NODE_SERIAL] = "serial",
+    [VIR_DOMAIN_DEVICES_NODE_CONSOLE] = "console",
+    [VIR_DOMAIN_DEVICES_NODE_CHANNEL] = "channel",
+    [VIR_DOMAIN_DEVICES_NODE_INPUT] = "input",
+    [VIR_DOMAIN_DEVICES_NODE_GRAPHICS] = "graphics",
+    [VIR_DOMAIN_DEVICES_NODE_SOUND] = "sound",
+    [VIR_DOMAIN_DEVICES_NODE_VIDEO] = "video",
+    [VIR_DOMAIN_DEVICES_NODE_HOSTDEV] = "hostdev",
+    [VIR_DOMAIN_DEVICES_NODE_WATCHDOG] = "watchdog",
+    [VIR_DOMAIN_DEVICES_NODE_MEMBALLOON] = "memballoon",
+    [VIR_DOMAIN_DEVICES_NODE_HUB] = "hub",
+    [VIR_DOMAIN_DEVICES_NODE_REDIRDEV] = "redirdev",
+    [VIR_DOMAIN_DEVICES_NODE_REDIRFILTER] = "redirfilter",
+};
+verify(ARRAY_CARDINALITY(virDomainDevicesNodeNames) ==
+       VIR_DOMAIN_DEVICES_NODE_LAST);
+
+typedef struct _virDomainDevicesNodes virDomainDevicesNodes;
+struct _virDomainDevicesNodes {
+    xmlNodePtr *nodes[VIR_DOMAIN_DEVICES_NODE_LAST];
+    size_t nnodes[VIR_DOMAIN_DEVICES_NODE_LAST];
+    size_t nodes_max[VIR_DOMAIN_DEVICES_NODE_LAST];
+};
+
+/* Sort the children of <devices> by element name in a single walk,
+ * rather than evaluating one XPath expression per device type, each
+ * of which has to go over every device again. Nodes keep document
+ * order, just like "./devices/<name>" would return them. */
+static int
+virDomainDevicesNodesCollect(xmlXPathContextPtr ctxt,
+                             virDomainDevicesNodes *devices)
 {
-    xmlNodePtr *nodes = NULL, node = NULL;
-    char *tmp = NULL;
-    int i, n;
-    long id = -1;
-    virDomainDefPtr def;
+    xmlNodePtr *parents = NULL;
+    xmlNodePtr cur;
+    int nparents;
+    int i, type;
+
+    if ((nparents = virXPathNodeSet("./devices", ctxt, &parents)) < 0)
+        return -1;
+
+    for (i = 0 ; i < nparents ; i++) {
+        for (cur = parents[i]->children ; cur ; cur = cur->next) {
+            if (cur->type != XML_ELEMENT_NODE)
+                continue;
+
+            for (type = 0 ; type < VIR_DOMAIN_DEVICES_NODE_LAST ; type++) {
+                if (xmlStrEqual(cur->name,
+                                BAD_CAST virDomainDevicesNodeNames[type]))
+                    break;
+            }
+            if (type == VIR_DOMAIN_DEVICES_NODE_LAST)
+                continue;
+
+            if (VIR_RESIZE_N(devices->nodes[type], devices->nodes_max[type],
+                             devices->nnodes[type], 1) < 0) {
+                virReportOOMError();
+                VIR_FREE(parents);
+                return -1;
+            }
+            devices->nodes[type][devices->nnodes[type]++] = cur;
+        }
+    }
+
+    VIR_FREE(parents);
+    return 0;
+}
+
+/* Hand over the list of nodes of @type, to be freed by the caller */
+static int
+virDomainDevicesNodesTake(virDomainDevicesNodes *devices,
+                          enum virDomainDevicesNode type,
+                          xmlNodePtr **nodes)
+{
+    int n = devices->nnodes[type];
+
+    *nodes = devices->nodes[type];
+    devices->nodes[type] = NULL;
+    devices->nnodes[type] = devices->nodes_max[type] = 0;
+    return n;
+}
+
+static void
+virDomainDevicesNodesClear(virDomainDevicesNodes *devices)
+{
+    int type;
+
+    for (type = 0 ; type < VIR_DOMAIN_DEVICES_NODE_LAST ; type++)
+        VIR_FREE(devices->nodes[type]);
+}
+
+
+static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
+                                            xmlDocPtr xml,
+                                            xmlNodePtr root,
+                                            xmlXPathContextPtr ctxt,
+                                            unsigned int expectedVirtTypes,
+                                            unsigned int flags)
+{
+    xmlNodePtr *nodes = NULL, node = NULL;
+    char *tmp = NULL;
+    int i, n;
+    long id = -1;
+    virDomainDefPtr def;
     unsigned long count;
     bool uuid_generated = false;
     virBitmapPtr bootMap = NULL;
@@ -8837,6 +9980,9 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     bool usb_none = false;
     bool usb_other = false;
     bool primaryVideo = false;
+    virDomainDevicesNodes devices;
+
+    memset(&devices, 0, sizeof(devices));
 
     if (VIR_ALLOC(def) < 0) {
         virReportOOMError();
@@ -8988,6 +10134,20 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     if (node)
         def->mem.hugepage_backed = true;
 
+    if ((n = virXPathNodeSet("./memoryBacking/hugepages/page",
+                             ctxt, &nodes)) < 0)
+        goto error;
+
+    if (n && VIR_ALLOC_N(def->mem.hugepages, n) < 0)
+        goto no_memory;
+
+    for (i = 0; i < n; i++) {
+        if (virDomainHugePageParseXML(nodes[i], &def->mem.hugepages[i]) < 0)
+            goto error;
+        def->mem.nhugepages++;
+    }
+    VIR_FREE(nodes);
+
     /* Extract blkio cgroup tunables */
     if (virXPathUInt("string(./blkiotune/weight)", ctxt,
                      &def->blkio.weight) < 0)
@@ -9003,15 +10163,15 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
 
     for (i = 0; i < n; i++) {
         int j;
-        if (virDomainBlkioDeviceWeightParseXML(nodes[i],
-                                               &def->blkio.devices[i]) < 0)
+        if (virDomainBlkioDeviceParseXML(nodes[i],
+                                         &def->blkio.devices[i]) < 0)
             goto error;
         def->blkio.ndevices++;
         for (j = 0; j < i; j++) {
             if (STREQ(def->blkio.devices[j].path,
                       def->blkio.devices[i].path)) {
                 virReportError(VIR_ERR_XML_ERROR,
-                               _("duplicate device weight path '%s'"),
+                               _("duplicate blkio device path '%s'"),
                                def->blkio.devices[i].path);
                 goto error;
             }
@@ -9019,6 +10179,21 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     }
     VIR_FREE(nodes);
 
+    if ((n = virXPathNodeSet("./blkiotune/throttlegroup", ctxt, &nodes)) < 0)
+        goto error;
+    if (n && VIR_ALLOC_N(def->blkio.groups, n) < 0)
+        goto no_memory;
+
+    for (i = 0; i < n; i++) {
+        if (virDomainBlkioThrottleGroupParseXML(nodes[i],
+                                                &def->blkio.groups[i]) < 0) {
+            virBlkioThrottleGroupArrayClear(&def->blkio.groups[i], 1);
+            goto error;
+        }
+        def->blkio.ngroups++;
+    }
+    VIR_FREE(nodes);
+
     /* Extract other memory tunables */
     if (virDomainParseMemory("./memtune/hard_limit[1]", ctxt,
                              &def->mem.hard_limit, false) < 0)
@@ -9102,6 +10277,12 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
         }
     }
 
+    if (virXPathUInt("string(./iothreads[1])", ctxt, &def->iothreads) == -2) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("iothreads count must be an unsigned integer"));
+        goto error;
+    }
+
     /* Extract cpu tunables. */
     if (virXPathULong("string(./cputune/shares[1])", ctxt,
                       &def->cputune.shares) < 0)
@@ -9229,6 +10410,35 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     }
     VIR_FREE(nodes);
 
+    if ((n = virXPathNodeSet("./cputune/iothreadpin", ctxt, &nodes)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot extract iothreadpin nodes"));
+        goto error;
+    }
+
+    if (n && VIR_ALLOC_N(def->cputune.iothreadpin, n) < 0)
+        goto no_memory;
+
+    for (i = 0 ; i < n ; i++) {
+        virDomainVcpuPinDefPtr iothreadpin;
+
+        if (!(iothreadpin = virDomainIOThreadPinDefParseXML(nodes[i], ctxt,
+                                                            def->iothreads)))
+            goto error;
+
+        if (virDomainVcpuPinIsDuplicate(def->cputune.iothreadpin,
+                                        def->cputune.niothreadpin,
+                                        iothreadpin->vcpuid)) {
+            virReportError(VIR_ERR_XML_ERROR, "%s",
+                           _("duplicate iothreadpin for same iothread"));
+            virDomainVcpuPinDefFree(iothreadpin);
+            goto error;
+        }
+
+        def->cputune.iothreadpin[def->cputune.niothreadpin++] = iothreadpin;
+    }
+    VIR_FREE(nodes);
+
     /* Extract numatune if exists. */
     if ((n = virXPathNodeSet("./numatune", ctxt, &nodes)) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -9325,6 +10535,9 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
                         def->placement_mode = VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO;
 
                     def->numatune.memory.placement_mode = placement_mode;
+                } else if (xmlStrEqual(cur->name, BAD_CAST "memnode")) {
+                    if (virDomainNumatuneMemNodeParseXML(def, cur) < 0)
+                        goto error;
                 } else {
                     virReportError(VIR_ERR_XML_ERROR,
                                    _("unsupported XML element %s"),
@@ -9461,6 +10674,13 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
                                  &def->pm.s4) < 0)
         goto error;
 
+    if (virXPathInt("string(./autostart/@priority)", ctxt,
+                    &def->autostartPriority) == -2) {
+        virReportError(VIR_ERR_XML_ERROR, "%s",
+                       _("invalid autostart priority"));
+        goto error;
+    }
+
     tmp = virXPathString("string(./clock/@offset)", ctxt);
     if (tmp) {
         if ((def->clock.offset = virDomainClockOffsetTypeFromString(tmp)) < 0) {
@@ -9701,10 +10921,13 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
             goto error;
     }
 
-    /* analysis of the disk devices */
-    if ((n = virXPathNodeSet("./devices/disk", ctxt, &nodes)) < 0)
+    if (virDomainDevicesNodesCollect(ctxt, &devices) < 0)
         goto error;
 
+    /* analysis of the disk devices */
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_DISK,
+                                  &nodes);
+
     if (n && VIR_ALLOC_N(def->disks, n) < 0)
         goto no_memory;
 
@@ -9719,13 +10942,22 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
         if (!disk)
             goto error;
 
+        if (disk->iothread > def->iothreads) {
+            virReportError(VIR_ERR_XML_ERROR,
+                           _("disk '%s' uses iothread %u but only %u "
+                             "iothreads are defined"),
+                           disk->dst, disk->iothread, def->iothreads);
+            virDomainDiskDefFree(disk);
+            goto error;
+        }
+
         virDomainDiskInsertPreAlloced(def, disk);
     }
     VIR_FREE(nodes);
 
     /* analysis of the controller devices */
-    if ((n = virXPathNodeSet("./devices/controller", ctxt, &nodes)) < 0)
-        goto error;
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_CONTROLLER,
+                                  &nodes);
 
     if (n && VIR_ALLOC_N(def->controllers, n) < 0)
         goto no_memory;
@@ -9768,11 +11000,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
             goto error;
 
     /* analysis of the resource leases */
-    if ((n = virXPathNodeSet("./devices/lease", ctxt, &nodes)) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       "%s", _("cannot extract device leases"));
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_LEASE,
+                                  &nodes);
     if (n && VIR_ALLOC_N(def->leases, n) < 0)
         goto no_memory;
     for (i = 0 ; i < n ; i++) {
@@ -9785,9 +11014,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     VIR_FREE(nodes);
 
     /* analysis of the filesystems */
-    if ((n = virXPathNodeSet("./devices/filesystem", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_FILESYSTEM,
+                                  &nodes);
     if (n && VIR_ALLOC_N(def->fss, n) < 0)
         goto no_memory;
     for (i = 0 ; i < n ; i++) {
@@ -9801,9 +11029,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     VIR_FREE(nodes);
 
     /* analysis of the network devices */
-    if ((n = virXPathNodeSet("./devices/interface", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_INTERFACE,
+                                  &nodes);
     if (n && VIR_ALLOC_N(def->nets, n) < 0)
         goto no_memory;
     for (i = 0 ; i < n ; i++) {
@@ -9827,9 +11054,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
 
 
     /* analysis of the smartcard devices */
-    if ((n = virXPathNodeSet("./devices/smartcard", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_SMARTCARD,
+                                  &nodes);
     if (n && VIR_ALLOC_N(def->smartcards, n) < 0)
         goto no_memory;
 
@@ -9845,9 +11071,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
 
 
     /* analysis of the character devices */
-    if ((n = virXPathNodeSet("./devices/parallel", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_PARALLEL,
+                                  &nodes);
     if (n && VIR_ALLOC_N(def->parallels, n) < 0)
         goto no_memory;
 
@@ -9875,8 +11100,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./devices/serial", ctxt, &nodes)) < 0)
-        goto error;
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_SERIAL,
+                                  &nodes);
 
     if (n && VIR_ALLOC_N(def->serials, n) < 0)
         goto no_memory;
@@ -9905,11 +11130,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./devices/console", ctxt, &nodes)) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       "%s", _("cannot extract console devices"));
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_CONSOLE,
+                                  &nodes);
     if (n && VIR_ALLOC_N(def->consoles, n) < 0)
         goto no_memory;
 
@@ -9987,9 +11209,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./devices/channel", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_CHANNEL,
+                                  &nodes);
     if (n && VIR_ALLOC_N(def->channels, n) < 0)
         goto no_memory;
 
@@ -10030,9 +11251,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
 
 
     /* analysis of the input devices */
-    if ((n = virXPathNodeSet("./devices/input", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_INPUT,
+                                  &nodes);
     if (n && VIR_ALLOC_N(def->inputs, n) < 0)
         goto no_memory;
 
@@ -10069,9 +11289,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     VIR_FREE(nodes);
 
     /* analysis of the graphics devices */
-    if ((n = virXPathNodeSet("./devices/graphics", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_GRAPHICS,
+                                  &nodes);
     if (n && VIR_ALLOC_N(def->graphics, n) < 0)
         goto no_memory;
     for (i = 0 ; i < n ; i++) {
@@ -10110,9 +11329,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
 
 
     /* analysis of the sound devices */
-    if ((n = virXPathNodeSet("./devices/sound", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_SOUND,
+                                  &nodes);
     if (n && VIR_ALLOC_N(def->sounds, n) < 0)
         goto no_memory;
     for (i = 0 ; i < n ; i++) {
@@ -10127,9 +11345,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     VIR_FREE(nodes);
 
     /* analysis of the video devices */
-    if ((n = virXPathNodeSet("./devices/video", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_VIDEO,
+                                  &nodes);
     if (n && VIR_ALLOC_N(def->videos, n) < 0)
         goto no_memory;
     for (i = 0 ; i < n ; i++) {
@@ -10181,9 +11398,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     }
 
     /* analysis of the host devices */
-    if ((n = virXPathNodeSet("./devices/hostdev", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_HOSTDEV,
+                                  &nodes);
     if (n && VIR_REALLOC_N(def->hostdevs, def->nhostdevs + n) < 0)
         goto no_memory;
     for (i = 0 ; i < n ; i++) {
@@ -10207,9 +11423,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
 
     /* analysis of the watchdog devices */
     def->watchdog = NULL;
-    if ((n = virXPathNodeSet("./devices/watchdog", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_WATCHDOG,
+                                  &nodes);
     if (n > 1) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("only a single watchdog device is supported"));
@@ -10227,9 +11442,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
 
     /* analysis of the memballoon devices */
     def->memballoon = NULL;
-    if ((n = virXPathNodeSet("./devices/memballoon", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_MEMBALLOON,
+                                  &nodes);
     if (n > 1) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("only a single memory balloon device is supported"));
@@ -10261,9 +11475,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     }
 
     /* analysis of the hub devices */
-    if ((n = virXPathNodeSet("./devices/hub", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_HUB,
+                                  &nodes);
     if (n && VIR_ALLOC_N(def->hubs, n) < 0)
         goto no_memory;
     for (i = 0 ; i < n ; i++) {
@@ -10283,9 +11496,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     VIR_FREE(nodes);
 
     /* analysis of the redirected devices */
-    if ((n = virXPathNodeSet("./devices/redirdev", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_REDIRDEV,
+                                  &nodes);
     if (n && VIR_ALLOC_N(def->redirdevs, n) < 0)
         goto no_memory;
     for (i = 0 ; i < n ; i++) {
@@ -10307,9 +11519,8 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
     VIR_FREE(nodes);
 
     /* analysis of the redirection filter rules */
-    if ((n = virXPathNodeSet("./devices/redirfilter", ctxt, &nodes)) < 0) {
-        goto error;
-    }
+    n = virDomainDevicesNodesTake(&devices, VIR_DOMAIN_DEVICES_NODE_REDIRFILTER,
+                                  &nodes);
     if (n > 1) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("only one set of redirection filter rule is supported"));
@@ -10352,6 +11563,9 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
         }
     }
 
+    if (virDomainDefCheckNUMACells(def) < 0)
+        goto error;
+
     if ((node = virXPathNode("./sysinfo[1]", ctxt)) != NULL) {
         xmlNodePtr oldnode = ctxt->node;
         ctxt->node = node;
@@ -10413,6 +11627,7 @@ static virDomainDefPtr virDomainDefParseXML(virCapsPtr caps,
         goto error;
 
     virBitmapFree(bootMap);
+    virDomainDevicesNodesClear(&devices);
 
     return def;
 
@@ -10424,6 +11639,7 @@ no_memory:
     VIR_FREE(tmp);
     VIR_FREE(nodes);
     virBitmapFree(bootMap);
+    virDomainDevicesNodesClear(&devices);
     virDomainDefFree(def);
     return NULL;
 }
@@ -12184,7 +13400,8 @@ virDomainDiskDefFormat(virBufferPtr buf,
     virBufferAddLit(buf, ">\n");
 
     if (def->driverName || def->format > 0 || def->cachemode ||
-        def->ioeventfd || def->event_idx || def->copy_on_read) {
+        def->ioeventfd || def->event_idx || def->copy_on_read ||
+        def->iothread) {
         virBufferAddLit(buf, "      <driver");
         if (def->driverName)
             virBufferAsprintf(buf, " name='%s'", def->driverName);
@@ -12205,6 +13422,8 @@ virDomainDiskDefFormat(virBufferPtr buf,
             virBufferAsprintf(buf, " event_idx='%s'", event_idx);
         if (def->copy_on_read)
             virBufferAsprintf(buf, " copy_on_read='%s'", copy_on_read);
+        if (def->iothread)
+            virBufferAsprintf(buf, " iothread='%u'", def->iothread);
         virBufferAddLit(buf, "/>\n");
     }
 
@@ -12862,7 +14081,8 @@ virDomainNetDefFormat(virBufferPtr buf,
         virBufferEscapeString(buf, "<model type='%s'/>\n",
                               def->model);
         if (STREQ(def->model, "virtio") &&
-            (def->driver.virtio.name || def->driver.virtio.txmode)) {
+            (def->driver.virtio.name || def->driver.virtio.txmode ||
+             def->driver.virtio.queues)) {
             virBufferAddLit(buf, "<driver");
             if (def->driver.virtio.name) {
                 virBufferAsprintf(buf, " name='%s'",
@@ -12880,6 +14100,8 @@ virDomainNetDefFormat(virBufferPtr buf,
                 virBufferAsprintf(buf, " event_idx='%s'",
                                   virDomainVirtioEventIdxTypeToString(def->driver.virtio.event_idx));
             }
+            if (def->driver.virtio.queues)
+                virBufferAsprintf(buf, " queues='%u'", def->driver.virtio.queues);
             virBufferAddLit(buf, "/>\n");
         }
     }
@@ -13901,6 +15123,27 @@ virDomainIsAllVcpupinInherited(virDomainDefPtr def)
    }
 }
 
+static void
+virDomainBlkioThrottleFormat(virBufferPtr buf,
+                             unsigned int riops,
+                             unsigned int wiops,
+                             unsigned long long rbps,
+                             unsigned long long wbps)
+{
+    if (rbps)
+        virBufferAsprintf(buf, "      <read_bytes_sec>%llu</read_bytes_sec>\n",
+                          rbps);
+    if (wbps)
+        virBufferAsprintf(buf, "      <write_bytes_sec>%llu</write_bytes_sec>\n",
+                          wbps);
+    if (riops)
+        virBufferAsprintf(buf, "      <read_iops_sec>%u</read_iops_sec>\n",
+                          riops);
+    if (wiops)
+        virBufferAsprintf(buf, "      <write_iops_sec>%u</write_iops_sec>\n",
+                          wiops);
+}
+
 #define DUMPXML_FLAGS                           \
     (VIR_DOMAIN_XML_SECURE |                    \
      VIR_DOMAIN_XML_INACTIVE |                  \
@@ -13995,11 +15238,14 @@ virDomainDefFormatInternal(virDomainDefPtr def,
                       def->mem.cur_balloon);
 
     /* add blkiotune only if there are any */
-    if (def->blkio.weight) {
+    if (def->blkio.weight || def->blkio.ngroups) {
         blkio = true;
     } else {
         for (n = 0; n < def->blkio.ndevices; n++) {
-            if (def->blkio.devices[n].weight) {
+            virBlkioDevicePtr dev = &def->blkio.devices[n];
+
+            if (dev->weight || dev->riops || dev->wiops ||
+                dev->rbps || dev->wbps) {
                 blkio = true;
                 break;
             }
@@ -14014,16 +15260,35 @@ virDomainDefFormatInternal(virDomainDefPtr def,
                               def->blkio.weight);
 
         for (n = 0; n < def->blkio.ndevices; n++) {
-            if (def->blkio.devices[n].weight == 0)
+            virBlkioDevicePtr dev = &def->blkio.devices[n];
+
+            if (!dev->weight && !dev->riops && !dev->wiops &&
+                !dev->rbps && !dev->wbps)
                 continue;
             virBufferAddLit(buf, "    <device>\n");
             virBufferEscapeString(buf, "      <path>%s</path>\n",
-                                  def->blkio.devices[n].path);
-            virBufferAsprintf(buf, "      <weight>%u</weight>\n",
-                              def->blkio.devices[n].weight);
+                                  dev->path);
+            if (dev->weight)
+                virBufferAsprintf(buf, "      <weight>%u</weight>\n",
+                                  dev->weight);
+            virDomainBlkioThrottleFormat(buf, dev->riops, dev->wiops,
+                                         dev->rbps, dev->wbps);
             virBufferAddLit(buf, "    </device>\n");
         }
 
+        for (n = 0; n < def->blkio.ngroups; n++) {
+            virBlkioThrottleGroupPtr group = &def->blkio.groups[n];
+            int j;
+
+            virBufferAddLit(buf, "    <throttlegroup>\n");
+            for (j = 0; j < group->npaths; j++)
+                virBufferEscapeString(buf, "      <path>%s</path>\n",
+                                      group->paths[j]);
+            virDomainBlkioThrottleFormat(buf, group->riops, group->wiops,
+                                         group->rbps, group->wbps);
+            virBufferAddLit(buf, "    </throttlegroup>\n");
+        }
+
         virBufferAddLit(buf, "  </blkiotune>\n");
     }
 
@@ -14052,10 +15317,30 @@ virDomainDefFormatInternal(virDomainDefPtr def,
         virBufferAddLit(buf, "  </memtune>\n");
 
     if (def->mem.hugepage_backed) {
-        virBufferStrcat(buf,
-                        "  <memoryBacking>\n",
-                        "    <hugepages/>\n",
-                        "  </memoryBacking>\n", NULL);
+        virBufferAddLit(buf, "  <memoryBacking>\n");
+        if (def->mem.nhugepages) {
+            virBufferAddLit(buf, "    <hugepages>\n");
+            for (i = 0; i < def->mem.nhugepages; i++) {
+                virBufferAsprintf(buf, "      <page size='%llu' unit='KiB'",
+                                  def->mem.hugepages[i].size);
+                if (def->mem.hugepages[i].nodemask) {
+                    char *nodeset;
+
+                    if (!(nodeset = virBitmapFormat(def->mem.hugepages[i].nodemask))) {
+                        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                       _("failed to format hugepage nodeset"));
+                        goto cleanup;
+                    }
+                    virBufferAsprintf(buf, " nodeset='%s'", nodeset);
+                    VIR_FREE(nodeset);
+                }
+                virBufferAddLit(buf, "/>\n");
+            }
+            virBufferAddLit(buf, "    </hugepages>\n");
+        } else {
+            virBufferAddLit(buf, "    <hugepages/>\n");
+        }
+        virBufferAddLit(buf, "  </memoryBacking>\n");
     }
 
     virBufferAddLit(buf, "  <vcpu");
@@ -14073,10 +15358,13 @@ virDomainDefFormatInternal(virDomainDefPtr def,
         virBufferAsprintf(buf, " current='%u'", def->vcpus);
     virBufferAsprintf(buf, ">%u</vcpu>\n", def->maxvcpus);
 
+    if (def->iothreads)
+        virBufferAsprintf(buf, "  <iothreads>%u</iothreads>\n", def->iothreads);
+
     if (def->cputune.shares ||
         (def->cputune.vcpupin && !virDomainIsAllVcpupinInherited(def)) ||
         def->cputune.period || def->cputune.quota ||
-        def->cputune.emulatorpin ||
+        def->cputune.emulatorpin || def->cputune.niothreadpin ||
         def->cputune.emulator_period || def->cputune.emulator_quota)
         virBufferAddLit(buf, "  <cputune>\n");
 
@@ -14141,22 +15429,40 @@ virDomainDefFormatInternal(virDomainDefPtr def,
         virBufferAsprintf(buf, "cpuset='%s'/>\n", cpumask);
         VIR_FREE(cpumask);
     }
+
+    for (i = 0; i < def->cputune.niothreadpin; i++) {
+        char *cpumask;
+
+        if (!(cpumask = virBitmapFormat(def->cputune.iothreadpin[i]->cpumask))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("failed to format cpuset for iothreadpin"));
+            goto cleanup;
+        }
+
+        virBufferAsprintf(buf, "    <iothreadpin iothread='%d' cpuset='%s'/>\n",
+                          def->cputune.iothreadpin[i]->vcpuid, cpumask);
+        VIR_FREE(cpumask);
+    }
+
     if (def->cputune.shares ||
         (def->cputune.vcpupin && !virDomainIsAllVcpupinInherited(def)) ||
         def->cputune.period || def->cputune.quota ||
-        def->cputune.emulatorpin ||
+        def->cputune.emulatorpin || def->cputune.niothreadpin ||
         def->cputune.emulator_period || def->cputune.emulator_quota)
         virBufferAddLit(buf, "  </cputune>\n");
 
     if (def->numatune.memory.nodemask ||
-        def->numatune.memory.placement_mode) {
+        def->numatune.memory.placement_mode ||
+        virDomainNumatuneHasMemNodes(&def->numatune)) {
         virBufferAddLit(buf, "  <numatune>\n");
         const char *mode;
         char *nodemask = NULL;
         const char *placement;
 
         mode = virDomainNumatuneMemModeTypeToString(def->numatune.memory.mode);
-        virBufferAsprintf(buf, "    <memory mode='%s' ", mode);
+        if (def->numatune.memory.nodemask ||
+            def->numatune.memory.placement_mode)
+            virBufferAsprintf(buf, "    <memory mode='%s' ", mode);
 
         if (def->numatune.memory.placement_mode ==
             VIR_DOMAIN_NUMATUNE_MEM_PLACEMENT_MODE_STATIC) {
@@ -14173,6 +15479,25 @@ virDomainDefFormatInternal(virDomainDefPtr def,
             placement = virDomainNumatuneMemPlacementModeTypeToString(def->numatune.memory.placement_mode);
             virBufferAsprintf(buf, "placement='%s'/>\n", placement);
         }
+
+        for (i = 0; i < def->numatune.nmem_nodes; i++) {
+            virDomainNumatuneMemNodePtr mem_node = &def->numatune.mem_nodes[i];
+
+            if (!mem_node->nodemask)
+                continue;
+
+            if (!(nodemask = virBitmapFormat(mem_node->nodemask))) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("failed to format nodeset for "
+                                 "NUMA memory tuning"));
+                goto cleanup;
+            }
+            virBufferAsprintf(buf, "    <memnode cellid='%d' mode='%s' "
+                              "nodeset='%s'/>\n", i,
+                              virDomainNumatuneMemModeTypeToString(mem_node->mode),
+                              nodemask);
+            VIR_FREE(nodemask);
+        }
         virBufferAddLit(buf, "  </numatune>\n");
     }
 
@@ -14374,6 +15699,10 @@ virDomainDefFormatInternal(virDomainDefPtr def,
         virBufferAddLit(buf, "  </pm>\n");
     }
 
+    if (def->autostartPriority)
+        virBufferAsprintf(buf, "  <autostart priority='%d'/>\n",
+                          def->autostartPriority);
+
     virBufferAddLit(buf, "  <devices>\n");
 
     virBufferEscapeString(buf, "    <emulator>%s</emulator>\n",
@@ -14538,6 +15867,57 @@ virDomainDefFormat(virDomainDefPtr def, unsigned int flags)
     return virBufferContentAndReset(&buf);
 }
 
+/**
+ * virDomainDefGetXMLCache:
+ * @def: domain definition
+ * @flags: format flags the cached XML must have been produced with
+ *
+ * Returns the XML previously stored with virDomainDefSetXMLCache for
+ * the same @flags, or NULL if there is none or it was invalidated.
+ * The string remains owned by @def.
+ */
+const char *
+virDomainDefGetXMLCache(virDomainDefPtr def, unsigned int flags)
+{
+    if (!def->xmlCache || def->xmlCacheFlags != flags)
+        return NULL;
+    return def->xmlCache;
+}
+
+/**
+ * virDomainDefSetXMLCache:
+ * @def: domain definition
+ * @flags: format flags @xml was produced with
+ * @xml: formatted XML of @def, ownership is transferred to @def
+ *
+ * Remember the formatted XML of @def so that repeated requests for it
+ * do not need to format the whole definition again.  Only one set of
+ * flags is cached at a time.  Whoever modifies @def must call
+ * virDomainDefInvalidateXMLCache (saving the config or status does
+ * so implicitly).
+ */
+void
+virDomainDefSetXMLCache(virDomainDefPtr def, unsigned int flags, char *xml)
+{
+    VIR_FREE(def->xmlCache);
+    def->xmlCache = xml;
+    def->xmlCacheFlags = flags;
+}
+
+void
+virDomainDefInvalidateXMLCache(virDomainDefPtr def)
+{
+    if (def)
+        VIR_FREE(def->xmlCache);
+}
+
+void
+virDomainObjInvalidateXMLCache(virDomainObjPtr obj)
+{
+    virDomainDefInvalidateXMLCache(obj->def);
+    virDomainDefInvalidateXMLCache(obj->newDef);
+}
+
 
 static char *virDomainObjFormat(virCapsPtr caps,
                                 virDomainObjPtr obj,
@@ -14669,6 +16049,8 @@ int virDomainSaveConfig(const char *configDir,
     int ret = -1;
     char *xml;
 
+    virDomainDefInvalidateXMLCache(def);
+
     if (!(xml = virDomainDefFormat(def,
                                    VIR_DOMAIN_XML_WRITE_FLAGS)))
         goto cleanup;
@@ -14694,6 +16076,8 @@ int virDomainSaveStatus(virCapsPtr caps,
     int ret = -1;
     char *xml;
 
+    virDomainDefInvalidateXMLCache(obj->def);
+
     if (!(xml = virDomainObjFormat(caps, obj, flags)))
         goto cleanup;
 
@@ -14707,26 +16091,23 @@ cleanup:
 }
 
 
+/* @def is consumed, whether this succeeds or not */
 static virDomainObjPtr virDomainLoadConfig(virCapsPtr caps,
                                            virDomainObjListPtr doms,
                                            const char *configDir,
                                            const char *autostartDir,
                                            const char *name,
-                                           unsigned int expectedVirtTypes,
+                                           virDomainDefPtr def,
                                            virDomainLoadConfigNotify notify,
                                            void *opaque)
 {
     char *configFile = NULL, *autostartLink = NULL;
-    virDomainDefPtr def = NULL;
     virDomainObjPtr dom;
     int autostart;
     int newVM = 1;
 
     if ((configFile = virDomainConfigFile(configDir, name)) == NULL)
         goto error;
-    if (!(def = virDomainDefParseFile(caps, configFile, expectedVirtTypes,
-                                      VIR_DOMAIN_XML_INACTIVE)))
-        goto error;
 
     if ((autostartLink = virDomainConfigFile(autostartDir, name)) == NULL)
         goto error;
@@ -14771,51 +16152,92 @@ error:
     return NULL;
 }
 
-static virDomainObjPtr virDomainLoadStatus(virCapsPtr caps,
-                                           virDomainObjListPtr doms,
-                                           const char *statusDir,
-                                           const char *name,
-                                           unsigned int expectedVirtTypes,
+/* @obj is consumed, whether this succeeds or not */
+static virDomainObjPtr virDomainLoadStatus(virDomainObjListPtr doms,
+                                           virDomainObjPtr obj,
                                            virDomainLoadConfigNotify notify,
                                            void *opaque)
 {
-    char *statusFile = NULL;
-    virDomainObjPtr obj = NULL;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
 
-    if ((statusFile = virDomainConfigFile(statusDir, name)) == NULL)
-        goto error;
-
-    if (!(obj = virDomainObjParseFile(caps, statusFile, expectedVirtTypes,
-                                      VIR_DOMAIN_XML_INTERNAL_STATUS |
-                                      VIR_DOMAIN_XML_INTERNAL_ACTUAL_NET |
-                                      VIR_DOMAIN_XML_INTERNAL_PCI_ORIG_STATES)))
-        goto error;
-
     virUUIDFormat(obj->def->uuid, uuidstr);
 
+    virMutexLock(&doms->lock);
     if (virHashLookup(doms->objs, uuidstr) != NULL) {
+        virMutexUnlock(&doms->lock);
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("unexpected domain %s already exists"),
                        obj->def->name);
         goto error;
     }
 
-    if (virHashAddEntry(doms->objs, uuidstr, obj) < 0)
+    if (virDomainObjListAddLocked(doms, obj) < 0) {
+        virMutexUnlock(&doms->lock);
         goto error;
+    }
+    virMutexUnlock(&doms->lock);
 
     if (notify)
         (*notify)(obj, 1, opaque);
 
-    VIR_FREE(statusFile);
     return obj;
 
 error:
     virObjectUnref(obj);
-    VIR_FREE(statusFile);
     return NULL;
 }
 
+
+/* Parsing the XML is by far the most expensive part of loading a
+ * config, and each file can be parsed on its own, so hosts with
+ * thousands of persistent domains parse them on several threads.
+ * Adding the results to the domain list stays serial, in directory
+ * order. */
+#define VIR_DOMAIN_LOAD_CONFIG_WORKERS 8
+
+typedef struct _virDomainLoadConfigState virDomainLoadConfigState;
+typedef virDomainLoadConfigState *virDomainLoadConfigStatePtr;
+struct _virDomainLoadConfigState {
+    virCapsPtr caps;
+    const char *configDir;
+    int liveStatus;
+    unsigned int expectedVirtTypes;
+};
+
+typedef struct _virDomainLoadConfigJob virDomainLoadConfigJob;
+typedef virDomainLoadConfigJob *virDomainLoadConfigJobPtr;
+struct _virDomainLoadConfigJob {
+    char *name;
+    virDomainDefPtr def;    /* set for persistent configs */
+    virDomainObjPtr obj;    /* set for live status */
+};
+
+static void
+virDomainLoadConfigParse(void *jobdata, void *opaque)
+{
+    virDomainLoadConfigJobPtr job = jobdata;
+    virDomainLoadConfigStatePtr state = opaque;
+    char *file;
+
+    VIR_INFO("Loading config file '%s.xml'", job->name);
+
+    /* NB: errors are only logged, so one malformed config doesn't
+     * kill the whole process */
+    if ((file = virDomainConfigFile(state->configDir, job->name))) {
+        if (state->liveStatus)
+            job->obj = virDomainObjParseFile(state->caps, file,
+                                             state->expectedVirtTypes,
+                                             VIR_DOMAIN_XML_INTERNAL_STATUS |
+                                             VIR_DOMAIN_XML_INTERNAL_ACTUAL_NET |
+                                             VIR_DOMAIN_XML_INTERNAL_PCI_ORIG_STATES);
+        else
+            job->def = virDomainDefParseFile(state->caps, file,
+                                             state->expectedVirtTypes,
+                                             VIR_DOMAIN_XML_INACTIVE);
+        VIR_FREE(file);
+    }
+}
+
 int virDomainLoadAllConfigs(virCapsPtr caps,
                             virDomainObjListPtr doms,
                             const char *configDir,
@@ -14827,6 +16249,12 @@ int virDomainLoadAllConfigs(virCapsPtr caps,
 {
     DIR *dir;
     struct dirent *entry;
+    virDomainLoadConfigState state;
+    virDomainLoadConfigJobPtr jobs = NULL;
+    size_t njobs = 0;
+    size_t maxjobs = 0;
+    int ret = -1;
+    size_t i;
 
     VIR_INFO("Scanning for configs in %s", configDir);
 
@@ -14839,35 +16267,59 @@ int virDomainLoadAllConfigs(virCapsPtr caps,
         return -1;
     }
 
-    while ((entry = readdir(dir))) {
-        virDomainObjPtr dom;
+    memset(&state, 0, sizeof(state));
+    state.caps = caps;
+    state.configDir = configDir;
+    state.liveStatus = liveStatus;
+    state.expectedVirtTypes = expectedVirtTypes;
 
+    while ((entry = readdir(dir))) {
         if (entry->d_name[0] == '.')
             continue;
 
         if (!virFileStripSuffix(entry->d_name, ".xml"))
             continue;
 
-        /* NB: ignoring errors, so one malformed config doesn't
-           kill the whole process */
-        VIR_INFO("Loading config file '%s.xml'", entry->d_name);
-        if (liveStatus)
-            dom = virDomainLoadStatus(caps,
-                                      doms,
-                                      configDir,
-                                      entry->d_name,
-                                      expectedVirtTypes,
-                                      notify,
-                                      opaque);
-        else
+        if (VIR_RESIZE_N(jobs, maxjobs, njobs, 1) < 0 ||
+            !(jobs[njobs].name = strdup(entry->d_name))) {
+            virReportOOMError();
+            closedir(dir);
+            goto cleanup;
+        }
+        njobs++;
+    }
+
+    closedir(dir);
+
+    /* Make sure libxml2's global state is set up before the
+     * workers race to do so */
+    xmlInitParser();
+
+    virThreadPoolRunJobs(VIR_DOMAIN_LOAD_CONFIG_WORKERS,
+                         virDomainLoadConfigParse, &state,
+                         jobs, njobs, sizeof(*jobs));
+
+    for (i = 0; i < njobs; i++) {
+        virDomainObjPtr dom;
+
+        if (liveStatus) {
+            if (!jobs[i].obj)
+                continue;
+            dom = virDomainLoadStatus(doms, jobs[i].obj, notify, opaque);
+            jobs[i].obj = NULL;
+        } else {
+            if (!jobs[i].def)
+                continue;
             dom = virDomainLoadConfig(caps,
                                       doms,
                                       configDir,
                                       autostartDir,
-                                      entry->d_name,
-                                      expectedVirtTypes,
+                                      jobs[i].name,
+                                      jobs[i].def,
                                       notify,
                                       opaque);
+            jobs[i].def = NULL;
+        }
         if (dom) {
             virDomainObjUnlock(dom);
             if (!liveStatus)
@@ -14875,9 +16327,16 @@ int virDomainLoadAllConfigs(virCapsPtr caps,
         }
     }
 
-    closedir(dir);
+    ret = 0;
 
-    return 0;
+cleanup:
+    for (i = 0; i < njobs; i++) {
+        VIR_FREE(jobs[i].name);
+        virDomainDefFree(jobs[i].def);
+        virObjectUnref(jobs[i].obj);
+    }
+    VIR_FREE(jobs);
+    return ret;
 }
 
 int virDomainDeleteConfig(const char *configDir,
@@ -15075,10 +16534,12 @@ static void virDomainObjListCountInactive(void *payload, const void *name ATTRIB
 int virDomainObjListNumOfDomains(virDomainObjListPtr doms, int active)
 {
     int count = 0;
+    virMutexLock(&doms->lock);
     if (active)
         virHashForEach(doms->objs, virDomainObjListCountActive, &count);
     else
         virHashForEach(doms->objs, virDomainObjListCountInactive, &count);
+    virMutexUnlock(&doms->lock);
     return count;
 }
 
@@ -15103,7 +16564,9 @@ int virDomainObjListGetActiveIDs(virDomainObjListPtr doms,
                                  int maxids)
 {
     struct virDomainIDData data = { 0, maxids, ids };
+    virMutexLock(&doms->lock);
     virHashForEach(doms->objs, virDomainObjListCopyActiveIDs, &data);
+    virMutexUnlock(&doms->lock);
     return data.numids;
 }
 
@@ -15139,7 +16602,9 @@ int virDomainObjListGetInactiveNames(virDomainObjListPtr doms,
 {
     struct virDomainNameData data = { 0, 0, maxnames, names };
     int i;
+    virMutexLock(&doms->lock);
     virHashForEach(doms->objs, virDomainObjListCopyInactiveNames, &data);
+    virMutexUnlock(&doms->lock);
     if (data.oom) {
         virReportOOMError();
         goto cleanup;
@@ -15153,6 +16618,22 @@ cleanup:
     return -1;
 }
 
+/*
+ * Run @iter over every domain in the list while holding the list
+ * lock. The iterator may lock individual domains, but must not
+ * add or remove any.
+ */
+int virDomainObjListForEach(virDomainObjListPtr doms,
+                            virHashIterator iter,
+                            void *data)
+{
+    int ret;
+    virMutexLock(&doms->lock);
+    ret = virHashForEach(doms->objs, iter, data);
+    virMutexUnlock(&doms->lock);
+    return ret;
+}
+
 int virDomainChrDefForeach(virDomainDefPtr def,
                            bool abortOnError,
                            virDomainChrDefIterator iter,
@@ -15353,6 +16834,9 @@ virDomainObjSetState(virDomainObjPtr dom, virDomainState state, int reason)
         return;
     }
 
+    if (dom->state.state != state)
+        virAtomicIntInc(&virDomainObjStateGeneration);
+
     dom->state.state = state;
     if (reason > 0 && reason < last)
         dom->state.reason = reason;
@@ -15805,33 +17289,152 @@ struct virDomainListData {
     virConnectPtr conn;
     virDomainPtr *domains;
     unsigned int flags;
+    virTypedParameterPtr filters;
+    int nfilters;
     int ndomains;
     bool error;
 };
 
-#define MATCH(FLAG) (data->flags & (FLAG))
-static void
-virDomainListPopulate(void *payload,
-                      const void *name ATTRIBUTE_UNUSED,
-                      void *opaque)
+enum {
+    VIR_DOMAIN_LIST_FILTER_NAME,
+    VIR_DOMAIN_LIST_FILTER_UUID,
+    VIR_DOMAIN_LIST_FILTER_TITLE,
+    VIR_DOMAIN_LIST_FILTER_METADATA,
+    VIR_DOMAIN_LIST_FILTER_METADATA_VALUE,
+
+    VIR_DOMAIN_LIST_FILTER_LAST
+};
+
+VIR_ENUM_DECL(virDomainListFilter)
+VIR_ENUM_IMPL(virDomainListFilter, VIR_DOMAIN_LIST_FILTER_LAST,
+              VIR_CONNECT_LIST_DOMAINS_FILTER_NAME,
+              VIR_CONNECT_LIST_DOMAINS_FILTER_UUID,
+              VIR_CONNECT_LIST_DOMAINS_FILTER_TITLE,
+              VIR_CONNECT_LIST_DOMAINS_FILTER_METADATA,
+              VIR_CONNECT_LIST_DOMAINS_FILTER_METADATA_VALUE)
+
+static int
+virDomainListFiltersValidate(virTypedParameterPtr filters,
+                             int nfilters)
 {
-    struct virDomainListData *data = opaque;
-    virDomainObjPtr vm = payload;
-    virDomainPtr dom;
+    int i;
 
-    if (data->error)
-        return;
+    for (i = 0; i < nfilters; i++) {
+        if (virDomainListFilterTypeFromString(filters[i].field) < 0) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("unknown domain list filter '%s'"),
+                           filters[i].field);
+            return -1;
+        }
+        if (filters[i].type != VIR_TYPED_PARAM_STRING ||
+            !filters[i].value.s) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("domain list filter '%s' must be a string"),
+                           filters[i].field);
+            return -1;
+        }
+        if (STREQ(filters[i].field,
+                  VIR_CONNECT_LIST_DOMAINS_FILTER_METADATA_VALUE) &&
+            !strchr(filters[i].value.s, ' ')) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("domain list filter '%s' must be a namespace "
+                             "URI and a value separated by a space"),
+                           filters[i].field);
+            return -1;
+        }
+    }
 
-    virDomainObjLock(vm);
-    /* check if the domain matches the filter */
+    return 0;
+}
+
+/* Return true if the text content of the <metadata> element of @def
+ * in the namespace given by @filter, "<uri> <text>", is <text> */
+static bool
+virDomainDefHasMetadataValue(virDomainDefPtr def,
+                             const char *filter)
+{
+    const char *value = strchr(filter, ' ');
+    xmlNodePtr node;
+    xmlChar *text;
+    bool ret;
+
+    if (!(node = virDomainDefFindMetadata(def, filter, value - filter)) ||
+        !(text = xmlNodeGetContent(node)))
+        return false;
+
+    ret = STREQ((const char *) text, value + 1);
+    xmlFree(text);
+    return ret;
+}
 
+/* Return true if the locked @vm passes @filters: values given for the
+ * same field are alternatives, distinct fields must all match. */
+static bool
+virDomainObjMatchFields(virDomainObjPtr vm,
+                        virTypedParameterPtr filters,
+                        int nfilters)
+{
+    bool seen[VIR_DOMAIN_LIST_FILTER_LAST] = { false };
+    bool matched[VIR_DOMAIN_LIST_FILTER_LAST] = { false };
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    int i;
+
+    if (!nfilters)
+        return true;
+
+    virUUIDFormat(vm->def->uuid, uuidstr);
+
+    for (i = 0; i < nfilters; i++) {
+        int type = virDomainListFilterTypeFromString(filters[i].field);
+        const char *value = filters[i].value.s;
+
+        seen[type] = true;
+        if (matched[type])
+            continue;
+
+        switch (type) {
+        case VIR_DOMAIN_LIST_FILTER_NAME:
+            matched[type] = fnmatch(value, vm->def->name, 0) == 0;
+            break;
+        case VIR_DOMAIN_LIST_FILTER_UUID:
+            matched[type] = STRCASEEQ(value, uuidstr);
+            break;
+        case VIR_DOMAIN_LIST_FILTER_TITLE:
+            matched[type] = vm->def->title &&
+                fnmatch(value, vm->def->title, 0) == 0;
+            break;
+        case VIR_DOMAIN_LIST_FILTER_METADATA:
+            matched[type] = !!virDomainDefFindMetadata(vm->def, value,
+                                                       strlen(value));
+            break;
+        case VIR_DOMAIN_LIST_FILTER_METADATA_VALUE:
+            matched[type] = virDomainDefHasMetadataValue(vm->def, value);
+            break;
+        }
+    }
+
+    for (i = 0; i < VIR_DOMAIN_LIST_FILTER_LAST; i++) {
+        if (seen[i] && !matched[i])
+            return false;
+    }
+
+    return true;
+}
+
+#define MATCH(FLAG) (flags & (FLAG))
+/* Return true if the locked @vm matches the virConnectListAllDomains
+ * style filter in @flags. */
+static bool
+virDomainObjMatchFilter(virDomainObjPtr vm,
+                        unsigned int flags)
+{
     /* filter by active state */
     if (MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE) &&
         !((MATCH(VIR_CONNECT_LIST_DOMAINS_ACTIVE) &&
            virDomainObjIsActive(vm)) ||
           (MATCH(VIR_CONNECT_LIST_DOMAINS_INACTIVE) &&
            !virDomainObjIsActive(vm))))
-        goto cleanup;
+        return false;
 
     /* filter by persistence */
     if (MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT) &&
@@ -15839,7 +17442,7 @@ virDomainListPopulate(void *payload,
            vm->persistent) ||
           (MATCH(VIR_CONNECT_LIST_DOMAINS_TRANSIENT) &&
            !vm->persistent)))
-        goto cleanup;
+        return false;
 
     /* filter by domain state */
     if (MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE)) {
@@ -15854,7 +17457,7 @@ virDomainListPopulate(void *payload,
                (st != VIR_DOMAIN_RUNNING &&
                 st != VIR_DOMAIN_PAUSED &&
                 st != VIR_DOMAIN_SHUTOFF))))
-            goto cleanup;
+            return false;
     }
 
     /* filter by existence of managed save state */
@@ -15863,26 +17466,48 @@ virDomainListPopulate(void *payload,
            vm->hasManagedSave) ||
           (MATCH(VIR_CONNECT_LIST_DOMAINS_NO_MANAGEDSAVE) &&
            !vm->hasManagedSave)))
-            goto cleanup;
+            return false;
 
     /* filter by autostart option */
     if (MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_AUTOSTART) &&
         !((MATCH(VIR_CONNECT_LIST_DOMAINS_AUTOSTART) && vm->autostart) ||
           (MATCH(VIR_CONNECT_LIST_DOMAINS_NO_AUTOSTART) && !vm->autostart)))
-        goto cleanup;
+        return false;
 
     /* filter by snapshot existence */
     if (MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_SNAPSHOT)) {
         int nsnap = virDomainSnapshotObjListNum(vm->snapshots, NULL, 0);
         if (!((MATCH(VIR_CONNECT_LIST_DOMAINS_HAS_SNAPSHOT) && nsnap > 0) ||
               (MATCH(VIR_CONNECT_LIST_DOMAINS_NO_SNAPSHOT) && nsnap <= 0)))
-            goto cleanup;
+            return false;
     }
 
+    return true;
+}
+#undef MATCH
+
+static void
+virDomainListPopulate(void *payload,
+                      const void *name ATTRIBUTE_UNUSED,
+                      void *opaque)
+{
+    struct virDomainListData *data = opaque;
+    virDomainObjPtr vm = payload;
+    virDomainPtr dom;
+
+    if (data->error)
+        return;
+
+    virDomainObjLock(vm);
+    /* check if the domain matches the filter */
+    if (!virDomainObjMatchFilter(vm, data->flags) ||
+        !virDomainObjMatchFields(vm, data->filters, data->nfilters))
+        goto cleanup;
+
     /* just count the machines */
     if (!data->domains) {
         data->ndomains++;
-        return;
+        goto cleanup;
     }
 
     if (!(dom = virGetDomain(data->conn, vm->def->name, vm->def->uuid))) {
@@ -15898,27 +17523,134 @@ cleanup:
     virDomainObjUnlock(vm);
     return;
 }
-#undef MATCH
 
 int
 virDomainList(virConnectPtr conn,
-              virHashTablePtr domobjs,
+              virDomainObjListPtr doms,
               virDomainPtr **domains,
               unsigned int flags)
+{
+    return virDomainListFiltered(conn, doms, domains, NULL, 0, flags);
+}
+
+struct virDomainObjListMetaCollectData {
+    virHashTablePtr candidates;
+    bool error;
+};
+
+static void
+virDomainObjListMetaCollect(void *payload,
+                            const void *name,
+                            void *opaque)
+{
+    struct virDomainObjListMetaCollectData *data = opaque;
+
+    if (!data->error &&
+        virHashUpdateEntry(data->candidates, name, payload) < 0)
+        data->error = true;
+}
+
+/*
+ * Look the domains matching the "metadata.value" @filters up in the
+ * metadata index of @doms, whose lock must be held. Only usable when
+ * every such filter is for an indexed namespace.
+ *
+ * Returns the hash table of uuid string -> virDomainObj of the domains
+ * that may match, or NULL if all of them have to be checked.
+ */
+static virHashTablePtr
+virDomainObjListMetaCandidates(virDomainObjListPtr doms,
+                               virTypedParameterPtr filters,
+                               int nfilters)
+{
+    struct virDomainObjListMetaCollectData data = { NULL, false };
+    bool usable = false;
+    int i;
+    int j;
+
+    virMutexLock(&doms->metaLock);
+    if (!doms->metaURIs)
+        goto cleanup;
+
+    for (i = 0; i < nfilters; i++) {
+        const char *value = filters[i].value.s;
+        size_t len = strchr(value, ' ') - value;
+        bool indexed = false;
+
+        if (STRNEQ(filters[i].field,
+                   VIR_CONNECT_LIST_DOMAINS_FILTER_METADATA_VALUE))
+            continue;
+
+        for (j = 0; doms->metaURIs[j]; j++) {
+            if (strlen(doms->metaURIs[j]) == len &&
+                STREQLEN(doms->metaURIs[j], value, len))
+                indexed = true;
+        }
+        if (!indexed)
+            goto cleanup;
+        usable = true;
+    }
+
+    if (!usable || !(data.candidates = virHashCreate(10, NULL)))
+        goto cleanup;
+
+    for (i = 0; i < nfilters; i++) {
+        virHashTablePtr set;
+
+        if (STREQ(filters[i].field,
+                  VIR_CONNECT_LIST_DOMAINS_FILTER_METADATA_VALUE) &&
+            (set = virHashLookup(doms->objsMeta, filters[i].value.s)))
+            virHashForEach(set, virDomainObjListMetaCollect, &data);
+    }
+
+cleanup:
+    virMutexUnlock(&doms->metaLock);
+    if (data.error) {
+        /* Missing candidates would hide matching domains */
+        virHashFree(data.candidates);
+        data.candidates = NULL;
+    }
+    if (usable && !data.candidates)
+        virResetLastError();
+    return data.candidates;
+}
+
+/*
+ * Like virDomainList, but only report the domains that also match
+ * @filters, see virConnectListAllDomainsFiltered.  The filters are
+ * checked while walking the list, with each domain locked in turn.
+ */
+int
+virDomainListFiltered(virConnectPtr conn,
+                      virDomainObjListPtr doms,
+                      virDomainPtr **domains,
+                      virTypedParameterPtr filters,
+                      int nfilters,
+                      unsigned int flags)
 {
     int ret = -1;
     int i;
+    virHashTablePtr candidates = NULL;
 
-    struct virDomainListData data = { conn, NULL, flags, 0, false };
+    struct virDomainListData data = { conn, NULL, flags, filters, nfilters,
+                                      0, false };
 
+    if (virDomainListFiltersValidate(filters, nfilters) < 0)
+        return -1;
+
+    virMutexLock(&doms->lock);
     if (domains) {
-        if (VIR_ALLOC_N(data.domains, virHashSize(domobjs) + 1) < 0) {
+        if (VIR_ALLOC_N(data.domains, virHashSize(doms->objs) + 1) < 0) {
             virReportOOMError();
             goto cleanup;
         }
     }
 
-    virHashForEach(domobjs, virDomainListPopulate, &data);
+    /* Domains indexed under the wanted metadata are the only ones
+     * worth checking; they are still matched against all filters */
+    candidates = virDomainObjListMetaCandidates(doms, filters, nfilters);
+    virHashForEach(candidates ? candidates : doms->objs,
+                   virDomainListPopulate, &data);
 
     if (data.error)
         goto cleanup;
@@ -15933,9 +17665,10 @@ virDomainList(virConnectPtr conn,
     ret = data.ndomains;
 
 cleanup:
+    virMutexUnlock(&doms->lock);
+    virHashFree(candidates);
     if (data.domains) {
-        int count = virHashSize(domobjs);
-        for (i = 0; i < count; i++)
+        for (i = 0; i < data.ndomains; i++)
             virObjectUnref(data.domains[i]);
     }
 
@@ -15943,6 +17676,58 @@ cleanup:
     return ret;
 }
 
+struct virDomainObjListCollectData {
+    virDomainObjPtr *vms;
+    size_t nvms;
+    unsigned int flags;
+};
+
+static void
+virDomainObjListCollectIterator(void *payload,
+                                const void *name ATTRIBUTE_UNUSED,
+                                void *opaque)
+{
+    struct virDomainObjListCollectData *data = opaque;
+    virDomainObjPtr vm = payload;
+
+    virDomainObjLock(vm);
+    if (!vm->removing && virDomainObjMatchFilter(vm, data->flags))
+        data->vms[data->nvms++] = virObjectRef(vm);
+    virDomainObjUnlock(vm);
+}
+
+/*
+ * Collect the domain objects matching the virConnectListAllDomains
+ * style filter in @flags into @vms.  Unlike virDomainList, the objects
+ * themselves are returned, unlocked and with a reference held, so that
+ * the caller can work on each of them in turn without going back to
+ * the list; release them with virObjectUnref and free the array.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virDomainObjListCollect(virDomainObjListPtr doms,
+                        virDomainObjPtr **vms,
+                        size_t *nvms,
+                        unsigned int flags)
+{
+    struct virDomainObjListCollectData data = { NULL, 0, flags };
+
+    virMutexLock(&doms->lock);
+    if (VIR_ALLOC_N(data.vms, virHashSize(doms->objs)) < 0) {
+        virMutexUnlock(&doms->lock);
+        virReportOOMError();
+        return -1;
+    }
+
+    virHashForEach(doms->objs, virDomainObjListCollectIterator, &data);
+    virMutexUnlock(&doms->lock);
+
+    *nvms = data.nvms;
+    *vms = data.vms;
+    return 0;
+}
+
 virSecurityLabelDefPtr
 virDomainDefGetSecurityLabelDef(virDomainDefPtr def, const char *model)
 {
@@ -629,6 +629,7 @@ struct _virDomainDiskDef {
     int ioeventfd;
     int event_idx;
     int copy_on_read;
+    unsigned int iothread; /* 0 means the main loop, otherwise an <iothreads> id */
     int snapshot; /* enum virDomainSnapshotLocation, snapshot_conf.h */
     int startupPolicy; /* enum virDomainStartupPolicy */
     unsigned int readonly : 1;
@@ -757,6 +758,7 @@ struct _virDomainFSDef {
     virDomainDeviceInfo info;
     unsigned long long space_hard_limit; /* in bytes */
     unsigned long long space_soft_limit; /* in bytes */
+    char *fstype; /* detected by the LXC controller, not in the XML */
 };
 
 
@@ -841,6 +843,7 @@ struct _virDomainNetDef {
             enum virDomainNetVirtioTxModeType txmode;
             enum virDomainIoEventFd ioeventfd;
             enum virDomainVirtioEventIdx event_idx;
+            unsigned int queues; /* Multiqueue virtio-net */
         } virtio;
     } driver;
     union {
@@ -1660,6 +1663,13 @@ virDomainVcpuPinDefPtr virDomainVcpuPinFindByVcpu(virDomainVcpuPinDefPtr *def,
                                                   int nvcpupin,
                                                   int vcpu);
 
+typedef struct _virDomainNumatuneMemNode virDomainNumatuneMemNode;
+typedef virDomainNumatuneMemNode *virDomainNumatuneMemNodePtr;
+struct _virDomainNumatuneMemNode {
+    virBitmapPtr nodemask; /* host nodes, NULL if the cell is not bound */
+    int mode; /* enum virDomainNumatuneMemMode */
+};
+
 typedef struct _virDomainNumatuneDef virDomainNumatuneDef;
 typedef virDomainNumatuneDef *virDomainNumatuneDefPtr;
 struct _virDomainNumatuneDef {
@@ -1669,18 +1679,52 @@ struct _virDomainNumatuneDef {
         int placement_mode; /* enum virDomainNumatuneMemPlacementMode */
     } memory;
 
+    /* Indexed by guest NUMA cell id */
+    size_t nmem_nodes;
+    virDomainNumatuneMemNodePtr mem_nodes;
+
     /* Future NUMA tuning related stuff should go here. */
 };
 
-typedef struct _virBlkioDeviceWeight virBlkioDeviceWeight;
-typedef virBlkioDeviceWeight *virBlkioDeviceWeightPtr;
-struct _virBlkioDeviceWeight {
+bool virDomainNumatuneHasMemNodes(virDomainNumatuneDefPtr numatune)
+    ATTRIBUTE_NONNULL(1);
+
+typedef struct _virDomainHugePage virDomainHugePage;
+typedef virDomainHugePage *virDomainHugePagePtr;
+struct _virDomainHugePage {
+    virBitmapPtr nodemask; /* guest NUMA cells, NULL for all others */
+    unsigned long long size; /* in kibibytes */
+};
+
+typedef struct _virBlkioDevice virBlkioDevice;
+typedef virBlkioDevice *virBlkioDevicePtr;
+struct _virBlkioDevice {
     char *path;
     unsigned int weight;
+    unsigned int riops;
+    unsigned int wiops;
+    unsigned long long rbps;
+    unsigned long long wbps;
 };
 
-void virBlkioDeviceWeightArrayClear(virBlkioDeviceWeightPtr deviceWeights,
-                                    int ndevices);
+void virBlkioDeviceArrayClear(virBlkioDevicePtr devices,
+                              int ndevices);
+
+/* Throttle limits shared by several host block devices: the limits
+ * apply to the sum of I/O the domain does on all of @paths. */
+typedef struct _virBlkioThrottleGroup virBlkioThrottleGroup;
+typedef virBlkioThrottleGroup *virBlkioThrottleGroupPtr;
+struct _virBlkioThrottleGroup {
+    size_t npaths;
+    char **paths;
+    unsigned int riops;
+    unsigned int wiops;
+    unsigned long long rbps;
+    unsigned long long wbps;
+};
+
+void virBlkioThrottleGroupArrayClear(virBlkioThrottleGroupPtr groups,
+                                     int ngroups);
 
 
 /*
@@ -1703,13 +1747,18 @@ struct _virDomainDef {
         unsigned int weight;
 
         size_t ndevices;
-        virBlkioDeviceWeightPtr devices;
+        virBlkioDevicePtr devices;
+
+        size_t ngroups;
+        virBlkioThrottleGroupPtr groups;
     } blkio;
 
     struct {
         unsigned long long max_balloon; /* in kibibytes */
         unsigned long long cur_balloon; /* in kibibytes */
         bool hugepage_backed;
+        size_t nhugepages;
+        virDomainHugePagePtr hugepages;
         int dump_core; /* enum virDomainMemDump */
         unsigned long long hard_limit; /* in kibibytes */
         unsigned long long soft_limit; /* in kibibytes */
@@ -1720,6 +1769,7 @@ struct _virDomainDef {
     unsigned short maxvcpus;
     int placement_mode;
     virBitmapPtr cpumask;
+    unsigned int iothreads;
 
     struct {
         unsigned long shares;
@@ -1730,6 +1780,8 @@ struct _virDomainDef {
         int nvcpupin;
         virDomainVcpuPinDefPtr *vcpupin;
         virDomainVcpuPinDefPtr emulatorpin;
+        int niothreadpin;
+        virDomainVcpuPinDefPtr *iothreadpin;
     } cputune;
 
     virDomainNumatuneDef numatune;
@@ -1747,6 +1799,9 @@ struct _virDomainDef {
         int s4;
     } pm;
 
+    /* Domains marked for autostart with a higher value start first */
+    int autostartPriority;
+
     virDomainOSDef os;
     char *emulator;
     int features;
@@ -1823,6 +1878,18 @@ struct _virDomainDef {
 
     /* Application-specific custom metadata */
     xmlNodePtr metadata;
+
+    /* Lookup caches over disks and nets, built on demand for guests
+     * with many devices; see virDomainDiskIndexByName */
+    virHashTablePtr diskIndex;
+    size_t diskIndexCount;
+    virHashTablePtr netIndex;
+    size_t netIndexCount;
+
+    /* Formatted XML cached on behalf of the driver, keyed by the
+     * format flags; see virDomainDefSetXMLCache */
+    char *xmlCache;
+    unsigned int xmlCacheFlags;
 };
 
 enum virDomainTaintFlags {
@@ -1857,6 +1924,8 @@ struct _virDomainObj {
     unsigned int autostart : 1;
     unsigned int persistent : 1;
     unsigned int updated : 1;
+    unsigned int removing : 1; /* lookups must skip it, see
+                                  virDomainRemoveInactive */
 
     virDomainDefPtr def; /* The current definition */
     virDomainDefPtr newDef; /* New definition to activate at shutdown */
@@ -1875,9 +1944,41 @@ struct _virDomainObj {
 typedef struct _virDomainObjList virDomainObjList;
 typedef virDomainObjList *virDomainObjListPtr;
 struct _virDomainObjList {
+    /* Protects objs, so lookups don't need the driver lock.
+     * Must be acquired before, never while holding, any
+     * virDomainObj lock */
+    virMutex lock;
+
     /* uuid string -> virDomainObj  mapping
      * for O(1), lockless lookup-by-uuid */
     virHashTable *objs;
+
+    /* name -> virDomainObj index, kept in sync with objs; holds
+     * no reference of its own */
+    virHashTable *objsName;
+
+    /* id string -> virDomainObj cache of running domains. IDs are
+     * assigned by the drivers without the list lock, so entries are
+     * only hints, checked against the domain before use and rebuilt
+     * whenever a lookup misses */
+    virHashTable *objsID;
+
+    /* Protects metaURIs and objsMeta. May be acquired while holding
+     * a virDomainObj lock, but no virDomainObj lock may be acquired
+     * while holding it */
+    virMutex metaLock;
+
+    /* Namespace URIs of the <metadata> elements to index, NULL
+     * terminated, or NULL */
+    char **metaURIs;
+
+    /* "<uri> <text>" -> hash table of uuid string -> virDomainObj,
+     * for the domains whose <metadata> has an element in one of
+     * metaURIs with that text content; holds no reference */
+    virHashTable *objsMeta;
+
+    /* Bumped atomically whenever a domain is added or removed */
+    int generation;
 };
 
 static inline bool
@@ -1890,6 +1991,13 @@ virDomainObjPtr virDomainObjNew(virCapsPtr caps);
 
 int virDomainObjListInit(virDomainObjListPtr objs);
 void virDomainObjListDeinit(virDomainObjListPtr objs);
+int virDomainObjListAdd(virDomainObjListPtr doms,
+                        virDomainObjPtr obj);
+unsigned long long virDomainObjListGetGeneration(virDomainObjListPtr doms);
+int virDomainObjListSetMetadataIndex(virDomainObjListPtr doms,
+                                     const char *const *uris);
+void virDomainObjListUpdateMetadataIndex(virDomainObjListPtr doms,
+                                         virDomainObjPtr obj);
 
 virDomainObjPtr virDomainFindByID(const virDomainObjListPtr doms,
                                   int id);
@@ -2013,6 +2121,14 @@ int virDomainDefFormatInternal(virDomainDefPtr def,
                                unsigned int flags,
                                virBufferPtr buf);
 
+const char *virDomainDefGetXMLCache(virDomainDefPtr def,
+                                    unsigned int flags);
+void virDomainDefSetXMLCache(virDomainDefPtr def,
+                             unsigned int flags,
+                             char *xml);
+void virDomainDefInvalidateXMLCache(virDomainDefPtr def);
+void virDomainObjInvalidateXMLCache(virDomainObjPtr obj);
+
 int virDomainDefCompatibleDevice(virDomainDefPtr def,
                                  virDomainDeviceDefPtr dev);
 
@@ -2159,6 +2275,9 @@ int virDomainObjListGetActiveIDs(virDomainObjListPtr doms,
 int virDomainObjListGetInactiveNames(virDomainObjListPtr doms,
                                      char **const names,
                                      int maxnames);
+int virDomainObjListForEach(virDomainObjListPtr doms,
+                            virHashIterator iter,
+                            void *data);
 
 typedef int (*virDomainSmartcardDefIterator)(virDomainDefPtr def,
                                              virDomainSmartcardDefPtr dev,
@@ -2344,10 +2463,26 @@ VIR_ENUM_DECL(virDomainStartupPolicy)
                  VIR_CONNECT_LIST_DOMAINS_FILTERS_AUTOSTART   | \
                  VIR_CONNECT_LIST_DOMAINS_FILTERS_SNAPSHOT)
 
-int virDomainList(virConnectPtr conn, virHashTablePtr domobjs,
+int virDomainList(virConnectPtr conn, virDomainObjListPtr doms,
                   virDomainPtr **domains, unsigned int flags);
+int virDomainListFiltered(virConnectPtr conn, virDomainObjListPtr doms,
+                          virDomainPtr **domains,
+                          virTypedParameterPtr filters, int nfilters,
+                          unsigned int flags);
+
+int virDomainObjListCollect(virDomainObjListPtr doms,
+                            virDomainObjPtr **vms,
+                            size_t *nvms,
+                            unsigned int flags);
 
 virDomainVcpuPinDefPtr virDomainLookupVcpuPin(virDomainDefPtr def,
                                               int vcpuid);
 
+void virBlkioDeviceGetThrottle(virDomainDefPtr def,
+                               const char *path,
+                               unsigned int *riops,
+                               unsigned int *wiops,
+                               unsigned long long *rbps,
+                               unsigned long long *wbps);
+
 #endif /* __DOMAIN_CONF_H */
@@ -1399,6 +1399,47 @@ virDomainEventQueueDispatch(virDomainEventQueuePtr queue,
     queue->count = 0;
 }
 
+/**
+ * virDomainEventQueueCoalesce:
+ * @evtQueue: the dom event queue
+ * @event: the event about to be queued
+ *
+ * Drop the queued event @event makes redundant, if any.  Only events
+ * reporting a new absolute value (balloon size, RTC offset) are
+ * coalesced, and only with the latest queued event of the same domain,
+ * so ordering relative to any other event of that domain is kept.
+ * Clients thereby see only the newest value for a burst of changes
+ * arriving within one flush, and remote clients get one message
+ * instead of one per change.
+ */
+static void
+virDomainEventQueueCoalesce(virDomainEventQueuePtr evtQueue,
+                            virDomainEventPtr event)
+{
+    int i;
+
+    if (event->eventID != VIR_DOMAIN_EVENT_ID_BALLOON_CHANGE &&
+        event->eventID != VIR_DOMAIN_EVENT_ID_RTC_CHANGE)
+        return;
+
+    for (i = evtQueue->count - 1 ; i >= 0 ; i--) {
+        virDomainEventPtr old = evtQueue->events[i];
+
+        if (memcmp(old->dom.uuid, event->dom.uuid, VIR_UUID_BUFLEN) != 0)
+            continue;
+
+        if (old->eventID == event->eventID) {
+            VIR_DEBUG("Dropping superseded event %d for domain %s",
+                      old->eventID, old->dom.name);
+            virDomainEventFree(old);
+            memmove(evtQueue->events + i, evtQueue->events + i + 1,
+                    sizeof(*evtQueue->events) * (evtQueue->count - i - 1));
+            evtQueue->count--;
+        }
+        return;
+    }
+}
+
 void
 virDomainEventStateQueue(virDomainEventStatePtr state,
                          virDomainEventPtr event)
@@ -1410,6 +1451,8 @@ virDomainEventStateQueue(virDomainEventStatePtr state,
 
     virDomainEventStateLock(state);
 
+    virDomainEventQueueCoalesce(state->queue, event);
+
     if (virDomainEventQueuePush(state->queue, event) < 0) {
         VIR_DEBUG("Error adding event to queue");
         virDomainEventFree(event);
@@ -1673,3 +1716,94 @@ virDomainEventStateEventID(virConnectPtr conn,
     virDomainEventStateUnlock(state);
     return ret;
 }
+
+
+/**
+ * virDomainEventStateCallbackDomain:
+ * @conn: connection associated with the callback
+ * @state: domain event state
+ * @callbackID: the callback to query
+ * @uuid: filled with the UUID of the domain the callback is bound to
+ *
+ * Query which domain, if any, the callback @callbackID for
+ * connection @conn is restricted to
+ *
+ * Returns 1 if the callback only receives events for the domain
+ * stored in @uuid, 0 if it receives events for all domains, -1 if
+ * there is no such callback
+ */
+int
+virDomainEventStateCallbackDomain(virConnectPtr conn,
+                                  virDomainEventStatePtr state,
+                                  int callbackID,
+                                  unsigned char *uuid)
+{
+    virDomainEventCallbackListPtr cbList;
+    int ret = -1;
+    int i;
+
+    virDomainEventStateLock(state);
+    cbList = state->callbacks;
+    for (i = 0 ; i < cbList->count ; i++) {
+        virDomainEventCallbackPtr cb = cbList->callbacks[i];
+
+        if (cb->deleted ||
+            cb->callbackID != callbackID ||
+            cb->conn != conn)
+            continue;
+
+        if (cb->dom) {
+            memcpy(uuid, cb->dom->uuid, VIR_UUID_BUFLEN);
+            ret = 1;
+        } else {
+            ret = 0;
+        }
+        break;
+    }
+    virDomainEventStateUnlock(state);
+    return ret;
+}
+
+
+/**
+ * virDomainEventStateCountID:
+ * @conn: connection associated with the callbacks, or NULL for all
+ * @state: domain event state
+ * @eventID: ID of the event type
+ * @uuid: domain the callbacks are bound to, or NULL
+ *
+ * Count the callbacks of connection @conn for events of type @eventID
+ * which are restricted to the domain @uuid, or if @uuid is NULL, which
+ * receive events for all domains.  Lifecycle callbacks registered with
+ * virDomainEventStateRegister count as the latter.
+ *
+ * Returns the number of matching callbacks
+ */
+int
+virDomainEventStateCountID(virConnectPtr conn,
+                           virDomainEventStatePtr state,
+                           int eventID,
+                           const unsigned char *uuid)
+{
+    virDomainEventCallbackListPtr cbList;
+    int ret = 0;
+    int i;
+
+    virDomainEventStateLock(state);
+    cbList = state->callbacks;
+    for (i = 0 ; i < cbList->count ; i++) {
+        virDomainEventCallbackPtr cb = cbList->callbacks[i];
+
+        if (cb->deleted ||
+            cb->eventID != eventID ||
+            (conn && cb->conn != conn))
+            continue;
+
+        if (uuid ?
+            (cb->dom && memcmp(cb->dom->uuid, uuid, VIR_UUID_BUFLEN) == 0) :
+            !cb->dom)
+            ret++;
+    }
+    virDomainEventStateUnlock(state);
+    return ret;
+}
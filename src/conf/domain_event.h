@@ -172,5 +172,17 @@ virDomainEventStateEventID(virConnectPtr conn,
                            virDomainEventStatePtr state,
                            int callbackID)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int
+virDomainEventStateCallbackDomain(virConnectPtr conn,
+                                  virDomainEventStatePtr state,
+                                  int callbackID,
+                                  unsigned char *uuid)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4);
+int
+virDomainEventStateCountID(virConnectPtr conn,
+                           virDomainEventStatePtr state,
+                           int eventID,
+                           const unsigned char *uuid)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 
 #endif
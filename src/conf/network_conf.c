@@ -44,6 +44,7 @@
 #include "buf.h"
 #include "c-ctype.h"
 #include "virfile.h"
+#include "threadpool.h"
 
 #define MAX_BRIDGE_ID 256
 #define VIR_FROM_THIS VIR_FROM_NETWORK
@@ -63,31 +64,72 @@ VIR_ENUM_IMPL(virNetworkForwardHostdevDevice,
 virNetworkObjPtr virNetworkFindByUUID(const virNetworkObjListPtr nets,
                                       const unsigned char *uuid)
 {
-    unsigned int i;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    virNetworkObjPtr net;
 
-    for (i = 0 ; i < nets->count ; i++) {
-        virNetworkObjLock(nets->objs[i]);
-        if (!memcmp(nets->objs[i]->def->uuid, uuid, VIR_UUID_BUFLEN))
-            return nets->objs[i];
-        virNetworkObjUnlock(nets->objs[i]);
-    }
+    if (!nets->objsUUID)
+        return NULL;
 
-    return NULL;
+    virUUIDFormat(uuid, uuidstr);
+    if (!(net = virHashLookup(nets->objsUUID, uuidstr)))
+        return NULL;
+
+    virNetworkObjLock(net);
+    /* A def swapped in on shutdown may carry another UUID */
+    if (memcmp(net->def->uuid, uuid, VIR_UUID_BUFLEN) != 0) {
+        virNetworkObjUnlock(net);
+        return NULL;
+    }
+    return net;
 }
 
 virNetworkObjPtr virNetworkFindByName(const virNetworkObjListPtr nets,
                                       const char *name)
 {
-    unsigned int i;
+    virNetworkObjPtr net;
 
-    for (i = 0 ; i < nets->count ; i++) {
-        virNetworkObjLock(nets->objs[i]);
-        if (STREQ(nets->objs[i]->def->name, name))
-            return nets->objs[i];
-        virNetworkObjUnlock(nets->objs[i]);
+    if (!nets->objsName)
+        return NULL;
+
+    if (!(net = virHashLookup(nets->objsName, name)))
+        return NULL;
+
+    virNetworkObjLock(net);
+    return net;
+}
+
+static int
+virNetworkObjListIndexAdd(virNetworkObjListPtr nets,
+                          virNetworkObjPtr net)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    if (!nets->objsUUID && !(nets->objsUUID = virHashCreate(50, NULL)))
+        return -1;
+    if (!nets->objsName && !(nets->objsName = virHashCreate(50, NULL)))
+        return -1;
+
+    virUUIDFormat(net->def->uuid, uuidstr);
+    if (virHashAddEntry(nets->objsUUID, uuidstr, net) < 0)
+        return -1;
+    if (virHashAddEntry(nets->objsName, net->def->name, net) < 0) {
+        virHashRemoveEntry(nets->objsUUID, uuidstr);
+        return -1;
     }
 
-    return NULL;
+    return 0;
+}
+
+static void
+virNetworkObjListIndexRemove(virNetworkObjListPtr nets,
+                             virNetworkObjPtr net)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(net->def->uuid, uuidstr);
+    if (virHashLookup(nets->objsUUID, uuidstr) == net)
+        virHashRemoveEntry(nets->objsUUID, uuidstr);
+    virHashRemoveEntry(nets->objsName, net->def->name);
 }
 
 
@@ -193,6 +235,9 @@ virNetworkForwardDefClear(virNetworkForwardDefPtr def)
         virNetworkForwardIfDefClear(&def->ifs[ii]);
     }
     VIR_FREE(def->ifs);
+
+    virBitmapFree(def->freeIfs);
+    def->freeIfs = NULL;
 }
 
 void
@@ -250,6 +295,9 @@ void virNetworkObjListFree(virNetworkObjListPtr nets)
 
     VIR_FREE(nets->objs);
     nets->count = 0;
+    virHashFree(nets->objsUUID);
+    virHashFree(nets->objsName);
+    nets->objsUUID = nets->objsName = NULL;
 }
 
 /*
@@ -318,10 +366,20 @@ virNetworkAssignDef(virNetworkObjListPtr nets,
     virNetworkObjPtr network;
 
     if ((network = virNetworkFindByName(nets, def->name))) {
+        char olduuidstr[VIR_UUID_STRING_BUFLEN];
+        char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+        virUUIDFormat(network->def->uuid, olduuidstr);
         if (virNetworkObjAssignDef(network, def, live) < 0) {
             virNetworkObjUnlock(network);
             return NULL;
         }
+
+        virUUIDFormat(network->def->uuid, uuidstr);
+        if (STRNEQ(uuidstr, olduuidstr)) {
+            virHashRemoveEntry(nets->objsUUID, olduuidstr);
+            ignore_value(virHashUpdateEntry(nets->objsUUID, uuidstr, network));
+        }
         return network;
     }
 
@@ -354,8 +412,13 @@ virNetworkAssignDef(virNetworkObjListPtr nets,
     ignore_value(virBitmapSetBit(network->class_id, 2));
 
     network->def = def;
+    if (virNetworkObjListIndexAdd(nets, network) < 0) {
+        network->def = NULL;
+        goto error;
+    }
     nets->objs[nets->count] = network;
     nets->count++;
+    nets->generation++;
 
     return network;
 error:
@@ -533,6 +596,7 @@ void virNetworkRemoveInactive(virNetworkObjListPtr nets,
         virNetworkObjLock(nets->objs[i]);
         if (nets->objs[i] == net) {
             virNetworkObjUnlock(nets->objs[i]);
+            virNetworkObjListIndexRemove(nets, nets->objs[i]);
             virNetworkObjFree(nets->objs[i]);
 
             if (i < (nets->count - 1))
@@ -543,6 +607,7 @@ void virNetworkRemoveInactive(virNetworkObjListPtr nets,
                 ; /* Failure to reduce memory allocation isn't fatal */
             }
             nets->count--;
+            nets->generation++;
 
             break;
         }
@@ -2348,13 +2413,15 @@ cleanup:
     return ret;
 }
 
-virNetworkObjPtr virNetworkLoadConfig(virNetworkObjListPtr nets,
-                                      const char *configDir,
-                                      const char *autostartDir,
-                                      const char *name)
+/* @def is consumed, whether this succeeds or not */
+static virNetworkObjPtr
+virNetworkLoadConfigDef(virNetworkObjListPtr nets,
+                        const char *configDir,
+                        const char *autostartDir,
+                        const char *name,
+                        virNetworkDefPtr def)
 {
     char *configFile = NULL, *autostartLink = NULL;
-    virNetworkDefPtr def = NULL;
     virNetworkObjPtr net;
     int autostart;
 
@@ -2366,9 +2433,6 @@ virNetworkObjPtr virNetworkLoadConfig(virNetworkObjListPtr nets,
     if ((autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
         goto error;
 
-    if (!(def = virNetworkDefParseFile(configFile)))
-        goto error;
-
     if (!STREQ(name, def->name)) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Network config filename '%s'"
@@ -2406,12 +2470,60 @@ error:
     return NULL;
 }
 
+virNetworkObjPtr virNetworkLoadConfig(virNetworkObjListPtr nets,
+                                      const char *configDir,
+                                      const char *autostartDir,
+                                      const char *name)
+{
+    char *configFile = NULL;
+    virNetworkDefPtr def;
+
+    if ((configFile = virNetworkConfigFile(configDir, name)) == NULL)
+        return NULL;
+    def = virNetworkDefParseFile(configFile);
+    VIR_FREE(configFile);
+    if (!def)
+        return NULL;
+
+    return virNetworkLoadConfigDef(nets, configDir, autostartDir, name, def);
+}
+
+
+/* Networks are parsed on several threads; adding them to the list,
+ * which may need to pick bridge names, stays serial */
+#define VIR_NETWORK_LOAD_CONFIG_WORKERS 8
+
+typedef struct _virNetworkLoadConfigJob virNetworkLoadConfigJob;
+typedef virNetworkLoadConfigJob *virNetworkLoadConfigJobPtr;
+struct _virNetworkLoadConfigJob {
+    char *name;
+    virNetworkDefPtr def;
+};
+
+static void
+virNetworkLoadConfigParse(void *jobdata, void *opaque)
+{
+    virNetworkLoadConfigJobPtr job = jobdata;
+    const char *configDir = opaque;
+    char *configFile;
+
+    if ((configFile = virNetworkConfigFile(configDir, job->name))) {
+        job->def = virNetworkDefParseFile(configFile);
+        VIR_FREE(configFile);
+    }
+}
+
 int virNetworkLoadAllConfigs(virNetworkObjListPtr nets,
                              const char *configDir,
                              const char *autostartDir)
 {
     DIR *dir;
     struct dirent *entry;
+    virNetworkLoadConfigJobPtr jobs = NULL;
+    size_t njobs = 0;
+    size_t maxjobs = 0;
+    int ret = -1;
+    size_t i;
 
     if (!(dir = opendir(configDir))) {
         if (errno == ENOENT)
@@ -2423,27 +2535,55 @@ int virNetworkLoadAllConfigs(virNetworkObjListPtr nets,
     }
 
     while ((entry = readdir(dir))) {
-        virNetworkObjPtr net;
-
         if (entry->d_name[0] == '.')
             continue;
 
         if (!virFileStripSuffix(entry->d_name, ".xml"))
             continue;
 
+        if (VIR_RESIZE_N(jobs, maxjobs, njobs, 1) < 0 ||
+            !(jobs[njobs].name = strdup(entry->d_name))) {
+            virReportOOMError();
+            closedir(dir);
+            goto cleanup;
+        }
+        njobs++;
+    }
+
+    closedir(dir);
+
+    xmlInitParser();
+    virThreadPoolRunJobs(VIR_NETWORK_LOAD_CONFIG_WORKERS,
+                         virNetworkLoadConfigParse, (void *) configDir,
+                         jobs, njobs, sizeof(*jobs));
+
+    for (i = 0; i < njobs; i++) {
+        virNetworkObjPtr net;
+
         /* NB: ignoring errors, so one malformed config doesn't
            kill the whole process */
-        net = virNetworkLoadConfig(nets,
-                                   configDir,
-                                   autostartDir,
-                                   entry->d_name);
+        if (!jobs[i].def)
+            continue;
+
+        net = virNetworkLoadConfigDef(nets,
+                                      configDir,
+                                      autostartDir,
+                                      jobs[i].name,
+                                      jobs[i].def);
+        jobs[i].def = NULL;
         if (net)
             virNetworkObjUnlock(net);
     }
 
-    closedir(dir);
+    ret = 0;
 
-    return 0;
+cleanup:
+    for (i = 0; i < njobs; i++) {
+        VIR_FREE(jobs[i].name);
+        virNetworkDefFree(jobs[i].def);
+    }
+    VIR_FREE(jobs);
+    return ret;
 }
 
 int virNetworkDeleteConfig(const char *configDir,
@@ -39,6 +39,7 @@
 # include "virmacaddr.h"
 # include "device_conf.h"
 # include "bitmap.h"
+# include "virhash.h"
 
 enum virNetworkForwardType {
     VIR_NETWORK_FORWARD_NONE   = 0,
@@ -151,6 +152,7 @@ struct _virNetworkForwardIfDef {
         char *dev;      /* name of device */
     }device;
     int connections; /* how many guest interfaces are connected to this device? */
+    int numaNode;    /* NUMA node of the device, -1 if unknown */
 };
 
 typedef struct _virNetworkForwardPfDef virNetworkForwardPfDef;
@@ -174,6 +176,11 @@ struct _virNetworkForwardDef {
 
     size_t nifs;
     virNetworkForwardIfDefPtr ifs;
+
+    /* Devices in @ifs with no connections, built by the network
+     * driver the first time a device is allocated from the pool.
+     */
+    virBitmapPtr freeIfs;
 };
 
 typedef struct _virPortGroupDef virPortGroupDef;
@@ -243,6 +250,14 @@ typedef virNetworkObjList *virNetworkObjListPtr;
 struct _virNetworkObjList {
     unsigned int count;
     virNetworkObjPtr *objs;
+
+    /* Lookup indexes of objs, created along with the first network */
+    virHashTablePtr objsUUID;   /* uuid string -> virNetworkObjPtr */
+    virHashTablePtr objsName;   /* name -> virNetworkObjPtr */
+
+    /* Bumped whenever a network is added, removed, started
+     * or stopped */
+    unsigned long long generation;
 };
 
 static inline int
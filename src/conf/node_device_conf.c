@@ -87,38 +87,165 @@ int virNodeDeviceHasCap(const virNodeDeviceObjPtr dev, const char *cap)
 }
 
 
+/* Key of @def in the WWN index, or NULL if it is not a FC HBA */
+static char *
+virNodeDeviceWWNKey(virNodeDeviceDefPtr def)
+{
+    virNodeDevCapsDefPtr cap;
+    char *key = NULL;
+
+    for (cap = def->caps; cap; cap = cap->next) {
+        if (cap->type == VIR_NODE_DEV_CAP_SCSI_HOST &&
+            (cap->data.scsi_host.flags & VIR_NODE_DEV_CAP_FLAG_HBA_FC_HOST) &&
+            cap->data.scsi_host.wwnn && cap->data.scsi_host.wwpn) {
+            if (virAsprintf(&key, "%s:%s",
+                            cap->data.scsi_host.wwnn,
+                            cap->data.scsi_host.wwpn) < 0)
+                virReportOOMError();
+            break;
+        }
+    }
+
+    return key;
+}
+
+
+static int
+virNodeDeviceObjListIndexInit(virNodeDeviceObjListPtr devs)
+{
+    if (!devs->byName &&
+        !(devs->byName = virHashCreate(50, NULL)))
+        return -1;
+    if (!devs->bySysfsPath &&
+        !(devs->bySysfsPath = virHashCreate(50, NULL)))
+        return -1;
+    if (!devs->byWWN &&
+        !(devs->byWWN = virHashCreate(10, NULL)))
+        return -1;
+    return 0;
+}
+
+
+static int
+virNodeDeviceObjListIndexMatch(const void *payload,
+                               const void *name ATTRIBUTE_UNUSED,
+                               const void *data)
+{
+    return payload == data;
+}
+
+
+static void
+virNodeDeviceObjListUnindexKey(virHashTablePtr table,
+                               const char *key,
+                               virNodeDeviceObjPtr dev)
+{
+    if (table && key && virHashLookup(table, key) == dev)
+        virHashRemoveEntry(table, key);
+}
+
+
+/* Must be called before @dev's definition is replaced or freed */
+static void
+virNodeDeviceObjListUnindex(virNodeDeviceObjListPtr devs,
+                            virNodeDeviceObjPtr dev)
+{
+    virNodeDeviceObjListUnindexKey(devs->byName, dev->def->name, dev);
+    virNodeDeviceObjListUnindexKey(devs->bySysfsPath,
+                                   dev->def->sysfs_path, dev);
+
+    /* The WWNs may have been refreshed from sysfs since the device
+     * was indexed, so look for it by value; there are few FC HBAs */
+    if (devs->byWWN)
+        virHashRemoveSet(devs->byWWN, virNodeDeviceObjListIndexMatch, dev);
+}
+
+
+static int
+virNodeDeviceObjListIndex(virNodeDeviceObjListPtr devs,
+                          virNodeDeviceObjPtr dev)
+{
+    char *wwn = NULL;
+    int ret = -1;
+
+    if (virNodeDeviceObjListIndexInit(devs) < 0)
+        goto cleanup;
+
+    if (virHashUpdateEntry(devs->byName, dev->def->name, dev) < 0)
+        goto cleanup;
+
+    if (dev->def->sysfs_path &&
+        virHashUpdateEntry(devs->bySysfsPath, dev->def->sysfs_path, dev) < 0)
+        goto cleanup;
+
+    if ((wwn = virNodeDeviceWWNKey(dev->def)) &&
+        virHashUpdateEntry(devs->byWWN, wwn, dev) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(wwn);
+    return ret;
+}
+
+
 virNodeDeviceObjPtr
 virNodeDeviceFindBySysfsPath(const virNodeDeviceObjListPtr devs,
                              const char *sysfs_path)
 {
-    unsigned int i;
+    virNodeDeviceObjPtr dev;
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(devs->objs[i]);
-        if ((devs->objs[i]->def->sysfs_path != NULL) &&
-            (STREQ(devs->objs[i]->def->sysfs_path, sysfs_path))) {
-            return devs->objs[i];
-        }
-        virNodeDeviceObjUnlock(devs->objs[i]);
+    if (!devs->bySysfsPath ||
+        !(dev = virHashLookup(devs->bySysfsPath, sysfs_path)))
+        return NULL;
+
+    virNodeDeviceObjLock(dev);
+    return dev;
+}
+
+
+/*
+ * The index is only as fresh as the last time the device was
+ * (re)assigned, so callers which refresh the FC host details
+ * themselves should fall back to a full scan if this finds nothing
+ */
+virNodeDeviceObjPtr
+virNodeDeviceFindByWWN(const virNodeDeviceObjListPtr devs,
+                       const char *wwnn,
+                       const char *wwpn)
+{
+    virNodeDeviceObjPtr dev;
+    char *key;
+
+    if (!devs->byWWN)
+        return NULL;
+
+    if (virAsprintf(&key, "%s:%s", wwnn, wwpn) < 0) {
+        virReportOOMError();
+        return NULL;
     }
 
-    return NULL;
+    dev = virHashLookup(devs->byWWN, key);
+    VIR_FREE(key);
+
+    if (dev)
+        virNodeDeviceObjLock(dev);
+    return dev;
 }
 
 
 virNodeDeviceObjPtr virNodeDeviceFindByName(const virNodeDeviceObjListPtr devs,
                                             const char *name)
 {
-    unsigned int i;
+    virNodeDeviceObjPtr dev;
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(devs->objs[i]);
-        if (STREQ(devs->objs[i]->def->name, name))
-            return devs->objs[i];
-        virNodeDeviceObjUnlock(devs->objs[i]);
-    }
+    if (!devs->byName ||
+        !(dev = virHashLookup(devs->byName, name)))
+        return NULL;
 
-    return NULL;
+    virNodeDeviceObjLock(dev);
+    return dev;
 }
 
 
@@ -166,6 +293,11 @@ void virNodeDeviceObjListFree(virNodeDeviceObjListPtr devs)
         virNodeDeviceObjFree(devs->objs[i]);
     VIR_FREE(devs->objs);
     devs->count = 0;
+
+    virHashFree(devs->byName);
+    virHashFree(devs->bySysfsPath);
+    virHashFree(devs->byWWN);
+    devs->byName = devs->bySysfsPath = devs->byWWN = NULL;
 }
 
 virNodeDeviceObjPtr virNodeDeviceAssignDef(virNodeDeviceObjListPtr devs,
@@ -174,8 +306,14 @@ virNodeDeviceObjPtr virNodeDeviceAssignDef(virNodeDeviceObjListPtr devs,
     virNodeDeviceObjPtr device;
 
     if ((device = virNodeDeviceFindByName(devs, def->name))) {
+        virNodeDeviceObjListUnindex(devs, device);
         virNodeDeviceDefFree(device->def);
         device->def = def;
+        if (virNodeDeviceObjListIndex(devs, device) < 0) {
+            /* Leave it findable by name at least */
+            virResetLastError();
+            ignore_value(virHashAddEntry(devs->byName, def->name, device));
+        }
         return device;
     }
 
@@ -202,6 +340,15 @@ virNodeDeviceObjPtr virNodeDeviceAssignDef(virNodeDeviceObjListPtr devs,
     }
     devs->objs[devs->count++] = device;
 
+    if (virNodeDeviceObjListIndex(devs, device) < 0) {
+        virNodeDeviceObjListUnindex(devs, device);
+        devs->count--;
+        device->def = NULL;
+        virNodeDeviceObjUnlock(device);
+        virNodeDeviceObjFree(device);
+        return NULL;
+    }
+
     return device;
 
 }
@@ -213,6 +360,8 @@ void virNodeDeviceObjRemove(virNodeDeviceObjListPtr devs,
 
     virNodeDeviceObjUnlock(dev);
 
+    virNodeDeviceObjListUnindex(devs, dev);
+
     for (i = 0; i < devs->count; i++) {
         virNodeDeviceObjLock(dev);
         if (devs->objs[i] == dev) {
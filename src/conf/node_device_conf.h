@@ -28,6 +28,7 @@
 # include "internal.h"
 # include "util.h"
 # include "threads.h"
+# include "virhash.h"
 
 # include <libxml/tree.h>
 
@@ -201,6 +202,12 @@ typedef virNodeDeviceObjList *virNodeDeviceObjListPtr;
 struct _virNodeDeviceObjList {
     unsigned int count;
     virNodeDeviceObjPtr *objs;
+
+    /* Lookup indexes, created on first use; the objects are
+     * owned by @objs */
+    virHashTablePtr byName;
+    virHashTablePtr bySysfsPath;
+    virHashTablePtr byWWN;              /* keyed by "wwnn:wwpn" */
 };
 
 typedef struct _virDeviceMonitorState virDeviceMonitorState;
@@ -210,6 +217,10 @@ struct _virDeviceMonitorState {
 
     virNodeDeviceObjList devs;		/* currently-known devices */
     void *privateData;			/* driver-specific private data */
+
+    /* Optional, fills in details of @def which are too expensive
+     * to look up for every device up front */
+    int (*updateDef)(virNodeDeviceDefPtr def);
 };
 
 
@@ -221,6 +232,9 @@ virNodeDeviceObjPtr
 virNodeDeviceFindBySysfsPath(const virNodeDeviceObjListPtr devs,
                              const char *sysfs_path)
     ATTRIBUTE_NONNULL(2);
+virNodeDeviceObjPtr virNodeDeviceFindByWWN(const virNodeDeviceObjListPtr devs,
+                                           const char *wwnn,
+                                           const char *wwpn);
 
 virNodeDeviceObjPtr virNodeDeviceAssignDef(virNodeDeviceObjListPtr devs,
                                            const virNodeDeviceDefPtr def);
@@ -47,6 +47,7 @@
 #include "domain_conf.h"
 #include "c-ctype.h"
 #include "virfile.h"
+#include "threadpool.h"
 
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
@@ -353,6 +354,69 @@ virNWFilterObjListFree(virNWFilterObjListPtr nwfilters)
         virNWFilterObjFree(nwfilters->objs[i]);
     VIR_FREE(nwfilters->objs);
     nwfilters->count = 0;
+    virHashFree(nwfilters->objsUUID);
+    virHashFree(nwfilters->objsName);
+    nwfilters->objsUUID = nwfilters->objsName = NULL;
+}
+
+
+static int
+virNWFilterObjListIndexAdd(virNWFilterObjListPtr nwfilters,
+                           virNWFilterObjPtr nwfilter)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    if (!nwfilters->objsUUID &&
+        !(nwfilters->objsUUID = virHashCreate(50, NULL)))
+        return -1;
+    if (!nwfilters->objsName &&
+        !(nwfilters->objsName = virHashCreate(50, NULL)))
+        return -1;
+
+    virUUIDFormat(nwfilter->def->uuid, uuidstr);
+    if (virHashAddEntry(nwfilters->objsUUID, uuidstr, nwfilter) < 0)
+        return -1;
+    if (virHashAddEntry(nwfilters->objsName,
+                        nwfilter->def->name, nwfilter) < 0) {
+        virHashRemoveEntry(nwfilters->objsUUID, uuidstr);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+virNWFilterObjListIndexRemove(virNWFilterObjListPtr nwfilters,
+                              virNWFilterObjPtr nwfilter)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(nwfilter->def->uuid, uuidstr);
+    if (virHashLookup(nwfilters->objsUUID, uuidstr) == nwfilter)
+        virHashRemoveEntry(nwfilters->objsUUID, uuidstr);
+    virHashRemoveEntry(nwfilters->objsName, nwfilter->def->name);
+}
+
+
+/* Keep the UUID index in step when the def of @nwfilter is
+ * about to be replaced by @def */
+static void
+virNWFilterObjListIndexUpdate(virNWFilterObjListPtr nwfilters,
+                              virNWFilterObjPtr nwfilter,
+                              virNWFilterDefPtr def)
+{
+    char olduuidstr[VIR_UUID_STRING_BUFLEN];
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(nwfilter->def->uuid, olduuidstr);
+    virUUIDFormat(def->uuid, uuidstr);
+    if (STREQ(uuidstr, olduuidstr))
+        return;
+
+    if (virHashLookup(nwfilters->objsUUID, olduuidstr) == nwfilter)
+        virHashRemoveEntry(nwfilters->objsUUID, olduuidstr);
+    ignore_value(virHashUpdateEntry(nwfilters->objsUUID, uuidstr, nwfilter));
 }
 
 
@@ -425,6 +489,7 @@ virNWFilterObjRemove(virNWFilterObjListPtr nwfilters,
         virNWFilterObjLock(nwfilters->objs[i]);
         if (nwfilters->objs[i] == nwfilter) {
             virNWFilterObjUnlock(nwfilters->objs[i]);
+            virNWFilterObjListIndexRemove(nwfilters, nwfilters->objs[i]);
             virNWFilterObjFree(nwfilters->objs[i]);
 
             if (i < (nwfilters->count - 1))
@@ -2684,32 +2749,34 @@ virNWFilterObjPtr
 virNWFilterObjFindByUUID(virNWFilterObjListPtr nwfilters,
                          const unsigned char *uuid)
 {
-    unsigned int i;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    virNWFilterObjPtr nwfilter;
 
-    for (i = 0 ; i < nwfilters->count ; i++) {
-        virNWFilterObjLock(nwfilters->objs[i]);
-        if (!memcmp(nwfilters->objs[i]->def->uuid, uuid, VIR_UUID_BUFLEN))
-            return nwfilters->objs[i];
-        virNWFilterObjUnlock(nwfilters->objs[i]);
-    }
+    if (!nwfilters->objsUUID)
+        return NULL;
 
-    return NULL;
+    virUUIDFormat(uuid, uuidstr);
+    if (!(nwfilter = virHashLookup(nwfilters->objsUUID, uuidstr)))
+        return NULL;
+
+    virNWFilterObjLock(nwfilter);
+    return nwfilter;
 }
 
 
 virNWFilterObjPtr
 virNWFilterObjFindByName(virNWFilterObjListPtr nwfilters, const char *name)
 {
-    unsigned int i;
+    virNWFilterObjPtr nwfilter;
 
-    for (i = 0 ; i < nwfilters->count ; i++) {
-        virNWFilterObjLock(nwfilters->objs[i]);
-        if (STREQ(nwfilters->objs[i]->def->name, name))
-            return nwfilters->objs[i];
-        virNWFilterObjUnlock(nwfilters->objs[i]);
-    }
+    if (!nwfilters->objsName)
+        return NULL;
 
-    return NULL;
+    if (!(nwfilter = virHashLookup(nwfilters->objsName, name)))
+        return NULL;
+
+    virNWFilterObjLock(nwfilter);
+    return nwfilter;
 }
 
 
@@ -3017,6 +3084,7 @@ virNWFilterObjAssignDef(virConnectPtr conn,
     if ((nwfilter = virNWFilterObjFindByName(nwfilters, def->name))) {
 
         if (virNWFilterDefEqual(def, nwfilter->def, false)) {
+            virNWFilterObjListIndexUpdate(nwfilters, nwfilter, def);
             virNWFilterDefFree(nwfilter->def);
             nwfilter->def = def;
             virNWFilterUnlockFilterUpdates();
@@ -3032,6 +3100,7 @@ virNWFilterObjAssignDef(virConnectPtr conn,
             return NULL;
         }
 
+        virNWFilterObjListIndexUpdate(nwfilters, nwfilter, def);
         virNWFilterDefFree(nwfilter->def);
         nwfilter->def = def;
         nwfilter->newDef = NULL;
@@ -3063,25 +3132,28 @@ virNWFilterObjAssignDef(virConnectPtr conn,
         virReportOOMError();
         return NULL;
     }
+    if (virNWFilterObjListIndexAdd(nwfilters, nwfilter) < 0) {
+        nwfilter->def = NULL;
+        virNWFilterObjUnlock(nwfilter);
+        virNWFilterObjFree(nwfilter);
+        return NULL;
+    }
     nwfilters->objs[nwfilters->count++] = nwfilter;
 
     return nwfilter;
 }
 
 
+/* @def is consumed, whether this succeeds or not */
 static virNWFilterObjPtr
 virNWFilterObjLoad(virConnectPtr conn,
                    virNWFilterObjListPtr nwfilters,
                    const char *file,
-                   const char *path)
+                   const char *path,
+                   virNWFilterDefPtr def)
 {
-    virNWFilterDefPtr def;
     virNWFilterObjPtr nwfilter;
 
-    if (!(def = virNWFilterDefParseFile(conn, path))) {
-        return NULL;
-    }
-
     if (!virFileMatchesNameSuffix(file, def->name, ".xml")) {
         virReportError(VIR_ERR_XML_ERROR,
                        _("network filter config filename '%s' does not match name '%s'"),
@@ -3107,6 +3179,28 @@ virNWFilterObjLoad(virConnectPtr conn,
 }
 
 
+/* Filters are parsed on several threads; adding them to the list,
+ * which checks them against the filters already loaded, stays
+ * serial and follows directory order */
+#define VIR_NWFILTER_LOAD_CONFIG_WORKERS 8
+
+typedef struct _virNWFilterLoadConfigJob virNWFilterLoadConfigJob;
+typedef virNWFilterLoadConfigJob *virNWFilterLoadConfigJobPtr;
+struct _virNWFilterLoadConfigJob {
+    char *file;
+    char *path;
+    virNWFilterDefPtr def;
+};
+
+static void
+virNWFilterLoadConfigParse(void *jobdata, void *opaque)
+{
+    virNWFilterLoadConfigJobPtr job = jobdata;
+    virConnectPtr conn = opaque;
+
+    job->def = virNWFilterDefParseFile(conn, job->path);
+}
+
 int
 virNWFilterLoadAllConfigs(virConnectPtr conn,
                           virNWFilterObjListPtr nwfilters,
@@ -3114,6 +3208,11 @@ virNWFilterLoadAllConfigs(virConnectPtr conn,
 {
     DIR *dir;
     struct dirent *entry;
+    virNWFilterLoadConfigJobPtr jobs = NULL;
+    size_t njobs = 0;
+    size_t maxjobs = 0;
+    int ret = -1;
+    size_t i;
 
     if (!(dir = opendir(configDir))) {
         if (errno == ENOENT) {
@@ -3126,7 +3225,6 @@ virNWFilterLoadAllConfigs(virConnectPtr conn,
 
     while ((entry = readdir(dir))) {
         char *path;
-        virNWFilterObjPtr nwfilter;
 
         if (entry->d_name[0] == '.')
             continue;
@@ -3137,16 +3235,46 @@ virNWFilterLoadAllConfigs(virConnectPtr conn,
         if (!(path = virFileBuildPath(configDir, entry->d_name, NULL)))
             continue;
 
-        nwfilter = virNWFilterObjLoad(conn, nwfilters, entry->d_name, path);
+        if (VIR_RESIZE_N(jobs, maxjobs, njobs, 1) < 0 ||
+            !(jobs[njobs].file = strdup(entry->d_name))) {
+            virReportOOMError();
+            VIR_FREE(path);
+            closedir(dir);
+            goto cleanup;
+        }
+        jobs[njobs++].path = path;
+    }
+
+    closedir(dir);
+
+    xmlInitParser();
+    virThreadPoolRunJobs(VIR_NWFILTER_LOAD_CONFIG_WORKERS,
+                         virNWFilterLoadConfigParse, conn,
+                         jobs, njobs, sizeof(*jobs));
+
+    for (i = 0; i < njobs; i++) {
+        virNWFilterObjPtr nwfilter;
+
+        if (!jobs[i].def)
+            continue;
+
+        nwfilter = virNWFilterObjLoad(conn, nwfilters, jobs[i].file,
+                                      jobs[i].path, jobs[i].def);
+        jobs[i].def = NULL;
         if (nwfilter)
             virNWFilterObjUnlock(nwfilter);
-
-        VIR_FREE(path);
     }
 
-    closedir(dir);
+    ret = 0;
 
-    return 0;
+cleanup:
+    for (i = 0; i < njobs; i++) {
+        VIR_FREE(jobs[i].file);
+        VIR_FREE(jobs[i].path);
+        virNWFilterDefFree(jobs[i].def);
+    }
+    VIR_FREE(jobs);
+    return ret;
 }
 
 
@@ -549,6 +549,10 @@ typedef virNWFilterObjList *virNWFilterObjListPtr;
 struct _virNWFilterObjList {
     unsigned int count;
     virNWFilterObjPtr *objs;
+
+    /* Lookup indexes of objs, created along with the first filter */
+    virHashTablePtr objsUUID;   /* uuid string -> virNWFilterObjPtr */
+    virHashTablePtr objsName;   /* name -> virNWFilterObjPtr */
 };
 
 
@@ -622,6 +626,9 @@ typedef int (*virNWFilterRuleFreeInstanceData)(void * _inst);
 
 typedef int (*virNWFilterRuleDisplayInstanceData)(void *_inst);
 
+typedef int (*virNWFilterRuleFormatInstanceData)(void *_inst,
+                                                 virBufferPtr buf);
+
 typedef int (*virNWFilterCanApplyBasicRules)(void);
 
 typedef int (*virNWFilterApplyBasicRules)(const char *ifname,
@@ -655,6 +662,7 @@ struct _virNWFilterTechDriver {
     virNWFilterRuleAllTeardown allTeardown;
     virNWFilterRuleFreeInstanceData freeRuleInstance;
     virNWFilterRuleDisplayInstanceData displayRuleInstance;
+    virNWFilterRuleFormatInstanceData formatRuleInstance;
 
     virNWFilterCanApplyBasicRules canApplyBasicRules;
     virNWFilterApplyBasicRules applyBasicRules;
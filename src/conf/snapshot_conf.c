@@ -935,8 +935,7 @@ virDomainSnapshotForEachDescendant(virDomainSnapshotObjPtr snapshot,
  * inspects the pre-existing snapshot->def->parent field, and adjusts
  * the snapshot->parent field as well as the parent's child fields to
  * wire up the hierarchical relations for the given snapshot.  The error
- * indicator gets set if a parent is missing or a requested parent would
- * cause a circular parent chain.  */
+ * indicator gets set if a parent is missing.  */
 struct snapshot_set_relation {
     virDomainSnapshotObjListPtr snapshots;
     int err;
@@ -948,40 +947,67 @@ virDomainSnapshotSetRelations(void *payload,
 {
     virDomainSnapshotObjPtr obj = payload;
     struct snapshot_set_relation *curr = data;
-    virDomainSnapshotObjPtr tmp;
+    virDomainSnapshotObjPtr parent;
 
-    obj->parent = virDomainSnapshotFindByName(curr->snapshots,
-                                              obj->def->parent);
-    if (!obj->parent) {
+    parent = virDomainSnapshotFindByName(curr->snapshots, obj->def->parent);
+    if (!parent) {
         curr->err = -1;
-        obj->parent = &curr->snapshots->metaroot;
+        parent = &curr->snapshots->metaroot;
         VIR_WARN("snapshot %s lacks parent", obj->def->name);
-    } else {
-        tmp = obj->parent;
-        while (tmp && tmp->def) {
-            if (tmp == obj) {
-                curr->err = -1;
-                obj->parent = &curr->snapshots->metaroot;
-                VIR_WARN("snapshot %s in circular chain", obj->def->name);
-                break;
-            }
-            tmp = tmp->parent;
-        }
     }
-    obj->parent->nchildren++;
-    obj->sibling = obj->parent->first_child;
-    obj->parent->first_child = obj;
+    virDomainSnapshotSetParent(obj, parent);
+}
+
+/* Callback which moves a snapshot whose ancestors loop back to itself
+ * to the top level, breaking the circular chain.  Only needed if some
+ * snapshots could not be reached from the metaroot.  */
+static void
+virDomainSnapshotBreakCycle(void *payload,
+                            const void *name ATTRIBUTE_UNUSED,
+                            void *data)
+{
+    virDomainSnapshotObjPtr obj = payload;
+    struct snapshot_set_relation *curr = data;
+    virDomainSnapshotObjPtr tmp = obj->parent;
+    size_t steps = virHashSize(curr->snapshots->objs);
+
+    while (tmp && tmp->def && tmp != obj && steps--)
+        tmp = tmp->parent;
+    if (tmp != obj)
+        return;
+
+    curr->err = -1;
+    VIR_WARN("snapshot %s in circular chain", obj->def->name);
+    virDomainSnapshotDropParent(obj);
+    virDomainSnapshotSetParent(obj, &curr->snapshots->metaroot);
+}
+
+static void
+virDomainSnapshotCountOne(void *payload ATTRIBUTE_UNUSED,
+                          const void *name ATTRIBUTE_UNUSED,
+                          void *data ATTRIBUTE_UNUSED)
+{
 }
 
 /* Populate parent link and child count of all snapshots, with all
  * relations starting as 0/NULL.  Return 0 on success, -1 if a parent
- * is missing or if a circular relationship was requested.  */
+ * is missing or if a circular relationship was requested.  This is
+ * linear in the number of snapshots, unless there is a cycle.  */
 int
 virDomainSnapshotUpdateRelations(virDomainSnapshotObjListPtr snapshots)
 {
     struct snapshot_set_relation act = { snapshots, 0 };
 
     virHashForEach(snapshots->objs, virDomainSnapshotSetRelations, &act);
+
+    /* Every snapshot is reachable from the metaroot, unless some of
+     * them form a cycle.  */
+    if (virDomainSnapshotForEachDescendant(&snapshots->metaroot,
+                                           virDomainSnapshotCountOne,
+                                           NULL) !=
+        virHashSize(snapshots->objs))
+        virHashForEach(snapshots->objs, virDomainSnapshotBreakCycle, &act);
+
     return act.err;
 }
 
@@ -992,25 +1018,63 @@ virDomainSnapshotUpdateRelations(virDomainSnapshotObjListPtr snapshots)
 void
 virDomainSnapshotDropParent(virDomainSnapshotObjPtr snapshot)
 {
-    virDomainSnapshotObjPtr prev = NULL;
-    virDomainSnapshotObjPtr curr = NULL;
+    if (!snapshot->parent)
+        return;
 
     snapshot->parent->nchildren--;
-    curr = snapshot->parent->first_child;
-    while (curr != snapshot) {
-        if (!curr) {
-            VIR_WARN("inconsistent snapshot relations");
-            return;
-        }
-        prev = curr;
-        curr = curr->sibling;
-    }
-    if (prev)
-        prev->sibling = snapshot->sibling;
+    if (snapshot->prev_sibling)
+        snapshot->prev_sibling->sibling = snapshot->sibling;
     else
         snapshot->parent->first_child = snapshot->sibling;
+    if (snapshot->sibling)
+        snapshot->sibling->prev_sibling = snapshot->prev_sibling;
     snapshot->parent = NULL;
     snapshot->sibling = NULL;
+    snapshot->prev_sibling = NULL;
+}
+
+/* Add snapshot, which must not have a parent yet, to the children
+ * of parent.  */
+void
+virDomainSnapshotSetParent(virDomainSnapshotObjPtr snapshot,
+                           virDomainSnapshotObjPtr parent)
+{
+    snapshot->parent = parent;
+    parent->nchildren++;
+    snapshot->prev_sibling = NULL;
+    snapshot->sibling = parent->first_child;
+    if (parent->first_child)
+        parent->first_child->prev_sibling = snapshot;
+    parent->first_child = snapshot;
+}
+
+/* Hand all children of from over to to, for example when from is
+ * deleted and its children move up to its parent.  This only touches
+ * the children, not any other snapshot in the list.  */
+void
+virDomainSnapshotMoveChildren(virDomainSnapshotObjPtr from,
+                              virDomainSnapshotObjPtr to)
+{
+    virDomainSnapshotObjPtr child = from->first_child;
+    virDomainSnapshotObjPtr last = NULL;
+
+    if (!child)
+        return;
+
+    while (child) {
+        child->parent = to;
+        last = child;
+        child = child->sibling;
+    }
+
+    last->sibling = to->first_child;
+    if (to->first_child)
+        to->first_child->prev_sibling = last;
+    to->first_child = from->first_child;
+    to->nchildren += from->nchildren;
+
+    from->first_child = NULL;
+    from->nchildren = 0;
 }
 
 int
@@ -1020,23 +1084,32 @@ virDomainListSnapshots(virDomainSnapshotObjListPtr snapshots,
                        virDomainSnapshotPtr **snaps,
                        unsigned int flags)
 {
-    int count = virDomainSnapshotObjListNum(snapshots, from, flags);
+    /* No listing can be longer than the whole list, so the names can be
+     * collected in a single filtering pass.  */
+    int maxnames = virHashSize(snapshots->objs);
+    int count = 0;
     virDomainSnapshotPtr *list = NULL;
-    char **names;
+    char **names = NULL;
     int ret = -1;
     int i;
 
-    if (!snaps || count < 0)
-        return count;
-    if (VIR_ALLOC_N(names, count) < 0 ||
-        VIR_ALLOC_N(list, count + 1) < 0) {
+    if (!snaps || maxnames < 0)
+        return virDomainSnapshotObjListNum(snapshots, from, flags);
+
+    if (maxnames && VIR_ALLOC_N(names, maxnames) < 0) {
         virReportOOMError();
+        return -1;
+    }
+    if ((count = virDomainSnapshotObjListGetNames(snapshots, from, names,
+                                                  maxnames, flags)) < 0) {
+        count = 0;
         goto cleanup;
     }
 
-    if (virDomainSnapshotObjListGetNames(snapshots, from, names, count,
-                                         flags) < 0)
+    if (VIR_ALLOC_N(list, count + 1) < 0) {
+        virReportOOMError();
         goto cleanup;
+    }
     for (i = 0; i < count; i++)
         if ((list[i] = virGetDomainSnapshot(dom, names[i])) == NULL)
             goto cleanup;
@@ -1056,7 +1129,6 @@ cleanup:
     return ret;
 }
 
-
 bool
 virDomainSnapshotIsExternal(virDomainSnapshotObjPtr snap)
 {
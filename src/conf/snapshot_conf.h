@@ -85,6 +85,7 @@ struct _virDomainSnapshotObj {
                                        virDomainSnapshotUpdateRelations, or
                                        after virDomainSnapshotDropParent */
     virDomainSnapshotObjPtr sibling; /* NULL if last child of parent */
+    virDomainSnapshotObjPtr prev_sibling; /* NULL if first child of parent */
     size_t nchildren;
     virDomainSnapshotObjPtr first_child; /* NULL if no children */
 };
@@ -136,6 +137,10 @@ int virDomainSnapshotForEachDescendant(virDomainSnapshotObjPtr snapshot,
                                        void *data);
 int virDomainSnapshotUpdateRelations(virDomainSnapshotObjListPtr snapshots);
 void virDomainSnapshotDropParent(virDomainSnapshotObjPtr snapshot);
+void virDomainSnapshotSetParent(virDomainSnapshotObjPtr snapshot,
+                                virDomainSnapshotObjPtr parent);
+void virDomainSnapshotMoveChildren(virDomainSnapshotObjPtr from,
+                                   virDomainSnapshotObjPtr to);
 
 # define VIR_DOMAIN_SNAPSHOT_FILTERS_METADATA           \
                (VIR_DOMAIN_SNAPSHOT_LIST_METADATA     | \
@@ -44,6 +44,7 @@
 #include "util.h"
 #include "memory.h"
 #include "virfile.h"
+#include "threadpool.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -387,6 +388,43 @@ void virStoragePoolObjListFree(virStoragePoolObjListPtr pools)
         virStoragePoolObjFree(pools->objs[i]);
     VIR_FREE(pools->objs);
     pools->count = 0;
+    virHashFree(pools->objsUUID);
+    virHashFree(pools->objsName);
+    pools->objsUUID = pools->objsName = NULL;
+}
+
+static int
+virStoragePoolObjListIndexAdd(virStoragePoolObjListPtr pools,
+                              virStoragePoolObjPtr pool)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    if (!pools->objsUUID && !(pools->objsUUID = virHashCreate(50, NULL)))
+        return -1;
+    if (!pools->objsName && !(pools->objsName = virHashCreate(50, NULL)))
+        return -1;
+
+    virUUIDFormat(pool->def->uuid, uuidstr);
+    if (virHashAddEntry(pools->objsUUID, uuidstr, pool) < 0)
+        return -1;
+    if (virHashAddEntry(pools->objsName, pool->def->name, pool) < 0) {
+        virHashRemoveEntry(pools->objsUUID, uuidstr);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+virStoragePoolObjListIndexRemove(virStoragePoolObjListPtr pools,
+                                 virStoragePoolObjPtr pool)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(pool->def->uuid, uuidstr);
+    if (virHashLookup(pools->objsUUID, uuidstr) == pool)
+        virHashRemoveEntry(pools->objsUUID, uuidstr);
+    virHashRemoveEntry(pools->objsName, pool->def->name);
 }
 
 void
@@ -401,6 +439,7 @@ virStoragePoolObjRemove(virStoragePoolObjListPtr pools,
         virStoragePoolObjLock(pools->objs[i]);
         if (pools->objs[i] == pool) {
             virStoragePoolObjUnlock(pools->objs[i]);
+            virStoragePoolObjListIndexRemove(pools, pools->objs[i]);
             virStoragePoolObjFree(pools->objs[i]);
 
             if (i < (pools->count - 1))
@@ -411,6 +450,7 @@ virStoragePoolObjRemove(virStoragePoolObjListPtr pools,
                 ; /* Failure to reduce memory allocation isn't fatal */
             }
             pools->count--;
+            pools->generation++;
 
             break;
         }
@@ -1417,31 +1457,38 @@ virStorageVolDefFormat(virStoragePoolDefPtr pool,
 virStoragePoolObjPtr
 virStoragePoolObjFindByUUID(virStoragePoolObjListPtr pools,
                             const unsigned char *uuid) {
-    unsigned int i;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    virStoragePoolObjPtr pool;
 
-    for (i = 0 ; i < pools->count ; i++) {
-        virStoragePoolObjLock(pools->objs[i]);
-        if (!memcmp(pools->objs[i]->def->uuid, uuid, VIR_UUID_BUFLEN))
-            return pools->objs[i];
-        virStoragePoolObjUnlock(pools->objs[i]);
-    }
+    if (!pools->objsUUID)
+        return NULL;
 
-    return NULL;
+    virUUIDFormat(uuid, uuidstr);
+    if (!(pool = virHashLookup(pools->objsUUID, uuidstr)))
+        return NULL;
+
+    virStoragePoolObjLock(pool);
+    /* A def swapped in on pool stop may carry another UUID */
+    if (memcmp(pool->def->uuid, uuid, VIR_UUID_BUFLEN) != 0) {
+        virStoragePoolObjUnlock(pool);
+        return NULL;
+    }
+    return pool;
 }
 
 virStoragePoolObjPtr
 virStoragePoolObjFindByName(virStoragePoolObjListPtr pools,
                             const char *name) {
-    unsigned int i;
+    virStoragePoolObjPtr pool;
 
-    for (i = 0 ; i < pools->count ; i++) {
-        virStoragePoolObjLock(pools->objs[i]);
-        if (STREQ(pools->objs[i]->def->name, name))
-            return pools->objs[i];
-        virStoragePoolObjUnlock(pools->objs[i]);
-    }
+    if (!pools->objsName)
+        return NULL;
 
-    return NULL;
+    if (!(pool = virHashLookup(pools->objsName, name)))
+        return NULL;
+
+    virStoragePoolObjLock(pool);
+    return pool;
 }
 
 virStoragePoolObjPtr
@@ -1459,6 +1506,15 @@ virStoragePoolSourceFindDuplicateDevices(virStoragePoolObjPtr pool,
     return NULL;
 }
 
+static void
+virStorageVolDefListFreeIndexes(virStorageVolDefListPtr vols)
+{
+    virHashFree(vols->byName);
+    virHashFree(vols->byKey);
+    virHashFree(vols->byPath);
+    vols->byName = vols->byKey = vols->byPath = NULL;
+}
+
 void
 virStoragePoolObjClearVols(virStoragePoolObjPtr pool)
 {
@@ -1468,6 +1524,164 @@ virStoragePoolObjClearVols(virStoragePoolObjPtr pool)
 
     VIR_FREE(pool->volumes.objs);
     pool->volumes.count = 0;
+    virStorageVolDefListFreeIndexes(&pool->volumes);
+}
+
+/* The value of the field of @vol an index is keyed on */
+typedef const char *(*virStorageVolDefIndexKey)(virStorageVolDefPtr vol);
+
+static const char *
+virStorageVolDefIndexName(virStorageVolDefPtr vol)
+{
+    return vol->name;
+}
+
+static const char *
+virStorageVolDefIndexKeyField(virStorageVolDefPtr vol)
+{
+    return vol->key;
+}
+
+static const char *
+virStorageVolDefIndexPath(virStorageVolDefPtr vol)
+{
+    return vol->target.path;
+}
+
+/*
+ * Several volumes may share a key or path, the index then refers
+ * to the first of them in the list just like a scan of it would.
+ */
+static int
+virStorageVolDefIndexAdd(virHashTablePtr index,
+                         virStorageVolDefIndexKey field,
+                         virStorageVolDefPtr vol)
+{
+    const char *key = field(vol);
+
+    if (!key || virHashLookup(index, key))
+        return 0;
+
+    return virHashAddEntry(index, key, vol);
+}
+
+static int
+virStorageVolDefIndexRemove(virHashTablePtr index,
+                            virStorageVolDefIndexKey field,
+                            virStorageVolDefListPtr vols,
+                            virStorageVolDefPtr vol)
+{
+    const char *key = field(vol);
+    unsigned int i;
+
+    if (!key || virHashLookup(index, key) != vol)
+        return 0;
+
+    if (virHashRemoveEntry(index, key) < 0)
+        return -1;
+
+    for (i = 0 ; i < vols->count ; i++) {
+        if (vols->objs[i] != vol &&
+            field(vols->objs[i]) &&
+            STREQ(field(vols->objs[i]), key))
+            return virHashAddEntry(index, key, vols->objs[i]);
+    }
+
+    return 0;
+}
+
+/**
+ * virStoragePoolObjAddVol:
+ * @pool: the pool to add to
+ * @vol: the volume to add, with its name, key and path filled in
+ *
+ * Appends @vol to the volumes of @pool, which takes ownership of it.
+ *
+ * Returns 0 on success, -1 with an error reported and @vol still
+ * owned by the caller otherwise.
+ */
+int
+virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                        virStorageVolDefPtr vol)
+{
+    virStorageVolDefListPtr vols = &pool->volumes;
+
+    if (VIR_REALLOC_N(vols->objs, vols->count + 1) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+    vols->objs[vols->count++] = vol;
+
+    /* Indexes are (re)built along with the list of an emptied pool.  A
+     * failure to update them is not fatal, lookups then scan the list
+     * until the next refresh of the pool. */
+    if (vols->count == 1 && !vols->byName) {
+        if (!(vols->byName = virHashCreate(0, NULL)) ||
+            !(vols->byKey = virHashCreate(0, NULL)) ||
+            !(vols->byPath = virHashCreate(0, NULL))) {
+            virResetLastError();
+            virStorageVolDefListFreeIndexes(vols);
+        }
+    }
+
+    if (vols->byName &&
+        (virStorageVolDefIndexAdd(vols->byName,
+                                  virStorageVolDefIndexName, vol) < 0 ||
+         virStorageVolDefIndexAdd(vols->byKey,
+                                  virStorageVolDefIndexKeyField, vol) < 0 ||
+         virStorageVolDefIndexAdd(vols->byPath,
+                                  virStorageVolDefIndexPath, vol) < 0)) {
+        virResetLastError();
+        virStorageVolDefListFreeIndexes(vols);
+    }
+
+    return 0;
+}
+
+/**
+ * virStoragePoolObjRemoveVol:
+ * @pool: the pool to remove from
+ * @vol: a volume of @pool
+ *
+ * Removes @vol from the volumes of @pool, handing its ownership back
+ * to the caller.
+ */
+void
+virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                           virStorageVolDefPtr vol)
+{
+    virStorageVolDefListPtr vols = &pool->volumes;
+    unsigned int i;
+
+    for (i = 0 ; i < vols->count ; i++) {
+        if (vols->objs[i] == vol)
+            break;
+    }
+    if (i == vols->count)
+        return;
+
+    if (vols->byName &&
+        (virStorageVolDefIndexRemove(vols->byName,
+                                     virStorageVolDefIndexName,
+                                     vols, vol) < 0 ||
+         virStorageVolDefIndexRemove(vols->byKey,
+                                     virStorageVolDefIndexKeyField,
+                                     vols, vol) < 0 ||
+         virStorageVolDefIndexRemove(vols->byPath,
+                                     virStorageVolDefIndexPath,
+                                     vols, vol) < 0)) {
+        virResetLastError();
+        virStorageVolDefListFreeIndexes(vols);
+    }
+
+    if (i < (vols->count - 1))
+        memmove(vols->objs + i, vols->objs + i + 1,
+                sizeof(*(vols->objs)) * (vols->count - (i + 1)));
+
+    if (VIR_REALLOC_N(vols->objs, vols->count - 1) < 0) {
+        ; /* Failure to reduce memory allocation isn't fatal */
+    }
+    vols->count--;
 }
 
 virStorageVolDefPtr
@@ -1475,6 +1689,9 @@ virStorageVolDefFindByKey(virStoragePoolObjPtr pool,
                           const char *key) {
     unsigned int i;
 
+    if (pool->volumes.byKey)
+        return virHashLookup(pool->volumes.byKey, key);
+
     for (i = 0 ; i < pool->volumes.count ; i++)
         if (STREQ(pool->volumes.objs[i]->key, key))
             return pool->volumes.objs[i];
@@ -1487,6 +1704,9 @@ virStorageVolDefFindByPath(virStoragePoolObjPtr pool,
                            const char *path) {
     unsigned int i;
 
+    if (pool->volumes.byPath)
+        return virHashLookup(pool->volumes.byPath, path);
+
     for (i = 0 ; i < pool->volumes.count ; i++)
         if (STREQ(pool->volumes.objs[i]->target.path, path))
             return pool->volumes.objs[i];
@@ -1499,6 +1719,9 @@ virStorageVolDefFindByName(virStoragePoolObjPtr pool,
                            const char *name) {
     unsigned int i;
 
+    if (pool->volumes.byName)
+        return virHashLookup(pool->volumes.byName, name);
+
     for (i = 0 ; i < pool->volumes.count ; i++)
         if (STREQ(pool->volumes.objs[i]->name, name))
             return pool->volumes.objs[i];
@@ -1513,6 +1736,16 @@ virStoragePoolObjAssignDef(virStoragePoolObjListPtr pools,
 
     if ((pool = virStoragePoolObjFindByName(pools, def->name))) {
         if (!virStoragePoolObjIsActive(pool)) {
+            char olduuidstr[VIR_UUID_STRING_BUFLEN];
+            char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+            virUUIDFormat(pool->def->uuid, olduuidstr);
+            virUUIDFormat(def->uuid, uuidstr);
+            if (STRNEQ(uuidstr, olduuidstr)) {
+                virHashRemoveEntry(pools->objsUUID, olduuidstr);
+                ignore_value(virHashUpdateEntry(pools->objsUUID,
+                                                uuidstr, pool));
+            }
             virStoragePoolDefFree(pool->def);
             pool->def = def;
         } else {
@@ -1535,6 +1768,7 @@ virStoragePoolObjAssignDef(virStoragePoolObjListPtr pools,
     }
     virStoragePoolObjLock(pool);
     pool->active = 0;
+    pool->watch = -1;
     pool->def = def;
 
     if (VIR_REALLOC_N(pools->objs, pools->count+1) < 0) {
@@ -1544,23 +1778,27 @@ virStoragePoolObjAssignDef(virStoragePoolObjListPtr pools,
         virReportOOMError();
         return NULL;
     }
+    if (virStoragePoolObjListIndexAdd(pools, pool) < 0) {
+        pool->def = NULL;
+        virStoragePoolObjUnlock(pool);
+        virStoragePoolObjFree(pool);
+        return NULL;
+    }
     pools->objs[pools->count++] = pool;
+    pools->generation++;
 
     return pool;
 }
 
+/* @def is consumed, whether this succeeds or not */
 static virStoragePoolObjPtr
 virStoragePoolObjLoad(virStoragePoolObjListPtr pools,
                       const char *file,
                       const char *path,
-                      const char *autostartLink) {
-    virStoragePoolDefPtr def;
+                      const char *autostartLink,
+                      virStoragePoolDefPtr def) {
     virStoragePoolObjPtr pool;
 
-    if (!(def = virStoragePoolDefParseFile(path))) {
-        return NULL;
-    }
-
     if (!virFileMatchesNameSuffix(file, def->name, ".xml")) {
         virReportError(VIR_ERR_XML_ERROR,
                        _("Storage pool config filename '%s' does not match pool name '%s'"),
@@ -1596,12 +1834,37 @@ virStoragePoolObjLoad(virStoragePoolObjListPtr pools,
 }
 
 
+/* Pool configs are parsed on several threads, then added to the
+ * list in directory order */
+#define VIR_STORAGE_POOL_LOAD_CONFIG_WORKERS 8
+
+typedef struct _virStoragePoolLoadConfigJob virStoragePoolLoadConfigJob;
+typedef virStoragePoolLoadConfigJob *virStoragePoolLoadConfigJobPtr;
+struct _virStoragePoolLoadConfigJob {
+    char *file;
+    char *path;
+    virStoragePoolDefPtr def;
+};
+
+static void
+virStoragePoolLoadConfigParse(void *jobdata, void *opaque ATTRIBUTE_UNUSED)
+{
+    virStoragePoolLoadConfigJobPtr job = jobdata;
+
+    job->def = virStoragePoolDefParseFile(job->path);
+}
+
 int
 virStoragePoolLoadAllConfigs(virStoragePoolObjListPtr pools,
                              const char *configDir,
                              const char *autostartDir) {
     DIR *dir;
     struct dirent *entry;
+    virStoragePoolLoadConfigJobPtr jobs = NULL;
+    size_t njobs = 0;
+    size_t maxjobs = 0;
+    int ret = -1;
+    size_t i;
 
     if (!(dir = opendir(configDir))) {
         if (errno == ENOENT)
@@ -1613,8 +1876,6 @@ virStoragePoolLoadAllConfigs(virStoragePoolObjListPtr pools,
 
     while ((entry = readdir(dir))) {
         char *path;
-        char *autostartLink;
-        virStoragePoolObjPtr pool;
 
         if (entry->d_name[0] == '.')
             continue;
@@ -1625,24 +1886,53 @@ virStoragePoolLoadAllConfigs(virStoragePoolObjListPtr pools,
         if (!(path = virFileBuildPath(configDir, entry->d_name, NULL)))
             continue;
 
-        if (!(autostartLink = virFileBuildPath(autostartDir, entry->d_name,
-                                               NULL))) {
+        if (VIR_RESIZE_N(jobs, maxjobs, njobs, 1) < 0 ||
+            !(jobs[njobs].file = strdup(entry->d_name))) {
+            virReportOOMError();
             VIR_FREE(path);
-            continue;
+            closedir(dir);
+            goto cleanup;
         }
+        jobs[njobs++].path = path;
+    }
+
+    closedir(dir);
+
+    xmlInitParser();
+    virThreadPoolRunJobs(VIR_STORAGE_POOL_LOAD_CONFIG_WORKERS,
+                         virStoragePoolLoadConfigParse, NULL,
+                         jobs, njobs, sizeof(*jobs));
+
+    for (i = 0; i < njobs; i++) {
+        char *autostartLink;
+        virStoragePoolObjPtr pool;
 
-        pool = virStoragePoolObjLoad(pools, entry->d_name, path,
-                                     autostartLink);
+        if (!jobs[i].def)
+            continue;
+
+        if (!(autostartLink = virFileBuildPath(autostartDir, jobs[i].file,
+                                               NULL)))
+            continue;
+
+        pool = virStoragePoolObjLoad(pools, jobs[i].file, jobs[i].path,
+                                     autostartLink, jobs[i].def);
+        jobs[i].def = NULL;
         if (pool)
             virStoragePoolObjUnlock(pool);
 
-        VIR_FREE(path);
         VIR_FREE(autostartLink);
     }
 
-    closedir(dir);
+    ret = 0;
 
-    return 0;
+cleanup:
+    for (i = 0; i < njobs; i++) {
+        VIR_FREE(jobs[i].file);
+        VIR_FREE(jobs[i].path);
+        virStoragePoolDefFree(jobs[i].def);
+    }
+    VIR_FREE(jobs);
+    return ret;
 }
 
 int
@@ -28,6 +28,7 @@
 # include "util.h"
 # include "storage_encryption_conf.h"
 # include "threads.h"
+# include "virhash.h"
 
 # include <libxml/tree.h>
 
@@ -96,6 +97,21 @@ struct _virStorageVolTarget {
 };
 
 
+/*
+ * Identity of a volume's file when it was last probed, allowing the
+ * filesystem backends to skip re-probing unchanged files on refresh
+ */
+typedef struct _virStorageVolProbeStamp virStorageVolProbeStamp;
+typedef virStorageVolProbeStamp *virStorageVolProbeStampPtr;
+struct _virStorageVolProbeStamp {
+    bool valid;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+};
+
 typedef struct _virStorageVolDef virStorageVolDef;
 typedef virStorageVolDef *virStorageVolDefPtr;
 struct _virStorageVolDef {
@@ -105,12 +121,20 @@ struct _virStorageVolDef {
 
     unsigned int building;
 
+    /* Long running job working on the volume with the pool unlocked */
+    int job; /* virStorageVolJobType */
+    unsigned long long jobProcessed; /* bytes */
+    unsigned long long jobTotal; /* bytes */
+    int jobAbort; /* set with the pool unlocked, use viratomic.h */
+
     unsigned long long allocation; /* bytes */
     unsigned long long capacity; /* bytes */
 
     virStorageVolSource source;
     virStorageVolTarget target;
     virStorageVolTarget backingStore;
+
+    virStorageVolProbeStamp probed;
 };
 
 typedef struct _virStorageVolDefList virStorageVolDefList;
@@ -118,6 +142,13 @@ typedef virStorageVolDefList *virStorageVolDefListPtr;
 struct _virStorageVolDefList {
     unsigned int count;
     virStorageVolDefPtr *objs;
+
+    /* Indexes of objs by name, key and target path, maintained by
+     * virStoragePoolObjAddVol and virStoragePoolObjRemoveVol.  NULL
+     * if they could not be kept up to date, lookups then scan objs */
+    virHashTablePtr byName;
+    virHashTablePtr byKey;
+    virHashTablePtr byPath;
 };
 
 
@@ -309,6 +340,7 @@ struct _virStoragePoolObj {
     int active;
     int autostart;
     unsigned int asyncjobs;
+    int watch; /* inotify watch on the target path, or -1 */
 
     virStoragePoolDefPtr def;
     virStoragePoolDefPtr newDef;
@@ -321,6 +353,14 @@ typedef virStoragePoolObjList *virStoragePoolObjListPtr;
 struct _virStoragePoolObjList {
     unsigned int count;
     virStoragePoolObjPtr *objs;
+
+    /* Lookup indexes of objs, created along with the first pool */
+    virHashTablePtr objsUUID;   /* uuid string -> virStoragePoolObjPtr */
+    virHashTablePtr objsName;   /* name -> virStoragePoolObjPtr */
+
+    /* Bumped whenever a pool is added, removed, started
+     * or stopped */
+    unsigned long long generation;
 };
 
 
@@ -336,6 +376,9 @@ struct _virStorageDriverState {
 
     char *configDir;
     char *autostartDir;
+
+    int inotifyFD;
+    int inotifyWatch;
 };
 
 typedef struct _virStoragePoolSourceList virStoragePoolSourceList;
@@ -370,6 +413,12 @@ virStorageVolDefPtr virStorageVolDefFindByName(virStoragePoolObjPtr pool,
                                                const char *name);
 
 void virStoragePoolObjClearVols(virStoragePoolObjPtr pool);
+int virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                            virStorageVolDefPtr vol)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+void virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                                virStorageVolDefPtr vol)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 
 virStoragePoolDefPtr virStoragePoolDefParseString(const char *xml);
 virStoragePoolDefPtr virStoragePoolDefParseFile(const char *filename);
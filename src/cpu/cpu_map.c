@@ -33,6 +33,7 @@
 #define CPUMAPFILE PKGDATADIR "/cpu_map.xml"
 
 static char *cpumap;
+static unsigned int cpumapGeneration;
 
 VIR_ENUM_IMPL(cpuMapElement, CPU_MAP_ELEMENT_LAST,
     "vendor",
@@ -154,5 +155,16 @@ cpuMapOverride(const char *path)
 
     VIR_FREE(cpumap);
     cpumap = map;
+    cpumapGeneration++;
     return 0;
 }
+
+
+/* Changes whenever cpuMapOverride() points us at a different file, so
+ * that drivers caching the parsed map know when to load it again.
+ */
+unsigned int
+cpuMapGeneration(void)
+{
+    return cpumapGeneration;
+}
@@ -51,4 +51,7 @@ cpuMapLoad(const char *arch,
 extern int
 cpuMapOverride(const char *path);
 
+extern unsigned int
+cpuMapGeneration(void);
+
 #endif /* __VIR_CPU_MAP_H__ */
@@ -32,6 +32,8 @@
 #include "cpu_map.h"
 #include "cpu_x86.h"
 #include "buf.h"
+#include "threads.h"
+#include "virobject.h"
 
 
 #define VIR_FROM_THIS VIR_FROM_CPU
@@ -64,7 +66,12 @@ struct x86_model {
     struct x86_model *next;
 };
 
+/* Once loaded, a map is never modified so a single instance can be
+ * shared by all callers; see x86LoadMap().
+ */
 struct x86_map {
+    virObject object;
+
     struct x86_vendor *vendors;
     struct x86_feature *features;
     struct x86_model *models;
@@ -1052,11 +1059,16 @@ ignore:
 }
 
 
+static virClassPtr x86MapClass;
+static virMutex x86MapLock;
+static struct x86_map *x86MapCache;
+static unsigned int x86MapCacheGeneration;
+
+
 static void
-x86MapFree(struct x86_map *map)
+x86MapDispose(void *obj)
 {
-    if (map == NULL)
-        return;
+    struct x86_map *map = obj;
 
     while (map->features != NULL) {
         struct x86_feature *feature = map->features;
@@ -1075,10 +1087,25 @@ x86MapFree(struct x86_map *map)
         map->vendors = vendor->next;
         x86VendorFree(vendor);
     }
+}
+
 
-    VIR_FREE(map);
+static int
+x86MapOnceInit(void)
+{
+    if (!(x86MapClass = virClassNew("x86_map",
+                                    sizeof(struct x86_map),
+                                    x86MapDispose)))
+        return -1;
+
+    if (virMutexInit(&x86MapLock) < 0)
+        return -1;
+
+    return 0;
 }
 
+VIR_ONCE_GLOBAL_INIT(x86Map)
+
 
 static int
 x86MapLoadCallback(enum cpuMapElement element,
@@ -1103,14 +1130,12 @@ x86MapLoadCallback(enum cpuMapElement element,
 
 
 static struct x86_map *
-x86LoadMap(void)
+x86MapLoadFile(void)
 {
     struct x86_map *map;
 
-    if (VIR_ALLOC(map) < 0) {
-        virReportOOMError();
+    if (!(map = virObjectNew(x86MapClass)))
         return NULL;
-    }
 
     if (cpuMapLoad("x86", x86MapLoadCallback, map) < 0)
         goto error;
@@ -1118,11 +1143,44 @@ x86LoadMap(void)
     return map;
 
 error:
-    x86MapFree(map);
+    virObjectUnref(map);
     return NULL;
 }
 
 
+/* Returns a reference to the parsed CPU map, which the caller releases
+ * with virObjectUnref(). The map is only parsed the first time and again
+ * after cpuMapOverride() switched to a different file.
+ */
+static struct x86_map *
+x86LoadMap(void)
+{
+    struct x86_map *map = NULL;
+    unsigned int generation;
+
+    if (x86MapInitialize() < 0)
+        return NULL;
+
+    virMutexLock(&x86MapLock);
+
+    generation = cpuMapGeneration();
+    if (!x86MapCache || x86MapCacheGeneration != generation) {
+        if (!(map = x86MapLoadFile()))
+            goto cleanup;
+
+        virObjectUnref(x86MapCache);
+        x86MapCache = map;
+        x86MapCacheGeneration = generation;
+    }
+
+    map = virObjectRef(x86MapCache);
+
+cleanup:
+    virMutexUnlock(&x86MapLock);
+    return map;
+}
+
+
 /* A helper macro to exit the cpu computation function without writing
  * redundant code:
  * MSG: error message
@@ -1266,7 +1324,7 @@ x86Compute(virCPUDefPtr host,
     }
 
 out:
-    x86MapFree(map);
+    virObjectUnref(map);
     x86ModelFree(host_model);
     x86ModelFree(diff);
     x86ModelFree(cpu_force);
@@ -1410,7 +1468,7 @@ x86Decode(virCPUDefPtr cpu,
     ret = 0;
 
 out:
-    x86MapFree(map);
+    virObjectUnref(map);
     virCPUDefFree(cpuModel);
 
     return ret;
@@ -1520,7 +1578,7 @@ x86Encode(const virCPUDefPtr cpu,
     ret = 0;
 
 cleanup:
-    x86MapFree(map);
+    virObjectUnref(map);
 
     return ret;
 
@@ -1717,7 +1775,7 @@ x86Baseline(virCPUDefPtr *cpus,
 
 cleanup:
     x86ModelFree(base_model);
-    x86MapFree(map);
+    virObjectUnref(map);
 
     return cpu;
 
@@ -1772,7 +1830,7 @@ x86UpdateCustom(virCPUDefPtr guest,
     ret = 0;
 
 cleanup:
-    x86MapFree(map);
+    virObjectUnref(map);
     x86ModelFree(host_model);
     return ret;
 }
@@ -1819,7 +1877,7 @@ static int x86HasFeature(const union cpuData *data,
     ret = x86DataIsSubset(data, feature->data) ? 1 : 0;
 
 cleanup:
-    x86MapFree(map);
+    virObjectUnref(map);
     return ret;
 }
 
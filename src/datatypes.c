@@ -83,6 +83,10 @@ virDataTypesOnceInit(void)
 
 #undef DECLARE_CLASS
 
+    /* Domain handles are created and released for most API calls */
+    if (virClassSetCache(virDomainClass, 64) < 0)
+        return -1;
+
     return 0;
 }
 
@@ -97,6 +97,9 @@ typedef int
                                          virNodeInfoPtr info);
 typedef char *
         (*virDrvGetCapabilities)        (virConnectPtr conn);
+typedef char *
+        (*virDrvConnectGetHostCapabilities) (virConnectPtr conn,
+                                             unsigned int flags);
 typedef int
         (*virDrvListDomains)            (virConnectPtr conn,
                                          int *ids,
@@ -141,6 +144,9 @@ typedef int
 typedef int
         (*virDrvDomainDestroyFlags)     (virDomainPtr domain,
                                          unsigned int flags);
+typedef int
+        (*virDrvConnectDestroyAllDomains) (virConnectPtr conn,
+                                           unsigned int flags);
 typedef char *
         (*virDrvDomainGetOSType)        (virDomainPtr domain);
 
@@ -200,6 +206,11 @@ typedef int
 typedef int
         (*virDrvDomainGetInfo)          (virDomainPtr domain,
                                          virDomainInfoPtr info);
+typedef int
+        (*virDrvDomainGetInfoAsync)     (virDomainPtr domain,
+                                         virDomainGetInfoCallback cb,
+                                         void *opaque,
+                                         virFreeCallback freecb);
 typedef int
         (*virDrvDomainGetState)         (virDomainPtr domain,
                                          int *state,
@@ -342,6 +353,11 @@ typedef int
         (*virDrvDomainAttachDeviceFlags) (virDomainPtr domain,
                                           const char *xml,
                                           unsigned int flags);
+typedef int
+        (*virDrvDomainAttachDevices)     (virDomainPtr domain,
+                                          const char **xmls,
+                                          unsigned int nxmls,
+                                          unsigned int flags);
 typedef int
         (*virDrvDomainDetachDevice)      (virDomainPtr domain,
                                          const char *xml);
@@ -444,6 +460,21 @@ typedef int
                      unsigned long long start, size_t size,
                      void *buffer,
                      unsigned int flags);
+typedef int
+    (*virDrvDomainBlockPeekStream)
+                    (virDomainPtr domain,
+                     virStreamPtr stream,
+                     const char *disk,
+                     unsigned long long offset,
+                     unsigned long long length,
+                     unsigned int flags);
+typedef int
+    (*virDrvDomainMemoryPeekStream)
+                    (virDomainPtr domain,
+                     virStreamPtr stream,
+                     unsigned long long start,
+                     unsigned long long size,
+                     unsigned int flags);
 typedef int
     (*virDrvDomainGetBlockInfo)
                     (virDomainPtr domain,
@@ -843,6 +874,10 @@ typedef int
                                const char *base, const char *top,
                                unsigned long bandwidth, unsigned int flags);
 
+typedef int
+    (*virDrvDomainBlockFlatten)(virDomainPtr dom, unsigned long bandwidth,
+                                unsigned int flags);
+
 typedef int
     (*virDrvSetKeepAlive)(virConnectPtr conn,
                           int interval,
@@ -915,6 +950,49 @@ typedef int
                           unsigned long long minimum,
                           unsigned int flags);
 
+typedef int
+    (*virDrvConnectGetAllDomainStats)(virConnectPtr conn,
+                                      unsigned int stats,
+                                      virDomainStatsRecordPtr **retStats,
+                                      unsigned int flags);
+
+typedef int
+    (*virDrvConnectListAllDomainsFiltered)(virConnectPtr conn,
+                                           virDomainPtr **domains,
+                                           virTypedParameterPtr filters,
+                                           int nfilters,
+                                           unsigned int flags);
+
+typedef int
+    (*virDrvDomainListFSFreeze)(virDomainPtr *doms,
+                                unsigned int ndoms,
+                                unsigned int timeout,
+                                unsigned int flags);
+
+typedef int
+    (*virDrvDomainListFSThaw)(virDomainPtr *doms,
+                              unsigned int ndoms,
+                              unsigned int timeout,
+                              unsigned int flags);
+
+typedef int
+    (*virDrvDomainMigrateGetCompressionCache)(virDomainPtr domain,
+                                              unsigned long long *cacheSize,
+                                              unsigned int flags);
+
+typedef int
+    (*virDrvDomainMigrateSetCompressionCache)(virDomainPtr domain,
+                                              unsigned long long cacheSize,
+                                              unsigned int flags);
+
+/* Shared by the hypervisor, network and storage drivers, each
+ * answering for the list types it owns */
+typedef int
+    (*virDrvConnectGetListGeneration)(virConnectPtr conn,
+                                      unsigned int type,
+                                      unsigned long long *generation,
+                                      unsigned int flags);
+
 /**
  * _virDriver:
  *
@@ -930,6 +1008,7 @@ typedef int
 struct _virDriver {
     int                                 no;    /* the number virDrvNo */
     const char                          *name; /* the name of the driver */
+    const char                          **uriSchemes; /* accepted URI schemes, or NULL for any */
     virDrvOpen                          open;
     virDrvClose                         close;
     virDrvDrvSupportsFeature            supports_feature;
@@ -1107,6 +1186,20 @@ struct _virDriver {
     virDrvNodeGetCPUMap                 nodeGetCPUMap;
     virDrvDomainFSTrim                  domainFSTrim;
     virDrvDomainSendProcessSignal       domainSendProcessSignal;
+    virDrvConnectGetAllDomainStats      connectGetAllDomainStats;
+    virDrvDomainGetInfoAsync            domainGetInfoAsync;
+    virDrvDomainAttachDevices           domainAttachDevices;
+    virDrvConnectGetHostCapabilities    connectGetHostCapabilities;
+    virDrvDomainBlockFlatten            domainBlockFlatten;
+    virDrvConnectDestroyAllDomains      connectDestroyAllDomains;
+    virDrvConnectGetListGeneration      connectGetListGeneration;
+    virDrvDomainBlockPeekStream         domainBlockPeekStream;
+    virDrvDomainMemoryPeekStream        domainMemoryPeekStream;
+    virDrvDomainListFSFreeze            domainListFSFreeze;
+    virDrvDomainListFSThaw              domainListFSThaw;
+    virDrvDomainMigrateGetCompressionCache domainMigrateGetCompressionCache;
+    virDrvDomainMigrateSetCompressionCache domainMigrateSetCompressionCache;
+    virDrvConnectListAllDomainsFiltered connectListAllDomainsFiltered;
 };
 
 typedef int
@@ -1166,6 +1259,11 @@ typedef int
         (*virDrvNetworkIsActive)        (virNetworkPtr net);
 typedef int
         (*virDrvNetworkIsPersistent)    (virNetworkPtr net);
+typedef int
+        (*virDrvNetworkGetDHCPLeases)   (virNetworkPtr network,
+                                         const char *mac,
+                                         virNetworkDHCPLeasePtr **leases,
+                                         unsigned int flags);
 
 
 
@@ -1205,6 +1303,8 @@ struct _virNetworkDriver {
         virDrvNetworkSetAutostart   networkSetAutostart;
         virDrvNetworkIsActive       networkIsActive;
         virDrvNetworkIsPersistent   networkIsPersistent;
+        virDrvNetworkGetDHCPLeases  networkGetDHCPLeases;
+        virDrvConnectGetListGeneration connectGetListGeneration;
 };
 
 /*-------*/
@@ -1431,6 +1531,15 @@ typedef int
                                    unsigned long long capacity,
                                    unsigned int flags);
 
+typedef int
+        (*virDrvStorageVolGetJobInfo)(virStorageVolPtr vol,
+                                      virStorageVolJobInfoPtr info,
+                                      unsigned int flags);
+
+typedef int
+        (*virDrvStorageVolAbortJob)(virStorageVolPtr vol,
+                                    unsigned int flags);
+
 typedef int
         (*virDrvStoragePoolIsActive)(virStoragePoolPtr pool);
 typedef int
@@ -1497,6 +1606,9 @@ struct _virStorageDriver {
     virDrvStorageVolResize                  volResize;
     virDrvStoragePoolIsActive               poolIsActive;
     virDrvStoragePoolIsPersistent           poolIsPersistent;
+    virDrvStorageVolGetJobInfo              volGetJobInfo;
+    virDrvStorageVolAbortJob                volAbortJob;
+    virDrvConnectGetListGeneration          connectGetListGeneration;
 };
 
 # ifdef WITH_LIBVIRTD
@@ -1507,6 +1619,7 @@ typedef int (*virDrvStateInitialize) (bool privileged,
 typedef int (*virDrvStateCleanup) (void);
 typedef int (*virDrvStateReload) (void);
 typedef int (*virDrvStateStop) (void);
+typedef int (*virDrvStatePreExecRestart) (void);
 
 typedef struct _virStateDriver virStateDriver;
 typedef virStateDriver *virStateDriverPtr;
@@ -1517,6 +1630,7 @@ struct _virStateDriver {
     virDrvStateCleanup     cleanup;
     virDrvStateReload      reload;
     virDrvStateStop        stop;
+    virDrvStatePreExecRestart preExecRestart;
 };
 # endif
 
@@ -1662,6 +1776,16 @@ typedef int (*virDrvStreamSend)(virStreamPtr st,
 typedef int (*virDrvStreamRecv)(virStreamPtr st,
                                 char *data,
                                 size_t nbytes);
+typedef int (*virDrvStreamRecvFlags)(virStreamPtr st,
+                                     char *data,
+                                     size_t nbytes,
+                                     unsigned int flags);
+typedef int (*virDrvStreamSendHole)(virStreamPtr st,
+                                    long long length,
+                                    unsigned int flags);
+typedef int (*virDrvStreamRecvHole)(virStreamPtr st,
+                                    long long *length,
+                                    unsigned int flags);
 
 typedef int (*virDrvStreamEventAddCallback)(virStreamPtr stream,
                                             int events,
@@ -1679,6 +1803,9 @@ typedef int (*virDrvStreamAbort)(virStreamPtr st);
 struct _virStreamDriver {
     virDrvStreamSend                streamSend;
     virDrvStreamRecv                streamRecv;
+    virDrvStreamRecvFlags           streamRecvFlags;
+    virDrvStreamSendHole            streamSendHole;
+    virDrvStreamRecvHole            streamRecvHole;
     virDrvStreamEventAddCallback    streamAddCallback;
     virDrvStreamEventUpdateCallback streamUpdateCallback;
     virDrvStreamEventRemoveCallback streamRemoveCallback;
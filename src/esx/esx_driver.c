@@ -5240,9 +5240,12 @@ no_memory:
 #undef MATCH
 
 
+static const char *esxURISchemes[] = { "vpx", "esx", "gsx", NULL };
+
 static virDriver esxDriver = {
     .no = VIR_DRV_ESX,
     .name = "ESX",
+    .uriSchemes = esxURISchemes,
     .open = esxOpen, /* 0.7.0 */
     .close = esxClose, /* 0.7.0 */
     .supports_feature = esxSupportsFeature, /* 0.7.0 */
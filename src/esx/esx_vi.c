@@ -750,6 +750,153 @@ esxVI_MultiCURL_Remove(esxVI_MultiCURL *multi, esxVI_CURL *curl)
 
 
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * CURLPool
+ */
+
+/* esxVI_CURLPool_Alloc */
+ESX_VI__TEMPLATE__ALLOC(CURLPool)
+
+/* esxVI_CURLPool_Free */
+ESX_VI__TEMPLATE__FREE(CURLPool,
+{
+    int i;
+
+    for (i = 0; i < ESX_VI__CURL_POOL__SIZE; ++i) {
+        if (item->busy[i]) {
+            /* Better leak than crash */
+            VIR_ERROR(_("Trying to free CURLPool object that is still in use"));
+            return;
+        }
+    }
+
+    for (i = 0; i < ESX_VI__CURL_POOL__SIZE; ++i) {
+        esxVI_CURL_Free(&item->handles[i]);
+    }
+
+    ignore_value(virCondDestroy(&item->cond));
+    virMutexDestroy(&item->lock);
+})
+
+int
+esxVI_CURLPool_Connect(esxVI_CURLPool *pool, esxUtil_ParsedUri *parsedUri,
+                       esxVI_SharedCURL *shared)
+{
+    int i;
+
+    for (i = 0; i < ESX_VI__CURL_POOL__SIZE; ++i) {
+        if (pool->handles[i] != NULL) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("Invalid call"));
+            return -1;
+        }
+    }
+
+    if (virMutexInit(&pool->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Could not initialize CURL (pool) mutex"));
+        return -1;
+    }
+
+    if (virCondInit(&pool->cond) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Could not initialize CURL (pool) condition"));
+        return -1;
+    }
+
+    for (i = 0; i < ESX_VI__CURL_POOL__SIZE; ++i) {
+        if (esxVI_CURL_Alloc(&pool->handles[i]) < 0 ||
+            esxVI_CURL_Connect(pool->handles[i], parsedUri) < 0 ||
+            esxVI_SharedCURL_Add(shared, pool->handles[i]) < 0) {
+            return -1;
+        }
+
+        /*
+         * Let the server compress SOAP responses, large property sets shrink
+         * a lot. This is not done for esxVI_CURL_Download, because it uses
+         * range requests.
+         */
+        curl_easy_setopt(pool->handles[i]->handle, CURLOPT_ENCODING, "");
+#if LIBCURL_VERSION_NUM >= 0x071900 /* 7.25.0 */
+        curl_easy_setopt(pool->handles[i]->handle, CURLOPT_TCP_KEEPALIVE, 1);
+#endif
+    }
+
+    return 0;
+}
+
+/*
+ * Get an idle handle from the pool, waiting for one to become idle if
+ * necessary. Each handle keeps its connection to the server open, so most
+ * requests don't have to connect first.
+ */
+esxVI_CURL *
+esxVI_CURLPool_Acquire(esxVI_CURLPool *pool)
+{
+    int i;
+    esxVI_CURL *curl = NULL;
+
+    virMutexLock(&pool->lock);
+
+    while (curl == NULL) {
+        for (i = 0; i < ESX_VI__CURL_POOL__SIZE; ++i) {
+            if (!pool->busy[i]) {
+                pool->busy[i] = true;
+                curl = pool->handles[i];
+                break;
+            }
+        }
+
+        if (curl == NULL && virCondWait(&pool->cond, &pool->lock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Could not wait for a CURL handle"));
+            break;
+        }
+    }
+
+    virMutexUnlock(&pool->lock);
+
+    return curl;
+}
+
+void
+esxVI_CURLPool_Release(esxVI_CURLPool *pool, esxVI_CURL *curl)
+{
+    int i;
+
+    virMutexLock(&pool->lock);
+
+    for (i = 0; i < ESX_VI__CURL_POOL__SIZE; ++i) {
+        if (pool->handles[i] == curl) {
+            pool->busy[i] = false;
+            virCondSignal(&pool->cond);
+            break;
+        }
+    }
+
+    virMutexUnlock(&pool->lock);
+}
+
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Inventory
+ */
+
+/* esxVI_Inventory_Alloc */
+ESX_VI__TEMPLATE__ALLOC(Inventory)
+
+/* esxVI_Inventory_Free */
+ESX_VI__TEMPLATE__FREE(Inventory,
+{
+    virMutexDestroy(&item->lock);
+    VIR_FREE(item->sessionKey);
+    esxVI_ManagedObjectReference_Free(&item->filter);
+    VIR_FREE(item->version);
+    esxVI_ObjectContent_Free(&item->virtualMachineList);
+})
+
+
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Context
  */
@@ -765,6 +912,7 @@ ESX_VI__TEMPLATE__FREE(Context,
     }
 
     esxVI_CURL_Free(&item->curl);
+    esxVI_CURLPool_Free(&item->curlPool);
     VIR_FREE(item->url);
     VIR_FREE(item->ipAddress);
     VIR_FREE(item->username);
@@ -785,6 +933,7 @@ ESX_VI__TEMPLATE__FREE(Context,
     esxVI_SelectionSpec_Free(&item->selectSet_computeResourceToHost);
     esxVI_SelectionSpec_Free(&item->selectSet_computeResourceToParentToParent);
     esxVI_SelectionSpec_Free(&item->selectSet_datacenterToNetwork);
+    esxVI_Inventory_Free(&item->inventory);
 })
 
 int
@@ -792,15 +941,32 @@ esxVI_Context_Connect(esxVI_Context *ctx, const char *url,
                       const char *ipAddress, const char *username,
                       const char *password, esxUtil_ParsedUri *parsedUri)
 {
+    esxVI_SharedCURL *shared = NULL;
+
     if (ctx == NULL || url == NULL || ipAddress == NULL || username == NULL ||
         password == NULL || ctx->url != NULL || ctx->service != NULL ||
-        ctx->curl != NULL) {
+        ctx->curl != NULL || ctx->curlPool != NULL) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("Invalid argument"));
         return -1;
     }
 
     if (esxVI_CURL_Alloc(&ctx->curl) < 0 ||
         esxVI_CURL_Connect(ctx->curl, parsedUri) < 0 ||
+        esxVI_SharedCURL_Alloc(&shared) < 0) {
+        return -1;
+    }
+
+    /*
+     * All handles share the session cookie. The SharedCURL object is freed
+     * together with the last handle that uses it.
+     */
+    if (esxVI_SharedCURL_Add(shared, ctx->curl) < 0) {
+        esxVI_SharedCURL_Free(&shared);
+        return -1;
+    }
+
+    if (esxVI_CURLPool_Alloc(&ctx->curlPool) < 0 ||
+        esxVI_CURLPool_Connect(ctx->curlPool, parsedUri, shared) < 0 ||
         esxVI_String_DeepCopyValue(&ctx->url, url) < 0 ||
         esxVI_String_DeepCopyValue(&ctx->ipAddress, ipAddress) < 0 ||
         esxVI_String_DeepCopyValue(&ctx->username, username) < 0 ||
@@ -819,6 +985,16 @@ esxVI_Context_Connect(esxVI_Context *ctx, const char *url,
         return -1;
     }
 
+    if (esxVI_Inventory_Alloc(&ctx->inventory) < 0) {
+        return -1;
+    }
+
+    if (virMutexInit(&ctx->inventory->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Could not initialize inventory mutex"));
+        return -1;
+    }
+
     if (esxVI_RetrieveServiceContent(ctx, &ctx->service) < 0) {
         return -1;
     }
@@ -1248,6 +1424,7 @@ esxVI_Context_Execute(esxVI_Context *ctx, const char *methodName,
                       esxVI_Occurrence occurrence)
 {
     int result = -1;
+    esxVI_CURL *curl = NULL;
     virBuffer buffer = VIR_BUFFER_INITIALIZER;
     esxVI_Fault *fault = NULL;
     char *xpathExpression = NULL;
@@ -1263,18 +1440,26 @@ esxVI_Context_Execute(esxVI_Context *ctx, const char *methodName,
         return -1;
     }
 
-    virMutexLock(&ctx->curl->lock);
+    curl = esxVI_CURLPool_Acquire(ctx->curlPool);
+
+    if (curl == NULL) {
+        goto cleanup;
+    }
+
+    virMutexLock(&curl->lock);
 
-    curl_easy_setopt(ctx->curl->handle, CURLOPT_URL, ctx->url);
-    curl_easy_setopt(ctx->curl->handle, CURLOPT_RANGE, NULL);
-    curl_easy_setopt(ctx->curl->handle, CURLOPT_WRITEDATA, &buffer);
-    curl_easy_setopt(ctx->curl->handle, CURLOPT_UPLOAD, 0);
-    curl_easy_setopt(ctx->curl->handle, CURLOPT_POSTFIELDS, request);
-    curl_easy_setopt(ctx->curl->handle, CURLOPT_POSTFIELDSIZE, strlen(request));
+    curl_easy_setopt(curl->handle, CURLOPT_URL, ctx->url);
+    curl_easy_setopt(curl->handle, CURLOPT_RANGE, NULL);
+    curl_easy_setopt(curl->handle, CURLOPT_WRITEDATA, &buffer);
+    curl_easy_setopt(curl->handle, CURLOPT_UPLOAD, 0);
+    curl_easy_setopt(curl->handle, CURLOPT_POSTFIELDS, request);
+    curl_easy_setopt(curl->handle, CURLOPT_POSTFIELDSIZE, strlen(request));
+
+    (*response)->responseCode = esxVI_CURL_Perform(curl, ctx->url);
 
-    (*response)->responseCode = esxVI_CURL_Perform(ctx->curl, ctx->url);
+    virMutexUnlock(&curl->lock);
 
-    virMutexUnlock(&ctx->curl->lock);
+    esxVI_CURLPool_Release(ctx->curlPool, curl);
 
     if ((*response)->responseCode < 0) {
         goto cleanup;
@@ -2747,11 +2932,485 @@ esxVI_LookupHostSystemProperties(esxVI_Context *ctx,
 
 
 
+/* Virtual machine properties kept in the inventory */
+static const char *esxVI_Inventory_properties =
+    "configStatus\0"
+    "name\0"
+    "config.uuid\0"
+    "runtime.powerState\0";
+
+static bool
+esxVI_Inventory_HasProperties(esxVI_String *propertyNameList)
+{
+    esxVI_String *propertyName;
+    const char *property;
+
+    for (propertyName = propertyNameList; propertyName != NULL;
+         propertyName = propertyName->_next) {
+        for (property = esxVI_Inventory_properties; *property != '\0';
+             property += strlen(property) + 1) {
+            if (STREQ(propertyName->value, property)) {
+                break;
+            }
+        }
+
+        if (*property == '\0') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+
+/* Forget everything, for example because the session has changed */
+static void
+esxVI_Inventory_Reset(esxVI_Inventory *inventory)
+{
+    VIR_FREE(inventory->sessionKey);
+    esxVI_ManagedObjectReference_Free(&inventory->filter);
+    VIR_FREE(inventory->version);
+    esxVI_ObjectContent_Free(&inventory->virtualMachineList);
+}
+
+
+
+static int
+esxVI_Inventory_CreateFilter(esxVI_Context *ctx, esxVI_Inventory *inventory)
+{
+    int result = -1;
+    esxVI_ObjectSpec *objectSpec = NULL;
+    bool objectSpec_isAppended = false;
+    esxVI_PropertySpec *propertySpec = NULL;
+    bool propertySpec_isAppended = false;
+    esxVI_PropertyFilterSpec *propertyFilterSpec = NULL;
+
+    if (esxVI_ObjectSpec_Alloc(&objectSpec) < 0) {
+        return -1;
+    }
+
+    /* FIXME: Switch from ctx->hostSystem to ctx->computeResource->resourcePool
+     *        for cluster support */
+    objectSpec->obj = ctx->hostSystem->_reference;
+    objectSpec->skip = esxVI_Boolean_False;
+    objectSpec->selectSet = ctx->selectSet_hostSystemToVm;
+
+    if (esxVI_PropertySpec_Alloc(&propertySpec) < 0) {
+        goto cleanup;
+    }
+
+    propertySpec->type = (char *)"VirtualMachine";
+
+    if (esxVI_String_AppendValueListToList(&propertySpec->pathSet,
+                                           esxVI_Inventory_properties) < 0 ||
+        esxVI_PropertyFilterSpec_Alloc(&propertyFilterSpec) < 0 ||
+        esxVI_PropertySpec_AppendToList(&propertyFilterSpec->propSet,
+                                        propertySpec) < 0) {
+        goto cleanup;
+    }
+
+    propertySpec_isAppended = true;
+
+    if (esxVI_ObjectSpec_AppendToList(&propertyFilterSpec->objectSet,
+                                      objectSpec) < 0) {
+        goto cleanup;
+    }
+
+    objectSpec_isAppended = true;
+
+    if (esxVI_CreateFilter(ctx, propertyFilterSpec, esxVI_Boolean_False,
+                           &inventory->filter) < 0 ||
+        esxVI_String_DeepCopyValue(&inventory->version, "") < 0) {
+        goto cleanup;
+    }
+
+    result = 0;
+
+  cleanup:
+    /*
+     * Remove values borrowed from the context from the data structures to
+     * prevent them from being freed by esxVI_PropertyFilterSpec_Free().
+     */
+    if (objectSpec != NULL) {
+        objectSpec->obj = NULL;
+        objectSpec->selectSet = NULL;
+    }
+
+    if (propertySpec != NULL) {
+        propertySpec->type = NULL;
+    }
+
+    if (!objectSpec_isAppended) {
+        esxVI_ObjectSpec_Free(&objectSpec);
+    }
+
+    if (!propertySpec_isAppended) {
+        esxVI_PropertySpec_Free(&propertySpec);
+    }
+
+    esxVI_PropertyFilterSpec_Free(&propertyFilterSpec);
+
+    return result;
+}
+
+
+
+static int
+esxVI_Inventory_ApplyObjectUpdate(esxVI_Inventory *inventory,
+                                  esxVI_ObjectUpdate *objectUpdate)
+{
+    esxVI_ObjectContent **next;
+    esxVI_ObjectContent *virtualMachine = NULL;
+    esxVI_PropertyChange *propertyChange;
+    esxVI_DynamicProperty **nextProperty;
+    esxVI_DynamicProperty *dynamicProperty = NULL;
+
+    for (next = &inventory->virtualMachineList; *next != NULL;
+         next = &(*next)->_next) {
+        if (STREQ((*next)->obj->value, objectUpdate->obj->value)) {
+            virtualMachine = *next;
+            break;
+        }
+    }
+
+    if (objectUpdate->kind == esxVI_ObjectUpdateKind_Leave) {
+        if (virtualMachine != NULL) {
+            *next = virtualMachine->_next;
+            virtualMachine->_next = NULL;
+            esxVI_ObjectContent_Free(&virtualMachine);
+        }
+
+        return 0;
+    }
+
+    if (virtualMachine == NULL) {
+        if (esxVI_ObjectContent_Alloc(&virtualMachine) < 0 ||
+            esxVI_ManagedObjectReference_DeepCopy(&virtualMachine->obj,
+                                                  objectUpdate->obj) < 0 ||
+            esxVI_ObjectContent_AppendToList(&inventory->virtualMachineList,
+                                             virtualMachine) < 0) {
+            esxVI_ObjectContent_Free(&virtualMachine);
+            return -1;
+        }
+    }
+
+    for (propertyChange = objectUpdate->changeSet; propertyChange != NULL;
+         propertyChange = propertyChange->_next) {
+        /* Drop the old value, then add the new one if there is one */
+        for (nextProperty = &virtualMachine->propSet; *nextProperty != NULL;
+             nextProperty = &(*nextProperty)->_next) {
+            if (STREQ((*nextProperty)->name, propertyChange->name)) {
+                dynamicProperty = *nextProperty;
+                *nextProperty = dynamicProperty->_next;
+                dynamicProperty->_next = NULL;
+                esxVI_DynamicProperty_Free(&dynamicProperty);
+                break;
+            }
+        }
+
+        if ((propertyChange->op != esxVI_PropertyChangeOp_Add &&
+             propertyChange->op != esxVI_PropertyChangeOp_Assign) ||
+            propertyChange->val == NULL) {
+            continue;
+        }
+
+        if (esxVI_DynamicProperty_Alloc(&dynamicProperty) < 0 ||
+            esxVI_String_DeepCopyValue(&dynamicProperty->name,
+                                       propertyChange->name) < 0 ||
+            esxVI_AnyType_DeepCopy(&dynamicProperty->val,
+                                   propertyChange->val) < 0 ||
+            esxVI_DynamicProperty_AppendToList(&virtualMachine->propSet,
+                                               dynamicProperty) < 0) {
+            esxVI_DynamicProperty_Free(&dynamicProperty);
+            return -1;
+        }
+
+        dynamicProperty = NULL;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Bring the inventory up to date, creating its filter first if there is none
+ * for the current session yet. Call with the inventory lock held.
+ */
+static int
+esxVI_Inventory_Refresh(esxVI_Context *ctx, esxVI_Inventory *inventory)
+{
+    int result = -1;
+    char *sessionKey = NULL;
+    esxVI_UpdateSet *updateSet = NULL;
+    esxVI_PropertyFilterUpdate *propertyFilterUpdate;
+    esxVI_ObjectUpdate *objectUpdate;
+
+    virMutexLock(ctx->sessionLock);
+
+    if (ctx->session != NULL) {
+        sessionKey = strdup(ctx->session->key);
+    }
+
+    virMutexUnlock(ctx->sessionLock);
+
+    if (sessionKey == NULL) {
+        return -1;
+    }
+
+    if (inventory->sessionKey != NULL &&
+        STRNEQ(inventory->sessionKey, sessionKey)) {
+        /* The filter went away with the old session */
+        esxVI_Inventory_Reset(inventory);
+    }
+
+    if (inventory->filter == NULL) {
+        if (esxVI_Inventory_CreateFilter(ctx, inventory) < 0) {
+            goto cleanup;
+        }
+
+        inventory->sessionKey = sessionKey;
+        sessionKey = NULL;
+    }
+
+    while (true) {
+        if (esxVI_CheckForUpdates(ctx, inventory->version, &updateSet) < 0) {
+            goto cleanup;
+        }
+
+        if (updateSet == NULL) {
+            break; /* Nothing changed */
+        }
+
+        for (propertyFilterUpdate = updateSet->filterSet;
+             propertyFilterUpdate != NULL;
+             propertyFilterUpdate = propertyFilterUpdate->_next) {
+            if (STRNEQ(propertyFilterUpdate->filter->value,
+                       inventory->filter->value)) {
+                continue; /* Some other filter of this session */
+            }
+
+            for (objectUpdate = propertyFilterUpdate->objectSet;
+                 objectUpdate != NULL; objectUpdate = objectUpdate->_next) {
+                if (esxVI_Inventory_ApplyObjectUpdate(inventory,
+                                                      objectUpdate) < 0) {
+                    goto cleanup;
+                }
+            }
+        }
+
+        VIR_FREE(inventory->version);
+
+        if (esxVI_String_DeepCopyValue(&inventory->version,
+                                       updateSet->version) < 0) {
+            goto cleanup;
+        }
+
+        esxVI_UpdateSet_Free(&updateSet);
+    }
+
+    result = 0;
+
+  cleanup:
+    if (result < 0) {
+        esxVI_Inventory_Reset(inventory);
+    }
+
+    VIR_FREE(sessionKey);
+    esxVI_UpdateSet_Free(&updateSet);
+
+    return result;
+}
+
+
+
+/*
+ * Copy the virtual machine from the inventory, with only the properties in
+ * propertyNameList.
+ */
+static int
+esxVI_Inventory_CopyVirtualMachine(esxVI_ObjectContent *virtualMachine,
+                                   esxVI_String *propertyNameList,
+                                   esxVI_ObjectContent **copy)
+{
+    esxVI_DynamicProperty *dynamicProperty;
+    esxVI_DynamicProperty *dynamicPropertyCopy = NULL;
+    esxVI_String *propertyName;
+
+    if (esxVI_ObjectContent_Alloc(copy) < 0 ||
+        esxVI_ManagedObjectReference_DeepCopy(&(*copy)->obj,
+                                              virtualMachine->obj) < 0) {
+        goto failure;
+    }
+
+    for (dynamicProperty = virtualMachine->propSet; dynamicProperty != NULL;
+         dynamicProperty = dynamicProperty->_next) {
+        for (propertyName = propertyNameList; propertyName != NULL;
+             propertyName = propertyName->_next) {
+            if (STREQ(propertyName->value, dynamicProperty->name)) {
+                break;
+            }
+        }
+
+        if (propertyName == NULL) {
+            continue;
+        }
+
+        if (esxVI_DynamicProperty_DeepCopy(&dynamicPropertyCopy,
+                                           dynamicProperty) < 0 ||
+            esxVI_DynamicProperty_AppendToList(&(*copy)->propSet,
+                                               dynamicPropertyCopy) < 0) {
+            esxVI_DynamicProperty_Free(&dynamicPropertyCopy);
+            goto failure;
+        }
+
+        dynamicPropertyCopy = NULL;
+    }
+
+    return 0;
+
+  failure:
+    esxVI_ObjectContent_Free(copy);
+
+    return -1;
+}
+
+
+
+/*
+ * Look up virtual machines in the inventory. If uuid is NULL all of them
+ * are returned, otherwise just the one with that UUID, if any.
+ *
+ * Returns 1 if the inventory could answer, 0 if the caller has to ask the
+ * server itself, or -1 on error.
+ */
+static int
+esxVI_Inventory_Lookup(esxVI_Context *ctx, const unsigned char *uuid,
+                       esxVI_String *propertyNameList,
+                       esxVI_ObjectContent **virtualMachineList)
+{
+    int result = -1;
+    esxVI_Inventory *inventory = ctx->inventory;
+    esxVI_ObjectContent *virtualMachine;
+    esxVI_ObjectContent *copy = NULL;
+    esxVI_DynamicProperty *dynamicProperty;
+    unsigned char uuid_candidate[VIR_UUID_BUFLEN];
+
+    if (inventory == NULL || ctx->hostSystem == NULL ||
+        !esxVI_Inventory_HasProperties(propertyNameList)) {
+        return 0;
+    }
+
+    virMutexLock(&inventory->lock);
+
+    if (esxVI_Inventory_Refresh(ctx, inventory) < 0) {
+        /* Fall back to looking things up the usual way */
+        VIR_DEBUG("Could not refresh the inventory");
+        virResetLastError();
+        result = 0;
+        goto cleanup;
+    }
+
+    for (virtualMachine = inventory->virtualMachineList;
+         virtualMachine != NULL; virtualMachine = virtualMachine->_next) {
+        if (uuid != NULL) {
+            for (dynamicProperty = virtualMachine->propSet;
+                 dynamicProperty != NULL;
+                 dynamicProperty = dynamicProperty->_next) {
+                if (STREQ(dynamicProperty->name, "config.uuid")) {
+                    break;
+                }
+            }
+
+            if (dynamicProperty == NULL ||
+                dynamicProperty->val->type != esxVI_Type_String ||
+                virUUIDParse(dynamicProperty->val->string,
+                             uuid_candidate) < 0 ||
+                memcmp(uuid, uuid_candidate, VIR_UUID_BUFLEN) != 0) {
+                continue;
+            }
+        }
+
+        if (esxVI_Inventory_CopyVirtualMachine(virtualMachine,
+                                               propertyNameList, &copy) < 0 ||
+            esxVI_ObjectContent_AppendToList(virtualMachineList, copy) < 0) {
+            esxVI_ObjectContent_Free(&copy);
+            esxVI_ObjectContent_Free(virtualMachineList);
+            goto cleanup;
+        }
+
+        copy = NULL;
+
+        if (uuid != NULL) {
+            break;
+        }
+    }
+
+    /* Virtual machines of other hosts can still be found by UUID */
+    result = uuid == NULL || *virtualMachineList != NULL ? 1 : 0;
+
+  cleanup:
+    virMutexUnlock(&inventory->lock);
+
+    return result;
+}
+
+
+
+/*
+ * The version of the inventory filter's last update set, or "" if there is
+ * no filter for the current session. Used as a starting point by other
+ * update loops on the same session, so their first update set doesn't carry
+ * the complete inventory.
+ */
+static int
+esxVI_Inventory_CopyVersion(esxVI_Context *ctx, char **version)
+{
+    esxVI_Inventory *inventory = ctx->inventory;
+    const char *value = "";
+    int result;
+
+    if (inventory == NULL) {
+        return esxVI_String_DeepCopyValue(version, value);
+    }
+
+    virMutexLock(&inventory->lock);
+    virMutexLock(ctx->sessionLock);
+
+    if (inventory->filter != NULL && ctx->session != NULL &&
+        STREQ(inventory->sessionKey, ctx->session->key)) {
+        value = inventory->version;
+    }
+
+    virMutexUnlock(ctx->sessionLock);
+
+    result = esxVI_String_DeepCopyValue(version, value);
+
+    virMutexUnlock(&inventory->lock);
+
+    return result;
+}
+
+
+
 int
 esxVI_LookupVirtualMachineList(esxVI_Context *ctx,
                                esxVI_String *propertyNameList,
                                esxVI_ObjectContent **virtualMachineList)
 {
+    int rc;
+
+    if (virtualMachineList == NULL || *virtualMachineList != NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("Invalid argument"));
+        return -1;
+    }
+
+    if ((rc = esxVI_Inventory_Lookup(ctx, NULL, propertyNameList,
+                                     virtualMachineList)) != 0) {
+        return rc < 0 ? -1 : 0;
+    }
+
     /* FIXME: Switch from ctx->hostSystem to ctx->computeResource->resourcePool
      *        for cluster support */
     return esxVI_LookupObjectContentByType(ctx, ctx->hostSystem->_reference,
@@ -2777,6 +3436,13 @@ esxVI_LookupVirtualMachineByUuid(esxVI_Context *ctx, const unsigned char *uuid,
         return -1;
     }
 
+    if ((result = esxVI_Inventory_Lookup(ctx, uuid, propertyNameList,
+                                         virtualMachine)) != 0) {
+        return result < 0 ? -1 : 0;
+    }
+
+    result = -1;
+
     virUUIDFormat(uuid, uuid_string);
 
     if (esxVI_FindByUuid(ctx, ctx->datacenter->_reference, uuid_string,
@@ -4389,10 +5055,7 @@ esxVI_WaitForTaskCompletion(esxVI_Context *ctx,
         return -1;
     }
 
-    version = strdup("");
-
-    if (version == NULL) {
-        virReportOOMError();
+    if (esxVI_Inventory_CopyVersion(ctx, &version) < 0) {
         return -1;
     }
 
@@ -79,6 +79,8 @@ typedef struct _esxVI_ParsedHostCpuIdInfo esxVI_ParsedHostCpuIdInfo;
 typedef struct _esxVI_CURL esxVI_CURL;
 typedef struct _esxVI_SharedCURL esxVI_SharedCURL;
 typedef struct _esxVI_MultiCURL esxVI_MultiCURL;
+typedef struct _esxVI_CURLPool esxVI_CURLPool;
+typedef struct _esxVI_Inventory esxVI_Inventory;
 typedef struct _esxVI_Context esxVI_Context;
 typedef struct _esxVI_Response esxVI_Response;
 typedef struct _esxVI_Enumeration esxVI_Enumeration;
@@ -202,13 +204,62 @@ int esxVI_MultiCURL_Remove(esxVI_MultiCURL *multi, esxVI_CURL *curl);
 
 
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * CURLPool
+ *
+ * A fixed set of CURL handles for SOAP requests, so several threads can talk
+ * to the same server at the same time. The handles share cookies and DNS
+ * lookups and keep their connections open between requests.
+ */
+
+# define ESX_VI__CURL_POOL__SIZE 4
+
+struct _esxVI_CURLPool {
+    virMutex lock;
+    virCond cond;
+    esxVI_CURL *handles[ESX_VI__CURL_POOL__SIZE];
+    bool busy[ESX_VI__CURL_POOL__SIZE];
+};
+
+int esxVI_CURLPool_Alloc(esxVI_CURLPool **pool);
+void esxVI_CURLPool_Free(esxVI_CURLPool **pool);
+int esxVI_CURLPool_Connect(esxVI_CURLPool *pool, esxUtil_ParsedUri *parsedUri,
+                           esxVI_SharedCURL *shared);
+esxVI_CURL *esxVI_CURLPool_Acquire(esxVI_CURLPool *pool);
+void esxVI_CURLPool_Release(esxVI_CURLPool *pool, esxVI_CURL *curl);
+
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Inventory
+ *
+ * A local copy of some properties of all virtual machines of the host
+ * system. A PropertyCollector filter tracks changes to them, so it can be
+ * brought up to date with a CheckForUpdates call that only transfers the
+ * changes, instead of retrieving all properties again.
+ */
+
+struct _esxVI_Inventory {
+    virMutex lock;
+    char *sessionKey; /* session the filter belongs to */
+    esxVI_ManagedObjectReference *filter;
+    char *version;
+    esxVI_ObjectContent *virtualMachineList;
+};
+
+int esxVI_Inventory_Alloc(esxVI_Inventory **inventory);
+void esxVI_Inventory_Free(esxVI_Inventory **inventory);
+
+
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * Context
  */
 
 struct _esxVI_Context {
     /* All members are used read-only after esxVI_Context_Connect ... */
-    esxVI_CURL *curl;
+    esxVI_CURL *curl; /* for downloads and uploads */
+    esxVI_CURLPool *curlPool; /* for SOAP requests, has its own lock */
     char *url;
     char *ipAddress;
     char *username;
@@ -233,6 +284,7 @@ struct _esxVI_Context {
     esxVI_SelectionSpec *selectSet_datacenterToNetwork;
     bool hasQueryVirtualDiskUuid;
     bool hasSessionIsActive;
+    esxVI_Inventory *inventory; /* has its own lock */
 };
 
 int esxVI_Context_Alloc(esxVI_Context **ctx);
@@ -30,6 +30,9 @@
 #if HAVE_SYS_UN_H
 # include <sys/un.h>
 #endif
+#if HAVE_LINUX_FALLOC_H
+# include <linux/falloc.h>
+#endif
 #include <netinet/in.h>
 
 #include "fdstream.h"
@@ -39,10 +42,39 @@
 #include "memory.h"
 #include "util.h"
 #include "virfile.h"
+#include "vireventthread.h"
 #include "configmake.h"
 
 #define VIR_FROM_THIS VIR_FROM_STREAMS
 
+/* Threads watching stream file handles instead of the main event
+ * loop, so that stream callbacks copying data run there too */
+static virMutex ioThreadsLock;
+static virEventThreadPtr *ioThreads;
+static size_t nioThreads;
+static size_t nextIOThread;
+
+static int virFDStreamOnceInit(void)
+{
+    if (virMutexInit(&ioThreadsLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        return -1;
+    }
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virFDStream)
+
+typedef struct _virFDStreamHole virFDStreamHole;
+typedef virFDStreamHole *virFDStreamHolePtr;
+struct _virFDStreamHole {
+    virFDStreamHolePtr next;
+    unsigned long long pos;     /* socket position the hole sits at */
+    unsigned long long length;
+};
+
 /* Tunnelled migration stream support */
 struct virFDStreamData {
     int fd;
@@ -50,8 +82,29 @@ struct virFDStreamData {
     virCommandPtr cmd;
     unsigned long long offset;
     unsigned long long length;
+    /* fd is a regular file whose holes are transferred as such */
+    bool sparse;
+
+    /* Non-blocking sparse streams can't do their I/O on the file
+     * in-process, as that would block the event loop, and the
+     * iohelper can't see holes. Instead @thread moves the file's
+     * data through a socket pair, whose other end is then @fd,
+     * while the holes go out of band in @holes, each tagged with
+     * the position in the socket's byte stream where it belongs */
+    bool threadRunning;
+    virThread thread;
+    bool threadWrite;           /* the thread writes to the file */
+    int threadFd;               /* the file, only used by the thread */
+    int threadSock;             /* the thread's end of the socket */
+    bool threadQuit;            /* stream aborted, stop at once */
+    bool threadDone;            /* reading thread has queued everything */
+    unsigned long long threadEnd; /* position of the end, once done */
+    virErrorPtr threadErr;      /* why the thread stopped early */
+    unsigned long long sockPos; /* bytes moved through @fd so far */
+    virFDStreamHolePtr holes;
 
     int watch;
+    virEventThreadPtr evt; /* thread owning watch, NULL for the main loop */
     int events;         /* events the stream callback is subscribed for */
     bool cbRemoved;
     bool dispatching;
@@ -73,6 +126,19 @@ struct virFDStreamData {
     virMutex lock;
 };
 
+static void virFDStreamPopHole(struct virFDStreamData *fdst);
+
+/* Report why the sparse I/O thread stopped. fdst->lock must be held */
+static void
+virFDStreamThreadReportError(struct virFDStreamData *fdst)
+{
+    if (fdst->threadErr)
+        virSetError(fdst->threadErr);
+    else
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("stream I/O thread has stopped"));
+}
+
 static int virFDStreamRemoveCallback(virStreamPtr stream)
 {
     struct virFDStreamData *fdst = stream->privateData;
@@ -91,7 +157,12 @@ static int virFDStreamRemoveCallback(virStreamPtr stream)
         goto cleanup;
     }
 
-    virEventRemoveHandle(fdst->watch);
+    if (fdst->evt) {
+        virEventThreadRemoveHandle(fdst->evt, fdst->watch);
+        fdst->evt = NULL;
+    } else {
+        virEventRemoveHandle(fdst->watch);
+    }
     if (fdst->dispatching)
         fdst->cbRemoved = true;
     else if (fdst->ff)
@@ -128,7 +199,10 @@ static int virFDStreamUpdateCallback(virStreamPtr stream, int events)
         goto cleanup;
     }
 
-    virEventUpdateHandle(fdst->watch, events);
+    if (fdst->evt)
+        virEventThreadUpdateHandle(fdst->evt, fdst->watch, events);
+    else
+        virEventUpdateHandle(fdst->watch, events);
     fdst->events = events;
 
     ret = 0;
@@ -187,6 +261,94 @@ static void virFDStreamCallbackFree(void *opaque)
 }
 
 
+/* Pick the I/O thread for a new watch, if there are any */
+static virEventThreadPtr
+virFDStreamGetIOThread(void)
+{
+    virEventThreadPtr evt = NULL;
+
+    if (virFDStreamInitialize() < 0)
+        return NULL;
+
+    virMutexLock(&ioThreadsLock);
+    if (nioThreads) {
+        evt = ioThreads[nextIOThread];
+        nextIOThread = (nextIOThread + 1) % nioThreads;
+    }
+    virMutexUnlock(&ioThreadsLock);
+
+    return evt;
+}
+
+/**
+ * virFDStreamSetIOThreads:
+ * @nthreads: number of threads, 0 to use the main event loop
+ *
+ * Service the callbacks of file descriptor streams registered from
+ * now on from @nthreads dedicated threads, in turn, rather than from
+ * the main event loop. Stream users such as the daemon copy data
+ * from those callbacks, which would otherwise hold up every other
+ * client and monitor on the main loop during large transfers.
+ *
+ * The threads live until the process exits, so this can only be
+ * called once, at startup.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virFDStreamSetIOThreads(size_t nthreads)
+{
+    virEventThreadPtr *threads = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (virFDStreamInitialize() < 0)
+        return -1;
+
+    if (nthreads == 0)
+        return 0;
+
+    if (ioThreads) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("stream I/O threads are already set up"));
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(threads, nthreads) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        char *name;
+
+        if (virAsprintf(&name, "stream-io-%zu", i) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        threads[i] = virEventThreadNew(name);
+        VIR_FREE(name);
+        if (!threads[i])
+            goto cleanup;
+    }
+
+    virMutexLock(&ioThreadsLock);
+    ioThreads = threads;
+    nioThreads = nthreads;
+    threads = NULL;
+    virMutexUnlock(&ioThreadsLock);
+    ret = 0;
+
+cleanup:
+    if (threads) {
+        for (i = 0; i < nthreads; i++)
+            virObjectUnref(threads[i]);
+        VIR_FREE(threads);
+    }
+    return ret;
+}
+
+
 static int
 virFDStreamAddCallback(virStreamPtr st,
                        int events,
@@ -210,13 +372,20 @@ virFDStreamAddCallback(virStreamPtr st,
         goto cleanup;
     }
 
-    if ((fdst->watch = virEventAddHandle(fdst->fd,
-                                           events,
-                                           virFDStreamEvent,
-                                           st,
-                                           virFDStreamCallbackFree)) < 0) {
+    fdst->evt = virFDStreamGetIOThread();
+    if (fdst->evt)
+        fdst->watch = virEventThreadAddHandle(fdst->evt, fdst->fd, events,
+                                              virFDStreamEvent, st,
+                                              virFDStreamCallbackFree);
+    else
+        fdst->watch = virEventAddHandle(fdst->fd, events,
+                                        virFDStreamEvent, st,
+                                        virFDStreamCallbackFree);
+    if (fdst->watch < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("cannot register file watch on stream"));
+        fdst->evt = NULL;
+        fdst->watch = 0;
         goto cleanup;
     }
 
@@ -242,6 +411,7 @@ virFDStreamCloseInt(virStreamPtr st, bool streamAbort)
     struct virFDStreamData *fdst;
     virStreamEventCallback cb;
     void *opaque;
+    int threadRet = 0;
     int ret;
 
     VIR_DEBUG("st=%p", st);
@@ -279,7 +449,38 @@ virFDStreamCloseInt(virStreamPtr st, bool streamAbort)
     }
 
     /* mutex locked */
+    if (fdst->threadRunning) {
+        /* A reader is stopped, a writer gets to write out what
+         * was sent before the end of its data */
+        if (streamAbort || !fdst->threadWrite)
+            fdst->threadQuit = true;
+        shutdown(fdst->fd, fdst->threadQuit ? SHUT_RDWR : SHUT_WR);
+        virMutexUnlock(&fdst->lock);
+        virThreadJoin(&fdst->thread);
+        virMutexLock(&fdst->lock);
+        fdst->threadRunning = false;
+
+        if (fdst->threadWrite && !streamAbort) {
+            if (fdst->threadErr) {
+                virSetError(fdst->threadErr);
+                threadRet = -1;
+            } else if (VIR_CLOSE(fdst->threadFd) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to close stream"));
+                threadRet = -1;
+            }
+        }
+        VIR_FORCE_CLOSE(fdst->threadFd);
+        VIR_FORCE_CLOSE(fdst->threadSock);
+        while (fdst->holes)
+            virFDStreamPopHole(fdst);
+        virFreeError(fdst->threadErr);
+        fdst->threadErr = NULL;
+    }
+
     ret = VIR_CLOSE(fdst->fd);
+    if (threadRet < 0)
+        ret = -1;
     if (fdst->cmd) {
         char buf[1024];
         ssize_t len;
@@ -379,8 +580,18 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->threadRunning && fdst->threadDone) {
+        virFDStreamThreadReportError(fdst);
+        virMutexUnlock(&fdst->lock);
+        return -1;
+    }
+
 retry:
-    ret = write(fdst->fd, bytes, nbytes);
+    /* The thread's socket must not raise SIGPIPE should it fail */
+    if (fdst->threadRunning)
+        ret = send(fdst->fd, bytes, nbytes, MSG_NOSIGNAL);
+    else
+        ret = write(fdst->fd, bytes, nbytes);
     if (ret < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             ret = -2;
@@ -391,8 +602,10 @@ retry:
             virReportSystemError(errno, "%s",
                                  _("cannot write to stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+    } else {
+        if (fdst->length)
+            fdst->offset += ret;
+        fdst->sockPos += ret;
     }
 
     virMutexUnlock(&fdst->lock);
@@ -400,11 +613,472 @@ retry:
 }
 
 
-static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+/*
+ * Work out whether the current position of the sparse file @fd
+ * is in data or in a hole, and how many bytes remain before that
+ * changes. Being at the end of the file shows up as a zero length
+ * hole.
+ */
+static int
+virFDStreamInData(int fd,
+                  bool *inData,
+                  unsigned long long *length)
+{
+    off_t cur, data, hole, end;
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) < 0)
+        goto error;
+
+    if ((data = lseek(fd, cur, SEEK_DATA)) < 0) {
+        if (errno == EINVAL) {
+            /* Kernel without SEEK_DATA support, so it's all data */
+            *inData = true;
+            *length = ULLONG_MAX;
+            return 0;
+        }
+        if (errno != ENXIO)
+            goto error;
+
+        /* No more data, so either in the trailing hole or at EOF */
+        if ((end = lseek(fd, 0, SEEK_END)) < 0)
+            goto error;
+        *inData = false;
+        *length = end > cur ? end - cur : 0;
+    } else if (data > cur) {
+        *inData = false;
+        *length = data - cur;
+    } else {
+        if ((hole = lseek(fd, cur, SEEK_HOLE)) < 0)
+            goto error;
+        *inData = true;
+        *length = hole - cur;
+    }
+
+    if (lseek(fd, cur, SEEK_SET) < 0)
+        goto error;
+
+    return 0;
+
+error:
+    virReportSystemError(errno, "%s",
+                         _("unable to look for holes in stream"));
+    return -1;
+}
+#else /* !(defined(SEEK_DATA) && defined(SEEK_HOLE)) */
+static int
+virFDStreamInData(int fd ATTRIBUTE_UNUSED,
+                  bool *inData,
+                  unsigned long long *length)
+{
+    /* No way to find the holes, so it's all data */
+    *inData = true;
+    *length = ULLONG_MAX;
+    return 0;
+}
+#endif /* !(defined(SEEK_DATA) && defined(SEEK_HOLE)) */
+
+
+/*
+ * Make the @len bytes at @offset in the regular file @fd read
+ * back as zeros, deallocating them where the filesystem allows.
+ */
+static int
+virFDStreamPunchHole(int fd, off_t offset, off_t len)
+{
+    static const char zeros[64 * 1024];
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  offset, len) == 0)
+        return 0;
+
+    if (errno != EOPNOTSUPP && errno != ENOSYS) {
+        virReportSystemError(errno, "%s",
+                             _("unable to punch hole in stream"));
+        return -1;
+    }
+#endif
+
+    /* Fall back to writing the zeros out */
+    if (lseek(fd, offset, SEEK_SET) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to seek in stream"));
+        return -1;
+    }
+
+    while (len > 0) {
+        size_t todo = len > sizeof(zeros) ? sizeof(zeros) : len;
+
+        if (safewrite(fd, zeros, todo) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("cannot write to stream"));
+            return -1;
+        }
+        len -= todo;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Turn the @length bytes of the regular file @fd from its current
+ * position into a hole, extending the file if need be, and move past
+ * them.
+ */
+static int
+virFDStreamMakeHole(int fd, unsigned long long length)
+{
+    struct stat sb;
+    off_t cur, end;
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) < 0 ||
+        fstat(fd, &sb) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to access stream"));
+        return -1;
+    }
+    end = cur + length;
+
+    /* Whatever the file already held in the hole's place must
+     * read back as zeros, and a hole past the end of the file
+     * must still extend it */
+    if (cur < sb.st_size &&
+        virFDStreamPunchHole(fd, cur,
+                             (end < sb.st_size ? end : sb.st_size) - cur) < 0)
+        return -1;
+
+    if (end > sb.st_size &&
+        ftruncate(fd, end) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to extend stream"));
+        return -1;
+    }
+
+    if (lseek(fd, end, SEEK_SET) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to seek in stream"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Queue a hole of @length at socket position @pos, merging it into
+ * the last one if that is at the same position. fdst->lock must be
+ * held */
+static int
+virFDStreamQueueHole(struct virFDStreamData *fdst,
+                     unsigned long long pos,
+                     unsigned long long length)
+{
+    virFDStreamHolePtr tail = fdst->holes;
+    virFDStreamHolePtr hole;
+
+    while (tail && tail->next)
+        tail = tail->next;
+
+    if (tail && tail->pos == pos) {
+        tail->length += length;
+        return 0;
+    }
+
+    if (VIR_ALLOC(hole) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+    hole->pos = pos;
+    hole->length = length;
+
+    if (tail)
+        tail->next = hole;
+    else
+        fdst->holes = hole;
+    return 0;
+}
+
+
+static void
+virFDStreamPopHole(struct virFDStreamData *fdst)
+{
+    virFDStreamHolePtr hole = fdst->holes;
+
+    fdst->holes = hole->next;
+    VIR_FREE(hole);
+}
+
+
+#define VIR_FDSTREAM_THREAD_BUFSIZE (256 * 1024)
+
+/*
+ * Copy the file into the socket, queueing its holes instead. @pos
+ * is set to the amount of data sent.
+ */
+static int
+virFDStreamThreadRead(struct virFDStreamData *fdst,
+                      char *buf,
+                      unsigned long long *pos)
+{
+    unsigned long long done = 0;
+
+    for (;;) {
+        bool inData;
+        unsigned long long sectionLen;
+        unsigned long long left = ULLONG_MAX;
+        size_t want = VIR_FDSTREAM_THREAD_BUFSIZE;
+        ssize_t got;
+        char *p;
+
+        if (fdst->length) {
+            if (done == fdst->length)
+                return 0;
+            left = fdst->length - done;
+        }
+
+        if (virFDStreamInData(fdst->threadFd, &inData, &sectionLen) < 0)
+            return -1;
+        if (sectionLen > left)
+            sectionLen = left;
+
+        if (!inData) {
+            bool quit;
+            int rc = 0;
+
+            if (sectionLen == 0)
+                return 0;
+
+            if (lseek(fdst->threadFd, sectionLen, SEEK_CUR) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("unable to seek in stream"));
+                return -1;
+            }
+
+            virMutexLock(&fdst->lock);
+            if (!(quit = fdst->threadQuit))
+                rc = virFDStreamQueueHole(fdst, *pos, sectionLen);
+            virMutexUnlock(&fdst->lock);
+            if (quit)
+                return 0;
+            if (rc < 0)
+                return -1;
+
+            done += sectionLen;
+            continue;
+        }
+
+        if (sectionLen < want)
+            want = sectionLen;
+
+        if ((got = saferead(fdst->threadFd, buf, want)) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("cannot read from stream"));
+            return -1;
+        }
+        if (got == 0)
+            return 0;
+
+        for (p = buf; p < buf + got;) {
+            ssize_t sent = send(fdst->threadSock, p, buf + got - p,
+                                MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR)
+                    continue;
+                virReportSystemError(errno, "%s",
+                                     _("cannot write to stream"));
+                return -1;
+            }
+            p += sent;
+        }
+
+        *pos += got;
+        done += got;
+    }
+}
+
+
+/* Make the holes queued at socket position @pos */
+static int
+virFDStreamThreadWriteHoles(struct virFDStreamData *fdst,
+                            unsigned long long pos)
+{
+    for (;;) {
+        unsigned long long length;
+
+        virMutexLock(&fdst->lock);
+        if (fdst->threadQuit ||
+            !fdst->holes || fdst->holes->pos != pos) {
+            virMutexUnlock(&fdst->lock);
+            return 0;
+        }
+        length = fdst->holes->length;
+        virFDStreamPopHole(fdst);
+        virMutexUnlock(&fdst->lock);
+
+        if (virFDStreamMakeHole(fdst->threadFd, length) < 0)
+            return -1;
+    }
+}
+
+
+/*
+ * Copy the socket into the file until the stream is closed, making
+ * the queued holes where they belong in between.
+ */
+static int
+virFDStreamThreadWrite(struct virFDStreamData *fdst,
+                       char *buf)
+{
+    unsigned long long pos = 0;
+
+    for (;;) {
+        ssize_t got;
+        ssize_t off = 0;
+
+        if (virFDStreamThreadWriteHoles(fdst, pos) < 0)
+            return -1;
+
+        if ((got = read(fdst->threadSock, buf,
+                        VIR_FDSTREAM_THREAD_BUFSIZE)) < 0) {
+            if (errno == EINTR)
+                continue;
+            virReportSystemError(errno, "%s",
+                                 _("cannot read from stream"));
+            return -1;
+        }
+        if (got == 0)
+            break;
+
+        /* Holes queued while this data was on its way must
+         * still be made in the right place within it */
+        while (off < got) {
+            size_t n = got - off;
+
+            virMutexLock(&fdst->lock);
+            if (fdst->holes && fdst->holes->pos < pos + n)
+                n = fdst->holes->pos - pos;
+            virMutexUnlock(&fdst->lock);
+
+            if (safewrite(fdst->threadFd, buf + off, n) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("cannot write to stream"));
+                return -1;
+            }
+            off += n;
+            pos += n;
+
+            if (virFDStreamThreadWriteHoles(fdst, pos) < 0)
+                return -1;
+        }
+    }
+
+    /* Holes sent after the last data */
+    return virFDStreamThreadWriteHoles(fdst, pos);
+}
+
+
+static void
+virFDStreamThread(void *opaque)
+{
+    struct virFDStreamData *fdst = opaque;
+    unsigned long long pos = 0;
+    char *buf = NULL;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, VIR_FDSTREAM_THREAD_BUFSIZE) < 0)
+        virReportOOMError();
+    else if (fdst->threadWrite)
+        ret = virFDStreamThreadWrite(fdst, buf);
+    else
+        ret = virFDStreamThreadRead(fdst, buf, &pos);
+    VIR_FREE(buf);
+
+    virMutexLock(&fdst->lock);
+    if (ret < 0 && !fdst->threadQuit && !fdst->threadErr)
+        fdst->threadErr = virSaveLastError();
+    fdst->threadEnd = pos;
+    fdst->threadDone = true;
+    virMutexUnlock(&fdst->lock);
+
+    if (fdst->threadWrite) {
+        /* Make the stream's writes fail from now on, rather
+         * than have them fill up the socket and wait forever */
+        shutdown(fdst->threadSock, SHUT_RDWR);
+    } else {
+        /* Past the end of the data, so that the stream wakes up
+         * to see that it is all there */
+        char marker = 0;
+        ignore_value(send(fdst->threadSock, &marker, 1, MSG_NOSIGNAL));
+    }
+}
+
+
+/* Read from the socket fed by virFDStreamThreadRead. fdst->lock
+ * must be held */
+static int
+virFDStreamThreadRecv(struct virFDStreamData *fdst,
+                      char *bytes,
+                      size_t nbytes,
+                      unsigned int flags)
+{
+    virFDStreamHolePtr hole = fdst->holes;
+    ssize_t ret;
+
+    if (hole && hole->pos == fdst->sockPos) {
+        if (flags & VIR_STREAM_RECV_STOP_AT_HOLE)
+            return -3;
+        if (hole->length < nbytes)
+            nbytes = hole->length;
+        memset(bytes, 0, nbytes);
+        if (!(hole->length -= nbytes))
+            virFDStreamPopHole(fdst);
+        return nbytes;
+    }
+
+    if (fdst->threadDone) {
+        if (fdst->sockPos == fdst->threadEnd) {
+            if (fdst->threadErr) {
+                virSetError(fdst->threadErr);
+                return -1;
+            }
+            return 0;
+        }
+        if (fdst->threadEnd - fdst->sockPos < nbytes)
+            nbytes = fdst->threadEnd - fdst->sockPos;
+    }
+
+    if (hole && hole->pos - fdst->sockPos < nbytes)
+        nbytes = hole->pos - fdst->sockPos;
+
+retry:
+    ret = read(fdst->fd, bytes, nbytes);
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -2;
+        if (errno == EINTR)
+            goto retry;
+        virReportSystemError(errno, "%s",
+                             _("cannot read from stream"));
+        return -1;
+    }
+
+    fdst->sockPos += ret;
+    return ret;
+}
+
+
+static int
+virFDStreamReadFlags(virStreamPtr st,
+                     char *bytes,
+                     size_t nbytes,
+                     unsigned int flags)
 {
     struct virFDStreamData *fdst = st->privateData;
     int ret;
 
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     if (nbytes > INT_MAX) {
         virReportSystemError(ERANGE, "%s",
                              _("Too many bytes to read from stream"));
@@ -429,6 +1103,43 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->threadRunning) {
+        if ((ret = virFDStreamThreadRecv(fdst, bytes, nbytes, flags)) < 0)
+            goto cleanup;
+        goto done;
+    }
+
+    if (fdst->sparse) {
+        bool inData;
+        unsigned long long sectionLen;
+
+        if (virFDStreamInData(fdst->fd, &inData, &sectionLen) < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+
+        if (sectionLen < nbytes)
+            nbytes = sectionLen;
+
+        if (!inData) {
+            if (nbytes == 0) {
+                ret = 0;
+            } else if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+                ret = -3;
+                goto cleanup;
+            } else if (lseek(fdst->fd, nbytes, SEEK_CUR) < 0) {
+                ret = -1;
+                virReportSystemError(errno, "%s",
+                                     _("unable to seek in stream"));
+                goto cleanup;
+            } else {
+                memset(bytes, 0, nbytes);
+                ret = nbytes;
+            }
+            goto done;
+        }
+    }
+
 retry:
     ret = read(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -441,10 +1152,135 @@ retry:
             virReportSystemError(errno, "%s",
                                  _("cannot read from stream"));
         }
-    } else if (fdst->length) {
+        goto cleanup;
+    }
+
+done:
+    if (fdst->length)
         fdst->offset += ret;
+
+cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
+static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+{
+    return virFDStreamReadFlags(st, bytes, nbytes, 0);
+}
+
+
+static int
+virFDStreamRecvHole(virStreamPtr st,
+                    long long *length,
+                    unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    bool inData = true;
+    unsigned long long sectionLen = 0;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    if (fdst->threadRunning) {
+        if (fdst->holes && fdst->holes->pos == fdst->sockPos) {
+            inData = false;
+            sectionLen = fdst->holes->length;
+        }
+    } else if (fdst->sparse &&
+               virFDStreamInData(fdst->fd, &inData, &sectionLen) < 0) {
+        goto cleanup;
+    }
+
+    if (fdst->length &&
+        (fdst->length - fdst->offset) < sectionLen)
+        sectionLen = fdst->length - fdst->offset;
+
+    if (inData || sectionLen == 0) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("stream is not positioned at a hole"));
+        goto cleanup;
     }
 
+    if (sectionLen > LLONG_MAX)
+        sectionLen = LLONG_MAX;
+
+    if (fdst->threadRunning) {
+        if (!(fdst->holes->length -= sectionLen))
+            virFDStreamPopHole(fdst);
+    } else if (lseek(fdst->fd, sectionLen, SEEK_CUR) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to seek in stream"));
+        goto cleanup;
+    }
+
+    if (fdst->length)
+        fdst->offset += sectionLen;
+    *length = sectionLen;
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
+static int
+virFDStreamSendHole(virStreamPtr st,
+                    long long length,
+                    unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    if (!fdst->sparse) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("stream does not support holes"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    if (fdst->length &&
+        (fdst->length - fdst->offset) < length) {
+        virReportSystemError(ENOSPC, "%s",
+                             _("cannot write to stream"));
+        goto cleanup;
+    }
+
+    if (fdst->threadRunning) {
+        if (fdst->threadDone) {
+            virFDStreamThreadReportError(fdst);
+            goto cleanup;
+        }
+        if (virFDStreamQueueHole(fdst, fdst->sockPos, length) < 0)
+            goto cleanup;
+    } else if (virFDStreamMakeHole(fdst->fd, length) < 0) {
+        goto cleanup;
+    }
+
+    if (fdst->length)
+        fdst->offset += length;
+    ret = 0;
+
+cleanup:
     virMutexUnlock(&fdst->lock);
     return ret;
 }
@@ -453,6 +1289,9 @@ retry:
 static virStreamDriver virFDStreamDrv = {
     .streamSend = virFDStreamWrite,
     .streamRecv = virFDStreamRead,
+    .streamRecvFlags = virFDStreamReadFlags,
+    .streamSendHole = virFDStreamSendHole,
+    .streamRecvHole = virFDStreamRecvHole,
     .streamFinish = virFDStreamClose,
     .streamAbort = virFDStreamAbort,
     .streamAddCallback = virFDStreamAddCallback,
@@ -571,16 +1410,20 @@ virFDStreamOpenFileInternal(virStreamPtr st,
                             unsigned long long offset,
                             unsigned long long length,
                             int oflags,
-                            int mode)
+                            int mode,
+                            bool sparse)
 {
     int fd = -1;
     int childfd = -1;
+    int filefd = -1;
+    int sock[2] = { -1, -1 };
     struct stat sb;
     virCommandPtr cmd = NULL;
     int errfd = -1;
+    struct virFDStreamData *fdst;
 
-    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o",
-              st, path, oflags, offset, length, mode);
+    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o sparse=%d",
+              st, path, oflags, offset, length, mode, sparse);
 
     if (oflags & O_CREAT)
         fd = open(path, oflags, mode);
@@ -608,14 +1451,47 @@ virFDStreamOpenFileInternal(virStreamPtr st,
         goto error;
     }
 
+    /* Holes can only be found in, or recreated in, a regular
+     * file. Any other kind of file just has no holes to read */
+    if (sparse && !S_ISREG(sb.st_mode)) {
+        if ((oflags & O_ACCMODE) != O_RDONLY) {
+            virReportError(VIR_ERR_OPERATION_UNSUPPORTED,
+                           _("%s: sparse streams can only be written to regular files"),
+                           path);
+            goto error;
+        }
+        sparse = false;
+    }
+
     /* Thanks to the POSIX i/o model, we can't reliably get
      * non-blocking I/O on block devs/regular files. To
      * support those we need to fork a helper process to do
      * the I/O so we just have a fifo. Or use AIO :-(
+     *
+     * A sparse stream has to see the file itself to find and
+     * make holes, so a thread of ours does the I/O instead,
+     * see virFDStreamThread.
      */
-    if ((st->flags & VIR_STREAM_NONBLOCK) &&
-        (!S_ISCHR(sb.st_mode) &&
-         !S_ISFIFO(sb.st_mode))) {
+    if ((st->flags & VIR_STREAM_NONBLOCK) && sparse) {
+        if ((oflags & O_ACCMODE) == O_RDWR) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("%s: Cannot request read and write flags together"),
+                           path);
+            goto error;
+        }
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create socket pair"));
+            goto error;
+        }
+
+        filefd = fd;
+        fd = sock[0];
+        sock[0] = -1;
+    } else if ((st->flags & VIR_STREAM_NONBLOCK) &&
+               (!S_ISCHR(sb.st_mode) &&
+                !S_ISFIFO(sb.st_mode))) {
         int fds[2] = { -1, -1 };
 
         if ((oflags & O_ACCMODE) == O_RDWR) {
@@ -658,11 +1534,33 @@ virFDStreamOpenFileInternal(virStreamPtr st,
     if (virFDStreamOpenInternal(st, fd, cmd, errfd, length) < 0)
         goto error;
 
+    fdst = st->privateData;
+    fdst->sparse = sparse;
+
+    if (filefd != -1) {
+        fdst->threadWrite = (oflags & O_ACCMODE) != O_RDONLY;
+        fdst->threadFd = filefd;
+        fdst->threadSock = sock[1];
+        if (virThreadCreate(&fdst->thread, true,
+                            virFDStreamThread, fdst) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to start stream I/O thread"));
+            /* This closes fd */
+            virFDStreamCloseInt(st, true);
+            fd = -1;
+            goto error;
+        }
+        fdst->threadRunning = true;
+    }
+
     return 0;
 
 error:
     virCommandFree(cmd);
     VIR_FORCE_CLOSE(fd);
+    VIR_FORCE_CLOSE(filefd);
+    VIR_FORCE_CLOSE(sock[0]);
+    VIR_FORCE_CLOSE(sock[1]);
     VIR_FORCE_CLOSE(childfd);
     VIR_FORCE_CLOSE(errfd);
     if (oflags & O_CREAT)
@@ -684,7 +1582,24 @@ int virFDStreamOpenFile(virStreamPtr st,
     }
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0);
+                                       oflags, 0, false);
+}
+
+int virFDStreamOpenFileSparse(virStreamPtr st,
+                              const char *path,
+                              unsigned long long offset,
+                              unsigned long long length,
+                              int oflags)
+{
+    if (oflags & O_CREAT) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Attempt to create %s without specifying mode"),
+                       path);
+        return -1;
+    }
+    return virFDStreamOpenFileInternal(st, path,
+                                       offset, length,
+                                       oflags, 0, true);
 }
 
 int virFDStreamCreateFile(virStreamPtr st,
@@ -696,7 +1611,7 @@ int virFDStreamCreateFile(virStreamPtr st,
 {
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags | O_CREAT, mode);
+                                       oflags | O_CREAT, mode, false);
 }
 
 int virFDStreamSetInternalCloseCb(virStreamPtr st,
@@ -33,6 +33,8 @@ typedef void (*virFDStreamInternalCloseCb)(virStreamPtr st, void *opaque);
 typedef void (*virFDStreamInternalCloseCbFreeOpaque)(void *opaque);
 
 
+int virFDStreamSetIOThreads(size_t nthreads);
+
 int virFDStreamOpen(virStreamPtr st,
                     int fd);
 
@@ -45,6 +47,11 @@ int virFDStreamOpenFile(virStreamPtr st,
                         unsigned long long offset,
                         unsigned long long length,
                         int oflags);
+int virFDStreamOpenFileSparse(virStreamPtr st,
+                              const char *path,
+                              unsigned long long offset,
+                              unsigned long long length,
+                              int oflags);
 int virFDStreamCreateFile(virStreamPtr st,
                           const char *path,
                           unsigned long long offset,
@@ -59,6 +59,8 @@ hypervFreePrivate(hypervPrivate **priv)
         wsmc_release((*priv)->client);
     }
 
+    hypervFreeObject(*priv, (*priv)->computerSystems);
+    virMutexDestroy(&(*priv)->cacheLock);
     hypervFreeParsedUri(&(*priv)->parsedUri);
     VIR_FREE(*priv);
 }
@@ -122,6 +124,13 @@ hypervOpen(virConnectPtr conn, virConnectAuthPtr auth, unsigned int flags)
         goto cleanup;
     }
 
+    if (virMutexInit(&priv->cacheLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(priv);
+        goto cleanup;
+    }
+
     if (hypervParseUri(&priv->parsedUri, conn->uri) < 0) {
         goto cleanup;
     }
@@ -373,12 +382,28 @@ hypervNodeGetInfo(virConnectPtr conn, virNodeInfoPtr info)
 
 
 
+/* Whether the state of @computerSystem matches MSVM_COMPUTERSYSTEM_WQL_ACTIVE,
+ * for filtering the cached list of virtual machines */
+static bool
+hypervMsvmComputerSystemIsListedActive(Msvm_ComputerSystem *computerSystem)
+{
+    switch (computerSystem->data->EnabledState) {
+      case MSVM_COMPUTERSYSTEM_ENABLEDSTATE_UNKNOWN:
+      case MSVM_COMPUTERSYSTEM_ENABLEDSTATE_DISABLED:
+      case MSVM_COMPUTERSYSTEM_ENABLEDSTATE_SUSPENDED:
+        return false;
+
+      default:
+        return true;
+    }
+}
+
+
+
 static int
 hypervListDomains(virConnectPtr conn, int *ids, int maxids)
 {
-    bool success = false;
     hypervPrivate *priv = conn->privateData;
-    virBuffer query = VIR_BUFFER_INITIALIZER;
     Msvm_ComputerSystem *computerSystemList = NULL;
     Msvm_ComputerSystem *computerSystem = NULL;
     int count = 0;
@@ -387,19 +412,17 @@ hypervListDomains(virConnectPtr conn, int *ids, int maxids)
         return 0;
     }
 
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_SELECT);
-    virBufferAddLit(&query, "where ");
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_VIRTUAL);
-    virBufferAddLit(&query, "and ");
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_ACTIVE);
-
-    if (hypervGetMsvmComputerSystemList(priv, &query,
-                                        &computerSystemList) < 0) {
-        goto cleanup;
+    if (hypervGetCachedMsvmComputerSystemList(priv,
+                                              &computerSystemList) < 0) {
+        return -1;
     }
 
     for (computerSystem = computerSystemList; computerSystem != NULL;
          computerSystem = computerSystem->next) {
+        if (!hypervMsvmComputerSystemIsListedActive(computerSystem)) {
+            continue;
+        }
+
         ids[count++] = computerSystem->data->ProcessID;
 
         if (count >= maxids) {
@@ -407,12 +430,9 @@ hypervListDomains(virConnectPtr conn, int *ids, int maxids)
         }
     }
 
-    success = true;
+    hypervReleaseCachedMsvmComputerSystemList(priv);
 
-  cleanup:
-    hypervFreeObject(priv, (hypervObject *)computerSystemList);
-
-    return success ? count : -1;
+    return count;
 }
 
 
@@ -420,35 +440,26 @@ hypervListDomains(virConnectPtr conn, int *ids, int maxids)
 static int
 hypervNumberOfDomains(virConnectPtr conn)
 {
-    bool success = false;
     hypervPrivate *priv = conn->privateData;
-    virBuffer query = VIR_BUFFER_INITIALIZER;
     Msvm_ComputerSystem *computerSystemList = NULL;
     Msvm_ComputerSystem *computerSystem = NULL;
     int count = 0;
 
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_SELECT);
-    virBufferAddLit(&query, "where ");
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_VIRTUAL);
-    virBufferAddLit(&query, "and ");
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_ACTIVE);
-
-    if (hypervGetMsvmComputerSystemList(priv, &query,
-                                        &computerSystemList) < 0) {
-        goto cleanup;
+    if (hypervGetCachedMsvmComputerSystemList(priv,
+                                              &computerSystemList) < 0) {
+        return -1;
     }
 
     for (computerSystem = computerSystemList; computerSystem != NULL;
          computerSystem = computerSystem->next) {
-        ++count;
+        if (hypervMsvmComputerSystemIsListedActive(computerSystem)) {
+            ++count;
+        }
     }
 
-    success = true;
-
-  cleanup:
-    hypervFreeObject(priv, (hypervObject *)computerSystemList);
+    hypervReleaseCachedMsvmComputerSystemList(priv);
 
-    return success ? count : -1;
+    return count;
 }
 
 
@@ -458,16 +469,16 @@ hypervDomainLookupByID(virConnectPtr conn, int id)
 {
     virDomainPtr domain = NULL;
     hypervPrivate *priv = conn->privateData;
-    virBuffer query = VIR_BUFFER_INITIALIZER;
     Msvm_ComputerSystem *computerSystem = NULL;
 
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_SELECT);
-    virBufferAddLit(&query, "where ");
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_VIRTUAL);
-    virBufferAsprintf(&query, "and ProcessID = %d", id);
+    if (hypervGetCachedMsvmComputerSystemList(priv, &computerSystem) < 0) {
+        return NULL;
+    }
 
-    if (hypervGetMsvmComputerSystemList(priv, &query, &computerSystem) < 0) {
-        goto cleanup;
+    for (; computerSystem != NULL; computerSystem = computerSystem->next) {
+        if (computerSystem->data->ProcessID == id) {
+            break;
+        }
     }
 
     if (computerSystem == NULL) {
@@ -478,7 +489,7 @@ hypervDomainLookupByID(virConnectPtr conn, int id)
     hypervMsvmComputerSystemToDomain(conn, computerSystem, &domain);
 
   cleanup:
-    hypervFreeObject(priv, (hypervObject *)computerSystem);
+    hypervReleaseCachedMsvmComputerSystemList(priv);
 
     return domain;
 }
@@ -491,21 +502,19 @@ hypervDomainLookupByUUID(virConnectPtr conn, const unsigned char *uuid)
     virDomainPtr domain = NULL;
     hypervPrivate *priv = conn->privateData;
     char uuid_string[VIR_UUID_STRING_BUFLEN];
-    virBuffer query = VIR_BUFFER_INITIALIZER;
+    Msvm_ComputerSystem *computerSystemList = NULL;
     Msvm_ComputerSystem *computerSystem = NULL;
 
-    virUUIDFormat(uuid, uuid_string);
-
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_SELECT);
-    virBufferAddLit(&query, "where ");
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_VIRTUAL);
-    virBufferAsprintf(&query, "and Name = \"%s\"", uuid_string);
-
-    if (hypervGetMsvmComputerSystemList(priv, &query, &computerSystem) < 0) {
-        goto cleanup;
+    if (hypervGetCachedMsvmComputerSystemList(priv,
+                                              &computerSystemList) < 0) {
+        return NULL;
     }
 
+    computerSystem = hypervFindMsvmComputerSystemByUUID(computerSystemList,
+                                                        uuid);
+
     if (computerSystem == NULL) {
+        virUUIDFormat(uuid, uuid_string);
         virReportError(VIR_ERR_NO_DOMAIN,
                        _("No domain with UUID %s"), uuid_string);
         goto cleanup;
@@ -514,7 +523,7 @@ hypervDomainLookupByUUID(virConnectPtr conn, const unsigned char *uuid)
     hypervMsvmComputerSystemToDomain(conn, computerSystem, &domain);
 
   cleanup:
-    hypervFreeObject(priv, (hypervObject *)computerSystem);
+    hypervReleaseCachedMsvmComputerSystemList(priv);
 
     return domain;
 }
@@ -526,16 +535,17 @@ hypervDomainLookupByName(virConnectPtr conn, const char *name)
 {
     virDomainPtr domain = NULL;
     hypervPrivate *priv = conn->privateData;
-    virBuffer query = VIR_BUFFER_INITIALIZER;
     Msvm_ComputerSystem *computerSystem = NULL;
 
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_SELECT);
-    virBufferAddLit(&query, "where ");
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_VIRTUAL);
-    virBufferAsprintf(&query, "and ElementName = \"%s\"", name);
+    if (hypervGetCachedMsvmComputerSystemList(priv, &computerSystem) < 0) {
+        return NULL;
+    }
 
-    if (hypervGetMsvmComputerSystemList(priv, &query, &computerSystem) < 0) {
-        goto cleanup;
+    /* Like the WQL comparison, which ignores case */
+    for (; computerSystem != NULL; computerSystem = computerSystem->next) {
+        if (STRCASEEQ(computerSystem->data->ElementName, name)) {
+            break;
+        }
     }
 
     if (computerSystem == NULL) {
@@ -547,7 +557,7 @@ hypervDomainLookupByName(virConnectPtr conn, const char *name)
     hypervMsvmComputerSystemToDomain(conn, computerSystem, &domain);
 
   cleanup:
-    hypervFreeObject(priv, (hypervObject *)computerSystem);
+    hypervReleaseCachedMsvmComputerSystemList(priv);
 
     return domain;
 }
@@ -674,7 +684,9 @@ hypervDomainGetInfo(virDomainPtr domain, virDomainInfoPtr info)
     hypervPrivate *priv = domain->conn->privateData;
     char uuid_string[VIR_UUID_STRING_BUFLEN];
     virBuffer query = VIR_BUFFER_INITIALIZER;
+    Msvm_ComputerSystem *computerSystemList = NULL;
     Msvm_ComputerSystem *computerSystem = NULL;
+    bool locked = false;
     Msvm_VirtualSystemSettingData *virtualSystemSettingData = NULL;
     Msvm_ProcessorSettingData *processorSettingData = NULL;
     Msvm_MemorySettingData *memorySettingData = NULL;
@@ -683,10 +695,26 @@ hypervDomainGetInfo(virDomainPtr domain, virDomainInfoPtr info)
 
     virUUIDFormat(domain->uuid, uuid_string);
 
-    /* Get Msvm_ComputerSystem */
-    if (hypervMsvmComputerSystemFromDomain(domain, &computerSystem) < 0) {
+    /* Get Msvm_ComputerSystem, only its state is needed from the cache */
+    if (hypervGetCachedMsvmComputerSystemList(priv,
+                                              &computerSystemList) < 0) {
         goto cleanup;
     }
+    locked = true;
+
+    computerSystem = hypervFindMsvmComputerSystemByUUID(computerSystemList,
+                                                        domain->uuid);
+
+    if (computerSystem == NULL) {
+        virReportError(VIR_ERR_NO_DOMAIN,
+                       _("No domain with UUID %s"), uuid_string);
+        goto cleanup;
+    }
+
+    info->state = hypervMsvmComputerSystemEnabledStateToDomainState(computerSystem);
+
+    hypervReleaseCachedMsvmComputerSystemList(priv);
+    locked = false;
 
     /* Get Msvm_VirtualSystemSettingData */
     virBufferAsprintf(&query,
@@ -706,7 +734,7 @@ hypervDomainGetInfo(virDomainPtr domain, virDomainInfoPtr info)
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Could not lookup %s for domain %s"),
                        "Msvm_VirtualSystemSettingData",
-                       computerSystem->data->ElementName);
+                       domain->name);
         goto cleanup;
     }
 
@@ -727,7 +755,7 @@ hypervDomainGetInfo(virDomainPtr domain, virDomainInfoPtr info)
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Could not lookup %s for domain %s"),
                        "Msvm_ProcessorSettingData",
-                       computerSystem->data->ElementName);
+                       domain->name);
         goto cleanup;
     }
 
@@ -749,12 +777,11 @@ hypervDomainGetInfo(virDomainPtr domain, virDomainInfoPtr info)
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Could not lookup %s for domain %s"),
                        "Msvm_MemorySettingData",
-                       computerSystem->data->ElementName);
+                       domain->name);
         goto cleanup;
     }
 
     /* Fill struct */
-    info->state = hypervMsvmComputerSystemEnabledStateToDomainState(computerSystem);
     info->maxMem = memorySettingData->data->Limit * 1024; /* megabyte to kilobyte */
     info->memory = memorySettingData->data->VirtualQuantity * 1024; /* megabyte to kilobyte */
     info->nrVirtCpu = processorSettingData->data->VirtualQuantity;
@@ -763,7 +790,10 @@ hypervDomainGetInfo(virDomainPtr domain, virDomainInfoPtr info)
     result = 0;
 
   cleanup:
-    hypervFreeObject(priv, (hypervObject *)computerSystem);
+    if (locked) {
+        hypervReleaseCachedMsvmComputerSystemList(priv);
+    }
+
     hypervFreeObject(priv, (hypervObject *)virtualSystemSettingData);
     hypervFreeObject(priv, (hypervObject *)processorSettingData);
     hypervFreeObject(priv, (hypervObject *)memorySettingData);
@@ -779,11 +809,24 @@ hypervDomainGetState(virDomainPtr domain, int *state, int *reason,
 {
     int result = -1;
     hypervPrivate *priv = domain->conn->privateData;
+    char uuid_string[VIR_UUID_STRING_BUFLEN];
+    Msvm_ComputerSystem *computerSystemList = NULL;
     Msvm_ComputerSystem *computerSystem = NULL;
 
     virCheckFlags(0, -1);
 
-    if (hypervMsvmComputerSystemFromDomain(domain, &computerSystem) < 0) {
+    if (hypervGetCachedMsvmComputerSystemList(priv,
+                                              &computerSystemList) < 0) {
+        return -1;
+    }
+
+    computerSystem = hypervFindMsvmComputerSystemByUUID(computerSystemList,
+                                                        domain->uuid);
+
+    if (computerSystem == NULL) {
+        virUUIDFormat(domain->uuid, uuid_string);
+        virReportError(VIR_ERR_NO_DOMAIN,
+                       _("No domain with UUID %s"), uuid_string);
         goto cleanup;
     }
 
@@ -796,7 +839,7 @@ hypervDomainGetState(virDomainPtr domain, int *state, int *reason,
     result = 0;
 
   cleanup:
-    hypervFreeObject(priv, (hypervObject *)computerSystem);
+    hypervReleaseCachedMsvmComputerSystemList(priv);
 
     return result;
 }
@@ -961,7 +1004,6 @@ hypervListDefinedDomains(virConnectPtr conn, char **const names, int maxnames)
 {
     bool success = false;
     hypervPrivate *priv = conn->privateData;
-    virBuffer query = VIR_BUFFER_INITIALIZER;
     Msvm_ComputerSystem *computerSystemList = NULL;
     Msvm_ComputerSystem *computerSystem = NULL;
     int count = 0;
@@ -971,19 +1013,17 @@ hypervListDefinedDomains(virConnectPtr conn, char **const names, int maxnames)
         return 0;
     }
 
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_SELECT);
-    virBufferAddLit(&query, "where ");
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_VIRTUAL);
-    virBufferAddLit(&query, "and ");
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_INACTIVE);
-
-    if (hypervGetMsvmComputerSystemList(priv, &query,
-                                        &computerSystemList) < 0) {
-        goto cleanup;
+    if (hypervGetCachedMsvmComputerSystemList(priv,
+                                              &computerSystemList) < 0) {
+        return -1;
     }
 
     for (computerSystem = computerSystemList; computerSystem != NULL;
          computerSystem = computerSystem->next) {
+        if (hypervMsvmComputerSystemIsListedActive(computerSystem)) {
+            continue;
+        }
+
         names[count] = strdup(computerSystem->data->ElementName);
 
         if (names[count] == NULL) {
@@ -1009,7 +1049,7 @@ hypervListDefinedDomains(virConnectPtr conn, char **const names, int maxnames)
         count = -1;
     }
 
-    hypervFreeObject(priv, (hypervObject *)computerSystemList);
+    hypervReleaseCachedMsvmComputerSystemList(priv);
 
     return count;
 }
@@ -1019,35 +1059,26 @@ hypervListDefinedDomains(virConnectPtr conn, char **const names, int maxnames)
 static int
 hypervNumberOfDefinedDomains(virConnectPtr conn)
 {
-    bool success = false;
     hypervPrivate *priv = conn->privateData;
-    virBuffer query = VIR_BUFFER_INITIALIZER;
     Msvm_ComputerSystem *computerSystemList = NULL;
     Msvm_ComputerSystem *computerSystem = NULL;
     int count = 0;
 
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_SELECT);
-    virBufferAddLit(&query, "where ");
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_VIRTUAL);
-    virBufferAddLit(&query, "and ");
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_INACTIVE);
-
-    if (hypervGetMsvmComputerSystemList(priv, &query,
-                                        &computerSystemList) < 0) {
-        goto cleanup;
+    if (hypervGetCachedMsvmComputerSystemList(priv,
+                                              &computerSystemList) < 0) {
+        return -1;
     }
 
     for (computerSystem = computerSystemList; computerSystem != NULL;
          computerSystem = computerSystem->next) {
-        ++count;
+        if (!hypervMsvmComputerSystemIsListedActive(computerSystem)) {
+            ++count;
+        }
     }
 
-    success = true;
-
-  cleanup:
-    hypervFreeObject(priv, (hypervObject *)computerSystemList);
+    hypervReleaseCachedMsvmComputerSystemList(priv);
 
-    return success ? count : -1;
+    return count;
 }
 
 
@@ -1140,16 +1171,29 @@ hypervDomainIsActive(virDomainPtr domain)
 {
     int result = -1;
     hypervPrivate *priv = domain->conn->privateData;
+    char uuid_string[VIR_UUID_STRING_BUFLEN];
+    Msvm_ComputerSystem *computerSystemList = NULL;
     Msvm_ComputerSystem *computerSystem = NULL;
 
-    if (hypervMsvmComputerSystemFromDomain(domain, &computerSystem) < 0) {
+    if (hypervGetCachedMsvmComputerSystemList(priv,
+                                              &computerSystemList) < 0) {
+        return -1;
+    }
+
+    computerSystem = hypervFindMsvmComputerSystemByUUID(computerSystemList,
+                                                        domain->uuid);
+
+    if (computerSystem == NULL) {
+        virUUIDFormat(domain->uuid, uuid_string);
+        virReportError(VIR_ERR_NO_DOMAIN,
+                       _("No domain with UUID %s"), uuid_string);
         goto cleanup;
     }
 
     result = hypervIsMsvmComputerSystemActive(computerSystem, NULL) ? 1 : 0;
 
   cleanup:
-    hypervFreeObject(priv, (hypervObject *)computerSystem);
+    hypervReleaseCachedMsvmComputerSystemList(priv);
 
     return result;
 }
@@ -1266,9 +1310,9 @@ hypervListAllDomains(virConnectPtr conn,
                      unsigned int flags)
 {
     hypervPrivate *priv = conn->privateData;
-    virBuffer query = VIR_BUFFER_INITIALIZER;
     Msvm_ComputerSystem *computerSystemList = NULL;
     Msvm_ComputerSystem *computerSystem = NULL;
+    bool locked = false;
     size_t ndoms;
     virDomainPtr domain;
     virDomainPtr *doms = NULL;
@@ -1297,27 +1341,10 @@ hypervListAllDomains(virConnectPtr conn,
         goto cleanup;
     }
 
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_SELECT);
-    virBufferAddLit(&query, "where ");
-    virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_VIRTUAL);
-
-    /* construct query with filter depending on flags */
-    if (!(MATCH(VIR_CONNECT_LIST_DOMAINS_ACTIVE) &&
-          MATCH(VIR_CONNECT_LIST_DOMAINS_INACTIVE))) {
-        if (MATCH(VIR_CONNECT_LIST_DOMAINS_ACTIVE)) {
-            virBufferAddLit(&query, "and ");
-            virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_ACTIVE);
-        }
-
-        if (MATCH(VIR_CONNECT_LIST_DOMAINS_INACTIVE)) {
-            virBufferAddLit(&query, "and ");
-            virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_INACTIVE);
-        }
-    }
-
-    if (hypervGetMsvmComputerSystemList(priv, &query,
-                                        &computerSystemList) < 0)
+    if (hypervGetCachedMsvmComputerSystemList(priv,
+                                              &computerSystemList) < 0)
         goto cleanup;
+    locked = true;
 
     if (domains) {
         if (VIR_ALLOC_N(doms, 1) < 0)
@@ -1328,6 +1355,16 @@ hypervListAllDomains(virConnectPtr conn,
     for (computerSystem = computerSystemList; computerSystem != NULL;
          computerSystem = computerSystem->next) {
 
+        /* filter by activity */
+        if (!(MATCH(VIR_CONNECT_LIST_DOMAINS_ACTIVE) &&
+              MATCH(VIR_CONNECT_LIST_DOMAINS_INACTIVE))) {
+            bool active = hypervMsvmComputerSystemIsListedActive(computerSystem);
+
+            if ((MATCH(VIR_CONNECT_LIST_DOMAINS_ACTIVE) && !active) ||
+                (MATCH(VIR_CONNECT_LIST_DOMAINS_INACTIVE) && active))
+                continue;
+        }
+
         /* filter by domain state */
         if (MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE)) {
             int st = hypervMsvmComputerSystemEnabledStateToDomainState(computerSystem);
@@ -1385,7 +1422,8 @@ cleanup:
         VIR_FREE(doms);
     }
 
-    hypervFreeObject(priv, (hypervObject *)computerSystemList);
+    if (locked)
+        hypervReleaseCachedMsvmComputerSystemList(priv);
 
     return ret;
 
@@ -1398,9 +1436,12 @@ no_memory:
 
 
 
+static const char *hypervURISchemes[] = { "hyperv", NULL };
+
 static virDriver hypervDriver = {
     .no = VIR_DRV_HYPERV,
     .name = "Hyper-V",
+    .uriSchemes = hypervURISchemes,
     .open = hypervOpen, /* 0.9.5 */
     .close = hypervClose, /* 0.9.5 */
     .type = hypervGetType, /* 0.9.5 */
@@ -26,6 +26,7 @@
 
 # include "internal.h"
 # include "virterror_internal.h"
+# include "threads.h"
 # include "hyperv_util.h"
 # include "openwsman.h"
 
@@ -34,6 +35,13 @@ typedef struct _hypervPrivate hypervPrivate;
 struct _hypervPrivate {
     hypervParsedUri *parsedUri;
     WsManClient *client;
+
+    /* All Msvm_ComputerSystem of virtual machines, shared by the
+     * lookup and list calls for a short while */
+    virMutex cacheLock;
+    bool computerSystemsValid;
+    unsigned long long computerSystemsTime;
+    struct _hypervObject *computerSystems;
 };
 
 #endif /* __HYPERV_PRIVATE_H__ */
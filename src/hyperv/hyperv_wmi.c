@@ -32,6 +32,7 @@
 #include "util.h"
 #include "uuid.h"
 #include "buf.h"
+#include "virtime.h"
 #include "hyperv_private.h"
 #include "hyperv_wmi.h"
 
@@ -45,6 +46,9 @@
 
 #define VIR_FROM_THIS VIR_FROM_HYPERV
 
+/* How long the list of all virtual machines is reused, in milliseconds */
+#define HYPERV_CACHE_TIME 2000
+
 
 
 int
@@ -524,6 +528,9 @@ hypervInvokeMsvmComputerSystemRequestStateChange(virDomainPtr domain,
     result = 0;
 
   cleanup:
+    /* Even a failed request may have changed the state */
+    hypervInvalidateMsvmComputerSystemCache(priv);
+
     if (options != NULL) {
         wsmc_options_destroy(options);
     }
@@ -684,5 +691,93 @@ hypervMsvmComputerSystemFromDomain(virDomainPtr domain,
 }
 
 
+/*
+ * Get the Msvm_ComputerSystem of all virtual machines with a single
+ * enumeration, or from the cache of @priv if that was done less than
+ * HYPERV_CACHE_TIME ago, so that listing and looking up many domains
+ * does not query the server for each of them. On success the cache is
+ * locked, and @list is valid until
+ * hypervReleaseCachedMsvmComputerSystemList is called.
+ */
+int
+hypervGetCachedMsvmComputerSystemList(hypervPrivate *priv,
+                                      Msvm_ComputerSystem **list)
+{
+    virBuffer query = VIR_BUFFER_INITIALIZER;
+    Msvm_ComputerSystem *computerSystems = NULL;
+    unsigned long long now;
+
+    virMutexLock(&priv->cacheLock);
+
+    if (virTimeMillisNow(&now) < 0) {
+        goto error;
+    }
+
+    if (!priv->computerSystemsValid ||
+        now - priv->computerSystemsTime > HYPERV_CACHE_TIME) {
+        virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_SELECT);
+        virBufferAddLit(&query, "where ");
+        virBufferAddLit(&query, MSVM_COMPUTERSYSTEM_WQL_VIRTUAL);
+
+        if (hypervGetMsvmComputerSystemList(priv, &query,
+                                            &computerSystems) < 0) {
+            goto error;
+        }
+
+        hypervFreeObject(priv, priv->computerSystems);
+        priv->computerSystems = (hypervObject *)computerSystems;
+        priv->computerSystemsTime = now;
+        priv->computerSystemsValid = true;
+    }
+
+    *list = (Msvm_ComputerSystem *)priv->computerSystems;
+
+    return 0;
+
+  error:
+    virMutexUnlock(&priv->cacheLock);
+
+    return -1;
+}
+
+void
+hypervReleaseCachedMsvmComputerSystemList(hypervPrivate *priv)
+{
+    virMutexUnlock(&priv->cacheLock);
+}
+
+/*
+ * Drop the cached list of virtual machines after changing the state of
+ * one of them.
+ */
+void
+hypervInvalidateMsvmComputerSystemCache(hypervPrivate *priv)
+{
+    virMutexLock(&priv->cacheLock);
+    hypervFreeObject(priv, priv->computerSystems);
+    priv->computerSystems = NULL;
+    priv->computerSystemsValid = false;
+    virMutexUnlock(&priv->cacheLock);
+}
+
+Msvm_ComputerSystem *
+hypervFindMsvmComputerSystemByUUID(Msvm_ComputerSystem *list,
+                                   const unsigned char *uuid)
+{
+    char uuid_string[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(uuid, uuid_string);
+
+    /* Like the WQL comparisons, which ignore case */
+    for (; list != NULL; list = list->next) {
+        if (STRCASEEQ(list->data->Name, uuid_string)) {
+            return list;
+        }
+    }
+
+    return NULL;
+}
+
+
 
 #include "hyperv_wmi.generated.c"
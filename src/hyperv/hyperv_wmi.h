@@ -114,6 +114,16 @@ int hypervMsvmComputerSystemToDomain(virConnectPtr conn,
 int hypervMsvmComputerSystemFromDomain(virDomainPtr domain,
                                        Msvm_ComputerSystem **computerSystem);
 
+int hypervGetCachedMsvmComputerSystemList(hypervPrivate *priv,
+                                          Msvm_ComputerSystem **list);
+
+void hypervReleaseCachedMsvmComputerSystemList(hypervPrivate *priv);
+
+void hypervInvalidateMsvmComputerSystemCache(hypervPrivate *priv);
+
+Msvm_ComputerSystem *hypervFindMsvmComputerSystemByUUID
+      (Msvm_ComputerSystem *list, const unsigned char *uuid);
+
 
 
 # include "hyperv_wmi.generated.h"
@@ -24,6 +24,9 @@
 #include <config.h>
 
 #include <netcf.h>
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
 
 #include "virterror_internal.h"
 #include "datatypes.h"
@@ -31,14 +34,73 @@
 #include "interface_conf.h"
 #include "memory.h"
 #include "logging.h"
+#include "event.h"
+#include "virfile.h"
+#include "virhash.h"
+#include "virnetdev.h"
+#include "virobject.h"
 
 #define VIR_FROM_THIS VIR_FROM_INTERFACE
 
+/*
+ * Asking netcf anything makes it reload the interface configuration
+ * files through augeas, which on hosts with many VLANs and bonds takes
+ * long enough to matter for clients polling the interface list. The
+ * answers which only depend on those files or on the set of links are
+ * kept here, for as long as inotify and the link event service say
+ * nothing changed. Anything involving addresses is not cached, as
+ * nothing tells us about address changes.
+ */
+typedef struct _netcfCacheIface netcfCacheIface;
+struct _netcfCacheIface {
+    char *name;
+    char *mac;
+};
+
+typedef struct _netcfCache netcfCache;
+typedef netcfCache *netcfCachePtr;
+struct _netcfCache {
+    virObject object;
+    virMutex lock;
+
+    unsigned long long serial;  /* bumped whenever something changes */
+    bool haveList;
+    netcfCacheIface *ifaces;
+    size_t nifaces;
+    virHashTablePtr inactiveXML; /* name => char *, ncf_if_xml_desc */
+
+    int inotifyFD;
+    int inotifyWatch;
+    int linkWatch;
+};
+
+/* Where the netcf backends of the various distros keep their files */
+static const char *const netcfConfigDirs[] = {
+    "/etc/sysconfig/network-scripts",
+    "/etc/sysconfig/network",
+    "/etc/network",
+};
+
+static virClassPtr netcfCacheClass;
+static void netcfCacheDispose(void *obj);
+
+static int netcfCacheOnceInit(void)
+{
+    if (!(netcfCacheClass = virClassNew("netcfCache",
+                                        sizeof(netcfCache),
+                                        netcfCacheDispose)))
+        return -1;
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(netcfCache)
+
 /* Main driver state */
 struct interface_driver
 {
     virMutex lock;
     struct netcf *netcf;
+    netcfCachePtr cache;        /* NULL if changes can't be followed */
 };
 
 
@@ -52,6 +114,173 @@ static void interfaceDriverUnlock(struct interface_driver *driver)
     virMutexUnlock(&driver->lock);
 }
 
+static void netcfCacheClearList(netcfCachePtr cache)
+{
+    size_t i;
+
+    for (i = 0; i < cache->nifaces; i++) {
+        VIR_FREE(cache->ifaces[i].name);
+        VIR_FREE(cache->ifaces[i].mac);
+    }
+    VIR_FREE(cache->ifaces);
+    cache->nifaces = 0;
+    cache->haveList = false;
+}
+
+static void netcfCacheInvalidate(netcfCachePtr cache, bool config)
+{
+    if (!cache)
+        return;
+
+    virMutexLock(&cache->lock);
+    cache->serial++;
+    netcfCacheClearList(cache);
+    if (config)
+        virHashRemoveAll(cache->inactiveXML);
+    virMutexUnlock(&cache->lock);
+}
+
+static void netcfCacheDispose(void *obj)
+{
+    netcfCachePtr cache = obj;
+
+    netcfCacheClearList(cache);
+    virHashFree(cache->inactiveXML);
+    VIR_FORCE_CLOSE(cache->inotifyFD);
+    virMutexDestroy(&cache->lock);
+}
+
+static void netcfCacheHashFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    VIR_FREE(payload);
+}
+
+#if HAVE_SYS_INOTIFY_H
+static void netcfCacheInotifyEvent(int watch ATTRIBUTE_UNUSED,
+                                   int fd,
+                                   int events ATTRIBUTE_UNUSED,
+                                   void *opaque)
+{
+    netcfCachePtr cache = opaque;
+    char buf[4096];
+    bool changed = false;
+    ssize_t got;
+
+    /* Which file changed does not matter, any of them can affect
+     * any interface */
+    while ((got = read(fd, buf, sizeof(buf))) != 0) {
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        changed = true;
+    }
+
+    if (changed) {
+        VIR_DEBUG("interface configuration changed, dropping cache");
+        netcfCacheInvalidate(cache, true);
+    }
+}
+#endif /* HAVE_SYS_INOTIFY_H */
+
+static void netcfCacheLinkEvent(const char *ifname ATTRIBUTE_UNUSED,
+                                int ifindex ATTRIBUTE_UNUSED,
+                                bool exists ATTRIBUTE_UNUSED,
+                                bool online ATTRIBUTE_UNUSED,
+                                void *opaque)
+{
+    /* MAC addresses missing from the configuration are read from
+     * the link, so the list goes, the configuration stays */
+    netcfCacheInvalidate(opaque, false);
+}
+
+static void netcfCacheFree(netcfCachePtr cache)
+{
+    if (!cache)
+        return;
+
+    if (cache->linkWatch >= 0)
+        virNetDevLinkEventRemoveCallback(cache->linkWatch);
+    /* The handle holds its own reference */
+    if (cache->inotifyWatch >= 0)
+        virEventRemoveHandle(cache->inotifyWatch);
+    virObjectUnref(cache);
+}
+
+/*
+ * Returns a cache which follows changes to the interface configuration
+ * and links, or NULL if it can't, in which case netcf is asked every
+ * time. Not being able to cache is not an error.
+ */
+static netcfCachePtr netcfCacheNew(void)
+{
+    netcfCachePtr cache;
+    size_t nwatches = 0;
+#if HAVE_SYS_INOTIFY_H
+    size_t i;
+#endif
+
+    if (netcfCacheInitialize() < 0)
+        return NULL;
+
+    if (!(cache = virObjectNew(netcfCacheClass)))
+        return NULL;
+
+    if (virMutexInit(&cache->lock) < 0) {
+        VIR_FREE(cache);
+        return NULL;
+    }
+
+    cache->inotifyFD = -1;
+    cache->inotifyWatch = -1;
+    cache->linkWatch = -1;
+
+    if (!(cache->inactiveXML = virHashCreate(32, netcfCacheHashFree)))
+        goto error;
+
+#if HAVE_SYS_INOTIFY_H
+    if ((cache->inotifyFD = inotify_init()) < 0 ||
+        virSetNonBlock(cache->inotifyFD) < 0 ||
+        virSetCloseExec(cache->inotifyFD) < 0)
+        goto error;
+
+    for (i = 0; i < ARRAY_CARDINALITY(netcfConfigDirs); i++) {
+        if (!virFileIsDir(netcfConfigDirs[i]))
+            continue;
+        if (inotify_add_watch(cache->inotifyFD, netcfConfigDirs[i],
+                              IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                              IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB) < 0)
+            goto error;
+        nwatches++;
+    }
+#endif /* HAVE_SYS_INOTIFY_H */
+    if (!nwatches)
+        goto error;
+
+    /* Only available inside libvirtd */
+    if ((cache->linkWatch =
+         virNetDevLinkEventAddCallback(netcfCacheLinkEvent, cache)) < 0)
+        goto error;
+
+#if HAVE_SYS_INOTIFY_H
+    if ((cache->inotifyWatch =
+         virEventAddHandle(cache->inotifyFD, VIR_EVENT_HANDLE_READABLE,
+                           netcfCacheInotifyEvent, cache,
+                           virObjectFreeCallback)) < 0)
+        goto error;
+    virObjectRef(cache);
+#endif /* HAVE_SYS_INOTIFY_H */
+
+    return cache;
+
+error:
+    VIR_DEBUG("Cannot follow interface changes, not caching netcf results");
+    virResetLastError();
+    netcfCacheFree(cache);
+    return NULL;
+}
+
 static int netcf_to_vir_err(int netcf_errcode)
 {
     switch (netcf_errcode)
@@ -116,6 +345,187 @@ static struct netcf_if *interfaceDriverGetNetcfIF(struct netcf *ncf, virInterfac
     return iface;
 }
 
+static void interfaceIfaceListFree(netcfCacheIface *ifaces, size_t nifaces)
+{
+    size_t i;
+
+    for (i = 0; i < nifaces; i++) {
+        VIR_FREE(ifaces[i].name);
+        VIR_FREE(ifaces[i].mac);
+    }
+    VIR_FREE(ifaces);
+}
+
+static int interfaceIfaceListCopy(netcfCacheIface *src, size_t nsrc,
+                                  netcfCacheIface **dst, size_t *ndst)
+{
+    size_t i;
+
+    *dst = NULL;
+    *ndst = 0;
+    if (nsrc == 0)
+        return 0;
+
+    if (VIR_ALLOC_N(*dst, nsrc) < 0)
+        goto no_memory;
+    *ndst = nsrc;
+
+    for (i = 0; i < nsrc; i++) {
+        if (!((*dst)[i].name = strdup(src[i].name)) ||
+            (src[i].mac && !((*dst)[i].mac = strdup(src[i].mac))))
+            goto no_memory;
+    }
+    return 0;
+
+no_memory:
+    virReportOOMError();
+    interfaceIfaceListFree(*dst, *ndst);
+    *dst = NULL;
+    *ndst = 0;
+    return -1;
+}
+
+/*
+ * Get the names and MAC addresses of all defined interfaces, from
+ * the cache if possible. Caller must hold the driver lock and free
+ * @ifaces with interfaceIfaceListFree().
+ */
+static int interfaceGetIfaceList(struct interface_driver *driver,
+                                 netcfCacheIface **ifaces,
+                                 size_t *nifaces)
+{
+    netcfCachePtr cache = driver->cache;
+    unsigned long long serial = 0;
+    char **names = NULL;
+    netcfCacheIface *list = NULL;
+    size_t nlist = 0;
+    struct netcf_if *iface;
+    int count = 0;
+    int ret = -1;
+    int i;
+
+    *ifaces = NULL;
+    *nifaces = 0;
+
+    if (cache) {
+        virMutexLock(&cache->lock);
+        if (cache->haveList) {
+            ret = interfaceIfaceListCopy(cache->ifaces, cache->nifaces,
+                                         ifaces, nifaces);
+            virMutexUnlock(&cache->lock);
+            return ret;
+        }
+        serial = cache->serial;
+        virMutexUnlock(&cache->lock);
+    }
+
+    /* List all interfaces, in case of we might support new filter flags
+     * except active|inactive in future.
+     */
+    count = ncf_num_of_interfaces(driver->netcf, NETCF_IFACE_ACTIVE |
+                                  NETCF_IFACE_INACTIVE);
+    if (count < 0) {
+        const char *errmsg, *details;
+        int errcode = ncf_error(driver->netcf, &errmsg, &details);
+        virReportError(netcf_to_vir_err(errcode),
+                       _("failed to get number of host interfaces: %s%s%s"),
+                       errmsg, details ? " - " : "",
+                       details ? details : "");
+        goto cleanup;
+    }
+
+    if (count > 0 &&
+        (VIR_ALLOC_N(names, count) < 0 ||
+         VIR_ALLOC_N(list, count) < 0)) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (count > 0 &&
+        (count = ncf_list_interfaces(driver->netcf, count, names,
+                                     NETCF_IFACE_ACTIVE |
+                                     NETCF_IFACE_INACTIVE)) < 0) {
+        const char *errmsg, *details;
+        int errcode = ncf_error(driver->netcf, &errmsg, &details);
+        virReportError(netcf_to_vir_err(errcode),
+                       _("failed to list host interfaces: %s%s%s"),
+                       errmsg, details ? " - " : "",
+                       details ? details : "");
+        goto cleanup;
+    }
+
+    for (i = 0; i < count; i++) {
+        const char *mac;
+
+        iface = ncf_lookup_by_name(driver->netcf, names[i]);
+        if (!iface) {
+            const char *errmsg, *details;
+            int errcode = ncf_error(driver->netcf, &errmsg, &details);
+            if (errcode != NETCF_NOERROR) {
+                virReportError(netcf_to_vir_err(errcode),
+                               _("couldn't find interface named '%s': %s%s%s"),
+                               names[i], errmsg,
+                               details ? " - " : "", details ? details : "");
+                goto cleanup;
+            } else {
+                /* Ignore the NETCF_NOERROR, as the interface is very likely
+                 * deleted by other management apps (e.g. virt-manager).
+                 */
+                VIR_WARN("couldn't find interface named '%s', might be "
+                         "deleted by other process", names[i]);
+                continue;
+            }
+        }
+
+        list[nlist].name = names[i];
+        names[i] = NULL;
+        nlist++;
+        mac = ncf_if_mac_string(iface);
+        if (mac && !(list[nlist - 1].mac = strdup(mac))) {
+            ncf_if_free(iface);
+            virReportOOMError();
+            goto cleanup;
+        }
+        ncf_if_free(iface);
+    }
+
+    if (cache) {
+        virMutexLock(&cache->lock);
+        /* Only keep the list if nothing changed while building it */
+        if (!cache->haveList && cache->serial == serial &&
+            interfaceIfaceListCopy(list, nlist,
+                                   &cache->ifaces, &cache->nifaces) == 0)
+            cache->haveList = true;
+        virResetLastError();
+        virMutexUnlock(&cache->lock);
+    }
+
+    *ifaces = list;
+    *nifaces = nlist;
+    list = NULL;
+    nlist = 0;
+    ret = 0;
+
+cleanup:
+    if (names)
+        for (i = 0; i < count; i++)
+            VIR_FREE(names[i]);
+    VIR_FREE(names);
+    interfaceIfaceListFree(list, nlist);
+    return ret;
+}
+
+/* Whether @name is up, the same way netcf decides it */
+static int interfaceIfaceIsActive(const char *name, bool *active)
+{
+    int rc;
+
+    *active = false;
+    if ((rc = virNetDevExists(name)) <= 0)
+        return rc;
+    return virNetDevIsOnline(name, active);
+}
+
 static virDrvOpenStatus interfaceOpenInterface(virConnectPtr conn,
                                                virConnectAuthPtr auth ATTRIBUTE_UNUSED,
                                                unsigned int flags)
@@ -144,6 +554,8 @@ static virDrvOpenStatus interfaceOpenInterface(virConnectPtr conn,
         goto netcf_error;
     }
 
+    driverState->cache = netcfCacheNew();
+
     conn->interfacePrivateData = driverState;
     return VIR_DRV_OPEN_SUCCESS;
 
@@ -166,6 +578,7 @@ static int interfaceCloseInterface(virConnectPtr conn)
     {
         struct interface_driver *driver = conn->interfacePrivateData;
 
+        netcfCacheFree(driver->cache);
         /* close netcf instance */
         ncf_close(driver->netcf);
         /* destroy lock */
@@ -266,115 +679,53 @@ interfaceListAllInterfaces(virConnectPtr conn,
                            unsigned int flags)
 {
     struct interface_driver *driver = conn->interfacePrivateData;
-    int count;
-    int i;
-    struct netcf_if *iface = NULL;
+    netcfCacheIface *list = NULL;
+    size_t nlist = 0;
+    size_t i;
     virInterfacePtr *tmp_iface_objs = NULL;
     virInterfacePtr iface_obj = NULL;
-    unsigned int status;
+    bool active;
     int niface_objs = 0;
     int ret = -1;
-    char **names = NULL;
 
     virCheckFlags(VIR_CONNECT_LIST_INTERFACES_ACTIVE |
                   VIR_CONNECT_LIST_INTERFACES_INACTIVE, -1);
 
     interfaceDriverLock(driver);
 
-    /* List all interfaces, in case of we might support new filter flags
-     * except active|inactive in future.
-     */
-    count = ncf_num_of_interfaces(driver->netcf, NETCF_IFACE_ACTIVE |
-                                  NETCF_IFACE_INACTIVE);
-    if (count < 0) {
-        const char *errmsg, *details;
-        int errcode = ncf_error(driver->netcf, &errmsg, &details);
-        virReportError(netcf_to_vir_err(errcode),
-                       _("failed to get number of host interfaces: %s%s%s"),
-                       errmsg, details ? " - " : "",
-                       details ? details : "");
-        ret = -1;
+    if (interfaceGetIfaceList(driver, &list, &nlist) < 0)
         goto cleanup;
-    }
 
-    if (count == 0) {
+    if (nlist == 0) {
         ret = 0;
         goto cleanup;
     }
 
-    if (VIR_ALLOC_N(names, count) < 0) {
-        virReportOOMError();
-        ret = -1;
-        goto cleanup;
-    }
-
-    if ((count = ncf_list_interfaces(driver->netcf, count, names,
-                                     NETCF_IFACE_ACTIVE |
-                                     NETCF_IFACE_INACTIVE)) < 0) {
-        const char *errmsg, *details;
-        int errcode = ncf_error(driver->netcf, &errmsg, &details);
-        virReportError(netcf_to_vir_err(errcode),
-                       _("failed to list host interfaces: %s%s%s"),
-                       errmsg, details ? " - " : "",
-                       details ? details : "");
-        goto cleanup;
-    }
-
     if (ifaces) {
-        if (VIR_ALLOC_N(tmp_iface_objs, count + 1) < 0) {
+        if (VIR_ALLOC_N(tmp_iface_objs, nlist + 1) < 0) {
             virReportOOMError();
             goto cleanup;
         }
     }
 
-    for (i = 0; i < count; i++) {
-        iface = ncf_lookup_by_name(driver->netcf, names[i]);
-        if (!iface) {
-            const char *errmsg, *details;
-            int errcode = ncf_error(driver->netcf, &errmsg, &details);
-            if (errcode != NETCF_NOERROR) {
-                virReportError(netcf_to_vir_err(errcode),
-                               _("couldn't find interface named '%s': %s%s%s"),
-                               names[i], errmsg,
-                               details ? " - " : "", details ? details : "");
-                goto cleanup;
-            } else {
-                /* Ignore the NETCF_NOERROR, as the interface is very likely
-                 * deleted by other management apps (e.g. virt-manager).
-                 */
-                VIR_WARN("couldn't find interface named '%s', might be "
-                         "deleted by other process", names[i]);
-                continue;
-            }
-        }
-
-        if (ncf_if_status(iface, &status) < 0) {
-            const char *errmsg, *details;
-            int errcode = ncf_error(driver->netcf, &errmsg, &details);
-            virReportError(netcf_to_vir_err(errcode),
-                           _("failed to get status of interface %s: %s%s%s"),
-                           names[i], errmsg, details ? " - " : "",
-                           details ? details : "");
+    for (i = 0; i < nlist; i++) {
+        if (interfaceIfaceIsActive(list[i].name, &active) < 0)
             goto cleanup;
-        }
 
         /* XXX: Filter the result, need to be splitted once new filter flags
          * except active|inactive are supported.
          */
-        if (((status & NETCF_IFACE_ACTIVE) &&
+        if ((active &&
              (flags & VIR_CONNECT_LIST_INTERFACES_ACTIVE)) ||
-            ((status & NETCF_IFACE_INACTIVE) &&
+            (!active &&
              (flags & VIR_CONNECT_LIST_INTERFACES_INACTIVE))) {
             if (ifaces) {
-                iface_obj = virGetInterface(conn, ncf_if_name(iface),
-                                            ncf_if_mac_string(iface));
+                iface_obj = virGetInterface(conn, list[i].name,
+                                            list[i].mac);
                 tmp_iface_objs[niface_objs] = iface_obj;
             }
             niface_objs++;
         }
-
-        ncf_if_free(iface);
-        iface = NULL;
     }
 
     if (tmp_iface_objs) {
@@ -387,12 +738,7 @@ interfaceListAllInterfaces(virConnectPtr conn,
     ret = niface_objs;
 
 cleanup:
-    ncf_if_free(iface);
-
-    if (names)
-        for (i = 0; i < count; i++)
-            VIR_FREE(names[i]);
-    VIR_FREE(names);
+    interfaceIfaceListFree(list, nlist);
 
     if (tmp_iface_objs) {
         for (i = 0; i < niface_objs; i++) {
@@ -410,10 +756,26 @@ static virInterfacePtr interfaceLookupByName(virConnectPtr conn,
                                              const char *name)
 {
     struct interface_driver *driver = conn->interfacePrivateData;
-    struct netcf_if *iface;
+    struct netcf_if *iface = NULL;
     virInterfacePtr ret = NULL;
+    size_t i;
 
     interfaceDriverLock(driver);
+
+    if (driver->cache) {
+        virMutexLock(&driver->cache->lock);
+        for (i = 0; driver->cache->haveList &&
+                    i < driver->cache->nifaces; i++) {
+            if (STREQ(driver->cache->ifaces[i].name, name)) {
+                ret = virGetInterface(conn, name,
+                                      driver->cache->ifaces[i].mac);
+                virMutexUnlock(&driver->cache->lock);
+                goto cleanup;
+            }
+        }
+        virMutexUnlock(&driver->cache->lock);
+    }
+
     iface = ncf_lookup_by_name(driver->netcf, name);
     if (!iface) {
         const char *errmsg, *details;
@@ -486,11 +848,33 @@ static char *interfaceGetXMLDesc(virInterfacePtr ifinfo,
     char *xmlstr = NULL;
     virInterfaceDefPtr ifacedef = NULL;
     char *ret = NULL;
+    netcfCachePtr cache = NULL;
+    unsigned long long serial = 0;
 
     virCheckFlags(VIR_INTERFACE_XML_INACTIVE, NULL);
 
     interfaceDriverLock(driver);
 
+    /* Only the configuration is cached, the live state includes
+     * addresses which can change without us hearing about it */
+    if ((flags & VIR_INTERFACE_XML_INACTIVE) && driver->cache) {
+        const char *cached;
+
+        cache = driver->cache;
+        virMutexLock(&cache->lock);
+        if ((cached = virHashLookup(cache->inactiveXML, ifinfo->name)) &&
+            !(xmlstr = strdup(cached))) {
+            virMutexUnlock(&cache->lock);
+            virReportOOMError();
+            goto cleanup;
+        }
+        serial = cache->serial;
+        virMutexUnlock(&cache->lock);
+
+        if (xmlstr)
+            goto parse;
+    }
+
     iface = interfaceDriverGetNetcfIF(driver->netcf, ifinfo);
     if (!iface) {
         /* helper already reported error */
@@ -512,6 +896,20 @@ static char *interfaceGetXMLDesc(virInterfacePtr ifinfo,
         goto cleanup;
     }
 
+    if (cache) {
+        char *copy;
+
+        virMutexLock(&cache->lock);
+        if (cache->serial == serial &&
+            (copy = strdup(xmlstr)) &&
+            virHashUpdateEntry(cache->inactiveXML, ifinfo->name, copy) < 0) {
+            VIR_FREE(copy);
+            virResetLastError();
+        }
+        virMutexUnlock(&cache->lock);
+    }
+
+parse:
     ifacedef = virInterfaceDefParseString(xmlstr);
     if (!ifacedef) {
         /* error was already reported */
@@ -559,6 +957,7 @@ static virInterfacePtr interfaceDefineXML(virConnectPtr conn,
     }
 
     iface = ncf_define(driver->netcf, xmlstr);
+    netcfCacheInvalidate(driver->cache, true);
     if (!iface) {
         const char *errmsg, *details;
         int errcode = ncf_error(driver->netcf, &errmsg, &details);
@@ -593,6 +992,7 @@ static int interfaceUndefine(virInterfacePtr ifinfo) {
     }
 
     ret = ncf_if_undefine(iface);
+    netcfCacheInvalidate(driver->cache, true);
     if (ret < 0) {
         const char *errmsg, *details;
         int errcode = ncf_error(driver->netcf, &errmsg, &details);
@@ -627,6 +1027,7 @@ static int interfaceCreate(virInterfacePtr ifinfo,
     }
 
     ret = ncf_if_up(iface);
+    netcfCacheInvalidate(driver->cache, false);
     if (ret < 0) {
         const char *errmsg, *details;
         int errcode = ncf_error(driver->netcf, &errmsg, &details);
@@ -661,6 +1062,7 @@ static int interfaceDestroy(virInterfacePtr ifinfo,
     }
 
     ret = ncf_if_down(iface);
+    netcfCacheInvalidate(driver->cache, false);
     if (ret < 0) {
         const char *errmsg, *details;
         int errcode = ncf_error(driver->netcf, &errmsg, &details);
@@ -744,6 +1146,7 @@ static int interfaceChangeCommit(virConnectPtr conn, unsigned int flags)
     interfaceDriverLock(driver);
 
     ret = ncf_change_commit(driver->netcf, 0);
+    netcfCacheInvalidate(driver->cache, true);
     if (ret < 0) {
         const char *errmsg, *details;
         int errcode = ncf_error(driver->netcf, &errmsg, &details);
@@ -767,6 +1170,7 @@ static int interfaceChangeRollback(virConnectPtr conn, unsigned int flags)
     interfaceDriverLock(driver);
 
     ret = ncf_change_rollback(driver->netcf, 0);
+    netcfCacheInvalidate(driver->cache, true);
     if (ret < 0) {
         const char *errmsg, *details;
         int errcode = ncf_error(driver->netcf, &errmsg, &details);
@@ -60,6 +60,8 @@
 #include "virrandom.h"
 #include "viruri.h"
 #include "threads.h"
+#include "virtypedparam.h"
+#include "virtime.h"
 
 #ifdef WITH_TEST
 # include "test/test_driver.h"
@@ -808,8 +810,11 @@ int virStateInitialize(bool privileged,
 
     for (i = 0 ; i < virStateDriverTabCount ; i++) {
         if (virStateDriverTab[i]->initialize) {
+            unsigned long long start = 0, end = 0;
+
             VIR_DEBUG("Running global init for %s state driver",
                       virStateDriverTab[i]->name);
+            ignore_value(virTimeMillisNow(&start));
             if (virStateDriverTab[i]->initialize(privileged,
                                                  callback,
                                                  opaque) < 0) {
@@ -817,6 +822,9 @@ int virStateInitialize(bool privileged,
                           virStateDriverTab[i]->name);
                 return -1;
             }
+            ignore_value(virTimeMillisNow(&end));
+            VIR_INFO("Initialized %s state driver in %llu ms",
+                     virStateDriverTab[i]->name, end - start);
         }
     }
     return 0;
@@ -876,6 +884,26 @@ int virStateStop(void) {
     return ret;
 }
 
+/**
+ * virStatePreExecRestart:
+ *
+ * Run each virtualization driver's "preExecRestart" method, before
+ * the daemon re-executes itself.  A driver fails it when it has
+ * background work in progress, which re-executing would lose.
+ *
+ * Returns 0 if all succeed, -1 on the first failure.
+ */
+int virStatePreExecRestart(void) {
+    int i;
+
+    for (i = 0 ; i < virStateDriverTabCount ; i++) {
+        if (virStateDriverTab[i]->preExecRestart &&
+            virStateDriverTab[i]->preExecRestart() < 0)
+            return -1;
+    }
+    return 0;
+}
+
 #endif
 
 
@@ -1082,6 +1110,30 @@ cleanup:
     return ret;
 }
 
+/*
+ * Whether @driver may accept a URI with @scheme, so that opening a
+ * connection does not ask every driver in turn. A scheme accepted by
+ * the driver also matches with a transport, as in "esx+https".
+ */
+static bool
+virConnectDriverHandlesScheme(virDriverPtr driver, const char *scheme)
+{
+    int i;
+
+    if (!driver->uriSchemes)
+        return true;
+
+    for (i = 0; driver->uriSchemes[i]; i++) {
+        size_t len = strlen(driver->uriSchemes[i]);
+
+        if (STRCASEEQLEN(scheme, driver->uriSchemes[i], len) &&
+            (scheme[len] == '\0' || scheme[len] == '+'))
+            return true;
+    }
+
+    return false;
+}
+
 static virConnectPtr
 do_open(const char *name,
         virConnectAuthPtr auth,
@@ -1188,6 +1240,14 @@ do_open(const char *name,
             goto failed;
         }
 
+        if (ret->uri && ret->uri->scheme &&
+            !virConnectDriverHandlesScheme(virDriverTab[i],
+                                           ret->uri->scheme)) {
+            VIR_DEBUG("skipping driver %d (%s) for scheme %s",
+                      i, virDriverTab[i]->name, ret->uri->scheme);
+            continue;
+        }
+
         VIR_DEBUG("trying driver %d (%s) ...", i, virDriverTab[i]->name);
         res = virDriverTab[i]->open(ret, auth, flags);
         VIR_DEBUG("driver %d %s returned %s",
@@ -2291,6 +2351,61 @@ error:
     return -1;
 }
 
+/**
+ * virConnectDestroyAllDomains:
+ * @conn: pointer to the hypervisor connection
+ * @flags: bitwise-OR of virConnectDestroyAllDomainsFlags
+ *
+ * Destroy every running domain, like calling virDomainDestroyFlags on
+ * each of them, for example to evacuate a host quickly.  Hypervisor
+ * drivers can terminate all the domains at the same time, so that the
+ * call takes about as long as destroying a single domain rather than
+ * growing with their number.
+ *
+ * Without @flags, domains which do not terminate by the end of the
+ * timeout are forcefully terminated, with the same risks as described
+ * for virDomainDestroyFlags.  VIR_CONNECT_DESTROY_ALL_DOMAINS_GRACEFUL
+ * prevents that, leaving those domains running.
+ *
+ * Every domain is attempted even if destroying some of them fails.
+ *
+ * Returns the number of domains destroyed, or -1 if any of them could
+ * not be destroyed.
+ */
+int
+virConnectDestroyAllDomains(virConnectPtr conn,
+                            unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, flags=%x", conn, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECT(conn)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    if (conn->flags & VIR_CONNECT_RO) {
+        virLibConnError(VIR_ERR_OPERATION_DENIED, __FUNCTION__);
+        goto error;
+    }
+
+    if (conn->driver->connectDestroyAllDomains) {
+        int ret;
+        ret = conn->driver->connectDestroyAllDomains(conn, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
 /**
  * virDomainFree:
  * @domain: a domain object
@@ -4241,6 +4356,61 @@ error:
     return -1;
 }
 
+/**
+ * virDomainGetInfoAsync:
+ * @domain: a domain object
+ * @cb: callback to invoke with the result
+ * @opaque: user data to pass to @cb
+ * @freecb: optional function to free @opaque once @cb has run
+ *
+ * Start retrieving the same information as virDomainGetInfo, but
+ * return without waiting for it. @cb is later invoked exactly once
+ * with the result, from the thread running the event loop, so an
+ * event loop implementation must have been registered before the
+ * connection was opened. Many such requests may be outstanding on
+ * a single connection at once.
+ *
+ * This is currently only implemented by the remote driver.
+ *
+ * Returns 0 if the request was submitted, in which case @cb will be
+ * invoked, or -1 on failure, in which case it won't.
+ */
+int
+virDomainGetInfoAsync(virDomainPtr domain,
+                      virDomainGetInfoCallback cb,
+                      void *opaque,
+                      virFreeCallback freecb)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "cb=%p, opaque=%p, freecb=%p", cb, opaque, freecb);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_DOMAIN(domain)) {
+        virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    virCheckNonNullArgGoto(cb, error);
+
+    conn = domain->conn;
+
+    if (conn->driver->domainGetInfoAsync) {
+        int ret;
+        ret = conn->driver->domainGetInfoAsync(domain, cb, opaque, freecb);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(domain->conn);
+    return -1;
+}
+
 /**
  * virDomainGetState:
  * @domain: a domain object
@@ -5125,6 +5295,8 @@ virDomainMigrateDirect(virDomainPtr domain,
  *                                 changes during the migration process (set
  *                                 automatically when supported).
  *   VIR_MIGRATE_UNSAFE    Force migration even if it is considered unsafe.
+ *   VIR_MIGRATE_COMPRESSED Compress memory pages the guest keeps rewriting,
+ *                          see virDomainMigrateSetCompressionCache.
  *
  * VIR_MIGRATE_TUNNELLED requires that VIR_MIGRATE_PEER2PEER be set.
  * Applications using the VIR_MIGRATE_PEER2PEER flag will probably
@@ -5334,6 +5506,8 @@ error:
  *                                 changes during the migration process (set
  *                                 automatically when supported).
  *   VIR_MIGRATE_UNSAFE    Force migration even if it is considered unsafe.
+ *   VIR_MIGRATE_COMPRESSED Compress memory pages the guest keeps rewriting,
+ *                          see virDomainMigrateSetCompressionCache.
  *
  * VIR_MIGRATE_TUNNELLED requires that VIR_MIGRATE_PEER2PEER be set.
  * Applications using the VIR_MIGRATE_PEER2PEER flag will probably
@@ -5560,6 +5734,8 @@ error:
  *                                 changes during the migration process (set
  *                                 automatically when supported).
  *   VIR_MIGRATE_UNSAFE    Force migration even if it is considered unsafe.
+ *   VIR_MIGRATE_COMPRESSED Compress memory pages the guest keeps rewriting,
+ *                          see virDomainMigrateSetCompressionCache.
  *
  * The operation of this API hinges on the VIR_MIGRATE_PEER2PEER flag.
  * If the VIR_MIGRATE_PEER2PEER flag is NOT set, the duri parameter
@@ -5693,6 +5869,8 @@ error:
  *                                 changes during the migration process (set
  *                                 automatically when supported).
  *   VIR_MIGRATE_UNSAFE    Force migration even if it is considered unsafe.
+ *   VIR_MIGRATE_COMPRESSED Compress memory pages the guest keeps rewriting,
+ *                          see virDomainMigrateSetCompressionCache.
  *
  * The operation of this API hinges on the VIR_MIGRATE_PEER2PEER flag.
  *
@@ -6512,6 +6690,52 @@ error:
     return NULL;
 }
 
+/**
+ * virConnectGetHostCapabilities:
+ * @conn: pointer to the hypervisor connection
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Provides the host part of the capabilities of the hypervisor /
+ * driver: the host CPU, its NUMA topology, power management, migration
+ * and security features.  This is the <host> element that
+ * virConnectGetCapabilities also reports, within the same
+ * <capabilities> root element, but without the <guest> elements
+ * describing every supported emulator and machine type, which makes
+ * it much cheaper for clients interested in the host only.
+ *
+ * Returns NULL in case of error, or an XML string
+ * defining the host capabilities.
+ * The client must free the returned string after use.
+ */
+char *
+virConnectGetHostCapabilities(virConnectPtr conn, unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, flags=%x", conn, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECT(conn)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return NULL;
+    }
+
+    if (conn->driver->connectGetHostCapabilities) {
+        char *ret;
+        ret = conn->driver->connectGetHostCapabilities(conn, flags);
+        if (!ret)
+            goto error;
+        VIR_DEBUG("conn=%p ret=%s", conn, ret);
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return NULL;
+}
+
 /**
  * virNodeGetCPUStats:
  * @conn: pointer to the hypervisor connection.
@@ -7690,6 +7914,7 @@ error:
  * For your program to be able to work reliably over a remote
  * connection you should split large requests to <= 65536 bytes.
  * However, with 0.9.13 this RPC limit has been raised to 1M byte.
+ * Larger areas can be read in one go with virDomainBlockPeekStream().
  *
  * Returns: 0 in case of success or -1 in case of failure.
  */
@@ -7742,6 +7967,73 @@ error:
     return -1;
 }
 
+/**
+ * virDomainBlockPeekStream:
+ * @dom: pointer to the domain object
+ * @stream: stream to use as output
+ * @disk: path to the block device, or device shorthand
+ * @offset: offset within block device
+ * @length: number of bytes to read, or 0 for everything from @offset
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Read the contents of a domain's disk into a stream, without the
+ * size limit of virDomainBlockPeek(), which makes reading large
+ * areas possible in a single call.  @disk is interpreted as for
+ * virDomainBlockPeek().
+ *
+ * Returns: 0 in case of success or -1 in case of failure.
+ */
+int
+virDomainBlockPeekStream(virDomainPtr dom,
+                         virStreamPtr stream,
+                         const char *disk,
+                         unsigned long long offset,
+                         unsigned long long length,
+                         unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(dom, "stream=%p, disk=%s, offset=%llu, length=%llu, "
+                     "flags=%x", stream, disk, offset, length, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_DOMAIN(dom)) {
+        virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    conn = dom->conn;
+
+    if (!VIR_IS_STREAM(stream)) {
+        virLibConnError(VIR_ERR_INVALID_STREAM, __FUNCTION__);
+        goto error;
+    }
+
+    if (dom->conn->flags & VIR_CONNECT_RO ||
+        stream->conn->flags & VIR_CONNECT_RO) {
+        virLibDomainError(VIR_ERR_OPERATION_DENIED, __FUNCTION__);
+        goto error;
+    }
+
+    virCheckNonNullArgGoto(disk, error);
+
+    if (conn->driver->domainBlockPeekStream) {
+        int ret;
+        ret = conn->driver->domainBlockPeekStream(dom, stream, disk,
+                                                  offset, length, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibDomainError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(dom->conn);
+    return -1;
+}
+
 /**
  * virDomainBlockResize:
  * @dom: pointer to the domain object
@@ -7840,6 +8132,7 @@ error:
  * For your program to be able to work reliably over a remote
  * connection you should split large requests to <= 65536 bytes.
  * However, with 0.9.13 this RPC limit has been raised to 1M byte.
+ * Larger areas can be read in one go with virDomainMemoryPeekStream().
  *
  * Returns: 0 in case of success or -1 in case of failure.
  */
@@ -7921,6 +8214,82 @@ error:
 }
 
 
+/**
+ * virDomainMemoryPeekStream:
+ * @dom: pointer to the domain object
+ * @stream: stream to use as output
+ * @start: start of memory to peek
+ * @size: number of bytes to peek
+ * @flags: bitwise-OR of virDomainMemoryFlags
+ *
+ * Read the contents of a domain's memory into a stream, without the
+ * size limit of virDomainMemoryPeek(), which makes reading large
+ * regions possible in a single call.  @start and @flags have the
+ * same meaning as for virDomainMemoryPeek().
+ *
+ * The memory is read in chunks while the stream is being consumed.
+ * If reading a chunk fails, the stream ends early, so callers should
+ * check that @size bytes were received before the end of the stream.
+ *
+ * Returns: 0 in case of success or -1 in case of failure.
+ */
+int
+virDomainMemoryPeekStream(virDomainPtr dom,
+                          virStreamPtr stream,
+                          unsigned long long start,
+                          unsigned long long size,
+                          unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(dom, "stream=%p, start=%llu, size=%llu, flags=%x",
+                     stream, start, size, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_DOMAIN(dom)) {
+        virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    conn = dom->conn;
+
+    if (!VIR_IS_STREAM(stream)) {
+        virLibConnError(VIR_ERR_INVALID_STREAM, __FUNCTION__);
+        goto error;
+    }
+
+    if (dom->conn->flags & VIR_CONNECT_RO ||
+        stream->conn->flags & VIR_CONNECT_RO) {
+        virLibDomainError(VIR_ERR_OPERATION_DENIED, __FUNCTION__);
+        goto error;
+    }
+
+    /* Exactly one of these two flags must be set.  */
+    if (!(flags & VIR_MEMORY_VIRTUAL) == !(flags & VIR_MEMORY_PHYSICAL)) {
+        virReportInvalidArg(flags,
+                            _("flags in %s must include VIR_MEMORY_VIRTUAL or VIR_MEMORY_PHYSICAL"),
+                            __FUNCTION__);
+        goto error;
+    }
+
+    if (conn->driver->domainMemoryPeekStream) {
+        int ret;
+        ret = conn->driver->domainMemoryPeekStream(dom, stream, start,
+                                                   size, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibDomainError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(dom->conn);
+    return -1;
+}
+
+
 /**
  * virDomainGetBlockInfo:
  * @domain: a domain object
@@ -8334,20 +8703,341 @@ error:
 }
 
 /**
- * virDomainCreate:
- * @domain: pointer to a defined domain
+ * virConnectListAllDomainsFiltered:
+ * @conn: Pointer to the hypervisor connection.
+ * @domains: Pointer to a variable to store the array containing domain objects
+ *           or NULL if the list is not required (just returns number of guests).
+ * @filters: array of filters, or NULL
+ * @nfilters: number of entries in @filters
+ * @flags: bitwise-OR of virConnectListAllDomainsFlags
  *
- * Launch a defined domain. If the call succeeds the domain moves from the
- * defined to the running domains pools.  The domain will be paused only
- * if restoring from managed state created from a paused domain.  For more
- * control, see virDomainCreateWithFlags().
+ * Like virConnectListAllDomains(), but additionally restricts the result
+ * to the domains matching @filters.  The filters are evaluated by the
+ * hypervisor driver while it walks its list of domains, so that callers
+ * looking for a few domains out of many do not have to fetch all of them
+ * and query each one in turn.
+ *
+ * Each filter is a VIR_TYPED_PARAM_STRING; the accepted fields are
+ * VIR_CONNECT_LIST_DOMAINS_FILTER_NAME, VIR_CONNECT_LIST_DOMAINS_FILTER_UUID,
+ * VIR_CONNECT_LIST_DOMAINS_FILTER_TITLE,
+ * VIR_CONNECT_LIST_DOMAINS_FILTER_METADATA and
+ * VIR_CONNECT_LIST_DOMAINS_FILTER_METADATA_VALUE.  A field may be given
+ * more than once, in which case a domain matching any of the values
+ * passes; a domain must pass every field that is present.  For example,
+ * two "uuid" filters together with a "title" filter select whichever of
+ * the two domains has a matching title.
+ *
+ * Drivers may keep an index of the domains by the text of their
+ * <metadata> elements in some namespaces, such as the ones listed in
+ * the metadata_index setting of the QEMU driver.  Looking domains up
+ * by VIR_CONNECT_LIST_DOMAINS_FILTER_METADATA_VALUE in those namespaces
+ * then only checks the domains found in the index.
  *
- * Returns 0 in case of success, -1 in case of error
+ * Returns the number of domains found or -1 and sets domains to NULL in case
+ * of error.  The returned array is handled as in virConnectListAllDomains().
  */
 int
-virDomainCreate(virDomainPtr domain) {
-    virConnectPtr conn;
-
+virConnectListAllDomainsFiltered(virConnectPtr conn,
+                                 virDomainPtr **domains,
+                                 virTypedParameterPtr filters,
+                                 int nfilters,
+                                 unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, domains=%p, filters=%p, nfilters=%d, flags=%x",
+              conn, domains, filters, nfilters, flags);
+
+    virResetLastError();
+
+    if (domains)
+        *domains = NULL;
+
+    if (!VIR_IS_CONNECT(conn)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    virCheckNonNegativeArgGoto(nfilters, error);
+    if (nfilters)
+        virCheckNonNullArgGoto(filters, error);
+
+    if (conn->driver->connectListAllDomainsFiltered) {
+        int ret;
+        ret = conn->driver->connectListAllDomainsFiltered(conn, domains,
+                                                   filters, nfilters, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
+/**
+ * virConnectGetListGeneration:
+ * @conn: Pointer to the hypervisor connection.
+ * @type: one of virConnectListGenerationType
+ * @generation: Pointer to a variable to store the generation in
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Query the generation of a list of objects: a counter which changes
+ * whenever an object of that type is added or removed, or an object
+ * starts or stops.  For domains, any other change of state such as
+ * pausing also counts.
+ *
+ * Applications polling virConnectListAllDomains,
+ * virConnectListAllNetworks or virConnectListAllStoragePools can keep
+ * the generation seen before listing and skip the next listing
+ * entirely while it is unchanged, which is much cheaper than fetching
+ * and comparing a long list.  A generation may also change when
+ * nothing that matters to the caller did, and says nothing about
+ * changes to the objects' configuration.  Generations start again
+ * from scratch when the daemon is restarted, so callers must list
+ * again after reconnecting.
+ *
+ * Returns 0 in case of success, -1 in case of error.
+ */
+int
+virConnectGetListGeneration(virConnectPtr conn,
+                            unsigned int type,
+                            unsigned long long *generation,
+                            unsigned int flags)
+{
+    virDrvConnectGetListGeneration func = NULL;
+
+    VIR_DEBUG("conn=%p, type=%u, generation=%p, flags=%x",
+              conn, type, generation, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECT(conn)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    virCheckNonNullArgGoto(generation, error);
+
+    switch ((virConnectListGenerationType) type) {
+    case VIR_CONNECT_LIST_GENERATION_DOMAINS:
+        func = conn->driver->connectGetListGeneration;
+        break;
+    case VIR_CONNECT_LIST_GENERATION_NETWORKS:
+        if (conn->networkDriver)
+            func = conn->networkDriver->connectGetListGeneration;
+        break;
+    case VIR_CONNECT_LIST_GENERATION_STORAGE_POOLS:
+        if (conn->storageDriver)
+            func = conn->storageDriver->connectGetListGeneration;
+        break;
+    default:
+        virReportInvalidArg(type,
+                            _("unknown list type %u in %s"),
+                            type, __FUNCTION__);
+        goto error;
+    }
+
+    if (func) {
+        int ret;
+        ret = func(conn, type, generation, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
+/**
+ * virConnectGetAllDomainStats:
+ * @conn: pointer to the hypervisor connection
+ * @stats: bitwise-OR of virDomainStatsTypes, or 0 for all supported groups
+ * @retStats: Pointer that will be filled with the array of returned stats
+ * @flags: extra flags; bitwise-OR of virConnectGetAllDomainStatsFlags
+ *
+ * Query statistics for all domains on a given connection in a single
+ * call, instead of listing the domains and issuing virDomainGetInfo(),
+ * virDomainBlockStats(), virDomainInterfaceStats() and friends for
+ * each of them in turn.
+ *
+ * Domains can be filtered with @flags, which accepts the active,
+ * persistence and state groups of virConnectListAllDomainsFlags under
+ * their VIR_CONNECT_GET_ALL_DOMAINS_STATS_* names.
+ *
+ * @stats selects the groups of statistics to report.  Groups that the
+ * hypervisor does not support are silently ignored, unless @flags
+ * contains VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, in which
+ * case the call fails instead.  Groups that cannot be collected for a
+ * particular domain (for example block statistics of an inactive domain)
+ * are simply omitted from its record.
+ *
+ * The statistics are returned as typed parameters, using the following
+ * field names:
+ *
+ * VIR_DOMAIN_STATS_STATE: "state.state" and "state.reason" as int,
+ * holding virDomainState and the matching reason.
+ *
+ * VIR_DOMAIN_STATS_CPU_TOTAL: "cpu.time" total cpu time in nanoseconds,
+ * and where available "cpu.user" and "cpu.system", all as unsigned long
+ * long.  Domains whose vCPUs have a bandwidth quota also report
+ * "cpu.throttle.periods", "cpu.throttle.count" and "cpu.throttle.time",
+ * the number of enforcement periods elapsed, of periods the domain was
+ * throttled in and the time it was throttled for in nanoseconds, as
+ * unsigned long long, and, when the hypervisor adjusts that quota on its
+ * own, "cpu.quota" as the current quota per vCPU in microseconds as long
+ * long.
+ *
+ * VIR_DOMAIN_STATS_BALLOON: "balloon.current" and "balloon.maximum" in
+ * kibibytes, as unsigned long long.  Domains handled by a hypervisor side
+ * memory overcommit manager also report "balloon.manager.target", the
+ * last balloon size it set in kibibytes, and "balloon.manager.inflations"
+ * and "balloon.manager.deflations", the number of times it shrank and
+ * grew the domain, as unsigned long long.
+ *
+ * VIR_DOMAIN_STATS_INTERFACE: "net.count" as unsigned int, then for each
+ * interface <num>: "net.<num>.name" as string and "net.<num>.rx.bytes",
+ * "net.<num>.rx.pkts", "net.<num>.rx.errs", "net.<num>.rx.drop",
+ * "net.<num>.tx.bytes", "net.<num>.tx.pkts", "net.<num>.tx.errs",
+ * "net.<num>.tx.drop" as unsigned long long.
+ *
+ * VIR_DOMAIN_STATS_BLOCK: "block.count" as unsigned int, then for each
+ * disk <num>: "block.<num>.name" as string and "block.<num>.rd.reqs",
+ * "block.<num>.rd.bytes", "block.<num>.rd.times", "block.<num>.wr.reqs",
+ * "block.<num>.wr.bytes", "block.<num>.wr.times", "block.<num>.fl.reqs",
+ * "block.<num>.fl.times" as unsigned long long, where the hypervisor
+ * provides them.
+ *
+ * VIR_DOMAIN_STATS_MONITOR: latency of the hypervisor monitor, all
+ * times in milliseconds.  "monitor.inflight.name" as string and
+ * "monitor.inflight.time" as unsigned long long describe the command
+ * currently waiting for its reply, if any.  "monitor.cmd.count" as
+ * unsigned int, then for each command <num>: "monitor.cmd.<num>.name"
+ * as string and "monitor.cmd.<num>.calls", "monitor.cmd.<num>.errors",
+ * "monitor.cmd.<num>.time" (total), "monitor.cmd.<num>.max",
+ * "monitor.cmd.<num>.p50", "monitor.cmd.<num>.p95" and
+ * "monitor.cmd.<num>.p99" as unsigned long long.  "monitor.job.count"
+ * as unsigned int, then for each type of job <num> API calls waited
+ * for: "monitor.job.<num>.name" as string and "monitor.job.<num>.waits",
+ * "monitor.job.<num>.timeouts", "monitor.job.<num>.time" (total),
+ * "monitor.job.<num>.max", and the time those jobs were then held for,
+ * "monitor.job.<num>.held" (total) and "monitor.job.<num>.held.max", as
+ * unsigned long long.  Percentiles are estimates.
+ *
+ * VIR_DOMAIN_STATS_VCPU: "vcpu.current" and "vcpu.maximum" as unsigned
+ * int, then for each running virtual CPU <num>: "vcpu.<num>.state" as
+ * int holding virVcpuState, "vcpu.<num>.time" cpu time and
+ * "vcpu.<num>.wait" time spent waiting for a host CPU, in nanoseconds,
+ * as unsigned long long.
+ *
+ * VIR_DOMAIN_STATS_JOB: "job.type" as int holding the virDomainJobType of
+ * the background job of the domain, and "job.queue.position" as unsigned
+ * int while an outgoing migration waits for its turn to run, 1 being
+ * the next migration to start.  While a migration compresses memory
+ * pages (see VIR_MIGRATE_COMPRESSED): "job.compression.cache" size of
+ * the cache and "job.compression.bytes" compressed data sent in bytes,
+ * "job.compression.pages" compressed pages sent,
+ * "job.compression.cache_misses" pages missing from the cache and
+ * "job.compression.overflow" pages too much changed to be compressed,
+ * all as unsigned long long.  While an incoming migration runs, the
+ * time in milliseconds preparing it took, as unsigned long long:
+ * "job.prepare.parse" parsing the domain XML, "job.prepare.define"
+ * adding the domain, "job.prepare.start" starting qemu, split into
+ * "job.prepare.start.<step>" with <step> one of "prepare", "cgroup",
+ * "cmdline", "exec", "label", "monitor" and "setup", and
+ * "job.prepare.incoming" setting up the incoming side.  The security
+ * labelling and the emulator capabilities lookup run alongside other
+ * steps; "job.prepare.labelling" and "job.prepare.capabilities" hold
+ * the time they took.
+ *
+ * Returns the count of returned statistics structures on success, -1 on
+ * error.  The requested data are returned in the @retStats parameter; the
+ * array is terminated by a NULL entry and must be freed by the caller
+ * with virDomainStatsRecordListFree().
+ */
+int
+virConnectGetAllDomainStats(virConnectPtr conn,
+                            unsigned int stats,
+                            virDomainStatsRecordPtr **retStats,
+                            unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, stats=0x%x, retStats=%p, flags=%x",
+              conn, stats, retStats, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECT(conn)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    virCheckNonNullArgGoto(retStats, error);
+    *retStats = NULL;
+
+    if (conn->driver->connectGetAllDomainStats) {
+        int ret;
+        ret = conn->driver->connectGetAllDomainStats(conn, stats,
+                                                     retStats, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
+/**
+ * virDomainStatsRecordListFree:
+ * @stats: NULL terminated array of virDomainStatsRecords to free
+ *
+ * Convenience function to free a list of domain stats returned by
+ * virConnectGetAllDomainStats().
+ */
+void
+virDomainStatsRecordListFree(virDomainStatsRecordPtr *stats)
+{
+    virDomainStatsRecordPtr *next;
+
+    if (!stats)
+        return;
+
+    for (next = stats; *next; next++) {
+        virTypedParameterArrayClear((*next)->params, (*next)->nparams);
+        VIR_FREE((*next)->params);
+        virObjectUnref((*next)->dom);
+        VIR_FREE(*next);
+    }
+
+    VIR_FREE(stats);
+}
+
+/**
+ * virDomainCreate:
+ * @domain: pointer to a defined domain
+ *
+ * Launch a defined domain. If the call succeeds the domain moves from the
+ * defined to the running domains pools.  The domain will be paused only
+ * if restoring from managed state created from a paused domain.  For more
+ * control, see virDomainCreateWithFlags().
+ *
+ * Returns 0 in case of success, -1 in case of error
+ */
+int
+virDomainCreate(virDomainPtr domain) {
+    virConnectPtr conn;
+
     VIR_DOMAIN_DEBUG(domain);
 
     virResetLastError();
@@ -9820,6 +10510,76 @@ error:
     return -1;
 }
 
+/**
+ * virDomainAttachDevices:
+ * @domain: pointer to domain object
+ * @xmls: array of XML descriptions of one device each
+ * @nxmls: number of elements in @xmls
+ * @flags: bitwise-OR of virDomainDeviceModifyFlags
+ *
+ * Attach several virtual devices to a domain at once, with the same
+ * semantics of @flags as virDomainAttachDeviceFlags.  This is cheaper
+ * than attaching the devices one by one, since the hypervisor driver
+ * can prepare the whole set together and only has to record the new
+ * domain state once.
+ *
+ * All descriptions are checked before any device is attached.  If
+ * attaching one of the devices to the running domain fails, the devices
+ * attached before it stay attached, while the persisted configuration
+ * is left untouched.
+ *
+ * Returns 0 in case of success, -1 in case of failure.
+ */
+int
+virDomainAttachDevices(virDomainPtr domain,
+                       const char **xmls,
+                       unsigned int nxmls,
+                       unsigned int flags)
+{
+    virConnectPtr conn;
+    unsigned int i;
+
+    VIR_DOMAIN_DEBUG(domain, "xmls=%p, nxmls=%u, flags=%x",
+                     xmls, nxmls, flags);
+    if (xmls) {
+        for (i = 0; i < nxmls; i++)
+            VIR_DEBUG("xmls[%u]=%s", i, NULLSTR(xmls[i]));
+    }
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_DOMAIN(domain)) {
+        virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    virCheckNonNullArgGoto(xmls, error);
+    virCheckNonZeroArgGoto(nxmls, error);
+    for (i = 0; i < nxmls; i++)
+        virCheckNonNullArgGoto(xmls[i], error);
+
+    if (domain->conn->flags & VIR_CONNECT_RO) {
+        virLibDomainError(VIR_ERR_OPERATION_DENIED, __FUNCTION__);
+        goto error;
+    }
+    conn = domain->conn;
+
+    if (conn->driver->domainAttachDevices) {
+        int ret;
+        ret = conn->driver->domainAttachDevices(domain, xmls, nxmls, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(domain->conn);
+    return -1;
+}
+
 /**
  * virDomainDetachDevice:
  * @domain: pointer to domain object
@@ -10945,6 +11705,89 @@ error:
     return NULL;
 }
 
+/**
+ * virNetworkGetDHCPLeases:
+ * @network: a network object
+ * @mac: optional MAC address of an interface, in ASCII format
+ * @leases: pointer to a variable to store the array of leases, or NULL
+ *          if only the number of leases is of interest
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Provides the DHCP leases currently handed out by @network, limited to
+ * the ones of the interface with MAC address @mac if it is not NULL.
+ * The network driver keeps the leases indexed, so that callers polling
+ * the addresses of many guests don't need to parse lease files.
+ *
+ * DHCPv6 leases carry no MAC address and are only reported when @mac
+ * is NULL.
+ *
+ * On success, @leases (if not NULL) is set to a newly allocated array
+ * of leases; the caller must release each lease with
+ * virNetworkDHCPLeaseFree() and then free the array with free().
+ *
+ * Returns the number of leases found, or -1 in case of error.
+ */
+int
+virNetworkGetDHCPLeases(virNetworkPtr network,
+                        const char *mac,
+                        virNetworkDHCPLeasePtr **leases,
+                        unsigned int flags)
+{
+    virConnectPtr conn;
+    VIR_DEBUG("network=%p, mac=%s, leases=%p, flags=%x",
+              network, NULLSTR(mac), leases, flags);
+
+    virResetLastError();
+
+    if (leases)
+        *leases = NULL;
+
+    if (!VIR_IS_CONNECTED_NETWORK(network)) {
+        virLibNetworkError(VIR_ERR_INVALID_NETWORK, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    conn = network->conn;
+
+    if (conn->networkDriver && conn->networkDriver->networkGetDHCPLeases) {
+        int ret;
+        ret = conn->networkDriver->networkGetDHCPLeases(network, mac,
+                                                        leases, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(network->conn);
+    return -1;
+}
+
+/**
+ * virNetworkDHCPLeaseFree:
+ * @lease: pointer to a leases object
+ *
+ * Frees all the memory occupied by @lease, as returned by
+ * virNetworkGetDHCPLeases().
+ */
+void
+virNetworkDHCPLeaseFree(virNetworkDHCPLeasePtr lease)
+{
+    if (!lease)
+        return;
+
+    VIR_FREE(lease->iface);
+    VIR_FREE(lease->mac);
+    VIR_FREE(lease->iaid);
+    VIR_FREE(lease->ipaddr);
+    VIR_FREE(lease->hostname);
+    VIR_FREE(lease->clientid);
+    VIR_FREE(lease);
+}
+
 /**
  * virNetworkGetAutostart:
  * @network: a network object
@@ -12771,12 +13614,20 @@ virStoragePoolRef(virStoragePoolPtr pool)
 /**
  * virStoragePoolRefresh:
  * @pool: pointer to storage pool
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStoragePoolRefreshFlags
  *
  * Request that the pool refresh its list of volumes. This may
  * involve communicating with a remote server, and/or initializing
  * new devices at the OS layer
  *
+ * If @flags contains VIR_STORAGE_POOL_REFRESH_CAPACITY, only the
+ * capacity, allocation and available space of the pool, as reported
+ * by virStoragePoolGetInfo, are updated.  The volumes are not probed
+ * again, which makes this cheap enough to be done periodically, and
+ * possible while jobs are running on volumes of the pool.  Pools
+ * which can't tell their size without looking at their volumes are
+ * fully refreshed.
+ *
  * Returns 0 if the volume list was refreshed, -1 on failure
  */
 int
@@ -13501,6 +14352,12 @@ error:
  * qcow2 image files which don't support full preallocation,
  * by creating a sparse image file with metadata.
  *
+ * If @flags contains VIR_STORAGE_VOL_CREATE_ASYNC, the volume is
+ * returned as soon as it is defined, while its contents are still
+ * being copied.  Until that job is done, virStorageVolGetJobInfo
+ * reports it and it can be cancelled with virStorageVolAbortJob;
+ * should it fail the new volume is deleted again.
+ *
  * Returns the storage volume, or NULL on error
  */
 virStorageVolPtr
@@ -13557,12 +14414,17 @@ error:
  * @stream: stream to use as output
  * @offset: position in @vol to start reading from
  * @length: limit on amount of data to download
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStorageVolDownloadFlags
  *
  * Download the content of the volume as a stream. If @length
  * is zero, then the remaining contents of the volume after
  * @offset will be downloaded.
  *
+ * If @flags contains VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM,
+ * holes in the volume are sent as hole packets rather than
+ * runs of zero bytes; use virStreamRecvFlags and
+ * virStreamRecvHole to handle them.
+ *
  * This call sets up an asynchronous stream; subsequent use of
  * stream APIs is necessary to transfer the actual data,
  * determine how much data is successfully transferred, and
@@ -13626,7 +14488,7 @@ error:
  * @stream: stream to use as input
  * @offset: position to start writing to
  * @length: limit on amount of data to upload
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStorageVolUploadFlags
  *
  * Upload new content to the volume from a stream. This call
  * will fail if @offset + @length exceeds the size of the
@@ -13634,6 +14496,11 @@ error:
  * will be raised if an attempt is made to upload greater
  * than @length bytes of data.
  *
+ * If @flags contains VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, the
+ * application may use virStreamSendHole to skip over runs of
+ * zeros, which are then left as holes in the volume. This is
+ * only supported for volumes backed by regular files.
+ *
  * This call sets up an asynchronous stream; subsequent use of
  * stream APIs is necessary to transfer the actual data,
  * determine how much data is successfully transferred, and
@@ -13740,10 +14607,14 @@ error:
 /**
  * virStorageVolWipe:
  * @vol: pointer to storage volume
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStorageVolWipeFlags
  *
  * Ensure data previously on a volume is not accessible to future reads
  *
+ * If @flags contains VIR_STORAGE_VOL_WIPE_ASYNC, the call returns as
+ * soon as the wipe has started; it then runs as a job on the volume
+ * that virStorageVolGetJobInfo reports until it is done.
+ *
  * Returns 0 on success, or -1 on error
  */
 int
@@ -13788,10 +14659,12 @@ error:
  * virStorageVolWipePattern:
  * @vol: pointer to storage volume
  * @algorithm: one of virStorageVolWipeAlgorithm
- * @flags: future flags, use 0 for now
+ * @flags: bitwise-OR of virStorageVolWipeFlags
  *
  * Similar to virStorageVolWipe, but one can choose
- * between different wiping algorithms.
+ * between different wiping algorithms.  The progress of a long
+ * wipe can be followed with virStorageVolGetJobInfo, and it can be
+ * stopped with virStorageVolAbortJob.
  *
  * Returns 0 on success, or -1 on error.
  */
@@ -14053,6 +14926,10 @@ error:
  * the absolute new size regardless of whether it is larger or smaller
  * than the current size.
  *
+ * If @flags contains VIR_STORAGE_VOL_RESIZE_ASYNC, the call returns as
+ * soon as the resize has started; it then runs as a job on the volume
+ * that virStorageVolGetJobInfo reports until it is done.
+ *
  * Returns 0 on success, or -1 on error.
  */
 int
@@ -14103,34 +14980,44 @@ error:
 }
 
 /**
- * virNodeNumOfDevices:
- * @conn: pointer to the hypervisor connection
- * @cap: capability name
+ * virStorageVolGetJobInfo:
+ * @vol: pointer to storage volume
+ * @info: pointer to a virStorageVolJobInfo structure
  * @flags: extra flags; not used yet, so callers should always pass 0
  *
- * Provides the number of node devices.
- *
- * If the optional 'cap'  argument is non-NULL, then the count
- * will be restricted to devices with the specified capability
+ * Request progress information about a long running job, such as a
+ * wipe, on the storage volume @vol.  Jobs started asynchronously are
+ * done once this reports no job any more.  Not all jobs track the
+ * bytes they have processed, those that don't leave @info->processed
+ * at 0.
  *
- * Returns the number of node devices or -1 in case of error
+ * Returns -1 in case of failure, 0 when nothing found, 1 when info was
+ * found and @info filled in.
  */
 int
-virNodeNumOfDevices(virConnectPtr conn, const char *cap, unsigned int flags)
+virStorageVolGetJobInfo(virStorageVolPtr vol,
+                        virStorageVolJobInfoPtr info,
+                        unsigned int flags)
 {
-    VIR_DEBUG("conn=%p, cap=%s, flags=%x", conn, NULLSTR(cap), flags);
+    virConnectPtr conn;
+    VIR_DEBUG("vol=%p, info=%p, flags=%x", vol, info, flags);
 
     virResetLastError();
 
-    if (!VIR_IS_CONNECT(conn)) {
-        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+    if (!VIR_IS_CONNECTED_STORAGE_VOL(vol)) {
+        virLibStorageVolError(VIR_ERR_INVALID_STORAGE_VOL, __FUNCTION__);
         virDispatchError(NULL);
         return -1;
     }
+    virCheckNonNullArgGoto(info, error);
 
-    if (conn->deviceMonitor && conn->deviceMonitor->numOfDevices) {
+    memset(info, 0, sizeof(*info));
+
+    conn = vol->conn;
+
+    if (conn->storageDriver && conn->storageDriver->volGetJobInfo) {
         int ret;
-        ret = conn->deviceMonitor->numOfDevices(conn, cap, flags);
+        ret = conn->storageDriver->volGetJobInfo(vol, info, flags);
         if (ret < 0)
             goto error;
         return ret;
@@ -14139,20 +15026,111 @@ virNodeNumOfDevices(virConnectPtr conn, const char *cap, unsigned int flags)
     virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
 
 error:
-    virDispatchError(conn);
+    virDispatchError(vol->conn);
     return -1;
 }
 
 /**
- * virConnectListAllNodeDevices:
- * @conn: Pointer to the hypervisor connection.
- * @devices: Pointer to a variable to store the array containing the node
- *           device objects or NULL if the list is not required (just returns
- *           number of node devices).
- * @flags: bitwise-OR of virConnectListAllNodeDevices.
+ * virStorageVolAbortJob:
+ * @vol: pointer to storage volume
+ * @flags: extra flags; not used yet, so callers should always pass 0
  *
- * Collect the list of node devices, and allocate an array to store those
- * objects.
+ * Cancel the job running on the storage volume @vol.  The call returns
+ * once the job has been asked to stop, which it does the next time it
+ * checks; virStorageVolGetJobInfo reports it until then.  A volume
+ * whose creation is aborted is deleted, a volume whose wipe is aborted
+ * is left partially wiped.  Not all jobs can be aborted.
+ *
+ * Returns 0 on success, -1 on failure, including when no job is
+ * running.
+ */
+int
+virStorageVolAbortJob(virStorageVolPtr vol,
+                      unsigned int flags)
+{
+    virConnectPtr conn;
+    VIR_DEBUG("vol=%p, flags=%x", vol, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_STORAGE_VOL(vol)) {
+        virLibStorageVolError(VIR_ERR_INVALID_STORAGE_VOL, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    conn = vol->conn;
+    if (conn->flags & VIR_CONNECT_RO) {
+        virLibStorageVolError(VIR_ERR_OPERATION_DENIED, __FUNCTION__);
+        goto error;
+    }
+
+    if (conn->storageDriver && conn->storageDriver->volAbortJob) {
+        int ret;
+        ret = conn->storageDriver->volAbortJob(vol, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(vol->conn);
+    return -1;
+}
+
+/**
+ * virNodeNumOfDevices:
+ * @conn: pointer to the hypervisor connection
+ * @cap: capability name
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Provides the number of node devices.
+ *
+ * If the optional 'cap'  argument is non-NULL, then the count
+ * will be restricted to devices with the specified capability
+ *
+ * Returns the number of node devices or -1 in case of error
+ */
+int
+virNodeNumOfDevices(virConnectPtr conn, const char *cap, unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, cap=%s, flags=%x", conn, NULLSTR(cap), flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECT(conn)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    if (conn->deviceMonitor && conn->deviceMonitor->numOfDevices) {
+        int ret;
+        ret = conn->deviceMonitor->numOfDevices(conn, cap, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
+/**
+ * virConnectListAllNodeDevices:
+ * @conn: Pointer to the hypervisor connection.
+ * @devices: Pointer to a variable to store the array containing the node
+ *           device objects or NULL if the list is not required (just returns
+ *           number of node devices).
+ * @flags: bitwise-OR of virConnectListAllNodeDevices.
+ *
+ * Collect the list of node devices, and allocate an array to store those
+ * objects.
  *
  * Normally, all node devices are returned; however, @flags can be used to
  * filter the results for a smaller list of targeted node devices.  The valid
@@ -15859,6 +16837,183 @@ error:
 }
 
 
+/**
+ * virStreamRecvFlags:
+ * @stream: pointer to the stream object
+ * @data: buffer to read into from stream
+ * @nbytes: size of @data buffer
+ * @flags: bitwise-OR of virStreamRecvFlagsValues
+ *
+ * Reads a series of bytes from the stream, just like
+ * virStreamRecv. For a sparse stream, such as one set up by
+ * virStorageVolDownload with VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM,
+ * holes in the data are transparently returned as zero bytes,
+ * unless @flags contains VIR_STREAM_RECV_STOP_AT_HOLE. In that
+ * case the read stops short of a hole, and once the stream is
+ * positioned at the start of a hole this function returns -3,
+ * after which the caller should use virStreamRecvHole to learn
+ * the size of the hole and skip over it. Streams which cannot
+ * contain holes never return -3.
+ *
+ * Returns the number of bytes read, which may be less
+ * than requested, 0 when the end of the stream is reached,
+ * -1 upon error, -2 if there is no data pending to be read &
+ * the stream is marked as non-blocking, or -3 if the stream
+ * is positioned at a hole and VIR_STREAM_RECV_STOP_AT_HOLE
+ * was requested.
+ */
+int virStreamRecvFlags(virStreamPtr stream,
+                       char *data,
+                       size_t nbytes,
+                       unsigned int flags)
+{
+    VIR_DEBUG("stream=%p, data=%p, nbytes=%zi, flags=%x",
+              stream, data, nbytes, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_STREAM(stream)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    virCheckNonNullArgGoto(data, error);
+
+    if (stream->driver &&
+        stream->driver->streamRecvFlags) {
+        int ret;
+        ret = (stream->driver->streamRecvFlags)(stream, data, nbytes, flags);
+        if (ret == -2 || ret == -3)
+            return ret;
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    /* A stream driver without hole support never has any
+     * holes to stop at, so a plain read is all that's needed */
+    if (stream->driver &&
+        stream->driver->streamRecv) {
+        int ret;
+        virCheckFlagsGoto(VIR_STREAM_RECV_STOP_AT_HOLE, error);
+        ret = (stream->driver->streamRecv)(stream, data, nbytes);
+        if (ret == -2)
+            return -2;
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(stream->conn);
+    return -1;
+}
+
+
+/**
+ * virStreamSendHole:
+ * @stream: pointer to the stream object
+ * @length: number of bytes to skip
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Sends a hole of @length bytes down a sparse stream, in place of
+ * that many zero bytes. The receiving end punches a hole or seeks
+ * over the region instead of writing out the zeros. This is only
+ * valid on streams set up for sparse transfer, such as those passed
+ * to virStorageVolUpload with VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM.
+ *
+ * Returns 0 on success, -1 upon error, at which time the stream
+ * will be marked as aborted, and the caller should now release
+ * the stream with virStreamFree.
+ */
+int virStreamSendHole(virStreamPtr stream,
+                      long long length,
+                      unsigned int flags)
+{
+    VIR_DEBUG("stream=%p, length=%lld, flags=%x", stream, length, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_STREAM(stream)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    if (length < 0) {
+        virReportInvalidArg(length,
+                            _("length in %s must not be negative"),
+                            __FUNCTION__);
+        goto error;
+    }
+
+    if (stream->driver &&
+        stream->driver->streamSendHole) {
+        int ret;
+        ret = (stream->driver->streamSendHole)(stream, length, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(stream->conn);
+    return -1;
+}
+
+
+/**
+ * virStreamRecvHole:
+ * @stream: pointer to the stream object
+ * @length: filled with the size of the hole
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Consumes the hole the stream is positioned at, as indicated
+ * by virStreamRecvFlags returning -3, storing its size in @length.
+ * The next virStreamRecvFlags call returns the data following
+ * the hole.
+ *
+ * Returns 0 on success, -1 upon error, including when the stream
+ * is not positioned at a hole.
+ */
+int virStreamRecvHole(virStreamPtr stream,
+                      long long *length,
+                      unsigned int flags)
+{
+    VIR_DEBUG("stream=%p, length=%p, flags=%x", stream, length, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_STREAM(stream)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    virCheckNonNullArgGoto(length, error);
+
+    if (stream->driver &&
+        stream->driver->streamRecvHole) {
+        int ret;
+        ret = (stream->driver->streamRecvHole)(stream, length, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(stream->conn);
+    return -1;
+}
+
+
 /**
  * virStreamSendAll:
  * @stream: pointer to the stream object
@@ -17510,6 +18665,103 @@ error:
     return -1;
 }
 
+/**
+ * virDomainMigrateGetCompressionCache:
+ * @domain: a domain object
+ * @cacheSize: return value of current size of the cache (in bytes)
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Gets current size of the cache (in bytes) used for compressing repeatedly
+ * transferred memory pages during live migration.
+ *
+ * Returns 0 in case of success, -1 otherwise.
+ */
+int
+virDomainMigrateGetCompressionCache(virDomainPtr domain,
+                                    unsigned long long *cacheSize,
+                                    unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "cacheSize=%p, flags=%x", cacheSize, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_DOMAIN(domain)) {
+        virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    conn = domain->conn;
+
+    virCheckNonNullArgGoto(cacheSize, error);
+
+    if (conn->driver->domainMigrateGetCompressionCache) {
+        if (conn->driver->domainMigrateGetCompressionCache(domain, cacheSize,
+                                                           flags) < 0)
+            goto error;
+        return 0;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
+/**
+ * virDomainMigrateSetCompressionCache:
+ * @domain: a domain object
+ * @cacheSize: size of the cache (in bytes) used for compression
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Sets size of the cache (in bytes) used for compressing repeatedly
+ * transferred memory pages during live migration, that is when the
+ * VIR_MIGRATE_COMPRESSED flag is used.  It's supposed to be called while
+ * the domain is being live-migrated as a reaction to migration progress
+ * and increasing number of compression cache misses obtained from
+ * virConnectGetAllDomainStats, or before the migration starts.  The
+ * hypervisor may round the size to its own granularity.
+ *
+ * Returns 0 in case of success, -1 otherwise.
+ */
+int
+virDomainMigrateSetCompressionCache(virDomainPtr domain,
+                                    unsigned long long cacheSize,
+                                    unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(domain, "cacheSize=%llu, flags=%x", cacheSize, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_DOMAIN(domain)) {
+        virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    conn = domain->conn;
+    if (conn->flags & VIR_CONNECT_RO) {
+        virLibDomainError(VIR_ERR_OPERATION_DENIED, __FUNCTION__);
+        goto error;
+    }
+
+    if (conn->driver->domainMigrateSetCompressionCache) {
+        if (conn->driver->domainMigrateSetCompressionCache(domain, cacheSize,
+                                                           flags) < 0)
+            goto error;
+        return 0;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
 /**
  * virConnectDomainEventRegisterAny:
  * @conn: pointer to the connection
@@ -17917,7 +19169,8 @@ virDomainSnapshotGetConnect(virDomainSnapshotPtr snapshot)
  * is not paused while creating the snapshot. This increases the size
  * of the memory dump file, but reduces downtime of the guest while
  * taking the snapshot. Some hypervisors only support this flag during
- * external checkpoints.
+ * external checkpoints. With qemu, the domain is then only paused for
+ * the end of the memory transfer and the disk snapshots.
  *
  * If @flags includes VIR_DOMAIN_SNAPSHOT_CREATE_DISK_ONLY, then the
  * snapshot will be limited to the disks described in @xmlDesc, and no
@@ -19617,6 +20870,74 @@ error:
 }
 
 
+/**
+ * virDomainBlockFlatten:
+ * @dom: pointer to domain object
+ * @bandwidth: (optional) aggregate bandwidth limit in MiB/s
+ * @flags: bitwise-OR of virDomainBlockFlattenFlags
+ *
+ * Shorten the backing file chain of every disk of a running domain at
+ * once, for example to get rid of the overlays left behind by external
+ * disk snapshots.  By default, the whole backing chain of each disk is
+ * pulled into its active image, as virDomainBlockPull() would do.  If
+ * @flags contains VIR_DOMAIN_BLOCK_FLATTEN_COMMIT, everything below the
+ * active image is committed into the bottom of the chain instead, as
+ * virDomainBlockCommit() would do with @top set to the immediate backing
+ * file of the active image; disks with fewer than two backing files are
+ * left alone in that case.
+ *
+ * One block job is started for each disk that has a backing chain, and
+ * all of them run concurrently.  Unlike the single disk APIs, this call
+ * only returns once every job has finished.  Meanwhile the operation is
+ * reported as a domain job: virDomainGetJobInfo() shows the combined
+ * progress of all disks, and virDomainAbortJob() cancels every job that
+ * is still running.  Block job events are still raised for each disk.
+ *
+ * The @bandwidth limit (in MiB/s) applies to all jobs together, and is
+ * shared evenly between the jobs that are still running.  If set to 0,
+ * the hypervisor default is used for each job.
+ *
+ * Returns 0 if every disk was flattened, -1 on failure or if the
+ * operation was aborted, in which case some disks may already have
+ * been flattened.
+ */
+int virDomainBlockFlatten(virDomainPtr dom, unsigned long bandwidth,
+                          unsigned int flags)
+{
+    virConnectPtr conn;
+
+    VIR_DOMAIN_DEBUG(dom, "bandwidth=%lu, flags=%x", bandwidth, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_DOMAIN(dom)) {
+        virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    conn = dom->conn;
+
+    if (dom->conn->flags & VIR_CONNECT_RO) {
+        virLibDomainError(VIR_ERR_OPERATION_DENIED, __FUNCTION__);
+        goto error;
+    }
+
+    if (conn->driver->domainBlockFlatten) {
+        int ret;
+        ret = conn->driver->domainBlockFlatten(dom, bandwidth, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibDomainError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(dom->conn);
+    return -1;
+}
+
+
 /**
  * virDomainOpenGraphics:
  * @dom: pointer to domain object
@@ -20424,3 +21745,150 @@ error:
     virDispatchError(dom->conn);
     return -1;
 }
+
+/*
+ * Checks the NULL terminated list of domains passed to one of the
+ * virDomainList* APIs, and returns the connection they all belong to
+ * or NULL with an error reported
+ */
+static virConnectPtr
+virDomainListGetConnect(virDomainPtr *doms,
+                        unsigned int *ndoms)
+{
+    virConnectPtr conn = NULL;
+    unsigned int i;
+
+    if (!doms || !doms[0]) {
+        virLibDomainError(VIR_ERR_INVALID_ARG, __FUNCTION__);
+        return NULL;
+    }
+
+    for (i = 0 ; doms[i] ; i++) {
+        if (!VIR_IS_DOMAIN(doms[i])) {
+            virLibDomainError(VIR_ERR_INVALID_DOMAIN, __FUNCTION__);
+            return NULL;
+        }
+        if (!conn) {
+            conn = doms[i]->conn;
+        } else if (doms[i]->conn != conn) {
+            virLibConnError(VIR_ERR_INVALID_ARG,
+                            _("domains must all be on the same connection"));
+            return NULL;
+        }
+    }
+
+    *ndoms = i;
+    return conn;
+}
+
+/**
+ * virDomainListFSFreeze:
+ * @doms: NULL terminated list of domains
+ * @timeout: seconds allowed for the whole operation
+ * @flags: extra flags, not used yet, so callers should always pass 0
+ *
+ * Freezes the file systems of all the domains in @doms, which must
+ * belong to the same connection, through their guest agents. The
+ * domains are frozen in parallel rather than one after the other, so
+ * that a consistent backup of a set of guests can be taken while they
+ * are all frozen. Each domain must have a guest agent.
+ *
+ * Either all the domains are frozen, or none is: if a guest fails to
+ * freeze within @timeout seconds, those already frozen are thawed
+ * again and the call fails.
+ *
+ * Use virDomainListFSThaw() once the backup is taken.
+ *
+ * Returns the number of domains frozen on success, -1 otherwise.
+ */
+int
+virDomainListFSFreeze(virDomainPtr *doms,
+                      unsigned int timeout,
+                      unsigned int flags)
+{
+    virConnectPtr conn;
+    unsigned int ndoms = 0;
+
+    VIR_DEBUG("doms=%p, timeout=%u, flags=%x", doms, timeout, flags);
+
+    virResetLastError();
+
+    if (!(conn = virDomainListGetConnect(doms, &ndoms))) {
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    if (conn->flags & VIR_CONNECT_RO) {
+        virLibConnError(VIR_ERR_OPERATION_DENIED, __FUNCTION__);
+        goto error;
+    }
+
+    virCheckNonZeroArgGoto(timeout, error);
+
+    if (conn->driver->domainListFSFreeze) {
+        int ret = conn->driver->domainListFSFreeze(doms, ndoms,
+                                                   timeout, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
+/**
+ * virDomainListFSThaw:
+ * @doms: NULL terminated list of domains
+ * @timeout: seconds allowed for the whole operation
+ * @flags: extra flags, not used yet, so callers should always pass 0
+ *
+ * Thaws the file systems of all the domains in @doms, which must
+ * belong to the same connection, through their guest agents, in
+ * parallel. A domain failing to thaw does not stop the others from
+ * being thawed.
+ *
+ * Returns the number of domains thawed if all of them were, -1
+ * otherwise.
+ */
+int
+virDomainListFSThaw(virDomainPtr *doms,
+                    unsigned int timeout,
+                    unsigned int flags)
+{
+    virConnectPtr conn;
+    unsigned int ndoms = 0;
+
+    VIR_DEBUG("doms=%p, timeout=%u, flags=%x", doms, timeout, flags);
+
+    virResetLastError();
+
+    if (!(conn = virDomainListGetConnect(doms, &ndoms))) {
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    if (conn->flags & VIR_CONNECT_RO) {
+        virLibConnError(VIR_ERR_OPERATION_DENIED, __FUNCTION__);
+        goto error;
+    }
+
+    virCheckNonZeroArgGoto(timeout, error);
+
+    if (conn->driver->domainListFSThaw) {
+        int ret = conn->driver->domainListFSThaw(doms, ndoms,
+                                                 timeout, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(conn);
+    return -1;
+}
@@ -37,6 +37,7 @@ int virStateInitialize(bool privileged,
 int virStateCleanup(void);
 int virStateReload(void);
 int virStateStop(void);
+int virStatePreExecRestart(void);
 # endif
 
 /* Feature detection.  This is a libvirt-private interface for determining
@@ -110,6 +111,24 @@ enum {
      * Support for offline migration.
      */
     VIR_DRV_FEATURE_MIGRATION_OFFLINE = 12,
+
+    /*
+     * Remote party can restrict domain events to a single domain
+     * before sending them (REMOTE_PROC_DOMAIN_EVENTS_REGISTER_DOMAIN).
+     */
+    VIR_DRV_FEATURE_REMOTE_EVENT_FILTER = 13,
+
+    /*
+     * Remote party can exchange compressed messages. Asking the server
+     * also tells it that the client can decompress its replies.
+     */
+    VIR_DRV_FEATURE_PROGRAM_COMPRESSION = 14,
+
+    /*
+     * Remote party limits stream data sent to the client to the credit
+     * the client grants with VIR_NET_STREAM_CREDIT packets.
+     */
+    VIR_DRV_FEATURE_STREAM_CREDIT = 15,
 };
 
 
@@ -84,6 +84,10 @@ struct _libxlDomainObjPrivate {
     /* per domain libxl ctx */
     libxl_ctx *ctx;
     libxl_evgen_domain_death *deathW;
+
+    /* Set while a create, save or destroy runs with the domain unlocked */
+    bool job;
+    virCond jobCond;
 };
 
 # define LIBXL_SAVE_MAGIC "libvirt-xml\n \0 \r"
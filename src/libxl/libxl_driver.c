@@ -45,6 +45,7 @@
 #include "xen_xm.h"
 #include "virtypedparam.h"
 #include "viruri.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_LIBXL
 
@@ -59,6 +60,9 @@
 /* Number of Xen scheduler parameters */
 #define XEN_SCHED_CREDIT_NPARAM   2
 
+/* Give up waiting for another job on the same domain after 30s */
+#define LIBXL_JOB_WAIT_TIME (1000ull * 30)
+
 struct libxlOSEventHookFDInfo {
     libxlDomainObjPrivatePtr priv;
     void *xl_priv;
@@ -262,6 +266,11 @@ libxlDomainObjPrivateAlloc(void)
     if (VIR_ALLOC(priv) < 0)
         return NULL;
 
+    if (virCondInit(&priv->jobCond) < 0) {
+        VIR_FREE(priv);
+        return NULL;
+    }
+
     libxl_ctx_alloc(&priv->ctx, LIBXL_VERSION, 0, libxl_driver->logger);
     priv->deathW = NULL;
     libxl_osevent_register_hooks(priv->ctx, &libxl_event_callbacks, priv);
@@ -280,6 +289,7 @@ libxlDomainObjPrivateFree(void *data)
     }
 
     libxl_ctx_free(priv->ctx);
+    ignore_value(virCondDestroy(&priv->jobCond));
     VIR_FREE(priv);
 }
 
@@ -291,6 +301,164 @@ libxlDomainEventQueue(libxlDriverPrivatePtr driver, virDomainEventPtr event)
     virDomainEventStateQueue(driver->domainEventState, event);
 }
 
+/*
+ * Acquire the job on a domain, which allows libxlDomainObjEnterLibxl to
+ * drop the driver and domain locks while libxenlight creates, saves or
+ * destroys it.  Must be called with both the driver and @vm locked; they
+ * are released while waiting for the job of another thread to finish
+ * and are locked again on return.
+ */
+static int
+libxlDomainObjBeginJobWithDriver(libxlDriverPrivatePtr driver,
+                                 virDomainObjPtr vm)
+{
+    libxlDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long now;
+    int ret = -1;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    virObjectRef(vm);
+    libxlDriverUnlock(driver);
+
+    while (priv->job) {
+        if (virCondWaitUntil(&priv->jobCond, &vm->lock,
+                             now + LIBXL_JOB_WAIT_TIME) < 0) {
+            if (errno == ETIMEDOUT)
+                virReportError(VIR_ERR_OPERATION_TIMEOUT, "%s",
+                               _("cannot acquire state change lock"));
+            else
+                virReportSystemError(errno, "%s",
+                                     _("cannot acquire job mutex"));
+            goto cleanup;
+        }
+    }
+
+    priv->job = true;
+    ret = 0;
+
+cleanup:
+    virDomainObjUnlock(vm);
+    libxlDriverLock(driver);
+    virDomainObjLock(vm);
+    if (ret < 0)
+        virObjectUnref(vm);
+    return ret;
+}
+
+/*
+ * Release the job on a locked domain.  Returns false if this dropped
+ * the last reference to @vm, which must not be used afterwards.
+ */
+static bool
+libxlDomainObjEndJob(virDomainObjPtr vm)
+{
+    libxlDomainObjPrivatePtr priv = vm->privateData;
+
+    priv->job = false;
+    virCondBroadcast(&priv->jobCond);
+    return virObjectUnref(vm);
+}
+
+/*
+ * A libxenlight asynchronous operation.  Its completion callback runs
+ * from the event loop, or from within the call which started it, so it
+ * only ever takes the lock of the operation itself.
+ */
+typedef struct _libxlAsyncOp libxlAsyncOp;
+typedef libxlAsyncOp *libxlAsyncOpPtr;
+struct _libxlAsyncOp {
+    virMutex lock;
+    virCond cond;
+    bool entered;
+    bool done;
+    int rc;
+    libxl_asyncop_how how;
+};
+
+static void
+libxlAsyncOpCallback(libxl_ctx *ctx ATTRIBUTE_UNUSED,
+                     int rc,
+                     void *for_callback)
+{
+    libxlAsyncOpPtr op = for_callback;
+
+    virMutexLock(&op->lock);
+    op->rc = rc;
+    op->done = true;
+    virCondSignal(&op->cond);
+    virMutexUnlock(&op->lock);
+}
+
+/*
+ * Prepare to call into libxenlight for a long running operation on
+ * @vm, which must be locked along with the driver.  If the caller holds
+ * the job on @vm both locks are released and the returned ao_how makes
+ * the operation complete through libvirt's event loop.  Otherwise,
+ * e.g. when called from the event loop itself, nothing is unlocked and
+ * NULL is returned so the operation runs synchronously.  Either way the
+ * result must be passed to libxlDomainObjExitLibxl.
+ */
+static libxl_asyncop_how *
+libxlDomainObjEnterLibxl(libxlDriverPrivatePtr driver,
+                         virDomainObjPtr vm,
+                         libxlAsyncOpPtr op)
+{
+    libxlDomainObjPrivatePtr priv = vm->privateData;
+
+    memset(op, 0, sizeof(*op));
+
+    if (!priv->job)
+        return NULL;
+
+    if (virMutexInit(&op->lock) < 0)
+        return NULL;
+    if (virCondInit(&op->cond) < 0) {
+        virMutexDestroy(&op->lock);
+        return NULL;
+    }
+
+    op->entered = true;
+    op->how.callback = libxlAsyncOpCallback;
+    op->how.u.for_callback = op;
+
+    virDomainObjUnlock(vm);
+    libxlDriverUnlock(driver);
+    return &op->how;
+}
+
+/*
+ * Wait for an operation started after libxlDomainObjEnterLibxl, given
+ * the return value @rc of the libxenlight call which started it, and
+ * lock the driver and @vm again.  Returns the result of the operation.
+ */
+static int
+libxlDomainObjExitLibxl(libxlDriverPrivatePtr driver,
+                        virDomainObjPtr vm,
+                        libxlAsyncOpPtr op,
+                        int rc)
+{
+    if (!op->entered)
+        return rc;
+
+    /* A failure to start the operation means its callback won't run */
+    if (rc == 0) {
+        virMutexLock(&op->lock);
+        while (!op->done)
+            ignore_value(virCondWait(&op->cond, &op->lock));
+        rc = op->rc;
+        virMutexUnlock(&op->lock);
+    }
+
+    ignore_value(virCondDestroy(&op->cond));
+    virMutexDestroy(&op->lock);
+
+    libxlDriverLock(driver);
+    virDomainObjLock(vm);
+    return rc;
+}
+
 static void
 libxlAutostartDomain(void *payload, const void *name ATTRIBUTE_UNUSED,
                      void *opaque)
@@ -499,7 +667,9 @@ libxlVmCleanup(libxlDriverPrivatePtr driver,
 /*
  * Reap a domain from libxenlight.
  *
- * virDomainObjPtr should be locked on invocation
+ * The driver and virDomainObjPtr should be locked on invocation.  If the
+ * caller holds the job on the domain, both are unlocked while libxenlight
+ * destroys it.
  */
 static int
 libxlVmReap(libxlDriverPrivatePtr driver,
@@ -507,10 +677,16 @@ libxlVmReap(libxlDriverPrivatePtr driver,
             virDomainShutoffReason reason)
 {
     libxlDomainObjPrivatePtr priv = vm->privateData;
+    int domid = vm->def->id;
+    libxl_asyncop_how *how;
+    libxlAsyncOp op;
+    int rc;
 
-    if (libxl_domain_destroy(priv->ctx, vm->def->id, NULL) < 0) {
+    how = libxlDomainObjEnterLibxl(driver, vm, &op);
+    rc = libxl_domain_destroy(priv->ctx, domid, how);
+    if (libxlDomainObjExitLibxl(driver, vm, &op, rc) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Unable to cleanup domain %d"), vm->def->id);
+                       _("Unable to cleanup domain %d"), domid);
         return -1;
     }
 
@@ -525,12 +701,21 @@ static void libxlEventHandler(void *data, const libxl_event *event)
 {
     libxlDriverPrivatePtr driver = libxl_driver;
     virDomainObjPtr vm = data;
+    libxlDomainObjPrivatePtr priv = vm->privateData;
     virDomainEventPtr dom_event = NULL;
 
     libxlDriverLock(driver);
     virDomainObjLock(vm);
     libxlDriverUnlock(driver);
 
+    /* The thread holding the job is about to change the domain's state
+     * anyway, and reaping it from here would race with that */
+    if (priv->job) {
+        VIR_DEBUG("Ignoring event %d for domain %d while it has a job",
+                  event->type, event->domid);
+        goto cleanup;
+    }
+
     if (event->type == LIBXL_EVENT_TYPE_DOMAIN_SHUTDOWN) {
         virDomainShutoffReason reason;
 
@@ -698,7 +883,9 @@ libxlFreeMem(libxlDomainObjPrivatePtr priv, libxl_domain_config *d_config)
 /*
  * Start a domain through libxenlight.
  *
- * virDomainObjPtr should be locked on invocation
+ * The driver and virDomainObjPtr should be locked on invocation.  If the
+ * caller holds the job on the domain, both are unlocked while libxenlight
+ * builds it.
  */
 static int
 libxlVmStart(libxlDriverPrivatePtr driver, virDomainObjPtr vm,
@@ -714,6 +901,8 @@ libxlVmStart(libxlDriverPrivatePtr driver, virDomainObjPtr vm,
     char *managed_save_path = NULL;
     int managed_save_fd = -1;
     libxlDomainObjPrivatePtr priv = vm->privateData;
+    libxl_asyncop_how *how;
+    libxlAsyncOp op;
 
     /* If there is a managed saved state restore it instead of starting
      * from scratch. The old state is removed once the restoring succeeded. */
@@ -768,14 +957,15 @@ libxlVmStart(libxlDriverPrivatePtr driver, virDomainObjPtr vm,
         goto error;
     }
 
-    /* use as synchronous operations => ao_how = NULL and no intermediate reports => ao_progress = NULL */
-
+    /* no intermediate reports => ao_progress = NULL */
+    how = libxlDomainObjEnterLibxl(driver, vm, &op);
     if (restore_fd < 0)
         ret = libxl_domain_create_new(priv->ctx, &d_config,
-                                      &domid, NULL, NULL);
+                                      &domid, how, NULL);
     else
         ret = libxl_domain_create_restore(priv->ctx, &d_config, &domid,
-                                          restore_fd, NULL, NULL);
+                                          restore_fd, how, NULL);
+    ret = libxlDomainObjExitLibxl(driver, vm, &op, ret);
 
     if (ret) {
         if (restore_fd < 0)
@@ -1298,9 +1488,16 @@ libxlDomainCreateXML(virConnectPtr conn, const char *xml,
         goto cleanup;
     def = NULL;
 
+    if (libxlDomainObjBeginJobWithDriver(driver, vm) < 0) {
+        virDomainRemoveInactive(&driver->domains, vm);
+        vm = NULL;
+        goto cleanup;
+    }
+
     if (libxlVmStart(driver, vm, (flags & VIR_DOMAIN_START_PAUSED) != 0,
                      -1) < 0) {
-        virDomainRemoveInactive(&driver->domains, vm);
+        if (libxlDomainObjEndJob(vm))
+            virDomainRemoveInactive(&driver->domains, vm);
         vm = NULL;
         goto cleanup;
     }
@@ -1309,6 +1506,9 @@ libxlDomainCreateXML(virConnectPtr conn, const char *xml,
     if (dom)
         dom->id = vm->def->id;
 
+    if (!libxlDomainObjEndJob(vm))
+        vm = NULL;
+
 cleanup:
     virDomainDefFree(def);
     if (vm)
@@ -1628,10 +1828,13 @@ libxlDomainDestroyFlags(virDomainPtr dom,
         goto cleanup;
     }
 
+    if (libxlDomainObjBeginJobWithDriver(driver, vm) < 0)
+        goto cleanup;
+
     if (!virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID,
                        "%s", _("Domain is not running"));
-        goto cleanup;
+        goto endjob;
     }
 
     event = virDomainEventNewFromObj(vm,VIR_DOMAIN_EVENT_STOPPED,
@@ -1640,16 +1843,19 @@ libxlDomainDestroyFlags(virDomainPtr dom,
     if (libxlVmReap(driver, vm, VIR_DOMAIN_SHUTOFF_DESTROYED) != 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Failed to destroy domain '%d'"), dom->id);
-        goto cleanup;
+        goto endjob;
     }
 
-    if (!vm->persistent) {
+    ret = 0;
+
+endjob:
+    if (!libxlDomainObjEndJob(vm)) {
+        vm = NULL;
+    } else if (ret == 0 && !vm->persistent) {
         virDomainRemoveInactive(&driver->domains, vm);
         vm = NULL;
     }
 
-    ret = 0;
-
 cleanup:
     if (vm)
         virDomainObjUnlock(vm);
@@ -1916,7 +2122,8 @@ libxlDomainGetState(virDomainPtr dom,
 }
 
 /* This internal function expects the driver lock to already be held on
- * entry and the vm must be active. */
+ * entry, the job to be held on the vm and the vm to be active. Transient
+ * domains are left for the caller to remove once the job has ended. */
 static int
 libxlDoDomainSave(libxlDriverPrivatePtr driver, virDomainObjPtr vm,
                   const char *to)
@@ -1926,7 +2133,11 @@ libxlDoDomainSave(libxlDriverPrivatePtr driver, virDomainObjPtr vm,
     virDomainEventPtr event = NULL;
     char *xml = NULL;
     uint32_t xml_len;
+    libxl_asyncop_how *how;
+    libxlAsyncOp op;
+    int domid = vm->def->id;
     int fd;
+    int rc;
     int ret = -1;
 
     if (virDomainObjGetState(vm, NULL) == VIR_DOMAIN_PAUSED) {
@@ -1964,10 +2175,12 @@ libxlDoDomainSave(libxlDriverPrivatePtr driver, virDomainObjPtr vm,
         goto cleanup;
     }
 
-    if (libxl_domain_suspend(priv->ctx, vm->def->id, fd, 0, NULL) != 0) {
+    how = libxlDomainObjEnterLibxl(driver, vm, &op);
+    rc = libxl_domain_suspend(priv->ctx, domid, fd, 0, how);
+    if (libxlDomainObjExitLibxl(driver, vm, &op, rc) != 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Failed to save domain '%d' with libxenlight"),
-                       vm->def->id);
+                       domid);
         goto cleanup;
     }
 
@@ -1981,12 +2194,6 @@ libxlDoDomainSave(libxlDriverPrivatePtr driver, virDomainObjPtr vm,
     }
 
     vm->hasManagedSave = true;
-
-    if (!vm->persistent) {
-        virDomainRemoveInactive(&driver->domains, vm);
-        vm = NULL;
-    }
-
     ret = 0;
 
 cleanup:
@@ -2024,13 +2231,24 @@ libxlDomainSaveFlags(virDomainPtr dom, const char *to, const char *dxml,
         goto cleanup;
     }
 
+    if (libxlDomainObjBeginJobWithDriver(driver, vm) < 0)
+        goto cleanup;
+
     if (!virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID, "%s", _("Domain is not running"));
-        goto cleanup;
+        goto endjob;
     }
 
     ret = libxlDoDomainSave(driver, vm, to);
 
+endjob:
+    if (!libxlDomainObjEndJob(vm)) {
+        vm = NULL;
+    } else if (ret == 0 && !vm->persistent) {
+        virDomainRemoveInactive(&driver->domains, vm);
+        vm = NULL;
+    }
+
 cleanup:
     if (vm)
         virDomainObjUnlock(vm);
@@ -2076,8 +2294,19 @@ libxlDomainRestoreFlags(virConnectPtr conn, const char *from,
 
     def = NULL;
 
-    if ((ret = libxlVmStart(driver, vm, false, fd)) < 0 &&
-        !vm->persistent) {
+    if (libxlDomainObjBeginJobWithDriver(driver, vm) < 0) {
+        if (!vm->persistent) {
+            virDomainRemoveInactive(&driver->domains, vm);
+            vm = NULL;
+        }
+        goto cleanup;
+    }
+
+    ret = libxlVmStart(driver, vm, false, fd);
+
+    if (!libxlDomainObjEndJob(vm)) {
+        vm = NULL;
+    } else if (ret < 0 && !vm->persistent) {
         virDomainRemoveInactive(&driver->domains, vm);
         vm = NULL;
     }
@@ -2212,24 +2441,31 @@ libxlDomainManagedSave(virDomainPtr dom, unsigned int flags)
         goto cleanup;
     }
 
+    if (libxlDomainObjBeginJobWithDriver(driver, vm) < 0)
+        goto cleanup;
+
     if (!virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID, "%s", _("Domain is not running"));
-        goto cleanup;
+        goto endjob;
     }
     if (!vm->persistent) {
         virReportError(VIR_ERR_OPERATION_INVALID, "%s",
                        _("cannot do managed save for transient domain"));
-        goto cleanup;
+        goto endjob;
     }
 
     name = libxlDomainManagedSavePath(driver, vm);
     if (name == NULL)
-        goto cleanup;
+        goto endjob;
 
     VIR_INFO("Saving state to %s", name);
 
     ret = libxlDoDomainSave(driver, vm, name);
 
+endjob:
+    if (!libxlDomainObjEndJob(vm))
+        vm = NULL;
+
 cleanup:
     if (vm)
         virDomainObjUnlock(vm);
@@ -2817,14 +3053,21 @@ libxlDomainCreateWithFlags(virDomainPtr dom,
         goto cleanup;
     }
 
+    if (libxlDomainObjBeginJobWithDriver(driver, vm) < 0)
+        goto cleanup;
+
     if (virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID,
                        "%s", _("Domain is already running"));
-        goto cleanup;
+        goto endjob;
     }
 
     ret = libxlVmStart(driver, vm, (flags & VIR_DOMAIN_START_PAUSED) != 0, -1);
 
+endjob:
+    if (!libxlDomainObjEndJob(vm))
+        vm = NULL;
+
 cleanup:
     if (vm)
         virDomainObjUnlock(vm);
@@ -2913,48 +3156,56 @@ libxlDomainUndefineFlags(virDomainPtr dom,
         goto cleanup;
     }
 
+    /* Don't remove a domain which is being started */
+    if (libxlDomainObjBeginJobWithDriver(driver, vm) < 0)
+        goto cleanup;
+
     if (!vm->persistent) {
         virReportError(VIR_ERR_OPERATION_INVALID,
                        "%s", _("cannot undefine transient domain"));
-        goto cleanup;
+        goto endjob;
     }
 
     name = libxlDomainManagedSavePath(driver, vm);
     if (name == NULL)
-        goto cleanup;
+        goto endjob;
 
     if (virFileExists(name)) {
         if (flags & VIR_DOMAIN_UNDEFINE_MANAGED_SAVE) {
             if (unlink(name) < 0) {
                 virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                                _("Failed to remove domain managed save image"));
-                goto cleanup;
+                goto endjob;
             }
         } else {
             virReportError(VIR_ERR_OPERATION_INVALID, "%s",
                            _("Refusing to undefine while domain managed "
                              "save image exists"));
-            goto cleanup;
+            goto endjob;
         }
     }
 
     if (virDomainDeleteConfig(driver->configDir,
                               driver->autostartDir,
                               vm) < 0)
-        goto cleanup;
+        goto endjob;
 
     event = virDomainEventNewFromObj(vm, VIR_DOMAIN_EVENT_UNDEFINED,
                                      VIR_DOMAIN_EVENT_UNDEFINED_REMOVED);
 
-    if (virDomainObjIsActive(vm)) {
+    if (virDomainObjIsActive(vm))
         vm->persistent = 0;
-    } else {
+
+    ret = 0;
+
+  endjob:
+    if (!libxlDomainObjEndJob(vm)) {
+        vm = NULL;
+    } else if (ret == 0 && !virDomainObjIsActive(vm)) {
         virDomainRemoveInactive(&driver->domains, vm);
         vm = NULL;
     }
 
-    ret = 0;
-
   cleanup:
     VIR_FREE(name);
     if (vm)
@@ -3970,7 +4221,7 @@ libxlListAllDomains(virConnectPtr conn,
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
 
     libxlDriverLock(driver);
-    ret = virDomainList(conn, driver->domains.objs, domains, flags);
+    ret = virDomainList(conn, &driver->domains, domains, flags);
     libxlDriverUnlock(driver);
 
     return ret;
@@ -3978,9 +4229,12 @@ libxlListAllDomains(virConnectPtr conn,
 
 
 
+static const char *libxlURISchemes[] = { "xen", NULL };
+
 static virDriver libxlDriver = {
     .no = VIR_DRV_LIBXL,
     .name = "xenlight",
+    .uriSchemes = libxlURISchemes,
     .open = libxlOpen, /* 0.9.0 */
     .close = libxlClose, /* 0.9.0 */
     .type = libxlGetType, /* 0.9.0 */
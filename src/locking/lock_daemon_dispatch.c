@@ -93,6 +93,109 @@ cleanup:
     return rv;
 }
 
+/* Release the first @n of @resources held by @owner, after a batched
+ * acquire failed part way through */
+static void
+virLockSpaceProtocolReleaseAcquired(virLockSpaceProtocolResource *resources,
+                                    size_t n,
+                                    pid_t owner)
+{
+    virErrorPtr orig_err = virSaveLastError();
+    size_t i;
+
+    for (i = 0 ; i < n ; i++) {
+        virLockSpacePtr lockspace =
+            virLockDaemonFindLockSpace(lockDaemon, resources[i].path);
+
+        if (lockspace)
+            ignore_value(virLockSpaceReleaseResource(lockspace,
+                                                     resources[i].name,
+                                                     owner));
+    }
+
+    if (orig_err) {
+        virSetError(orig_err);
+        virFreeError(orig_err);
+    }
+}
+
+
+static int
+virLockSpaceProtocolDispatchAcquireResources(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                             virNetServerClientPtr client,
+                                             virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                             virNetMessageErrorPtr rerr,
+                                             virLockSpaceProtocolAcquireResourcesArgs *args)
+{
+    int rv = -1;
+    unsigned int flags = args->flags;
+    virLockDaemonClientPtr priv =
+        virNetServerClientGetPrivateData(client);
+    size_t i;
+
+    virMutexLock(&priv->lock);
+
+    virCheckFlagsGoto(0, cleanup);
+
+    if (priv->restricted) {
+        virReportError(VIR_ERR_OPERATION_DENIED, "%s",
+                       _("lock manager connection has been restricted"));
+        goto cleanup;
+    }
+
+    if (!priv->ownerPid) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("lock owner details have not been registered"));
+        goto cleanup;
+    }
+
+    /* Either all the resources are acquired or none */
+    for (i = 0 ; i < args->resources.resources_len ; i++) {
+        virLockSpaceProtocolResource *res = &args->resources.resources_val[i];
+        virLockSpacePtr lockspace;
+        unsigned int newFlags = 0;
+
+        if (res->flags & ~(VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED |
+                           VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE)) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("unsupported flags (0x%x) for resource %s"),
+                           res->flags, res->name);
+            goto rollback;
+        }
+
+        if (!(lockspace = virLockDaemonFindLockSpace(lockDaemon, res->path))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Lockspace for path %s does not exist"),
+                           res->path);
+            goto rollback;
+        }
+
+        if (res->flags & VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED)
+            newFlags |= VIR_LOCK_SPACE_ACQUIRE_SHARED;
+        if (res->flags & VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE)
+            newFlags |= VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE;
+
+        if (virLockSpaceAcquireResource(lockspace,
+                                        res->name,
+                                        priv->ownerPid,
+                                        newFlags) < 0)
+            goto rollback;
+    }
+
+    rv = 0;
+
+cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virMutexUnlock(&priv->lock);
+    return rv;
+
+rollback:
+    virLockSpaceProtocolReleaseAcquired(args->resources.resources_val, i,
+                                        priv->ownerPid);
+    goto cleanup;
+}
+
 
 static int
 virLockSpaceProtocolDispatchCreateResource(virNetServerPtr server ATTRIBUTE_UNUSED,
@@ -346,6 +449,70 @@ cleanup:
     return rv;
 }
 
+static int
+virLockSpaceProtocolDispatchReleaseResources(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                             virNetServerClientPtr client,
+                                             virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                             virNetMessageErrorPtr rerr,
+                                             virLockSpaceProtocolReleaseResourcesArgs *args)
+{
+    int rv = -1;
+    unsigned int flags = args->flags;
+    virLockDaemonClientPtr priv =
+        virNetServerClientGetPrivateData(client);
+    virErrorPtr first_err = NULL;
+    size_t i;
+
+    virMutexLock(&priv->lock);
+
+    virCheckFlagsGoto(0, cleanup);
+
+    if (priv->restricted) {
+        virReportError(VIR_ERR_OPERATION_DENIED, "%s",
+                       _("lock manager connection has been restricted"));
+        goto cleanup;
+    }
+
+    if (!priv->ownerPid) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("lock owner details have not been registered"));
+        goto cleanup;
+    }
+
+    /* Release as much as possible, reporting the first failure */
+    for (i = 0 ; i < args->resources.resources_len ; i++) {
+        virLockSpaceProtocolResource *res = &args->resources.resources_val[i];
+        virLockSpacePtr lockspace;
+
+        if (!(lockspace = virLockDaemonFindLockSpace(lockDaemon, res->path))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Lockspace for path %s does not exist"),
+                           res->path);
+        } else if (virLockSpaceReleaseResource(lockspace,
+                                               res->name,
+                                               priv->ownerPid) == 0) {
+            continue;
+        }
+
+        if (!first_err)
+            first_err = virSaveLastError();
+    }
+
+    if (first_err) {
+        virSetError(first_err);
+        goto cleanup;
+    }
+
+    rv = 0;
+
+cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virMutexUnlock(&priv->lock);
+    virFreeError(first_err);
+    return rv;
+}
+
 
 static int
 virLockSpaceProtocolDispatchRestrict(virNetServerPtr server ATTRIBUTE_UNUSED,
@@ -698,6 +698,83 @@ error:
 }
 
 
+/*
+ * Acquire or release all resources of @lock with a single request,
+ * instead of one round trip per resource.
+ *
+ * Returns 0 on success, 1 if the resources have to be handled one
+ * by one because virtlockd predates batched requests, -1 on error
+ */
+static int
+virLockManagerLockDaemonBatchResources(virLockManagerPtr lock,
+                                       virNetClientPtr client,
+                                       virNetClientProgramPtr program,
+                                       int *counter,
+                                       bool acquire)
+{
+    virLockManagerLockDaemonPrivatePtr priv = lock->privateData;
+    virLockSpaceProtocolResource *resources = NULL;
+    virLockSpaceProtocolAcquireResourcesArgs acquireArgs;
+    virLockSpaceProtocolReleaseResourcesArgs releaseArgs;
+    virErrorPtr err;
+    size_t i;
+    int rv = -1;
+
+    if (priv->nresources > VIR_LOCK_SPACE_PROTOCOL_RESOURCES_MAX)
+        return 1;
+
+    if (VIR_ALLOC_N(resources, priv->nresources) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (i = 0 ; i < priv->nresources ; i++) {
+        resources[i].path = priv->resources[i].lockspace;
+        resources[i].name = priv->resources[i].name;
+        resources[i].flags = acquire ? priv->resources[i].flags : 0;
+    }
+
+    memset(&acquireArgs, 0, sizeof(acquireArgs));
+    memset(&releaseArgs, 0, sizeof(releaseArgs));
+
+    if (acquire) {
+        acquireArgs.resources.resources_len = priv->nresources;
+        acquireArgs.resources.resources_val = resources;
+        rv = virNetClientProgramCall(program,
+                                     client,
+                                     (*counter)++,
+                                     VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCES,
+                                     0, NULL, NULL, NULL,
+                                     (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourcesArgs, &acquireArgs,
+                                     (xdrproc_t)xdr_void, NULL);
+    } else {
+        releaseArgs.resources.resources_len = priv->nresources;
+        releaseArgs.resources.resources_val = resources;
+        rv = virNetClientProgramCall(program,
+                                     client,
+                                     (*counter)++,
+                                     VIR_LOCK_SPACE_PROTOCOL_PROC_RELEASE_RESOURCES,
+                                     0, NULL, NULL, NULL,
+                                     (xdrproc_t)xdr_virLockSpaceProtocolReleaseResourcesArgs, &releaseArgs,
+                                     (xdrproc_t)xdr_void, NULL);
+    }
+
+    /* An older virtlockd rejects the unknown procedure without
+     * touching any resource */
+    if (rv < 0 &&
+        (err = virGetLastError()) &&
+        err->code == VIR_ERR_RPC) {
+        VIR_DEBUG("Batched lease requests unsupported: %s",
+                  NULLSTR(err->message));
+        virResetLastError();
+        rv = 1;
+    }
+
+    VIR_FREE(resources);
+    return rv;
+}
+
+
 static int virLockManagerLockDaemonAcquire(virLockManagerPtr lock,
                                            const char *state ATTRIBUTE_UNUSED,
                                            unsigned int flags,
@@ -728,9 +805,17 @@ static int virLockManagerLockDaemonAcquire(virLockManagerPtr lock,
         (*fd = virNetClientDupFD(client, false)) < 0)
         goto cleanup;
 
-    if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY)) {
+    if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY) &&
+        priv->nresources) {
         size_t i;
-        for (i = 0 ; i < priv->nresources ; i++) {
+        int rc;
+
+        if ((rc = virLockManagerLockDaemonBatchResources(lock, client,
+                                                         program, &counter,
+                                                         true)) < 0)
+            goto cleanup;
+
+        for (i = 0 ; rc == 1 && i < priv->nresources ; i++) {
             virLockSpaceProtocolAcquireResourceArgs args;
 
             memset(&args, 0, sizeof(args));
@@ -773,29 +858,46 @@ static int virLockManagerLockDaemonRelease(virLockManagerPtr lock,
 {
     virNetClientPtr client = NULL;
     virNetClientProgramPtr program = NULL;
+    virLockManagerLockDaemonPrivatePtr priv = lock->privateData;
     int counter = 0;
-    virLockSpaceProtocolReleaseResourceArgs args;
     int rv = -1;
+    int rc;
+    size_t i;
 
-    memset(&args, 0, sizeof(args));
+    virCheckFlags(0, -1);
 
     if (state)
         *state = NULL;
 
+    if (!priv->nresources)
+        return 0;
+
     if (!(client = virLockManagerLockDaemonConnect(lock, &program, &counter)))
         goto cleanup;
 
-    args.flags = flags;
-
-    if (virNetClientProgramCall(program,
-                                client,
-                                counter++,
-                                VIR_LOCK_SPACE_PROTOCOL_PROC_RELEASE_RESOURCE,
-                                0, NULL, NULL, NULL,
-                                (xdrproc_t)xdr_virLockSpaceProtocolReleaseResourceArgs, &args,
-                                (xdrproc_t)xdr_void, NULL) < 0)
+    if ((rc = virLockManagerLockDaemonBatchResources(lock, client,
+                                                     program, &counter,
+                                                     false)) < 0)
         goto cleanup;
 
+    for (i = 0 ; rc == 1 && i < priv->nresources ; i++) {
+        virLockSpaceProtocolReleaseResourceArgs args;
+
+        memset(&args, 0, sizeof(args));
+
+        args.path = priv->resources[i].lockspace;
+        args.name = priv->resources[i].name;
+
+        if (virNetClientProgramCall(program,
+                                    client,
+                                    counter++,
+                                    VIR_LOCK_SPACE_PROTOCOL_PROC_RELEASE_RESOURCE,
+                                    0, NULL, NULL, NULL,
+                                    (xdrproc_t)xdr_virLockSpaceProtocolReleaseResourceArgs, &args,
+                                    (xdrproc_t)xdr_void, NULL) < 0)
+            goto cleanup;
+    }
+
     rv = 0;
 
 cleanup:
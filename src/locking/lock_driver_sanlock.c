@@ -44,6 +44,8 @@
 #include "virfile.h"
 #include "md5.h"
 #include "conf.h"
+#include "threads.h"
+#include "viratomic.h"
 
 #include "configmake.h"
 
@@ -79,6 +81,10 @@ struct _virLockManagerSanlockDriver {
 
 static virLockManagerSanlockDriver *driver = NULL;
 
+/* Set once the auto disk lease lockspace is known to be joined.
+ * Accessed atomically, since it is also read in forked children */
+static int lockspaceReady = 0;
+
 struct _virLockManagerSanlockPrivate {
     const char *vm_uri;
     char vm_name[SANLK_NAME_LEN];
@@ -189,33 +195,155 @@ static int virLockManagerSanlockLoadConfig(const char *configFile)
 /* How many times try adding a lockspace? */
 #define LOCKSPACE_RETRIES 10
 
-static int virLockManagerSanlockSetupLockspace(void)
+/*
+ * Fill @ls in for the auto disk lease lockspace, whose file path
+ * is returned in @path
+ */
+static int virLockManagerSanlockLockspaceArgs(struct sanlk_lockspace *ls,
+                                              char **path)
 {
-    int fd = -1;
-    struct stat st;
-    int rv;
-    struct sanlk_lockspace ls;
-    char *path = NULL;
-    char *dir = NULL;
-    int retries = LOCKSPACE_RETRIES;
+    memset(ls, 0, sizeof(*ls));
 
-    if (virAsprintf(&path, "%s/%s",
+    if (virAsprintf(path, "%s/%s",
                     driver->autoDiskLeasePath,
                     VIR_LOCK_MANAGER_SANLOCK_AUTO_DISK_LOCKSPACE) < 0) {
         virReportOOMError();
-        goto error;
+        return -1;
     }
 
-    memcpy(ls.name, VIR_LOCK_MANAGER_SANLOCK_AUTO_DISK_LOCKSPACE, SANLK_NAME_LEN);
-    ls.host_id = 0; /* Doesn't matter for initialization */
-    ls.flags = 0;
-    if (!virStrcpy(ls.host_id_disk.path, path, SANLK_PATH_LEN)) {
+    memcpy(ls->name, VIR_LOCK_MANAGER_SANLOCK_AUTO_DISK_LOCKSPACE, SANLK_NAME_LEN);
+    ls->host_id = 0; /* Doesn't matter for initialization */
+    ls->flags = 0;
+    if (!virStrcpy(ls->host_id_disk.path, *path, SANLK_PATH_LEN)) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Lockspace path '%s' exceeded %d characters"),
-                       path, SANLK_PATH_LEN);
-        goto error;
+                       *path, SANLK_PATH_LEN);
+        VIR_FREE(*path);
+        return -1;
+    }
+    ls->host_id_disk.offset = 0;
+
+    return 0;
+}
+
+
+/*
+ * Register the lockspace @ls with the sanlock daemon. This
+ * acquires our host ID lease, which can take many seconds.
+ */
+static int virLockManagerSanlockAddLockspace(struct sanlk_lockspace *ls,
+                                             const char *path)
+{
+    int rv;
+    int retries = LOCKSPACE_RETRIES;
+
+    /* Try to register the lockspace with the daemon.  If the lockspace
+     * is already registered, we should get EEXIST back in which case we can
+     * just carry on with life. If EINPROGRESS is returned, we have two options:
+     * either call a sanlock API that blocks us until lockspace changes state,
+     * or we can fallback to polling.
+     */
+retry:
+    if ((rv = sanlock_add_lockspace(ls, 0)) < 0) {
+        if (-rv == EINPROGRESS && --retries) {
+#ifdef HAVE_SANLOCK_INQ_LOCKSPACE
+            /* we have this function which blocks until lockspace change the
+             * state. It returns 0 if lockspace has been added, -ENOENT if it
+             * hasn't. */
+            VIR_DEBUG("Inquiring lockspace");
+            if (sanlock_inq_lockspace(ls, SANLK_INQ_WAIT) < 0)
+                VIR_DEBUG("Unable to inquire lockspace");
+#else
+            /* fall back to polling */
+            VIR_DEBUG("Sleeping for %dms", LOCKSPACE_SLEEP);
+            usleep(LOCKSPACE_SLEEP * 1000);
+#endif
+            VIR_DEBUG("Retrying to add lockspace (left %d)", retries);
+            goto retry;
+        }
+        if (-rv != EEXIST) {
+            if (rv <= -200)
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Unable to add lockspace %s: error %d"),
+                               path, rv);
+            else
+                virReportSystemError(-rv,
+                                     _("Unable to add lockspace %s"),
+                                     path);
+            return -1;
+        } else {
+            VIR_DEBUG("Lockspace %s is already registered", path);
+        }
+    } else {
+        VIR_DEBUG("Lockspace %s has been registered", path);
+    }
+
+    virAtomicIntSet(&lockspaceReady, 1);
+    return 0;
+}
+
+
+struct virLockManagerSanlockJoinData {
+    struct sanlk_lockspace ls;
+    char *path;
+};
+
+static void virLockManagerSanlockJoinLockspace(void *opaque)
+{
+    struct virLockManagerSanlockJoinData *data = opaque;
+
+    if (virLockManagerSanlockAddLockspace(&data->ls, data->path) < 0) {
+        virErrorPtr err = virGetLastError();
+        VIR_WARN("Failed to join lockspace %s, guests using it "
+                 "will try again when starting: %s",
+                 data->path, err ? err->message : _("unknown error"));
     }
-    ls.host_id_disk.offset = 0;
+
+    VIR_FREE(data->path);
+    VIR_FREE(data);
+}
+
+
+/*
+ * Make sure the auto disk lease lockspace has been joined before
+ * acquiring leases in it. This normally returns straight away once
+ * the join started at initialization has finished, but waits for it
+ * or retries it otherwise. It is usually called in the forked child
+ * starting the guest, so it must not rely on any other thread.
+ */
+static int virLockManagerSanlockWaitLockspace(void)
+{
+    struct sanlk_lockspace ls;
+    char *path = NULL;
+    int ret;
+
+    if (virAtomicIntGet(&lockspaceReady))
+        return 0;
+
+    if (virLockManagerSanlockLockspaceArgs(&ls, &path) < 0)
+        return -1;
+    ls.host_id = driver->hostID;
+
+    VIR_DEBUG("Waiting for lockspace %s", path);
+    ret = virLockManagerSanlockAddLockspace(&ls, path);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int virLockManagerSanlockSetupLockspace(void)
+{
+    int fd = -1;
+    struct stat st;
+    int rv;
+    struct sanlk_lockspace ls;
+    char *path = NULL;
+    char *dir = NULL;
+    struct virLockManagerSanlockJoinData *data = NULL;
+    virThread thread;
+
+    if (virLockManagerSanlockLockspaceArgs(&ls, &path) < 0)
+        goto error;
 
     /* Stage 1: Ensure the lockspace file exists on disk, has
      * space allocated for it and is initialized with lease
@@ -324,47 +452,28 @@ static int virLockManagerSanlockSetupLockspace(void)
     }
 
     ls.host_id = driver->hostID;
-    /* Stage 2: Try to register the lockspace with the daemon.  If the lockspace
-     * is already registered, we should get EEXIST back in which case we can
-     * just carry on with life. If EINPROGRESS is returned, we have two options:
-     * either call a sanlock API that blocks us until lockspace changes state,
-     * or we can fallback to polling.
+    /* Stage 2: Join the lockspace in the background, so that
+     * acquiring the host ID lease doesn't hold up the daemon. Guests
+     * using the lockspace wait for it when they acquire leases.
      */
-retry:
-    if ((rv = sanlock_add_lockspace(&ls, 0)) < 0) {
-        if (-rv == EINPROGRESS && --retries) {
-#ifdef HAVE_SANLOCK_INQ_LOCKSPACE
-            /* we have this function which blocks until lockspace change the
-             * state. It returns 0 if lockspace has been added, -ENOENT if it
-             * hasn't. */
-            VIR_DEBUG("Inquiring lockspace");
-            if (sanlock_inq_lockspace(&ls, SANLK_INQ_WAIT) < 0)
-                VIR_DEBUG("Unable to inquire lockspace");
-#else
-            /* fall back to polling */
-            VIR_DEBUG("Sleeping for %dms", LOCKSPACE_SLEEP);
-            usleep(LOCKSPACE_SLEEP * 1000);
-#endif
-            VIR_DEBUG("Retrying to add lockspace (left %d)", retries);
-            goto retry;
-        }
-        if (-rv != EEXIST) {
-            if (rv <= -200)
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Unable to add lockspace %s: error %d"),
-                               path, rv);
-            else
-                virReportSystemError(-rv,
-                                     _("Unable to add lockspace %s"),
-                                     path);
-            goto error;
-        } else {
-            VIR_DEBUG("Lockspace %s is already registered", path);
-        }
-    } else {
-        VIR_DEBUG("Lockspace %s has been registered", path);
+    if (VIR_ALLOC(data) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+    data->ls = ls;
+    data->path = path;
+    path = NULL;
+
+    if (virThreadCreate(&thread, false,
+                        virLockManagerSanlockJoinLockspace, data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create lockspace thread"));
+        VIR_FREE(data->path);
+        VIR_FREE(data);
+        goto error;
     }
 
+    VIR_FREE(dir);
     return 0;
 
 error_unlink:
@@ -962,9 +1071,22 @@ static int virLockManagerSanlockAcquire(virLockManagerPtr lock,
     }
 
     if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY)) {
-        VIR_DEBUG("Acquiring object %u", priv->res_count);
+        if (driver->autoDiskLease) {
+            for (i = 0 ; i < res_count ; i++) {
+                if (STREQ(res_args[i]->lockspace_name,
+                          VIR_LOCK_MANAGER_SANLOCK_AUTO_DISK_LOCKSPACE))
+                    break;
+            }
+            if (i < res_count &&
+                virLockManagerSanlockWaitLockspace() < 0)
+                goto error;
+        }
+
+        /* All the leases are acquired in one go, so that sanlock
+         * reads and writes their lease areas together */
+        VIR_DEBUG("Acquiring object %d", res_count);
         if ((rv = sanlock_acquire(sock, priv->vm_pid, 0,
-                                  priv->res_count, priv->res_args,
+                                  res_count, res_args,
                                   opt)) < 0) {
             if (rv <= -200)
                 virReportError(VIR_ERR_INTERNAL_ERROR,
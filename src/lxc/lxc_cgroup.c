@@ -176,64 +176,28 @@ static int virLXCCgroupGetMemTotal(virCgroupPtr cgroup,
 static int virLXCCgroupGetMemStat(virCgroupPtr cgroup,
                                   virLXCMeminfoPtr meminfo)
 {
-    int ret = 0;
-    FILE *statfd = NULL;
-    char *statFile = NULL;
-    char *line = NULL;
-    size_t n;
-
-    ret = virCgroupPathOfController(cgroup, VIR_CGROUP_CONTROLLER_MEMORY,
-                                    "memory.stat", &statFile);
-    if (ret != 0) {
-        virReportSystemError(-ret, "%s",
-                             _("cannot get the path of MEMORY cgroup controller"));
+    int ret;
+    virStatFileField fields[] = {
+        { "cache", 0, false },
+        { "inactive_anon", 0, false },
+        { "active_anon", 0, false },
+        { "inactive_file", 0, false },
+        { "active_file", 0, false },
+        { "unevictable", 0, false },
+    };
+
+    ret = virCgroupGetMemoryStat(cgroup, fields, ARRAY_CARDINALITY(fields));
+    if (ret < 0)
         return ret;
-    }
 
-    statfd = fopen(statFile, "r");
-    if (statfd == NULL) {
-        ret = -errno;
-        goto cleanup;
-    }
-
-    while (getline(&line, &n, statfd) > 0) {
-
-        char *value = strchr(line, ' ');
-        char *nl = value ? strchr(line, '\n') : NULL;
-        unsigned long long stat_value;
-
-        if (!value)
-            continue;
-
-        if (nl)
-            *nl = '\0';
-
-        *value = '\0';
-
-        if (virStrToLong_ull(value + 1, NULL, 10, &stat_value) < 0) {
-            ret = -EINVAL;
-            goto cleanup;
-        }
-        if (STREQ(line, "cache"))
-            meminfo->cached = stat_value >> 10;
-        else if (STREQ(line, "inactive_anon"))
-            meminfo->inactive_anon = stat_value >> 10;
-        else if (STREQ(line, "active_anon"))
-            meminfo->active_anon = stat_value >> 10;
-        else if (STREQ(line, "inactive_file"))
-            meminfo->inactive_file = stat_value >> 10;
-        else if (STREQ(line, "active_file"))
-            meminfo->active_file = stat_value >> 10;
-        else if (STREQ(line, "unevictable"))
-            meminfo->unevictable = stat_value >> 10;
-    }
-    ret = 0;
+    meminfo->cached = fields[0].value >> 10;
+    meminfo->inactive_anon = fields[1].value >> 10;
+    meminfo->active_anon = fields[2].value >> 10;
+    meminfo->inactive_file = fields[3].value >> 10;
+    meminfo->active_file = fields[4].value >> 10;
+    meminfo->unevictable = fields[5].value >> 10;
 
-cleanup:
-    VIR_FREE(line);
-    VIR_FREE(statFile);
-    VIR_FORCE_FCLOSE(statfd);
-    return ret;
+    return 0;
 }
 
 
@@ -280,6 +244,80 @@ cleanup:
 }
 
 
+int virLXCCgroupGetCpuacct(virLXCCpuacctPtr cpuacct)
+{
+    int ret;
+    virCgroupPtr cgroup;
+    char *percpu = NULL;
+    char *p;
+
+    memset(cpuacct, 0, sizeof(*cpuacct));
+
+    ret = virCgroupGetAppRoot(&cgroup);
+    if (ret < 0) {
+        virReportSystemError(-ret, "%s",
+                             _("Unable to get cgroup for container"));
+        return ret;
+    }
+
+    ret = virCgroupGetCpuacctStat(cgroup, &cpuacct->user, &cpuacct->sys);
+    if (ret < 0) {
+        virReportSystemError(-ret, "%s",
+                             _("Unable to get cpuacct cgroup stat"));
+        goto cleanup;
+    }
+
+    ret = virCgroupGetCpuacctPercpuUsage(cgroup, &percpu);
+    if (ret < 0) {
+        virReportSystemError(-ret, "%s",
+                             _("Unable to get cpuacct cgroup percpu usage"));
+        goto cleanup;
+    }
+
+    p = percpu;
+    for (;;) {
+        unsigned long long usage;
+
+        while (*p == ' ')
+            p++;
+        if (*p == '\0' || *p == '\n')
+            break;
+        if (virStrToLong_ull(p, &p, 10, &usage) < 0 ||
+            VIR_EXPAND_N(cpuacct->percpu, cpuacct->npercpu, 1) < 0) {
+            ret = -EINVAL;
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unable to parse cpuacct usage '%s'"), percpu);
+            VIR_FREE(cpuacct->percpu);
+            cpuacct->npercpu = 0;
+            goto cleanup;
+        }
+        cpuacct->percpu[cpuacct->npercpu - 1] = usage;
+    }
+
+    ret = 0;
+cleanup:
+    VIR_FREE(percpu);
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+
+int virLXCCgroupGetCpuset(char **cpus)
+{
+    int ret;
+    virCgroupPtr cgroup;
+
+    *cpus = NULL;
+
+    ret = virCgroupGetAppRoot(&cgroup);
+    if (ret < 0)
+        return ret;
+
+    ret = virCgroupGetCpusetCpus(cgroup, cpus);
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
 
 typedef struct _virLXCCgroupDevicePolicy virLXCCgroupDevicePolicy;
 typedef virLXCCgroupDevicePolicy *virLXCCgroupDevicePolicyPtr;
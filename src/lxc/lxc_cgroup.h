@@ -28,6 +28,8 @@
 
 int virLXCCgroupSetup(virDomainDefPtr def);
 int virLXCCgroupGetMeminfo(virLXCMeminfoPtr meminfo);
+int virLXCCgroupGetCpuacct(virLXCCpuacctPtr cpuacct);
+int virLXCCgroupGetCpuset(char **cpus);
 
 int
 virLXCSetupHostUsbDeviceCgroup(usbDevice *dev,
@@ -600,23 +600,32 @@ cleanup:
 static int lxcContainerMountProcFuse(virDomainDefPtr def,
                                      const char *srcprefix)
 {
-    int ret;
-    char *meminfo_path = NULL;
+    static const char *const files[] = { "meminfo", "stat", "cpuinfo" };
+    int ret = 0;
+    size_t i;
 
-    if ((ret = virAsprintf(&meminfo_path,
-                           "%s/%s/%s/meminfo",
-                           srcprefix, LXC_STATE_DIR,
-                           def->name)) < 0)
-        return ret;
+    for (i = 0; i < ARRAY_CARDINALITY(files) && ret == 0; i++) {
+        char *src = NULL;
+        char *dst = NULL;
 
-    if ((ret = mount(meminfo_path, "/proc/meminfo",
-                     NULL, MS_BIND, NULL)) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to mount %s on /proc/meminfo"),
-                             meminfo_path);
+        if ((ret = virAsprintf(&src, "%s/%s/%s/%s",
+                               srcprefix, LXC_STATE_DIR,
+                               def->name, files[i])) < 0 ||
+            (ret = virAsprintf(&dst, "/proc/%s", files[i])) < 0) {
+            VIR_FREE(src);
+            return ret;
+        }
+
+        if ((ret = mount(src, dst, NULL, MS_BIND, NULL)) < 0) {
+            virReportSystemError(errno,
+                                 _("Failed to mount %s on %s"),
+                                 src, dst);
+        }
+
+        VIR_FREE(src);
+        VIR_FREE(dst);
     }
 
-    VIR_FREE(meminfo_path);
     return ret;
 }
 #else
@@ -827,8 +836,8 @@ cleanup:
 
 
 #ifdef HAVE_LIBBLKID
-static int
-lxcContainerMountDetectFilesystem(const char *src, char **type)
+int
+lxcContainerDetectFilesystem(const char *src, char **type)
 {
     int fd;
     int ret = -1;
@@ -898,9 +907,9 @@ cleanup:
     return ret;
 }
 #else /* ! HAVE_LIBBLKID */
-static int
-lxcContainerMountDetectFilesystem(const char *src ATTRIBUTE_UNUSED,
-                                  char **type)
+int
+lxcContainerDetectFilesystem(const char *src ATTRIBUTE_UNUSED,
+                             char **type)
 {
     /* No libblkid, so just return success with no detected type */
     *type = NULL;
@@ -1064,8 +1073,15 @@ static int lxcContainerMountFSBlockHelper(virDomainFSDefPtr fs,
         goto cleanup;
     }
 
-    if (lxcContainerMountDetectFilesystem(src, &format) < 0)
+    /* The controller may already have found the type for us */
+    if (fs->fstype) {
+        if (!(format = strdup(fs->fstype))) {
+            virReportOOMError();
+            goto cleanup;
+        }
+    } else if (lxcContainerDetectFilesystem(src, &format) < 0) {
         goto cleanup;
+    }
 
     if (format) {
         VIR_DEBUG("Mount %s with detected format %s", src, format);
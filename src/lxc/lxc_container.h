@@ -63,6 +63,9 @@ int lxcContainerStart(virDomainDefPtr def,
 
 int lxcContainerAvailable(int features);
 
+int lxcContainerDetectFilesystem(const char *src, char **type)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 virArch lxcContainerGetAlt32bitArch(virArch arch);
 
 #endif /* LXC_CONTAINER_H */
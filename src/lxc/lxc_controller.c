@@ -71,10 +71,17 @@
 #include "nodeinfo.h"
 #include "virrandom.h"
 #include "virprocess.h"
+#include "threadpool.h"
 #include "rpc/virnetserver.h"
 
 #define VIR_FROM_THIS VIR_FROM_LXC
 
+/* Threads used to probe the filesystems of a container */
+#define VIR_LXC_CONTROLLER_PROBE_WORKERS 4
+
+/* Bytes buffered for each direction of a console */
+#define VIR_LXC_CONTROLLER_CONSOLE_BUF (64 * 1024)
+
 typedef struct _virLXCControllerConsole virLXCControllerConsole;
 typedef virLXCControllerConsole *virLXCControllerConsolePtr;
 struct _virLXCControllerConsole {
@@ -93,10 +100,17 @@ struct _virLXCControllerConsole {
     int epollWatch;
     int epollFd; /* epoll FD for dealing with EOF */
 
+    /* When both pipes are open, data is moved between the PTYs
+     * with splice() and the pipes serve as buffers instead of
+     * fromHostBuf and fromContBuf */
+    bool useSplice;
+    int fromHostPipe[2];
+    int fromContPipe[2];
+
     size_t fromHostLen;
-    char fromHostBuf[1024];
+    char fromHostBuf[VIR_LXC_CONTROLLER_CONSOLE_BUF];
     size_t fromContLen;
-    char fromContBuf[1024];
+    char fromContBuf[VIR_LXC_CONTROLLER_CONSOLE_BUF];
 
     virNetServerPtr server;
 };
@@ -241,6 +255,12 @@ static void virLXCControllerConsoleClose(virLXCControllerConsolePtr console)
     if (console->epollWatch != -1)
         virEventRemoveHandle(console->epollWatch);
     VIR_FORCE_CLOSE(console->epollFd);
+
+    VIR_FORCE_CLOSE(console->fromHostPipe[0]);
+    VIR_FORCE_CLOSE(console->fromHostPipe[1]);
+    VIR_FORCE_CLOSE(console->fromContPipe[0]);
+    VIR_FORCE_CLOSE(console->fromContPipe[1]);
+    console->useSplice = false;
 }
 
 
@@ -303,6 +323,11 @@ static int virLXCControllerAddConsole(virLXCControllerPtr ctrl,
 
     ctrl->consoles[ctrl->nconsoles-1].epollFd = -1;
     ctrl->consoles[ctrl->nconsoles-1].epollWatch = -1;
+
+    ctrl->consoles[ctrl->nconsoles-1].fromHostPipe[0] = -1;
+    ctrl->consoles[ctrl->nconsoles-1].fromHostPipe[1] = -1;
+    ctrl->consoles[ctrl->nconsoles-1].fromContPipe[0] = -1;
+    ctrl->consoles[ctrl->nconsoles-1].fromContPipe[1] = -1;
     return 0;
 }
 
@@ -379,11 +404,165 @@ static int virLXCControllerSetupLoopDevice(virDomainFSDefPtr fs)
 }
 
 
+/*
+ * Filesystem types found in disk images are remembered across
+ * container starts, keyed on the image's inode and validated
+ * against its size and modification time.
+ */
+static char *virLXCControllerFSTypeCachePath(struct stat *sb)
+{
+    char *path;
+
+    if (virAsprintf(&path, "%s/fstype/%llx-%llx", LXC_STATE_DIR,
+                    (unsigned long long)sb->st_dev,
+                    (unsigned long long)sb->st_ino) < 0)
+        return NULL;
+    return path;
+}
+
+
+static char *virLXCControllerFSTypeCacheStamp(struct stat *sb)
+{
+    char *stamp;
+
+    if (virAsprintf(&stamp, "%lld %lld.%09ld ",
+                    (long long)sb->st_size,
+                    (long long)sb->st_mtim.tv_sec,
+                    (long)sb->st_mtim.tv_nsec) < 0)
+        return NULL;
+    return stamp;
+}
+
+
+static char *virLXCControllerFSTypeCacheLookup(struct stat *sb)
+{
+    char *path = NULL;
+    char *stamp = NULL;
+    char *content = NULL;
+    char *type = NULL;
+    char *nl;
+
+    if (!(path = virLXCControllerFSTypeCachePath(sb)) ||
+        !(stamp = virLXCControllerFSTypeCacheStamp(sb)))
+        goto cleanup;
+
+    if (!virFileExists(path) ||
+        virFileReadAll(path, 1024, &content) < 0)
+        goto cleanup;
+
+    if (!STRPREFIX(content, stamp))
+        goto cleanup;
+
+    if ((nl = strchr(content, '\n')))
+        *nl = '\0';
+    if (content[strlen(stamp)] != '\0')
+        type = strdup(content + strlen(stamp));
+
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(stamp);
+    VIR_FREE(content);
+    return type;
+}
+
+
+static void virLXCControllerFSTypeCacheStore(struct stat *sb,
+                                             const char *type)
+{
+    char *dir = NULL;
+    char *path = NULL;
+    char *stamp = NULL;
+    char *content = NULL;
+
+    if (virAsprintf(&dir, "%s/fstype", LXC_STATE_DIR) < 0 ||
+        !(path = virLXCControllerFSTypeCachePath(sb)) ||
+        !(stamp = virLXCControllerFSTypeCacheStamp(sb)) ||
+        virAsprintf(&content, "%s%s\n", stamp, type) < 0)
+        goto cleanup;
+
+    if (virFileMakePath(dir) < 0 ||
+        virFileWriteStr(path, content, 0600) < 0)
+        VIR_WARN("Unable to cache filesystem type in %s", path);
+
+cleanup:
+    VIR_FREE(dir);
+    VIR_FREE(path);
+    VIR_FREE(stamp);
+    VIR_FREE(content);
+}
+
+
+/*
+ * Find out the filesystem type of a block device or disk image
+ * ahead of time, so the container does not have to probe it once
+ * it is running. Failure is not fatal: the container falls back
+ * to probing the device itself.
+ */
+static void virLXCControllerProbeFilesystem(void *jobdata,
+                                            void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainFSDefPtr fs = *(virDomainFSDefPtr *)jobdata;
+    bool cacheable = fs->type == VIR_DOMAIN_FS_TYPE_FILE;
+    struct stat sb;
+    char *type = NULL;
+
+    if (cacheable) {
+        if (stat(fs->src, &sb) < 0)
+            return;
+        if ((fs->fstype = virLXCControllerFSTypeCacheLookup(&sb))) {
+            VIR_DEBUG("Using cached filesystem type %s for %s",
+                      fs->fstype, fs->src);
+            return;
+        }
+    }
+
+    if (lxcContainerDetectFilesystem(fs->src, &type) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    if (type) {
+        VIR_DEBUG("Detected filesystem type %s for %s", type, fs->src);
+        if (cacheable)
+            virLXCControllerFSTypeCacheStore(&sb, type);
+    }
+    fs->fstype = type;
+}
+
+
+static void virLXCControllerProbeFilesystems(virLXCControllerPtr ctrl)
+{
+    virDomainFSDefPtr *fss = NULL;
+    size_t nfss = 0;
+    size_t i;
+
+    if (VIR_ALLOC_N(fss, ctrl->def->nfss) < 0)
+        return;
+
+    for (i = 0 ; i < ctrl->def->nfss ; i++) {
+        virDomainFSDefPtr fs = ctrl->def->fss[i];
+
+        if (fs->type != VIR_DOMAIN_FS_TYPE_FILE &&
+            fs->type != VIR_DOMAIN_FS_TYPE_BLOCK)
+            continue;
+        VIR_FREE(fs->fstype);
+        fss[nfss++] = fs;
+    }
+
+    virThreadPoolRunJobs(VIR_LXC_CONTROLLER_PROBE_WORKERS,
+                         virLXCControllerProbeFilesystem, NULL,
+                         fss, nfss, sizeof(*fss));
+    VIR_FREE(fss);
+}
+
+
 static int virLXCControllerSetupLoopDevices(virLXCControllerPtr ctrl)
 {
     size_t i;
     int ret = -1;
 
+    virLXCControllerProbeFilesystems(ctrl);
+
     for (i = 0 ; i < ctrl->def->nfss ; i++) {
         int fd;
 
@@ -710,13 +889,13 @@ static void virLXCControllerConsoleUpdateWatch(virLXCControllerConsolePtr consol
     int contEvents = 0;
 
     if (!console->hostClosed || (!console->hostBlocking && console->fromContLen)) {
-        if (console->fromHostLen < sizeof(console->fromHostBuf))
+        if (console->fromHostLen < VIR_LXC_CONTROLLER_CONSOLE_BUF)
             hostEvents |= VIR_EVENT_HANDLE_READABLE;
         if (console->fromContLen)
             hostEvents |= VIR_EVENT_HANDLE_WRITABLE;
     }
     if (!console->contClosed || (!console->contBlocking && console->fromHostLen)) {
-        if (console->fromContLen < sizeof(console->fromContBuf))
+        if (console->fromContLen < VIR_LXC_CONTROLLER_CONSOLE_BUF)
             contEvents |= VIR_EVENT_HANDLE_READABLE;
         if (console->fromHostLen)
             contEvents |= VIR_EVENT_HANDLE_WRITABLE;
@@ -853,9 +1032,181 @@ cleanup:
     virMutexUnlock(&lock);
 }
 
+#if HAVE_SPLICE
+static void virLXCControllerConsoleSetupSplice(virLXCControllerConsolePtr console)
+{
+    if (pipe2(console->fromHostPipe, O_CLOEXEC | O_NONBLOCK) < 0 ||
+        pipe2(console->fromContPipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        VIR_DEBUG("Unable to create console pipes, copying instead");
+        VIR_FORCE_CLOSE(console->fromHostPipe[0]);
+        VIR_FORCE_CLOSE(console->fromHostPipe[1]);
+        return;
+    }
+
+# ifdef F_SETPIPE_SZ
+    /* Best effort, the default pipe size is usually as big */
+    ignore_value(fcntl(console->fromHostPipe[1], F_SETPIPE_SZ,
+                       VIR_LXC_CONTROLLER_CONSOLE_BUF));
+    ignore_value(fcntl(console->fromContPipe[1], F_SETPIPE_SZ,
+                       VIR_LXC_CONTROLLER_CONSOLE_BUF));
+# endif
+
+    console->useSplice = true;
+}
+
+
+/*
+ * Called when the kernel can't splice() one of the PTYs: move
+ * whatever the pipes already hold into the userspace buffers and
+ * copy from then on.
+ */
+static int virLXCControllerConsoleStopSplice(virLXCControllerConsolePtr console)
+{
+    if (console->fromHostLen &&
+        saferead(console->fromHostPipe[0], console->fromHostBuf,
+                 console->fromHostLen) != console->fromHostLen)
+        return -1;
+    if (console->fromContLen &&
+        saferead(console->fromContPipe[0], console->fromContBuf,
+                 console->fromContLen) != console->fromContLen)
+        return -1;
+
+    VIR_DEBUG("Kernel cannot splice console PTYs, copying instead");
+    VIR_FORCE_CLOSE(console->fromHostPipe[0]);
+    VIR_FORCE_CLOSE(console->fromHostPipe[1]);
+    VIR_FORCE_CLOSE(console->fromContPipe[0]);
+    VIR_FORCE_CLOSE(console->fromContPipe[1]);
+    console->useSplice = false;
+    return 0;
+}
+#endif /* HAVE_SPLICE */
+
+
+/*
+ * Read from @fd into the buffer for data going from the host to the
+ * container if @fromHost is true, or the other way round otherwise
+ */
+static int virLXCControllerConsoleFill(virLXCControllerConsolePtr console,
+                                       int fd, bool fromHost)
+{
+    char *buf = fromHost ? console->fromHostBuf : console->fromContBuf;
+    size_t *len = fromHost ? &console->fromHostLen : &console->fromContLen;
+    size_t avail = VIR_LXC_CONTROLLER_CONSOLE_BUF - *len;
+    ssize_t done;
+
+    if (!avail)
+        return 0;
+
+#if HAVE_SPLICE
+    if (console->useSplice) {
+        int *pipefd = fromHost ? console->fromHostPipe : console->fromContPipe;
+
+    resplice:
+        done = splice(fd, NULL, pipefd[1], NULL, avail,
+                      SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (done == -1 && errno == EINTR)
+            goto resplice;
+        if (done == -1 && errno == EINVAL) {
+            if (virLXCControllerConsoleStopSplice(console) < 0)
+                goto error;
+            goto reread;
+        }
+        goto done;
+    }
+#endif
+
+reread:
+    done = read(fd, buf + *len, avail);
+    if (done == -1 && errno == EINTR)
+        goto reread;
+
+#if HAVE_SPLICE
+done:
+#endif
+    if (done == -1 && errno != EAGAIN)
+        goto error;
+    if (done > 0) {
+        *len += done;
+    } else {
+        VIR_DEBUG("Read fd %d done %d errno %d", fd, (int)done, errno);
+    }
+    return 0;
+
+error:
+    virReportSystemError(errno, "%s",
+                         _("Unable to read container pty"));
+    return -1;
+}
+
+
+/*
+ * Write as much of the buffer picked by @fromHost to @fd as it takes
+ */
+static int virLXCControllerConsoleDrain(virLXCControllerConsolePtr console,
+                                        int fd, bool fromHost)
+{
+    char *buf = fromHost ? console->fromHostBuf : console->fromContBuf;
+    size_t *len = fromHost ? &console->fromHostLen : &console->fromContLen;
+    ssize_t done;
+
+    if (!*len)
+        return 0;
+
+#if HAVE_SPLICE
+    if (console->useSplice) {
+        int *pipefd = fromHost ? console->fromHostPipe : console->fromContPipe;
+
+    resplice:
+        done = splice(pipefd[0], NULL, fd, NULL, *len,
+                      SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (done == -1 && errno == EINTR)
+            goto resplice;
+        if (done == -1 && errno == EINVAL) {
+            if (virLXCControllerConsoleStopSplice(console) < 0)
+                goto error;
+            goto rewrite;
+        }
+        if (done > 0) {
+            *len -= done;
+            return 0;
+        }
+        goto done;
+    }
+#endif
+
+rewrite:
+    done = write(fd, buf, *len);
+    if (done == -1 && errno == EINTR)
+        goto rewrite;
+    if (done > 0) {
+        memmove(buf, buf + done, (*len - done));
+        *len -= done;
+        return 0;
+    }
+
+#if HAVE_SPLICE
+done:
+#endif
+    if (done == -1 && errno != EAGAIN)
+        goto error;
+    VIR_DEBUG("Write fd %d done %d errno %d", fd, (int)done, errno);
+    if (fd == console->hostFd)
+        console->hostBlocking = true;
+    else
+        console->contBlocking = true;
+    return 0;
+
+error:
+    virReportSystemError(errno, "%s",
+                         _("Unable to write to container pty"));
+    return -1;
+}
+
+
 static void virLXCControllerConsoleIO(int watch, int fd, int events, void *opaque)
 {
     virLXCControllerConsolePtr console = opaque;
+    bool fromHost = watch == console->hostWatch;
 
     virMutexLock(&lock);
     VIR_DEBUG("IO event watch=%d fd=%d events=%d fromHost=%zu fromcont=%zu",
@@ -863,66 +1214,23 @@ static void virLXCControllerConsoleIO(int watch, int fd, int events, void *opaqu
               console->fromHostLen,
               console->fromContLen);
     if (events & VIR_EVENT_HANDLE_READABLE) {
-        char *buf;
-        size_t *len;
-        size_t avail;
-        ssize_t done;
-        if (watch == console->hostWatch) {
-            buf = console->fromHostBuf;
-            len = &console->fromHostLen;
-            avail = sizeof(console->fromHostBuf) - *len;
-        } else {
-            buf = console->fromContBuf;
-            len = &console->fromContLen;
-            avail = sizeof(console->fromContBuf) - *len;
-        }
-    reread:
-        done = read(fd, buf + *len, avail);
-        if (done == -1 && errno == EINTR)
-            goto reread;
-        if (done == -1 && errno != EAGAIN) {
-            virReportSystemError(errno, "%s",
-                                 _("Unable to read container pty"));
+        if (virLXCControllerConsoleFill(console, fd, fromHost) < 0)
             goto error;
-        }
-        if (done > 0) {
-            *len += done;
-        } else {
-            VIR_DEBUG("Read fd %d done %d errno %d", fd, (int)done, errno);
+
+        /* Pass the data on right away, rather than waiting for the
+         * other PTY to be polled as writable on the next iteration */
+        if (fromHost && !console->contClosed) {
+            if (virLXCControllerConsoleDrain(console, console->contFd, true) < 0)
+                goto error;
+        } else if (!fromHost && !console->hostClosed) {
+            if (virLXCControllerConsoleDrain(console, console->hostFd, false) < 0)
+                goto error;
         }
     }
 
     if (events & VIR_EVENT_HANDLE_WRITABLE) {
-        char *buf;
-        size_t *len;
-        ssize_t done;
-        if (watch == console->hostWatch) {
-            buf = console->fromContBuf;
-            len = &console->fromContLen;
-        } else {
-            buf = console->fromHostBuf;
-            len = &console->fromHostLen;
-        }
-
-    rewrite:
-        done = write(fd, buf, *len);
-        if (done == -1 && errno == EINTR)
-            goto rewrite;
-        if (done == -1 && errno != EAGAIN) {
-            virReportSystemError(errno, "%s",
-                                 _("Unable to write to container pty"));
+        if (virLXCControllerConsoleDrain(console, fd, !fromHost) < 0)
             goto error;
-        }
-        if (done > 0) {
-            memmove(buf, buf + done, (*len - done));
-            *len -= done;
-        } else {
-            VIR_DEBUG("Write fd %d done %d errno %d", fd, (int)done, errno);
-            if (watch == console->hostWatch)
-                console->hostBlocking = true;
-            else
-                console->contBlocking = true;
-        }
     }
 
     if (events & VIR_EVENT_HANDLE_HANGUP) {
@@ -974,6 +1282,10 @@ static int virLXCControllerMain(virLXCControllerPtr ctrl)
     virResetLastError();
 
     for (i = 0 ; i < ctrl->nconsoles ; i++) {
+#if HAVE_SPLICE
+        virLXCControllerConsoleSetupSplice(&(ctrl->consoles[i]));
+#endif
+
         if ((ctrl->consoles[i].epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
             virReportSystemError(errno, "%s",
                                  _("Unable to create epoll fd"));
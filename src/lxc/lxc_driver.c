@@ -2743,7 +2743,7 @@ lxcListAllDomains(virConnectPtr conn,
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
 
     lxcDriverLock(driver);
-    ret = virDomainList(conn, driver->domains.objs, domains, flags);
+    ret = virDomainList(conn, &driver->domains, domains, flags);
     lxcDriverUnlock(driver);
 
     return ret;
@@ -3250,7 +3250,8 @@ lxcDomainAttachDeviceNetLive(virConnectPtr conn,
      * network's pool of devices, or resolve bridge device name
      * to the one defined in the network definition.
      */
-    if (networkAllocateActualDevice(net) < 0)
+    if (networkAllocateActualDevice(net,
+                                    vm->def->numatune.memory.nodemask) < 0)
         return -1;
 
     actualType = virDomainNetGetActualType(net);
@@ -4467,10 +4468,13 @@ static int lxcDomainDetachDevice(virDomainPtr dom,
 }
 
 
+static const char *lxcURISchemes[] = { "lxc", NULL };
+
 /* Function Tables */
 static virDriver lxcDriver = {
     .no = VIR_DRV_LXC,
     .name = LXC_DRIVER_NAME,
+    .uriSchemes = lxcURISchemes,
     .open = lxcOpen, /* 0.4.2 */
     .close = lxcClose, /* 0.4.2 */
     .version = lxcVersion, /* 0.4.6 */
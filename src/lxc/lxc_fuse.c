@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/mount.h>
 #include <mntent.h>
 
@@ -35,12 +36,30 @@
 #include "logging.h"
 #include "virfile.h"
 #include "buf.h"
+#include "bitmap.h"
+#include "virtime.h"
+#include "intprops.h"
 
 #define VIR_FROM_THIS VIR_FROM_LXC
 
 #if HAVE_FUSE
 
-static const char *fuse_meminfo_path = "/meminfo";
+static const char *lxcProcFiles[VIR_LXC_FUSE_FILE_LAST] = {
+    [VIR_LXC_FUSE_FILE_MEMINFO] = "/meminfo",
+    [VIR_LXC_FUSE_FILE_STAT] = "/stat",
+    [VIR_LXC_FUSE_FILE_CPUINFO] = "/cpuinfo",
+};
+
+static int lxcProcFileIndex(const char *path)
+{
+    int i;
+
+    for (i = 0; i < VIR_LXC_FUSE_FILE_LAST; i++) {
+        if (STREQ(path, lxcProcFiles[i]))
+            return i;
+    }
+    return -1;
+}
 
 static int lxcProcGetattr(const char *path, struct stat *stbuf)
 {
@@ -59,7 +78,7 @@ static int lxcProcGetattr(const char *path, struct stat *stbuf)
     if (STREQ(path, "/")) {
         stbuf->st_mode = S_IFDIR | 0755;
         stbuf->st_nlink = 2;
-    } else if (STREQ(path, fuse_meminfo_path)) {
+    } else if (lxcProcFileIndex(path) >= 0) {
         if (stat(mempath, &sb) < 0) {
             res = -errno;
             goto cleanup;
@@ -86,12 +105,15 @@ static int lxcProcReaddir(const char *path, void *buf,
                           off_t offset ATTRIBUTE_UNUSED,
                           struct fuse_file_info *fi ATTRIBUTE_UNUSED)
 {
+    int i;
+
     if (!STREQ(path, "/"))
         return -ENOENT;
 
     filler(buf, ".", NULL, 0);
     filler(buf, "..", NULL, 0);
-    filler(buf, fuse_meminfo_path + 1, NULL, 0);
+    for (i = 0; i < VIR_LXC_FUSE_FILE_LAST; i++)
+        filler(buf, lxcProcFiles[i] + 1, NULL, 0);
 
     return 0;
 }
@@ -99,7 +121,7 @@ static int lxcProcReaddir(const char *path, void *buf,
 static int lxcProcOpen(const char *path ATTRIBUTE_UNUSED,
                        struct fuse_file_info *fi ATTRIBUTE_UNUSED)
 {
-    if (!STREQ(path, fuse_meminfo_path))
+    if (lxcProcFileIndex(path) < 0)
         return -ENOENT;
 
     if ((fi->flags & 3) != O_RDONLY)
@@ -124,17 +146,14 @@ static int lxcProcHostRead(char *path, char *buf, size_t size, off_t offset)
     return res;
 }
 
-static int lxcProcReadMeminfo(char *hostpath, virDomainDefPtr def,
-                              char *buf, size_t size, off_t offset)
+static int lxcProcGenMeminfo(const char *hostpath, virDomainDefPtr def,
+                             virBufferPtr new_meminfo)
 {
-    int copied = 0;
     int res;
     FILE *fd = NULL;
     char *line = NULL;
     size_t n;
     struct virLXCMeminfo meminfo;
-    virBuffer buffer = VIR_BUFFER_INITIALIZER;
-    virBufferPtr new_meminfo = &buffer;
 
     if ((res = virLXCCgroupGetMeminfo(&meminfo)) < 0)
         return res;
@@ -146,14 +165,8 @@ static int lxcProcReadMeminfo(char *hostpath, virDomainDefPtr def,
         goto cleanup;
     }
 
-    if (fseek(fd, offset, SEEK_SET) < 0) {
-        virReportSystemError(errno, "%s", _("fseek failed"));
-        res = -errno;
-        goto cleanup;
-    }
-
     res = -1;
-    while (copied < size && getline(&line, &n, fd) > 0) {
+    while (getline(&line, &n, fd) > 0) {
         char *ptr = strchr(line, ':');
         if (ptr) {
             *ptr = '\0';
@@ -206,32 +219,242 @@ static int lxcProcReadMeminfo(char *hostpath, virDomainDefPtr def,
 
             if (virBufferError(new_meminfo))
                 goto cleanup;
+        }
+    }
+    res = 0;
+
+cleanup:
+    VIR_FREE(line);
+    VIR_FORCE_FCLOSE(fd);
+    return res;
+}
 
-            copied += strlen(line);
-            if (copied > size)
-                copied = size;
+/*
+ * The container's CPU times come from cpuacct: each CPU's usage is
+ * split between user and system time in the cgroup's overall ratio,
+ * and everything else the host CPU did is reported as idle. All other
+ * lines are the host's.
+ */
+static void lxcProcFormatCpu(virBufferPtr buf, const char *name,
+                             unsigned long long used,
+                             unsigned long long hosttotal,
+                             virLXCCpuacctPtr cpuacct,
+                             unsigned long long ticks)
+{
+    unsigned long long user, sys, idle;
+
+    used = used / (1000ull * 1000 * 1000 / ticks);
+    if (cpuacct->user + cpuacct->sys)
+        user = used * ((double) cpuacct->user /
+                       (cpuacct->user + cpuacct->sys));
+    else
+        user = 0;
+    sys = used - user;
+    idle = hosttotal > used ? hosttotal - used : 0;
+
+    virBufferAsprintf(buf, "%s %llu 0 %llu %llu 0 0 0 0 0 0\n",
+                      name, user, sys, idle);
+}
+
+static int lxcProcGenStat(const char *hostpath,
+                          virDomainDefPtr def ATTRIBUTE_UNUSED,
+                          virBufferPtr buf)
+{
+    int res;
+    FILE *fd = NULL;
+    char *line = NULL;
+    size_t n;
+    struct virLXCCpuacct cpuacct;
+    unsigned long long ticks = sysconf(_SC_CLK_TCK);
+    unsigned long long total = 0;
+    size_t i;
+
+    if ((res = virLXCCgroupGetCpuacct(&cpuacct)) < 0)
+        return res;
+
+    if (ticks == 0 || ticks > 1000ull * 1000 * 1000)
+        ticks = 100;
+    for (i = 0; i < cpuacct.npercpu; i++)
+        total += cpuacct.percpu[i];
+
+    fd = fopen(hostpath, "r");
+    if (fd == NULL) {
+        virReportSystemError(errno, _("Cannot open %s"), hostpath);
+        res = -errno;
+        goto cleanup;
+    }
+
+    while (getline(&line, &n, fd) > 0) {
+        unsigned long long hosttotal = 0;
+        unsigned long long field;
+        unsigned int cpu;
+        char *p;
+
+        if (!STRPREFIX(line, "cpu")) {
+            virBufferAdd(buf, line, -1);
+            continue;
+        }
+
+        p = line + 3;
+        if (*p == ' ') {
+            cpu = UINT_MAX;
+        } else if (virStrToLong_ui(p, &p, 10, &cpu) < 0) {
+            virBufferAdd(buf, line, -1);
+            continue;
+        }
+
+        while (virStrToLong_ull(p, &p, 10, &field) == 0)
+            hosttotal += field;
+
+        if (cpu == UINT_MAX)
+            lxcProcFormatCpu(buf, "cpu ", total, hosttotal, &cpuacct, ticks);
+        else if (cpu < cpuacct.npercpu) {
+            char name[INT_BUFSIZE_BOUND(cpu) + 3];
+            snprintf(name, sizeof(name), "cpu%u", cpu);
+            lxcProcFormatCpu(buf, name, cpuacct.percpu[cpu], hosttotal,
+                             &cpuacct, ticks);
+        } else {
+            virBufferAdd(buf, line, -1);
         }
     }
-    res = copied;
-    memcpy(buf, virBufferCurrentContent(new_meminfo), copied);
+
+    res = virBufferError(buf) ? -ENOMEM : 0;
 
 cleanup:
+    VIR_FREE(cpuacct.percpu);
     VIR_FREE(line);
-    virBufferFreeAndReset(new_meminfo);
     VIR_FORCE_FCLOSE(fd);
     return res;
 }
 
-static int lxcProcRead(const char *path ATTRIBUTE_UNUSED,
-                       char *buf ATTRIBUTE_UNUSED,
-                       size_t size ATTRIBUTE_UNUSED,
-                       off_t offset ATTRIBUTE_UNUSED,
+/* Only the processors of the container's cpuset are listed, numbered
+ * from 0 the way the container sees them */
+static int lxcProcGenCpuinfo(const char *hostpath,
+                             virDomainDefPtr def ATTRIBUTE_UNUSED,
+                             virBufferPtr buf)
+{
+    int res;
+    FILE *fd = NULL;
+    char *line = NULL;
+    char *cpus = NULL;
+    size_t n;
+    virBitmapPtr cpuset = NULL;
+    bool keep = true;
+    unsigned int next = 0;
+
+    if ((res = virLXCCgroupGetCpuset(&cpus)) < 0)
+        return res;
+
+    if (virBitmapParse(cpus, 0, &cpuset, VIR_DOMAIN_CPUMASK_LEN) < 0) {
+        res = -EINVAL;
+        goto cleanup;
+    }
+
+    fd = fopen(hostpath, "r");
+    if (fd == NULL) {
+        virReportSystemError(errno, _("Cannot open %s"), hostpath);
+        res = -errno;
+        goto cleanup;
+    }
+
+    while (getline(&line, &n, fd) > 0) {
+        char *sep;
+        unsigned int cpu;
+        bool set = false;
+
+        if (STRPREFIX(line, "processor") &&
+            (sep = strchr(line, ':')) &&
+            virStrToLong_ui(sep + 1, NULL, 10, &cpu) == 0) {
+            keep = virBitmapGetBit(cpuset, cpu, &set) == 0 && set;
+            if (keep) {
+                *sep = '\0';
+                virBufferAsprintf(buf, "%s: %u\n", line, next++);
+                continue;
+            }
+        }
+
+        if (keep)
+            virBufferAdd(buf, line, -1);
+    }
+
+    res = virBufferError(buf) ? -ENOMEM : 0;
+
+cleanup:
+    virBitmapFree(cpuset);
+    VIR_FREE(cpus);
+    VIR_FREE(line);
+    VIR_FORCE_FCLOSE(fd);
+    return res;
+}
+
+typedef int (*lxcProcGenFunc)(const char *hostpath,
+                              virDomainDefPtr def,
+                              virBufferPtr buf);
+
+static lxcProcGenFunc lxcProcGenerators[VIR_LXC_FUSE_FILE_LAST] = {
+    [VIR_LXC_FUSE_FILE_MEMINFO] = lxcProcGenMeminfo,
+    [VIR_LXC_FUSE_FILE_STAT] = lxcProcGenStat,
+    [VIR_LXC_FUSE_FILE_CPUINFO] = lxcProcGenCpuinfo,
+};
+
+/*
+ * Copy out part of an emulated file, regenerating it first if the
+ * cached copy is older than VIR_LXC_FUSE_CACHE_MS. Reads at later
+ * offsets thus see the same content as the read at offset 0.
+ * Must be called with fuse->cacheLock held.
+ */
+static int lxcProcReadCached(virLXCFusePtr fuse, int file, char *hostpath,
+                             char *buf, size_t size, off_t offset)
+{
+    struct virLXCFuseCache *cache = &fuse->files[file];
+    unsigned long long now;
+    int res;
+
+    if (virTimeMillisNow(&now) < 0)
+        now = 0;
+
+    if (!cache->content || now == 0 ||
+        now - cache->when >= VIR_LXC_FUSE_CACHE_MS) {
+        virBuffer buffer = VIR_BUFFER_INITIALIZER;
+
+        if ((res = lxcProcGenerators[file](hostpath, fuse->def,
+                                           &buffer)) < 0) {
+            virBufferFreeAndReset(&buffer);
+            return res;
+        }
+        if (virBufferError(&buffer)) {
+            virBufferFreeAndReset(&buffer);
+            return -ENOMEM;
+        }
+
+        VIR_FREE(cache->content);
+        cache->len = virBufferUse(&buffer);
+        cache->content = virBufferContentAndReset(&buffer);
+        cache->when = now;
+    }
+
+    if (offset >= cache->len)
+        return 0;
+    if (size > cache->len - offset)
+        size = cache->len - offset;
+    memcpy(buf, cache->content + offset, size);
+    return size;
+}
+
+static int lxcProcRead(const char *path,
+                       char *buf,
+                       size_t size,
+                       off_t offset,
                        struct fuse_file_info *fi ATTRIBUTE_UNUSED)
 {
     int res = -ENOENT;
     char *hostpath = NULL;
     struct fuse_context *context = NULL;
-    virDomainDefPtr def = NULL;
+    virLXCFusePtr fuse = NULL;
+    int file;
+
+    if ((file = lxcProcFileIndex(path)) < 0)
+        return -ENOENT;
 
     if (virAsprintf(&hostpath, "/proc/%s", path) < 0) {
         virReportOOMError();
@@ -239,12 +462,15 @@ static int lxcProcRead(const char *path ATTRIBUTE_UNUSED,
     }
 
     context = fuse_get_context();
-    def = (virDomainDefPtr)context->private_data;
+    fuse = context->private_data;
 
-    if (STREQ(path, fuse_meminfo_path)) {
-        if ((res = lxcProcReadMeminfo(hostpath, def, buf, size, offset)) < 0)
-            res = lxcProcHostRead(hostpath, buf, size, offset);
-    }
+    /* Requests are served by several threads */
+    virMutexLock(&fuse->cacheLock);
+    res = lxcProcReadCached(fuse, file, hostpath, buf, size, offset);
+    virMutexUnlock(&fuse->cacheLock);
+
+    if (res < 0)
+        res = lxcProcHostRead(hostpath, buf, size, offset);
 
     VIR_FREE(hostpath);
     return res;
@@ -270,9 +496,9 @@ static void lxcFuseRun(void *opaque)
 {
     virLXCFusePtr fuse = opaque;
 
-    if (fuse_loop(fuse->fuse) < 0)
+    if (fuse_loop_mt(fuse->fuse) < 0)
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("fuse_loop failed"));
+                       _("fuse_loop_mt failed"));
 
     lxcFuseDestroy(fuse);
 }
@@ -290,6 +516,10 @@ int lxcSetupFuse(virLXCFusePtr *f, virDomainDefPtr def)
 
     if (virMutexInit(&fuse->lock) < 0)
         goto cleanup2;
+    if (virMutexInit(&fuse->cacheLock) < 0) {
+        virMutexDestroy(&fuse->lock);
+        goto cleanup2;
+    }
 
     if (virAsprintf(&fuse->mountpoint, "%s/%s/", LXC_STATE_DIR,
                     def->name) < 0) {
@@ -314,7 +544,7 @@ int lxcSetupFuse(virLXCFusePtr *f, virDomainDefPtr def)
         goto cleanup1;
 
     fuse->fuse = fuse_new(fuse->ch, &args, &lxcProcOper,
-                          sizeof(lxcProcOper), fuse->def);
+                          sizeof(lxcProcOper), fuse);
     if (fuse->fuse == NULL) {
         fuse_unmount(fuse->mountpoint, fuse->ch);
         goto cleanup1;
@@ -333,6 +563,7 @@ cleanup:
     return ret;
 cleanup1:
     VIR_FREE(fuse->mountpoint);
+    virMutexDestroy(&fuse->cacheLock);
     virMutexDestroy(&fuse->lock);
 cleanup2:
     VIR_FREE(fuse);
@@ -342,6 +573,7 @@ cleanup2:
 void lxcFreeFuse(virLXCFusePtr *f)
 {
     virLXCFusePtr fuse = *f;
+    int i;
     /* lxcFuseRun thread create success */
     if (fuse) {
         /* exit fuse_loop, lxcFuseRun thread may try to destroy
@@ -353,6 +585,9 @@ void lxcFreeFuse(virLXCFusePtr *f)
 
         virThreadJoin(&fuse->thread);
 
+        for (i = 0; i < VIR_LXC_FUSE_FILE_LAST; i++)
+            VIR_FREE(fuse->files[i].content);
+        virMutexDestroy(&fuse->cacheLock);
         VIR_FREE(fuse->mountpoint);
         VIR_FREE(*f);
     }
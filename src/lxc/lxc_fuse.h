@@ -49,6 +49,33 @@ struct virLXCMeminfo {
 };
 typedef struct virLXCMeminfo *virLXCMeminfoPtr;
 
+struct virLXCCpuacct {
+    unsigned long long user;        /* nanoseconds */
+    unsigned long long sys;         /* nanoseconds */
+    unsigned long long *percpu;     /* nanoseconds, indexed by host CPU */
+    size_t npercpu;
+};
+typedef struct virLXCCpuacct *virLXCCpuacctPtr;
+
+/* Files emulated under the container's /proc */
+enum {
+    VIR_LXC_FUSE_FILE_MEMINFO,
+    VIR_LXC_FUSE_FILE_STAT,
+    VIR_LXC_FUSE_FILE_CPUINFO,
+
+    VIR_LXC_FUSE_FILE_LAST
+};
+
+/* Generated file contents are reused for this long, so that readers
+ * polling every container don't each recompute them */
+# define VIR_LXC_FUSE_CACHE_MS 500
+
+struct virLXCFuseCache {
+    char *content;
+    size_t len;
+    unsigned long long when;    /* ms since the epoch, 0 if never filled */
+};
+
 struct virLXCFuse {
     virDomainDefPtr def;
     virThread thread;
@@ -56,6 +83,9 @@ struct virLXCFuse {
     struct fuse *fuse;
     struct fuse_chan *ch;
     virMutex lock;
+
+    virMutex cacheLock;         /* protects files */
+    struct virLXCFuseCache files[VIR_LXC_FUSE_FILE_LAST];
 };
 typedef struct virLXCFuse *virLXCFusePtr;
 
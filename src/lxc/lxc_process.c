@@ -230,10 +230,11 @@ static void virLXCProcessCleanup(virLXCDriverPtr driver,
     if (virHookPresent(VIR_HOOK_DRIVER_LXC)) {
         char *xml = virDomainDefFormat(vm->def, 0);
 
-        /* we can't stop the operation even if the script raised an error */
-        virHookCall(VIR_HOOK_DRIVER_LXC, vm->def->name,
-                    VIR_HOOK_LXC_OP_STOPPED, VIR_HOOK_SUBOP_END,
-                    NULL, xml, NULL);
+        /* we can't stop the operation even if the script raised an
+         * error, so there is no need to wait for it either */
+        virHookCallAsync(VIR_HOOK_DRIVER_LXC, vm->def->name,
+                         VIR_HOOK_LXC_OP_STOPPED, VIR_HOOK_SUBOP_END,
+                         NULL, xml);
         VIR_FREE(xml);
     }
 
@@ -284,10 +285,11 @@ static void virLXCProcessCleanup(virLXCDriverPtr driver,
     if (virHookPresent(VIR_HOOK_DRIVER_LXC)) {
         char *xml = virDomainDefFormat(vm->def, 0);
 
-        /* we can't stop the operation even if the script raised an error */
-        virHookCall(VIR_HOOK_DRIVER_LXC, vm->def->name,
-                    VIR_HOOK_LXC_OP_RELEASE, VIR_HOOK_SUBOP_END,
-                    NULL, xml, NULL);
+        /* we can't stop the operation even if the script raised an
+         * error, so there is no need to wait for it either */
+        virHookCallAsync(VIR_HOOK_DRIVER_LXC, vm->def->name,
+                         VIR_HOOK_LXC_OP_RELEASE, VIR_HOOK_SUBOP_END,
+                         NULL, xml);
         VIR_FREE(xml);
     }
 
@@ -436,7 +438,8 @@ static int virLXCProcessSetupInterfaces(virConnectPtr conn,
          * network's pool of devices, or resolve bridge device name
          * to the one defined in the network definition.
          */
-        if (networkAllocateActualDevice(def->nets[i]) < 0)
+        if (networkAllocateActualDevice(def->nets[i],
+                                        def->numatune.memory.nodemask) < 0)
             goto cleanup;
 
         if (VIR_EXPAND_N(*veths, *nveths, 1) < 0) {
@@ -43,6 +43,9 @@
 #include <sys/wait.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
 
 #include "virterror_internal.h"
 #include "datatypes.h"
@@ -70,6 +73,7 @@
 
 #define NETWORK_PID_DIR LOCALSTATEDIR "/run/libvirt/network"
 #define NETWORK_STATE_DIR LOCALSTATEDIR "/lib/libvirt/network"
+#define NETWORK_CACHE_DIR LOCALSTATEDIR "/cache/libvirt/network"
 
 #define DNSMASQ_STATE_DIR LOCALSTATEDIR "/lib/libvirt/dnsmasq"
 #define RADVD_STATE_DIR LOCALSTATEDIR "/lib/libvirt/radvd"
@@ -87,6 +91,18 @@ struct network_driver {
     char *networkAutostartDir;
     char *logDir;
     dnsmasqCapsPtr dnsmasqCaps;
+
+    /* Parsed lease files of dnsmasq, only kept while changes to them
+     * are followed through inotify. Guarded by leaseLock rather than
+     * the driver lock, so lease queries don't serialize with network
+     * management. */
+    virMutex leaseLock;
+    virHashTablePtr leases;     /* lease file path => dnsmasqLeaseIndexPtr */
+#if HAVE_SYS_INOTIFY_H
+    int inotifyFD;
+    int inotifyWatch;
+    int leaseDirWatch;          /* watch descriptor of DNSMASQ_STATE_DIR */
+#endif
 };
 
 
@@ -285,6 +301,7 @@ networkFindActiveConfigs(struct network_driver *driver) {
         if (obj->def->bridge &&
             virNetDevExists(obj->def->bridge) == 1) {
             obj->active = 1;
+            driver->networks.generation++;
 
             /* Try and read dnsmasq/radvd pids if any */
             if (obj->def->ips && (obj->def->nips > 0)) {
@@ -345,6 +362,130 @@ firewalld_dbus_filter_bridge(DBusConnection *connection ATTRIBUTE_UNUSED,
 }
 #endif
 
+static void
+networkLeaseIndexDataFree(void *payload,
+                          const void *name ATTRIBUTE_UNUSED)
+{
+    dnsmasqLeaseIndexFree(payload);
+}
+
+#if HAVE_SYS_INOTIFY_H
+static void
+networkLeaseInotifyEvent(int watch,
+                         int fd,
+                         int events ATTRIBUTE_UNUSED,
+                         void *opaque)
+{
+    union {
+        struct inotify_event e; /* keeps buf suitably aligned */
+        char buf[4096];
+    } data;
+    struct inotify_event *e;
+    ssize_t got;
+    char *tmp;
+    char *path;
+    struct network_driver *driver = opaque;
+
+    virMutexLock(&driver->leaseLock);
+    if (watch != driver->inotifyWatch)
+        goto cleanup;
+
+reread:
+    got = read(fd, data.buf, sizeof(data.buf));
+    if (got == -1) {
+        if (errno == EINTR)
+            goto reread;
+        goto cleanup;
+    }
+
+    tmp = data.buf;
+    while (got) {
+        if (got < sizeof(struct inotify_event))
+            goto cleanup; /* bad */
+
+        e = (struct inotify_event *)tmp;
+        tmp += sizeof(struct inotify_event);
+        got -= sizeof(struct inotify_event);
+
+        if (got < e->len)
+            goto cleanup;
+
+        tmp += e->len;
+        got -= e->len;
+
+        if (e->mask & (IN_Q_OVERFLOW | IN_IGNORED)) {
+            VIR_DEBUG("lost track of lease files, dropping parsed leases");
+            virHashRemoveAll(driver->leases);
+            if (e->mask & IN_IGNORED)
+                driver->leaseDirWatch = -1;
+            continue;
+        }
+
+        if (e->wd != driver->leaseDirWatch || !e->len)
+            continue;
+
+        if (virAsprintf(&path, DNSMASQ_STATE_DIR "/%s", e->name) < 0) {
+            virReportOOMError();
+            virHashRemoveAll(driver->leases);
+            continue;
+        }
+        virHashRemoveEntry(driver->leases, path);
+        VIR_FREE(path);
+    }
+
+cleanup:
+    virMutexUnlock(&driver->leaseLock);
+}
+#endif /* HAVE_SYS_INOTIFY_H */
+
+/*
+ * Start following changes to the lease files of dnsmasq, so that their
+ * parsed contents can be kept around between lease queries. Failing to
+ * do so is not fatal, the files are then parsed on every query.
+ */
+static void
+networkLeaseWatchInit(struct network_driver *driver ATTRIBUTE_UNUSED,
+                      bool privileged ATTRIBUTE_UNUSED)
+{
+#if HAVE_SYS_INOTIFY_H
+    driver->inotifyFD = -1;
+    driver->inotifyWatch = -1;
+    driver->leaseDirWatch = -1;
+
+    if (!privileged)
+        return;
+
+    if (virFileMakePath(DNSMASQ_STATE_DIR) < 0 ||
+        (driver->inotifyFD = inotify_init()) < 0 ||
+        virSetNonBlock(driver->inotifyFD) < 0 ||
+        virSetCloseExec(driver->inotifyFD) < 0 ||
+        (driver->leaseDirWatch =
+         inotify_add_watch(driver->inotifyFD, DNSMASQ_STATE_DIR,
+                           IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE |
+                           IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) < 0 ||
+        (driver->inotifyWatch =
+         virEventAddHandle(driver->inotifyFD, VIR_EVENT_HANDLE_READABLE,
+                           networkLeaseInotifyEvent, driver, NULL)) < 0) {
+        VIR_WARN("Cannot watch lease files in %s for changes, "
+                 "they will be parsed on every lease query",
+                 DNSMASQ_STATE_DIR);
+        VIR_FORCE_CLOSE(driver->inotifyFD);
+        driver->inotifyWatch = -1;
+        driver->leaseDirWatch = -1;
+    }
+#endif
+}
+
+static void
+networkLeaseWatchShutdown(struct network_driver *driver ATTRIBUTE_UNUSED)
+{
+#if HAVE_SYS_INOTIFY_H
+    if (driver->inotifyWatch != -1)
+        virEventRemoveHandle(driver->inotifyWatch);
+    VIR_FORCE_CLOSE(driver->inotifyFD);
+#endif
+}
+
 /**
  * networkStartup:
  *
@@ -367,8 +508,17 @@ networkStartup(bool privileged,
         VIR_FREE(driverState);
         goto error;
     }
+    if (virMutexInit(&driverState->leaseLock) < 0) {
+        virMutexDestroy(&driverState->lock);
+        VIR_FREE(driverState);
+        goto error;
+    }
+    networkLeaseWatchInit(driverState, privileged);
     networkDriverLock(driverState);
 
+    if (!(driverState->leases = virHashCreate(16, networkLeaseIndexDataFree)))
+        goto error;
+
     if (privileged) {
         if (virAsprintf(&driverState->logDir,
                         "%s/log/libvirt/qemu", LOCALSTATEDIR) == -1)
@@ -414,7 +564,13 @@ networkStartup(bool privileged,
     }
 
     /* if this fails now, it will be retried later with dnsmasqCapsRefresh() */
-    driverState->dnsmasqCaps = dnsmasqCapsNewFromBinary(DNSMASQ);
+    if (privileged && virFileMakePath(NETWORK_CACHE_DIR) == 0) {
+        driverState->dnsmasqCaps =
+            dnsmasqCapsNewFromBinaryCached(DNSMASQ, NETWORK_CACHE_DIR
+                                           "/dnsmasq-caps");
+    } else {
+        driverState->dnsmasqCaps = dnsmasqCapsNewFromBinary(DNSMASQ);
+    }
 
     if (virNetworkLoadAllConfigs(&driverState->networks,
                                  driverState->networkConfigDir,
@@ -515,7 +671,11 @@ networkShutdown(void) {
 
     virObjectUnref(driverState->dnsmasqCaps);
 
+    networkLeaseWatchShutdown(driverState);
+    virHashFree(driverState->leases);
+
     networkDriverUnlock(driverState);
+    virMutexDestroy(&driverState->leaseLock);
     virMutexDestroy(&driverState->lock);
 
     VIR_FREE(driverState);
@@ -1121,7 +1281,8 @@ cleanup:
 /* networkRefreshDhcpDaemon:
  *  Update dnsmasq config files, then send a SIGHUP so that it rereads
  *  them.   This only works for the dhcp-hostsfile and the
- *  addn-hosts file.
+ *  addn-hosts file. Files are only touched where they changed, so
+ *  adding a host appends a line instead of rewriting the file.
  *
  *  Returns 0 on success, -1 on failure.
  */
@@ -1177,7 +1338,8 @@ networkRefreshDhcpDaemon(struct network_driver *driver,
     if (networkBuildDnsmasqHostsList(dctx, &network->def->dns) < 0)
        goto cleanup;
 
-    if ((ret = dnsmasqSave(dctx)) < 0)
+    /* dnsmasq only needs to reread the files if they changed */
+    if ((ret = dnsmasqUpdate(dctx)) <= 0)
         goto cleanup;
 
     ret = kill(network->dnsmasqPid, SIGHUP);
@@ -2139,6 +2301,10 @@ networkReloadIptablesRules(struct network_driver *driver)
 
     VIR_INFO("Reloading iptables rules");
 
+    /* Rules of networks which are still in place are left alone;
+     * only the differences get applied, in a single transaction */
+    iptablesContextBeginBatch(driver->iptables);
+
     for (i = 0 ; i < driver->networks.count ; i++) {
         virNetworkObjPtr network = driver->networks.objs[i];
 
@@ -2157,6 +2323,10 @@ networkReloadIptablesRules(struct network_driver *driver)
         }
         virNetworkObjUnlock(network);
     }
+
+    if (iptablesContextCommitBatch(driver->iptables) < 0) {
+        /* failed to apply but already logged */
+    }
 }
 
 /* Enable IP Forwarding. Return 0 for success, -1 for failure. */
@@ -2396,7 +2566,7 @@ networkStartNetworkVirtual(struct network_driver *driver,
         /* Keep tun fd open and interface up to allow for IPv6 DAD to happen */
         if (virNetDevTapCreateInBridgePort(network->def->bridge,
                                            &macTapIfName, &network->def->mac,
-                                           NULL, &tapfd, NULL, NULL,
+                                           NULL, &tapfd, 1, NULL, NULL,
                                            VIR_NETDEV_TAP_CREATE_USE_MAC_FOR_BRIDGE |
                                            VIR_NETDEV_TAP_CREATE_IFUP |
                                            VIR_NETDEV_TAP_CREATE_PERSIST) < 0) {
@@ -2649,6 +2819,7 @@ networkStartNetwork(struct network_driver *driver,
 
     VIR_INFO("Starting up network '%s'", network->def->name);
     network->active = 1;
+    driver->networks.generation++;
 
 error:
     if (ret < 0) {
@@ -2698,6 +2869,7 @@ static int networkShutdownNetwork(struct network_driver *driver,
     }
 
     network->active = 0;
+    driver->networks.generation++;
     virNetworkObjUnsetDefTransient(network);
     return ret;
 }
@@ -2871,6 +3043,23 @@ networkListAllNetworks(virConnectPtr conn,
     return ret;
 }
 
+static int
+networkGetListGeneration(virConnectPtr conn,
+                         unsigned int type ATTRIBUTE_UNUSED,
+                         unsigned long long *generation,
+                         unsigned int flags)
+{
+    struct network_driver *driver = conn->networkPrivateData;
+
+    virCheckFlags(0, -1);
+
+    networkDriverLock(driver);
+    *generation = driver->networks.generation;
+    networkDriverUnlock(driver);
+
+    return 0;
+}
+
 static int networkIsActive(virNetworkPtr net)
 {
     struct network_driver *driver = net->conn->networkPrivateData;
@@ -3557,6 +3746,209 @@ cleanup:
 }
 
 
+/*
+ * Returns the parsed lease file at @leasefile, which must be released
+ * with dnsmasqLeaseIndexFree() if @cached is set to false.
+ * Must be called with leaseLock held.
+ */
+static dnsmasqLeaseIndexPtr
+networkGetLeaseIndex(struct network_driver *driver,
+                     const char *leasefile,
+                     bool *cached)
+{
+    dnsmasqLeaseIndexPtr idx;
+
+    *cached = false;
+
+    if ((idx = virHashLookup(driver->leases, leasefile))) {
+        *cached = true;
+        return idx;
+    }
+
+    if (!(idx = dnsmasqLeaseIndexNewFromFile(leasefile)))
+        return NULL;
+
+#if HAVE_SYS_INOTIFY_H
+    /* only files whose changes invalidate the index can be cached */
+    if (driver->leaseDirWatch >= 0 &&
+        STRPREFIX(leasefile, DNSMASQ_STATE_DIR "/") &&
+        !strchr(leasefile + strlen(DNSMASQ_STATE_DIR "/"), '/')) {
+        if (virHashAddEntry(driver->leases, leasefile, idx) < 0) {
+            dnsmasqLeaseIndexFree(idx);
+            return NULL;
+        }
+        *cached = true;
+    }
+#endif
+
+    return idx;
+}
+
+static unsigned int
+networkGetLeasePrefix(virNetworkDefPtr def,
+                      dnsmasqLeasePtr lease)
+{
+    virSocketAddr addr;
+    size_t i;
+
+    if (virSocketAddrParse(&addr, lease->ipaddr, AF_UNSPEC) < 0) {
+        virResetLastError();
+        return 0;
+    }
+
+    for (i = 0; i < def->nips; i++) {
+        virNetworkIpDefPtr ipdef = &def->ips[i];
+        virSocketAddr netmask;
+        int prefix;
+
+        if (!VIR_SOCKET_ADDR_IS_FAMILY(&ipdef->address,
+                                       VIR_SOCKET_ADDR_FAMILY(&addr)) ||
+            (prefix = virNetworkIpDefPrefix(ipdef)) < 0 ||
+            virSocketAddrPrefixToNetmask(prefix, &netmask,
+                                         VIR_SOCKET_ADDR_FAMILY(&addr)) < 0)
+            continue;
+
+        if (virSocketAddrCheckNetmask(&addr, &ipdef->address, &netmask) == 1)
+            return prefix;
+    }
+
+    return 0;
+}
+
+static int
+networkCopyLease(virNetworkDefPtr def,
+                 dnsmasqLeasePtr lease,
+                 virNetworkDHCPLeasePtr *dst)
+{
+    virNetworkDHCPLeasePtr tmp;
+
+    if (VIR_ALLOC(tmp) < 0)
+        goto no_memory;
+
+    tmp->expirytime = lease->expirytime;
+    tmp->type = lease->ipv6 ? VIR_IP_ADDR_TYPE_IPV6 : VIR_IP_ADDR_TYPE_IPV4;
+    tmp->prefix = networkGetLeasePrefix(def, lease);
+
+    if (!(tmp->iface = strdup(def->bridge)) ||
+        !(tmp->ipaddr = strdup(lease->ipaddr)) ||
+        (lease->mac && !(tmp->mac = strdup(lease->mac))) ||
+        (lease->iaid && !(tmp->iaid = strdup(lease->iaid))) ||
+        (lease->hostname && !(tmp->hostname = strdup(lease->hostname))) ||
+        (lease->clientid && !(tmp->clientid = strdup(lease->clientid))))
+        goto no_memory;
+
+    *dst = tmp;
+    return 0;
+
+no_memory:
+    virReportOOMError();
+    virNetworkDHCPLeaseFree(tmp);
+    return -1;
+}
+
+static int
+networkGetDHCPLeases(virNetworkPtr net,
+                     const char *mac,
+                     virNetworkDHCPLeasePtr **leases,
+                     unsigned int flags)
+{
+    struct network_driver *driver = net->conn->networkPrivateData;
+    virNetworkObjPtr network;
+    virNetworkDHCPLeasePtr *tmp_leases = NULL;
+    virNetworkDHCPLeasePtr lease_ret;
+    dnsmasqLeaseIndexPtr idx = NULL;
+    dnsmasqLeasePtr lease;
+    char macstr[VIR_MAC_STRING_BUFLEN];
+    char *leasefile = NULL;
+    bool cached = false;
+    long long now = time(NULL);
+    size_t nleases = 0;
+    size_t i = 0;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (mac) {
+        virMacAddr addr;
+
+        if (virMacAddrParse(mac, &addr) < 0) {
+            virReportError(VIR_ERR_INVALID_MAC,
+                           _("unable to parse mac address '%s'"), mac);
+            return -1;
+        }
+        /* dnsmasq writes lower case MAC addresses, just like this */
+        virMacAddrFormat(&addr, macstr);
+    }
+
+    networkDriverLock(driver);
+    network = virNetworkFindByUUID(&driver->networks, net->uuid);
+    networkDriverUnlock(driver);
+
+    if (!network) {
+        virReportError(VIR_ERR_NO_NETWORK,
+                       "%s", _("no network with matching uuid"));
+        goto cleanup;
+    }
+
+    if (!virNetworkObjIsActive(network)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("network '%s' is not active"), network->def->name);
+        goto cleanup;
+    }
+
+    if (!(leasefile = networkDnsmasqLeaseFileName(network->def->name))) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    virMutexLock(&driver->leaseLock);
+
+    if (!(idx = networkGetLeaseIndex(driver, leasefile, &cached)))
+        goto unlock;
+
+    lease = mac ? dnsmasqLeaseIndexLookupByMac(idx, macstr)
+                : dnsmasqLeaseIndexGet(idx, i++);
+    while (lease) {
+        if (lease->expirytime == 0 || lease->expirytime >= now) {
+            if (leases) {
+                if (networkCopyLease(network->def, lease, &lease_ret) < 0)
+                    goto unlock;
+                if (VIR_APPEND_ELEMENT(tmp_leases, nleases, lease_ret) < 0) {
+                    virNetworkDHCPLeaseFree(lease_ret);
+                    virReportOOMError();
+                    goto unlock;
+                }
+            } else {
+                nleases++;
+            }
+        }
+
+        lease = mac ? lease->nextByMac : dnsmasqLeaseIndexGet(idx, i++);
+    }
+
+    if (leases) {
+        *leases = tmp_leases;
+        tmp_leases = NULL;
+    }
+    ret = nleases;
+
+unlock:
+    if (!cached)
+        dnsmasqLeaseIndexFree(idx);
+    virMutexUnlock(&driver->leaseLock);
+
+cleanup:
+    if (tmp_leases) {
+        for (i = 0; i < nleases; i++)
+            virNetworkDHCPLeaseFree(tmp_leases[i]);
+        VIR_FREE(tmp_leases);
+    }
+    VIR_FREE(leasefile);
+    if (network)
+        virNetworkObjUnlock(network);
+    return ret;
+}
+
 static virNetworkDriver networkDriver = {
     "Network",
     .open = networkOpenNetwork, /* 0.2.0 */
@@ -3580,6 +3972,8 @@ static virNetworkDriver networkDriver = {
     .networkSetAutostart = networkSetAutostart, /* 0.2.1 */
     .networkIsActive = networkIsActive, /* 0.7.3 */
     .networkIsPersistent = networkIsPersistent, /* 0.7.3 */
+    .networkGetDHCPLeases = networkGetDHCPLeases, /* 1.0.2 */
+    .connectGetListGeneration = networkGetListGeneration, /* 1.0.2 */
 };
 
 static virStateDriver networkStateDriver = {
@@ -3679,19 +4073,149 @@ finish:
     return ret;
 }
 
+#define NETWORK_SYSFS_NET "/sys/class/net/"
+#define NETWORK_SYSFS_PCI "/sys/bus/pci/devices/"
+
+/* networkForwardIfGetNumaNode:
+ * @dev: a device of a network's interface pool
+ *
+ * Returns the NUMA node @dev is attached to, or -1 if unknown.
+ */
+static int
+networkForwardIfGetNumaNode(virNetworkForwardIfDefPtr dev)
+{
+    char *path = NULL;
+    char *buf = NULL;
+    char *end;
+    int node = -1;
+    int rc;
+
+    if (dev->type == VIR_NETWORK_FORWARD_HOSTDEV_DEVICE_PCI)
+        rc = virAsprintf(&path, NETWORK_SYSFS_PCI "%04x:%02x:%02x.%x/numa_node",
+                         dev->device.pci.domain, dev->device.pci.bus,
+                         dev->device.pci.slot, dev->device.pci.function);
+    else
+        rc = virAsprintf(&path, NETWORK_SYSFS_NET "%s/device/numa_node",
+                         dev->device.dev);
+    if (rc < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (!virFileExists(path) ||
+        virFileReadAll(path, 32, &buf) < 0)
+        goto cleanup;
+
+    if (virStrToLong_i(buf, &end, 10, &node) < 0)
+        node = -1;
+
+cleanup:
+    VIR_FREE(buf);
+    VIR_FREE(path);
+    return node;
+}
+
+/* networkInterfacePoolInit:
+ * @netdef: the network owning the pool
+ *
+ * Builds the bitmap of unused devices of the interface pool and
+ * records the NUMA node of each device, unless already done.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+static int
+networkInterfacePoolInit(virNetworkDefPtr netdef)
+{
+    int ii;
+
+    if (netdef->forward.freeIfs || netdef->forward.nifs == 0)
+        return 0;
+
+    if (!(netdef->forward.freeIfs = virBitmapNew(netdef->forward.nifs))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (ii = 0; ii < netdef->forward.nifs; ii++) {
+        virNetworkForwardIfDefPtr dev = &netdef->forward.ifs[ii];
+
+        dev->numaNode = networkForwardIfGetNumaNode(dev);
+        if (dev->connections == 0)
+            ignore_value(virBitmapSetBit(netdef->forward.freeIfs, ii));
+    }
+
+    return 0;
+}
+
+/* networkInterfacePoolGetFree:
+ * @netdef: the network owning the pool
+ * @nodeset: NUMA nodes the guest is placed on, or NULL
+ *
+ * Returns an unused device of the pool, preferring one attached to a
+ * node in @nodeset, or NULL if all devices are in use.
+ */
+static virNetworkForwardIfDefPtr
+networkInterfacePoolGetFree(virNetworkDefPtr netdef,
+                            virBitmapPtr nodeset)
+{
+    ssize_t first;
+    ssize_t ii;
+
+    if (!netdef->forward.freeIfs ||
+        (first = virBitmapNextSetBit(netdef->forward.freeIfs, -1)) < 0)
+        return NULL;
+
+    if (!nodeset)
+        return &netdef->forward.ifs[first];
+
+    /* VFs of one PF share a node, so this normally stops at the
+     * first free device or after skipping a single remote PF. */
+    for (ii = first; ii >= 0;
+         ii = virBitmapNextSetBit(netdef->forward.freeIfs, ii)) {
+        int node = netdef->forward.ifs[ii].numaNode;
+        bool local = false;
+
+        if (node >= 0 &&
+            virBitmapGetBit(nodeset, node, &local) == 0 && local)
+            return &netdef->forward.ifs[ii];
+    }
+
+    return &netdef->forward.ifs[first];
+}
+
+static void
+networkForwardIfAddConnection(virNetworkDefPtr netdef,
+                              virNetworkForwardIfDefPtr dev)
+{
+    if (dev->connections++ == 0 && netdef->forward.freeIfs)
+        ignore_value(virBitmapClearBit(netdef->forward.freeIfs,
+                                       dev - netdef->forward.ifs));
+}
+
+static void
+networkForwardIfRemoveConnection(virNetworkDefPtr netdef,
+                                 virNetworkForwardIfDefPtr dev)
+{
+    if (--dev->connections == 0 && netdef->forward.freeIfs)
+        ignore_value(virBitmapSetBit(netdef->forward.freeIfs,
+                                     dev - netdef->forward.ifs));
+}
+
 /* networkAllocateActualDevice:
  * @iface: the original NetDef from the domain
+ * @nodeset: NUMA nodes the domain is placed on, or NULL
  *
  * Looks up the network reference by iface, allocates a physical
  * device from that network (if appropriate), and returns with the
  * virDomainActualNetDef filled in accordingly. If there are no
  * changes to be made in the netdef, then just leave the actualdef
- * empty.
+ * empty. Devices local to @nodeset are preferred.
  *
  * Returns 0 on success, -1 on failure.
  */
 int
-networkAllocateActualDevice(virDomainNetDefPtr iface)
+networkAllocateActualDevice(virDomainNetDefPtr iface,
+                            virBitmapPtr nodeset)
 {
     struct network_driver *driver = driverState;
     enum virDomainNetType actualType = iface->type;
@@ -3823,14 +4347,11 @@ networkAllocateActualDevice(virDomainNetDefPtr iface)
             networkCreateInterfacePool(netdef) < 0) {
             goto error;
         }
+        if (networkInterfacePoolInit(netdef) < 0)
+            goto error;
 
-        /* pick first dev with 0 connections */
-        for (ii = 0; ii < netdef->forward.nifs; ii++) {
-            if (netdef->forward.ifs[ii].connections == 0) {
-                dev = &netdef->forward.ifs[ii];
-                break;
-            }
-        }
+        /* pick an unused dev, close to the guest if possible */
+        dev = networkInterfacePoolGetFree(netdef, nodeset);
         if (!dev) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("network '%s' requires exclusive access "
@@ -3943,6 +4464,8 @@ networkAllocateActualDevice(virDomainNetDefPtr iface)
                 networkCreateInterfacePool(netdef) < 0) {
                 goto error;
             }
+            if (networkInterfacePoolInit(netdef) < 0)
+                goto error;
 
             /* PASSTHROUGH mode, and PRIVATE Mode + 802.1Qbh both
              * require exclusive access to a device, so current
@@ -3956,15 +4479,10 @@ networkAllocateActualDevice(virDomainNetDefPtr iface)
                  (iface->data.network.actual->virtPortProfile->virtPortType
                   == VIR_NETDEV_VPORT_PROFILE_8021QBH))) {
 
-                /* pick first dev with 0 connections */
-                for (ii = 0; ii < netdef->forward.nifs; ii++) {
-                    if (netdef->forward.ifs[ii].connections == 0) {
-                        dev = &netdef->forward.ifs[ii];
-                        break;
-                    }
-                }
-            } else {
-                /* pick least used dev */
+                /* pick an unused dev, close to the guest if possible */
+                dev = networkInterfacePoolGetFree(netdef, nodeset);
+            } else if (!(dev = networkInterfacePoolGetFree(netdef, nodeset))) {
+                /* no unused dev left, pick least used dev */
                 dev = &netdef->forward.ifs[0];
                 for (ii = 1; ii < netdef->forward.nifs; ii++) {
                     if (netdef->forward.ifs[ii].connections < dev->connections)
@@ -4035,7 +4553,7 @@ validate:
 
     if (dev) {
         /* we are now assured of success, so mark the allocation */
-        dev->connections++;
+        networkForwardIfAddConnection(netdef, dev);
         if (actualType != VIR_DOMAIN_NET_TYPE_HOSTDEV) {
             VIR_DEBUG("Using physical device %s, %d connections",
                       dev->device.dev, dev->connections);
@@ -4167,7 +4685,7 @@ networkNotifyActualDevice(virDomainNetDefPtr iface)
         }
 
         /* we are now assured of success, so mark the allocation */
-        dev->connections++;
+        networkForwardIfAddConnection(netdef, dev);
         VIR_DEBUG("Using physical device %s, connections %d",
                   dev->device.dev, dev->connections);
 
@@ -4222,7 +4740,7 @@ networkNotifyActualDevice(virDomainNetDefPtr iface)
         }
 
         /* we are now assured of success, so mark the allocation */
-        dev->connections++;
+        networkForwardIfAddConnection(netdef, dev);
         VIR_DEBUG("Using physical device %04x:%02x:%02x.%x, connections %d",
                   dev->device.pci.domain, dev->device.pci.bus,
                   dev->device.pci.slot, dev->device.pci.function,
@@ -4327,7 +4845,7 @@ networkReleaseActualDevice(virDomainNetDefPtr iface)
             goto error;
         }
 
-        dev->connections--;
+        networkForwardIfRemoveConnection(netdef, dev);
         VIR_DEBUG("Releasing physical device %s, connections %d",
                   dev->device.dev, dev->connections);
 
@@ -4363,7 +4881,7 @@ networkReleaseActualDevice(virDomainNetDefPtr iface)
                 goto error;
         }
 
-        dev->connections--;
+        networkForwardIfRemoveConnection(netdef, dev);
         VIR_DEBUG("Releasing physical device %04x:%02x:%02x.%x, connections %d",
                   dev->device.pci.domain, dev->device.pci.bus,
                   dev->device.pci.slot, dev->device.pci.function,
@@ -36,7 +36,8 @@
 int networkRegister(void);
 
 # if WITH_NETWORK
-int networkAllocateActualDevice(virDomainNetDefPtr iface)
+int networkAllocateActualDevice(virDomainNetDefPtr iface,
+                                virBitmapPtr nodeset)
     ATTRIBUTE_NONNULL(1);
 int networkNotifyActualDevice(virDomainNetDefPtr iface)
     ATTRIBUTE_NONNULL(1);
@@ -53,7 +54,7 @@ int networkDnsmasqConfContents(virNetworkObjPtr network,
                         dnsmasqCapsPtr caps);
 # else
 /* Define no-op replacements that don't drag in any link dependencies.  */
-#  define networkAllocateActualDevice(iface) 0
+#  define networkAllocateActualDevice(iface, nodeset) 0
 #  define networkNotifyActualDevice(iface) (iface=iface, 0)
 #  define networkReleaseActualDevice(iface) (iface=iface, 0)
 #  define networkGetNetworkAddress(netname, netaddr) (-2)
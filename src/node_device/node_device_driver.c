@@ -42,10 +42,14 @@
 #define VIR_FROM_THIS VIR_FROM_NODEDEV
 
 
-static int update_caps(virNodeDeviceObjPtr dev)
+static int update_caps(virDeviceMonitorStatePtr driver,
+                       virNodeDeviceObjPtr dev)
 {
     virNodeDevCapsDefPtr cap = dev->def->caps;
 
+    if (driver->updateDef && driver->updateDef(dev->def) < 0)
+        return -1;
+
     while (cap) {
         /* The only caps that currently need updating are FC related. */
         if (cap->type == VIR_NODE_DEV_CAP_SCSI_HOST) {
@@ -238,6 +242,24 @@ nodeDeviceLookupByWWN(virConnectPtr conn,
 
     nodeDeviceLock(driver);
 
+    if ((obj = virNodeDeviceFindByWWN(devs, wwnn, wwpn))) {
+        for (cap = obj->def->caps; cap; cap = cap->next) {
+            if (cap->type != VIR_NODE_DEV_CAP_SCSI_HOST)
+                continue;
+            check_fc_host(&cap->data);
+            if ((cap->data.scsi_host.flags &
+                 VIR_NODE_DEV_CAP_FLAG_HBA_FC_HOST) &&
+                STREQ(cap->data.scsi_host.wwnn, wwnn) &&
+                STREQ(cap->data.scsi_host.wwpn, wwpn)) {
+                dev = virGetNodeDevice(conn, obj->def->name);
+                virNodeDeviceObjUnlock(obj);
+                goto out;
+            }
+        }
+        virNodeDeviceObjUnlock(obj);
+    }
+
+    /* The index may be stale if the WWNs changed behind our back */
     for (i = 0; i < devs->count; i++) {
 
         obj = devs->objs[i];
@@ -293,7 +315,7 @@ nodeDeviceGetXMLDesc(virNodeDevicePtr dev,
     }
 
     update_driver_name(obj);
-    update_caps(obj);
+    update_caps(driver, obj);
 
     ret = virNodeDeviceDefFormat(obj->def);
 
@@ -52,6 +52,22 @@ struct _udevPrivate {
 
 static virDeviceMonitorStatePtr driverState = NULL;
 
+/* pci_get_strings is not thread safe, and is called with only the
+ * device lock held */
+static virMutex udevPCIIdsLock;
+
+static int udevPCIIdsOnceInit(void)
+{
+    if (virMutexInit(&udevPCIIdsLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(udevPCIIds)
+
 static int udevStrToLong_ull(char const *s,
                              char **end_ptr,
                              int base,
@@ -409,6 +425,42 @@ out:
 }
 
 
+/*
+ * Resolving PCI IDs to names means searching the PCI ID database,
+ * which for a host with thousands of devices (SR-IOV VFs, mostly)
+ * dominates startup, so it is deferred until a device's XML is
+ * actually wanted.
+ */
+static int udevUpdateDef(virNodeDeviceDefPtr def)
+{
+    virNodeDevCapsDefPtr cap;
+    int ret = 0;
+
+    for (cap = def->caps; cap; cap = cap->next) {
+        union _virNodeDevCapData *data = &cap->data;
+
+        if (cap->type != VIR_NODE_DEV_CAP_PCI_DEV ||
+            data->pci_dev.vendor_name || data->pci_dev.product_name)
+            continue;
+
+        if (udevPCIIdsInitialize() < 0)
+            return -1;
+
+        virMutexLock(&udevPCIIdsLock);
+        ret = udevTranslatePCIIds(data->pci_dev.vendor,
+                                  data->pci_dev.product,
+                                  &data->pci_dev.vendor_name,
+                                  &data->pci_dev.product_name);
+        virMutexUnlock(&udevPCIIdsLock);
+
+        if (ret < 0)
+            break;
+    }
+
+    return ret;
+}
+
+
 static int udevProcessPCI(struct udev_device *device,
                           virNodeDeviceDefPtr def)
 {
@@ -470,12 +522,8 @@ static int udevProcessPCI(struct udev_device *device,
         goto out;
     }
 
-    if (udevTranslatePCIIds(data->pci_dev.vendor,
-                            data->pci_dev.product,
-                            &data->pci_dev.vendor_name,
-                            &data->pci_dev.product_name) != 0) {
-        goto out;
-    }
+    /* The vendor and product names are looked up in the PCI ID
+     * database only when someone asks for them, see udevUpdateDef */
 
     if (udevGenerateDeviceName(device, def, NULL) != 0) {
         goto out;
@@ -1647,6 +1695,8 @@ static int udevDeviceMonitorStartup(bool privileged ATTRIBUTE_UNUSED,
         goto out;
     }
 
+    driverState->updateDef = udevUpdateDef;
+
     if (virMutexInit(&driverState->lock) < 0) {
         VIR_ERROR(_("Failed to initialize mutex for driverState"));
         VIR_FREE(priv);
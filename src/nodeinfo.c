@@ -31,6 +31,7 @@
 #include <dirent.h>
 #include <sys/utsname.h>
 #include <sched.h>
+#include <fcntl.h>
 #include "conf/domain_conf.h"
 
 #if HAVE_NUMACTL
@@ -50,6 +51,9 @@
 #include "virarch.h"
 #include "virfile.h"
 #include "virtypedparam.h"
+#include "virstatfile.h"
+#include "buf.h"
+#include "threads.h"
 
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -685,21 +689,22 @@ int linuxNodeGetMemoryStats(FILE *meminfo,
                             int *nparams)
 {
     int ret = -1;
-    int i = 0, j = 0, k = 0;
+    size_t j;
+    int k = 0;
     int found = 0;
     int nr_param;
     char line[1024];
-    char meminfo_hdr[VIR_NODE_MEMORY_STATS_FIELD_LENGTH];
-    unsigned long val;
-    struct field_conv {
-        const char *meminfo_hdr;  // meminfo header
-        const char *field;        // MemoryStats field name
-    } field_conv[] = {
-        {"MemTotal:", VIR_NODE_MEMORY_STATS_TOTAL},
-        {"MemFree:",  VIR_NODE_MEMORY_STATS_FREE},
-        {"Buffers:",  VIR_NODE_MEMORY_STATS_BUFFERS},
-        {"Cached:",   VIR_NODE_MEMORY_STATS_CACHED},
-        {NULL,        NULL}
+    virStatFileField fields[] = {
+        { "MemTotal", 0, false },
+        { "MemFree", 0, false },
+        { "Buffers", 0, false },
+        { "Cached", 0, false },
+    };
+    const char *field_names[] = {
+        VIR_NODE_MEMORY_STATS_TOTAL,
+        VIR_NODE_MEMORY_STATS_FREE,
+        VIR_NODE_MEMORY_STATS_BUFFERS,
+        VIR_NODE_MEMORY_STATS_CACHED,
     };
 
     if (cellNum == VIR_NODE_MEMORY_STATS_ALL_CELLS) {
@@ -722,54 +727,22 @@ int linuxNodeGetMemoryStats(FILE *meminfo,
         goto cleanup;
     }
 
-    while (fgets(line, sizeof(line), meminfo) != NULL) {
-        char *buf = line;
-
-        if (STRPREFIX(buf, "Node ")) {
-            /*
-             * /sys/devices/system/node/nodeX/meminfo format is below.
-             * So, skip prefix "Node XX ".
-             *
-             * Node 0 MemTotal:        8386980 kB
-             * Node 0 MemFree:         5300920 kB
-             *         :
-             */
-            char *p;
-
-            p = buf;
-            for (i = 0; i < 2; i++) {
-                p = strchr(p, ' ');
-                if (p == NULL) {
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   "%s", _("no prefix found"));
-                    goto cleanup;
-                }
-                p++;
-            }
-            buf = p;
-        }
-
-        if (sscanf(buf, "%s %lu kB", meminfo_hdr, &val) < 2)
-            continue;
-
-        for (j = 0; field_conv[j].meminfo_hdr != NULL; j++) {
-            struct field_conv *convp = &field_conv[j];
-
-            if (STREQ(meminfo_hdr, convp->meminfo_hdr)) {
-                virNodeMemoryStatsPtr param = &params[k++];
-
-                if (virStrcpyStatic(param->field, convp->field) == NULL) {
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   "%s", _("Field kernel memory too long for destination"));
-                    goto cleanup;
-                }
-                param->value = val;
-                found++;
-                break;
-            }
+    while (found < nr_param && fgets(line, sizeof(line), meminfo) != NULL) {
+        /*
+         * /sys/devices/system/node/nodeX/meminfo format is below.
+         * So, skip prefix "Node XX ".
+         *
+         * Node 0 MemTotal:        8386980 kB
+         * Node 0 MemFree:         5300920 kB
+         *         :
+         */
+        found = virStatFileScan(line, STRPREFIX(line, "Node ") ? 2 : 0,
+                                fields, ARRAY_CARDINALITY(fields));
+        if (found < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("invalid memory line '%s'"), line);
+            goto cleanup;
         }
-        if (found >= nr_param)
-            break;
     }
 
     if (found == 0) {
@@ -778,6 +751,21 @@ int linuxNodeGetMemoryStats(FILE *meminfo,
         goto cleanup;
     }
 
+    for (j = 0; j < ARRAY_CARDINALITY(fields) && k < nr_param; j++) {
+        virNodeMemoryStatsPtr param = &params[k];
+
+        if (!fields[j].found)
+            continue;
+
+        if (virStrcpyStatic(param->field, field_names[j]) == NULL) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "%s", _("Field kernel memory too long for destination"));
+            goto cleanup;
+        }
+        param->value = fields[j].value;
+        k++;
+    }
+
     ret = 0;
 
 cleanup:
@@ -842,6 +830,121 @@ error:
 }
 #endif
 
+#ifdef __linux__
+/* Discovering the CPU topology of a large host means walking every
+ * cpu directory in sysfs, yet the result only changes when CPUs are
+ * plugged, unplugged, onlined or offlined.  What nodeGetInfo and
+ * nodeCapsInitNUMA discover is therefore remembered along with the
+ * contents of cpu/present and cpu/online at the time, and discovered
+ * again only once those differ.  */
+struct nodeNUMACell {
+    int num;
+    int ncpus;
+    int *cpus;
+};
+
+static virMutex nodeTopologyLock;
+static char *nodeTopologyKey;
+static bool nodeInfoCached;
+static virNodeInfo nodeInfoCache;
+static bool nodeNUMACached;
+static struct nodeNUMACell *nodeNUMACells;
+static size_t nodeNUMANCells;
+
+static int nodeTopologyOnceInit(void)
+{
+    if (virMutexInit(&nodeTopologyLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(nodeTopology)
+
+static void
+nodeNUMACellsFree(void)
+{
+    size_t i;
+
+    for (i = 0; i < nodeNUMANCells; i++)
+        VIR_FREE(nodeNUMACells[i].cpus);
+    VIR_FREE(nodeNUMACells);
+    nodeNUMANCells = 0;
+    nodeNUMACached = false;
+}
+
+static void
+nodeTopologyFlush(void)
+{
+    nodeNUMACellsFree();
+    nodeInfoCached = false;
+}
+
+/* Append the contents of @path, if any, to @buf.  Kernels lacking the
+ * file lack CPU hotplug altogether, so its absence is not an error. */
+static int
+nodeTopologyReadKey(virBufferPtr buf, const char *path)
+{
+    char *str = NULL;
+    int fd;
+    int len;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return errno == ENOENT ? 0 : -1;
+
+    len = virFileReadLimFD(fd, 64 * 1024, &str);
+    VIR_FORCE_CLOSE(fd);
+    if (len < 0)
+        return -1;
+
+    virBufferAdd(buf, str, len);
+    virBufferAddChar(buf, '|');
+    VIR_FREE(str);
+    return 0;
+}
+
+/* Forget the cached topology if the present or online CPUs changed
+ * since it was discovered.  Returns true if whatever is discovered
+ * now may be cached.  Must be called with nodeTopologyLock held.  */
+static bool
+nodeTopologyRevalidate(void)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *key;
+
+    if (nodeTopologyReadKey(&buf, SYSFS_SYSTEM_PATH "/cpu/present") < 0 ||
+        nodeTopologyReadKey(&buf, SYSFS_SYSTEM_PATH "/cpu/online") < 0 ||
+        virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        nodeTopologyFlush();
+        VIR_FREE(nodeTopologyKey);
+        return false;
+    }
+
+    key = virBufferContentAndReset(&buf);
+    if (!key && !(key = strdup(""))) {
+        nodeTopologyFlush();
+        VIR_FREE(nodeTopologyKey);
+        return false;
+    }
+
+    if (!nodeTopologyKey || STRNEQ(key, nodeTopologyKey)) {
+        if (nodeTopologyKey)
+            VIR_DEBUG("Host CPUs changed, rediscovering topology");
+        nodeTopologyFlush();
+        VIR_FREE(nodeTopologyKey);
+        nodeTopologyKey = key;
+    } else {
+        VIR_FREE(key);
+    }
+
+    return true;
+}
+#endif
+
 int nodeGetInfo(virConnectPtr conn ATTRIBUTE_UNUSED, virNodeInfoPtr nodeinfo)
 {
     virArch hostarch = virArchFromHost();
@@ -852,21 +955,46 @@ int nodeGetInfo(virConnectPtr conn ATTRIBUTE_UNUSED, virNodeInfoPtr nodeinfo)
 #ifdef __linux__
     {
     int ret = -1;
-    FILE *cpuinfo = fopen(CPUINFO_PATH, "r");
-    if (!cpuinfo) {
+    FILE *cpuinfo = NULL;
+    bool cacheable;
+
+    if (nodeTopologyInitialize() < 0)
+        return -1;
+
+    virMutexLock(&nodeTopologyLock);
+    cacheable = nodeTopologyRevalidate();
+    if (nodeInfoCached) {
+        nodeinfo->cpus = nodeInfoCache.cpus;
+        nodeinfo->mhz = nodeInfoCache.mhz;
+        nodeinfo->nodes = nodeInfoCache.nodes;
+        nodeinfo->sockets = nodeInfoCache.sockets;
+        nodeinfo->cores = nodeInfoCache.cores;
+        nodeinfo->threads = nodeInfoCache.threads;
+        ret = 0;
+        goto memory;
+    }
+
+    if (!(cpuinfo = fopen(CPUINFO_PATH, "r"))) {
         virReportSystemError(errno,
                              _("cannot open %s"), CPUINFO_PATH);
-        return -1;
+        goto cleanup;
     }
 
     ret = linuxNodeInfoCPUPopulate(cpuinfo, SYSFS_SYSTEM_PATH, nodeinfo);
     if (ret < 0)
         goto cleanup;
 
+    if (cacheable) {
+        nodeInfoCache = *nodeinfo;
+        nodeInfoCached = true;
+    }
+
+memory:
     /* Convert to KB. */
     nodeinfo->memory = physmem_total() / 1024;
 
 cleanup:
+    virMutexUnlock(&nodeTopologyLock);
     VIR_FORCE_FCLOSE(cpuinfo);
     return ret;
     }
@@ -1410,6 +1538,127 @@ cleanup:
 # define MASK_CPU_ISSET(mask, cpu) \
   (((mask)[((cpu) / n_bits(*(mask)))] >> ((cpu) % n_bits(*(mask)))) & 1)
 
+# ifdef __linux__
+static int
+nodeReadHugepageCount(const char *dir,
+                      const char *field,
+                      unsigned long long *value)
+{
+    char *path = NULL;
+    char *buf = NULL;
+    char *tmp;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/%s", dir, field) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (virFileReadAll(path, 1024, &buf) < 0)
+        goto cleanup;
+
+    if ((tmp = strchr(buf, '\n')))
+        *tmp = '\0';
+
+    if (virStrToLong_ull(buf, NULL, 10, value) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("failed to parse %s"), path);
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(buf);
+    return ret;
+}
+
+/*
+ * The huge page pools of a cell are not part of the cached topology:
+ * guests keep allocating from them, so they are read again each time
+ * the capabilities are built.
+ */
+static int
+nodeCapsAddNUMACellPages(virCapsPtr caps, int cell)
+{
+    char *hugedir = NULL;
+    char *pooldir = NULL;
+    DIR *dir = NULL;
+    struct dirent *entry;
+    int ret = -1;
+
+    if (virAsprintf(&hugedir, "%s/node/node%d/hugepages",
+                    SYSFS_SYSTEM_PATH, cell) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (!(dir = opendir(hugedir))) {
+        /* no huge page support in the kernel */
+        ret = 0;
+        goto cleanup;
+    }
+
+    while ((entry = readdir(dir))) {
+        unsigned int size;
+        unsigned long long total;
+        unsigned long long avail;
+
+        if (sscanf(entry->d_name, "hugepages-%ukB", &size) != 1)
+            continue;
+
+        if (virAsprintf(&pooldir, "%s/%s", hugedir, entry->d_name) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        if (nodeReadHugepageCount(pooldir, "nr_hugepages", &total) < 0 ||
+            nodeReadHugepageCount(pooldir, "free_hugepages", &avail) < 0)
+            goto cleanup;
+
+        if (virCapabilitiesAddHostNUMACellPages(caps, cell, size,
+                                                total, avail) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        VIR_FREE(pooldir);
+    }
+
+    ret = 0;
+cleanup:
+    if (dir)
+        closedir(dir);
+    VIR_FREE(pooldir);
+    VIR_FREE(hugedir);
+    return ret;
+}
+# else
+static int
+nodeCapsAddNUMACellPages(virCapsPtr caps ATTRIBUTE_UNUSED,
+                         int cell ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+# endif
+
+static int
+nodeCapsAddCachedNUMA(virCapsPtr caps)
+{
+    size_t i;
+
+    for (i = 0; i < nodeNUMANCells; i++) {
+        if (virCapabilitiesAddHostNUMACell(caps,
+                                           nodeNUMACells[i].num,
+                                           nodeNUMACells[i].ncpus,
+                                           nodeNUMACells[i].cpus) < 0 ||
+            nodeCapsAddNUMACellPages(caps, nodeNUMACells[i].num) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
 int
 nodeCapsInitNUMA(virCapsPtr caps)
 {
@@ -1419,10 +1668,21 @@ nodeCapsInitNUMA(virCapsPtr caps)
     int *cpus = NULL;
     int ret = -1;
     int max_n_cpus = NUMA_MAX_N_CPUS;
+    bool cacheable;
 
     if (numa_available() < 0)
         return 0;
 
+    if (nodeTopologyInitialize() < 0)
+        return -1;
+
+    virMutexLock(&nodeTopologyLock);
+    cacheable = nodeTopologyRevalidate();
+    if (nodeNUMACached) {
+        ret = nodeCapsAddCachedNUMA(caps);
+        goto cleanup;
+    }
+
     int mask_n_bytes = max_n_cpus / 8;
     if (VIR_ALLOC_N(mask, mask_n_bytes / sizeof(*mask)) < 0)
         goto cleanup;
@@ -1460,15 +1720,32 @@ nodeCapsInitNUMA(virCapsPtr caps)
         if (virCapabilitiesAddHostNUMACell(caps,
                                            n,
                                            ncpus,
-                                           cpus) < 0)
+                                           cpus) < 0 ||
+            nodeCapsAddNUMACellPages(caps, n) < 0)
             goto cleanup;
 
+        if (cacheable) {
+            if (VIR_EXPAND_N(nodeNUMACells, nodeNUMANCells, 1) < 0) {
+                cacheable = false;
+                nodeNUMACellsFree();
+            } else {
+                nodeNUMACells[nodeNUMANCells - 1].num = n;
+                nodeNUMACells[nodeNUMANCells - 1].ncpus = ncpus;
+                nodeNUMACells[nodeNUMANCells - 1].cpus = cpus;
+                cpus = NULL;
+            }
+        }
+
         VIR_FREE(cpus);
     }
 
+    nodeNUMACached = cacheable;
     ret = 0;
 
 cleanup:
+    if (ret < 0 && !nodeNUMACached)
+        nodeNUMACellsFree();
+    virMutexUnlock(&nodeTopologyLock);
     VIR_FREE(cpus);
     VIR_FREE(mask);
     VIR_FREE(allonesmask);
@@ -76,18 +76,31 @@
 # define LEASEFILE LOCALSTATEDIR "/run/libvirt/network/nwfilter.leases"
 # define TMPLEASEFILE LOCALSTATEDIR "/run/libvirt/network/nwfilter.ltmp"
 
+# define SNOOP_HOUSEKEEPING_INTERVAL_MS 1000 /* lease expiry & file flush */
+
+typedef struct _virNWFilterSnoopCapture virNWFilterSnoopCapture;
+typedef virNWFilterSnoopCapture *virNWFilterSnoopCapturePtr;
+
 struct virNWFilterSnoopState {
     /* lease file */
-    int                  leaseFD;
-    int                  nLeases; /* number of active leases */
-    int                  wLeases; /* number of written leases */
-    int                  nThreads; /* number of running threads */
+    int                  leasesDirty; /* leases changed since last write */
     /* thread management */
     virHashTablePtr      snoopReqs;
     virHashTablePtr      ifnameToKey;
     virMutex             snoopLock;  /* protects SnoopReqs and IfNameToKey */
     virHashTablePtr      active;
     virMutex             activeLock; /* protects Active */
+    /* the snooping thread capturing on all interfaces */
+    virThread            captureThread;
+    bool                 captureThreadRunning;
+    int                  captureQuit;
+    int                  wakeupFDs[2];
+    virNWFilterSnoopCapturePtr *newCaptures; /* not yet polled */
+    size_t               nNewCaptures;
+    virMutex             captureLock; /* protects newCaptures */
+    /* the worker shared by all interfaces */
+    virThreadPoolPtr     worker;
+    int                  housekeeping; /* housekeeping job is queued */
 };
 
 # define virNWFilterSnoopLock() \
@@ -115,12 +128,6 @@ typedef virNWFilterSnoopReq *virNWFilterSnoopReqPtr;
 typedef struct _virNWFilterSnoopIPLease virNWFilterSnoopIPLease;
 typedef virNWFilterSnoopIPLease *virNWFilterSnoopIPLeasePtr;
 
-typedef enum {
-    THREAD_STATUS_NONE,
-    THREAD_STATUS_OK,
-    THREAD_STATUS_FAIL,
-} virNWFilterSnoopThreadStatus;
-
 struct _virNWFilterSnoopReq {
     /*
      * reference counter: while the req is on the
@@ -144,11 +151,9 @@ struct _virNWFilterSnoopReq {
     virNWFilterSnoopIPLeasePtr           end;
     char                                *threadkey;
 
-    virNWFilterSnoopThreadStatus         threadStatus;
-    virCond                              threadStatusCond;
+    /* the number of submitted jobs in the worker's queue per direction */
+    int                                  qCtr[2];
 
-    int                                  jobCompletionStatus;
-    /* the number of submitted jobs in the worker's queue */
     /*
      * protect those members that can change while the
      * req is on the public SnoopReq hash and
@@ -158,7 +163,6 @@ struct _virNWFilterSnoopReq {
      * - start
      * - end
      * - a lease while it is on the list
-     * - threadStatus
      * (for refctr, see above)
      */
     virMutex                             lock;
@@ -238,6 +242,7 @@ typedef struct _virNWFilterDHCPDecodeJob virNWFilterDHCPDecodeJob;
 typedef virNWFilterDHCPDecodeJob *virNWFilterDHCPDecodeJobPtr;
 
 struct _virNWFilterDHCPDecodeJob {
+    virNWFilterSnoopReqPtr req; /* NULL for the housekeeping job */
     unsigned char packet[PCAP_PBUFSIZE];
     int caplen;
     bool fromVM;
@@ -259,9 +264,9 @@ struct _virNWFilterSnoopRateLimitConf {
     time_t prev;
     unsigned int pkt_ctr;
     time_t burst;
-    const unsigned int rate;
-    const unsigned int burstRate;
-    const unsigned int burstInterval;
+    unsigned int rate;
+    unsigned int burstRate;
+    unsigned int burstInterval;
 };
 
 typedef struct _virNWFilterSnoopPcapConf virNWFilterSnoopPcapConf;
@@ -269,14 +274,52 @@ typedef virNWFilterSnoopPcapConf *virNWFilterSnoopPcapConfPtr;
 
 struct _virNWFilterSnoopPcapConf {
     pcap_t *handle;
-    const pcap_direction_t dir;
+    pcap_direction_t dir;
     const char *filter;
     virNWFilterSnoopRateLimitConf rateLimit; /* indep. rate limiters */
-    int qCtr; /* number of jobs in the worker's queue */
-    const unsigned int maxQSize;
+    unsigned int maxQSize;
     unsigned long long penaltyTimeoutAbs;
 };
 
+static const virNWFilterSnoopPcapConf virNWFilterSnoopPcapConfTemplate[2] = {
+    {
+        .dir = PCAP_D_IN, /* from VM */
+        .filter = "dst port 67 and src port 68",
+        .rateLimit = {
+            .rate = DHCP_PKT_RATE,
+            .burstRate = DHCP_PKT_BURST,
+            .burstInterval = DHCP_BURST_INTERVAL_S,
+        },
+        .maxQSize = MAX_QUEUED_JOBS,
+    }, {
+        .dir = PCAP_D_OUT, /* to VM */
+        .filter = "src port 67 and dst port 68",
+        .rateLimit = {
+            .rate = DHCP_PKT_RATE,
+            .burstRate = DHCP_PKT_BURST,
+            .burstInterval = DHCP_BURST_INTERVAL_S,
+        },
+        .maxQSize = MAX_QUEUED_JOBS,
+    },
+};
+
+/*
+ * The packet captures on the interface of a snoop request; owned
+ * by the snooping thread once handed over to it.
+ */
+struct _virNWFilterSnoopCapture {
+    virNWFilterSnoopReqPtr req; /* holds a reference */
+    char *threadkey;
+    char *ifname;
+    int ifindex;
+    int errcount;
+    bool failed;
+    time_t last_displayed;
+    time_t last_displayed_queue;
+    /* same order as virNWFilterSnoopPcapConfTemplate */
+    virNWFilterSnoopPcapConf pcapConf[2];
+};
+
 /* local function prototypes */
 static int virNWFilterSnoopReqLeaseDel(virNWFilterSnoopReqPtr req,
                                        virSocketAddrPtr ipaddr,
@@ -286,12 +329,13 @@ static int virNWFilterSnoopReqLeaseDel(virNWFilterSnoopReqPtr req,
 static void virNWFilterSnoopReqLock(virNWFilterSnoopReqPtr req);
 static void virNWFilterSnoopReqUnlock(virNWFilterSnoopReqPtr req);
 
-static void virNWFilterSnoopLeaseFileLoad(void);
-static void virNWFilterSnoopLeaseFileSave(virNWFilterSnoopIPLeasePtr ipl);
+static void virNWFilterSnoopLeaseFileSave(void);
+static void virNWFilterSnoopLeaseFileFlush(void);
+static void virNWFilterSnoopCaptureWakeup(void);
 
 /* local variables */
 static struct virNWFilterSnoopState virNWFilterSnoopState = {
-    .leaseFD = -1,
+    .wakeupFDs = { -1, -1 },
 };
 
 static const unsigned char dhcp_magic[4] = { 99, 130, 83, 99 };
@@ -330,6 +374,9 @@ virNWFilterSnoopCancel(char **threadKey)
     VIR_FREE(*threadKey);
 
     virNWFilterSnoopActiveUnlock();
+
+    /* have the snooping thread release the interface's capture */
+    virNWFilterSnoopCaptureWakeup();
 }
 
 static bool
@@ -587,22 +634,14 @@ virNWFilterSnoopReqNew(const char *ifkey)
         return NULL;
     }
 
-    req->threadStatus = THREAD_STATUS_NONE;
-
     if (virStrcpyStatic(req->ifkey, ifkey) == NULL ||
         virMutexInitRecursive(&req->lock) < 0)
         goto err_free_req;
 
-    if (virCondInit(&req->threadStatusCond) < 0)
-        goto err_destroy_mutex;
-
     virNWFilterSnoopReqGet(req);
 
     return req;
 
-err_destroy_mutex:
-    virMutexDestroy(&req->lock);
-
 err_free_req:
     VIR_FREE(req);
 
@@ -636,7 +675,6 @@ virNWFilterSnoopReqFree(virNWFilterSnoopReqPtr req)
     virNWFilterHashTableFree(req->vars);
 
     virMutexDestroy(&req->lock);
-    ignore_value(virCondDestroy(&req->threadStatusCond));
 
     VIR_FREE(req);
 }
@@ -781,11 +819,9 @@ virNWFilterSnoopReqLeaseAdd(virNWFilterSnoopReqPtr req,
     /* put the lease on the req's list */
     virNWFilterSnoopIPLeaseTimerAdd(pl);
 
-    virAtomicIntInc(&virNWFilterSnoopState.nLeases);
-
 exit:
     if (update_leasefile)
-        virNWFilterSnoopLeaseFileSave(pl);
+        virNWFilterSnoopLeaseFileSave();
 
     return 0;
 }
@@ -863,7 +899,7 @@ virNWFilterSnoopReqLeaseDel(virNWFilterSnoopReqPtr req,
     /* lease is off the list now */
 
     if (update_leasefile)
-        virNWFilterSnoopLeaseFileSave(ipl);
+        virNWFilterSnoopLeaseFileSave();
 
     ipAddrLeft = virNWFilterIPAddrMapDelIPAddr(req->ifname, ipstr);
 
@@ -897,8 +933,6 @@ virNWFilterSnoopReqLeaseDel(virNWFilterSnoopReqPtr req,
 skip_instantiate:
     VIR_FREE(ipl);
 
-    virAtomicIntDecAndTest(&virNWFilterSnoopState.nLeases);
-
 lease_not_found:
     VIR_FREE(ipstr);
 
@@ -1161,33 +1195,148 @@ cleanup_nohandle:
     return NULL;
 }
 
+/*
+ * Stop snooping on the interface of a request unless the request has
+ * been re-activated under a different thread key in the meantime.
+ * A NULL @threadkey stops snooping regardless of the key.
+ * The request is kept along with its leases.
+ */
+static void
+virNWFilterSnoopReqStop(virNWFilterSnoopReqPtr req, const char *threadkey)
+{
+    /* protect IfNameToKey */
+    virNWFilterSnoopLock();
+
+    /* protect req->ifname & req->threadkey */
+    virNWFilterSnoopReqLock(req);
+
+    if (req->threadkey &&
+        (threadkey == NULL || STREQ(req->threadkey, threadkey))) {
+        virNWFilterSnoopCancel(&req->threadkey);
+
+        if (req->ifname)
+            ignore_value(virHashRemoveEntry(virNWFilterSnoopState.ifnameToKey,
+                                            req->ifname));
+
+        VIR_FREE(req->ifname);
+    }
+
+    virNWFilterSnoopReqUnlock(req);
+    virNWFilterSnoopUnlock();
+}
+
+typedef struct _virNWFilterSnoopReqList virNWFilterSnoopReqList;
+typedef virNWFilterSnoopReqList *virNWFilterSnoopReqListPtr;
+
+struct _virNWFilterSnoopReqList {
+    time_t now;
+    virNWFilterSnoopReqPtr *reqs;
+    size_t nreqs;
+};
+
+/*
+ * Iterator collecting the snooped requests that have expired leases;
+ * a reference is taken on every collected request.
+ * Call this function with the SnoopLock held.
+ */
+static void
+virNWFilterSnoopExpiredIter(void *payload,
+                            const void *name ATTRIBUTE_UNUSED,
+                            void *data)
+{
+    virNWFilterSnoopReqPtr req = payload;
+    virNWFilterSnoopReqListPtr list = data;
+
+    /* protect req->threadkey & req->start */
+    virNWFilterSnoopReqLock(req);
+
+    /* on OOM the request is simply picked up by the next run */
+    if (req->threadkey && req->start && req->start->timeout <= list->now &&
+        VIR_APPEND_ELEMENT_COPY(list->reqs, list->nreqs, req) == 0)
+        virNWFilterSnoopReqGet(req);
+
+    virNWFilterSnoopReqUnlock(req);
+}
+
+/*
+ * Periodic housekeeping run by the worker: expire the leases of the
+ * snooped interfaces and write the lease changes of all interfaces
+ * to the lease file in one go.
+ */
+static void
+virNWFilterSnoopHousekeeping(void)
+{
+    virNWFilterSnoopReqList list = { .now = time(0) };
+    size_t i;
+
+    virNWFilterSnoopLock();
+
+    if (virNWFilterSnoopState.snoopReqs)
+        virHashForEach(virNWFilterSnoopState.snoopReqs,
+                       virNWFilterSnoopExpiredIter, &list);
+
+    virNWFilterSnoopUnlock();
+
+    /* re-instantiate the filters without holding the SnoopLock */
+    for (i = 0; i < list.nreqs; i++) {
+        virNWFilterSnoopReqLeaseTimerRun(list.reqs[i]);
+        virNWFilterSnoopReqPut(list.reqs[i]);
+    }
+    VIR_FREE(list.reqs);
+
+    virNWFilterSnoopLeaseFileFlush();
+}
+
 /*
  * Worker function to decode the DHCP message and with that
- * also do the time-consuming work of instantiating the filters
+ * also do the time-consuming work of instantiating the filters.
+ * The worker is shared by all interfaces; a job without a req
+ * runs the housekeeping.
  */
-static void virNWFilterDHCPDecodeWorker(void *jobdata, void *opaque)
+static void virNWFilterDHCPDecodeWorker(void *jobdata,
+                                        void *opaque ATTRIBUTE_UNUSED)
 {
-    virNWFilterSnoopReqPtr req = opaque;
     virNWFilterDHCPDecodeJobPtr job = jobdata;
+    virNWFilterSnoopReqPtr req = job->req;
     virNWFilterSnoopEthHdrPtr packet = (virNWFilterSnoopEthHdrPtr)job->packet;
+    bool active;
 
-    if (virNWFilterSnoopDHCPDecode(req, packet,
-                                   job->caplen, job->fromVM) == -1) {
-        req->jobCompletionStatus = -1;
+    if (!req) {
+        virNWFilterSnoopHousekeeping();
+        virAtomicIntSet(&virNWFilterSnoopState.housekeeping, 0);
+        goto cleanup;
+    }
+
+    /* protect req->threadkey */
+    virNWFilterSnoopReqLock(req);
+    active = req->threadkey != NULL;
+    virNWFilterSnoopReqUnlock(req);
 
+    /* drop packets of interfaces no longer snooped */
+    if (active &&
+        virNWFilterSnoopDHCPDecode(req, packet,
+                                   job->caplen, job->fromVM) == -1) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Instantiation of rules failed on "
                          "interface '%s'"), req->ifname);
+        virNWFilterSnoopReqStop(req, NULL);
     }
     virAtomicIntDecAndTest(job->qCtr);
+    virNWFilterSnoopReqPut(req);
+
+cleanup:
     VIR_FREE(job);
 }
 
 /*
  * Submit a job to the worker thread doing the time-consuming work...
+ *
+ * The jobs of one interface are processed in order; the worker serves
+ * the interfaces round robin so that a flooding VM cannot starve the
+ * others.
  */
 static int
-virNWFilterSnoopDHCPDecodeJobSubmit(virThreadPoolPtr pool,
+virNWFilterSnoopDHCPDecodeJobSubmit(virNWFilterSnoopReqPtr req,
                                     virNWFilterSnoopEthHdrPtr pep,
                                     int len, pcap_direction_t dir,
                                     int *qCtr)
@@ -1207,17 +1356,48 @@ virNWFilterSnoopDHCPDecodeJobSubmit(virThreadPoolPtr pool,
     job->caplen = len;
     job->fromVM = (dir == PCAP_D_IN);
     job->qCtr = qCtr;
+    job->req = req;
 
-    ret = virThreadPoolSendJob(pool, 0, job);
+    /* the capture holds a reference, so the req cannot go away here */
+    virNWFilterSnoopReqGet(req);
+    virAtomicIntInc(qCtr);
 
-    if (ret == 0)
-        virAtomicIntInc(qCtr);
-    else
+    ret = virThreadPoolSendGroupJob(virNWFilterSnoopState.worker, 0,
+                                    req, job);
+
+    if (ret < 0) {
+        virAtomicIntDecAndTest(qCtr);
+        virNWFilterSnoopReqPut(req);
         VIR_FREE(job);
+    }
 
     return ret;
 }
 
+/*
+ * Queue the housekeeping job unless it is already queued.
+ */
+static void
+virNWFilterSnoopHousekeepingSubmit(void)
+{
+    virNWFilterDHCPDecodeJobPtr job;
+
+    if (virAtomicIntGet(&virNWFilterSnoopState.housekeeping))
+        return;
+
+    if (VIR_ALLOC(job) < 0) {
+        virReportOOMError();
+        return;
+    }
+
+    virAtomicIntSet(&virNWFilterSnoopState.housekeeping, 1);
+
+    if (virThreadPoolSendJob(virNWFilterSnoopState.worker, 0, job) < 0) {
+        virAtomicIntSet(&virNWFilterSnoopState.housekeeping, 0);
+        VIR_FREE(job);
+    }
+}
+
 /*
  * virNWFilterSnoopRateLimit -- limit the rate of jobs submitted to the
  *                              worker thread
@@ -1293,7 +1473,7 @@ virNWFilterSnoopRatePenalty(virNWFilterSnoopPcapConfPtr pc,
 }
 
 static int
-virNWFilterSnoopAdjustPoll(virNWFilterSnoopPcapConfPtr pc,
+virNWFilterSnoopAdjustPoll(virNWFilterSnoopPcapConfPtr *pc,
                            size_t nPc, struct pollfd *pfd,
                            int *pollTo)
 {
@@ -1305,7 +1485,7 @@ virNWFilterSnoopAdjustPoll(virNWFilterSnoopPcapConfPtr pc,
     *pollTo = -1;
 
     for (i = 0; i < nPc; i++) {
-        if (pc[i].penaltyTimeoutAbs != 0) {
+        if (pc[i]->penaltyTimeoutAbs != 0) {
             if (now == 0) {
                 if (virTimeMillisNow(&now) < 0) {
                     ret = -1;
@@ -1313,21 +1493,21 @@ virNWFilterSnoopAdjustPoll(virNWFilterSnoopPcapConfPtr pc,
                 }
             }
 
-            if (now < pc[i].penaltyTimeoutAbs) {
+            if (now < pc[i]->penaltyTimeoutAbs) {
                 /* don't listen to incoming data on the fd for some time */
                 pfd[i].events &= ~POLLIN;
                 /*
                  * calc the max. time to spend in poll() until adjustments
                  * to the pollfd array are needed again.
                  */
-                tmp = pc[i].penaltyTimeoutAbs - now;
+                tmp = pc[i]->penaltyTimeoutAbs - now;
                 if (*pollTo == -1 || tmp < *pollTo)
                     *pollTo = tmp;
             } else {
                 /* listen again to the fd */
                 pfd[i].events |= POLLIN;
 
-                pc[i].penaltyTimeoutAbs = 0;
+                pc[i]->penaltyTimeoutAbs = 0;
             }
         }
     }
@@ -1336,246 +1516,324 @@ virNWFilterSnoopAdjustPoll(virNWFilterSnoopPcapConfPtr pc,
 }
 
 /*
- * The DHCP snooping thread. It spends most of its time in the pcap
- * library and if it gets suitable packets, it submits them to the worker
- * thread for processing.
+ * Wake up the snooping thread so that it picks up new or
+ * cancelled captures.
  */
 static void
-virNWFilterDHCPSnoopThread(void *req0)
+virNWFilterSnoopCaptureWakeup(void)
 {
-    virNWFilterSnoopReqPtr req = req0;
-    struct pcap_pkthdr *hdr;
-    virNWFilterSnoopEthHdrPtr packet;
-    int ifindex = 0;
-    int errcount = 0;
-    int tmp = -1, i, rv, n, pollTo;
-    char *threadkey = NULL;
-    virThreadPoolPtr worker = NULL;
-    time_t last_displayed = 0, last_displayed_queue = 0;
-    virNWFilterSnoopPcapConf pcapConf[] = {
-        {
-            .dir = PCAP_D_IN, /* from VM */
-            .filter = "dst port 67 and src port 68",
-            .rateLimit = {
-                .prev = time(0),
-                .rate = DHCP_PKT_RATE,
-                .burstRate = DHCP_PKT_BURST,
-                .burstInterval = DHCP_BURST_INTERVAL_S,
-            },
-            .maxQSize = MAX_QUEUED_JOBS,
-        }, {
-            .dir = PCAP_D_OUT, /* to VM */
-            .filter = "src port 67 and dst port 68",
-            .rateLimit = {
-                .prev = time(0),
-                .rate = DHCP_PKT_RATE,
-                .burstRate = DHCP_PKT_BURST,
-                .burstInterval = DHCP_BURST_INTERVAL_S,
-            },
-            .maxQSize = MAX_QUEUED_JOBS,
-        },
-    };
-    struct pollfd fds[] = {
-        {
-            /* get a POLLERR if interface goes down or disappears */
-            .events = POLLIN | POLLERR,
-        }, {
-            .events = POLLIN | POLLERR,
-        },
-    };
-    bool error = false;
+    char c = 0;
 
-    /* whoever started us increased the reference counter for the req for us */
+    if (virNWFilterSnoopState.wakeupFDs[1] < 0)
+        return;
 
-    /* protect req->ifname & req->threadkey */
-    virNWFilterSnoopReqLock(req);
+    /* the pipe is non-blocking; if it is full, a wakeup is pending anyway */
+    ignore_value(safewrite(virNWFilterSnoopState.wakeupFDs[1], &c, 1));
+}
 
-    if (req->ifname && req->threadkey) {
-        for (i = 0; i < ARRAY_CARDINALITY(pcapConf); i++) {
-            pcapConf[i].handle =
-                virNWFilterSnoopDHCPOpen(req->ifname, &req->macaddr,
-                                         pcapConf[i].filter,
-                                         pcapConf[i].dir);
-            if (!pcapConf[i].handle) {
-                error = true;
-                break;
-            }
-            fds[i].fd = pcap_fileno(pcapConf[i].handle);
-        }
-        tmp = virNetDevGetIndex(req->ifname, &ifindex);
-        threadkey = strdup(req->threadkey);
-        worker = virThreadPoolNew(1, 1, 0,
-                                  virNWFilterDHCPDecodeWorker,
-                                  req);
+static void
+virNWFilterSnoopCaptureFree(virNWFilterSnoopCapturePtr capture)
+{
+    size_t i;
+
+    if (!capture)
+        return;
+
+    for (i = 0; i < ARRAY_CARDINALITY(capture->pcapConf); i++) {
+        if (capture->pcapConf[i].handle)
+            pcap_close(capture->pcapConf[i].handle);
     }
 
-    /* let creator know how well we initialized */
-    if (error == true || !threadkey || tmp < 0 || !worker ||
-        ifindex != req->ifindex)
-        req->threadStatus = THREAD_STATUS_FAIL;
-    else
-        req->threadStatus = THREAD_STATUS_OK;
+    virNWFilterSnoopReqPut(capture->req);
 
-    virCondSignal(&req->threadStatusCond);
+    VIR_FREE(capture->threadkey);
+    VIR_FREE(capture->ifname);
+    VIR_FREE(capture);
+}
 
-    virNWFilterSnoopReqUnlock(req);
+/*
+ * Open the packet captures on the interface of a request.
+ * Call this function with the SnoopLock and the req's lock held;
+ * the capture takes its own reference to the req.
+ */
+static virNWFilterSnoopCapturePtr
+virNWFilterSnoopCaptureNew(virNWFilterSnoopReqPtr req)
+{
+    virNWFilterSnoopCapturePtr capture;
+    size_t i;
 
-    if (req->threadStatus != THREAD_STATUS_OK)
-        goto exit;
+    if (VIR_ALLOC(capture) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
 
-    while (!error) {
-        if (virNWFilterSnoopAdjustPoll(pcapConf,
-                                       ARRAY_CARDINALITY(pcapConf),
-                                       fds, &pollTo) < 0) {
-            break;
-        }
+    capture->ifname = strdup(req->ifname);
+    capture->threadkey = strdup(req->threadkey);
+    if (!capture->ifname || !capture->threadkey) {
+        virReportOOMError();
+        goto error;
+    }
+    capture->ifindex = req->ifindex;
 
-        n = poll(fds, ARRAY_CARDINALITY(fds), pollTo);
+    for (i = 0; i < ARRAY_CARDINALITY(capture->pcapConf); i++) {
+        virNWFilterSnoopPcapConfPtr pc = &capture->pcapConf[i];
 
-        if (n < 0) {
-            if (errno != EAGAIN && errno != EINTR)
-                error = true;
-        }
+        *pc = virNWFilterSnoopPcapConfTemplate[i];
+        pc->rateLimit.prev = time(0);
+        pc->handle = virNWFilterSnoopDHCPOpen(req->ifname, &req->macaddr,
+                                              pc->filter, pc->dir);
+        if (!pc->handle)
+            goto error;
+    }
 
-        virNWFilterSnoopReqLeaseTimerRun(req);
+    virNWFilterSnoopReqGet(req);
+    capture->req = req;
 
-        /*
-         * Check whether we were cancelled or whether
-         * a previously submitted job failed.
-         */
-        if (!virNWFilterSnoopIsActive(threadkey) ||
-            req->jobCompletionStatus != 0)
-            goto exit;
+    return capture;
 
-        for (i = 0; n > 0 && i < ARRAY_CARDINALITY(fds); i++) {
-            if (!fds[i].revents)
-                continue;
+error:
+    virNWFilterSnoopCaptureFree(capture);
 
-            fds[i].revents = 0;
-            n--;
+    return NULL;
+}
 
-            rv = pcap_next_ex(pcapConf[i].handle, &hdr,
-                              (const u_char **)&packet);
+/*
+ * Hand a capture over to the snooping thread.
+ */
+static int
+virNWFilterSnoopCaptureAdd(virNWFilterSnoopCapturePtr capture)
+{
+    int ret;
 
-            if (rv < 0) {
-                /* error reading from socket */
-                tmp = -1;
+    virMutexLock(&virNWFilterSnoopState.captureLock);
+    ret = VIR_APPEND_ELEMENT_COPY(virNWFilterSnoopState.newCaptures,
+                                  virNWFilterSnoopState.nNewCaptures,
+                                  capture);
+    virMutexUnlock(&virNWFilterSnoopState.captureLock);
 
-                /* protect req->ifname */
-                virNWFilterSnoopReqLock(req);
+    if (ret < 0) {
+        virReportOOMError();
+        return -1;
+    }
 
-                if (req->ifname)
-                    tmp = virNetDevValidateConfig(req->ifname, NULL, ifindex);
+    virNWFilterSnoopCaptureWakeup();
 
-                virNWFilterSnoopReqUnlock(req);
+    return 0;
+}
 
-                if (tmp <= 0) {
-                    error = true;
-                    break;
-                }
+/*
+ * Read a packet from the capture in direction @i of an interface and
+ * submit it to the worker thread.
+ *
+ * Returns -1 if snooping on the interface has to be stopped.
+ */
+static int
+virNWFilterSnoopCaptureRead(virNWFilterSnoopCapturePtr capture, size_t i)
+{
+    virNWFilterSnoopPcapConfPtr pc = &capture->pcapConf[i];
+    virNWFilterSnoopReqPtr req = capture->req;
+    struct pcap_pkthdr *hdr;
+    virNWFilterSnoopEthHdrPtr packet;
+    unsigned int diff;
+    int rv;
 
-                if (++errcount > PCAP_READ_MAXERRS) {
-                    pcap_close(pcapConf[i].handle);
-                    pcapConf[i].handle = NULL;
-
-                    /* protect req->ifname */
-                    virNWFilterSnoopReqLock(req);
-
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   _("interface '%s' failing; "
-                                     "reopening"),
-                                   req->ifname);
-                    if (req->ifname)
-                        pcapConf[i].handle =
-                            virNWFilterSnoopDHCPOpen(req->ifname, &req->macaddr,
-                                                     pcapConf[i].filter,
-                                                     pcapConf[i].dir);
-
-                    virNWFilterSnoopReqUnlock(req);
-
-                    if (!pcapConf[i].handle) {
-                        error = true;
-                        break;
-                    }
-                }
-                continue;
-            }
+    rv = pcap_next_ex(pc->handle, &hdr, (const u_char **)&packet);
 
-            errcount = 0;
+    if (rv < 0) {
+        /* error reading from socket */
+        if (virNetDevValidateConfig(capture->ifname, NULL,
+                                    capture->ifindex) <= 0)
+            return -1;
 
-            if (rv) {
-                unsigned int diff;
+        if (++capture->errcount > PCAP_READ_MAXERRS) {
+            pcap_close(pc->handle);
 
-                /* submit packet to worker thread */
-                if (virAtomicIntGet(&pcapConf[i].qCtr) >
-                    pcapConf[i].maxQSize) {
-                    if (last_displayed_queue - time(0) > 10) {
-                        last_displayed_queue = time(0);
-                        VIR_WARN("Worker thread for interface '%s' has a "
-                                 "job queue that is too long\n",
-                                 req->ifname);
-                    }
-                    continue;
-                }
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("interface '%s' failing; "
+                             "reopening"),
+                           capture->ifname);
+            pc->handle = virNWFilterSnoopDHCPOpen(capture->ifname,
+                                                  &req->macaddr,
+                                                  pc->filter, pc->dir);
+            if (!pc->handle)
+                return -1;
+        }
+        return 0;
+    }
 
-                diff = virNWFilterSnoopRateLimit(&pcapConf[i].rateLimit);
-                if (diff > 0) {
-                    virNWFilterSnoopRatePenalty(&pcapConf[i], diff,
-                                                DHCP_PKT_RATE);
-                    /* rate-limited warnings */
-                    if (time(0) - last_displayed > 10) {
-                         last_displayed = time(0);
-                         VIR_WARN("Too many DHCP packets on interface '%s'",
-                                  req->ifname);
-                    }
-                    continue;
-                }
+    capture->errcount = 0;
 
-                if (virNWFilterSnoopDHCPDecodeJobSubmit(worker, packet,
-                                                      hdr->caplen,
-                                                      pcapConf[i].dir,
-                                                      &pcapConf[i].qCtr) < 0) {
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   _("Job submission failed on "
-                                     "interface '%s'"), req->ifname);
-                    error = true;
-                    break;
-                }
+    if (rv == 0)
+        return 0;
+
+    /* submit packet to worker thread */
+    if (virAtomicIntGet(&req->qCtr[i]) > pc->maxQSize) {
+        if (time(0) - capture->last_displayed_queue > 10) {
+            capture->last_displayed_queue = time(0);
+            VIR_WARN("Worker thread for interface '%s' has a "
+                     "job queue that is too long",
+                     capture->ifname);
+        }
+        return 0;
+    }
+
+    diff = virNWFilterSnoopRateLimit(&pc->rateLimit);
+    if (diff > 0) {
+        virNWFilterSnoopRatePenalty(pc, diff, DHCP_PKT_RATE);
+        /* rate-limited warnings */
+        if (time(0) - capture->last_displayed > 10) {
+            capture->last_displayed = time(0);
+            VIR_WARN("Too many DHCP packets on interface '%s'",
+                     capture->ifname);
+        }
+        return 0;
+    }
+
+    if (virNWFilterSnoopDHCPDecodeJobSubmit(req, packet, hdr->caplen,
+                                            pc->dir, &req->qCtr[i]) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Job submission failed on "
+                         "interface '%s'"), capture->ifname);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * The DHCP snooping thread. It captures the DHCP traffic of all snooped
+ * interfaces, spending most of its time in poll(), and submits suitable
+ * packets to the worker thread for processing. It also schedules the
+ * periodic housekeeping.
+ */
+static void
+virNWFilterDHCPSnoopThread(void *opaque ATTRIBUTE_UNUSED)
+{
+    virNWFilterSnoopCapturePtr *captures = NULL;
+    size_t nCaptures = 0, nCapturesAlloc = 0;
+    virNWFilterSnoopPcapConfPtr *pcs = NULL;
+    size_t nPcsAlloc = 0;
+    struct pollfd *fds = NULL;
+    size_t nfds, nfdsAlloc = 0;
+    unsigned long long now, nextHousekeeping = 0;
+    size_t i, j;
+    int n, pollTo, tmp;
+    char buf[64];
+
+    /* the wakeup pipe is always polled */
+    if (VIR_RESIZE_N(fds, nfdsAlloc, 0, 1) < 0) {
+        virReportOOMError();
+        return;
+    }
+
+    while (!virAtomicIntGet(&virNWFilterSnoopState.captureQuit)) {
+        /* take over the captures of newly snooped interfaces */
+        virMutexLock(&virNWFilterSnoopState.captureLock);
+
+        if (virNWFilterSnoopState.nNewCaptures > 0 &&
+            VIR_RESIZE_N(captures, nCapturesAlloc, nCaptures,
+                         virNWFilterSnoopState.nNewCaptures) == 0) {
+            memcpy(captures + nCaptures, virNWFilterSnoopState.newCaptures,
+                   virNWFilterSnoopState.nNewCaptures * sizeof(*captures));
+            nCaptures += virNWFilterSnoopState.nNewCaptures;
+            VIR_FREE(virNWFilterSnoopState.newCaptures);
+            virNWFilterSnoopState.nNewCaptures = 0;
+        }
+
+        virMutexUnlock(&virNWFilterSnoopState.captureLock);
+
+        /* release the captures of interfaces no longer snooped */
+        for (i = 0; i < nCaptures; ) {
+            if (virNWFilterSnoopIsActive(captures[i]->threadkey)) {
+                i++;
+                continue;
             }
-        } /* for all fds */
-    } /* while (!error) */
+            virNWFilterSnoopCaptureFree(captures[i]);
+            captures[i] = captures[--nCaptures];
+        }
 
-    /* protect IfNameToKey */
-    virNWFilterSnoopLock();
+        nfds = 1;
+        if (VIR_RESIZE_N(fds, nfdsAlloc, 0, 1 + 2 * nCaptures) < 0 ||
+            VIR_RESIZE_N(pcs, nPcsAlloc, 0, 2 * nCaptures) < 0) {
+            /* keep listening to the wakeup pipe only */
+            virReportOOMError();
+        } else {
+            nfds += 2 * nCaptures;
+        }
 
-    /* protect req->ifname & req->threadkey */
-    virNWFilterSnoopReqLock(req);
+        fds[0].fd = virNWFilterSnoopState.wakeupFDs[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
 
-    virNWFilterSnoopCancel(&req->threadkey);
+        for (i = 0; i < (nfds - 1) / 2; i++) {
+            for (j = 0; j < 2; j++) {
+                struct pollfd *pfd = &fds[1 + 2 * i + j];
 
-    ignore_value(virHashRemoveEntry(virNWFilterSnoopState.ifnameToKey,
-                                    req->ifname));
+                pcs[2 * i + j] = &captures[i]->pcapConf[j];
+                pfd->fd = pcap_fileno(captures[i]->pcapConf[j].handle);
+                /* get a POLLERR if interface goes down or disappears */
+                pfd->events = POLLIN | POLLERR;
+                pfd->revents = 0;
+            }
+        }
 
-    VIR_FREE(req->ifname);
+        if (virNWFilterSnoopAdjustPoll(pcs, nfds - 1, fds + 1, &pollTo) < 0)
+            pollTo = PCAP_FLOOD_TIMEOUT_MS;
 
-    virNWFilterSnoopReqUnlock(req);
-    virNWFilterSnoopUnlock();
+        /* no housekeeping needed while idle */
+        if ((nCaptures > 0 ||
+             virAtomicIntGet(&virNWFilterSnoopState.leasesDirty)) &&
+            virTimeMillisNow(&now) == 0) {
+            if (now >= nextHousekeeping) {
+                virNWFilterSnoopHousekeepingSubmit();
+                nextHousekeeping = now + SNOOP_HOUSEKEEPING_INTERVAL_MS;
+            }
+            tmp = nextHousekeeping - now;
+            if (pollTo == -1 || tmp < pollTo)
+                pollTo = tmp;
+        }
 
-exit:
-    virThreadPoolFree(worker);
+        n = poll(fds, nfds, pollTo);
 
-    virNWFilterSnoopReqPut(req);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            virReportSystemError(errno, "%s",
+                                 _("poll on DHCP snooping captures failed"));
+            break;
+        }
+
+        if (fds[0].revents) {
+            n--;
+            while (read(fds[0].fd, buf, sizeof(buf)) > 0)
+                ;
+        }
 
-    VIR_FREE(threadkey);
+        for (i = 0; n > 0 && i < (nfds - 1) / 2; i++) {
+            for (j = 0; j < 2; j++) {
+                if (!fds[1 + 2 * i + j].revents)
+                    continue;
+
+                n--;
 
-    for (i = 0; i < ARRAY_CARDINALITY(pcapConf); i++) {
-        if (pcapConf[i].handle)
-            pcap_close(pcapConf[i].handle);
+                if (captures[i]->failed)
+                    continue;
+
+                if (virNWFilterSnoopCaptureRead(captures[i], j) < 0) {
+                    captures[i]->failed = true;
+                    virNWFilterSnoopReqStop(captures[i]->req,
+                                            captures[i]->threadkey);
+                }
+            }
+        }
     }
 
-    virAtomicIntDecAndTest(&virNWFilterSnoopState.nThreads);
+    for (i = 0; i < nCaptures; i++)
+        virNWFilterSnoopCaptureFree(captures[i]);
 
-    return;
+    VIR_FREE(captures);
+    VIR_FREE(pcs);
+    VIR_FREE(fds);
 }
 
 static void
@@ -1602,7 +1860,7 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
     bool isnewreq;
     char ifkey[VIR_IFKEY_LEN];
     int tmp;
-    virThread thread;
+    virNWFilterSnoopCapturePtr capture;
     virNWFilterVarValuePtr dhcpsrvrs;
 
     virNWFilterSnoopIFKeyFMT(ifkey, vmuuid, macaddr);
@@ -1686,19 +1944,9 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
         goto exit_rem_ifnametokey;
     }
 
-    /* prevent thread from holding req */
+    /* protect req->ifname & req->threadkey */
     virNWFilterSnoopReqLock(req);
 
-    if (virThreadCreate(&thread, false, virNWFilterDHCPSnoopThread,
-                        req) != 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("virNWFilterDHCPSnoopReq virThreadCreate "
-                         "failed on interface '%s'"), ifname);
-        goto exit_snoopreq_unlock;
-    }
-
-    virAtomicIntInc(&virNWFilterSnoopState.nThreads);
-
     req->threadkey = virNWFilterSnoopActivate(req);
     if (!req->threadkey) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -1714,16 +1962,21 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriverPtr techdriver,
         goto exit_snoop_cancel;
     }
 
-    /* sync with thread */
-    if (virCondWait(&req->threadStatusCond, &req->lock) < 0 ||
-        req->threadStatus != THREAD_STATUS_OK)
+    capture = virNWFilterSnoopCaptureNew(req);
+    if (!capture)
+        goto exit_snoop_cancel;
+
+    if (virNWFilterSnoopCaptureAdd(capture) < 0) {
+        virNWFilterSnoopCaptureFree(capture);
         goto exit_snoop_cancel;
+    }
 
     virNWFilterSnoopReqUnlock(req);
 
     virNWFilterSnoopUnlock();
 
-    /* do not 'put' the req -- the thread will do this */
+    /* the capture holds its own reference to the req */
+    virNWFilterSnoopReqPut(req);
 
     return 0;
 
@@ -1741,21 +1994,6 @@ exit_snoopreqput:
     return -1;
 }
 
-static void
-virNWFilterSnoopLeaseFileClose(void)
-{
-    VIR_FORCE_CLOSE(virNWFilterSnoopState.leaseFD);
-}
-
-static void
-virNWFilterSnoopLeaseFileOpen(void)
-{
-    virNWFilterSnoopLeaseFileClose();
-
-    virNWFilterSnoopState.leaseFD = open(LEASEFILE, O_CREAT|O_RDWR|O_APPEND,
-                                         0644);
-}
-
 /*
  * Write a single lease to the given file.
  *
@@ -1793,8 +2031,6 @@ virNWFilterSnoopLeaseFileWrite(int lfd, const char *ifkey,
         goto cleanup;
     }
 
-    ignore_value(fsync(lfd));
-
 cleanup:
     VIR_FREE(lbuf);
     VIR_FREE(dhcpstr);
@@ -1804,31 +2040,20 @@ cleanup:
 }
 
 /*
- * Append a single lease to the end of the lease file.
- * To keep a limited number of dead leases, re-read the lease
- * file if the threshold of active leases versus written ones
- * exceeds a threshold.
+ * Note that a lease changed. Rather than writing every lease as it
+ * changes, the housekeeping rewrites the lease file with the leases
+ * of all interfaces at most once per housekeeping interval.
  */
 static void
-virNWFilterSnoopLeaseFileSave(virNWFilterSnoopIPLeasePtr ipl)
+virNWFilterSnoopLeaseFileSave(void)
 {
-    virNWFilterSnoopReqPtr req = ipl->snoopReq;
-
-    virNWFilterSnoopLock();
-
-    if (virNWFilterSnoopState.leaseFD < 0)
-        virNWFilterSnoopLeaseFileOpen();
-    if (virNWFilterSnoopLeaseFileWrite(virNWFilterSnoopState.leaseFD,
-                                       req->ifkey, ipl) < 0)
-        goto err_exit;
+    if (virAtomicIntGet(&virNWFilterSnoopState.leasesDirty))
+        return;
 
-    /* keep dead leases at < ~95% of file size */
-    if (virAtomicIntInc(&virNWFilterSnoopState.wLeases) >=
-        virAtomicIntGet(&virNWFilterSnoopState.nLeases) * 20)
-        virNWFilterSnoopLeaseFileLoad();   /* load & refresh lease file */
+    virAtomicIntSet(&virNWFilterSnoopState.leasesDirty, 1);
 
-err_exit:
-    virNWFilterSnoopUnlock();
+    /* get the housekeeping scheduled if the snooping thread is idle */
+    virNWFilterSnoopCaptureWakeup();
 }
 
 /*
@@ -1894,6 +2119,8 @@ virNWFilterSnoopLeaseFileRefresh(void)
 {
     int tfd;
 
+    virAtomicIntSet(&virNWFilterSnoopState.leasesDirty, 0);
+
     if (unlink(TMPLEASEFILE) < 0 && errno != ENOENT)
         virReportSystemError(errno, _("unlink(\"%s\")"), TMPLEASEFILE);
 
@@ -1913,10 +2140,12 @@ virNWFilterSnoopLeaseFileRefresh(void)
                        virNWFilterSnoopSaveIter, (void *)&tfd);
     }
 
+    ignore_value(fsync(tfd));
+
     if (VIR_CLOSE(tfd) < 0) {
         virReportSystemError(errno, _("unable to close %s"), TMPLEASEFILE);
         /* assuming the old lease file is still better, skip the renaming */
-        goto skip_rename;
+        return;
     }
 
     if (rename(TMPLEASEFILE, LEASEFILE) < 0) {
@@ -1924,10 +2153,23 @@ virNWFilterSnoopLeaseFileRefresh(void)
                              TMPLEASEFILE, LEASEFILE);
         ignore_value(unlink(TMPLEASEFILE));
     }
-    virAtomicIntSet(&virNWFilterSnoopState.wLeases, 0);
+}
 
-skip_rename:
-    virNWFilterSnoopLeaseFileOpen();
+/*
+ * Write out the lease changes not yet in the lease file.
+ */
+static void
+virNWFilterSnoopLeaseFileFlush(void)
+{
+    if (!virAtomicIntGet(&virNWFilterSnoopState.leasesDirty))
+        return;
+
+    /* protect the lease file */
+    virNWFilterSnoopLock();
+
+    virNWFilterSnoopLeaseFileRefresh();
+
+    virNWFilterSnoopUnlock();
 }
 
 
@@ -2007,19 +2249,6 @@ virNWFilterSnoopLeaseFileLoad(void)
     virNWFilterSnoopUnlock();
 }
 
-/*
- * Wait until all threads have ended.
- */
-static void
-virNWFilterSnoopJoinThreads(void)
-{
-    while (virAtomicIntGet(&virNWFilterSnoopState.nThreads) != 0) {
-        VIR_WARN("Waiting for snooping threads to terminate: %u\n",
-                 virAtomicIntGet(&virNWFilterSnoopState.nThreads));
-        usleep(1000 * 1000);
-    }
-}
-
 /*
  * Iterator to remove a request, repeatedly called on one
  * request after another.
@@ -2080,7 +2309,8 @@ virNWFilterDHCPSnoopInit(void)
     VIR_DEBUG("Initializing DHCP snooping");
 
     if (virMutexInitRecursive(&virNWFilterSnoopState.snoopLock) < 0 ||
-        virMutexInit(&virNWFilterSnoopState.activeLock) < 0)
+        virMutexInit(&virNWFilterSnoopState.activeLock) < 0 ||
+        virMutexInit(&virNWFilterSnoopState.captureLock) < 0)
         return -1;
 
     virNWFilterSnoopState.ifnameToKey = virHashCreate(0, NULL);
@@ -2095,12 +2325,43 @@ virNWFilterDHCPSnoopInit(void)
         goto err_exit;
     }
 
+    if (pipe2(virNWFilterSnoopState.wakeupFDs, O_CLOEXEC) < 0 ||
+        virSetNonBlock(virNWFilterSnoopState.wakeupFDs[0]) < 0 ||
+        virSetNonBlock(virNWFilterSnoopState.wakeupFDs[1]) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot create DHCP snooping wakeup pipe"));
+        goto err_exit;
+    }
+
+    /*
+     * A single worker: instantiating the filters is serialized anyway
+     * and it keeps the packets of an interface in order.
+     */
+    virNWFilterSnoopState.worker = virThreadPoolNew(1, 1, 0,
+                                                    virNWFilterDHCPDecodeWorker,
+                                                    NULL);
+    if (!virNWFilterSnoopState.worker)
+        goto err_exit;
+
     virNWFilterSnoopLeaseFileLoad();
-    virNWFilterSnoopLeaseFileOpen();
+
+    if (virThreadCreate(&virNWFilterSnoopState.captureThread, true,
+                        virNWFilterDHCPSnoopThread, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot create DHCP snooping thread"));
+        goto err_exit;
+    }
+    virNWFilterSnoopState.captureThreadRunning = true;
 
     return 0;
 
 err_exit:
+    virThreadPoolFree(virNWFilterSnoopState.worker);
+    virNWFilterSnoopState.worker = NULL;
+
+    VIR_FORCE_CLOSE(virNWFilterSnoopState.wakeupFDs[0]);
+    VIR_FORCE_CLOSE(virNWFilterSnoopState.wakeupFDs[1]);
+
     virHashFree(virNWFilterSnoopState.ifnameToKey);
     virNWFilterSnoopState.ifnameToKey = NULL;
 
@@ -2158,7 +2419,8 @@ virNWFilterDHCPSnoopEnd(const char *ifname)
 
         virNWFilterSnoopReqPut(req);
     } else {                      /* free all of them */
-        virNWFilterSnoopLeaseFileClose();
+        /* the leases are re-read from the file */
+        virNWFilterSnoopLeaseFileFlush();
 
         virHashRemoveAll(virNWFilterSnoopState.ifnameToKey);
 
@@ -2175,12 +2437,36 @@ cleanup:
 void
 virNWFilterDHCPSnoopShutdown(void)
 {
+    size_t i;
+
+    if (virNWFilterSnoopState.captureThreadRunning) {
+        virAtomicIntSet(&virNWFilterSnoopState.captureQuit, 1);
+        virNWFilterSnoopCaptureWakeup();
+        virThreadJoin(&virNWFilterSnoopState.captureThread);
+        virNWFilterSnoopState.captureThreadRunning = false;
+    }
+
+    /* waits for the job the worker is running */
+    virThreadPoolFree(virNWFilterSnoopState.worker);
+    virNWFilterSnoopState.worker = NULL;
+
+    virMutexLock(&virNWFilterSnoopState.captureLock);
+    for (i = 0; i < virNWFilterSnoopState.nNewCaptures; i++)
+        virNWFilterSnoopCaptureFree(virNWFilterSnoopState.newCaptures[i]);
+    VIR_FREE(virNWFilterSnoopState.newCaptures);
+    virNWFilterSnoopState.nNewCaptures = 0;
+    virMutexUnlock(&virNWFilterSnoopState.captureLock);
+
+    /* write out the leases while the requests are still around */
+    virNWFilterSnoopLeaseFileFlush();
+
     virNWFilterSnoopEndThreads();
-    virNWFilterSnoopJoinThreads();
+
+    VIR_FORCE_CLOSE(virNWFilterSnoopState.wakeupFDs[0]);
+    VIR_FORCE_CLOSE(virNWFilterSnoopState.wakeupFDs[1]);
 
     virNWFilterSnoopLock();
 
-    virNWFilterSnoopLeaseFileClose();
     virHashFree(virNWFilterSnoopState.ifnameToKey);
     virHashFree(virNWFilterSnoopState.snoopReqs);
 
@@ -43,6 +43,7 @@
 #include "command.h"
 #include "configmake.h"
 #include "intprops.h"
+#include "sha256.h"
 
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
@@ -85,6 +86,18 @@ static char *iptables_cmd_path;
 static char *ip6tables_cmd_path;
 static char *grep_cmd_path;
 
+/* tools used for applying a filter's rules in a single transaction;
+ * only available when not going through firewalld */
+static char *iptables_restore_cmd_path;
+static char *ip6tables_restore_cmd_path;
+static bool ebtables_atomic;
+
+/* multi-valued address variables of ip(6)tables rules are matched
+ * through an ipset rather than with one rule per value */
+static char *ipset_cmd_path;
+
+#define IPSET_NAME_PREFIX "libvirt-nwf-"
+
 #define PRINT_ROOT_CHAIN(buf, prefix, ifname) \
     snprintf(buf, sizeof(buf), "libvirt-%c-%s", prefix, ifname)
 #define PRINT_CHAIN(buf, prefix, ifname, suffix) \
@@ -145,10 +158,31 @@ static const char ebiptables_script_set_ifs[] =
     "tmp='\n'\n"
     "IFS=' ''\t'$tmp\n";
 
+/* The ipt_batch() function stands in for $IPT while the rules of a
+ * filter are being instantiated. Instead of running one iptables
+ * process per rule, each of which reads and rewrites the whole table,
+ * it appends the rule in iptables-restore syntax to the file $batch,
+ * which is then applied with a single call to iptables-restore.
+ */
+static const char iptables_script_func_batch[] =
+    "ipt_batch()\n"
+    "{\n"
+    "  line=''\n"
+    "  for arg in \"$@\"; do\n"
+    "    case $arg in\n"
+    "      ''|*[[:space:]\\\"\\\\]*)\n"
+    "        arg=\\\"$(printf '%s' \"$arg\" | sed 's/[\\\\\"]/\\\\&/g')\\\" ;;\n"
+    "    esac\n"
+    "    line=\"${line:+$line }$arg\"\n"
+    "  done\n"
+    "  printf '%s\\n' \"$line\" >> \"$batch\"\n"
+    "}\n";
+
 #define NWFILTER_FUNC_COLLECT_CHAINS ebtables_script_func_collect_chains
 #define NWFILTER_FUNC_RM_CHAINS ebiptables_script_func_rm_chains
 #define NWFILTER_FUNC_RENAME_CHAINS ebiptables_script_func_rename_chains
 #define NWFILTER_FUNC_SET_IFS ebiptables_script_set_ifs
+#define NWFILTER_FUNC_IPT_BATCH iptables_script_func_batch
 
 #define NWFILTER_SET_EBTABLES_SHELLVAR(BUFPTR) \
     virBufferAsprintf(BUFPTR, "EBT=\"%s\"\n", ebtables_cmd_path);
@@ -459,6 +493,7 @@ ebiptablesRuleInstFree(ebiptablesRuleInstPtr inst)
         return;
 
     VIR_FREE(inst->commandTemplate);
+    VIR_FREE(inst->ipsetCommands);
     VIR_FREE(inst);
 }
 
@@ -933,6 +968,69 @@ iptablesInstCommand(virBufferPtr buf,
 }
 
 
+/*
+ * iptablesBatchBegin
+ *
+ * Redirect all $IPT commands following in the script into a batch
+ * file rather than executing them. Returns false if no restore tool
+ * is available, in which case the commands are run one by one.
+ */
+static bool
+iptablesBatchBegin(virBufferPtr buf, const char *restore_cmd)
+{
+    if (!restore_cmd)
+        return false;
+
+    virBufferAdd(buf, NWFILTER_FUNC_IPT_BATCH, -1);
+    virBufferAddLit(buf,
+                    "batch=$(mktemp) || exit 1\n"
+                    "trap 'rm -f \"${batch}\"' EXIT\n"
+                    "echo '*filter' > \"${batch}\"\n"
+                    "IPT=ipt_batch\n");
+    return true;
+}
+
+
+/*
+ * iptablesBatchCommit
+ *
+ * Apply the rules collected since iptablesBatchBegin in one transaction;
+ * either all of them get installed or none.
+ */
+static void
+iptablesBatchCommit(virBufferPtr buf, const char *restore_cmd)
+{
+    virBufferAsprintf(buf,
+                      "echo COMMIT >> \"${batch}\"\n"
+                      "res=$(%s --noflush < \"${batch}\" 2>&1)\n"
+                      "if [ $? -ne 0 ]; then"
+                      "  echo \"Failure to apply rules : '${res}'.\";"
+                      "  exit 1;"
+                      "fi" CMD_SEPARATOR,
+                      restore_cmd);
+}
+
+
+/*
+ * ipsetRemoveUnusedSets
+ *
+ * Destroy the ipsets created for rules that no longer exist. The kernel
+ * refuses to destroy a set that is still referenced by a rule, so the
+ * sets of other interfaces stay in place.
+ */
+static void
+ipsetRemoveUnusedSets(virBufferPtr buf)
+{
+    virBufferAsprintf(buf,
+                      "for tmp in $(%s list -n 2>/dev/null); do\n"
+                      "  case $tmp in\n"
+                      "    " IPSET_NAME_PREFIX "*) %s destroy $tmp 2>/dev/null ;;\n"
+                      "  esac\n"
+                      "done\n",
+                      ipset_cmd_path, ipset_cmd_path);
+}
+
+
 static int
 iptablesHandleSrcMacAddr(virBufferPtr buf,
                          virNWFilterVarCombIterPtr vars,
@@ -2692,6 +2790,275 @@ ebiptablesCreateRuleInstance(enum virDomainNetType nettype ATTRIBUTE_UNUSED,
     return rc;
 }
 
+static ipHdrDataDefPtr
+iptablesGetIpHdr(virNWFilterRuleDefPtr rule, bool *isIPv6)
+{
+    switch (rule->prtclType) {
+    case VIR_NWFILTER_RULE_PROTOCOL_TCPoIPV6:
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPoIPV6:
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPLITEoIPV6:
+    case VIR_NWFILTER_RULE_PROTOCOL_ESPoIPV6:
+    case VIR_NWFILTER_RULE_PROTOCOL_AHoIPV6:
+    case VIR_NWFILTER_RULE_PROTOCOL_SCTPoIPV6:
+    case VIR_NWFILTER_RULE_PROTOCOL_ICMPV6:
+    case VIR_NWFILTER_RULE_PROTOCOL_ALLoIPV6:
+        *isIPv6 = true;
+    break;
+    default:
+        *isIPv6 = false;
+    break;
+    }
+
+    switch (rule->prtclType) {
+    case VIR_NWFILTER_RULE_PROTOCOL_TCP:
+    case VIR_NWFILTER_RULE_PROTOCOL_TCPoIPV6:
+        return &rule->p.tcpHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_UDP:
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPoIPV6:
+        return &rule->p.udpHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPLITE:
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPLITEoIPV6:
+        return &rule->p.udpliteHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_ESP:
+    case VIR_NWFILTER_RULE_PROTOCOL_ESPoIPV6:
+        return &rule->p.espHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_AH:
+    case VIR_NWFILTER_RULE_PROTOCOL_AHoIPV6:
+        return &rule->p.ahHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_SCTP:
+    case VIR_NWFILTER_RULE_PROTOCOL_SCTPoIPV6:
+        return &rule->p.sctpHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_ICMP:
+    case VIR_NWFILTER_RULE_PROTOCOL_ICMPV6:
+        return &rule->p.icmpHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_IGMP:
+        return &rule->p.igmpHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_ALL:
+    case VIR_NWFILTER_RULE_PROTOCOL_ALLoIPV6:
+        return &rule->p.allHdrFilter.ipHdr;
+    default:
+        return NULL;
+    }
+}
+
+
+/*
+ * iptablesIPSetCandidate:
+ * @rule: the rule
+ * @ipHdr: the IP header data of the rule
+ * @item: the source or destination address item of @ipHdr
+ * @mask: the mask belonging to @item
+ * @vars: the variables the rule is instantiated with
+ *
+ * Returns the values of the variable of @item if the rule would be
+ * instantiated once per value of it and could instead match against a
+ * set of all of them, NULL otherwise.
+ */
+static virNWFilterVarValuePtr
+iptablesIPSetCandidate(virNWFilterRuleDefPtr rule,
+                       ipHdrDataDefPtr ipHdr,
+                       nwItemDescPtr item,
+                       nwItemDescPtr mask,
+                       virNWFilterHashTablePtr vars)
+{
+    virNWFilterVarAccessPtr access = item->varAccess;
+    virNWFilterVarValuePtr value;
+    nwItemDescPtr others[] = {
+        &ipHdr->dataSrcIPAddr, &ipHdr->dataDstIPAddr,
+        &ipHdr->dataSrcIPFrom, &ipHdr->dataSrcIPTo,
+        &ipHdr->dataDstIPFrom, &ipHdr->dataDstIPTo,
+    };
+    size_t i;
+
+    if (!HAS_ENTRY_ITEM(item) ||
+        !(item->flags & NWFILTER_ENTRY_ITEM_FLAG_HAS_VAR) ||
+        (item->flags & NWFILTER_ENTRY_ITEM_FLAG_IS_NEG) ||
+        HAS_ENTRY_ITEM(mask))
+        return NULL;
+
+    if (virNWFilterVarAccessGetType(access) !=
+        VIR_NWFILTER_VAR_ACCESS_ITERATOR)
+        return NULL;
+
+    value = virHashLookup(vars->hashTable,
+                          virNWFilterVarAccessGetVarName(access));
+    if (!value || virNWFilterVarValueGetCardinality(value) < 2)
+        return NULL;
+
+    /* the variable must not be iterated over along with another one... */
+    for (i = 0; i < rule->nVarAccess; i++) {
+        if (rule->varAccess[i] != access &&
+            virNWFilterVarAccessGetType(rule->varAccess[i]) ==
+            VIR_NWFILTER_VAR_ACCESS_ITERATOR &&
+            virNWFilterVarAccessGetIterId(rule->varAccess[i]) ==
+            virNWFilterVarAccessGetIterId(access))
+            return NULL;
+    }
+
+    /* ...nor be used by any other address of the rule */
+    for (i = 0; i < ARRAY_CARDINALITY(others); i++) {
+        if (others[i] != item &&
+            HAS_ENTRY_ITEM(others[i]) &&
+            others[i]->varAccess == access)
+            return NULL;
+    }
+
+    return value;
+}
+
+
+/*
+ * iptablesCompileIPSetRule:
+ * @rule: the rule about to be instantiated
+ * @vars: the variables to instantiate it with
+ * @setRule: filled with a copy of @rule that matches against an ipset
+ * @setCommands: filled with shell commands creating the ipset
+ *
+ * A rule with a source or destination address taken from a variable
+ * holding a list of addresses is instantiated once per address, so that
+ * every packet is matched against one rule per address. Compile such
+ * rules into a single rule matching against an ipset of the addresses.
+ * Sets are named after a digest of their content, so interfaces with
+ * the same addresses share a set, and a set never changes while in use.
+ *
+ * The copy in @setRule shares everything but its list of variable
+ * accesses with @rule; only that list must be freed.
+ *
+ * Returns 1 if the rule was compiled, 0 if it has to be instantiated
+ * as is and -1 on error.
+ */
+static int
+iptablesCompileIPSetRule(virNWFilterRuleDefPtr rule,
+                         virNWFilterHashTablePtr vars,
+                         virNWFilterRuleDefPtr setRule,
+                         char **setCommands)
+{
+    ipHdrDataDefPtr ipHdr;
+    virNWFilterVarValuePtr value;
+    nwItemDescPtr item;
+    bool isSrc = true, isIPv6;
+    virBuffer content = VIR_BUFFER_INITIALIZER;
+    virBuffer cmds = VIR_BUFFER_INITIALIZER;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char setname[MAX_IPSET_NAME_LENGTH];
+    const char *family;
+    virSocketAddr addr;
+    unsigned int i, j, n;
+    int ret = -1;
+
+    if (!ipset_cmd_path)
+        return 0;
+
+    if (!(ipHdr = iptablesGetIpHdr(rule, &isIPv6)) ||
+        HAS_ENTRY_ITEM(&ipHdr->dataIPSet))
+        return 0;
+
+    item = &ipHdr->dataSrcIPAddr;
+    if (!(value = iptablesIPSetCandidate(rule, ipHdr, item,
+                                         &ipHdr->dataSrcIPMask, vars))) {
+        isSrc = false;
+        item = &ipHdr->dataDstIPAddr;
+        if (!(value = iptablesIPSetCandidate(rule, ipHdr, item,
+                                             &ipHdr->dataDstIPMask, vars)))
+            return 0;
+    }
+
+    family = isIPv6 ? "inet6" : "inet";
+    n = virNWFilterVarValueGetCardinality(value);
+
+    virBufferAsprintf(&content, "%s\n", family);
+    for (i = 0; i < n; i++) {
+        const char *val = virNWFilterVarValueGetNthValue(value, i);
+
+        /* leave reporting of bad addresses to the per-value rules */
+        if (virSocketAddrParse(&addr, val,
+                               isIPv6 ? AF_INET6 : AF_INET) < 0) {
+            virResetLastError();
+            virBufferFreeAndReset(&content);
+            return 0;
+        }
+        virBufferAsprintf(&content, "%s\n", val);
+    }
+
+    if (virBufferError(&content)) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (!sha256_buffer(virBufferCurrentContent(&content),
+                       virBufferUse(&content), digest)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to compute sha256 checksum"));
+        goto cleanup;
+    }
+
+    j = snprintf(setname, sizeof(setname), "%s", IPSET_NAME_PREFIX);
+    for (i = 0; i < 8; i++)
+        j += snprintf(setname + j, sizeof(setname) - j, "%02x", digest[i]);
+
+    virBufferAsprintf(&cmds,
+                      "%s -exist restore << 'EOF'\n"
+                      "create %s hash:ip family %s\n",
+                      ipset_cmd_path, setname, family);
+    for (i = 0; i < n; i++)
+        virBufferAsprintf(&cmds, "add %s %s\n",
+                          setname, virNWFilterVarValueGetNthValue(value, i));
+    virBufferAsprintf(&cmds,
+                      "EOF\n"
+                      "if [ $? -ne 0 ]; then"
+                      "  echo \"Failure to create ipset %s.\";"
+                      "  exit 1;"
+                      "fi" CMD_SEPARATOR,
+                      setname);
+
+    if (virBufferError(&cmds)) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    *setRule = *rule;
+    setRule->varAccess = NULL;
+    setRule->nVarAccess = 0;
+
+    if (rule->nVarAccess > 1) {
+        if (VIR_ALLOC_N(setRule->varAccess, rule->nVarAccess - 1) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        for (i = 0; i < rule->nVarAccess; i++) {
+            if (rule->varAccess[i] != item->varAccess)
+                setRule->varAccess[setRule->nVarAccess++] = rule->varAccess[i];
+        }
+    }
+
+    /* replace the address with a match against the set */
+    ipHdr = iptablesGetIpHdr(setRule, &isIPv6);
+    if (isSrc)
+        ipHdr->dataSrcIPAddr.flags = 0;
+    else
+        ipHdr->dataDstIPAddr.flags = 0;
+
+    memset(&ipHdr->dataIPSet, 0, sizeof(ipHdr->dataIPSet));
+    ipHdr->dataIPSet.flags = NWFILTER_ENTRY_ITEM_FLAG_EXISTS;
+    ipHdr->dataIPSet.datatype = DATATYPE_IPSETNAME;
+    ignore_value(virStrcpyStatic(ipHdr->dataIPSet.u.ipset.setname, setname));
+
+    memset(&ipHdr->dataIPSetFlags, 0, sizeof(ipHdr->dataIPSetFlags));
+    ipHdr->dataIPSetFlags.flags = NWFILTER_ENTRY_ITEM_FLAG_EXISTS;
+    ipHdr->dataIPSetFlags.datatype = DATATYPE_IPSETFLAGS;
+    ipHdr->dataIPSetFlags.u.ipset.numFlags = 1;
+    ipHdr->dataIPSetFlags.u.ipset.flags = isSrc ? 1 : 0;
+
+    *setCommands = virBufferContentAndReset(&cmds);
+    ret = 1;
+
+cleanup:
+    virBufferFreeAndReset(&content);
+    virBufferFreeAndReset(&cmds);
+    return ret;
+}
+
+
 static int
 ebiptablesCreateRuleInstanceIterate(
                              enum virDomainNetType nettype ATTRIBUTE_UNUSED,
@@ -2703,6 +3070,16 @@ ebiptablesCreateRuleInstanceIterate(
 {
     int rc = 0;
     virNWFilterVarCombIterPtr vciter;
+    virNWFilterRuleDef setRule;
+    char *setCommands = NULL;
+    int compiled;
+    int i, ndata = res->ndata;
+
+    compiled = iptablesCompileIPSetRule(rule, vars, &setRule, &setCommands);
+    if (compiled < 0)
+        return -1;
+    if (compiled)
+        rule = &setRule;
 
     /* rule->vars holds all the variables names that this rule will access.
      * iterate over all combinations of the variables' values and instantiate
@@ -2710,8 +3087,10 @@ ebiptablesCreateRuleInstanceIterate(
      */
     vciter = virNWFilterVarCombIterCreate(vars,
                                           rule->varAccess, rule->nVarAccess);
-    if (!vciter)
-        return -1;
+    if (!vciter) {
+        rc = -1;
+        goto cleanup;
+    }
 
     do {
         rc = ebiptablesCreateRuleInstance(nettype,
@@ -2727,6 +3106,22 @@ ebiptablesCreateRuleInstanceIterate(
 
     virNWFilterVarCombIterFree(vciter);
 
+    /* the set has to exist before any of the rules gets applied */
+    for (i = ndata; rc == 0 && compiled && i < res->ndata; i++) {
+        ebiptablesRuleInstPtr inst = res->data[i];
+
+        if (!(inst->ipsetCommands = strdup(setCommands))) {
+            virReportOOMError();
+            rc = -1;
+        }
+    }
+
+cleanup:
+    if (compiled) {
+        VIR_FREE(setRule.varAccess);
+        VIR_FREE(setCommands);
+    }
+
     return rc;
 }
 
@@ -2749,6 +3144,31 @@ ebiptablesDisplayRuleInstance(void *_inst)
 }
 
 
+/**
+ * ebiptablesFormatRuleInstance:
+ * @_inst: the rule instance to format
+ * @buf: buffer to append the rule instance to
+ *
+ * Append a single line to @buf describing everything that goes into
+ * the firewall for this rule instance. Two instances producing the same
+ * line result in the same firewall rule.
+ */
+static int
+ebiptablesFormatRuleInstance(void *_inst, virBufferPtr buf)
+{
+    ebiptablesRuleInstPtr inst = (ebiptablesRuleInstPtr)_inst;
+
+    virBufferAsprintf(buf, "%d %d %d %d %s %s\n",
+                      inst->ruleType,
+                      inst->chainprefix,
+                      inst->chainPriority,
+                      inst->priority,
+                      NULLSTR(inst->neededProtocolChain),
+                      inst->commandTemplate);
+    return 0;
+}
+
+
 /**
  * ebiptablesExecCLI:
  * @buf : pointer to virBuffer containing the string with the commands to
@@ -3164,6 +3584,120 @@ ebiptablesInstCommand(virBufferPtr buf,
 }
 
 
+/* Exit status of a batch script that found the nat table changed by
+ * someone else and left it alone, see ebtablesBatchCommit */
+#define EBTABLES_BATCH_CONFLICT 3
+
+/*
+ * ebtablesBatchBegin
+ *
+ * Make all $EBT commands following in the script operate on a copy of
+ * the nat table in a file rather than on the kernel's table. Returns
+ * false if ebtables does not support atomic commits.
+ *
+ * ebtables can only commit a whole table, so the copy covers chains
+ * that libvirt does not own as well. A listing of the table is kept
+ * to tell at commit time whether anything else changed it since.
+ */
+static bool
+ebtablesBatchBegin(virBufferPtr buf)
+{
+    if (!ebtables_atomic)
+        return false;
+
+    virBufferAsprintf(buf,
+                      "ebt_before=$($EBT -t nat -L) || exit 1\n"
+                      "EBTABLES_ATOMIC_FILE=$(mktemp) || exit 1\n"
+                      "export EBTABLES_ATOMIC_FILE\n"
+                      "trap 'rm -f \"${EBTABLES_ATOMIC_FILE}\"' EXIT\n"
+                      CMD_DEF("$EBT -t nat --atomic-save") CMD_SEPARATOR
+                      CMD_EXEC
+                      "%s",
+                      CMD_STOPONERR(1));
+    return true;
+}
+
+
+/*
+ * ebtablesBatchCommit
+ *
+ * Replace the kernel's nat table with the one built up since
+ * ebtablesBatchBegin, unless something other than libvirt (whose own
+ * updates are serialized by execCLIMutex) changed the table meanwhile:
+ * the script then exits with EBTABLES_BATCH_CONFLICT without touching
+ * it, and the caller has to apply the rules one by one instead.
+ *
+ * This only narrows the window in which a change made by another tool
+ * is overwritten down to the time between that check and the commit;
+ * ebtables offers nothing to close it. Rule counters of the table are
+ * also set back to what they were at ebtablesBatchBegin.
+ */
+static void
+ebtablesBatchCommit(virBufferPtr buf)
+{
+    virBufferAsprintf(buf,
+                      "if [ \"$(unset EBTABLES_ATOMIC_FILE; $EBT -t nat -L)\" != \"${ebt_before}\" ]; then\n"
+                      "  exit %d\n"
+                      "fi\n"
+                      CMD_DEF("$EBT -t nat --atomic-commit") CMD_SEPARATOR
+                      CMD_EXEC
+                      "%s",
+                      EBTABLES_BATCH_CONFLICT,
+                      CMD_STOPONERR(1));
+}
+
+
+/*
+ * ebtablesInstRules
+ *
+ * Append the ebtables rules among @inst to @buf, interleaved with the
+ * commands for connecting the chains in @ebtChains, and note whether
+ * there are any ip(6)tables rules.
+ */
+static void
+ebtablesInstRules(virBufferPtr buf,
+                  ebiptablesRuleInstPtr *inst,
+                  int nruleInstances,
+                  ebiptablesRuleInstPtr ebtChains,
+                  int nEbtChains,
+                  bool *haveIptables,
+                  bool *haveIp6tables)
+{
+    int i, j;
+
+    /* process ebtables commands; interleave commands from filters with
+       commands for creating and connecting ebtables chains */
+    j = 0;
+    for (i = 0; i < nruleInstances; i++) {
+        sa_assert(inst);
+        switch (inst[i]->ruleType) {
+        case RT_EBTABLES:
+            while (j < nEbtChains &&
+                   ebtChains[j].priority <= inst[i]->priority) {
+                ebiptablesInstCommand(buf,
+                                      ebtChains[j++].commandTemplate,
+                                      'A', -1, 1);
+            }
+            ebiptablesInstCommand(buf,
+                                  inst[i]->commandTemplate,
+                                  'A', -1, 1);
+        break;
+        case RT_IPTABLES:
+            *haveIptables = true;
+        break;
+        case RT_IP6TABLES:
+            *haveIp6tables = true;
+        break;
+        }
+    }
+
+    while (j < nEbtChains)
+        ebiptablesInstCommand(buf,
+                              ebtChains[j++].commandTemplate,
+                              'A', -1, 1);
+}
+
+
 /**
  * ebiptablesCanApplyBasicRules
  *
@@ -3655,19 +4189,44 @@ ebtablesCreateTmpRootAndSubChains(virBufferPtr buf,
     return rc;
 }
 
+/*
+ * ebiptablesInstIPSet
+ *
+ * Add the commands creating the ipset a rule matches against to the
+ * script, unless that was already done for another rule.
+ */
+static int
+ebiptablesInstIPSet(virBufferPtr buf,
+                    virHashTablePtr ipsets,
+                    ebiptablesRuleInstPtr inst)
+{
+    if (!inst->ipsetCommands ||
+        virHashLookup(ipsets, inst->ipsetCommands))
+        return 0;
+
+    if (virHashAddEntry(ipsets, inst->ipsetCommands, inst) < 0)
+        return -1;
+
+    virBufferAdd(buf, inst->ipsetCommands, -1);
+    return 0;
+}
+
+
 static int
 ebiptablesApplyNewRules(const char *ifname,
                         int nruleInstances,
                         void **_inst)
 {
-    int i, j;
+    int i;
     int cli_status;
     ebiptablesRuleInstPtr *inst = (ebiptablesRuleInstPtr *)_inst;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
     virHashTablePtr chains_in_set  = virHashCreate(10, NULL);
     virHashTablePtr chains_out_set = virHashCreate(10, NULL);
+    virHashTablePtr ipsets = virHashCreate(10, NULL);
     bool haveIptables = false;
     bool haveIp6tables = false;
+    bool batched;
     ebiptablesRuleInstPtr ebtChains = NULL;
     int nEbtChains = 0;
     char *errmsg = NULL;
@@ -3675,7 +4234,7 @@ ebiptablesApplyNewRules(const char *ifname,
     if (inst == NULL)
         nruleInstances = 0;
 
-    if (!chains_in_set || !chains_out_set) {
+    if (!chains_in_set || !chains_out_set || !ipsets) {
         virReportOOMError();
         goto exit_free_sets;
     }
@@ -3739,37 +4298,29 @@ ebiptablesApplyNewRules(const char *ifname,
 
     NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
 
-    /* process ebtables commands; interleave commands from filters with
-       commands for creating and connecting ebtables chains */
-    j = 0;
-    for (i = 0; i < nruleInstances; i++) {
-        sa_assert(inst);
-        switch (inst[i]->ruleType) {
-        case RT_EBTABLES:
-            while (j < nEbtChains &&
-                   ebtChains[j].priority <= inst[i]->priority) {
-                ebiptablesInstCommand(&buf,
-                                      ebtChains[j++].commandTemplate,
-                                      'A', -1, 1);
-            }
-            ebiptablesInstCommand(&buf,
-                                  inst[i]->commandTemplate,
-                                  'A', -1, 1);
-        break;
-        case RT_IPTABLES:
-            haveIptables = true;
-        break;
-        case RT_IP6TABLES:
-            haveIp6tables = true;
-        break;
+    batched = ebtablesBatchBegin(&buf);
+
+    ebtablesInstRules(&buf, inst, nruleInstances, ebtChains, nEbtChains,
+                      &haveIptables, &haveIp6tables);
+
+    if (batched) {
+        ebtablesBatchCommit(&buf);
+
+        if (ebiptablesExecCLI(&buf, &cli_status, &errmsg) < 0)
+            goto tear_down_tmpebchains;
+
+        if (cli_status == EBTABLES_BATCH_CONFLICT) {
+            VIR_DEBUG("nat table changed under the batch for %s, "
+                      "applying its rules one by one", ifname);
+            NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
+            ebtablesInstRules(&buf, inst, nruleInstances,
+                              ebtChains, nEbtChains,
+                              &haveIptables, &haveIp6tables);
+        } else if (cli_status != 0) {
+            goto tear_down_tmpebchains;
         }
     }
 
-    while (j < nEbtChains)
-        ebiptablesInstCommand(&buf,
-                              ebtChains[j++].commandTemplate,
-                              'A', -1, 1);
-
     if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
         goto tear_down_tmpebchains;
 
@@ -3800,14 +4351,24 @@ ebiptablesApplyNewRules(const char *ifname,
 
         NWFILTER_SET_IPTABLES_SHELLVAR(&buf);
 
+        batched = iptablesBatchBegin(&buf, iptables_restore_cmd_path);
+
         for (i = 0; i < nruleInstances; i++) {
             sa_assert(inst);
-            if (inst[i]->ruleType == RT_IPTABLES)
+            if (inst[i]->ruleType == RT_IPTABLES) {
+                if (ebiptablesInstIPSet(&buf, ipsets, inst[i]) < 0) {
+                    virBufferFreeAndReset(&buf);
+                    goto tear_down_tmpiptchains;
+                }
                 iptablesInstCommand(&buf,
                                     inst[i]->commandTemplate,
                                     'A', -1, 1);
+            }
         }
 
+        if (batched)
+            iptablesBatchCommit(&buf, iptables_restore_cmd_path);
+
         if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
            goto tear_down_tmpiptchains;
 
@@ -3841,13 +4402,23 @@ ebiptablesApplyNewRules(const char *ifname,
 
         NWFILTER_SET_IP6TABLES_SHELLVAR(&buf);
 
+        batched = iptablesBatchBegin(&buf, ip6tables_restore_cmd_path);
+
         for (i = 0; i < nruleInstances; i++) {
-            if (inst[i]->ruleType == RT_IP6TABLES)
+            if (inst[i]->ruleType == RT_IP6TABLES) {
+                if (ebiptablesInstIPSet(&buf, ipsets, inst[i]) < 0) {
+                    virBufferFreeAndReset(&buf);
+                    goto tear_down_tmpip6tchains;
+                }
                 iptablesInstCommand(&buf,
                                     inst[i]->commandTemplate,
                                     'A', -1, 1);
+            }
         }
 
+        if (batched)
+            iptablesBatchCommit(&buf, ip6tables_restore_cmd_path);
+
         if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
            goto tear_down_tmpip6tchains;
 
@@ -3866,6 +4437,7 @@ ebiptablesApplyNewRules(const char *ifname,
 
     virHashFree(chains_in_set);
     virHashFree(chains_out_set);
+    virHashFree(ipsets);
 
     for (i = 0; i < nEbtChains; i++)
         VIR_FREE(ebtChains[i].commandTemplate);
@@ -3908,6 +4480,9 @@ tear_down_tmpebchains:
         ebtablesRemoveTmpRootChain(&buf, 0, ifname);
     }
 
+    if (ipset_cmd_path && virHashSize(ipsets) > 0)
+        ipsetRemoveUnusedSets(&buf);
+
     ebiptablesExecCLI(&buf, &cli_status, NULL);
 
     virReportError(VIR_ERR_BUILD_FIREWALL,
@@ -3920,6 +4495,7 @@ tear_down_tmpebchains:
 exit_free_sets:
     virHashFree(chains_in_set);
     virHashFree(chains_out_set);
+    virHashFree(ipsets);
 
     for (i = 0; i < nEbtChains; i++)
         VIR_FREE(ebtChains[i].commandTemplate);
@@ -3962,6 +4538,9 @@ ebiptablesTearNewRules(const char *ifname)
         ebtablesRemoveTmpRootChain(&buf, 0, ifname);
     }
 
+    if (ipset_cmd_path)
+        ipsetRemoveUnusedSets(&buf);
+
     ebiptablesExecCLI(&buf, &cli_status, NULL);
 
     return 0;
@@ -3995,6 +4574,11 @@ ebiptablesTearOldRules(const char *ifname)
         ebiptablesExecCLI(&buf, &cli_status, NULL);
     }
 
+    if (ipset_cmd_path) {
+        ipsetRemoveUnusedSets(&buf);
+        ebiptablesExecCLI(&buf, &cli_status, NULL);
+    }
+
     if (ebtables_cmd_path) {
         NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
 
@@ -4102,6 +4686,10 @@ ebiptablesAllTeardown(const char *ifname)
         ebtablesRemoveRootChain(&buf, 1, ifname);
         ebtablesRemoveRootChain(&buf, 0, ifname);
     }
+
+    if (ipset_cmd_path)
+        ipsetRemoveUnusedSets(&buf);
+
     ebiptablesExecCLI(&buf, &cli_status, NULL);
 
     return 0;
@@ -4123,6 +4711,7 @@ virNWFilterTechDriver ebiptables_driver = {
     .removeRules         = ebiptablesRemoveRules,
     .freeRuleInstance    = ebiptablesFreeRuleInstance,
     .displayRuleInstance = ebiptablesDisplayRuleInstance,
+    .formatRuleInstance  = ebiptablesFormatRuleInstance,
 
     .canApplyBasicRules  = ebiptablesCanApplyBasicRules,
     .applyBasicRules     = ebtablesApplyBasicRules,
@@ -4210,9 +4799,89 @@ ebiptablesDriverInitCLITools(void)
     if (!ip6tables_cmd_path)
         VIR_WARN("Could not find 'ip6tables' executable");
 
+    if (iptables_cmd_path)
+        iptables_restore_cmd_path = virFindFileInPath("iptables-restore");
+    if (ip6tables_cmd_path)
+        ip6tables_restore_cmd_path = virFindFileInPath("ip6tables-restore");
+
     return 0;
 }
 
+/*
+ * ebiptablesDriverProbeBatching
+ *
+ * Determine whether the tools support applying a set of rules in a single
+ * transaction. Where they don't, rules are applied one command at a time.
+ */
+static void
+ebiptablesDriverProbeBatching(void)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    int status;
+
+    if (ebtables_cmd_path) {
+        NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
+        virBufferAddLit(&buf,
+                        "EBTABLES_ATOMIC_FILE=$(mktemp) || exit 1\n"
+                        "export EBTABLES_ATOMIC_FILE\n"
+                        "$EBT -t nat --atomic-save\n"
+                        "status=$?\n"
+                        "rm -f \"${EBTABLES_ATOMIC_FILE}\"\n"
+                        "exit $status\n");
+
+        if (ebiptablesExecCLI(&buf, &status, NULL) == 0 && status == 0)
+            ebtables_atomic = true;
+        else
+            VIR_INFO("ebtables does not support atomic commits");
+    }
+
+    if (iptables_restore_cmd_path) {
+        virBufferAsprintf(&buf,
+                          "printf '*filter\\nCOMMIT\\n' | %s --test --noflush\n",
+                          iptables_restore_cmd_path);
+
+        if (ebiptablesExecCLI(&buf, &status, NULL) < 0 || status != 0) {
+            VIR_INFO("Testing of iptables-restore command failed");
+            VIR_FREE(iptables_restore_cmd_path);
+        }
+    }
+
+    if (ip6tables_restore_cmd_path) {
+        virBufferAsprintf(&buf,
+                          "printf '*filter\\nCOMMIT\\n' | %s --test --noflush\n",
+                          ip6tables_restore_cmd_path);
+
+        if (ebiptablesExecCLI(&buf, &status, NULL) < 0 || status != 0) {
+            VIR_INFO("Testing of ip6tables-restore command failed");
+            VIR_FREE(ip6tables_restore_cmd_path);
+        }
+    }
+}
+
+/*
+ * ebiptablesDriverProbeIPSet
+ *
+ * Determine whether ipsets can be created, so that rules with lists of
+ * addresses can match against a set instead of being repeated per
+ * address.
+ */
+static void
+ebiptablesDriverProbeIPSet(void)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    int status;
+
+    if (!(ipset_cmd_path = virFindFileInPath("ipset")))
+        return;
+
+    virBufferAsprintf(&buf, "%s list -n > /dev/null\n", ipset_cmd_path);
+
+    if (ebiptablesExecCLI(&buf, &status, NULL) < 0 || status != 0) {
+        VIR_INFO("Testing of ipset command failed");
+        VIR_FREE(ipset_cmd_path);
+    }
+}
+
 /*
  * ebiptablesDriverTestCLITools
  *
@@ -4285,6 +4954,8 @@ ebiptablesDriverTestCLITools(void)
 static int
 ebiptablesDriverInit(bool privileged)
 {
+    bool probeBatching = false;
+
     if (!privileged)
         return 0;
 
@@ -4298,12 +4969,21 @@ ebiptablesDriverInit(bool privileged)
      * if not, we just fall back to eb/iptables command
      * line tools.
      */
-    if (ebiptablesDriverInitWithFirewallD() < 0)
+    if (ebiptablesDriverInitWithFirewallD() < 0) {
         ebiptablesDriverInitCLITools();
+        /* rules passed through firewalld are never batched */
+        probeBatching = true;
+    }
 
     /* make sure tools are available and work */
     ebiptablesDriverTestCLITools();
 
+    if (probeBatching)
+        ebiptablesDriverProbeBatching();
+
+    if (iptables_cmd_path || ip6tables_cmd_path)
+        ebiptablesDriverProbeIPSet();
+
     /* ip(6)tables support needs awk & grep, ebtables doesn't */
     if ((iptables_cmd_path != NULL || ip6tables_cmd_path != NULL) &&
         !grep_cmd_path) {
@@ -4332,5 +5012,9 @@ ebiptablesDriverShutdown(void)
     VIR_FREE(ebtables_cmd_path);
     VIR_FREE(iptables_cmd_path);
     VIR_FREE(ip6tables_cmd_path);
+    VIR_FREE(iptables_restore_cmd_path);
+    VIR_FREE(ip6tables_restore_cmd_path);
+    VIR_FREE(ipset_cmd_path);
+    ebtables_atomic = false;
     ebiptables_driver.flags = 0;
 }
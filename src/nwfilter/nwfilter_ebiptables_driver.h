@@ -40,6 +40,7 @@ struct _ebiptablesRuleInst {
     char chainprefix;    /* I for incoming, O for outgoing */
     virNWFilterRulePriority priority;
     enum RuleType ruleType;
+    char *ipsetCommands; /* creates the ipset the rule matches against */
 };
 
 extern virNWFilterTechDriver ebiptables_driver;
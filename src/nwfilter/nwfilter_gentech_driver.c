@@ -37,6 +37,8 @@
 #include "nwfilter_learnipaddr.h"
 #include "virnetdev.h"
 #include "datatypes.h"
+#include "threads.h"
+#include "sha256.h"
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
 
@@ -54,15 +56,45 @@ static virNWFilterTechDriverPtr filter_tech_drivers[] = {
     NULL
 };
 
+/*
+ * Digest of the rule set that was last applied to an interface, keyed
+ * by interface name. Redefining a filter that is used by many
+ * interfaces only needs to touch those interfaces whose effective
+ * rules actually change.
+ */
+static virMutex ruleDigestLock;
+static virHashTablePtr ruleDigests;
+
+
+static void
+freeRuleDigest(void *payload, const void *name ATTRIBUTE_UNUSED) {
+    VIR_FREE(payload);
+}
 
-void virNWFilterTechDriversInit(bool privileged) {
+
+int virNWFilterTechDriversInit(bool privileged) {
     int i = 0;
+
+    if (virMutexInit(&ruleDigestLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("mutex initialization failed"));
+        return -1;
+    }
+
+    if (!(ruleDigests = virHashCreate(0, freeRuleDigest))) {
+        virMutexDestroy(&ruleDigestLock);
+        virReportOOMError();
+        return -1;
+    }
+
     VIR_DEBUG("Initializing NWFilter technology drivers");
     while (filter_tech_drivers[i]) {
         if (!(filter_tech_drivers[i]->flags & TECHDRV_FLAG_INITIALIZED))
             filter_tech_drivers[i]->init(privileged);
         i++;
     }
+
+    return 0;
 }
 
 
@@ -73,6 +105,12 @@ void virNWFilterTechDriversShutdown(void) {
             filter_tech_drivers[i]->shutdown();
         i++;
     }
+
+    if (ruleDigests) {
+        virHashFree(ruleDigests);
+        ruleDigests = NULL;
+        virMutexDestroy(&ruleDigestLock);
+    }
 }
 
 
@@ -625,6 +663,127 @@ virNWFilterRuleInstancesToArray(int nEntries,
 }
 
 
+/**
+ * virNWFilterRuleInstancesDigest:
+ * @techdriver: The driver the rule instances were created by
+ * @nptrs: Number of rule instances
+ * @ptrs: The rule instances as passed to the driver's applyNewRules
+ * @digest: Buffer to store the digest in
+ *
+ * Compute a digest over the canonical form of the given rule instances,
+ * in the order in which they are handed to the tech driver.
+ *
+ * Returns 0 on success, -1 on failure with error reported.
+ */
+static int
+virNWFilterRuleInstancesDigest(virNWFilterTechDriverPtr techdriver,
+                               int nptrs,
+                               void **ptrs,
+                               unsigned char *digest)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    const char *content;
+    int i;
+    int ret = -1;
+
+    if (!techdriver->formatRuleInstance) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("ACL tech driver '%s' cannot format rule instances"),
+                       techdriver->name);
+        return -1;
+    }
+
+    for (i = 0; i < nptrs; i++) {
+        if (techdriver->formatRuleInstance(ptrs[i], &buf) < 0)
+            goto cleanup;
+    }
+
+    if (virBufferError(&buf)) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    content = virBufferCurrentContent(&buf);
+    if (!sha256_buffer(content, strlen(content), digest)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to compute sha256 checksum"));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(&buf);
+    return ret;
+}
+
+
+/*
+ * Returns true if @digest matches the rule set last applied to @ifname.
+ */
+static bool
+virNWFilterRuleDigestMatches(const char *ifname,
+                             const unsigned char *digest)
+{
+    unsigned char *applied;
+    bool ret = false;
+
+    if (!ruleDigests)
+        return false;
+
+    virMutexLock(&ruleDigestLock);
+    applied = virHashLookup(ruleDigests, ifname);
+    if (applied && memcmp(applied, digest, SHA256_DIGEST_SIZE) == 0)
+        ret = true;
+    virMutexUnlock(&ruleDigestLock);
+
+    return ret;
+}
+
+
+/*
+ * Remember @digest as the rule set applied to @ifname. Failing to do so
+ * is not an error; the next update of the interface won't be skipped.
+ */
+static void
+virNWFilterRuleDigestStore(const char *ifname,
+                           const unsigned char *digest)
+{
+    unsigned char *applied;
+
+    if (!ruleDigests)
+        return;
+
+    virMutexLock(&ruleDigestLock);
+    if (VIR_ALLOC_N(applied, SHA256_DIGEST_SIZE) < 0 ||
+        virHashUpdateEntry(ruleDigests, ifname, applied) < 0) {
+        VIR_FREE(applied);
+        virHashRemoveEntry(ruleDigests, ifname);
+        virResetLastError();
+    } else {
+        memcpy(applied, digest, SHA256_DIGEST_SIZE);
+    }
+    virMutexUnlock(&ruleDigestLock);
+}
+
+
+/*
+ * Forget about the rule set applied to @ifname, for example because
+ * the rules were torn down or the update they were part of was rolled
+ * back.
+ */
+static void
+virNWFilterRuleDigestForget(const char *ifname)
+{
+    if (!ruleDigests)
+        return;
+
+    virMutexLock(&ruleDigestLock);
+    virHashRemoveEntry(ruleDigests, ifname);
+    virMutexUnlock(&ruleDigestLock);
+}
+
+
 /**
  * virNWFilterInstantiate:
  * @vmuuid: The UUID of the VM
@@ -665,6 +824,7 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
     int nEntries = 0;
     virNWFilterRuleInstPtr *insts = NULL;
     void **ptrs = NULL;
+    unsigned char digest[SHA256_DIGEST_SIZE];
     int instantiate = 1;
     char *buf;
     virNWFilterVarValuePtr lv;
@@ -702,6 +862,8 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
                 reportIP = true;
                 goto err_unresolvable_vars;
             }
+            /* rules get replaced while the address is being learned */
+            virNWFilterRuleDigestForget(ifname);
             if (STRCASEEQ(learning, "dhcp")) {
                 rc = virNWFilterDHCPSnoopReq(techdriver, ifname, linkdev,
                                              nettype, vmuuid, macaddr,
@@ -763,9 +925,22 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
         if (rc < 0)
             goto err_exit;
 
+        rc = virNWFilterRuleInstancesDigest(techdriver, nptrs, ptrs, digest);
+        if (rc < 0)
+            goto err_exit;
+
         if (virNWFilterLockIface(ifname) < 0)
             goto err_exit;
 
+        if (useNewFilter == INSTANTIATE_FOLLOW_NEWFILTER &&
+            virNWFilterRuleDigestMatches(ifname, digest)) {
+            /* the changed filter tree still yields the rules in place */
+            VIR_DEBUG("Rules for interface %s unchanged", ifname);
+            *foundNewFilter = false;
+            virNWFilterUnlockIface(ifname);
+            goto err_exit;
+        }
+
         rc = techdriver->applyNewRules(ifname, nptrs, ptrs);
 
         if (teardownOld && rc == 0)
@@ -778,6 +953,11 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
             rc = -1;
         }
 
+        if (rc == 0)
+            virNWFilterRuleDigestStore(ifname, digest);
+        else
+            virNWFilterRuleDigestForget(ifname);
+
         virNWFilterUnlockIface(ifname);
     }
 
@@ -1075,6 +1255,9 @@ virNWFilterRollbackUpdateFilter(const virDomainNetDefPtr net)
         return -1;
     }
 
+    /* the rules remembered for the interface were never put in place */
+    virNWFilterRuleDigestForget(net->ifname);
+
     /* don't tear anything while the address is being learned */
     if (virNetDevGetIndex(net->ifname, &ifindex) < 0)
         virResetLastError();
@@ -1134,6 +1317,7 @@ _virNWFilterTeardownFilter(const char *ifname)
        return -1;
 
     techdriver->allTeardown(ifname);
+    virNWFilterRuleDigestForget(ifname);
 
     virNWFilterIPAddrMapDelIPAddr(ifname, NULL);
 
@@ -560,6 +560,7 @@ openvzFreeDriver(struct openvz_driver *driver)
 
     virDomainObjListDeinit(&driver->domains);
     virCapabilitiesFree(driver->caps);
+    virOutputCacheFree(driver->vzlistCache);
     VIR_FREE(driver);
 }
 
@@ -570,6 +571,7 @@ int openvzLoadDomains(struct openvz_driver *driver) {
     char *status;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
     virDomainObjPtr dom = NULL;
+    virDomainObjPtr dup;
     char *temp = NULL;
     char *outbuf = NULL;
     char *line;
@@ -655,15 +657,16 @@ int openvzLoadDomains(struct openvz_driver *driver) {
         openvzReadFSConf(dom->def, veid);
         openvzReadMemConf(dom->def, veid);
 
-        virUUIDFormat(dom->def->uuid, uuidstr);
-        if (virHashLookup(driver->domains.objs, uuidstr)) {
+        if ((dup = virDomainFindByUUID(&driver->domains, dom->def->uuid))) {
+            virDomainObjUnlock(dup);
+            virUUIDFormat(dom->def->uuid, uuidstr);
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("Duplicate container UUID %s detected for %d"),
                            uuidstr,
                            veid);
             goto cleanup;
         }
-        if (virHashAddEntry(driver->domains.objs, uuidstr, dom) < 0) {
+        if (virDomainObjListAdd(&driver->domains, dom) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("Could not add UUID for container %d"), veid);
             goto cleanup;
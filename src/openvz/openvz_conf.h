@@ -32,6 +32,7 @@
 # include "internal.h"
 # include "domain_conf.h"
 # include "threads.h"
+# include "viroutputcache.h"
 
 
 /* OpenVZ commands - Replace with wrapper scripts later? */
@@ -41,12 +42,16 @@
 
 # define VZCTL_BRIDGE_MIN_VERSION ((3 * 1000 * 1000) + (0 * 1000) + 22 + 1)
 
+/* How long a container listing from vzlist is reused, in milliseconds */
+# define OPENVZ_VZLIST_CACHE_TTL 2000
+
 struct openvz_driver {
     virMutex lock;
 
     virCapsPtr caps;
     virDomainObjList domains;
     int version;
+    virOutputCachePtr vzlistCache; /* has its own lock */
 };
 
 typedef int (*openvzLocateConfFileFunc)(int vpsid, char **conffile, const char *ext);
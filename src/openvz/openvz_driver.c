@@ -75,7 +75,8 @@ static int openvzDomainSetVcpusInternal(virDomainObjPtr vm,
                                         unsigned int nvcpus);
 static int openvzDomainSetMemoryInternal(virDomainObjPtr vm,
                                          unsigned long long memory);
-static int openvzGetVEStatus(virDomainObjPtr vm, int *status, int *reason);
+static int openvzGetVEStatus(struct openvz_driver *driver, virDomainObjPtr vm,
+                             int *status, int *reason);
 
 static void openvzDriverLock(struct openvz_driver *driver)
 {
@@ -398,7 +399,7 @@ static int openvzDomainGetInfo(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (openvzGetVEStatus(vm, &state, NULL) == -1)
+    if (openvzGetVEStatus(driver, vm, &state, NULL) == -1)
         goto cleanup;
     info->state = state;
 
@@ -446,7 +447,7 @@ openvzDomainGetState(virDomainPtr dom,
         goto cleanup;
     }
 
-    ret = openvzGetVEStatus(vm, state, reason);
+    ret = openvzGetVEStatus(driver, vm, state, reason);
 
 cleanup:
     if (vm)
@@ -548,6 +549,17 @@ static void openvzSetProgramSentinal(const char **prog, const char *key)
     }
 }
 
+/* Run vzctl on a container, then forget what vzlist said about it */
+static int
+openvzRunCtl(struct openvz_driver *driver, const char **prog)
+{
+    int ret = virRun(prog, NULL);
+
+    /* Even a failed command may have changed the container's state */
+    virOutputCacheInvalidate(driver->vzlistCache);
+    return ret;
+}
+
 static int openvzDomainSuspend(virDomainPtr dom) {
     struct openvz_driver *driver = dom->conn->privateData;
     virDomainObjPtr vm;
@@ -572,7 +584,7 @@ static int openvzDomainSuspend(virDomainPtr dom) {
 
     if (virDomainObjGetState(vm, NULL) != VIR_DOMAIN_PAUSED) {
         openvzSetProgramSentinal(prog, vm->def->name);
-        if (virRun(prog, NULL) < 0) {
+        if (openvzRunCtl(driver, prog) < 0) {
             goto cleanup;
         }
         virDomainObjSetState(vm, VIR_DOMAIN_PAUSED, VIR_DOMAIN_PAUSED_USER);
@@ -610,7 +622,7 @@ static int openvzDomainResume(virDomainPtr dom) {
 
   if (virDomainObjGetState(vm, NULL) == VIR_DOMAIN_PAUSED) {
       openvzSetProgramSentinal(prog, vm->def->name);
-      if (virRun(prog, NULL) < 0) {
+      if (openvzRunCtl(driver, prog) < 0) {
           goto cleanup;
       }
       virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, VIR_DOMAIN_RUNNING_UNPAUSED);
@@ -645,7 +657,7 @@ openvzDomainShutdownFlags(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (openvzGetVEStatus(vm, &status, NULL) == -1)
+    if (openvzGetVEStatus(driver, vm, &status, NULL) == -1)
         goto cleanup;
 
     openvzSetProgramSentinal(prog, vm->def->name);
@@ -655,7 +667,7 @@ openvzDomainShutdownFlags(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (virRun(prog, NULL) < 0)
+    if (openvzRunCtl(driver, prog) < 0)
         goto cleanup;
 
     vm->def->id = -1;
@@ -696,7 +708,7 @@ static int openvzDomainReboot(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (openvzGetVEStatus(vm, &status, NULL) == -1)
+    if (openvzGetVEStatus(driver, vm, &status, NULL) == -1)
         goto cleanup;
 
     openvzSetProgramSentinal(prog, vm->def->name);
@@ -706,7 +718,7 @@ static int openvzDomainReboot(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (virRun(prog, NULL) < 0)
+    if (openvzRunCtl(driver, prog) < 0)
         goto cleanup;
     ret = 0;
 
@@ -978,6 +990,7 @@ openvzDomainDefineXML(virConnectPtr conn, const char *xml)
         VIR_ERROR(_("Error creating initial configuration"));
         goto cleanup;
     }
+    virOutputCacheInvalidate(driver->vzlistCache);
 
     if (vm->def->nfss == 1) {
         if (openvzSetDiskQuota(vm->def, vm->def->fss[0], true) < 0) {
@@ -1066,6 +1079,7 @@ openvzDomainCreateXML(virConnectPtr conn, const char *xml,
         VIR_ERROR(_("Error creating initial configuration"));
         goto cleanup;
     }
+    virOutputCacheInvalidate(driver->vzlistCache);
 
     if (vm->def->nfss == 1) {
         if (openvzSetDiskQuota(vm->def, vm->def->fss[0], true) < 0) {
@@ -1086,7 +1100,7 @@ openvzDomainCreateXML(virConnectPtr conn, const char *xml,
 
     openvzSetProgramSentinal(progstart, vm->def->name);
 
-    if (virRun(progstart, NULL) < 0) {
+    if (openvzRunCtl(driver, progstart) < 0) {
         goto cleanup;
     }
 
@@ -1135,7 +1149,7 @@ openvzDomainCreateWithFlags(virDomainPtr dom, unsigned int flags)
         goto cleanup;
     }
 
-    if (openvzGetVEStatus(vm, &status, NULL) == -1)
+    if (openvzGetVEStatus(driver, vm, &status, NULL) == -1)
         goto cleanup;
 
     if (status != VIR_DOMAIN_SHUTOFF) {
@@ -1145,7 +1159,7 @@ openvzDomainCreateWithFlags(virDomainPtr dom, unsigned int flags)
     }
 
     openvzSetProgramSentinal(prog, vm->def->name);
-    if (virRun(prog, NULL) < 0) {
+    if (openvzRunCtl(driver, prog) < 0) {
         goto cleanup;
     }
 
@@ -1187,11 +1201,11 @@ openvzDomainUndefineFlags(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (openvzGetVEStatus(vm, &status, NULL) == -1)
+    if (openvzGetVEStatus(driver, vm, &status, NULL) == -1)
         goto cleanup;
 
     openvzSetProgramSentinal(prog, vm->def->name);
-    if (virRun(prog, NULL) < 0) {
+    if (openvzRunCtl(driver, prog) < 0) {
         goto cleanup;
     }
 
@@ -1442,6 +1456,9 @@ static virDrvOpenStatus openvzOpen(virConnectPtr conn,
     if (virDomainObjListInit(&driver->domains) < 0)
         goto cleanup;
 
+    if (!(driver->vzlistCache = virOutputCacheNew(OPENVZ_VZLIST_CACHE_TTL)))
+        goto cleanup;
+
     if (!(driver->caps = openvzCapsInit()))
         goto cleanup;
 
@@ -1500,47 +1517,68 @@ static char *openvzGetCapabilities(virConnectPtr conn) {
     return ret;
 }
 
-static int openvzListDomains(virConnectPtr conn ATTRIBUTE_UNUSED,
-                             int *ids, int nids) {
-    int got = 0;
-    int veid;
-    int outfd = -1;
-    int rc = -1;
-    int ret;
-    char buf[32];
-    char *endptr;
-    virCommandPtr cmd = virCommandNewArgList(VZLIST, "-ovpsid", "-H" , NULL);
+/* Get vzlist's listing of all containers and whether they run */
+static char *
+openvzListAll(struct openvz_driver *driver)
+{
+    virCommandPtr cmd = virCommandNewArgList(VZLIST, "-a", "-ovpsid,status",
+                                             "-H", NULL);
+    char *output;
 
-    virCommandSetOutputFD(cmd, &outfd);
-    if (virCommandRunAsync(cmd, NULL) < 0)
-        goto cleanup;
+    output = virOutputCacheRunCommand(driver->vzlistCache, cmd);
+    virCommandFree(cmd);
+    return output;
+}
 
-    while (got < nids) {
-        ret = openvz_readline(outfd, buf, 32);
-        if (!ret)
-            break;
-        if (virStrToLong_i(buf, &endptr, 10, &veid) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Could not parse VPS ID %s"), buf);
-            continue;
-        }
-        ids[got] = veid;
-        got ++;
+/* Parse the next line of openvzListAll output and advance @cur past
+ * it.  Returns 1 if a container was found, 0 at the end of the output
+ * and -1 on error. */
+static int
+openvzListNext(const char **cur, int *veid, bool *running)
+{
+    const char *p = *cur;
+    char *end;
+
+    virSkipSpaces(&p);
+    if (!*p)
+        return 0;
+
+    if (virStrToLong_i(p, &end, 10, veid) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Could not parse VPS ID %s"), p);
+        return -1;
     }
+    p = end;
+    virSkipSpaces(&p);
 
-    if (virCommandWait(cmd, NULL) < 0)
-        goto cleanup;
+    *running = STRPREFIX(p, "running");
 
-    if (VIR_CLOSE(outfd) < 0) {
-        virReportSystemError(errno, "%s", _("failed to close file"));
-        goto cleanup;
+    p += strcspn(p, "\n");
+    *cur = p;
+    return 1;
+}
+
+static int openvzListDomains(virConnectPtr conn,
+                             int *ids, int nids) {
+    struct openvz_driver *driver = conn->privateData;
+    int got = 0;
+    int veid;
+    bool running;
+    int rc = 0;
+    char *output;
+    const char *cur;
+
+    if (!(output = openvzListAll(driver)))
+        return -1;
+
+    cur = output;
+    while (got < nids && (rc = openvzListNext(&cur, &veid, &running)) > 0) {
+        if (running)
+            ids[got++] = veid;
     }
 
-    rc = got;
-cleanup:
-    VIR_FORCE_CLOSE(outfd);
-    virCommandFree(cmd);
-    return rc;
+    VIR_FREE(output);
+    return rc < 0 ? -1 : got;
 }
 
 static int openvzNumDomains(virConnectPtr conn) {
@@ -1554,56 +1592,38 @@ static int openvzNumDomains(virConnectPtr conn) {
     return n;
 }
 
-static int openvzListDefinedDomains(virConnectPtr conn ATTRIBUTE_UNUSED,
+static int openvzListDefinedDomains(virConnectPtr conn,
                                     char **const names, int nnames) {
+    struct openvz_driver *driver = conn->privateData;
     int got = 0;
-    int veid, outfd = -1, ret;
-    int rc = -1;
-    char vpsname[32];
-    char buf[32];
-    char *endptr;
-    virCommandPtr cmd = virCommandNewArgList(VZLIST,
-                                             "-ovpsid", "-H", "-S", NULL);
-
-    /* the -S options lists only stopped domains */
-    virCommandSetOutputFD(cmd, &outfd);
-    if (virCommandRunAsync(cmd, NULL) < 0)
-        goto out;
-
-    while (got < nnames) {
-        ret = openvz_readline(outfd, buf, 32);
-        if (!ret)
-            break;
-        if (virStrToLong_i(buf, &endptr, 10, &veid) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Could not parse VPS ID %s"), buf);
+    int veid;
+    bool running;
+    int rc = 0;
+    char *output;
+    const char *cur;
+
+    if (!(output = openvzListAll(driver)))
+        return -1;
+
+    cur = output;
+    while (got < nnames && (rc = openvzListNext(&cur, &veid, &running)) > 0) {
+        if (running)
             continue;
-        }
-        snprintf(vpsname, sizeof(vpsname), "%d", veid);
-        if (!(names[got] = strdup(vpsname))) {
+        if (virAsprintf(&names[got], "%d", veid) < 0) {
             virReportOOMError();
-            goto out;
+            rc = -1;
+            break;
         }
-        got ++;
-    }
-
-    if (virCommandWait(cmd, NULL) < 0)
-        goto out;
-
-    if (VIR_CLOSE(outfd) < 0) {
-        virReportSystemError(errno, "%s", _("failed to close file"));
-        goto out;
+        got++;
     }
 
-    rc = got;
-out:
-    VIR_FORCE_CLOSE(outfd);
-    virCommandFree(cmd);
+    VIR_FREE(output);
     if (rc < 0) {
-        for (; got >= 0 ; got--)
-            VIR_FREE(names[got]);
+        for (; got > 0; got--)
+            VIR_FREE(names[got - 1]);
+        return -1;
     }
-    return rc;
+    return got;
 }
 
 static int openvzGetProcessInfo(unsigned long long *cpuTime, int vpsid)
@@ -1899,29 +1919,39 @@ cleanup:
 
 
 static int
-openvzGetVEStatus(virDomainObjPtr vm, int *status, int *reason)
+openvzGetVEStatus(struct openvz_driver *driver, virDomainObjPtr vm,
+                  int *status, int *reason)
 {
-    virCommandPtr cmd;
-    char *outbuf;
-    char *line;
+    char *output;
+    const char *cur;
+    int veid = strtoI(vm->def->name);
+    int id;
+    bool running = false;
     int state;
-    int ret = -1;
+    int rc;
 
-    cmd = virCommandNewArgList(VZLIST, vm->def->name, "-ostatus", "-H", NULL);
-    virCommandSetOutputBuffer(cmd, &outbuf);
-    if (virCommandRun(cmd, NULL) < 0)
-        goto cleanup;
+    if (!(output = openvzListAll(driver)))
+        return -1;
 
-    if ((line = strchr(outbuf, '\n')) == NULL) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Failed to parse vzlist output"));
-        goto cleanup;
+    cur = output;
+    while ((rc = openvzListNext(&cur, &id, &running)) > 0) {
+        if (id == veid)
+            break;
+    }
+    VIR_FREE(output);
+
+    if (rc < 0)
+        return -1;
+    if (rc == 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Container %s not found in vzlist output"),
+                       vm->def->name);
+        return -1;
     }
-    *line++ = '\0';
 
     state = virDomainObjGetState(vm, reason);
 
-    if (STREQ(outbuf, "running")) {
+    if (running) {
         /* There is no way to detect whether a domain is paused or not
          * with vzlist */
         if (state == VIR_DOMAIN_PAUSED)
@@ -1932,12 +1962,7 @@ openvzGetVEStatus(virDomainObjPtr vm, int *status, int *reason)
         *status = VIR_DOMAIN_SHUTOFF;
     }
 
-    ret = 0;
-
-cleanup:
-    virCommandFree(cmd);
-    VIR_FREE(outbuf);
-    return ret;
+    return 0;
 }
 
 static int
@@ -2105,16 +2130,19 @@ openvzListAllDomains(virConnectPtr conn,
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
 
     openvzDriverLock(driver);
-    ret = virDomainList(conn, driver->domains.objs, domains, flags);
+    ret = virDomainList(conn, &driver->domains, domains, flags);
     openvzDriverUnlock(driver);
 
     return ret;
 }
 
 
+static const char *openvzURISchemes[] = { "openvz", NULL };
+
 static virDriver openvzDriver = {
     .no = VIR_DRV_OPENVZ,
     .name = "OPENVZ",
+    .uriSchemes = openvzURISchemes,
     .open = openvzOpen, /* 0.3.1 */
     .close = openvzClose, /* 0.3.1 */
     .type = openvzGetType, /* 0.3.1 */
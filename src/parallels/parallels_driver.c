@@ -1109,7 +1109,7 @@ parallelsListAllDomains(virConnectPtr conn,
 
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
     parallelsDriverLock(privconn);
-    ret = virDomainList(conn, privconn->domains.objs, domains, flags);
+    ret = virDomainList(conn, &privconn->domains, domains, flags);
     parallelsDriverUnlock(privconn);
 
     return ret;
@@ -2386,9 +2386,12 @@ parallelsDomainDefineXML(virConnectPtr conn, const char *xml)
     return ret;
 }
 
+static const char *parallelsURISchemes[] = { "parallels", NULL };
+
 static virDriver parallelsDriver = {
     .no = VIR_DRV_PARALLELS,
     .name = "Parallels",
+    .uriSchemes = parallelsURISchemes,
     .open = parallelsOpen,            /* 0.10.0 */
     .close = parallelsClose,          /* 0.10.0 */
     .version = parallelsGetVersion,   /* 0.10.0 */
@@ -324,10 +324,10 @@ static int parallelsAddDiskVolume(virStoragePoolObjPtr pool,
     if (!(def->key = strdup(def->target.path)))
         goto no_memory;
 
-    if (VIR_REALLOC_N(pool->volumes.objs, pool->volumes.count + 1) < 0)
-        goto no_memory;
-
-    pool->volumes.objs[pool->volumes.count++] = def;
+    if (virStoragePoolObjAddVol(pool, def) < 0) {
+        virStorageVolDefFree(def);
+        return -1;
+    }
 
     return 0;
 no_memory:
@@ -1267,11 +1267,6 @@ parallelsStorageVolumeDefine(virStoragePoolObjPtr pool,
         }
     }
 
-    if (VIR_REALLOC_N(pool->volumes.objs, pool->volumes.count + 1) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
     if (virAsprintf(&privvol->target.path, "%s/%s",
                     pool->def->target.path, privvol->name) < 0) {
         virReportOOMError();
@@ -1294,14 +1289,17 @@ parallelsStorageVolumeDefine(virStoragePoolObjPtr pool,
                            _("Can't create file with volume description"));
             goto cleanup;
         }
+    }
 
+    if (virStoragePoolObjAddVol(pool, privvol) < 0)
+        goto cleanup;
+
+    if (is_new) {
         pool->def->allocation += privvol->allocation;
         pool->def->available = (pool->def->capacity -
                                 pool->def->allocation);
     }
 
-    pool->volumes.objs[pool->volumes.count++] = privvol;
-
     ret = privvol;
     privvol = NULL;
 
@@ -1407,12 +1405,6 @@ parallelsStorageVolumeCreateXMLFrom(virStoragePoolPtr pool,
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    if (VIR_REALLOC_N(privpool->volumes.objs,
-                      privpool->volumes.count + 1) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
     if (virAsprintf(&privvol->target.path, "%s/%s",
                     privpool->def->target.path, privvol->name) == -1) {
         virReportOOMError();
@@ -1425,12 +1417,13 @@ parallelsStorageVolumeCreateXMLFrom(virStoragePoolPtr pool,
         goto cleanup;
     }
 
+    if (virStoragePoolObjAddVol(privpool, privvol) < 0)
+        goto cleanup;
+
     privpool->def->allocation += privvol->allocation;
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    privpool->volumes.objs[privpool->volumes.count++] = privvol;
-
     ret = virGetStorageVol(pool->conn, privpool->def->name,
                            privvol->name, privvol->key,
                            NULL, NULL);
@@ -1466,20 +1459,9 @@ int parallelsStorageVolumeDefRemove(virStoragePoolObjPtr privpool,
                 goto cleanup;
             }
 
+            virStoragePoolObjRemoveVol(privpool, privvol);
             virStorageVolDefFree(privvol);
 
-            if (i < (privpool->volumes.count - 1))
-                memmove(privpool->volumes.objs + i,
-                        privpool->volumes.objs + i + 1,
-                        sizeof(*(privpool->volumes.objs)) *
-                        (privpool->volumes.count - (i + 1)));
-
-            if (VIR_REALLOC_N(privpool->volumes.objs,
-                              privpool->volumes.count - 1) < 0) {
-                ;   /* Failure to reduce memory allocation isn't fatal */
-            }
-            privpool->volumes.count--;
-
             break;
         }
     }
@@ -58,6 +58,7 @@
 #include "nodeinfo.h"
 #include "virfile.h"
 #include "interface_conf.h"
+#include "viroutputcache.h"
 
 #include "phyp_driver.h"
 
@@ -114,6 +115,7 @@ phypExec(LIBSSH2_SESSION *session, const char *cmd, int *exit_status,
 {
     LIBSSH2_CHANNEL *channel;
     ConnectionData *connection_data = conn->networkPrivateData;
+    phyp_driverPtr phyp_driver = conn->privateData;
     virBuffer tex_ret = VIR_BUFFER_INITIALIZER;
     char *buffer = NULL;
     size_t buffer_size = 16384;
@@ -182,6 +184,12 @@ phypExec(LIBSSH2_SESSION *session, const char *cmd, int *exit_status,
     channel = NULL;
     VIR_FREE(buffer);
 
+    /* Whether they succeeded or not, these may have changed LPARs */
+    if (phyp_driver && phyp_driver->lpar_cache &&
+        (STRPREFIX(cmd, "chsysstate") || STRPREFIX(cmd, "mksyscfg") ||
+         STRPREFIX(cmd, "rmsyscfg") || STRPREFIX(cmd, "chsyscfg")))
+        virOutputCacheInvalidate(phyp_driver->lpar_cache);
+
     if (virBufferError(&tex_ret)) {
         virBufferFreeAndReset(&tex_ret);
         virReportOOMError();
@@ -246,6 +254,86 @@ phypExecInt(LIBSSH2_SESSION *session, virBufferPtr buf, virConnectPtr conn,
     return ret;
 }
 
+/* Run the LPAR listing that phypListLpars caches */
+static char *
+phypListLparsFill(const char *cmd, void *opaque)
+{
+    virConnectPtr conn = opaque;
+    ConnectionData *connection_data = conn->networkPrivateData;
+    int exit_status = 0;
+    char *ret;
+
+    ret = phypExec(connection_data->session, cmd, &exit_status, conn);
+    if (ret == NULL || exit_status != 0) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("Unable to list LPARs: '%s'"), NULLSTR(ret));
+        VIR_FREE(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+/* Get the id and state of all LPARs as "id,state" lines. The output
+ * is reused for PHYP_LPAR_CACHE_TTL milliseconds, or until a command
+ * that changes LPARs is run, so listing domains and looking up their
+ * states doesn't cost a round trip each time. */
+static char *
+phypListLpars(virConnectPtr conn)
+{
+    phyp_driverPtr phyp_driver = conn->privateData;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *cmd;
+    char *ret;
+
+    virBufferAddLit(&buf, "lssyscfg -r lpar");
+    if (phyp_driver->system_type == HMC)
+        virBufferAsprintf(&buf, " -m %s", phyp_driver->managed_system);
+    virBufferAddLit(&buf, " -F lpar_id,state");
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        virReportOOMError();
+        return NULL;
+    }
+    cmd = virBufferContentAndReset(&buf);
+
+    ret = virOutputCacheGet(phyp_driver->lpar_cache, cmd,
+                            phypListLparsFill, conn);
+    VIR_FREE(cmd);
+    return ret;
+}
+
+/* Split the next line off phypListLpars output, which is modified.
+ * Returns 1 if an LPAR was found, 0 at the end and -1 on error. */
+static int
+phypListLparsNext(char **cur, int *id, const char **state)
+{
+    char *line;
+    char *next_line;
+
+    while (**cur == '\n')
+        (*cur)++;
+    if (**cur == '\0')
+        return 0;
+
+    line = *cur;
+    if ((next_line = strchr(line, '\n'))) {
+        *next_line = '\0';
+        *cur = next_line + 1;
+    } else {
+        *cur = line + strlen(line);
+    }
+
+    if (virStrToLong_i(line, &next_line, 10, id) < 0 ||
+        *next_line != ',') {
+        VIR_ERROR(_("Cannot parse number from '%s'"), line);
+        return -1;
+    }
+    *state = next_line + 1;
+    return 1;
+}
+
 static int
 phypGetSystemType(virConnectPtr conn)
 {
@@ -348,33 +436,38 @@ no_memory:
 static int
 phypNumDomainsGeneric(virConnectPtr conn, unsigned int type)
 {
-    ConnectionData *connection_data = conn->networkPrivateData;
     phyp_driverPtr phyp_driver = conn->privateData;
-    LIBSSH2_SESSION *session = connection_data->session;
     int system_type = phyp_driver->system_type;
-    int ndom = -1;
-    char *managed_system = phyp_driver->managed_system;
+    int ndom = 0;
+    int id;
+    int rc;
+    char *ret;
+    char *cur;
     const char *state;
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    const char *match;
 
     if (type == 0)
-        state = "|grep Running";
+        match = "Running";
     else if (type == 1) {
         if (system_type == HMC) {
-            state = "|grep \"Not Activated\"";
+            match = "Not Activated";
         } else {
-            state = "|grep \"Open Firmware\"";
+            match = "Open Firmware";
         }
     } else
-        state = " ";
+        match = NULL;
 
-    virBufferAddLit(&buf, "lssyscfg -r lpar");
-    if (system_type == HMC)
-        virBufferAsprintf(&buf, " -m %s", managed_system);
-    virBufferAsprintf(&buf, " -F lpar_id,state %s |grep -c '^[0-9][0-9]*'",
-                      state);
-    phypExecInt(session, &buf, conn, &ndom);
-    return ndom;
+    if ((ret = phypListLpars(conn)) == NULL)
+        return -1;
+
+    cur = ret;
+    while ((rc = phypListLparsNext(&cur, &id, &state)) > 0) {
+        if (match == NULL || strstr(state, match))
+            ndom++;
+    }
+
+    VIR_FREE(ret);
+    return rc < 0 ? -1 : ndom;
 }
 
 /* This is a generic function that won't be used directly by
@@ -388,51 +481,25 @@ static int
 phypListDomainsGeneric(virConnectPtr conn, int *ids, int nids,
                        unsigned int type)
 {
-    ConnectionData *connection_data = conn->networkPrivateData;
-    phyp_driverPtr phyp_driver = conn->privateData;
-    LIBSSH2_SESSION *session = connection_data->session;
-    int system_type = phyp_driver->system_type;
-    char *managed_system = phyp_driver->managed_system;
-    int exit_status = 0;
-    int got = -1;
-    char *ret = NULL;
-    char *line, *next_line;
+    int got = 0;
+    int id;
+    int rc = 0;
+    char *ret;
+    char *cur;
     const char *state;
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
-
-    if (type == 0)
-        state = "|grep Running";
-    else
-        state = " ";
-
-    virBufferAddLit(&buf, "lssyscfg -r lpar");
-    if (system_type == HMC)
-        virBufferAsprintf(&buf, " -m %s", managed_system);
-    virBufferAsprintf(&buf, " -F lpar_id,state %s | sed -e 's/,.*$//'",
-                      state);
-    ret = phypExecBuffer(session, &buf, &exit_status, conn, false);
 
-    if (exit_status < 0 || ret == NULL)
-        goto cleanup;
+    if ((ret = phypListLpars(conn)) == NULL)
+        return -1;
 
-    /* I need to parse the textual return in order to get the ids */
-    line = ret;
-    got = 0;
-    while (*line && got < nids) {
-        if (virStrToLong_i(line, &next_line, 10, &ids[got]) == -1) {
-            VIR_ERROR(_("Cannot parse number from '%s'"), line);
-            got = -1;
-            goto cleanup;
-        }
-        got++;
-        line = next_line;
-        while (*line == '\n')
-            line++; /* skip \n */
+    cur = ret;
+    while (got < nids && (rc = phypListLparsNext(&cur, &id, &state)) > 0) {
+        if (type == 0 && !strstr(state, "Running"))
+            continue;
+        ids[got++] = id;
     }
 
-cleanup:
     VIR_FREE(ret);
-    return got;
+    return rc < 0 ? -1 : got;
 }
 
 static int
@@ -1213,6 +1280,9 @@ phypOpen(virConnectPtr conn,
         phyp_driver->managed_system = managed_system;
 
     phyp_driver->uuid_table = uuid_table;
+    if ((phyp_driver->lpar_cache = virOutputCacheNew(PHYP_LPAR_CACHE_TTL)) == NULL)
+        goto failure;
+
     if ((phyp_driver->caps = phypCapsInit()) == NULL) {
         virReportOOMError();
         goto failure;
@@ -1237,6 +1307,7 @@ phypOpen(virConnectPtr conn,
 failure:
     if (phyp_driver != NULL) {
         virCapabilitiesFree(phyp_driver->caps);
+        virOutputCacheFree(phyp_driver->lpar_cache);
         VIR_FREE(phyp_driver->managed_system);
         VIR_FREE(phyp_driver);
     }
@@ -1264,6 +1335,7 @@ phypClose(virConnectPtr conn)
     libssh2_session_free(session);
 
     virCapabilitiesFree(phyp_driver->caps);
+    virOutputCacheFree(phyp_driver->lpar_cache);
     phypUUIDTable_Free(phyp_driver->uuid_table);
     VIR_FREE(phyp_driver->managed_system);
     VIR_FREE(phyp_driver);
@@ -3128,33 +3200,29 @@ phypNumOfInterfaces(virConnectPtr conn)
 static int
 phypGetLparState(virConnectPtr conn, unsigned int lpar_id)
 {
-    ConnectionData *connection_data = conn->networkPrivateData;
-    phyp_driverPtr phyp_driver = conn->privateData;
-    LIBSSH2_SESSION *session = connection_data->session;
-    int system_type = phyp_driver->system_type;
-    char *ret = NULL;
-    int exit_status = 0;
-    char *managed_system = phyp_driver->managed_system;
+    char *ret;
+    char *cur;
+    const char *lpar_state;
+    int id;
     int state = VIR_DOMAIN_NOSTATE;
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
 
-    virBufferAddLit(&buf, "lssyscfg -r lpar");
-    if (system_type == HMC)
-        virBufferAsprintf(&buf, " -m %s", managed_system);
-    virBufferAsprintf(&buf, " -F state --filter lpar_ids=%d", lpar_id);
-    ret = phypExecBuffer(session, &buf, &exit_status, conn, true);
+    if ((ret = phypListLpars(conn)) == NULL)
+        return state;
 
-    if (exit_status < 0 || ret == NULL)
-        goto cleanup;
+    cur = ret;
+    while (phypListLparsNext(&cur, &id, &lpar_state) > 0) {
+        if (id != lpar_id)
+            continue;
 
-    if (STREQ(ret, "Running"))
-        state = VIR_DOMAIN_RUNNING;
-    else if (STREQ(ret, "Not Activated"))
-        state = VIR_DOMAIN_SHUTOFF;
-    else if (STREQ(ret, "Shutting Down"))
-        state = VIR_DOMAIN_SHUTDOWN;
+        if (STREQ(lpar_state, "Running"))
+            state = VIR_DOMAIN_RUNNING;
+        else if (STREQ(lpar_state, "Not Activated"))
+            state = VIR_DOMAIN_SHUTOFF;
+        else if (STREQ(lpar_state, "Shutting Down"))
+            state = VIR_DOMAIN_SHUTDOWN;
+        break;
+    }
 
-cleanup:
     VIR_FREE(ret);
     return state;
 }
@@ -3778,9 +3846,12 @@ phypVIOSDriverClose(virConnectPtr conn ATTRIBUTE_UNUSED)
     return 0;
 }
 
+static const char *phypURISchemes[] = { "phyp", NULL };
+
 static virDriver phypDriver = {
     .no = VIR_DRV_PHYP,
     .name = "PHYP",
+    .uriSchemes = phypURISchemes,
     .open = phypOpen, /* 0.7.0 */
     .close = phypClose, /* 0.7.0 */
     .getCapabilities = phypConnectGetCapabilities, /* 0.7.3 */
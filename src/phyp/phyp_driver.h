@@ -27,6 +27,7 @@
 
 # include "conf/capabilities.h"
 # include "conf/domain_conf.h"
+# include "viroutputcache.h"
 # include <config.h>
 # include <libssh2.h>
 
@@ -34,6 +35,8 @@
 # define SSH_CONN_ERR -2         /* error while trying to connect to remote host */
 # define SSH_CMD_ERR -3          /* error while trying to execute the remote cmd */
 
+# define PHYP_LPAR_CACHE_TTL 2000 /* milliseconds the LPAR listing is reused */
+
 typedef struct _ConnectionData ConnectionData;
 typedef ConnectionData *ConnectionDataPtr;
 struct _ConnectionData {
@@ -76,6 +79,7 @@ struct _phyp_driver {
      * */
     int system_type;
     char *managed_system;
+    virOutputCachePtr lpar_cache;
 };
 
 int phypRegister(void);
@@ -42,6 +42,7 @@
 #include "virprocess.h"
 #include "virtime.h"
 #include "virobject.h"
+#include "vireventthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
@@ -80,6 +81,26 @@ struct _qemuAgentMessage {
     bool finished;
 };
 
+typedef struct _qemuAgentAsyncCommand qemuAgentAsyncCommand;
+typedef qemuAgentAsyncCommand *qemuAgentAsyncCommandPtr;
+
+/* A command sent with qemuAgentCommandAsync.  Like qemuAgentCommand
+ * it is preceded by a guest-sync, both being driven from the I/O
+ * callback rather than by a thread waiting for the replies */
+struct _qemuAgentAsyncCommand {
+    qemuAgentMessage msg;
+    virJSONValuePtr cmd;
+    unsigned long long syncID;
+    bool synced;
+    int timer;
+
+    /* Set if the command failed before a reply was received */
+    virError error;
+
+    qemuAgentAsyncCallback cb;
+    void *opaque;
+};
+
 
 struct _qemuAgent {
     virObject object;
@@ -89,6 +110,9 @@ struct _qemuAgent {
 
     int fd;
     int watch;
+    /* Dedicated thread servicing the fd, or NULL for the main event
+     * loop.  Owned by the driver, which outlives the agent */
+    virEventThreadPtr evt;
 
     bool connectPending;
 
@@ -100,6 +124,10 @@ struct _qemuAgent {
      * non-NULL */
     qemuAgentMessagePtr msg;
 
+    /* If the command being processed was sent asynchronously, this
+     * owns it and msg points into it */
+    qemuAgentAsyncCommandPtr async;
+
     /* Buffer incoming data ready for Agent monitor
      * code to process & find message boundaries */
     size_t bufferOffset;
@@ -119,6 +147,12 @@ struct _qemuAgent {
 static virClassPtr qemuAgentClass;
 static void qemuAgentDispose(void *obj);
 
+static int qemuAgentAsyncStep(qemuAgentPtr mon);
+static qemuAgentAsyncCommandPtr qemuAgentAsyncDetach(qemuAgentPtr mon);
+static qemuAgentAsyncCommandPtr qemuAgentAsyncFail(qemuAgentPtr mon);
+static void qemuAgentAsyncComplete(qemuAgentPtr mon,
+                                   qemuAgentAsyncCommandPtr async);
+
 static int qemuAgentOnceInit(void)
 {
     if (!(qemuAgentClass = virClassNew("qemuAgent",
@@ -579,7 +613,10 @@ static void qemuAgentUpdateWatch(qemuAgentPtr mon)
             events |= VIR_EVENT_HANDLE_WRITABLE;
     }
 
-    virEventUpdateHandle(mon->watch, events);
+    if (mon->evt)
+        virEventThreadUpdateHandle(mon->evt, mon->watch, events);
+    else
+        virEventUpdateHandle(mon->watch, events);
 }
 
 
@@ -588,6 +625,7 @@ qemuAgentIO(int watch, int fd, int events, void *opaque) {
     qemuAgentPtr mon = opaque;
     bool error = false;
     bool eof = false;
+    qemuAgentAsyncCommandPtr async = NULL;
 
     virObjectRef(mon);
     /* lock access to the monitor and protect fd */
@@ -660,6 +698,17 @@ qemuAgentIO(int watch, int fd, int events, void *opaque) {
         }
     }
 
+    /* A bad reply to an asynchronous command only fails that command */
+    if (!error && !eof && mon->async && mon->async->msg.finished) {
+        int rc = qemuAgentAsyncStep(mon);
+        if (rc < 0) {
+            async = qemuAgentAsyncFail(mon);
+            virResetLastError();
+        } else if (rc > 0) {
+            async = qemuAgentAsyncDetach(mon);
+        }
+    }
+
     if (error || eof) {
         if (mon->lastError.code != VIR_ERR_OK) {
             /* Already have an error, so clear any new error */
@@ -676,7 +725,11 @@ qemuAgentIO(int watch, int fd, int events, void *opaque) {
         VIR_DEBUG("Error on monitor %s", NULLSTR(mon->lastError.message));
         /* If IO process resulted in an error & we have a message,
          * then wakeup that waiter */
-        if (mon->msg && !mon->msg->finished) {
+        if (mon->async) {
+            virSetError(&mon->lastError);
+            async = qemuAgentAsyncFail(mon);
+            virResetLastError();
+        } else if (mon->msg && !mon->msg->finished) {
             mon->msg->finished = 1;
             virCondSignal(&mon->notify);
         }
@@ -713,15 +766,21 @@ qemuAgentIO(int watch, int fd, int events, void *opaque) {
         qemuAgentUnlock(mon);
         virObjectUnref(mon);
     }
+
+    /* The command holds its own reference on the agent */
+    if (async)
+        qemuAgentAsyncComplete(mon, async);
 }
 
 
 qemuAgentPtr
 qemuAgentOpen(virDomainObjPtr vm,
               virDomainChrSourceDefPtr config,
+              virEventThreadPtr evt,
               qemuAgentCallbacksPtr cb)
 {
     qemuAgentPtr mon;
+    int events;
 
     if (!cb || !cb->eofNotify) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -750,6 +809,7 @@ qemuAgentOpen(virDomainObjPtr vm,
     }
     mon->fd = -1;
     mon->vm = vm;
+    mon->evt = evt;
     mon->cb = cb;
     qemuAgentLock(mon);
 
@@ -773,16 +833,20 @@ qemuAgentOpen(virDomainObjPtr vm,
     if (mon->fd == -1)
         goto cleanup;
 
-    if ((mon->watch = virEventAddHandle(mon->fd,
-                                        VIR_EVENT_HANDLE_HANGUP |
-                                        VIR_EVENT_HANDLE_ERROR |
-                                        VIR_EVENT_HANDLE_READABLE |
-                                        (mon->connectPending ?
-                                         VIR_EVENT_HANDLE_WRITABLE :
-                                         0),
-                                        qemuAgentIO,
-                                        mon,
-                                        virObjectFreeCallback)) < 0) {
+    events = VIR_EVENT_HANDLE_HANGUP |
+        VIR_EVENT_HANDLE_ERROR |
+        VIR_EVENT_HANDLE_READABLE |
+        (mon->connectPending ? VIR_EVENT_HANDLE_WRITABLE : 0);
+    if (evt)
+        mon->watch = virEventThreadAddHandle(evt, mon->fd, events,
+                                             qemuAgentIO, mon,
+                                             virObjectFreeCallback);
+    else
+        mon->watch = virEventAddHandle(mon->fd, events,
+                                       qemuAgentIO, mon,
+                                       virObjectFreeCallback);
+    if (mon->watch < 0) {
+        mon->watch = 0;
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("unable to register monitor events"));
         goto cleanup;
@@ -809,6 +873,9 @@ cleanup:
 
 void qemuAgentClose(qemuAgentPtr mon)
 {
+    qemuAgentAsyncCommandPtr async = NULL;
+    virErrorPtr orig_err = NULL;
+
     if (!mon)
         return;
 
@@ -817,19 +884,36 @@ void qemuAgentClose(qemuAgentPtr mon)
     qemuAgentLock(mon);
 
     if (mon->fd >= 0) {
-        if (mon->watch)
-            virEventRemoveHandle(mon->watch);
+        if (mon->watch) {
+            if (mon->evt)
+                virEventThreadRemoveHandle(mon->evt, mon->watch);
+            else
+                virEventRemoveHandle(mon->watch);
+        }
         VIR_FORCE_CLOSE(mon->fd);
     }
 
     /* If there is somebody waiting for a message
      * wake him up. No message will arrive anyway. */
-    if (mon->msg && !mon->msg->finished) {
+    if (mon->async) {
+        orig_err = virSaveLastError();
+        virReportError(VIR_ERR_AGENT_UNRESPONSIVE, "%s",
+                       _("Guest agent was closed"));
+        async = qemuAgentAsyncFail(mon);
+    } else if (mon->msg && !mon->msg->finished) {
         mon->msg->finished = 1;
         virCondSignal(&mon->notify);
     }
     qemuAgentUnlock(mon);
 
+    if (async) {
+        qemuAgentAsyncComplete(mon, async);
+        if (orig_err) {
+            virSetError(orig_err);
+            virFreeError(orig_err);
+        }
+    }
+
     virObjectUnref(mon);
 }
 
@@ -878,6 +962,28 @@ static int qemuAgentSend(qemuAgentPtr mon,
         then = now + seconds * 1000ull;
     }
 
+    /* Commands are sent one at a time, so let any asynchronous
+     * command finish first */
+    while (mon->async) {
+        if ((then && virCondWaitUntil(&mon->notify, &mon->lock, then) < 0) ||
+            (!then && virCondWait(&mon->notify, &mon->lock) < 0)) {
+            if (errno == ETIMEDOUT) {
+                virReportError(VIR_ERR_AGENT_UNRESPONSIVE, "%s",
+                               _("Guest agent not available for now"));
+                return -2;
+            }
+            virReportSystemError(errno, "%s",
+                                 _("Unable to wait on agent monitor "
+                                   "condition"));
+            return -1;
+        }
+    }
+
+    if (mon->lastError.code != VIR_ERR_OK) {
+        virSetError(&mon->lastError);
+        return -1;
+    }
+
     mon->msg = msg;
     qemuAgentUpdateWatch(mon);
 
@@ -1259,6 +1365,244 @@ error:
     return NULL;
 }
 
+
+/*
+ * Moves an asynchronous command on once its current message got a
+ * reply: the reply to guest-sync is checked and the command itself
+ * is queued for sending.
+ *
+ * Returns 1 if the command is complete, 0 if it is waiting for
+ * another reply, -1 if it failed
+ */
+static int
+qemuAgentAsyncStep(qemuAgentPtr mon)
+{
+    qemuAgentAsyncCommandPtr async = mon->async;
+    unsigned long long id;
+    char *cmdstr = NULL;
+
+    if (async->synced)
+        return 1;
+
+    if (!async->msg.rxObject ||
+        virJSONValueObjectGetNumberUlong(async->msg.rxObject,
+                                         "return", &id) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Malformed return value"));
+        return -1;
+    }
+    if (id != async->syncID) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Guest agent returned ID: %llu instead of %llu"),
+                       id, async->syncID);
+        return -1;
+    }
+
+    virJSONValueFree(async->msg.rxObject);
+    async->msg.rxObject = NULL;
+    VIR_FREE(async->msg.txBuffer);
+
+    if (!(cmdstr = virJSONValueToString(async->cmd, false)) ||
+        virAsprintf(&async->msg.txBuffer, "%s" LINE_ENDING, cmdstr) < 0) {
+        VIR_FREE(cmdstr);
+        virReportOOMError();
+        return -1;
+    }
+    VIR_DEBUG("Send async command '%s' for write", cmdstr);
+    VIR_FREE(cmdstr);
+
+    async->msg.txOffset = 0;
+    async->msg.txLength = strlen(async->msg.txBuffer);
+    async->msg.finished = false;
+    async->synced = true;
+    return 0;
+}
+
+
+/* Takes the asynchronous command off the agent, which must be locked */
+static qemuAgentAsyncCommandPtr
+qemuAgentAsyncDetach(qemuAgentPtr mon)
+{
+    qemuAgentAsyncCommandPtr async = mon->async;
+
+    if (!async)
+        return NULL;
+
+    mon->async = NULL;
+    if (mon->msg == &async->msg)
+        mon->msg = NULL;
+
+    /* Synchronous commands wait for their turn */
+    virCondBroadcast(&mon->notify);
+    return async;
+}
+
+
+/*
+ * As qemuAgentAsyncDetach, but the command fails with the error last
+ * reported in the calling thread
+ */
+static qemuAgentAsyncCommandPtr
+qemuAgentAsyncFail(qemuAgentPtr mon)
+{
+    qemuAgentAsyncCommandPtr async = qemuAgentAsyncDetach(mon);
+
+    if (async && async->error.code == VIR_ERR_OK)
+        virCopyLastError(&async->error);
+    return async;
+}
+
+
+/*
+ * Runs the callback of a detached asynchronous command and frees it.
+ * Must be called without the agent locked.
+ */
+static void
+qemuAgentAsyncComplete(qemuAgentPtr mon,
+                       qemuAgentAsyncCommandPtr async)
+{
+    int ret = -1;
+
+    if (async->timer > 0)
+        virEventRemoveTimeout(async->timer);
+
+    if (async->error.code != VIR_ERR_OK) {
+        virSetError(&async->error);
+    } else if (!async->msg.rxObject) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing monitor reply object"));
+    } else if (qemuAgentCheckError(async->cmd, async->msg.rxObject) == 0 &&
+               virJSONValueObjectGetNumberInt(async->msg.rxObject,
+                                              "return", &ret) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed return value"));
+        ret = -1;
+    }
+
+    VIR_DEBUG("Async command %s on mon %p completed ret=%d",
+              qemuAgentCommandName(async->cmd), mon, ret);
+    (async->cb)(mon, ret, async->opaque);
+    virResetLastError();
+
+    virJSONValueFree(async->cmd);
+    virJSONValueFree(async->msg.rxObject);
+    VIR_FREE(async->msg.txBuffer);
+    virResetError(&async->error);
+    VIR_FREE(async);
+    virObjectUnref(mon);
+}
+
+
+static void
+qemuAgentAsyncTimeout(int timer, void *opaque)
+{
+    qemuAgentPtr mon = opaque;
+    qemuAgentAsyncCommandPtr async = NULL;
+
+    qemuAgentLock(mon);
+    if (mon->async && mon->async->timer == timer) {
+        virReportError(VIR_ERR_AGENT_UNRESPONSIVE, "%s",
+                       _("Guest agent not available for now"));
+        async = qemuAgentAsyncFail(mon);
+        virResetLastError();
+        qemuAgentUpdateWatch(mon);
+    }
+    qemuAgentUnlock(mon);
+
+    if (async)
+        qemuAgentAsyncComplete(mon, async);
+}
+
+
+/*
+ * qemuAgentCommandAsync:
+ * @mon: Agent, locked
+ * @cmd: the command, which is freed once complete
+ * @deadline: time in milliseconds since the Epoch by which the
+ *            command must have completed
+ * @cb: callback for the integer returned by @cmd
+ * @opaque: data for @cb
+ *
+ * Sends @cmd like qemuAgentCommand, but returns straight away.
+ * @cb is invoked from the event loop once the reply arrives, the
+ * agent fails or @deadline passes.  Synchronous commands sent
+ * meanwhile wait for it to complete.
+ *
+ * Returns 0 if @cb will be invoked, -1 on error
+ */
+static int
+qemuAgentCommandAsync(qemuAgentPtr mon,
+                      virJSONValuePtr cmd,
+                      unsigned long long deadline,
+                      qemuAgentAsyncCallback cb,
+                      void *opaque)
+{
+    qemuAgentAsyncCommandPtr async = NULL;
+    unsigned long long now;
+
+    if (mon->lastError.code != VIR_ERR_OK) {
+        VIR_DEBUG("Attempt to send command while error is set %s",
+                  NULLSTR(mon->lastError.message));
+        virSetError(&mon->lastError);
+        goto error;
+    }
+
+    if (mon->msg || mon->async) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Guest agent is busy with another command"));
+        goto error;
+    }
+
+    if (virTimeMillisNow(&now) < 0)
+        goto error;
+
+    if (VIR_ALLOC(async) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+
+    async->syncID = now;
+    if (virAsprintf(&async->msg.txBuffer,
+                    "{\"execute\":\"guest-sync\", "
+                    "\"arguments\":{\"id\":%llu}}", now) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+    async->msg.txLength = strlen(async->msg.txBuffer);
+
+    virObjectRef(mon);
+    if ((async->timer = virEventAddTimeout(deadline > now ? deadline - now : 0,
+                                           qemuAgentAsyncTimeout, mon,
+                                           virObjectFreeCallback)) < 0) {
+        virObjectUnref(mon);
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("unable to register agent command timeout"));
+        goto error;
+    }
+
+    VIR_DEBUG("Sending guest-sync command with ID: %llu for async command %s",
+              now, qemuAgentCommandName(cmd));
+
+    async->cmd = cmd;
+    async->cb = cb;
+    async->opaque = opaque;
+
+    virObjectRef(mon);
+    mon->async = async;
+    mon->msg = &async->msg;
+    qemuAgentUpdateWatch(mon);
+
+    return 0;
+
+error:
+    if (async)
+        VIR_FREE(async->msg.txBuffer);
+    VIR_FREE(async);
+    virJSONValueFree(cmd);
+    return -1;
+}
+
+
 void qemuAgentNotifyEvent(qemuAgentPtr mon,
                           qemuAgentEvent event)
 {
@@ -1387,6 +1731,56 @@ cleanup:
     return ret;
 }
 
+/*
+ * qemuAgentFSFreezeAsync:
+ * @mon: Agent
+ * @deadline: time in milliseconds since the Epoch by which the
+ *            file systems must be frozen
+ * @cb: callback for the result of qemuAgentFSFreeze
+ * @opaque: data for @cb
+ *
+ * Asynchronous variant of qemuAgentFSFreeze, see qemuAgentCommandAsync.
+ *
+ * Returns 0 if @cb will be invoked, -1 on error
+ */
+int qemuAgentFSFreezeAsync(qemuAgentPtr mon,
+                           unsigned long long deadline,
+                           qemuAgentAsyncCallback cb,
+                           void *opaque)
+{
+    virJSONValuePtr cmd;
+
+    if (!(cmd = qemuAgentMakeCommand("guest-fsfreeze-freeze", NULL)))
+        return -1;
+
+    return qemuAgentCommandAsync(mon, cmd, deadline, cb, opaque);
+}
+
+/*
+ * qemuAgentFSThawAsync:
+ * @mon: Agent
+ * @deadline: time in milliseconds since the Epoch by which the
+ *            file systems must be thawed
+ * @cb: callback for the result of qemuAgentFSThaw
+ * @opaque: data for @cb
+ *
+ * Asynchronous variant of qemuAgentFSThaw, see qemuAgentCommandAsync.
+ *
+ * Returns 0 if @cb will be invoked, -1 on error
+ */
+int qemuAgentFSThawAsync(qemuAgentPtr mon,
+                         unsigned long long deadline,
+                         qemuAgentAsyncCallback cb,
+                         void *opaque)
+{
+    virJSONValuePtr cmd;
+
+    if (!(cmd = qemuAgentMakeCommand("guest-fsfreeze-thaw", NULL)))
+        return -1;
+
+    return qemuAgentCommandAsync(mon, cmd, deadline, cb, opaque);
+}
+
 VIR_ENUM_DECL(qemuAgentSuspendMode);
 
 VIR_ENUM_IMPL(qemuAgentSuspendMode,
@@ -27,6 +27,7 @@
 
 # include "internal.h"
 # include "domain_conf.h"
+# include "vireventthread.h"
 
 typedef struct _qemuAgent qemuAgent;
 typedef qemuAgent *qemuAgentPtr;
@@ -45,6 +46,7 @@ struct _qemuAgentCallbacks {
 
 qemuAgentPtr qemuAgentOpen(virDomainObjPtr vm,
                            virDomainChrSourceDefPtr config,
+                           virEventThreadPtr evt,
                            qemuAgentCallbacksPtr cb);
 
 void qemuAgentLock(qemuAgentPtr mon);
@@ -76,6 +78,20 @@ int qemuAgentShutdown(qemuAgentPtr mon,
 int qemuAgentFSFreeze(qemuAgentPtr mon);
 int qemuAgentFSThaw(qemuAgentPtr mon);
 
+/* @ret is the integer returned by the command, or -1 with the error set */
+typedef void (*qemuAgentAsyncCallback)(qemuAgentPtr mon,
+                                       int ret,
+                                       void *opaque);
+
+int qemuAgentFSFreezeAsync(qemuAgentPtr mon,
+                           unsigned long long deadline,
+                           qemuAgentAsyncCallback cb,
+                           void *opaque);
+int qemuAgentFSThawAsync(qemuAgentPtr mon,
+                         unsigned long long deadline,
+                         qemuAgentAsyncCallback cb,
+                         void *opaque);
+
 int qemuAgentSuspend(qemuAgentPtr mon,
                      unsigned int target);
 
@@ -38,6 +38,9 @@
 #include "bitmap.h"
 #include "virnodesuspend.h"
 #include "qemu_monitor.h"
+#include "buf.h"
+#include "xml.h"
+#include "sha256.h"
 
 #include <sys/stat.h>
 #include <unistd.h>
@@ -199,6 +202,13 @@ VIR_ENUM_IMPL(qemuCaps, QEMU_CAPS_LAST,
               "cirrus-vga",
               "vmware-svga",
               "device-video-primary",
+              "nbd-server",
+
+              "migrate-xbzrle", /* 125 */
+              "iothread",
+              "virtio-blk-pci.x-data-plane",
+              "memory-backend-ram",
+              "memory-backend-file",
     );
 
 struct _qemuCaps {
@@ -228,6 +238,7 @@ struct _qemuCapsCache {
     virMutex lock;
     virHashTablePtr binaries;
     char *libDir;
+    char *cacheDir;
     char *runDir;
     uid_t runUid;
     gid_t runGid;
@@ -1347,6 +1358,9 @@ struct qemuCapsStringFlags qemuCapsObjectTypes[] = {
     { "VGA", QEMU_CAPS_DEVICE_VGA },
     { "cirrus-vga", QEMU_CAPS_DEVICE_CIRRUS_VGA },
     { "vmware-svga", QEMU_CAPS_DEVICE_VMWARE_SVGA },
+    { "iothread", QEMU_CAPS_OBJECT_IOTHREAD },
+    { "memory-backend-ram", QEMU_CAPS_OBJECT_MEMORY_RAM },
+    { "memory-backend-file", QEMU_CAPS_OBJECT_MEMORY_FILE },
 };
 
 
@@ -1357,6 +1371,7 @@ static struct qemuCapsStringFlags qemuCapsObjectPropsVirtioBlk[] = {
     { "event_idx", QEMU_CAPS_VIRTIO_BLK_EVENT_IDX },
     { "scsi", QEMU_CAPS_VIRTIO_BLK_SCSI },
     { "logical_block_size", QEMU_CAPS_BLOCKIO },
+    { "x-data-plane", QEMU_CAPS_VIRTIO_BLK_DATA_PLANE },
 };
 
 static struct qemuCapsStringFlags qemuCapsObjectPropsVirtioNet[] = {
@@ -1951,6 +1966,8 @@ qemuCapsProbeQMPCommands(qemuCapsPtr caps,
             qemuCapsSet(caps, QEMU_CAPS_DRIVE_MIRROR);
         else if (STREQ(name, "blockdev-snapshot-sync"))
             qemuCapsSet(caps, QEMU_CAPS_DISK_SNAPSHOT);
+        else if (STREQ(name, "nbd-server-start"))
+            qemuCapsSet(caps, QEMU_CAPS_NBD_SERVER);
         VIR_FREE(name);
     }
     VIR_FREE(commands);
@@ -2117,6 +2134,23 @@ qemuCapsProbeQMPKVMState(qemuCapsPtr caps,
 }
 
 
+static int
+qemuCapsProbeQMPMigrationCapabilities(qemuCapsPtr caps,
+                                      qemuMonitorPtr mon)
+{
+    int rc;
+
+    if ((rc = qemuMonitorGetMigrationCapability(mon,
+                        QEMU_MONITOR_MIGRATION_CAPS_XBZRLE)) < 0)
+        return -1;
+
+    if (rc > 0)
+        qemuCapsSet(caps, QEMU_CAPS_MIGRATE_XBZRLE);
+
+    return 0;
+}
+
+
 int qemuCapsProbeQMP(qemuCapsPtr caps,
                      qemuMonitorPtr mon)
 {
@@ -2350,7 +2384,7 @@ qemuCapsInitQMP(qemuCapsPtr caps,
         goto cleanup;
     }
 
-    if (!(mon = qemuMonitorOpen(NULL, &config, true, &callbacks))) {
+    if (!(mon = qemuMonitorOpen(NULL, &config, true, NULL, &callbacks))) {
         ret = 0;
         goto cleanup;
     }
@@ -2423,6 +2457,8 @@ qemuCapsInitQMP(qemuCapsPtr caps,
         goto cleanup;
     if (qemuCapsProbeQMPKVMState(caps, mon) < 0)
         goto cleanup;
+    if (qemuCapsProbeQMPMigrationCapabilities(caps, mon) < 0)
+        goto cleanup;
 
     ret = 0;
 
@@ -2522,6 +2558,322 @@ bool qemuCapsIsValid(qemuCapsPtr caps)
 }
 
 
+/*
+ * Probing a binary means running it several times, which adds up
+ * with a few emulators installed, so the results are also kept on
+ * disk in <cacheDir>/capabilities/<sha256 of binary path>.xml. A
+ * cache file is only used if it was written by this version of
+ * libvirt, for the binary as it is now, going by its path, size
+ * and modification time, and with /dev/kvm in the same state.
+ */
+static char *
+qemuCapsCacheFilePath(qemuCapsCachePtr cache, const char *binary)
+{
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    if (!sha256_buffer(binary, strlen(binary), digest)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to compute sha256 checksum"));
+        return NULL;
+    }
+
+    virBufferAsprintf(&buf, "%s/capabilities/", cache->cacheDir);
+    for (i = 0 ; i < SHA256_DIGEST_SIZE ; i++)
+        virBufferAsprintf(&buf, "%02x", digest[i]);
+    virBufferAddLit(&buf, ".xml");
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        virReportOOMError();
+        return NULL;
+    }
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+static int
+qemuCapsCacheWriteFile(int fd, void *opaque)
+{
+    const char *xml = opaque;
+
+    if (safewrite(fd, xml, strlen(xml)) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static char *
+qemuCapsFormatCache(qemuCapsPtr caps, off_t size)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    virBufferAddLit(&buf, "<qemuCaps>\n");
+    virBufferEscapeString(&buf, "  <binary path='%s'", caps->binary);
+    virBufferAsprintf(&buf, " mtime='%lld' size='%lld'/>\n",
+                      (long long)caps->mtime, (long long)size);
+    virBufferAsprintf(&buf, "  <libvirtVersion>%lu</libvirtVersion>\n",
+                      (unsigned long)LIBVIR_VERSION_NUMBER);
+    if (virFileExists("/dev/kvm"))
+        virBufferAddLit(&buf, "  <kvmDevice/>\n");
+    if (caps->usedQMP)
+        virBufferAddLit(&buf, "  <usedQMP/>\n");
+    virBufferAsprintf(&buf, "  <version>%u</version>\n", caps->version);
+    virBufferAsprintf(&buf, "  <kvmVersion>%u</kvmVersion>\n",
+                      caps->kvmVersion);
+    virBufferAsprintf(&buf, "  <arch>%s</arch>\n",
+                      qemuCapsArchToString(caps->arch));
+
+    for (i = 0 ; i < QEMU_CAPS_LAST ; i++) {
+        if (qemuCapsGet(caps, i))
+            virBufferAsprintf(&buf, "  <flag name='%s'/>\n",
+                              qemuCapsTypeToString(i));
+    }
+
+    for (i = 0 ; i < caps->ncpuDefinitions ; i++)
+        virBufferEscapeString(&buf, "  <cpu name='%s'/>\n",
+                              caps->cpuDefinitions[i]);
+
+    for (i = 0 ; i < caps->nmachineTypes ; i++) {
+        virBufferEscapeString(&buf, "  <machine name='%s'",
+                              caps->machineTypes[i]);
+        if (caps->machineAliases[i])
+            virBufferEscapeString(&buf, " alias='%s'",
+                                  caps->machineAliases[i]);
+        virBufferAddLit(&buf, "/>\n");
+    }
+
+    virBufferAddLit(&buf, "</qemuCaps>\n");
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        virReportOOMError();
+        return NULL;
+    }
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/*
+ * Store @caps in the on-disk cache. Failing to do so only costs
+ * a probe next time round, so nothing is reported to the caller.
+ */
+static void
+qemuCapsSaveCache(qemuCapsCachePtr cache, qemuCapsPtr caps)
+{
+    char *path = NULL;
+    char *dir = NULL;
+    char *xml = NULL;
+    struct stat sb;
+    bool saved = false;
+
+    if (!cache->cacheDir)
+        return;
+
+    if (stat(caps->binary, &sb) < 0 ||
+        sb.st_mtime != caps->mtime) {
+        VIR_DEBUG("Binary %s changed while probing it, not caching",
+                  caps->binary);
+        return;
+    }
+
+    if (virAsprintf(&dir, "%s/capabilities", cache->cacheDir) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (virFileMakePath(dir) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to create directory %s"), dir);
+        goto cleanup;
+    }
+
+    if (!(path = qemuCapsCacheFilePath(cache, caps->binary)) ||
+        !(xml = qemuCapsFormatCache(caps, sb.st_size)))
+        goto cleanup;
+
+    if (virFileRewrite(path, S_IRUSR | S_IWUSR,
+                       qemuCapsCacheWriteFile, xml) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Saved capabilities for %s in %s", caps->binary, path);
+    saved = true;
+
+cleanup:
+    if (!saved) {
+        VIR_WARN("Unable to cache capabilities for %s", caps->binary);
+        virResetLastError();
+    }
+    VIR_FREE(dir);
+    VIR_FREE(path);
+    VIR_FREE(xml);
+}
+
+
+static int
+qemuCapsParseCache(qemuCapsPtr caps,
+                   const char *binary,
+                   struct stat *sb,
+                   xmlXPathContextPtr ctxt)
+{
+    xmlNodePtr *nodes = NULL;
+    char *str = NULL;
+    long long ll;
+    unsigned long ul;
+    int n;
+    size_t i;
+    int ret = -1;
+
+    if (!(str = virXPathString("string(./binary/@path)", ctxt)) ||
+        STRNEQ(str, binary) ||
+        virXPathLongLong("string(./binary/@mtime)", ctxt, &ll) < 0 ||
+        ll != sb->st_mtime ||
+        virXPathLongLong("string(./binary/@size)", ctxt, &ll) < 0 ||
+        ll != sb->st_size) {
+        VIR_DEBUG("Binary %s changed since it was cached", binary);
+        goto cleanup;
+    }
+    VIR_FREE(str);
+
+    if (virXPathULong("string(./libvirtVersion)", ctxt, &ul) < 0 ||
+        ul != LIBVIR_VERSION_NUMBER) {
+        VIR_DEBUG("Cached capabilities come from another libvirt version");
+        goto cleanup;
+    }
+
+    if (virXPathBoolean("boolean(./kvmDevice)", ctxt) !=
+        virFileExists("/dev/kvm")) {
+        VIR_DEBUG("/dev/kvm changed since capabilities were cached");
+        goto cleanup;
+    }
+
+    caps->usedQMP = virXPathBoolean("boolean(./usedQMP)", ctxt) > 0;
+
+    if (virXPathUInt("string(./version)", ctxt, &caps->version) < 0 ||
+        virXPathUInt("string(./kvmVersion)", ctxt, &caps->kvmVersion) < 0)
+        goto cleanup;
+
+    if (!(str = virXPathString("string(./arch)", ctxt)) ||
+        (caps->arch = qemuCapsArchFromString(str)) == VIR_ARCH_NONE)
+        goto cleanup;
+    VIR_FREE(str);
+
+    if ((n = virXPathNodeSet("./flag", ctxt, &nodes)) < 0)
+        goto cleanup;
+    for (i = 0 ; i < n ; i++) {
+        int flag;
+
+        if (!(str = virXMLPropString(nodes[i], "name")) ||
+            (flag = qemuCapsTypeFromString(str)) < 0)
+            goto cleanup;
+        VIR_FREE(str);
+        qemuCapsSet(caps, flag);
+    }
+    VIR_FREE(nodes);
+
+    if ((n = virXPathNodeSet("./cpu", ctxt, &nodes)) < 0)
+        goto cleanup;
+    if (n > 0) {
+        if (VIR_ALLOC_N(caps->cpuDefinitions, n) < 0)
+            goto no_memory;
+        caps->ncpuDefinitions = n;
+        for (i = 0 ; i < n ; i++) {
+            if (!(caps->cpuDefinitions[i] = virXMLPropString(nodes[i], "name")))
+                goto cleanup;
+        }
+    }
+    VIR_FREE(nodes);
+
+    if ((n = virXPathNodeSet("./machine", ctxt, &nodes)) < 0)
+        goto cleanup;
+    if (n > 0) {
+        if (VIR_ALLOC_N(caps->machineTypes, n) < 0 ||
+            VIR_ALLOC_N(caps->machineAliases, n) < 0)
+            goto no_memory;
+        caps->nmachineTypes = n;
+        for (i = 0 ; i < n ; i++) {
+            if (!(caps->machineTypes[i] = virXMLPropString(nodes[i], "name")))
+                goto cleanup;
+            caps->machineAliases[i] = virXMLPropString(nodes[i], "alias");
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(str);
+    VIR_FREE(nodes);
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    goto cleanup;
+}
+
+
+/*
+ * Load the capabilities of @binary from the on-disk cache, returning
+ * NULL if there is no usable cache file for it.
+ */
+static qemuCapsPtr
+qemuCapsLoadCache(qemuCapsCachePtr cache, const char *binary)
+{
+    char *path = NULL;
+    xmlDocPtr xml = NULL;
+    xmlXPathContextPtr ctxt = NULL;
+    qemuCapsPtr caps = NULL;
+    struct stat sb;
+
+    if (!cache->cacheDir)
+        return NULL;
+
+    /* Leave reporting any problem with the binary to the probe */
+    if (stat(binary, &sb) < 0)
+        return NULL;
+
+    if (!(path = qemuCapsCacheFilePath(cache, binary)))
+        goto error;
+
+    if (!virFileExists(path))
+        goto cleanup;
+
+    if (!(xml = virXMLParseFileCtxt(path, &ctxt)))
+        goto error;
+
+    if (!(caps = qemuCapsNew()))
+        goto error;
+
+    if (!(caps->binary = strdup(binary))) {
+        virReportOOMError();
+        goto error;
+    }
+    caps->mtime = sb.st_mtime;
+
+    if (qemuCapsParseCache(caps, binary, &sb, ctxt) < 0)
+        goto error;
+
+    VIR_DEBUG("Loaded capabilities for %s from %s", binary, path);
+
+cleanup:
+    VIR_FREE(path);
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(xml);
+    return caps;
+
+error:
+    VIR_DEBUG("Ignoring cached capabilities for %s", binary);
+    virResetLastError();
+    virObjectUnref(caps);
+    caps = NULL;
+    goto cleanup;
+}
+
+
 static void
 qemuCapsHashDataFree(void *payload, const void *key ATTRIBUTE_UNUSED)
 {
@@ -2530,8 +2882,8 @@ qemuCapsHashDataFree(void *payload, const void *key ATTRIBUTE_UNUSED)
 
 
 qemuCapsCachePtr
-qemuCapsCacheNew(const char *libDir, const char *runDir,
-                 uid_t runUid, gid_t runGid)
+qemuCapsCacheNew(const char *libDir, const char *cacheDir,
+                 const char *runDir, uid_t runUid, gid_t runGid)
 {
     qemuCapsCachePtr cache;
 
@@ -2550,7 +2902,8 @@ qemuCapsCacheNew(const char *libDir, const char *runDir,
     if (!(cache->binaries = virHashCreate(10, qemuCapsHashDataFree)))
         goto error;
     if (!(cache->libDir = strdup(libDir)) ||
-        !(cache->runDir = strdup(runDir))) {
+        !(cache->runDir = strdup(runDir)) ||
+        (cacheDir && !(cache->cacheDir = strdup(cacheDir)))) {
         virReportOOMError();
         goto error;
     }
@@ -2579,12 +2932,21 @@ qemuCapsCacheLookup(qemuCapsCachePtr cache, const char *binary)
         virHashRemoveEntry(cache->binaries, binary);
         ret = NULL;
     }
-    if (!ret) {
+    if (!ret &&
+        (ret = qemuCapsLoadCache(cache, binary))) {
+        VIR_DEBUG("Caching capabilities %p for %s from disk",
+                  ret, binary);
+        if (virHashAddEntry(cache->binaries, binary, ret) < 0) {
+            virObjectUnref(ret);
+            ret = NULL;
+        }
+    } else if (!ret) {
         VIR_DEBUG("Creating capabilities for %s",
                   binary);
         ret = qemuCapsNewForBinary(binary, cache->libDir, cache->runDir,
                                    cache->runUid, cache->runGid);
         if (ret) {
+            qemuCapsSaveCache(cache, ret);
             VIR_DEBUG("Caching capabilities %p for %s",
                       ret, binary);
             if (virHashAddEntry(cache->binaries, binary, ret) < 0) {
@@ -2622,6 +2984,7 @@ qemuCapsCacheFree(qemuCapsCachePtr cache)
         return;
 
     VIR_FREE(cache->libDir);
+    VIR_FREE(cache->cacheDir);
     VIR_FREE(cache->runDir);
     virHashFree(cache->binaries);
     virMutexDestroy(&cache->lock);
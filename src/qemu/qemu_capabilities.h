@@ -162,6 +162,12 @@ enum qemuCapsFlags {
     QEMU_CAPS_DEVICE_VMWARE_SVGA = 122, /* -device vmware-svga */
     QEMU_CAPS_DEVICE_VIDEO_PRIMARY = 123, /* safe to use -device XXX
                                            for primary video device */
+    QEMU_CAPS_NBD_SERVER         = 124, /* nbd-server-start QMP command */
+    QEMU_CAPS_MIGRATE_XBZRLE     = 125, /* XBZRLE migration capability */
+    QEMU_CAPS_OBJECT_IOTHREAD    = 126, /* -object iothread */
+    QEMU_CAPS_VIRTIO_BLK_DATA_PLANE = 127, /* virtio-blk-pci.x-data-plane */
+    QEMU_CAPS_OBJECT_MEMORY_RAM  = 128, /* -object memory-backend-ram */
+    QEMU_CAPS_OBJECT_MEMORY_FILE = 129, /* -object memory-backend-file */
 
     QEMU_CAPS_LAST,                   /* this must always be the last item */
 };
@@ -216,8 +222,8 @@ int qemuCapsGetMachineTypesCaps(qemuCapsPtr caps,
 bool qemuCapsIsValid(qemuCapsPtr caps);
 
 
-qemuCapsCachePtr qemuCapsCacheNew(const char *libDir, const char *runDir,
-                                  uid_t uid, gid_t gid);
+qemuCapsCachePtr qemuCapsCacheNew(const char *libDir, const char *cacheDir,
+                                  const char *runDir, uid_t uid, gid_t gid);
 qemuCapsPtr qemuCapsCacheLookup(qemuCapsCachePtr cache, const char *binary);
 qemuCapsPtr qemuCapsCacheLookupCopy(qemuCapsCachePtr cache, const char *binary);
 void qemuCapsCacheFree(qemuCapsCachePtr cache);
@@ -188,6 +188,35 @@ int qemuSetupHostUsbDeviceCgroup(usbDevice *dev ATTRIBUTE_UNUSED,
     return 0;
 }
 
+/*
+ * Program the throttle limits of @def for host block device @path into
+ * @cgroup, combining the per-device limits and the throttle groups the
+ * device is part of.  Limits that are not set are cleared.
+ */
+int qemuSetupBlkioDeviceThrottle(virCgroupPtr cgroup,
+                                 virDomainDefPtr def,
+                                 const char *path)
+{
+    unsigned int riops, wiops;
+    unsigned long long rbps, wbps;
+    int rc;
+
+    virBlkioDeviceGetThrottle(def, path, &riops, &wiops, &rbps, &wbps);
+
+    if ((rc = virCgroupSetBlkioDeviceReadIops(cgroup, path, riops)) < 0 ||
+        (rc = virCgroupSetBlkioDeviceWriteIops(cgroup, path, wiops)) < 0 ||
+        (rc = virCgroupSetBlkioDeviceReadBps(cgroup, path, rbps)) < 0 ||
+        (rc = virCgroupSetBlkioDeviceWriteBps(cgroup, path, wbps)) < 0) {
+        virReportSystemError(-rc,
+                             _("Unable to set io throttle for device %s "
+                               "of domain %s"),
+                             path, def->name);
+        return -1;
+    }
+
+    return 0;
+}
+
 int qemuSetupCgroup(virQEMUDriverPtr driver,
                     virDomainObjPtr vm,
                     virBitmapPtr nodemask)
@@ -316,20 +345,38 @@ int qemuSetupCgroup(virQEMUDriverPtr driver,
         }
     }
 
-    if (vm->def->blkio.ndevices) {
+    if (vm->def->blkio.ndevices || vm->def->blkio.ngroups) {
         if (qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_BLKIO)) {
             for (i = 0; i < vm->def->blkio.ndevices; i++) {
-                virBlkioDeviceWeightPtr dw = &vm->def->blkio.devices[i];
-                if (!dw->weight)
-                    continue;
-                rc = virCgroupSetBlkioDeviceWeight(cgroup, dw->path,
-                                                   dw->weight);
-                if (rc != 0) {
-                    virReportSystemError(-rc,
-                                         _("Unable to set io device weight "
-                                           "for domain %s"),
-                                         vm->def->name);
+                virBlkioDevicePtr dev = &vm->def->blkio.devices[i];
+
+                if (dev->weight) {
+                    rc = virCgroupSetBlkioDeviceWeight(cgroup, dev->path,
+                                                       dev->weight);
+                    if (rc != 0) {
+                        virReportSystemError(-rc,
+                                             _("Unable to set io device weight "
+                                               "for domain %s"),
+                                             vm->def->name);
+                        goto cleanup;
+                    }
+                }
+
+                /* only touch the throttle files when asked to, not every
+                 * host has throttling enabled */
+                if ((dev->riops || dev->wiops || dev->rbps || dev->wbps) &&
+                    qemuSetupBlkioDeviceThrottle(cgroup, vm->def,
+                                                 dev->path) < 0)
                     goto cleanup;
+            }
+            for (i = 0; i < vm->def->blkio.ngroups; i++) {
+                virBlkioThrottleGroupPtr group = &vm->def->blkio.groups[i];
+                int j;
+
+                for (j = 0; j < group->npaths; j++) {
+                    if (qemuSetupBlkioDeviceThrottle(cgroup, vm->def,
+                                                     group->paths[j]) < 0)
+                        goto cleanup;
                 }
             }
         } else {
@@ -490,6 +537,86 @@ cleanup:
     return -1;
 }
 
+/*
+ * Take @percent off the CPU time each vcpu of @vm may use per period,
+ * or give the vcpus back the quota of their definition if @percent is 0.
+ */
+int qemuCgroupThrottleVcpus(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm,
+                            unsigned int percent)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virCgroupPtr cgroup = NULL;
+    virCgroupPtr cgroup_vcpu = NULL;
+    unsigned long long period;
+    long long quota;
+    int rc;
+    int i;
+    int ret = -1;
+
+    if (!qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_CPU)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("cgroup CPU controller is not mounted"));
+        return -1;
+    }
+
+    /* Without a thread per vcpu the emulator would be throttled too */
+    if (priv->nvcpupids == 0 || priv->vcpupids[0] == vm->pid) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("vcpus of the domain do not run in their own threads"));
+        return -1;
+    }
+
+    rc = virCgroupForDomain(driver->cgroup, vm->def->name, &cgroup, 0);
+    if (rc < 0) {
+        virReportSystemError(-rc,
+                             _("Unable to find cgroup for %s"),
+                             vm->def->name);
+        return -1;
+    }
+
+    for (i = 0; i < priv->nvcpupids; i++) {
+        rc = virCgroupForVcpu(cgroup, i, &cgroup_vcpu, 0);
+        if (rc < 0) {
+            virReportSystemError(-rc,
+                                 _("Unable to find vcpu cgroup for %s(vcpu:"
+                                   " %d)"),
+                                 vm->def->name, i);
+            goto cleanup;
+        }
+
+        if (percent == 0) {
+            quota = vm->def->cputune.quota ? vm->def->cputune.quota : -1;
+        } else {
+            rc = virCgroupGetCpuCfsPeriod(cgroup_vcpu, &period);
+            if (rc < 0) {
+                virReportSystemError(-rc, "%s",
+                                     _("Unable to get cpu bandwidth period"));
+                goto cleanup;
+            }
+
+            quota = vm->def->cputune.quota > 0 ?
+                vm->def->cputune.quota : period;
+            quota = quota * (100 - percent) / 100;
+            /* smallest quota the kernel accepts */
+            if (quota < 1000)
+                quota = 1000;
+        }
+
+        if (qemuSetupCgroupVcpuBW(cgroup_vcpu, 0, quota) < 0)
+            goto cleanup;
+
+        virCgroupFree(&cgroup_vcpu);
+    }
+
+    ret = 0;
+
+cleanup:
+    virCgroupFree(&cgroup_vcpu);
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
 int qemuSetupCgroupVcpuPin(virCgroupPtr cgroup,
                            virDomainVcpuPinDefPtr *vcpupin,
                            int nvcpupin,
@@ -739,6 +866,319 @@ cleanup:
     return rc;
 }
 
+/*
+ * Give each iothread of @vm its own group below the domain group, so
+ * that <iothreadpin> applies to the I/O threads alone.  Must run after
+ * qemuSetupCgroupForEmulator, which moves every thread of QEMU into
+ * the emulator group.
+ */
+int qemuSetupCgroupForIOThreads(virQEMUDriverPtr driver, virDomainObjPtr vm)
+{
+    virCgroupPtr cgroup = NULL;
+    virCgroupPtr cgroup_iothread = NULL;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainDefPtr def = vm->def;
+    virDomainVcpuPinDefPtr iothreadpin;
+    int rc;
+    int i;
+
+    /* Pinning falls back to virProcessInfoSetAffinity without cgroups */
+    if (driver->cgroup == NULL || priv->niothreadpids == 0)
+        return 0;
+
+    rc = virCgroupForDomain(driver->cgroup, vm->def->name, &cgroup, 0);
+    if (rc != 0) {
+        virReportSystemError(-rc,
+                             _("Unable to find cgroup for %s"),
+                             vm->def->name);
+        goto cleanup;
+    }
+
+    for (i = 0; i < priv->niothreadpids; i++) {
+        /* iothreads are numbered from 1, as in the domain XML */
+        rc = virCgroupForIOThread(cgroup, i + 1, &cgroup_iothread, 1);
+        if (rc < 0) {
+            virReportSystemError(-rc,
+                                 _("Unable to create iothread cgroup for "
+                                   "%s(iothread: %d)"),
+                                 vm->def->name, i + 1);
+            goto cleanup;
+        }
+
+        rc = virCgroupAddTask(cgroup_iothread, priv->iothreadpids[i]);
+        if (rc < 0) {
+            virReportSystemError(-rc,
+                                 _("unable to add iothread %d task %d to "
+                                   "cgroup"),
+                                 i + 1, priv->iothreadpids[i]);
+            goto cleanup;
+        }
+
+        if (qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_CPUSET) &&
+            (iothreadpin = virDomainVcpuPinFindByVcpu(def->cputune.iothreadpin,
+                                                      def->cputune.niothreadpin,
+                                                      i + 1)) &&
+            qemuSetupCgroupEmulatorPin(cgroup_iothread,
+                                       iothreadpin->cpumask) < 0)
+            goto cleanup;
+
+        virCgroupFree(&cgroup_iothread);
+    }
+
+    virCgroupFree(&cgroup);
+    return 0;
+
+cleanup:
+    if (cgroup_iothread) {
+        virCgroupRemove(cgroup_iothread);
+        virCgroupFree(&cgroup_iothread);
+    }
+    virCgroupFree(&cgroup);
+    return -1;
+}
+
+/*
+ * Look up the cgroup of @vm, or of its vcpu @vcpu unless that is -1,
+ * for reading statistics.  The group is kept in the private data of
+ * @vm so that the files read from it stay open between calls; it
+ * remains owned by @vm and is only valid while @vm stays locked.
+ *
+ * Returns 0 on success, -errno on failure.
+ */
+int qemuGetStatsCgroup(virQEMUDriverPtr driver,
+                       virDomainObjPtr vm,
+                       int vcpu,
+                       virCgroupPtr *group)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    int rc;
+
+    *group = NULL;
+
+    if (driver->cgroup == NULL)
+        return -ENOENT;
+
+    if (!priv->cgroup &&
+        (rc = virCgroupForDomain(driver->cgroup, vm->def->name,
+                                 &priv->cgroup, 0)) != 0)
+        return rc;
+
+    if (vcpu < 0) {
+        *group = priv->cgroup;
+        return 0;
+    }
+
+    if (vcpu >= priv->nvcpuCgroups &&
+        VIR_EXPAND_N(priv->vcpuCgroups, priv->nvcpuCgroups,
+                     vcpu + 1 - priv->nvcpuCgroups) < 0)
+        return -ENOMEM;
+
+    if (!priv->vcpuCgroups[vcpu] &&
+        (rc = virCgroupForVcpu(priv->cgroup, vcpu,
+                               &priv->vcpuCgroups[vcpu], 0)) != 0)
+        return rc;
+
+    *group = priv->vcpuCgroups[vcpu];
+    return 0;
+}
+
+/*
+ * Get the host NUMA nodes the memory of @vm is currently confined to.
+ */
+int qemuCgroupGetNUMANodes(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           virBitmapPtr *nodemask)
+{
+    virCgroupPtr cgroup = NULL;
+    char *mems = NULL;
+    int ret = -1;
+    int rc;
+
+    if (driver->cgroup == NULL ||
+        !qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_CPUSET)) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("cgroup cpuset controller is not mounted"));
+        return -1;
+    }
+
+    rc = virCgroupForDomain(driver->cgroup, vm->def->name, &cgroup, 0);
+    if (rc != 0) {
+        virReportSystemError(-rc,
+                             _("Unable to find cgroup for %s"),
+                             vm->def->name);
+        goto cleanup;
+    }
+
+    rc = virCgroupGetCpusetMems(cgroup, &mems);
+    if (rc != 0) {
+        virReportSystemError(-rc,
+                             _("Unable to get cpuset.mems for domain %s"),
+                             vm->def->name);
+        goto cleanup;
+    }
+
+    if (virBitmapParse(mems, 0, nodemask, VIR_DOMAIN_CPUMASK_LEN) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(mems);
+    virCgroupFree(&cgroup);
+    return ret;
+}
+
+static int
+qemuCgroupSetNUMANodes(virCgroupPtr cgroup,
+                       const char *mems,
+                       const char *cpus)
+{
+    int rc;
+
+    if ((rc = virCgroupSetCpusetMemoryMigrate(cgroup, true)) != 0) {
+        virReportSystemError(-rc, "%s",
+                             _("Unable to set cpuset.memory_migrate"));
+        return -1;
+    }
+
+    if ((rc = virCgroupSetCpusetMems(cgroup, mems)) != 0) {
+        virReportSystemError(-rc, "%s", _("Unable to set cpuset.mems"));
+        return -1;
+    }
+
+    if (cpus && (rc = virCgroupSetCpusetCpus(cgroup, cpus)) != 0) {
+        virReportSystemError(-rc, "%s", _("Unable to set cpuset.cpus"));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Move the running guest @vm to the host NUMA nodes in @nodemask: the
+ * vcpu and emulator threads are confined to the CPUs of those nodes
+ * and, with cpuset.memory_migrate set, the kernel moves the memory of
+ * the guest over as cpuset.mems changes.
+ *
+ * A cpuset can't be narrowed below what its children use, so the
+ * memory of the domain group is first widened to cover both the old
+ * and the new nodes, then the children are moved, and only then is
+ * the domain group narrowed down.
+ */
+int qemuCgroupMoveToNUMANodes(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm,
+                              virBitmapPtr nodemask)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virCgroupPtr cgroup = NULL;
+    virCgroupPtr child = NULL;
+    virBitmapPtr cpumap = NULL;
+    char *oldmems = NULL;
+    char *widemems = NULL;
+    char *mems = NULL;
+    char *cpus = NULL;
+    size_t i;
+    int ret = -1;
+    int rc;
+
+    if (driver->cgroup == NULL ||
+        !qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_CPUSET)) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("cgroup cpuset controller is not mounted"));
+        return -1;
+    }
+
+    if (!(cpumap = qemuPrepareCpumap(driver, nodemask)))
+        return -1;
+
+    if (!(mems = virBitmapFormat(nodemask)) ||
+        !(cpus = virBitmapFormat(cpumap))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("failed to convert NUMA nodemask"));
+        goto cleanup;
+    }
+
+    rc = virCgroupForDomain(driver->cgroup, vm->def->name, &cgroup, 0);
+    if (rc != 0) {
+        virReportSystemError(-rc,
+                             _("Unable to find cgroup for %s"),
+                             vm->def->name);
+        goto cleanup;
+    }
+
+    if ((rc = virCgroupGetCpusetMems(cgroup, &oldmems)) != 0) {
+        virReportSystemError(-rc,
+                             _("Unable to get cpuset.mems for domain %s"),
+                             vm->def->name);
+        goto cleanup;
+    }
+
+    if (virAsprintf(&widemems, "%s,%s", oldmems, mems) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (qemuCgroupSetNUMANodes(cgroup, widemems, NULL) < 0)
+        goto cleanup;
+
+    rc = virCgroupForEmulator(cgroup, &child, 0);
+    if (rc != 0) {
+        virReportSystemError(-rc,
+                             _("Unable to find emulator cgroup for %s"),
+                             vm->def->name);
+        goto cleanup;
+    }
+    if (qemuCgroupSetNUMANodes(child, mems, cpus) < 0)
+        goto cleanup;
+    virCgroupFree(&child);
+
+    /* vcpu groups only exist when the vcpu threads are known */
+    if (priv->nvcpupids && priv->vcpupids[0] != vm->pid) {
+        for (i = 0; i < priv->nvcpupids; i++) {
+            rc = virCgroupForVcpu(cgroup, i, &child, 0);
+            if (rc != 0) {
+                virReportSystemError(-rc,
+                                     _("Unable to find vcpu cgroup for %s(vcpu:"
+                                       " %zu)"),
+                                     vm->def->name, i);
+                goto cleanup;
+            }
+            if (qemuCgroupSetNUMANodes(child, mems, cpus) < 0)
+                goto cleanup;
+            virCgroupFree(&child);
+        }
+    }
+
+    for (i = 0; i < priv->niothreadpids; i++) {
+        rc = virCgroupForIOThread(cgroup, i + 1, &child, 0);
+        if (rc != 0) {
+            virReportSystemError(-rc,
+                                 _("Unable to find iothread cgroup for "
+                                   "%s(iothread: %zu)"),
+                                 vm->def->name, i + 1);
+            goto cleanup;
+        }
+        if (qemuCgroupSetNUMANodes(child, mems, cpus) < 0)
+            goto cleanup;
+        virCgroupFree(&child);
+    }
+
+    if (qemuCgroupSetNUMANodes(cgroup, mems, NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virCgroupFree(&child);
+    virCgroupFree(&cgroup);
+    virBitmapFree(cpumap);
+    VIR_FREE(oldmems);
+    VIR_FREE(widemems);
+    VIR_FREE(mems);
+    VIR_FREE(cpus);
+    return ret;
+}
+
 int qemuRemoveCgroup(virQEMUDriverPtr driver,
                      virDomainObjPtr vm,
                      int quiet)
@@ -749,6 +1189,8 @@ int qemuRemoveCgroup(virQEMUDriverPtr driver,
     if (driver->cgroup == NULL)
         return 0; /* Not supported, so claim success */
 
+    qemuDomainObjDropCgroups(vm);
+
     rc = virCgroupForDomain(driver->cgroup, vm->def->name, &cgroup, 0);
     if (rc != 0) {
         if (!quiet)
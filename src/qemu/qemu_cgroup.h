@@ -45,12 +45,18 @@ int qemuTeardownDiskCgroup(virDomainObjPtr vm,
 int qemuSetupHostUsbDeviceCgroup(usbDevice *dev,
                                  const char *path,
                                  void *opaque);
+int qemuSetupBlkioDeviceThrottle(virCgroupPtr cgroup,
+                                 virDomainDefPtr def,
+                                 const char *path);
 int qemuSetupCgroup(virQEMUDriverPtr driver,
                     virDomainObjPtr vm,
                     virBitmapPtr nodemask);
 int qemuSetupCgroupVcpuBW(virCgroupPtr cgroup,
                           unsigned long long period,
                           long long quota);
+int qemuCgroupThrottleVcpus(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm,
+                            unsigned int percent);
 int qemuSetupCgroupVcpuPin(virCgroupPtr cgroup,
                            virDomainVcpuPinDefPtr *vcpupin,
                            int nvcpupin,
@@ -60,6 +66,18 @@ int qemuSetupCgroupForVcpu(virQEMUDriverPtr driver, virDomainObjPtr vm);
 int qemuSetupCgroupForEmulator(virQEMUDriverPtr driver,
                                virDomainObjPtr vm,
                                virBitmapPtr nodemask);
+int qemuSetupCgroupForIOThreads(virQEMUDriverPtr driver,
+                                virDomainObjPtr vm);
+int qemuGetStatsCgroup(virQEMUDriverPtr driver,
+                       virDomainObjPtr vm,
+                       int vcpu,
+                       virCgroupPtr *group);
+int qemuCgroupGetNUMANodes(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           virBitmapPtr *nodemask);
+int qemuCgroupMoveToNUMANodes(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm,
+                              virBitmapPtr nodemask);
 int qemuRemoveCgroup(virQEMUDriverPtr driver,
                      virDomainObjPtr vm,
                      int quiet);
@@ -189,16 +189,24 @@ error:
 }
 
 
+/**
+ * qemuNetworkIfaceConnect:
+ * @tapfd: array of @tapfdSize file descriptors, receiving the open
+ *         queues of the tap device
+ *
+ * Returns 0 on success, -1 on failure
+ */
 int
 qemuNetworkIfaceConnect(virDomainDefPtr def,
                         virConnectPtr conn,
                         virQEMUDriverPtr driver,
                         virDomainNetDefPtr net,
-                        qemuCapsPtr caps)
+                        qemuCapsPtr caps,
+                        int *tapfd,
+                        int tapfdSize)
 {
     char *brname = NULL;
-    int err;
-    int tapfd = -1;
+    int ret = -1;
     unsigned int tap_create_flags = VIR_NETDEV_TAP_CREATE_IFUP;
     bool template_ifname = false;
     int actualType = virDomainNetGetActualType(net);
@@ -265,19 +273,20 @@ qemuNetworkIfaceConnect(virDomainDefPtr def,
         tap_create_flags |= VIR_NETDEV_TAP_CREATE_VNET_HDR;
     }
 
-    err = virNetDevTapCreateInBridgePort(brname, &net->ifname, &net->mac,
-                                         def->uuid, &tapfd,
-                                         virDomainNetGetActualVirtPortProfile(net),
-                                         virDomainNetGetActualVlan(net),
-                                         tap_create_flags);
-    virDomainAuditNetDevice(def, net, "/dev/net/tun", tapfd >= 0);
-    if (err < 0) {
+    if (virNetDevTapCreateInBridgePort(brname, &net->ifname, &net->mac,
+                                       def->uuid, tapfd, tapfdSize,
+                                       virDomainNetGetActualVirtPortProfile(net),
+                                       virDomainNetGetActualVlan(net),
+                                       tap_create_flags) < 0) {
+        virDomainAuditNetDevice(def, net, "/dev/net/tun", false);
         if (template_ifname)
             VIR_FREE(net->ifname);
-        tapfd = -1;
+        goto cleanup;
     }
+    virDomainAuditNetDevice(def, net, "/dev/net/tun", true);
 
     if (driver->macFilter) {
+        int err;
         if ((err = networkAllowMacOnPort(driver, net->ifname, &net->mac))) {
             virReportSystemError(err,
                  _("failed to add ebtables rule to allow MAC address on '%s'"),
@@ -285,42 +294,55 @@ qemuNetworkIfaceConnect(virDomainDefPtr def,
         }
     }
 
-    if (tapfd >= 0 &&
-        virNetDevBandwidthSet(net->ifname,
+    if (virNetDevBandwidthSet(net->ifname,
                               virDomainNetGetActualBandwidth(net),
                               false) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("cannot set bandwidth limits on %s"),
                        net->ifname);
-        VIR_FORCE_CLOSE(tapfd);
         goto cleanup;
     }
 
-    if (tapfd >= 0) {
-        if ((net->filter) && (net->ifname)) {
-            if (virDomainConfNWFilterInstantiate(conn, def->uuid, net) < 0)
-                VIR_FORCE_CLOSE(tapfd);
-        }
-    }
+    if (net->filter && net->ifname &&
+        virDomainConfNWFilterInstantiate(conn, def->uuid, net) < 0)
+        goto cleanup;
+
+    ret = 0;
 
 cleanup:
+    if (ret < 0) {
+        int i;
+        for (i = 0; i < tapfdSize && tapfd[i] >= 0; i++)
+            VIR_FORCE_CLOSE(tapfd[i]);
+    }
     VIR_FREE(brname);
 
-    return tapfd;
+    return ret;
 }
 
 
+/**
+ * qemuOpenVhostNet:
+ * @vhostfd: array of *@vhostfdSize file descriptors
+ * @vhostfdSize: number of vhost-net devices to open, one per queue;
+ *               set to the number actually opened, 0 if vhost-net
+ *               is not to be used
+ *
+ * Returns 0 on success, -1 on failure
+ */
 int
 qemuOpenVhostNet(virDomainDefPtr def,
                  virDomainNetDefPtr net,
                  qemuCapsPtr caps,
-                 int *vhostfd)
+                 int *vhostfd,
+                 int *vhostfdSize)
 {
-    *vhostfd = -1;   /* assume we won't use vhost */
+    int i;
 
     /* If the config says explicitly to not use vhost, return now */
     if (net->driver.virtio.name == VIR_DOMAIN_NET_BACKEND_TYPE_QEMU) {
-       return 0;
+        *vhostfdSize = 0;
+        return 0;
     }
 
     /* If qemu doesn't support vhost-net mode (including the -netdev command
@@ -335,6 +357,7 @@ qemuOpenVhostNet(virDomainDefPtr def,
                                    "this QEMU binary"));
             return -1;
         }
+        *vhostfdSize = 0;
         return 0;
     }
 
@@ -346,23 +369,39 @@ qemuOpenVhostNet(virDomainDefPtr def,
                                    "virtio network interfaces"));
             return -1;
         }
+        *vhostfdSize = 0;
         return 0;
     }
 
-    *vhostfd = open("/dev/vhost-net", O_RDWR);
-    virDomainAuditNetDevice(def, net, "/dev/vhost-net", *vhostfd >= 0);
+    /* Each queue gets its own vhost-net device, and thus kernel thread */
+    for (i = 0; i < *vhostfdSize; i++) {
+        vhostfd[i] = open("/dev/vhost-net", O_RDWR);
+        virDomainAuditNetDevice(def, net, "/dev/vhost-net", vhostfd[i] >= 0);
 
-    /* If the config says explicitly to use vhost and we couldn't open it,
-     * report an error.
-     */
-    if ((*vhostfd < 0) &&
-        (net->driver.virtio.name == VIR_DOMAIN_NET_BACKEND_TYPE_VHOST)) {
-        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
-                       "%s", _("vhost-net was requested for an interface, "
-                               "but is unavailable"));
-        return -1;
+        if (vhostfd[i] < 0) {
+            /* If the config says explicitly to use vhost and we couldn't
+             * open it, report an error. Otherwise fall back to the qemu
+             * backend for all queues.
+             */
+            if (net->driver.virtio.name == VIR_DOMAIN_NET_BACKEND_TYPE_VHOST) {
+                virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                               "%s", _("vhost-net was requested for an interface, "
+                                       "but is unavailable"));
+                goto error;
+            }
+            while (i--)
+                VIR_FORCE_CLOSE(vhostfd[i]);
+            *vhostfdSize = 0;
+            return 0;
+        }
     }
     return 0;
+
+error:
+    while (i--)
+        VIR_FORCE_CLOSE(vhostfd[i]);
+    *vhostfdSize = 0;
+    return -1;
 }
 
 
@@ -943,31 +982,41 @@ cleanup:
 #define QEMU_PCI_ADDRESS_LAST_SLOT 31
 #define QEMU_PCI_ADDRESS_LAST_FUNCTION 8
 struct _qemuDomainPCIAddressSet {
-    virHashTablePtr used;
+    /* functions in use of each slot of bus 0, one bit per function */
+    uint8_t used[QEMU_PCI_ADDRESS_LAST_SLOT + 1];
     int nextslot;
 };
 
+#define QEMU_PCI_ADDRESS_ARGS(dev)              \
+    (dev)->addr.pci.domain, (dev)->addr.pci.bus, \
+    (dev)->addr.pci.slot, (dev)->addr.pci.function
 
-static char *qemuPCIAddressAsString(virDomainDeviceInfoPtr dev)
-{
-    char *addr;
 
+static int qemuPCIAddressValidate(virDomainDeviceInfoPtr dev)
+{
     if (dev->addr.pci.domain != 0 ||
         dev->addr.pci.bus != 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Only PCI domain 0 and bus 0 are available"));
-        return NULL;
+        return -1;
     }
 
-    if (virAsprintf(&addr, "%d:%d:%d.%d",
-                    dev->addr.pci.domain,
-                    dev->addr.pci.bus,
-                    dev->addr.pci.slot,
-                    dev->addr.pci.function) < 0) {
-        virReportOOMError();
-        return NULL;
+    if (dev->addr.pci.slot > QEMU_PCI_ADDRESS_LAST_SLOT ||
+        dev->addr.pci.function >= QEMU_PCI_ADDRESS_LAST_FUNCTION) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("Invalid PCI address %d:%d:%d.%d"),
+                       QEMU_PCI_ADDRESS_ARGS(dev));
+        return -1;
     }
-    return addr;
+
+    return 0;
+}
+
+
+static bool qemuPCIAddressIsUsed(qemuDomainPCIAddressSetPtr addrs,
+                                 int slot, int function)
+{
+    return !!(addrs->used[slot] & (1 << function));
 }
 
 
@@ -976,9 +1025,8 @@ static int qemuCollectPCIAddress(virDomainDefPtr def ATTRIBUTE_UNUSED,
                                  virDomainDeviceInfoPtr info,
                                  void *opaque)
 {
-    int ret = -1;
-    char *addr = NULL;
     qemuDomainPCIAddressSetPtr addrs = opaque;
+    int slot = info->addr.pci.slot;
 
     if ((info->type != VIR_DOMAIN_DEVICE_ADDRESS_TYPE_PCI)
         || ((device->type == VIR_DOMAIN_DEVICE_HOSTDEV) &&
@@ -990,59 +1038,50 @@ static int qemuCollectPCIAddress(virDomainDefPtr def ATTRIBUTE_UNUSED,
         return 0;
     }
 
-    addr = qemuPCIAddressAsString(info);
-    if (!addr)
-        goto cleanup;
+    if (qemuPCIAddressValidate(info) < 0)
+        return -1;
 
-    if (virHashLookup(addrs->used, addr)) {
+    if (qemuPCIAddressIsUsed(addrs, slot, info->addr.pci.function)) {
         if (info->addr.pci.function != 0) {
             virReportError(VIR_ERR_XML_ERROR,
-                           _("Attempted double use of PCI Address '%s' "
+                           _("Attempted double use of PCI Address '%d:%d:%d.%d' "
                              "(may need \"multifunction='on'\" for device on function 0)"),
-                           addr);
+                           QEMU_PCI_ADDRESS_ARGS(info));
         } else {
             virReportError(VIR_ERR_XML_ERROR,
-                           _("Attempted double use of PCI Address '%s'"), addr);
+                           _("Attempted double use of PCI Address '%d:%d:%d.%d'"),
+                           QEMU_PCI_ADDRESS_ARGS(info));
         }
-        goto cleanup;
+        return -1;
     }
 
-    VIR_DEBUG("Remembering PCI addr %s", addr);
-    if (virHashAddEntry(addrs->used, addr, addr) < 0)
-        goto cleanup;
-    addr = NULL;
+    VIR_DEBUG("Remembering PCI addr %d:%d:%d.%d",
+              QEMU_PCI_ADDRESS_ARGS(info));
+    addrs->used[slot] |= 1 << info->addr.pci.function;
 
     if ((info->addr.pci.function == 0) &&
         (info->addr.pci.multi != VIR_DEVICE_ADDRESS_PCI_MULTI_ON)) {
         /* a function 0 w/o multifunction=on must reserve the entire slot */
         int function;
-        virDomainDeviceInfo temp_info = *info;
 
         for (function = 1; function < QEMU_PCI_ADDRESS_LAST_FUNCTION; function++) {
-            temp_info.addr.pci.function = function;
-            addr = qemuPCIAddressAsString(&temp_info);
-            if (!addr)
-                goto cleanup;
-
-            if (virHashLookup(addrs->used, addr)) {
+            if (qemuPCIAddressIsUsed(addrs, slot, function)) {
                 virReportError(VIR_ERR_XML_ERROR,
-                               _("Attempted double use of PCI Address '%s' "
+                               _("Attempted double use of PCI Address '%d:%d:%d.%d' "
                                  "(need \"multifunction='off'\" for device "
                                  "on function 0)"),
-                               addr);
-                goto cleanup;
+                               info->addr.pci.domain, info->addr.pci.bus,
+                               slot, function);
+                return -1;
             }
-
-            VIR_DEBUG("Remembering PCI addr %s (multifunction=off for function 0)", addr);
-            if (virHashAddEntry(addrs->used, addr, addr))
-                goto cleanup;
-            addr = NULL;
         }
+
+        VIR_DEBUG("Remembering PCI slot %d (multifunction=off for function 0)",
+                  slot);
+        addrs->used[slot] = 0xff;
     }
-    ret = 0;
-cleanup:
-    VIR_FREE(addr);
-    return ret;
+
+    return 0;
 }
 
 
@@ -1099,13 +1138,6 @@ int qemuDomainAssignAddresses(virDomainDefPtr def,
     return qemuDomainAssignPCIAddresses(def, caps, obj);
 }
 
-static void
-qemuDomainPCIAddressSetFreeEntry(void *payload,
-                                 const void *name ATTRIBUTE_UNUSED)
-{
-    VIR_FREE(payload);
-}
-
 qemuDomainPCIAddressSetPtr qemuDomainPCIAddressSetCreate(virDomainDefPtr def)
 {
     qemuDomainPCIAddressSetPtr addrs;
@@ -1113,9 +1145,6 @@ qemuDomainPCIAddressSetPtr qemuDomainPCIAddressSetCreate(virDomainDefPtr def)
     if (VIR_ALLOC(addrs) < 0)
         goto no_memory;
 
-    if (!(addrs->used = virHashCreate(10, qemuDomainPCIAddressSetFreeEntry)))
-        goto error;
-
     if (virDomainDeviceInfoIterate(def, qemuCollectPCIAddress, addrs) < 0)
         goto error;
 
@@ -1135,24 +1164,15 @@ error:
 static int qemuDomainPCIAddressCheckSlot(qemuDomainPCIAddressSetPtr addrs,
                                          virDomainDeviceInfoPtr dev)
 {
-    char *addr;
     virDomainDeviceInfo temp_dev;
-    int function;
 
     temp_dev = *dev;
-    for (function = 0; function < QEMU_PCI_ADDRESS_LAST_FUNCTION; function++) {
-        temp_dev.addr.pci.function = function;
-        addr = qemuPCIAddressAsString(&temp_dev);
-        if (!addr)
-            return -1;
-
-        if (virHashLookup(addrs->used, addr)) {
-            VIR_FREE(addr);
-            return -1;
-        }
+    temp_dev.addr.pci.function = 0;
+    if (qemuPCIAddressValidate(&temp_dev) < 0)
+        return -1;
 
-        VIR_FREE(addr);
-    }
+    if (addrs->used[temp_dev.addr.pci.slot])
+        return -1;
 
     return 0;
 }
@@ -1160,25 +1180,21 @@ static int qemuDomainPCIAddressCheckSlot(qemuDomainPCIAddressSetPtr addrs,
 int qemuDomainPCIAddressReserveAddr(qemuDomainPCIAddressSetPtr addrs,
                                     virDomainDeviceInfoPtr dev)
 {
-    char *addr;
-
-    addr = qemuPCIAddressAsString(dev);
-    if (!addr)
+    if (qemuPCIAddressValidate(dev) < 0)
         return -1;
 
-    VIR_DEBUG("Reserving PCI addr %s", addr);
+    VIR_DEBUG("Reserving PCI addr %d:%d:%d.%d",
+              QEMU_PCI_ADDRESS_ARGS(dev));
 
-    if (virHashLookup(addrs->used, addr)) {
+    if (qemuPCIAddressIsUsed(addrs, dev->addr.pci.slot,
+                             dev->addr.pci.function)) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("unable to reserve PCI address %s"), addr);
-        VIR_FREE(addr);
+                       _("unable to reserve PCI address %d:%d:%d.%d"),
+                       QEMU_PCI_ADDRESS_ARGS(dev));
         return -1;
     }
 
-    if (virHashAddEntry(addrs->used, addr, addr)) {
-        VIR_FREE(addr);
-        return -1;
-    }
+    addrs->used[dev->addr.pci.slot] |= 1 << dev->addr.pci.function;
 
     if (dev->addr.pci.slot > addrs->nextslot) {
         addrs->nextslot = dev->addr.pci.slot + 1;
@@ -1247,18 +1263,16 @@ int qemuDomainPCIAddressEnsureAddr(qemuDomainPCIAddressSetPtr addrs,
 int qemuDomainPCIAddressReleaseAddr(qemuDomainPCIAddressSetPtr addrs,
                                     virDomainDeviceInfoPtr dev)
 {
-    char *addr;
-    int ret;
-
-    addr = qemuPCIAddressAsString(dev);
-    if (!addr)
+    if (qemuPCIAddressValidate(dev) < 0)
         return -1;
 
-    ret = virHashRemoveEntry(addrs->used, addr);
+    if (!qemuPCIAddressIsUsed(addrs, dev->addr.pci.slot,
+                              dev->addr.pci.function))
+        return -1;
 
-    VIR_FREE(addr);
+    addrs->used[dev->addr.pci.slot] &= ~(1 << dev->addr.pci.function);
 
-    return ret;
+    return 0;
 }
 
 int qemuDomainPCIAddressReleaseFunction(qemuDomainPCIAddressSetPtr addrs,
@@ -1277,39 +1291,22 @@ int qemuDomainPCIAddressReleaseFunction(qemuDomainPCIAddressSetPtr addrs,
 int qemuDomainPCIAddressReleaseSlot(qemuDomainPCIAddressSetPtr addrs, int slot)
 {
     virDomainDeviceInfo dev;
-    char *addr;
-    int ret = 0;
-    unsigned int *function = &dev.addr.pci.function;
 
     dev.addr.pci.domain = 0;
     dev.addr.pci.bus = 0;
     dev.addr.pci.slot = slot;
+    dev.addr.pci.function = 0;
 
-    for (*function = 0; *function < QEMU_PCI_ADDRESS_LAST_FUNCTION; (*function)++) {
-        addr = qemuPCIAddressAsString(&dev);
-        if (!addr)
-            return -1;
-
-        if (!virHashLookup(addrs->used, addr)) {
-            VIR_FREE(addr);
-            continue;
-        }
-
-        VIR_FREE(addr);
+    if (qemuPCIAddressValidate(&dev) < 0)
+        return -1;
 
-        if (qemuDomainPCIAddressReleaseFunction(addrs, slot, *function) < 0)
-            ret = -1;
-    }
+    addrs->used[slot] = 0;
 
-    return ret;
+    return 0;
 }
 
 void qemuDomainPCIAddressSetFree(qemuDomainPCIAddressSetPtr addrs)
 {
-    if (!addrs)
-        return;
-
-    virHashFree(addrs->used);
     VIR_FREE(addrs);
 }
 
@@ -1321,29 +1318,15 @@ static int qemuDomainPCIAddressGetNextSlot(qemuDomainPCIAddressSetPtr addrs)
 
     for (i = addrs->nextslot, iteration = 0;
          iteration <= QEMU_PCI_ADDRESS_LAST_SLOT; i++, iteration++) {
-        virDomainDeviceInfo maybe;
-        char *addr;
-
         if (QEMU_PCI_ADDRESS_LAST_SLOT < i)
             i = 0;
-        memset(&maybe, 0, sizeof(maybe));
-        maybe.addr.pci.domain = 0;
-        maybe.addr.pci.bus = 0;
-        maybe.addr.pci.slot = i;
-        maybe.addr.pci.function = 0;
 
-        if (!(addr = qemuPCIAddressAsString(&maybe)))
-            return -1;
-
-        if (qemuDomainPCIAddressCheckSlot(addrs, &maybe) < 0) {
-            VIR_DEBUG("PCI addr %s already in use", addr);
-            VIR_FREE(addr);
+        if (addrs->used[i]) {
+            VIR_DEBUG("PCI slot %d already in use", i);
             continue;
         }
 
-        VIR_DEBUG("Found free PCI addr %s", addr);
-        VIR_FREE(addr);
-
+        VIR_DEBUG("Found free PCI slot %d", i);
         return i;
     }
 
@@ -2573,6 +2556,54 @@ error:
     return NULL;
 }
 
+/*
+ * Attach a virtio disk to its I/O thread. QEMU with iothread objects
+ * lets several disks share one of the threads declared by <iothreads>;
+ * older QEMU only offers the experimental data plane, which spawns one
+ * thread per disk and is restricted to raw images opened with O_DIRECT
+ * and native AIO.
+ */
+static int
+qemuBuildDriveIOThreadStr(virBufferPtr opt,
+                          virDomainDefPtr def,
+                          virDomainDiskDefPtr disk,
+                          qemuCapsPtr caps)
+{
+    /* hotplugged disks have not been checked against <iothreads> yet */
+    if (disk->iothread > def->iothreads) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("disk '%s' uses iothread %u but only %u iothreads "
+                         "are defined"),
+                       disk->dst, disk->iothread, def->iothreads);
+        return -1;
+    }
+
+    if (qemuCapsGet(caps, QEMU_CAPS_OBJECT_IOTHREAD)) {
+        virBufferAsprintf(opt, ",iothread=iothread%u", disk->iothread);
+        return 0;
+    }
+
+    if (!qemuCapsGet(caps, QEMU_CAPS_VIRTIO_BLK_DATA_PLANE)) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("disk iothread is not supported by this QEMU"));
+        return -1;
+    }
+
+    if (disk->device == VIR_DOMAIN_DISK_DEVICE_LUN ||
+        disk->format != VIR_STORAGE_FILE_RAW ||
+        disk->cachemode != VIR_DOMAIN_DISK_CACHE_DISABLE ||
+        disk->iomode != VIR_DOMAIN_DISK_IO_NATIVE) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("disk '%s' needs a raw image with cache='none' and "
+                         "io='native' to use a data plane iothread"),
+                       disk->dst);
+        return -1;
+    }
+
+    virBufferAddLit(opt, ",config-wce=off,x-data-plane=on");
+    return 0;
+}
+
 char *
 qemuBuildDriveDevStr(virDomainDefPtr def,
                      virDomainDiskDefPtr disk,
@@ -2814,6 +2845,9 @@ qemuBuildDriveDevStr(virDomainDefPtr def,
                               (disk->device == VIR_DOMAIN_DISK_DEVICE_LUN)
                               ? "on" : "off");
         }
+        if (disk->iothread &&
+            qemuBuildDriveIOThreadStr(&opt, def, disk, caps) < 0)
+            goto error;
         if (qemuBuildDeviceAddressStr(&opt, &disk->info, caps) < 0)
             goto error;
         break;
@@ -3218,6 +3252,12 @@ qemuBuildNicDevStr(virDomainNetDefPtr net,
             virBufferAsprintf(&buf, ",event_idx=%s",
                               virDomainVirtioEventIdxTypeToString(net->driver.virtio.event_idx));
         }
+        if (net->driver.virtio.queues > 1) {
+            /* One MSI-X vector per tx and rx queue, plus one for
+             * configuration changes and one for the control queue */
+            virBufferAsprintf(&buf, ",mq=on,vectors=%u",
+                              2 * net->driver.virtio.queues + 2);
+        }
     }
     if (vlan == -1)
         virBufferAsprintf(&buf, ",netdev=host%s", net->info.alias);
@@ -3254,10 +3294,13 @@ qemuBuildHostNetStr(virDomainNetDefPtr net,
                     qemuCapsPtr caps,
                     char type_sep,
                     int vlan,
-                    const char *tapfd,
-                    const char *vhostfd)
+                    char **tapfd,
+                    int tapfdSize,
+                    char **vhostfd,
+                    int vhostfdSize)
 {
     bool is_tap = false;
+    int i;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
     enum virDomainNetType netType = virDomainNetGetActualType(net);
     const char *brname = NULL;
@@ -3286,7 +3329,13 @@ qemuBuildHostNetStr(virDomainNetDefPtr net,
         }
     case VIR_DOMAIN_NET_TYPE_NETWORK:
     case VIR_DOMAIN_NET_TYPE_DIRECT:
-        virBufferAsprintf(&buf, "tap%cfd=%s", type_sep, tapfd);
+        if (tapfdSize > 1) {
+            virBufferAsprintf(&buf, "tap%cfds=%s", type_sep, tapfd[0]);
+            for (i = 1; i < tapfdSize; i++)
+                virBufferAsprintf(&buf, ":%s", tapfd[i]);
+        } else {
+            virBufferAsprintf(&buf, "tap%cfd=%s", type_sep, tapfd[0]);
+        }
         type_sep = ',';
         is_tap = true;
         break;
@@ -3346,8 +3395,13 @@ qemuBuildHostNetStr(virDomainNetDefPtr net,
     }
 
     if (is_tap) {
-        if (vhostfd && *vhostfd)
-            virBufferAsprintf(&buf, ",vhost=on,vhostfd=%s", vhostfd);
+        if (vhostfdSize > 1) {
+            virBufferAsprintf(&buf, ",vhost=on,vhostfds=%s", vhostfd[0]);
+            for (i = 1; i < vhostfdSize; i++)
+                virBufferAsprintf(&buf, ":%s", vhostfd[i]);
+        } else if (vhostfdSize == 1) {
+            virBufferAsprintf(&buf, ",vhost=on,vhostfd=%s", vhostfd[0]);
+        }
         if (net->tune.sndbuf_specified)
             virBufferAsprintf(&buf, ",sndbuf=%lu", net->tune.sndbuf);
     }
@@ -4609,14 +4663,170 @@ qemuBuildSmpArgStr(const virDomainDefPtr def,
     return virBufferContentAndReset(&buf);
 }
 
+/*
+ * Guest NUMA cells need a memory backend object of their own when
+ * they are bound to host nodes individually, or when only some of
+ * them are backed by huge pages.
+ */
+static bool
+qemuBuildNumaNeedMemdev(const virDomainDefPtr def)
+{
+    size_t i;
+
+    if (virDomainNumatuneHasMemNodes(&def->numatune))
+        return true;
+
+    if (!def->mem.hugepage_backed)
+        return false;
+
+    for (i = 0; i < def->mem.nhugepages; i++) {
+        if (def->mem.hugepages[i].nodemask)
+            return true;
+    }
+
+    return false;
+}
+
+/* Returns the hugetlbfs backing guest NUMA @cellid, or NULL with
+ * @err cleared if the cell uses ordinary memory */
+static virHugeTLBFSPtr
+qemuBuildNumaHugeTLBFS(virQEMUDriverPtr driver,
+                       const virDomainDefPtr def,
+                       int cellid,
+                       bool *err)
+{
+    virDomainHugePagePtr deflt = NULL;
+    size_t i;
+    bool set;
+    virHugeTLBFSPtr fs;
+
+    *err = false;
+    if (!def->mem.hugepage_backed)
+        return NULL;
+
+    if (!def->mem.nhugepages) {
+        if (!(fs = qemuGetHugeTLBFS(driver, 0)))
+            *err = true;
+        return fs;
+    }
+
+    for (i = 0; i < def->mem.nhugepages; i++) {
+        virDomainHugePagePtr page = &def->mem.hugepages[i];
+
+        if (!page->nodemask) {
+            deflt = page;
+            continue;
+        }
+
+        if (virBitmapGetBit(page->nodemask, cellid, &set) == 0 && set) {
+            deflt = page;
+            break;
+        }
+    }
+
+    if (!deflt)
+        return NULL;
+
+    if (!(fs = qemuGetHugeTLBFS(driver, deflt->size)))
+        *err = true;
+    return fs;
+}
+
+static int
+qemuBuildNumaMemdevStr(virQEMUDriverPtr driver,
+                       const virDomainDefPtr def,
+                       qemuCapsPtr caps,
+                       virCellDefPtr cell,
+                       virBufferPtr buf)
+{
+    virDomainNumatuneMemNodePtr memnode = NULL;
+    virHugeTLBFSPtr fs;
+    char *mem_path = NULL;
+    bool err;
+    int node = -1;
+
+    if (!(fs = qemuBuildNumaHugeTLBFS(driver, def, cell->cellid, &err)) && err)
+        return -1;
+
+    if ((size_t) cell->cellid < def->numatune.nmem_nodes &&
+        def->numatune.mem_nodes[cell->cellid].nodemask)
+        memnode = &def->numatune.mem_nodes[cell->cellid];
+
+    if (fs) {
+        if (!qemuCapsGet(caps, QEMU_CAPS_OBJECT_MEMORY_FILE)) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("per NUMA cell hugepage backing is not "
+                             "supported with this QEMU binary"));
+            return -1;
+        }
+        if (!(mem_path = qemuGetHugepagePath(fs)))
+            return -1;
+
+        virBufferAsprintf(buf, "memory-backend-file,id=ram-node%d,"
+                          "prealloc=yes,mem-path=%s",
+                          cell->cellid, mem_path);
+        VIR_FREE(mem_path);
+    } else {
+        if (!qemuCapsGet(caps, QEMU_CAPS_OBJECT_MEMORY_RAM)) {
+            virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                           _("per NUMA cell memory binding is not "
+                             "supported with this QEMU binary"));
+            return -1;
+        }
+        virBufferAsprintf(buf, "memory-backend-ram,id=ram-node%d",
+                          cell->cellid);
+    }
+
+    virBufferAsprintf(buf, ",size=%uM", cell->mem / 1024);
+
+    if (memnode) {
+        while ((node = virBitmapNextSetBit(memnode->nodemask, node)) >= 0)
+            virBufferAsprintf(buf, ",host-nodes=%d", node);
+
+        switch ((virDomainNumatuneMemMode) memnode->mode) {
+        case VIR_DOMAIN_NUMATUNE_MEM_STRICT:
+            virBufferAddLit(buf, ",policy=bind");
+            break;
+        case VIR_DOMAIN_NUMATUNE_MEM_PREFERRED:
+            virBufferAddLit(buf, ",policy=preferred");
+            break;
+        case VIR_DOMAIN_NUMATUNE_MEM_INTERLEAVE:
+            virBufferAddLit(buf, ",policy=interleave");
+            break;
+        case VIR_DOMAIN_NUMATUNE_MEM_LAST:
+            break;
+        }
+    }
+
+    return 0;
+}
+
 static int
-qemuBuildNumaArgStr(const virDomainDefPtr def, virCommandPtr cmd)
+qemuBuildNumaArgStr(virQEMUDriverPtr driver,
+                    const virDomainDefPtr def,
+                    qemuCapsPtr caps,
+                    virCommandPtr cmd)
 {
     int i;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
     char *cpumask;
+    bool memdev = qemuBuildNumaNeedMemdev(def);
 
     for (i = 0; i < def->cpu->ncells; i++) {
+        def->cpu->cells[i].mem = VIR_DIV_UP(def->cpu->cells[i].mem,
+                                            1024) * 1024;
+
+        if (memdev) {
+            if (qemuBuildNumaMemdevStr(driver, def, caps,
+                                       &def->cpu->cells[i], &buf) < 0)
+                goto cleanup;
+            if (virBufferError(&buf))
+                goto no_memory;
+
+            virCommandAddArg(cmd, "-object");
+            virCommandAddArgBuffer(cmd, &buf);
+        }
+
         virCommandAddArg(cmd, "-numa");
         virBufferAsprintf(&buf, "node,nodeid=%d", def->cpu->cells[i].cellid);
         virBufferAddLit(&buf, ",cpus=");
@@ -4625,20 +4835,23 @@ qemuBuildNumaArgStr(const virDomainDefPtr def, virCommandPtr cmd)
             virBufferAsprintf(&buf, "%s", cpumask);
             VIR_FREE(cpumask);
         }
-        def->cpu->cells[i].mem = VIR_DIV_UP(def->cpu->cells[i].mem,
-                                            1024) * 1024;
-        virBufferAsprintf(&buf, ",mem=%d", def->cpu->cells[i].mem / 1024);
+        if (memdev)
+            virBufferAsprintf(&buf, ",memdev=ram-node%d",
+                              def->cpu->cells[i].cellid);
+        else
+            virBufferAsprintf(&buf, ",mem=%d", def->cpu->cells[i].mem / 1024);
 
         if (virBufferError(&buf))
-            goto error;
+            goto no_memory;
 
         virCommandAddArgBuffer(cmd, &buf);
     }
     return 0;
 
-error:
-    virBufferFreeAndReset(&buf);
+no_memory:
     virReportOOMError();
+cleanup:
+    virBufferFreeAndReset(&buf);
     return -1;
 }
 
@@ -4976,6 +5189,186 @@ error:
     return -1;
 }
 
+static int
+qemuBuildInterfaceCommandLine(virCommandPtr cmd,
+                              virQEMUDriverPtr driver,
+                              virConnectPtr conn,
+                              virDomainDefPtr def,
+                              virDomainNetDefPtr net,
+                              qemuCapsPtr caps,
+                              int vlan,
+                              int bootindex,
+                              enum virNetDevVPortProfileOp vmop)
+{
+    int ret = -1;
+    char *nic = NULL, *host = NULL;
+    int *tapfd = NULL;
+    int tapfdSize = 0;
+    int *vhostfd = NULL;
+    int vhostfdSize = 0;
+    char **tapfdName = NULL;
+    char **vhostfdName = NULL;
+    int actualType = virDomainNetGetActualType(net);
+    bool connected = false;
+    bool transferred = false;
+    int i;
+
+    if (net->driver.virtio.queues > 1 &&
+        !(actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
+          (actualType == VIR_DOMAIN_NET_TYPE_BRIDGE &&
+           (driver->privileged ||
+            !qemuCapsGet(caps, QEMU_CAPS_NETDEV_BRIDGE))))) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("multiple queues are only supported for tap "
+                         "devices created by libvirt"));
+        return -1;
+    }
+
+    if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
+        actualType == VIR_DOMAIN_NET_TYPE_BRIDGE) {
+        /*
+         * If type='bridge' then we attempt to allocate the tap fd here only if
+         * running under a privilged user or -netdev bridge option is not
+         * supported.
+         */
+        if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
+            driver->privileged ||
+            (!qemuCapsGet(caps, QEMU_CAPS_NETDEV_BRIDGE))) {
+            /* one tap queue per virtio-net queue */
+            tapfdSize = net->driver.virtio.queues ? net->driver.virtio.queues : 1;
+            if (VIR_ALLOC_N(tapfd, tapfdSize) < 0)
+                goto no_memory;
+            for (i = 0; i < tapfdSize; i++)
+                tapfd[i] = -1;
+            if (VIR_ALLOC_N(tapfdName, tapfdSize) < 0)
+                goto no_memory;
+
+            if (qemuNetworkIfaceConnect(def, conn, driver, net, caps,
+                                        tapfd, tapfdSize) < 0)
+                goto cleanup;
+            connected = true;
+        }
+    } else if (actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
+        tapfdSize = 1;
+        if (VIR_ALLOC(tapfd) < 0)
+            goto no_memory;
+        tapfd[0] = -1;
+        if (VIR_ALLOC(tapfdName) < 0)
+            goto no_memory;
+
+        if ((tapfd[0] = qemuPhysIfaceConnect(def, driver, net,
+                                             caps, vmop)) < 0)
+            goto cleanup;
+        connected = true;
+    }
+
+    if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
+        actualType == VIR_DOMAIN_NET_TYPE_BRIDGE ||
+        actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
+        /* Attempt to use vhost-net mode for these types of
+           network device, with one vhost-net device per queue */
+        vhostfdSize = tapfdSize ? tapfdSize : 1;
+        if (VIR_ALLOC_N(vhostfd, vhostfdSize) < 0)
+            goto no_memory;
+        for (i = 0; i < vhostfdSize; i++)
+            vhostfd[i] = -1;
+        if (VIR_ALLOC_N(vhostfdName, vhostfdSize) < 0)
+            goto no_memory;
+
+        if (qemuOpenVhostNet(def, net, caps, vhostfd, &vhostfdSize) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < tapfdSize; i++)
+        virCommandTransferFD(cmd, tapfd[i]);
+    for (i = 0; i < vhostfdSize; i++)
+        virCommandTransferFD(cmd, vhostfd[i]);
+    transferred = true;
+
+    for (i = 0; i < tapfdSize; i++) {
+        if (virAsprintf(&tapfdName[i], "%d", tapfd[i]) < 0)
+            goto no_memory;
+    }
+    for (i = 0; i < vhostfdSize; i++) {
+        if (virAsprintf(&vhostfdName[i], "%d", vhostfd[i]) < 0)
+            goto no_memory;
+    }
+
+    /* Possible combinations:
+     *
+     *  1. Old way:   -net nic,model=e1000,vlan=1 -net tap,vlan=1
+     *  2. Semi-new:  -device e1000,vlan=1        -net tap,vlan=1
+     *  3. Best way:  -netdev type=tap,id=netdev1 -device e1000,id=netdev1
+     *
+     * NB, no support for -netdev without use of -device
+     */
+    if (qemuCapsGet(caps, QEMU_CAPS_NETDEV) &&
+        qemuCapsGet(caps, QEMU_CAPS_DEVICE)) {
+        virCommandAddArg(cmd, "-netdev");
+        if (!(host = qemuBuildHostNetStr(net, driver, caps,
+                                         ',', vlan,
+                                         tapfdName, tapfdSize,
+                                         vhostfdName, vhostfdSize)))
+            goto cleanup;
+        virCommandAddArg(cmd, host);
+        VIR_FREE(host);
+    }
+    if (qemuCapsGet(caps, QEMU_CAPS_DEVICE)) {
+        virCommandAddArg(cmd, "-device");
+        nic = qemuBuildNicDevStr(net, vlan, bootindex, caps);
+        if (!nic)
+            goto cleanup;
+        virCommandAddArg(cmd, nic);
+        VIR_FREE(nic);
+    } else {
+        virCommandAddArg(cmd, "-net");
+        if (!(nic = qemuBuildNicStr(net, "nic,", vlan)))
+            goto cleanup;
+        virCommandAddArg(cmd, nic);
+        VIR_FREE(nic);
+    }
+    if (!(qemuCapsGet(caps, QEMU_CAPS_NETDEV) &&
+          qemuCapsGet(caps, QEMU_CAPS_DEVICE))) {
+        virCommandAddArg(cmd, "-net");
+        if (!(host = qemuBuildHostNetStr(net, driver, caps,
+                                         ',', vlan,
+                                         tapfdName, tapfdSize,
+                                         vhostfdName, vhostfdSize)))
+            goto cleanup;
+        virCommandAddArg(cmd, host);
+        VIR_FREE(host);
+    }
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0 && connected)
+        virDomainConfNWFilterTeardown(net);
+    for (i = 0; tapfd && i < tapfdSize; i++) {
+        if (!transferred)
+            VIR_FORCE_CLOSE(tapfd[i]);
+        if (tapfdName)
+            VIR_FREE(tapfdName[i]);
+    }
+    for (i = 0; vhostfd && i < vhostfdSize; i++) {
+        if (!transferred)
+            VIR_FORCE_CLOSE(vhostfd[i]);
+        if (vhostfdName)
+            VIR_FREE(vhostfdName[i]);
+    }
+    VIR_FREE(tapfd);
+    VIR_FREE(vhostfd);
+    VIR_FREE(tapfdName);
+    VIR_FREE(vhostfdName);
+    VIR_FREE(nic);
+    VIR_FREE(host);
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    goto cleanup;
+}
+
 /*
  * Constructs a argv suitable for launching qemu with config defined
  * for a given virtual machine.
@@ -5144,25 +5537,25 @@ qemuBuildCommandLine(virConnectPtr conn,
     virCommandAddArg(cmd, "-m");
     def->mem.max_balloon = VIR_DIV_UP(def->mem.max_balloon, 1024) * 1024;
     virCommandAddArgFormat(cmd, "%llu", def->mem.max_balloon / 1024);
-    if (def->mem.hugepage_backed) {
-        if (!driver->hugetlbfs_mount) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           "%s", _("hugetlbfs filesystem is not mounted"));
-            goto error;
-        }
-        if (!driver->hugepage_path) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           "%s", _("hugepages are disabled by administrator config"));
+    if (def->mem.hugepage_backed &&
+        !(def->cpu && def->cpu->ncells && qemuBuildNumaNeedMemdev(def))) {
+        virHugeTLBFSPtr fs;
+        char *mem_path;
+
+        if (!(fs = qemuGetHugeTLBFS(driver, def->mem.nhugepages ?
+                                    def->mem.hugepages[0].size : 0)))
             goto error;
-        }
         if (!qemuCapsGet(caps, QEMU_CAPS_MEM_PATH)) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("hugepage backing not supported by '%s'"),
                            def->emulator);
             goto error;
         }
+        if (!(mem_path = qemuGetHugepagePath(fs)))
+            goto error;
         virCommandAddArgList(cmd, "-mem-prealloc", "-mem-path",
-                             driver->hugepage_path, NULL);
+                             mem_path, NULL);
+        VIR_FREE(mem_path);
     }
 
     virCommandAddArg(cmd, "-smp");
@@ -5171,8 +5564,15 @@ qemuBuildCommandLine(virConnectPtr conn,
     virCommandAddArg(cmd, smp);
     VIR_FREE(smp);
 
+    if (def->iothreads && qemuCapsGet(caps, QEMU_CAPS_OBJECT_IOTHREAD)) {
+        for (i = 1; i <= def->iothreads; i++) {
+            virCommandAddArg(cmd, "-object");
+            virCommandAddArgFormat(cmd, "iothread,id=iothread%d", i);
+        }
+    }
+
     if (def->cpu && def->cpu->ncells)
-        if (qemuBuildNumaArgStr(def, cmd) < 0)
+        if (qemuBuildNumaArgStr(driver, def, caps, cmd) < 0)
             goto error;
 
     if (qemuCapsGet(caps, QEMU_CAPS_UUID))
@@ -5972,9 +6372,6 @@ qemuBuildCommandLine(virConnectPtr conn,
 
         for (i = 0 ; i < def->nnets ; i++) {
             virDomainNetDefPtr net = def->nets[i];
-            char *nic, *host;
-            char tapfd_name[50] = "";
-            char vhostfd_name[50] = "";
             int vlan;
             int bootindex = bootNet;
             int actualType;
@@ -5994,7 +6391,8 @@ qemuBuildCommandLine(virConnectPtr conn,
              * network's pool of devices, or resolve bridge device name
              * to the one defined in the network definition.
              */
-            if (networkAllocateActualDevice(net) < 0)
+            if (networkAllocateActualDevice(net,
+                                            def->numatune.memory.nodemask) < 0)
                goto error;
 
             actualType = virDomainNetGetActualType(net);
@@ -6037,101 +6435,12 @@ qemuBuildCommandLine(virConnectPtr conn,
                 continue;
             }
 
-            if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
-                actualType == VIR_DOMAIN_NET_TYPE_BRIDGE) {
-                /*
-                 * If type='bridge' then we attempt to allocate the tap fd here only if
-                 * running under a privilged user or -netdev bridge option is not
-                 * supported.
-                 */
-                if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
-                    driver->privileged ||
-                    (!qemuCapsGet(caps, QEMU_CAPS_NETDEV_BRIDGE))) {
-                    int tapfd = qemuNetworkIfaceConnect(def, conn, driver, net,
-                                                        caps);
-                    if (tapfd < 0)
-                        goto error;
-
-                    last_good_net = i;
-                    virCommandTransferFD(cmd, tapfd);
-
-                    if (snprintf(tapfd_name, sizeof(tapfd_name), "%d",
-                                 tapfd) >= sizeof(tapfd_name))
-                        goto no_memory;
-                }
-            } else if (actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
-                int tapfd = qemuPhysIfaceConnect(def, driver, net,
-                                                 caps, vmop);
-                if (tapfd < 0)
-                    goto error;
-
-                last_good_net = i;
-                virCommandTransferFD(cmd, tapfd);
-
-                if (snprintf(tapfd_name, sizeof(tapfd_name), "%d",
-                             tapfd) >= sizeof(tapfd_name))
-                    goto no_memory;
-            }
-
-            if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
-                actualType == VIR_DOMAIN_NET_TYPE_BRIDGE ||
-                actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
-                /* Attempt to use vhost-net mode for these types of
-                   network device */
-                int vhostfd;
-
-                if (qemuOpenVhostNet(def, net, caps, &vhostfd) < 0)
-                    goto error;
-                if (vhostfd >= 0) {
-                    virCommandTransferFD(cmd, vhostfd);
+            if (qemuBuildInterfaceCommandLine(cmd, driver, conn, def, net,
+                                              caps, vlan, bootindex,
+                                              vmop) < 0)
+                goto error;
 
-                    if (snprintf(vhostfd_name, sizeof(vhostfd_name), "%d",
-                                 vhostfd) >= sizeof(vhostfd_name))
-                        goto no_memory;
-                }
-            }
-            /* Possible combinations:
-             *
-             *  1. Old way:   -net nic,model=e1000,vlan=1 -net tap,vlan=1
-             *  2. Semi-new:  -device e1000,vlan=1        -net tap,vlan=1
-             *  3. Best way:  -netdev type=tap,id=netdev1 -device e1000,id=netdev1
-             *
-             * NB, no support for -netdev without use of -device
-             */
-            if (qemuCapsGet(caps, QEMU_CAPS_NETDEV) &&
-                qemuCapsGet(caps, QEMU_CAPS_DEVICE)) {
-                virCommandAddArg(cmd, "-netdev");
-                if (!(host = qemuBuildHostNetStr(net, driver, caps,
-                                                 ',', vlan, tapfd_name,
-                                                 vhostfd_name)))
-                    goto error;
-                virCommandAddArg(cmd, host);
-                VIR_FREE(host);
-            }
-            if (qemuCapsGet(caps, QEMU_CAPS_DEVICE)) {
-                virCommandAddArg(cmd, "-device");
-                nic = qemuBuildNicDevStr(net, vlan, bootindex, caps);
-                if (!nic)
-                    goto error;
-                virCommandAddArg(cmd, nic);
-                VIR_FREE(nic);
-            } else {
-                virCommandAddArg(cmd, "-net");
-                if (!(nic = qemuBuildNicStr(net, "nic,", vlan)))
-                    goto error;
-                virCommandAddArg(cmd, nic);
-                VIR_FREE(nic);
-            }
-            if (!(qemuCapsGet(caps, QEMU_CAPS_NETDEV) &&
-                  qemuCapsGet(caps, QEMU_CAPS_DEVICE))) {
-                virCommandAddArg(cmd, "-net");
-                if (!(host = qemuBuildHostNetStr(net, driver, caps,
-                                                 ',', vlan, tapfd_name,
-                                                 vhostfd_name)))
-                    goto error;
-                virCommandAddArg(cmd, host);
-                VIR_FREE(host);
-            }
+            last_good_net = i;
         }
     }
 
@@ -74,8 +74,10 @@ char * qemuBuildHostNetStr(virDomainNetDefPtr net,
                            qemuCapsPtr caps,
                            char type_sep,
                            int vlan,
-                           const char *tapfd,
-                           const char *vhostfd);
+                           char **tapfd,
+                           int tapfdSize,
+                           char **vhostfd,
+                           int vhostfdSize);
 
 /* Legacy, pre device support */
 char * qemuBuildNicStr(virDomainNetDefPtr net,
@@ -148,7 +150,9 @@ int qemuNetworkIfaceConnect(virDomainDefPtr def,
                             virConnectPtr conn,
                             virQEMUDriverPtr driver,
                             virDomainNetDefPtr net,
-                            qemuCapsPtr caps)
+                            qemuCapsPtr caps,
+                            int *tapfd,
+                            int tapfdSize)
     ATTRIBUTE_NONNULL(2);
 
 int qemuPhysIfaceConnect(virDomainDefPtr def,
@@ -160,7 +164,8 @@ int qemuPhysIfaceConnect(virDomainDefPtr def,
 int qemuOpenVhostNet(virDomainDefPtr def,
                      virDomainNetDefPtr net,
                      qemuCapsPtr caps,
-                     int *vhostfd);
+                     int *vhostfd,
+                     int *vhostfdSize);
 
 /*
  * NB: def->name can be NULL upon return and the caller
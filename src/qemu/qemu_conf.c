@@ -53,6 +53,10 @@
 #include "virfile.h"
 #include "configmake.h"
 
+#ifdef WITH_DTRACE_PROBES
+# include "libvirt_qemu_probes.h"
+#endif
+
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
 struct _qemuDriverCloseDef {
@@ -62,10 +66,13 @@ struct _qemuDriverCloseDef {
 
 void qemuDriverLock(virQEMUDriverPtr driver)
 {
+    PROBE(QEMU_DRIVER_LOCK_WAIT, "driver=%p", driver);
     virMutexLock(&driver->lock);
+    PROBE(QEMU_DRIVER_LOCK_ACQUIRE, "driver=%p", driver);
 }
 void qemuDriverUnlock(virQEMUDriverPtr driver)
 {
+    PROBE(QEMU_DRIVER_UNLOCK, "driver=%p", driver);
     virMutexUnlock(&driver->lock);
 }
 
@@ -102,17 +109,12 @@ int qemuLoadDriverConfig(virQEMUDriverPtr driver,
         goto no_memory;
 
 #if defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R
-    /* For privileged driver, try and find hugepage mount automatically.
+    /* For privileged driver, try and find hugepage mounts automatically.
      * Non-privileged driver requires admin to create a dir for the
      * user, chown it, and then let user configure it manually */
     if (driver->privileged &&
-        !(driver->hugetlbfs_mount = virFileFindMountPoint("hugetlbfs"))) {
-        if (errno != ENOENT) {
-            virReportSystemError(errno, "%s",
-                                 _("unable to find hugetlbfs mountpoint"));
-            goto cleanup;
-        }
-    }
+        virFileFindHugeTLBFS(&driver->hugetlbfs, &driver->nhugetlbfs) < 0)
+        goto cleanup;
 #endif
 
     if (!(driver->lockManager = virLockManagerPluginNew("nop",
@@ -124,6 +126,8 @@ int qemuLoadDriverConfig(virQEMUDriverPtr driver,
     driver->keepAliveInterval = 5;
     driver->keepAliveCount = 5;
     driver->seccompSandbox = -1;
+    driver->memOvercommitLow = 10;
+    driver->memOvercommitHigh = 20;
 
     /* Just check the file is readable before opening it, otherwise
      * libvirt emits an error.
@@ -327,8 +331,50 @@ int qemuLoadDriverConfig(virQEMUDriverPtr driver,
     GET_VALUE_STR("auto_dump_path", driver->autoDumpPath);
     GET_VALUE_LONG("auto_dump_bypass_cache", driver->autoDumpBypassCache);
     GET_VALUE_LONG("auto_start_bypass_cache", driver->autoStartBypassCache);
+    GET_VALUE_LONG("auto_start_concurrency", driver->autoStartConcurrency);
 
-    GET_VALUE_STR("hugetlbfs_mount", driver->hugetlbfs_mount);
+    p = virConfGetValue(conf, "hugetlbfs_mount");
+    if (p && p->type == VIR_CONF_LIST) {
+        size_t len;
+        virConfValuePtr pp;
+
+        for (len = 0, pp = p->list; pp; len++, pp = pp->next) {
+            if (pp->type != VIR_CONF_STRING) {
+                virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                               _("hugetlbfs_mount must be a list of strings"));
+                goto cleanup;
+            }
+        }
+
+        virHugeTLBFSArrayFree(driver->hugetlbfs, driver->nhugetlbfs);
+        driver->hugetlbfs = NULL;
+        driver->nhugetlbfs = 0;
+
+        if (len && VIR_ALLOC_N(driver->hugetlbfs, len) < 0)
+            goto no_memory;
+        driver->nhugetlbfs = len;
+
+        for (i = 0, pp = p->list; pp; i++, pp = pp->next) {
+            if (virFileSetupHugeTLBFS(&driver->hugetlbfs[i], pp->str) < 0)
+                goto cleanup;
+        }
+    } else {
+        CHECK_TYPE("hugetlbfs_mount", VIR_CONF_STRING);
+        if (p && p->str) {
+            virHugeTLBFSArrayFree(driver->hugetlbfs, driver->nhugetlbfs);
+            driver->hugetlbfs = NULL;
+            driver->nhugetlbfs = 0;
+
+            /* "" disables hugepage backing even when mounted */
+            if (*p->str) {
+                if (VIR_ALLOC_N(driver->hugetlbfs, 1) < 0)
+                    goto no_memory;
+                driver->nhugetlbfs = 1;
+                if (virFileSetupHugeTLBFS(&driver->hugetlbfs[0], p->str) < 0)
+                    goto cleanup;
+            }
+        }
+    }
 
     p = virConfGetValue(conf, "mac_filter");
     CHECK_TYPE("mac_filter", VIR_CONF_LONG);
@@ -356,6 +402,58 @@ int qemuLoadDriverConfig(virQEMUDriverPtr driver,
     GET_VALUE_LONG("set_process_name", driver->setProcessName);
     GET_VALUE_LONG("max_processes", driver->maxProcesses);
     GET_VALUE_LONG("max_files", driver->maxFiles);
+    GET_VALUE_LONG("memory_stats_period", driver->memoryStatsPeriod);
+    GET_VALUE_LONG("numa_rebalance_threshold", driver->numaRebalanceThreshold);
+    if (driver->numaRebalanceThreshold > 99) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("%s: numa_rebalance_threshold: must be lower "
+                         "than 100"), filename);
+        goto cleanup;
+    }
+    GET_VALUE_LONG("memory_overcommit_interval", driver->memOvercommitInterval);
+    GET_VALUE_LONG("memory_overcommit_low", driver->memOvercommitLow);
+    GET_VALUE_LONG("memory_overcommit_high", driver->memOvercommitHigh);
+    if (driver->memOvercommitInterval) {
+        if (!driver->memoryStatsPeriod) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("%s: memory_overcommit_interval: needs "
+                             "memory_stats_period"), filename);
+            goto cleanup;
+        }
+        if (driver->memOvercommitLow >= driver->memOvercommitHigh ||
+            driver->memOvercommitHigh > 100) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("%s: memory_overcommit_low must be lower than "
+                             "memory_overcommit_high, itself at most 100"),
+                           filename);
+            goto cleanup;
+        }
+    }
+
+    GET_VALUE_LONG("cpu_quota_interval", driver->cpuQuotaInterval);
+
+    p = virConfGetValue(conf, "metadata_index");
+    CHECK_TYPE("metadata_index", VIR_CONF_LIST);
+    if (p) {
+        int len = 0;
+        virConfValuePtr pp;
+        for (pp = p->list; pp; pp = pp->next)
+            len++;
+        if (VIR_ALLOC_N(driver->metadataIndex, 1+len) < 0)
+            goto no_memory;
+
+        for (i = 0, pp = p->list; pp; ++i, pp = pp->next) {
+            if (pp->type != VIR_CONF_STRING || strchr(pp->str, ' ')) {
+                virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                               _("metadata_index must be a "
+                                 "list of namespace URIs"));
+                goto cleanup;
+            }
+            if (!(driver->metadataIndex[i] = strdup(pp->str)))
+                goto no_memory;
+        }
+        driver->metadataIndex[i] = NULL;
+    }
 
     p = virConfGetValue(conf, "lock_manager");
     CHECK_TYPE("lock_manager", VIR_CONF_STRING);
@@ -367,8 +465,37 @@ int qemuLoadDriverConfig(virQEMUDriverPtr driver,
     }
 
     GET_VALUE_LONG("max_queued", driver->max_queued);
+    GET_VALUE_LONG("monitor_io_threads", driver->monitorIOThreads);
     GET_VALUE_LONG("keepalive_interval", driver->keepAliveInterval);
     GET_VALUE_LONG("keepalive_count", driver->keepAliveCount);
+
+    GET_VALUE_LONG("migration_max_downtime", driver->migrationMaxDowntime);
+    GET_VALUE_LONG("migration_max_throttle", driver->migrationMaxThrottle);
+    if (driver->migrationMaxThrottle > 99) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("%s: migration_max_throttle: must be lower "
+                         "than 100"), filename);
+        goto cleanup;
+    }
+
+    GET_VALUE_LONG("migration_max_concurrent", driver->migrationMaxConcurrent);
+    GET_VALUE_LONG("migration_host_bandwidth", driver->migrationHostBandwidth);
+
+    p = virConfGetValue(conf, "migration_queue_order");
+    CHECK_TYPE("migration_queue_order", VIR_CONF_STRING);
+    if (p && p->str) {
+        if (STREQ(p->str, "memory")) {
+            driver->migrationQueueByMemory = true;
+        } else if (STREQ(p->str, "fifo")) {
+            driver->migrationQueueByMemory = false;
+        } else {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("%s: migration_queue_order: unknown order '%s'"),
+                           filename, p->str);
+            goto cleanup;
+        }
+    }
+
     GET_VALUE_LONG("seccomp_sandbox", driver->seccompSandbox);
 
     ret = 0;
@@ -386,6 +513,57 @@ no_memory:
 #undef GET_VALUE_LONG
 #undef GET_VALUE_STRING
 
+/* The directory guests backed by @hugepage keep their memory files in */
+char *
+qemuGetHugepagePath(virHugeTLBFSPtr hugepage)
+{
+    char *ret;
+
+    if (virAsprintf(&ret, "%s/libvirt/qemu", hugepage->mnt_dir) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    return ret;
+}
+
+/**
+ * qemuGetHugeTLBFS:
+ * @driver: qemu driver
+ * @size: huge page size in KiB, 0 for the default one
+ *
+ * Returns the hugetlbfs mount providing pages of @size, or NULL with
+ * an error reported if there is none.
+ */
+virHugeTLBFSPtr
+qemuGetHugeTLBFS(virQEMUDriverPtr driver,
+                 unsigned long long size)
+{
+    size_t i;
+
+    if (!driver->nhugetlbfs) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("hugetlbfs filesystem is not mounted "
+                         "or disabled by administrator config"));
+        return NULL;
+    }
+
+    for (i = 0; i < driver->nhugetlbfs; i++) {
+        if (size ? driver->hugetlbfs[i].size == size
+                 : driver->hugetlbfs[i].deflt)
+            return &driver->hugetlbfs[i];
+    }
+
+    /* Without a mount of the default size, any will do */
+    if (!size)
+        return &driver->hugetlbfs[0];
+
+    virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                   _("hugetlbfs filesystem with %llu KiB pages is not mounted"),
+                   size);
+    return NULL;
+}
+
 static void
 qemuDriverCloseCallbackFree(void *payload,
                             const void *name ATTRIBUTE_UNUSED)
@@ -42,6 +42,7 @@
 # include "bitmap.h"
 # include "command.h"
 # include "threadpool.h"
+# include "vireventthread.h"
 # include "locking/lock_manager.h"
 # include "qemu_capabilities.h"
 
@@ -50,6 +51,9 @@
 typedef struct _qemuDriverCloseDef qemuDriverCloseDef;
 typedef qemuDriverCloseDef *qemuDriverCloseDefPtr;
 
+typedef struct _qemuMigrationSched qemuMigrationSched;
+typedef qemuMigrationSched *qemuMigrationSchedPtr;
+
 typedef struct _virQEMUDriver virQEMUDriver;
 typedef virQEMUDriver *virQEMUDriverPtr;
 
@@ -59,6 +63,18 @@ struct _virQEMUDriver {
 
     virThreadPoolPtr workerPool;
 
+    /* Single writer coalescing status file updates, see
+     * qemuDomainObjSaveStatusDeferred */
+    virThreadPoolPtr statusPool;
+
+    /* Reconnecting to running domains at startup, see
+     * qemuProcessReconnectAll */
+    virThreadPoolPtr reconnectPool;
+    size_t reconnectTotal;
+    size_t reconnectDone;
+    unsigned long long reconnectStart;
+    unsigned long long reconnectMaxTime;
+
     bool privileged;
     const char *uri;
 
@@ -73,6 +89,9 @@ struct _virQEMUDriver {
     int cgroupControllers;
     char **cgroupDeviceACL;
 
+    /* Namespaces of the <metadata> elements domains are indexed by */
+    char **metadataIndex;
+
     size_t nactive;
     virStateInhibitCallback inhibitCallback;
     void *inhibitOpaque;
@@ -107,8 +126,8 @@ struct _virQEMUDriver {
     char *spicePassword;
     int remotePortMin;
     int remotePortMax;
-    char *hugetlbfs_mount;
-    char *hugepage_path;
+    virHugeTLBFSPtr hugetlbfs;
+    size_t nhugetlbfs;
 
     unsigned int macFilter : 1;
     ebtablesContext *ebtables;
@@ -122,10 +141,48 @@ struct _virQEMUDriver {
     int maxProcesses;
     int maxFiles;
 
+    /* Seconds between balloon statistics pushed by guests, also the
+     * time they are cached for; 0 disables polling */
+    unsigned int memoryStatsPeriod;
+
+    /* Percentage by which the best fitting NUMA nodes must have more
+     * free memory than those of a guest using automatic placement for
+     * the guest to be moved there; 0 disables rebalancing */
+    unsigned int numaRebalanceThreshold;
+    virThreadPoolPtr numaRebalancePool;
+    int numaRebalanceTimer;
+
+    /* Seconds between passes of the memory overcommit manager, which
+     * adjusts balloons to keep between memOvercommitLow and
+     * memOvercommitHigh percent of host memory available; 0 disables it */
+    unsigned int memOvercommitInterval;
+    unsigned int memOvercommitLow;
+    unsigned int memOvercommitHigh;
+    virThreadPoolPtr memOvercommitPool;
+    int memOvercommitTimer;
+
+    /* Seconds between passes of the CPU quota controller, 0 disables
+     * it; host idle time and time of its previous pass */
+    unsigned int cpuQuotaInterval;
+    virThreadPoolPtr cpuQuotaPool;
+    int cpuQuotaTimer;
+    unsigned long long cpuQuotaIdle;
+    unsigned long long cpuQuotaTime;
+
+    /* Threads servicing the monitor and agent sockets of domains, each
+     * domain being assigned to one of them; with none configured they
+     * are serviced by the main event loop */
+    unsigned int monitorIOThreads;
+    virEventThreadPtr *monitorIOThreadList;
+
     int max_queued;
 
     virCapsPtr caps;
     qemuCapsCachePtr capsCache;
+    /* Formatted forms of caps, built on demand and dropped with it */
+    char *capsXML;
+    char *hostCapsXML;
+    unsigned long long capsTime;
 
     virDomainEventStatePtr domainEventState;
 
@@ -141,6 +198,8 @@ struct _virQEMUDriver {
     bool autoDumpBypassCache;
 
     bool autoStartBypassCache;
+    /* How many domains may be autostarted at once, 0 for one per CPU */
+    unsigned int autoStartConcurrency;
 
     pciDeviceList *activePciHostdevs;
     usbDeviceList *activeUsbHostdevs;
@@ -163,6 +222,20 @@ struct _virQEMUDriver {
 
     int keepAliveInterval;
     unsigned int keepAliveCount;
+
+    /* Bounds within which stalled live migrations are helped to
+     * converge; 0 disables each of them */
+    unsigned long long migrationMaxDowntime; /* in milliseconds */
+    unsigned int migrationMaxThrottle;       /* percent of vcpu time */
+
+    /* Host wide limits of outgoing migrations, which are queued while
+     * migrationMaxConcurrent of them are running and share
+     * migrationHostBandwidth between them; 0 disables each of them */
+    unsigned int migrationMaxConcurrent;
+    unsigned long migrationHostBandwidth;    /* in MiB/s */
+    bool migrationQueueByMemory;             /* smallest guests first */
+    qemuMigrationSchedPtr migrationSched;
+
     int seccompSandbox;
 };
 
@@ -187,6 +260,10 @@ void qemuDriverUnlock(virQEMUDriverPtr driver);
 int qemuLoadDriverConfig(virQEMUDriverPtr driver,
                          const char *filename);
 
+char *qemuGetHugepagePath(virHugeTLBFSPtr hugepage);
+virHugeTLBFSPtr qemuGetHugeTLBFS(virQEMUDriverPtr driver,
+                                 unsigned long long size);
+
 struct qemuDomainDiskInfo {
     bool removable;
     bool locked;
@@ -43,6 +43,10 @@
 
 #include <libxml/xpathInternals.h>
 
+#ifdef WITH_DTRACE_PROBES
+# include "libvirt_qemu_probes.h"
+#endif
+
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
 #define QEMU_NAMESPACE_HREF "http://libvirt.org/schemas/domain/qemu/1.0"
@@ -66,6 +70,24 @@ VIR_ENUM_IMPL(qemuDomainAsyncJob, QEMU_ASYNC_JOB_LAST,
               "save",
               "dump",
               "snapshot",
+              "block flatten",
+);
+
+VIR_ENUM_IMPL(qemuDomainStartStep, QEMU_START_STEP_LAST,
+              "prepare",
+              "cgroup",
+              "cmdline",
+              "exec",
+              "label",
+              "monitor",
+              "setup",
+);
+
+VIR_ENUM_IMPL(qemuMigrationPrepareStep, QEMU_MIGRATION_PREPARE_LAST,
+              "parse",
+              "define",
+              "start",
+              "incoming",
 );
 
 
@@ -81,6 +103,7 @@ qemuDomainAsyncJobPhaseToString(enum qemuDomainAsyncJob job,
     case QEMU_ASYNC_JOB_SAVE:
     case QEMU_ASYNC_JOB_DUMP:
     case QEMU_ASYNC_JOB_SNAPSHOT:
+    case QEMU_ASYNC_JOB_BLOCK_FLATTEN:
     case QEMU_ASYNC_JOB_NONE:
     case QEMU_ASYNC_JOB_LAST:
         ; /* fall through */
@@ -104,6 +127,7 @@ qemuDomainAsyncJobPhaseFromString(enum qemuDomainAsyncJob job,
     case QEMU_ASYNC_JOB_SAVE:
     case QEMU_ASYNC_JOB_DUMP:
     case QEMU_ASYNC_JOB_SNAPSHOT:
+    case QEMU_ASYNC_JOB_BLOCK_FLATTEN:
     case QEMU_ASYNC_JOB_NONE:
     case QEMU_ASYNC_JOB_LAST:
         ; /* fall through */
@@ -137,6 +161,12 @@ qemuDomainObjInitJob(qemuDomainObjPrivatePtr priv)
         return -1;
     }
 
+    if (virCondInit(&priv->job.progressCond) < 0) {
+        ignore_value(virCondDestroy(&priv->job.cond));
+        ignore_value(virCondDestroy(&priv->job.asyncCond));
+        return -1;
+    }
+
     return 0;
 }
 
@@ -147,6 +177,7 @@ qemuDomainObjResetJob(qemuDomainObjPrivatePtr priv)
 
     job->active = QEMU_JOB_NONE;
     job->owner = 0;
+    job->nqueries = 0;
 }
 
 static void
@@ -161,6 +192,12 @@ qemuDomainObjResetAsyncJob(qemuDomainObjPrivatePtr priv)
     job->start = 0;
     job->dump_memory_only = false;
     job->asyncAbort = false;
+    job->migDowntime = 0;
+    job->migThrottle = 0;
+    job->migScheduled = false;
+    job->migBandwidth = 0;
+    job->migSpeed = 0;
+    memset(&job->migStatus, 0, sizeof(job->migStatus));
     memset(&job->info, 0, sizeof(job->info));
 }
 
@@ -196,6 +233,7 @@ qemuDomainObjFreeJob(qemuDomainObjPrivatePtr priv)
 {
     ignore_value(virCondDestroy(&priv->job.cond));
     ignore_value(virCondDestroy(&priv->job.asyncCond));
+    ignore_value(virCondDestroy(&priv->job.progressCond));
 }
 
 static bool
@@ -227,6 +265,17 @@ error:
     return NULL;
 }
 
+static void qemuDomainObjPrivateFreeCgroups(qemuDomainObjPrivatePtr priv)
+{
+    size_t i;
+
+    virCgroupFree(&priv->cgroup);
+    for (i = 0; i < priv->nvcpuCgroups; i++)
+        virCgroupFree(&priv->vcpuCgroups[i]);
+    VIR_FREE(priv->vcpuCgroups);
+    priv->nvcpuCgroups = 0;
+}
+
 static void qemuDomainObjPrivateFree(void *data)
 {
     qemuDomainObjPrivatePtr priv = data;
@@ -237,8 +286,11 @@ static void qemuDomainObjPrivateFree(void *data)
     virDomainChrSourceDefFree(priv->monConfig);
     qemuDomainObjFreeJob(priv);
     VIR_FREE(priv->vcpupids);
+    VIR_FREE(priv->iothreadpids);
     VIR_FREE(priv->lockState);
     VIR_FREE(priv->origname);
+    qemuMonitorStatsClear(&priv->statsCache);
+    qemuDomainObjPrivateFreeCgroups(priv);
 
     virConsoleFree(priv->cons);
 
@@ -291,6 +343,16 @@ static int qemuDomainObjPrivateXMLFormat(virBufferPtr buf, void *data)
         virBufferAddLit(buf, "  </vcpus>\n");
     }
 
+    if (priv->niothreadpids) {
+        int i;
+        virBufferAddLit(buf, "  <iothreads>\n");
+        for (i = 0 ; i < priv->niothreadpids ; i++) {
+            virBufferAsprintf(buf, "    <iothread pid='%d'/>\n",
+                              priv->iothreadpids[i]);
+        }
+        virBufferAddLit(buf, "  </iothreads>\n");
+    }
+
     if (priv->caps) {
         int i;
         virBufferAddLit(buf, "  <qemuCaps>\n");
@@ -402,6 +464,31 @@ static int qemuDomainObjPrivateXMLParse(xmlXPathContextPtr ctxt, void *data)
         VIR_FREE(nodes);
     }
 
+    n = virXPathNodeSet("./iothreads/iothread", ctxt, &nodes);
+    if (n < 0)
+        goto error;
+    if (n) {
+        priv->niothreadpids = n;
+        if (VIR_REALLOC_N(priv->iothreadpids, priv->niothreadpids) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+
+        for (i = 0 ; i < n ; i++) {
+            char *pidstr = virXMLPropString(nodes[i], "pid");
+            if (!pidstr)
+                goto error;
+
+            if (virStrToLong_i(pidstr, NULL, 10,
+                               &(priv->iothreadpids[i])) < 0) {
+                VIR_FREE(pidstr);
+                goto error;
+            }
+            VIR_FREE(pidstr);
+        }
+        VIR_FREE(nodes);
+    }
+
     if ((n = virXPathNodeSet("./qemuCaps/flag", ctxt, &nodes)) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("failed to parse qemu capabilities flags"));
@@ -660,17 +747,99 @@ void qemuDomainSetNamespaceHooks(virCapsPtr caps)
     caps->ns.href = qemuDomainDefNamespaceHref;
 }
 
-static void
-qemuDomainObjSaveJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
+/*
+ * obj must be locked before calling
+ *
+ * Queue the status file of @obj to be rewritten by the status writer
+ * instead of writing it right away.  Further changes made before the
+ * writer gets to @obj are coalesced into the same write, so a storm
+ * of events costs one rewrite rather than one per event.  The file
+ * itself is still replaced atomically by virDomainSaveStatus.
+ */
+void
+qemuDomainObjSaveStatusDeferred(virQEMUDriverPtr driver,
+                                virDomainObjPtr obj)
 {
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+
     if (!virDomainObjIsActive(obj)) {
         /* don't write the state file yet, it will be written once the domain
          * gets activated */
         return;
     }
 
-    if (virDomainSaveStatus(driver->caps, driver->stateDir, obj) < 0)
+    /* the caller changed the definition, so don't let the formatted XML
+     * cache wait for the writer */
+    virDomainObjInvalidateXMLCache(obj);
+
+    if (priv->statusDirty)
+        return;
+
+    /* the queued job holds a reference until the writer is done */
+    virObjectRef(obj);
+    if (!driver->statusPool ||
+        virThreadPoolSendJob(driver->statusPool, 0, obj) < 0) {
+        virObjectUnref(obj);
+        if (virDomainSaveStatus(driver->caps, driver->stateDir, obj) < 0)
+            VIR_WARN("Failed to save status on vm %s", obj->def->name);
+        return;
+    }
+    priv->statusDirty = true;
+}
+
+/*
+ * obj must be locked before calling
+ *
+ * Write a status file queued by qemuDomainObjSaveStatusDeferred
+ * right away, dropping the reference held by the queued job.  Only
+ * meant for when driver->statusPool was freed with the job still
+ * pending.
+ */
+void
+qemuDomainObjFlushStatus(virQEMUDriverPtr driver, virDomainObjPtr obj)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+
+    if (!priv->statusDirty)
+        return;
+
+    priv->statusDirty = false;
+    if (virDomainObjIsActive(obj) &&
+        virDomainSaveStatus(driver->caps, driver->stateDir, obj) < 0)
+        VIR_WARN("Failed to save status on vm %s", obj->def->name);
+    ignore_value(virObjectUnref(obj));
+}
+
+/*
+ * Worker function of driver->statusPool
+ */
+void
+qemuDomainStatusWriter(void *data, void *opaque)
+{
+    virDomainObjPtr obj = data;
+    virQEMUDriverPtr driver = opaque;
+    qemuDomainObjPrivatePtr priv;
+
+    virDomainObjLock(obj);
+    priv = obj->privateData;
+
+    /* changes from now on need another write */
+    priv->statusDirty = false;
+
+    /* the domain may have been stopped, and its status file removed,
+     * since the write was queued */
+    if (virDomainObjIsActive(obj) &&
+        virDomainSaveStatus(driver->caps, driver->stateDir, obj) < 0)
         VIR_WARN("Failed to save status on vm %s", obj->def->name);
+
+    if (virObjectUnref(obj))
+        virDomainObjUnlock(obj);
+}
+
+static void
+qemuDomainObjSaveJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
+{
+    qemuDomainObjSaveStatusDeferred(driver, obj);
 }
 
 void
@@ -744,10 +913,74 @@ qemuDomainNestedJobAllowed(qemuDomainObjPrivatePtr priv, enum qemuDomainJob job)
     return !priv->job.asyncJob || (priv->job.mask & JOB_MASK(job)) != 0;
 }
 
+/* Whether @job may join the job currently running */
+static bool
+qemuDomainJobShareable(qemuDomainObjPrivatePtr priv, enum qemuDomainJob job)
+{
+    return job == QEMU_JOB_QUERY &&
+           priv->job.active == QEMU_JOB_QUERY &&
+           !priv->job.waiters;
+}
+
 bool
 qemuDomainJobAllowed(qemuDomainObjPrivatePtr priv, enum qemuDomainJob job)
 {
-    return !priv->job.active && qemuDomainNestedJobAllowed(priv, job);
+    return (!priv->job.active || qemuDomainJobShareable(priv, job)) &&
+           qemuDomainNestedJobAllowed(priv, job);
+}
+
+/* Account the time since @start a thread waited for a @job to the
+ * job wait statistics of the domain.  Returns that time, in ms.  */
+static unsigned long long
+qemuDomainObjRecordJobWait(qemuDomainObjPrivatePtr priv,
+                           enum qemuDomainJob job,
+                           unsigned long long start,
+                           bool failed)
+{
+    qemuDomainJobWaitStatsPtr stats = &priv->jobWait[job];
+    unsigned long long now;
+    unsigned long long elapsed;
+
+    /* the raw variant keeps the error of a failed wait */
+    if (virTimeMillisNowRaw(&now) < 0)
+        return 0;
+    elapsed = now > start ? now - start : 0;
+
+    if (failed)
+        stats->timeouts++;
+    else
+        stats->waits++;
+    stats->total += elapsed;
+    if (elapsed > stats->max)
+        stats->max = elapsed;
+    return elapsed;
+}
+
+/* Account the time since @start a @job was held to the job
+ * statistics of the domain, once it ends.  */
+static void
+qemuDomainObjRecordJobHeld(virDomainObjPtr obj,
+                           enum qemuDomainJob job,
+                           enum qemuDomainAsyncJob asyncJob,
+                           unsigned long long start)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+    qemuDomainJobWaitStatsPtr stats = &priv->jobWait[job];
+    unsigned long long now;
+    unsigned long long elapsed;
+
+    if (!start || virTimeMillisNowRaw(&now) < 0)
+        return;
+    elapsed = now > start ? now - start : 0;
+
+    stats->held += elapsed;
+    if (elapsed > stats->heldMax)
+        stats->heldMax = elapsed;
+
+    PROBE(QEMU_JOB_END,
+          "vm=%p job=%s asyncjob=%s held=%llu",
+          obj, qemuDomainJobTypeToString(job),
+          qemuDomainAsyncJobTypeToString(asyncJob), elapsed);
 }
 
 /* Give up waiting for mutex after 30 seconds */
@@ -767,6 +1000,7 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     qemuDomainObjPrivatePtr priv = obj->privateData;
     unsigned long long now;
     unsigned long long then;
+    unsigned long long waited;
     bool nested = job == QEMU_JOB_ASYNC_NESTED;
 
     priv->jobs_queued++;
@@ -775,6 +1009,11 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
         return -1;
     then = now + QEMU_JOB_WAIT_TIME;
 
+    PROBE(QEMU_JOB_BEGIN,
+          "vm=%p job=%s asyncjob=%s",
+          obj, qemuDomainJobTypeToString(job),
+          qemuDomainAsyncJobTypeToString(asyncJob));
+
     virObjectRef(obj);
     if (driver_locked)
         qemuDriverUnlock(driver);
@@ -790,9 +1029,20 @@ retry:
             goto error;
     }
 
-    while (priv->job.active) {
-        if (virCondWaitUntil(&priv->job.cond, &obj->lock, then) < 0)
-            goto error;
+    /* Queries keep joining each other until another job starts waiting */
+    if (priv->job.active && !qemuDomainJobShareable(priv, job)) {
+        if (job != QEMU_JOB_QUERY)
+            priv->job.waiters++;
+        while (priv->job.active && !qemuDomainJobShareable(priv, job)) {
+            if (virCondWaitUntil(&priv->job.cond, &obj->lock, then) < 0) {
+                if (job != QEMU_JOB_QUERY &&
+                    --priv->job.waiters == 0)
+                    virCondBroadcast(&priv->job.cond);
+                goto error;
+            }
+        }
+        if (job != QEMU_JOB_QUERY)
+            priv->job.waiters--;
     }
 
     /* No job is active but a new async job could have been started while obj
@@ -800,6 +1050,15 @@ retry:
     if (!nested && !qemuDomainNestedJobAllowed(priv, job))
         goto retry;
 
+    if (priv->job.active == QEMU_JOB_QUERY) {
+        VIR_DEBUG("Joining job: %s (async=%s, sharing with %d)",
+                  qemuDomainJobTypeToString(job),
+                  qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+                  priv->job.nqueries);
+        priv->job.nqueries++;
+        goto done;
+    }
+
     qemuDomainObjResetJob(priv);
 
     if (job != QEMU_JOB_ASYNC) {
@@ -808,6 +1067,10 @@ retry:
                    qemuDomainAsyncJobTypeToString(priv->job.asyncJob));
         priv->job.active = job;
         priv->job.owner = virThreadSelfID();
+        if (virTimeMillisNowRaw(&priv->job.acquired) < 0)
+            priv->job.acquired = 0;
+        if (job == QEMU_JOB_QUERY)
+            priv->job.nqueries = 1;
     } else {
         VIR_DEBUG("Starting async job: %s",
                   qemuDomainAsyncJobTypeToString(asyncJob));
@@ -817,6 +1080,13 @@ retry:
         priv->job.start = now;
     }
 
+done:
+    waited = qemuDomainObjRecordJobWait(priv, job, now, false);
+    PROBE(QEMU_JOB_ACQUIRE,
+          "vm=%p job=%s asyncjob=%s waited=%llu",
+          obj, qemuDomainJobTypeToString(job),
+          qemuDomainAsyncJobTypeToString(asyncJob), waited);
+
     if (driver_locked) {
         virDomainObjUnlock(obj);
         qemuDriverLock(driver);
@@ -850,6 +1120,11 @@ error:
         virReportSystemError(errno,
                              "%s", _("cannot acquire job mutex"));
     priv->jobs_queued--;
+    waited = qemuDomainObjRecordJobWait(priv, job, now, true);
+    PROBE(QEMU_JOB_FAIL,
+          "vm=%p job=%s asyncjob=%s waited=%llu",
+          obj, qemuDomainJobTypeToString(job),
+          qemuDomainAsyncJobTypeToString(asyncJob), waited);
     if (driver_locked) {
         virDomainObjUnlock(obj);
         qemuDriverLock(driver);
@@ -931,14 +1206,28 @@ bool qemuDomainObjEndJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
 
     priv->jobs_queued--;
 
+    /* The query job lasts until the last thread sharing it is done */
+    if (job == QEMU_JOB_QUERY && --priv->job.nqueries > 0) {
+        VIR_DEBUG("Leaving job: %s (%d threads still share it)",
+                  qemuDomainJobTypeToString(job), priv->job.nqueries);
+        return virObjectUnref(obj);
+    }
+
     VIR_DEBUG("Stopping job: %s (async=%s)",
               qemuDomainJobTypeToString(job),
               qemuDomainAsyncJobTypeToString(priv->job.asyncJob));
 
+    qemuDomainObjRecordJobHeld(obj, job, priv->job.asyncJob,
+                               priv->job.acquired);
     qemuDomainObjResetJob(priv);
     if (qemuDomainTrackJob(job))
         qemuDomainObjSaveJob(driver, obj);
-    virCondSignal(&priv->job.cond);
+    /* Any job but a query may have changed the definition */
+    if (job != QEMU_JOB_QUERY) {
+        virDomainObjInvalidateXMLCache(obj);
+        qemuDomainObjInvalidateStatsCache(obj);
+    }
+    virCondBroadcast(&priv->job.cond);
 
     return virObjectUnref(obj);
 }
@@ -953,8 +1242,12 @@ qemuDomainObjEndAsyncJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
     VIR_DEBUG("Stopping async job: %s",
               qemuDomainAsyncJobTypeToString(priv->job.asyncJob));
 
+    qemuDomainObjRecordJobHeld(obj, QEMU_JOB_ASYNC, priv->job.asyncJob,
+                               priv->job.start);
     qemuDomainObjResetAsyncJob(priv);
     qemuDomainObjSaveJob(driver, obj);
+    virDomainObjInvalidateXMLCache(obj);
+    qemuDomainObjInvalidateStatsCache(obj);
     virCondBroadcast(&priv->job.asyncCond);
 
     return virObjectUnref(obj);
@@ -969,6 +1262,46 @@ qemuDomainObjAbortAsyncJob(virDomainObjPtr obj)
               qemuDomainAsyncJobTypeToString(priv->job.asyncJob));
 
     priv->job.asyncAbort = true;
+    qemuDomainObjWakeAsyncJob(obj);
+}
+
+/*
+ * Let the thread running the async job of @obj look at its progress
+ * without waiting for the next poll, because of an event that may have
+ * completed, ended or cancelled it.  Must be called with @obj locked.
+ */
+void
+qemuDomainObjWakeAsyncJob(virDomainObjPtr obj)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+
+    if (priv->job.asyncJob != QEMU_ASYNC_JOB_NONE)
+        virCondBroadcast(&priv->job.progressCond);
+}
+
+/*
+ * Forget the monitor statistics cached for @obj, once something may
+ * have changed them.  Must be called with @obj locked.
+ */
+void
+qemuDomainObjInvalidateStatsCache(virDomainObjPtr obj)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+
+    qemuMonitorStatsClear(&priv->statsCache);
+    priv->statsCacheTime = 0;
+    priv->nmemStats = 0;
+    priv->memStatsTime = 0;
+}
+
+/*
+ * Close the cgroups kept open for statistics of @obj, before the
+ * groups are removed or re-created.  Must be called with @obj locked.
+ */
+void
+qemuDomainObjDropCgroups(virDomainObjPtr obj)
+{
+    qemuDomainObjPrivateFreeCgroups(obj->privateData);
 }
 
 static int
@@ -1007,6 +1340,9 @@ qemuDomainObjEnterMonitorInternal(virQEMUDriverPtr driver,
     qemuMonitorLock(priv->mon);
     virObjectRef(priv->mon);
     ignore_value(virTimeMillisNow(&priv->monStart));
+    PROBE(QEMU_MONITOR_ENTER,
+          "vm=%p mon=%p job=%s",
+          obj, priv->mon, qemuDomainJobTypeToString(priv->job.active));
     virDomainObjUnlock(obj);
     if (driver_locked)
         qemuDriverUnlock(driver);
@@ -1020,8 +1356,16 @@ qemuDomainObjExitMonitorInternal(virQEMUDriverPtr driver,
                                  virDomainObjPtr obj)
 {
     qemuDomainObjPrivatePtr priv = obj->privateData;
+    unsigned long long now;
     bool hasRefs;
 
+    if (priv->monStart && virTimeMillisNowRaw(&now) == 0) {
+        PROBE(QEMU_MONITOR_EXIT,
+              "vm=%p mon=%p held=%llu",
+              obj, priv->mon,
+              now > priv->monStart ? now - priv->monStart : 0);
+    }
+
     hasRefs = virObjectUnref(priv->mon);
 
     if (hasRefs)
@@ -1036,9 +1380,11 @@ qemuDomainObjExitMonitorInternal(virQEMUDriverPtr driver,
         priv->mon = NULL;
 
     if (priv->job.active == QEMU_JOB_ASYNC_NESTED) {
+        qemuDomainObjRecordJobHeld(obj, QEMU_JOB_ASYNC_NESTED,
+                                   priv->job.asyncJob, priv->job.acquired);
         qemuDomainObjResetJob(priv);
         qemuDomainObjSaveJob(driver, obj);
-        virCondSignal(&priv->job.cond);
+        virCondBroadcast(&priv->job.cond);
 
         virObjectUnref(obj);
     }
@@ -1332,13 +1678,34 @@ char *qemuDomainFormatXML(virQEMUDriverPtr driver,
                           unsigned int flags)
 {
     virDomainDefPtr def;
+    const char *cached;
+    char *ret;
+    char *copy;
 
     if ((flags & VIR_DOMAIN_XML_INACTIVE) && vm->newDef)
         def = vm->newDef;
     else
         def = vm->def;
 
-    return qemuDomainDefFormatXML(driver, def, flags);
+    /* The host CPU can change what UPDATE_CPU produces, so only the
+     * plain formats are served from the cache */
+    if (flags & VIR_DOMAIN_XML_UPDATE_CPU)
+        return qemuDomainDefFormatXML(driver, def, flags);
+
+    if ((cached = virDomainDefGetXMLCache(def, flags))) {
+        if (!(ret = strdup(cached)))
+            virReportOOMError();
+        return ret;
+    }
+
+    if (!(ret = qemuDomainDefFormatXML(driver, def, flags)))
+        return NULL;
+
+    /* Failing to cache is harmless, the next call formats again */
+    if ((copy = strdup(ret)))
+        virDomainDefSetXMLCache(def, flags, copy);
+
+    return ret;
 }
 
 char *
@@ -57,12 +57,17 @@
      JOB_MASK(QEMU_JOB_DESTROY) |       \
      JOB_MASK(QEMU_JOB_ABORT))
 
+/* How long monitor statistics fetched by one query job may be
+ * handed out to other queries (ms) */
+# define QEMU_DOMAIN_STATS_CACHE_TTL    1000
+
 /* Jobs which have to be tracked in domain state XML. */
 # define QEMU_DOMAIN_TRACK_JOBS         \
     (JOB_MASK(QEMU_JOB_DESTROY) |       \
      JOB_MASK(QEMU_JOB_ASYNC))
 
-/* Only 1 job is allowed at any time
+/* Only 1 job is allowed at any time, except for QEMU_JOB_QUERY which
+ * any number of threads may share as long as no other job waits.
  * A job includes *all* monitor commands, even those just querying
  * information, not merely actions */
 enum qemuDomainJob {
@@ -93,25 +98,87 @@ enum qemuDomainAsyncJob {
     QEMU_ASYNC_JOB_SAVE,
     QEMU_ASYNC_JOB_DUMP,
     QEMU_ASYNC_JOB_SNAPSHOT,
+    QEMU_ASYNC_JOB_BLOCK_FLATTEN,
 
     QEMU_ASYNC_JOB_LAST
 };
 VIR_ENUM_DECL(qemuDomainAsyncJob)
 
+/* Steps of starting a domain as timed by qemuProcessStart */
+enum qemuDomainStartStep {
+    QEMU_START_STEP_PREPARE,    /* Host devices, ports, log and disks */
+    QEMU_START_STEP_CGROUP,     /* Cgroup set up, done while labelling */
+    QEMU_START_STEP_CMDLINE,    /* Command line, taps and bridges */
+    QEMU_START_STEP_EXEC,       /* Running qemu up to the handshake */
+    QEMU_START_STEP_LABEL,      /* Waiting for labelling to finish */
+    QEMU_START_STEP_MONITOR,    /* Waiting for the monitor */
+    QEMU_START_STEP_SETUP,      /* vCPU threads, balloon, passwords, ... */
+
+    QEMU_START_STEP_LAST
+};
+VIR_ENUM_DECL(qemuDomainStartStep)
+
+/* Steps of preparing an incoming migration as timed by
+ * qemuMigrationPrepareAny */
+enum qemuMigrationPrepareStep {
+    QEMU_MIGRATION_PREPARE_PARSE,    /* Parsing the XML, migrate hook */
+    QEMU_MIGRATION_PREPARE_DEFINE,   /* Adding the domain, eating cookie */
+    QEMU_MIGRATION_PREPARE_START,    /* qemuProcessStart with -incoming */
+    QEMU_MIGRATION_PREPARE_INCOMING, /* Tunnel, NBD server, capabilities */
+
+    QEMU_MIGRATION_PREPARE_LAST
+};
+VIR_ENUM_DECL(qemuMigrationPrepareStep)
+
 struct qemuDomainJobObj {
     virCond cond;                       /* Use to coordinate jobs */
     enum qemuDomainJob active;          /* Currently running job */
     int owner;                          /* Thread which set current job */
+    int nqueries;                       /* Threads sharing the current
+                                           QEMU_JOB_QUERY */
+    int waiters;                        /* Other jobs waiting for the current
+                                           one, which new queries must not
+                                           join anymore */
 
     virCond asyncCond;                  /* Use to coordinate with async jobs */
+    virCond progressCond;               /* Wakes the async job up when its
+                                           progress may have changed */
     enum qemuDomainAsyncJob asyncJob;   /* Currently active async job */
     int asyncOwner;                     /* Thread which set current async job */
     int phase;                          /* Job phase (mainly for migrations) */
     unsigned long long mask;            /* Jobs allowed during async job */
     unsigned long long start;           /* When the async job started */
+    unsigned long long acquired;        /* When the current job started */
     bool dump_memory_only;              /* use dump-guest-memory to do dump */
     virDomainJobInfo info;              /* Async job progress data */
+    const char *path;                   /* File written by the async job */
+    unsigned long long pathOffset;      /* Where the job's data starts */
     bool asyncAbort;                    /* abort of async job requested */
+    unsigned long long migDowntime;     /* Max downtime of the migration (ms),
+                                           0 if left to qemu's default */
+    unsigned int migThrottle;           /* Percent of vcpu time taken off
+                                           the guest to converge */
+    bool migScheduled;                  /* Outgoing migration admitted by
+                                           the host migration scheduler */
+    unsigned long migBandwidth;         /* Max bandwidth asked for the
+                                           migration (MiB/s), 0 to follow
+                                           migMaxBandwidth */
+    unsigned long migSpeed;             /* Bandwidth set in qemu (MiB/s) */
+    qemuMonitorMigrationStatus migStatus; /* Last progress of an active
+                                             migration reported by qemu */
+};
+
+/* Time threads spent in qemuDomainObjBeginJob* waiting for a job,
+ * and time the jobs were then held for */
+typedef struct _qemuDomainJobWaitStats qemuDomainJobWaitStats;
+typedef qemuDomainJobWaitStats *qemuDomainJobWaitStatsPtr;
+struct _qemuDomainJobWaitStats {
+    unsigned long long waits;       /* Jobs acquired */
+    unsigned long long timeouts;    /* Waits which failed */
+    unsigned long long total;       /* ms, including failed waits */
+    unsigned long long max;         /* ms */
+    unsigned long long held;        /* ms, from acquiring to ending jobs */
+    unsigned long long heldMax;     /* ms */
 };
 
 typedef struct _qemuDomainPCIAddressSet qemuDomainPCIAddressSet;
@@ -142,6 +209,9 @@ struct _qemuDomainObjPrivate {
     int nvcpupids;
     int *vcpupids;
 
+    int niothreadpids;
+    int *iothreadpids;
+
     qemuDomainPCIAddressSetPtr pciaddrs;
     int persistentAddrs;
 
@@ -154,12 +224,55 @@ struct _qemuDomainObjPrivate {
 
     unsigned long migMaxBandwidth;
     char *origname;
+    int nbdPort; /* Port of the NBD server of an incoming migration */
 
     virConsolesPtr cons;
 
     qemuDomainCleanupCallback *cleanupCallbacks;
     size_t ncleanupCallbacks;
     size_t ncleanupCallbacks_max;
+
+    /* status file write queued on driver->statusPool */
+    bool statusDirty;
+
+    /* Monitor statistics recently fetched by a query job */
+    qemuMonitorStats statsCache;
+    unsigned long long statsCacheTime;
+
+    /* Balloon statistics, kept for driver->memoryStatsPeriod */
+    virDomainMemoryStatStruct memStats[VIR_DOMAIN_MEMORY_STAT_NR];
+    unsigned int nmemStats;
+    unsigned long long memStatsTime;
+
+    /* Memory overcommit manager: last balloon target it set, in KiB,
+     * and the number of times it inflated and deflated the balloon */
+    unsigned long long memOvercommitTarget;
+    unsigned long long memOvercommitInflations;
+    unsigned long long memOvercommitDeflations;
+
+    /* CPU quota controller: per vCPU quota it last set, in usecs (0 if
+     * none), and the throttled periods count seen on its previous pass */
+    long long cpuQuota;
+    unsigned long long cpuQuotaThrottled;
+
+    /* Job wait statistics indexed by enum qemuDomainJob */
+    qemuDomainJobWaitStats jobWait[QEMU_JOB_LAST];
+
+    /* Time (ms) the steps of the last qemuProcessStart took, indexed by
+     * enum qemuDomainStartStep, and how long the security labelling and
+     * the emulator capabilities lookup running alongside them took */
+    unsigned long long startSteps[QEMU_START_STEP_LAST];
+    unsigned long long startLabel;
+    unsigned long long startCaps;
+
+    /* Time (ms) the steps of preparing the last incoming migration
+     * took, indexed by enum qemuMigrationPrepareStep */
+    unsigned long long migPrepareSteps[QEMU_MIGRATION_PREPARE_LAST];
+
+    /* Cgroups kept open for statistics, see qemuGetStatsCgroup */
+    virCgroupPtr cgroup;
+    virCgroupPtr *vcpuCgroups;
+    size_t nvcpuCgroups;
 };
 
 struct qemuDomainWatchdogEvent
@@ -206,6 +319,15 @@ bool qemuDomainObjEndAsyncJob(virQEMUDriverPtr driver,
                               virDomainObjPtr obj)
     ATTRIBUTE_RETURN_CHECK;
 void qemuDomainObjAbortAsyncJob(virDomainObjPtr obj);
+void qemuDomainObjWakeAsyncJob(virDomainObjPtr obj);
+void qemuDomainObjInvalidateStatsCache(virDomainObjPtr obj);
+void qemuDomainObjDropCgroups(virDomainObjPtr obj);
+void qemuDomainObjSaveStatusDeferred(virQEMUDriverPtr driver,
+                                     virDomainObjPtr obj);
+void qemuDomainObjFlushStatus(virQEMUDriverPtr driver,
+                              virDomainObjPtr obj);
+void qemuDomainStatusWriter(void *data, void *opaque);
+
 void qemuDomainObjSetJobPhase(virQEMUDriverPtr driver,
                               virDomainObjPtr obj,
                               int phase);
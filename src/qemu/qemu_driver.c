@@ -91,6 +91,8 @@
 #include "virnodesuspend.h"
 #include "virtime.h"
 #include "virtypedparam.h"
+#include "virprocess.h"
+#include "virstring.h"
 #include "bitmap.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
@@ -111,6 +113,13 @@
 #define QEMU_SCHED_MIN_QUOTA               1000LL
 #define QEMU_SCHED_MAX_QUOTA  18446744073709551LL
 
+/* How long rebuilt capabilities are reused, in milliseconds */
+#define QEMU_CAPS_REFRESH_INTERVAL 5000
+
+/* How often guests with automatic NUMA placement are rebalanced, in
+ * milliseconds */
+#define QEMU_NUMA_REBALANCE_INTERVAL (60 * 1000)
+
 #if HAVE_LINUX_KVM_H
 # include <linux/kvm.h>
 #endif
@@ -129,7 +138,7 @@
 # define KVM_CAP_NR_VCPUS 9       /* returns max vcpus per vm */
 #endif
 
-#define QEMU_NB_BLKIO_PARAM  2
+#define QEMU_NB_BLKIO_PARAM  6
 
 #define QEMU_NB_BANDWIDTH_PARAM 6
 
@@ -148,6 +157,13 @@ static void qemuDomainManagedSaveLoad(void *payload,
                                       const void *n ATTRIBUTE_UNUSED,
                                       void *opaque);
 
+static qemuMonitorStatsPtr qemuDomainGetStatsMonitor(virQEMUDriverPtr driver,
+                                                     virDomainObjPtr dom,
+                                                     unsigned int stats);
+
+static int qemuDomainMemoryStatsFetch(virQEMUDriverPtr driver,
+                                      virDomainObjPtr vm);
+
 
 virQEMUDriverPtr qemu_driver = NULL;
 
@@ -168,7 +184,7 @@ static int
 qemuVMFilterRebuild(virConnectPtr conn ATTRIBUTE_UNUSED,
                     virHashIterator iter, void *data)
 {
-    virHashForEach(qemu_driver->domains.objs, iter, data);
+    virDomainObjListForEach(&qemu_driver->domains, iter, data);
 
     return 0;
 }
@@ -184,6 +200,16 @@ static virNWFilterCallbackDriver qemuCallbackDriver = {
 struct qemuAutostartData {
     virQEMUDriverPtr driver;
     virConnectPtr conn;
+
+    virMutex lock;
+    virCond cond;
+    size_t pending;     /* Domains of the current priority not done yet */
+    size_t started;
+};
+
+struct qemuAutostartEntry {
+    virDomainObjPtr vm;
+    int priority;
 };
 
 /**
@@ -225,7 +251,8 @@ qemuDomObjFromDomainDriver(virDomainPtr domain, virQEMUDriverPtr *drv)
  * @domain: Domain pointer that has to be looked up
  *
  * This function looks up @domain and returns the appropriate
- * virDomainObjPtr. The driver is unlocked after the call.
+ * virDomainObjPtr. The domain list has its own lock, so the
+ * driver lock is never taken.
  *
  * Returns the domain object which is locked on success, NULL
  * otherwise. The driver remains unlocked after the call.
@@ -233,13 +260,16 @@ qemuDomObjFromDomainDriver(virDomainPtr domain, virQEMUDriverPtr *drv)
 static virDomainObjPtr
 qemuDomObjFromDomain(virDomainPtr domain)
 {
+    virQEMUDriverPtr driver = domain->conn->privateData;
     virDomainObjPtr vm;
-    virQEMUDriverPtr driver;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
 
-    if (!(vm = qemuDomObjFromDomainDriver(domain, &driver)))
+    if (!(vm = virDomainFindByUUID(&driver->domains, domain->uuid))) {
+        virUUIDFormat(domain->uuid, uuidstr);
+        virReportError(VIR_ERR_NO_DOMAIN,
+                       _("no domain with matching uuid '%s'"), uuidstr);
         return NULL;
-
-    qemuDriverUnlock(driver);
+    }
 
     return vm;
 }
@@ -278,18 +308,23 @@ qemuSnapObjFromSnapshot(virDomainObjPtr vm,
     return qemuSnapObjFromName(vm, snapshot->name);
 }
 
+/*
+ * Autostart one domain, as a job of the pool set up by
+ * qemuAutostartDomains which passes a reference to @jobdata.
+ */
 static void
-qemuAutostartDomain(void *payload, const void *name ATTRIBUTE_UNUSED,
-                    void *opaque)
+qemuAutostartDomain(void *jobdata, void *opaque)
 {
-    virDomainObjPtr vm = payload;
+    virDomainObjPtr vm = jobdata;
     struct qemuAutostartData *data = opaque;
     virErrorPtr err;
     int flags = 0;
+    bool started = false;
 
     if (data->driver->autoStartBypassCache)
         flags |= VIR_DOMAIN_START_BYPASS_CACHE;
 
+    qemuDriverLock(data->driver);
     virDomainObjLock(vm);
     virResetLastError();
     if (vm->autostart &&
@@ -308,6 +343,8 @@ qemuAutostartDomain(void *payload, const void *name ATTRIBUTE_UNUSED,
             VIR_ERROR(_("Failed to autostart VM '%s': %s"),
                       vm->def->name,
                       err ? err->message : _("unknown error"));
+        } else {
+            started = true;
         }
 
         if (qemuDomainObjEndJob(data->driver, vm) == 0)
@@ -315,11 +352,40 @@ qemuAutostartDomain(void *payload, const void *name ATTRIBUTE_UNUSED,
     }
 
 cleanup:
-    if (vm)
+    if (vm && virObjectUnref(vm))
         virDomainObjUnlock(vm);
+    qemuDriverUnlock(data->driver);
+
+    virMutexLock(&data->lock);
+    data->pending--;
+    if (started)
+        data->started++;
+    virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
 }
 
+static int
+qemuAutostartEntryCompare(const void *a, const void *b)
+{
+    const struct qemuAutostartEntry *ea = a;
+    const struct qemuAutostartEntry *eb = b;
+
+    /* highest priority first */
+    if (ea->priority > eb->priority)
+        return -1;
+    if (ea->priority < eb->priority)
+        return 1;
+    return 0;
+}
 
+/*
+ * Start every inactive domain marked for autostart.  Domains with the
+ * same <autostart priority='...'/> are started in parallel by a pool
+ * of auto_start_concurrency workers, so that one waiting for its
+ * monitor doesn't hold up the others, and each priority only begins
+ * once all domains of the higher one are done.  Must be called with
+ * the driver unlocked.
+ */
 static void
 qemuAutostartDomains(virQEMUDriverPtr driver)
 {
@@ -332,676 +398,1468 @@ qemuAutostartDomains(virQEMUDriverPtr driver)
                                         "qemu:///system" :
                                         "qemu:///session");
     /* Ignoring NULL conn which is mostly harmless here */
-    struct qemuAutostartData data = { driver, conn };
+    struct qemuAutostartData data = { .driver = driver, .conn = conn };
+    virDomainObjPtr *vms = NULL;
+    struct qemuAutostartEntry *entries = NULL;
+    virThreadPoolPtr pool = NULL;
+    size_t nvms = 0;
+    size_t nworkers;
+    size_t i, j;
+    unsigned long long start = 0;
+    unsigned long long now = 0;
 
-    qemuDriverLock(driver);
-    virHashForEach(driver->domains.objs, qemuAutostartDomain, &data);
-    qemuDriverUnlock(driver);
+    if (virMutexInit(&data.lock) < 0) {
+        VIR_ERROR(_("Unable to initialize autostart mutex"));
+        goto cleanup_conn;
+    }
+    if (virCondInit(&data.cond) < 0) {
+        VIR_ERROR(_("Unable to initialize autostart condition"));
+        virMutexDestroy(&data.lock);
+        goto cleanup_conn;
+    }
 
-    if (conn)
-        virConnectClose(conn);
-}
+    if (virDomainObjListCollect(&driver->domains, &vms, &nvms,
+                                VIR_CONNECT_LIST_DOMAINS_AUTOSTART |
+                                VIR_CONNECT_LIST_DOMAINS_INACTIVE) < 0)
+        goto cleanup;
 
-static int
-qemuSecurityInit(virQEMUDriverPtr driver)
-{
-    char **names;
-    virSecurityManagerPtr mgr = NULL;
-    virSecurityManagerPtr stack = NULL;
+    if (nvms == 0)
+        goto cleanup;
 
-    if (driver->securityDriverNames &&
-        driver->securityDriverNames[0]) {
-        names = driver->securityDriverNames;
-        while (names && *names) {
-            if (!(mgr = virSecurityManagerNew(*names,
-                                              QEMU_DRIVER_NAME,
-                                              driver->allowDiskFormatProbing,
-                                              driver->securityDefaultConfined,
-                                              driver->securityRequireConfined)))
-                goto error;
-            if (!stack) {
-                if (!(stack = virSecurityManagerNewStack(mgr)))
-                    goto error;
-            } else {
-                if (virSecurityManagerStackAddNested(stack, mgr) < 0)
-                    goto error;
-            }
-            mgr = NULL;
-            names++;
+    if (VIR_ALLOC_N(entries, nvms) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0; i < nvms; i++) {
+        virDomainObjLock(vms[i]);
+        entries[i].vm = vms[i];
+        entries[i].priority = vms[i]->def->autostartPriority;
+        virDomainObjUnlock(vms[i]);
+    }
+    VIR_FREE(vms);
+
+    qsort(entries, nvms, sizeof(*entries), qemuAutostartEntryCompare);
+
+    if ((nworkers = driver->autoStartConcurrency) == 0) {
+        int ncpus = nodeGetCPUCount();
+
+        if (ncpus < 1) {
+            virResetLastError();
+            ncpus = 1;
         }
-    } else {
-        if (!(mgr = virSecurityManagerNew(NULL,
-                                          QEMU_DRIVER_NAME,
-                                          driver->allowDiskFormatProbing,
-                                          driver->securityDefaultConfined,
-                                          driver->securityRequireConfined)))
-            goto error;
-        if (!(stack = virSecurityManagerNewStack(mgr)))
-            goto error;
-        mgr = NULL;
+        nworkers = ncpus;
     }
+    if (nworkers > nvms)
+        nworkers = nvms;
 
-    if (driver->privileged) {
-        if (!(mgr = virSecurityManagerNewDAC(QEMU_DRIVER_NAME,
-                                             driver->user,
-                                             driver->group,
-                                             driver->allowDiskFormatProbing,
-                                             driver->securityDefaultConfined,
-                                             driver->securityRequireConfined,
-                                             driver->dynamicOwnership)))
-            goto error;
-        if (!stack) {
-            if (!(stack = virSecurityManagerNewStack(mgr)))
-                goto error;
-        } else {
-            if (virSecurityManagerStackAddNested(stack, mgr) < 0)
-                goto error;
+    if (!(pool = virThreadPoolNew(nworkers, nworkers, 0,
+                                  qemuAutostartDomain, &data))) {
+        VIR_ERROR(_("Unable to create autostart thread pool"));
+        goto cleanup;
+    }
+
+    VIR_INFO("Autostarting %zu domains using %zu workers", nvms, nworkers);
+    ignore_value(virTimeMillisNow(&start));
+
+    virMutexLock(&data.lock);
+    for (i = 0; i < nvms; i = j) {
+        for (j = i; j < nvms && entries[j].priority == entries[i].priority; j++) {
+            if (virThreadPoolSendJob(pool, 0, entries[j].vm) < 0) {
+                VIR_ERROR(_("Unable to queue autostart of a domain"));
+                continue;
+            }
+            /* the job owns the reference now */
+            entries[j].vm = NULL;
+            data.pending++;
+        }
+
+        while (data.pending) {
+            if (virCondWait(&data.cond, &data.lock) < 0) {
+                VIR_ERROR(_("Unable to wait for autostart to complete"));
+                break;
+            }
         }
-        mgr = NULL;
     }
+    virMutexUnlock(&data.lock);
 
-    driver->securityManager = stack;
-    return 0;
+    if (virTimeMillisNow(&now) < 0)
+        now = start;
+    VIR_INFO("Autostart complete: started %zu of %zu domains in %llu ms",
+             data.started, nvms, now - start);
 
-error:
-    VIR_ERROR(_("Failed to initialize security drivers"));
-    virSecurityManagerFree(stack);
-    virSecurityManagerFree(mgr);
-    return -1;
+cleanup:
+    /* Lets the workers finish whatever could still be running */
+    virThreadPoolFree(pool);
+    for (i = 0; i < nvms; i++) {
+        if (vms)
+            virObjectUnref(vms[i]);
+        else if (entries[i].vm)
+            virObjectUnref(entries[i].vm);
+    }
+    VIR_FREE(vms);
+    VIR_FREE(entries);
+    ignore_value(virCondDestroy(&data.cond));
+    virMutexDestroy(&data.lock);
+
+cleanup_conn:
+    if (conn)
+        virConnectClose(conn);
 }
 
-
-static virCapsPtr
-qemuCreateCapabilities(virQEMUDriverPtr driver)
+static void
+qemuNUMARebalanceWorker(void *data ATTRIBUTE_UNUSED, void *opaque)
 {
+    virQEMUDriverPtr driver = opaque;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
     size_t i;
-    virCapsPtr caps;
-    virSecurityManagerPtr *sec_managers = NULL;
-    /* Security driver data */
-    const char *doi, *model;
 
-    /* Basic host arch / guest machine capabilities */
-    if (!(caps = qemuCapsInit(driver->capsCache))) {
-        virReportOOMError();
-        return NULL;
-    }
+    if (virDomainObjListCollect(&driver->domains, &vms, &nvms,
+                                VIR_CONNECT_LIST_DOMAINS_ACTIVE) < 0)
+        return;
 
-    if (driver->allowDiskFormatProbing) {
-        caps->defaultDiskDriverName = NULL;
-        caps->defaultDiskDriverType = VIR_STORAGE_FILE_AUTO;
-    } else {
-        caps->defaultDiskDriverName = "qemu";
-        caps->defaultDiskDriverType = VIR_STORAGE_FILE_RAW;
-    }
+    for (i = 0; i < nvms; i++) {
+        virDomainObjPtr vm = vms[i];
 
-    qemuDomainSetPrivateDataHooks(caps);
-    qemuDomainSetNamespaceHooks(caps);
+        virDomainObjLock(vm);
+        if (vm->def->placement_mode != VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO)
+            goto next;
 
-    if (virGetHostUUID(caps->host.host_uuid)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       "%s", _("cannot get the host uuid"));
-        goto err_exit;
-    }
+        if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+            goto next;
 
-    /* access sec drivers and create a sec model for each one */
-    sec_managers = virSecurityManagerGetNested(driver->securityManager);
-    if (sec_managers == NULL) {
-        goto err_exit;
+        if (virDomainObjIsActive(vm) &&
+            qemuProcessRebalanceNUMA(driver, vm,
+                                     driver->numaRebalanceThreshold) < 0) {
+            virErrorPtr err = virGetLastError();
+            VIR_WARN("Unable to rebalance domain %s: %s", vm->def->name,
+                     err && err->message ? err->message : _("unknown error"));
+            virResetLastError();
+        }
+
+        /* Safe to ignore value, we hold a reference from the list */
+        ignore_value(qemuDomainObjEndJob(driver, vm));
+
+    next:
+        virDomainObjUnlock(vm);
+        virObjectUnref(vm);
     }
 
-    /* calculate length */
-    for (i = 0; sec_managers[i]; i++)
-        ;
-    caps->host.nsecModels = i;
+    VIR_FREE(vms);
+}
 
-    if (VIR_ALLOC_N(caps->host.secModels, caps->host.nsecModels) < 0)
-        goto no_memory;
+static void
+qemuNUMARebalanceTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    virThreadPoolStats stats;
 
-    for (i = 0; sec_managers[i]; i++) {
-        doi = virSecurityManagerGetDOI(sec_managers[i]);
-        model = virSecurityManagerGetModel(sec_managers[i]);
-        if (!(caps->host.secModels[i].model = strdup(model)))
-            goto no_memory;
-        if (!(caps->host.secModels[i].doi = strdup(doi)))
-            goto no_memory;
-        VIR_DEBUG("Initialized caps for security driver \"%s\" with "
-                  "DOI \"%s\"", model, doi);
-    }
-    VIR_FREE(sec_managers);
+    /* Don't pile up passes behind one that is still running */
+    virThreadPoolGetStats(driver->numaRebalancePool, &stats);
+    if (stats.jobQueueDepth > 0)
+        return;
 
-    return caps;
+    if (virThreadPoolSendJob(driver->numaRebalancePool, 0, NULL) < 0)
+        VIR_WARN("Unable to schedule NUMA rebalancing");
+}
 
-no_memory:
-    virReportOOMError();
-err_exit:
-    VIR_FREE(sec_managers);
-    virCapabilitiesFree(caps);
-    return NULL;
+/* Whether the memory overcommit manager looks after @def */
+static bool
+qemuMemOvercommitIsManaged(virDomainDefPtr def)
+{
+    return def->mem.min_guarantee &&
+           def->memballoon &&
+           def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO;
 }
 
+typedef struct _qemuMemOvercommitEntry qemuMemOvercommitEntry;
+typedef qemuMemOvercommitEntry *qemuMemOvercommitEntryPtr;
+struct _qemuMemOvercommitEntry {
+    virDomainObjPtr vm;
+    unsigned long long cur;     /* current balloon size, KiB */
+    unsigned long long unused;  /* memory left unused by the guest, KiB */
+    unsigned long long target;  /* size decided for this pass, KiB */
+};
 
-static void
-qemuDomainSnapshotLoad(void *payload,
-                       const void *name ATTRIBUTE_UNUSED,
-                       void *data)
+static int
+qemuMemOvercommitCompareUnused(const void *a, const void *b)
 {
-    virDomainObjPtr vm = (virDomainObjPtr)payload;
-    char *baseDir = (char *)data;
-    char *snapDir = NULL;
-    DIR *dir = NULL;
-    struct dirent *entry;
-    char *xmlStr;
-    int ret;
-    char *fullpath;
-    virDomainSnapshotDefPtr def = NULL;
-    virDomainSnapshotObjPtr snap = NULL;
-    virDomainSnapshotObjPtr current = NULL;
-    char ebuf[1024];
-    unsigned int flags = (VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE |
-                          VIR_DOMAIN_SNAPSHOT_PARSE_DISKS |
-                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL);
+    const qemuMemOvercommitEntry *ea = a;
+    const qemuMemOvercommitEntry *eb = b;
 
-    virDomainObjLock(vm);
-    if (virAsprintf(&snapDir, "%s/%s", baseDir, vm->def->name) < 0) {
-        VIR_ERROR(_("Failed to allocate memory for snapshot directory for domain %s"),
-                   vm->def->name);
+    if (ea->unused == eb->unused)
+        return 0;
+    return ea->unused < eb->unused ? 1 : -1;
+}
+
+/*
+ * Fill in the total and available (free, buffers and page cache)
+ * memory of the host, in KiB
+ */
+static int
+qemuMemOvercommitHostMemory(unsigned long long *total,
+                            unsigned long long *avail)
+{
+    virNodeMemoryStatsPtr params = NULL;
+    int nparams = 0;
+    int ret = -1;
+    int i;
+
+    if (nodeGetMemoryStats(NULL, VIR_NODE_MEMORY_STATS_ALL_CELLS,
+                           NULL, &nparams, 0) < 0)
         goto cleanup;
-    }
 
-    VIR_INFO("Scanning for snapshots for domain %s in %s", vm->def->name,
-             snapDir);
+    if (VIR_ALLOC_N(params, nparams) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
 
-    if (!(dir = opendir(snapDir))) {
-        if (errno != ENOENT)
-            VIR_ERROR(_("Failed to open snapshot directory %s for domain %s: %s"),
-                      snapDir, vm->def->name,
-                      virStrerror(errno, ebuf, sizeof(ebuf)));
+    if (nodeGetMemoryStats(NULL, VIR_NODE_MEMORY_STATS_ALL_CELLS,
+                           params, &nparams, 0) < 0)
         goto cleanup;
+
+    *total = *avail = 0;
+    for (i = 0; i < nparams; i++) {
+        if (STREQ(params[i].field, VIR_NODE_MEMORY_STATS_TOTAL))
+            *total = params[i].value;
+        else if (STREQ(params[i].field, VIR_NODE_MEMORY_STATS_FREE) ||
+                 STREQ(params[i].field, VIR_NODE_MEMORY_STATS_BUFFERS) ||
+                 STREQ(params[i].field, VIR_NODE_MEMORY_STATS_CACHED))
+            *avail += params[i].value;
     }
 
-    while ((entry = readdir(dir))) {
-        if (entry->d_name[0] == '.')
-            continue;
+    if (!*total) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("unable to determine host memory size"));
+        goto cleanup;
+    }
 
-        /* NB: ignoring errors, so one malformed config doesn't
-           kill the whole process */
-        VIR_INFO("Loading snapshot file '%s'", entry->d_name);
+    ret = 0;
 
-        if (virAsprintf(&fullpath, "%s/%s", snapDir, entry->d_name) < 0) {
-            VIR_ERROR(_("Failed to allocate memory for path"));
-            continue;
-        }
+cleanup:
+    VIR_FREE(params);
+    return ret;
+}
 
-        ret = virFileReadAll(fullpath, 1024*1024*1, &xmlStr);
-        if (ret < 0) {
-            /* Nothing we can do here, skip this one */
-            VIR_ERROR(_("Failed to read snapshot file %s: %s"), fullpath,
-                      virStrerror(errno, ebuf, sizeof(ebuf)));
-            VIR_FREE(fullpath);
-            continue;
-        }
-
-        def = virDomainSnapshotDefParseString(xmlStr, qemu_driver->caps,
-                                              QEMU_EXPECTED_VIRT_TYPES,
-                                              flags);
-        if (def == NULL) {
-            /* Nothing we can do here, skip this one */
-            VIR_ERROR(_("Failed to parse snapshot XML from file '%s'"),
-                      fullpath);
-            VIR_FREE(fullpath);
-            VIR_FREE(xmlStr);
-            continue;
-        }
-
-        snap = virDomainSnapshotAssignDef(vm->snapshots, def);
-        if (snap == NULL) {
-            virDomainSnapshotDefFree(def);
-        } else if (snap->def->current) {
-            current = snap;
-            if (!vm->current_snapshot)
-                vm->current_snapshot = snap;
-        }
+/* Number of pages currently shared by KSM, 0 if unknown */
+static unsigned long long
+qemuMemOvercommitSharedPages(void)
+{
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    unsigned long long ret = 0;
+    int i;
 
-        VIR_FREE(fullpath);
-        VIR_FREE(xmlStr);
+    if (nodeGetMemoryParameters(NULL, NULL, &nparams, 0) < 0 ||
+        VIR_ALLOC_N(params, nparams) < 0 ||
+        nodeGetMemoryParameters(NULL, params, &nparams, 0) < 0) {
+        virResetLastError();
+        goto cleanup;
     }
 
-    if (vm->current_snapshot != current) {
-        VIR_ERROR(_("Too many snapshots claiming to be current for domain %s"),
-                  vm->def->name);
-        vm->current_snapshot = NULL;
+    for (i = 0; i < nparams; i++) {
+        if (STREQ(params[i].field, VIR_NODE_MEMORY_SHARED_PAGES_SHARING))
+            ret = params[i].value.ul;
     }
 
-    if (virDomainSnapshotUpdateRelations(vm->snapshots) < 0)
-        VIR_ERROR(_("Snapshots have inconsistent relations for domain %s"),
-                  vm->def->name);
-
-    /* FIXME: qemu keeps internal track of snapshots.  We can get access
-     * to this info via the "info snapshots" monitor command for running
-     * domains, or via "qemu-img snapshot -l" for shutoff domains.  It would
-     * be nice to update our internal state based on that, but there is a
-     * a problem.  qemu doesn't track all of the same metadata that we do.
-     * In particular we wouldn't be able to fill in the <parent>, which is
-     * pretty important in our metadata.
-     */
-
-    virResetLastError();
-
 cleanup:
-    if (dir)
-        closedir(dir);
-    VIR_FREE(snapDir);
-    virDomainObjUnlock(vm);
+    VIR_FREE(params);
+    return ret;
 }
 
-
-static void
-qemuDomainNetsRestart(void *payload,
-                      const void *name ATTRIBUTE_UNUSED,
-                      void *data ATTRIBUTE_UNUSED)
+/*
+ * Refresh the balloon statistics of @vm unless the cached ones are
+ * still current, and fill in @entry from them.  Returns 0 when the
+ * guest reports how much memory it leaves unused, -1 otherwise.
+ */
+static int
+qemuMemOvercommitSample(virQEMUDriverPtr driver,
+                        virDomainObjPtr vm,
+                        qemuMemOvercommitEntryPtr entry)
 {
-    int i;
-    virDomainObjPtr vm = (virDomainObjPtr)payload;
-    virDomainDefPtr def = vm->def;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long now;
+    bool have_unused = false;
+    int ret = -1;
+    unsigned int i;
 
-    virDomainObjLock(vm);
+    if (virTimeMillisNow(&now) < 0) {
+        virResetLastError();
+        now = 0;
+    }
 
-    for (i = 0; i < def->nnets; i++) {
-        virDomainNetDefPtr net = def->nets[i];
-        if (virDomainNetGetActualType(net) == VIR_DOMAIN_NET_TYPE_DIRECT &&
-            virDomainNetGetActualDirectMode(net) == VIR_NETDEV_MACVLAN_MODE_VEPA) {
-            VIR_DEBUG("VEPA mode device %s active in domain %s. Reassociating.",
-                      net->ifname, def->name);
-            ignore_value(virNetDevMacVLanRestartWithVPortProfile(net->ifname,
-                                                                 &net->mac,
-                                                                 virDomainNetGetActualDirectDev(net),
-                                                                 def->uuid,
-                                                                 virDomainNetGetActualVirtPortProfile(net),
-                                                                 VIR_NETDEV_VPORT_PROFILE_OP_CREATE));
+    if (!now || !priv->memStatsTime ||
+        now >= priv->memStatsTime + driver->memoryStatsPeriod * 1000ULL) {
+        if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+            return -1;
+
+        if (virDomainObjIsActive(vm))
+            ret = qemuDomainMemoryStatsFetch(driver, vm);
+
+        /* Safe to ignore value, we hold a reference from the list */
+        ignore_value(qemuDomainObjEndJob(driver, vm));
+        if (ret < 0)
+            return -1;
+    }
+
+    entry->cur = vm->def->mem.cur_balloon;
+    for (i = 0; i < priv->nmemStats; i++) {
+        switch (priv->memStats[i].tag) {
+        case VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON:
+            entry->cur = priv->memStats[i].val;
+            break;
+        case VIR_DOMAIN_MEMORY_STAT_UNUSED:
+            entry->unused = priv->memStats[i].val;
+            have_unused = true;
+            break;
         }
     }
+    entry->target = entry->cur;
 
-    virDomainObjUnlock(vm);
+    return have_unused ? 0 : -1;
 }
 
-
+/* Move the balloon of @entry->vm to @entry->target */
 static void
-qemuDomainFindMaxID(void *payload,
-                    const void *name ATTRIBUTE_UNUSED,
-                    void *data)
+qemuMemOvercommitApply(virQEMUDriverPtr driver,
+                       qemuMemOvercommitEntryPtr entry)
 {
-    virDomainObjPtr vm = payload;
-    int *driver_maxid = data;
+    virDomainObjPtr vm = entry->vm;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    int r;
 
-    if (vm->def->id >= *driver_maxid)
-        *driver_maxid = vm->def->id + 1;
-}
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        return;
 
+    if (!virDomainObjIsActive(vm))
+        goto endjob;
 
-/**
- * qemuStartup:
- *
- * Initialization function for the QEmu daemon
+    qemuDomainObjEnterMonitor(driver, vm);
+    r = qemuMonitorSetBalloon(priv->mon, entry->target);
+    qemuDomainObjExitMonitor(driver, vm);
+    virDomainAuditMemory(vm, entry->cur, entry->target, "update", r == 1);
+
+    if (r == 1) {
+        priv->memOvercommitTarget = entry->target;
+        if (entry->target < entry->cur)
+            priv->memOvercommitInflations++;
+        else
+            priv->memOvercommitDeflations++;
+        VIR_INFO("Memory overcommit: balloon of domain %s moved from "
+                 "%llu KiB to %llu KiB", vm->def->name,
+                 entry->cur, entry->target);
+    } else {
+        virResetLastError();
+        VIR_WARN("Unable to resize balloon of domain %s", vm->def->name);
+    }
+
+endjob:
+    /* Safe to ignore value, we hold a reference from the list */
+    ignore_value(qemuDomainObjEndJob(driver, vm));
+}
+
+/*
+ * One pass of the memory overcommit manager.  While less than
+ * memOvercommitLow percent of host memory is available, memory the
+ * guests leave unused is reclaimed by inflating their balloons,
+ * largest idle guest first; once more than memOvercommitHigh percent
+ * is available, guests short of memory get some of it back.  Either
+ * way the aim is the middle of the two thresholds, and no balloon is
+ * moved outside <memtune><min_guarantee> and <memory>.
  */
-static int
-qemuStartup(bool privileged,
-            virStateInhibitCallback callback,
-            void *opaque)
+static void
+qemuMemOvercommitWorker(void *data ATTRIBUTE_UNUSED, void *opaque)
 {
-    char *base;
-    char *driverConf = NULL;
-    int rc;
-    virConnectPtr conn = NULL;
-    char ebuf[1024];
-    char *membase = NULL;
-    char *mempath = NULL;
-
-    if (VIR_ALLOC(qemu_driver) < 0)
-        return -1;
+    virQEMUDriverPtr driver = opaque;
+    virDomainObjPtr *vms = NULL;
+    qemuMemOvercommitEntryPtr entries = NULL;
+    size_t nvms = 0;
+    size_t nentries = 0;
+    unsigned long long total;
+    unsigned long long avail;
+    unsigned long long goal;
+    unsigned long long amount;
+    size_t i;
 
-    if (virMutexInit(&qemu_driver->lock) < 0) {
-        VIR_ERROR(_("cannot initialize mutex"));
-        VIR_FREE(qemu_driver);
-        return -1;
+    if (qemuMemOvercommitHostMemory(&total, &avail) < 0) {
+        virErrorPtr err = virGetLastError();
+        VIR_WARN("Unable to get host memory statistics: %s",
+                 err && err->message ? err->message : _("unknown error"));
+        virResetLastError();
+        return;
     }
-    qemuDriverLock(qemu_driver);
 
-    qemu_driver->privileged = privileged;
-    qemu_driver->uri = privileged ? "qemu:///system" : "qemu:///session";
-    qemu_driver->inhibitCallback = callback;
-    qemu_driver->inhibitOpaque = opaque;
+    VIR_DEBUG("host memory total=%llu available=%llu ksm_pages_sharing=%llu",
+              total, avail, qemuMemOvercommitSharedPages());
 
-    /* Don't have a dom0 so start from 1 */
-    qemu_driver->nextvmid = 1;
+    if (avail * 100 >= total * driver->memOvercommitLow &&
+        avail * 100 <= total * driver->memOvercommitHigh)
+        return;
 
-    if (virDomainObjListInit(&qemu_driver->domains) < 0)
-        goto out_of_memory;
+    if (virDomainObjListCollect(&driver->domains, &vms, &nvms,
+                                VIR_CONNECT_LIST_DOMAINS_ACTIVE) < 0)
+        return;
 
-    /* Init domain events */
-    qemu_driver->domainEventState = virDomainEventStateNew();
-    if (!qemu_driver->domainEventState)
-        goto error;
+    if (VIR_ALLOC_N(entries, nvms) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
 
-    /* read the host sysinfo */
-    if (privileged)
-        qemu_driver->hostsysinfo = virSysinfoRead();
+    for (i = 0; i < nvms; i++) {
+        virDomainObjPtr vm = vms[i];
 
-    if (privileged) {
-        if (virAsprintf(&qemu_driver->logDir,
-                        "%s/log/libvirt/qemu", LOCALSTATEDIR) == -1)
-            goto out_of_memory;
+        virDomainObjLock(vm);
+        if (qemuMemOvercommitIsManaged(vm->def) &&
+            qemuMemOvercommitSample(driver, vm, &entries[nentries]) == 0)
+            entries[nentries++].vm = vm;
+        virResetLastError();
+        virDomainObjUnlock(vm);
+    }
 
-        if ((qemu_driver->configBaseDir = strdup(SYSCONFDIR "/libvirt")) == NULL)
-            goto out_of_memory;
-        base = qemu_driver->configBaseDir;
+    goal = total * (driver->memOvercommitLow + driver->memOvercommitHigh) / 200;
 
-        if (virAsprintf(&qemu_driver->stateDir,
-                      "%s/run/libvirt/qemu", LOCALSTATEDIR) == -1)
-            goto out_of_memory;
+    if (avail < goal) {
+        amount = goal - avail;
+        qsort(entries, nentries, sizeof(*entries),
+              qemuMemOvercommitCompareUnused);
 
-        if (virAsprintf(&qemu_driver->libDir,
-                      "%s/lib/libvirt/qemu", LOCALSTATEDIR) == -1)
-            goto out_of_memory;
+        for (i = 0; i < nentries && amount; i++) {
+            virDomainDefPtr def = entries[i].vm->def;
+            unsigned long long take = entries[i].unused / 2;
 
-        if (virAsprintf(&qemu_driver->cacheDir,
-                      "%s/cache/libvirt/qemu", LOCALSTATEDIR) == -1)
-            goto out_of_memory;
-        if (virAsprintf(&qemu_driver->saveDir,
-                      "%s/lib/libvirt/qemu/save", LOCALSTATEDIR) == -1)
-            goto out_of_memory;
-        if (virAsprintf(&qemu_driver->snapshotDir,
-                        "%s/lib/libvirt/qemu/snapshot", LOCALSTATEDIR) == -1)
-            goto out_of_memory;
-        if (virAsprintf(&qemu_driver->autoDumpPath,
-                        "%s/lib/libvirt/qemu/dump", LOCALSTATEDIR) == -1)
-            goto out_of_memory;
+            if (entries[i].cur <= def->mem.min_guarantee)
+                continue;
+            take = MIN(take, entries[i].cur - def->mem.min_guarantee);
+            take = MIN(take, amount);
+            entries[i].target = entries[i].cur - take;
+            amount -= take;
+        }
     } else {
-        char *rundir;
-        char *cachedir;
+        amount = avail - goal;
 
-        cachedir = virGetUserCacheDirectory();
-        if (!cachedir)
-            goto error;
+        for (i = 0; i < nentries && amount; i++) {
+            virDomainDefPtr def = entries[i].vm->def;
+            unsigned long long give = def->mem.max_balloon / 10;
 
-        if (virAsprintf(&qemu_driver->logDir,
-                        "%s/qemu/log", cachedir) == -1) {
-            VIR_FREE(cachedir);
-            goto out_of_memory;
-        }
-        if (virAsprintf(&qemu_driver->cacheDir, "%s/qemu/cache", cachedir) == -1) {
-            VIR_FREE(cachedir);
-            goto out_of_memory;
+            if (entries[i].cur >= def->mem.max_balloon ||
+                entries[i].unused * 10 >= entries[i].cur)
+                continue;
+            give = MIN(give, def->mem.max_balloon - entries[i].cur);
+            give = MIN(give, amount);
+            entries[i].target = entries[i].cur + give;
+            amount -= give;
         }
-        VIR_FREE(cachedir);
+    }
 
-        rundir = virGetUserRuntimeDirectory();
-        if (!rundir)
-            goto error;
-        if (virAsprintf(&qemu_driver->stateDir, "%s/qemu/run", rundir) == -1) {
-            VIR_FREE(rundir);
-            goto out_of_memory;
-        }
-        VIR_FREE(rundir);
+    for (i = 0; i < nentries; i++) {
+        if (entries[i].target == entries[i].cur)
+            continue;
 
-        if (!(qemu_driver->configBaseDir = virGetUserConfigDirectory()))
-            goto error;
-        base = qemu_driver->configBaseDir;
-        if (virAsprintf(&qemu_driver->libDir, "%s/qemu/lib", base) == -1)
-            goto out_of_memory;
-        if (virAsprintf(&qemu_driver->saveDir, "%s/qemu/save", base) == -1)
-            goto out_of_memory;
-        if (virAsprintf(&qemu_driver->snapshotDir, "%s/qemu/snapshot", base) == -1)
-            goto out_of_memory;
-        if (virAsprintf(&qemu_driver->autoDumpPath, "%s/qemu/dump", base) == -1)
-            goto out_of_memory;
+        virDomainObjLock(entries[i].vm);
+        qemuMemOvercommitApply(driver, &entries[i]);
+        virDomainObjUnlock(entries[i].vm);
     }
 
-    if (virFileMakePath(qemu_driver->stateDir) < 0) {
-        VIR_ERROR(_("Failed to create state dir '%s': %s"),
-                  qemu_driver->stateDir, virStrerror(errno, ebuf, sizeof(ebuf)));
-        goto error;
-    }
-    if (virFileMakePath(qemu_driver->libDir) < 0) {
-        VIR_ERROR(_("Failed to create lib dir '%s': %s"),
-                  qemu_driver->libDir, virStrerror(errno, ebuf, sizeof(ebuf)));
-        goto error;
-    }
-    if (virFileMakePath(qemu_driver->cacheDir) < 0) {
-        VIR_ERROR(_("Failed to create cache dir '%s': %s"),
-                  qemu_driver->cacheDir, virStrerror(errno, ebuf, sizeof(ebuf)));
-        goto error;
-    }
-    if (virFileMakePath(qemu_driver->saveDir) < 0) {
-        VIR_ERROR(_("Failed to create save dir '%s': %s"),
-                  qemu_driver->saveDir, virStrerror(errno, ebuf, sizeof(ebuf)));
-        goto error;
-    }
-    if (virFileMakePath(qemu_driver->snapshotDir) < 0) {
-        VIR_ERROR(_("Failed to create save dir '%s': %s"),
-                  qemu_driver->snapshotDir, virStrerror(errno, ebuf, sizeof(ebuf)));
-        goto error;
-    }
-    if (virFileMakePath(qemu_driver->autoDumpPath) < 0) {
-        VIR_ERROR(_("Failed to create dump dir '%s': %s"),
-                  qemu_driver->autoDumpPath, virStrerror(errno, ebuf, sizeof(ebuf)));
-        goto error;
-    }
-
-    /* Configuration paths are either ~/.libvirt/qemu/... (session) or
-     * /etc/libvirt/qemu/... (system).
-     */
-    if (virAsprintf(&driverConf, "%s/qemu.conf", base) < 0 ||
-        virAsprintf(&qemu_driver->configDir, "%s/qemu", base) < 0 ||
-        virAsprintf(&qemu_driver->autostartDir, "%s/qemu/autostart", base) < 0)
-        goto out_of_memory;
-
-    rc = virCgroupForDriver("qemu", &qemu_driver->cgroup, privileged, 1);
-    if (rc < 0) {
-        VIR_INFO("Unable to create cgroup for driver: %s",
-                 virStrerror(-rc, ebuf, sizeof(ebuf)));
-    }
+cleanup:
+    for (i = 0; i < nvms; i++)
+        virObjectUnref(vms[i]);
+    VIR_FREE(vms);
+    VIR_FREE(entries);
+}
 
-    if (qemuLoadDriverConfig(qemu_driver, driverConf) < 0) {
-        goto error;
-    }
-    VIR_FREE(driverConf);
+static void
+qemuMemOvercommitTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    virThreadPoolStats stats;
 
-    /* Allocate bitmap for remote display port reservations. We cannot
-     * do this before the config is loaded properly, since the port
-     * numbers are configurable now */
-    if ((qemu_driver->reservedRemotePorts =
-         virBitmapNew(qemu_driver->remotePortMax - qemu_driver->remotePortMin)) == NULL)
-        goto out_of_memory;
+    /* Don't pile up passes behind one that is still running */
+    virThreadPoolGetStats(driver->memOvercommitPool, &stats);
+    if (stats.jobQueueDepth > 0)
+        return;
 
-    /* We should always at least have the 'nop' manager, so
-     * NULLs here are a fatal error
-     */
-    if (!qemu_driver->lockManager) {
-        VIR_ERROR(_("Missing lock manager implementation"));
-        goto error;
-    }
+    if (virThreadPoolSendJob(driver->memOvercommitPool, 0, NULL) < 0)
+        VIR_WARN("Unable to schedule memory overcommit pass");
+}
 
-    if (qemuSecurityInit(qemu_driver) < 0)
-        goto error;
+/* Whether the CPU quota controller looks after @vm */
+static bool
+qemuCpuQuotaIsManaged(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
 
-    qemu_driver->capsCache = qemuCapsCacheNew(qemu_driver->libDir,
-                                              qemu_driver->stateDir,
-                                              qemu_driver->user,
-                                              qemu_driver->group);
-    if (!qemu_driver->capsCache)
-        goto error;
+    return vm->def->cputune.quota > 0 &&
+           priv->nvcpupids > 0 &&
+           priv->vcpupids[0] != vm->pid;
+}
 
-    if ((qemu_driver->caps = qemuCreateCapabilities(qemu_driver)) == NULL)
-        goto error;
+/* Cumulated idle time of all host CPUs, in nanoseconds */
+static int
+qemuCpuQuotaHostIdle(unsigned long long *idle)
+{
+    virNodeCPUStatsPtr params = NULL;
+    int nparams = 0;
+    int ret = -1;
+    int i;
 
-    if ((qemu_driver->activePciHostdevs = pciDeviceListNew()) == NULL)
-        goto error;
+    if (nodeGetCPUStats(NULL, VIR_NODE_CPU_STATS_ALL_CPUS,
+                        NULL, &nparams, 0) < 0)
+        goto cleanup;
 
-    if ((qemu_driver->activeUsbHostdevs = usbDeviceListNew()) == NULL)
-        goto error;
+    if (VIR_ALLOC_N(params, nparams) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
 
-    if ((qemu_driver->inactivePciHostdevs = pciDeviceListNew()) == NULL)
-        goto error;
+    if (nodeGetCPUStats(NULL, VIR_NODE_CPU_STATS_ALL_CPUS,
+                        params, &nparams, 0) < 0)
+        goto cleanup;
 
-    if (privileged) {
-        if (chown(qemu_driver->libDir, qemu_driver->user, qemu_driver->group) < 0) {
-            virReportSystemError(errno,
-                                 _("unable to set ownership of '%s' to user %d:%d"),
-                                 qemu_driver->libDir, qemu_driver->user, qemu_driver->group);
-            goto error;
-        }
-        if (chown(qemu_driver->cacheDir, qemu_driver->user, qemu_driver->group) < 0) {
-            virReportSystemError(errno,
-                                 _("unable to set ownership of '%s' to %d:%d"),
-                                 qemu_driver->cacheDir, qemu_driver->user, qemu_driver->group);
-            goto error;
-        }
-        if (chown(qemu_driver->saveDir, qemu_driver->user, qemu_driver->group) < 0) {
-            virReportSystemError(errno,
-                                 _("unable to set ownership of '%s' to %d:%d"),
-                                 qemu_driver->saveDir, qemu_driver->user, qemu_driver->group);
-            goto error;
-        }
-        if (chown(qemu_driver->snapshotDir, qemu_driver->user, qemu_driver->group) < 0) {
-            virReportSystemError(errno,
-                                 _("unable to set ownership of '%s' to %d:%d"),
-                                 qemu_driver->snapshotDir, qemu_driver->user, qemu_driver->group);
-            goto error;
+    for (i = 0; i < nparams; i++) {
+        if (STREQ(params[i].field, VIR_NODE_CPU_STATS_IDLE)) {
+            *idle = params[i].value;
+            ret = 0;
+            goto cleanup;
         }
     }
 
-    /* If hugetlbfs is present, then we need to create a sub-directory within
-     * it, since we can't assume the root mount point has permissions that
-     * will let our spawned QEMU instances use it.
-     *
-     * NB the check for '/', since user may config "" to disable hugepages
-     * even when mounted
-     */
-    if (qemu_driver->hugetlbfs_mount &&
-        qemu_driver->hugetlbfs_mount[0] == '/') {
-        if (virAsprintf(&membase, "%s/libvirt",
-                        qemu_driver->hugetlbfs_mount) < 0 ||
-            virAsprintf(&mempath, "%s/qemu", membase) < 0)
-            goto out_of_memory;
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("unable to determine host idle time"));
 
-        if (virFileMakePath(mempath) < 0) {
-            virReportSystemError(errno,
-                                 _("unable to create hugepage path %s"), mempath);
-            goto error;
-        }
-        if (qemu_driver->privileged) {
-            if (virFileUpdatePerm(membase, 0, S_IXGRP | S_IXOTH) < 0)
-                goto error;
-            if (chown(mempath, qemu_driver->user, qemu_driver->group) < 0) {
-                virReportSystemError(errno,
-                                     _("unable to set ownership on %s to %d:%d"),
-                                     mempath, qemu_driver->user,
-                                     qemu_driver->group);
-                goto error;
-            }
-        }
-        VIR_FREE(membase);
+cleanup:
+    VIR_FREE(params);
+    return ret;
+}
+
+/*
+ * Sum the cpu.stat counters of the vCPU cgroups of @vm, which is
+ * where its CFS quota is enforced.
+ */
+static int
+qemuCpuQuotaGetThrottling(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm,
+                          unsigned long long *nr_periods,
+                          unsigned long long *nr_throttled,
+                          unsigned long long *throttled_time)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virCgroupPtr group;
+    unsigned long long periods;
+    unsigned long long throttled;
+    unsigned long long time;
+    int i;
+    int rc;
 
-        qemu_driver->hugepage_path = mempath;
+    *nr_periods = *nr_throttled = *throttled_time = 0;
+    for (i = 0; i < priv->nvcpupids; i++) {
+        if ((rc = qemuGetStatsCgroup(driver, vm, i, &group)) < 0 ||
+            (rc = virCgroupGetCpuStat(group, &periods,
+                                      &throttled, &time)) < 0)
+            return rc;
+        *nr_periods += periods;
+        *nr_throttled += throttled;
+        *throttled_time += time;
     }
 
-    if (qemuDriverCloseCallbackInit(qemu_driver) < 0)
-        goto error;
+    return 0;
+}
 
-    /* Get all the running persistent or transient configs first */
-    if (virDomainLoadAllConfigs(qemu_driver->caps,
-                                &qemu_driver->domains,
-                                qemu_driver->stateDir,
-                                NULL,
-                                1, QEMU_EXPECTED_VIRT_TYPES,
-                                NULL, NULL) < 0)
-        goto error;
+/* Set the CFS quota of every vCPU of @vm to @quota */
+static void
+qemuCpuQuotaApply(virQEMUDriverPtr driver,
+                  virDomainObjPtr vm,
+                  long long quota)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virCgroupPtr group;
+    int i;
+    int rc;
 
-    /* find the maximum ID from active and transient configs to initialize
-     * the driver with. This is to avoid race between autostart and reconnect
-     * threads */
-    virHashForEach(qemu_driver->domains.objs,
-                   qemuDomainFindMaxID,
-                   &qemu_driver->nextvmid);
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0) {
+        virResetLastError();
+        return;
+    }
 
-    virHashForEach(qemu_driver->domains.objs, qemuDomainNetsRestart, NULL);
+    if (!virDomainObjIsActive(vm) || !qemuCpuQuotaIsManaged(vm))
+        goto endjob;
 
-    conn = virConnectOpen(qemu_driver->uri);
+    for (i = 0; i < priv->nvcpupids; i++) {
+        if ((rc = qemuGetStatsCgroup(driver, vm, i, &group)) < 0 ||
+            (rc = virCgroupSetCpuCfsQuota(group, quota)) < 0) {
+            char ebuf[1024];
+            VIR_WARN("Unable to set cpu quota of domain %s vcpu %d: %s",
+                     vm->def->name, i, virStrerror(-rc, ebuf, sizeof(ebuf)));
+            goto endjob;
+        }
+    }
 
-    qemuProcessReconnectAll(conn, qemu_driver);
+    VIR_DEBUG("cpu quota of domain %s moved from %lld to %lld",
+              vm->def->name,
+              priv->cpuQuota ? priv->cpuQuota : vm->def->cputune.quota,
+              quota);
+    priv->cpuQuota = quota == vm->def->cputune.quota ? 0 : quota;
 
-    /* Then inactive persistent configs */
-    if (virDomainLoadAllConfigs(qemu_driver->caps,
-                                &qemu_driver->domains,
-                                qemu_driver->configDir,
-                                qemu_driver->autostartDir,
-                                0, QEMU_EXPECTED_VIRT_TYPES,
-                                NULL, NULL) < 0)
-        goto error;
+endjob:
+    /* Safe to ignore value, we hold a reference from the list */
+    ignore_value(qemuDomainObjEndJob(driver, vm));
+}
 
+/*
+ * One pass of the CPU quota controller.  The host CPU time left idle
+ * since the previous pass is shared between the managed domains that
+ * got throttled meanwhile, in proportion to their CPU shares, on top
+ * of their configured <cputune> quota and up to a full host CPU per
+ * vCPU; domains that were not throttled fall back to their configured
+ * quota.
+ */
+static void
+qemuCpuQuotaWorker(void *data ATTRIBUTE_UNUSED, void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    virDomainObjPtr *vms = NULL;
+    unsigned long long *shares = NULL;
+    size_t nvms = 0;
+    unsigned long long total_shares = 0;
+    unsigned long long idle;
+    unsigned long long now;
+    unsigned long long spare = 0;
+    size_t i;
 
-    virHashForEach(qemu_driver->domains.objs, qemuDomainSnapshotLoad,
-                   qemu_driver->snapshotDir);
+    if (virTimeMillisNow(&now) < 0 ||
+        qemuCpuQuotaHostIdle(&idle) < 0) {
+        virErrorPtr err = virGetLastError();
+        VIR_WARN("Unable to get host cpu statistics: %s",
+                 err && err->message ? err->message : _("unknown error"));
+        virResetLastError();
+        return;
+    }
 
-    virHashForEach(qemu_driver->domains.objs, qemuDomainManagedSaveLoad,
-                   qemu_driver);
+    /* Idle host CPUs since the previous pass, in thousandths */
+    if (driver->cpuQuotaTime && now > driver->cpuQuotaTime &&
+        idle > driver->cpuQuotaIdle)
+        spare = (idle - driver->cpuQuotaIdle) /
+                ((now - driver->cpuQuotaTime) * 1000);
+    driver->cpuQuotaIdle = idle;
+    driver->cpuQuotaTime = now;
 
-    qemu_driver->workerPool = virThreadPoolNew(0, 1, 0, processWatchdogEvent, qemu_driver);
-    if (!qemu_driver->workerPool)
-        goto error;
+    if (virDomainObjListCollect(&driver->domains, &vms, &nvms,
+                                VIR_CONNECT_LIST_DOMAINS_ACTIVE) < 0)
+        return;
 
-    qemuDriverUnlock(qemu_driver);
+    if (VIR_ALLOC_N(shares, nvms) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
 
-    qemuAutostartDomains(qemu_driver);
+    /* Find out which domains ran into their quota */
+    for (i = 0; i < nvms; i++) {
+        virDomainObjPtr vm = vms[i];
+        qemuDomainObjPrivatePtr priv = vm->privateData;
+        unsigned long long periods;
+        unsigned long long throttled;
+        unsigned long long time;
+
+        virDomainObjLock(vm);
+        if (qemuCpuQuotaIsManaged(vm) &&
+            qemuCpuQuotaGetThrottling(driver, vm, &periods,
+                                      &throttled, &time) == 0) {
+            if (throttled > priv->cpuQuotaThrottled) {
+                shares[i] = vm->def->cputune.shares ?
+                            vm->def->cputune.shares : 1024;
+                total_shares += shares[i];
+            }
+            priv->cpuQuotaThrottled = throttled;
+        }
+        virDomainObjUnlock(vm);
+    }
 
-    if (conn)
-        virConnectClose(conn);
+    for (i = 0; i < nvms; i++) {
+        virDomainObjPtr vm = vms[i];
+        qemuDomainObjPrivatePtr priv = vm->privateData;
+        unsigned long long period;
+        long long quota;
+
+        virDomainObjLock(vm);
+        if (!qemuCpuQuotaIsManaged(vm))
+            goto next;
+
+        period = vm->def->cputune.period ? vm->def->cputune.period : 100000;
+        quota = vm->def->cputune.quota;
+        if (shares[i] && spare) {
+            quota += spare * shares[i] / total_shares * period /
+                     (1000 * priv->nvcpupids);
+            if (quota > period)
+                quota = period;
+        }
 
-    virNWFilterRegisterCallbackDriver(&qemuCallbackDriver);
-    return 0;
+        if (quota != (priv->cpuQuota ? priv->cpuQuota :
+                      vm->def->cputune.quota))
+            qemuCpuQuotaApply(driver, vm, quota);
 
-out_of_memory:
-    virReportOOMError();
-error:
-    if (qemu_driver)
-        qemuDriverUnlock(qemu_driver);
-    if (conn)
-        virConnectClose(conn);
-    VIR_FREE(driverConf);
-    VIR_FREE(membase);
-    VIR_FREE(mempath);
-    qemuShutdown();
-    return -1;
+    next:
+        virDomainObjUnlock(vm);
+    }
+
+cleanup:
+    for (i = 0; i < nvms; i++)
+        virObjectUnref(vms[i]);
+    VIR_FREE(vms);
+    VIR_FREE(shares);
 }
 
-static void qemuNotifyLoadDomain(virDomainObjPtr vm, int newVM, void *opaque)
+static void
+qemuCpuQuotaTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 {
     virQEMUDriverPtr driver = opaque;
+    virThreadPoolStats stats;
 
-    if (newVM) {
-        virDomainEventPtr event =
-            virDomainEventNewFromObj(vm,
-                                     VIR_DOMAIN_EVENT_DEFINED,
-                                     VIR_DOMAIN_EVENT_DEFINED_ADDED);
-        if (event)
-            qemuDomainEventQueue(driver, event);
-    }
+    /* Don't pile up passes behind one that is still running */
+    virThreadPoolGetStats(driver->cpuQuotaPool, &stats);
+    if (stats.jobQueueDepth > 0)
+        return;
+
+    if (virThreadPoolSendJob(driver->cpuQuotaPool, 0, NULL) < 0)
+        VIR_WARN("Unable to schedule cpu quota pass");
 }
 
-/**
- * qemuReload:
- *
- * Function to restart the QEmu daemon, it will recheck the configuration
- * files and update its state and the networking
- */
 static int
-qemuReload(void) {
-    if (!qemu_driver)
-        return 0;
-
-    qemuDriverLock(qemu_driver);
-    virDomainLoadAllConfigs(qemu_driver->caps,
-                            &qemu_driver->domains,
+qemuSecurityInit(virQEMUDriverPtr driver)
+{
+    char **names;
+    virSecurityManagerPtr mgr = NULL;
+    virSecurityManagerPtr stack = NULL;
+
+    if (driver->securityDriverNames &&
+        driver->securityDriverNames[0]) {
+        names = driver->securityDriverNames;
+        while (names && *names) {
+            if (!(mgr = virSecurityManagerNew(*names,
+                                              QEMU_DRIVER_NAME,
+                                              driver->allowDiskFormatProbing,
+                                              driver->securityDefaultConfined,
+                                              driver->securityRequireConfined)))
+                goto error;
+            if (!stack) {
+                if (!(stack = virSecurityManagerNewStack(mgr)))
+                    goto error;
+            } else {
+                if (virSecurityManagerStackAddNested(stack, mgr) < 0)
+                    goto error;
+            }
+            mgr = NULL;
+            names++;
+        }
+    } else {
+        if (!(mgr = virSecurityManagerNew(NULL,
+                                          QEMU_DRIVER_NAME,
+                                          driver->allowDiskFormatProbing,
+                                          driver->securityDefaultConfined,
+                                          driver->securityRequireConfined)))
+            goto error;
+        if (!(stack = virSecurityManagerNewStack(mgr)))
+            goto error;
+        mgr = NULL;
+    }
+
+    if (driver->privileged) {
+        if (!(mgr = virSecurityManagerNewDAC(QEMU_DRIVER_NAME,
+                                             driver->user,
+                                             driver->group,
+                                             driver->allowDiskFormatProbing,
+                                             driver->securityDefaultConfined,
+                                             driver->securityRequireConfined,
+                                             driver->dynamicOwnership)))
+            goto error;
+        if (!stack) {
+            if (!(stack = virSecurityManagerNewStack(mgr)))
+                goto error;
+        } else {
+            if (virSecurityManagerStackAddNested(stack, mgr) < 0)
+                goto error;
+        }
+        mgr = NULL;
+    }
+
+    driver->securityManager = stack;
+    return 0;
+
+error:
+    VIR_ERROR(_("Failed to initialize security drivers"));
+    virSecurityManagerFree(stack);
+    virSecurityManagerFree(mgr);
+    return -1;
+}
+
+
+static virCapsPtr
+qemuCreateCapabilities(virQEMUDriverPtr driver)
+{
+    size_t i;
+    virCapsPtr caps;
+    virSecurityManagerPtr *sec_managers = NULL;
+    /* Security driver data */
+    const char *doi, *model;
+
+    /* Basic host arch / guest machine capabilities */
+    if (!(caps = qemuCapsInit(driver->capsCache))) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (driver->allowDiskFormatProbing) {
+        caps->defaultDiskDriverName = NULL;
+        caps->defaultDiskDriverType = VIR_STORAGE_FILE_AUTO;
+    } else {
+        caps->defaultDiskDriverName = "qemu";
+        caps->defaultDiskDriverType = VIR_STORAGE_FILE_RAW;
+    }
+
+    qemuDomainSetPrivateDataHooks(caps);
+    qemuDomainSetNamespaceHooks(caps);
+
+    if (virGetHostUUID(caps->host.host_uuid)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("cannot get the host uuid"));
+        goto err_exit;
+    }
+
+    /* access sec drivers and create a sec model for each one */
+    sec_managers = virSecurityManagerGetNested(driver->securityManager);
+    if (sec_managers == NULL) {
+        goto err_exit;
+    }
+
+    /* calculate length */
+    for (i = 0; sec_managers[i]; i++)
+        ;
+    caps->host.nsecModels = i;
+
+    if (VIR_ALLOC_N(caps->host.secModels, caps->host.nsecModels) < 0)
+        goto no_memory;
+
+    for (i = 0; sec_managers[i]; i++) {
+        doi = virSecurityManagerGetDOI(sec_managers[i]);
+        model = virSecurityManagerGetModel(sec_managers[i]);
+        if (!(caps->host.secModels[i].model = strdup(model)))
+            goto no_memory;
+        if (!(caps->host.secModels[i].doi = strdup(doi)))
+            goto no_memory;
+        VIR_DEBUG("Initialized caps for security driver \"%s\" with "
+                  "DOI \"%s\"", model, doi);
+    }
+    VIR_FREE(sec_managers);
+
+    return caps;
+
+no_memory:
+    virReportOOMError();
+err_exit:
+    VIR_FREE(sec_managers);
+    virCapabilitiesFree(caps);
+    return NULL;
+}
+
+
+static void
+qemuDomainSnapshotLoad(void *payload,
+                       const void *name ATTRIBUTE_UNUSED,
+                       void *data)
+{
+    virDomainObjPtr vm = (virDomainObjPtr)payload;
+    char *baseDir = (char *)data;
+    char *snapDir = NULL;
+    DIR *dir = NULL;
+    struct dirent *entry;
+    char *xmlStr;
+    int ret;
+    char *fullpath;
+    virDomainSnapshotDefPtr def = NULL;
+    virDomainSnapshotObjPtr snap = NULL;
+    virDomainSnapshotObjPtr current = NULL;
+    char ebuf[1024];
+    unsigned int flags = (VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_DISKS |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL);
+
+    virDomainObjLock(vm);
+    if (virAsprintf(&snapDir, "%s/%s", baseDir, vm->def->name) < 0) {
+        VIR_ERROR(_("Failed to allocate memory for snapshot directory for domain %s"),
+                   vm->def->name);
+        goto cleanup;
+    }
+
+    VIR_INFO("Scanning for snapshots for domain %s in %s", vm->def->name,
+             snapDir);
+
+    if (!(dir = opendir(snapDir))) {
+        if (errno != ENOENT)
+            VIR_ERROR(_("Failed to open snapshot directory %s for domain %s: %s"),
+                      snapDir, vm->def->name,
+                      virStrerror(errno, ebuf, sizeof(ebuf)));
+        goto cleanup;
+    }
+
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        /* NB: ignoring errors, so one malformed config doesn't
+           kill the whole process */
+        VIR_INFO("Loading snapshot file '%s'", entry->d_name);
+
+        if (virAsprintf(&fullpath, "%s/%s", snapDir, entry->d_name) < 0) {
+            VIR_ERROR(_("Failed to allocate memory for path"));
+            continue;
+        }
+
+        ret = virFileReadAll(fullpath, 1024*1024*1, &xmlStr);
+        if (ret < 0) {
+            /* Nothing we can do here, skip this one */
+            VIR_ERROR(_("Failed to read snapshot file %s: %s"), fullpath,
+                      virStrerror(errno, ebuf, sizeof(ebuf)));
+            VIR_FREE(fullpath);
+            continue;
+        }
+
+        def = virDomainSnapshotDefParseString(xmlStr, qemu_driver->caps,
+                                              QEMU_EXPECTED_VIRT_TYPES,
+                                              flags);
+        if (def == NULL) {
+            /* Nothing we can do here, skip this one */
+            VIR_ERROR(_("Failed to parse snapshot XML from file '%s'"),
+                      fullpath);
+            VIR_FREE(fullpath);
+            VIR_FREE(xmlStr);
+            continue;
+        }
+
+        snap = virDomainSnapshotAssignDef(vm->snapshots, def);
+        if (snap == NULL) {
+            virDomainSnapshotDefFree(def);
+        } else if (snap->def->current) {
+            current = snap;
+            if (!vm->current_snapshot)
+                vm->current_snapshot = snap;
+        }
+
+        VIR_FREE(fullpath);
+        VIR_FREE(xmlStr);
+    }
+
+    if (vm->current_snapshot != current) {
+        VIR_ERROR(_("Too many snapshots claiming to be current for domain %s"),
+                  vm->def->name);
+        vm->current_snapshot = NULL;
+    }
+
+    if (virDomainSnapshotUpdateRelations(vm->snapshots) < 0)
+        VIR_ERROR(_("Snapshots have inconsistent relations for domain %s"),
+                  vm->def->name);
+
+    /* FIXME: qemu keeps internal track of snapshots.  We can get access
+     * to this info via the "info snapshots" monitor command for running
+     * domains, or via "qemu-img snapshot -l" for shutoff domains.  It would
+     * be nice to update our internal state based on that, but there is a
+     * a problem.  qemu doesn't track all of the same metadata that we do.
+     * In particular we wouldn't be able to fill in the <parent>, which is
+     * pretty important in our metadata.
+     */
+
+    virResetLastError();
+
+cleanup:
+    if (dir)
+        closedir(dir);
+    VIR_FREE(snapDir);
+    virDomainObjUnlock(vm);
+}
+
+
+static void
+qemuDomainNetsRestart(void *payload,
+                      const void *name ATTRIBUTE_UNUSED,
+                      void *data ATTRIBUTE_UNUSED)
+{
+    int i;
+    virDomainObjPtr vm = (virDomainObjPtr)payload;
+    virDomainDefPtr def = vm->def;
+
+    virDomainObjLock(vm);
+
+    for (i = 0; i < def->nnets; i++) {
+        virDomainNetDefPtr net = def->nets[i];
+        if (virDomainNetGetActualType(net) == VIR_DOMAIN_NET_TYPE_DIRECT &&
+            virDomainNetGetActualDirectMode(net) == VIR_NETDEV_MACVLAN_MODE_VEPA) {
+            VIR_DEBUG("VEPA mode device %s active in domain %s. Reassociating.",
+                      net->ifname, def->name);
+            ignore_value(virNetDevMacVLanRestartWithVPortProfile(net->ifname,
+                                                                 &net->mac,
+                                                                 virDomainNetGetActualDirectDev(net),
+                                                                 def->uuid,
+                                                                 virDomainNetGetActualVirtPortProfile(net),
+                                                                 VIR_NETDEV_VPORT_PROFILE_OP_CREATE));
+        }
+    }
+
+    virDomainObjUnlock(vm);
+}
+
+
+static void
+qemuDomainFindMaxID(void *payload,
+                    const void *name ATTRIBUTE_UNUSED,
+                    void *data)
+{
+    virDomainObjPtr vm = payload;
+    int *driver_maxid = data;
+
+    if (vm->def->id >= *driver_maxid)
+        *driver_maxid = vm->def->id + 1;
+}
+
+
+/**
+ * qemuStartup:
+ *
+ * Initialization function for the QEmu daemon
+ */
+static int
+qemuStartup(bool privileged,
+            virStateInhibitCallback callback,
+            void *opaque)
+{
+    char *base;
+    char *driverConf = NULL;
+    int rc;
+    virConnectPtr conn = NULL;
+    char ebuf[1024];
+    char *membase = NULL;
+    char *mempath = NULL;
+    size_t i;
+
+    if (VIR_ALLOC(qemu_driver) < 0)
+        return -1;
+
+    if (virMutexInit(&qemu_driver->lock) < 0) {
+        VIR_ERROR(_("cannot initialize mutex"));
+        VIR_FREE(qemu_driver);
+        return -1;
+    }
+    qemuDriverLock(qemu_driver);
+
+    qemu_driver->numaRebalanceTimer = -1;
+    qemu_driver->memOvercommitTimer = -1;
+    qemu_driver->cpuQuotaTimer = -1;
+    qemu_driver->privileged = privileged;
+    qemu_driver->uri = privileged ? "qemu:///system" : "qemu:///session";
+    qemu_driver->inhibitCallback = callback;
+    qemu_driver->inhibitOpaque = opaque;
+
+    /* Don't have a dom0 so start from 1 */
+    qemu_driver->nextvmid = 1;
+
+    if (virDomainObjListInit(&qemu_driver->domains) < 0)
+        goto out_of_memory;
+
+    /* Init domain events */
+    qemu_driver->domainEventState = virDomainEventStateNew();
+    if (!qemu_driver->domainEventState)
+        goto error;
+
+    if (privileged) {
+        if (virAsprintf(&qemu_driver->logDir,
+                        "%s/log/libvirt/qemu", LOCALSTATEDIR) == -1)
+            goto out_of_memory;
+
+        if ((qemu_driver->configBaseDir = strdup(SYSCONFDIR "/libvirt")) == NULL)
+            goto out_of_memory;
+        base = qemu_driver->configBaseDir;
+
+        if (virAsprintf(&qemu_driver->stateDir,
+                      "%s/run/libvirt/qemu", LOCALSTATEDIR) == -1)
+            goto out_of_memory;
+
+        if (virAsprintf(&qemu_driver->libDir,
+                      "%s/lib/libvirt/qemu", LOCALSTATEDIR) == -1)
+            goto out_of_memory;
+
+        if (virAsprintf(&qemu_driver->cacheDir,
+                      "%s/cache/libvirt/qemu", LOCALSTATEDIR) == -1)
+            goto out_of_memory;
+        if (virAsprintf(&qemu_driver->saveDir,
+                      "%s/lib/libvirt/qemu/save", LOCALSTATEDIR) == -1)
+            goto out_of_memory;
+        if (virAsprintf(&qemu_driver->snapshotDir,
+                        "%s/lib/libvirt/qemu/snapshot", LOCALSTATEDIR) == -1)
+            goto out_of_memory;
+        if (virAsprintf(&qemu_driver->autoDumpPath,
+                        "%s/lib/libvirt/qemu/dump", LOCALSTATEDIR) == -1)
+            goto out_of_memory;
+    } else {
+        char *rundir;
+        char *cachedir;
+
+        cachedir = virGetUserCacheDirectory();
+        if (!cachedir)
+            goto error;
+
+        if (virAsprintf(&qemu_driver->logDir,
+                        "%s/qemu/log", cachedir) == -1) {
+            VIR_FREE(cachedir);
+            goto out_of_memory;
+        }
+        if (virAsprintf(&qemu_driver->cacheDir, "%s/qemu/cache", cachedir) == -1) {
+            VIR_FREE(cachedir);
+            goto out_of_memory;
+        }
+        VIR_FREE(cachedir);
+
+        rundir = virGetUserRuntimeDirectory();
+        if (!rundir)
+            goto error;
+        if (virAsprintf(&qemu_driver->stateDir, "%s/qemu/run", rundir) == -1) {
+            VIR_FREE(rundir);
+            goto out_of_memory;
+        }
+        VIR_FREE(rundir);
+
+        if (!(qemu_driver->configBaseDir = virGetUserConfigDirectory()))
+            goto error;
+        base = qemu_driver->configBaseDir;
+        if (virAsprintf(&qemu_driver->libDir, "%s/qemu/lib", base) == -1)
+            goto out_of_memory;
+        if (virAsprintf(&qemu_driver->saveDir, "%s/qemu/save", base) == -1)
+            goto out_of_memory;
+        if (virAsprintf(&qemu_driver->snapshotDir, "%s/qemu/snapshot", base) == -1)
+            goto out_of_memory;
+        if (virAsprintf(&qemu_driver->autoDumpPath, "%s/qemu/dump", base) == -1)
+            goto out_of_memory;
+    }
+
+    if (virFileMakePath(qemu_driver->stateDir) < 0) {
+        VIR_ERROR(_("Failed to create state dir '%s': %s"),
+                  qemu_driver->stateDir, virStrerror(errno, ebuf, sizeof(ebuf)));
+        goto error;
+    }
+    if (virFileMakePath(qemu_driver->libDir) < 0) {
+        VIR_ERROR(_("Failed to create lib dir '%s': %s"),
+                  qemu_driver->libDir, virStrerror(errno, ebuf, sizeof(ebuf)));
+        goto error;
+    }
+    if (virFileMakePath(qemu_driver->cacheDir) < 0) {
+        VIR_ERROR(_("Failed to create cache dir '%s': %s"),
+                  qemu_driver->cacheDir, virStrerror(errno, ebuf, sizeof(ebuf)));
+        goto error;
+    }
+    if (virFileMakePath(qemu_driver->saveDir) < 0) {
+        VIR_ERROR(_("Failed to create save dir '%s': %s"),
+                  qemu_driver->saveDir, virStrerror(errno, ebuf, sizeof(ebuf)));
+        goto error;
+    }
+    if (virFileMakePath(qemu_driver->snapshotDir) < 0) {
+        VIR_ERROR(_("Failed to create save dir '%s': %s"),
+                  qemu_driver->snapshotDir, virStrerror(errno, ebuf, sizeof(ebuf)));
+        goto error;
+    }
+    if (virFileMakePath(qemu_driver->autoDumpPath) < 0) {
+        VIR_ERROR(_("Failed to create dump dir '%s': %s"),
+                  qemu_driver->autoDumpPath, virStrerror(errno, ebuf, sizeof(ebuf)));
+        goto error;
+    }
+
+    /* read the host sysinfo, reusing the dmidecode output from the
+     * previous start if the host has not changed since */
+    if (privileged) {
+        char *sysinfoCache;
+
+        if (virAsprintf(&sysinfoCache, "%s/sysinfo",
+                        qemu_driver->cacheDir) < 0)
+            goto out_of_memory;
+        qemu_driver->hostsysinfo = virSysinfoReadCached(sysinfoCache);
+        VIR_FREE(sysinfoCache);
+    }
+
+    /* Configuration paths are either ~/.libvirt/qemu/... (session) or
+     * /etc/libvirt/qemu/... (system).
+     */
+    if (virAsprintf(&driverConf, "%s/qemu.conf", base) < 0 ||
+        virAsprintf(&qemu_driver->configDir, "%s/qemu", base) < 0 ||
+        virAsprintf(&qemu_driver->autostartDir, "%s/qemu/autostart", base) < 0)
+        goto out_of_memory;
+
+    rc = virCgroupForDriver("qemu", &qemu_driver->cgroup, privileged, 1);
+    if (rc < 0) {
+        VIR_INFO("Unable to create cgroup for driver: %s",
+                 virStrerror(-rc, ebuf, sizeof(ebuf)));
+    }
+
+    if (qemuLoadDriverConfig(qemu_driver, driverConf) < 0) {
+        goto error;
+    }
+    VIR_FREE(driverConf);
+
+    if (virDomainObjListSetMetadataIndex(&qemu_driver->domains,
+                                         (const char *const *)
+                                         qemu_driver->metadataIndex) < 0)
+        goto error;
+
+    /* Allocate bitmap for remote display port reservations. We cannot
+     * do this before the config is loaded properly, since the port
+     * numbers are configurable now */
+    if ((qemu_driver->reservedRemotePorts =
+         virBitmapNew(qemu_driver->remotePortMax - qemu_driver->remotePortMin)) == NULL)
+        goto out_of_memory;
+
+    /* We should always at least have the 'nop' manager, so
+     * NULLs here are a fatal error
+     */
+    if (!qemu_driver->lockManager) {
+        VIR_ERROR(_("Missing lock manager implementation"));
+        goto error;
+    }
+
+    if (qemuSecurityInit(qemu_driver) < 0)
+        goto error;
+
+    qemu_driver->capsCache = qemuCapsCacheNew(qemu_driver->libDir,
+                                              qemu_driver->cacheDir,
+                                              qemu_driver->stateDir,
+                                              qemu_driver->user,
+                                              qemu_driver->group);
+    if (!qemu_driver->capsCache)
+        goto error;
+
+    if ((qemu_driver->caps = qemuCreateCapabilities(qemu_driver)) == NULL)
+        goto error;
+
+    if ((qemu_driver->activePciHostdevs = pciDeviceListNew()) == NULL)
+        goto error;
+
+    if ((qemu_driver->activeUsbHostdevs = usbDeviceListNew()) == NULL)
+        goto error;
+
+    if ((qemu_driver->inactivePciHostdevs = pciDeviceListNew()) == NULL)
+        goto error;
+
+    if (privileged) {
+        if (chown(qemu_driver->libDir, qemu_driver->user, qemu_driver->group) < 0) {
+            virReportSystemError(errno,
+                                 _("unable to set ownership of '%s' to user %d:%d"),
+                                 qemu_driver->libDir, qemu_driver->user, qemu_driver->group);
+            goto error;
+        }
+        if (chown(qemu_driver->cacheDir, qemu_driver->user, qemu_driver->group) < 0) {
+            virReportSystemError(errno,
+                                 _("unable to set ownership of '%s' to %d:%d"),
+                                 qemu_driver->cacheDir, qemu_driver->user, qemu_driver->group);
+            goto error;
+        }
+        if (chown(qemu_driver->saveDir, qemu_driver->user, qemu_driver->group) < 0) {
+            virReportSystemError(errno,
+                                 _("unable to set ownership of '%s' to %d:%d"),
+                                 qemu_driver->saveDir, qemu_driver->user, qemu_driver->group);
+            goto error;
+        }
+        if (chown(qemu_driver->snapshotDir, qemu_driver->user, qemu_driver->group) < 0) {
+            virReportSystemError(errno,
+                                 _("unable to set ownership of '%s' to %d:%d"),
+                                 qemu_driver->snapshotDir, qemu_driver->user, qemu_driver->group);
+            goto error;
+        }
+    }
+
+    /* If hugetlbfs is present, then we need to create a sub-directory within
+     * each mount, since we can't assume the root mount point has permissions
+     * that will let our spawned QEMU instances use it.
+     */
+    for (i = 0; i < qemu_driver->nhugetlbfs; i++) {
+        if (virAsprintf(&membase, "%s/libvirt",
+                        qemu_driver->hugetlbfs[i].mnt_dir) < 0 ||
+            virAsprintf(&mempath, "%s/qemu", membase) < 0)
+            goto out_of_memory;
+
+        if (virFileMakePath(mempath) < 0) {
+            virReportSystemError(errno,
+                                 _("unable to create hugepage path %s"), mempath);
+            goto error;
+        }
+        if (qemu_driver->privileged) {
+            if (virFileUpdatePerm(membase, 0, S_IXGRP | S_IXOTH) < 0)
+                goto error;
+            if (chown(mempath, qemu_driver->user, qemu_driver->group) < 0) {
+                virReportSystemError(errno,
+                                     _("unable to set ownership on %s to %d:%d"),
+                                     mempath, qemu_driver->user,
+                                     qemu_driver->group);
+                goto error;
+            }
+        }
+        VIR_FREE(membase);
+        VIR_FREE(mempath);
+    }
+
+    if (qemuDriverCloseCallbackInit(qemu_driver) < 0)
+        goto error;
+
+    if (!(qemu_driver->migrationSched = qemuMigrationSchedNew()))
+        goto error;
+
+    /* Needed before reconnecting to the monitors of running domains */
+    if (qemu_driver->monitorIOThreads) {
+        if (VIR_ALLOC_N(qemu_driver->monitorIOThreadList,
+                        qemu_driver->monitorIOThreads) < 0)
+            goto out_of_memory;
+        for (i = 0 ; i < qemu_driver->monitorIOThreads ; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "qemu-monitor-io-%zu", i);
+            if (!(qemu_driver->monitorIOThreadList[i] =
+                  virEventThreadNew(name)))
+                goto error;
+        }
+    }
+
+    /* Get all the running persistent or transient configs first */
+    if (virDomainLoadAllConfigs(qemu_driver->caps,
+                                &qemu_driver->domains,
+                                qemu_driver->stateDir,
+                                NULL,
+                                1, QEMU_EXPECTED_VIRT_TYPES,
+                                NULL, NULL) < 0)
+        goto error;
+
+    /* find the maximum ID from active and transient configs to initialize
+     * the driver with. This is to avoid race between autostart and reconnect
+     * threads */
+    virHashForEach(qemu_driver->domains.objs,
+                   qemuDomainFindMaxID,
+                   &qemu_driver->nextvmid);
+
+    virHashForEach(qemu_driver->domains.objs, qemuDomainNetsRestart, NULL);
+
+    conn = virConnectOpen(qemu_driver->uri);
+
+    qemuProcessReconnectAll(conn, qemu_driver);
+
+    /* Then inactive persistent configs */
+    if (virDomainLoadAllConfigs(qemu_driver->caps,
+                                &qemu_driver->domains,
+                                qemu_driver->configDir,
+                                qemu_driver->autostartDir,
+                                0, QEMU_EXPECTED_VIRT_TYPES,
+                                NULL, NULL) < 0)
+        goto error;
+
+
+    virHashForEach(qemu_driver->domains.objs, qemuDomainSnapshotLoad,
+                   qemu_driver->snapshotDir);
+
+    virHashForEach(qemu_driver->domains.objs, qemuDomainManagedSaveLoad,
+                   qemu_driver);
+
+    qemu_driver->workerPool = virThreadPoolNew(0, 1, 0, processWatchdogEvent, qemu_driver);
+    if (!qemu_driver->workerPool)
+        goto error;
+
+    qemu_driver->statusPool = virThreadPoolNew(0, 1, 0, qemuDomainStatusWriter,
+                                               qemu_driver);
+    if (!qemu_driver->statusPool)
+        goto error;
+
+    if (qemu_driver->numaRebalanceThreshold) {
+        qemu_driver->numaRebalancePool = virThreadPoolNew(0, 1, 0,
+                                                          qemuNUMARebalanceWorker,
+                                                          qemu_driver);
+        if (!qemu_driver->numaRebalancePool)
+            goto error;
+
+        qemu_driver->numaRebalanceTimer =
+            virEventAddTimeout(QEMU_NUMA_REBALANCE_INTERVAL,
+                               qemuNUMARebalanceTimer, qemu_driver, NULL);
+        if (qemu_driver->numaRebalanceTimer < 0)
+            VIR_WARN("Unable to register NUMA rebalancing timer");
+    }
+
+    if (qemu_driver->memOvercommitInterval) {
+        qemu_driver->memOvercommitPool = virThreadPoolNew(0, 1, 0,
+                                                          qemuMemOvercommitWorker,
+                                                          qemu_driver);
+        if (!qemu_driver->memOvercommitPool)
+            goto error;
+
+        qemu_driver->memOvercommitTimer =
+            virEventAddTimeout(qemu_driver->memOvercommitInterval * 1000,
+                               qemuMemOvercommitTimer, qemu_driver, NULL);
+        if (qemu_driver->memOvercommitTimer < 0)
+            VIR_WARN("Unable to register memory overcommit timer");
+    }
+
+    if (qemu_driver->cpuQuotaInterval) {
+        qemu_driver->cpuQuotaPool = virThreadPoolNew(0, 1, 0,
+                                                     qemuCpuQuotaWorker,
+                                                     qemu_driver);
+        if (!qemu_driver->cpuQuotaPool)
+            goto error;
+
+        qemu_driver->cpuQuotaTimer =
+            virEventAddTimeout(qemu_driver->cpuQuotaInterval * 1000,
+                               qemuCpuQuotaTimer, qemu_driver, NULL);
+        if (qemu_driver->cpuQuotaTimer < 0)
+            VIR_WARN("Unable to register cpu quota timer");
+    }
+
+    qemuDriverUnlock(qemu_driver);
+
+    qemuAutostartDomains(qemu_driver);
+
+    if (conn)
+        virConnectClose(conn);
+
+    virNWFilterRegisterCallbackDriver(&qemuCallbackDriver);
+    return 0;
+
+out_of_memory:
+    virReportOOMError();
+error:
+    if (qemu_driver)
+        qemuDriverUnlock(qemu_driver);
+    if (conn)
+        virConnectClose(conn);
+    VIR_FREE(driverConf);
+    VIR_FREE(membase);
+    VIR_FREE(mempath);
+    qemuShutdown();
+    return -1;
+}
+
+static void qemuNotifyLoadDomain(virDomainObjPtr vm, int newVM, void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+
+    if (newVM) {
+        virDomainEventPtr event =
+            virDomainEventNewFromObj(vm,
+                                     VIR_DOMAIN_EVENT_DEFINED,
+                                     VIR_DOMAIN_EVENT_DEFINED_ADDED);
+        if (event)
+            qemuDomainEventQueue(driver, event);
+    }
+}
+
+/**
+ * qemuReload:
+ *
+ * Function to restart the QEmu daemon, it will recheck the configuration
+ * files and update its state and the networking
+ */
+static int
+qemuReload(void) {
+    if (!qemu_driver)
+        return 0;
+
+    qemuDriverLock(qemu_driver);
+    virDomainLoadAllConfigs(qemu_driver->caps,
+                            &qemu_driver->domains,
                             qemu_driver->configDir,
                             qemu_driver->autostartDir,
                             0, QEMU_EXPECTED_VIRT_TYPES,
@@ -1079,6 +1937,76 @@ qemuStop(void) {
     return ret;
 }
 
+static void
+qemuDomainFlushDeferredStatus(void *payload,
+                              const void *name ATTRIBUTE_UNUSED,
+                              void *opaque)
+{
+    virDomainObjPtr vm = payload;
+
+    virDomainObjLock(vm);
+    qemuDomainObjFlushStatus(opaque, vm);
+    virDomainObjUnlock(vm);
+}
+
+static void
+qemuDomainCountDeferredStatus(void *payload,
+                              const void *name ATTRIBUTE_UNUSED,
+                              void *opaque)
+{
+    virDomainObjPtr vm = payload;
+    qemuDomainObjPrivatePtr priv;
+    size_t *pending = opaque;
+
+    /* The status writer keeps the domain locked while writing */
+    virDomainObjLock(vm);
+    priv = vm->privateData;
+    if (priv->statusDirty)
+        (*pending)++;
+    virDomainObjUnlock(vm);
+}
+
+/**
+ * qemuPreExecRestart:
+ *
+ * Refuse to let the daemon re-execute itself while outgoing migrations
+ * are scheduled or status files are waiting to be written, as neither
+ * would survive it.
+ */
+static int
+qemuPreExecRestart(void)
+{
+    size_t pending = 0;
+    int ret = -1;
+
+    if (!qemu_driver)
+        return 0;
+
+    qemuDriverLock(qemu_driver);
+
+    if ((pending = qemuMigrationSchedCount(qemu_driver->migrationSched))) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("%zu outgoing migrations are queued or running"),
+                       pending);
+        goto cleanup;
+    }
+
+    virHashForEach(qemu_driver->domains.objs, qemuDomainCountDeferredStatus,
+                   &pending);
+    if (pending) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("status of %zu domains is still being written"),
+                       pending);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    qemuDriverUnlock(qemu_driver);
+    return ret;
+}
+
 /**
  * qemuShutdown:
  *
@@ -1091,17 +2019,60 @@ qemuShutdown(void) {
     if (!qemu_driver)
         return -1;
 
+    /* Lets any reconnect still in progress finish, which needs
+     * the driver lock */
+    virThreadPoolFree(qemu_driver->reconnectPool);
+
+    if (qemu_driver->numaRebalanceTimer >= 0)
+        virEventRemoveTimeout(qemu_driver->numaRebalanceTimer);
+    virThreadPoolFree(qemu_driver->numaRebalancePool);
+    if (qemu_driver->memOvercommitTimer >= 0)
+        virEventRemoveTimeout(qemu_driver->memOvercommitTimer);
+    virThreadPoolFree(qemu_driver->memOvercommitPool);
+    if (qemu_driver->cpuQuotaTimer >= 0)
+        virEventRemoveTimeout(qemu_driver->cpuQuotaTimer);
+    virThreadPoolFree(qemu_driver->cpuQuotaPool);
+
+    /* Monitor event handlers take the driver lock and queue status
+     * writes, so the threads running them must be stopped before
+     * the status pool goes away and the driver lock is taken */
+    if (qemu_driver->monitorIOThreadList) {
+        for (i = 0 ; i < qemu_driver->monitorIOThreads ; i++) {
+            if (qemu_driver->monitorIOThreadList[i])
+                virEventThreadStop(qemu_driver->monitorIOThreadList[i]);
+        }
+    }
+
+    /* Nothing queues status writes any more: let the writer finish,
+     * then write whatever it left queued */
+    virThreadPoolFree(qemu_driver->statusPool);
+    qemu_driver->statusPool = NULL;
+
     qemuDriverLock(qemu_driver);
+    virHashForEach(qemu_driver->domains.objs, qemuDomainFlushDeferredStatus,
+                   qemu_driver);
     virNWFilterUnRegisterCallbackDriver(&qemuCallbackDriver);
     pciDeviceListFree(qemu_driver->activePciHostdevs);
     pciDeviceListFree(qemu_driver->inactivePciHostdevs);
     usbDeviceListFree(qemu_driver->activeUsbHostdevs);
     virCapabilitiesFree(qemu_driver->caps);
+    VIR_FREE(qemu_driver->capsXML);
+    VIR_FREE(qemu_driver->hostCapsXML);
     qemuCapsCacheFree(qemu_driver->capsCache);
 
     virDomainObjListDeinit(&qemu_driver->domains);
     virBitmapFree(qemu_driver->reservedRemotePorts);
 
+    /* Running domains keep their monitors, which are dropped along
+     * with the threads servicing them */
+    if (qemu_driver->monitorIOThreadList) {
+        for (i = 0 ; i < qemu_driver->monitorIOThreads ; i++)
+            virObjectUnref(qemu_driver->monitorIOThreadList[i]);
+        VIR_FREE(qemu_driver->monitorIOThreadList);
+    }
+
+    qemuMigrationSchedFree(qemu_driver->migrationSched);
+
     virSysinfoDefFree(qemu_driver->hostsysinfo);
 
     qemuDriverCloseCallbackShutdown(qemu_driver);
@@ -1124,8 +2095,7 @@ qemuShutdown(void) {
     VIR_FREE(qemu_driver->spiceTLSx509certdir);
     VIR_FREE(qemu_driver->spiceListen);
     VIR_FREE(qemu_driver->spicePassword);
-    VIR_FREE(qemu_driver->hugetlbfs_mount);
-    VIR_FREE(qemu_driver->hugepage_path);
+    virHugeTLBFSArrayFree(qemu_driver->hugetlbfs, qemu_driver->nhugetlbfs);
     VIR_FREE(qemu_driver->saveImageFormat);
     VIR_FREE(qemu_driver->dumpImageFormat);
 
@@ -1138,6 +2108,7 @@ qemuShutdown(void) {
             VIR_FREE(qemu_driver->cgroupDeviceACL[i]);
         VIR_FREE(qemu_driver->cgroupDeviceACL);
     }
+    virStringFreeList(qemu_driver->metadataIndex);
 
     /* Free domain callback list */
     virDomainEventStateFree(qemu_driver->domainEventState);
@@ -1333,22 +2304,81 @@ static int qemuGetMaxVCPUs(virConnectPtr conn ATTRIBUTE_UNUSED, const char *type
 }
 
 
+/* Rebuild the capabilities, which probes the host and every emulator
+ * binary, unless that was done less than QEMU_CAPS_REFRESH_INTERVAL
+ * ago, so that a burst of clients connecting at once shares a single
+ * rebuild and its formatted XML.  Must be called with the driver
+ * locked.  */
+static int
+qemuRefreshCapabilities(virQEMUDriverPtr driver)
+{
+    virCapsPtr caps;
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        now = 0;
+
+    if (now && driver->capsTime &&
+        now < driver->capsTime + QEMU_CAPS_REFRESH_INTERVAL)
+        return 0;
+
+    if ((caps = qemuCreateCapabilities(driver)) == NULL)
+        return -1;
+
+    virCapabilitiesFree(driver->caps);
+    driver->caps = caps;
+    VIR_FREE(driver->capsXML);
+    VIR_FREE(driver->hostCapsXML);
+    driver->capsTime = now;
+
+    return 0;
+}
+
 static char *qemuGetCapabilities(virConnectPtr conn) {
     virQEMUDriverPtr driver = conn->privateData;
-    virCapsPtr caps = NULL;
     char *xml = NULL;
 
     qemuDriverLock(driver);
 
-    if ((caps = qemuCreateCapabilities(qemu_driver)) == NULL) {
-        virCapabilitiesFree(caps);
+    if (qemuRefreshCapabilities(driver) < 0)
+        goto cleanup;
+
+    if (!driver->capsXML &&
+        !(driver->capsXML = virCapabilitiesFormatXML(driver->caps))) {
+        virReportOOMError();
         goto cleanup;
     }
 
-    virCapabilitiesFree(qemu_driver->caps);
-    qemu_driver->caps = caps;
+    if (!(xml = strdup(driver->capsXML)))
+        virReportOOMError();
+
+cleanup:
+    qemuDriverUnlock(driver);
+
+    return xml;
+}
+
+
+static char *
+qemuConnectGetHostCapabilities(virConnectPtr conn, unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    char *xml = NULL;
+
+    virCheckFlags(0, NULL);
+
+    qemuDriverLock(driver);
+
+    if (qemuRefreshCapabilities(driver) < 0)
+        goto cleanup;
+
+    if (!driver->hostCapsXML &&
+        !(driver->hostCapsXML = virCapabilitiesFormatHostXML(driver->caps))) {
+        virReportOOMError();
+        goto cleanup;
+    }
 
-    if ((xml = virCapabilitiesFormatXML(driver->caps)) == NULL)
+    if (!(xml = strdup(driver->hostCapsXML)))
         virReportOOMError();
 
 cleanup:
@@ -1440,9 +2470,7 @@ static virDomainPtr qemuDomainLookupByID(virConnectPtr conn,
     virDomainObjPtr vm;
     virDomainPtr dom = NULL;
 
-    qemuDriverLock(driver);
     vm  = virDomainFindByID(&driver->domains, id);
-    qemuDriverUnlock(driver);
 
     if (!vm) {
         virReportError(VIR_ERR_NO_DOMAIN,
@@ -1465,9 +2493,7 @@ static virDomainPtr qemuDomainLookupByUUID(virConnectPtr conn,
     virDomainObjPtr vm;
     virDomainPtr dom = NULL;
 
-    qemuDriverLock(driver);
     vm = virDomainFindByUUID(&driver->domains, uuid);
-    qemuDriverUnlock(driver);
 
     if (!vm) {
         char uuidstr[VIR_UUID_STRING_BUFLEN];
@@ -1492,9 +2518,7 @@ static virDomainPtr qemuDomainLookupByName(virConnectPtr conn,
     virDomainObjPtr vm;
     virDomainPtr dom = NULL;
 
-    qemuDriverLock(driver);
     vm = virDomainFindByName(&driver->domains, name);
-    qemuDriverUnlock(driver);
 
     if (!vm) {
         virReportError(VIR_ERR_NO_DOMAIN,
@@ -1514,20 +2538,11 @@ cleanup:
 
 static int qemuDomainIsActive(virDomainPtr dom)
 {
-    virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr obj;
     int ret = -1;
 
-    qemuDriverLock(driver);
-    obj = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-    if (!obj) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(obj = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
     ret = virDomainObjIsActive(obj);
 
 cleanup:
@@ -1538,20 +2553,11 @@ cleanup:
 
 static int qemuDomainIsPersistent(virDomainPtr dom)
 {
-    virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr obj;
     int ret = -1;
 
-    qemuDriverLock(driver);
-    obj = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-    if (!obj) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(obj = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
     ret = obj->persistent;
 
 cleanup:
@@ -1562,20 +2568,11 @@ cleanup:
 
 static int qemuDomainIsUpdated(virDomainPtr dom)
 {
-    virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr obj;
     int ret = -1;
 
-    qemuDriverLock(driver);
-    obj = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-    if (!obj) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(obj = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
     ret = obj->updated;
 
 cleanup:
@@ -1606,9 +2603,7 @@ static int qemuListDomains(virConnectPtr conn, int *ids, int nids) {
     virQEMUDriverPtr driver = conn->privateData;
     int n;
 
-    qemuDriverLock(driver);
     n = virDomainObjListGetActiveIDs(&driver->domains, ids, nids);
-    qemuDriverUnlock(driver);
 
     return n;
 }
@@ -1617,9 +2612,7 @@ static int qemuNumDomains(virConnectPtr conn) {
     virQEMUDriverPtr driver = conn->privateData;
     int n;
 
-    qemuDriverLock(driver);
     n = virDomainObjListNumOfDomains(&driver->domains, 1);
-    qemuDriverUnlock(driver);
 
     return n;
 }
@@ -1907,17 +2900,8 @@ static int qemuDomainShutdownFlags(virDomainPtr dom, unsigned int flags) {
         return -1;
     }
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     priv = vm->privateData;
 
@@ -1997,17 +2981,8 @@ qemuDomainReboot(virDomainPtr dom, unsigned int flags)
         return -1;
     }
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     priv = vm->privateData;
 
@@ -2089,17 +3064,8 @@ qemuDomainReset(virDomainPtr dom, unsigned int flags)
 
     virCheckFlags(0, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
         goto cleanup;
@@ -2229,21 +3195,150 @@ qemuDomainDestroy(virDomainPtr dom)
     return qemuDomainDestroyFlags(dom, 0);
 }
 
+/*
+ * Destroy every running domain.  All qemu processes are signalled
+ * and waited for together before any domain is cleaned up, so that
+ * the grace period of qemuProcessKill is spent once for the whole
+ * host instead of once per domain; the per-domain cleanup then only
+ * finds processes which are already gone.
+ */
+static int
+qemuConnectDestroyAllDomains(virConnectPtr conn,
+                             unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
+    pid_t *pids = NULL;
+    size_t npids = 0;
+    int nalive = 0;
+    int ndestroyed = 0;
+    bool failed = false;
+    size_t i;
+    int j;
+    int ret = -1;
+
+    virCheckFlags(VIR_CONNECT_DESTROY_ALL_DOMAINS_GRACEFUL, -1);
+
+    qemuDriverLock(driver);
+
+    if (virDomainObjListCollect(&driver->domains, &vms, &nvms,
+                                VIR_CONNECT_LIST_DOMAINS_ACTIVE) < 0)
+        goto cleanup;
+
+    if (nvms == 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(pids, nvms) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    /* Like qemuDomainDestroyFlags, keep the monitor EOF callback from
+     * doing our work while the domains are unlocked */
+    for (i = 0; i < nvms; i++) {
+        virDomainObjPtr vm = vms[i];
+        qemuDomainObjPrivatePtr priv = vm->privateData;
+
+        virDomainObjLock(vm);
+        if (virDomainObjIsActive(vm)) {
+            qemuDomainSetFakeReboot(driver, vm, false);
+            priv->beingDestroyed = true;
+            pids[npids++] = vm->pid;
+        }
+        virDomainObjUnlock(vm);
+    }
+
+    qemuDriverUnlock(driver);
+    nalive = virProcessKillPainfullyAll(pids, npids,
+                                        !(flags & VIR_CONNECT_DESTROY_ALL_DOMAINS_GRACEFUL));
+    qemuDriverLock(driver);
+
+    if (nalive < 0) {
+        failed = true;
+        nalive = 0;
+    }
+
+    for (i = 0; i < nvms; i++) {
+        virDomainObjPtr vm = vms[i];
+        qemuDomainObjPrivatePtr priv = vm->privateData;
+        virDomainEventPtr event = NULL;
+
+        virDomainObjLock(vm);
+        if (!priv->beingDestroyed)
+            goto next;
+
+        /* Survivors of SIGKILL are left to qemuProcessStop */
+        if (flags & VIR_CONNECT_DESTROY_ALL_DOMAINS_GRACEFUL) {
+            for (j = 0; j < nalive; j++) {
+                if (pids[j] == vm->pid)
+                    break;
+            }
+            if (j < nalive) {
+                virReportError(VIR_ERR_OPERATION_FAILED,
+                               _("domain '%s' did not terminate"),
+                               vm->def->name);
+                priv->beingDestroyed = false;
+                failed = true;
+                goto next;
+            }
+        }
+
+        if (qemuDomainObjBeginJobWithDriver(driver, vm, QEMU_JOB_DESTROY) < 0) {
+            priv->beingDestroyed = false;
+            failed = true;
+            goto next;
+        }
+
+        priv->beingDestroyed = false;
+
+        if (virDomainObjIsActive(vm)) {
+            qemuProcessStop(driver, vm, VIR_DOMAIN_SHUTOFF_DESTROYED, 0);
+            event = virDomainEventNewFromObj(vm,
+                                             VIR_DOMAIN_EVENT_STOPPED,
+                                             VIR_DOMAIN_EVENT_STOPPED_DESTROYED);
+            virDomainAuditStop(vm, "destroyed");
+            ndestroyed++;
+        }
+
+        /* We hold a reference from the list, so @vm stays around */
+        if (qemuDomainObjEndJob(driver, vm) > 0 && !vm->persistent) {
+            qemuDomainRemoveInactive(driver, vm);
+            virObjectUnref(vm);
+            if (event)
+                qemuDomainEventQueue(driver, event);
+            continue;
+        }
+
+    next:
+        virDomainObjUnlock(vm);
+        virObjectUnref(vm);
+        if (event)
+            qemuDomainEventQueue(driver, event);
+    }
+    VIR_FREE(vms);
+    nvms = 0;
+
+    if (!failed)
+        ret = ndestroyed;
+
+cleanup:
+    for (i = 0; i < nvms; i++)
+        virObjectUnref(vms[i]);
+    VIR_FREE(vms);
+    VIR_FREE(pids);
+    qemuDriverUnlock(driver);
+    return ret;
+}
+
 static char *qemuDomainGetOSType(virDomainPtr dom) {
-    virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
     char *type = NULL;
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (!(type = strdup(vm->def->os.type)))
         virReportOOMError();
@@ -2258,21 +3353,11 @@ cleanup:
 static unsigned long long
 qemuDomainGetMaxMemory(virDomainPtr dom)
 {
-    virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
     unsigned long long ret = 0;
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     ret = vm->def->mem.max_balloon;
 
@@ -2294,16 +3379,8 @@ static int qemuDomainSetMemoryFlags(virDomainPtr dom, unsigned long newmem,
                   VIR_DOMAIN_AFFECT_CONFIG |
                   VIR_DOMAIN_MEM_MAXIMUM, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
         goto cleanup;
@@ -2520,16 +3597,8 @@ static int qemuDomainGetInfo(virDomainPtr dom,
     int err;
     unsigned long long balloon;
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     info->state = virDomainObjGetState(vm, NULL);
 
@@ -2602,23 +3671,13 @@ qemuDomainGetState(virDomainPtr dom,
                    int *reason,
                    unsigned int flags)
 {
-    virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
     int ret = -1;
 
     virCheckFlags(0, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     *state = virDomainObjGetState(vm, reason);
     ret = 0;
@@ -2634,24 +3693,14 @@ qemuDomainGetControlInfo(virDomainPtr dom,
                           virDomainControlInfoPtr info,
                           unsigned int flags)
 {
-    virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
     qemuDomainObjPrivatePtr priv;
     int ret = -1;
 
     virCheckFlags(0, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (!virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID,
@@ -2709,6 +3758,7 @@ typedef enum {
      */
     QEMU_SAVE_FORMAT_XZ = 3,
     QEMU_SAVE_FORMAT_LZOP = 4,
+    QEMU_SAVE_FORMAT_PARALLEL = 5,
     /* Note: add new members only at the end.
        These values are used in the on-disk format.
        Do not change or re-use numbers. */
@@ -2722,7 +3772,8 @@ VIR_ENUM_IMPL(qemuSaveCompression, QEMU_SAVE_FORMAT_LAST,
               "gzip",
               "bzip2",
               "xz",
-              "lzop")
+              "lzop",
+              "parallel")
 
 typedef struct _virQEMUSaveHeader virQEMUSaveHeader;
 typedef virQEMUSaveHeader *virQEMUSaveHeaderPtr;
@@ -2770,10 +3821,14 @@ endjob:
 }
 
 /* Given a virQEMUSaveFormat compression level, return the name
- * of the program to run, or NULL if no program is needed.  */
+ * of the program to run, or NULL if no program is needed.  The
+ * "parallel" format is implemented by libvirt's own I/O helper,
+ * which spreads the work over all host CPUs.  */
 static const char *
 qemuCompressProgramName(int compress)
 {
+    if (compress == QEMU_SAVE_FORMAT_PARALLEL)
+        return LIBEXECDIR "/libvirt_iohelper";
     return (compress == QEMU_SAVE_FORMAT_RAW ? NULL :
             qemuSaveCompressionTypeToString(compress));
 }
@@ -2893,6 +3948,13 @@ cleanup:
     return fd;
 }
 
+/* Called by qemuDomainSaveMemory once qemu has sent the whole memory
+ * state, while the guest is still paused but before the image is
+ * flushed to disk */
+typedef int (*qemuDomainSaveMemoryCallback)(virQEMUDriverPtr driver,
+                                            virDomainObjPtr vm,
+                                            void *opaque);
+
 /* Helper function to execute a migration to file with a correct save header
  * the caller needs to make sure that the processors are stopped and do all other
  * actions besides saving memory */
@@ -2904,7 +3966,9 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
                      int compressed,
                      bool was_running,
                      unsigned int flags,
-                     enum qemuDomainAsyncJob asyncJob)
+                     enum qemuDomainAsyncJob asyncJob,
+                     qemuDomainSaveMemoryCallback converged,
+                     void *opaque)
 {
     virQEMUSaveHeader header;
     bool bypassSecurityDriver = false;
@@ -2978,6 +4042,9 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
                             asyncJob) < 0)
         goto cleanup;
 
+    if (converged && converged(driver, vm, opaque) < 0)
+        goto cleanup;
+
     /* Touch up file header to mark image complete. */
 
     /* Reopen the file to touch up the header, since we aren't set
@@ -3095,7 +4162,8 @@ qemuDomainSaveInternal(virQEMUDriverPtr driver, virDomainPtr dom,
     }
 
     ret = qemuDomainSaveMemory(driver, vm, path, xml, compressed,
-                               was_running, flags, QEMU_ASYNC_JOB_SAVE);
+                               was_running, flags, QEMU_ASYNC_JOB_SAVE,
+                               NULL, NULL);
     if (ret < 0)
         goto endjob;
 
@@ -3147,6 +4215,13 @@ static bool qemuCompressProgramAvailable(virQEMUSaveFormat compress)
 
     if (compress == QEMU_SAVE_FORMAT_RAW)
         return true;
+    if (compress == QEMU_SAVE_FORMAT_PARALLEL) {
+#if HAVE_ZLIB
+        return virFileIsExecutable(qemuCompressProgramName(compress));
+#else
+        return false;
+#endif
+    }
     prog = qemuSaveCompressionTypeToString(compress);
     c = virFindFileInPath(prog);
     if (!c)
@@ -3352,10 +4427,19 @@ cleanup:
     return ret;
 }
 
+/* Dump the guest memory in ELF format to @fd, which is open on @path.
+ * If @compressor is set, qemu writes into a pipe and the compressor
+ * writes into @fd instead, just like qemuMigrationToFile does for full
+ * dumps.  dump-guest-memory only returns once the dump is complete,
+ * so progress is derived from the size of @path meanwhile.  */
 static int qemuDumpToFd(virQEMUDriverPtr driver, virDomainObjPtr vm,
-                        int fd, enum qemuDomainAsyncJob asyncJob)
+                        int fd, const char *path, const char *compressor,
+                        enum qemuDomainAsyncJob asyncJob)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    virCommandPtr cmd = NULL;
+    int pipeFD[2] = { -1, -1 };
+    int dumpFD = fd;
     int ret = -1;
 
     if (!qemuCapsGet(priv->caps, QEMU_CAPS_DUMP_GUEST_MEMORY)) {
@@ -3364,18 +4448,60 @@ static int qemuDumpToFd(virQEMUDriverPtr driver, virDomainObjPtr vm,
         return -1;
     }
 
+    if (compressor) {
+        const char *args[] = { compressor, "-c", NULL };
+
+        if (pipe(pipeFD) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("unable to create pipe for compressor"));
+            goto cleanup;
+        }
+        if (virSetCloseExec(pipeFD[1]) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to set cloexec flag"));
+            goto cleanup;
+        }
+        cmd = virCommandNewArgs(args);
+        virCommandSetInputFD(cmd, pipeFD[0]);
+        virCommandSetOutputFD(cmd, &fd);
+        if (virCommandRunAsync(cmd, NULL) < 0)
+            goto cleanup;
+        VIR_FORCE_CLOSE(pipeFD[0]);
+        dumpFD = pipeFD[1];
+    }
+
     if (virSecurityManagerSetImageFDLabel(driver->securityManager, vm->def,
-                                          fd) < 0)
-        return -1;
+                                          dumpFD) < 0)
+        goto cleanup;
 
     priv->job.dump_memory_only = true;
+    priv->job.info.type = VIR_DOMAIN_JOB_UNBOUNDED;
+    /* The size of a compressed dump says nothing about how much
+     * memory has been written yet */
+    if (!compressor)
+        priv->job.info.dataTotal = vm->def->mem.cur_balloon << 10;
+    priv->job.path = path;
+    priv->job.pathOffset = 0;
 
     if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
-        return -1;
+        goto cleanup;
 
-    ret = qemuMonitorDumpToFd(priv->mon, fd);
+    ret = qemuMonitorDumpToFd(priv->mon, dumpFD);
     qemuDomainObjExitMonitorWithDriver(driver, vm);
 
+    /* The compressor only sees the end of its input once every copy
+     * of the write end is closed, including the one passed to qemu */
+    VIR_FORCE_CLOSE(pipeFD[1]);
+    if (ret == 0 && cmd && virCommandWait(cmd, NULL) < 0)
+        ret = -1;
+
+cleanup:
+    priv->job.path = NULL;
+    VIR_FORCE_CLOSE(pipeFD[0]);
+    VIR_FORCE_CLOSE(pipeFD[1]);
+    if (ret < 0 && cmd)
+        virCommandAbort(cmd);
+    virCommandFree(cmd);
     return ret;
 }
 
@@ -3414,7 +4540,9 @@ doCoreDump(virQEMUDriverPtr driver,
         goto cleanup;
 
     if (dump_flags & VIR_DUMP_MEMORY_ONLY) {
-        ret = qemuDumpToFd(driver, vm, fd, QEMU_ASYNC_JOB_DUMP);
+        ret = qemuDumpToFd(driver, vm, fd, path,
+                           qemuCompressProgramName(compress),
+                           QEMU_ASYNC_JOB_DUMP);
     } else {
         ret = qemuMigrationToFile(driver, vm, fd, 0, path,
                                   qemuCompressProgramName(compress), false,
@@ -3584,6 +4712,48 @@ cleanup:
     return ret;
 }
 
+/* Largest screendump read back from qemu, 4096x4096 in PPM */
+#define QEMU_SCREENSHOT_MAX_SIZE (4096 * 4096 * 3 + 64)
+
+typedef struct _qemuScreenshotData qemuScreenshotData;
+typedef qemuScreenshotData *qemuScreenshotDataPtr;
+struct _qemuScreenshotData {
+    int fifofd;                 /* read end of the fifo qemu writes to */
+    int fd;                     /* write end of the stream's pipe */
+};
+
+/*
+ * Collects the screendump qemu writes into the fifo and feeds it into
+ * the stream. qemu blocks writing the fifo, so it has to be drained
+ * while the monitor command runs, but the stream can only be read once
+ * the API returns: the image is kept in memory in between.
+ */
+static void
+qemuDomainScreenshotWorker(void *opaque)
+{
+    qemuScreenshotDataPtr data = opaque;
+    char *buf = NULL;
+    int len;
+
+    if ((len = virFileReadLimFD(data->fifofd, QEMU_SCREENSHOT_MAX_SIZE,
+                                &buf)) < 0) {
+        VIR_WARN("Unable to read screendump: %s", strerror(errno));
+        goto cleanup;
+    }
+
+    /* EPIPE just means the stream was closed early */
+    if (safewrite(data->fd, buf, len) < 0 && errno != EPIPE)
+        VIR_WARN("Unable to write screendump to stream: %s",
+                 strerror(errno));
+
+cleanup:
+    VIR_FREE(buf);
+    VIR_FORCE_CLOSE(data->fifofd);
+    /* the stream sees the end of data once this is closed */
+    VIR_FORCE_CLOSE(data->fd);
+    VIR_FREE(data);
+}
+
 static char *
 qemuDomainScreenshot(virDomainPtr dom,
                      virStreamPtr st,
@@ -3593,24 +4763,20 @@ qemuDomainScreenshot(virDomainPtr dom,
     virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
     qemuDomainObjPrivatePtr priv;
+    qemuScreenshotDataPtr data = NULL;
+    virThread thread;
     char *tmp = NULL;
-    int tmp_fd = -1;
+    int fifofd = -1;
+    int holdfd = -1;
+    int pipefd[2] = { -1, -1 };
     char *ret = NULL;
     bool unlink_tmp = false;
+    int rc;
 
     virCheckFlags(0, NULL);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     priv = vm->privateData;
 
@@ -3632,41 +4798,81 @@ qemuDomainScreenshot(virDomainPtr dom,
         goto endjob;
     }
 
-    if (virAsprintf(&tmp, "%s/qemu.screendump.XXXXXX", driver->cacheDir) < 0) {
+    /* screendump only takes a file name, so qemu is given a fifo: the
+     * image never touches the disk. The job makes the name unique. */
+    if (virAsprintf(&tmp, "%s/qemu.screendump.%d",
+                    driver->cacheDir, vm->def->id) < 0) {
         virReportOOMError();
         goto endjob;
     }
 
-    if ((tmp_fd = mkostemp(tmp, O_CLOEXEC)) == -1) {
-        virReportSystemError(errno, _("mkostemp(\"%s\") failed"), tmp);
+    unlink(tmp);
+    if (mkfifo(tmp, S_IRUSR | S_IWUSR) < 0) {
+        virReportSystemError(errno, _("cannot create fifo '%s'"), tmp);
         goto endjob;
     }
     unlink_tmp = true;
 
+    /* Holding a write end of our own until the monitor command returns
+     * means the reader only sees the end of the data once qemu is done
+     * with the fifo, or if qemu fails before even opening it */
+    if ((fifofd = open(tmp, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0 ||
+        (holdfd = open(tmp, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) < 0) {
+        virReportSystemError(errno, _("cannot open fifo '%s'"), tmp);
+        goto endjob;
+    }
+    if (virSetBlocking(fifofd, true) < 0) {
+        virReportSystemError(errno, _("cannot set blocking mode on '%s'"),
+                             tmp);
+        goto endjob;
+    }
+
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+        virReportSystemError(errno, "%s", _("unable to create pipe"));
+        goto endjob;
+    }
+
     virSecurityManagerSetSavedStateLabel(qemu_driver->securityManager, vm->def, tmp);
 
-    qemuDomainObjEnterMonitor(driver, vm);
-    if (qemuMonitorScreendump(priv->mon, tmp) < 0) {
-        qemuDomainObjExitMonitor(driver, vm);
+    if (VIR_ALLOC(data) < 0) {
+        virReportOOMError();
         goto endjob;
     }
-    qemuDomainObjExitMonitor(driver, vm);
+    data->fifofd = fifofd;
+    data->fd = pipefd[1];
 
-    if (VIR_CLOSE(tmp_fd) < 0) {
-        virReportSystemError(errno, _("unable to close %s"), tmp);
+    if (virThreadCreate(&thread, false, qemuDomainScreenshotWorker,
+                        data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create screenshot thread"));
+        VIR_FREE(data);
         goto endjob;
     }
+    fifofd = -1;
+    pipefd[1] = -1;
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    rc = qemuMonitorScreendump(priv->mon, tmp);
+    qemuDomainObjExitMonitor(driver, vm);
+    VIR_FORCE_CLOSE(holdfd);
+    if (rc < 0)
+        goto endjob;
 
-    if (virFDStreamOpenFile(st, tmp, 0, 0, O_RDONLY) < 0) {
+    if (virFDStreamOpen(st, pipefd[0]) < 0) {
         virReportError(VIR_ERR_OPERATION_FAILED, "%s",
                        _("unable to open stream"));
         goto endjob;
     }
+    pipefd[0] = -1;
 
     ret = strdup("image/x-portable-pixmap");
 
 endjob:
-    VIR_FORCE_CLOSE(tmp_fd);
+    /* closing the read end on failure makes the worker give up */
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(pipefd[1]);
+    VIR_FORCE_CLOSE(holdfd);
+    VIR_FORCE_CLOSE(fifofd);
     if (unlink_tmp)
         unlink(tmp);
     VIR_FREE(tmp);
@@ -3910,6 +5116,7 @@ static int qemuDomainHotplugVcpus(virQEMUDriverPtr driver,
                 }
 
                 /* Remove cgroup for the offlined vcpu */
+                qemuDomainObjDropCgroups(vm);
                 virCgroupRemove(cgroup_vcpu);
                 virCgroupFree(&cgroup_vcpu);
             }
@@ -3966,17 +5173,8 @@ qemuDomainSetVcpusFlags(virDomainPtr dom, unsigned int nvcpus,
         return -1;
     }
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
         goto cleanup;
@@ -4078,17 +5276,8 @@ qemuDomainPinVcpuFlags(virDomainPtr dom,
     virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
                   VIR_DOMAIN_AFFECT_CONFIG, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (virDomainLiveConfigHelperMethod(driver->caps, vm, &flags,
                                         &persistentDef) < 0)
@@ -4261,17 +5450,8 @@ qemuDomainGetVcpuPinInfo(virDomainPtr dom,
     virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
                   VIR_DOMAIN_AFFECT_CONFIG, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (virDomainLiveConfigHelperMethod(driver->caps, vm, &flags,
                                         &targetDef) < 0)
@@ -4351,17 +5531,8 @@ qemuDomainPinEmulator(virDomainPtr dom,
     virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
                   VIR_DOMAIN_AFFECT_CONFIG, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (vm->def->placement_mode == VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO) {
         virReportError(VIR_ERR_OPERATION_INVALID, "%s",
@@ -4508,17 +5679,8 @@ qemuDomainGetEmulatorPinInfo(virDomainPtr dom,
     virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
                   VIR_DOMAIN_AFFECT_CONFIG, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (virDomainLiveConfigHelperMethod(driver->caps, vm, &flags,
                                         &targetDef) < 0)
@@ -4573,23 +5735,13 @@ qemuDomainGetVcpus(virDomainPtr dom,
                    int maxinfo,
                    unsigned char *cpumaps,
                    int maplen) {
-    virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
     int i, v, maxcpu, hostcpus;
     int ret = -1;
     qemuDomainObjPrivatePtr priv;
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (!virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID,
@@ -4617,17 +5769,27 @@ qemuDomainGetVcpus(virDomainPtr dom,
             for (i = 0 ; i < maxinfo ; i++) {
                 info[i].number = i;
                 info[i].state = VIR_VCPU_RUNNING;
+            }
 
-                if (priv->vcpupids != NULL &&
-                    qemuGetProcessInfo(&(info[i].cpuTime),
-                                       &(info[i].cpu),
-                                       NULL,
-                                       vm->pid,
-                                       priv->vcpupids[i]) < 0) {
-                    virReportSystemError(errno, "%s",
-                                         _("cannot get vCPU placement & pCPU time"));
+            if (priv->vcpupids != NULL) {
+                virProcessInfoThreadStatsPtr tstats;
+
+                if (VIR_ALLOC_N(tstats, maxinfo) < 0) {
+                    virReportOOMError();
+                    goto cleanup;
+                }
+
+                if (virProcessInfoGetThreadStats(vm->pid, priv->vcpupids,
+                                                 maxinfo, tstats) < 0) {
+                    VIR_FREE(tstats);
                     goto cleanup;
                 }
+
+                for (i = 0 ; i < maxinfo ; i++) {
+                    info[i].cpuTime = tstats[i].cpuTime;
+                    info[i].cpu = tstats[i].lastCpu;
+                }
+                VIR_FREE(tstats);
             }
         }
 
@@ -4679,17 +5841,8 @@ qemuDomainGetVcpusFlags(virDomainPtr dom, unsigned int flags)
                   VIR_DOMAIN_AFFECT_CONFIG |
                   VIR_DOMAIN_VCPU_MAXIMUM, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (virDomainLiveConfigHelperMethod(driver->caps, vm, &flags, &def) < 0)
         goto cleanup;
@@ -5046,13 +6199,15 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
     virCommandPtr cmd = NULL;
 
     if (header->version == 2) {
-        const char *prog = qemuSaveCompressionTypeToString(header->compressed);
-        if (prog == NULL) {
+        const char *prog;
+
+        if (qemuSaveCompressionTypeToString(header->compressed) == NULL) {
             virReportError(VIR_ERR_OPERATION_FAILED,
                            _("Invalid compressed save format %d"),
                            header->compressed);
             goto out;
         }
+        prog = qemuCompressProgramName(header->compressed);
 
         if (header->compressed != QEMU_SAVE_FORMAT_RAW) {
             cmd = virCommandNewArgList(prog, "-dc", NULL);
@@ -5430,8 +6585,10 @@ endjob:
             }
             if (err < 0)
                 goto cleanup;
-            if (err > 0)
+            if (err > 0 && vm->def->mem.cur_balloon != balloon) {
                 vm->def->mem.cur_balloon = balloon;
+                virDomainDefInvalidateXMLCache(vm->def);
+            }
             /* err == 0 indicates no balloon support, so ignore it */
         }
     }
@@ -5620,9 +6777,7 @@ static int qemuListDefinedDomains(virConnectPtr conn,
     virQEMUDriverPtr driver = conn->privateData;
     int n;
 
-    qemuDriverLock(driver);
     n = virDomainObjListGetInactiveNames(&driver->domains, names, nnames);
-    qemuDriverUnlock(driver);
     return n;
 }
 
@@ -5630,9 +6785,7 @@ static int qemuNumDefinedDomains(virConnectPtr conn) {
     virQEMUDriverPtr driver = conn->privateData;
     int n;
 
-    qemuDriverLock(driver);
     n = virDomainObjListNumOfDomains(&driver->domains, 0);
-    qemuDriverUnlock(driver);
 
     return n;
 }
@@ -5849,6 +7002,7 @@ static virDomainPtr qemuDomainDefine(virConnectPtr conn, const char *xml) {
     } else {
         virDomainDefFree(def_backup);
     }
+    virDomainObjListUpdateMetadataIndex(&driver->domains, vm);
 
     event = virDomainEventNewFromObj(vm,
                                      VIR_DOMAIN_EVENT_DEFINED,
@@ -5973,36 +7127,38 @@ qemuDomainUndefine(virDomainPtr dom)
     return qemuDomainUndefineFlags(dom, 0);
 }
 
+/* Check that @disk can be hotplugged into @vm and look up its backing
+ * chain.  If @cgroup is non-NULL, also allow the domain to use it.  */
 static int
-qemuDomainAttachDeviceDiskLive(virConnectPtr conn,
-                               virQEMUDriverPtr driver,
-                               virDomainObjPtr vm,
-                               virDomainDeviceDefPtr dev)
+qemuDomainPrepareDiskLive(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm,
+                          virDomainDiskDefPtr disk,
+                          virCgroupPtr cgroup)
 {
-    virDomainDiskDefPtr disk = dev->data.disk;
-    virCgroupPtr cgroup = NULL;
-    int ret = -1;
-
     if (disk->driverName != NULL && !STREQ(disk->driverName, "qemu")) {
         virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                        _("unsupported driver name '%s' for disk '%s'"),
                        disk->driverName, disk->src);
-        goto end;
+        return -1;
     }
 
     if (qemuDomainDetermineDiskChain(driver, disk, false) < 0)
-        goto end;
+        return -1;
+
+    if (cgroup && qemuSetupDiskCgroup(vm, cgroup, disk) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+qemuDomainHotplugDisk(virConnectPtr conn,
+                      virQEMUDriverPtr driver,
+                      virDomainObjPtr vm,
+                      virDomainDiskDefPtr disk)
+{
+    int ret = -1;
 
-    if (qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_DEVICES)) {
-        if (virCgroupForDomain(driver->cgroup, vm->def->name, &cgroup, 0)) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("Unable to find cgroup for %s"),
-                           vm->def->name);
-            goto end;
-        }
-        if (qemuSetupDiskCgroup(vm, cgroup, disk) < 0)
-            goto end;
-    }
     switch (disk->device)  {
     case VIR_DOMAIN_DISK_DEVICE_CDROM:
     case VIR_DOMAIN_DISK_DEVICE_FLOPPY:
@@ -6035,6 +7191,33 @@ qemuDomainAttachDeviceDiskLive(virConnectPtr conn,
         break;
     }
 
+    return ret;
+}
+
+static int
+qemuDomainAttachDeviceDiskLive(virConnectPtr conn,
+                               virQEMUDriverPtr driver,
+                               virDomainObjPtr vm,
+                               virDomainDeviceDefPtr dev)
+{
+    virDomainDiskDefPtr disk = dev->data.disk;
+    virCgroupPtr cgroup = NULL;
+    int ret = -1;
+
+    if (qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_DEVICES)) {
+        if (virCgroupForDomain(driver->cgroup, vm->def->name, &cgroup, 0)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unable to find cgroup for %s"),
+                           vm->def->name);
+            goto end;
+        }
+    }
+
+    if (qemuDomainPrepareDiskLive(driver, vm, disk, cgroup) < 0)
+        goto end;
+
+    ret = qemuDomainHotplugDisk(conn, driver, vm, disk);
+
     if (ret != 0 && cgroup) {
         if (qemuTeardownDiskCgroup(vm, cgroup, disk) < 0)
             VIR_WARN("Failed to teardown cgroup for disk path %s",
@@ -6067,10 +7250,15 @@ qemuDomainAttachDeviceControllerLive(virQEMUDriverPtr driver,
     return ret;
 }
 
+/*
+ * Disks are expected to have gone through qemuDomainPrepareDiskLive
+ * already if @prepared is true.
+ */
 static int
 qemuDomainAttachDeviceLive(virDomainObjPtr vm,
                            virDomainDeviceDefPtr dev,
-                           virDomainPtr dom)
+                           virDomainPtr dom,
+                           bool prepared)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
     int ret = -1;
@@ -6078,7 +7266,11 @@ qemuDomainAttachDeviceLive(virDomainObjPtr vm,
     switch (dev->type) {
     case VIR_DOMAIN_DEVICE_DISK:
         qemuDomainObjCheckDiskTaint(driver, vm, dev->data.disk, -1);
-        ret = qemuDomainAttachDeviceDiskLive(dom->conn, driver, vm, dev);
+        if (prepared)
+            ret = qemuDomainHotplugDisk(dom->conn, driver, vm,
+                                        dev->data.disk);
+        else
+            ret = qemuDomainAttachDeviceDiskLive(dom->conn, driver, vm, dev);
         if (!ret)
             dev->data.disk = NULL;
         break;
@@ -6671,7 +7863,7 @@ qemuDomainModifyDeviceFlags(virDomainPtr dom, const char *xml,
 
         switch (action) {
         case QEMU_DEVICE_ATTACH:
-            ret = qemuDomainAttachDeviceLive(vm, dev_copy, dom);
+            ret = qemuDomainAttachDeviceLive(vm, dev_copy, dom, false);
             break;
         case QEMU_DEVICE_DETACH:
             ret = qemuDomainDetachDeviceLive(vm, dev_copy, dom);
@@ -6736,6 +7928,188 @@ static int qemuDomainAttachDevice(virDomainPtr dom, const char *xml)
                                        VIR_DOMAIN_AFFECT_LIVE);
 }
 
+/*
+ * Attach all of @xmls within a single job.  Every device is parsed and
+ * checked before anything is changed, the cgroup device ACLs of all
+ * disks are set up in one pass, and the status and config files are
+ * only written once at the end.
+ */
+static int
+qemuDomainAttachDevices(virDomainPtr dom,
+                        const char **xmls,
+                        unsigned int nxmls,
+                        unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm = NULL;
+    virDomainDefPtr vmdef = NULL;
+    virDomainDeviceDefPtr *devs = NULL;
+    virDomainDeviceDefPtr *live = NULL;
+    virCgroupPtr cgroup = NULL;
+    qemuCapsPtr caps = NULL;
+    qemuDomainObjPrivatePtr priv;
+    unsigned int affect;
+    size_t nprepared = 0;
+    size_t i;
+    int ret = -1;
+
+    virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
+                  VIR_DOMAIN_AFFECT_CONFIG, -1);
+
+    affect = flags & (VIR_DOMAIN_AFFECT_LIVE | VIR_DOMAIN_AFFECT_CONFIG);
+
+    if (VIR_ALLOC_N(devs, nxmls) < 0 ||
+        VIR_ALLOC_N(live, nxmls) < 0) {
+        virReportOOMError();
+        VIR_FREE(devs);
+        return -1;
+    }
+
+    qemuDriverLock(driver);
+    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
+    if (!vm) {
+        char uuidstr[VIR_UUID_STRING_BUFLEN];
+        virUUIDFormat(dom->uuid, uuidstr);
+        virReportError(VIR_ERR_NO_DOMAIN,
+                       _("no domain with matching uuid '%s'"), uuidstr);
+        goto cleanup;
+    }
+    priv = vm->privateData;
+
+    if (qemuDomainObjBeginJobWithDriver(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (virDomainObjIsActive(vm)) {
+        if (affect == VIR_DOMAIN_AFFECT_CURRENT)
+            flags |= VIR_DOMAIN_AFFECT_LIVE;
+    } else {
+        if (affect == VIR_DOMAIN_AFFECT_CURRENT)
+            flags |= VIR_DOMAIN_AFFECT_CONFIG;
+        /* check consistency between flags and the vm state */
+        if (flags & VIR_DOMAIN_AFFECT_LIVE) {
+            virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                           _("cannot do live update a device on "
+                             "inactive domain"));
+            goto endjob;
+        }
+    }
+
+    if ((flags & VIR_DOMAIN_AFFECT_CONFIG) && !vm->persistent) {
+         virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                        _("cannot modify device on transient domain"));
+         goto endjob;
+    }
+
+    for (i = 0; i < nxmls; i++) {
+        if (!(devs[i] = virDomainDeviceDefParse(driver->caps, vm->def,
+                                                xmls[i],
+                                                VIR_DOMAIN_XML_INACTIVE)))
+            goto endjob;
+
+        if (flags & VIR_DOMAIN_AFFECT_CONFIG &&
+            flags & VIR_DOMAIN_AFFECT_LIVE) {
+            /* adding to CONFIG takes one instance */
+            if (!(live[i] = virDomainDeviceDefCopy(driver->caps, vm->def,
+                                                   devs[i])))
+                goto endjob;
+        } else if (flags & VIR_DOMAIN_AFFECT_LIVE) {
+            live[i] = devs[i];
+            devs[i] = NULL;
+        }
+    }
+
+    if (priv->caps)
+        caps = virObjectRef(priv->caps);
+    else if (!(caps = qemuCapsCacheLookup(driver->capsCache, vm->def->emulator)))
+        goto endjob;
+
+    if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
+        if (!(vmdef = virDomainObjCopyPersistentDef(driver->caps, vm)))
+            goto endjob;
+
+        for (i = 0; i < nxmls; i++) {
+            if (virDomainDefCompatibleDevice(vm->def, devs[i]) < 0 ||
+                qemuDomainAttachDeviceConfig(caps, vmdef, devs[i]) < 0)
+                goto endjob;
+        }
+    }
+
+    if (flags & VIR_DOMAIN_AFFECT_LIVE) {
+        for (i = 0; i < nxmls; i++) {
+            if (virDomainDefCompatibleDevice(vm->def, live[i]) < 0)
+                goto endjob;
+        }
+
+        if (qemuCgroupControllerActive(driver,
+                                       VIR_CGROUP_CONTROLLER_DEVICES) &&
+            virCgroupForDomain(driver->cgroup, vm->def->name, &cgroup, 0)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unable to find cgroup for %s"),
+                           vm->def->name);
+            goto endjob;
+        }
+
+        for (nprepared = 0; nprepared < nxmls; nprepared++) {
+            if (live[nprepared]->type == VIR_DOMAIN_DEVICE_DISK &&
+                qemuDomainPrepareDiskLive(driver, vm,
+                                          live[nprepared]->data.disk,
+                                          cgroup) < 0)
+                goto endjob;
+        }
+
+        for (i = 0; i < nxmls; i++) {
+            if (qemuDomainAttachDeviceLive(vm, live[i], dom, true) < 0)
+                break;
+        }
+
+        /*
+         * update domain status forcibly because the domain status may be
+         * changed even if we failed to attach the device. For example,
+         * a new controller may be created.
+         */
+        if (virDomainSaveStatus(driver->caps, driver->stateDir, vm) < 0 ||
+            i < nxmls)
+            goto endjob;
+    }
+
+    /* Finally, if no error until here, we can save config. */
+    if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
+        if (virDomainSaveConfig(driver->configDir, vmdef) < 0)
+            goto endjob;
+        virDomainObjAssignDef(vm, vmdef, false);
+        vmdef = NULL;
+    }
+
+    ret = 0;
+
+endjob:
+    /* drop the ACLs of disks which did not make it into the domain */
+    for (i = 0; cgroup && i < nprepared; i++) {
+        if (live[i]->type == VIR_DOMAIN_DEVICE_DISK && live[i]->data.disk &&
+            qemuTeardownDiskCgroup(vm, cgroup, live[i]->data.disk) < 0)
+            VIR_WARN("Failed to teardown cgroup for disk path %s",
+                     NULLSTR(live[i]->data.disk->src));
+    }
+    if (qemuDomainObjEndJob(driver, vm) == 0)
+        vm = NULL;
+
+cleanup:
+    if (cgroup)
+        virCgroupFree(&cgroup);
+    virObjectUnref(caps);
+    virDomainDefFree(vmdef);
+    for (i = 0; i < nxmls; i++) {
+        virDomainDeviceDefFree(devs[i]);
+        virDomainDeviceDefFree(live[i]);
+    }
+    VIR_FREE(devs);
+    VIR_FREE(live);
+    if (vm)
+        virDomainObjUnlock(vm);
+    qemuDriverUnlock(driver);
+    return ret;
+}
+
 
 static int qemuDomainUpdateDeviceFlags(virDomainPtr dom,
                                        const char *xml,
@@ -6758,21 +8132,11 @@ static int qemuDomainDetachDevice(virDomainPtr dom, const char *xml)
 
 static int qemuDomainGetAutostart(virDomainPtr dom,
                                   int *autostart) {
-    virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
     int ret = -1;
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     *autostart = vm->autostart;
     ret = 0;
@@ -6918,26 +8282,28 @@ cleanup:
     return ret;
 }
 
-/* deviceWeightStr in the form of /device/path,weight,/device/path,weight
+/* blkioDeviceStr in the form of /device/path,value,/device/path,value
  * for example, /dev/disk/by-path/pci-0000:00:1f.2-scsi-0:0:0:0,800
+ * where value is the per-device tunable named by @type, one of the
+ * VIR_DOMAIN_BLKIO_DEVICE_* parameters.
  */
 static int
-qemuDomainParseDeviceWeightStr(char *deviceWeightStr,
-                               virBlkioDeviceWeightPtr *dw, size_t *size)
+qemuDomainParseBlkioDeviceStr(char *blkioDeviceStr, const char *type,
+                              virBlkioDevicePtr *dev, size_t *size)
 {
     char *temp;
     int ndevices = 0;
     int nsep = 0;
     int i;
-    virBlkioDeviceWeightPtr result = NULL;
+    virBlkioDevicePtr result = NULL;
 
-    *dw = NULL;
+    *dev = NULL;
     *size = 0;
 
-    if (STREQ(deviceWeightStr, ""))
+    if (STREQ(blkioDeviceStr, ""))
         return 0;
 
-    temp = deviceWeightStr;
+    temp = blkioDeviceStr;
     while (temp) {
         temp = strchr(temp, ',');
         if (temp) {
@@ -6959,9 +8325,10 @@ qemuDomainParseDeviceWeightStr(char *deviceWeightStr,
     }
 
     i = 0;
-    temp = deviceWeightStr;
+    temp = blkioDeviceStr;
     while (temp) {
         char *p = temp;
+        int rc;
 
         /* device path */
         p = strchr(p, ',');
@@ -6974,10 +8341,20 @@ qemuDomainParseDeviceWeightStr(char *deviceWeightStr,
             goto cleanup;
         }
 
-        /* weight */
+        /* value */
         temp = p + 1;
 
-        if (virStrToLong_ui(temp, &p, 10, &result[i].weight) < 0)
+        if (STREQ(type, VIR_DOMAIN_BLKIO_DEVICE_WEIGHT))
+            rc = virStrToLong_ui(temp, &p, 10, &result[i].weight);
+        else if (STREQ(type, VIR_DOMAIN_BLKIO_DEVICE_READ_IOPS))
+            rc = virStrToLong_ui(temp, &p, 10, &result[i].riops);
+        else if (STREQ(type, VIR_DOMAIN_BLKIO_DEVICE_WRITE_IOPS))
+            rc = virStrToLong_ui(temp, &p, 10, &result[i].wiops);
+        else if (STREQ(type, VIR_DOMAIN_BLKIO_DEVICE_READ_BPS))
+            rc = virStrToLong_ull(temp, &p, 10, &result[i].rbps);
+        else
+            rc = virStrToLong_ull(temp, &p, 10, &result[i].wbps);
+        if (rc < 0)
             goto error;
 
         i++;
@@ -6992,30 +8369,82 @@ qemuDomainParseDeviceWeightStr(char *deviceWeightStr,
     if (!i)
         VIR_FREE(result);
 
-    *dw = result;
+    *dev = result;
     *size = i;
 
     return 0;
 
 error:
     virReportError(VIR_ERR_INVALID_ARG,
-                   _("unable to parse device weight '%s'"), deviceWeightStr);
+                   _("unable to parse blkio device '%s' '%s'"),
+                   type, blkioDeviceStr);
 cleanup:
-    virBlkioDeviceWeightArrayClear(result, ndevices);
+    virBlkioDeviceArrayClear(result, ndevices);
     VIR_FREE(result);
     return -1;
 }
 
-/* Modify dest_array to reflect all device weight changes described in
- * src_array.  */
+/* Format the per-device tunable @type of @def back into the string
+ * form accepted by qemuDomainParseBlkioDeviceStr.  */
+static char *
+qemuDomainFormatBlkioDeviceStr(virDomainDefPtr def, const char *type)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    bool comma = false;
+    int i;
+
+    for (i = 0; i < def->blkio.ndevices; i++) {
+        virBlkioDevicePtr dev = &def->blkio.devices[i];
+        unsigned long long value;
+
+        if (STREQ(type, VIR_DOMAIN_BLKIO_DEVICE_WEIGHT))
+            value = dev->weight;
+        else if (STREQ(type, VIR_DOMAIN_BLKIO_DEVICE_READ_IOPS))
+            value = dev->riops;
+        else if (STREQ(type, VIR_DOMAIN_BLKIO_DEVICE_WRITE_IOPS))
+            value = dev->wiops;
+        else if (STREQ(type, VIR_DOMAIN_BLKIO_DEVICE_READ_BPS))
+            value = dev->rbps;
+        else
+            value = dev->wbps;
+
+        if (!value)
+            continue;
+        if (comma)
+            virBufferAddChar(&buf, ',');
+        else
+            comma = true;
+        virBufferAsprintf(&buf, "%s,%llu", dev->path, value);
+    }
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (!comma) {
+        char *ret = strdup("");
+
+        if (!ret)
+            virReportOOMError();
+        return ret;
+    }
+
+    return virBufferContentAndReset(&buf);
+}
+
+/* Modify dest_array to reflect all blkio device changes of tunable
+ * @type described in src_array.  */
 static int
-qemuDomainMergeDeviceWeights(virBlkioDeviceWeightPtr *dest_array,
-                             size_t *dest_size,
-                             virBlkioDeviceWeightPtr src_array,
-                             size_t src_size)
+qemuDomainMergeBlkioDevice(virBlkioDevicePtr *dest_array,
+                           size_t *dest_size,
+                           virBlkioDevicePtr src_array,
+                           size_t src_size,
+                           const char *type)
 {
     int i, j;
-    virBlkioDeviceWeightPtr dest, src;
+    virBlkioDevicePtr dest, src;
 
     for (i = 0; i < src_size; i++) {
         bool found = false;
@@ -7025,12 +8454,12 @@ qemuDomainMergeDeviceWeights(virBlkioDeviceWeightPtr *dest_array,
             dest = &(*dest_array)[j];
             if (STREQ(src->path, dest->path)) {
                 found = true;
-                dest->weight = src->weight;
                 break;
             }
         }
         if (!found) {
-            if (!src->weight)
+            if (!src->weight && !src->riops && !src->wiops &&
+                !src->rbps && !src->wbps)
                 continue;
             if (VIR_EXPAND_N(*dest_array, *dest_size, 1) < 0) {
                 virReportOOMError();
@@ -7038,9 +8467,19 @@ qemuDomainMergeDeviceWeights(virBlkioDeviceWeightPtr *dest_array,
             }
             dest = &(*dest_array)[*dest_size - 1];
             dest->path = src->path;
-            dest->weight = src->weight;
             src->path = NULL;
         }
+
+        if (STREQ(type, VIR_DOMAIN_BLKIO_DEVICE_WEIGHT))
+            dest->weight = src->weight;
+        else if (STREQ(type, VIR_DOMAIN_BLKIO_DEVICE_READ_IOPS))
+            dest->riops = src->riops;
+        else if (STREQ(type, VIR_DOMAIN_BLKIO_DEVICE_WRITE_IOPS))
+            dest->wiops = src->wiops;
+        else if (STREQ(type, VIR_DOMAIN_BLKIO_DEVICE_READ_BPS))
+            dest->rbps = src->rbps;
+        else
+            dest->wbps = src->wbps;
     }
 
     return 0;
@@ -7066,6 +8505,14 @@ qemuDomainSetBlkioParameters(virDomainPtr dom,
                                        VIR_TYPED_PARAM_UINT,
                                        VIR_DOMAIN_BLKIO_DEVICE_WEIGHT,
                                        VIR_TYPED_PARAM_STRING,
+                                       VIR_DOMAIN_BLKIO_DEVICE_READ_IOPS,
+                                       VIR_TYPED_PARAM_STRING,
+                                       VIR_DOMAIN_BLKIO_DEVICE_WRITE_IOPS,
+                                       VIR_TYPED_PARAM_STRING,
+                                       VIR_DOMAIN_BLKIO_DEVICE_READ_BPS,
+                                       VIR_TYPED_PARAM_STRING,
+                                       VIR_DOMAIN_BLKIO_DEVICE_WRITE_BPS,
+                                       VIR_TYPED_PARAM_STRING,
                                        NULL) < 0)
         return -1;
 
@@ -7081,6 +8528,7 @@ qemuDomainSetBlkioParameters(virDomainPtr dom,
     if (virDomainLiveConfigHelperMethod(driver->caps, vm, &flags,
                                         &persistentDef) < 0)
         goto cleanup;
+    virDomainObjInvalidateXMLCache(vm);
 
     if (flags & VIR_DOMAIN_AFFECT_LIVE) {
         if (!qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_BLKIO)) {
@@ -7119,12 +8567,13 @@ qemuDomainSetBlkioParameters(virDomainPtr dom,
                 }
             } else if (STREQ(param->field, VIR_DOMAIN_BLKIO_DEVICE_WEIGHT)) {
                 size_t ndevices;
-                virBlkioDeviceWeightPtr devices = NULL;
+                virBlkioDevicePtr devices = NULL;
                 int j;
 
-                if (qemuDomainParseDeviceWeightStr(params[i].value.s,
-                                                   &devices,
-                                                   &ndevices) < 0) {
+                if (qemuDomainParseBlkioDeviceStr(params[i].value.s,
+                                                  param->field,
+                                                  &devices,
+                                                  &ndevices) < 0) {
                     ret = -1;
                     continue;
                 }
@@ -7141,11 +8590,45 @@ qemuDomainSetBlkioParameters(virDomainPtr dom,
                     }
                 }
                 if (j != ndevices ||
-                    qemuDomainMergeDeviceWeights(&vm->def->blkio.devices,
-                                                 &vm->def->blkio.ndevices,
-                                                 devices, ndevices) < 0)
+                    qemuDomainMergeBlkioDevice(&vm->def->blkio.devices,
+                                               &vm->def->blkio.ndevices,
+                                               devices, ndevices,
+                                               param->field) < 0)
+                    ret = -1;
+                virBlkioDeviceArrayClear(devices, ndevices);
+                VIR_FREE(devices);
+            } else if (STREQ(param->field, VIR_DOMAIN_BLKIO_DEVICE_READ_IOPS) ||
+                       STREQ(param->field, VIR_DOMAIN_BLKIO_DEVICE_WRITE_IOPS) ||
+                       STREQ(param->field, VIR_DOMAIN_BLKIO_DEVICE_READ_BPS) ||
+                       STREQ(param->field, VIR_DOMAIN_BLKIO_DEVICE_WRITE_BPS)) {
+                size_t ndevices;
+                virBlkioDevicePtr devices = NULL;
+                int j;
+
+                /* record the new limits first: the value programmed for
+                 * a device also depends on the throttle groups it is in */
+                if (qemuDomainParseBlkioDeviceStr(params[i].value.s,
+                                                  param->field,
+                                                  &devices,
+                                                  &ndevices) < 0) {
+                    ret = -1;
+                    continue;
+                }
+                if (qemuDomainMergeBlkioDevice(&vm->def->blkio.devices,
+                                               &vm->def->blkio.ndevices,
+                                               devices, ndevices,
+                                               param->field) < 0) {
                     ret = -1;
-                virBlkioDeviceWeightArrayClear(devices, ndevices);
+                } else {
+                    for (j = 0; j < ndevices; j++) {
+                        if (qemuSetupBlkioDeviceThrottle(group, vm->def,
+                                                         devices[j].path) < 0) {
+                            ret = -1;
+                            break;
+                        }
+                    }
+                }
+                virBlkioDeviceArrayClear(devices, ndevices);
                 VIR_FREE(devices);
             }
         }
@@ -7168,21 +8651,27 @@ qemuDomainSetBlkioParameters(virDomainPtr dom,
                 }
 
                 persistentDef->blkio.weight = params[i].value.ui;
-            } else if (STREQ(param->field, VIR_DOMAIN_BLKIO_DEVICE_WEIGHT)) {
-                virBlkioDeviceWeightPtr devices = NULL;
+            } else if (STREQ(param->field, VIR_DOMAIN_BLKIO_DEVICE_WEIGHT) ||
+                       STREQ(param->field, VIR_DOMAIN_BLKIO_DEVICE_READ_IOPS) ||
+                       STREQ(param->field, VIR_DOMAIN_BLKIO_DEVICE_WRITE_IOPS) ||
+                       STREQ(param->field, VIR_DOMAIN_BLKIO_DEVICE_READ_BPS) ||
+                       STREQ(param->field, VIR_DOMAIN_BLKIO_DEVICE_WRITE_BPS)) {
+                virBlkioDevicePtr devices = NULL;
                 size_t ndevices;
 
-                if (qemuDomainParseDeviceWeightStr(params[i].value.s,
-                                                   &devices,
-                                                   &ndevices) < 0) {
+                if (qemuDomainParseBlkioDeviceStr(params[i].value.s,
+                                                  param->field,
+                                                  &devices,
+                                                  &ndevices) < 0) {
                     ret = -1;
                     continue;
                 }
-                if (qemuDomainMergeDeviceWeights(&persistentDef->blkio.devices,
-                                                 &persistentDef->blkio.ndevices,
-                                                 devices, ndevices) < 0)
+                if (qemuDomainMergeBlkioDevice(&persistentDef->blkio.devices,
+                                               &persistentDef->blkio.ndevices,
+                                               devices, ndevices,
+                                               param->field) < 0)
                     ret = -1;
-                virBlkioDeviceWeightArrayClear(devices, ndevices);
+                virBlkioDeviceArrayClear(devices, ndevices);
                 VIR_FREE(devices);
             }
         }
@@ -7199,6 +8688,29 @@ cleanup:
     return ret;
 }
 
+/* The per-device blkio tunables, in the order they are reported by
+ * qemuDomainGetBlkioParameters after the weight.  */
+static const char *const qemuBlkioDeviceParams[] = {
+    VIR_DOMAIN_BLKIO_DEVICE_WEIGHT,
+    VIR_DOMAIN_BLKIO_DEVICE_READ_IOPS,
+    VIR_DOMAIN_BLKIO_DEVICE_WRITE_IOPS,
+    VIR_DOMAIN_BLKIO_DEVICE_READ_BPS,
+    VIR_DOMAIN_BLKIO_DEVICE_WRITE_BPS,
+};
+
+static int
+qemuDomainGetBlkioDeviceParam(virDomainDefPtr def,
+                              const char *type,
+                              virTypedParameterPtr param)
+{
+    char *str;
+
+    if (!(str = qemuDomainFormatBlkioDeviceStr(def, type)))
+        return -1;
+
+    return virTypedParameterAssign(param, type, VIR_TYPED_PARAM_STRING, str);
+}
+
 static int
 qemuDomainGetBlkioParameters(virDomainPtr dom,
                              virTypedParameterPtr params,
@@ -7206,7 +8718,7 @@ qemuDomainGetBlkioParameters(virDomainPtr dom,
                              unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
-    int i, j;
+    int i;
     virCgroupPtr group = NULL;
     virDomainObjPtr vm = NULL;
     virDomainDefPtr persistentDef = NULL;
@@ -7275,31 +8787,13 @@ qemuDomainGetBlkioParameters(virDomainPtr dom,
                     goto cleanup;
                 break;
             case 1: /* blkiotune.device_weight */
-                if (vm->def->blkio.ndevices > 0) {
-                    virBuffer buf = VIR_BUFFER_INITIALIZER;
-                    bool comma = false;
-
-                    for (j = 0; j < vm->def->blkio.ndevices; j++) {
-                        if (!vm->def->blkio.devices[j].weight)
-                            continue;
-                        if (comma)
-                            virBufferAddChar(&buf, ',');
-                        else
-                            comma = true;
-                        virBufferAsprintf(&buf, "%s,%u",
-                                          vm->def->blkio.devices[j].path,
-                                          vm->def->blkio.devices[j].weight);
-                    }
-                    if (virBufferError(&buf)) {
-                        virReportOOMError();
-                        goto cleanup;
-                    }
-                    param->value.s = virBufferContentAndReset(&buf);
-                }
-                if (virTypedParameterAssign(param,
-                                            VIR_DOMAIN_BLKIO_DEVICE_WEIGHT,
-                                            VIR_TYPED_PARAM_STRING,
-                                            param->value.s) < 0)
+            case 2: /* blkiotune.device_read_iops_sec */
+            case 3: /* blkiotune.device_write_iops_sec */
+            case 4: /* blkiotune.device_read_bytes_sec */
+            case 5: /* blkiotune.device_write_bytes_sec */
+                if (qemuDomainGetBlkioDeviceParam(vm->def,
+                                                  qemuBlkioDeviceParams[i - 1],
+                                                  param) < 0)
                     goto cleanup;
                 break;
 
@@ -7326,43 +8820,15 @@ qemuDomainGetBlkioParameters(virDomainPtr dom,
                 param->value.ui = persistentDef->blkio.weight;
                 break;
 
-            case 1: /* blkiotune.device_weight */
-                if (persistentDef->blkio.ndevices > 0) {
-                    virBuffer buf = VIR_BUFFER_INITIALIZER;
-                    bool comma = false;
-
-                    for (j = 0; j < persistentDef->blkio.ndevices; j++) {
-                        if (!persistentDef->blkio.devices[j].weight)
-                            continue;
-                        if (comma)
-                            virBufferAddChar(&buf, ',');
-                        else
-                            comma = true;
-                        virBufferAsprintf(&buf, "%s,%u",
-                                          persistentDef->blkio.devices[j].path,
-                                          persistentDef->blkio.devices[j].weight);
-                    }
-                    if (virBufferError(&buf)) {
-                        virReportOOMError();
-                        goto cleanup;
-                    }
-                    param->value.s = virBufferContentAndReset(&buf);
-                }
-                if (!param->value.s) {
-                    param->value.s = strdup("");
-                    if (!param->value.s) {
-                        virReportOOMError();
-                        goto cleanup;
-                    }
-                }
-                param->type = VIR_TYPED_PARAM_STRING;
-                if (virStrcpyStatic(param->field,
-                                    VIR_DOMAIN_BLKIO_DEVICE_WEIGHT) == NULL) {
-                    virReportError(VIR_ERR_INTERNAL_ERROR,
-                                   _("Field name '%s' too long"),
-                                   VIR_DOMAIN_BLKIO_DEVICE_WEIGHT);
+            case 1: /* blkiotune.device_weight */
+            case 2: /* blkiotune.device_read_iops_sec */
+            case 3: /* blkiotune.device_write_iops_sec */
+            case 4: /* blkiotune.device_read_bytes_sec */
+            case 5: /* blkiotune.device_write_bytes_sec */
+                if (qemuDomainGetBlkioDeviceParam(persistentDef,
+                                                  qemuBlkioDeviceParams[i - 1],
+                                                  param) < 0)
                     goto cleanup;
-                }
                 break;
 
             default:
@@ -7750,6 +9216,7 @@ qemuDomainSetNumaParameters(virDomainPtr dom,
     if (virDomainLiveConfigHelperMethod(driver->caps, vm, &flags,
                                         &persistentDef) < 0)
         goto cleanup;
+    virDomainObjInvalidateXMLCache(vm);
 
     if (flags & VIR_DOMAIN_AFFECT_LIVE) {
         if (!qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_CPUSET)) {
@@ -8533,17 +10000,8 @@ qemuDomainBlockResize(virDomainPtr dom,
         size *= 1024;
     }
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     priv = vm->privateData;
 
@@ -8561,59 +10019,317 @@ qemuDomainBlockResize(virDomainPtr dom,
                        _("invalid path: %s"), path);
         goto endjob;
     }
-    disk = vm->def->disks[i];
+    disk = vm->def->disks[i];
+
+    if (virAsprintf(&device, "%s%s", QEMU_DRIVE_HOST_PREFIX,
+                    disk->info.alias) < 0) {
+        virReportOOMError();
+        goto endjob;
+    }
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    if (qemuMonitorBlockResize(priv->mon, device, size) < 0) {
+        qemuDomainObjExitMonitor(driver, vm);
+        goto endjob;
+    }
+    qemuDomainObjExitMonitor(driver, vm);
+
+    ret = 0;
+
+endjob:
+    if (qemuDomainObjEndJob(driver, vm) == 0)
+        vm = NULL;
+
+cleanup:
+    VIR_FREE(device);
+    if (vm)
+        virDomainObjUnlock(vm);
+    return ret;
+}
+
+/* This uses the 'info blockstats' monitor command which was
+ * integrated into both qemu & kvm in late 2007.  If the command is
+ * not supported we detect this and return the appropriate error.
+ */
+static int
+qemuDomainBlockStats(virDomainPtr dom,
+                     const char *path,
+                     struct _virDomainBlockStats *stats)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    int i, ret = -1;
+    virDomainObjPtr vm;
+    virDomainDiskDefPtr disk = NULL;
+    qemuDomainObjPrivatePtr priv;
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto cleanup;
+    }
+
+    if ((i = virDomainDiskIndexByName(vm->def, path, false)) < 0) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("invalid path: %s"), path);
+        goto cleanup;
+    }
+    disk = vm->def->disks[i];
+
+    if (!disk->info.alias) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("missing disk device alias name for %s"), disk->dst);
+        goto cleanup;
+    }
+
+    priv = vm->privateData;
+
+    /* Serve the request from the statistics of all disks fetched for
+     * this interval, so polling every disk of a domain costs a single
+     * query-blockstats instead of one per disk */
+    if (qemuCapsGet(priv->caps, QEMU_CAPS_MONITOR_JSON)) {
+        qemuMonitorStatsPtr monstats;
+        qemuBlockStatsPtr entry;
+
+        virObjectRef(vm);
+        monstats = qemuDomainGetStatsMonitor(driver, vm,
+                                             VIR_DOMAIN_STATS_BLOCK);
+        if (!virObjectUnref(vm)) {
+            vm = NULL;
+            virReportError(VIR_ERR_OPERATION_INVALID,
+                           "%s", _("domain is not running"));
+            goto cleanup;
+        }
+        if (virDomainObjIsActive(vm) &&
+            monstats->fetched & QEMU_MONITOR_STATS_BLOCK &&
+            (entry = virHashLookup(monstats->blockstats, disk->info.alias))) {
+            stats->rd_req = entry->rd_req;
+            stats->rd_bytes = entry->rd_bytes;
+            stats->wr_req = entry->wr_req;
+            stats->wr_bytes = entry->wr_bytes;
+            stats->errs = -1;
+            ret = 0;
+            goto cleanup;
+        }
+    }
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto endjob;
+    }
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    ret = qemuMonitorGetBlockStatsInfo(priv->mon,
+                                       disk->info.alias,
+                                       &stats->rd_req,
+                                       &stats->rd_bytes,
+                                       NULL,
+                                       &stats->wr_req,
+                                       &stats->wr_bytes,
+                                       NULL,
+                                       NULL,
+                                       NULL,
+                                       &stats->errs);
+    qemuDomainObjExitMonitor(driver, vm);
+
+endjob:
+    if (qemuDomainObjEndJob(driver, vm) == 0)
+        vm = NULL;
+
+cleanup:
+    if (vm)
+        virDomainObjUnlock(vm);
+    return ret;
+}
+
+static int
+qemuDomainBlockStatsFlags(virDomainPtr dom,
+                          const char *path,
+                          virTypedParameterPtr params,
+                          int *nparams,
+                          unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    int i, tmp, ret = -1;
+    virDomainObjPtr vm;
+    virDomainDiskDefPtr disk = NULL;
+    qemuDomainObjPrivatePtr priv;
+    long long rd_req, rd_bytes, wr_req, wr_bytes, rd_total_times;
+    long long wr_total_times, flush_req, flush_total_times, errs;
+    virTypedParameterPtr param;
+
+    virCheckFlags(VIR_TYPED_PARAM_STRING_OKAY, -1);
+
+    /* We don't return strings, and thus trivially support this flag.  */
+    flags &= ~VIR_TYPED_PARAM_STRING_OKAY;
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto cleanup;
+    }
+
+    if (*nparams != 0) {
+        if ((i = virDomainDiskIndexByName(vm->def, path, false)) < 0) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("invalid path: %s"), path);
+            goto cleanup;
+        }
+        disk = vm->def->disks[i];
+
+        if (!disk->info.alias) {
+             virReportError(VIR_ERR_INTERNAL_ERROR,
+                            _("missing disk device alias name for %s"),
+                            disk->dst);
+             goto cleanup;
+        }
+    }
+
+    priv = vm->privateData;
+    VIR_DEBUG("priv=%p, params=%p, flags=%x", priv, params, flags);
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto endjob;
+    }
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    tmp = *nparams;
+    ret = qemuMonitorGetBlockStatsParamsNumber(priv->mon, nparams);
+
+    if (tmp == 0 || ret < 0) {
+        qemuDomainObjExitMonitor(driver, vm);
+        goto endjob;
+    }
+
+    ret = qemuMonitorGetBlockStatsInfo(priv->mon,
+                                       disk->info.alias,
+                                       &rd_req,
+                                       &rd_bytes,
+                                       &rd_total_times,
+                                       &wr_req,
+                                       &wr_bytes,
+                                       &wr_total_times,
+                                       &flush_req,
+                                       &flush_total_times,
+                                       &errs);
+
+    qemuDomainObjExitMonitor(driver, vm);
+
+    if (ret < 0)
+        goto endjob;
+
+    tmp = 0;
+    ret = -1;
+
+    if (tmp < *nparams && wr_bytes != -1) {
+        param = &params[tmp];
+        if (virTypedParameterAssign(param, VIR_DOMAIN_BLOCK_STATS_WRITE_BYTES,
+                                    VIR_TYPED_PARAM_LLONG, wr_bytes) < 0)
+            goto endjob;
+        tmp++;
+    }
+
+    if (tmp < *nparams && wr_req != -1) {
+        param = &params[tmp];
+        if (virTypedParameterAssign(param, VIR_DOMAIN_BLOCK_STATS_WRITE_REQ,
+                                    VIR_TYPED_PARAM_LLONG, wr_req) < 0)
+            goto endjob;
+        tmp++;
+    }
+
+    if (tmp < *nparams && rd_bytes != -1) {
+        param = &params[tmp];
+        if (virTypedParameterAssign(param, VIR_DOMAIN_BLOCK_STATS_READ_BYTES,
+                                    VIR_TYPED_PARAM_LLONG, rd_bytes) < 0)
+            goto endjob;
+        tmp++;
+    }
+
+    if (tmp < *nparams && rd_req != -1) {
+        param = &params[tmp];
+        if (virTypedParameterAssign(param, VIR_DOMAIN_BLOCK_STATS_READ_REQ,
+                                    VIR_TYPED_PARAM_LLONG, rd_req) < 0)
+            goto endjob;
+        tmp++;
+    }
+
+    if (tmp < *nparams && flush_req != -1) {
+        param = &params[tmp];
+        if (virTypedParameterAssign(param, VIR_DOMAIN_BLOCK_STATS_FLUSH_REQ,
+                                    VIR_TYPED_PARAM_LLONG, flush_req) < 0)
+            goto endjob;
+        tmp++;
+    }
+
+    if (tmp < *nparams && wr_total_times != -1) {
+        param = &params[tmp];
+        if (virTypedParameterAssign(param,
+                                    VIR_DOMAIN_BLOCK_STATS_WRITE_TOTAL_TIMES,
+                                    VIR_TYPED_PARAM_LLONG, wr_total_times) < 0)
+            goto endjob;
+        tmp++;
+    }
 
-    if (virAsprintf(&device, "%s%s", QEMU_DRIVE_HOST_PREFIX,
-                    disk->info.alias) < 0) {
-        virReportOOMError();
-        goto endjob;
+    if (tmp < *nparams && rd_total_times != -1) {
+        param = &params[tmp];
+        if (virTypedParameterAssign(param,
+                                    VIR_DOMAIN_BLOCK_STATS_READ_TOTAL_TIMES,
+                                    VIR_TYPED_PARAM_LLONG, rd_total_times) < 0)
+            goto endjob;
+        tmp++;
     }
 
-    qemuDomainObjEnterMonitor(driver, vm);
-    if (qemuMonitorBlockResize(priv->mon, device, size) < 0) {
-        qemuDomainObjExitMonitor(driver, vm);
-        goto endjob;
+    if (tmp < *nparams && flush_total_times != -1) {
+        param = &params[tmp];
+        if (virTypedParameterAssign(param,
+                                    VIR_DOMAIN_BLOCK_STATS_FLUSH_TOTAL_TIMES,
+                                    VIR_TYPED_PARAM_LLONG,
+                                    flush_total_times) < 0)
+            goto endjob;
+        tmp++;
     }
-    qemuDomainObjExitMonitor(driver, vm);
+
+    /* Field 'errs' is meaningless for QEMU, won't set it. */
 
     ret = 0;
+    *nparams = tmp;
 
 endjob:
     if (qemuDomainObjEndJob(driver, vm) == 0)
         vm = NULL;
 
 cleanup:
-    VIR_FREE(device);
     if (vm)
         virDomainObjUnlock(vm);
     return ret;
 }
 
-/* This uses the 'info blockstats' monitor command which was
- * integrated into both qemu & kvm in late 2007.  If the command is
- * not supported we detect this and return the appropriate error.
- */
+#ifdef __linux__
 static int
-qemuDomainBlockStats(virDomainPtr dom,
-                     const char *path,
-                     struct _virDomainBlockStats *stats)
+qemuDomainInterfaceStats(virDomainPtr dom,
+                         const char *path,
+                         struct _virDomainInterfaceStats *stats)
 {
-    virQEMUDriverPtr driver = dom->conn->privateData;
-    int i, ret = -1;
     virDomainObjPtr vm;
-    virDomainDiskDefPtr disk = NULL;
-    qemuDomainObjPrivatePtr priv;
+    int i;
+    int ret = -1;
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (!virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID,
@@ -8621,640 +10337,661 @@ qemuDomainBlockStats(virDomainPtr dom,
         goto cleanup;
     }
 
-    if ((i = virDomainDiskIndexByName(vm->def, path, false)) < 0) {
+    /* Check the path is one of the domain's network interfaces. */
+    for (i = 0 ; i < vm->def->nnets ; i++) {
+        if (vm->def->nets[i]->ifname &&
+            STREQ(vm->def->nets[i]->ifname, path)) {
+            ret = 0;
+            break;
+        }
+    }
+
+    if (ret == 0)
+        ret = linuxDomainInterfaceStats(path, stats);
+    else
         virReportError(VIR_ERR_INVALID_ARG,
-                       _("invalid path: %s"), path);
+                       _("invalid path, '%s' is not a known interface"), path);
+
+cleanup:
+    if (vm)
+        virDomainObjUnlock(vm);
+    return ret;
+}
+#else
+static int
+qemuDomainInterfaceStats(virDomainPtr dom ATTRIBUTE_UNUSED,
+                         const char *path ATTRIBUTE_UNUSED,
+                         struct _virDomainInterfaceStats *stats ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                   _("interface stats not implemented on this platform"));
+    return -1;
+}
+#endif
+
+static int
+qemuDomainSetInterfaceParameters(virDomainPtr dom,
+                                 const char *device,
+                                 virTypedParameterPtr params,
+                                 int nparams,
+                                 unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    int i;
+    virCgroupPtr group = NULL;
+    virDomainObjPtr vm = NULL;
+    virDomainDefPtr persistentDef = NULL;
+    int ret = -1;
+    virDomainNetDefPtr net = NULL, persistentNet = NULL;
+    virNetDevBandwidthPtr bandwidth = NULL, newBandwidth = NULL;
+
+    virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
+                  VIR_DOMAIN_AFFECT_CONFIG, -1);
+    if (virTypedParameterArrayValidate(params, nparams,
+                                       VIR_DOMAIN_BANDWIDTH_IN_AVERAGE,
+                                       VIR_TYPED_PARAM_UINT,
+                                       VIR_DOMAIN_BANDWIDTH_IN_PEAK,
+                                       VIR_TYPED_PARAM_UINT,
+                                       VIR_DOMAIN_BANDWIDTH_IN_BURST,
+                                       VIR_TYPED_PARAM_UINT,
+                                       VIR_DOMAIN_BANDWIDTH_OUT_AVERAGE,
+                                       VIR_TYPED_PARAM_UINT,
+                                       VIR_DOMAIN_BANDWIDTH_OUT_PEAK,
+                                       VIR_TYPED_PARAM_UINT,
+                                       VIR_DOMAIN_BANDWIDTH_OUT_BURST,
+                                       VIR_TYPED_PARAM_UINT,
+                                       NULL) < 0)
+        return -1;
+
+    qemuDriverLock(driver);
+    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
+
+    if (vm == NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("No such domain %s"), dom->uuid);
         goto cleanup;
     }
-    disk = vm->def->disks[i];
 
-    if (!disk->info.alias) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("missing disk device alias name for %s"), disk->dst);
+    if (virDomainLiveConfigHelperMethod(driver->caps, vm, &flags,
+                                        &persistentDef) < 0)
         goto cleanup;
+    virDomainObjInvalidateXMLCache(vm);
+
+    if (flags & VIR_DOMAIN_AFFECT_LIVE) {
+        net = virDomainNetFind(vm->def, device);
+        if (!net) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("Can't find device %s"), device);
+            goto cleanup;
+        }
+    }
+    if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
+        persistentNet = virDomainNetFind(persistentDef, device);
+        if (!persistentNet) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("Can't find device %s"), device);
+            goto cleanup;
+        }
     }
 
-    priv = vm->privateData;
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    if ((VIR_ALLOC(bandwidth) < 0) ||
+        (VIR_ALLOC(bandwidth->in) < 0) ||
+        (VIR_ALLOC(bandwidth->out) < 0)) {
+        virReportOOMError();
         goto cleanup;
+    }
 
-    if (!virDomainObjIsActive(vm)) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       "%s", _("domain is not running"));
-        goto endjob;
+    for (i = 0; i < nparams; i++) {
+        virTypedParameterPtr param = &params[i];
+
+        if (STREQ(param->field, VIR_DOMAIN_BANDWIDTH_IN_AVERAGE)) {
+            bandwidth->in->average = params[i].value.ui;
+        } else if (STREQ(param->field, VIR_DOMAIN_BANDWIDTH_IN_PEAK)) {
+            bandwidth->in->peak = params[i].value.ui;
+        } else if (STREQ(param->field, VIR_DOMAIN_BANDWIDTH_IN_BURST)) {
+            bandwidth->in->burst = params[i].value.ui;
+        } else if (STREQ(param->field, VIR_DOMAIN_BANDWIDTH_OUT_AVERAGE)) {
+            bandwidth->out->average = params[i].value.ui;
+        } else if (STREQ(param->field, VIR_DOMAIN_BANDWIDTH_OUT_PEAK)) {
+            bandwidth->out->peak = params[i].value.ui;
+        } else if (STREQ(param->field, VIR_DOMAIN_BANDWIDTH_OUT_BURST)) {
+            bandwidth->out->burst = params[i].value.ui;
+        }
     }
 
-    qemuDomainObjEnterMonitor(driver, vm);
-    ret = qemuMonitorGetBlockStatsInfo(priv->mon,
-                                       disk->info.alias,
-                                       &stats->rd_req,
-                                       &stats->rd_bytes,
-                                       NULL,
-                                       &stats->wr_req,
-                                       &stats->wr_bytes,
-                                       NULL,
-                                       NULL,
-                                       NULL,
-                                       &stats->errs);
-    qemuDomainObjExitMonitor(driver, vm);
+    /* average is mandatory, peak and burst are optional. So if no
+     * average is given, we free inbound/outbound here which causes
+     * inbound/outbound to not be set. */
+    if (!bandwidth->in->average) {
+        VIR_FREE(bandwidth->in);
+    }
+    if (!bandwidth->out->average) {
+        VIR_FREE(bandwidth->out);
+    }
+
+    if (flags & VIR_DOMAIN_AFFECT_LIVE) {
+        if (VIR_ALLOC(newBandwidth) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        /* virNetDevBandwidthSet() will clear any previous value of
+         * bandwidth parameters, so merge with old bandwidth parameters
+         * here to prevent them from being lost. */
+        if (bandwidth->in ||
+            (net->bandwidth && net->bandwidth->in)) {
+            if (VIR_ALLOC(newBandwidth->in) < 0) {
+                virReportOOMError();
+                goto cleanup;
+            }
+
+            memcpy(newBandwidth->in,
+                   bandwidth->in ? bandwidth->in : net->bandwidth->in,
+                   sizeof(*newBandwidth->in));
+        }
+        if (bandwidth->out ||
+            (net->bandwidth && net->bandwidth->out)) {
+            if (VIR_ALLOC(newBandwidth->out) < 0) {
+                virReportOOMError();
+                goto cleanup;
+            }
+
+            memcpy(newBandwidth->out,
+                   bandwidth->out ? bandwidth->out : net->bandwidth->out,
+                   sizeof(*newBandwidth->out));
+        }
+
+        if (virNetDevBandwidthSet(net->ifname, newBandwidth, false) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("cannot set bandwidth limits on %s"),
+                           device);
+            goto cleanup;
+        }
+
+        virNetDevBandwidthFree(net->bandwidth);
+        net->bandwidth = newBandwidth;
+        newBandwidth = NULL;
+    }
+    if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
+        if (!persistentNet->bandwidth) {
+            persistentNet->bandwidth = bandwidth;
+            bandwidth = NULL;
+        } else {
+            if (bandwidth->in) {
+                VIR_FREE(persistentNet->bandwidth->in);
+                persistentNet->bandwidth->in = bandwidth->in;
+                bandwidth->in = NULL;
+            }
+            if (bandwidth->out) {
+                VIR_FREE(persistentNet->bandwidth->out);
+                persistentNet->bandwidth->out = bandwidth->out;
+                bandwidth->out = NULL;
+            }
+        }
 
-endjob:
-    if (qemuDomainObjEndJob(driver, vm) == 0)
-        vm = NULL;
+        if (virDomainSaveConfig(driver->configDir, persistentDef) < 0)
+            goto cleanup;
+    }
 
+    ret = 0;
 cleanup:
+    virNetDevBandwidthFree(bandwidth);
+    virNetDevBandwidthFree(newBandwidth);
+    virCgroupFree(&group);
     if (vm)
         virDomainObjUnlock(vm);
+    qemuDriverUnlock(driver);
     return ret;
 }
 
 static int
-qemuDomainBlockStatsFlags(virDomainPtr dom,
-                          const char *path,
-                          virTypedParameterPtr params,
-                          int *nparams,
-                          unsigned int flags)
+qemuDomainGetInterfaceParameters(virDomainPtr dom,
+                                 const char *device,
+                                 virTypedParameterPtr params,
+                                 int *nparams,
+                                 unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
-    int i, tmp, ret = -1;
-    virDomainObjPtr vm;
-    virDomainDiskDefPtr disk = NULL;
-    qemuDomainObjPrivatePtr priv;
-    long long rd_req, rd_bytes, wr_req, wr_bytes, rd_total_times;
-    long long wr_total_times, flush_req, flush_total_times, errs;
-    virTypedParameterPtr param;
+    int i;
+    virCgroupPtr group = NULL;
+    virDomainObjPtr vm = NULL;
+    virDomainDefPtr def = NULL;
+    virDomainDefPtr persistentDef = NULL;
+    virDomainNetDefPtr net = NULL;
+    int ret = -1;
 
-    virCheckFlags(VIR_TYPED_PARAM_STRING_OKAY, -1);
+    virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
+                  VIR_DOMAIN_AFFECT_CONFIG |
+                  VIR_TYPED_PARAM_STRING_OKAY, -1);
+
+    qemuDriverLock(driver);
 
-    /* We don't return strings, and thus trivially support this flag.  */
     flags &= ~VIR_TYPED_PARAM_STRING_OKAY;
 
-    qemuDriverLock(driver);
     vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
-        goto cleanup;
-    }
 
-    if (!virDomainObjIsActive(vm)) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       "%s", _("domain is not running"));
+    if (vm == NULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("No such domain %s"), dom->uuid);
         goto cleanup;
     }
 
-    if (*nparams != 0) {
-        if ((i = virDomainDiskIndexByName(vm->def, path, false)) < 0) {
-            virReportError(VIR_ERR_INVALID_ARG,
-                           _("invalid path: %s"), path);
-            goto cleanup;
-        }
-        disk = vm->def->disks[i];
-
-        if (!disk->info.alias) {
-             virReportError(VIR_ERR_INTERNAL_ERROR,
-                            _("missing disk device alias name for %s"),
-                            disk->dst);
-             goto cleanup;
-        }
-    }
-
-    priv = vm->privateData;
-    VIR_DEBUG("priv=%p, params=%p, flags=%x", priv, params, flags);
-
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    if (virDomainLiveConfigHelperMethod(driver->caps, vm, &flags,
+                                        &persistentDef) < 0)
         goto cleanup;
 
-    if (!virDomainObjIsActive(vm)) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       "%s", _("domain is not running"));
-        goto endjob;
-    }
-
-    qemuDomainObjEnterMonitor(driver, vm);
-    tmp = *nparams;
-    ret = qemuMonitorGetBlockStatsParamsNumber(priv->mon, nparams);
-
-    if (tmp == 0 || ret < 0) {
-        qemuDomainObjExitMonitor(driver, vm);
-        goto endjob;
-    }
-
-    ret = qemuMonitorGetBlockStatsInfo(priv->mon,
-                                       disk->info.alias,
-                                       &rd_req,
-                                       &rd_bytes,
-                                       &rd_total_times,
-                                       &wr_req,
-                                       &wr_bytes,
-                                       &wr_total_times,
-                                       &flush_req,
-                                       &flush_total_times,
-                                       &errs);
-
-    qemuDomainObjExitMonitor(driver, vm);
-
-    if (ret < 0)
-        goto endjob;
-
-    tmp = 0;
-    ret = -1;
-
-    if (tmp < *nparams && wr_bytes != -1) {
-        param = &params[tmp];
-        if (virTypedParameterAssign(param, VIR_DOMAIN_BLOCK_STATS_WRITE_BYTES,
-                                    VIR_TYPED_PARAM_LLONG, wr_bytes) < 0)
-            goto endjob;
-        tmp++;
-    }
-
-    if (tmp < *nparams && wr_req != -1) {
-        param = &params[tmp];
-        if (virTypedParameterAssign(param, VIR_DOMAIN_BLOCK_STATS_WRITE_REQ,
-                                    VIR_TYPED_PARAM_LLONG, wr_req) < 0)
-            goto endjob;
-        tmp++;
-    }
-
-    if (tmp < *nparams && rd_bytes != -1) {
-        param = &params[tmp];
-        if (virTypedParameterAssign(param, VIR_DOMAIN_BLOCK_STATS_READ_BYTES,
-                                    VIR_TYPED_PARAM_LLONG, rd_bytes) < 0)
-            goto endjob;
-        tmp++;
-    }
-
-    if (tmp < *nparams && rd_req != -1) {
-        param = &params[tmp];
-        if (virTypedParameterAssign(param, VIR_DOMAIN_BLOCK_STATS_READ_REQ,
-                                    VIR_TYPED_PARAM_LLONG, rd_req) < 0)
-            goto endjob;
-        tmp++;
-    }
-
-    if (tmp < *nparams && flush_req != -1) {
-        param = &params[tmp];
-        if (virTypedParameterAssign(param, VIR_DOMAIN_BLOCK_STATS_FLUSH_REQ,
-                                    VIR_TYPED_PARAM_LLONG, flush_req) < 0)
-            goto endjob;
-        tmp++;
+    if ((*nparams) == 0) {
+        *nparams = QEMU_NB_BANDWIDTH_PARAM;
+        ret = 0;
+        goto cleanup;
     }
 
-    if (tmp < *nparams && wr_total_times != -1) {
-        param = &params[tmp];
-        if (virTypedParameterAssign(param,
-                                    VIR_DOMAIN_BLOCK_STATS_WRITE_TOTAL_TIMES,
-                                    VIR_TYPED_PARAM_LLONG, wr_total_times) < 0)
-            goto endjob;
-        tmp++;
-    }
+    def = persistentDef;
+    if (!def)
+        def = vm->def;
 
-    if (tmp < *nparams && rd_total_times != -1) {
-        param = &params[tmp];
-        if (virTypedParameterAssign(param,
-                                    VIR_DOMAIN_BLOCK_STATS_READ_TOTAL_TIMES,
-                                    VIR_TYPED_PARAM_LLONG, rd_total_times) < 0)
-            goto endjob;
-        tmp++;
+    net = virDomainNetFind(def, device);
+    if (!net) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("Can't find device %s"), device);
+        goto cleanup;
     }
 
-    if (tmp < *nparams && flush_total_times != -1) {
-        param = &params[tmp];
-        if (virTypedParameterAssign(param,
-                                    VIR_DOMAIN_BLOCK_STATS_FLUSH_TOTAL_TIMES,
-                                    VIR_TYPED_PARAM_LLONG,
-                                    flush_total_times) < 0)
-            goto endjob;
-        tmp++;
+    for (i = 0; i < *nparams && i < QEMU_NB_BANDWIDTH_PARAM; i++) {
+        switch (i) {
+        case 0: /* inbound.average */
+            if (virTypedParameterAssign(&params[i],
+                                        VIR_DOMAIN_BANDWIDTH_IN_AVERAGE,
+                                        VIR_TYPED_PARAM_UINT, 0) < 0)
+                goto cleanup;
+            if (net->bandwidth && net->bandwidth->in)
+                params[i].value.ui = net->bandwidth->in->average;
+            break;
+        case 1: /* inbound.peak */
+            if (virTypedParameterAssign(&params[i],
+                                        VIR_DOMAIN_BANDWIDTH_IN_PEAK,
+                                        VIR_TYPED_PARAM_UINT, 0) < 0)
+                goto cleanup;
+            if (net->bandwidth && net->bandwidth->in)
+                params[i].value.ui = net->bandwidth->in->peak;
+            break;
+        case 2: /* inbound.burst */
+            if (virTypedParameterAssign(&params[i],
+                                        VIR_DOMAIN_BANDWIDTH_IN_BURST,
+                                        VIR_TYPED_PARAM_UINT, 0) < 0)
+                goto cleanup;
+            if (net->bandwidth && net->bandwidth->in)
+                params[i].value.ui = net->bandwidth->in->burst;
+            break;
+        case 3: /* outbound.average */
+            if (virTypedParameterAssign(&params[i],
+                                        VIR_DOMAIN_BANDWIDTH_OUT_AVERAGE,
+                                        VIR_TYPED_PARAM_UINT, 0) < 0)
+                goto cleanup;
+            if (net->bandwidth && net->bandwidth->out)
+                params[i].value.ui = net->bandwidth->out->average;
+            break;
+        case 4: /* outbound.peak */
+            if (virTypedParameterAssign(&params[i],
+                                        VIR_DOMAIN_BANDWIDTH_OUT_PEAK,
+                                        VIR_TYPED_PARAM_UINT, 0) < 0)
+                goto cleanup;
+            if (net->bandwidth && net->bandwidth->out)
+                params[i].value.ui = net->bandwidth->out->peak;
+            break;
+        case 5: /* outbound.burst */
+            if (virTypedParameterAssign(&params[i],
+                                        VIR_DOMAIN_BANDWIDTH_OUT_BURST,
+                                        VIR_TYPED_PARAM_UINT, 0) < 0)
+                goto cleanup;
+            if (net->bandwidth && net->bandwidth->out)
+                params[i].value.ui = net->bandwidth->out->burst;
+            break;
+        default:
+            break;
+            /* should not hit here */
+        }
     }
 
-    /* Field 'errs' is meaningless for QEMU, won't set it. */
-
+    if (*nparams > QEMU_NB_BANDWIDTH_PARAM)
+        *nparams = QEMU_NB_BANDWIDTH_PARAM;
     ret = 0;
-    *nparams = tmp;
-
-endjob:
-    if (qemuDomainObjEndJob(driver, vm) == 0)
-        vm = NULL;
 
 cleanup:
+    if (group)
+        virCgroupFree(&group);
     if (vm)
         virDomainObjUnlock(vm);
+    qemuDriverUnlock(driver);
     return ret;
 }
 
-#ifdef __linux__
+/*
+ * Refresh the balloon statistics cached for @vm.  Called with a
+ * QUERY job held on an active @vm.
+ */
 static int
-qemuDomainInterfaceStats(virDomainPtr dom,
-                         const char *path,
-                         struct _virDomainInterfaceStats *stats)
+qemuDomainMemoryStatsFetch(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm)
 {
-    virQEMUDriverPtr driver = dom->conn->privateData;
-    virDomainObjPtr vm;
-    int i;
-    int ret = -1;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainMemoryStatStruct stats[VIR_DOMAIN_MEMORY_STAT_NR];
+    virDomainMemoryStatStruct guest[VIR_DOMAIN_MEMORY_STAT_NR];
+    const char *alias = NULL;
+    int nstats;
+    int nguest = 0;
+    int i, j;
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
+    if (driver->memoryStatsPeriod &&
+        vm->def->memballoon &&
+        vm->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO)
+        alias = vm->def->memballoon->info.alias;
 
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
-        goto cleanup;
+    qemuDomainObjEnterMonitor(driver, vm);
+    nstats = qemuMonitorGetMemoryStats(priv->mon, stats,
+                                       VIR_DOMAIN_MEMORY_STAT_NR);
+    /* The balloon size alone is still worth returning when the
+     * guest has not pushed any statistics yet */
+    if (nstats >= 0 && alias &&
+        (nguest = qemuMonitorGetGuestMemoryStats(priv->mon, alias, guest,
+                                                 VIR_DOMAIN_MEMORY_STAT_NR)) < 0) {
+        virResetLastError();
+        nguest = 0;
     }
+    qemuDomainObjExitMonitor(driver, vm);
+
+    if (nstats < 0)
+        return -1;
 
     if (!virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID,
                        "%s", _("domain is not running"));
-        goto cleanup;
+        return -1;
     }
 
-    /* Check the path is one of the domain's network interfaces. */
-    for (i = 0 ; i < vm->def->nnets ; i++) {
-        if (vm->def->nets[i]->ifname &&
-            STREQ(vm->def->nets[i]->ifname, path)) {
-            ret = 0;
-            break;
+    /* Older qemu reports the guest statistics in query-balloon */
+    for (i = 0; i < nguest && nstats < VIR_DOMAIN_MEMORY_STAT_NR; i++) {
+        for (j = 0; j < nstats; j++) {
+            if (stats[j].tag == guest[i].tag)
+                break;
         }
+        if (j == nstats)
+            stats[nstats++] = guest[i];
     }
 
-    if (ret == 0)
-        ret = linuxDomainInterfaceStats(path, stats);
-    else
-        virReportError(VIR_ERR_INVALID_ARG,
-                       _("invalid path, '%s' is not a known interface"), path);
-
-cleanup:
-    if (vm)
-        virDomainObjUnlock(vm);
-    return ret;
-}
-#else
-static int
-qemuDomainInterfaceStats(virDomainPtr dom ATTRIBUTE_UNUSED,
-                         const char *path ATTRIBUTE_UNUSED,
-                         struct _virDomainInterfaceStats *stats ATTRIBUTE_UNUSED)
-{
-    virReportError(VIR_ERR_OPERATION_INVALID, "%s",
-                   _("interface stats not implemented on this platform"));
-    return -1;
+    memcpy(priv->memStats, stats, sizeof(stats));
+    priv->nmemStats = nstats;
+    if (virTimeMillisNow(&priv->memStatsTime) < 0) {
+        virResetLastError();
+        priv->memStatsTime = 0;
+    }
+    return 0;
 }
-#endif
 
 static int
-qemuDomainSetInterfaceParameters(virDomainPtr dom,
-                                 const char *device,
-                                 virTypedParameterPtr params,
-                                 int nparams,
-                                 unsigned int flags)
+qemuDomainMemoryStats(virDomainPtr dom,
+                      struct _virDomainMemoryStat *stats,
+                      unsigned int nr_stats,
+                      unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
-    int i;
-    virCgroupPtr group = NULL;
-    virDomainObjPtr vm = NULL;
-    virDomainDefPtr persistentDef = NULL;
+    virDomainObjPtr vm;
+    qemuDomainObjPrivatePtr priv;
+    unsigned long long ttl;
+    unsigned long long now;
+    long rss;
     int ret = -1;
-    virDomainNetDefPtr net = NULL, persistentNet = NULL;
-    virNetDevBandwidthPtr bandwidth = NULL, newBandwidth = NULL;
+    int i;
 
-    virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
-                  VIR_DOMAIN_AFFECT_CONFIG, -1);
-    if (virTypedParameterArrayValidate(params, nparams,
-                                       VIR_DOMAIN_BANDWIDTH_IN_AVERAGE,
-                                       VIR_TYPED_PARAM_UINT,
-                                       VIR_DOMAIN_BANDWIDTH_IN_PEAK,
-                                       VIR_TYPED_PARAM_UINT,
-                                       VIR_DOMAIN_BANDWIDTH_IN_BURST,
-                                       VIR_TYPED_PARAM_UINT,
-                                       VIR_DOMAIN_BANDWIDTH_OUT_AVERAGE,
-                                       VIR_TYPED_PARAM_UINT,
-                                       VIR_DOMAIN_BANDWIDTH_OUT_PEAK,
-                                       VIR_TYPED_PARAM_UINT,
-                                       VIR_DOMAIN_BANDWIDTH_OUT_BURST,
-                                       VIR_TYPED_PARAM_UINT,
-                                       NULL) < 0)
-        return -1;
+    virCheckFlags(0, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+    priv = vm->privateData;
 
-    if (vm == NULL) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("No such domain %s"), dom->uuid);
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
         goto cleanup;
     }
 
-    if (virDomainLiveConfigHelperMethod(driver->caps, vm, &flags,
-                                        &persistentDef) < 0)
-        goto cleanup;
+    /* A polling guest pushes new statistics only once per period, so
+     * asking qemu for them any sooner cannot return anything new */
+    ttl = driver->memoryStatsPeriod ?
+          driver->memoryStatsPeriod * 1000ULL : QEMU_DOMAIN_STATS_CACHE_TTL;
+    if (virTimeMillisNow(&now) < 0) {
+        virResetLastError();
+        now = 0;
+    }
 
-    if (flags & VIR_DOMAIN_AFFECT_LIVE) {
-        net = virDomainNetFind(vm->def, device);
-        if (!net) {
-            virReportError(VIR_ERR_INVALID_ARG,
-                           _("Can't find device %s"), device);
+    if (!now || !priv->memStatsTime || now >= priv->memStatsTime + ttl) {
+        int rc = -1;
+
+        if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
             goto cleanup;
-        }
-    }
-    if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
-        persistentNet = virDomainNetFind(persistentDef, device);
-        if (!persistentNet) {
-            virReportError(VIR_ERR_INVALID_ARG,
-                           _("Can't find device %s"), device);
+
+        if (!virDomainObjIsActive(vm))
+            virReportError(VIR_ERR_OPERATION_INVALID,
+                           "%s", _("domain is not running"));
+        else
+            rc = qemuDomainMemoryStatsFetch(driver, vm);
+
+        if (qemuDomainObjEndJob(driver, vm) == 0) {
+            vm = NULL;
             goto cleanup;
         }
+        if (rc < 0)
+            goto cleanup;
     }
 
-    if ((VIR_ALLOC(bandwidth) < 0) ||
-        (VIR_ALLOC(bandwidth->in) < 0) ||
-        (VIR_ALLOC(bandwidth->out) < 0)) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
-    for (i = 0; i < nparams; i++) {
-        virTypedParameterPtr param = &params[i];
+    ret = MIN(priv->nmemStats, nr_stats);
+    memcpy(stats, priv->memStats, ret * sizeof(*stats));
 
-        if (STREQ(param->field, VIR_DOMAIN_BANDWIDTH_IN_AVERAGE)) {
-            bandwidth->in->average = params[i].value.ui;
-        } else if (STREQ(param->field, VIR_DOMAIN_BANDWIDTH_IN_PEAK)) {
-            bandwidth->in->peak = params[i].value.ui;
-        } else if (STREQ(param->field, VIR_DOMAIN_BANDWIDTH_IN_BURST)) {
-            bandwidth->in->burst = params[i].value.ui;
-        } else if (STREQ(param->field, VIR_DOMAIN_BANDWIDTH_OUT_AVERAGE)) {
-            bandwidth->out->average = params[i].value.ui;
-        } else if (STREQ(param->field, VIR_DOMAIN_BANDWIDTH_OUT_PEAK)) {
-            bandwidth->out->peak = params[i].value.ui;
-        } else if (STREQ(param->field, VIR_DOMAIN_BANDWIDTH_OUT_BURST)) {
-            bandwidth->out->burst = params[i].value.ui;
+    /* Balloon change events keep the current size up to date */
+    if (qemuCapsGet(priv->caps, QEMU_CAPS_BALLOON_EVENT)) {
+        for (i = 0; i < ret; i++) {
+            if (stats[i].tag == VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON)
+                stats[i].val = vm->def->mem.cur_balloon;
         }
     }
 
-    /* average is mandatory, peak and burst are optional. So if no
-     * average is given, we free inbound/outbound here which causes
-     * inbound/outbound to not be set. */
-    if (!bandwidth->in->average) {
-        VIR_FREE(bandwidth->in);
-    }
-    if (!bandwidth->out->average) {
-        VIR_FREE(bandwidth->out);
+    if (ret < nr_stats) {
+        if (qemuGetProcessInfo(NULL, NULL, &rss, vm->pid, 0) < 0) {
+            virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                           _("cannot get RSS for domain"));
+        } else {
+            stats[ret].tag = VIR_DOMAIN_MEMORY_STAT_RSS;
+            stats[ret].val = rss;
+            ret++;
+        }
     }
 
-    if (flags & VIR_DOMAIN_AFFECT_LIVE) {
-        if (VIR_ALLOC(newBandwidth) < 0) {
-            virReportOOMError();
-            goto cleanup;
-        }
+cleanup:
+    if (vm)
+        virDomainObjUnlock(vm);
+    return ret;
+}
 
-        /* virNetDevBandwidthSet() will clear any previous value of
-         * bandwidth parameters, so merge with old bandwidth parameters
-         * here to prevent them from being lost. */
-        if (bandwidth->in ||
-            (net->bandwidth && net->bandwidth->in)) {
-            if (VIR_ALLOC(newBandwidth->in) < 0) {
-                virReportOOMError();
-                goto cleanup;
-            }
+static int
+qemuDomainBlockPeek(virDomainPtr dom,
+                    const char *path,
+                    unsigned long long offset, size_t size,
+                    void *buffer,
+                    unsigned int flags)
+{
+    virDomainObjPtr vm;
+    int fd = -1, ret = -1;
+    const char *actual;
 
-            memcpy(newBandwidth->in,
-                   bandwidth->in ? bandwidth->in : net->bandwidth->in,
-                   sizeof(*newBandwidth->in));
-        }
-        if (bandwidth->out ||
-            (net->bandwidth && net->bandwidth->out)) {
-            if (VIR_ALLOC(newBandwidth->out) < 0) {
-                virReportOOMError();
-                goto cleanup;
-            }
+    virCheckFlags(0, -1);
 
-            memcpy(newBandwidth->out,
-                   bandwidth->out ? bandwidth->out : net->bandwidth->out,
-                   sizeof(*newBandwidth->out));
-        }
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
 
-        if (virNetDevBandwidthSet(net->ifname, newBandwidth, false) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot set bandwidth limits on %s"),
-                           device);
-            goto cleanup;
-        }
+    if (!path || path[0] == '\0') {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       "%s", _("NULL or empty path"));
+        goto cleanup;
+    }
 
-        virNetDevBandwidthFree(net->bandwidth);
-        net->bandwidth = newBandwidth;
-        newBandwidth = NULL;
+    /* Check the path belongs to this domain.  */
+    if (!(actual = virDomainDiskPathByName(vm->def, path))) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("invalid path '%s'"), path);
+        goto cleanup;
+    }
+    path = actual;
+
+    /* The path is correct, now try to open it and get its size. */
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        virReportSystemError(errno,
+                             _("%s: failed to open"), path);
+        goto cleanup;
     }
-    if (flags & VIR_DOMAIN_AFFECT_CONFIG) {
-        if (!persistentNet->bandwidth) {
-            persistentNet->bandwidth = bandwidth;
-            bandwidth = NULL;
-        } else {
-            if (bandwidth->in) {
-                VIR_FREE(persistentNet->bandwidth->in);
-                persistentNet->bandwidth->in = bandwidth->in;
-                bandwidth->in = NULL;
-            }
-            if (bandwidth->out) {
-                VIR_FREE(persistentNet->bandwidth->out);
-                persistentNet->bandwidth->out = bandwidth->out;
-                bandwidth->out = NULL;
-            }
-        }
 
-        if (virDomainSaveConfig(driver->configDir, persistentDef) < 0)
-            goto cleanup;
+    /* Seek and read. */
+    /* NB. Because we configure with AC_SYS_LARGEFILE, off_t should
+     * be 64 bits on all platforms.
+     */
+    if (lseek(fd, offset, SEEK_SET) == (off_t) -1 ||
+        saferead(fd, buffer, size) == (ssize_t) -1) {
+        virReportSystemError(errno,
+                             _("%s: failed to seek or read"), path);
+        goto cleanup;
     }
 
     ret = 0;
+
 cleanup:
-    virNetDevBandwidthFree(bandwidth);
-    virNetDevBandwidthFree(newBandwidth);
-    virCgroupFree(&group);
+    VIR_FORCE_CLOSE(fd);
     if (vm)
         virDomainObjUnlock(vm);
-    qemuDriverUnlock(driver);
     return ret;
 }
 
 static int
-qemuDomainGetInterfaceParameters(virDomainPtr dom,
-                                 const char *device,
-                                 virTypedParameterPtr params,
-                                 int *nparams,
-                                 unsigned int flags)
+qemuDomainMemoryPeek(virDomainPtr dom,
+                     unsigned long long offset, size_t size,
+                     void *buffer,
+                     unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
-    int i;
-    virCgroupPtr group = NULL;
-    virDomainObjPtr vm = NULL;
-    virDomainDefPtr def = NULL;
-    virDomainDefPtr persistentDef = NULL;
-    virDomainNetDefPtr net = NULL;
-    int ret = -1;
-
-    virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
-                  VIR_DOMAIN_AFFECT_CONFIG |
-                  VIR_TYPED_PARAM_STRING_OKAY, -1);
-
-    qemuDriverLock(driver);
+    virDomainObjPtr vm;
+    char *tmp = NULL;
+    int fd = -1, ret = -1;
+    qemuDomainObjPrivatePtr priv;
 
-    flags &= ~VIR_TYPED_PARAM_STRING_OKAY;
+    virCheckFlags(VIR_MEMORY_VIRTUAL | VIR_MEMORY_PHYSICAL, -1);
 
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
 
-    if (vm == NULL) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("No such domain %s"), dom->uuid);
+    if (flags != VIR_MEMORY_VIRTUAL && flags != VIR_MEMORY_PHYSICAL) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       "%s", _("flags parameter must be VIR_MEMORY_VIRTUAL or VIR_MEMORY_PHYSICAL"));
         goto cleanup;
     }
 
-    if (virDomainLiveConfigHelperMethod(driver->caps, vm, &flags,
-                                        &persistentDef) < 0)
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
         goto cleanup;
 
-    if ((*nparams) == 0) {
-        *nparams = QEMU_NB_BANDWIDTH_PARAM;
-        ret = 0;
-        goto cleanup;
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto endjob;
     }
 
-    def = persistentDef;
-    if (!def)
-        def = vm->def;
+    if (virAsprintf(&tmp, "%s/qemu.mem.XXXXXX", driver->cacheDir) < 0) {
+        virReportOOMError();
+        goto endjob;
+    }
 
-    net = virDomainNetFind(def, device);
-    if (!net) {
-        virReportError(VIR_ERR_INVALID_ARG,
-                       _("Can't find device %s"), device);
-        goto cleanup;
+    /* Create a temporary filename. */
+    if ((fd = mkostemp(tmp, O_CLOEXEC)) == -1) {
+        virReportSystemError(errno,
+                             _("mkostemp(\"%s\") failed"), tmp);
+        goto endjob;
     }
 
-    for (i = 0; i < *nparams && i < QEMU_NB_BANDWIDTH_PARAM; i++) {
-        switch (i) {
-        case 0: /* inbound.average */
-            if (virTypedParameterAssign(&params[i],
-                                        VIR_DOMAIN_BANDWIDTH_IN_AVERAGE,
-                                        VIR_TYPED_PARAM_UINT, 0) < 0)
-                goto cleanup;
-            if (net->bandwidth && net->bandwidth->in)
-                params[i].value.ui = net->bandwidth->in->average;
-            break;
-        case 1: /* inbound.peak */
-            if (virTypedParameterAssign(&params[i],
-                                        VIR_DOMAIN_BANDWIDTH_IN_PEAK,
-                                        VIR_TYPED_PARAM_UINT, 0) < 0)
-                goto cleanup;
-            if (net->bandwidth && net->bandwidth->in)
-                params[i].value.ui = net->bandwidth->in->peak;
-            break;
-        case 2: /* inbound.burst */
-            if (virTypedParameterAssign(&params[i],
-                                        VIR_DOMAIN_BANDWIDTH_IN_BURST,
-                                        VIR_TYPED_PARAM_UINT, 0) < 0)
-                goto cleanup;
-            if (net->bandwidth && net->bandwidth->in)
-                params[i].value.ui = net->bandwidth->in->burst;
-            break;
-        case 3: /* outbound.average */
-            if (virTypedParameterAssign(&params[i],
-                                        VIR_DOMAIN_BANDWIDTH_OUT_AVERAGE,
-                                        VIR_TYPED_PARAM_UINT, 0) < 0)
-                goto cleanup;
-            if (net->bandwidth && net->bandwidth->out)
-                params[i].value.ui = net->bandwidth->out->average;
-            break;
-        case 4: /* outbound.peak */
-            if (virTypedParameterAssign(&params[i],
-                                        VIR_DOMAIN_BANDWIDTH_OUT_PEAK,
-                                        VIR_TYPED_PARAM_UINT, 0) < 0)
-                goto cleanup;
-            if (net->bandwidth && net->bandwidth->out)
-                params[i].value.ui = net->bandwidth->out->peak;
-            break;
-        case 5: /* outbound.burst */
-            if (virTypedParameterAssign(&params[i],
-                                        VIR_DOMAIN_BANDWIDTH_OUT_BURST,
-                                        VIR_TYPED_PARAM_UINT, 0) < 0)
-                goto cleanup;
-            if (net->bandwidth && net->bandwidth->out)
-                params[i].value.ui = net->bandwidth->out->burst;
-            break;
-        default:
-            break;
-            /* should not hit here */
+    virSecurityManagerSetSavedStateLabel(qemu_driver->securityManager, vm->def, tmp);
+
+    priv = vm->privateData;
+    qemuDomainObjEnterMonitor(driver, vm);
+    if (flags == VIR_MEMORY_VIRTUAL) {
+        if (qemuMonitorSaveVirtualMemory(priv->mon, offset, size, tmp) < 0) {
+            qemuDomainObjExitMonitor(driver, vm);
+            goto endjob;
+        }
+    } else {
+        if (qemuMonitorSavePhysicalMemory(priv->mon, offset, size, tmp) < 0) {
+            qemuDomainObjExitMonitor(driver, vm);
+            goto endjob;
         }
     }
+    qemuDomainObjExitMonitor(driver, vm);
+
+    /* Read the memory file into buffer. */
+    if (saferead(fd, buffer, size) == (ssize_t) -1) {
+        virReportSystemError(errno,
+                             _("failed to read temporary file "
+                               "created with template %s"), tmp);
+        goto endjob;
+    }
 
-    if (*nparams > QEMU_NB_BANDWIDTH_PARAM)
-        *nparams = QEMU_NB_BANDWIDTH_PARAM;
     ret = 0;
 
+endjob:
+    if (qemuDomainObjEndJob(driver, vm) == 0)
+        vm = NULL;
+
 cleanup:
-    if (group)
-        virCgroupFree(&group);
+    VIR_FORCE_CLOSE(fd);
+    if (tmp)
+        unlink(tmp);
+    VIR_FREE(tmp);
     if (vm)
         virDomainObjUnlock(vm);
-    qemuDriverUnlock(driver);
     return ret;
 }
 
+
 static int
-qemuDomainMemoryStats(virDomainPtr dom,
-                      struct _virDomainMemoryStat *stats,
-                      unsigned int nr_stats,
-                      unsigned int flags)
+qemuDomainBlockPeekStream(virDomainPtr dom,
+                          virStreamPtr st,
+                          const char *path,
+                          unsigned long long offset,
+                          unsigned long long length,
+                          unsigned int flags)
 {
-    virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
+    const char *actual;
     int ret = -1;
 
     virCheckFlags(0, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
 
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!path || path[0] == '\0') {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       "%s", _("NULL or empty path"));
         goto cleanup;
     }
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    /* Check the path belongs to this domain.  */
+    if (!(actual = virDomainDiskPathByName(vm->def, path))) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("invalid path '%s'"), path);
         goto cleanup;
-
-    if (!virDomainObjIsActive(vm)) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       "%s", _("domain is not running"));
-    } else {
-        qemuDomainObjPrivatePtr priv = vm->privateData;
-        qemuDomainObjEnterMonitor(driver, vm);
-        ret = qemuMonitorGetMemoryStats(priv->mon, stats, nr_stats);
-        qemuDomainObjExitMonitor(driver, vm);
-
-        if (ret >= 0 && ret < nr_stats) {
-            long rss;
-            if (qemuGetProcessInfo(NULL, NULL, &rss, vm->pid, 0) < 0) {
-                virReportError(VIR_ERR_OPERATION_FAILED, "%s",
-                               _("cannot get RSS for domain"));
-            } else {
-                stats[ret].tag = VIR_DOMAIN_MEMORY_STAT_RSS;
-                stats[ret].val = rss;
-                ret++;
-            }
-
-        }
     }
 
-    if (qemuDomainObjEndJob(driver, vm) == 0)
-        vm = NULL;
+    /* The data goes straight from the disk into the stream, through
+     * the I/O helper, without passing through the event loop */
+    if (virFDStreamOpenFile(st, actual, offset, length, O_RDONLY) < 0)
+        goto cleanup;
+
+    ret = 0;
 
 cleanup:
     if (vm)
@@ -9262,99 +10999,143 @@ cleanup:
     return ret;
 }
 
-static int
-qemuDomainBlockPeek(virDomainPtr dom,
-                    const char *path,
-                    unsigned long long offset, size_t size,
-                    void *buffer,
-                    unsigned int flags)
-{
-    virQEMUDriverPtr driver = dom->conn->privateData;
+
+/* How much memory is saved by each memsave/pmemsave command while
+ * streaming, so that the monitor is not held for too long at once */
+#define QEMU_MEMORY_PEEK_CHUNK (16 * 1024 * 1024)
+
+typedef struct _qemuMemoryPeekData qemuMemoryPeekData;
+typedef qemuMemoryPeekData *qemuMemoryPeekDataPtr;
+struct _qemuMemoryPeekData {
+    virQEMUDriverPtr driver;
     virDomainObjPtr vm;
-    int fd = -1, ret = -1;
-    const char *actual;
+    char *tmp;                  /* file qemu saves each chunk to */
+    int fd;                     /* write end of the stream's pipe */
+    unsigned long long start;
+    unsigned long long size;
+    unsigned int flags;
+};
 
-    virCheckFlags(0, -1);
+/*
+ * Saves the requested memory chunk by chunk through the monitor and
+ * feeds it into the stream. The job is only held while qemu saves a
+ * chunk, so a slow reader does not block other monitor commands.
+ */
+static void
+qemuDomainMemoryPeekWorker(void *opaque)
+{
+    qemuMemoryPeekDataPtr data = opaque;
+    virQEMUDriverPtr driver = data->driver;
+    virDomainObjPtr vm = data->vm;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long done = 0;
+    char *buf = NULL;
+    size_t bufsize = 64 * 1024;
+    int tmpfd = -1;
+
+    if (VIR_ALLOC_N(buf, bufsize) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    while (done < data->size) {
+        unsigned long long chunk = MIN(data->size - done,
+                                       QEMU_MEMORY_PEEK_CHUNK);
+        unsigned long long copied = 0;
+        int rc = -1;
+
+        virDomainObjLock(vm);
+        if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0) {
+            virDomainObjUnlock(vm);
+            goto cleanup;
+        }
+
+        if (!virDomainObjIsActive(vm)) {
+            virReportError(VIR_ERR_OPERATION_INVALID,
+                           "%s", _("domain is not running"));
+        } else {
+            qemuDomainObjEnterMonitor(driver, vm);
+            if (data->flags == VIR_MEMORY_VIRTUAL)
+                rc = qemuMonitorSaveVirtualMemory(priv->mon,
+                                                  data->start + done,
+                                                  chunk, data->tmp);
+            else
+                rc = qemuMonitorSavePhysicalMemory(priv->mon,
+                                                   data->start + done,
+                                                   chunk, data->tmp);
+            qemuDomainObjExitMonitor(driver, vm);
+        }
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
+        /* we hold a reference of our own, so the object stays */
+        ignore_value(qemuDomainObjEndJob(driver, vm));
+        virDomainObjUnlock(vm);
 
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
-        goto cleanup;
-    }
+        if (rc < 0)
+            goto cleanup;
 
-    if (!path || path[0] == '\0') {
-        virReportError(VIR_ERR_INVALID_ARG,
-                       "%s", _("NULL or empty path"));
-        goto cleanup;
-    }
+        if ((tmpfd = open(data->tmp, O_RDONLY | O_CLOEXEC)) < 0) {
+            virReportSystemError(errno, _("unable to open %s"), data->tmp);
+            goto cleanup;
+        }
 
-    /* Check the path belongs to this domain.  */
-    if (!(actual = virDomainDiskPathByName(vm->def, path))) {
-        virReportError(VIR_ERR_INVALID_ARG,
-                       _("invalid path '%s'"), path);
-        goto cleanup;
-    }
-    path = actual;
+        while (copied < chunk) {
+            ssize_t got = saferead(tmpfd, buf, MIN(bufsize, chunk - copied));
 
-    /* The path is correct, now try to open it and get its size. */
-    fd = open(path, O_RDONLY);
-    if (fd == -1) {
-        virReportSystemError(errno,
-                             _("%s: failed to open"), path);
-        goto cleanup;
-    }
+            if (got <= 0) {
+                virReportSystemError(got < 0 ? errno : EIO,
+                                     _("failed to read %s"), data->tmp);
+                goto cleanup;
+            }
+            if (safewrite(data->fd, buf, got) < 0) {
+                /* EPIPE just means the stream was closed early */
+                if (errno != EPIPE)
+                    virReportSystemError(errno, "%s",
+                                         _("failed to write to stream"));
+                goto cleanup;
+            }
+            copied += got;
+        }
 
-    /* Seek and read. */
-    /* NB. Because we configure with AC_SYS_LARGEFILE, off_t should
-     * be 64 bits on all platforms.
-     */
-    if (lseek(fd, offset, SEEK_SET) == (off_t) -1 ||
-        saferead(fd, buffer, size) == (ssize_t) -1) {
-        virReportSystemError(errno,
-                             _("%s: failed to seek or read"), path);
-        goto cleanup;
+        VIR_FORCE_CLOSE(tmpfd);
+        done += chunk;
     }
 
-    ret = 0;
-
 cleanup:
-    VIR_FORCE_CLOSE(fd);
-    if (vm)
+    if (done < data->size)
+        VIR_WARN("Memory stream of domain %s ended after %llu of %llu bytes",
+                 vm->def->name, done, data->size);
+    VIR_FREE(buf);
+    VIR_FORCE_CLOSE(tmpfd);
+    /* the stream sees the end of data once this is closed */
+    VIR_FORCE_CLOSE(data->fd);
+    unlink(data->tmp);
+    VIR_FREE(data->tmp);
+
+    virDomainObjLock(vm);
+    if (virObjectUnref(vm))
         virDomainObjUnlock(vm);
-    return ret;
+    VIR_FREE(data);
 }
 
 static int
-qemuDomainMemoryPeek(virDomainPtr dom,
-                     unsigned long long offset, size_t size,
-                     void *buffer,
-                     unsigned int flags)
+qemuDomainMemoryPeekStream(virDomainPtr dom,
+                           virStreamPtr st,
+                           unsigned long long start,
+                           unsigned long long size,
+                           unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
-    char *tmp = NULL;
-    int fd = -1, ret = -1;
-    qemuDomainObjPrivatePtr priv;
+    qemuMemoryPeekDataPtr data = NULL;
+    virThread thread;
+    int pipefd[2] = { -1, -1 };
+    int tmpfd = -1;
+    int ret = -1;
 
     virCheckFlags(VIR_MEMORY_VIRTUAL | VIR_MEMORY_PHYSICAL, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (flags != VIR_MEMORY_VIRTUAL && flags != VIR_MEMORY_PHYSICAL) {
         virReportError(VIR_ERR_INVALID_ARG,
@@ -9362,69 +11143,73 @@ qemuDomainMemoryPeek(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
-        goto cleanup;
-
     if (!virDomainObjIsActive(vm)) {
         virReportError(VIR_ERR_OPERATION_INVALID,
                        "%s", _("domain is not running"));
-        goto endjob;
+        goto cleanup;
     }
 
-    if (virAsprintf(&tmp, "%s/qemu.mem.XXXXXX", driver->cacheDir) < 0) {
+    if (VIR_ALLOC(data) < 0 ||
+        virAsprintf(&data->tmp, "%s/qemu.mem.XXXXXX", driver->cacheDir) < 0) {
         virReportOOMError();
-        goto endjob;
+        goto cleanup;
     }
+    data->fd = -1;
 
-    /* Create a temporary filename. */
-    if ((fd = mkostemp(tmp, O_CLOEXEC)) == -1) {
+    if ((tmpfd = mkostemp(data->tmp, O_CLOEXEC)) == -1) {
         virReportSystemError(errno,
-                             _("mkostemp(\"%s\") failed"), tmp);
-        goto endjob;
+                             _("mkostemp(\"%s\") failed"), data->tmp);
+        VIR_FREE(data->tmp);
+        goto cleanup;
     }
+    VIR_FORCE_CLOSE(tmpfd);
 
-    virSecurityManagerSetSavedStateLabel(qemu_driver->securityManager, vm->def, tmp);
+    virSecurityManagerSetSavedStateLabel(qemu_driver->securityManager,
+                                         vm->def, data->tmp);
 
-    priv = vm->privateData;
-    qemuDomainObjEnterMonitor(driver, vm);
-    if (flags == VIR_MEMORY_VIRTUAL) {
-        if (qemuMonitorSaveVirtualMemory(priv->mon, offset, size, tmp) < 0) {
-            qemuDomainObjExitMonitor(driver, vm);
-            goto endjob;
-        }
-    } else {
-        if (qemuMonitorSavePhysicalMemory(priv->mon, offset, size, tmp) < 0) {
-            qemuDomainObjExitMonitor(driver, vm);
-            goto endjob;
-        }
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+        virReportSystemError(errno, "%s", _("unable to create pipe"));
+        goto cleanup;
     }
-    qemuDomainObjExitMonitor(driver, vm);
 
-    /* Read the memory file into buffer. */
-    if (saferead(fd, buffer, size) == (ssize_t) -1) {
-        virReportSystemError(errno,
-                             _("failed to read temporary file "
-                               "created with template %s"), tmp);
-        goto endjob;
+    if (virFDStreamOpen(st, pipefd[0]) < 0)
+        goto cleanup;
+    pipefd[0] = -1;
+
+    data->driver = driver;
+    data->vm = vm;
+    data->fd = pipefd[1];
+    data->start = start;
+    data->size = size;
+    data->flags = flags;
+
+    virObjectRef(vm);
+    if (virThreadCreate(&thread, false, qemuDomainMemoryPeekWorker,
+                        data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create memory peek thread"));
+        virObjectUnref(vm);
+        goto cleanup;
     }
+    pipefd[1] = -1;
+    data = NULL;
 
     ret = 0;
 
-endjob:
-    if (qemuDomainObjEndJob(driver, vm) == 0)
-        vm = NULL;
-
 cleanup:
-    VIR_FORCE_CLOSE(fd);
-    if (tmp)
-        unlink(tmp);
-    VIR_FREE(tmp);
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(pipefd[1]);
+    if (data) {
+        if (data->tmp)
+            unlink(data->tmp);
+        VIR_FREE(data->tmp);
+        VIR_FREE(data);
+    }
     if (vm)
         virDomainObjUnlock(vm);
     return ret;
 }
 
-
 static int qemuDomainGetBlockInfo(virDomainPtr dom,
                                   const char *path,
                                   virDomainBlockInfoPtr info,
@@ -9442,16 +11227,8 @@ static int qemuDomainGetBlockInfo(virDomainPtr dom,
 
     virCheckFlags(0, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (!path || path[0] == '\0') {
         virReportError(VIR_ERR_INVALID_ARG,
@@ -10382,28 +12159,35 @@ qemuCPUBaseline(virConnectPtr conn ATTRIBUTE_UNUSED,
 
 static int qemuDomainGetJobInfo(virDomainPtr dom,
                                 virDomainJobInfoPtr info) {
-    virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
     int ret = -1;
     qemuDomainObjPrivatePtr priv;
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     priv = vm->privateData;
 
     if (virDomainObjIsActive(vm)) {
-        if (priv->job.asyncJob && !priv->job.dump_memory_only) {
+        if (priv->job.asyncJob) {
             memcpy(info, &priv->job.info, sizeof(*info));
 
+            /* A memory-only dump is a single monitor command, so follow
+             * it by what it has written so far */
+            if (priv->job.dump_memory_only && priv->job.path) {
+                struct stat sb;
+
+                if (stat(priv->job.path, &sb) == 0 && S_ISREG(sb.st_mode)) {
+                    info->fileProcessed = sb.st_size;
+                    if (info->dataTotal) {
+                        info->dataProcessed = MIN(sb.st_size,
+                                                  info->dataTotal);
+                        info->dataRemaining = info->dataTotal -
+                                              info->dataProcessed;
+                    }
+                }
+            }
+
             /* Refresh elapsed time again just to ensure it
              * is fully updated. This is primarily for benefit
              * of incoming migration which we don't currently
@@ -10437,16 +12221,8 @@ static int qemuDomainAbortJob(virDomainPtr dom) {
     int ret = -1;
     qemuDomainObjPrivatePtr priv;
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_ABORT) < 0)
         goto cleanup;
@@ -10472,6 +12248,13 @@ static int qemuDomainAbortJob(virDomainPtr dom) {
 
     VIR_DEBUG("Cancelling job at client request");
     qemuDomainObjAbortAsyncJob(vm);
+
+    /* The thread running the block jobs cancels them itself */
+    if (priv->job.asyncJob == QEMU_ASYNC_JOB_BLOCK_FLATTEN) {
+        ret = 0;
+        goto endjob;
+    }
+
     qemuDomainObjEnterMonitor(driver, vm);
     ret = qemuMonitorMigrateCancel(priv->mon);
     qemuDomainObjExitMonitor(driver, vm);
@@ -10499,17 +12282,8 @@ qemuDomainMigrateSetMaxDowntime(virDomainPtr dom,
 
     virCheckFlags(0, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         return -1;
-    }
 
     if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MIGRATION_OP) < 0)
         goto cleanup;
@@ -10532,6 +12306,8 @@ qemuDomainMigrateSetMaxDowntime(virDomainPtr dom,
     qemuDomainObjEnterMonitor(driver, vm);
     ret = qemuMonitorSetMigrationDowntime(priv->mon, downtime);
     qemuDomainObjExitMonitor(driver, vm);
+    if (ret == 0)
+        priv->job.migDowntime = downtime;
 
 endjob:
     if (qemuDomainObjEndJob(driver, vm) == 0)
@@ -10555,17 +12331,8 @@ qemuDomainMigrateSetMaxSpeed(virDomainPtr dom,
 
     virCheckFlags(0, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         return -1;
-    }
 
     priv = vm->privateData;
     if (virDomainObjIsActive(vm)) {
@@ -10578,21 +12345,98 @@ qemuDomainMigrateSetMaxSpeed(virDomainPtr dom,
             goto endjob;
         }
 
-        VIR_DEBUG("Setting migration bandwidth to %luMbs", bandwidth);
-        qemuDomainObjEnterMonitor(driver, vm);
-        ret = qemuMonitorSetMigrationSpeed(priv->mon, bandwidth);
-        qemuDomainObjExitMonitor(driver, vm);
+        VIR_DEBUG("Setting migration bandwidth to %luMbs", bandwidth);
+        qemuDomainObjEnterMonitor(driver, vm);
+        ret = qemuMonitorSetMigrationSpeed(priv->mon, bandwidth);
+        qemuDomainObjExitMonitor(driver, vm);
+
+        if (ret == 0) {
+            priv->migMaxBandwidth = bandwidth;
+            /* Keep a scheduled migration within the new maximum */
+            if (priv->job.migScheduled) {
+                priv->job.migBandwidth = 0;
+                priv->job.migSpeed = bandwidth;
+            }
+        }
+
+endjob:
+        if (qemuDomainObjEndJob(driver, vm) == 0)
+            vm = NULL;
+    } else {
+        priv->migMaxBandwidth = bandwidth;
+        ret = 0;
+    }
+
+cleanup:
+    if (vm)
+        virDomainObjUnlock(vm);
+    return ret;
+}
+
+static int
+qemuDomainMigrateGetMaxSpeed(virDomainPtr dom,
+                             unsigned long *bandwidth,
+                             unsigned int flags)
+{
+    virDomainObjPtr vm;
+    qemuDomainObjPrivatePtr priv;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    priv = vm->privateData;
+    *bandwidth = priv->migMaxBandwidth;
+    ret = 0;
+
+cleanup:
+    if (vm)
+        virDomainObjUnlock(vm);
+    return ret;
+}
+
+static int
+qemuDomainMigrateGetCompressionCache(virDomainPtr dom,
+                                     unsigned long long *cacheSize,
+                                     unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm;
+    qemuDomainObjPrivatePtr priv;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto endjob;
+    }
+
+    priv = vm->privateData;
 
-        if (ret == 0)
-            priv->migMaxBandwidth = bandwidth;
+    if (!qemuCapsGet(priv->caps, QEMU_CAPS_MIGRATE_XBZRLE)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Compressed migration is not supported by "
+                         "QEMU binary"));
+        goto endjob;
+    }
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    ret = qemuMonitorGetMigrationCacheSize(priv->mon, cacheSize);
+    qemuDomainObjExitMonitor(driver, vm);
 
 endjob:
-        if (qemuDomainObjEndJob(driver, vm) == 0)
-            vm = NULL;
-    } else {
-        priv->migMaxBandwidth = bandwidth;
-        ret = 0;
-    }
+    if (qemuDomainObjEndJob(driver, vm) == 0)
+        vm = NULL;
 
 cleanup:
     if (vm)
@@ -10601,9 +12445,9 @@ cleanup:
 }
 
 static int
-qemuDomainMigrateGetMaxSpeed(virDomainPtr dom,
-                             unsigned long *bandwidth,
-                             unsigned int flags)
+qemuDomainMigrateSetCompressionCache(virDomainPtr dom,
+                                     unsigned long long cacheSize,
+                                     unsigned int flags)
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
@@ -10612,21 +12456,35 @@ qemuDomainMigrateGetMaxSpeed(virDomainPtr dom,
 
     virCheckFlags(0, -1);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
 
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MIGRATION_OP) < 0)
         goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto endjob;
     }
 
     priv = vm->privateData;
-    *bandwidth = priv->migMaxBandwidth;
-    ret = 0;
+
+    if (!qemuCapsGet(priv->caps, QEMU_CAPS_MIGRATE_XBZRLE)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Compressed migration is not supported by "
+                         "QEMU binary"));
+        goto endjob;
+    }
+
+    VIR_DEBUG("Setting compression cache to %llu B", cacheSize);
+    qemuDomainObjEnterMonitor(driver, vm);
+    ret = qemuMonitorSetMigrationCacheSize(priv->mon, cacheSize);
+    qemuDomainObjExitMonitor(driver, vm);
+
+endjob:
+    if (qemuDomainObjEndJob(driver, vm) == 0)
+        vm = NULL;
 
 cleanup:
     if (vm)
@@ -11367,6 +13225,45 @@ cleanup:
 }
 
 
+struct qemuDomainSnapshotConvergedData {
+    virConnectPtr conn;
+    virDomainSnapshotObjPtr snap;
+    unsigned int flags;
+    bool resume;                /* resume the guest after the disks */
+    bool disks;                 /* set once the disks are snapshotted */
+    bool resumed;               /* set once the guest runs again */
+};
+
+/*
+ * Snapshot the disks of a live external checkpoint at the instant the
+ * memory migration converged, and let the guest run again while the
+ * memory image is still being flushed to disk, so that the guest is
+ * only paused for the migration downtime and the disk snapshots.
+ */
+static int
+qemuDomainSnapshotMemoryConverged(virQEMUDriverPtr driver,
+                                  virDomainObjPtr vm,
+                                  void *opaque)
+{
+    struct qemuDomainSnapshotConvergedData *data = opaque;
+
+    if (qemuDomainSnapshotCreateDiskActive(driver, vm, data->snap,
+                                           data->flags,
+                                           QEMU_ASYNC_JOB_SNAPSHOT) < 0)
+        return -1;
+    data->disks = true;
+
+    if (data->resume && virDomainObjIsActive(vm)) {
+        if (qemuProcessStartCPUs(driver, vm, data->conn,
+                                 VIR_DOMAIN_RUNNING_UNPAUSED,
+                                 QEMU_ASYNC_JOB_SNAPSHOT) < 0)
+            return -1;
+        data->resumed = true;
+    }
+
+    return 0;
+}
+
 static int
 qemuDomainSnapshotCreateActiveExternal(virConnectPtr conn,
                                        virQEMUDriverPtr driver,
@@ -11384,6 +13281,9 @@ qemuDomainSnapshotCreateActiveExternal(virConnectPtr conn,
     bool atomic = !!(flags & VIR_DOMAIN_SNAPSHOT_CREATE_ATOMIC);
     bool transaction = qemuCapsGet(priv->caps, QEMU_CAPS_TRANSACTION);
     int thaw = 0; /* 1 if freeze succeeded, -1 if freeze failed */
+    struct qemuDomainSnapshotConvergedData converged = {
+        conn, snap, flags, false, false, false
+    };
 
     if (qemuDomainObjBeginAsyncJobWithDriver(driver, vm,
                                              QEMU_ASYNC_JOB_SNAPSHOT) < 0)
@@ -11446,10 +13346,21 @@ qemuDomainSnapshotCreateActiveExternal(virConnectPtr conn,
         if (!(xml = qemuDomainDefFormatLive(driver, vm->def, true, false)))
             goto endjob;
 
-        if ((ret = qemuDomainSaveMemory(driver, vm, snap->def->file,
-                                        xml, QEMU_SAVE_FORMAT_RAW,
-                                        resume, 0,
-                                        QEMU_ASYNC_JOB_SNAPSHOT)) < 0)
+        /* A live checkpoint takes the disk snapshots as soon as qemu
+         * paused the guest at the end of the migration, and resumes
+         * it before the image is flushed, unless it is to be halted */
+        converged.resume = resume &&
+            !(flags & VIR_DOMAIN_SNAPSHOT_CREATE_HALT);
+        ret = qemuDomainSaveMemory(driver, vm, snap->def->file,
+                                   xml, QEMU_SAVE_FORMAT_RAW,
+                                   resume, 0,
+                                   QEMU_ASYNC_JOB_SNAPSHOT,
+                                   (flags & VIR_DOMAIN_SNAPSHOT_CREATE_LIVE) ?
+                                   qemuDomainSnapshotMemoryConverged : NULL,
+                                   &converged);
+        if (converged.resumed)
+            resume = false;
+        if (ret < 0)
             goto endjob;
 
         /* the memory image was created, remove it on errors */
@@ -11460,13 +13371,15 @@ qemuDomainSnapshotCreateActiveExternal(virConnectPtr conn,
     }
 
     /* now the domain is now paused if:
-     * - if a memory snapshot was requested
+     * - if a memory snapshot was requested, and it was not live
      * - an atomic snapshot was requested AND
      *   qemu does not support transactions
      *
-     * Next we snapshot the disks.
+     * Next we snapshot the disks, unless a live memory snapshot
+     * already did.
      */
-    if ((ret = qemuDomainSnapshotCreateDiskActive(driver, vm, snap, flags,
+    if (!converged.disks &&
+        (ret = qemuDomainSnapshotCreateDiskActive(driver, vm, snap, flags,
                                                   QEMU_ASYNC_JOB_SNAPSHOT)) < 0)
         goto endjob;
 
@@ -11839,10 +13752,7 @@ cleanup:
                     vm->current_snapshot = snap;
                 other = virDomainSnapshotFindByName(vm->snapshots,
                                                     snap->def->parent);
-                snap->parent = other;
-                other->nchildren++;
-                snap->sibling = other->first_child;
-                other->first_child = snap;
+                virDomainSnapshotSetParent(snap, other);
             }
         } else if (snap) {
             virDomainSnapshotObjListRemove(vm->snapshots, snap);
@@ -12453,8 +14363,10 @@ static int qemuDomainRevertToSnapshot(virDomainSnapshotPtr snapshot,
             }
             goto endjob;
         }
-        if (config)
+        if (config) {
             virDomainObjAssignDef(vm, config, false);
+            virDomainObjListUpdateMetadataIndex(&driver->domains, vm);
+        }
 
         if (flags & (VIR_DOMAIN_SNAPSHOT_REVERT_RUNNING |
                      VIR_DOMAIN_SNAPSHOT_REVERT_PAUSED)) {
@@ -12529,7 +14441,6 @@ struct _virQEMUSnapReparent {
     virDomainSnapshotObjPtr parent;
     virDomainObjPtr vm;
     int err;
-    virDomainSnapshotObjPtr last;
 };
 
 static void
@@ -12545,7 +14456,6 @@ qemuDomainSnapshotReparentChildren(void *payload,
     }
 
     VIR_FREE(snap->def->parent);
-    snap->parent = rep->parent;
 
     if (rep->parent->def) {
         snap->def->parent = strdup(rep->parent->def->name);
@@ -12557,9 +14467,6 @@ qemuDomainSnapshotReparentChildren(void *payload,
         }
     }
 
-    if (!snap->sibling)
-        rep->last = snap;
-
     rep->err = qemuDomainSnapshotWriteMetadata(rep->vm, snap,
                                                rep->driver->snapshotDir);
 }
@@ -12643,16 +14550,13 @@ static int qemuDomainSnapshotDelete(virDomainSnapshotPtr snapshot,
         rep.parent = snap->parent;
         rep.vm = vm;
         rep.err = 0;
-        rep.last = NULL;
         virDomainSnapshotForEachChild(snap,
                                       qemuDomainSnapshotReparentChildren,
                                       &rep);
         if (rep.err < 0)
             goto endjob;
         /* Can't modify siblings during ForEachChild, so do it now.  */
-        snap->parent->nchildren += snap->nchildren;
-        rep.last->sibling = snap->parent->first_child;
-        snap->parent->first_child = snap->first_child;
+        virDomainSnapshotMoveChildren(snap, snap->parent);
     }
 
     if (flags & VIR_DOMAIN_SNAPSHOT_DELETE_CHILDREN_ONLY) {
@@ -13656,6 +15560,359 @@ cleanup:
     return ret;
 }
 
+/* How often virDomainBlockFlatten looks at its block jobs (ms), unless
+ * a block job event wakes it up earlier */
+#define QEMU_BLOCK_FLATTEN_POLL 500
+
+typedef struct _qemuBlockFlattenDisk qemuBlockFlattenDisk;
+typedef qemuBlockFlattenDisk *qemuBlockFlattenDiskPtr;
+struct _qemuBlockFlattenDisk {
+    virDomainDiskDefPtr disk;
+    char *device;               /* qemu alias of the drive */
+    char *base;                 /* commit target, NULL for pull */
+    bool started;
+    bool done;
+    unsigned long long cur;     /* last known progress */
+    unsigned long long end;
+};
+
+/* Limit every job of @disks which is still running to @share MiB/s,
+ * so that their sum stays within the limit requested by the caller.  */
+static int
+qemuDomainBlockFlattenSetSpeed(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm,
+                               qemuBlockFlattenDiskPtr disks,
+                               size_t ndisks,
+                               unsigned long share)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    size_t i;
+    int ret = 0;
+
+    for (i = 0; i < ndisks && ret == 0; i++) {
+        if (!disks[i].started || disks[i].done)
+            continue;
+
+        if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                           QEMU_ASYNC_JOB_BLOCK_FLATTEN) < 0)
+            return -1;
+        ret = qemuMonitorBlockJob(priv->mon, disks[i].device, NULL, share,
+                                  NULL, BLOCK_JOB_SPEED, true);
+        qemuDomainObjExitMonitorWithDriver(driver, vm);
+    }
+
+    return ret;
+}
+
+/* A block job which is gone from qemu either completed, in which case
+ * the block job event already refreshed the backing chain of its disk,
+ * or failed or was cancelled and left the chain as it was.  */
+static bool
+qemuDomainBlockFlattenSucceeded(qemuBlockFlattenDiskPtr fdisk)
+{
+    virStorageFileMetadataPtr chain = fdisk->disk->backingChain;
+
+    if (!chain)
+        return false;
+    if (!fdisk->base)
+        return !chain->backingStore;
+    return chain->backingMeta && !chain->backingMeta->backingStore;
+}
+
+static int
+qemuDomainBlockFlatten(virDomainPtr dom, unsigned long bandwidth,
+                       unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm = NULL;
+    qemuDomainObjPrivatePtr priv;
+    qemuBlockFlattenDiskPtr disks = NULL;
+    size_t ndisks = 0;
+    size_t nalloc = 0;
+    size_t running = 0;
+    virCgroupPtr cgroup = NULL;
+    bool commit = (flags & VIR_DOMAIN_BLOCK_FLATTEN_COMMIT) != 0;
+    bool failed = false;
+    int ret = -1;
+    size_t i;
+
+    virCheckFlags(VIR_DOMAIN_BLOCK_FLATTEN_COMMIT, -1);
+
+    qemuDriverLock(driver);
+    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
+    if (!vm) {
+        char uuidstr[VIR_UUID_STRING_BUFLEN];
+        virUUIDFormat(dom->uuid, uuidstr);
+        virReportError(VIR_ERR_NO_DOMAIN,
+                       _("no domain with matching uuid '%s'"), uuidstr);
+        goto cleanup;
+    }
+    priv = vm->privateData;
+
+    if (qemuDomainObjBeginAsyncJobWithDriver(driver, vm,
+                                             QEMU_ASYNC_JOB_BLOCK_FLATTEN) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto endjob;
+    }
+    if (commit ? !qemuCapsGet(priv->caps, QEMU_CAPS_BLOCK_COMMIT) :
+        !qemuCapsGet(priv->caps, QEMU_CAPS_BLOCKJOB_ASYNC)) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       commit ?
+                       _("online commit not supported with this QEMU binary") :
+                       _("block jobs not supported with this QEMU binary"));
+        goto endjob;
+    }
+
+    if (VIR_ALLOC_N(disks, vm->def->ndisks) < 0) {
+        virReportOOMError();
+        goto endjob;
+    }
+    nalloc = vm->def->ndisks;
+
+    /* Pick the disks first, so that nothing is started unless every
+     * disk can be flattened.  */
+    for (i = 0; i < vm->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = vm->def->disks[i];
+        qemuBlockFlattenDiskPtr fdisk = &disks[ndisks];
+        virStorageFileMetadataPtr chain;
+
+        if (!disk->src || disk->readonly)
+            continue;
+        if (disk->mirror) {
+            virReportError(VIR_ERR_BLOCK_COPY_ACTIVE,
+                           _("disk '%s' already in active block copy job"),
+                           disk->dst);
+            goto endjob;
+        }
+        if (qemuDomainDetermineDiskChain(driver, disk, false) < 0)
+            goto endjob;
+
+        chain = disk->backingChain;
+        if (!chain || !chain->backingStore)
+            continue;
+        if (commit) {
+            const char *base;
+
+            /* Committing the active image is not possible while the
+             * domain runs, so its immediate backing file is the top */
+            if (!chain->backingMeta || !chain->backingMeta->backingStore)
+                continue;
+            if (!(base = virStorageFileChainLookup(chain->backingMeta,
+                                                   chain->backingStore,
+                                                   NULL, NULL, NULL))) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("could not find base of chain for '%s'"),
+                               disk->dst);
+                goto endjob;
+            }
+            if (!(fdisk->base = strdup(base))) {
+                virReportOOMError();
+                goto endjob;
+            }
+        }
+
+        fdisk->disk = disk;
+        if (virAsprintf(&fdisk->device, "%s%s",
+                        QEMU_DRIVE_HOST_PREFIX, disk->info.alias) < 0) {
+            virReportOOMError();
+            goto endjob;
+        }
+        ndisks++;
+    }
+
+    if (!ndisks) {
+        ret = 0;
+        goto endjob;
+    }
+
+    if (commit &&
+        qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_DEVICES) &&
+        virCgroupForDomain(driver->cgroup, vm->def->name, &cgroup, 0) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to find cgroup for %s"),
+                       vm->def->name);
+        goto endjob;
+    }
+
+    priv->job.info.type = VIR_DOMAIN_JOB_BOUNDED;
+
+    for (i = 0; i < ndisks; i++) {
+        qemuBlockFlattenDiskPtr fdisk = &disks[i];
+        unsigned long share = bandwidth ? MAX(bandwidth / ndisks, 1) : 0;
+        int rc;
+
+        /* See qemuDomainBlockCommit for why the base must be writable */
+        if (fdisk->base &&
+            qemuDomainPrepareDiskChainElement(driver, vm, cgroup, fdisk->disk,
+                                              fdisk->base,
+                                              VIR_DISK_CHAIN_READ_WRITE) < 0)
+            goto abort;
+
+        if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                           QEMU_ASYNC_JOB_BLOCK_FLATTEN) < 0)
+            goto abort;
+        if (fdisk->base)
+            rc = qemuMonitorBlockCommit(priv->mon, fdisk->device,
+                                        fdisk->disk->backingChain->backingStore,
+                                        fdisk->base, share);
+        else
+            rc = qemuMonitorBlockJob(priv->mon, fdisk->device, NULL, share,
+                                     NULL, BLOCK_JOB_PULL, true);
+        qemuDomainObjExitMonitorWithDriver(driver, vm);
+
+        if (rc < 0) {
+            if (fdisk->base)
+                qemuDomainPrepareDiskChainElement(driver, vm, cgroup,
+                                                  fdisk->disk, fdisk->base,
+                                                  VIR_DISK_CHAIN_READ_ONLY);
+            goto abort;
+        }
+        fdisk->started = true;
+        running++;
+    }
+
+    while (running) {
+        unsigned long long now;
+        size_t finished = 0;
+
+        priv->job.info.dataTotal = 0;
+        priv->job.info.dataProcessed = 0;
+
+        for (i = 0; i < ndisks; i++) {
+            qemuBlockFlattenDiskPtr fdisk = &disks[i];
+            virDomainBlockJobInfo info;
+            int rc;
+
+            if (fdisk->done)
+                goto account;
+
+            if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                               QEMU_ASYNC_JOB_BLOCK_FLATTEN) < 0)
+                goto abort;
+
+            if (priv->job.asyncAbort) {
+                /* explicitly do this *after* we entered the monitor,
+                 * as this is a critical section so we are guaranteed
+                 * priv->job.asyncAbort will not change */
+                qemuDomainObjExitMonitorWithDriver(driver, vm);
+                virReportError(VIR_ERR_OPERATION_ABORTED, "%s",
+                               _("block flatten job: canceled by client"));
+                goto abort;
+            }
+
+            rc = qemuMonitorBlockJob(priv->mon, fdisk->device, NULL, 0,
+                                     &info, BLOCK_JOB_INFO, true);
+            qemuDomainObjExitMonitorWithDriver(driver, vm);
+
+            if (rc < 0)
+                goto abort;
+
+            if (rc == 0) {
+                fdisk->done = true;
+                fdisk->cur = fdisk->end;
+                finished++;
+                if (!qemuDomainBlockFlattenSucceeded(fdisk)) {
+                    virReportError(VIR_ERR_OPERATION_FAILED,
+                                   _("flattening disk '%s' failed"),
+                                   fdisk->disk->dst);
+                    goto abort;
+                }
+            } else {
+                fdisk->cur = info.cur;
+                fdisk->end = info.end;
+            }
+
+        account:
+            priv->job.info.dataTotal += fdisk->end;
+            priv->job.info.dataProcessed += fdisk->cur;
+        }
+        priv->job.info.dataRemaining = priv->job.info.dataTotal -
+                                       priv->job.info.dataProcessed;
+
+        running -= finished;
+        if (!running)
+            break;
+
+        /* Hand the bandwidth of finished jobs to the remaining ones */
+        if (finished && bandwidth &&
+            qemuDomainBlockFlattenSetSpeed(driver, vm, disks, ndisks,
+                                           MAX(bandwidth / running, 1)) < 0)
+            goto abort;
+
+        if (virTimeMillisNow(&now) < 0)
+            goto abort;
+
+        /* Block job events wake us up as soon as a job ends */
+        qemuDriverUnlock(driver);
+        ignore_value(virCondWaitUntil(&priv->job.progressCond, &vm->lock,
+                                      now + QEMU_BLOCK_FLATTEN_POLL));
+        virDomainObjUnlock(vm);
+
+        qemuDriverLock(driver);
+        virDomainObjLock(vm);
+
+        if (!virDomainObjIsActive(vm)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("guest unexpectedly quit"));
+            goto endjob;
+        }
+    }
+
+    priv->job.info.type = VIR_DOMAIN_JOB_COMPLETED;
+    ret = 0;
+    goto endjob;
+
+abort:
+    failed = true;
+    priv->job.info.type = VIR_DOMAIN_JOB_FAILED;
+
+endjob:
+    if (failed && virDomainObjIsActive(vm)) {
+        virErrorPtr orig_err = virSaveLastError();
+
+        /* Jobs which are still running are cancelled in the background
+         * and report that through their own events */
+        for (i = 0; i < ndisks; i++) {
+            if (!disks[i].started || disks[i].done)
+                continue;
+            if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                               QEMU_ASYNC_JOB_BLOCK_FLATTEN) < 0)
+                break;
+            if (qemuMonitorBlockJob(priv->mon, disks[i].device, NULL, 0, NULL,
+                                    BLOCK_JOB_ABORT, true) < 0)
+                VIR_DEBUG("Unable to cancel block job of '%s'",
+                          disks[i].device);
+            qemuDomainObjExitMonitorWithDriver(driver, vm);
+        }
+
+        if (orig_err) {
+            virSetError(orig_err);
+            virFreeError(orig_err);
+        }
+    }
+    if (cgroup)
+        virCgroupFree(&cgroup);
+    if (qemuDomainObjEndAsyncJob(driver, vm) == 0)
+        vm = NULL;
+
+cleanup:
+    if (disks) {
+        for (i = 0; i < nalloc; i++) {
+            VIR_FREE(disks[i].device);
+            VIR_FREE(disks[i].base);
+        }
+        VIR_FREE(disks);
+    }
+    if (vm)
+        virDomainObjUnlock(vm);
+    qemuDriverUnlock(driver);
+    return ret;
+}
+
 static int
 qemuDomainOpenGraphics(virDomainPtr dom,
                        unsigned int idx,
@@ -14133,22 +16390,14 @@ qemuDomainSetMetadata(virDomainPtr dom,
 
     virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
                   VIR_DOMAIN_AFFECT_CONFIG, -1);
-
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (virDomainLiveConfigHelperMethod(driver->caps, vm, &flags,
                                         &persistentDef) < 0)
         goto cleanup;
+    virDomainObjInvalidateXMLCache(vm);
 
     if (flags & VIR_DOMAIN_AFFECT_LIVE) {
         switch ((virDomainMetadataType) type) {
@@ -14234,17 +16483,8 @@ qemuDomainGetMetadata(virDomainPtr dom,
     virCheckFlags(VIR_DOMAIN_AFFECT_LIVE |
                   VIR_DOMAIN_AFFECT_CONFIG, NULL);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     if (virDomainLiveConfigHelperMethod(driver->caps, vm, &flags, &def) < 0)
         goto cleanup;
@@ -14354,7 +16594,8 @@ qemuDomainGetTotalcpuStats(virCgroupPtr group,
  *   s3 = t03 + t13
  */
 static int
-getSumVcpuPercpuStats(virCgroupPtr group,
+getSumVcpuPercpuStats(virQEMUDriverPtr driver,
+                      virDomainObjPtr vm,
                       unsigned int nvcpu,
                       unsigned long long *sum_cpu_time,
                       unsigned int num)
@@ -14362,14 +16603,14 @@ getSumVcpuPercpuStats(virCgroupPtr group,
     int ret = -1;
     int i;
     char *buf = NULL;
-    virCgroupPtr group_vcpu = NULL;
+    virCgroupPtr group_vcpu;
 
     for (i = 0; i < nvcpu; i++) {
         char *pos;
         unsigned long long tmp;
         int j;
 
-        if (virCgroupForVcpu(group, i, &group_vcpu, 0) < 0) {
+        if (qemuGetStatsCgroup(driver, vm, i, &group_vcpu) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("error accessing cgroup cpuacct for vcpu"));
             goto cleanup;
@@ -14388,19 +16629,18 @@ getSumVcpuPercpuStats(virCgroupPtr group,
             sum_cpu_time[j] += tmp;
         }
 
-        virCgroupFree(&group_vcpu);
         VIR_FREE(buf);
     }
 
     ret = 0;
 cleanup:
-    virCgroupFree(&group_vcpu);
     VIR_FREE(buf);
     return ret;
 }
 
 static int
-qemuDomainGetPercpuStats(virDomainObjPtr vm,
+qemuDomainGetPercpuStats(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm,
                          virCgroupPtr group,
                          virTypedParameterPtr params,
                          unsigned int nparams,
@@ -14481,7 +16721,7 @@ qemuDomainGetPercpuStats(virDomainObjPtr vm,
         virReportOOMError();
         goto cleanup;
     }
-    if (getSumVcpuPercpuStats(group, priv->nvcpupids, sum_cpu_time, n) < 0)
+    if (getSumVcpuPercpuStats(driver, vm, priv->nvcpupids, sum_cpu_time, n) < 0)
         goto cleanup;
 
     sum_cpu_pos = sum_cpu_time;
@@ -14543,7 +16783,7 @@ qemuDomainGetCPUStats(virDomainPtr domain,
         goto cleanup;
     }
 
-    if (virCgroupForDomain(driver->cgroup, vm->def->name, &group, 0) != 0) {
+    if (qemuGetStatsCgroup(driver, vm, -1, &group) != 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("cannot find cgroup for domain %s"), vm->def->name);
         goto cleanup;
@@ -14552,10 +16792,9 @@ qemuDomainGetCPUStats(virDomainPtr domain,
     if (start_cpu == -1)
         ret = qemuDomainGetTotalcpuStats(group, params, nparams);
     else
-        ret = qemuDomainGetPercpuStats(vm, group, params, nparams,
+        ret = qemuDomainGetPercpuStats(driver, vm, group, params, nparams,
                                        start_cpu, ncpus);
 cleanup:
-    virCgroupFree(&group);
     if (vm)
         virDomainObjUnlock(vm);
     qemuDriverUnlock(driver);
@@ -14590,17 +16829,8 @@ qemuDomainPMSuspendForDuration(virDomainPtr dom,
         return -1;
     }
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
-    }
 
     priv = vm->privateData;
 
@@ -14649,98 +16879,891 @@ qemuDomainPMSuspendForDuration(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
-        goto cleanup;
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto endjob;
+    }
+
+    qemuDomainObjEnterAgent(driver, vm);
+    ret = qemuAgentSuspend(priv->agent, target);
+    qemuDomainObjExitAgent(driver, vm);
+
+endjob:
+    if (qemuDomainObjEndJob(driver, vm) == 0)
+        vm = NULL;
+
+cleanup:
+    if (vm)
+        virDomainObjUnlock(vm);
+    return ret;
+}
+
+static int
+qemuDomainPMWakeup(virDomainPtr dom,
+                   unsigned int flags)
+{
+    virQEMUDriverPtr driver = dom->conn->privateData;
+    virDomainObjPtr vm;
+    int ret = -1;
+    qemuDomainObjPrivatePtr priv;
+
+    virCheckFlags(0, -1);
+
+    if (!(vm = qemuDomObjFromDomain(dom)))
+        goto cleanup;
+
+    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
+        goto cleanup;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       "%s", _("domain is not running"));
+        goto endjob;
+    }
+
+    priv = vm->privateData;
+
+    if (!qemuCapsGet(priv->caps, QEMU_CAPS_WAKEUP)) {
+       virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                      _("Unable to wake up domain due to "
+                        "missing system_wakeup monitor command"));
+       goto endjob;
+    }
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    ret = qemuMonitorSystemWakeup(priv->mon);
+    qemuDomainObjExitMonitor(driver, vm);
+
+endjob:
+    if (qemuDomainObjEndJob(driver, vm) == 0)
+        vm = NULL;
+
+cleanup:
+    if (vm)
+        virDomainObjUnlock(vm);
+    return ret;
+}
+
+static int
+qemuListAllDomains(virConnectPtr conn,
+                   virDomainPtr **domains,
+                   unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    int ret = -1;
+
+    virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
+
+    ret = virDomainList(conn, &driver->domains, domains, flags);
+
+    return ret;
+}
+
+static int
+qemuConnectListAllDomainsFiltered(virConnectPtr conn,
+                                  virDomainPtr **domains,
+                                  virTypedParameterPtr filters,
+                                  int nfilters,
+                                  unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+
+    virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
+
+    return virDomainListFiltered(conn, &driver->domains, domains,
+                                 filters, nfilters, flags);
+}
+
+static int
+qemuConnectGetListGeneration(virConnectPtr conn,
+                             unsigned int type ATTRIBUTE_UNUSED,
+                             unsigned long long *generation,
+                             unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+
+    virCheckFlags(0, -1);
+
+    *generation = virDomainObjListGetGeneration(&driver->domains);
+    return 0;
+}
+
+#define QEMU_ADD_STATS_PARAM(record, maxparams, name, type, value)          \
+    do {                                                                    \
+        if (VIR_RESIZE_N((record)->params, *(maxparams),                    \
+                         (record)->nparams, 1) < 0) {                       \
+            virReportOOMError();                                            \
+            goto cleanup;                                                   \
+        }                                                                   \
+        if (virTypedParameterAssign(&(record)->params[(record)->nparams],   \
+                                    name, type, value) < 0)                 \
+            goto cleanup;                                                   \
+        (record)->nparams++;                                                \
+    } while (0)
+
+#define QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, prefix, idx,        \
+                                     suffix, type, value)                   \
+    do {                                                                    \
+        char field[VIR_TYPED_PARAM_FIELD_LENGTH];                           \
+        snprintf(field, sizeof(field), "%s.%zu.%s", prefix, idx, suffix);    \
+        QEMU_ADD_STATS_PARAM(record, maxparams, field, type, value);        \
+    } while (0)
+
+/* Statistics reported as -1 are not provided by the hypervisor. */
+#define QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, prefix, idx,        \
+                                     suffix, value)                         \
+    do {                                                                    \
+        if ((value) >= 0)                                                   \
+            QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, prefix, idx,    \
+                                         suffix, VIR_TYPED_PARAM_ULLONG,    \
+                                         (unsigned long long) (value));     \
+    } while (0)
+
+#define QEMU_ADD_STATS_INDEXED_NAME(record, maxparams, prefix, idx, name)   \
+    do {                                                                    \
+        char *tmpname = strdup(name);                                       \
+        if (!tmpname) {                                                     \
+            virReportOOMError();                                            \
+            goto cleanup;                                                   \
+        }                                                                   \
+        if (VIR_RESIZE_N((record)->params, *(maxparams),                    \
+                         (record)->nparams, 1) < 0) {                       \
+            VIR_FREE(tmpname);                                              \
+            virReportOOMError();                                            \
+            goto cleanup;                                                   \
+        }                                                                   \
+        QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, prefix, idx,        \
+                                     "name", VIR_TYPED_PARAM_STRING,        \
+                                     tmpname);                              \
+    } while (0)
+
+typedef int
+(*qemuDomainGetStatsFunc)(virQEMUDriverPtr driver,
+                          virDomainObjPtr dom,
+                          qemuMonitorStatsPtr monstats,
+                          virHashTablePtr ifstats,
+                          virDomainStatsRecordPtr record,
+                          size_t *maxparams);
+
+static int
+qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                        virDomainObjPtr dom,
+                        qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                        virHashTablePtr ifstats ATTRIBUTE_UNUSED,
+                        virDomainStatsRecordPtr record,
+                        size_t *maxparams)
+{
+    int state;
+    int reason;
+    int ret = -1;
+
+    state = virDomainObjGetState(dom, &reason);
+
+    QEMU_ADD_STATS_PARAM(record, maxparams, "state.state",
+                         VIR_TYPED_PARAM_INT, state);
+    QEMU_ADD_STATS_PARAM(record, maxparams, "state.reason",
+                         VIR_TYPED_PARAM_INT, reason);
+
+    ret = 0;
+
+cleanup:
+    return ret;
+}
+
+static int
+qemuDomainGetStatsCpu(virQEMUDriverPtr driver,
+                      virDomainObjPtr dom,
+                      qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                      virHashTablePtr ifstats ATTRIBUTE_UNUSED,
+                      virDomainStatsRecordPtr record,
+                      size_t *maxparams)
+{
+    virCgroupPtr group;
+    unsigned long long cpu_time = 0;
+    unsigned long long user;
+    unsigned long long sys;
+    int ret = -1;
+
+    if (!virDomainObjIsActive(dom))
+        return 0;
+
+    if (qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_CPUACCT) &&
+        qemuGetStatsCgroup(driver, dom, -1, &group) == 0) {
+        if (virCgroupGetCpuacctTimes(group, &cpu_time, &user, &sys) == 0) {
+            QEMU_ADD_STATS_PARAM(record, maxparams, "cpu.time",
+                                 VIR_TYPED_PARAM_ULLONG, cpu_time);
+            QEMU_ADD_STATS_PARAM(record, maxparams, "cpu.user",
+                                 VIR_TYPED_PARAM_ULLONG, user);
+            QEMU_ADD_STATS_PARAM(record, maxparams, "cpu.system",
+                                 VIR_TYPED_PARAM_ULLONG, sys);
+        } else if (virCgroupGetCpuacctUsage(group, &cpu_time) == 0) {
+            QEMU_ADD_STATS_PARAM(record, maxparams, "cpu.time",
+                                 VIR_TYPED_PARAM_ULLONG, cpu_time);
+        }
+    } else if (qemuGetProcessInfo(&cpu_time, NULL, NULL, dom->pid, 0) == 0) {
+        QEMU_ADD_STATS_PARAM(record, maxparams, "cpu.time",
+                             VIR_TYPED_PARAM_ULLONG, cpu_time);
+    }
+
+    if (qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_CPU) &&
+        qemuCpuQuotaIsManaged(dom)) {
+        qemuDomainObjPrivatePtr priv = dom->privateData;
+        unsigned long long periods;
+        unsigned long long throttled;
+        unsigned long long time;
+
+        if (qemuCpuQuotaGetThrottling(driver, dom, &periods,
+                                      &throttled, &time) == 0) {
+            QEMU_ADD_STATS_PARAM(record, maxparams, "cpu.throttle.periods",
+                                 VIR_TYPED_PARAM_ULLONG, periods);
+            QEMU_ADD_STATS_PARAM(record, maxparams, "cpu.throttle.count",
+                                 VIR_TYPED_PARAM_ULLONG, throttled);
+            QEMU_ADD_STATS_PARAM(record, maxparams, "cpu.throttle.time",
+                                 VIR_TYPED_PARAM_ULLONG, time);
+        }
+        if (driver->cpuQuotaInterval)
+            QEMU_ADD_STATS_PARAM(record, maxparams, "cpu.quota",
+                                 VIR_TYPED_PARAM_LLONG,
+                                 priv->cpuQuota ? priv->cpuQuota :
+                                 dom->def->cputune.quota);
+    }
+
+    ret = 0;
+
+cleanup:
+    return ret;
+}
+
+/* The balloon size tracked in the domain definition is kept current
+ * by BALLOON_CHANGE events where QEMU supports them; otherwise the
+ * size fetched along with the other monitor statistics is preferred. */
+static int
+qemuDomainGetStatsVcpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                       virDomainObjPtr dom,
+                       qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                       virHashTablePtr ifstats ATTRIBUTE_UNUSED,
+                       virDomainStatsRecordPtr record,
+                       size_t *maxparams)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    virProcessInfoThreadStatsPtr tstats = NULL;
+    size_t i;
+    int ret = -1;
+
+    QEMU_ADD_STATS_PARAM(record, maxparams, "vcpu.current",
+                         VIR_TYPED_PARAM_UINT, dom->def->vcpus);
+    QEMU_ADD_STATS_PARAM(record, maxparams, "vcpu.maximum",
+                         VIR_TYPED_PARAM_UINT, dom->def->maxvcpus);
+
+    if (!virDomainObjIsActive(dom) || !priv->vcpupids)
+        return 0;
+
+    if (VIR_ALLOC_N(tstats, priv->nvcpupids) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (virProcessInfoGetThreadStats(dom->pid, priv->vcpupids,
+                                     priv->nvcpupids, tstats) < 0) {
+        virResetLastError();
+        ret = 0;
+        goto cleanup;
+    }
+
+    for (i = 0; i < priv->nvcpupids; i++) {
+        QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "vcpu", i, "state",
+                                     VIR_TYPED_PARAM_INT, VIR_VCPU_RUNNING);
+        QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "vcpu", i, "time",
+                                     VIR_TYPED_PARAM_ULLONG,
+                                     tstats[i].cpuTime);
+        QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "vcpu", i, "wait",
+                                     VIR_TYPED_PARAM_ULLONG,
+                                     tstats[i].waitTime);
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(tstats);
+    return ret;
+}
+
+static int
+qemuDomainGetStatsBalloon(virQEMUDriverPtr driver,
+                          virDomainObjPtr dom,
+                          qemuMonitorStatsPtr monstats,
+                          virHashTablePtr ifstats ATTRIBUTE_UNUSED,
+                          virDomainStatsRecordPtr record,
+                          size_t *maxparams)
+{
+    unsigned long long cur_balloon;
+    int ret = -1;
+
+    if (dom->def->memballoon &&
+        dom->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_NONE)
+        cur_balloon = dom->def->mem.max_balloon;
+    else if (monstats->fetched & QEMU_MONITOR_STATS_BALLOON)
+        cur_balloon = monstats->balloon;
+    else
+        cur_balloon = dom->def->mem.cur_balloon;
+
+    QEMU_ADD_STATS_PARAM(record, maxparams, "balloon.current",
+                         VIR_TYPED_PARAM_ULLONG, cur_balloon);
+    QEMU_ADD_STATS_PARAM(record, maxparams, "balloon.maximum",
+                         VIR_TYPED_PARAM_ULLONG, dom->def->mem.max_balloon);
+
+    if (driver->memOvercommitInterval &&
+        qemuMemOvercommitIsManaged(dom->def)) {
+        qemuDomainObjPrivatePtr priv = dom->privateData;
+
+        QEMU_ADD_STATS_PARAM(record, maxparams, "balloon.manager.target",
+                             VIR_TYPED_PARAM_ULLONG,
+                             priv->memOvercommitTarget);
+        QEMU_ADD_STATS_PARAM(record, maxparams, "balloon.manager.inflations",
+                             VIR_TYPED_PARAM_ULLONG,
+                             priv->memOvercommitInflations);
+        QEMU_ADD_STATS_PARAM(record, maxparams, "balloon.manager.deflations",
+                             VIR_TYPED_PARAM_ULLONG,
+                             priv->memOvercommitDeflations);
+    }
+
+    ret = 0;
+
+cleanup:
+    return ret;
+}
+
+static int
+qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                            virDomainObjPtr dom,
+                            qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                            virHashTablePtr ifstats,
+                            virDomainStatsRecordPtr record,
+                            size_t *maxparams)
+{
+    size_t i;
+    int ret = -1;
+
+    if (!virDomainObjIsActive(dom))
+        return 0;
+
+    QEMU_ADD_STATS_PARAM(record, maxparams, "net.count",
+                         VIR_TYPED_PARAM_UINT, dom->def->nnets);
+
+    for (i = 0; i < dom->def->nnets; i++) {
+        virDomainNetDefPtr net = dom->def->nets[i];
+        struct _virDomainInterfaceStats *tmp;
+
+        if (!net->ifname)
+            continue;
+
+        QEMU_ADD_STATS_INDEXED_NAME(record, maxparams, "net", i, net->ifname);
+
+        if (!ifstats || !(tmp = virHashLookup(ifstats, net->ifname)))
+            continue;
+
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "net", i,
+                                     "rx.bytes", tmp->rx_bytes);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "net", i,
+                                     "rx.pkts", tmp->rx_packets);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "net", i,
+                                     "rx.errs", tmp->rx_errs);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "net", i,
+                                     "rx.drop", tmp->rx_drop);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "net", i,
+                                     "tx.bytes", tmp->tx_bytes);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "net", i,
+                                     "tx.pkts", tmp->tx_packets);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "net", i,
+                                     "tx.errs", tmp->tx_errs);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "net", i,
+                                     "tx.drop", tmp->tx_drop);
+    }
+
+    ret = 0;
+
+cleanup:
+    return ret;
+}
+
+/* If the monitor could not provide block statistics, the group is
+ * left out of the record rather than failing the whole bulk request. */
+static int
+qemuDomainGetStatsBlock(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                        virDomainObjPtr dom,
+                        qemuMonitorStatsPtr monstats,
+                        virHashTablePtr ifstats ATTRIBUTE_UNUSED,
+                        virDomainStatsRecordPtr record,
+                        size_t *maxparams)
+{
+    virHashTablePtr stats = monstats->blockstats;
+    size_t i;
+    int ret = -1;
+
+    if (!(monstats->fetched & QEMU_MONITOR_STATS_BLOCK))
+        return 0;
+
+    QEMU_ADD_STATS_PARAM(record, maxparams, "block.count",
+                         VIR_TYPED_PARAM_UINT, dom->def->ndisks);
+
+    for (i = 0; i < dom->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = dom->def->disks[i];
+        qemuBlockStatsPtr entry;
+
+        QEMU_ADD_STATS_INDEXED_NAME(record, maxparams, "block", i, disk->dst);
+
+        if (!disk->info.alias ||
+            !(entry = virHashLookup(stats, disk->info.alias)))
+            continue;
+
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "block", i,
+                                     "rd.reqs", entry->rd_req);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "block", i,
+                                     "rd.bytes", entry->rd_bytes);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "block", i,
+                                     "rd.times", entry->rd_total_times);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "block", i,
+                                     "wr.reqs", entry->wr_req);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "block", i,
+                                     "wr.bytes", entry->wr_bytes);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "block", i,
+                                     "wr.times", entry->wr_total_times);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "block", i,
+                                     "fl.reqs", entry->flush_req);
+        QEMU_ADD_STATS_INDEXED_LLONG(record, maxparams, "block", i,
+                                     "fl.times", entry->flush_total_times);
+    }
+
+    ret = 0;
+
+cleanup:
+    return ret;
+}
+
+/* Monitor latency is read without a job, so that it can be reported
+ * precisely when a command hangs and every job is stuck behind it.
+ * Job wait statistics survive restarts of the domain, monitor ones
+ * are reset whenever the monitor is reopened.  */
+static int
+qemuDomainGetStatsMonitorLatency(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                                 virDomainObjPtr dom,
+                                 qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                                 virHashTablePtr ifstats ATTRIBUTE_UNUSED,
+                                 virDomainStatsRecordPtr record,
+                                 size_t *maxparams)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    qemuMonitorLatency latency;
+    size_t njobs = 0;
+    size_t i;
+    int ret = -1;
+
+    memset(&latency, 0, sizeof(latency));
+
+    if (virDomainObjIsActive(dom) && priv->mon) {
+        if (qemuMonitorGetLatency(priv->mon, &latency) < 0)
+            goto cleanup;
+
+        if (latency.inflight) {
+            QEMU_ADD_STATS_PARAM(record, maxparams, "monitor.inflight.name",
+                                 VIR_TYPED_PARAM_STRING, latency.inflight);
+            latency.inflight = NULL;
+            QEMU_ADD_STATS_PARAM(record, maxparams, "monitor.inflight.time",
+                                 VIR_TYPED_PARAM_ULLONG, latency.inflightTime);
+        }
+
+        QEMU_ADD_STATS_PARAM(record, maxparams, "monitor.cmd.count",
+                             VIR_TYPED_PARAM_UINT,
+                             (unsigned int) latency.ncommands);
+
+        for (i = 0; i < latency.ncommands; i++) {
+            qemuMonitorCommandLatencyPtr cmd = &latency.commands[i];
+
+            QEMU_ADD_STATS_INDEXED_NAME(record, maxparams, "monitor.cmd", i,
+                                        cmd->name);
+            QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "monitor.cmd", i,
+                                         "calls", VIR_TYPED_PARAM_ULLONG,
+                                         cmd->calls);
+            QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "monitor.cmd", i,
+                                         "errors", VIR_TYPED_PARAM_ULLONG,
+                                         cmd->errors);
+            QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "monitor.cmd", i,
+                                         "time", VIR_TYPED_PARAM_ULLONG,
+                                         cmd->total);
+            QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "monitor.cmd", i,
+                                         "max", VIR_TYPED_PARAM_ULLONG,
+                                         cmd->max);
+            QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "monitor.cmd", i,
+                                         "p50", VIR_TYPED_PARAM_ULLONG,
+                                         qemuMonitorCommandLatencyPercentile(cmd, 50));
+            QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "monitor.cmd", i,
+                                         "p95", VIR_TYPED_PARAM_ULLONG,
+                                         qemuMonitorCommandLatencyPercentile(cmd, 95));
+            QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "monitor.cmd", i,
+                                         "p99", VIR_TYPED_PARAM_ULLONG,
+                                         qemuMonitorCommandLatencyPercentile(cmd, 99));
+        }
+    }
+
+    for (i = 0; i < QEMU_JOB_LAST; i++) {
+        if (priv->jobWait[i].waits || priv->jobWait[i].timeouts)
+            njobs++;
+    }
+
+    QEMU_ADD_STATS_PARAM(record, maxparams, "monitor.job.count",
+                         VIR_TYPED_PARAM_UINT, (unsigned int) njobs);
 
-    if (!virDomainObjIsActive(vm)) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       "%s", _("domain is not running"));
-        goto endjob;
-    }
+    njobs = 0;
+    for (i = 0; i < QEMU_JOB_LAST; i++) {
+        qemuDomainJobWaitStatsPtr wait = &priv->jobWait[i];
 
-    qemuDomainObjEnterAgent(driver, vm);
-    ret = qemuAgentSuspend(priv->agent, target);
-    qemuDomainObjExitAgent(driver, vm);
+        if (!wait->waits && !wait->timeouts)
+            continue;
 
-endjob:
-    if (qemuDomainObjEndJob(driver, vm) == 0)
-        vm = NULL;
+        QEMU_ADD_STATS_INDEXED_NAME(record, maxparams, "monitor.job", njobs,
+                                    qemuDomainJobTypeToString(i));
+        QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "monitor.job", njobs,
+                                     "waits", VIR_TYPED_PARAM_ULLONG,
+                                     wait->waits);
+        QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "monitor.job", njobs,
+                                     "timeouts", VIR_TYPED_PARAM_ULLONG,
+                                     wait->timeouts);
+        QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "monitor.job", njobs,
+                                     "time", VIR_TYPED_PARAM_ULLONG,
+                                     wait->total);
+        QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "monitor.job", njobs,
+                                     "max", VIR_TYPED_PARAM_ULLONG,
+                                     wait->max);
+        QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "monitor.job", njobs,
+                                     "held", VIR_TYPED_PARAM_ULLONG,
+                                     wait->held);
+        QEMU_ADD_STATS_INDEXED_PARAM(record, maxparams, "monitor.job", njobs,
+                                     "held.max", VIR_TYPED_PARAM_ULLONG,
+                                     wait->heldMax);
+        njobs++;
+    }
+
+    ret = 0;
 
 cleanup:
-    if (vm)
-        virDomainObjUnlock(vm);
+    qemuMonitorLatencyClear(&latency);
     return ret;
 }
 
 static int
-qemuDomainPMWakeup(virDomainPtr dom,
-                   unsigned int flags)
+qemuDomainGetStatsJob(virQEMUDriverPtr driver,
+                      virDomainObjPtr dom,
+                      qemuMonitorStatsPtr monstats ATTRIBUTE_UNUSED,
+                      virHashTablePtr ifstats ATTRIBUTE_UNUSED,
+                      virDomainStatsRecordPtr record,
+                      size_t *maxparams)
 {
-    virQEMUDriverPtr driver = dom->conn->privateData;
-    virDomainObjPtr vm;
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    int type = VIR_DOMAIN_JOB_NONE;
+    size_t pos;
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    int i;
     int ret = -1;
-    qemuDomainObjPrivatePtr priv;
 
-    virCheckFlags(0, -1);
+    if (virDomainObjIsActive(dom) && priv->job.asyncJob)
+        type = priv->job.info.type;
+
+    QEMU_ADD_STATS_PARAM(record, maxparams, "job.type",
+                         VIR_TYPED_PARAM_INT, type);
+
+    if (priv->job.asyncJob == QEMU_ASYNC_JOB_MIGRATION_OUT &&
+        (pos = qemuMigrationSchedGetPosition(driver, dom)))
+        QEMU_ADD_STATS_PARAM(record, maxparams, "job.queue.position",
+                             VIR_TYPED_PARAM_UINT, (unsigned int) pos);
+
+    if (priv->job.asyncJob == QEMU_ASYNC_JOB_MIGRATION_OUT &&
+        priv->job.migStatus.xbzrle_set) {
+        qemuMonitorMigrationStatusPtr status = &priv->job.migStatus;
+
+        QEMU_ADD_STATS_PARAM(record, maxparams, "job.compression.cache",
+                             VIR_TYPED_PARAM_ULLONG,
+                             status->xbzrle_cache_size);
+        QEMU_ADD_STATS_PARAM(record, maxparams, "job.compression.bytes",
+                             VIR_TYPED_PARAM_ULLONG, status->xbzrle_bytes);
+        QEMU_ADD_STATS_PARAM(record, maxparams, "job.compression.pages",
+                             VIR_TYPED_PARAM_ULLONG, status->xbzrle_pages);
+        QEMU_ADD_STATS_PARAM(record, maxparams,
+                             "job.compression.cache_misses",
+                             VIR_TYPED_PARAM_ULLONG,
+                             status->xbzrle_cache_miss);
+        QEMU_ADD_STATS_PARAM(record, maxparams, "job.compression.overflow",
+                             VIR_TYPED_PARAM_ULLONG,
+                             status->xbzrle_overflow);
+    }
+
+    if (priv->job.asyncJob == QEMU_ASYNC_JOB_MIGRATION_IN) {
+        for (i = 0; i < QEMU_MIGRATION_PREPARE_LAST; i++) {
+            snprintf(field, sizeof(field), "job.prepare.%s",
+                     qemuMigrationPrepareStepTypeToString(i));
+            QEMU_ADD_STATS_PARAM(record, maxparams, field,
+                                 VIR_TYPED_PARAM_ULLONG,
+                                 priv->migPrepareSteps[i]);
+        }
+        for (i = 0; i < QEMU_START_STEP_LAST; i++) {
+            snprintf(field, sizeof(field), "job.prepare.start.%s",
+                     qemuDomainStartStepTypeToString(i));
+            QEMU_ADD_STATS_PARAM(record, maxparams, field,
+                                 VIR_TYPED_PARAM_ULLONG,
+                                 priv->startSteps[i]);
+        }
+        QEMU_ADD_STATS_PARAM(record, maxparams, "job.prepare.labelling",
+                             VIR_TYPED_PARAM_ULLONG, priv->startLabel);
+        QEMU_ADD_STATS_PARAM(record, maxparams, "job.prepare.capabilities",
+                             VIR_TYPED_PARAM_ULLONG, priv->startCaps);
+    }
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    qemuDriverUnlock(driver);
+    ret = 0;
 
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(dom->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                       _("no domain with matching uuid '%s'"), uuidstr);
-        goto cleanup;
+cleanup:
+    return ret;
+}
+
+#undef QEMU_ADD_STATS_INDEXED_NAME
+#undef QEMU_ADD_STATS_INDEXED_LLONG
+#undef QEMU_ADD_STATS_INDEXED_PARAM
+#undef QEMU_ADD_STATS_PARAM
+
+struct qemuDomainGetStatsWorker {
+    qemuDomainGetStatsFunc func;
+    unsigned int stats;
+};
+
+static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
+    { qemuDomainGetStatsState, VIR_DOMAIN_STATS_STATE },
+    { qemuDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL },
+    { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU },
+    { qemuDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON },
+    { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE },
+    { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK },
+    { qemuDomainGetStatsMonitorLatency, VIR_DOMAIN_STATS_MONITOR },
+    { qemuDomainGetStatsJob, VIR_DOMAIN_STATS_JOB },
+    { NULL, 0 }
+};
+
+static int
+qemuDomainGetStatsCheckSupport(unsigned int *stats,
+                               bool enforce)
+{
+    unsigned int supported = 0;
+    size_t i;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
+        supported |= qemuDomainGetStatsWorkers[i].stats;
+
+    if (*stats == 0) {
+        *stats = supported;
+        return 0;
     }
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0)
-        goto cleanup;
+    if (enforce && (*stats & ~supported)) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                       _("Stats types bits 0x%x are not supported by this daemon"),
+                       *stats & ~supported);
+        return -1;
+    }
 
-    if (!virDomainObjIsActive(vm)) {
-        virReportError(VIR_ERR_OPERATION_INVALID,
-                       "%s", _("domain is not running"));
-        goto endjob;
+    *stats &= supported;
+    return 0;
+}
+
+/* Fetch whatever the requested @stats need from the monitor of @dom
+ * with a single batch of commands under one QUERY job, unless the
+ * statistics another query fetched less than
+ * QEMU_DOMAIN_STATS_CACHE_TTL ago already cover them.  If the job
+ * cannot be acquired or the monitor fails, the groups relying on the
+ * result do without.  The returned statistics are owned by @dom and
+ * only valid while it stays locked.  */
+static qemuMonitorStatsPtr
+qemuDomainGetStatsMonitor(virQEMUDriverPtr driver,
+                          virDomainObjPtr dom,
+                          unsigned int stats)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    qemuMonitorStats monstats;
+    unsigned long long now;
+    bool fresh;
+    unsigned int what = 0;
+    int rc = -1;
+
+    if (virTimeMillisNow(&now) < 0) {
+        virResetLastError();
+        now = 0;
+    }
+    fresh = now && priv->statsCacheTime &&
+            now < priv->statsCacheTime + QEMU_DOMAIN_STATS_CACHE_TTL;
+    if (!fresh) {
+        qemuMonitorStatsClear(&priv->statsCache);
+        priv->statsCacheTime = 0;
     }
 
-    priv = vm->privateData;
+    if (!virDomainObjIsActive(dom))
+        return &priv->statsCache;
 
-    if (!qemuCapsGet(priv->caps, QEMU_CAPS_WAKEUP)) {
-       virReportError(VIR_ERR_OPERATION_INVALID, "%s",
-                      _("Unable to wake up domain due to "
-                        "missing system_wakeup monitor command"));
-       goto endjob;
+    if (stats & VIR_DOMAIN_STATS_BLOCK)
+        what |= QEMU_MONITOR_STATS_BLOCK;
+
+    if (stats & VIR_DOMAIN_STATS_BALLOON &&
+        !qemuCapsGet(priv->caps, QEMU_CAPS_BALLOON_EVENT) &&
+        !(dom->def->memballoon &&
+          dom->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_NONE))
+        what |= QEMU_MONITOR_STATS_BALLOON;
+
+    if (!what || (fresh && (priv->statsCache.fetched & what) == what) ||
+        !qemuDomainJobAllowed(priv, QEMU_JOB_QUERY))
+        return &priv->statsCache;
+
+    if (qemuDomainObjBeginJob(driver, dom, QEMU_JOB_QUERY) < 0) {
+        virResetLastError();
+        return &priv->statsCache;
+    }
+
+    if (virDomainObjIsActive(dom)) {
+        qemuDomainObjEnterMonitor(driver, dom);
+        if ((rc = qemuMonitorGetStats(priv->mon, what, &monstats)) < 0)
+            virResetLastError();
+        qemuDomainObjExitMonitor(driver, dom);
+    }
+
+    /* Another query may have refreshed the cache meanwhile; the
+     * newest result wins either way */
+    if (rc == 0 && !virDomainObjIsActive(dom)) {
+        qemuMonitorStatsClear(&monstats);
+    } else if (rc == 0) {
+        qemuMonitorStatsClear(&priv->statsCache);
+        priv->statsCache = monstats;
+        if (virTimeMillisNow(&priv->statsCacheTime) < 0) {
+            virResetLastError();
+            priv->statsCacheTime = 0;
+        }
     }
 
-    qemuDomainObjEnterMonitor(driver, vm);
-    ret = qemuMonitorSystemWakeup(priv->mon);
-    qemuDomainObjExitMonitor(driver, vm);
+    /* the caller holds a reference, so @dom cannot go away here */
+    ignore_value(qemuDomainObjEndJob(driver, dom));
 
-endjob:
-    if (qemuDomainObjEndJob(driver, vm) == 0)
-        vm = NULL;
+    return &priv->statsCache;
+}
+
+/* Collect the requested @stats of the locked domain @dom into a newly
+ * allocated record.  @ifstats holds the counters of all host
+ * interfaces, if they could be fetched.  */
+static int
+qemuDomainGetStats(virConnectPtr conn,
+                   virQEMUDriverPtr driver,
+                   virDomainObjPtr dom,
+                   unsigned int stats,
+                   virHashTablePtr ifstats,
+                   virDomainStatsRecordPtr *record)
+{
+    virDomainStatsRecordPtr tmp;
+    qemuMonitorStatsPtr monstats;
+    size_t maxparams = 0;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC(tmp) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    monstats = qemuDomainGetStatsMonitor(driver, dom, stats);
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
+        if (stats & qemuDomainGetStatsWorkers[i].stats &&
+            qemuDomainGetStatsWorkers[i].func(driver, dom, monstats,
+                                              ifstats, tmp, &maxparams) < 0)
+            goto cleanup;
+    }
+
+    if (!(tmp->dom = virGetDomain(conn, dom->def->name, dom->def->uuid)))
+        goto cleanup;
+    tmp->dom->id = dom->def->id;
+
+    *record = tmp;
+    tmp = NULL;
+    ret = 0;
 
 cleanup:
-    if (vm)
-        virDomainObjUnlock(vm);
+    if (tmp) {
+        virTypedParameterArrayClear(tmp->params, tmp->nparams);
+        VIR_FREE(tmp->params);
+        VIR_FREE(tmp);
+    }
     return ret;
 }
 
 static int
-qemuListAllDomains(virConnectPtr conn,
-                   virDomainPtr **domains,
-                   unsigned int flags)
+qemuConnectGetAllDomainStats(virConnectPtr conn,
+                             unsigned int stats,
+                             virDomainStatsRecordPtr **retStats,
+                             unsigned int flags)
 {
     virQEMUDriverPtr driver = conn->privateData;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    virHashTablePtr ifstats = NULL;
+    int nstats = 0;
+    size_t i;
     int ret = -1;
 
-    virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
+    virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
 
-    qemuDriverLock(driver);
-    ret = virDomainList(conn, driver->domains.objs, domains, flags);
-    qemuDriverUnlock(driver);
+    if (qemuDomainGetStatsCheckSupport(&stats,
+                                       !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS)) < 0)
+        return -1;
+
+    if (virDomainObjListCollect(&driver->domains, &vms, &nvms,
+                                flags & VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL) < 0)
+        return -1;
+
+    if (VIR_ALLOC_N(tmpstats, nvms + 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+#ifdef __linux__
+    /* One dump of all host interfaces serves every domain */
+    if (stats & VIR_DOMAIN_STATS_INTERFACE &&
+        !(ifstats = linuxDomainInterfaceStatsAll()))
+        virResetLastError();
+#endif
 
+    for (i = 0; i < nvms; i++) {
+        virDomainObjPtr vm = vms[i];
+        int rc;
+
+        virDomainObjLock(vm);
+        rc = qemuDomainGetStats(conn, driver, vm, stats, ifstats,
+                                &tmpstats[nstats]);
+        virDomainObjUnlock(vm);
+
+        if (rc < 0)
+            goto cleanup;
+        nstats++;
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+    ret = nstats;
+
+cleanup:
+    virDomainStatsRecordListFree(tmpstats);
+    virHashFree(ifstats);
+    for (i = 0; i < nvms; i++)
+        virObjectUnref(vms[i]);
+    VIR_FREE(vms);
     return ret;
 }
 
@@ -14758,17 +17781,8 @@ qemuDomainAgentCommand(virDomainPtr domain,
 
     virCheckFlags(0, NULL);
 
-    qemuDriverLock(driver);
-    vm = virDomainFindByUUID(&driver->domains, domain->uuid);
-    qemuDriverUnlock(driver);
-
-    if (!vm) {
-        char uuidstr[VIR_UUID_STRING_BUFLEN];
-        virUUIDFormat(domain->uuid, uuidstr);
-        virReportError(VIR_ERR_NO_DOMAIN,
-                        _("no domain with matching uuid '%s'"), uuidstr);
+    if (!(vm = qemuDomObjFromDomain(domain)))
         goto cleanup;
-    }
 
     priv = vm->privateData;
 
@@ -14887,9 +17901,270 @@ cleanup:
     return ret;
 }
 
+/* State shared by the agent commands of qemuDomainListFSRun */
+typedef struct _qemuDomainListFSState qemuDomainListFSState;
+typedef qemuDomainListFSState *qemuDomainListFSStatePtr;
+struct _qemuDomainListFSState {
+    virMutex lock;
+    virCond cond;
+    size_t pending;
+};
+
+typedef struct _qemuDomainListFSResult qemuDomainListFSResult;
+typedef qemuDomainListFSResult *qemuDomainListFSResultPtr;
+struct _qemuDomainListFSResult {
+    qemuDomainListFSStatePtr state;
+    virDomainObjPtr vm;     /* unlocked, but with a job held */
+    bool todo;              /* whether to send the next command */
+    bool sent;              /* the command was sent, whatever its outcome */
+    int ret;
+    virErrorPtr err;
+};
+
+static void
+qemuDomainListFSCallback(qemuAgentPtr mon ATTRIBUTE_UNUSED,
+                         int ret,
+                         void *opaque)
+{
+    qemuDomainListFSResultPtr res = opaque;
+    qemuDomainListFSStatePtr state = res->state;
+
+    virMutexLock(&state->lock);
+    res->ret = ret;
+    if (ret < 0)
+        res->err = virSaveLastError();
+    state->pending--;
+    virCondSignal(&state->cond);
+    virMutexUnlock(&state->lock);
+}
+
+/*
+ * Freezes or thaws the file systems of every domain of @results
+ * marked todo, all at once, and waits for them all to complete or
+ * @deadline to pass
+ */
+static void
+qemuDomainListFSRun(virQEMUDriverPtr driver,
+                    qemuDomainListFSStatePtr state,
+                    qemuDomainListFSResultPtr results,
+                    size_t nresults,
+                    bool freeze,
+                    unsigned long long deadline)
+{
+    size_t i;
+
+    for (i = 0 ; i < nresults ; i++) {
+        qemuDomainListFSResultPtr res = &results[i];
+        virDomainObjPtr vm = res->vm;
+        qemuDomainObjPrivatePtr priv = vm->privateData;
+        int rc = -1;
+
+        res->sent = false;
+        res->ret = -1;
+        virFreeError(res->err);
+        res->err = NULL;
+
+        if (!res->todo)
+            continue;
+
+        virDomainObjLock(vm);
+        if (!virDomainObjIsActive(vm)) {
+            virReportError(VIR_ERR_OPERATION_INVALID,
+                           "%s", _("domain is not running"));
+        } else if (!priv->agent) {
+            virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED, "%s",
+                           _("QEMU guest agent is not configured"));
+        } else if (priv->agentError) {
+            virReportError(VIR_ERR_AGENT_UNRESPONSIVE, "%s",
+                           _("QEMU guest agent is not "
+                             "available due to an error"));
+        } else {
+            /* The reply may come before we are back */
+            virMutexLock(&state->lock);
+            state->pending++;
+            virMutexUnlock(&state->lock);
+
+            qemuDomainObjEnterAgent(driver, vm);
+            if (freeze)
+                rc = qemuAgentFSFreezeAsync(priv->agent, deadline,
+                                            qemuDomainListFSCallback, res);
+            else
+                rc = qemuAgentFSThawAsync(priv->agent, deadline,
+                                          qemuDomainListFSCallback, res);
+            qemuDomainObjExitAgent(driver, vm);
+
+            if (rc < 0) {
+                virMutexLock(&state->lock);
+                state->pending--;
+                virMutexUnlock(&state->lock);
+            } else {
+                res->sent = true;
+            }
+        }
+        if (rc < 0)
+            res->err = virSaveLastError();
+        virDomainObjUnlock(vm);
+    }
+
+    /* Every command sent completes by the deadline at the latest */
+    virMutexLock(&state->lock);
+    while (state->pending)
+        ignore_value(virCondWait(&state->cond, &state->lock));
+    virMutexUnlock(&state->lock);
+}
+
+static int
+qemuDomainListFSFreezeThaw(virDomainPtr *doms,
+                           unsigned int ndoms,
+                           unsigned int timeout,
+                           bool freeze)
+{
+    virQEMUDriverPtr driver = doms[0]->conn->privateData;
+    qemuDomainListFSState state;
+    qemuDomainListFSResultPtr results = NULL;
+    size_t nresults = 0;
+    unsigned long long deadline;
+    virErrorPtr err = NULL;
+    const char *failed = NULL;
+    size_t i, j;
+    int done = 0;
+    int ret = -1;
+
+    memset(&state, 0, sizeof(state));
+    if (virMutexInit(&state.lock) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize mutex"));
+        return -1;
+    }
+    if (virCondInit(&state.cond) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize condition"));
+        virMutexDestroy(&state.lock);
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(results, ndoms) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    /* Take the job of every domain first, so that the commands are
+     * all sent together */
+    for (i = 0 ; i < ndoms ; i++) {
+        virDomainObjPtr vm;
+
+        if (!(vm = qemuDomObjFromDomain(doms[i])))
+            goto cleanup;
+
+        for (j = 0 ; j < nresults ; j++) {
+            if (results[j].vm == vm) {
+                virReportError(VIR_ERR_INVALID_ARG,
+                               _("domain '%s' is listed more than once"),
+                               vm->def->name);
+                virDomainObjUnlock(vm);
+                goto cleanup;
+            }
+        }
+
+        if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_MODIFY) < 0) {
+            virDomainObjUnlock(vm);
+            goto cleanup;
+        }
+        virDomainObjUnlock(vm);
+
+        results[nresults].state = &state;
+        results[nresults].vm = vm;
+        results[nresults].todo = true;
+        nresults++;
+    }
+
+    if (virTimeMillisNow(&deadline) < 0)
+        goto cleanup;
+    qemuDomainListFSRun(driver, &state, results, nresults, freeze,
+                        deadline + timeout * 1000ull);
+
+    for (i = 0 ; i < nresults ; i++) {
+        if (results[i].ret >= 0) {
+            done++;
+        } else if (!err) {
+            err = results[i].err;
+            results[i].err = NULL;
+            failed = results[i].vm->def->name;
+        }
+    }
+
+    if (err && freeze) {
+        /* Leave no guest frozen, including those which did not
+         * answer in time and may yet freeze */
+        for (i = 0 ; i < nresults ; i++)
+            results[i].todo = results[i].sent;
+
+        if (virTimeMillisNow(&deadline) < 0)
+            goto cleanup;
+        qemuDomainListFSRun(driver, &state, results, nresults, false,
+                            deadline + timeout * 1000ull);
+
+        for (i = 0 ; i < nresults ; i++) {
+            if (results[i].todo && results[i].ret < 0)
+                VIR_WARN("Unable to thaw file systems of domain %s: %s",
+                         results[i].vm->def->name,
+                         results[i].err && results[i].err->message ?
+                         results[i].err->message : "");
+        }
+    }
+
+    if (err) {
+        virReportError(err->code,
+                       freeze ?
+                       _("unable to freeze file systems of domain '%s': %s") :
+                       _("unable to thaw file systems of domain '%s': %s"),
+                       failed, NULLSTR(err->message));
+        goto cleanup;
+    }
+
+    ret = done;
+
+cleanup:
+    for (i = 0 ; i < nresults ; i++) {
+        virFreeError(results[i].err);
+        virDomainObjLock(results[i].vm);
+        if (qemuDomainObjEndJob(driver, results[i].vm) > 0)
+            virDomainObjUnlock(results[i].vm);
+    }
+    VIR_FREE(results);
+    virFreeError(err);
+    ignore_value(virCondDestroy(&state.cond));
+    virMutexDestroy(&state.lock);
+    return ret;
+}
+
+static int
+qemuDomainListFSFreeze(virDomainPtr *doms,
+                       unsigned int ndoms,
+                       unsigned int timeout,
+                       unsigned int flags)
+{
+    virCheckFlags(0, -1);
+
+    return qemuDomainListFSFreezeThaw(doms, ndoms, timeout, true);
+}
+
+static int
+qemuDomainListFSThaw(virDomainPtr *doms,
+                     unsigned int ndoms,
+                     unsigned int timeout,
+                     unsigned int flags)
+{
+    virCheckFlags(0, -1);
+
+    return qemuDomainListFSFreezeThaw(doms, ndoms, timeout, false);
+}
+
+
+static const char *qemuURISchemes[] = { "qemu", NULL };
+
 static virDriver qemuDriver = {
     .no = VIR_DRV_QEMU,
     .name = QEMU_DRIVER_NAME,
+    .uriSchemes = qemuURISchemes,
     .open = qemuOpen, /* 0.2.0 */
     .close = qemuClose, /* 0.2.0 */
     .supports_feature = qemuSupportsFeature, /* 0.5.0 */
@@ -15061,6 +18336,19 @@ static virDriver qemuDriver = {
     .nodeSetMemoryParameters = nodeSetMemoryParameters, /* 0.10.2 */
     .nodeGetCPUMap = nodeGetCPUMap, /* 1.0.0 */
     .domainFSTrim = qemuDomainFSTrim, /* 1.0.1 */
+    .connectGetAllDomainStats = qemuConnectGetAllDomainStats, /* 1.0.2 */
+    .domainAttachDevices = qemuDomainAttachDevices, /* 1.0.2 */
+    .connectGetHostCapabilities = qemuConnectGetHostCapabilities, /* 1.0.2 */
+    .domainBlockFlatten = qemuDomainBlockFlatten, /* 1.0.2 */
+    .connectDestroyAllDomains = qemuConnectDestroyAllDomains, /* 1.0.2 */
+    .domainBlockPeekStream = qemuDomainBlockPeekStream, /* 1.0.2 */
+    .domainMemoryPeekStream = qemuDomainMemoryPeekStream, /* 1.0.2 */
+    .connectGetListGeneration = qemuConnectGetListGeneration, /* 1.0.2 */
+    .domainListFSFreeze = qemuDomainListFSFreeze, /* 1.0.2 */
+    .domainListFSThaw = qemuDomainListFSThaw, /* 1.0.2 */
+    .domainMigrateGetCompressionCache = qemuDomainMigrateGetCompressionCache, /* 1.0.2 */
+    .domainMigrateSetCompressionCache = qemuDomainMigrateSetCompressionCache, /* 1.0.2 */
+    .connectListAllDomainsFiltered = qemuConnectListAllDomainsFiltered, /* 1.0.2 */
 };
 
 
@@ -15070,6 +18358,7 @@ static virStateDriver qemuStateDriver = {
     .cleanup = qemuShutdown,
     .reload = qemuReload,
     .stop = qemuStop,
+    .preExecRestart = qemuPreExecRestart,
 };
 
 int qemuRegister(void) {
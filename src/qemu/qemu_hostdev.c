@@ -463,13 +463,11 @@ int qemuPrepareHostdevPCIDevices(virQEMUDriverPtr driver,
     }
 
     /* Loop 3: Now that all the PCI hostdevs have been detached, we
-     * can safely reset them */
-    for (i = 0; i < pciDeviceListCount(pcidevs); i++) {
-        pciDevice *dev = pciDeviceListGet(pcidevs, i);
-        if (pciResetDevice(dev, driver->activePciHostdevs,
+     * can safely reset them; devices on different buses are reset
+     * in parallel */
+    if (pciResetDeviceList(pcidevs, driver->activePciHostdevs,
                            driver->inactivePciHostdevs) < 0)
-            goto reattachdevs;
-    }
+        goto reattachdevs;
 
     /* Loop 4: For SRIOV network devices, Now that we have detached the
      * the network device, set the netdev config */
@@ -896,15 +894,12 @@ void qemuDomainReAttachHostdevDevices(virQEMUDriverPtr driver,
          }
     }
 
-    for (i = 0; i < pciDeviceListCount(pcidevs); i++) {
-        pciDevice *dev = pciDeviceListGet(pcidevs, i);
-        if (pciResetDevice(dev, driver->activePciHostdevs,
+    if (pciResetDeviceList(pcidevs, driver->activePciHostdevs,
                            driver->inactivePciHostdevs) < 0) {
-            virErrorPtr err = virGetLastError();
-            VIR_ERROR(_("Failed to reset PCI device: %s"),
-                      err ? err->message : _("unknown error"));
-            virResetError(err);
-        }
+        virErrorPtr err = virGetLastError();
+        VIR_ERROR(_("Failed to reset PCI device: %s"),
+                  err ? err->message : _("unknown error"));
+        virResetError(err);
     }
 
     while (pciDeviceListCount(pcidevs) > 0) {
@@ -664,6 +664,7 @@ int qemuDomainAttachNetDevice(virConnectPtr conn,
     int tapfd = -1;
     char *vhostfd_name = NULL;
     int vhostfd = -1;
+    int vhostfdSize = 1;
     char *nicstr = NULL;
     char *netstr = NULL;
     virNetDevVPortProfilePtr vport = NULL;
@@ -674,6 +675,14 @@ int qemuDomainAttachNetDevice(virConnectPtr conn,
     bool iface_connected = false;
     int actualType;
 
+    /* the monitor passes only one tap and vhost-net fd per device */
+    if (net->driver.virtio.queues > 1) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("hotplug of interfaces with multiple queues "
+                         "is not supported"));
+        return -1;
+    }
+
     /* preallocate new slot for device */
     if (VIR_REALLOC_N(vm->def->nets, vm->def->nnets+1) < 0) {
         virReportOOMError();
@@ -684,7 +693,8 @@ int qemuDomainAttachNetDevice(virConnectPtr conn,
      * network's pool of devices, or resolve bridge device name
      * to the one defined in the network definition.
      */
-    if (networkAllocateActualDevice(net) < 0)
+    if (networkAllocateActualDevice(net,
+                                    vm->def->numatune.memory.nodemask) < 0)
         return -1;
 
     actualType = virDomainNetGetActualType(net);
@@ -716,11 +726,12 @@ int qemuDomainAttachNetDevice(virConnectPtr conn,
         if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
             driver->privileged ||
             (!qemuCapsGet(priv->caps, QEMU_CAPS_NETDEV_BRIDGE))) {
-            if ((tapfd = qemuNetworkIfaceConnect(vm->def, conn, driver, net,
-                                                 priv->caps)) < 0)
+            if (qemuNetworkIfaceConnect(vm->def, conn, driver, net,
+                                        priv->caps, &tapfd, 1) < 0)
                 goto cleanup;
             iface_connected = true;
-            if (qemuOpenVhostNet(vm->def, net, priv->caps, &vhostfd) < 0)
+            if (qemuOpenVhostNet(vm->def, net, priv->caps,
+                                 &vhostfd, &vhostfdSize) < 0)
                 goto cleanup;
         }
     } else if (actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
@@ -729,7 +740,8 @@ int qemuDomainAttachNetDevice(virConnectPtr conn,
                                           VIR_NETDEV_VPORT_PROFILE_OP_CREATE)) < 0)
             goto cleanup;
         iface_connected = true;
-        if (qemuOpenVhostNet(vm->def, net, priv->caps, &vhostfd) < 0)
+        if (qemuOpenVhostNet(vm->def, net, priv->caps,
+                             &vhostfd, &vhostfdSize) < 0)
             goto cleanup;
     }
 
@@ -771,13 +783,15 @@ int qemuDomainAttachNetDevice(virConnectPtr conn,
     if (qemuCapsGet(priv->caps, QEMU_CAPS_NETDEV) &&
         qemuCapsGet(priv->caps, QEMU_CAPS_DEVICE)) {
         if (!(netstr = qemuBuildHostNetStr(net, driver, priv->caps,
-                                           ',', -1, tapfd_name,
-                                           vhostfd_name)))
+                                           ',', -1,
+                                           &tapfd_name, tapfd_name ? 1 : 0,
+                                           &vhostfd_name, vhostfd_name ? 1 : 0)))
             goto cleanup;
     } else {
         if (!(netstr = qemuBuildHostNetStr(net, driver, priv->caps,
-                                           ' ', vlan, tapfd_name,
-                                           vhostfd_name)))
+                                           ' ', vlan,
+                                           &tapfd_name, tapfd_name ? 1 : 0,
+                                           &vhostfd_name, vhostfd_name ? 1 : 0)))
             goto cleanup;
     }
 
@@ -1564,7 +1578,8 @@ qemuDomainChangeNet(virQEMUDriverPtr driver,
      * free it if we fail for any reason
      */
     if (newdev->type == VIR_DOMAIN_NET_TYPE_NETWORK &&
-        networkAllocateActualDevice(newdev) < 0) {
+        networkAllocateActualDevice(newdev,
+                                    vm->def->numatune.memory.nodemask) < 0) {
         goto cleanup;
     }
 
@@ -23,10 +23,14 @@
 #include <config.h>
 
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
 #include <fcntl.h>
 #include <poll.h>
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
 
 #include "qemu_migration.h"
 #include "qemu_monitor.h"
@@ -34,6 +38,7 @@
 #include "qemu_process.h"
 #include "qemu_capabilities.h"
 #include "qemu_cgroup.h"
+#include "qemu_command.h"
 
 #include "domain_audit.h"
 #include "logging.h"
@@ -50,6 +55,7 @@
 #include "storage_file.h"
 #include "viruri.h"
 #include "hooks.h"
+#include "base64.h"
 
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
@@ -72,6 +78,7 @@ enum qemuMigrationCookieFlags {
     QEMU_MIGRATION_COOKIE_FLAG_LOCKSTATE,
     QEMU_MIGRATION_COOKIE_FLAG_PERSISTENT,
     QEMU_MIGRATION_COOKIE_FLAG_NETWORK,
+    QEMU_MIGRATION_COOKIE_FLAG_NBD,
 
     QEMU_MIGRATION_COOKIE_FLAG_LAST
 };
@@ -79,13 +86,14 @@ enum qemuMigrationCookieFlags {
 VIR_ENUM_DECL(qemuMigrationCookieFlag);
 VIR_ENUM_IMPL(qemuMigrationCookieFlag,
               QEMU_MIGRATION_COOKIE_FLAG_LAST,
-              "graphics", "lockstate", "persistent", "network");
+              "graphics", "lockstate", "persistent", "network", "nbd");
 
 enum qemuMigrationCookieFeatures {
     QEMU_MIGRATION_COOKIE_GRAPHICS  = (1 << QEMU_MIGRATION_COOKIE_FLAG_GRAPHICS),
     QEMU_MIGRATION_COOKIE_LOCKSTATE = (1 << QEMU_MIGRATION_COOKIE_FLAG_LOCKSTATE),
     QEMU_MIGRATION_COOKIE_PERSISTENT = (1 << QEMU_MIGRATION_COOKIE_FLAG_PERSISTENT),
     QEMU_MIGRATION_COOKIE_NETWORK = (1 << QEMU_MIGRATION_COOKIE_FLAG_NETWORK),
+    QEMU_MIGRATION_COOKIE_NBD = (1 << QEMU_MIGRATION_COOKIE_FLAG_NBD),
 };
 
 typedef struct _qemuMigrationCookieGraphics qemuMigrationCookieGraphics;
@@ -119,6 +127,14 @@ struct _qemuMigrationCookieNetwork {
     qemuMigrationCookieNetDataPtr net;
 };
 
+typedef struct _qemuMigrationCookieNBD qemuMigrationCookieNBD;
+typedef qemuMigrationCookieNBD *qemuMigrationCookieNBDPtr;
+struct _qemuMigrationCookieNBD {
+    /* Port the destination NBD server listens on, 0 in the request
+     * sent by the source */
+    int port;
+};
+
 typedef struct _qemuMigrationCookie qemuMigrationCookie;
 typedef qemuMigrationCookie *qemuMigrationCookiePtr;
 struct _qemuMigrationCookie {
@@ -145,8 +161,14 @@ struct _qemuMigrationCookie {
     /* If (flags & QEMU_MIGRATION_COOKIE_PERSISTENT) */
     virDomainDefPtr persistent;
 
+    /* The peer can read a zlib compressed persistent definition */
+    bool remoteZlib;
+
     /* If (flags & QEMU_MIGRATION_COOKIE_NETWORK) */
     qemuMigrationCookieNetworkPtr network;
+
+    /* If (flags & QEMU_MIGRATION_COOKIE_NBD) */
+    qemuMigrationCookieNBDPtr nbd;
 };
 
 static void qemuMigrationCookieGraphicsFree(qemuMigrationCookieGraphicsPtr grap)
@@ -187,6 +209,7 @@ static void qemuMigrationCookieFree(qemuMigrationCookiePtr mig)
     if (mig->flags & QEMU_MIGRATION_COOKIE_NETWORK)
         qemuMigrationCookieNetworkFree(mig->network);
 
+    VIR_FREE(mig->nbd);
     VIR_FREE(mig->localHostname);
     VIR_FREE(mig->remoteHostname);
     VIR_FREE(mig->name);
@@ -308,6 +331,10 @@ qemuMigrationCookieNetworkAlloc(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                                 virDomainDefPtr def)
 {
     qemuMigrationCookieNetworkPtr mig;
+    const char **ovsnames = NULL;
+    char **ovsdata = NULL;
+    size_t *ovsidx = NULL;
+    size_t novs = 0;
     int i;
 
     if (VIR_ALLOC(mig) < 0)
@@ -315,7 +342,10 @@ qemuMigrationCookieNetworkAlloc(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
 
     mig->nnets = def->nnets;
 
-    if (VIR_ALLOC_N(mig->net, def->nnets) <0)
+    if (VIR_ALLOC_N(mig->net, def->nnets) < 0 ||
+        VIR_ALLOC_N(ovsnames, def->nnets) < 0 ||
+        VIR_ALLOC_N(ovsdata, def->nnets) < 0 ||
+        VIR_ALLOC_N(ovsidx, def->nnets) < 0)
         goto no_memory;
 
     for (i = 0; i < def->nnets; i++) {
@@ -334,24 +364,39 @@ qemuMigrationCookieNetworkAlloc(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
             case VIR_NETDEV_VPORT_PROFILE_8021QBH:
                break;
             case VIR_NETDEV_VPORT_PROFILE_OPENVSWITCH:
-                if (virNetDevOpenvswitchGetMigrateData(&mig->net[i].portdata,
-                                                       netptr->ifname) != 0) {
-                        virReportSystemError(VIR_ERR_INTERNAL_ERROR,
-                                             _("Unable to run command to get OVS port data for "
-                                             "interface %s"), netptr->ifname);
-                        goto error;
-                }
+                /* Collected below with a single ovs-vsctl run */
+                ovsnames[novs] = netptr->ifname;
+                ovsidx[novs++] = i;
                 break;
             default:
                 break;
             }
         }
     }
+
+    if (novs) {
+        if (virNetDevOpenvswitchGetMigrateDataList(ovsdata, ovsnames,
+                                                   novs) != 0) {
+            virReportSystemError(VIR_ERR_INTERNAL_ERROR,
+                                 _("Unable to run command to get OVS port data for "
+                                 "interface %s"), ovsnames[0]);
+            goto error;
+        }
+        for (i = 0; i < novs; i++)
+            mig->net[ovsidx[i]].portdata = ovsdata[i];
+    }
+
+    VIR_FREE(ovsnames);
+    VIR_FREE(ovsdata);
+    VIR_FREE(ovsidx);
     return mig;
 
 no_memory:
     virReportOOMError();
 error:
+    VIR_FREE(ovsnames);
+    VIR_FREE(ovsdata);
+    VIR_FREE(ovsidx);
     qemuMigrationCookieNetworkFree(mig);
     return NULL;
 }
@@ -492,6 +537,31 @@ qemuMigrationCookieAddNetwork(qemuMigrationCookiePtr mig,
 }
 
 
+static int
+qemuMigrationCookieAddNBD(qemuMigrationCookiePtr mig,
+                          virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (mig->flags & QEMU_MIGRATION_COOKIE_NBD) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("NBD migration data already present"));
+        return -1;
+    }
+
+    /* Reuse the request parsed from the incoming cookie, if any */
+    if (!mig->nbd && VIR_ALLOC(mig->nbd) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    mig->nbd->port = priv->nbdPort;
+    mig->flags |= QEMU_MIGRATION_COOKIE_NBD;
+
+    return 0;
+}
+
+
 static void qemuMigrationCookieGraphicsXMLFormat(virBufferPtr buf,
                                                  qemuMigrationCookieGraphicsPtr grap)
 {
@@ -541,6 +611,168 @@ qemuMigrationCookieNetworkXMLFormat(virBufferPtr buf,
 }
 
 
+#define QEMU_MIGRATION_PERSISTENT_FLAGS \
+    (VIR_DOMAIN_XML_INACTIVE |          \
+     VIR_DOMAIN_XML_SECURE |            \
+     VIR_DOMAIN_XML_MIGRATABLE)
+
+/* Persistent definitions smaller than this are not worth compressing */
+#define QEMU_MIGRATION_COMPRESS_MIN 4096
+
+/*
+ * Format the persistent definition carried by @mig, reusing the XML
+ * cached on the definition when it did not change since the previous
+ * migration phase.
+ */
+static char *
+qemuMigrationCookiePersistentFormat(virQEMUDriverPtr driver,
+                                    virDomainDefPtr def)
+{
+    const char *cached;
+    char *xml;
+    char *copy;
+
+    if ((cached = virDomainDefGetXMLCache(def,
+                                          QEMU_MIGRATION_PERSISTENT_FLAGS))) {
+        if (!(xml = strdup(cached)))
+            virReportOOMError();
+        return xml;
+    }
+
+    if (!(xml = qemuDomainDefFormatXML(driver, def,
+                                       QEMU_MIGRATION_PERSISTENT_FLAGS)))
+        return NULL;
+
+    if ((copy = strdup(xml)))
+        virDomainDefSetXMLCache(def, QEMU_MIGRATION_PERSISTENT_FLAGS, copy);
+
+    return xml;
+}
+
+#if HAVE_ZLIB
+/*
+ * Compress @len bytes of @data with zlib and encode them in base64,
+ * which is stored in @encoded.
+ */
+static int
+qemuMigrationCompress(const char *data,
+                      size_t len,
+                      char **encoded)
+{
+    uLongf zlen = compressBound(len);
+    char *zdata = NULL;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(zdata, zlen) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (compress((Bytef *)zdata, &zlen, (const Bytef *)data, len) != Z_OK) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("failed to compress migration data"));
+        goto cleanup;
+    }
+
+    base64_encode_alloc(zdata, zlen, encoded);
+    if (!*encoded) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(zdata);
+    return ret;
+}
+
+/*
+ * Decode the base64 @encoded data and decompress it to the @len bytes
+ * it had originally, a NUL terminated string stored in @data.
+ */
+static int
+qemuMigrationDecompress(const char *encoded,
+                        size_t len,
+                        char **data)
+{
+    char *zdata = NULL;
+    size_t zlen;
+    uLongf outlen = len;
+    char *out = NULL;
+    int ret = -1;
+
+    if (!base64_decode_alloc(encoded, strlen(encoded), &zdata, &zlen)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed compressed data in migration cookie"));
+        goto cleanup;
+    }
+    if (!zdata) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(out, len + 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (uncompress((Bytef *)out, &outlen,
+                   (const Bytef *)zdata, zlen) != Z_OK ||
+        outlen != len) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("failed to decompress migration cookie data"));
+        goto cleanup;
+    }
+    out[len] = '\0';
+
+    *data = out;
+    out = NULL;
+    ret = 0;
+
+cleanup:
+    VIR_FREE(zdata);
+    VIR_FREE(out);
+    return ret;
+}
+#endif /* HAVE_ZLIB */
+
+
+static int
+qemuMigrationCookiePersistentXMLFormat(virQEMUDriverPtr driver,
+                                       virBufferPtr buf,
+                                       qemuMigrationCookiePtr mig)
+{
+    char *xml;
+
+    if (!(xml = qemuMigrationCookiePersistentFormat(driver, mig->persistent)))
+        return -1;
+
+#if HAVE_ZLIB
+    if (mig->remoteZlib && strlen(xml) >= QEMU_MIGRATION_COMPRESS_MIN) {
+        char *encoded = NULL;
+
+        if (qemuMigrationCompress(xml, strlen(xml), &encoded) < 0) {
+            VIR_FREE(xml);
+            return -1;
+        }
+
+        virBufferAsprintf(buf, "  <persistent compression='zlib' size='%zu'>"
+                          "%s</persistent>\n", strlen(xml), encoded);
+        VIR_FREE(encoded);
+        VIR_FREE(xml);
+        return 0;
+    }
+#endif
+
+    /* The cached XML is not indented, which makes no difference to
+     * the parser on the other side */
+    virBufferAdd(buf, xml, -1);
+    VIR_FREE(xml);
+    return 0;
+}
+
+
 static int
 qemuMigrationCookieXMLFormat(virQEMUDriverPtr driver,
                              virBufferPtr buf,
@@ -578,22 +810,26 @@ qemuMigrationCookieXMLFormat(virQEMUDriverPtr driver,
         virBufferAddLit(buf, "  </lockstate>\n");
     }
 
+#if HAVE_ZLIB
+    /* Older peers ignore this, so they are never sent compressed data */
+    virBufferAddLit(buf, "  <compression name='zlib'/>\n");
+#endif
+
     if ((mig->flags & QEMU_MIGRATION_COOKIE_PERSISTENT) &&
-        mig->persistent) {
-        virBufferAdjustIndent(buf, 2);
-        if (qemuDomainDefFormatBuf(driver,
-                                   mig->persistent,
-                                   VIR_DOMAIN_XML_INACTIVE |
-                                   VIR_DOMAIN_XML_SECURE |
-                                   VIR_DOMAIN_XML_MIGRATABLE,
-                                   buf) < 0)
-            return -1;
-        virBufferAdjustIndent(buf, -2);
-    }
+        mig->persistent &&
+        qemuMigrationCookiePersistentXMLFormat(driver, buf, mig) < 0)
+        return -1;
 
     if ((mig->flags & QEMU_MIGRATION_COOKIE_NETWORK) && mig->network)
         qemuMigrationCookieNetworkXMLFormat(buf, mig->network);
 
+    if ((mig->flags & QEMU_MIGRATION_COOKIE_NBD) && mig->nbd) {
+        virBufferAddLit(buf, "  <nbd");
+        if (mig->nbd->port)
+            virBufferAsprintf(buf, " port='%d'", mig->nbd->port);
+        virBufferAddLit(buf, "/>\n");
+    }
+
     virBufferAddLit(buf, "</qemu-migration>\n");
     return 0;
 }
@@ -722,6 +958,51 @@ error:
 }
 
 
+/* Parse the compressed form of the persistent definition */
+static virDomainDefPtr
+qemuMigrationCookiePersistentXMLParse(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                                      xmlXPathContextPtr ctxt)
+{
+    virDomainDefPtr def = NULL;
+    char *compression = NULL;
+    char *encoded = NULL;
+    char *xml = NULL;
+    unsigned long size;
+
+    compression = virXPathString("string(./persistent[1]/@compression)", ctxt);
+    if (STRNEQ_NULLABLE(compression, "zlib")) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unsupported compression '%s' in migration cookie"),
+                       NULLSTR(compression));
+        goto cleanup;
+    }
+
+    if (virXPathULong("string(./persistent[1]/@size)", ctxt, &size) < 0 ||
+        !(encoded = virXPathString("string(./persistent[1])", ctxt))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed persistent data in migration cookie"));
+        goto cleanup;
+    }
+
+#if HAVE_ZLIB
+    if (qemuMigrationDecompress(encoded, size, &xml) < 0)
+        goto cleanup;
+
+    def = virDomainDefParseString(driver->caps, xml, -1,
+                                  VIR_DOMAIN_XML_INACTIVE);
+#else
+    virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                   _("this libvirt was built without zlib support"));
+#endif
+
+cleanup:
+    VIR_FREE(compression);
+    VIR_FREE(encoded);
+    VIR_FREE(xml);
+    return def;
+}
+
+
 static int
 qemuMigrationCookieXMLParse(qemuMigrationCookiePtr mig,
                             virQEMUDriverPtr driver,
@@ -799,6 +1080,11 @@ qemuMigrationCookieXMLParse(qemuMigrationCookiePtr mig,
     }
     VIR_FREE(tmp);
 
+#if HAVE_ZLIB
+    mig->remoteZlib = virXPathBoolean("count(./compression[@name='zlib']) > 0",
+                                      ctxt) == 1;
+#endif
+
     /* Check to ensure all mandatory features from XML are also
      * present in 'flags' */
     if ((n = virXPathNodeSet("./features", ctxt, &nodes)) < 0)
@@ -868,11 +1154,38 @@ qemuMigrationCookieXMLParse(qemuMigrationCookiePtr mig,
         VIR_FREE(nodes);
     }
 
+    if ((flags & QEMU_MIGRATION_COOKIE_PERSISTENT) &&
+        !mig->persistent &&
+        virXPathBoolean("count(./persistent) > 0", ctxt) &&
+        !(mig->persistent = qemuMigrationCookiePersistentXMLParse(driver,
+                                                                  ctxt)))
+        goto error;
+
     if ((flags & QEMU_MIGRATION_COOKIE_NETWORK) &&
         virXPathBoolean("count(./network) > 0", ctxt) &&
         (!(mig->network = qemuMigrationCookieNetworkXMLParse(ctxt))))
         goto error;
 
+    if (flags & QEMU_MIGRATION_COOKIE_NBD &&
+        virXPathBoolean("boolean(./nbd)", ctxt)) {
+        char *port;
+
+        if (VIR_ALLOC(mig->nbd) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+
+        port = virXPathString("string(./nbd/@port)", ctxt);
+        if (port && virStrToLong_i(port, NULL, 10, &mig->nbd->port) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Malformed nbd port '%s'"),
+                           port);
+            VIR_FREE(port);
+            goto error;
+        }
+        VIR_FREE(port);
+    }
+
     return 0;
 
 error:
@@ -937,6 +1250,10 @@ qemuMigrationBakeCookie(qemuMigrationCookiePtr mig,
         return -1;
     }
 
+    if (flags & QEMU_MIGRATION_COOKIE_NBD &&
+        qemuMigrationCookieAddNBD(mig, dom) < 0)
+        return -1;
+
     if (!(*cookieout = qemuMigrationCookieXMLFormatStr(driver, mig)))
         return -1;
 
@@ -1139,12 +1456,9 @@ qemuMigrationUpdateJobStatus(virQEMUDriverPtr driver,
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     int ret;
-    int status;
     bool wait_for_spice = false;
     bool spice_migrated = false;
-    unsigned long long memProcessed;
-    unsigned long long memRemaining;
-    unsigned long long memTotal;
+    qemuMonitorMigrationStatus status;
 
     /* If guest uses SPICE and supports seamles_migration we have to hold up
      * migration finish until SPICE server transfers its data */
@@ -1158,15 +1472,11 @@ qemuMigrationUpdateJobStatus(virQEMUDriverPtr driver,
         /* Guest already exited; nothing further to update.  */
         return -1;
     }
-    ret = qemuMonitorGetMigrationStatus(priv->mon,
-                                        &status,
-                                        &memProcessed,
-                                        &memRemaining,
-                                        &memTotal);
+    ret = qemuMonitorGetMigrationStatus(priv->mon, &status);
 
     /* If qemu says migrated, check spice */
     if (wait_for_spice && (ret == 0) &&
-        (status == QEMU_MONITOR_MIGRATION_STATUS_COMPLETED))
+        (status.status == QEMU_MONITOR_MIGRATION_STATUS_COMPLETED))
         ret = qemuMonitorGetSpiceMigrationStatus(priv->mon,
                                                  &spice_migrated);
 
@@ -1179,7 +1489,7 @@ qemuMigrationUpdateJobStatus(virQEMUDriverPtr driver,
     priv->job.info.timeElapsed -= priv->job.start;
 
     ret = -1;
-    switch (status) {
+    switch (status.status) {
     case QEMU_MONITOR_MIGRATION_STATUS_INACTIVE:
         priv->job.info.type = VIR_DOMAIN_JOB_NONE;
         virReportError(VIR_ERR_OPERATION_FAILED,
@@ -1187,13 +1497,26 @@ qemuMigrationUpdateJobStatus(virQEMUDriverPtr driver,
         break;
 
     case QEMU_MONITOR_MIGRATION_STATUS_ACTIVE:
-        priv->job.info.dataTotal = memTotal;
-        priv->job.info.dataRemaining = memRemaining;
-        priv->job.info.dataProcessed = memProcessed;
+        priv->job.info.dataTotal = status.total;
+        priv->job.info.dataRemaining = status.remaining;
+        priv->job.info.dataProcessed = status.transferred;
+
+        priv->job.info.memTotal = status.total;
+        priv->job.info.memRemaining = status.remaining;
+        priv->job.info.memProcessed = status.transferred;
 
-        priv->job.info.memTotal = memTotal;
-        priv->job.info.memRemaining = memRemaining;
-        priv->job.info.memProcessed = memProcessed;
+        priv->job.migStatus = status;
+
+        /* For save and dump jobs, report how much has been written to
+         * the file so that the compression ratio can be followed */
+        if (priv->job.path) {
+            struct stat sb;
+
+            if (stat(priv->job.path, &sb) == 0 && S_ISREG(sb.st_mode) &&
+                sb.st_size > priv->job.pathOffset)
+                priv->job.info.fileProcessed = sb.st_size -
+                                               priv->job.pathOffset;
+        }
 
         ret = 0;
         break;
@@ -1221,12 +1544,416 @@ qemuMigrationUpdateJobStatus(virQEMUDriverPtr driver,
 }
 
 
+/* Interval at which a queued outgoing migration checks whether its
+ * turn came, in milliseconds */
+#define QEMU_MIGRATION_SCHED_POLL 200
+
+typedef struct _qemuMigrationSchedEntry qemuMigrationSchedEntry;
+typedef qemuMigrationSchedEntry *qemuMigrationSchedEntryPtr;
+struct _qemuMigrationSchedEntry {
+    virDomainObjPtr vm;
+    unsigned long long ticket;      /* order of arrival */
+    unsigned long long memory;      /* KiB */
+    bool running;
+};
+
+/* Outgoing migrations of the host, queued or running */
+struct _qemuMigrationSched {
+    virMutex lock;
+    unsigned long long tickets;
+    qemuMigrationSchedEntryPtr entries;
+    size_t nentries;
+    size_t nrunning;
+};
+
+qemuMigrationSchedPtr
+qemuMigrationSchedNew(void)
+{
+    qemuMigrationSchedPtr sched;
+
+    if (VIR_ALLOC(sched) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (virMutexInit(&sched->lock) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize mutex"));
+        VIR_FREE(sched);
+        return NULL;
+    }
+
+    return sched;
+}
+
+void
+qemuMigrationSchedFree(qemuMigrationSchedPtr sched)
+{
+    if (!sched)
+        return;
+
+    VIR_FREE(sched->entries);
+    virMutexDestroy(&sched->lock);
+    VIR_FREE(sched);
+}
+
+/* Must be called with sched->lock held */
+static ssize_t
+qemuMigrationSchedFind(qemuMigrationSchedPtr sched,
+                       virDomainObjPtr vm)
+{
+    size_t i;
+
+    for (i = 0 ; i < sched->nentries ; i++) {
+        if (sched->entries[i].vm == vm)
+            return i;
+    }
+    return -1;
+}
+
+/* Position of @entry among the queued migrations, 1 being the next one
+ * to run.  Must be called with sched->lock held */
+static size_t
+qemuMigrationSchedPosition(virQEMUDriverPtr driver,
+                           qemuMigrationSchedPtr sched,
+                           qemuMigrationSchedEntryPtr entry)
+{
+    size_t pos = 1;
+    size_t i;
+
+    for (i = 0 ; i < sched->nentries ; i++) {
+        qemuMigrationSchedEntryPtr other = &sched->entries[i];
+
+        if (other == entry || other->running)
+            continue;
+
+        if (driver->migrationQueueByMemory &&
+            other->memory != entry->memory) {
+            if (other->memory < entry->memory)
+                pos++;
+        } else if (other->ticket < entry->ticket) {
+            pos++;
+        }
+    }
+
+    return pos;
+}
+
+/**
+ * qemuMigrationSchedGetPosition:
+ *
+ * Returns the position of the outgoing migration of @vm in the queue of
+ * migrations waiting for their turn to run, 1 being the next one, or 0
+ * if @vm is not waiting.
+ */
+size_t
+qemuMigrationSchedGetPosition(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm)
+{
+    qemuMigrationSchedPtr sched = driver->migrationSched;
+    size_t pos = 0;
+    ssize_t i;
+
+    if (!sched)
+        return 0;
+
+    virMutexLock(&sched->lock);
+    if ((i = qemuMigrationSchedFind(sched, vm)) >= 0 &&
+        !sched->entries[i].running)
+        pos = qemuMigrationSchedPosition(driver, sched, &sched->entries[i]);
+    virMutexUnlock(&sched->lock);
+
+    return pos;
+}
+
+/**
+ * qemuMigrationSchedCount:
+ *
+ * Returns the number of outgoing migrations, queued or running.
+ */
+size_t
+qemuMigrationSchedCount(qemuMigrationSchedPtr sched)
+{
+    size_t count;
+
+    if (!sched)
+        return 0;
+
+    virMutexLock(&sched->lock);
+    count = sched->nentries;
+    virMutexUnlock(&sched->lock);
+
+    return count;
+}
+
+static void
+qemuMigrationSchedLeave(virQEMUDriverPtr driver,
+                        virDomainObjPtr vm)
+{
+    qemuMigrationSchedPtr sched = driver->migrationSched;
+    ssize_t i;
+
+    virMutexLock(&sched->lock);
+    if ((i = qemuMigrationSchedFind(sched, vm)) >= 0) {
+        if (sched->entries[i].running)
+            sched->nrunning--;
+        VIR_DELETE_ELEMENT(sched->entries, i, sched->nentries);
+    }
+    virMutexUnlock(&sched->lock);
+}
+
+/*
+ * Wait until the outgoing migration of @vm may start, that is until it
+ * comes first in the queue and fewer than migration_max_concurrent
+ * migrations are running.  Must be called with both @driver and @vm
+ * locked, they are unlocked while waiting.
+ */
+static int
+qemuMigrationSchedEnter(virQEMUDriverPtr driver,
+                        virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuMigrationSchedPtr sched = driver->migrationSched;
+    qemuMigrationSchedEntry entry;
+    size_t logged = 0;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.vm = vm;
+    entry.memory = vm->def->mem.cur_balloon;
+
+    virMutexLock(&sched->lock);
+    entry.ticket = sched->tickets++;
+    if (VIR_APPEND_ELEMENT(sched->entries, sched->nentries, entry) < 0) {
+        virMutexUnlock(&sched->lock);
+        virReportOOMError();
+        return -1;
+    }
+    virMutexUnlock(&sched->lock);
+
+    for (;;) {
+        unsigned long long now;
+        size_t pos;
+        ssize_t i;
+
+        virMutexLock(&sched->lock);
+        i = qemuMigrationSchedFind(sched, vm);
+        pos = qemuMigrationSchedPosition(driver, sched, &sched->entries[i]);
+        if (pos == 1 &&
+            (!driver->migrationMaxConcurrent ||
+             sched->nrunning < driver->migrationMaxConcurrent)) {
+            sched->entries[i].running = true;
+            sched->nrunning++;
+            virMutexUnlock(&sched->lock);
+            break;
+        }
+        virMutexUnlock(&sched->lock);
+
+        if (pos != logged) {
+            VIR_INFO("Migration of %s is waiting at position %zu",
+                     vm->def->name, pos);
+            logged = pos;
+        }
+
+        if (priv->job.asyncAbort) {
+            virReportError(VIR_ERR_OPERATION_ABORTED, _("%s: %s"),
+                           qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+                           _("canceled by client"));
+            goto error;
+        }
+
+        if (!virDomainObjIsActive(vm)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("guest unexpectedly quit"));
+            goto error;
+        }
+
+        if (virTimeMillisNow(&now) < 0)
+            goto error;
+
+        /* Aborting the job wakes us up early */
+        qemuDriverUnlock(driver);
+        ignore_value(virCondWaitUntil(&priv->job.progressCond, &vm->lock,
+                                      now + QEMU_MIGRATION_SCHED_POLL));
+        virDomainObjUnlock(vm);
+
+        qemuDriverLock(driver);
+        virDomainObjLock(vm);
+    }
+
+    return 0;
+
+error:
+    qemuMigrationSchedLeave(driver, vm);
+    return -1;
+}
+
+/* Bandwidth the outgoing migration of @vm may use, in MiB/s: the
+ * maximum set for it, within its share of migration_host_bandwidth */
+static unsigned long
+qemuMigrationSchedBandwidth(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuMigrationSchedPtr sched = driver->migrationSched;
+    unsigned long bandwidth = priv->job.migBandwidth ?
+                              priv->job.migBandwidth : priv->migMaxBandwidth;
+    unsigned long share;
+    size_t nrunning;
+
+    if (!driver->migrationHostBandwidth)
+        return bandwidth;
+
+    virMutexLock(&sched->lock);
+    nrunning = sched->nrunning;
+    virMutexUnlock(&sched->lock);
+
+    share = driver->migrationHostBandwidth / MAX(nrunning, 1);
+    return MIN(bandwidth, MAX(share, 1));
+}
+
+/* Follow the share of the host bandwidth of a running migration of @vm
+ * as other migrations start and end */
+static void
+qemuMigrationSchedUpdateSpeed(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm,
+                              enum qemuDomainAsyncJob asyncJob)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long speed = qemuMigrationSchedBandwidth(driver, vm);
+    int rc;
+
+    if (speed == priv->job.migSpeed)
+        return;
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+        return;
+    rc = qemuMonitorSetMigrationSpeed(priv->mon, speed);
+    qemuDomainObjExitMonitorWithDriver(driver, vm);
+
+    if (rc < 0) {
+        VIR_WARN("Unable to change migration speed of %s", vm->def->name);
+        virResetLastError();
+        return;
+    }
+
+    VIR_DEBUG("Migration speed of %s changed from %luMiB/s to %luMiB/s",
+              vm->def->name, priv->job.migSpeed, speed);
+    priv->job.migSpeed = speed;
+}
+
+
+/* Downtime qemu allows a migration by default, in milliseconds */
+#define QEMU_MIGRATION_DEFAULT_DOWNTIME 30
+
+/* How long the memory remaining to be migrated has to stay above 90%
+ * of its lowest value for the migration to be considered stalled, in
+ * milliseconds */
+#define QEMU_MIGRATION_CONVERGE_PERIOD 5000
+
+/* Vcpu time taken off the guest at each step of throttling, in percent */
+#define QEMU_MIGRATION_THROTTLE_STEP 20
+
+typedef struct _qemuMigrationConvergence qemuMigrationConvergence;
+typedef qemuMigrationConvergence *qemuMigrationConvergencePtr;
+struct _qemuMigrationConvergence {
+    unsigned long long checked;     /* when @remaining was recorded */
+    unsigned long long remaining;   /* lowest memory remaining seen */
+};
+
+/*
+ * Help a live migration of @vm which stopped making progress to
+ * converge, within the bounds set in qemu.conf: raise its maximum
+ * downtime first, and then throttle the vcpus of @vm.
+ */
+static void
+qemuMigrationConverge(virQEMUDriverPtr driver,
+                      virDomainObjPtr vm,
+                      enum qemuDomainAsyncJob asyncJob,
+                      qemuMigrationConvergencePtr conv)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long remaining = priv->job.info.memRemaining;
+    unsigned long long elapsed = priv->job.info.timeElapsed;
+    unsigned long long downtime;
+    unsigned int throttle;
+    int rc;
+
+    if (virDomainObjGetState(vm, NULL) != VIR_DOMAIN_RUNNING ||
+        remaining == 0)
+        return;
+
+    if (conv->checked == 0 || remaining < conv->remaining / 10 * 9) {
+        conv->checked = elapsed;
+        conv->remaining = remaining;
+        return;
+    }
+
+    if (elapsed - conv->checked < QEMU_MIGRATION_CONVERGE_PERIOD)
+        return;
+
+    conv->checked = elapsed;
+    conv->remaining = remaining;
+
+    downtime = priv->job.migDowntime ? priv->job.migDowntime :
+                                       QEMU_MIGRATION_DEFAULT_DOWNTIME;
+    if (downtime < driver->migrationMaxDowntime) {
+        downtime = MIN(downtime * 2, driver->migrationMaxDowntime);
+
+        if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+            return;
+        rc = qemuMonitorSetMigrationDowntime(priv->mon, downtime);
+        qemuDomainObjExitMonitorWithDriver(driver, vm);
+
+        if (rc < 0) {
+            VIR_WARN("Unable to raise migration downtime of %s",
+                     vm->def->name);
+        } else {
+            VIR_INFO("Migration of %s is not converging with %lluB left, "
+                     "raised max downtime to %llums",
+                     vm->def->name, remaining, downtime);
+            priv->job.migDowntime = downtime;
+        }
+        return;
+    }
+
+    if (priv->job.migThrottle < driver->migrationMaxThrottle) {
+        throttle = MIN(priv->job.migThrottle + QEMU_MIGRATION_THROTTLE_STEP,
+                       driver->migrationMaxThrottle);
+
+        if (qemuCgroupThrottleVcpus(driver, vm, throttle) < 0) {
+            virErrorPtr err = virGetLastError();
+            VIR_WARN("Unable to throttle vcpus of %s: %s",
+                     vm->def->name, err ? err->message : _("unknown error"));
+            virResetLastError();
+            /* don't try again */
+            priv->job.migThrottle = driver->migrationMaxThrottle;
+            return;
+        }
+
+        VIR_INFO("Migration of %s is not converging with %lluB left, "
+                 "throttled vcpus by %u%%",
+                 vm->def->name, remaining, throttle);
+        priv->job.migThrottle = throttle;
+    }
+}
+
+/* Bounds of the interval between two queries of the job status, in
+ * milliseconds.  The interval doubles up to the maximum as long as
+ * nothing happens to the domain, and drops to the minimum when an
+ * event such as the guest being stopped at the end of a migration
+ * hints that the job may be about to complete */
+#define QEMU_MIGRATION_POLL_MIN 5
+#define QEMU_MIGRATION_POLL_START 50
+#define QEMU_MIGRATION_POLL_MAX 400
+
 static int
 qemuMigrationWaitForCompletion(virQEMUDriverPtr driver, virDomainObjPtr vm,
                                enum qemuDomainAsyncJob asyncJob,
                                virConnectPtr dconn)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long interval = QEMU_MIGRATION_POLL_START;
+    qemuMigrationConvergence conv = { 0, 0 };
+    bool throttled = false;
     const char *job;
 
     switch (priv->job.asyncJob) {
@@ -1246,28 +1973,61 @@ qemuMigrationWaitForCompletion(virQEMUDriverPtr driver, virDomainObjPtr vm,
     priv->job.info.type = VIR_DOMAIN_JOB_UNBOUNDED;
 
     while (priv->job.info.type == VIR_DOMAIN_JOB_UNBOUNDED) {
-        /* Poll every 50ms for progress & to allow cancellation */
-        struct timespec ts = { .tv_sec = 0, .tv_nsec = 50 * 1000 * 1000ull };
+        unsigned long long now;
+        bool woken;
 
         if (qemuMigrationUpdateJobStatus(driver, vm, job, asyncJob) < 0)
             goto cleanup;
 
+        if (priv->job.info.type != VIR_DOMAIN_JOB_UNBOUNDED)
+            break;
+
+        if (asyncJob == QEMU_ASYNC_JOB_MIGRATION_OUT &&
+            (driver->migrationMaxDowntime || driver->migrationMaxThrottle)) {
+            qemuMigrationConverge(driver, vm, asyncJob, &conv);
+            if (priv->job.migThrottle)
+                throttled = true;
+        }
+
+        if (asyncJob == QEMU_ASYNC_JOB_MIGRATION_OUT &&
+            driver->migrationHostBandwidth && priv->job.migScheduled)
+            qemuMigrationSchedUpdateSpeed(driver, vm, asyncJob);
+
         if (dconn && virConnectIsAlive(dconn) <= 0) {
             virReportError(VIR_ERR_OPERATION_FAILED, "%s",
                            _("Lost connection to destination host"));
             goto cleanup;
         }
 
-        virDomainObjUnlock(vm);
-        qemuDriverUnlock(driver);
+        if (virTimeMillisNow(&now) < 0) {
+            priv->job.info.type = VIR_DOMAIN_JOB_FAILED;
+            goto cleanup;
+        }
 
-        nanosleep(&ts, NULL);
+        /* Wait for the next poll, unless woken up early by an event
+         * or a request to abort the job */
+        qemuDriverUnlock(driver);
+        woken = virCondWaitUntil(&priv->job.progressCond, &vm->lock,
+                                 now + interval) == 0;
+        virDomainObjUnlock(vm);
 
         qemuDriverLock(driver);
         virDomainObjLock(vm);
+
+        if (woken)
+            interval = QEMU_MIGRATION_POLL_MIN;
+        else
+            interval = MIN(interval * 2, QEMU_MIGRATION_POLL_MAX);
     }
 
 cleanup:
+    /* Once migrated the guest is paused, and it is resumed if the
+     * migration fails later on, in both cases at full speed */
+    if (throttled && virDomainObjIsActive(vm) &&
+        qemuCgroupThrottleVcpus(driver, vm, 0) < 0) {
+        VIR_WARN("Unable to lift vcpu throttling of %s", vm->def->name);
+    }
+
     if (priv->job.info.type == VIR_DOMAIN_JOB_COMPLETED)
         return 0;
     else
@@ -1317,9 +2077,18 @@ qemuDomainMigrateOPDRelocate(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                              qemuMigrationCookiePtr cookie)
 {
     virDomainNetDefPtr netptr;
+    const char **ovsnames = NULL;
+    char **ovsdata = NULL;
+    size_t novs = 0;
     int ret = -1;
     int i;
 
+    if (VIR_ALLOC_N(ovsnames, cookie->network->nnets) < 0 ||
+        VIR_ALLOC_N(ovsdata, cookie->network->nnets) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
     for (i = 0; i < cookie->network->nnets; i++) {
         netptr = vm->def->nets[i];
 
@@ -1329,21 +2098,26 @@ qemuDomainMigrateOPDRelocate(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
         case VIR_NETDEV_VPORT_PROFILE_8021QBH:
            break;
         case VIR_NETDEV_VPORT_PROFILE_OPENVSWITCH:
-            if (virNetDevOpenvswitchSetMigrateData(cookie->network->net[i].portdata,
-                                                   netptr->ifname) != 0) {
-                virReportSystemError(VIR_ERR_INTERNAL_ERROR,
-                                     _("Unable to run command to set OVS port data for "
-                                     "interface %s"), netptr->ifname);
-                goto cleanup;
-            }
+            ovsnames[novs] = netptr->ifname;
+            ovsdata[novs++] = cookie->network->net[i].portdata;
             break;
         default:
             break;
         }
     }
 
+    if (novs &&
+        virNetDevOpenvswitchSetMigrateDataList(ovsdata, ovsnames, novs) != 0) {
+        virReportSystemError(VIR_ERR_INTERNAL_ERROR,
+                             _("Unable to run command to set OVS port data for "
+                             "interface %s"), ovsnames[0]);
+        goto cleanup;
+    }
+
     ret = 0;
 cleanup:
+    VIR_FREE(ovsnames);
+    VIR_FREE(ovsdata);
     return ret;
 }
 
@@ -1422,6 +2196,7 @@ char *qemuMigrationBegin(virQEMUDriverPtr driver,
     qemuMigrationCookiePtr mig = NULL;
     virDomainDefPtr def = NULL;
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned int cookieFlags = QEMU_MIGRATION_COOKIE_LOCKSTATE;
 
     VIR_DEBUG("driver=%p, vm=%p, xmlin=%s, dname=%s,"
               " cookieout=%p, cookieoutlen=%p, flags=%lx",
@@ -1441,12 +2216,20 @@ char *qemuMigrationBegin(virQEMUDriverPtr driver,
     if (!(flags & VIR_MIGRATE_UNSAFE) && !qemuMigrationIsSafe(vm->def))
         goto cleanup;
 
+    /* Ask the destination to export the disks over NBD, so that all of
+     * them can be mirrored at once before RAM is migrated instead of
+     * being copied one after another within the migration stream */
+    if (flags & (VIR_MIGRATE_NON_SHARED_DISK | VIR_MIGRATE_NON_SHARED_INC) &&
+        !(flags & VIR_MIGRATE_TUNNELLED) &&
+        qemuCapsGet(priv->caps, QEMU_CAPS_DRIVE_MIRROR))
+        cookieFlags |= QEMU_MIGRATION_COOKIE_NBD;
+
     if (!(mig = qemuMigrationEatCookie(driver, vm, NULL, 0, 0)))
         goto cleanup;
 
     if (qemuMigrationBakeCookie(mig, driver, vm,
                                 cookieout, cookieoutlen,
-                                QEMU_MIGRATION_COOKIE_LOCKSTATE) < 0)
+                                cookieFlags) < 0)
         goto cleanup;
 
     if (flags & VIR_MIGRATE_OFFLINE) {
@@ -1477,45 +2260,190 @@ char *qemuMigrationBegin(virQEMUDriverPtr driver,
                                             VIR_DOMAIN_XML_INACTIVE)))
             goto cleanup;
 
-        if (STRNEQ(def->name, vm->def->name)) {
-            virReportError(VIR_ERR_INVALID_ARG, "%s",
-                           _("target domain name doesn't match source name"));
-            goto cleanup;
-        }
+        if (STRNEQ(def->name, vm->def->name)) {
+            virReportError(VIR_ERR_INVALID_ARG, "%s",
+                           _("target domain name doesn't match source name"));
+            goto cleanup;
+        }
+
+        if (!virDomainDefCheckABIStability(vm->def, def))
+            goto cleanup;
+
+        rv = qemuDomainDefFormatLive(driver, def, false, true);
+    } else {
+        rv = qemuDomainDefFormatLive(driver, vm->def, false, true);
+    }
+
+cleanup:
+    qemuMigrationCookieFree(mig);
+    virDomainDefFree(def);
+    return rv;
+}
+
+
+/* Prepare is the first step, and it runs on the destination host.
+ */
+
+static void
+qemuMigrationPrepareCleanup(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    VIR_DEBUG("driver=%p, vm=%s, job=%s, asyncJob=%s",
+              driver,
+              vm->def->name,
+              qemuDomainJobTypeToString(priv->job.active),
+              qemuDomainAsyncJobTypeToString(priv->job.asyncJob));
+
+    if (!qemuMigrationJobIsActive(vm, QEMU_ASYNC_JOB_MIGRATION_IN))
+        return;
+    qemuDomainObjDiscardAsyncJob(driver, vm);
+}
+
+/* Hand out ports for incoming migration and NBD servers in turn from
+ * our pool.  The caller must hold the driver lock. */
+static int
+qemuMigrationNextPort(void)
+{
+    static int port = 0;
+    int ret = QEMUD_MIGRATION_FIRST_PORT + port++;
+
+    if (port == QEMUD_MIGRATION_NUM_PORTS)
+        port = 0;
+
+    return ret;
+}
+
+/* Whether @disk is copied to the destination by mirroring it to the
+ * NBD server there when migrating with non-shared storage */
+static bool
+qemuMigrationDiskIsMirrorable(virDomainDiskDefPtr disk)
+{
+    return disk->src && !disk->readonly && !disk->shared &&
+        (disk->type == VIR_DOMAIN_DISK_TYPE_FILE ||
+         disk->type == VIR_DOMAIN_DISK_TYPE_BLOCK);
+}
+
+/* Start an NBD server in the incoming qemu and export every disk the
+ * source is going to mirror to it.  The port is remembered so that it
+ * can be passed back in the cookie and the server stopped in Finish. */
+static int
+qemuMigrationStartNBDServer(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    int port = qemuMigrationNextPort();
+    char *diskAlias = NULL;
+    int ret = -1;
+    int i;
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                       QEMU_ASYNC_JOB_MIGRATION_IN) < 0)
+        return -1;
+
+    if (qemuMonitorNBDServerStart(priv->mon, "0.0.0.0", port) < 0)
+        goto cleanup;
+
+    for (i = 0; i < vm->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = vm->def->disks[i];
+
+        if (!qemuMigrationDiskIsMirrorable(disk))
+            continue;
+
+        VIR_FREE(diskAlias);
+        if (virAsprintf(&diskAlias, "%s%s",
+                        QEMU_DRIVE_HOST_PREFIX, disk->info.alias) < 0) {
+            virReportOOMError();
+            goto stop;
+        }
+
+        if (qemuMonitorNBDServerAdd(priv->mon, diskAlias, true) < 0)
+            goto stop;
+    }
+
+    priv->nbdPort = port;
+    ret = 0;
+
+cleanup:
+    qemuDomainObjExitMonitorWithDriver(driver, vm);
+    VIR_FREE(diskAlias);
+    return ret;
+
+stop:
+    ignore_value(qemuMonitorNBDServerStop(priv->mon));
+    goto cleanup;
+}
+
+static void
+qemuMigrationStopNBDServer(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
 
-        if (!virDomainDefCheckABIStability(vm->def, def))
-            goto cleanup;
+    if (!priv->nbdPort)
+        return;
 
-        rv = qemuDomainDefFormatLive(driver, def, false, true);
-    } else {
-        rv = qemuDomainDefFormatLive(driver, vm->def, false, true);
+    if (virDomainObjIsActive(vm) &&
+        qemuDomainObjEnterMonitorAsync(driver, vm,
+                                       QEMU_ASYNC_JOB_MIGRATION_IN) == 0) {
+        if (qemuMonitorNBDServerStop(priv->mon) < 0)
+            VIR_WARN("Unable to stop NBD server of %s", vm->def->name);
+        qemuDomainObjExitMonitorWithDriver(driver, vm);
     }
 
-cleanup:
-    qemuMigrationCookieFree(mig);
-    virDomainDefFree(def);
-    return rv;
+    priv->nbdPort = 0;
 }
 
-
-/* Prepare is the first step, and it runs on the destination host.
+/*
+ * Turn on XBZRLE compression of the pages the guest keeps rewriting, on
+ * the source of a migration for it to send deltas of these pages and on
+ * the destination to make sure it can decode them
  */
-
-static void
-qemuMigrationPrepareCleanup(virQEMUDriverPtr driver,
-                            virDomainObjPtr vm)
+static int
+qemuMigrationSetCompression(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm,
+                            enum qemuDomainAsyncJob job)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    int ret;
 
-    VIR_DEBUG("driver=%p, vm=%s, job=%s, asyncJob=%s",
-              driver,
-              vm->def->name,
-              qemuDomainJobTypeToString(priv->job.active),
-              qemuDomainAsyncJobTypeToString(priv->job.asyncJob));
+    if (!qemuCapsGet(priv->caps, QEMU_CAPS_MIGRATE_XBZRLE)) {
+        virReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                       job == QEMU_ASYNC_JOB_MIGRATION_IN ?
+                       _("Compressed migration is not supported by "
+                         "target QEMU binary") :
+                       _("Compressed migration is not supported by "
+                         "source QEMU binary"));
+        return -1;
+    }
 
-    if (!qemuMigrationJobIsActive(vm, QEMU_ASYNC_JOB_MIGRATION_IN))
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, job) < 0)
+        return -1;
+
+    ret = qemuMonitorSetMigrationCapability(priv->mon,
+                                            QEMU_MONITOR_MIGRATION_CAPS_XBZRLE);
+
+    qemuDomainObjExitMonitorWithDriver(driver, vm);
+
+    return ret;
+}
+
+/* Account the time spent since *@stepStart to @step in @steps */
+static void
+qemuMigrationPrepareStepDone(unsigned long long *steps,
+                             unsigned long long *stepStart,
+                             enum qemuMigrationPrepareStep step)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0) {
+        virResetLastError();
         return;
-    qemuDomainObjDiscardAsyncJob(driver, vm);
+    }
+
+    steps[step] = now - *stepStart;
+    *stepStart = now;
 }
 
 static int
@@ -1543,6 +2471,7 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
     char *origname = NULL;
     char *xmlout = NULL;
     unsigned int cookieFlags;
+    unsigned long long steps[QEMU_MIGRATION_PREPARE_LAST] = { 0 };
 
     if (virTimeMillisNow(&now) < 0)
         return -1;
@@ -1627,6 +2556,8 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
         }
     }
 
+    qemuMigrationPrepareStepDone(steps, &now, QEMU_MIGRATION_PREPARE_PARSE);
+
     if (virDomainObjIsDuplicate(&driver->domains, def, 1) < 0)
         goto cleanup;
 
@@ -1642,7 +2573,8 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
     origname = NULL;
 
     if (!(mig = qemuMigrationEatCookie(driver, vm, cookiein, cookieinlen,
-                                       QEMU_MIGRATION_COOKIE_LOCKSTATE)))
+                                       QEMU_MIGRATION_COOKIE_LOCKSTATE |
+                                       QEMU_MIGRATION_COOKIE_NBD)))
         goto cleanup;
 
     if (qemuMigrationJobStart(driver, vm, QEMU_ASYNC_JOB_MIGRATION_IN) < 0)
@@ -1651,6 +2583,7 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
 
     /* Domain starts inactive, even if the domain XML had an id field. */
     vm->def->id = -1;
+    qemuMigrationPrepareStepDone(steps, &now, QEMU_MIGRATION_PREPARE_DEFINE);
 
     if (flags & VIR_MIGRATE_OFFLINE)
         goto done;
@@ -1675,6 +2608,7 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
          */
         goto endjob;
     }
+    qemuMigrationPrepareStepDone(steps, &now, QEMU_MIGRATION_PREPARE_START);
 
     if (tunnel) {
         if (virFDStreamOpen(st, dataFD[1]) < 0) {
@@ -1687,6 +2621,25 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
         dataFD[1] = -1; /* 'st' owns the FD now & will close it */
     }
 
+    /* Without an NBD server the source falls back to copying disks
+     * within the migration stream */
+    if (mig->nbd && !tunnel &&
+        flags & (VIR_MIGRATE_NON_SHARED_DISK | VIR_MIGRATE_NON_SHARED_INC) &&
+        qemuCapsGet(priv->caps, QEMU_CAPS_NBD_SERVER) &&
+        qemuMigrationStartNBDServer(driver, vm) < 0) {
+        virDomainAuditStart(vm, "migrated", false);
+        qemuProcessStop(driver, vm, VIR_DOMAIN_SHUTOFF_FAILED, 0);
+        goto endjob;
+    }
+
+    if (flags & VIR_MIGRATE_COMPRESSED &&
+        qemuMigrationSetCompression(driver, vm,
+                                    QEMU_ASYNC_JOB_MIGRATION_IN) < 0) {
+        virDomainAuditStart(vm, "migrated", false);
+        qemuProcessStop(driver, vm, VIR_DOMAIN_SHUTOFF_FAILED, 0);
+        goto endjob;
+    }
+
     if (mig->lockState) {
         VIR_DEBUG("Received lockstate %s", mig->lockState);
         VIR_FREE(priv->lockState);
@@ -1695,13 +2648,25 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
     } else {
         VIR_DEBUG("Received no lockstate");
     }
+    qemuMigrationPrepareStepDone(steps, &now,
+                                 QEMU_MIGRATION_PREPARE_INCOMING);
 
 done:
+    memcpy(priv->migPrepareSteps, steps, sizeof(steps));
+    VIR_DEBUG("Prepared in parse=%llums define=%llums start=%llums "
+              "incoming=%llums", steps[QEMU_MIGRATION_PREPARE_PARSE],
+              steps[QEMU_MIGRATION_PREPARE_DEFINE],
+              steps[QEMU_MIGRATION_PREPARE_START],
+              steps[QEMU_MIGRATION_PREPARE_INCOMING]);
+
     if (flags & VIR_MIGRATE_OFFLINE)
         cookieFlags = 0;
     else
         cookieFlags = QEMU_MIGRATION_COOKIE_GRAPHICS;
 
+    if (priv->nbdPort)
+        cookieFlags |= QEMU_MIGRATION_COOKIE_NBD;
+
     if (qemuMigrationBakeCookie(mig, driver, vm, cookieout, cookieoutlen,
                                 cookieFlags) < 0) {
         /* We could tear down the whole guest here, but
@@ -1805,7 +2770,6 @@ qemuMigrationPrepareDirect(virQEMUDriverPtr driver,
                            const char *dom_xml,
                            unsigned long flags)
 {
-    static int port = 0;
     int this_port;
     char *hostname = NULL;
     char migrateFrom [64];
@@ -1830,8 +2794,7 @@ qemuMigrationPrepareDirect(virQEMUDriverPtr driver,
      * to be a correct hostname which refers to the target machine).
      */
     if (uri_in == NULL) {
-        this_port = QEMUD_MIGRATION_FIRST_PORT + port++;
-        if (port == QEMUD_MIGRATION_NUM_PORTS) port = 0;
+        this_port = qemuMigrationNextPort();
 
         /* Get hostname */
         if ((hostname = virGetHostname(NULL)) == NULL)
@@ -1870,9 +2833,7 @@ qemuMigrationPrepareDirect(virQEMUDriverPtr driver,
         p = strrchr(uri_in, ':');
         if (p == strchr(uri_in, ':')) {
             /* Generate a port */
-            this_port = QEMUD_MIGRATION_FIRST_PORT + port++;
-            if (port == QEMUD_MIGRATION_NUM_PORTS)
-                port = 0;
+            this_port = qemuMigrationNextPort();
 
             /* Caller frees */
             if (virAsprintf(uri_out, "%s:%d", uri_in, this_port) < 0) {
@@ -1949,6 +2910,10 @@ struct _qemuMigrationSpec {
 
 #define TUNNEL_SEND_BUF_SIZE 65536
 
+/* Number of buffers in flight between reading the migration data from
+ * qemu and sending it to the stream */
+#define TUNNEL_SEND_BUF_COUNT 8
+
 typedef struct _qemuMigrationIOThread qemuMigrationIOThread;
 typedef qemuMigrationIOThread *qemuMigrationIOThreadPtr;
 struct _qemuMigrationIOThread {
@@ -1958,12 +2923,128 @@ struct _qemuMigrationIOThread {
     virError err;
     int wakeupRecvFD;
     int wakeupSendFD;
+
+    /* The IO thread fills the buffers with what qemu writes to @sock,
+     * and another thread sends them to @st, so that reading from qemu
+     * goes on while the stream, which may need to encrypt the data,
+     * is busy */
+    virThread sendThread;
+    bool sending;
+    virMutex lock;
+    virCond cond;
+    char *buffers[TUNNEL_SEND_BUF_COUNT];
+    size_t lengths[TUNNEL_SEND_BUF_COUNT];
+    size_t head;                /* first filled buffer */
+    size_t count;               /* number of filled buffers */
+    bool eof;                   /* no more buffers will be filled */
+    bool quit;                  /* drop the filled buffers */
+    bool failed;                /* sending failed with sendErr */
+    virError sendErr;
 };
 
-static void qemuMigrationIOFunc(void *arg)
+static void qemuMigrationSendFunc(void *arg)
 {
     qemuMigrationIOThreadPtr data = arg;
+    char *buffer;
+    size_t len;
+    int rc;
+
+    virMutexLock(&data->lock);
+    for (;;) {
+        while (data->count == 0 && !data->eof && !data->quit)
+            ignore_value(virCondWait(&data->cond, &data->lock));
+
+        if (data->quit || data->count == 0)
+            break;
+
+        buffer = data->buffers[data->head];
+        len = data->lengths[data->head];
+        virMutexUnlock(&data->lock);
+
+        rc = virStreamSend(data->st, buffer, len);
+
+        virMutexLock(&data->lock);
+        if (rc < 0) {
+            data->failed = true;
+            virCopyLastError(&data->sendErr);
+            virResetLastError();
+            virCondBroadcast(&data->cond);
+            break;
+        }
+
+        data->head = (data->head + 1) % TUNNEL_SEND_BUF_COUNT;
+        data->count--;
+        virCondBroadcast(&data->cond);
+    }
+    virMutexUnlock(&data->lock);
+}
+
+/*
+ * Wait for a buffer to be free to read the next data from qemu into.
+ * Returns NULL if the data can no longer be sent.
+ */
+static char *
+qemuMigrationIOGetBuffer(qemuMigrationIOThreadPtr data)
+{
     char *buffer = NULL;
+
+    virMutexLock(&data->lock);
+    while (data->count == TUNNEL_SEND_BUF_COUNT && !data->failed)
+        ignore_value(virCondWait(&data->cond, &data->lock));
+
+    if (!data->failed)
+        buffer = data->buffers[(data->head + data->count) %
+                               TUNNEL_SEND_BUF_COUNT];
+    virMutexUnlock(&data->lock);
+
+    return buffer;
+}
+
+/* Queue the buffer returned by qemuMigrationIOGetBuffer for sending */
+static int
+qemuMigrationIOQueueBuffer(qemuMigrationIOThreadPtr data,
+                           size_t len)
+{
+    int ret = -1;
+
+    virMutexLock(&data->lock);
+    if (!data->failed) {
+        data->lengths[(data->head + data->count) %
+                      TUNNEL_SEND_BUF_COUNT] = len;
+        data->count++;
+        virCondBroadcast(&data->cond);
+        ret = 0;
+    }
+    virMutexUnlock(&data->lock);
+
+    return ret;
+}
+
+/* Stop the send thread once it has sent everything queued, or at once
+ * if @quit is true */
+static void
+qemuMigrationIOStopSending(qemuMigrationIOThreadPtr data,
+                           bool quit)
+{
+    if (!data->sending)
+        return;
+
+    virMutexLock(&data->lock);
+    if (quit)
+        data->quit = true;
+    else
+        data->eof = true;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+
+    virThreadJoin(&data->sendThread);
+    data->sending = false;
+}
+
+static void qemuMigrationIOFunc(void *arg)
+{
+    qemuMigrationIOThreadPtr data = arg;
+    char *buffer;
     struct pollfd fds[2];
     int timeout = -1;
     virErrorPtr err = NULL;
@@ -1971,10 +3052,13 @@ static void qemuMigrationIOFunc(void *arg)
     VIR_DEBUG("Running migration tunnel; stream=%p, sock=%d",
               data->st, data->sock);
 
-    if (VIR_ALLOC_N(buffer, TUNNEL_SEND_BUF_SIZE) < 0) {
-        virReportOOMError();
+    if (virThreadCreate(&data->sendThread, true,
+                        qemuMigrationSendFunc, data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create migration send thread"));
         goto abrt;
     }
+    data->sending = true;
 
     fds[0].fd = data->sock;
     fds[1].fd = data->wakeupRecvFD;
@@ -2025,10 +3109,13 @@ static void qemuMigrationIOFunc(void *arg)
         if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
             int nbytes;
 
+            if (!(buffer = qemuMigrationIOGetBuffer(data)))
+                goto send_error;
+
             nbytes = saferead(data->sock, buffer, TUNNEL_SEND_BUF_SIZE);
             if (nbytes > 0) {
-                if (virStreamSend(data->st, buffer, nbytes) < 0)
-                    goto error;
+                if (qemuMigrationIOQueueBuffer(data, nbytes) < 0)
+                    goto send_error;
             } else if (nbytes < 0) {
                 virReportSystemError(errno, "%s",
                         _("tunnelled migration failed to read from qemu"));
@@ -2040,19 +3127,28 @@ static void qemuMigrationIOFunc(void *arg)
         }
     }
 
+    /* Flush the data still queued */
+    qemuMigrationIOStopSending(data, false);
+    if (data->failed)
+        goto send_error;
+
     if (virStreamFinish(data->st) < 0)
         goto error;
 
-    VIR_FREE(buffer);
-
     return;
 
+send_error:
+    qemuMigrationIOStopSending(data, true);
+    virSetError(&data->sendErr);
+    goto error;
+
 abrt:
     err = virSaveLastError();
     if (err && err->code == VIR_ERR_OK) {
         virFreeError(err);
         err = NULL;
     }
+    qemuMigrationIOStopSending(data, true);
     virStreamAbort(data->st);
     if (err) {
         virSetError(err);
@@ -2062,7 +3158,25 @@ abrt:
 error:
     virCopyLastError(&data->err);
     virResetLastError();
-    VIR_FREE(buffer);
+}
+
+
+static void
+qemuMigrationIOThreadFree(qemuMigrationIOThreadPtr io)
+{
+    size_t i;
+
+    if (!io)
+        return;
+
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++)
+        VIR_FREE(io->buffers[i]);
+    virResetError(&io->sendErr);
+    ignore_value(virCondDestroy(&io->cond));
+    virMutexDestroy(&io->lock);
+    VIR_FORCE_CLOSE(io->wakeupSendFD);
+    VIR_FORCE_CLOSE(io->wakeupRecvFD);
+    VIR_FREE(io);
 }
 
 
@@ -2072,6 +3186,7 @@ qemuMigrationStartTunnel(virStreamPtr st,
 {
     qemuMigrationIOThreadPtr io = NULL;
     int wakeupFD[2] = { -1, -1 };
+    size_t i;
 
     if (pipe2(wakeupFD, O_CLOEXEC) < 0) {
         virReportSystemError(errno, "%s",
@@ -2082,10 +3197,30 @@ qemuMigrationStartTunnel(virStreamPtr st,
     if (VIR_ALLOC(io) < 0)
         goto no_memory;
 
+    if (virMutexInit(&io->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        VIR_FREE(io);
+        goto error;
+    }
+    if (virCondInit(&io->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize condition variable"));
+        virMutexDestroy(&io->lock);
+        VIR_FREE(io);
+        goto error;
+    }
+
     io->st = st;
     io->sock = sock;
     io->wakeupRecvFD = wakeupFD[0];
     io->wakeupSendFD = wakeupFD[1];
+    wakeupFD[0] = wakeupFD[1] = -1;
+
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++) {
+        if (VIR_ALLOC_N(io->buffers[i], TUNNEL_SEND_BUF_SIZE) < 0)
+            goto no_memory;
+    }
 
     if (virThreadCreate(&io->thread, true,
                         qemuMigrationIOFunc,
@@ -2102,7 +3237,7 @@ no_memory:
 error:
     VIR_FORCE_CLOSE(wakeupFD[0]);
     VIR_FORCE_CLOSE(wakeupFD[1]);
-    VIR_FREE(io);
+    qemuMigrationIOThreadFree(io);
     return NULL;
 }
 
@@ -2134,9 +3269,7 @@ qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
     rv = 0;
 
 cleanup:
-    VIR_FORCE_CLOSE(io->wakeupSendFD);
-    VIR_FORCE_CLOSE(io->wakeupRecvFD);
-    VIR_FREE(io);
+    qemuMigrationIOThreadFree(io);
     return rv;
 }
 
@@ -2178,6 +3311,215 @@ cleanup:
     return ret;
 }
 
+/* Cancel the mirrors started by qemuMigrationDriveMirror, keeping
+ * any error which has been reported already */
+static void
+qemuMigrationCancelDriveMirror(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virErrorPtr orig_err = virSaveLastError();
+    char *diskAlias = NULL;
+    int i;
+
+    for (i = 0; i < vm->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = vm->def->disks[i];
+
+        if (!qemuMigrationDiskIsMirrorable(disk))
+            continue;
+
+        if (!virDomainObjIsActive(vm))
+            break;
+
+        VIR_FREE(diskAlias);
+        if (virAsprintf(&diskAlias, "%s%s",
+                        QEMU_DRIVE_HOST_PREFIX, disk->info.alias) < 0) {
+            virReportOOMError();
+            break;
+        }
+
+        if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                           QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+            break;
+
+        /* Disks which never got a mirror just fail to cancel */
+        if (qemuMonitorBlockJob(priv->mon, diskAlias, NULL, 0, NULL,
+                                BLOCK_JOB_ABORT, true) < 0)
+            VIR_DEBUG("Unable to cancel drive mirroring of '%s'", diskAlias);
+        qemuDomainObjExitMonitorWithDriver(driver, vm);
+    }
+
+    VIR_FREE(diskAlias);
+    if (orig_err) {
+        virSetError(orig_err);
+        virFreeError(orig_err);
+    } else {
+        virResetLastError();
+    }
+}
+
+/* Mirror all disks which the destination exported over NBD (see
+ * qemuMigrationStartNBDServer) at once and wait until every mirror
+ * is in sync.  Each mirror is limited to @speed MiB/s on its own.
+ * Once this returns successfully qemu keeps the copies in sync until
+ * the guest is paused at the end of the migration, after which the
+ * mirrors have to be cancelled by qemuMigrationCancelDriveMirror. */
+static int
+qemuMigrationDriveMirror(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm,
+                         qemuMigrationCookiePtr mig,
+                         const char *host,
+                         unsigned long speed,
+                         unsigned long flags)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned int mirror_flags = VIR_DOMAIN_BLOCK_REBASE_REUSE_EXT;
+    unsigned long long interval = QEMU_MIGRATION_POLL_START;
+    bool *synced = NULL;
+    size_t pending = 0;
+    char *diskAlias = NULL;
+    char *nbd_dest = NULL;
+    int ret = -1;
+    int i;
+
+    VIR_DEBUG("driver=%p, vm=%p, mig=%p, host=%s, speed=%lu, flags=%lx",
+              driver, vm, mig, host, speed, flags);
+
+    if (flags & VIR_MIGRATE_NON_SHARED_INC)
+        mirror_flags |= VIR_DOMAIN_BLOCK_REBASE_SHALLOW;
+
+    if (VIR_ALLOC_N(synced, vm->def->ndisks) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (i = 0; i < vm->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = vm->def->disks[i];
+        int mon_ret;
+
+        if (!qemuMigrationDiskIsMirrorable(disk)) {
+            synced[i] = true;
+            continue;
+        }
+
+        VIR_FREE(diskAlias);
+        VIR_FREE(nbd_dest);
+        if ((virAsprintf(&diskAlias, "%s%s",
+                         QEMU_DRIVE_HOST_PREFIX, disk->info.alias) < 0) ||
+            (virAsprintf(&nbd_dest, "nbd:%s:%d:exportname=%s",
+                         host, mig->nbd->port, diskAlias) < 0)) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                           QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+            goto cleanup;
+        /* The export is already formatted by the destination, so raw
+         * is always the right format and nothing needs to be probed */
+        mon_ret = qemuMonitorDriveMirror(priv->mon, diskAlias, nbd_dest,
+                                         "raw", speed, mirror_flags);
+        qemuDomainObjExitMonitorWithDriver(driver, vm);
+
+        if (mon_ret < 0)
+            goto cleanup;
+        pending++;
+    }
+
+    while (pending) {
+        unsigned long long now;
+        bool woken;
+
+        for (i = 0; i < vm->def->ndisks; i++) {
+            virDomainDiskDefPtr disk = vm->def->disks[i];
+            virDomainBlockJobInfo info;
+            int mon_ret;
+
+            if (synced[i])
+                continue;
+
+            VIR_FREE(diskAlias);
+            if (virAsprintf(&diskAlias, "%s%s",
+                            QEMU_DRIVE_HOST_PREFIX, disk->info.alias) < 0) {
+                virReportOOMError();
+                goto cleanup;
+            }
+
+            if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                               QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+                goto cleanup;
+
+            if (priv->job.asyncAbort) {
+                /* explicitly do this *after* we entered the monitor,
+                 * as this is a critical section so we are guaranteed
+                 * priv->job.asyncAbort will not change */
+                qemuDomainObjExitMonitorWithDriver(driver, vm);
+                virReportError(VIR_ERR_OPERATION_ABORTED, _("%s: %s"),
+                               qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+                               _("canceled by client"));
+                goto cleanup;
+            }
+
+            mon_ret = qemuMonitorBlockJob(priv->mon, diskAlias, NULL, 0,
+                                          &info, BLOCK_JOB_INFO, true);
+            qemuDomainObjExitMonitorWithDriver(driver, vm);
+
+            if (mon_ret < 0)
+                goto cleanup;
+
+            if (mon_ret == 0) {
+                virReportError(VIR_ERR_OPERATION_FAILED,
+                               _("migration of disk %s failed"),
+                               disk->dst);
+                goto cleanup;
+            }
+
+            if (info.cur == info.end) {
+                VIR_DEBUG("Drive mirroring of '%s' in sync", diskAlias);
+                synced[i] = true;
+                pending--;
+            }
+        }
+
+        if (!pending)
+            break;
+
+        if (virTimeMillisNow(&now) < 0)
+            goto cleanup;
+
+        /* Block job events wake us up as soon as a mirror becomes
+         * ready or fails */
+        qemuDriverUnlock(driver);
+        woken = virCondWaitUntil(&priv->job.progressCond, &vm->lock,
+                                 now + interval) == 0;
+        virDomainObjUnlock(vm);
+
+        qemuDriverLock(driver);
+        virDomainObjLock(vm);
+
+        if (!virDomainObjIsActive(vm)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("guest unexpectedly quit"));
+            goto cleanup;
+        }
+
+        if (woken)
+            interval = QEMU_MIGRATION_POLL_MIN;
+        else
+            interval = MIN(interval * 2, QEMU_MIGRATION_POLL_MAX);
+    }
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0)
+        qemuMigrationCancelDriveMirror(driver, vm);
+    VIR_FREE(synced);
+    VIR_FREE(diskAlias);
+    VIR_FREE(nbd_dest);
+    return ret;
+}
+
 static int
 qemuMigrationRun(virQEMUDriverPtr driver,
                  virDomainObjPtr vm,
@@ -2196,8 +3538,9 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     qemuMigrationCookiePtr mig = NULL;
     qemuMigrationIOThreadPtr iothread = NULL;
     int fd = -1;
-    unsigned long migrate_speed = resource ? resource : priv->migMaxBandwidth;
+    unsigned long migrate_speed;
     virErrorPtr orig_err = NULL;
+    bool mirrored = false;
 
     VIR_DEBUG("driver=%p, vm=%p, cookiein=%s, cookieinlen=%d, "
               "cookieout=%p, cookieoutlen=%p, flags=%lx, resource=%lu, "
@@ -2215,8 +3558,16 @@ qemuMigrationRun(virQEMUDriverPtr driver,
         return -1;
     }
 
+    /* Wait for our turn among the outgoing migrations of the host */
+    if (qemuMigrationSchedEnter(driver, vm) < 0)
+        return -1;
+    priv->job.migScheduled = true;
+    priv->job.migBandwidth = resource;
+    migrate_speed = qemuMigrationSchedBandwidth(driver, vm);
+
     if (!(mig = qemuMigrationEatCookie(driver, vm, cookiein, cookieinlen,
-                                       QEMU_MIGRATION_COOKIE_GRAPHICS)))
+                                       QEMU_MIGRATION_COOKIE_GRAPHICS |
+                                       QEMU_MIGRATION_COOKIE_NBD)))
         goto cleanup;
 
     if (qemuDomainMigrateGraphicsRelocate(driver, vm, mig) < 0)
@@ -2229,6 +3580,24 @@ qemuMigrationRun(virQEMUDriverPtr driver,
             goto cleanup;
     }
 
+    /* If the destination exported the disks over NBD, they are all
+     * copied by now and must not be sent along with RAM again */
+    if (mig->nbd && mig->nbd->port &&
+        spec->destType == MIGRATION_DEST_HOST &&
+        flags & (VIR_MIGRATE_NON_SHARED_DISK | VIR_MIGRATE_NON_SHARED_INC) &&
+        qemuCapsGet(priv->caps, QEMU_CAPS_DRIVE_MIRROR)) {
+        if (qemuMigrationDriveMirror(driver, vm, mig, spec->dest.host.name,
+                                     migrate_speed, flags) < 0)
+            goto cleanup;
+        mirrored = true;
+        flags &= ~(VIR_MIGRATE_NON_SHARED_DISK | VIR_MIGRATE_NON_SHARED_INC);
+    }
+
+    if (flags & VIR_MIGRATE_COMPRESSED &&
+        qemuMigrationSetCompression(driver, vm,
+                                    QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+        goto cleanup;
+
     if (qemuDomainObjEnterMonitorAsync(driver, vm,
                                        QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
         goto cleanup;
@@ -2248,6 +3617,7 @@ qemuMigrationRun(virQEMUDriverPtr driver,
         qemuDomainObjExitMonitorWithDriver(driver, vm);
         goto cleanup;
     }
+    priv->job.migSpeed = migrate_speed;
 
     if (flags & VIR_MIGRATE_NON_SHARED_DISK)
         migrate_flags |= QEMU_MONITOR_MIGRATE_NON_SHARED_DISK;
@@ -2361,6 +3731,11 @@ cleanup:
         VIR_FORCE_CLOSE(fd);
     }
 
+    /* Once the guest is paused the copies on the destination are
+     * complete; on failure they are of no use anyway */
+    if (mirrored)
+        qemuMigrationCancelDriveMirror(driver, vm);
+
     if (ret == 0 &&
         qemuMigrationBakeCookie(mig, driver, vm, cookieout, cookieoutlen,
                                 QEMU_MIGRATION_COOKIE_PERSISTENT |
@@ -2370,6 +3745,9 @@ cleanup:
 
     qemuMigrationCookieFree(mig);
 
+    qemuMigrationSchedLeave(driver, vm);
+    priv->job.migScheduled = false;
+
     if (orig_err) {
         virSetError(orig_err);
         virFreeError(orig_err);
@@ -3326,6 +4704,9 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
                                        cookieinlen, cookie_flags)))
         goto endjob;
 
+    /* Disks are up to date now, or the migration failed */
+    qemuMigrationStopNBDServer(driver, vm);
+
     /* Did the migration go as planned?  If yes, return the domain
      * object, but if no, clean up the empty qemu process.
      */
@@ -3697,7 +5078,10 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
     if (rc < 0)
         goto cleanup;
 
+    priv->job.path = path;
+    priv->job.pathOffset = offset;
     rc = qemuMigrationWaitForCompletion(driver, vm, asyncJob, NULL);
+    priv->job.path = NULL;
 
     if (rc < 0)
         goto cleanup;
@@ -37,7 +37,8 @@
      VIR_MIGRATE_NON_SHARED_INC |               \
      VIR_MIGRATE_CHANGE_PROTECTION |            \
      VIR_MIGRATE_UNSAFE |                       \
-     VIR_MIGRATE_OFFLINE)
+     VIR_MIGRATE_OFFLINE |                      \
+     VIR_MIGRATE_COMPRESSED)
 
 enum qemuMigrationJobPhase {
     QEMU_MIGRATION_PHASE_NONE = 0,
@@ -75,6 +76,13 @@ bool qemuMigrationJobIsActive(virDomainObjPtr vm,
 bool qemuMigrationJobFinish(virQEMUDriverPtr driver, virDomainObjPtr obj)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
+qemuMigrationSchedPtr qemuMigrationSchedNew(void);
+void qemuMigrationSchedFree(qemuMigrationSchedPtr sched);
+size_t qemuMigrationSchedGetPosition(virQEMUDriverPtr driver,
+                                     virDomainObjPtr vm)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+size_t qemuMigrationSchedCount(qemuMigrationSchedPtr sched);
+
 int qemuMigrationSetOffline(virQEMUDriverPtr driver,
                             virDomainObjPtr vm);
 
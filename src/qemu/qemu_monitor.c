@@ -37,6 +37,8 @@
 #include "virfile.h"
 #include "virprocess.h"
 #include "virobject.h"
+#include "virtime.h"
+#include "vireventthread.h"
 
 #ifdef WITH_DTRACE_PROBES
 # include "libvirt_qemu_probes.h"
@@ -56,6 +58,9 @@ struct _qemuMonitor {
     int fd;
     int watch;
     int hasSendFD;
+    /* Dedicated thread servicing the fd, or NULL for the main event
+     * loop.  Owned by the driver, which outlives the monitor */
+    virEventThreadPtr evt;
 
     virDomainObjPtr vm;
 
@@ -79,7 +84,23 @@ struct _qemuMonitor {
 
     unsigned json: 1;
     unsigned wait_greeting: 1;
+
+    /* Latency of the commands sent so far.  A job keeps lock held
+     * while it talks to qemu, so these have a lock of their own to
+     * stay readable while a command is stuck */
+    virMutex statsLock;
+    qemuMonitorCommandLatencyPtr latency;
+    size_t nlatency;
+    /* Name and start (ms) of the command waiting for its reply */
+    const char *inflight;
+    unsigned long long inflightStart;
+};
+
+static const unsigned long long qemuMonitorLatencyBounds[] = {
+    QEMU_MONITOR_LATENCY_BOUNDS
 };
+verify(ARRAY_CARDINALITY(qemuMonitorLatencyBounds) + 1 ==
+       QEMU_MONITOR_LATENCY_BUCKETS);
 
 static virClassPtr qemuMonitorClass;
 static void qemuMonitorDispose(void *obj);
@@ -101,6 +122,10 @@ VIR_ENUM_IMPL(qemuMonitorMigrationStatus,
               QEMU_MONITOR_MIGRATION_STATUS_LAST,
               "inactive", "active", "completed", "failed", "cancelled")
 
+VIR_ENUM_IMPL(qemuMonitorMigrationCaps,
+              QEMU_MONITOR_MIGRATION_CAPS_LAST,
+              "xbzrle")
+
 VIR_ENUM_IMPL(qemuMonitorVMStatus,
               QEMU_MONITOR_VM_STATUS_LAST,
               "debug", "inmigrate", "internal-error", "io-error", "paused",
@@ -243,6 +268,7 @@ void qemuMonitorUnlock(qemuMonitorPtr mon)
 static void qemuMonitorDispose(void *obj)
 {
     qemuMonitorPtr mon = obj;
+    size_t i;
 
     VIR_DEBUG("mon=%p", mon);
     if (mon->cb && mon->cb->destroy)
@@ -251,16 +277,28 @@ static void qemuMonitorDispose(void *obj)
     {}
     virMutexDestroy(&mon->lock);
     VIR_FREE(mon->buffer);
+
+    for (i = 0; i < mon->nlatency; i++)
+        VIR_FREE(mon->latency[i].name);
+    VIR_FREE(mon->latency);
+    virMutexDestroy(&mon->statsLock);
 }
 
 
+/* How long to wait for the monitor socket to show up (ms) */
+#define QEMU_MONITOR_OPEN_TIMEOUT    3000
+/* Longest pause between two connection attempts (ms) */
+#define QEMU_MONITOR_OPEN_POLL_MAX   200
+
 static int
 qemuMonitorOpenUnix(const char *monitor, pid_t cpid)
 {
     struct sockaddr_un addr;
     int monfd;
-    int timeout = 3; /* In seconds */
-    int ret, i = 0;
+    unsigned long long now;
+    unsigned long long deadline;
+    unsigned int delay = 1; /* In milliseconds */
+    int ret;
 
     if ((monfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
         virReportSystemError(errno,
@@ -276,24 +314,40 @@ qemuMonitorOpenUnix(const char *monitor, pid_t cpid)
         goto error;
     }
 
-    do {
+    if (virTimeMillisNow(&now) < 0)
+        goto error;
+    deadline = now + QEMU_MONITOR_OPEN_TIMEOUT;
+
+    /* Start polling often, so that a freshly started qemu is picked up
+     * as soon as its socket is there, and slow down if it takes long */
+    while (true) {
         ret = connect(monfd, (struct sockaddr *) &addr, sizeof(addr));
 
         if (ret == 0)
             break;
 
-        if ((errno == ENOENT || errno == ECONNREFUSED) &&
-            (!cpid || virProcessKill(cpid, 0) == 0)) {
-            /* ENOENT       : Socket may not have shown up yet
-             * ECONNREFUSED : Leftover socket hasn't been removed yet */
-            continue;
+        if ((errno != ENOENT && errno != ECONNREFUSED) ||
+            (cpid && virProcessKill(cpid, 0) != 0)) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to connect to monitor socket"));
+            goto error;
         }
 
-        virReportSystemError(errno, "%s",
-                             _("failed to connect to monitor socket"));
-        goto error;
+        /* ENOENT       : Socket may not have shown up yet
+         * ECONNREFUSED : Leftover socket hasn't been removed yet */
+        if (virTimeMillisNow(&now) < 0)
+            goto error;
+        if (now >= deadline)
+            break;
 
-    } while ((++i <= timeout*5) && (usleep(.2 * 1000000) <= 0));
+        if (delay > deadline - now)
+            delay = deadline - now;
+        usleep(delay * 1000);
+        if (delay < QEMU_MONITOR_OPEN_POLL_MAX)
+            delay *= 2;
+        if (delay > QEMU_MONITOR_OPEN_POLL_MAX)
+            delay = QEMU_MONITOR_OPEN_POLL_MAX;
+    }
 
     if (ret != 0) {
         virReportSystemError(errno, "%s",
@@ -334,8 +388,12 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
     qemuMonitorMessagePtr msg = NULL;
 
     /* See if there's a message & whether its ready for its reply
-     * ie whether its completed writing all its data */
-    if (mon->msg && mon->msg->txOffset == mon->msg->txLength)
+     * ie whether its completed writing all its data.  The commands
+     * at the start of a batch may be answered while the rest are
+     * still being written */
+    if (mon->msg &&
+        (mon->msg->txOffset == mon->msg->txLength ||
+         (mon->msg->nrxIds && mon->msg->txOffset > 0)))
         msg = mon->msg;
 
 #if DEBUG_IO
@@ -549,7 +607,20 @@ static void qemuMonitorUpdateWatch(qemuMonitorPtr mon)
             events |= VIR_EVENT_HANDLE_WRITABLE;
     }
 
-    virEventUpdateHandle(mon->watch, events);
+    if (mon->evt)
+        virEventThreadUpdateHandle(mon->evt, mon->watch, events);
+    else
+        virEventUpdateHandle(mon->watch, events);
+}
+
+
+static void qemuMonitorRemoveWatch(qemuMonitorPtr mon)
+{
+    if (mon->evt)
+        virEventThreadRemoveHandle(mon->evt, mon->watch);
+    else
+        virEventRemoveHandle(mon->watch);
+    mon->watch = 0;
 }
 
 
@@ -649,7 +720,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque) {
          * then wakeup that waiter */
         if (mon->msg && !mon->msg->finished) {
             mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+            virCondBroadcast(&mon->notify);
         }
     }
 
@@ -664,7 +735,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque) {
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         qemuMonitorUnlock(mon);
         virObjectUnref(mon);
         VIR_DEBUG("Triggering EOF callback");
@@ -675,7 +746,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque) {
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         qemuMonitorUnlock(mon);
         virObjectUnref(mon);
         VIR_DEBUG("Triggering error callback");
@@ -692,9 +763,13 @@ qemuMonitorOpenInternal(virDomainObjPtr vm,
                         int fd,
                         bool hasSendFD,
                         int json,
+                        virEventThreadPtr evt,
                         qemuMonitorCallbacksPtr cb)
 {
     qemuMonitorPtr mon;
+    int events = VIR_EVENT_HANDLE_HANGUP |
+        VIR_EVENT_HANDLE_ERROR |
+        VIR_EVENT_HANDLE_READABLE;
 
     if (!cb->eofNotify) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -726,10 +801,19 @@ qemuMonitorOpenInternal(virDomainObjPtr vm,
         VIR_FREE(mon);
         return NULL;
     }
+    if (virMutexInit(&mon->statsLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize monitor mutex"));
+        ignore_value(virCondDestroy(&mon->notify));
+        virMutexDestroy(&mon->lock);
+        VIR_FREE(mon);
+        return NULL;
+    }
     mon->fd = fd;
     mon->hasSendFD = hasSendFD;
     mon->vm = vm;
     mon->json = json;
+    mon->evt = evt;
     if (json)
         mon->wait_greeting = 1;
     mon->cb = cb;
@@ -747,13 +831,16 @@ qemuMonitorOpenInternal(virDomainObjPtr vm,
     }
 
 
-    if ((mon->watch = virEventAddHandle(mon->fd,
-                                        VIR_EVENT_HANDLE_HANGUP |
-                                        VIR_EVENT_HANDLE_ERROR |
-                                        VIR_EVENT_HANDLE_READABLE,
-                                        qemuMonitorIO,
-                                        mon,
-                                        virObjectFreeCallback)) < 0) {
+    if (evt)
+        mon->watch = virEventThreadAddHandle(evt, mon->fd, events,
+                                             qemuMonitorIO, mon,
+                                             virObjectFreeCallback);
+    else
+        mon->watch = virEventAddHandle(mon->fd, events,
+                                       qemuMonitorIO, mon,
+                                       virObjectFreeCallback);
+    if (mon->watch < 0) {
+        mon->watch = 0;
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("unable to register monitor events"));
         goto cleanup;
@@ -778,7 +865,7 @@ cleanup:
     /* The caller owns 'fd' on failure */
     mon->fd = -1;
     if (mon->watch)
-        virEventRemoveHandle(mon->watch);
+        qemuMonitorRemoveWatch(mon);
     qemuMonitorClose(mon);
     return NULL;
 }
@@ -787,6 +874,7 @@ qemuMonitorPtr
 qemuMonitorOpen(virDomainObjPtr vm,
                 virDomainChrSourceDefPtr config,
                 int json,
+                virEventThreadPtr evt,
                 qemuMonitorCallbacksPtr cb)
 {
     int fd;
@@ -812,7 +900,7 @@ qemuMonitorOpen(virDomainObjPtr vm,
         return NULL;
     }
 
-    ret = qemuMonitorOpenInternal(vm, fd, hasSendFD, json, cb);
+    ret = qemuMonitorOpenInternal(vm, fd, hasSendFD, json, evt, cb);
     if (!ret)
         VIR_FORCE_CLOSE(fd);
     return ret;
@@ -822,9 +910,10 @@ qemuMonitorOpen(virDomainObjPtr vm,
 qemuMonitorPtr qemuMonitorOpenFD(virDomainObjPtr vm,
                                  int sockfd,
                                  int json,
+                                 virEventThreadPtr evt,
                                  qemuMonitorCallbacksPtr cb)
 {
-    return qemuMonitorOpenInternal(vm, sockfd, true, json, cb);
+    return qemuMonitorOpenInternal(vm, sockfd, true, json, evt, cb);
 }
 
 
@@ -838,10 +927,8 @@ void qemuMonitorClose(qemuMonitorPtr mon)
           "mon=%p refs=%d", mon, mon->object.refs);
 
     if (mon->fd >= 0) {
-        if (mon->watch) {
-            virEventRemoveHandle(mon->watch);
-            mon->watch = 0;
-        }
+        if (mon->watch)
+            qemuMonitorRemoveWatch(mon);
         VIR_FORCE_CLOSE(mon->fd);
     }
 
@@ -863,7 +950,7 @@ void qemuMonitorClose(qemuMonitorPtr mon)
             }
         }
         mon->msg->finished = 1;
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
     }
 
     qemuMonitorUnlock(mon);
@@ -883,10 +970,59 @@ char *qemuMonitorNextCommandID(qemuMonitorPtr mon)
 }
 
 
+/* Account a command which took @elapsed ms to the statistics of its
+ * name.  Must be called with statsLock held.  */
+static void
+qemuMonitorRecordLatency(qemuMonitorPtr mon,
+                         const char *name,
+                         unsigned long long elapsed,
+                         bool failed)
+{
+    qemuMonitorCommandLatencyPtr cmd = NULL;
+    size_t i;
+
+    for (i = 0; i < mon->nlatency; i++) {
+        if (STREQ(mon->latency[i].name, name)) {
+            cmd = &mon->latency[i];
+            break;
+        }
+    }
+
+    if (!cmd) {
+        qemuMonitorCommandLatency tmp;
+
+        memset(&tmp, 0, sizeof(tmp));
+        /* statistics are best effort, losing them is not worth
+         * failing the command over */
+        if (!(tmp.name = strdup(name)) ||
+            VIR_APPEND_ELEMENT(mon->latency, mon->nlatency, tmp) < 0) {
+            VIR_FREE(tmp.name);
+            return;
+        }
+        cmd = &mon->latency[mon->nlatency - 1];
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(qemuMonitorLatencyBounds); i++) {
+        if (elapsed <= qemuMonitorLatencyBounds[i])
+            break;
+    }
+    cmd->buckets[i]++;
+    cmd->calls++;
+    if (failed)
+        cmd->errors++;
+    cmd->total += elapsed;
+    if (elapsed > cmd->max)
+        cmd->max = elapsed;
+}
+
+
 int qemuMonitorSend(qemuMonitorPtr mon,
                     qemuMonitorMessagePtr msg)
 {
     int ret = -1;
+    unsigned long long start = 0;
+    unsigned long long end;
+    const char *name = msg->txName ? msg->txName : "unknown";
 
     /* Check whether qemu quited unexpectedly */
     if (mon->lastError.code != VIR_ERR_OK) {
@@ -896,9 +1032,34 @@ int qemuMonitorSend(qemuMonitorPtr mon,
         return -1;
     }
 
+    /* Concurrent query jobs may share the monitor; only one message
+     * can be in flight at a time */
+    while (mon->msg) {
+        if (virCondWait(&mon->notify, &mon->lock) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to wait on monitor condition"));
+            return -1;
+        }
+    }
+
+    if (mon->lastError.code != VIR_ERR_OK) {
+        VIR_DEBUG("Attempt to send command while error is set %s",
+                  NULLSTR(mon->lastError.message));
+        virSetError(&mon->lastError);
+        return -1;
+    }
+
     mon->msg = msg;
     qemuMonitorUpdateWatch(mon);
 
+    /* the raw variant leaves the error of a failing command alone */
+    if (virTimeMillisNowRaw(&start) < 0)
+        start = 0;
+    virMutexLock(&mon->statsLock);
+    mon->inflight = name;
+    mon->inflightStart = start;
+    virMutexUnlock(&mon->statsLock);
+
     PROBE(QEMU_MONITOR_SEND_MSG,
           "mon=%p msg=%s fd=%d",
           mon, mon->msg->txBuffer, mon->msg->txFD);
@@ -921,8 +1082,16 @@ int qemuMonitorSend(qemuMonitorPtr mon,
     ret = 0;
 
 cleanup:
+    virMutexLock(&mon->statsLock);
+    if (start && virTimeMillisNowRaw(&end) == 0)
+        qemuMonitorRecordLatency(mon, name, end > start ? end - start : 0,
+                                 ret < 0);
+    mon->inflight = NULL;
+    virMutexUnlock(&mon->statsLock);
+
     mon->msg = NULL;
     qemuMonitorUpdateWatch(mon);
+    virCondBroadcast(&mon->notify);
 
     return ret;
 }
@@ -1290,6 +1459,26 @@ int qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
     return ret;
 }
 
+int qemuMonitorGetIOThreads(qemuMonitorPtr mon,
+                            int **pids)
+{
+    VIR_DEBUG("mon=%p", mon);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return -1;
+    }
+
+    if (!mon->json) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("JSON monitor is required"));
+        return -1;
+    }
+
+    return qemuMonitorJSONGetIOThreads(mon, pids);
+}
+
 int qemuMonitorSetLink(qemuMonitorPtr mon,
                        const char *name,
                        enum virDomainNetInterfaceLinkState state)
@@ -1370,6 +1559,56 @@ int qemuMonitorGetMemoryStats(qemuMonitorPtr mon,
     return ret;
 }
 
+/* Ask the balloon driver of the guest to push its statistics to qemu
+ * every @period seconds, or stop it with 0, so that reading them does
+ * not have to wait for the guest.  */
+int qemuMonitorSetMemoryStatsPeriod(qemuMonitorPtr mon,
+                                    const char *balloonAlias,
+                                    int period)
+{
+    VIR_DEBUG("mon=%p balloonAlias=%s period=%d", mon, balloonAlias, period);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return -1;
+    }
+
+    if (!mon->json) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("balloon statistics polling requires JSON monitor"));
+        return -1;
+    }
+
+    return qemuMonitorJSONSetMemoryStatsPeriod(mon, balloonAlias, period);
+}
+
+/* Read the last statistics the guest pushed to qemu after
+ * qemuMonitorSetMemoryStatsPeriod.  */
+int qemuMonitorGetGuestMemoryStats(qemuMonitorPtr mon,
+                                   const char *balloonAlias,
+                                   virDomainMemoryStatPtr stats,
+                                   unsigned int nr_stats)
+{
+    VIR_DEBUG("mon=%p balloonAlias=%s stats=%p nstats=%u",
+              mon, balloonAlias, stats, nr_stats);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return -1;
+    }
+
+    if (!mon->json) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("balloon statistics polling requires JSON monitor"));
+        return -1;
+    }
+
+    return qemuMonitorJSONGetGuestMemoryStats(mon, balloonAlias,
+                                              stats, nr_stats);
+}
+
 int
 qemuMonitorBlockIOStatusToError(const char *status)
 {
@@ -1485,6 +1724,174 @@ int qemuMonitorGetBlockStatsInfo(qemuMonitorPtr mon,
     return ret;
 }
 
+/* Fetch the statistics of all block devices with a single monitor
+ * command.  Returns a hash table of qemuBlockStats keyed by the
+ * device alias, or NULL on failure.
+ */
+virHashTablePtr
+qemuMonitorGetAllBlockStatsInfo(qemuMonitorPtr mon)
+{
+    int ret;
+    virHashTablePtr table;
+
+    VIR_DEBUG("mon=%p", mon);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return NULL;
+    }
+
+    if (!mon->json) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("bulk block statistics require a JSON monitor"));
+        return NULL;
+    }
+
+    if (!(table = virHashCreate(32, (virHashDataFree) free)))
+        return NULL;
+
+    ret = qemuMonitorJSONGetAllBlockStatsInfo(mon, table);
+
+    if (ret < 0) {
+        virHashFree(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+/* Fetch the statistics selected by @what, a set of
+ * qemuMonitorStatsFlags, sending all the queries they need at once.
+ * A query qemu fails to answer only leaves its flag out of
+ * @stats->fetched; -1 is returned if the monitor itself failed.
+ * @stats must be released with qemuMonitorStatsClear.
+ */
+int
+qemuMonitorGetStats(qemuMonitorPtr mon,
+                    unsigned int what,
+                    qemuMonitorStatsPtr stats)
+{
+    VIR_DEBUG("mon=%p what=%x", mon, what);
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return -1;
+    }
+
+    if (!mon->json) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("batched statistics require a JSON monitor"));
+        return -1;
+    }
+
+    return qemuMonitorJSONGetStats(mon, what, stats);
+}
+
+void
+qemuMonitorStatsClear(qemuMonitorStatsPtr stats)
+{
+    if (!stats)
+        return;
+
+    virHashFree(stats->blockstats);
+    memset(stats, 0, sizeof(*stats));
+}
+
+/* Copy the latency statistics of the commands @mon sent so far, and
+ * of the one it is waiting for, into @latency.  This does not need
+ * the monitor lock and may be used while a job is stuck in a
+ * command.  */
+int
+qemuMonitorGetLatency(qemuMonitorPtr mon,
+                      qemuMonitorLatencyPtr latency)
+{
+    unsigned long long now = 0;
+    size_t i;
+    int ret = -1;
+
+    memset(latency, 0, sizeof(*latency));
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    virMutexLock(&mon->statsLock);
+
+    if (VIR_ALLOC_N(latency->commands, mon->nlatency) < 0)
+        goto no_memory;
+    for (i = 0; i < mon->nlatency; i++) {
+        latency->commands[i] = mon->latency[i];
+        latency->commands[i].name = NULL;
+        latency->ncommands++;
+        if (!(latency->commands[i].name = strdup(mon->latency[i].name)))
+            goto no_memory;
+    }
+
+    if (mon->inflight) {
+        if (!(latency->inflight = strdup(mon->inflight)))
+            goto no_memory;
+        if (now > mon->inflightStart && mon->inflightStart)
+            latency->inflightTime = now - mon->inflightStart;
+    }
+
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&mon->statsLock);
+    if (ret < 0)
+        qemuMonitorLatencyClear(latency);
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    goto cleanup;
+}
+
+
+void
+qemuMonitorLatencyClear(qemuMonitorLatencyPtr latency)
+{
+    size_t i;
+
+    if (!latency)
+        return;
+
+    for (i = 0; i < latency->ncommands; i++)
+        VIR_FREE(latency->commands[i].name);
+    VIR_FREE(latency->commands);
+    VIR_FREE(latency->inflight);
+    memset(latency, 0, sizeof(*latency));
+}
+
+
+/* Estimate the latency (ms) @percent of the calls of @cmd stayed
+ * within: the upper bound of the bucket the percentile falls into,
+ * capped by the slowest call seen.  */
+unsigned long long
+qemuMonitorCommandLatencyPercentile(qemuMonitorCommandLatencyPtr cmd,
+                                    unsigned int percent)
+{
+    unsigned long long wanted;
+    unsigned long long seen = 0;
+    size_t i;
+
+    if (!cmd->calls)
+        return 0;
+
+    wanted = (cmd->calls * percent + 99) / 100;
+    for (i = 0; i < ARRAY_CARDINALITY(qemuMonitorLatencyBounds); i++) {
+        seen += cmd->buckets[i];
+        if (seen >= wanted)
+            return MIN(qemuMonitorLatencyBounds[i], cmd->max);
+    }
+
+    return cmd->max;
+}
+
+
 /* Return 0 and update @nparams with the number of block stats
  * QEMU supports if success. Return -1 if failure.
  */
@@ -1810,10 +2217,7 @@ int qemuMonitorSetMigrationDowntime(qemuMonitorPtr mon,
 
 
 int qemuMonitorGetMigrationStatus(qemuMonitorPtr mon,
-                                  int *status,
-                                  unsigned long long *transferred,
-                                  unsigned long long *remaining,
-                                  unsigned long long *total)
+                                  qemuMonitorMigrationStatusPtr status)
 {
     int ret;
     VIR_DEBUG("mon=%p", mon);
@@ -1824,20 +2228,107 @@ int qemuMonitorGetMigrationStatus(qemuMonitorPtr mon,
         return -1;
     }
 
+    memset(status, 0, sizeof(*status));
+
     if (mon->json)
-        ret = qemuMonitorJSONGetMigrationStatus(mon, status,
-                                                transferred,
-                                                remaining,
-                                                total);
+        ret = qemuMonitorJSONGetMigrationStatus(mon, status);
     else
-        ret = qemuMonitorTextGetMigrationStatus(mon, status,
-                                                transferred,
-                                                remaining,
-                                                total);
+        ret = qemuMonitorTextGetMigrationStatus(mon, &status->status,
+                                                &status->transferred,
+                                                &status->remaining,
+                                                &status->total);
     return ret;
 }
 
 
+/**
+ * qemuMonitorGetMigrationCapability:
+ *
+ * Returns 1 if @capability is supported, 0 if it is not, and -1 on
+ * error.
+ */
+int qemuMonitorGetMigrationCapability(qemuMonitorPtr mon,
+                                      qemuMonitorMigrationCaps capability)
+{
+    VIR_DEBUG("mon=%p capability=%d", mon, capability);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return -1;
+    }
+
+    /* No capability is supported without JSON monitor */
+    if (!mon->json)
+        return 0;
+
+    return qemuMonitorJSONGetMigrationCapability(mon, capability);
+}
+
+
+int qemuMonitorSetMigrationCapability(qemuMonitorPtr mon,
+                                      qemuMonitorMigrationCaps capability)
+{
+    VIR_DEBUG("mon=%p capability=%d", mon, capability);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return -1;
+    }
+
+    if (!mon->json) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("JSON monitor is required"));
+        return -1;
+    }
+
+    return qemuMonitorJSONSetMigrationCapability(mon, capability);
+}
+
+
+int qemuMonitorGetMigrationCacheSize(qemuMonitorPtr mon,
+                                     unsigned long long *cacheSize)
+{
+    VIR_DEBUG("mon=%p cacheSize=%p", mon, cacheSize);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return -1;
+    }
+
+    if (!mon->json) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("JSON monitor is required"));
+        return -1;
+    }
+
+    return qemuMonitorJSONGetMigrationCacheSize(mon, cacheSize);
+}
+
+
+int qemuMonitorSetMigrationCacheSize(qemuMonitorPtr mon,
+                                     unsigned long long cacheSize)
+{
+    VIR_DEBUG("mon=%p cacheSize=%llu", mon, cacheSize);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return -1;
+    }
+
+    if (!mon->json) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("JSON monitor is required"));
+        return -1;
+    }
+
+    return qemuMonitorJSONSetMigrationCacheSize(mon, cacheSize);
+}
+
+
 int qemuMonitorGetSpiceMigrationStatus(qemuMonitorPtr mon,
                                        bool *spice_migrated)
 {
@@ -3320,3 +3811,69 @@ char *qemuMonitorGetTargetArch(qemuMonitorPtr mon)
 
     return qemuMonitorJSONGetTargetArch(mon);
 }
+
+
+int qemuMonitorNBDServerStart(qemuMonitorPtr mon,
+                              const char *host,
+                              unsigned int port)
+{
+    VIR_DEBUG("mon=%p host=%s port=%u",
+              mon, host, port);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return -1;
+    }
+
+    if (!mon->json) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("JSON monitor is required"));
+        return -1;
+    }
+
+    return qemuMonitorJSONNBDServerStart(mon, host, port);
+}
+
+
+int qemuMonitorNBDServerAdd(qemuMonitorPtr mon,
+                            const char *deviceID,
+                            bool writable)
+{
+    VIR_DEBUG("mon=%p deviceID=%s writable=%d",
+              mon, deviceID, writable);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return -1;
+    }
+
+    if (!mon->json) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("JSON monitor is required"));
+        return -1;
+    }
+
+    return qemuMonitorJSONNBDServerAdd(mon, deviceID, writable);
+}
+
+
+int qemuMonitorNBDServerStop(qemuMonitorPtr mon)
+{
+    VIR_DEBUG("mon=%p", mon);
+
+    if (!mon) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("monitor must not be NULL"));
+        return -1;
+    }
+
+    if (!mon->json) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("JSON monitor is required"));
+        return -1;
+    }
+
+    return qemuMonitorJSONNBDServerStop(mon);
+}
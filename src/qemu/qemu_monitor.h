@@ -32,6 +32,7 @@
 # include "virhash.h"
 # include "json.h"
 # include "device_conf.h"
+# include "vireventthread.h"
 
 typedef struct _qemuMonitor qemuMonitor;
 typedef qemuMonitor *qemuMonitorPtr;
@@ -57,6 +58,18 @@ struct _qemuMonitorMessage {
     int rxLength;
     /* Used by the JSON monitor to hold reply / error */
     void *rxObject;
+    /* Optionally used by the JSON monitor to drop the parts of
+     * the "return" value nobody is going to look at; depth 1 is
+     * for the members of the value itself */
+    virJSONValueFilter rxFilter;
+    void *rxFilterOpaque;
+    /* Used by the JSON monitor when txBuffer holds a batch of
+     * several commands: their ids and the replies matched to them,
+     * in the order the commands were queued */
+    char **rxIds;
+    void **rxObjects;
+    size_t nrxIds;
+    size_t nrxPending;
 
     /* True if rxBuffer / rxObject are ready, or a
      * fatal error occurred on the monitor channel
@@ -65,6 +78,9 @@ struct _qemuMonitorMessage {
 
     qemuMonitorPasswordHandler passwordHandler;
     void *passwordOpaque;
+
+    /* Command name latency statistics are recorded under */
+    const char *txName;
 };
 
 typedef struct _qemuMonitorCallbacks qemuMonitorCallbacks;
@@ -146,13 +162,15 @@ char *qemuMonitorUnescapeArg(const char *in);
 qemuMonitorPtr qemuMonitorOpen(virDomainObjPtr vm,
                                virDomainChrSourceDefPtr config,
                                int json,
+                               virEventThreadPtr evt,
                                qemuMonitorCallbacksPtr cb)
-    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4);
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(5);
 qemuMonitorPtr qemuMonitorOpenFD(virDomainObjPtr vm,
                                  int sockfd,
                                  int json,
+                                 virEventThreadPtr evt,
                                  qemuMonitorCallbacksPtr cb)
-    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(4);
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(5);
 
 void qemuMonitorClose(qemuMonitorPtr mon);
 
@@ -250,6 +268,8 @@ int qemuMonitorSystemPowerdown(qemuMonitorPtr mon);
 
 int qemuMonitorGetCPUInfo(qemuMonitorPtr mon,
                           int **pids);
+int qemuMonitorGetIOThreads(qemuMonitorPtr mon,
+                            int **pids);
 int qemuMonitorGetVirtType(qemuMonitorPtr mon,
                            int *virtType);
 int qemuMonitorGetBalloonInfo(qemuMonitorPtr mon,
@@ -257,6 +277,13 @@ int qemuMonitorGetBalloonInfo(qemuMonitorPtr mon,
 int qemuMonitorGetMemoryStats(qemuMonitorPtr mon,
                               virDomainMemoryStatPtr stats,
                               unsigned int nr_stats);
+int qemuMonitorSetMemoryStatsPeriod(qemuMonitorPtr mon,
+                                    const char *balloonAlias,
+                                    int period);
+int qemuMonitorGetGuestMemoryStats(qemuMonitorPtr mon,
+                                   const char *balloonAlias,
+                                   virDomainMemoryStatPtr stats,
+                                   unsigned int nr_stats);
 
 int qemuMonitorBlockIOStatusToError(const char *status);
 virHashTablePtr qemuMonitorGetBlockInfo(qemuMonitorPtr mon);
@@ -278,6 +305,79 @@ int qemuMonitorGetBlockStatsInfo(qemuMonitorPtr mon,
 int qemuMonitorGetBlockStatsParamsNumber(qemuMonitorPtr mon,
                                          int *nparams);
 
+typedef struct _qemuBlockStats qemuBlockStats;
+typedef qemuBlockStats *qemuBlockStatsPtr;
+struct _qemuBlockStats {
+    long long rd_req;
+    long long rd_bytes;
+    long long rd_total_times;
+    long long wr_req;
+    long long wr_bytes;
+    long long wr_total_times;
+    long long flush_req;
+    long long flush_total_times;
+};
+
+virHashTablePtr qemuMonitorGetAllBlockStatsInfo(qemuMonitorPtr mon);
+
+typedef enum {
+    QEMU_MONITOR_STATS_BLOCK   = (1 << 0), /* query-blockstats */
+    QEMU_MONITOR_STATS_BALLOON = (1 << 1), /* query-balloon */
+} qemuMonitorStatsFlags;
+
+typedef struct _qemuMonitorStats qemuMonitorStats;
+typedef qemuMonitorStats *qemuMonitorStatsPtr;
+struct _qemuMonitorStats {
+    /* qemuMonitorStatsFlags qemu did provide */
+    unsigned int fetched;
+
+    /* qemuBlockStats keyed by the device alias */
+    virHashTablePtr blockstats;
+    /* current balloon size in KiB */
+    unsigned long long balloon;
+};
+
+int qemuMonitorGetStats(qemuMonitorPtr mon,
+                        unsigned int what,
+                        qemuMonitorStatsPtr stats)
+    ATTRIBUTE_NONNULL(3);
+void qemuMonitorStatsClear(qemuMonitorStatsPtr stats);
+
+/* Upper bounds (ms) of the latency buckets but the last one */
+# define QEMU_MONITOR_LATENCY_BOUNDS \
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 5000
+# define QEMU_MONITOR_LATENCY_BUCKETS 12
+
+typedef struct _qemuMonitorCommandLatency qemuMonitorCommandLatency;
+typedef qemuMonitorCommandLatency *qemuMonitorCommandLatencyPtr;
+struct _qemuMonitorCommandLatency {
+    char *name;
+    unsigned long long calls;
+    unsigned long long errors;
+    unsigned long long total;   /* ms */
+    unsigned long long max;     /* ms */
+    unsigned long long buckets[QEMU_MONITOR_LATENCY_BUCKETS];
+};
+
+typedef struct _qemuMonitorLatency qemuMonitorLatency;
+typedef qemuMonitorLatency *qemuMonitorLatencyPtr;
+struct _qemuMonitorLatency {
+    qemuMonitorCommandLatencyPtr commands;
+    size_t ncommands;
+
+    /* Command still waiting for its reply, if any */
+    char *inflight;
+    unsigned long long inflightTime;    /* ms */
+};
+
+int qemuMonitorGetLatency(qemuMonitorPtr mon,
+                          qemuMonitorLatencyPtr latency)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+void qemuMonitorLatencyClear(qemuMonitorLatencyPtr latency);
+unsigned long long
+qemuMonitorCommandLatencyPercentile(qemuMonitorCommandLatencyPtr cmd,
+                                    unsigned int percent);
+
 int qemuMonitorGetBlockExtent(qemuMonitorPtr mon,
                               const char *dev_name,
                               unsigned long long *extent);
@@ -338,14 +438,46 @@ enum {
 
 VIR_ENUM_DECL(qemuMonitorMigrationStatus)
 
+typedef struct _qemuMonitorMigrationStatus qemuMonitorMigrationStatus;
+typedef qemuMonitorMigrationStatus *qemuMonitorMigrationStatusPtr;
+struct _qemuMonitorMigrationStatus {
+    int status;
+    unsigned long long transferred;
+    unsigned long long remaining;
+    unsigned long long total;
+
+    /* Only reported while XBZRLE compression is enabled */
+    bool xbzrle_set;
+    unsigned long long xbzrle_cache_size;
+    unsigned long long xbzrle_bytes;
+    unsigned long long xbzrle_pages;
+    unsigned long long xbzrle_cache_miss;
+    unsigned long long xbzrle_overflow;
+};
+
 int qemuMonitorGetMigrationStatus(qemuMonitorPtr mon,
-                                  int *status,
-                                  unsigned long long *transferred,
-                                  unsigned long long *remaining,
-                                  unsigned long long *total);
+                                  qemuMonitorMigrationStatusPtr status);
 int qemuMonitorGetSpiceMigrationStatus(qemuMonitorPtr mon,
                                        bool *spice_migrated);
 
+typedef enum {
+    QEMU_MONITOR_MIGRATION_CAPS_XBZRLE,
+
+    QEMU_MONITOR_MIGRATION_CAPS_LAST
+} qemuMonitorMigrationCaps;
+
+VIR_ENUM_DECL(qemuMonitorMigrationCaps)
+
+int qemuMonitorGetMigrationCapability(qemuMonitorPtr mon,
+                                      qemuMonitorMigrationCaps capability);
+int qemuMonitorSetMigrationCapability(qemuMonitorPtr mon,
+                                      qemuMonitorMigrationCaps capability);
+
+int qemuMonitorGetMigrationCacheSize(qemuMonitorPtr mon,
+                                     unsigned long long *cacheSize);
+int qemuMonitorSetMigrationCacheSize(qemuMonitorPtr mon,
+                                     unsigned long long cacheSize);
+
 typedef enum {
   QEMU_MONITOR_MIGRATE_BACKGROUND	= 1 << 0,
   QEMU_MONITOR_MIGRATE_NON_SHARED_DISK  = 1 << 1, /* migration with non-shared storage with full disk copy */
@@ -631,6 +763,14 @@ int qemuMonitorGetObjectProps(qemuMonitorPtr mon,
                               char ***props);
 char *qemuMonitorGetTargetArch(qemuMonitorPtr mon);
 
+int qemuMonitorNBDServerStart(qemuMonitorPtr mon,
+                              const char *host,
+                              unsigned int port);
+int qemuMonitorNBDServerAdd(qemuMonitorPtr mon,
+                            const char *deviceID,
+                            bool writable);
+int qemuMonitorNBDServerStop(qemuMonitorPtr mon);
+
 /**
  * When running two dd process and using <> redirection, we need a
  * shell that will not truncate files.  These two strings serve that
@@ -137,6 +137,62 @@ qemuMonitorJSONIOProcessEvent(qemuMonitorPtr mon,
     return 0;
 }
 
+struct qemuMonitorJSONReplyFilterData {
+    qemuMonitorMessagePtr msg;
+    bool inReturn;
+};
+
+/* Apply the pending command's filter to the "return" member only,
+ * the line may as well turn out to be an event */
+static bool
+qemuMonitorJSONReplyFilter(const char *key,
+                           unsigned int depth,
+                           void *opaque)
+{
+    struct qemuMonitorJSONReplyFilterData *data = opaque;
+
+    if (depth == 1) {
+        data->inReturn = STREQ(key, "return");
+        return true;
+    }
+
+    if (!data->inReturn)
+        return true;
+
+    return data->msg->rxFilter(key, depth - 1, data->msg->rxFilterOpaque);
+}
+
+/* Hand a reply to the command of the batch @msg it belongs to.  QMP
+ * answers commands in order, so a reply without an id, as sent for
+ * commands qemu failed to parse, goes to the oldest command still
+ * waiting for one */
+static int
+qemuMonitorJSONIOProcessBatchReply(qemuMonitorMessagePtr msg,
+                                   virJSONValuePtr obj,
+                                   const char *line)
+{
+    const char *id = virJSONValueObjectGetString(obj, "id");
+    size_t i;
+
+    for (i = 0; i < msg->nrxIds; i++) {
+        if (msg->rxObjects[i])
+            continue;
+        if (!id || STREQ(id, msg->rxIds[i]))
+            break;
+    }
+
+    if (i == msg->nrxIds) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected JSON reply '%s'"), line);
+        return -1;
+    }
+
+    msg->rxObjects[i] = obj;
+    if (--msg->nrxPending == 0)
+        msg->finished = 1;
+    return 0;
+}
+
 static int
 qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
                              const char *line,
@@ -147,7 +203,16 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
 
     VIR_DEBUG("Line [%s]", line);
 
-    if (!(obj = virJSONValueFromString(line)))
+    if (msg && msg->rxFilter) {
+        struct qemuMonitorJSONReplyFilterData data = { msg, false };
+
+        obj = virJSONValueFromStringFiltered(line,
+                                             qemuMonitorJSONReplyFilter,
+                                             &data);
+    } else {
+        obj = virJSONValueFromString(line);
+    }
+    if (!obj)
         goto cleanup;
 
     if (obj->type != VIR_JSON_TYPE_OBJECT) {
@@ -166,7 +231,11 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
                virJSONValueObjectHasKey(obj, "return") == 1) {
         PROBE(QEMU_MONITOR_RECV_REPLY,
               "mon=%p reply=%s", mon, line);
-        if (msg) {
+        if (msg && msg->nrxIds) {
+            if ((ret = qemuMonitorJSONIOProcessBatchReply(msg, obj,
+                                                          line)) == 0)
+                obj = NULL;
+        } else if (msg) {
             msg->rxObject = obj;
             msg->finished = 1;
             obj = NULL;
@@ -221,10 +290,12 @@ int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
 }
 
 static int
-qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
-                             virJSONValuePtr cmd,
-                             int scm_fd,
-                             virJSONValuePtr *reply)
+qemuMonitorJSONCommandFull(qemuMonitorPtr mon,
+                           virJSONValuePtr cmd,
+                           int scm_fd,
+                           virJSONValueFilter filter,
+                           void *filterOpaque,
+                           virJSONValuePtr *reply)
 {
     int ret = -1;
     qemuMonitorMessage msg;
@@ -235,6 +306,8 @@ qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
     *reply = NULL;
 
     memset(&msg, 0, sizeof(msg));
+    msg.rxFilter = filter;
+    msg.rxFilterOpaque = filterOpaque;
 
     exe = virJSONValueObjectGet(cmd, "execute");
     if (exe) {
@@ -257,6 +330,7 @@ qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
     }
     msg.txLength = strlen(msg.txBuffer);
     msg.txFD = scm_fd;
+    msg.txName = virJSONValueObjectGetString(cmd, "execute");
 
     VIR_DEBUG("Send command '%s' for write with FD %d", cmdstr, scm_fd);
 
@@ -285,6 +359,105 @@ cleanup:
 }
 
 
+/* Send the @ncmds commands in @cmds to qemu in a single write and
+ * wait until all of them are answered, so that independent queries
+ * cost one round trip.  The replies are stored in @replies in the
+ * order of @cmds; unlike after qemuMonitorJSONCommand, each of them
+ * still has to be checked for errors by the caller.  */
+static int
+qemuMonitorJSONCommandBatch(qemuMonitorPtr mon,
+                            virJSONValuePtr *cmds,
+                            size_t ncmds,
+                            virJSONValuePtr *replies)
+{
+    int ret = -1;
+    qemuMonitorMessage msg;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *cmdstr = NULL;
+    size_t i;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(replies, 0, sizeof(*replies) * ncmds);
+
+    if (ncmds == 0)
+        return 0;
+
+    if (VIR_ALLOC_N(msg.rxIds, ncmds) < 0 ||
+        VIR_ALLOC_N(msg.rxObjects, ncmds) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    msg.nrxIds = ncmds;
+
+    for (i = 0; i < ncmds; i++) {
+        if (!(msg.rxIds[i] = qemuMonitorNextCommandID(mon)))
+            goto cleanup;
+        if (virJSONValueObjectAppendString(cmds[i], "id", msg.rxIds[i]) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to append command 'id' string"));
+            goto cleanup;
+        }
+
+        if (!(cmdstr = virJSONValueToString(cmds[i], false))) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        VIR_DEBUG("Queue command '%s' in batch of %zu", cmdstr, ncmds);
+        virBufferAsprintf(&buf, "%s\r\n", cmdstr);
+        VIR_FREE(cmdstr);
+    }
+
+    if (virBufferError(&buf)) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    msg.txBuffer = virBufferContentAndReset(&buf);
+    msg.txLength = strlen(msg.txBuffer);
+    msg.txFD = -1;
+    msg.txName = "batch";
+    msg.nrxPending = ncmds;
+
+    if (qemuMonitorSend(mon, &msg) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ncmds; i++) {
+        if (!msg.rxObjects[i]) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Missing monitor reply object"));
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < ncmds; i++) {
+        replies[i] = msg.rxObjects[i];
+        msg.rxObjects[i] = NULL;
+    }
+    ret = 0;
+
+cleanup:
+    for (i = 0; i < msg.nrxIds; i++) {
+        VIR_FREE(msg.rxIds[i]);
+        virJSONValueFree(msg.rxObjects[i]);
+    }
+    VIR_FREE(msg.rxIds);
+    VIR_FREE(msg.rxObjects);
+    VIR_FREE(msg.txBuffer);
+    VIR_FREE(cmdstr);
+    virBufferFreeAndReset(&buf);
+    return ret;
+}
+
+
+static int
+qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
+                             virJSONValuePtr cmd,
+                             int scm_fd,
+                             virJSONValuePtr *reply)
+{
+    return qemuMonitorJSONCommandFull(mon, cmd, scm_fd, NULL, NULL, reply);
+}
+
+
 static int
 qemuMonitorJSONCommand(qemuMonitorPtr mon,
                        virJSONValuePtr cmd,
@@ -292,6 +465,21 @@ qemuMonitorJSONCommand(qemuMonitorPtr mon,
     return qemuMonitorJSONCommandWithFd(mon, cmd, -1, reply);
 }
 
+
+/*
+ * Run @cmd, building only the parts of the "return" value that
+ * @filter accepts. Large replies polled often, such as
+ * query-blockstats, carry plenty of data we never read.
+ */
+static int
+qemuMonitorJSONCommandFiltered(qemuMonitorPtr mon,
+                               virJSONValuePtr cmd,
+                               virJSONValueFilter filter,
+                               virJSONValuePtr *reply)
+{
+    return qemuMonitorJSONCommandFull(mon, cmd, -1, filter, NULL, reply);
+}
+
 /* Ignoring OOM in this method, since we're already reporting
  * a more important error
  *
@@ -1245,6 +1433,16 @@ cleanup:
 }
 
 
+/* Only the vCPU number and thread ID of each entry are used */
+static bool
+qemuMonitorJSONCPUInfoFilter(const char *key,
+                             unsigned int depth,
+                             void *opaque ATTRIBUTE_UNUSED)
+{
+    return depth != 2 || STREQ(key, "CPU") || STREQ(key, "thread_id");
+}
+
+
 int qemuMonitorJSONGetCPUInfo(qemuMonitorPtr mon,
                               int **pids)
 {
@@ -1258,7 +1456,9 @@ int qemuMonitorJSONGetCPUInfo(qemuMonitorPtr mon,
     if (!cmd)
         return -1;
 
-    ret = qemuMonitorJSONCommand(mon, cmd, &reply);
+    ret = qemuMonitorJSONCommandFiltered(mon, cmd,
+                                         qemuMonitorJSONCPUInfoFilter,
+                                         &reply);
 
     if (ret == 0)
         ret = qemuMonitorJSONCheckError(cmd, reply);
@@ -1272,6 +1472,100 @@ int qemuMonitorJSONGetCPUInfo(qemuMonitorPtr mon,
 }
 
 
+/*
+ * Fill @pids with the host thread IDs of the iothread objects, indexed
+ * by their number minus one, so that "iothread1" lands at pids[0].
+ * Returns the number of iothreads or -1 on error.
+ */
+static int
+qemuMonitorJSONExtractIOThreads(virJSONValuePtr reply,
+                                int **pids)
+{
+    virJSONValuePtr data;
+    int *threads = NULL;
+    int n;
+    int ret = -1;
+    int i;
+
+    if (!(data = virJSONValueObjectGet(reply, "return")) ||
+        data->type != VIR_JSON_TYPE_ARRAY) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-iothreads reply was missing return data"));
+        goto cleanup;
+    }
+
+    if ((n = virJSONValueArraySize(data)) <= 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(threads, n) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < n ; i++) {
+        virJSONValuePtr entry = virJSONValueArrayGet(data, i);
+        const char *id;
+        unsigned int idx;
+        int thread;
+
+        if (!entry ||
+            !(id = virJSONValueObjectGetString(entry, "id")) ||
+            virJSONValueObjectGetNumberInt(entry, "thread-id", &thread) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed iothread entry in query-iothreads "
+                             "reply"));
+            goto cleanup;
+        }
+
+        if (!STRPREFIX(id, "iothread") ||
+            virStrToLong_ui(id + strlen("iothread"), NULL, 10, &idx) < 0 ||
+            idx == 0 || idx > (unsigned int) n) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("unexpected iothread id '%s'"), id);
+            goto cleanup;
+        }
+
+        threads[idx - 1] = thread;
+    }
+
+    *pids = threads;
+    threads = NULL;
+    ret = n;
+
+cleanup:
+    VIR_FREE(threads);
+    return ret;
+}
+
+
+int qemuMonitorJSONGetIOThreads(qemuMonitorPtr mon,
+                                int **pids)
+{
+    int ret;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    *pids = NULL;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("query-iothreads", NULL)))
+        return -1;
+
+    ret = qemuMonitorJSONCommand(mon, cmd, &reply);
+
+    if (ret == 0)
+        ret = qemuMonitorJSONCheckError(cmd, reply);
+
+    if (ret == 0)
+        ret = qemuMonitorJSONExtractIOThreads(reply, pids);
+
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
 int qemuMonitorJSONGetVirtType(qemuMonitorPtr mon,
                                int *virtType)
 {
@@ -1318,6 +1612,41 @@ cleanup:
 }
 
 
+static int
+qemuMonitorJSONExtractBalloonInfo(virJSONValuePtr cmd,
+                                  virJSONValuePtr reply,
+                                  unsigned long long *currmem)
+{
+    virJSONValuePtr data;
+    unsigned long long mem;
+
+    *currmem = 0;
+
+    /* See if balloon soft-failed */
+    if (qemuMonitorJSONHasError(reply, "DeviceNotActive") ||
+        qemuMonitorJSONHasError(reply, "KVMMissingCap"))
+        return 0;
+
+    /* See if any other fatal error occurred */
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        return -1;
+
+    if (!(data = virJSONValueObjectGet(reply, "return"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("info balloon reply was missing return data"));
+        return -1;
+    }
+
+    if (virJSONValueObjectGetNumberUlong(data, "actual", &mem) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("info balloon reply was missing balloon data"));
+        return -1;
+    }
+
+    *currmem = (mem/1024);
+    return 1;
+}
+
 /*
  * Returns: 0 if balloon not supported, +1 if balloon query worked
  * or -1 on failure
@@ -1337,40 +1666,9 @@ int qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
 
     ret = qemuMonitorJSONCommand(mon, cmd, &reply);
 
-    if (ret == 0) {
-        /* See if balloon soft-failed */
-        if (qemuMonitorJSONHasError(reply, "DeviceNotActive") ||
-            qemuMonitorJSONHasError(reply, "KVMMissingCap"))
-            goto cleanup;
-
-        /* See if any other fatal error occurred */
-        ret = qemuMonitorJSONCheckError(cmd, reply);
-
-        /* Success */
-        if (ret == 0) {
-            virJSONValuePtr data;
-            unsigned long long mem;
-
-            if (!(data = virJSONValueObjectGet(reply, "return"))) {
-                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                               _("info balloon reply was missing return data"));
-                ret = -1;
-                goto cleanup;
-            }
-
-            if (virJSONValueObjectGetNumberUlong(data, "actual", &mem) < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                               _("info balloon reply was missing balloon data"));
-                ret = -1;
-                goto cleanup;
-            }
-
-            *currmem = (mem/1024);
-            ret = 1;
-        }
-    }
+    if (ret == 0)
+        ret = qemuMonitorJSONExtractBalloonInfo(cmd, reply, currmem);
 
-cleanup:
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
@@ -1504,6 +1802,114 @@ cleanup:
 }
 
 
+/* QOM path of the balloon device, which is named after its alias */
+#define QEMU_MONITOR_JSON_PERIPHERAL "/machine/peripheral/"
+
+int qemuMonitorJSONSetMemoryStatsPeriod(qemuMonitorPtr mon,
+                                        const char *balloonAlias,
+                                        int period)
+{
+    int ret = -1;
+    char *path = NULL;
+    virJSONValuePtr cmd = NULL;
+    virJSONValuePtr reply = NULL;
+
+    if (virAsprintf(&path, "%s%s",
+                    QEMU_MONITOR_JSON_PERIPHERAL, balloonAlias) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("qom-set",
+                                           "s:path", path,
+                                           "s:property",
+                                           "guest-stats-polling-interval",
+                                           "i:value", period,
+                                           NULL)))
+        goto cleanup;
+
+    ret = qemuMonitorJSONCommand(mon, cmd, &reply);
+
+    if (ret == 0)
+        ret = qemuMonitorJSONCheckError(cmd, reply);
+
+cleanup:
+    VIR_FREE(path);
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+int qemuMonitorJSONGetGuestMemoryStats(qemuMonitorPtr mon,
+                                       const char *balloonAlias,
+                                       virDomainMemoryStatPtr stats,
+                                       unsigned int nr_stats)
+{
+    static const struct {
+        const char *name;
+        int tag;
+        unsigned int divisor;   /* qemu reports sizes in bytes */
+    } fields[] = {
+        { "stat-swap-in", VIR_DOMAIN_MEMORY_STAT_SWAP_IN, 1024 },
+        { "stat-swap-out", VIR_DOMAIN_MEMORY_STAT_SWAP_OUT, 1024 },
+        { "stat-major-faults", VIR_DOMAIN_MEMORY_STAT_MAJOR_FAULT, 1 },
+        { "stat-minor-faults", VIR_DOMAIN_MEMORY_STAT_MINOR_FAULT, 1 },
+        { "stat-free-memory", VIR_DOMAIN_MEMORY_STAT_UNUSED, 1024 },
+        { "stat-total-memory", VIR_DOMAIN_MEMORY_STAT_AVAILABLE, 1024 },
+    };
+    int ret = -1;
+    int got = 0;
+    size_t i;
+    char *path = NULL;
+    virJSONValuePtr cmd = NULL;
+    virJSONValuePtr reply = NULL;
+    virJSONValuePtr data;
+
+    if (virAsprintf(&path, "%s%s",
+                    QEMU_MONITOR_JSON_PERIPHERAL, balloonAlias) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("qom-get",
+                                           "s:path", path,
+                                           "s:property", "guest-stats",
+                                           NULL)))
+        goto cleanup;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0 ||
+        qemuMonitorJSONCheckError(cmd, reply) < 0)
+        goto cleanup;
+
+    if (!(data = virJSONValueObjectGet(reply, "return")) ||
+        !(data = virJSONValueObjectGet(data, "stats"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("guest-stats reply was missing stats data"));
+        goto cleanup;
+    }
+
+    /* Statistics the guest does not provide are reported as -1 */
+    for (i = 0; i < ARRAY_CARDINALITY(fields) && got < nr_stats; i++) {
+        long long val;
+
+        if (virJSONValueObjectGetNumberLong(data, fields[i].name, &val) < 0 ||
+            val < 0)
+            continue;
+        stats[got].tag = fields[i].tag;
+        stats[got].val = val / fields[i].divisor;
+        got++;
+    }
+
+    ret = got;
+
+cleanup:
+    VIR_FREE(path);
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
 int qemuMonitorJSONGetBlockInfo(qemuMonitorPtr mon,
                                 virHashTablePtr table)
 {
@@ -1601,6 +2007,17 @@ cleanup:
 }
 
 
+/* The stats of the backing "parent" are only needed for the
+ * block extent */
+static bool
+qemuMonitorJSONBlockStatsFilter(const char *key,
+                                unsigned int depth,
+                                void *opaque ATTRIBUTE_UNUSED)
+{
+    return depth != 2 || STRNEQ(key, "parent");
+}
+
+
 int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
                                      const char *dev_name,
                                      long long *rd_req,
@@ -1615,11 +2032,32 @@ int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
 {
     int ret;
     int i;
+    size_t j;
     int found = 0;
     virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-blockstats",
                                                      NULL);
     virJSONValuePtr reply = NULL;
     virJSONValuePtr devices;
+    virJSONValueObjectField fields[] = {
+        { "rd_bytes", NULL },
+        { "rd_operations", NULL },
+        { "rd_total_time_ns", NULL },
+        { "wr_bytes", NULL },
+        { "wr_operations", NULL },
+        { "wr_total_time_ns", NULL },
+        { "flush_operations", NULL },
+        { "flush_total_time_ns", NULL },
+    };
+    long long *values[] = {
+        rd_bytes, rd_req, rd_total_times,
+        wr_bytes, wr_req, wr_total_times,
+        flush_req, flush_total_times,
+    };
+    const bool optional[] = {
+        false, false, true,
+        false, false, true,
+        true, true,
+    };
 
     *rd_req = *rd_bytes = -1;
     *wr_req = *wr_bytes = *errs = -1;
@@ -1636,7 +2074,9 @@ int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
     if (!cmd)
         return -1;
 
-    ret = qemuMonitorJSONCommand(mon, cmd, &reply);
+    ret = qemuMonitorJSONCommandFiltered(mon, cmd,
+                                         qemuMonitorJSONBlockStatsFilter,
+                                         &reply);
 
     if (ret == 0)
         ret = qemuMonitorJSONCheckError(cmd, reply);
@@ -1685,78 +2125,239 @@ int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
             goto cleanup;
         }
 
-        if (virJSONValueObjectGetNumberLong(stats, "rd_bytes", rd_bytes) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "rd_bytes");
-            goto cleanup;
-        }
-        if (virJSONValueObjectGetNumberLong(stats, "rd_operations", rd_req) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                            "rd_operations");
+        if (virJSONValueObjectGetFields(stats, fields,
+                                        ARRAY_CARDINALITY(fields)) < 0)
             goto cleanup;
+
+        for (j = 0 ; j < ARRAY_CARDINALITY(fields) ; j++) {
+            /* Only the basic counters are reported by every QEMU */
+            if (!values[j] || (!fields[j].value && optional[j]))
+                continue;
+
+            if (!fields[j].value ||
+                virJSONValueGetNumberLong(fields[j].value, values[j]) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("cannot read %s statistic"),
+                               fields[j].key);
+                goto cleanup;
+            }
         }
-        if (rd_total_times &&
-            virJSONValueObjectHasKey(stats, "rd_total_time_ns") &&
-            (virJSONValueObjectGetNumberLong(stats, "rd_total_time_ns",
-                                             rd_total_times) < 0)) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "rd_total_time_ns");
-            goto cleanup;
+    }
+
+    if (!found) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot find statistics for device '%s'"), dev_name);
+        goto cleanup;
+    }
+    ret = 0;
+
+cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+/* Read a statistic into @value; an @optional one that QEMU does not
+ * report is left at -1. */
+static int
+qemuMonitorJSONGetBlockStatsField(virJSONValuePtr stats,
+                                  const char *name,
+                                  bool optional,
+                                  long long *value)
+{
+    *value = -1;
+
+    if (optional && !virJSONValueObjectHasKey(stats, name))
+        return 0;
+
+    if (virJSONValueObjectGetNumberLong(stats, name, value) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot read %s statistic"), name);
+        return -1;
+    }
+    return 0;
+}
+
+
+static int
+qemuMonitorJSONExtractAllBlockStats(virJSONValuePtr cmd,
+                                    virJSONValuePtr reply,
+                                    virHashTablePtr table)
+{
+    int i;
+    virJSONValuePtr devices;
+
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        return -1;
+
+    devices = virJSONValueObjectGet(reply, "return");
+    if (!devices || devices->type != VIR_JSON_TYPE_ARRAY) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("blockstats reply was missing device list"));
+        return -1;
+    }
+
+    for (i = 0 ; i < virJSONValueArraySize(devices) ; i++) {
+        virJSONValuePtr dev = virJSONValueArrayGet(devices, i);
+        virJSONValuePtr stats;
+        qemuBlockStatsPtr bstats;
+        const char *thisdev;
+
+        if (!dev || dev->type != VIR_JSON_TYPE_OBJECT) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("blockstats device entry was not in expected format"));
+            return -1;
         }
-        if (virJSONValueObjectGetNumberLong(stats, "wr_bytes", wr_bytes) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "wr_bytes");
-            goto cleanup;
+
+        if ((thisdev = virJSONValueObjectGetString(dev, "device")) == NULL) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("blockstats device entry was not in expected format"));
+            return -1;
         }
-        if (virJSONValueObjectGetNumberLong(stats, "wr_operations", wr_req) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "wr_operations");
-            goto cleanup;
+
+        if (STRPREFIX(thisdev, QEMU_DRIVE_HOST_PREFIX))
+            thisdev += strlen(QEMU_DRIVE_HOST_PREFIX);
+
+        if ((stats = virJSONValueObjectGet(dev, "stats")) == NULL ||
+            stats->type != VIR_JSON_TYPE_OBJECT) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("blockstats stats entry was not in expected format"));
+            return -1;
         }
-        if (wr_total_times &&
-            virJSONValueObjectHasKey(stats, "wr_total_time_ns") &&
-            (virJSONValueObjectGetNumberLong(stats, "wr_total_time_ns",
-                                             wr_total_times) < 0)) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "wr_total_time_ns");
-            goto cleanup;
+
+        if (VIR_ALLOC(bstats) < 0) {
+            virReportOOMError();
+            return -1;
         }
-        if (flush_req &&
-            virJSONValueObjectHasKey(stats, "flush_operations") &&
-            (virJSONValueObjectGetNumberLong(stats, "flush_operations",
-                                            flush_req) < 0)) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "flush_operations");
-            goto cleanup;
+
+        if (virHashAddEntry(table, thisdev, bstats) < 0) {
+            VIR_FREE(bstats);
+            return -1;
         }
-        if (flush_total_times &&
-            virJSONValueObjectHasKey(stats, "flush_total_time_ns") &&
-            (virJSONValueObjectGetNumberLong(stats, "flush_total_time_ns",
-                                            flush_total_times) < 0)) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                           _("cannot read %s statistic"),
-                           "flush_total_time_ns");
+
+        if (qemuMonitorJSONGetBlockStatsField(stats, "rd_bytes", false,
+                                              &bstats->rd_bytes) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "rd_operations", false,
+                                              &bstats->rd_req) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "rd_total_time_ns", true,
+                                              &bstats->rd_total_times) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "wr_bytes", false,
+                                              &bstats->wr_bytes) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "wr_operations", false,
+                                              &bstats->wr_req) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "wr_total_time_ns", true,
+                                              &bstats->wr_total_times) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "flush_operations", true,
+                                              &bstats->flush_req) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "flush_total_time_ns", true,
+                                              &bstats->flush_total_times) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+int qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                        virHashTablePtr table)
+{
+    int ret;
+    virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-blockstats",
+                                                     NULL);
+    virJSONValuePtr reply = NULL;
+
+    if (!cmd)
+        return -1;
+
+    ret = qemuMonitorJSONCommandFiltered(mon, cmd,
+                                         qemuMonitorJSONBlockStatsFilter,
+                                         &reply);
+
+    if (ret == 0)
+        ret = qemuMonitorJSONExtractAllBlockStats(cmd, reply, table);
+
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+int qemuMonitorJSONGetStats(qemuMonitorPtr mon,
+                            unsigned int what,
+                            qemuMonitorStatsPtr stats)
+{
+    static const struct {
+        unsigned int flag;
+        const char *command;
+    } queries[] = {
+        { QEMU_MONITOR_STATS_BLOCK, "query-blockstats" },
+        { QEMU_MONITOR_STATS_BALLOON, "query-balloon" },
+    };
+    virJSONValuePtr cmds[ARRAY_CARDINALITY(queries)];
+    virJSONValuePtr replies[ARRAY_CARDINALITY(queries)];
+    unsigned int flags[ARRAY_CARDINALITY(queries)];
+    size_t ncmds = 0;
+    size_t i;
+    int ret = -1;
+
+    memset(replies, 0, sizeof(replies));
+
+    for (i = 0; i < ARRAY_CARDINALITY(queries); i++) {
+        if (!(what & queries[i].flag))
+            continue;
+        if (!(cmds[ncmds] = qemuMonitorJSONMakeCommand(queries[i].command,
+                                                       NULL)))
             goto cleanup;
-        }
+        flags[ncmds++] = queries[i].flag;
     }
 
-    if (!found) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("cannot find statistics for device '%s'"), dev_name);
+    if (qemuMonitorJSONCommandBatch(mon, cmds, ncmds, replies) < 0)
         goto cleanup;
+
+    for (i = 0; i < ncmds; i++) {
+        int rc = -1;
+
+        switch (flags[i]) {
+        case QEMU_MONITOR_STATS_BLOCK:
+            if (!(stats->blockstats = virHashCreate(32,
+                                                    (virHashDataFree) free)))
+                goto cleanup;
+            rc = qemuMonitorJSONExtractAllBlockStats(cmds[i], replies[i],
+                                                     stats->blockstats);
+            if (rc < 0) {
+                virHashFree(stats->blockstats);
+                stats->blockstats = NULL;
+            }
+            break;
+
+        case QEMU_MONITOR_STATS_BALLOON:
+            /* a guest without balloon reports nothing */
+            rc = qemuMonitorJSONExtractBalloonInfo(cmds[i], replies[i],
+                                                   &stats->balloon);
+            if (rc == 0)
+                rc = -1;
+            break;
+        }
+
+        if (rc < 0) {
+            virErrorPtr err = virGetLastError();
+            VIR_DEBUG("Dropping statistics %x: %s", flags[i],
+                      err && err->message ? err->message : "no data");
+            virResetLastError();
+            continue;
+        }
+
+        stats->fetched |= flags[i];
     }
+
     ret = 0;
 
 cleanup:
-    virJSONValueFree(cmd);
-    virJSONValueFree(reply);
+    for (i = 0; i < ncmds; i++) {
+        virJSONValueFree(cmds[i]);
+        virJSONValueFree(replies[i]);
+    }
     return ret;
 }
 
@@ -1775,7 +2376,9 @@ int qemuMonitorJSONGetBlockStatsParamsNumber(qemuMonitorPtr mon,
     if (!cmd)
         return -1;
 
-    ret = qemuMonitorJSONCommand(mon, cmd, &reply);
+    ret = qemuMonitorJSONCommandFiltered(mon, cmd,
+                                         qemuMonitorJSONBlockStatsFilter,
+                                         &reply);
 
     if (ret == 0)
         ret = qemuMonitorJSONCheckError(cmd, reply);
@@ -2251,10 +2854,7 @@ int qemuMonitorJSONSetMigrationDowntime(qemuMonitorPtr mon,
 
 static int
 qemuMonitorJSONGetMigrationStatusReply(virJSONValuePtr reply,
-                                       int *status,
-                                       unsigned long long *transferred,
-                                       unsigned long long *remaining,
-                                       unsigned long long *total)
+                                       qemuMonitorMigrationStatusPtr status)
 {
     virJSONValuePtr ret;
     const char *statusstr;
@@ -2272,14 +2872,18 @@ qemuMonitorJSONGetMigrationStatusReply(virJSONValuePtr reply,
         return -1;
     }
 
-    if ((*status = qemuMonitorMigrationStatusTypeFromString(statusstr)) < 0) {
+    status->status = qemuMonitorMigrationStatusTypeFromString(statusstr);
+    if (status->status < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("unexpected migration status in %s"), statusstr);
         return -1;
     }
 
-    if (*status == QEMU_MONITOR_MIGRATION_STATUS_ACTIVE) {
+    if (status->status == QEMU_MONITOR_MIGRATION_STATUS_ACTIVE) {
         virJSONValuePtr ram = virJSONValueObjectGet(ret, "ram");
+        virJSONValuePtr disk;
+        virJSONValuePtr comp;
+
         if (!ram) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("migration was active, but no RAM info was set"));
@@ -2287,51 +2891,70 @@ qemuMonitorJSONGetMigrationStatusReply(virJSONValuePtr reply,
         }
 
         if (virJSONValueObjectGetNumberUlong(ram, "transferred",
-                                             transferred) < 0) {
+                                             &status->transferred) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("migration was active, but RAM 'transferred' "
                              "data was missing"));
             return -1;
         }
-        if (virJSONValueObjectGetNumberUlong(ram, "remaining", remaining) < 0) {
+        if (virJSONValueObjectGetNumberUlong(ram, "remaining",
+                                             &status->remaining) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("migration was active, but RAM 'remaining' "
                              "data was missing"));
             return -1;
         }
-        if (virJSONValueObjectGetNumberUlong(ram, "total", total) < 0) {
+        if (virJSONValueObjectGetNumberUlong(ram, "total",
+                                             &status->total) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("migration was active, but RAM 'total' "
                              "data was missing"));
             return -1;
         }
 
-        virJSONValuePtr disk = virJSONValueObjectGet(ret, "disk");
-        if (!disk) {
-            return 0;
+        if ((disk = virJSONValueObjectGet(ret, "disk"))) {
+            if (virJSONValueObjectGetNumberUlong(disk, "transferred",
+                                                 &t) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("disk migration was active, but "
+                                 "'transferred' data was missing"));
+                return -1;
+            }
+            status->transferred += t;
+            if (virJSONValueObjectGetNumberUlong(disk, "remaining", &t) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("disk migration was active, but "
+                                 "'remaining' data was missing"));
+                return -1;
+            }
+            status->remaining += t;
+            if (virJSONValueObjectGetNumberUlong(disk, "total", &t) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("disk migration was active, but "
+                                 "'total' data was missing"));
+                return -1;
+            }
+            status->total += t;
         }
 
-        if (virJSONValueObjectGetNumberUlong(disk, "transferred", &t) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("disk migration was active, but 'transferred' "
-                             "data was missing"));
-            return -1;
-        }
-        *transferred += t;
-        if (virJSONValueObjectGetNumberUlong(disk, "remaining", &t) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("disk migration was active, but 'remaining' "
-                             "data was missing"));
-            return -1;
-        }
-        *remaining += t;
-        if (virJSONValueObjectGetNumberUlong(disk, "total", &t) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("disk migration was active, but 'total' "
-                             "data was missing"));
-            return -1;
+        if ((comp = virJSONValueObjectGet(ret, "xbzrle-cache"))) {
+            if (virJSONValueObjectGetNumberUlong(comp, "cache-size",
+                                                 &status->xbzrle_cache_size) < 0 ||
+                virJSONValueObjectGetNumberUlong(comp, "bytes",
+                                                 &status->xbzrle_bytes) < 0 ||
+                virJSONValueObjectGetNumberUlong(comp, "pages",
+                                                 &status->xbzrle_pages) < 0 ||
+                virJSONValueObjectGetNumberUlong(comp, "cache-miss",
+                                                 &status->xbzrle_cache_miss) < 0 ||
+                virJSONValueObjectGetNumberUlong(comp, "overflow",
+                                                 &status->xbzrle_overflow) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("XBZRLE is active, but its statistics "
+                                 "are missing"));
+                return -1;
+            }
+            status->xbzrle_set = true;
         }
-        *total += t;
     }
 
     return 0;
@@ -2339,20 +2962,154 @@ qemuMonitorJSONGetMigrationStatusReply(virJSONValuePtr reply,
 
 
 int qemuMonitorJSONGetMigrationStatus(qemuMonitorPtr mon,
-                                      int *status,
-                                      unsigned long long *transferred,
-                                      unsigned long long *remaining,
-                                      unsigned long long *total)
+                                      qemuMonitorMigrationStatusPtr status)
 {
     int ret;
     virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-migrate",
                                                      NULL);
     virJSONValuePtr reply = NULL;
 
-    *status = 0;
-    *transferred = *remaining = *total = 0;
+    memset(status, 0, sizeof(*status));
+
+    if (!cmd)
+        return -1;
+
+    ret = qemuMonitorJSONCommand(mon, cmd, &reply);
+
+    if (ret == 0)
+        ret = qemuMonitorJSONCheckError(cmd, reply);
+
+    if (ret == 0 &&
+        qemuMonitorJSONGetMigrationStatusReply(reply, status) < 0)
+        ret = -1;
+
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+int qemuMonitorJSONGetMigrationCapability(qemuMonitorPtr mon,
+                                          qemuMonitorMigrationCaps capability)
+{
+    int ret;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+    virJSONValuePtr caps;
+    int i;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("query-migrate-capabilities",
+                                           NULL)))
+        return -1;
+
+    ret = qemuMonitorJSONCommand(mon, cmd, &reply);
+
+    if (ret == 0) {
+        /* Too old a qemu to have any capability */
+        if (qemuMonitorJSONHasError(reply, "CommandNotFound"))
+            goto cleanup;
+        ret = qemuMonitorJSONCheckError(cmd, reply);
+    }
+
+    if (ret < 0)
+        goto cleanup;
+
+    ret = -1;
+
+    caps = virJSONValueObjectGet(reply, "return");
+    if (!caps || caps->type != VIR_JSON_TYPE_ARRAY) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("missing migration capabilities"));
+        goto cleanup;
+    }
+
+    ret = 0;
+    for (i = 0 ; i < virJSONValueArraySize(caps) ; i++) {
+        virJSONValuePtr cap = virJSONValueArrayGet(caps, i);
+        const char *name;
+
+        if (!cap || cap->type != VIR_JSON_TYPE_OBJECT) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("missing entry in migration capabilities list"));
+            ret = -1;
+            goto cleanup;
+        }
+
+        if (!(name = virJSONValueObjectGetString(cap, "capability"))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("missing migration capability name"));
+            ret = -1;
+            goto cleanup;
+        }
+
+        if (qemuMonitorMigrationCapsTypeFromString(name) == capability) {
+            ret = 1;
+            break;
+        }
+    }
+
+cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+int qemuMonitorJSONSetMigrationCapability(qemuMonitorPtr mon,
+                                          qemuMonitorMigrationCaps capability)
+{
+    int ret = -1;
+    virJSONValuePtr cmd = NULL;
+    virJSONValuePtr reply = NULL;
+    virJSONValuePtr cap = NULL;
+    virJSONValuePtr caps;
+
+    if (!(caps = virJSONValueNewArray()))
+        goto no_memory;
+
+    if (!(cap = virJSONValueNewObject()) ||
+        virJSONValueObjectAppendString(cap, "capability",
+                qemuMonitorMigrationCapsTypeToString(capability)) < 0 ||
+        virJSONValueObjectAppendBoolean(cap, "state", 1) < 0 ||
+        virJSONValueArrayAppend(caps, cap) < 0)
+        goto no_memory;
+    cap = NULL;
 
+    cmd = qemuMonitorJSONMakeCommand("migrate-set-capabilities",
+                                     "a:capabilities", caps,
+                                     NULL);
     if (!cmd)
+        goto cleanup;
+
+    if ((ret = qemuMonitorJSONCommand(mon, cmd, &reply)) < 0)
+        goto cleanup;
+
+    ret = qemuMonitorJSONCheckError(cmd, reply);
+
+cleanup:
+    virJSONValueFree(cap);
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    virJSONValueFree(caps);
+    goto cleanup;
+}
+
+
+int qemuMonitorJSONGetMigrationCacheSize(qemuMonitorPtr mon,
+                                         unsigned long long *cacheSize)
+{
+    int ret;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    *cacheSize = 0;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("query-migrate-cache-size",
+                                           NULL)))
         return -1;
 
     ret = qemuMonitorJSONCommand(mon, cmd, &reply);
@@ -2361,12 +3118,36 @@ int qemuMonitorJSONGetMigrationStatus(qemuMonitorPtr mon,
         ret = qemuMonitorJSONCheckError(cmd, reply);
 
     if (ret == 0 &&
-        qemuMonitorJSONGetMigrationStatusReply(reply,
-                                               status,
-                                               transferred,
-                                               remaining,
-                                               total) < 0)
+        virJSONValueObjectGetNumberUlong(reply, "return", cacheSize) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("invalid cache size in query-migrate-cache-size "
+                         "reply"));
         ret = -1;
+    }
+
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+int qemuMonitorJSONSetMigrationCacheSize(qemuMonitorPtr mon,
+                                         unsigned long long cacheSize)
+{
+    int ret;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    cmd = qemuMonitorJSONMakeCommand("migrate-set-cache-size",
+                                     "U:value", cacheSize,
+                                     NULL);
+    if (!cmd)
+        return -1;
+
+    ret = qemuMonitorJSONCommand(mon, cmd, &reply);
+
+    if (ret == 0)
+        ret = qemuMonitorJSONCheckError(cmd, reply);
 
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
@@ -4273,3 +5054,103 @@ cleanup:
     virJSONValueFree(reply);
     return ret;
 }
+
+
+int
+qemuMonitorJSONNBDServerStart(qemuMonitorPtr mon,
+                              const char *host,
+                              unsigned int port)
+{
+    int ret = -1;
+    virJSONValuePtr cmd = NULL;
+    virJSONValuePtr reply = NULL;
+    virJSONValuePtr data = NULL;
+    virJSONValuePtr addr = NULL;
+    char *port_str = NULL;
+
+    if (!(data = virJSONValueNewObject()) ||
+        !(addr = virJSONValueNewObject()) ||
+        (virAsprintf(&port_str, "%u", port) < 0)) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    /* port is really expected as a string here by qemu */
+    if (virJSONValueObjectAppendString(data, "host", host) < 0 ||
+        virJSONValueObjectAppendString(data, "port", port_str) < 0 ||
+        virJSONValueObjectAppendString(addr, "type", "inet") < 0 ||
+        virJSONValueObjectAppend(addr, "data", data) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    /* From now on, @data is part of @addr */
+    data = NULL;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("nbd-server-start",
+                                           "a:addr", addr,
+                                           NULL)))
+        goto cleanup;
+
+    /* From now on, @addr is part of @cmd */
+    addr = NULL;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    ret = qemuMonitorJSONCheckError(cmd, reply);
+
+cleanup:
+    VIR_FREE(port_str);
+    virJSONValueFree(reply);
+    virJSONValueFree(cmd);
+    virJSONValueFree(addr);
+    virJSONValueFree(data);
+    return ret;
+}
+
+int
+qemuMonitorJSONNBDServerAdd(qemuMonitorPtr mon,
+                            const char *deviceID,
+                            bool writable)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("nbd-server-add",
+                                           "s:device", deviceID,
+                                           "b:writable", writable,
+                                           NULL)))
+        return ret;
+
+    ret = qemuMonitorJSONCommand(mon, cmd, &reply);
+
+    if (ret == 0)
+        ret = qemuMonitorJSONCheckError(cmd, reply);
+
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+int
+qemuMonitorJSONNBDServerStop(qemuMonitorPtr mon)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("nbd-server-stop",
+                                           NULL)))
+        return ret;
+
+    ret = qemuMonitorJSONCommand(mon, cmd, &reply);
+
+    if (ret == 0)
+        ret = qemuMonitorJSONCheckError(cmd, reply);
+
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
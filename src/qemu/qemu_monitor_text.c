@@ -227,17 +227,31 @@ qemuMonitorTextCommandWithHandler(qemuMonitorPtr mon,
 {
     int ret;
     qemuMonitorMessage msg;
+    char *name;
+    size_t len;
 
     *reply = NULL;
 
     memset(&msg, 0, sizeof(msg));
 
+    /* Latency is accounted to the command word, or to "info <what>"
+     * for queries; the arguments may hold passwords anyway */
+    len = strcspn(cmd, " ");
+    if (STRPREFIX(cmd, "info "))
+        len += 1 + strcspn(cmd + len + 1, " ");
+    if (!(name = strndup(cmd, len))) {
+        virReportOOMError();
+        return -1;
+    }
+
     if (virAsprintf(&msg.txBuffer, "%s\r", cmd) < 0) {
         virReportOOMError();
+        VIR_FREE(name);
         return -1;
     }
     msg.txLength = strlen(msg.txBuffer);
     msg.txFD = scm_fd;
+    msg.txName = name;
     msg.passwordHandler = passwordHandler;
     msg.passwordOpaque = passwordOpaque;
 
@@ -251,6 +265,7 @@ qemuMonitorTextCommandWithHandler(qemuMonitorPtr mon,
     /* Just in case buffer had some passwords in */
     memset(msg.txBuffer, 0, msg.txLength);
     VIR_FREE(msg.txBuffer);
+    VIR_FREE(name);
 
     if (ret >= 0) {
         /* To make life safer for callers, already ensure there's at least an empty string */
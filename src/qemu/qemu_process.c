@@ -206,6 +206,21 @@ qemuFindAgentConfig(virDomainDefPtr def)
     return config;
 }
 
+/*
+ * Returns the thread servicing the monitor and agent of @vm, or NULL
+ * for the main event loop.  Domain IDs are handed out in sequence, so
+ * this spreads domains evenly over the threads.
+ */
+static virEventThreadPtr
+qemuProcessGetIOThread(virQEMUDriverPtr driver, virDomainObjPtr vm)
+{
+    if (!driver->monitorIOThreads)
+        return NULL;
+
+    return driver->monitorIOThreadList[(unsigned int) vm->def->id %
+                                       driver->monitorIOThreads];
+}
+
 static int
 qemuConnectAgent(virQEMUDriverPtr driver, virDomainObjPtr vm)
 {
@@ -234,6 +249,7 @@ qemuConnectAgent(virQEMUDriverPtr driver, virDomainObjPtr vm)
 
     agent = qemuAgentOpen(vm,
                           config,
+                          qemuProcessGetIOThread(driver, vm),
                           &agentCallbacks);
 
     qemuDriverLock(driver);
@@ -292,6 +308,8 @@ qemuProcessHandleMonitorEOF(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 
     priv = vm->privateData;
 
+    qemuDomainObjWakeAsyncJob(vm);
+
     if (priv->beingDestroyed) {
         VIR_DEBUG("Domain is being destroyed, EOF is expected");
         goto unlock;
@@ -696,6 +714,10 @@ qemuProcessHandleStop(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virDomainEventPtr event = NULL;
 
     virDomainObjLock(vm);
+
+    /* A migration stops the guest when it is about to complete */
+    qemuDomainObjWakeAsyncJob(vm);
+
     if (virDomainObjGetState(vm, NULL) == VIR_DOMAIN_RUNNING) {
         qemuDomainObjPrivatePtr priv = vm->privateData;
 
@@ -750,8 +772,7 @@ qemuProcessHandleRTCChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     if (vm->def->clock.offset == VIR_DOMAIN_CLOCK_OFFSET_VARIABLE)
         vm->def->clock.data.variable.adjustment = offset;
 
-    if (virDomainSaveStatus(driver->caps, driver->stateDir, vm) < 0)
-        VIR_WARN("unable to save domain status with RTC change");
+    qemuDomainObjSaveStatusDeferred(driver, vm);
 
     virDomainObjUnlock(vm);
 
@@ -928,6 +949,10 @@ qemuProcessHandleBlockJob(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         if (disk->mirror && type == VIR_DOMAIN_BLOCK_JOB_TYPE_COPY &&
             status == VIR_DOMAIN_BLOCK_JOB_READY)
             disk->mirroring = true;
+        /* Storage migration waits for its mirrors to become ready,
+         * and flattening all disks for its jobs to end */
+        qemuDomainObjWakeAsyncJob(vm);
+        qemuDomainObjSaveStatusDeferred(driver, vm);
     }
 
     virDomainObjUnlock(vm);
@@ -1061,10 +1086,7 @@ qemuProcessHandleTrayChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         else if (reason == VIR_DOMAIN_EVENT_TRAY_CHANGE_CLOSE)
             disk->tray_status = VIR_DOMAIN_DISK_TRAY_CLOSED;
 
-        if (virDomainSaveStatus(driver->caps, driver->stateDir, vm) < 0) {
-            VIR_WARN("Unable to save status on vm %s after tray moved event",
-                     vm->def->name);
-        }
+        qemuDomainObjSaveStatusDeferred(driver, vm);
     }
 
     virDomainObjUnlock(vm);
@@ -1183,8 +1205,7 @@ qemuProcessHandleBalloonChange(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
               vm->def->mem.cur_balloon, actual);
     vm->def->mem.cur_balloon = actual;
 
-    if (virDomainSaveStatus(driver->caps, driver->stateDir, vm) < 0)
-        VIR_WARN("unable to save domain status with balloon change");
+    qemuDomainObjSaveStatusDeferred(driver, vm);
 
     virDomainObjUnlock(vm);
 
@@ -1289,6 +1310,7 @@ qemuConnectMonitor(virQEMUDriverPtr driver, virDomainObjPtr vm)
     mon = qemuMonitorOpen(vm,
                           priv->monConfig,
                           priv->monJSON,
+                          qemuProcessGetIOThread(driver, vm),
                           &monitorCallbacks);
 
     qemuDriverLock(driver);
@@ -1660,7 +1682,12 @@ qemuProcessWaitForMonitor(virQEMUDriverPtr driver,
             goto closelog;
         }
 
-        if (qemuProcessReadLogOutput(vm, logfd, buf, buf_size,
+        /* With -chardev, 'info chardev' reliably tells the paths of all
+         * PTYs once the monitor is up, so there is no need to wait for
+         * qemu to print them; the log is still kept around for
+         * reporting early deaths */
+        if (!qemuCapsGet(caps, QEMU_CAPS_CHARDEV) &&
+            qemuProcessReadLogOutput(vm, logfd, buf, buf_size,
                                      qemuProcessFindCharDevicePTYs,
                                      "console", 30) < 0)
             goto closelog;
@@ -1754,6 +1781,45 @@ qemuProcessDetectVcpuPIDs(virQEMUDriverPtr driver,
 }
 
 
+/*
+ * Only iothread objects can be queried for their thread IDs; the
+ * threads QEMU spawns for x-data-plane disks stay in the emulator
+ * group and can't be pinned on their own.
+ */
+static int
+qemuProcessDetectIOThreadPIDs(virQEMUDriverPtr driver,
+                              virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    int *iothreadpids = NULL;
+    int niothreadpids;
+
+    if (!vm->def->iothreads ||
+        !qemuCapsGet(priv->caps, QEMU_CAPS_OBJECT_IOTHREAD))
+        return 0;
+
+    qemuDomainObjEnterMonitorWithDriver(driver, vm);
+    niothreadpids = qemuMonitorGetIOThreads(priv->mon, &iothreadpids);
+    qemuDomainObjExitMonitorWithDriver(driver, vm);
+
+    if (niothreadpids < 0)
+        return -1;
+
+    if (niothreadpids != vm->def->iothreads) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("got wrong number of IOThread pids from QEMU "
+                         "monitor. got %d, wanted %u"),
+                       niothreadpids, vm->def->iothreads);
+        VIR_FREE(iothreadpids);
+        return -1;
+    }
+
+    priv->niothreadpids = niothreadpids;
+    priv->iothreadpids = iothreadpids;
+    return 0;
+}
+
+
 /*
  * Set NUMA memory policy for qemu process, to be run between
  * fork/exec of QEMU only.
@@ -1892,12 +1958,220 @@ qemuGetNumadAdvice(virDomainDefPtr def)
 static char *
 qemuGetNumadAdvice(virDomainDefPtr def ATTRIBUTE_UNUSED)
 {
-    virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
-                   _("numad is not available on this host"));
+    VIR_DEBUG("numad is not available on this host");
     return NULL;
 }
 #endif
 
+/*
+ * Fetch the free memory, in bytes, of each host NUMA cell, indexed
+ * like driver->caps->host.numaCell.
+ */
+static unsigned long long *
+qemuProcessGetCellsFreeMemory(virQEMUDriverPtr driver)
+{
+    virCapsHostPtr host = &driver->caps->host;
+    unsigned long long *freeMems = NULL;
+    size_t i;
+
+    if (host->nnumaCell == 0) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("host NUMA topology is not available"));
+        return NULL;
+    }
+
+    if (VIR_ALLOC_N(freeMems, host->nnumaCell) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    for (i = 0; i < host->nnumaCell; i++) {
+        if (nodeGetCellsFreeMemory(NULL, &freeMems[i],
+                                   host->numaCell[i]->num, 1) != 1) {
+            VIR_FREE(freeMems);
+            return NULL;
+        }
+    }
+
+    return freeMems;
+}
+
+/*
+ * Pick the host NUMA nodes for a guest using automatic placement when
+ * numad can't tell: the node with the most free memory among those
+ * able to hold both the memory and the vcpus of the guest, or, when
+ * no single node is big enough, as few nodes as possible taken in
+ * order of decreasing free memory.
+ */
+static virBitmapPtr
+qemuProcessPickNUMANodes(virQEMUDriverPtr driver,
+                         virDomainDefPtr def,
+                         const unsigned long long *freeMems)
+{
+    virCapsHostPtr host = &driver->caps->host;
+    unsigned long long need = def->mem.cur_balloon * 1024ULL;
+    unsigned long long sumMem = 0;
+    virBitmapPtr nodemask = NULL;
+    bool *used = NULL;
+    int sumCpus = 0;
+    int best = -1;
+    size_t i;
+
+    if (!(nodemask = virBitmapNew(VIR_DOMAIN_CPUMASK_LEN)) ||
+        VIR_ALLOC_N(used, host->nnumaCell) < 0) {
+        virReportOOMError();
+        virBitmapFree(nodemask);
+        return NULL;
+    }
+
+    for (i = 0; i < host->nnumaCell; i++) {
+        if (freeMems[i] < need || host->numaCell[i]->ncpus < def->vcpus)
+            continue;
+        if (best < 0 || freeMems[i] > freeMems[best])
+            best = i;
+    }
+
+    if (best >= 0) {
+        ignore_value(virBitmapSetBit(nodemask, host->numaCell[best]->num));
+        goto cleanup;
+    }
+
+    while (sumMem < need || sumCpus < def->vcpus) {
+        best = -1;
+        for (i = 0; i < host->nnumaCell; i++) {
+            if (!used[i] && (best < 0 || freeMems[i] > freeMems[best]))
+                best = i;
+        }
+        if (best < 0)
+            break;
+
+        used[best] = true;
+        sumMem += freeMems[best];
+        sumCpus += host->numaCell[best]->ncpus;
+        ignore_value(virBitmapSetBit(nodemask, host->numaCell[best]->num));
+    }
+
+cleanup:
+    VIR_FREE(used);
+    return nodemask;
+}
+
+/*
+ * Get the nodeset a guest using automatic placement is started on:
+ * the advice of numad when available, otherwise our own pick based
+ * on the free memory of the host NUMA nodes.
+ */
+static virBitmapPtr
+qemuProcessGetAutoNodeset(virQEMUDriverPtr driver,
+                          virDomainDefPtr def)
+{
+    unsigned long long *freeMems = NULL;
+    virBitmapPtr nodemask = NULL;
+    char *nodeset = NULL;
+
+    if ((nodeset = qemuGetNumadAdvice(def))) {
+        VIR_DEBUG("Nodeset returned from numad: %s", nodeset);
+        if (virBitmapParse(nodeset, 0, &nodemask,
+                           VIR_DOMAIN_CPUMASK_LEN) < 0)
+            nodemask = NULL;
+        VIR_FREE(nodeset);
+        return nodemask;
+    }
+
+    VIR_DEBUG("No advice from numad, picking NUMA nodes for %s", def->name);
+    virResetLastError();
+
+    if (!(freeMems = qemuProcessGetCellsFreeMemory(driver)))
+        return NULL;
+
+    nodemask = qemuProcessPickNUMANodes(driver, def, freeMems);
+    VIR_FREE(freeMems);
+    return nodemask;
+}
+
+/*
+ * Move the running guest @vm, which must be locked and have a job, to
+ * the best fitting host NUMA nodes if those have more than @threshold
+ * percent more free memory than the nodes it is currently confined to
+ * and the move narrows the gap.  Only guests whose placement,
+ * memory included, is entirely automatic are considered.
+ *
+ * Returns 1 if the guest was moved, 0 if it was left alone and -1 on
+ * error.
+ */
+int
+qemuProcessRebalanceNUMA(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm,
+                         unsigned int threshold)
+{
+    virDomainDefPtr def = vm->def;
+    virCapsHostPtr host = &driver->caps->host;
+    unsigned long long need = def->mem.cur_balloon * 1024ULL;
+    unsigned long long curFree = 0;
+    unsigned long long bestFree = 0;
+    unsigned long long *freeMems = NULL;
+    virBitmapPtr cur = NULL;
+    virBitmapPtr best = NULL;
+    char *nodeset = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (def->placement_mode != VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO ||
+        def->numatune.memory.placement_mode !=
+        VIR_DOMAIN_NUMATUNE_MEM_PLACEMENT_MODE_AUTO ||
+        def->numatune.memory.mode != VIR_DOMAIN_NUMATUNE_MEM_STRICT ||
+        def->cputune.nvcpupin || def->cputune.emulatorpin ||
+        def->cputune.niothreadpin)
+        return 0;
+
+    if (qemuCgroupGetNUMANodes(driver, vm, &cur) < 0)
+        goto cleanup;
+
+    if (!(freeMems = qemuProcessGetCellsFreeMemory(driver)) ||
+        !(best = qemuProcessPickNUMANodes(driver, def, freeMems)))
+        goto cleanup;
+
+    if (virBitmapEqual(cur, best)) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    for (i = 0; i < host->nnumaCell; i++) {
+        bool isCur = false, isBest = false;
+
+        ignore_value(virBitmapGetBit(cur, host->numaCell[i]->num, &isCur));
+        ignore_value(virBitmapGetBit(best, host->numaCell[i]->num, &isBest));
+        if (isCur)
+            curFree += freeMems[i];
+        if (isBest)
+            bestFree += freeMems[i];
+    }
+
+    /* The guest takes its memory along, so moving it only helps when
+     * the gap is bigger than the guest itself */
+    if (bestFree <= curFree + need ||
+        curFree * 100 >= bestFree * (100 - threshold)) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    nodeset = virBitmapFormat(best);
+    VIR_INFO("Moving domain %s to NUMA nodes %s (%llu free, %llu on "
+             "current nodes)", def->name, NULLSTR(nodeset), bestFree, curFree);
+
+    if (qemuCgroupMoveToNUMANodes(driver, vm, best) < 0)
+        goto cleanup;
+
+    ret = 1;
+
+cleanup:
+    VIR_FREE(nodeset);
+    VIR_FREE(freeMems);
+    virBitmapFree(cur);
+    virBitmapFree(best);
+    return ret;
+}
+
 /* Helper to prepare cpumap for affinity setting, convert
  * NUMA nodeset into cpuset if @nodemask is not NULL, otherwise
  * just return a new allocated bitmap.
@@ -2056,6 +2330,34 @@ cleanup:
     return ret;
 }
 
+/* Set CPU affinities for iothreads if iothreadpin xml provided. */
+static int
+qemuProcessSetIOThreadAffinites(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virDomainDefPtr def = vm->def;
+    int n;
+
+    if (!def->cputune.niothreadpin)
+        return 0;
+
+    if (priv->iothreadpids == NULL) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("iothread affinity is not supported by this QEMU"));
+        return -1;
+    }
+
+    for (n = 0; n < def->cputune.niothreadpin; n++) {
+        int iothread = def->cputune.iothreadpin[n]->vcpuid;
+
+        if (virProcessInfoSetAffinity(priv->iothreadpids[iothread - 1],
+                                      def->cputune.iothreadpin[n]->cpumask) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
 /* Set CPU affinities for emulator threads. */
 static int
 qemuProcessSetEmulatorAffinites(virConnectPtr conn ATTRIBUTE_UNUSED,
@@ -3053,6 +3355,11 @@ qemuProcessRecoverJob(virQEMUDriverPtr driver,
         }
         break;
 
+    case QEMU_ASYNC_JOB_BLOCK_FLATTEN:
+        /* The block jobs keep running in qemu on their own and only
+         * the thread waiting for them is gone.  */
+        break;
+
     case QEMU_ASYNC_JOB_NONE:
     case QEMU_ASYNC_JOB_LAST:
         break;
@@ -3104,18 +3411,59 @@ struct qemuProcessReconnectData {
     void *payload;
     struct qemuDomainJobObj oldjob;
 };
+
+/*
+ * Account for one finished domain reconnect, which started at @start
+ * (in milliseconds), logging progress and, once the last one is done,
+ * how long reconnecting to all the domains took.
+ *
+ * Must be called with the driver locked.
+ */
+static void
+qemuProcessReconnectDone(virQEMUDriverPtr driver,
+                         const char *name,
+                         unsigned long long start,
+                         bool success)
+{
+    unsigned long long now;
+    unsigned long long elapsed;
+
+    if (virTimeMillisNow(&now) < 0)
+        now = start;
+    elapsed = now - start;
+
+    if (elapsed > driver->reconnectMaxTime)
+        driver->reconnectMaxTime = elapsed;
+    driver->reconnectDone++;
+
+    if (success)
+        VIR_INFO("Reconnected to domain '%s' in %llu ms (%zu of %zu done)",
+                 NULLSTR(name), elapsed,
+                 driver->reconnectDone, driver->reconnectTotal);
+    else
+        VIR_INFO("Failed to reconnect to domain '%s' after %llu ms (%zu of %zu done)",
+                 NULLSTR(name), elapsed,
+                 driver->reconnectDone, driver->reconnectTotal);
+
+    if (driver->reconnectDone == driver->reconnectTotal)
+        VIR_INFO("Reconnected to %zu domains in %llu ms, slowest took %llu ms",
+                 driver->reconnectTotal, now - driver->reconnectStart,
+                 driver->reconnectMaxTime);
+}
+
 /*
  * Open an existing VM's monitor, re-detect VCPU threads
  * and re-reserve the security labels in use
  *
- * We own the virConnectPtr we are passed here - whoever started
- * this thread function has increased the reference counter to it
- * so that we now have to close it.
+ * This runs as a job in the driver's reconnect pool. We own the
+ * virConnectPtr we are passed here - whoever queued this job has
+ * increased the reference counter to it so that we now have to
+ * close it.
  */
 static void
-qemuProcessReconnect(void *opaque)
+qemuProcessReconnect(void *jobdata, void *opaque ATTRIBUTE_UNUSED)
 {
-    struct qemuProcessReconnectData *data = opaque;
+    struct qemuProcessReconnectData *data = jobdata;
     virQEMUDriverPtr driver = data->driver;
     virDomainObjPtr obj = data->payload;
     qemuDomainObjPrivatePtr priv;
@@ -3123,14 +3471,21 @@ qemuProcessReconnect(void *opaque)
     struct qemuDomainJobObj oldjob;
     int state;
     int reason;
+    unsigned long long start;
+    char *name;
 
     memcpy(&oldjob, &data->oldjob, sizeof(oldjob));
 
     VIR_FREE(data);
 
+    ignore_value(virTimeMillisNow(&start));
+
     qemuDriverLock(driver);
     virDomainObjLock(obj);
 
+    /* Only used for reporting, so running out of memory is harmless */
+    name = strdup(obj->def->name);
+
 
     VIR_DEBUG("Reconnect monitor to %p '%s'", obj, obj->def->name);
 
@@ -3244,9 +3599,11 @@ endjob:
     if (obj && virObjectUnref(obj))
         virDomainObjUnlock(obj);
 
+    qemuProcessReconnectDone(driver, name, start, true);
     qemuDriverUnlock(driver);
 
     virConnectClose(conn);
+    VIR_FREE(name);
 
     return;
 
@@ -3258,7 +3615,9 @@ error:
         if (!virDomainObjIsActive(obj)) {
             if (virObjectUnref(obj))
                 virDomainObjUnlock(obj);
+            qemuProcessReconnectDone(driver, name, start, false);
             qemuDriverUnlock(driver);
+            VIR_FREE(name);
             return;
         }
 
@@ -3284,9 +3643,11 @@ error:
                 virDomainObjUnlock(obj);
         }
     }
+    qemuProcessReconnectDone(driver, name, start, false);
     qemuDriverUnlock(driver);
 
     virConnectClose(conn);
+    VIR_FREE(name);
 }
 
 static void
@@ -3294,7 +3655,6 @@ qemuProcessReconnectHelper(void *payload,
                            const void *name ATTRIBUTE_UNUSED,
                            void *opaque)
 {
-    virThread thread;
     struct qemuProcessReconnectData *src = opaque;
     struct qemuProcessReconnectData *data;
     virDomainObjPtr obj = payload;
@@ -3308,8 +3668,8 @@ qemuProcessReconnectHelper(void *payload,
     data->payload = payload;
 
     /* This iterator is called with driver being locked.
-     * We create a separate thread to run qemuProcessReconnect in it.
-     * However, qemuProcessReconnect needs to:
+     * We queue a job to run qemuProcessReconnect in the reconnect
+     * pool. However, qemuProcessReconnect needs to:
      * 1. lock driver
      * 2. just before monitor reconnect do lightweight MonitorEnter
      *    (increase VM refcount, unlock VM & driver)
@@ -3343,12 +3703,12 @@ qemuProcessReconnectHelper(void *payload,
      */
     virConnectRef(data->conn);
 
-    if (virThreadCreate(&thread, true, qemuProcessReconnect, data) < 0) {
+    if (virThreadPoolSendJob(src->driver->reconnectPool, 0, data) < 0) {
 
         virConnectClose(data->conn);
 
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Could not create thread. QEMU initialization "
+                       _("Could not queue reconnect job. QEMU initialization "
                          "might be incomplete"));
         if (!qemuDomainObjEndJob(src->driver, obj)) {
             obj = NULL;
@@ -3364,6 +3724,7 @@ qemuProcessReconnectHelper(void *payload,
         goto error;
     }
 
+    src->driver->reconnectTotal++;
     virDomainObjUnlock(obj);
 
     return;
@@ -3377,14 +3738,204 @@ error:
  *
  * Try to re-open the resources for live VMs that we care
  * about.
+ *
+ * The reconnects run in a pool of at most one worker per host CPU,
+ * rather than all at once, so that a host with many domains doesn't
+ * have them all fighting over the driver lock and timing out their
+ * monitors. This returns once they are all queued; each domain can
+ * be used as soon as its own reconnect is done. Must be called with
+ * the driver locked.
  */
 void
 qemuProcessReconnectAll(virConnectPtr conn, virQEMUDriverPtr driver)
 {
     struct qemuProcessReconnectData data = {.conn = conn, .driver = driver};
+    int ndomains = virHashSize(driver->domains.objs);
+    int nworkers;
+
+    if (ndomains <= 0)
+        return;
+
+    if ((nworkers = nodeGetCPUCount()) < 1) {
+        virResetLastError();
+        nworkers = 1;
+    }
+    if (nworkers > ndomains)
+        nworkers = ndomains;
+
+    /* The pool hangs around until the driver is shut down: its
+     * workers can't free it themselves once the last job is done */
+    if (!(driver->reconnectPool = virThreadPoolNew(nworkers, nworkers, 0,
+                                                   qemuProcessReconnect,
+                                                   driver))) {
+        VIR_ERROR(_("Unable to create reconnect thread pool"));
+        return;
+    }
+
+    VIR_INFO("Reconnecting to %d domains using %d workers",
+             ndomains, nworkers);
+    ignore_value(virTimeMillisNow(&driver->reconnectStart));
+
     virHashForEach(driver->domains.objs, qemuProcessReconnectHelper, &data);
 }
 
+/*
+ * Security labels of the disks and other host resources of a domain
+ * do not depend on the emulator process, so qemuProcessStart applies
+ * them in a separate thread while it sets up cgroups, taps and the
+ * command line, and only waits for them before letting qemu exec.
+ */
+struct qemuProcessLabelData {
+    virSecurityManagerPtr mgr;
+    virDomainDefPtr def;
+    const char *stdin_path;
+
+    virThread thread;
+    int ret;
+    virErrorPtr err;
+    unsigned long long duration;
+};
+
+static void
+qemuProcessLabelWorker(void *opaque)
+{
+    struct qemuProcessLabelData *data = opaque;
+    unsigned long long start = 0;
+    unsigned long long end = 0;
+
+    ignore_value(virTimeMillisNow(&start));
+    data->ret = virSecurityManagerSetAllLabel(data->mgr, data->def,
+                                              data->stdin_path);
+    if (data->ret < 0)
+        data->err = virSaveLastError();
+    ignore_value(virTimeMillisNow(&end));
+    data->duration = end - start;
+}
+
+/* Wait for the labelling started by qemuProcessStart and report its
+ * error, if any */
+static int
+qemuProcessLabelWait(struct qemuProcessLabelData *data)
+{
+    virThreadJoin(&data->thread);
+
+    if (data->ret < 0) {
+        if (data->err) {
+            virSetError(data->err);
+            virFreeError(data->err);
+            data->err = NULL;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Looking the emulator capabilities up may have to run the emulator
+ * binary when it changed, which takes as long as the host side
+ * preparation of the domain it does not depend on, so qemuProcessStart
+ * does it in a separate thread and waits for it before assigning
+ * device aliases.
+ */
+struct qemuProcessCapsData {
+    qemuCapsCachePtr cache;
+    const char *binary;
+
+    virThread thread;
+    qemuCapsPtr caps;
+    virErrorPtr err;
+    unsigned long long duration;
+};
+
+static void
+qemuProcessCapsWorker(void *opaque)
+{
+    struct qemuProcessCapsData *data = opaque;
+    unsigned long long start = 0;
+    unsigned long long end = 0;
+
+    ignore_value(virTimeMillisNow(&start));
+    if (!(data->caps = qemuCapsCacheLookupCopy(data->cache, data->binary)))
+        data->err = virSaveLastError();
+    ignore_value(virTimeMillisNow(&end));
+    data->duration = end - start;
+}
+
+/* Wait for the lookup started by qemuProcessStart and return the
+ * capabilities it found, or NULL with its error reported */
+static qemuCapsPtr
+qemuProcessCapsWait(struct qemuProcessCapsData *data)
+{
+    qemuCapsPtr caps;
+
+    virThreadJoin(&data->thread);
+
+    if (!(caps = data->caps)) {
+        if (data->err) {
+            virSetError(data->err);
+            virFreeError(data->err);
+            data->err = NULL;
+        }
+        return NULL;
+    }
+    data->caps = NULL;
+    return caps;
+}
+
+/* Account the time spent since *@stageStart to @step in @timings and
+ * in the start statistics of the domain */
+static void
+qemuProcessStartStage(virBufferPtr timings,
+                      unsigned long long *stageStart,
+                      qemuDomainObjPrivatePtr priv,
+                      enum qemuDomainStartStep step)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    priv->startSteps[step] = now - *stageStart;
+    virBufferAsprintf(timings, " %s=%llums",
+                      qemuDomainStartStepTypeToString(step),
+                      priv->startSteps[step]);
+    *stageStart = now;
+}
+
+/* Label the hugetlbfs directories of every page size @def uses */
+static int
+qemuProcessSetHugepagesLabel(virQEMUDriverPtr driver,
+                             virDomainDefPtr def)
+{
+    size_t i;
+    size_t npages = def->mem.nhugepages ? def->mem.nhugepages : 1;
+    virHugeTLBFSPtr fs;
+    char *path;
+    int ret;
+
+    for (i = 0; i < npages; i++) {
+        if (!(fs = qemuGetHugeTLBFS(driver, def->mem.nhugepages ?
+                                    def->mem.hugepages[i].size : 0)))
+            return -1;
+
+        if (!(path = qemuGetHugepagePath(fs)))
+            return -1;
+
+        ret = virSecurityManagerSetHugepages(driver->securityManager,
+                                             def, path);
+        VIR_FREE(path);
+        if (ret < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           "%s", _("Unable to set huge path in security driver"));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 int qemuProcessStart(virConnectPtr conn,
                      virQEMUDriverPtr driver,
                      virDomainObjPtr vm,
@@ -3405,9 +3956,15 @@ int qemuProcessStart(virConnectPtr conn,
     struct qemuProcessHookData hookData;
     unsigned long cur_balloon;
     int i;
-    char *nodeset = NULL;
     virBitmapPtr nodemask = NULL;
     unsigned int stop_flags;
+    struct qemuProcessLabelData label;
+    bool labelling = false;
+    struct qemuProcessCapsData capsData;
+    bool probing = false;
+    virBuffer timings = VIR_BUFFER_INITIALIZER;
+    unsigned long long startTime = 0;
+    unsigned long long stageStart = 0;
 
     /* Okay, these are just internal flags,
      * but doesn't hurt to check */
@@ -3433,6 +3990,14 @@ int qemuProcessStart(virConnectPtr conn,
         return -1;
     }
 
+    memset(&label, 0, sizeof(label));
+    memset(&capsData, 0, sizeof(capsData));
+    memset(priv->startSteps, 0, sizeof(priv->startSteps));
+    priv->startLabel = priv->startCaps = 0;
+    if (virTimeMillisNow(&startTime) < 0)
+        return -1;
+    stageStart = startTime;
+
     /* Do this upfront, so any part of the startup process can add
      * runtime state to vm->def that won't be persisted. This let's us
      * report implicit runtime defaults in the XML, like vnc listen/socket
@@ -3441,6 +4006,10 @@ int qemuProcessStart(virConnectPtr conn,
     if (virDomainObjSetDefTransient(driver->caps, vm, true) < 0)
         goto cleanup;
 
+    /* Restoring a saved image or reverting to a snapshot may have
+     * swapped in a live definition with different metadata */
+    virDomainObjListUpdateMetadataIndex(&driver->domains, vm);
+
     vm->def->id = driver->nextvmid++;
     qemuDomainSetFakeReboot(driver, vm, false);
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, VIR_DOMAIN_SHUTOFF_UNKNOWN);
@@ -3466,6 +4035,17 @@ int qemuProcessStart(virConnectPtr conn,
             goto cleanup;
     }
 
+    VIR_DEBUG("Determining emulator version in the background");
+    capsData.cache = driver->capsCache;
+    capsData.binary = vm->def->emulator;
+    if (virThreadCreate(&capsData.thread, true,
+                        qemuProcessCapsWorker, &capsData) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create capabilities lookup thread"));
+        goto cleanup;
+    }
+    probing = true;
+
     /* Must be run before security labelling */
     VIR_DEBUG("Preparing host devices");
     if (qemuPrepareHostDevices(driver, vm->def, !migrateFrom) < 0)
@@ -3487,14 +4067,9 @@ int qemuProcessStart(virConnectPtr conn,
     }
     virDomainAuditSecurityLabel(vm, true);
 
-    if (driver->hugepage_path && vm->def->mem.hugepage_backed) {
-        if (virSecurityManagerSetHugepages(driver->securityManager,
-                    vm->def, driver->hugepage_path) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR,
-                    "%s", _("Unable to set huge path in security driver"));
-            goto cleanup;
-        }
-    }
+    if (vm->def->mem.hugepage_backed &&
+        qemuProcessSetHugepagesLabel(driver, vm->def) < 0)
+        goto cleanup;
 
     /* Ensure no historical cgroup for this VM is lying around bogus
      * settings */
@@ -3586,10 +4161,12 @@ int qemuProcessStart(virConnectPtr conn,
         }
     }
 
-    VIR_DEBUG("Determining emulator version");
+    VIR_DEBUG("Waiting for emulator version");
     virObjectUnref(priv->caps);
-    if (!(priv->caps = qemuCapsCacheLookupCopy(driver->capsCache,
-                                               vm->def->emulator)))
+    probing = false;
+    priv->caps = qemuProcessCapsWait(&capsData);
+    priv->startCaps = capsData.duration;
+    if (!priv->caps)
         goto cleanup;
 
     if (qemuAssignDeviceAliases(vm->def, priv->caps) < 0)
@@ -3599,22 +4176,31 @@ int qemuProcessStart(virConnectPtr conn,
     if (qemuDomainCheckDiskPresence(driver, vm,
                                     flags & VIR_QEMU_PROCESS_START_COLD) < 0)
         goto cleanup;
+    qemuProcessStartStage(&timings, &stageStart, priv,
+                          QEMU_START_STEP_PREPARE);
+
+    /* The set of disks is final now, so nothing that follows changes
+     * which files need labelling */
+    VIR_DEBUG("Setting domain security labels in the background");
+    label.mgr = driver->securityManager;
+    label.def = vm->def;
+    label.stdin_path = stdin_path;
+    if (virThreadCreate(&label.thread, true,
+                        qemuProcessLabelWorker, &label) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create security labelling thread"));
+        goto cleanup;
+    }
+    labelling = true;
 
-    /* Get the advisory nodeset from numad if 'placement' of
+    /* Get the nodeset to place the domain on if 'placement' of
      * either <vcpu> or <numatune> is 'auto'.
      */
     if ((vm->def->placement_mode ==
          VIR_DOMAIN_CPU_PLACEMENT_MODE_AUTO) ||
         (vm->def->numatune.memory.placement_mode ==
          VIR_DOMAIN_NUMATUNE_MEM_PLACEMENT_MODE_AUTO)) {
-        nodeset = qemuGetNumadAdvice(vm->def);
-        if (!nodeset)
-            goto cleanup;
-
-        VIR_DEBUG("Nodeset returned from numad: %s", nodeset);
-
-        if (virBitmapParse(nodeset, 0, &nodemask,
-                           VIR_DOMAIN_CPUMASK_LEN) < 0)
+        if (!(nodemask = qemuProcessGetAutoNodeset(driver, vm->def)))
             goto cleanup;
     }
     hookData.nodemask = nodemask;
@@ -3622,6 +4208,8 @@ int qemuProcessStart(virConnectPtr conn,
     VIR_DEBUG("Setting up domain cgroup (if required)");
     if (qemuSetupCgroup(driver, vm, nodemask) < 0)
         goto cleanup;
+    qemuProcessStartStage(&timings, &stageStart, priv,
+                          QEMU_START_STEP_CGROUP);
 
     if (VIR_ALLOC(priv->monConfig) < 0) {
         virReportOOMError();
@@ -3640,6 +4228,7 @@ int qemuProcessStart(virConnectPtr conn,
     priv->monError = false;
     priv->monStart = 0;
     priv->gotShutdown = false;
+    priv->nbdPort = 0;
 
     VIR_FREE(priv->pidfile);
     if (!(priv->pidfile = virPidFileBuildPath(driver->stateDir, vm->def->name))) {
@@ -3674,6 +4263,8 @@ int qemuProcessStart(virConnectPtr conn,
                                      priv->monJSON != 0, priv->caps,
                                      migrateFrom, stdin_fd, snapshot, vmop)))
         goto cleanup;
+    qemuProcessStartStage(&timings, &stageStart, priv,
+                          QEMU_START_STEP_CMDLINE);
 
     /* now that we know it is about to start call the hook if present */
     if (virHookPresent(VIR_HOOK_DRIVER_QEMU)) {
@@ -3776,10 +4367,18 @@ int qemuProcessStart(virConnectPtr conn,
         goto cleanup;
     }
 
-    VIR_DEBUG("Setting domain security labels");
-    if (virSecurityManagerSetAllLabel(driver->securityManager,
-                                      vm->def, stdin_path) < 0)
+    qemuProcessStartStage(&timings, &stageStart, priv,
+                          QEMU_START_STEP_EXEC);
+
+    VIR_DEBUG("Waiting for domain security labels");
+    labelling = false;
+    if (qemuProcessLabelWait(&label) < 0)
         goto cleanup;
+    qemuProcessStartStage(&timings, &stageStart, priv,
+                          QEMU_START_STEP_LABEL);
+    priv->startLabel = label.duration;
+    virBufferAsprintf(&timings, " (labelling took %llums, capabilities %llums)",
+                      label.duration, capsData.duration);
 
     /* Security manager labeled all devices, therefore
      * if any operation from now on fails and we goto cleanup,
@@ -3823,6 +4422,8 @@ int qemuProcessStart(virConnectPtr conn,
     VIR_DEBUG("Waiting for monitor to show up");
     if (qemuProcessWaitForMonitor(driver, vm, priv->caps, pos) < 0)
         goto cleanup;
+    qemuProcessStartStage(&timings, &stageStart, priv,
+                          QEMU_START_STEP_MONITOR);
 
     /* Failure to connect to agent shouldn't be fatal */
     if (qemuConnectAgent(driver, vm) < 0) {
@@ -3852,6 +4453,18 @@ int qemuProcessStart(virConnectPtr conn,
     if (qemuProcessSetEmulatorAffinites(conn, vm) < 0)
         goto cleanup;
 
+    VIR_DEBUG("Detecting IOThread PIDs");
+    if (qemuProcessDetectIOThreadPIDs(driver, vm) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Setting cgroup for each IOThread (if required)");
+    if (qemuSetupCgroupForIOThreads(driver, vm) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Setting IOThread affinities");
+    if (qemuProcessSetIOThreadAffinites(vm) < 0)
+        goto cleanup;
+
     VIR_DEBUG("Setting any required VM passwords");
     if (qemuProcessInitPasswords(conn, driver, vm) < 0)
         goto cleanup;
@@ -3893,6 +4506,18 @@ int qemuProcessStart(virConnectPtr conn,
         qemuDomainObjExitMonitorWithDriver(driver, vm);
         goto cleanup;
     }
+    /* Older qemu cannot poll the guest; the statistics are then
+     * requested from it on demand as before */
+    if (driver->memoryStatsPeriod &&
+        vm->def->memballoon &&
+        vm->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO &&
+        vm->def->memballoon->info.alias &&
+        qemuMonitorSetMemoryStatsPeriod(priv->mon,
+                                        vm->def->memballoon->info.alias,
+                                        driver->memoryStatsPeriod) < 0) {
+        VIR_DEBUG("Unable to enable balloon statistics polling");
+        virResetLastError();
+    }
     qemuDomainObjExitMonitorWithDriver(driver, vm);
 
     if (!(flags & VIR_QEMU_PROCESS_START_PAUSED)) {
@@ -3938,6 +4563,17 @@ int qemuProcessStart(virConnectPtr conn,
             goto cleanup;
     }
 
+    qemuProcessStartStage(&timings, &stageStart, priv,
+                          QEMU_START_STEP_SETUP);
+    if (virBufferError(&timings)) {
+        virBufferFreeAndReset(&timings);
+    } else {
+        char *str = virBufferContentAndReset(&timings);
+        VIR_INFO("Domain %s started in %llums:%s", vm->def->name,
+                 stageStart - startTime, NULLSTR(str));
+        VIR_FREE(str);
+    }
+
     virCommandFree(cmd);
     VIR_FORCE_CLOSE(logfile);
 
@@ -3947,7 +4583,25 @@ cleanup:
     /* We jump here if we failed to start the VM for any reason, or
      * if we failed to initialize the now running VM. kill it off and
      * pretend we never started it */
-    VIR_FREE(nodeset);
+    if (labelling) {
+        /* Labels the thread managed to apply must be restored, but
+         * the error that sent us here is the one to report */
+        virErrorPtr orig_err = virSaveLastError();
+
+        if (qemuProcessLabelWait(&label) == 0)
+            stop_flags &= ~VIR_QEMU_PROCESS_STOP_NO_RELABEL;
+        if (orig_err) {
+            virSetError(orig_err);
+            virFreeError(orig_err);
+        }
+    }
+    if (probing) {
+        /* Nobody wants the capabilities any more, nor its error */
+        virThreadJoin(&capsData.thread);
+        virObjectUnref(capsData.caps);
+        virFreeError(capsData.err);
+    }
+    virBufferFreeAndReset(&timings);
     virBitmapFree(nodemask);
     virCommandFree(cmd);
     VIR_FORCE_CLOSE(logfile);
@@ -4088,6 +4742,7 @@ void qemuProcessStop(virQEMUDriverPtr driver,
         qemuMonitorClose(priv->mon);
         priv->mon = NULL;
     }
+    qemuDomainObjInvalidateStatsCache(vm);
 
     if (priv->monConfig) {
         if (priv->monConfig->type == VIR_DOMAIN_CHR_TYPE_UNIX)
@@ -4109,10 +4764,11 @@ void qemuProcessStop(virQEMUDriverPtr driver,
     if (virHookPresent(VIR_HOOK_DRIVER_QEMU)) {
         char *xml = qemuDomainDefFormatXML(driver, vm->def, 0);
 
-        /* we can't stop the operation even if the script raised an error */
-        virHookCall(VIR_HOOK_DRIVER_QEMU, vm->def->name,
-                    VIR_HOOK_QEMU_OP_STOPPED, VIR_HOOK_SUBOP_END,
-                    NULL, xml, NULL);
+        /* we can't stop the operation even if the script raised an
+         * error, so there is no need to wait for it either */
+        virHookCallAsync(VIR_HOOK_DRIVER_QEMU, vm->def->name,
+                         VIR_HOOK_QEMU_OP_STOPPED, VIR_HOOK_SUBOP_END,
+                         NULL, xml);
         VIR_FREE(xml);
     }
 
@@ -4197,6 +4853,8 @@ retry:
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
     VIR_FREE(priv->vcpupids);
     priv->nvcpupids = 0;
+    VIR_FREE(priv->iothreadpids);
+    priv->niothreadpids = 0;
     virObjectUnref(priv->caps);
     priv->caps = NULL;
     VIR_FREE(priv->pidfile);
@@ -4205,10 +4863,11 @@ retry:
     if (virHookPresent(VIR_HOOK_DRIVER_QEMU)) {
         char *xml = qemuDomainDefFormatXML(driver, vm->def, 0);
 
-        /* we can't stop the operation even if the script raised an error */
-        virHookCall(VIR_HOOK_DRIVER_QEMU, vm->def->name,
-                    VIR_HOOK_QEMU_OP_RELEASE, VIR_HOOK_SUBOP_END,
-                    NULL, xml, NULL);
+        /* we can't stop the operation even if the script raised an
+         * error, so there is no need to wait for it either */
+        virHookCallAsync(VIR_HOOK_DRIVER_QEMU, vm->def->name,
+                         VIR_HOOK_QEMU_OP_RELEASE, VIR_HOOK_SUBOP_END,
+                         NULL, xml);
         VIR_FREE(xml);
     }
 
@@ -4217,7 +4876,9 @@ retry:
         vm->def = vm->newDef;
         vm->def->id = -1;
         vm->newDef = NULL;
+        virDomainObjListUpdateMetadataIndex(&driver->domains, vm);
     }
+    virDomainObjInvalidateXMLCache(vm);
 
     if (orig_err) {
         virSetError(orig_err);
@@ -98,5 +98,8 @@ bool qemuProcessAutoDestroyActive(virQEMUDriverPtr driver,
                                   virDomainObjPtr vm);
 virBitmapPtr qemuPrepareCpumap(virQEMUDriverPtr driver,
                                virBitmapPtr nodemask);
+int qemuProcessRebalanceNUMA(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm,
+                             unsigned int threshold);
 
 #endif /* __QEMU_PROCESS_H__ */
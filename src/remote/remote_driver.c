@@ -47,6 +47,8 @@
 #include "viruri.h"
 #include "virauth.h"
 #include "virauthconfig.h"
+#include "virhash.h"
+#include "uuid.h"
 
 #define VIR_FROM_THIS VIR_FROM_REMOTE
 
@@ -87,10 +89,53 @@ struct private_data {
     int localUses;              /* Ref count for private data */
     char *hostname;             /* Original hostname */
     bool serverKeepAlive;       /* Does server support keepalive protocol? */
+    int serverEventFilter;      /* Can server filter events by domain?
+                                 * -1 until probed */
+    char *sharedKey;            /* Key in remoteShared if connections
+                                 * with the same URI share this one */
+    virConnectPtr eventConn;    /* Connection events are built for,
+                                 * if not the one which was opened */
 
     virDomainEventStatePtr domainEventState;
+
+    virMutex cacheLock;         /* Leaf lock protecting domainCache */
+    virHashTablePtr domainCache; /* remoteDomainCacheEntry by UUID if the
+                                  * "cache" URI parameter enabled it */
+};
+
+/* What is known about a domain without asking the server again. Each
+ * entry is dropped on a lifecycle event of its domain, the whole
+ * cache on any call which may change a domain. */
+typedef struct _remoteDomainCacheEntry remoteDomainCacheEntry;
+typedef remoteDomainCacheEntry *remoteDomainCacheEntryPtr;
+struct _remoteDomainCacheEntry {
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char *name;                 /* NULL until the domain was looked up */
+    int id;
+    int persistent;             /* -1 if not known yet */
+    char *ostype;               /* NULL if not known yet */
 };
 
+/* Read-only connections opened with the "shared" URI parameter,
+ * keyed by their URI */
+static virMutex remoteSharedLock;
+static virHashTablePtr remoteShared;
+
+static int
+remoteSharedOnceInit(void)
+{
+    if (virMutexInit(&remoteSharedLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return -1;
+    }
+    if (!(remoteShared = virHashCreate(5, NULL)))
+        return -1;
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(remoteShared)
+
 enum {
     REMOTE_CALL_QEMU              = (1 << 0),
 };
@@ -114,6 +159,11 @@ static int callWithFD(virConnectPtr conn, struct private_data *priv,
                       unsigned int flags, int fd, int proc_nr,
                       xdrproc_t args_filter, char *args,
                       xdrproc_t ret_filter, char *ret);
+static int callWithFDs(virConnectPtr conn, struct private_data *priv,
+                       unsigned int flags, int *fds, size_t nfds,
+                       int proc_nr,
+                       xdrproc_t args_filter, char *args,
+                       xdrproc_t ret_filter, char *ret);
 static int remoteAuthenticate(virConnectPtr conn, struct private_data *priv,
                               virConnectAuthPtr auth, const char *authtype);
 #if HAVE_SASL
@@ -145,6 +195,217 @@ static void make_nonnull_domain_snapshot(remote_nonnull_domain_snapshot *snapsho
 static void remoteDomainEventQueue(struct private_data *priv, virDomainEventPtr event);
 /*----------------------------------------------------------------------*/
 
+/* Cache of domain lookups and immutable domain attributes, see
+ * remoteDomainCacheEntry.  All helpers expect cacheLock to be held. */
+
+static void
+remoteDomainCacheEntryFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    remoteDomainCacheEntryPtr entry = payload;
+
+    VIR_FREE(entry->name);
+    VIR_FREE(entry->ostype);
+    VIR_FREE(entry);
+}
+
+static remoteDomainCacheEntryPtr
+remoteDomainCacheFind(struct private_data *priv, const unsigned char *uuid)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(uuid, uuidstr);
+    return virHashLookup(priv->domainCache, uuidstr);
+}
+
+static int
+remoteDomainCacheMatchName(const void *payload,
+                           const void *name ATTRIBUTE_UNUSED,
+                           const void *data)
+{
+    const remoteDomainCacheEntry *entry = payload;
+
+    return entry->name && STREQ(entry->name, data);
+}
+
+/* Returns the entry of @uuid, adding an empty one if there is none
+ * yet, or NULL if that failed. Failing to cache is not an error. */
+static remoteDomainCacheEntryPtr
+remoteDomainCacheGet(struct private_data *priv, const unsigned char *uuid)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    remoteDomainCacheEntryPtr entry;
+
+    virUUIDFormat(uuid, uuidstr);
+    if ((entry = virHashLookup(priv->domainCache, uuidstr)))
+        return entry;
+
+    if (VIR_ALLOC(entry) < 0)
+        return NULL;
+    memcpy(entry->uuid, uuid, VIR_UUID_BUFLEN);
+    entry->id = -1;
+    entry->persistent = -1;
+
+    if (virHashAddEntry(priv->domainCache, uuidstr, entry) < 0) {
+        virResetLastError();
+        VIR_FREE(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+/* Remember what a lookup returned about @dom */
+static void
+remoteDomainCacheAddDomain(struct private_data *priv, virDomainPtr dom)
+{
+    remoteDomainCacheEntryPtr entry;
+    char *name;
+
+    if (!(entry = remoteDomainCacheGet(priv, dom->uuid)) ||
+        !(name = strdup(dom->name)))
+        return;
+
+    VIR_FREE(entry->name);
+    entry->name = name;
+    entry->id = dom->id;
+}
+
+static virDomainPtr
+remoteDomainCacheGetDomain(virConnectPtr conn,
+                           remoteDomainCacheEntryPtr entry)
+{
+    virDomainPtr dom;
+
+    if (!entry || !entry->name)
+        return NULL;
+
+    if ((dom = virGetDomain(conn, entry->name, entry->uuid)))
+        dom->id = entry->id;
+    return dom;
+}
+
+/* Calls which leave every domain as it was, and so the cache valid */
+static bool
+remoteDomainCacheKeepsProc(unsigned int flags, int proc_nr)
+{
+    if (flags & REMOTE_CALL_QEMU)
+        return false;
+
+    switch (proc_nr) {
+    case REMOTE_PROC_GET_TYPE:
+    case REMOTE_PROC_GET_VERSION:
+    case REMOTE_PROC_GET_LIB_VERSION:
+    case REMOTE_PROC_GET_HOSTNAME:
+    case REMOTE_PROC_GET_URI:
+    case REMOTE_PROC_GET_CAPABILITIES:
+    case REMOTE_PROC_GET_MAX_VCPUS:
+    case REMOTE_PROC_IS_SECURE:
+    case REMOTE_PROC_SUPPORTS_FEATURE:
+    case REMOTE_PROC_NODE_GET_INFO:
+    case REMOTE_PROC_NODE_GET_FREE_MEMORY:
+    case REMOTE_PROC_NODE_GET_CPU_STATS:
+    case REMOTE_PROC_NODE_GET_MEMORY_STATS:
+    case REMOTE_PROC_NUM_OF_DOMAINS:
+    case REMOTE_PROC_LIST_DOMAINS:
+    case REMOTE_PROC_NUM_OF_DEFINED_DOMAINS:
+    case REMOTE_PROC_LIST_DEFINED_DOMAINS:
+    case REMOTE_PROC_CONNECT_LIST_ALL_DOMAINS:
+    case REMOTE_PROC_DOMAIN_LOOKUP_BY_ID:
+    case REMOTE_PROC_DOMAIN_LOOKUP_BY_NAME:
+    case REMOTE_PROC_DOMAIN_LOOKUP_BY_UUID:
+    case REMOTE_PROC_DOMAIN_GET_INFO:
+    case REMOTE_PROC_DOMAIN_GET_STATE:
+    case REMOTE_PROC_DOMAIN_GET_XML_DESC:
+    case REMOTE_PROC_DOMAIN_GET_OS_TYPE:
+    case REMOTE_PROC_DOMAIN_GET_MAX_MEMORY:
+    case REMOTE_PROC_DOMAIN_GET_AUTOSTART:
+    case REMOTE_PROC_DOMAIN_GET_VCPUS:
+    case REMOTE_PROC_DOMAIN_GET_VCPUS_FLAGS:
+    case REMOTE_PROC_DOMAIN_GET_JOB_INFO:
+    case REMOTE_PROC_DOMAIN_GET_SCHEDULER_TYPE:
+    case REMOTE_PROC_DOMAIN_IS_ACTIVE:
+    case REMOTE_PROC_DOMAIN_IS_PERSISTENT:
+    case REMOTE_PROC_DOMAIN_IS_UPDATED:
+    case REMOTE_PROC_DOMAIN_BLOCK_STATS:
+    case REMOTE_PROC_DOMAIN_BLOCK_STATS_FLAGS:
+    case REMOTE_PROC_DOMAIN_INTERFACE_STATS:
+    case REMOTE_PROC_DOMAIN_MEMORY_STATS:
+    case REMOTE_PROC_DOMAIN_EVENTS_REGISTER:
+    case REMOTE_PROC_DOMAIN_EVENTS_DEREGISTER:
+    case REMOTE_PROC_DOMAIN_EVENTS_REGISTER_ANY:
+    case REMOTE_PROC_DOMAIN_EVENTS_DEREGISTER_ANY:
+    case REMOTE_PROC_DOMAIN_EVENTS_REGISTER_DOMAIN:
+    case REMOTE_PROC_DOMAIN_EVENTS_DEREGISTER_DOMAIN:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/* Called with the driver lock held after every call; the lifecycle
+ * event of a change made by this very connection may only come in
+ * after its reply */
+static void
+remoteDomainCacheCheckProc(struct private_data *priv,
+                           unsigned int flags,
+                           int proc_nr)
+{
+    if (!priv->domainCache || remoteDomainCacheKeepsProc(flags, proc_nr))
+        return;
+
+    virMutexLock(&priv->cacheLock);
+    virHashRemoveAll(priv->domainCache);
+    virMutexUnlock(&priv->cacheLock);
+}
+
+/* Called from the event handlers, without the driver lock */
+static void
+remoteDomainCacheInvalidate(struct private_data *priv,
+                            const unsigned char *uuid)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    if (!priv->domainCache)
+        return;
+
+    virUUIDFormat(uuid, uuidstr);
+    virMutexLock(&priv->cacheLock);
+    virHashRemoveEntry(priv->domainCache, uuidstr);
+    virMutexUnlock(&priv->cacheLock);
+}
+
+/* The cache is only usable once the server sends us the lifecycle
+ * events of every domain, which this connection keeps registered
+ * until it is closed. If that is impossible, we go without. */
+static void
+remoteDomainCacheStart(virConnectPtr conn, struct private_data *priv)
+{
+    remote_domain_events_register_any_args args;
+
+    if (!priv->domainCache)
+        return;
+
+    args.eventID = VIR_DOMAIN_EVENT_ID_LIFECYCLE;
+    if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_EVENTS_REGISTER_ANY,
+             (xdrproc_t) xdr_remote_domain_events_register_any_args, (char *) &args,
+             (xdrproc_t) xdr_void, (char *) NULL) == -1) {
+        VIR_DEBUG("Cannot get lifecycle events, not caching domains");
+        virResetLastError();
+        virHashFree(priv->domainCache);
+        priv->domainCache = NULL;
+    }
+}
+
+/* Whether the server keeps sending @eventID for every domain
+ * regardless of callbacks, because the domain cache needs them */
+static bool
+remoteDomainCacheHoldsEvents(struct private_data *priv, int eventID)
+{
+    return priv->domainCache && eventID == VIR_DOMAIN_EVENT_ID_LIFECYCLE;
+}
+
+/*----------------------------------------------------------------------*/
+
 /* Helper functions for remoteOpen. */
 static char *get_transport_from_scheme(char *scheme);
 
@@ -379,6 +640,44 @@ static void remoteClientCloseFunc(virNetClientPtr client ATTRIBUTE_UNUSED,
         var->ignore = 1;                                                    \
         continue;                                                           \
     }
+/*
+ * Hand the daemon a shared memory ring to carry messages from now
+ * on, instead of the UNIX socket. Not getting one is not an error,
+ * but once the daemon has switched over we must follow.
+ */
+static int
+remoteOpenShmRing(virConnectPtr conn, struct private_data *priv)
+{
+    remote_connect_open_shm_ring_args args = { VIR_NET_SHM_RING_SIZE, 0 };
+    virNetShmRingPtr ring;
+    int fds[VIR_NET_SHM_RING_FD_LAST];
+    int ret = 0;
+
+    if (!(ring = virNetShmRingNewClient(VIR_NET_SHM_RING_SIZE))) {
+        virResetLastError();
+        return 0;
+    }
+
+    virNetShmRingGetFDs(ring, fds);
+
+    if (callWithFDs(conn, priv, 0, fds, VIR_NET_SHM_RING_FD_LAST,
+                    REMOTE_PROC_CONNECT_OPEN_SHM_RING,
+                    (xdrproc_t) xdr_remote_connect_open_shm_ring_args,
+                    (char *) &args,
+                    (xdrproc_t) xdr_void, (char *) NULL) == -1) {
+        VIR_DEBUG("Server did not accept a shared memory ring");
+        virResetLastError();
+        goto cleanup;
+    }
+
+    if (virNetClientSetShmRing(priv->client, ring) < 0)
+        ret = -1;
+
+cleanup:
+    virObjectUnref(ring);
+    return ret;
+}
+
 /*
  * URIs that this driver needs to handle:
  *
@@ -477,6 +776,9 @@ doRemoteOpen(virConnectPtr conn,
     char *name = NULL, *command = NULL, *sockname = NULL, *netcat = NULL;
     char *port = NULL, *authtype = NULL, *username = NULL;
     bool sanity = true, verify = true, tty ATTRIBUTE_UNUSED = true;
+    bool compress = true;
+    bool shm = false;
+    bool cache = false;
     char *pkipath = NULL, *keyfile = NULL, *sshauth = NULL;
 
     char *knownHostsVerify = NULL,  *knownHosts = NULL;
@@ -532,6 +834,33 @@ doRemoteOpen(virConnectPtr conn,
             EXTRACT_URI_ARG_BOOL("no_sanity", sanity);
             EXTRACT_URI_ARG_BOOL("no_verify", verify);
             EXTRACT_URI_ARG_BOOL("no_tty", tty);
+            EXTRACT_URI_ARG_BOOL("no_compress", compress);
+
+            if (STRCASEEQ(var->name, "shm")) {
+                int tmp;
+                if (virStrToLong_i(var->value, NULL, 10, &tmp) < 0) {
+                    virReportError(VIR_ERR_INVALID_ARG,
+                                   _("Failed to parse value of URI component %s"),
+                                   var->name);
+                    goto failed;
+                }
+                shm = tmp != 0;
+                var->ignore = 1;
+                continue;
+            }
+
+            if (STRCASEEQ(var->name, "cache")) {
+                int tmp;
+                if (virStrToLong_i(var->value, NULL, 10, &tmp) < 0) {
+                    virReportError(VIR_ERR_INVALID_ARG,
+                                   _("Failed to parse value of URI component %s"),
+                                   var->name);
+                    goto failed;
+                }
+                cache = tmp != 0;
+                var->ignore = 1;
+                continue;
+            }
 
             if (STRCASEEQ(var->name, "authfile")) {
                 /* Strip this param, used by virauth.c */
@@ -539,6 +868,12 @@ doRemoteOpen(virConnectPtr conn,
                 continue;
             }
 
+            if (STRCASEEQ(var->name, "shared")) {
+                /* Strip this param, handled by remoteOpen */
+                var->ignore = 1;
+                continue;
+            }
+
             VIR_DEBUG("passing through variable '%s' ('%s') to remote end",
                        var->name, var->value);
         }
@@ -749,13 +1084,15 @@ doRemoteOpen(virConnectPtr conn,
 
     virNetClientSetCloseCallback(priv->client,
                                  remoteClientCloseFunc,
-                                 conn, NULL);
+                                 priv->eventConn ? priv->eventConn : conn,
+                                 NULL);
 
     if (!(priv->remoteProgram = virNetClientProgramNew(REMOTE_PROGRAM,
                                                        REMOTE_PROTOCOL_VERSION,
                                                        remoteDomainEvents,
                                                        ARRAY_CARDINALITY(remoteDomainEvents),
-                                                       conn)))
+                                                       priv->eventConn ?
+                                                       priv->eventConn : conn)))
         goto failed;
     if (!(priv->qemuProgram = virNetClientProgramNew(QEMU_PROGRAM,
                                                      QEMU_PROTOCOL_VERSION,
@@ -802,6 +1139,51 @@ doRemoteOpen(virConnectPtr conn,
             goto failed;
     }
 
+    /* Compression only pays off where bandwidth is scarce, so
+     * it is not bothered with for local UNIX socket connections */
+    if (compress && transport != trans_unix &&
+        virNetMessageCompressionSupported()) {
+        remote_supports_feature_args args =
+            { VIR_DRV_FEATURE_PROGRAM_COMPRESSION };
+        remote_supports_feature_ret ret = { 0 };
+
+        if (call(conn, priv, 0, REMOTE_PROC_SUPPORTS_FEATURE,
+                 (xdrproc_t)xdr_remote_supports_feature_args, (char *) &args,
+                 (xdrproc_t)xdr_remote_supports_feature_ret, (char *) &ret) == -1) {
+            virResetLastError();
+            ret.supported = 0;
+        }
+
+        if (ret.supported)
+            virNetClientEnableCompression(priv->client);
+        else
+            VIR_DEBUG("Server does not support compressed messages");
+    }
+
+    /* Keep stream data the server sends us within what we
+     * have room for */
+    {
+        remote_supports_feature_args args =
+            { VIR_DRV_FEATURE_STREAM_CREDIT };
+        remote_supports_feature_ret ret = { 0 };
+
+        if (call(conn, priv, 0, REMOTE_PROC_SUPPORTS_FEATURE,
+                 (xdrproc_t)xdr_remote_supports_feature_args, (char *) &args,
+                 (xdrproc_t)xdr_remote_supports_feature_ret, (char *) &ret) == -1) {
+            virResetLastError();
+            ret.supported = 0;
+        }
+
+        if (ret.supported)
+            virNetClientEnableStreamCredit(priv->client);
+        else
+            VIR_DEBUG("Server does not support stream credit");
+    }
+
+    if (shm && transport == trans_unix &&
+        remoteOpenShmRing(conn, priv) < 0)
+        goto failed;
+
     /* Now try and find out what URI the daemon used */
     if (conn->uri == NULL) {
         remote_get_uri_ret uriret;
@@ -824,6 +1206,10 @@ doRemoteOpen(virConnectPtr conn,
     if (!(priv->domainEventState = virDomainEventStateNew()))
         goto failed;
 
+    if (cache &&
+        !(priv->domainCache = virHashCreate(50, remoteDomainCacheEntryFree)))
+        goto failed;
+
     /* Successful. */
     retcode = VIR_DRV_OPEN_SUCCESS;
 
@@ -875,8 +1261,16 @@ remoteAllocPrivateData(void)
         VIR_FREE(priv);
         return NULL;
     }
+    if (virMutexInit(&priv->cacheLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        virMutexDestroy(&priv->lock);
+        VIR_FREE(priv);
+        return NULL;
+    }
     remoteDriverLock(priv);
     priv->localUses = 1;
+    priv->serverEventFilter = -1;
 
     return priv;
 }
@@ -902,26 +1296,141 @@ remoteOpenSecondaryDriver(virConnectPtr conn,
         VIR_FREE(*priv);
     } else {
         (*priv)->localUses = 1;
+        /* Domains are only looked up through the primary connection */
+        virHashFree((*priv)->domainCache);
+        (*priv)->domainCache = NULL;
         remoteDriverUnlock(*priv);
     }
 
     return ret;
 }
 
+static void remoteProbeEventFilter(virConnectPtr conn,
+                                   struct private_data *priv);
+
+/* If @conn is a read-only connection asking to be shared, join the
+ * connection to the same URI another one opened, or store the key it
+ * will be published under in @sharedKey.  Returns
+ * VIR_DRV_OPEN_DECLINED if a new connection has to be opened.  */
+static virDrvOpenStatus
+remoteOpenShared(virConnectPtr conn,
+                 unsigned int flags,
+                 char **sharedKey)
+{
+    struct private_data *priv;
+    bool shared = false;
+    int i;
+
+    *sharedKey = NULL;
+
+    if (!conn->uri || !(flags & VIR_CONNECT_RO))
+        return VIR_DRV_OPEN_DECLINED;
+
+    for (i = 0; i < conn->uri->paramsCount; i++) {
+        virURIParamPtr var = &conn->uri->params[i];
+        int tmp;
+
+        if (STRCASENEQ(var->name, "shared"))
+            continue;
+        if (virStrToLong_i(var->value, NULL, 10, &tmp) < 0) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("Failed to parse value of URI component %s"),
+                           var->name);
+            return VIR_DRV_OPEN_ERROR;
+        }
+        shared = tmp != 0;
+    }
+
+    if (!shared)
+        return VIR_DRV_OPEN_DECLINED;
+
+    if (remoteSharedInitialize() < 0 ||
+        !(*sharedKey = virURIFormat(conn->uri)))
+        return VIR_DRV_OPEN_ERROR;
+
+    virMutexLock(&remoteSharedLock);
+    if (!(priv = virHashLookup(remoteShared, *sharedKey))) {
+        virMutexUnlock(&remoteSharedLock);
+        return VIR_DRV_OPEN_DECLINED;
+    }
+
+    remoteDriverLock(priv);
+    priv->localUses++;
+    conn->privateData = priv;
+    remoteDriverUnlock(priv);
+    virMutexUnlock(&remoteSharedLock);
+
+    VIR_DEBUG("Sharing connection %p to %s", priv, *sharedKey);
+    return VIR_DRV_OPEN_SUCCESS;
+}
+
+
+/* Publish the connection @priv freshly opened by @conn under
+ * @sharedKey, which is consumed.  Its callbacks are counted across
+ * connections, which only works with a server registering callbacks
+ * restricted to a domain separately; otherwise @priv stays private
+ * to @conn.  */
+static void
+remoteAddShared(virConnectPtr conn,
+                struct private_data *priv,
+                char *sharedKey)
+{
+    remoteProbeEventFilter(conn, priv);
+    if (priv->serverEventFilter != 1) {
+        VIR_DEBUG("Server cannot filter events, not sharing %s", sharedKey);
+        VIR_FREE(sharedKey);
+        return;
+    }
+
+    virMutexLock(&remoteSharedLock);
+    /* Another thread may have published the same URI meanwhile; the
+     * first one stays in use for new connections */
+    if (!virHashLookup(remoteShared, sharedKey) &&
+        virHashAddEntry(remoteShared, sharedKey, priv) == 0) {
+        priv->sharedKey = sharedKey;
+        sharedKey = NULL;
+    } else {
+        virResetLastError();
+    }
+    virMutexUnlock(&remoteSharedLock);
+    VIR_FREE(sharedKey);
+}
+
+
 static virDrvOpenStatus
 remoteOpen(virConnectPtr conn,
            virConnectAuthPtr auth,
            unsigned int flags)
 {
     struct private_data *priv;
+    char *sharedKey = NULL;
     int ret, rflags = 0;
     const char *autostart = getenv("LIBVIRT_AUTOSTART");
 
     if (inside_daemon && (!conn->uri || (conn->uri && !conn->uri->server)))
         return VIR_DRV_OPEN_DECLINED;
 
-    if (!(priv = remoteAllocPrivateData()))
+    if ((ret = remoteOpenShared(conn, flags, &sharedKey)) !=
+        VIR_DRV_OPEN_DECLINED) {
+        VIR_FREE(sharedKey);
+        return ret;
+    }
+
+    if (!(priv = remoteAllocPrivateData())) {
+        VIR_FREE(sharedKey);
+        return VIR_DRV_OPEN_ERROR;
+    }
+
+    /* Events are built for a connection of our own, since the one
+     * being opened may be closed long before the ones sharing it */
+    if (sharedKey && !(priv->eventConn = virGetConnect())) {
+        remoteDriverUnlock(priv);
+        VIR_FREE(priv);
+        VIR_FREE(sharedKey);
         return VIR_DRV_OPEN_ERROR;
+    }
+    if (priv->eventConn)
+        priv->eventConn->privateData = priv;
 
     if (flags & VIR_CONNECT_RO)
         rflags |= VIR_DRV_OPEN_REMOTE_RO;
@@ -971,9 +1480,14 @@ remoteOpen(virConnectPtr conn,
     if (ret != VIR_DRV_OPEN_SUCCESS) {
         conn->privateData = NULL;
         remoteDriverUnlock(priv);
+        virObjectUnref(priv->eventConn);
         VIR_FREE(priv);
+        VIR_FREE(sharedKey);
     } else {
         conn->privateData = priv;
+        remoteDomainCacheStart(conn, priv);
+        if (sharedKey)
+            remoteAddShared(conn, priv, sharedKey);
         remoteDriverUnlock(priv);
     }
     return ret;
@@ -1023,28 +1537,23 @@ doRemoteClose(virConnectPtr conn, struct private_data *priv)
     virDomainEventStateFree(priv->domainEventState);
     priv->domainEventState = NULL;
 
+    virHashFree(priv->domainCache);
+    priv->domainCache = NULL;
+
+    virObjectUnref(priv->eventConn);
+    priv->eventConn = NULL;
+    VIR_FREE(priv->sharedKey);
+
     return ret;
 }
 
+static int
+remoteGenericClose(virConnectPtr conn, void **genericPrivateData);
+
 static int
 remoteClose(virConnectPtr conn)
 {
-    int ret = 0;
-    struct private_data *priv = conn->privateData;
-
-    remoteDriverLock(priv);
-    priv->localUses--;
-    if (!priv->localUses) {
-        ret = doRemoteClose(conn, priv);
-        conn->privateData = NULL;
-        remoteDriverUnlock(priv);
-        virMutexDestroy(&priv->lock);
-        VIR_FREE(priv);
-    }
-    if (priv)
-        remoteDriverUnlock(priv);
-
-    return ret;
+    return remoteGenericClose(conn, &conn->privateData);
 }
 
 
@@ -1589,27 +2098,337 @@ cleanup:
 }
 
 static int
-remoteDeserializeDomainDiskErrors(remote_domain_disk_error *ret_errors_val,
-                                  u_int ret_errors_len,
-                                  int limit,
-                                  virDomainDiskErrorPtr errors,
-                                  int maxerrors)
+remoteConnectGetAllDomainStats(virConnectPtr conn,
+                               unsigned int stats,
+                               virDomainStatsRecordPtr **retStats,
+                               unsigned int flags)
 {
-    int i = 0;
-    int j;
+    int rv = -1;
+    int i;
+    virDomainStatsRecordPtr *tmpret = NULL;
+    remote_connect_get_all_domain_stats_args args;
+    remote_connect_get_all_domain_stats_ret ret;
 
-    if (ret_errors_len > limit || ret_errors_len > maxerrors) {
+    struct private_data *priv = conn->privateData;
+
+    remoteDriverLock(priv);
+
+    args.stats = stats;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(conn,
+             priv,
+             0,
+             REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS,
+             (xdrproc_t) xdr_remote_connect_get_all_domain_stats_args,
+             (char *) &args,
+             (xdrproc_t) xdr_remote_connect_get_all_domain_stats_ret,
+             (char *) &ret) == -1)
+        goto done;
+
+    if (ret.retStats.retStats_len > REMOTE_DOMAIN_LIST_MAX) {
         virReportError(VIR_ERR_RPC, "%s",
-                       _("returned number of disk errors exceeds limit"));
-        goto error;
+                       _("returned number of domain stats records exceeds limit"));
+        goto cleanup;
     }
 
-    for (i = 0; i < ret_errors_len; i++) {
-        if (!(errors[i].disk = strdup(ret_errors_val[i].disk))) {
-            virReportOOMError();
-            goto error;
-        }
-        errors[i].error = ret_errors_val[i].error;
+    if (VIR_ALLOC_N(tmpret, ret.retStats.retStats_len + 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0; i < ret.retStats.retStats_len; i++) {
+        remote_domain_stats_record *rec = ret.retStats.retStats_val + i;
+        virDomainStatsRecordPtr elem;
+
+        if (VIR_ALLOC(elem) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        tmpret[i] = elem;
+
+        if (!(elem->dom = get_nonnull_domain(conn, rec->dom))) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        if (VIR_ALLOC_N(elem->params, rec->params.params_len) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        elem->nparams = rec->params.params_len;
+
+        if (remoteDeserializeTypedParameters(rec->params.params_val,
+                                             rec->params.params_len,
+                                             REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX,
+                                             elem->params,
+                                             &elem->nparams) < 0) {
+            elem->nparams = 0;
+            goto cleanup;
+        }
+    }
+
+    *retStats = tmpret;
+    tmpret = NULL;
+    rv = ret.retStats.retStats_len;
+
+cleanup:
+    virDomainStatsRecordListFree(tmpret);
+
+    xdr_free((xdrproc_t) xdr_remote_connect_get_all_domain_stats_ret,
+             (char *) &ret);
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static int
+remoteConnectListAllDomainsFiltered(virConnectPtr conn,
+                                    virDomainPtr **domains,
+                                    virTypedParameterPtr filters,
+                                    int nfilters,
+                                    unsigned int flags)
+{
+    int rv = -1;
+    int i;
+    virDomainPtr *doms = NULL;
+    remote_connect_list_all_domains_filtered_args args;
+    remote_connect_list_all_domains_filtered_ret ret;
+
+    struct private_data *priv = conn->privateData;
+
+    remoteDriverLock(priv);
+
+    memset(&args, 0, sizeof(args));
+    memset(&ret, 0, sizeof(ret));
+
+    if (nfilters > REMOTE_CONNECT_LIST_ALL_DOMAINS_FILTERS_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("too many domain list filters: %d > %d"),
+                       nfilters, REMOTE_CONNECT_LIST_ALL_DOMAINS_FILTERS_MAX);
+        goto done;
+    }
+
+    if (remoteSerializeTypedParameters(filters, nfilters,
+                                       &args.filters.filters_val,
+                                       &args.filters.filters_len) < 0)
+        goto done;
+
+    args.need_results = !!domains;
+    args.flags = flags;
+
+    if (call(conn,
+             priv,
+             0,
+             REMOTE_PROC_CONNECT_LIST_ALL_DOMAINS_FILTERED,
+             (xdrproc_t) xdr_remote_connect_list_all_domains_filtered_args,
+             (char *) &args,
+             (xdrproc_t) xdr_remote_connect_list_all_domains_filtered_ret,
+             (char *) &ret) == -1)
+        goto done;
+
+    if (domains) {
+        if (VIR_ALLOC_N(doms, ret.domains.domains_len + 1) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        for (i = 0; i < ret.domains.domains_len; i++) {
+            doms[i] = get_nonnull_domain(conn, ret.domains.domains_val[i]);
+            if (!doms[i]) {
+                virReportOOMError();
+                goto cleanup;
+            }
+        }
+        *domains = doms;
+        doms = NULL;
+    }
+
+    rv = ret.ret;
+
+cleanup:
+    if (doms) {
+        for (i = 0; i < ret.domains.domains_len; i++)
+            if (doms[i])
+                virDomainFree(doms[i]);
+        VIR_FREE(doms);
+    }
+
+    xdr_free((xdrproc_t) xdr_remote_connect_list_all_domains_filtered_ret,
+             (char *) &ret);
+
+done:
+    remoteFreeTypedParameters(args.filters.filters_val,
+                              args.filters.filters_len);
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static int
+remoteConnectGetListGeneration(virConnectPtr conn,
+                               unsigned int type,
+                               unsigned long long *generation,
+                               unsigned int flags)
+{
+    int rv = -1;
+    struct private_data *priv;
+    remote_connect_get_list_generation_args args;
+    remote_connect_get_list_generation_ret ret;
+
+    /* This serves the hypervisor, network and storage drivers alike */
+    switch (type) {
+    case VIR_CONNECT_LIST_GENERATION_NETWORKS:
+        priv = conn->networkPrivateData;
+        break;
+    case VIR_CONNECT_LIST_GENERATION_STORAGE_POOLS:
+        priv = conn->storagePrivateData;
+        break;
+    default:
+        priv = conn->privateData;
+        break;
+    }
+
+    remoteDriverLock(priv);
+
+    args.type = type;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_GET_LIST_GENERATION,
+             (xdrproc_t) xdr_remote_connect_get_list_generation_args,
+             (char *) &args,
+             (xdrproc_t) xdr_remote_connect_get_list_generation_ret,
+             (char *) &ret) == -1)
+        goto done;
+
+    *generation = ret.generation;
+    rv = 0;
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static int
+remoteDomainListFSFreeze(virDomainPtr *doms,
+                         unsigned int ndoms,
+                         unsigned int timeout,
+                         unsigned int flags)
+{
+    int rv = -1;
+    unsigned int i;
+    virConnectPtr conn = doms[0]->conn;
+    struct private_data *priv = conn->privateData;
+    remote_domain_list_fs_freeze_args args;
+    remote_domain_list_fs_freeze_ret ret;
+
+    remoteDriverLock(priv);
+
+    memset(&args, 0, sizeof(args));
+    if (ndoms > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("too many domains '%u' for limit '%d'"),
+                       ndoms, REMOTE_DOMAIN_LIST_MAX);
+        goto done;
+    }
+    if (VIR_ALLOC_N(args.doms.doms_val, ndoms) < 0) {
+        virReportOOMError();
+        goto done;
+    }
+    args.doms.doms_len = ndoms;
+    for (i = 0 ; i < ndoms ; i++)
+        make_nonnull_domain(args.doms.doms_val + i, doms[i]);
+    args.timeout = timeout;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_LIST_FS_FREEZE,
+             (xdrproc_t) xdr_remote_domain_list_fs_freeze_args,
+             (char *) &args,
+             (xdrproc_t) xdr_remote_domain_list_fs_freeze_ret,
+             (char *) &ret) == -1)
+        goto done;
+
+    rv = ret.ret;
+
+done:
+    VIR_FREE(args.doms.doms_val);
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static int
+remoteDomainListFSThaw(virDomainPtr *doms,
+                       unsigned int ndoms,
+                       unsigned int timeout,
+                       unsigned int flags)
+{
+    int rv = -1;
+    unsigned int i;
+    virConnectPtr conn = doms[0]->conn;
+    struct private_data *priv = conn->privateData;
+    remote_domain_list_fs_thaw_args args;
+    remote_domain_list_fs_thaw_ret ret;
+
+    remoteDriverLock(priv);
+
+    memset(&args, 0, sizeof(args));
+    if (ndoms > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("too many domains '%u' for limit '%d'"),
+                       ndoms, REMOTE_DOMAIN_LIST_MAX);
+        goto done;
+    }
+    if (VIR_ALLOC_N(args.doms.doms_val, ndoms) < 0) {
+        virReportOOMError();
+        goto done;
+    }
+    args.doms.doms_len = ndoms;
+    for (i = 0 ; i < ndoms ; i++)
+        make_nonnull_domain(args.doms.doms_val + i, doms[i]);
+    args.timeout = timeout;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_LIST_FS_THAW,
+             (xdrproc_t) xdr_remote_domain_list_fs_thaw_args,
+             (char *) &args,
+             (xdrproc_t) xdr_remote_domain_list_fs_thaw_ret,
+             (char *) &ret) == -1)
+        goto done;
+
+    rv = ret.ret;
+
+done:
+    VIR_FREE(args.doms.doms_val);
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static int
+remoteDeserializeDomainDiskErrors(remote_domain_disk_error *ret_errors_val,
+                                  u_int ret_errors_len,
+                                  int limit,
+                                  virDomainDiskErrorPtr errors,
+                                  int maxerrors)
+{
+    int i = 0;
+    int j;
+
+    if (ret_errors_len > limit || ret_errors_len > maxerrors) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("returned number of disk errors exceeds limit"));
+        goto error;
+    }
+
+    for (i = 0; i < ret_errors_len; i++) {
+        if (!(errors[i].disk = strdup(ret_errors_val[i].disk))) {
+            virReportOOMError();
+            goto error;
+        }
+        errors[i].error = ret_errors_val[i].error;
     }
 
     return 0;
@@ -2130,28 +2949,203 @@ remoteDomainGetSecurityLabelList(virDomainPtr domain, virSecurityLabelPtr* secla
              (xdrproc_t) xdr_remote_domain_get_security_label_list_args, (char *)&args,
              (xdrproc_t) xdr_remote_domain_get_security_label_list_ret, (char *)&ret) == -1) {
         goto done;
-    }
+    }
+
+    if (VIR_ALLOC_N(*seclabels, ret.labels.labels_len) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ret.labels.labels_len; i++) {
+        remote_domain_get_security_label_ret *cur = &ret.labels.labels_val[i];
+        if (cur->label.label_val != NULL) {
+            if (strlen(cur->label.label_val) >= sizeof((*seclabels)->label)) {
+                virReportError(VIR_ERR_RPC, _("security label exceeds maximum: %zd"),
+                               sizeof((*seclabels)->label) - 1);
+                VIR_FREE(*seclabels);
+                goto cleanup;
+            }
+            strcpy((*seclabels)[i].label, cur->label.label_val);
+            (*seclabels)[i].enforcing = cur->enforcing;
+        }
+    }
+    rv = ret.ret;
+
+cleanup:
+    xdr_free((xdrproc_t) xdr_remote_domain_get_security_label_list_ret, (char *)&ret);
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static virDomainPtr
+remoteDomainLookupByUUID(virConnectPtr conn, const unsigned char *uuid)
+{
+    virDomainPtr rv = NULL;
+    remote_domain_lookup_by_uuid_args args;
+    remote_domain_lookup_by_uuid_ret ret;
+    struct private_data *priv = conn->privateData;
+
+    remoteDriverLock(priv);
+
+    if (priv->domainCache) {
+        virMutexLock(&priv->cacheLock);
+        rv = remoteDomainCacheGetDomain(conn,
+                                        remoteDomainCacheFind(priv, uuid));
+        virMutexUnlock(&priv->cacheLock);
+        if (rv)
+            goto done;
+    }
+
+    memcpy(args.uuid, uuid, VIR_UUID_BUFLEN);
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_LOOKUP_BY_UUID,
+             (xdrproc_t) xdr_remote_domain_lookup_by_uuid_args, (char *) &args,
+             (xdrproc_t) xdr_remote_domain_lookup_by_uuid_ret, (char *) &ret) == -1)
+        goto done;
+
+    rv = get_nonnull_domain(conn, ret.dom);
+    xdr_free((xdrproc_t) xdr_remote_domain_lookup_by_uuid_ret, (char *) &ret);
+
+    if (rv && priv->domainCache) {
+        virMutexLock(&priv->cacheLock);
+        remoteDomainCacheAddDomain(priv, rv);
+        virMutexUnlock(&priv->cacheLock);
+    }
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static virDomainPtr
+remoteDomainLookupByName(virConnectPtr conn, const char *name)
+{
+    virDomainPtr rv = NULL;
+    remote_domain_lookup_by_name_args args;
+    remote_domain_lookup_by_name_ret ret;
+    struct private_data *priv = conn->privateData;
+
+    remoteDriverLock(priv);
+
+    if (priv->domainCache) {
+        virMutexLock(&priv->cacheLock);
+        rv = remoteDomainCacheGetDomain(conn,
+                                        virHashSearch(priv->domainCache,
+                                                      remoteDomainCacheMatchName,
+                                                      name));
+        virMutexUnlock(&priv->cacheLock);
+        if (rv)
+            goto done;
+    }
+
+    args.name = (char *) name;
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_LOOKUP_BY_NAME,
+             (xdrproc_t) xdr_remote_domain_lookup_by_name_args, (char *) &args,
+             (xdrproc_t) xdr_remote_domain_lookup_by_name_ret, (char *) &ret) == -1)
+        goto done;
+
+    rv = get_nonnull_domain(conn, ret.dom);
+    xdr_free((xdrproc_t) xdr_remote_domain_lookup_by_name_ret, (char *) &ret);
+
+    if (rv && priv->domainCache) {
+        virMutexLock(&priv->cacheLock);
+        remoteDomainCacheAddDomain(priv, rv);
+        virMutexUnlock(&priv->cacheLock);
+    }
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static int
+remoteDomainIsPersistent(virDomainPtr dom)
+{
+    int rv = -1;
+    remote_domain_is_persistent_args args;
+    remote_domain_is_persistent_ret ret;
+    struct private_data *priv = dom->conn->privateData;
+    remoteDomainCacheEntryPtr entry;
+
+    remoteDriverLock(priv);
+
+    if (priv->domainCache) {
+        virMutexLock(&priv->cacheLock);
+        if ((entry = remoteDomainCacheFind(priv, dom->uuid)))
+            rv = entry->persistent;
+        virMutexUnlock(&priv->cacheLock);
+        if (rv >= 0)
+            goto done;
+    }
+
+    make_nonnull_domain(&args.dom, dom);
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(dom->conn, priv, 0, REMOTE_PROC_DOMAIN_IS_PERSISTENT,
+             (xdrproc_t) xdr_remote_domain_is_persistent_args, (char *) &args,
+             (xdrproc_t) xdr_remote_domain_is_persistent_ret, (char *) &ret) == -1)
+        goto done;
+
+    rv = ret.persistent;
+
+    if (priv->domainCache) {
+        virMutexLock(&priv->cacheLock);
+        if ((entry = remoteDomainCacheGet(priv, dom->uuid)))
+            entry->persistent = rv;
+        virMutexUnlock(&priv->cacheLock);
+    }
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+static char *
+remoteDomainGetOSType(virDomainPtr dom)
+{
+    char *rv = NULL;
+    remote_domain_get_os_type_args args;
+    remote_domain_get_os_type_ret ret;
+    struct private_data *priv = dom->conn->privateData;
+    remoteDomainCacheEntryPtr entry;
+
+    remoteDriverLock(priv);
+
+    if (priv->domainCache) {
+        bool cached = false;
+
+        virMutexLock(&priv->cacheLock);
+        if ((entry = remoteDomainCacheFind(priv, dom->uuid)) &&
+            entry->ostype) {
+            cached = true;
+            if (!(rv = strdup(entry->ostype)))
+                virReportOOMError();
+        }
+        virMutexUnlock(&priv->cacheLock);
+        if (cached)
+            goto done;
+    }
+
+    make_nonnull_domain(&args.dom, dom);
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(dom->conn, priv, 0, REMOTE_PROC_DOMAIN_GET_OS_TYPE,
+             (xdrproc_t) xdr_remote_domain_get_os_type_args, (char *) &args,
+             (xdrproc_t) xdr_remote_domain_get_os_type_ret, (char *) &ret) == -1)
+        goto done;
 
-    if (VIR_ALLOC_N(*seclabels, ret.labels.labels_len) < 0)
-        goto cleanup;
+    rv = ret.type;
 
-    for (i = 0; i < ret.labels.labels_len; i++) {
-        remote_domain_get_security_label_ret *cur = &ret.labels.labels_val[i];
-        if (cur->label.label_val != NULL) {
-            if (strlen(cur->label.label_val) >= sizeof((*seclabels)->label)) {
-                virReportError(VIR_ERR_RPC, _("security label exceeds maximum: %zd"),
-                               sizeof((*seclabels)->label) - 1);
-                VIR_FREE(*seclabels);
-                goto cleanup;
-            }
-            strcpy((*seclabels)[i].label, cur->label.label_val);
-            (*seclabels)[i].enforcing = cur->enforcing;
-        }
+    if (priv->domainCache) {
+        virMutexLock(&priv->cacheLock);
+        if ((entry = remoteDomainCacheGet(priv, dom->uuid)) &&
+            !entry->ostype)
+            entry->ostype = strdup(rv);
+        virMutexUnlock(&priv->cacheLock);
     }
-    rv = ret.ret;
-
-cleanup:
-    xdr_free((xdrproc_t) xdr_remote_domain_get_security_label_list_ret, (char *)&ret);
 
 done:
     remoteDriverUnlock(priv);
@@ -2798,6 +3792,108 @@ done:
     return rv;
 }
 
+static int
+remoteNetworkGetDHCPLeases(virNetworkPtr net,
+                           const char *mac,
+                           virNetworkDHCPLeasePtr **leases,
+                           unsigned int flags)
+{
+    int rv = -1;
+    int i;
+    struct private_data *priv = net->conn->networkPrivateData;
+    remote_network_get_dhcp_leases_args args;
+    remote_network_get_dhcp_leases_ret ret;
+    virNetworkDHCPLeasePtr *tmp_leases = NULL;
+
+    remoteDriverLock(priv);
+
+    make_nonnull_network(&args.net, net);
+    args.mac = mac ? (char **) &mac : NULL;
+    args.need_results = !!leases;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(net->conn,
+             priv,
+             0,
+             REMOTE_PROC_NETWORK_GET_DHCP_LEASES,
+             (xdrproc_t) xdr_remote_network_get_dhcp_leases_args,
+             (char *) &args,
+             (xdrproc_t) xdr_remote_network_get_dhcp_leases_ret,
+             (char *) &ret) == -1)
+        goto done;
+
+    if (ret.leases.leases_len > REMOTE_NETWORK_DHCP_LEASES_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of leases is %d, which exceeds max limit: %d"),
+                       ret.leases.leases_len, REMOTE_NETWORK_DHCP_LEASES_MAX);
+        goto cleanup;
+    }
+
+    if (leases) {
+        if (VIR_ALLOC_N(tmp_leases, ret.leases.leases_len + 1) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        for (i = 0; i < ret.leases.leases_len; i++) {
+            remote_network_dhcp_lease *src = ret.leases.leases_val + i;
+            virNetworkDHCPLeasePtr lease;
+
+            if (VIR_ALLOC(lease) < 0) {
+                virReportOOMError();
+                goto cleanup;
+            }
+            tmp_leases[i] = lease;
+
+            lease->expirytime = src->expirytime;
+            lease->type = src->type;
+            lease->prefix = src->prefix;
+
+            /* Steal the strings so they are not duplicated */
+            lease->iface = src->iface;
+            src->iface = NULL;
+            lease->ipaddr = src->ipaddr;
+            src->ipaddr = NULL;
+            if (src->mac) {
+                lease->mac = *src->mac;
+                *src->mac = NULL;
+            }
+            if (src->iaid) {
+                lease->iaid = *src->iaid;
+                *src->iaid = NULL;
+            }
+            if (src->hostname) {
+                lease->hostname = *src->hostname;
+                *src->hostname = NULL;
+            }
+            if (src->clientid) {
+                lease->clientid = *src->clientid;
+                *src->clientid = NULL;
+            }
+        }
+
+        *leases = tmp_leases;
+        tmp_leases = NULL;
+    }
+
+    rv = ret.ret;
+
+cleanup:
+    if (tmp_leases) {
+        for (i = 0; i < ret.leases.leases_len; i++)
+            virNetworkDHCPLeaseFree(tmp_leases[i]);
+        VIR_FREE(tmp_leases);
+    }
+
+    xdr_free((xdrproc_t) xdr_remote_network_get_dhcp_leases_ret,
+             (char *) &ret);
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 static int
 remoteConnectListAllInterfaces(virConnectPtr conn,
                                virInterfacePtr **ifaces,
@@ -3097,14 +4193,25 @@ remoteGenericClose(virConnectPtr conn, void **genericPrivateData)
 {
     int rv = 0;
     struct private_data *priv = *genericPrivateData;
+    /* set before the connection could be shared and never changed */
+    bool shared = priv->sharedKey != NULL;
 
+    /* The last user must unpublish a shared connection before anyone
+     * can find it again */
+    if (shared)
+        virMutexLock(&remoteSharedLock);
     remoteDriverLock(priv);
     priv->localUses--;
+    if (shared && !priv->localUses)
+        virHashRemoveEntry(remoteShared, priv->sharedKey);
+    if (shared)
+        virMutexUnlock(&remoteSharedLock);
     if (!priv->localUses) {
         rv = doRemoteClose(conn, priv);
         *genericPrivateData = NULL;
         remoteDriverUnlock(priv);
         virMutexDestroy(&priv->lock);
+        virMutexDestroy(&priv->cacheLock);
         VIR_FREE(priv);
     }
     if (priv)
@@ -3315,6 +4422,42 @@ done:
     return rv;
 }
 
+static int
+remoteStorageVolGetJobInfo(virStorageVolPtr vol,
+                           virStorageVolJobInfoPtr info,
+                           unsigned int flags)
+{
+    int rv = -1;
+    remote_storage_vol_get_job_info_args args;
+    remote_storage_vol_get_job_info_ret ret;
+    struct private_data *priv = vol->conn->storagePrivateData;
+
+    remoteDriverLock(priv);
+
+    make_nonnull_storage_vol(&args.vol, vol);
+    args.flags = flags;
+
+    if (call(vol->conn, priv, 0, REMOTE_PROC_STORAGE_VOL_GET_JOB_INFO,
+             (xdrproc_t)xdr_remote_storage_vol_get_job_info_args,
+               (char *)&args,
+             (xdrproc_t)xdr_remote_storage_vol_get_job_info_ret,
+               (char *)&ret) == -1)
+        goto done;
+
+    if (ret.found) {
+        info->type = ret.type;
+        info->processed = ret.processed;
+        info->total = ret.total;
+        rv = 1;
+    } else {
+        rv = 0;
+    }
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 
 /*----------------------------------------------------------------------*/
 
@@ -4144,6 +5287,40 @@ out:
 #endif /* HAVE_POLKIT */
 /*----------------------------------------------------------------------*/
 
+/*
+ * Find out once per connection whether the server can restrict the
+ * events it sends to a single domain, so that callbacks registered
+ * for one domain do not pull in the events of every other domain.
+ */
+static void
+remoteProbeEventFilter(virConnectPtr conn, struct private_data *priv)
+{
+    remote_supports_feature_args args =
+        { VIR_DRV_FEATURE_REMOTE_EVENT_FILTER };
+    remote_supports_feature_ret ret = { 0 };
+
+    if (priv->serverEventFilter != -1)
+        return;
+
+    if (call(conn, priv, 0, REMOTE_PROC_SUPPORTS_FEATURE,
+             (xdrproc_t)xdr_remote_supports_feature_args, (char *) &args,
+             (xdrproc_t)xdr_remote_supports_feature_ret, (char *) &ret) == -1) {
+        virResetLastError();
+        ret.supported = 0;
+    }
+
+    priv->serverEventFilter = ret.supported ? 1 : 0;
+}
+
+/* Callbacks of all connections sharing @priv are registered with the
+ * server together, so they are counted regardless of their
+ * connection */
+static virConnectPtr
+remoteEventConn(virConnectPtr conn, struct private_data *priv)
+{
+    return priv->sharedKey ? NULL : conn;
+}
+
 static int remoteDomainEventRegister(virConnectPtr conn,
                                      virConnectDomainEventCallback callback,
                                      void *opaque,
@@ -4155,13 +5332,24 @@ static int remoteDomainEventRegister(virConnectPtr conn,
 
     remoteDriverLock(priv);
 
+    remoteProbeEventFilter(conn, priv);
+
     if ((count = virDomainEventStateRegister(conn, priv->domainEventState,
                                              callback, opaque, freecb)) < 0) {
          virReportError(VIR_ERR_RPC, "%s", _("adding cb to list"));
          goto done;
     }
 
-    if (count == 1) {
+    /* Callbacks restricted to a domain are registered separately with
+     * a server filtering events */
+    if (priv->serverEventFilter == 1)
+        count = virDomainEventStateCountID(remoteEventConn(conn, priv),
+                                           priv->domainEventState,
+                                           VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                           NULL);
+
+    if (count == 1 &&
+        !remoteDomainCacheHoldsEvents(priv, VIR_DOMAIN_EVENT_ID_LIFECYCLE)) {
         /* Tell the server when we are the first callback deregistering */
         if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_EVENTS_REGISTER,
                  (xdrproc_t) xdr_void, (char *) NULL,
@@ -4190,7 +5378,14 @@ static int remoteDomainEventDeregister(virConnectPtr conn,
                                                callback)) < 0)
         goto done;
 
-    if (count == 0) {
+    if (priv->serverEventFilter == 1)
+        count = virDomainEventStateCountID(remoteEventConn(conn, priv),
+                                           priv->domainEventState,
+                                           VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                           NULL);
+
+    if (count == 0 &&
+        !remoteDomainCacheHoldsEvents(priv, VIR_DOMAIN_EVENT_ID_LIFECYCLE)) {
         /* Tell the server when we are the last callback deregistering */
         if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_EVENTS_DEREGISTER,
                  (xdrproc_t) xdr_void, (char *) NULL,
@@ -4217,6 +5412,8 @@ remoteDomainBuildEventLifecycle(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
     virDomainPtr dom;
     virDomainEventPtr event = NULL;
 
+    remoteDomainCacheInvalidate(priv, (unsigned char *) msg->dom.uuid);
+
     dom = get_nonnull_domain(conn, msg->dom);
     if (!dom)
         return;
@@ -4691,15 +5888,18 @@ remoteStreamSend(virStreamPtr st,
 
 
 static int
-remoteStreamRecv(virStreamPtr st,
-                 char *data,
-                 size_t nbytes)
+remoteStreamRecvFlags(virStreamPtr st,
+                      char *data,
+                      size_t nbytes,
+                      unsigned int flags)
 {
-    VIR_DEBUG("st=%p data=%p nbytes=%zu", st, data, nbytes);
+    VIR_DEBUG("st=%p data=%p nbytes=%zu flags=%x", st, data, nbytes, flags);
     struct private_data *priv = st->conn->privateData;
     virNetClientStreamPtr privst = st->privateData;
     int rv;
 
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     if (virNetClientStreamRaiseError(privst))
         return -1;
 
@@ -4711,7 +5911,8 @@ remoteStreamRecv(virStreamPtr st,
                                       priv->client,
                                       data,
                                       nbytes,
-                                      (st->flags & VIR_STREAM_NONBLOCK));
+                                      (st->flags & VIR_STREAM_NONBLOCK),
+                                      (flags & VIR_STREAM_RECV_STOP_AT_HOLE));
 
     VIR_DEBUG("Done %d", rv);
 
@@ -4721,6 +5922,63 @@ remoteStreamRecv(virStreamPtr st,
     return rv;
 }
 
+
+static int
+remoteStreamRecv(virStreamPtr st,
+                 char *data,
+                 size_t nbytes)
+{
+    return remoteStreamRecvFlags(st, data, nbytes, 0);
+}
+
+
+static int
+remoteStreamSendHole(virStreamPtr st,
+                     long long length,
+                     unsigned int flags)
+{
+    VIR_DEBUG("st=%p length=%lld flags=%x", st, length, flags);
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv;
+
+    virCheckFlags(0, -1);
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    rv = virNetClientStreamSendHole(privst,
+                                    priv->client,
+                                    length,
+                                    flags);
+
+    remoteDriverLock(priv);
+    priv->localUses--;
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteStreamRecvHole(virStreamPtr st,
+                     long long *length,
+                     unsigned int flags)
+{
+    VIR_DEBUG("st=%p length=%p flags=%x", st, length, flags);
+    virNetClientStreamPtr privst = st->privateData;
+
+    virCheckFlags(0, -1);
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    return virNetClientStreamRecvHole(privst, length);
+}
+
 struct remoteStreamCallbackData {
     virStreamPtr st;
     virStreamEventCallback cb;
@@ -4894,6 +6152,9 @@ cleanup:
 
 static virStreamDriver remoteStreamDrv = {
     .streamRecv = remoteStreamRecv,
+    .streamRecvFlags = remoteStreamRecvFlags,
+    .streamSendHole = remoteStreamSendHole,
+    .streamRecvHole = remoteStreamRecvHole,
     .streamSend = remoteStreamSend,
     .streamFinish = remoteStreamFinish,
     .streamAbort = remoteStreamAbort,
@@ -4918,6 +6179,8 @@ static int remoteDomainEventRegisterAny(virConnectPtr conn,
 
     remoteDriverLock(priv);
 
+    remoteProbeEventFilter(conn, priv);
+
     if ((count = virDomainEventStateRegisterID(conn,
                                                priv->domainEventState,
                                                dom, eventID,
@@ -4927,9 +6190,32 @@ static int remoteDomainEventRegisterAny(virConnectPtr conn,
         goto done;
     }
 
+    /* A server filtering events gets one registration per domain
+     * callbacks are restricted to, and one for the callbacks which
+     * want every domain */
+    if (priv->serverEventFilter == 1)
+        count = virDomainEventStateCountID(remoteEventConn(conn, priv),
+                                           priv->domainEventState,
+                                           eventID, dom ? dom->uuid : NULL);
+
     /* If this is the first callback for this eventID, we need to enable
      * events on the server */
-    if (count == 1) {
+    if (count == 1 && priv->serverEventFilter == 1 && dom) {
+        remote_domain_events_register_domain_args dargs;
+
+        dargs.eventID = eventID;
+        make_nonnull_domain(&dargs.dom, dom);
+
+        if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_EVENTS_REGISTER_DOMAIN,
+                 (xdrproc_t) xdr_remote_domain_events_register_domain_args, (char *) &dargs,
+                 (xdrproc_t) xdr_void, (char *)NULL) == -1) {
+            virDomainEventStateDeregisterID(conn,
+                                            priv->domainEventState,
+                                            callbackID);
+            goto done;
+        }
+    } else if (count == 1 &&
+               !remoteDomainCacheHoldsEvents(priv, eventID)) {
         args.eventID = eventID;
 
         if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_EVENTS_REGISTER_ANY,
@@ -4956,6 +6242,8 @@ static int remoteDomainEventDeregisterAny(virConnectPtr conn,
     struct private_data *priv = conn->privateData;
     int rv = -1;
     remote_domain_events_deregister_any_args args;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    int filtered = 0;
     int eventID;
     int count;
 
@@ -4968,6 +6256,14 @@ static int remoteDomainEventDeregisterAny(virConnectPtr conn,
         goto done;
     }
 
+    if (priv->serverEventFilter == 1 &&
+        (filtered = virDomainEventStateCallbackDomain(conn,
+                                                      priv->domainEventState,
+                                                      callbackID, uuid)) < 0) {
+        virReportError(VIR_ERR_RPC, _("unable to find callback ID %d"), callbackID);
+        goto done;
+    }
+
     if ((count = virDomainEventStateDeregisterID(conn,
                                                  priv->domainEventState,
                                                  callbackID)) < 0) {
@@ -4975,10 +6271,26 @@ static int remoteDomainEventDeregisterAny(virConnectPtr conn,
         goto done;
     }
 
+    if (priv->serverEventFilter == 1)
+        count = virDomainEventStateCountID(remoteEventConn(conn, priv),
+                                           priv->domainEventState,
+                                           eventID, filtered ? uuid : NULL);
+
     /* If that was the last callback for this eventID, we need to disable
      * events on the server */
-    if (count == 0) {
-        args.eventID = callbackID;
+    if (count == 0 && filtered) {
+        remote_domain_events_deregister_domain_args dargs;
+
+        dargs.eventID = eventID;
+        memcpy(dargs.uuid, uuid, VIR_UUID_BUFLEN);
+
+        if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_EVENTS_DEREGISTER_DOMAIN,
+                 (xdrproc_t) xdr_remote_domain_events_deregister_domain_args, (char *) &dargs,
+                 (xdrproc_t) xdr_void, (char *) NULL) == -1)
+            goto done;
+    } else if (count == 0 &&
+               !remoteDomainCacheHoldsEvents(priv, eventID)) {
+        args.eventID = eventID;
 
         if (call(conn, priv, 0, REMOTE_PROC_DOMAIN_EVENTS_DEREGISTER_ANY,
                  (xdrproc_t) xdr_remote_domain_events_deregister_any_args, (char *) &args,
@@ -5514,20 +6826,19 @@ done:
  * send that to the server and wait for reply
  */
 static int
-callWithFD(virConnectPtr conn ATTRIBUTE_UNUSED,
-           struct private_data *priv,
-           unsigned int flags,
-           int fd,
-           int proc_nr,
-           xdrproc_t args_filter, char *args,
-           xdrproc_t ret_filter, char *ret)
+callWithFDs(virConnectPtr conn ATTRIBUTE_UNUSED,
+            struct private_data *priv,
+            unsigned int flags,
+            int *fds,
+            size_t nfds,
+            int proc_nr,
+            xdrproc_t args_filter, char *args,
+            xdrproc_t ret_filter, char *ret)
 {
     int rv;
     virNetClientProgramPtr prog = flags & REMOTE_CALL_QEMU ? priv->qemuProgram : priv->remoteProgram;
     int counter = priv->counter++;
     virNetClientPtr client = priv->client;
-    int fds[] = { fd };
-    size_t nfds = fd == -1 ? 0 : 1;
     priv->localUses++;
 
     /* Unlock, so that if we get any async events/stream data
@@ -5545,9 +6856,27 @@ callWithFD(virConnectPtr conn ATTRIBUTE_UNUSED,
     remoteDriverLock(priv);
     priv->localUses--;
 
+    remoteDomainCacheCheckProc(priv, flags, proc_nr);
+
     return rv;
 }
 
+static int
+callWithFD(virConnectPtr conn,
+           struct private_data *priv,
+           unsigned int flags,
+           int fd,
+           int proc_nr,
+           xdrproc_t args_filter, char *args,
+           xdrproc_t ret_filter, char *ret)
+{
+    int fds[] = { fd };
+
+    return callWithFDs(conn, priv, flags, fds, fd == -1 ? 0 : 1, proc_nr,
+                       args_filter, args,
+                       ret_filter, ret);
+}
+
 static int
 call(virConnectPtr conn,
      struct private_data *priv,
@@ -5561,6 +6890,123 @@ call(virConnectPtr conn,
                       ret_filter, ret);
 }
 
+/*
+ * Submit an RPC call whose reply is handed to @cb, which will
+ * get a @retsize byte buffer holding the decoded reply. The driver
+ * lock is dropped while submitting, since @cb may run straight
+ * away if the connection fails.
+ */
+static int
+callAsync(virConnectPtr conn ATTRIBUTE_UNUSED,
+          struct private_data *priv,
+          unsigned int flags,
+          int proc_nr,
+          xdrproc_t args_filter, char *args,
+          xdrproc_t ret_filter, size_t retsize,
+          virNetClientProgramCallFunc cb,
+          void *opaque)
+{
+    int rv;
+    virNetClientProgramPtr prog = flags & REMOTE_CALL_QEMU ? priv->qemuProgram : priv->remoteProgram;
+    int counter = priv->counter++;
+    virNetClientPtr client = priv->client;
+    priv->localUses++;
+
+    remoteDriverUnlock(priv);
+    rv = virNetClientProgramCallAsync(prog,
+                                      client,
+                                      counter,
+                                      proc_nr,
+                                      args_filter, args,
+                                      ret_filter, retsize,
+                                      cb, opaque);
+    remoteDriverLock(priv);
+    priv->localUses--;
+
+    remoteDomainCacheCheckProc(priv, flags, proc_nr);
+
+    return rv;
+}
+
+
+struct remoteDomainGetInfoAsyncData {
+    virDomainPtr dom;
+    virDomainGetInfoCallback cb;
+    void *opaque;
+    virFreeCallback freecb;
+};
+
+static void
+remoteDomainGetInfoAsyncDone(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                             int status,
+                             void *reply,
+                             void *opaque)
+{
+    struct remoteDomainGetInfoAsyncData *data = opaque;
+    remote_domain_get_info_ret *ret = reply;
+    virDomainInfo info;
+
+    memset(&info, 0, sizeof(info));
+    if (status == 0) {
+        info.state = ret->state;
+        info.maxMem = ret->maxMem;
+        info.memory = ret->memory;
+        info.nrVirtCpu = ret->nrVirtCpu;
+        info.cpuTime = ret->cpuTime;
+        virResetLastError();
+    }
+
+    data->cb(data->dom, status, status == 0 ? &info : NULL, data->opaque);
+
+    if (data->freecb)
+        data->freecb(data->opaque);
+    virObjectUnref(data->dom);
+    VIR_FREE(data);
+}
+
+static int
+remoteDomainGetInfoAsync(virDomainPtr domain,
+                         virDomainGetInfoCallback cb,
+                         void *opaque,
+                         virFreeCallback freecb)
+{
+    int rv = -1;
+    remote_domain_get_info_args args;
+    struct remoteDomainGetInfoAsyncData *data = NULL;
+    struct private_data *priv = domain->conn->privateData;
+
+    remoteDriverLock(priv);
+
+    if (VIR_ALLOC(data) < 0) {
+        virReportOOMError();
+        goto done;
+    }
+
+    make_nonnull_domain(&args.dom, domain);
+
+    virObjectRef(domain);
+    data->dom = domain;
+    data->cb = cb;
+    data->opaque = opaque;
+    data->freecb = freecb;
+
+    if (callAsync(domain->conn, priv, 0, REMOTE_PROC_DOMAIN_GET_INFO,
+                  (xdrproc_t) xdr_remote_domain_get_info_args, (char *) &args,
+                  (xdrproc_t) xdr_remote_domain_get_info_ret,
+                  sizeof(remote_domain_get_info_ret),
+                  remoteDomainGetInfoAsyncDone, data) < 0) {
+        virObjectUnref(domain);
+        VIR_FREE(data);
+        goto done;
+    }
+
+    rv = 0;
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 
 static int
 remoteDomainGetInterfaceParameters(virDomainPtr domain,
@@ -6153,6 +7599,20 @@ static virDriver remote_driver = {
     .nodeGetMemoryParameters = remoteNodeGetMemoryParameters, /* 0.10.2 */
     .nodeGetCPUMap = remoteNodeGetCPUMap, /* 1.0.0 */
     .domainFSTrim = remoteDomainFSTrim, /* 1.0.1 */
+    .connectGetAllDomainStats = remoteConnectGetAllDomainStats, /* 1.0.2 */
+    .domainGetInfoAsync = remoteDomainGetInfoAsync, /* 1.0.2 */
+    .domainAttachDevices = remoteDomainAttachDevices, /* 1.0.2 */
+    .connectGetHostCapabilities = remoteConnectGetHostCapabilities, /* 1.0.2 */
+    .domainBlockFlatten = remoteDomainBlockFlatten, /* 1.0.2 */
+    .connectDestroyAllDomains = remoteConnectDestroyAllDomains, /* 1.0.2 */
+    .domainBlockPeekStream = remoteDomainBlockPeekStream, /* 1.0.2 */
+    .domainMemoryPeekStream = remoteDomainMemoryPeekStream, /* 1.0.2 */
+    .connectGetListGeneration = remoteConnectGetListGeneration, /* 1.0.2 */
+    .domainListFSFreeze = remoteDomainListFSFreeze, /* 1.0.2 */
+    .domainListFSThaw = remoteDomainListFSThaw, /* 1.0.2 */
+    .domainMigrateGetCompressionCache = remoteDomainMigrateGetCompressionCache, /* 1.0.2 */
+    .domainMigrateSetCompressionCache = remoteDomainMigrateSetCompressionCache, /* 1.0.2 */
+    .connectListAllDomainsFiltered = remoteConnectListAllDomainsFiltered, /* 1.0.2 */
 };
 
 static virNetworkDriver network_driver = {
@@ -6178,6 +7638,8 @@ static virNetworkDriver network_driver = {
     .networkSetAutostart = remoteNetworkSetAutostart, /* 0.3.0 */
     .networkIsActive = remoteNetworkIsActive, /* 0.7.3 */
     .networkIsPersistent = remoteNetworkIsPersistent, /* 0.7.3 */
+    .networkGetDHCPLeases = remoteNetworkGetDHCPLeases, /* 1.0.2 */
+    .connectGetListGeneration = remoteConnectGetListGeneration, /* 1.0.2 */
 };
 
 static virInterfaceDriver interface_driver = {
@@ -6247,6 +7709,9 @@ static virStorageDriver storage_driver = {
     .volResize = remoteStorageVolResize, /* 0.9.10 */
     .poolIsActive = remoteStoragePoolIsActive, /* 0.7.3 */
     .poolIsPersistent = remoteStoragePoolIsPersistent, /* 0.7.3 */
+    .volGetJobInfo = remoteStorageVolGetJobInfo, /* 1.0.2 */
+    .volAbortJob = remoteStorageVolAbortJob, /* 1.0.2 */
+    .connectGetListGeneration = remoteConnectGetListGeneration, /* 1.0.2 */
 };
 
 static virSecretDriver secret_driver = {
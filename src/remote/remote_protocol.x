@@ -81,6 +81,9 @@ const REMOTE_DOMAIN_ID_LIST_MAX = 16384;
 /* Upper limit on lists of domain names. */
 const REMOTE_DOMAIN_NAME_LIST_MAX = 16384;
 
+/* Upper limit on lists of domains, e.g. in virConnectGetAllDomainStats. */
+const REMOTE_DOMAIN_LIST_MAX = 16384;
+
 /* Upper limit on cpumap (bytes) passed to virDomainPinVcpu. */
 const REMOTE_CPUMAP_MAX = 256;
 
@@ -203,6 +206,11 @@ const REMOTE_SECRET_UUID_LIST_MAX = 16384;
  */
 const REMOTE_CPU_BASELINE_MAX = 256;
 
+/*
+ * Upper limit on list of devices attached by virDomainAttachDevices.
+ */
+const REMOTE_DOMAIN_ATTACH_DEVICES_MAX = 256;
+
 /*
  * Max number of sending keycodes.
  */
@@ -234,6 +242,21 @@ const REMOTE_DOMAIN_DISK_ERRORS_MAX = 256;
  */
 const REMOTE_NODE_MEMORY_PARAMETERS_MAX = 64;
 
+/*
+ * Upper limit on number of stats parameters returned for one domain
+ * by virConnectGetAllDomainStats
+ */
+const REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX = 4096;
+
+/*
+ * Upper limit on number of filters accepted by
+ * virConnectListAllDomainsFiltered
+ */
+const REMOTE_CONNECT_LIST_ALL_DOMAINS_FILTERS_MAX = 256;
+
+/* Upper limit on number of DHCP leases returned for a network */
+const REMOTE_NETWORK_DHCP_LEASES_MAX = 65536;
+
 /* UUID.  VIR_UUID_BUFLEN definition comes from libvirt.h */
 typedef opaque remote_uuid[VIR_UUID_BUFLEN];
 
@@ -471,6 +494,14 @@ struct remote_get_capabilities_ret {
     remote_nonnull_string capabilities;
 };
 
+struct remote_connect_get_host_capabilities_args {
+    unsigned int flags;
+};
+
+struct remote_connect_get_host_capabilities_ret {
+    remote_nonnull_string capabilities;
+};
+
 struct remote_node_get_cpu_stats_args {
     int cpuNum;
     int nparams;
@@ -701,6 +732,21 @@ struct remote_domain_memory_peek_ret {
     opaque buffer<REMOTE_DOMAIN_MEMORY_PEEK_BUFFER_MAX>;
 };
 
+struct remote_domain_block_peek_stream_args {
+    remote_nonnull_domain dom;
+    remote_nonnull_string disk;
+    unsigned hyper offset;
+    unsigned hyper length;
+    unsigned int flags;
+};
+
+struct remote_domain_memory_peek_stream_args {
+    remote_nonnull_domain dom;
+    unsigned hyper start;
+    unsigned hyper size;
+    unsigned int flags;
+};
+
 struct remote_domain_get_block_info_args {
     remote_nonnull_domain dom;
     remote_nonnull_string path;
@@ -801,6 +847,14 @@ struct remote_domain_destroy_flags_args {
     unsigned int flags;
 };
 
+struct remote_connect_destroy_all_domains_args {
+    unsigned int flags;
+};
+
+struct remote_connect_destroy_all_domains_ret {
+    int num;
+};
+
 struct remote_domain_get_os_type_args {
     remote_nonnull_domain dom;
 };
@@ -1158,6 +1212,12 @@ struct remote_domain_update_device_flags_args {
     unsigned int flags;
 };
 
+struct remote_domain_attach_devices_args {
+    remote_nonnull_domain dom;
+    remote_nonnull_string xmls<REMOTE_DOMAIN_ATTACH_DEVICES_MAX>; /* (const char **) */
+    unsigned int flags;
+};
+
 struct remote_domain_get_autostart_args {
     remote_nonnull_domain dom;
 };
@@ -1240,6 +1300,12 @@ struct remote_domain_block_commit_args {
     unsigned int flags;
 };
 
+struct remote_domain_block_flatten_args {
+    remote_nonnull_domain dom;
+    unsigned hyper bandwidth;
+    unsigned int flags;
+};
+
 struct remote_domain_set_block_io_tune_args {
     remote_nonnull_domain dom;
     remote_nonnull_string disk;
@@ -1823,6 +1889,23 @@ struct remote_storage_vol_resize_args {
     unsigned int flags;
 };
 
+struct remote_storage_vol_get_job_info_args {
+    remote_nonnull_storage_vol vol;
+    unsigned int flags;
+};
+
+struct remote_storage_vol_get_job_info_ret {
+    int found;
+    int type;
+    unsigned hyper processed;
+    unsigned hyper total;
+};
+
+struct remote_storage_vol_abort_job_args {
+    remote_nonnull_storage_vol vol;
+    unsigned int flags;
+};
+
 /* Node driver calls: */
 
 struct remote_node_num_of_devices_args {
@@ -2181,6 +2264,16 @@ struct remote_domain_events_deregister_any_args {
     int eventID;
 };
 
+struct remote_domain_events_register_domain_args {
+    int eventID;
+    remote_nonnull_domain dom;
+};
+
+struct remote_domain_events_deregister_domain_args {
+    int eventID;
+    remote_uuid uuid;
+};
+
 struct remote_domain_event_reboot_msg {
     remote_nonnull_domain dom;
 };
@@ -2591,6 +2684,17 @@ struct remote_connect_list_all_domains_ret {
     unsigned int ret;
 };
 
+struct remote_connect_list_all_domains_filtered_args {
+    remote_typed_param filters<REMOTE_CONNECT_LIST_ALL_DOMAINS_FILTERS_MAX>;
+    int need_results;
+    unsigned int flags;
+};
+
+struct remote_connect_list_all_domains_filtered_ret {
+    remote_nonnull_domain domains<>;
+    unsigned int ret;
+};
+
 struct remote_connect_list_all_storage_pools_args {
     int need_results;
     unsigned int flags;
@@ -2696,6 +2800,95 @@ struct remote_domain_fstrim_args {
     unsigned int flags;
 };
 
+struct remote_domain_list_fs_freeze_args {
+    remote_nonnull_domain doms<REMOTE_DOMAIN_LIST_MAX>;
+    unsigned int timeout;
+    unsigned int flags;
+};
+
+struct remote_domain_list_fs_freeze_ret {
+    int ret;
+};
+
+struct remote_domain_list_fs_thaw_args {
+    remote_nonnull_domain doms<REMOTE_DOMAIN_LIST_MAX>;
+    unsigned int timeout;
+    unsigned int flags;
+};
+
+struct remote_domain_list_fs_thaw_ret {
+    int ret;
+};
+
+struct remote_domain_migrate_get_compression_cache_args {
+    remote_nonnull_domain dom;
+    unsigned int flags;
+};
+
+struct remote_domain_migrate_get_compression_cache_ret {
+    unsigned hyper cacheSize; /* insert@1 */
+};
+
+struct remote_domain_migrate_set_compression_cache_args {
+    remote_nonnull_domain dom;
+    unsigned hyper cacheSize;
+    unsigned int flags;
+};
+
+struct remote_domain_stats_record {
+    remote_nonnull_domain dom;
+    remote_typed_param params<REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX>;
+};
+
+struct remote_connect_get_all_domain_stats_args {
+    unsigned int stats;
+    unsigned int flags;
+};
+
+struct remote_connect_get_all_domain_stats_ret {
+    remote_domain_stats_record retStats<REMOTE_DOMAIN_LIST_MAX>;
+};
+
+struct remote_network_dhcp_lease {
+    remote_nonnull_string iface;
+    hyper expirytime;
+    int type;
+    remote_string mac;
+    remote_string iaid;
+    remote_nonnull_string ipaddr;
+    unsigned int prefix;
+    remote_string hostname;
+    remote_string clientid;
+};
+
+struct remote_network_get_dhcp_leases_args {
+    remote_nonnull_network net;
+    remote_string mac;
+    int need_results;
+    unsigned int flags;
+};
+
+struct remote_network_get_dhcp_leases_ret {
+    remote_network_dhcp_lease leases<REMOTE_NETWORK_DHCP_LEASES_MAX>;
+    unsigned int ret;
+};
+
+/* The memory file and the two doorbells of the ring are passed
+ * along with the call, see virnetshmring.h */
+struct remote_connect_open_shm_ring_args {
+    unsigned int size;
+    unsigned int flags;
+};
+
+struct remote_connect_get_list_generation_args {
+    unsigned int type;
+    unsigned int flags;
+};
+
+struct remote_connect_get_list_generation_ret {
+    unsigned hyper generation;
+};
+
 /*----- Protocol. -----*/
 
 /* Define the program number, protocol version and procedure numbers here. */
@@ -2738,13 +2931,13 @@ enum remote_procedure {
     REMOTE_PROC_DOMAIN_GET_INFO = 16, /* autogen autogen */
     REMOTE_PROC_DOMAIN_GET_MAX_MEMORY = 17, /* autogen autogen priority:high */
     REMOTE_PROC_DOMAIN_GET_MAX_VCPUS = 18, /* autogen autogen priority:high */
-    REMOTE_PROC_DOMAIN_GET_OS_TYPE = 19, /* autogen autogen priority:high */
+    REMOTE_PROC_DOMAIN_GET_OS_TYPE = 19, /* autogen skipgen priority:high */
     REMOTE_PROC_DOMAIN_GET_VCPUS = 20, /* skipgen skipgen priority:high */
 
     REMOTE_PROC_LIST_DEFINED_DOMAINS = 21, /* autogen autogen priority:high */
     REMOTE_PROC_DOMAIN_LOOKUP_BY_ID = 22, /* autogen autogen priority:high */
-    REMOTE_PROC_DOMAIN_LOOKUP_BY_NAME = 23, /* autogen autogen priority:high */
-    REMOTE_PROC_DOMAIN_LOOKUP_BY_UUID = 24, /* autogen autogen priority:high */
+    REMOTE_PROC_DOMAIN_LOOKUP_BY_NAME = 23, /* autogen skipgen priority:high */
+    REMOTE_PROC_DOMAIN_LOOKUP_BY_UUID = 24, /* autogen skipgen priority:high */
     REMOTE_PROC_NUM_OF_DEFINED_DOMAINS = 25, /* autogen autogen priority:high */
     REMOTE_PROC_DOMAIN_PIN_VCPU = 26, /* autogen autogen */
     REMOTE_PROC_DOMAIN_REBOOT = 27, /* autogen autogen */
@@ -2884,7 +3077,7 @@ enum remote_procedure {
     REMOTE_PROC_IS_SECURE = 149, /* autogen skipgen priority:high */
     REMOTE_PROC_DOMAIN_IS_ACTIVE = 150, /* autogen autogen priority:high */
 
-    REMOTE_PROC_DOMAIN_IS_PERSISTENT = 151, /* autogen autogen priority:high */
+    REMOTE_PROC_DOMAIN_IS_PERSISTENT = 151, /* autogen skipgen priority:high */
     REMOTE_PROC_NETWORK_IS_ACTIVE = 152, /* autogen autogen priority:high */
     REMOTE_PROC_NETWORK_IS_PERSISTENT = 153, /* autogen autogen priority:high */
     REMOTE_PROC_STORAGE_POOL_IS_ACTIVE = 154, /* autogen autogen priority:high */
@@ -3042,7 +3235,28 @@ enum remote_procedure {
     REMOTE_PROC_DOMAIN_EVENT_PMSUSPEND_DISK = 292, /* autogen autogen */
     REMOTE_PROC_NODE_GET_CPU_MAP = 293, /* skipgen skipgen */
     REMOTE_PROC_DOMAIN_FSTRIM = 294, /* autogen autogen */
-    REMOTE_PROC_DOMAIN_SEND_PROCESS_SIGNAL = 295 /* autogen autogen */
+    REMOTE_PROC_DOMAIN_SEND_PROCESS_SIGNAL = 295, /* autogen autogen */
+    REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS = 296, /* skipgen skipgen */
+    REMOTE_PROC_DOMAIN_EVENTS_REGISTER_DOMAIN = 297, /* skipgen skipgen priority:high */
+    REMOTE_PROC_DOMAIN_EVENTS_DEREGISTER_DOMAIN = 298, /* skipgen skipgen priority:high */
+    REMOTE_PROC_STORAGE_VOL_GET_JOB_INFO = 299, /* skipgen skipgen */
+    REMOTE_PROC_STORAGE_VOL_ABORT_JOB = 300, /* autogen autogen */
+
+    REMOTE_PROC_DOMAIN_ATTACH_DEVICES = 301, /* autogen autogen */
+    REMOTE_PROC_CONNECT_GET_HOST_CAPABILITIES = 302, /* autogen autogen */
+    REMOTE_PROC_DOMAIN_BLOCK_FLATTEN = 303, /* autogen autogen */
+    REMOTE_PROC_CONNECT_DESTROY_ALL_DOMAINS = 304, /* autogen autogen */
+    REMOTE_PROC_NETWORK_GET_DHCP_LEASES = 305, /* skipgen skipgen */
+    REMOTE_PROC_CONNECT_OPEN_SHM_RING = 306, /* skipgen skipgen */
+    REMOTE_PROC_CONNECT_GET_LIST_GENERATION = 307, /* skipgen skipgen */
+    REMOTE_PROC_DOMAIN_BLOCK_PEEK_STREAM = 308, /* autogen autogen | readstream@1 */
+    REMOTE_PROC_DOMAIN_MEMORY_PEEK_STREAM = 309, /* autogen autogen | readstream@1 */
+
+    REMOTE_PROC_DOMAIN_LIST_FS_FREEZE = 310, /* skipgen skipgen */
+    REMOTE_PROC_DOMAIN_LIST_FS_THAW = 311, /* skipgen skipgen */
+    REMOTE_PROC_DOMAIN_MIGRATE_GET_COMPRESSION_CACHE = 312, /* autogen autogen */
+    REMOTE_PROC_DOMAIN_MIGRATE_SET_COMPRESSION_CACHE = 313, /* autogen autogen */
+    REMOTE_PROC_CONNECT_LIST_ALL_DOMAINS_FILTERED = 314 /* skipgen skipgen priority:high */
 
     /*
      * Notice how the entries are grouped in sets of 10 ?
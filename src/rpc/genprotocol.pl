@@ -33,6 +33,86 @@ open TARGET, ">$target"
 
 my $fixup = $^O eq "linux" || $^O eq "cygwin";
 
+# XDR routines of fixed size scalars, which can be put in and taken
+# out of a buffer directly: the number of XDR units each uses, and
+# whether the value is signed.
+my %scalars = (
+    "int" => [1, 1],
+    "u_int" => [1, 0],
+    "short" => [1, 1],
+    "u_short" => [1, 0],
+    "char" => [1, 1],
+    "u_char" => [1, 0],
+    "int64_t" => [2, 1],
+    "uint64_t" => [2, 0],
+);
+
+# rpcgen only inlines runs of 32 bit integers, and only long ones.
+# For a struct made of nothing but fixed size scalars, such as the
+# replies of the statistics calls, get the space of the whole struct
+# at once and copy the fields in or out of it, keeping the per field
+# calls for streams which cannot provide it.
+sub inline_scalars {
+    my @body = grep !/^\s*$/ && !/\bint32_t \*buf;/ && !/return TRUE;/, @_;
+    my @fields;
+    my $units = 0;
+
+    return @_ if @body < 4 || @body % 2;
+
+    while (@body) {
+        my $call = shift @body;
+        my $ret = shift @body;
+
+        return @_ unless
+            $call =~ m/^\s*if \(!xdr_(\w+) \(xdrs, &objp->(\w+)\)\)$/;
+
+        my ($type, $field) = ($1, $2);
+        return @_ unless
+            exists $scalars{$type} && $ret =~ m/^\s*return FALSE;$/;
+
+        push @fields, [$field, @{$scalars{$type}}];
+        $units += $scalars{$type}->[0];
+    }
+
+    my @encode;
+    my @decode;
+    foreach (@fields) {
+        my ($field, $size, $signed) = @$_;
+        my $get = $signed ? "IXDR_GET_INT32" : "IXDR_GET_U_INT32";
+
+        if ($size == 2) {
+            push @encode,
+                "                        (void)IXDR_PUT_U_INT32(buf, (uint64_t) objp->$field >> 32);\n",
+                "                        (void)IXDR_PUT_U_INT32(buf, objp->$field);\n";
+            push @decode,
+                "                        objp->$field = (uint64_t) IXDR_GET_U_INT32(buf) << 32;\n",
+                "                        objp->$field |= IXDR_GET_U_INT32(buf);\n";
+        } else {
+            push @encode,
+                "                        (void)IXDR_PUT_INT32(buf, objp->$field);\n";
+            push @decode,
+                "                        objp->$field = $get(buf);\n";
+        }
+    }
+
+    return ("        register int32_t *buf;\n",
+            "\n",
+            "        if (xdrs->x_op == XDR_ENCODE) {\n",
+            "                buf = XDR_INLINE (xdrs, $units * BYTES_PER_XDR_UNIT);\n",
+            "                if (buf != NULL) {\n",
+            @encode,
+            "                        return TRUE;\n",
+            "                }\n",
+            "        } else if (xdrs->x_op == XDR_DECODE) {\n",
+            "                buf = XDR_INLINE (xdrs, $units * BYTES_PER_XDR_UNIT);\n",
+            "                if (buf != NULL) {\n",
+            @decode,
+            "                        return TRUE;\n",
+            "                }\n",
+            "        }\n",
+            grep !/\bint32_t \*buf;/, @_);
+}
+
 if ($mode eq "-c") {
     print TARGET "#include <config.h>\n";
 }
@@ -68,6 +148,8 @@ while (<RPCGEN>) {
 
         # Note: The body of the function is in @function.
 
+        @function = inline_scalars(@function);
+
         # Remove decl of buf, if buf isn't used in the function.
         my @uses = grep /[^.>]\bbuf\b/, @function;
         @function = grep !/[^.>]\bbuf\b/, @function if @uses == 1;
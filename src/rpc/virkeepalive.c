@@ -44,7 +44,14 @@ struct _virKeepAlive {
     unsigned int countToDeath;
     time_t lastPacketReceived;
     time_t intervalStart;
-    int timer;
+    bool running;
+
+    /* Protected by virKeepAliveWheelLock */
+    bool inWheel;
+    time_t wheelDeadline;
+    size_t wheelSlot;
+    virKeepAlivePtr wheelNext;
+    virKeepAlivePtr wheelPrev;
 
     virKeepAliveSendFunc sendCB;
     virKeepAliveDeadFunc deadCB;
@@ -53,6 +60,23 @@ struct _virKeepAlive {
 };
 
 
+/*
+ * Rather than giving each connection an event loop timer of its own,
+ * all keepalive objects share a hashed timer wheel driven by a single
+ * timer which ticks once a second while the wheel is not empty. Each
+ * object sits in the slot of the second in which it is next due.
+ * Incoming traffic only moves the start of the current interval, so
+ * when an object's slot comes round it may turn out not to be due yet,
+ * in which case it is simply put back into the right slot.
+ */
+#define VIR_KEEPALIVE_WHEEL_SLOTS 64
+
+static virMutex virKeepAliveWheelLock;
+static virKeepAlivePtr virKeepAliveWheel[VIR_KEEPALIVE_WHEEL_SLOTS];
+static size_t virKeepAliveWheelCount;
+static time_t virKeepAliveWheelLast;
+static int virKeepAliveWheelTimer = -1;
+
 static virClassPtr virKeepAliveClass;
 static void virKeepAliveDispose(void *obj);
 
@@ -63,6 +87,12 @@ static int virKeepAliveOnceInit(void)
                                           virKeepAliveDispose)))
         return -1;
 
+    if (virMutexInit(&virKeepAliveWheelLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
     return 0;
 }
 
@@ -136,11 +166,8 @@ virKeepAliveTimerInternal(virKeepAlivePtr ka,
     if (ka->interval <= 0 || ka->intervalStart == 0)
         return false;
 
-    if (now - ka->intervalStart < ka->interval) {
-        int timeout = ka->interval - (now - ka->intervalStart);
-        virEventUpdateTimeout(ka->timer, timeout * 1000);
+    if (now - ka->intervalStart < ka->interval)
         return false;
-    }
 
     PROBE(RPC_KEEPALIVE_TIMEOUT,
           "ka=%p client=%p countToDeath=%d idle=%d",
@@ -159,43 +186,173 @@ virKeepAliveTimerInternal(virKeepAlivePtr ka,
         ka->countToDeath--;
         ka->intervalStart = now;
         *msg = virKeepAliveMessage(ka, KEEPALIVE_PROC_PING);
-        virEventUpdateTimeout(ka->timer, ka->interval * 1000);
         return false;
     }
 }
 
 
+static void virKeepAliveWheelTick(int timer, void *opaque);
+
+/* Caller must hold ka->lock and virKeepAliveWheelLock */
 static void
-virKeepAliveTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
+virKeepAliveWheelLink(virKeepAlivePtr ka)
+{
+    size_t slot;
+
+    ka->wheelDeadline = ka->intervalStart + ka->interval;
+    if (ka->wheelDeadline <= virKeepAliveWheelLast)
+        slot = (virKeepAliveWheelLast + 1) % VIR_KEEPALIVE_WHEEL_SLOTS;
+    else
+        slot = ka->wheelDeadline % VIR_KEEPALIVE_WHEEL_SLOTS;
+
+    ka->wheelSlot = slot;
+    ka->wheelPrev = NULL;
+    ka->wheelNext = virKeepAliveWheel[slot];
+    if (ka->wheelNext)
+        ka->wheelNext->wheelPrev = ka;
+    virKeepAliveWheel[slot] = ka;
+    ka->inWheel = true;
+}
+
+/* Caller must hold virKeepAliveWheelLock */
+static void
+virKeepAliveWheelUnlink(virKeepAlivePtr ka)
+{
+    if (ka->wheelPrev)
+        ka->wheelPrev->wheelNext = ka->wheelNext;
+    else
+        virKeepAliveWheel[ka->wheelSlot] = ka->wheelNext;
+    if (ka->wheelNext)
+        ka->wheelNext->wheelPrev = ka->wheelPrev;
+    ka->wheelNext = ka->wheelPrev = NULL;
+    ka->inWheel = false;
+}
+
+/*
+ * Put @ka into the wheel, which then holds a reference to it.
+ * Caller must hold ka->lock.
+ */
+static int
+virKeepAliveWheelAdd(virKeepAlivePtr ka)
+{
+    int ret = -1;
+
+    virMutexLock(&virKeepAliveWheelLock);
+
+    if (virKeepAliveWheelTimer < 0) {
+        virKeepAliveWheelLast = time(NULL);
+        if ((virKeepAliveWheelTimer =
+             virEventAddTimeout(1000, virKeepAliveWheelTick,
+                                NULL, NULL)) < 0)
+            goto cleanup;
+    } else if (virKeepAliveWheelCount == 0) {
+        virKeepAliveWheelLast = time(NULL);
+        virEventUpdateTimeout(virKeepAliveWheelTimer, 1000);
+    }
+
+    virKeepAliveWheelLink(ka);
+    virKeepAliveWheelCount++;
+    virObjectRef(ka);
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&virKeepAliveWheelLock);
+    return ret;
+}
+
+/* Caller must hold virKeepAliveWheelLock */
+static void
+virKeepAliveWheelDrop(virKeepAlivePtr ka)
+{
+    virKeepAliveWheelUnlink(ka);
+    if (--virKeepAliveWheelCount == 0)
+        virEventUpdateTimeout(virKeepAliveWheelTimer, -1);
+}
+
+/*
+ * Handle @ka which was taken off the wheel as due, along with the
+ * wheel's reference to it.
+ */
+static void
+virKeepAliveWheelRun(virKeepAlivePtr ka)
 {
-    virKeepAlivePtr ka = opaque;
     virNetMessagePtr msg = NULL;
-    bool dead;
+    bool dead = false;
     void *client;
 
     virKeepAliveLock(ka);
 
+    /* Stopped, or stopped and started again, while we were not looking */
+    if (!ka->running || ka->inWheel) {
+        virKeepAliveUnlock(ka);
+        virObjectUnref(ka);
+        return;
+    }
+
     client = ka->client;
     dead = virKeepAliveTimerInternal(ka, &msg);
 
-    if (!dead && !msg)
-        goto cleanup;
+    if (!dead && virKeepAliveWheelAdd(ka) < 0) {
+        VIR_WARN("Failed to reschedule keepalive for client %p", client);
+        virResetLastError();
+    }
 
-    virObjectRef(ka);
     virKeepAliveUnlock(ka);
 
     if (dead) {
         ka->deadCB(client);
-    } else if (ka->sendCB(client, msg) < 0) {
+    } else if (msg && ka->sendCB(client, msg) < 0) {
         VIR_WARN("Failed to send keepalive request to client %p", client);
         virNetMessageFree(msg);
     }
 
-    virKeepAliveLock(ka);
     virObjectUnref(ka);
+}
 
-cleanup:
-    virKeepAliveUnlock(ka);
+
+static void
+virKeepAliveWheelTick(int timer ATTRIBUTE_UNUSED,
+                      void *opaque ATTRIBUTE_UNUSED)
+{
+    time_t now = time(NULL);
+    time_t t, first, last;
+    virKeepAlivePtr due = NULL;
+    virKeepAlivePtr ka, next;
+
+    virMutexLock(&virKeepAliveWheelLock);
+
+    /* Only the slots of the seconds which passed since the last tick
+     * need looking at, unless the clock jumped */
+    first = virKeepAliveWheelLast + 1;
+    last = now;
+    if (now < first || now - first >= VIR_KEEPALIVE_WHEEL_SLOTS) {
+        first = 0;
+        last = VIR_KEEPALIVE_WHEEL_SLOTS - 1;
+    }
+
+    for (t = first; t <= last; t++) {
+        for (ka = virKeepAliveWheel[t % VIR_KEEPALIVE_WHEEL_SLOTS];
+             ka; ka = next) {
+            next = ka->wheelNext;
+
+            /* Those a full turn of the wheel or more away stay */
+            if (ka->wheelDeadline > now && first != 0)
+                continue;
+
+            virKeepAliveWheelDrop(ka);
+            ka->wheelNext = due;
+            due = ka;
+        }
+    }
+    virKeepAliveWheelLast = now;
+
+    virMutexUnlock(&virKeepAliveWheelLock);
+
+    for (ka = due; ka; ka = next) {
+        next = ka->wheelNext;
+        ka->wheelNext = NULL;
+        virKeepAliveWheelRun(ka);
+    }
 }
 
 
@@ -225,7 +382,6 @@ virKeepAliveNew(int interval,
     ka->interval = interval;
     ka->count = count;
     ka->countToDeath = count;
-    ka->timer = -1;
     ka->client = client;
     ka->sendCB = sendCB;
     ka->deadCB = deadCB;
@@ -261,7 +417,7 @@ virKeepAliveStart(virKeepAlivePtr ka,
 
     virKeepAliveLock(ka);
 
-    if (ka->timer >= 0) {
+    if (ka->running) {
         VIR_DEBUG("Keepalive messages already enabled");
         ret = 0;
         goto cleanup;
@@ -295,13 +451,10 @@ virKeepAliveStart(virKeepAlivePtr ka,
     else
         timeout = ka->interval - delay;
     ka->intervalStart = now - (ka->interval - timeout);
-    ka->timer = virEventAddTimeout(timeout * 1000, virKeepAliveTimer,
-                                   ka, virObjectFreeCallback);
-    if (ka->timer < 0)
+    if (virKeepAliveWheelAdd(ka) < 0)
         goto cleanup;
 
-    /* the timer now has another reference to this object */
-    virObjectRef(ka);
+    ka->running = true;
     ret = 0;
 
 cleanup:
@@ -313,18 +466,28 @@ cleanup:
 void
 virKeepAliveStop(virKeepAlivePtr ka)
 {
+    bool unref = false;
+
     virKeepAliveLock(ka);
 
     PROBE(RPC_KEEPALIVE_STOP,
           "ka=%p client=%p",
           ka, ka->client);
 
-    if (ka->timer > 0) {
-        virEventRemoveTimeout(ka->timer);
-        ka->timer = -1;
+    ka->running = false;
+
+    virMutexLock(&virKeepAliveWheelLock);
+    if (ka->inWheel) {
+        virKeepAliveWheelDrop(ka);
+        unref = true;
     }
+    virMutexUnlock(&virKeepAliveWheelLock);
 
     virKeepAliveUnlock(ka);
+
+    /* drop the reference the wheel had */
+    if (unref)
+        virObjectUnref(ka);
 }
 
 
@@ -416,9 +579,8 @@ virKeepAliveCheckMessage(virKeepAlivePtr ka,
         }
     }
 
-    if (ka->timer >= 0)
-        virEventUpdateTimeout(ka->timer, ka->interval * 1000);
-
+    /* The wheel notices the new interval start when the current
+     * deadline comes round, so there is nothing to update here */
     virKeepAliveUnlock(ka);
 
     return ret;
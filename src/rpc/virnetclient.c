@@ -34,6 +34,7 @@
 #include "threads.h"
 #include "virfile.h"
 #include "logging.h"
+#include "event.h"
 #include "util.h"
 #include "virterror_internal.h"
 
@@ -56,6 +57,11 @@ struct _virNetClientCall {
     bool nonBlock;
     bool haveThread;
 
+    /* Set for calls whose reply is handed to a callback
+     * instead of a waiting thread */
+    virNetClientReplyFunc replyCb;
+    void *replyOpaque;
+
     virCond cond;
 
     virNetClientCallPtr next;
@@ -94,6 +100,12 @@ struct _virNetClient {
      * which might be a partially sent non-blocking call.
      */
     virNetClientCallPtr waitDispatch;
+    /* Finished asynchronous calls whose callbacks
+     * have yet to be run, outside the client lock */
+    virNetClientCallPtr asyncDone;
+    /* Zero-length timer running those callbacks from
+     * the event loop, or -1 */
+    int asyncDoneTimer;
     /* True if a thread holds the buck */
     bool haveTheBuck;
 
@@ -107,6 +119,11 @@ struct _virNetClient {
     virNetClientCloseFunc closeCb;
     void *closeOpaque;
     virFreeCallback closeFf;
+
+    /* Whether the server agreed to receive compressed messages */
+    bool compress;
+    /* Whether the server waits for credit on stream data */
+    bool streamCredit;
 };
 
 
@@ -131,6 +148,7 @@ static int virNetClientQueueNonBlocking(virNetClientPtr client,
                                         virNetMessagePtr msg);
 static void virNetClientCloseInternal(virNetClientPtr client,
                                       int reason);
+static void virNetClientScheduleAsyncDone(virNetClientPtr client);
 
 
 static void virNetClientLock(virNetClientPtr client)
@@ -177,19 +195,16 @@ static void virNetClientCallQueue(virNetClientCallPtr *head,
     call->next = NULL;
 }
 
-#if 0
 /* Obtain a call from the head of the list */
 static virNetClientCallPtr virNetClientCallServe(virNetClientCallPtr *head)
 {
     virNetClientCallPtr tmp = *head;
-    if (tmp)
-        *head = tmp->next;
-    else
-        *head = NULL;
+    if (!tmp)
+        return NULL;
+    *head = tmp->next;
     tmp->next = NULL;
     return tmp;
 }
-#endif
 
 /* Remove a call from anywhere in the list */
 static void virNetClientCallRemove(virNetClientCallPtr *head,
@@ -265,6 +280,60 @@ virNetClientKeepAliveIsSupported(virNetClientPtr client)
     return supported;
 }
 
+/*
+ * Start compressing large messages sent to the server, once it has
+ * agreed to VIR_DRV_FEATURE_PROGRAM_COMPRESSION. Returns false if
+ * this build does not support compression.
+ */
+bool
+virNetClientEnableCompression(virNetClientPtr client)
+{
+    if (!virNetMessageCompressionSupported())
+        return false;
+
+    virNetClientLock(client);
+    client->compress = true;
+    virNetClientUnlock(client);
+
+    return true;
+}
+
+/*
+ * Grant credit for the data of streams added from now on, once the
+ * server has agreed to VIR_DRV_FEATURE_STREAM_CREDIT.
+ */
+void
+virNetClientEnableStreamCredit(virNetClientPtr client)
+{
+    virNetClientLock(client);
+    client->streamCredit = true;
+    virNetClientUnlock(client);
+}
+
+/*
+ * Moves message data over to @ring, once the server has agreed to
+ * use it. The socket is still used to pass FDs.
+ */
+int
+virNetClientSetShmRing(virNetClientPtr client,
+                       virNetShmRingPtr ring)
+{
+    int ret = -1;
+
+    virNetClientLock(client);
+    if (!client->sock) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("client socket is closed"));
+        goto cleanup;
+    }
+
+    ret = virNetSocketSetShmRing(client->sock, ring);
+
+cleanup:
+    virNetClientUnlock(client);
+    return ret;
+}
+
 int
 virNetClientKeepAliveStart(virNetClientPtr client,
                            int interval,
@@ -332,6 +401,7 @@ static virNetClientPtr virNetClientNew(virNetSocketPtr sock,
     client->wakeupReadFD = wakeupFD[0];
     client->wakeupSendFD = wakeupFD[1];
     wakeupFD[0] = wakeupFD[1] = -1;
+    client->asyncDoneTimer = -1;
 
     if (hostname &&
         !(client->hostname = strdup(hostname)))
@@ -723,6 +793,7 @@ static void virNetClientCloseInternal(virNetClientPtr client,
         virNetClientIOEventLoopPassTheBuck(client, NULL);
     }
 
+    virNetClientScheduleAsyncDone(client);
     virNetClientUnlock(client);
 }
 
@@ -907,6 +978,9 @@ int virNetClientAddStream(virNetClientPtr client,
 
     client->streams[client->nstreams-1] = virObjectRef(st);
 
+    if (client->streamCredit)
+        virNetClientStreamEnableCredit(st);
+
     virNetClientUnlock(client);
     return 0;
 
@@ -987,12 +1061,14 @@ virNetClientCallDispatchReply(virNetClientPtr client)
         return -1;
     }
 
-    if (VIR_REALLOC_N(thecall->msg->buffer, client->msg.bufferLength) < 0) {
-        virReportOOMError();
-        return -1;
-    }
+    /* Hand the reply buffer over to the waiting call rather than
+     * copying it; a fresh one is taken for the next message */
+    virNetMessageReleaseBuffer(thecall->msg);
+    thecall->msg->buffer = client->msg.buffer;
+    thecall->msg->bufferAlloc = client->msg.bufferAlloc;
+    client->msg.buffer = NULL;
+    client->msg.bufferAlloc = 0;
 
-    memcpy(thecall->msg->buffer, client->msg.buffer, client->msg.bufferLength);
     memcpy(&thecall->msg->header, &client->msg.header, sizeof(client->msg.header));
     thecall->msg->bufferLength = client->msg.bufferLength;
     thecall->msg->bufferOffset = client->msg.bufferOffset;
@@ -1066,8 +1142,12 @@ static int virNetClientCallDispatchStream(virNetClientPtr client)
      */
     switch (client->msg.header.status) {
     case VIR_NET_CONTINUE: {
-        if (virNetClientStreamQueuePacket(st, &client->msg) < 0)
+        if (client->msg.header.type == VIR_NET_STREAM_HOLE) {
+            if (virNetClientStreamQueueHole(st, &client->msg) < 0)
+                return -1;
+        } else if (virNetClientStreamQueuePacket(st, &client->msg) < 0) {
             return -1;
+        }
 
         if (thecall && thecall->expectReply) {
             if (thecall->msg->header.status == VIR_NET_CONTINUE) {
@@ -1144,6 +1224,7 @@ virNetClientCallDispatch(virNetClientPtr client)
         return virNetClientCallDispatchMessage(client);
 
     case VIR_NET_STREAM: /* Stream protocol */
+    case VIR_NET_STREAM_HOLE: /* Sparse stream protocol */
         return virNetClientCallDispatchStream(client);
 
     default:
@@ -1184,7 +1265,7 @@ virNetClientIOWriteMessage(virNetClientPtr client,
         }
         thecall->msg->donefds = 0;
         thecall->msg->bufferOffset = thecall->msg->bufferLength = 0;
-        VIR_FREE(thecall->msg->buffer);
+        virNetMessageReleaseBuffer(thecall->msg);
         if (thecall->expectReply)
             thecall->mode = VIR_NET_CLIENT_MODE_WAIT_RX;
         else
@@ -1233,10 +1314,9 @@ virNetClientIOReadMessage(virNetClientPtr client)
     /* Start by reading length word */
     if (client->msg.bufferLength == 0) {
         client->msg.bufferLength = 4;
-        if (VIR_ALLOC_N(client->msg.buffer, client->msg.bufferLength) < 0) {
-            virReportOOMError();
+        if (virNetMessageReserveBuffer(&client->msg,
+                                       client->msg.bufferLength) < 0)
             return -ENOMEM;
-        }
     }
 
     wantData = client->msg.bufferLength - client->msg.bufferOffset;
@@ -1314,7 +1394,7 @@ virNetClientIOHandleInput(virNetClientPtr client)
 
                 ret = virNetClientCallDispatch(client);
                 client->msg.bufferOffset = client->msg.bufferLength = 0;
-                VIR_FREE(client->msg.buffer);
+                virNetMessageReleaseBuffer(&client->msg);
                 /*
                  * We've completed one call, but we don't want to
                  * spin around the loop forever if there are many
@@ -1355,12 +1435,17 @@ static bool virNetClientIOEventLoopPollEvents(virNetClientCallPtr call,
 }
 
 
+struct virNetClientIORemoveData {
+    virNetClientPtr client;
+    virNetClientCallPtr thiscall;
+};
+
 static bool virNetClientIOEventLoopRemoveDone(virNetClientCallPtr call,
                                               void *opaque)
 {
-    virNetClientCallPtr thiscall = opaque;
+    struct virNetClientIORemoveData *data = opaque;
 
-    if (call == thiscall)
+    if (call == data->thiscall)
         return false;
 
     if (call->mode != VIR_NET_CLIENT_MODE_COMPLETE)
@@ -1370,7 +1455,9 @@ static bool virNetClientIOEventLoopRemoveDone(virNetClientCallPtr call,
      * ...if the call being removed from the list
      * still has a thread, then wake that thread up,
      * otherwise free the call. The latter should
-     * only happen for calls without replies.
+     * only happen for calls without replies, or
+     * asynchronous calls, which are put aside
+     * until their callback can be run.
      *
      * ...the threads won't actually wakeup until
      * we release our mutex a short while
@@ -1379,6 +1466,9 @@ static bool virNetClientIOEventLoopRemoveDone(virNetClientCallPtr call,
     if (call->haveThread) {
         VIR_DEBUG("Waking up sleep %p", call);
         virCondSignal(&call->cond);
+    } else if (call->replyCb) {
+        VIR_DEBUG("Completed async call %p", call);
+        virNetClientCallQueue(&data->client->asyncDone, call);
     } else {
         VIR_DEBUG("Removing completed call %p", call);
         if (call->expectReply)
@@ -1404,11 +1494,19 @@ static bool
 virNetClientIOEventLoopRemoveAll(virNetClientCallPtr call,
                                  void *opaque)
 {
-    virNetClientCallPtr thiscall = opaque;
+    struct virNetClientIORemoveData *data = opaque;
 
-    if (call == thiscall)
+    if (call == data->thiscall)
         return false;
 
+    /* Async calls are failed, rather than freed, by letting
+     * their callback see a call which never completed */
+    if (call->replyCb) {
+        VIR_DEBUG("Failing async call %p", call);
+        virNetClientCallQueue(&data->client->asyncDone, call);
+        return true;
+    }
+
     VIR_DEBUG("Removing call %p", call);
     ignore_value(virCondDestroy(&call->cond));
     VIR_FREE(call->msg);
@@ -1437,10 +1535,11 @@ virNetClientIOEventLoopPassTheBuck(virNetClientPtr client,
 
     VIR_DEBUG("No thread to pass the buck to");
     if (client->wantClose) {
+        struct virNetClientIORemoveData data = { client, thiscall };
         virNetClientCloseLocked(client);
         virNetClientCallRemovePredicate(&client->waitDispatch,
                                         virNetClientIOEventLoopRemoveAll,
-                                        thiscall);
+                                        &data);
     }
 }
 
@@ -1456,12 +1555,19 @@ virNetClientIOEventLoopPassTheBuck(virNetClientPtr client,
 static int virNetClientIOEventLoop(virNetClientPtr client,
                                    virNetClientCallPtr thiscall)
 {
-    struct pollfd fds[2];
+    struct pollfd fds[3];
+    struct virNetClientIORemoveData data = { client, thiscall };
     int ret;
 
-    fds[0].fd = virNetSocketGetFD(client->sock);
+    fds[0].fd = virNetSocketGetPollFD(client->sock);
     fds[1].fd = client->wakeupReadFD;
 
+    /* With a shared memory ring fds[0] is its doorbell, and the
+     * socket itself is only polled for passed FDs and hangup */
+    fds[2].fd = virNetSocketGetFD(client->sock);
+    if (fds[2].fd == fds[0].fd)
+        fds[2].fd = -1;
+
     for (;;) {
         char ignore;
         sigset_t oldmask, blockedsigs;
@@ -1501,6 +1607,9 @@ static int virNetClientIOEventLoop(virNetClientPtr client,
         if (client->nstreams)
             fds[0].events |= POLLIN;
 
+        fds[2].events = fds[0].events & POLLIN;
+        fds[2].revents = 0;
+
         /* Release lock while poll'ing so other threads
          * can stuff themselves on the queue */
         virNetClientUnlock(client);
@@ -1542,6 +1651,8 @@ static int virNetClientIOEventLoop(virNetClientPtr client,
             virNetMessageFree(msg);
         }
 
+        fds[0].revents |= fds[2].revents & (POLLIN | POLLHUP | POLLERR);
+
         /* If we have existing SASL decoded data, pretend
          * the socket became readable so we consume it
          */
@@ -1583,7 +1694,7 @@ static int virNetClientIOEventLoop(virNetClientPtr client,
          */
         virNetClientCallRemovePredicate(&client->waitDispatch,
                                         virNetClientIOEventLoopRemoveDone,
-                                        thiscall);
+                                        &data);
 
         /* Now see if *we* are done */
         if (thiscall->mode == VIR_NET_CLIENT_MODE_COMPLETE) {
@@ -1814,6 +1925,7 @@ void virNetClientIncomingEvent(virNetSocketPtr sock,
                                void *opaque)
 {
     virNetClientPtr client = opaque;
+    struct virNetClientIORemoveData data = { client, NULL };
 
     virNetClientLock(client);
 
@@ -1851,12 +1963,19 @@ void virNetClientIncomingEvent(virNetSocketPtr sock,
     /* Remove completed calls or signal their threads. */
     virNetClientCallRemovePredicate(&client->waitDispatch,
                                     virNetClientIOEventLoopRemoveDone,
-                                    NULL);
+                                    &data);
     virNetClientIOUpdateCallback(client, true);
 
 done:
     if (client->wantClose)
         virNetClientCloseLocked(client);
+    /* Nobody is left to complete calls still queued on
+     * a closed connection */
+    if (!client->sock && !client->haveTheBuck)
+        virNetClientCallRemovePredicate(&client->waitDispatch,
+                                        virNetClientIOEventLoopRemoveAll,
+                                        &data);
+    virNetClientScheduleAsyncDone(client);
     virNetClientUnlock(client);
 }
 
@@ -1864,7 +1983,9 @@ done:
 static virNetClientCallPtr
 virNetClientCallNew(virNetMessagePtr msg,
                     bool expectReply,
-                    bool nonBlock)
+                    bool nonBlock,
+                    virNetClientReplyFunc replyCb,
+                    void *replyOpaque)
 {
     virNetClientCallPtr call = NULL;
 
@@ -1877,7 +1998,7 @@ virNetClientCallNew(virNetMessagePtr msg,
         goto error;
     }
 
-    if (expectReply && nonBlock) {
+    if (expectReply && nonBlock && !replyCb) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Attempt to send a non-blocking message with"
                          " a synchronous reply"));
@@ -1903,9 +2024,11 @@ virNetClientCallNew(virNetMessagePtr msg,
     call->msg = msg;
     call->expectReply = expectReply;
     call->nonBlock = nonBlock;
+    call->replyCb = replyCb;
+    call->replyOpaque = replyOpaque;
 
-    VIR_DEBUG("New call %p: msg=%p, expectReply=%d, nonBlock=%d",
-              call, msg, expectReply, nonBlock);
+    VIR_DEBUG("New call %p: msg=%p, expectReply=%d, nonBlock=%d, replyCb=%p",
+              call, msg, expectReply, nonBlock, replyCb);
 
     return call;
 
@@ -1928,7 +2051,7 @@ virNetClientQueueNonBlocking(virNetClientPtr client,
           msg->header.prog, msg->header.vers, msg->header.proc,
           msg->header.type, msg->header.status, msg->header.serial);
 
-    if (!(call = virNetClientCallNew(msg, false, true)))
+    if (!(call = virNetClientCallNew(msg, false, true, NULL, NULL)))
         return -1;
 
     virNetClientCallQueue(&client->waitDispatch, call);
@@ -1960,7 +2083,12 @@ static int virNetClientSendInternal(virNetClientPtr client,
         return -1;
     }
 
-    if (!(call = virNetClientCallNew(msg, expectReply, nonBlock))) {
+    if (client->compress &&
+        virNetMessageCompress(msg, VIR_NET_MESSAGE_COMPRESS_MIN) < 0)
+        return -1;
+
+    if (!(call = virNetClientCallNew(msg, expectReply, nonBlock,
+                                     NULL, NULL))) {
         virReportOOMError();
         return -1;
     }
@@ -1995,6 +2123,7 @@ int virNetClientSendWithReply(virNetClientPtr client,
     int ret;
     virNetClientLock(client);
     ret = virNetClientSendInternal(client, msg, true, false);
+    virNetClientScheduleAsyncDone(client);
     virNetClientUnlock(client);
     if (ret < 0)
         return -1;
@@ -2018,6 +2147,7 @@ int virNetClientSendNoReply(virNetClientPtr client,
     int ret;
     virNetClientLock(client);
     ret = virNetClientSendInternal(client, msg, false, false);
+    virNetClientScheduleAsyncDone(client);
     virNetClientUnlock(client);
     if (ret < 0)
         return -1;
@@ -2041,6 +2171,7 @@ int virNetClientSendNonBlock(virNetClientPtr client,
     int ret;
     virNetClientLock(client);
     ret = virNetClientSendInternal(client, msg, false, true);
+    virNetClientScheduleAsyncDone(client);
     virNetClientUnlock(client);
     return ret;
 }
@@ -2071,8 +2202,169 @@ int virNetClientSendWithReplyStream(virNetClientPtr client,
     }
 
     ret = virNetClientSendInternal(client, msg, true, false);
+    virNetClientScheduleAsyncDone(client);
     virNetClientUnlock(client);
     if (ret < 0)
         return -1;
     return 0;
 }
+
+
+/*
+ * Run the callbacks of finished asynchronous calls. The client
+ * lock is dropped around each callback so that it can issue
+ * further calls on the same client.
+ */
+static void
+virNetClientDispatchAsyncDone(virNetClientPtr client)
+{
+    virNetClientCallPtr call;
+
+    while ((call = virNetClientCallServe(&client->asyncDone))) {
+        int status = 0;
+
+        virNetClientUnlock(client);
+
+        if (call->mode != VIR_NET_CLIENT_MODE_COMPLETE) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("client socket is closed"));
+            status = -1;
+        }
+
+        VIR_DEBUG("Running callback of async call %p status=%d", call, status);
+        call->replyCb(client, status, call->msg, call->replyOpaque);
+
+        virNetMessageFree(call->msg);
+        ignore_value(virCondDestroy(&call->cond));
+        VIR_FREE(call);
+
+        virNetClientLock(client);
+        /* Drop the reference the call held, with the lock held as
+         * virNetClientDispose expects; our caller still owns one */
+        virObjectUnref(client);
+    }
+}
+
+
+static void
+virNetClientAsyncDoneTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
+{
+    virNetClientPtr client = opaque;
+
+    virNetClientLock(client);
+    if (client->asyncDoneTimer != -1) {
+        virEventRemoveTimeout(client->asyncDoneTimer);
+        client->asyncDoneTimer = -1;
+    }
+    virNetClientDispatchAsyncDone(client);
+    virNetClientUnlock(client);
+}
+
+
+/*
+ * Arrange for the callbacks of finished asynchronous calls to
+ * be run from the event loop, rather than from whichever thread
+ * happened to read their reply or to fail them.
+ */
+static void
+virNetClientScheduleAsyncDone(virNetClientPtr client)
+{
+    if (!client->asyncDone || client->asyncDoneTimer != -1)
+        return;
+
+    virObjectRef(client);
+    if ((client->asyncDoneTimer =
+         virEventAddTimeout(0, virNetClientAsyncDoneTimer, client,
+                            virObjectFreeCallback)) < 0) {
+        virObjectUnref(client);
+        client->asyncDoneTimer = -1;
+        VIR_WARN("Unable to schedule callbacks of asynchronous calls");
+    }
+}
+
+
+/*
+ * @msg: a message allocated on the heap
+ * @cb: callback to run once the reply arrives
+ * @opaque: data passed to @cb
+ *
+ * Send a message and return without waiting for the reply.
+ * Once the reply has been received, or the connection has been
+ * closed before that, @cb is invoked with the client unlocked,
+ * from the thread running the event loop, never from within this
+ * or any other call on the client: a @status of 0 means @msg
+ * holds the reply, -1 means the call failed and the error is
+ * set in the calling thread. Any number of such calls may be
+ * outstanding on one client; they are matched to their replies
+ * by serial.
+ *
+ * This requires the client to be registered with the event loop
+ * through virNetClientRegisterAsyncIO.
+ *
+ * @msg is owned by the client from now on, whatever the outcome,
+ * and is freed once @cb returns.
+ *
+ * Returns 0 if the message was queued, -1 on error, in which case
+ * @cb is never invoked.
+ */
+int virNetClientSendWithReplyAsync(virNetClientPtr client,
+                                   virNetMessagePtr msg,
+                                   virNetClientReplyFunc cb,
+                                   void *opaque)
+{
+    virNetClientCallPtr call;
+    int ret = -1;
+    int rv;
+
+    virNetClientLock(client);
+
+    PROBE(RPC_CLIENT_MSG_TX_QUEUE,
+          "client=%p len=%zu prog=%u vers=%u proc=%u type=%u status=%u serial=%u",
+          client, msg->bufferLength,
+          msg->header.prog, msg->header.vers, msg->header.proc,
+          msg->header.type, msg->header.status, msg->header.serial);
+
+    if (!client->asyncIO) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("asynchronous calls require an event loop"));
+        goto error;
+    }
+
+    if (!client->sock || client->wantClose) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("client socket is closed"));
+        goto error;
+    }
+
+    if (!(call = virNetClientCallNew(msg, true, true, cb, opaque)))
+        goto error;
+
+    call->haveThread = true;
+    rv = virNetClientIO(client, call);
+
+    if (rv < 0) {
+        ignore_value(virCondDestroy(&call->cond));
+        VIR_FREE(call);
+        goto error;
+    }
+
+    /* The call holds a reference until its callback has run */
+    virObjectRef(client);
+
+    /* The reply may have come in before virNetClientIO returned,
+     * in which case the call is no longer queued anywhere */
+    if (rv == 0) {
+        call->haveThread = false;
+        virNetClientCallQueue(&client->asyncDone, call);
+    }
+
+    ret = 0;
+    virNetClientScheduleAsyncDone(client);
+    virNetClientUnlock(client);
+    return ret;
+
+error:
+    virNetClientUnlock(client);
+    virNetMessageFree(msg);
+    return ret;
+}
@@ -25,6 +25,7 @@
 
 # include "virnettlscontext.h"
 # include "virnetmessage.h"
+# include "virnetshmring.h"
 # ifdef HAVE_SASL
 #  include "virnetsaslcontext.h"
 # endif
@@ -102,6 +103,16 @@ int virNetClientSendWithReplyStream(virNetClientPtr client,
                                     virNetMessagePtr msg,
                                     virNetClientStreamPtr st);
 
+typedef void (*virNetClientReplyFunc)(virNetClientPtr client,
+                                      int status,
+                                      virNetMessagePtr msg,
+                                      void *opaque);
+
+int virNetClientSendWithReplyAsync(virNetClientPtr client,
+                                   virNetMessagePtr msg,
+                                   virNetClientReplyFunc cb,
+                                   void *opaque);
+
 # ifdef HAVE_SASL
 void virNetClientSetSASLSession(virNetClientPtr client,
                                 virNetSASLSessionPtr sasl);
@@ -127,4 +138,11 @@ int virNetClientKeepAliveStart(virNetClientPtr client,
 
 void virNetClientKeepAliveStop(virNetClientPtr client);
 
+bool virNetClientEnableCompression(virNetClientPtr client);
+
+void virNetClientEnableStreamCredit(virNetClientPtr client);
+
+int virNetClientSetShmRing(virNetClientPtr client,
+                           virNetShmRingPtr ring);
+
 #endif /* __VIR_NET_CLIENT_H__ */
@@ -267,6 +267,37 @@ cleanup:
 }
 
 
+static int
+virNetClientProgramCheckReply(virNetMessagePtr msg,
+                              unsigned serial,
+                              int proc)
+{
+    /* None of these 3 should ever happen here, because
+     * virNetClientSend should have validated the reply,
+     * but it doesn't hurt to check again.
+     */
+    if (msg->header.type != VIR_NET_REPLY &&
+        msg->header.type != VIR_NET_REPLY_WITH_FDS) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected message type %d"), msg->header.type);
+        return -1;
+    }
+    if (msg->header.proc != proc) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected message proc %d != %d"),
+                       msg->header.proc, proc);
+        return -1;
+    }
+    if (msg->header.serial != serial) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected message serial %d != %d"),
+                       msg->header.serial, serial);
+        return -1;
+    }
+    return 0;
+}
+
+
 int virNetClientProgramCall(virNetClientProgramPtr prog,
                             virNetClientPtr client,
                             unsigned serial,
@@ -330,28 +361,8 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
     if (virNetClientSendWithReply(client, msg) < 0)
         goto error;
 
-    /* None of these 3 should ever happen here, because
-     * virNetClientSend should have validated the reply,
-     * but it doesn't hurt to check again.
-     */
-    if (msg->header.type != VIR_NET_REPLY &&
-        msg->header.type != VIR_NET_REPLY_WITH_FDS) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Unexpected message type %d"), msg->header.type);
+    if (virNetClientProgramCheckReply(msg, serial, proc) < 0)
         goto error;
-    }
-    if (msg->header.proc != proc) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Unexpected message proc %d != %d"),
-                       msg->header.proc, proc);
-        goto error;
-    }
-    if (msg->header.serial != serial) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Unexpected message serial %d != %d"),
-                       msg->header.serial, serial);
-        goto error;
-    }
 
     switch (msg->header.status) {
     case VIR_NET_OK:
@@ -405,3 +416,132 @@ error:
     }
     return -1;
 }
+
+
+struct virNetClientProgramAsyncCall {
+    virNetClientProgramPtr prog;
+    unsigned serial;
+    int proc;
+    xdrproc_t ret_filter;
+    size_t retsize;
+    virNetClientProgramCallFunc cb;
+    void *opaque;
+};
+
+
+static void
+virNetClientProgramAsyncReply(virNetClientPtr client ATTRIBUTE_UNUSED,
+                              int status,
+                              virNetMessagePtr msg,
+                              void *opaque)
+{
+    struct virNetClientProgramAsyncCall *call = opaque;
+    char *ret = NULL;
+
+    if (status < 0)
+        goto error;
+
+    if (virNetClientProgramCheckReply(msg, call->serial, call->proc) < 0)
+        goto error;
+
+    switch (msg->header.status) {
+    case VIR_NET_OK:
+        if (VIR_ALLOC_N(ret, call->retsize) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+        if (virNetMessageDecodePayload(msg, call->ret_filter, ret) < 0)
+            goto error;
+        break;
+
+    case VIR_NET_ERROR:
+        virNetClientProgramDispatchError(call->prog, msg);
+        goto error;
+
+    default:
+        virReportError(VIR_ERR_RPC,
+                       _("Unexpected message status %d"), msg->header.status);
+        goto error;
+    }
+
+    call->cb(call->prog, 0, ret, call->opaque);
+    xdr_free(call->ret_filter, ret);
+    goto cleanup;
+
+error:
+    call->cb(call->prog, -1, NULL, call->opaque);
+
+cleanup:
+    VIR_FREE(ret);
+    virObjectUnref(call->prog);
+    VIR_FREE(call);
+}
+
+
+/*
+ * Submit a call without waiting for its reply. Once the reply has
+ * been decoded into a zeroed buffer of @retsize bytes, @cb gets it
+ * with a status of 0; the buffer is xdr_free'd when @cb returns. On
+ * failure @cb sees a status of -1 and a NULL reply, with the error
+ * set in the calling thread. Passing file descriptors is not
+ * supported.
+ *
+ * Returns 0 if the call was queued, -1 on error, in which case @cb
+ * is never invoked.
+ */
+int virNetClientProgramCallAsync(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 unsigned serial,
+                                 int proc,
+                                 xdrproc_t args_filter, void *args,
+                                 xdrproc_t ret_filter, size_t retsize,
+                                 virNetClientProgramCallFunc cb,
+                                 void *opaque)
+{
+    virNetMessagePtr msg;
+    struct virNetClientProgramAsyncCall *call = NULL;
+
+    if (!(msg = virNetMessageNew(false)))
+        return -1;
+
+    msg->header.prog = prog->program;
+    msg->header.vers = prog->version;
+    msg->header.status = VIR_NET_OK;
+    msg->header.type = VIR_NET_CALL;
+    msg->header.serial = serial;
+    msg->header.proc = proc;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto error;
+
+    if (virNetMessageEncodePayload(msg, args_filter, args) < 0)
+        goto error;
+
+    if (VIR_ALLOC(call) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+
+    call->prog = virObjectRef(prog);
+    call->serial = serial;
+    call->proc = proc;
+    call->ret_filter = ret_filter;
+    call->retsize = retsize;
+    call->cb = cb;
+    call->opaque = opaque;
+
+    /* The message belongs to the client from here on */
+    if (virNetClientSendWithReplyAsync(client, msg,
+                                       virNetClientProgramAsyncReply,
+                                       call) < 0) {
+        virObjectUnref(call->prog);
+        VIR_FREE(call);
+        return -1;
+    }
+
+    return 0;
+
+error:
+    virNetMessageFree(msg);
+    return -1;
+}
@@ -81,6 +81,20 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
                             xdrproc_t args_filter, void *args,
                             xdrproc_t ret_filter, void *ret);
 
+typedef void (*virNetClientProgramCallFunc)(virNetClientProgramPtr prog,
+                                            int status,
+                                            void *ret,
+                                            void *opaque);
+
+int virNetClientProgramCallAsync(virNetClientProgramPtr prog,
+                                 virNetClientPtr client,
+                                 unsigned serial,
+                                 int proc,
+                                 xdrproc_t args_filter, void *args,
+                                 xdrproc_t ret_filter, size_t retsize,
+                                 virNetClientProgramCallFunc cb,
+                                 void *opaque);
+
 
 
 #endif /* __VIR_NET_CLIENT_PROGRAM_H__ */
@@ -32,6 +32,15 @@
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+typedef struct _virNetClientStreamHole virNetClientStreamHole;
+typedef virNetClientStreamHole *virNetClientStreamHolePtr;
+
+struct _virNetClientStreamHole {
+    /* Amount of data queued ahead of the hole */
+    unsigned long long pos;
+    long long length;
+};
+
 struct _virNetClientStream {
     virObject object;
 
@@ -49,12 +58,32 @@ struct _virNetClientStream {
      * recv them. Figure out how to address this some
      * time by stopping consuming any incoming data
      * off the socket....
+     *
+     * Pending data lives in incoming[incomingStart..incomingOffset);
+     * all three are reset to zero once it has been consumed.
      */
     char *incoming;
+    size_t incomingStart;
     size_t incomingOffset;
     size_t incomingLength;
     bool incomingEOF;
 
+    /* Holes received on a sparse stream, in order, positioned
+     * relative to the running totals of data bytes queued and
+     * consumed; hole bytes are not included in either total.
+     */
+    virNetClientStreamHolePtr holes;
+    size_t nholes;
+    unsigned long long incomingQueued;
+    unsigned long long incomingConsumed;
+
+    /* Whether the server waits for our credit before sending data,
+     * and the total of data bytes it has been granted so far. This
+     * bounds the incoming buffer to VIR_NET_STREAM_CREDIT_WINDOW.
+     */
+    bool credit;
+    unsigned long long creditLimit;
+
     virNetClientStreamEventCallback cb;
     void *cbOpaque;
     virFreeCallback cbFree;
@@ -88,7 +117,7 @@ virNetClientStreamEventTimerUpdate(virNetClientStreamPtr st)
 
     VIR_DEBUG("Check timer offset=%zu %d", st->incomingOffset, st->cbEvents);
 
-    if (((st->incomingOffset || st->incomingEOF) &&
+    if (((st->incomingOffset || st->nholes || st->incomingEOF) &&
          (st->cbEvents & VIR_STREAM_EVENT_READABLE)) ||
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE)) {
         VIR_DEBUG("Enabling event timer");
@@ -111,7 +140,7 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_READABLE) &&
-        (st->incomingOffset || st->incomingEOF))
+        (st->incomingOffset || st->nholes || st->incomingEOF))
         events |= VIR_STREAM_EVENT_READABLE;
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE))
@@ -164,12 +193,26 @@ virNetClientStreamPtr virNetClientStreamNew(virNetClientProgramPtr prog,
     return st;
 }
 
+/*
+ * Take part in credit based flow control, once the server has agreed
+ * to VIR_DRV_FEATURE_STREAM_CREDIT. Must be called before any data is
+ * received.
+ */
+void virNetClientStreamEnableCredit(virNetClientStreamPtr st)
+{
+    virMutexLock(&st->lock);
+    st->credit = true;
+    st->creditLimit = VIR_NET_STREAM_CREDIT_WINDOW;
+    virMutexUnlock(&st->lock);
+}
+
 void virNetClientStreamDispose(void *obj)
 {
     virNetClientStreamPtr st = obj;
 
     virResetError(&st->err);
     VIR_FREE(st->incoming);
+    VIR_FREE(st->holes);
     virMutexDestroy(&st->lock);
     virObjectUnref(st->prog);
 }
@@ -279,21 +322,34 @@ int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
     virMutexLock(&st->lock);
     need = msg->bufferLength - msg->bufferOffset;
     if (need) {
-        size_t avail = st->incomingLength - st->incomingOffset;
-        if (need > avail) {
-            size_t extra = need - avail;
-            if (VIR_REALLOC_N(st->incoming,
-                              st->incomingLength + extra) < 0) {
+        if (!st->incoming) {
+            /* Nothing pending, so steal the message buffer rather
+             * than copying the payload out of it */
+            st->incoming = msg->buffer;
+            st->incomingStart = msg->bufferOffset;
+            st->incomingOffset = st->incomingLength = msg->bufferLength;
+            msg->buffer = NULL;
+            msg->bufferAlloc = 0;
+            msg->bufferLength = msg->bufferOffset = 0;
+        } else {
+            if (st->incomingStart) {
+                memmove(st->incoming, st->incoming + st->incomingStart,
+                        st->incomingOffset - st->incomingStart);
+                st->incomingOffset -= st->incomingStart;
+                st->incomingStart = 0;
+            }
+
+            if (VIR_RESIZE_N(st->incoming, st->incomingLength,
+                             st->incomingOffset, need) < 0) {
                 VIR_DEBUG("Out of memory handling stream data");
                 goto cleanup;
             }
-            st->incomingLength += extra;
-        }
 
-        memcpy(st->incoming + st->incomingOffset,
-               msg->buffer + msg->bufferOffset,
-               msg->bufferLength - msg->bufferOffset);
-        st->incomingOffset += (msg->bufferLength - msg->bufferOffset);
+            memcpy(st->incoming + st->incomingOffset,
+                   msg->buffer + msg->bufferOffset, need);
+            st->incomingOffset += need;
+        }
+        st->incomingQueued += need;
     } else {
         st->incomingEOF = true;
     }
@@ -311,6 +367,60 @@ cleanup:
 }
 
 
+int virNetClientStreamQueueHole(virNetClientStreamPtr st,
+                                virNetMessagePtr msg)
+{
+    virNetStreamHole data;
+    int ret = -1;
+
+    memset(&data, 0, sizeof(data));
+
+    virMutexLock(&st->lock);
+
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto cleanup;
+
+    if (data.length < 0) {
+        virReportError(VIR_ERR_RPC,
+                       _("invalid stream hole length %lld"),
+                       (long long)data.length);
+        goto cleanup;
+    }
+
+    if (st->nholes &&
+        st->holes[st->nholes - 1].pos == st->incomingQueued) {
+        /* Back to back holes, with no data between them */
+        st->holes[st->nholes - 1].length += data.length;
+    } else {
+        if (VIR_EXPAND_N(st->holes, st->nholes, 1) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        st->holes[st->nholes - 1].pos = st->incomingQueued;
+        st->holes[st->nholes - 1].length = data.length;
+    }
+
+    VIR_DEBUG("Stream hole at %llu length %lld, %zu holes pending",
+              st->incomingQueued, (long long)data.length, st->nholes);
+    virNetClientStreamEventTimerUpdate(st);
+
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&st->lock);
+    return ret;
+}
+
+
+/* Is the next item to read from the stream a hole? */
+static bool
+virNetClientStreamAtHole(virNetClientStreamPtr st)
+{
+    return st->nholes && st->holes[0].pos == st->incomingConsumed;
+}
+
+
 int virNetClientStreamSendPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  int status,
@@ -364,17 +474,116 @@ error:
     return -1;
 }
 
+int virNetClientStreamSendHole(virNetClientStreamPtr st,
+                               virNetClientPtr client,
+                               long long length,
+                               unsigned int flags)
+{
+    virNetMessagePtr msg;
+    virNetStreamHole data;
+
+    VIR_DEBUG("st=%p length=%lld flags=%x", st, length, flags);
+
+    memset(&data, 0, sizeof(data));
+    data.length = length;
+    data.flags = flags;
+
+    if (!(msg = virNetMessageNew(false)))
+        return -1;
+
+    virMutexLock(&st->lock);
+
+    msg->header.prog = virNetClientProgramGetProgram(st->prog);
+    msg->header.vers = virNetClientProgramGetVersion(st->prog);
+    msg->header.status = VIR_NET_CONTINUE;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = st->serial;
+    msg->header.proc = st->proc;
+
+    virMutexUnlock(&st->lock);
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto error;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto error;
+
+    /* Holes are async fire&forget, just like data packets */
+    if (virNetClientSendNoReply(client, msg) < 0)
+        goto error;
+
+    virNetMessageFree(msg);
+    return 0;
+
+error:
+    virNetMessageFree(msg);
+    return -1;
+}
+
+
+/*
+ * Allow the server to send data up to @limit bytes into the stream
+ */
+static int
+virNetClientStreamSendCredit(virNetClientStreamPtr st,
+                             virNetClientPtr client,
+                             unsigned long long limit)
+{
+    virNetMessagePtr msg;
+    virNetStreamCredit data;
+
+    VIR_DEBUG("st=%p limit=%llu", st, limit);
+
+    memset(&data, 0, sizeof(data));
+    data.limit = limit;
+
+    if (!(msg = virNetMessageNew(false)))
+        return -1;
+
+    virMutexLock(&st->lock);
+
+    msg->header.prog = virNetClientProgramGetProgram(st->prog);
+    msg->header.vers = virNetClientProgramGetVersion(st->prog);
+    msg->header.status = VIR_NET_CONTINUE;
+    msg->header.type = VIR_NET_STREAM_CREDIT;
+    msg->header.serial = st->serial;
+    msg->header.proc = st->proc;
+
+    virMutexUnlock(&st->lock);
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto error;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetStreamCredit,
+                                   &data) < 0)
+        goto error;
+
+    if (virNetClientSendNoReply(client, msg) < 0)
+        goto error;
+
+    virNetMessageFree(msg);
+    return 0;
+
+error:
+    virNetMessageFree(msg);
+    return -1;
+}
+
+
 int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  char *data,
                                  size_t nbytes,
-                                 bool nonblock)
+                                 bool nonblock,
+                                 bool stopAtHole)
 {
     int rv = -1;
-    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d",
-              st, client, data, nbytes, nonblock);
+    unsigned long long grant = 0;
+    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d stopAtHole=%d",
+              st, client, data, nbytes, nonblock, stopAtHole);
     virMutexLock(&st->lock);
-    if (!st->incomingOffset && !st->incomingEOF) {
+    if (!st->incomingOffset && !st->nholes && !st->incomingEOF) {
         virNetMessagePtr msg;
         int ret;
 
@@ -407,19 +616,49 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
     }
 
     VIR_DEBUG("After IO %zu", st->incomingOffset);
-    if (st->incomingOffset) {
-        int want = st->incomingOffset;
+    if (virNetClientStreamAtHole(st)) {
+        long long want = st->holes[0].length;
+
+        if (stopAtHole) {
+            VIR_DEBUG("Stopping at hole of %lld bytes", want);
+            rv = -3;
+            goto cleanup;
+        }
+
+        /* The caller doesn't know about holes, so fill them in */
         if (want > nbytes)
             want = nbytes;
-        memcpy(data, st->incoming, want);
-        if (want < st->incomingOffset) {
-            memmove(st->incoming, st->incoming + want, st->incomingOffset - want);
-            st->incomingOffset -= want;
-        } else {
+        memset(data, 0, want);
+        st->holes[0].length -= want;
+        if (st->holes[0].length == 0)
+            VIR_DELETE_ELEMENT(st->holes, 0, st->nholes);
+        rv = want;
+    } else if (st->incomingOffset) {
+        size_t want = st->incomingOffset - st->incomingStart;
+        if (want > nbytes)
+            want = nbytes;
+        /* Don't read past the start of the next hole */
+        if (st->nholes &&
+            want > st->holes[0].pos - st->incomingConsumed)
+            want = st->holes[0].pos - st->incomingConsumed;
+        memcpy(data, st->incoming + st->incomingStart, want);
+        st->incomingStart += want;
+        st->incomingConsumed += want;
+        if (st->incomingStart == st->incomingOffset) {
             VIR_FREE(st->incoming);
-            st->incomingOffset = st->incomingLength = 0;
+            st->incomingStart = st->incomingOffset = st->incomingLength = 0;
         }
         rv = want;
+
+        /* Top the credit back up once half of it has been used,
+         * so the server always has data in flight */
+        if (st->credit &&
+            st->incomingConsumed + VIR_NET_STREAM_CREDIT_WINDOW -
+            st->creditLimit >= VIR_NET_STREAM_CREDIT_WINDOW / 2) {
+            st->creditLimit = st->incomingConsumed +
+                VIR_NET_STREAM_CREDIT_WINDOW;
+            grant = st->creditLimit;
+        }
     } else {
         rv = 0;
     }
@@ -428,10 +667,41 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
 
 cleanup:
     virMutexUnlock(&st->lock);
+
+    if (grant &&
+        virNetClientStreamSendCredit(st, client, grant) < 0)
+        rv = -1;
+
     return rv;
 }
 
 
+int virNetClientStreamRecvHole(virNetClientStreamPtr st,
+                               long long *length)
+{
+    int ret = -1;
+
+    virMutexLock(&st->lock);
+
+    if (!virNetClientStreamAtHole(st)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("stream is not positioned at a hole"));
+        goto cleanup;
+    }
+
+    *length = st->holes[0].length;
+    VIR_DELETE_ELEMENT(st->holes, 0, st->nholes);
+    VIR_DEBUG("Consumed hole of %lld bytes", *length);
+
+    virNetClientStreamEventTimerUpdate(st);
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&st->lock);
+    return ret;
+}
+
+
 int virNetClientStreamEventAddCallback(virNetClientStreamPtr st,
                                        int events,
                                        virNetClientStreamEventCallback cb,
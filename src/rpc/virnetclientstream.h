@@ -36,6 +36,8 @@ virNetClientStreamPtr virNetClientStreamNew(virNetClientProgramPtr prog,
                                             int proc,
                                             unsigned serial);
 
+void virNetClientStreamEnableCredit(virNetClientStreamPtr st);
+
 bool virNetClientStreamRaiseError(virNetClientStreamPtr st);
 
 int virNetClientStreamSetError(virNetClientStreamPtr st,
@@ -47,6 +49,9 @@ bool virNetClientStreamMatches(virNetClientStreamPtr st,
 int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
                                   virNetMessagePtr msg);
 
+int virNetClientStreamQueueHole(virNetClientStreamPtr st,
+                                virNetMessagePtr msg);
+
 int virNetClientStreamSendPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  int status,
@@ -57,7 +62,16 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  char *data,
                                  size_t nbytes,
-                                 bool nonblock);
+                                 bool nonblock,
+                                 bool stopAtHole);
+
+int virNetClientStreamSendHole(virNetClientStreamPtr st,
+                               virNetClientPtr client,
+                               long long length,
+                               unsigned int flags);
+
+int virNetClientStreamRecvHole(virNetClientStreamPtr st,
+                               long long *length);
 
 int virNetClientStreamEventAddCallback(virNetClientStreamPtr st,
                                        int events,
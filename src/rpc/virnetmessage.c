@@ -22,6 +22,9 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
 
 #include "virnetmessage.h"
 #include "memory.h"
@@ -29,9 +32,169 @@
 #include "logging.h"
 #include "virfile.h"
 #include "util.h"
+#include "threads.h"
+#include "verify.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+/*
+ * Message buffers are recycled through a small process wide pool
+ * rather than being malloc'd and free'd for every RPC. Buffers are
+ * handed out in a few fixed size classes, so a buffer returned by
+ * one message can satisfy any later request in the same class. The
+ * largest class covers a maximum sized message, and each class only
+ * retains a bounded number of idle buffers.
+ */
+#define VIR_NET_MESSAGE_POOL_CLASSES 4
+#define VIR_NET_MESSAGE_POOL_DEPTH 64
+
+static const size_t virNetMessagePoolSize[VIR_NET_MESSAGE_POOL_CLASSES] = {
+    1024,
+    VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX,
+    1024 * 1024,
+    VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX,
+};
+static const size_t virNetMessagePoolMax[VIR_NET_MESSAGE_POOL_CLASSES] = {
+    VIR_NET_MESSAGE_POOL_DEPTH, 16, 2, 1,
+};
+
+verify(VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX > 1024);
+verify(VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX < 1024 * 1024);
+verify(VIR_NET_MESSAGE_MAX > 1024 * 1024);
+
+typedef struct _virNetMessagePoolClass virNetMessagePoolClass;
+struct _virNetMessagePoolClass {
+    char *buffers[VIR_NET_MESSAGE_POOL_DEPTH];
+    size_t nbuffers;
+};
+
+static virMutex virNetMessagePoolLock;
+static virNetMessagePoolClass virNetMessagePool[VIR_NET_MESSAGE_POOL_CLASSES];
+
+static int virNetMessagePoolOnceInit(void)
+{
+    if (virMutexInit(&virNetMessagePoolLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Failed to initialized mutex"));
+        return -1;
+    }
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetMessagePool)
+
+
+/*
+ * Returns a buffer of at least @len bytes, storing its real size
+ * in @alloc. Requests beyond the largest class are allocated
+ * exactly and will not be pooled when released.
+ */
+static char *virNetMessagePoolGet(size_t len, size_t *alloc)
+{
+    char *buf = NULL;
+    size_t i;
+
+    for (i = 0 ; i < VIR_NET_MESSAGE_POOL_CLASSES ; i++) {
+        if (len <= virNetMessagePoolSize[i])
+            break;
+    }
+
+    if (i == VIR_NET_MESSAGE_POOL_CLASSES) {
+        *alloc = len;
+    } else {
+        *alloc = virNetMessagePoolSize[i];
+
+        virMutexLock(&virNetMessagePoolLock);
+        if (virNetMessagePool[i].nbuffers)
+            buf = virNetMessagePool[i].buffers[--virNetMessagePool[i].nbuffers];
+        virMutexUnlock(&virNetMessagePoolLock);
+    }
+
+    if (!buf &&
+        VIR_ALLOC_N(buf, *alloc) < 0)
+        return NULL;
+
+    return buf;
+}
+
+
+static void virNetMessagePoolPut(char *buf, size_t alloc)
+{
+    size_t i;
+
+    if (!buf)
+        return;
+
+    for (i = 0 ; i < VIR_NET_MESSAGE_POOL_CLASSES ; i++) {
+        if (alloc == virNetMessagePoolSize[i])
+            break;
+    }
+
+    if (i < VIR_NET_MESSAGE_POOL_CLASSES) {
+        virMutexLock(&virNetMessagePoolLock);
+        if (virNetMessagePool[i].nbuffers < virNetMessagePoolMax[i]) {
+            virNetMessagePool[i].buffers[virNetMessagePool[i].nbuffers++] = buf;
+            buf = NULL;
+        }
+        virMutexUnlock(&virNetMessagePoolLock);
+    }
+
+    VIR_FREE(buf);
+}
+
+
+/*
+ * @msg: the message whose buffer to grow
+ * @len: the minimum number of bytes required
+ *
+ * Ensures msg->buffer can hold at least @len bytes, preserving its
+ * current contents. The buffer is taken from the shared pool, so it
+ * may be larger than asked for; bufferLength is left untouched and
+ * remains the caller's business.
+ *
+ * returns 0 on success, -1 upon OOM
+ */
+int virNetMessageReserveBuffer(virNetMessagePtr msg, size_t len)
+{
+    char *buf;
+    size_t alloc;
+
+    if (msg->buffer && msg->bufferAlloc >= len)
+        return 0;
+
+    if (virNetMessagePoolInitialize() < 0)
+        return -1;
+
+    if (!(buf = virNetMessagePoolGet(len, &alloc))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (msg->buffer) {
+        memcpy(buf, msg->buffer, msg->bufferAlloc);
+        virNetMessagePoolPut(msg->buffer, msg->bufferAlloc);
+    }
+
+    msg->buffer = buf;
+    msg->bufferAlloc = alloc;
+    return 0;
+}
+
+
+/*
+ * @msg: the message whose buffer to release
+ *
+ * Hands msg->buffer back to the shared pool, leaving the
+ * message without a buffer.
+ */
+void virNetMessageReleaseBuffer(virNetMessagePtr msg)
+{
+    virNetMessagePoolPut(msg->buffer, msg->bufferAlloc);
+    msg->buffer = NULL;
+    msg->bufferAlloc = 0;
+}
+
 virNetMessagePtr virNetMessageNew(bool tracked)
 {
     virNetMessagePtr msg;
@@ -58,7 +221,7 @@ void virNetMessageClear(virNetMessagePtr msg)
     for (i = 0 ; i < msg->nfds ; i++)
         VIR_FORCE_CLOSE(msg->fds[i]);
     VIR_FREE(msg->fds);
-    VIR_FREE(msg->buffer);
+    virNetMessageReleaseBuffer(msg);
     memset(msg, 0, sizeof(*msg));
     msg->tracked = tracked;
 }
@@ -77,7 +240,7 @@ void virNetMessageFree(virNetMessagePtr msg)
 
     for (i = 0 ; i < msg->nfds ; i++)
         VIR_FORCE_CLOSE(msg->fds[i]);
-    VIR_FREE(msg->buffer);
+    virNetMessageReleaseBuffer(msg);
     VIR_FREE(msg->fds);
     VIR_FREE(msg);
 }
@@ -143,10 +306,8 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
     /* Extend our declared buffer length and carry
        on reading the header + payload */
     msg->bufferLength += len;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0) {
-        virReportOOMError();
+    if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
         goto cleanup;
-    }
 
     VIR_DEBUG("Got length, now need %zu total (%u more)",
               msg->bufferLength, len);
@@ -159,6 +320,122 @@ cleanup:
 }
 
 
+/*
+ * Writes the length word @len and @header at the start of @buffer,
+ * which must have room for both.
+ */
+static int virNetMessageRewriteHeader(char *buffer,
+                                      unsigned int len,
+                                      virNetMessageHeaderPtr header)
+{
+    XDR xdr;
+    int ret = -1;
+
+    xdrmem_create(&xdr, buffer,
+                  VIR_NET_MESSAGE_LEN_MAX + VIR_NET_MESSAGE_HEADER_MAX,
+                  XDR_ENCODE);
+
+    if (!xdr_u_int(&xdr, &len) ||
+        !xdr_virNetMessageHeader(&xdr, header)) {
+        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message header"));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    xdr_destroy(&xdr);
+    return ret;
+}
+
+
+/*
+ * @msg: the incoming message, whose header has just been decoded
+ *
+ * Replaces the compressed payload of @msg with the original one and
+ * clears VIR_NET_MESSAGE_COMPRESSED from its header, both in the
+ * decoded copy and in the buffer, so decoding the header again finds
+ * a plain message.
+ *
+ * returns 0 on success, -1 upon fatal error
+ */
+#if HAVE_ZLIB
+static int virNetMessageDecompress(virNetMessagePtr msg)
+{
+    size_t start = VIR_NET_MESSAGE_LEN_MAX + VIR_NET_MESSAGE_HEADER_MAX;
+    unsigned int plen;
+    uLongf destLen;
+    char *buf = NULL;
+    size_t alloc = 0;
+    XDR xdr;
+    int ret = -1;
+
+    if (msg->bufferOffset != start ||
+        msg->bufferLength < start + VIR_NET_MESSAGE_LEN_MAX) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Compressed message too short"));
+        return -1;
+    }
+
+    xdrmem_create(&xdr, msg->buffer + start,
+                  VIR_NET_MESSAGE_LEN_MAX, XDR_DECODE);
+    if (!xdr_u_int(&xdr, &plen)) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unable to decode compressed payload length"));
+        goto cleanup;
+    }
+
+    if (plen > VIR_NET_MESSAGE_PAYLOAD_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("compressed payload of %u bytes too large, want %d"),
+                       plen, VIR_NET_MESSAGE_PAYLOAD_MAX);
+        goto cleanup;
+    }
+
+    if (!(buf = virNetMessagePoolGet(start + plen, &alloc))) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    destLen = plen;
+    if (uncompress((Bytef *)buf + start, &destLen,
+                   (Bytef *)msg->buffer + start + VIR_NET_MESSAGE_LEN_MAX,
+                   msg->bufferLength - start - VIR_NET_MESSAGE_LEN_MAX) != Z_OK ||
+        destLen != plen) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unable to decompress message payload"));
+        goto cleanup;
+    }
+
+    msg->header.type &= ~VIR_NET_MESSAGE_COMPRESSED;
+    if (virNetMessageRewriteHeader(buf, start + plen, &msg->header) < 0)
+        goto cleanup;
+
+    virNetMessageReleaseBuffer(msg);
+    msg->buffer = buf;
+    msg->bufferAlloc = alloc;
+    msg->bufferLength = start + plen;
+    buf = NULL;
+
+    VIR_DEBUG("Decompressed payload to %u bytes", plen);
+    ret = 0;
+
+cleanup:
+    virNetMessagePoolPut(buf, alloc);
+    xdr_destroy(&xdr);
+    return ret;
+}
+#else /* !HAVE_ZLIB */
+static int virNetMessageDecompress(virNetMessagePtr msg ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_RPC, "%s",
+                   _("Received compressed message, but compression is not "
+                     "supported in this build"));
+    return -1;
+}
+#endif /* !HAVE_ZLIB */
+
+
 /*
  * @msg: the complete incoming message, whose header to decode
  *
@@ -190,6 +467,10 @@ int virNetMessageDecodeHeader(virNetMessagePtr msg)
 
     msg->bufferOffset += xdr_getpos(&xdr);
 
+    if ((msg->header.type & VIR_NET_MESSAGE_COMPRESSED) &&
+        virNetMessageDecompress(msg) < 0)
+        goto cleanup;
+
     ret = 0;
 
 cleanup:
@@ -205,7 +486,9 @@ cleanup:
  * message offset ready to encode the payload. Leaves space
  * for the length field later. Upon return bufferLength will
  * refer to the total available space for message, while
- * bufferOffset will refer to current space used by header
+ * bufferOffset will refer to current space used by header.
+ * The buffer starts at VIR_NET_MESSAGE_INITIAL bytes and the
+ * payload encoders grow it as needed up to VIR_NET_MESSAGE_MAX.
  *
  * returns 0 if successfully encoded, -1 upon fatal error
  */
@@ -215,11 +498,9 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
     int ret = -1;
     unsigned int len = 0;
 
-    msg->bufferLength = VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0) {
-        virReportOOMError();
+    msg->bufferLength = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
+    if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
         return ret;
-    }
     msg->bufferOffset = 0;
 
     /* Format the header. */
@@ -338,6 +619,9 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
 {
     XDR xdr;
     unsigned int msglen;
+#ifdef HAVE_XDR_SIZEOF
+    bool sized = false;
+#endif
 
     /* Serialise payload of the message. This assumes that
      * virNetMessageEncodeHeader has already been run, so
@@ -345,9 +629,41 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
     xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
                   msg->bufferLength - msg->bufferOffset, XDR_ENCODE);
 
-    if (!(*filter)(&xdr, data)) {
-        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message payload"));
-        goto error;
+    /* Try to encode the payload. If the buffer is too small increase it. */
+    while (!(*filter)(&xdr, data)) {
+        size_t curlen = msg->bufferLength - VIR_NET_MESSAGE_LEN_MAX;
+        size_t newlen = curlen * 2;
+
+#ifdef HAVE_XDR_SIZEOF
+        /* Most payloads fit the initial buffer; for those which
+         * don't, measure the payload once and grow straight to
+         * the right size instead of doubling and re-encoding */
+        if (!sized) {
+            size_t need = msg->bufferOffset - VIR_NET_MESSAGE_LEN_MAX +
+                xdr_sizeof(filter, data);
+
+            sized = true;
+            if (need > curlen)
+                newlen = need;
+        }
+#endif
+
+        if (newlen > VIR_NET_MESSAGE_MAX) {
+            virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message payload"));
+            goto error;
+        }
+
+        xdr_destroy(&xdr);
+
+        msg->bufferLength = newlen + VIR_NET_MESSAGE_LEN_MAX;
+
+        if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
+            goto error;
+
+        xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
+                      msg->bufferLength - msg->bufferOffset, XDR_ENCODE);
+
+        VIR_DEBUG("Increased message buffer length = %zu", msg->bufferLength);
     }
 
     /* Get the length stored in buffer. */
@@ -402,23 +718,90 @@ error:
 }
 
 
-int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
-                                  const char *data,
-                                  size_t len)
+/*
+ * @msg: the outgoing message, whose header has been encoded
+ * @len: number of bytes of raw payload the caller will provide
+ * @data: filled with the location to store the payload at
+ *
+ * Makes room for @len bytes of raw stream data after the header, so
+ * that the producer can read it straight into the message instead of
+ * into a bounce buffer. The message is completed with
+ * virNetMessageCommitPayloadRaw once the real length is known, which
+ * may be shorter than @len.
+ *
+ * returns 0 on success, -1 upon fatal error
+ */
+int virNetMessageReservePayloadRaw(virNetMessagePtr msg,
+                                   size_t len,
+                                   char **data)
 {
-    XDR xdr;
-    unsigned int msglen;
+    if (len > VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX - msg->bufferOffset) {
+        virReportError(VIR_ERR_RPC,
+                       _("Stream data too long to send (%zu bytes needed, %zu bytes available)"),
+                       len, (VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX -
+                             msg->bufferOffset));
+        return -1;
+    }
+
+    if (msg->bufferLength - msg->bufferOffset < len) {
+        msg->bufferLength = msg->bufferOffset + len;
+        if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
+            return -1;
+        VIR_DEBUG("Increased message buffer length = %zu", msg->bufferLength);
+    }
+
+    *data = msg->buffer + msg->bufferOffset;
+    return 0;
+}
+
 
+/*
+ * @msg: the outgoing message, previously given to
+ *       virNetMessageReservePayloadRaw
+ * @len: number of bytes actually stored in the reserved area
+ *
+ * Accounts for @len bytes of raw payload and re-encodes the
+ * length word, making the message ready for transmission.
+ *
+ * returns 0 on success, -1 upon fatal error
+ */
+int virNetMessageCommitPayloadRaw(virNetMessagePtr msg,
+                                  size_t len)
+{
     if ((msg->bufferLength - msg->bufferOffset) < len) {
         virReportError(VIR_ERR_RPC,
-                    _("Stream data too long to send (%zu bytes needed, %zu bytes available)"),
-                    len, (msg->bufferLength - msg->bufferOffset));
+                       _("Stream data too long to send (%zu bytes needed, %zu bytes available)"),
+                       len, (msg->bufferLength - msg->bufferOffset));
         return -1;
     }
 
-    memcpy(msg->buffer + msg->bufferOffset, data, len);
     msg->bufferOffset += len;
 
+    return virNetMessageEncodePayloadEmpty(msg);
+}
+
+
+int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
+                                  const char *data,
+                                  size_t len)
+{
+    char *payload;
+
+    if (virNetMessageReservePayloadRaw(msg, len, &payload) < 0)
+        return -1;
+
+    if (len)
+        memcpy(payload, data, len);
+
+    return virNetMessageCommitPayloadRaw(msg, len);
+}
+
+
+int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
+{
+    XDR xdr;
+    unsigned int msglen;
+
     /* Re-encode the length word. */
     VIR_DEBUG("Encode length as %zu", msg->bufferOffset);
     xdrmem_create(&xdr, msg->buffer, VIR_NET_MESSAGE_HEADER_XDR_LEN, XDR_ENCODE);
@@ -439,28 +822,103 @@ error:
 }
 
 
-int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
+/*
+ * @msg: the complete outgoing message
+ * @threshold: the smallest payload worth compressing
+ *
+ * Compresses the payload of @msg if it is at least @threshold bytes
+ * and compression actually makes it smaller, marking the header with
+ * VIR_NET_MESSAGE_COMPRESSED. Only to be used on connections whose
+ * peer has agreed to VIR_DRV_FEATURE_PROGRAM_COMPRESSION. The message
+ * is sent as it is if it is too small, incompressible, or this build
+ * lacks compression.
+ *
+ * returns 0 on success, -1 upon fatal error
+ */
+#if HAVE_ZLIB
+int virNetMessageCompress(virNetMessagePtr msg,
+                          size_t threshold)
 {
+    size_t start = VIR_NET_MESSAGE_LEN_MAX + VIR_NET_MESSAGE_HEADER_MAX;
+    virNetMessageHeader header;
+    size_t plen;
+    uLongf destLen;
+    char *buf = NULL;
+    size_t alloc;
     XDR xdr;
-    unsigned int msglen;
+    unsigned int len;
+    int ret = -1;
 
-    /* Re-encode the length word. */
-    VIR_DEBUG("Encode length as %zu", msg->bufferOffset);
-    xdrmem_create(&xdr, msg->buffer, VIR_NET_MESSAGE_HEADER_XDR_LEN, XDR_ENCODE);
-    msglen = msg->bufferOffset;
-    if (!xdr_u_int(&xdr, &msglen)) {
-        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message length"));
-        goto error;
+    if (msg->bufferOffset != 0 ||
+        msg->bufferLength < start ||
+        (plen = msg->bufferLength - start) < threshold ||
+        (msg->header.type & VIR_NET_MESSAGE_COMPRESSED))
+        return 0;
+
+    destLen = compressBound(plen);
+    if (!(buf = virNetMessagePoolGet(start + VIR_NET_MESSAGE_LEN_MAX + destLen,
+                                     &alloc))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (compress2((Bytef *)buf + start + VIR_NET_MESSAGE_LEN_MAX, &destLen,
+                  (Bytef *)msg->buffer + start, plen, Z_BEST_SPEED) != Z_OK ||
+        start + VIR_NET_MESSAGE_LEN_MAX + destLen >= msg->bufferLength) {
+        VIR_DEBUG("Not compressing payload of %zu bytes", plen);
+        virNetMessagePoolPut(buf, alloc);
+        return 0;
+    }
+
+    header = msg->header;
+    header.type |= VIR_NET_MESSAGE_COMPRESSED;
+    if (virNetMessageRewriteHeader(buf, start + VIR_NET_MESSAGE_LEN_MAX + destLen,
+                                   &header) < 0)
+        goto cleanup;
+
+    len = plen;
+    xdrmem_create(&xdr, buf + start, VIR_NET_MESSAGE_LEN_MAX, XDR_ENCODE);
+    if (!xdr_u_int(&xdr, &len)) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unable to encode compressed payload length"));
+        xdr_destroy(&xdr);
+        goto cleanup;
     }
     xdr_destroy(&xdr);
 
-    msg->bufferLength = msg->bufferOffset;
-    msg->bufferOffset = 0;
+    VIR_DEBUG("Compressed payload from %zu to %lu bytes",
+              plen, (unsigned long)destLen);
+
+    virNetMessageReleaseBuffer(msg);
+    msg->buffer = buf;
+    msg->bufferAlloc = alloc;
+    msg->bufferLength = start + VIR_NET_MESSAGE_LEN_MAX + destLen;
+    buf = NULL;
+    ret = 0;
+
+cleanup:
+    virNetMessagePoolPut(buf, alloc);
+    return ret;
+}
+#else /* !HAVE_ZLIB */
+int virNetMessageCompress(virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                          size_t threshold ATTRIBUTE_UNUSED)
+{
     return 0;
+}
+#endif /* !HAVE_ZLIB */
 
-error:
-    xdr_destroy(&xdr);
-    return -1;
+
+/*
+ * Returns true if this build can exchange compressed messages
+ */
+bool virNetMessageCompressionSupported(void)
+{
+#if HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
 }
 
 
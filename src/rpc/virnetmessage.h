@@ -34,7 +34,8 @@ typedef void (*virNetMessageFreeCallback)(virNetMessagePtr msg, void *opaque);
 struct _virNetMessage {
     bool tracked;
 
-    char *buffer; /* Typically VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX */
+    char *buffer; /* Up to VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX */
+    size_t bufferAlloc; /* Real size of buffer, may exceed bufferLength */
     size_t bufferLength;
     size_t bufferOffset;
 
@@ -47,6 +48,10 @@ struct _virNetMessage {
     int *fds;
     size_t donefds;
 
+    /* When the message was queued for dispatch, in microseconds
+     * since an arbitrary point; 0 unless RPC statistics are on */
+    unsigned long long queued;
+
     virNetMessagePtr next;
 };
 
@@ -57,6 +62,11 @@ void virNetMessageClear(virNetMessagePtr);
 
 void virNetMessageFree(virNetMessagePtr msg);
 
+int virNetMessageReserveBuffer(virNetMessagePtr msg, size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+void virNetMessageReleaseBuffer(virNetMessagePtr msg)
+    ATTRIBUTE_NONNULL(1);
+
 virNetMessagePtr virNetMessageQueueServe(virNetMessagePtr *queue)
     ATTRIBUTE_NONNULL(1);
 void virNetMessageQueuePush(virNetMessagePtr *queue,
@@ -86,9 +96,24 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
                                   const char *buf,
                                   size_t len)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageReservePayloadRaw(virNetMessagePtr msg,
+                                   size_t len,
+                                   char **data)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageCommitPayloadRaw(virNetMessagePtr msg,
+                                  size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
+/* Payloads smaller than this are not worth compressing */
+# define VIR_NET_MESSAGE_COMPRESS_MIN 4096
+
+int virNetMessageCompress(virNetMessagePtr msg,
+                          size_t threshold)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+bool virNetMessageCompressionSupported(void);
+
 void virNetMessageSaveError(virNetMessageErrorPtr rerr)
     ATTRIBUTE_NONNULL(1);
 
@@ -44,6 +44,9 @@
 
 /*----- Data types. -----*/
 
+/* Initial message buffer size; grown on demand up to VIR_NET_MESSAGE_MAX */
+const VIR_NET_MESSAGE_INITIAL = 65536;
+
 /* Maximum total message size (serialised). */
 const VIR_NET_MESSAGE_MAX = 4194304;
 
@@ -67,6 +70,13 @@ const VIR_NET_MESSAGE_STRING_MAX = 1048576;
  */
 const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
 
+/* Stream data bytes the sender may have outstanding when credit
+ * based flow control is in use, and which the receiver grants up
+ * front.  Data packets are cut to a quarter of it, so that several
+ * of them are in flight at any time.
+ */
+const VIR_NET_STREAM_CREDIT_WINDOW = 4194304;
+
 /*
  * RPC wire format
  *
@@ -92,6 +102,12 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *  - type == VIR_NET_STREAM
  *      * serial matches that from the corresponding VIR_NET_CALL
  *
+ *  - type == VIR_NET_STREAM_HOLE
+ *      * serial matches that from the corresponding VIR_NET_CALL
+ *
+ *  - type == VIR_NET_STREAM_CREDIT
+ *      * serial matches that from the corresponding VIR_NET_CALL
+ *
  * and the 'status' field varies according to:
  *
  *  - type == VIR_NET_CALL
@@ -109,6 +125,12 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *     * VIR_NET_OK if stream is complete
  *     * VIR_NET_ERROR if stream had an error
  *
+ *  - type == VIR_NET_STREAM_HOLE
+ *     * VIR_NET_CONTINUE always
+ *
+ *  - type == VIR_NET_STREAM_CREDIT
+ *     * VIR_NET_CONTINUE always
+ *
  * Payload varies according to type and status:
  *
  *  - type == VIR_NET_CALL
@@ -132,6 +154,14 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *     * status == VIR_NET_OK
  *          <empty>
  *
+ *  - type == VIR_NET_STREAM_HOLE
+ *     * status == VIR_NET_CONTINUE
+ *          virNetStreamHole  size of the hole in the stream data
+ *
+ *  - type == VIR_NET_STREAM_CREDIT
+ *     * status == VIR_NET_CONTINUE
+ *          virNetStreamCredit  data the receiver accepts so far
+ *
  *  - type == VIR_NET_CALL_WITH_FDS
  *          int8 - number of FDs
  *          XXX_args  for procedure
@@ -143,6 +173,19 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *     * status == VIR_NET_ERROR
  *          remote_error    Error information
  *
+ * Any type may have VIR_NET_MESSAGE_COMPRESSED or'd in, in which case
+ * the payload described above is replaced by
+ *
+ *          unsigned int    length of the original payload
+ *          byte[]          original payload, zlib compressed
+ *
+ * Compressed messages are only sent to peers which have asked for
+ * VIR_DRV_FEATURE_PROGRAM_COMPRESSION.
+ *
+ * Credit packets are only sent to peers which have agreed to
+ * VIR_DRV_FEATURE_STREAM_CREDIT. From then on the server starts each
+ * stream with VIR_NET_STREAM_CREDIT_WINDOW bytes of credit, and sends
+ * no more data than the client last allowed.
  */
 enum virNetMessageType {
     /* client -> server. args from a method call */
@@ -156,7 +199,11 @@ enum virNetMessageType {
     /* client -> server. args from a method call, with passed FDs */
     VIR_NET_CALL_WITH_FDS = 4,
     /* server -> client. reply/error from a method call, with passed FDs */
-    VIR_NET_REPLY_WITH_FDS = 5
+    VIR_NET_REPLY_WITH_FDS = 5,
+    /* either direction. hole in the data of a sparse stream */
+    VIR_NET_STREAM_HOLE = 6,
+    /* client -> server. more room for stream data */
+    VIR_NET_STREAM_CREDIT = 7
 };
 
 enum virNetMessageStatus {
@@ -175,6 +222,9 @@ enum virNetMessageStatus {
     VIR_NET_CONTINUE = 2
 };
 
+/* Flag or'd into virNetMessageType when the payload is compressed */
+const VIR_NET_MESSAGE_COMPRESSED = 256;
+
 /* 4 byte length word per header */
 const VIR_NET_MESSAGE_HEADER_XDR_LEN = 4;
 
@@ -236,3 +286,16 @@ struct virNetMessageError {
     int int2;
     virNetMessageNetwork net; /* unused */
 };
+
+/* Payload of a VIR_NET_STREAM_HOLE packet */
+struct virNetStreamHole {
+    hyper length;
+    unsigned int flags;
+};
+
+/* Payload of a VIR_NET_STREAM_CREDIT packet */
+struct virNetStreamCredit {
+    /* Total stream data bytes, counted from the start of the
+     * stream, the client accepts */
+    unsigned hyper limit;
+};
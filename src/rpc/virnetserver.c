@@ -91,6 +91,7 @@ struct _virNetServer {
 
     size_t nclients;
     size_t nclients_max;
+    size_t client_queue_max;
     virNetServerClientPtr *clients;
 
     int keepaliveInterval;
@@ -220,6 +221,8 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
     VIR_DEBUG("server=%p client=%p message=%p",
               srv, client, msg);
 
+    msg->queued = virNetServerProgramStatsNow();
+
     virNetServerLock(srv);
     for (i = 0 ; i < srv->nprograms ; i++) {
         if (virNetServerProgramMatches(srv->programs[i], msg)) {
@@ -245,7 +248,9 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
             priority = virNetServerProgramGetPriority(prog, msg->header.proc);
         }
 
-        ret = virThreadPoolSendJob(srv->workers, priority, job);
+        /* Group by client, so that one client flooding the server
+         * with requests can't hold up those of other clients */
+        ret = virThreadPoolSendGroupJob(srv->workers, priority, client, job);
 
         if (ret < 0) {
             VIR_FREE(job);
@@ -290,6 +295,7 @@ static int virNetServerAddClient(virNetServerPtr srv,
 
     virNetServerClientInitKeepAlive(client, srv->keepaliveInterval,
                                     srv->keepaliveCount);
+    virNetServerClientSetQueueLimit(client, srv->client_queue_max);
 
     virNetServerUnlock(srv);
     return 0;
@@ -511,7 +517,7 @@ virNetServerPtr virNetServerNewPostExecRestart(virJSONValuePtr object,
         goto error;
     }
 
-    if (!(srv = virNetServerNew(min_workers, max_clients,
+    if (!(srv = virNetServerNew(min_workers, max_workers,
                                 priority_workers, max_clients,
                                 keepaliveInterval, keepaliveCount,
                                 keepaliveRequired, mdnsGroupName,
@@ -551,18 +557,45 @@ virNetServerPtr virNetServerNewPostExecRestart(virJSONValuePtr object,
         }
     }
 
-
-    if (!(clients = virJSONValueObjectGet(object, "clients"))) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Missing clients data in JSON document"));
+    /* The clients may have been split off to be restored later */
+    if ((clients = virJSONValueObjectGet(object, "clients")) &&
+        virNetServerAddClientsPostExecRestart(srv, clients,
+                                              clientPrivNewPostExecRestart) < 0)
         goto error;
-    }
+
+    return srv;
+
+error:
+    virObjectUnref(srv);
+    return NULL;
+}
+
+
+/**
+ * virNetServerAddClientsPostExecRestart:
+ * @srv: the server
+ * @clients: the "clients" array saved by virNetServerPreExecRestart
+ * @clientPrivNewPostExecRestart: restores the client private data
+ *
+ * Restore the clients saved before re-executing the process. A
+ * program may take them out of the server data and restore them
+ * once it is ready to handle their requests, rather than from
+ * virNetServerNewPostExecRestart.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetServerAddClientsPostExecRestart(virNetServerPtr srv,
+                                          virJSONValuePtr clients,
+                                          virNetServerClientPrivNewPostExecRestart clientPrivNewPostExecRestart)
+{
+    size_t i;
+    int n;
 
     n =  virJSONValueArraySize(clients);
     if (n < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Malformed clients data in JSON document"));
-        goto error;
+        return -1;
     }
 
     for (i = 0 ; i < n ; i++) {
@@ -571,28 +604,24 @@ virNetServerPtr virNetServerNewPostExecRestart(virJSONValuePtr object,
         if (!child) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("Missing client data in JSON document"));
-            goto error;
+            return -1;
         }
 
         if (!(client = virNetServerClientNewPostExecRestart(child,
                                                             clientPrivNewPostExecRestart,
-                                                            clientPrivPreExecRestart,
-                                                            clientPrivFree,
-                                                            clientPrivOpaque)))
-            goto error;
+                                                            srv->clientPrivPreExecRestart,
+                                                            srv->clientPrivFree,
+                                                            srv->clientPrivOpaque)))
+            return -1;
 
         if (virNetServerAddClient(srv, client) < 0) {
             virObjectUnref(client);
-            goto error;
+            return -1;
         }
         virObjectUnref(client);
     }
 
-    return srv;
-
-error:
-    virObjectUnref(srv);
-    return NULL;
+    return 0;
 }
 
 
@@ -1035,6 +1064,52 @@ no_memory:
     return -1;
 }
 
+/**
+ * virNetServerFormatStats:
+ * @srv: the server
+ * @buf: buffer to append to
+ *
+ * Format the RPC statistics of all programs of @srv, see
+ * virNetServerProgramFormatStats(), followed by the back-pressure
+ * counters of its clients.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int virNetServerFormatStats(virNetServerPtr srv,
+                            virBufferPtr buf)
+{
+    int ret;
+
+    virNetServerLock(srv);
+    ret = virNetServerProgramFormatStats(srv->programs, srv->nprograms, buf);
+    virNetServerUnlock(srv);
+
+    if (ret == 0)
+        virNetServerClientFormatQueueStats(buf);
+
+    return ret;
+}
+
+/**
+ * virNetServerSetClientQueueLimit:
+ * @srv: the server
+ * @max: maximum bytes queued for sending to a client, or 0
+ *
+ * Set how many bytes of replies and events may be queued for sending
+ * to each client of @srv before events for that client get dropped.
+ */
+void virNetServerSetClientQueueLimit(virNetServerPtr srv,
+                                     size_t max)
+{
+    size_t i;
+
+    virNetServerLock(srv);
+    srv->client_queue_max = max;
+    for (i = 0 ; i < srv->nclients ; i++)
+        virNetServerClientSetQueueLimit(srv->clients[i], max);
+    virNetServerUnlock(srv);
+}
+
 int virNetServerSetTLSContext(virNetServerPtr srv,
                               virNetTLSContextPtr tls)
 {
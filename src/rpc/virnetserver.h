@@ -53,6 +53,10 @@ virNetServerPtr virNetServerNewPostExecRestart(virJSONValuePtr object,
                                                virFreeCallback clientPrivFree,
                                                void *clientPrivOpaque);
 
+int virNetServerAddClientsPostExecRestart(virNetServerPtr srv,
+                                          virJSONValuePtr clients,
+                                          virNetServerClientPrivNewPostExecRestart clientPrivNewPostExecRestart);
+
 virJSONValuePtr virNetServerPreExecRestart(virNetServerPtr srv);
 
 typedef int (*virNetServerAutoShutdownFunc)(virNetServerPtr srv, void *opaque);
@@ -79,6 +83,12 @@ int virNetServerAddService(virNetServerPtr srv,
 int virNetServerAddProgram(virNetServerPtr srv,
                            virNetServerProgramPtr prog);
 
+int virNetServerFormatStats(virNetServerPtr srv,
+                            virBufferPtr buf);
+
+void virNetServerSetClientQueueLimit(virNetServerPtr srv,
+                                     size_t max);
+
 int virNetServerSetTLSContext(virNetServerPtr srv,
                               virNetTLSContextPtr tls);
 
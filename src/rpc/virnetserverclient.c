@@ -34,9 +34,16 @@
 #include "memory.h"
 #include "threads.h"
 #include "virkeepalive.h"
+#include "virkeepaliveprotocol.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+/* Most messages read from a client in one wakeup */
+#define VIR_NET_SERVER_CLIENT_READ_BATCH 16
+/* Most messages sent to a client in one write */
+#define VIR_NET_SERVER_CLIENT_WRITE_BATCH 16
+
 /* Allow for filtering of incoming messages to a custom
  * dispatch processing queue, instead of the workers.
  * This allows for certain types of messages to be handled
@@ -87,6 +94,14 @@ struct _virNetServerClient
     /* Zero or many messages waiting for transmit
      * back to client, including async events */
     virNetMessagePtr tx;
+    /* Bytes of all messages in the 'tx' queue. Once it
+     * exceeds txBytesMax (if non-zero) async events are
+     * dropped until the client catches up again */
+    size_t txBytes;
+    size_t txBytesMax;
+    bool txOverLimit;
+    unsigned long long txOverLimitSince;
+    unsigned long long txDropped;
 
     /* Filters to capture messages that would otherwise
      * end up on the 'dx' queue */
@@ -102,14 +117,40 @@ struct _virNetServerClient
     virNetServerClientCloseFunc privateDataCloseFunc;
 
     virKeepAlivePtr keepalive;
+
+    /* Whether the client agreed to receive compressed messages */
+    bool compress;
+
+    /* Shared memory ring to switch to once the reply with
+     * shmRingSerial has been sent */
+    virNetShmRingPtr shmRing;
+    unsigned int shmRingSerial;
 };
 
 
+/* How often back-pressure kicked in, over all clients */
+typedef struct _virNetServerClientQueueStats virNetServerClientQueueStats;
+struct _virNetServerClientQueueStats {
+    unsigned long long rxThrottled;   /* reading stopped at nrequests_max */
+    unsigned long long txOverLimit;   /* tx queue went over txBytesMax */
+    unsigned long long txDropped;     /* events dropped as a result */
+    unsigned long long txDroppedBytes;
+};
+
+static virMutex virNetServerClientQueueStatsLock;
+static virNetServerClientQueueStats virNetServerClientQueueStatsTotal;
+
 static virClassPtr virNetServerClientClass;
 static void virNetServerClientDispose(void *obj);
 
 static int virNetServerClientOnceInit(void)
 {
+    if (virMutexInit(&virNetServerClientQueueStatsLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
     if (!(virNetServerClientClass = virClassNew("virNetServerClient",
                                                 sizeof(virNetServerClient),
                                                 virNetServerClientDispose)))
@@ -310,8 +351,7 @@ virNetServerClientCheckAccess(virNetServerClientPtr client)
      * (NB. The '\1' byte is sent in an encrypted record).
      */
     confirm->bufferLength = 1;
-    if (VIR_ALLOC_N(confirm->buffer, confirm->bufferLength) < 0) {
-        virReportOOMError();
+    if (virNetMessageReserveBuffer(confirm, confirm->bufferLength) < 0) {
         virNetMessageFree(confirm);
         return -1;
     }
@@ -319,6 +359,7 @@ virNetServerClientCheckAccess(virNetServerClientPtr client)
     confirm->buffer[0] = '\1';
 
     client->tx = confirm;
+    client->txBytes = confirm->bufferLength;
 
     return 0;
 }
@@ -372,10 +413,8 @@ virNetServerClientNewInternal(virNetSocketPtr sock,
     if (!(client->rx = virNetMessageNew(true)))
         goto error;
     client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_ALLOC_N(client->rx->buffer, client->rx->bufferLength) < 0) {
-        virReportOOMError();
+    if (virNetMessageReserveBuffer(client->rx, client->rx->bufferLength) < 0)
         goto error;
-    }
     client->nrequests = 1;
 
     PROBE(RPC_SERVER_CLIENT_NEW,
@@ -482,6 +521,14 @@ virNetServerClientPtr virNetServerClientNewPostExecRestart(virJSONValuePtr objec
         virNetServerClientSetIdentity(client, identity) < 0)
         goto error;
 
+    /* Not saved by older versions */
+    if (virJSONValueObjectHasKey(object, "compress") &&
+        virJSONValueObjectGetBoolean(object, "compress", &client->compress) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Malformed compress field in JSON state document"));
+        goto error;
+    }
+
     if (privNew) {
         if (!(child = virJSONValueObjectGet(object, "privateData"))) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -514,12 +561,29 @@ virJSONValuePtr virNetServerClientPreExecRestart(virNetServerClientPtr client)
 
     virNetServerClientLock(client);
 
+    /* Replies and events not yet sent, or a request partly read,
+     * would be lost, and the shared memory ring can't be handed
+     * over */
+    if (client->nrequests || client->tx ||
+        (client->rx && client->rx->bufferOffset)) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Unable to save client state with messages in flight"));
+        goto error;
+    }
+    if (client->shmRing) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Unable to save client state with a shared memory ring"));
+        goto error;
+    }
+
     if (virJSONValueObjectAppendNumberInt(object, "auth", client->auth) < 0)
         goto error;
     if (virJSONValueObjectAppendBoolean(object, "readonly", client->readonly) < 0)
         goto error;
     if (virJSONValueObjectAppendNumberUint(object, "nrequests_max", client->nrequests_max) < 0)
         goto error;
+    if (virJSONValueObjectAppendBoolean(object, "compress", client->compress) < 0)
+        goto error;
 
     if (client->identity &&
         virJSONValueObjectAppendString(object, "identity", client->identity) < 0)
@@ -533,13 +597,14 @@ virJSONValuePtr virNetServerClientPreExecRestart(virNetServerClientPtr client)
         goto error;
     }
 
-    if (client->privateData && client->privateDataPreExecRestart &&
-        !(child = client->privateDataPreExecRestart(client, client->privateData)))
-        goto error;
+    if (client->privateData && client->privateDataPreExecRestart) {
+        if (!(child = client->privateDataPreExecRestart(client, client->privateData)))
+            goto error;
 
-    if (virJSONValueObjectAppend(object, "privateData", child) < 0) {
-        virJSONValueFree(child);
-        goto error;
+        if (virJSONValueObjectAppend(object, "privateData", child) < 0) {
+            virJSONValueFree(child);
+            goto error;
+        }
     }
 
     virNetServerClientUnlock(client);
@@ -732,6 +797,7 @@ void virNetServerClientDispose(void *obj)
         virEventRemoveTimeout(client->sockTimer);
     virObjectUnref(client->tls);
     virObjectUnref(client->tlsCtxt);
+    virObjectUnref(client->shmRing);
     virObjectUnref(client->sock);
     virNetServerClientUnlock(client);
     virMutexDestroy(&client->lock);
@@ -800,6 +866,7 @@ void virNetServerClientClose(virNetServerClientPtr client)
             = virNetMessageQueueServe(&client->tx);
         virNetMessageFree(msg);
     }
+    client->txBytes = 0;
 
     if (client->sock) {
         virObjectUnref(client->sock);
@@ -924,10 +991,14 @@ static ssize_t virNetServerClientRead(virNetServerClientPtr client)
 
 
 /*
- * Read data until we get a complete message to process
+ * Read data until we get a complete message to process, and keep
+ * going with the messages after it for as long as the client has
+ * already sent them
  */
 static void virNetServerClientDispatchRead(virNetServerClientPtr client)
 {
+    size_t nmsgs = 0;
+
 readmore:
     if (client->rx->nfds == 0) {
         if (virNetServerClientRead(client) < 0) {
@@ -1028,6 +1099,12 @@ readmore:
                         client->wantClose = true;
                     break;
                 }
+                if (ret == VIR_NET_SERVER_CLIENT_FILTER_DONE) {
+                    virNetMessageFree(msg);
+                    client->nrequests--;
+                    msg = NULL;
+                    break;
+                }
                 if (ret > 0) {
                     msg = NULL;
                     break;
@@ -1055,15 +1132,29 @@ readmore:
                 client->wantClose = true;
             } else {
                 client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                if (VIR_ALLOC_N(client->rx->buffer,
-                                client->rx->bufferLength) < 0) {
-                    virReportOOMError();
+                if (virNetMessageReserveBuffer(client->rx,
+                                               client->rx->bufferLength) < 0) {
                     client->wantClose = true;
                 } else {
                     client->nrequests++;
                 }
             }
+        } else {
+            /* Stop reading until a reply has been sent */
+            VIR_DEBUG("client=%p throttled at %zu requests",
+                      client, client->nrequests);
+            virMutexLock(&virNetServerClientQueueStatsLock);
+            virNetServerClientQueueStatsTotal.rxThrottled++;
+            virMutexUnlock(&virNetServerClientQueueStatsLock);
         }
+
+        /* A client pipelining calls has likely sent the next one
+         * already, so save a trip through poll(). The limit keeps
+         * one busy client from holding up the event loop */
+        if (client->rx && !client->wantClose &&
+            ++nmsgs < VIR_NET_SERVER_CLIENT_READ_BATCH)
+            goto readmore;
+
         virNetServerClientUpdateEvent(client);
     }
 }
@@ -1079,7 +1170,11 @@ readmore:
  */
 static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
 {
+    struct iovec iov[VIR_NET_SERVER_CLIENT_WRITE_BATCH];
+    virNetMessagePtr msg;
+    int niov = 0;
     ssize_t ret;
+    size_t done;
 
     if (client->tx->bufferLength < client->tx->bufferOffset) {
         virReportError(VIR_ERR_RPC,
@@ -1092,13 +1187,36 @@ static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
     if (client->tx->bufferLength == client->tx->bufferOffset)
         return 1;
 
-    ret = virNetSocketWrite(client->sock,
-                            client->tx->buffer + client->tx->bufferOffset,
-                            client->tx->bufferLength - client->tx->bufferOffset);
+    /* Send as many queued messages as we can in one go. A message
+     * with file descriptors has to be followed by them, and once
+     * SASL or a shared memory ring is about to be switched to the
+     * messages after the current one must wait for that */
+    for (msg = client->tx;
+         msg && niov < VIR_NET_SERVER_CLIENT_WRITE_BATCH;
+         msg = msg->next) {
+        iov[niov].iov_base = msg->buffer + msg->bufferOffset;
+        iov[niov].iov_len = msg->bufferLength - msg->bufferOffset;
+        niov++;
+
+        if (msg->nfds || client->shmRing)
+            break;
+#if HAVE_SASL
+        if (client->sasl)
+            break;
+#endif
+    }
+
+    ret = virNetSocketWritev(client->sock, iov, niov);
     if (ret <= 0)
         return ret; /* -1 error, 0 = egain */
 
-    client->tx->bufferOffset += ret;
+    for (msg = client->tx, done = ret; msg && done; msg = msg->next) {
+        size_t len = msg->bufferLength - msg->bufferOffset;
+        if (len > done)
+            len = done;
+        msg->bufferOffset += len;
+        done -= len;
+    }
     return ret;
 }
 
@@ -1148,8 +1266,37 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
             }
 #endif
 
+            /* The client only starts using the shared memory ring
+             * once it has read the reply accepting it, so all later
+             * rx/tx goes through the ring */
+            if (client->shmRing &&
+                client->tx->header.type == VIR_NET_REPLY &&
+                client->tx->header.serial == client->shmRingSerial) {
+                if (client->tx->header.status == VIR_NET_OK &&
+                    virNetSocketSetShmRing(client->sock, client->shmRing) < 0) {
+                    client->wantClose = true;
+                    return;
+                }
+                virObjectUnref(client->shmRing);
+                client->shmRing = NULL;
+            }
+
             /* Get finished msg from head of tx queue */
             msg = virNetMessageQueueServe(&client->tx);
+            client->txBytes -= msg->bufferLength;
+
+            /* Only start passing on events again once there is
+             * room for more than a few of them */
+            if (client->txOverLimit &&
+                client->txBytes <= client->txBytesMax / 2) {
+                unsigned long long now = 0;
+
+                ignore_value(virTimeMillisNow(&now));
+                VIR_DEBUG("client=%p caught up after %llu ms, %llu events dropped",
+                          client, now - client->txOverLimitSince,
+                          client->txDropped);
+                client->txOverLimit = false;
+            }
 
             if (msg->tracked) {
                 client->nrequests--;
@@ -1159,8 +1306,7 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
                     /* Ready to recv more messages */
                     virNetMessageClear(msg);
                     msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                    if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0) {
-                        virReportOOMError();
+                    if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0) {
                         virNetMessageFree(msg);
                         return;
                     }
@@ -1241,6 +1387,49 @@ virNetServerClientDispatchEvent(virNetSocketPtr sock, int events, void *opaque)
 }
 
 
+/*
+ * Decide whether the async event @msg should be dropped rather than
+ * queued because @client is not reading what we send it fast enough.
+ * Replies, stream data and keepalive messages are always queued: the
+ * former are already limited by nrequests_max and the flow control of
+ * streams, and dropping the latter would make a slow client look dead.
+ */
+static bool
+virNetServerClientDropEventLocked(virNetServerClientPtr client,
+                                  virNetMessagePtr msg)
+{
+    if (msg->header.type != VIR_NET_MESSAGE ||
+        msg->header.prog == KEEPALIVE_PROGRAM)
+        return false;
+
+    if (!client->txOverLimit) {
+        if (client->txBytes + msg->bufferLength <= client->txBytesMax)
+            return false;
+
+        client->txOverLimit = true;
+        ignore_value(virTimeMillisNow(&client->txOverLimitSince));
+        VIR_WARN("Client %p is not keeping up with its events, "
+                 "%zu bytes are queued; dropping events until it catches up",
+                 client, client->txBytes);
+        virMutexLock(&virNetServerClientQueueStatsLock);
+        virNetServerClientQueueStatsTotal.txOverLimit++;
+        virMutexUnlock(&virNetServerClientQueueStatsLock);
+    }
+
+    PROBE(RPC_SERVER_CLIENT_MSG_TX_DROP,
+          "client=%p len=%zu prog=%u vers=%u proc=%u",
+          client, msg->bufferLength,
+          msg->header.prog, msg->header.vers, msg->header.proc);
+    client->txDropped++;
+    virMutexLock(&virNetServerClientQueueStatsLock);
+    virNetServerClientQueueStatsTotal.txDropped++;
+    virNetServerClientQueueStatsTotal.txDroppedBytes += msg->bufferLength;
+    virMutexUnlock(&virNetServerClientQueueStatsLock);
+
+    return true;
+}
+
+
 static int
 virNetServerClientSendMessageLocked(virNetServerClientPtr client,
                                     virNetMessagePtr msg)
@@ -1252,12 +1441,23 @@ virNetServerClientSendMessageLocked(virNetServerClientPtr client,
 
     msg->donefds = 0;
     if (client->sock && !client->wantClose) {
+        if (client->compress &&
+            virNetMessageCompress(msg, VIR_NET_MESSAGE_COMPRESS_MIN) < 0)
+            return -1;
+
+        if (client->txBytesMax &&
+            virNetServerClientDropEventLocked(client, msg)) {
+            virNetMessageFree(msg);
+            return 0;
+        }
+
         PROBE(RPC_SERVER_CLIENT_MSG_TX_QUEUE,
               "client=%p len=%zu prog=%u vers=%u proc=%u type=%u status=%u serial=%u",
               client, msg->bufferLength,
               msg->header.prog, msg->header.vers, msg->header.proc,
               msg->header.type, msg->header.status, msg->header.serial);
         virNetMessageQueuePush(&client->tx, msg);
+        client->txBytes += msg->bufferLength;
 
         virNetServerClientUpdateEvent(client);
         ret = 0;
@@ -1279,6 +1479,106 @@ int virNetServerClientSendMessage(virNetServerClientPtr client,
 }
 
 
+/*
+ * Start compressing large messages sent to @client, which has told
+ * us it can decompress them. Returns false if this build does not
+ * support compression.
+ */
+bool virNetServerClientEnableCompression(virNetServerClientPtr client)
+{
+    if (!virNetMessageCompressionSupported())
+        return false;
+
+    virNetServerClientLock(client);
+    client->compress = true;
+    virNetServerClientUnlock(client);
+    return true;
+}
+
+
+/*
+ * Arrange for @client to move over to @ring as soon as the
+ * successful reply to the call with @serial has been sent.
+ */
+int virNetServerClientSetShmRing(virNetServerClientPtr client,
+                                 virNetShmRingPtr ring,
+                                 unsigned int serial)
+{
+    int ret = -1;
+
+    virNetServerClientLock(client);
+    if (client->shmRing) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("A shared memory ring is already being set up"));
+        goto cleanup;
+    }
+    if (client->tls) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Shared memory rings cannot be used with TLS"));
+        goto cleanup;
+    }
+
+    client->shmRing = virObjectRef(ring);
+    client->shmRingSerial = serial;
+    ret = 0;
+
+cleanup:
+    virNetServerClientUnlock(client);
+    return ret;
+}
+
+
+/*
+ * Limit the bytes queued for sending to @client to @txBytesMax,
+ * by dropping async events while more than that are queued.
+ * Zero means no limit.
+ */
+void virNetServerClientSetQueueLimit(virNetServerClientPtr client,
+                                     size_t txBytesMax)
+{
+    virNetServerClientLock(client);
+    client->txBytesMax = txBytesMax;
+    client->txOverLimit = false;
+    virNetServerClientUnlock(client);
+}
+
+
+/**
+ * virNetServerClientFormatQueueStats:
+ * @buf: buffer to append to
+ *
+ * Format counters of how often back-pressure was applied to clients
+ * in the Prometheus text exposition format.
+ */
+void virNetServerClientFormatQueueStats(virBufferPtr buf)
+{
+    virNetServerClientQueueStats stats;
+
+    if (virNetServerClientInitialize() < 0)
+        return;
+
+    virMutexLock(&virNetServerClientQueueStatsLock);
+    stats = virNetServerClientQueueStatsTotal;
+    virMutexUnlock(&virNetServerClientQueueStatsLock);
+
+    virBufferAsprintf(buf,
+                      "# HELP libvirt_rpc_client_read_throttled_total Times reading from a client stopped because it had max_client_requests calls in progress.\n"
+                      "# TYPE libvirt_rpc_client_read_throttled_total counter\n"
+                      "libvirt_rpc_client_read_throttled_total %llu\n"
+                      "# HELP libvirt_rpc_client_queue_full_total Times a client fell so far behind that its events were dropped.\n"
+                      "# TYPE libvirt_rpc_client_queue_full_total counter\n"
+                      "libvirt_rpc_client_queue_full_total %llu\n"
+                      "# HELP libvirt_rpc_client_events_dropped_total Events dropped for clients that fell behind.\n"
+                      "# TYPE libvirt_rpc_client_events_dropped_total counter\n"
+                      "libvirt_rpc_client_events_dropped_total %llu\n"
+                      "# HELP libvirt_rpc_client_events_dropped_bytes_total Bytes of events dropped for clients that fell behind.\n"
+                      "# TYPE libvirt_rpc_client_events_dropped_bytes_total counter\n"
+                      "libvirt_rpc_client_events_dropped_bytes_total %llu\n",
+                      stats.rxThrottled, stats.txOverLimit,
+                      stats.txDropped, stats.txDroppedBytes);
+}
+
+
 bool virNetServerClientNeedAuth(virNetServerClientPtr client)
 {
     bool need = false;
@@ -28,6 +28,7 @@
 # include "virnetmessage.h"
 # include "virobject.h"
 # include "json.h"
+# include "buf.h"
 
 typedef struct _virNetServerClient virNetServerClient;
 typedef virNetServerClient *virNetServerClientPtr;
@@ -36,10 +37,18 @@ typedef int (*virNetServerClientDispatchFunc)(virNetServerClientPtr client,
                                               virNetMessagePtr msg,
                                               void *opaque);
 
+/*
+ * Returns 1 if the filter took over @msg, 0 to pass it on to the
+ * next filter, -1 on fatal error. Returning
+ * VIR_NET_SERVER_CLIENT_FILTER_DONE instead means @msg was fully
+ * handled, will never get a reply and can be discarded.
+ */
 typedef int (*virNetServerClientFilterFunc)(virNetServerClientPtr client,
                                             virNetMessagePtr msg,
                                             void *opaque);
 
+# define VIR_NET_SERVER_CLIENT_FILTER_DONE 2
+
 typedef virJSONValuePtr (*virNetServerClientPrivPreExecRestart)(virNetServerClientPtr client,
                                                                 void *data);
 typedef void *(*virNetServerClientPrivNewPostExecRestart)(virNetServerClientPtr client,
@@ -127,6 +136,15 @@ const char *virNetServerClientRemoteAddrString(virNetServerClientPtr client);
 int virNetServerClientSendMessage(virNetServerClientPtr client,
                                   virNetMessagePtr msg);
 
+bool virNetServerClientEnableCompression(virNetServerClientPtr client);
+int virNetServerClientSetShmRing(virNetServerClientPtr client,
+                                 virNetShmRingPtr ring,
+                                 unsigned int serial);
+
+void virNetServerClientSetQueueLimit(virNetServerClientPtr client,
+                                     size_t txBytesMax);
+void virNetServerClientFormatQueueStats(virBufferPtr buf);
+
 bool virNetServerClientNeedAuth(virNetServerClientPtr client);
 
 
@@ -23,6 +23,8 @@
 
 #include <config.h>
 
+#include <time.h>
+
 #include "virnetserverprogram.h"
 #include "virnetserverclient.h"
 
@@ -34,6 +36,37 @@
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
+/* Number of latency histogram buckets */
+#define VIR_NET_SERVER_PROGRAM_STATS_BUCKETS 11
+
+/* Upper bounds of all but the last latency histogram bucket, in
+ * microseconds */
+static const unsigned long long
+virNetServerProgramStatsBounds[VIR_NET_SERVER_PROGRAM_STATS_BUCKETS - 1] = {
+    16, 64, 256, 1000, 4000, 16000, 64000, 256000, 1000000, 4000000,
+};
+
+typedef struct _virNetServerProgramProcStats virNetServerProgramProcStats;
+typedef virNetServerProgramProcStats *virNetServerProgramProcStatsPtr;
+struct _virNetServerProgramProcStats {
+    unsigned long long calls;
+    unsigned long long replyBytes;
+    unsigned long long queueUsec;
+    unsigned long long execUsec;
+    unsigned int queue[VIR_NET_SERVER_PROGRAM_STATS_BUCKETS];
+    unsigned int exec[VIR_NET_SERVER_PROGRAM_STATS_BUCKETS];
+};
+
+/* Statistics of one program recorded by one worker thread. Only that
+ * thread ever writes them, so recording a call takes no lock; readers
+ * may see a call half accounted for, which is fine for monitoring. */
+typedef struct _virNetServerProgramThreadStats virNetServerProgramThreadStats;
+typedef virNetServerProgramThreadStats *virNetServerProgramThreadStatsPtr;
+struct _virNetServerProgramThreadStats {
+    virNetServerProgramProcStatsPtr procs; /* nprocs entries */
+    virNetServerProgramThreadStatsPtr next;
+};
+
 struct _virNetServerProgram {
     virObject object;
 
@@ -41,8 +74,15 @@ struct _virNetServerProgram {
     unsigned version;
     virNetServerProgramProcPtr procs;
     size_t nprocs;
+
+    /* Protects the list of per-thread statistics, not its contents */
+    virMutex statsLock;
+    virThreadLocal statsLocal;
+    virNetServerProgramThreadStatsPtr stats;
 };
 
+static bool virNetServerProgramStatsEnabled;
+
 
 static virClassPtr virNetServerProgramClass;
 static void virNetServerProgramDispose(void *obj);
@@ -73,6 +113,20 @@ virNetServerProgramPtr virNetServerProgramNew(unsigned program,
     if (!(prog = virObjectNew(virNetServerProgramClass)))
         return NULL;
 
+    if (virMutexInit(&prog->statsLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        virObjectUnref(prog);
+        return NULL;
+    }
+
+    if (virThreadLocalInit(&prog->statsLocal, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize thread local variable"));
+        virObjectUnref(prog);
+        return NULL;
+    }
+
     prog->program = program;
     prog->version = version;
     prog->procs = procs;
@@ -124,6 +178,274 @@ static virNetServerProgramProcPtr virNetServerProgramGetProc(virNetServerProgram
     return proc;
 }
 
+/**
+ * virNetServerProgramEnableStats:
+ *
+ * Start recording per procedure call counts, latencies and reply
+ * sizes of all programs. Without this, no clock is ever read while
+ * dispatching calls.
+ */
+void virNetServerProgramEnableStats(void)
+{
+    virNetServerProgramStatsEnabled = true;
+}
+
+
+/**
+ * virNetServerProgramStatsNow:
+ *
+ * Returns the current time in microseconds for use as the queued
+ * timestamp of a message, or 0 if statistics are not enabled.
+ */
+unsigned long long virNetServerProgramStatsNow(void)
+{
+    struct timespec ts;
+
+    if (!virNetServerProgramStatsEnabled ||
+        clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+static virNetServerProgramThreadStatsPtr
+virNetServerProgramGetThreadStats(virNetServerProgramPtr prog)
+{
+    virNetServerProgramThreadStatsPtr stats;
+
+    if ((stats = virThreadLocalGet(&prog->statsLocal)))
+        return stats;
+
+    /* Statistics are best effort, so failures are not reported */
+    if (VIR_ALLOC(stats) < 0)
+        return NULL;
+    if (VIR_ALLOC_N(stats->procs, prog->nprocs) < 0 ||
+        virThreadLocalSet(&prog->statsLocal, stats) < 0) {
+        VIR_FREE(stats->procs);
+        VIR_FREE(stats);
+        return NULL;
+    }
+
+    virMutexLock(&prog->statsLock);
+    stats->next = prog->stats;
+    prog->stats = stats;
+    virMutexUnlock(&prog->statsLock);
+
+    return stats;
+}
+
+
+static size_t
+virNetServerProgramStatsBucket(unsigned long long usec)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_NET_SERVER_PROGRAM_STATS_BUCKETS - 1; i++) {
+        if (usec <= virNetServerProgramStatsBounds[i])
+            break;
+    }
+    return i;
+}
+
+
+/*
+ * Account a call of @procedure which waited in the queue since
+ * @queued and started executing at @start, producing a reply of
+ * @replyLen bytes.
+ */
+static void
+virNetServerProgramRecordStats(virNetServerProgramPtr prog,
+                               int procedure,
+                               unsigned long long queued,
+                               unsigned long long start,
+                               size_t replyLen)
+{
+    virNetServerProgramThreadStatsPtr stats;
+    virNetServerProgramProcStatsPtr proc;
+    unsigned long long end;
+    unsigned long long wait = 0;
+    unsigned long long exec = 0;
+
+    if (!start || procedure < 0 || procedure >= prog->nprocs)
+        return;
+
+    if (!(stats = virNetServerProgramGetThreadStats(prog)))
+        return;
+
+    end = virNetServerProgramStatsNow();
+    if (queued && queued < start)
+        wait = start - queued;
+    if (end > start)
+        exec = end - start;
+
+    proc = &stats->procs[procedure];
+    proc->calls++;
+    proc->replyBytes += replyLen;
+    proc->queueUsec += wait;
+    proc->queue[virNetServerProgramStatsBucket(wait)]++;
+    proc->execUsec += exec;
+    proc->exec[virNetServerProgramStatsBucket(exec)]++;
+}
+
+
+static void
+virNetServerProgramFormatHistogram(virBufferPtr buf,
+                                   const char *name,
+                                   const char *labels,
+                                   const unsigned int *buckets,
+                                   unsigned long long sumUsec,
+                                   unsigned long long count)
+{
+    unsigned long long total = 0;
+    size_t i;
+
+    for (i = 0; i < VIR_NET_SERVER_PROGRAM_STATS_BUCKETS - 1; i++) {
+        total += buckets[i];
+        virBufferAsprintf(buf, "%s_bucket{%s,le=\"%llu.%06llu\"} %llu\n",
+                          name, labels,
+                          virNetServerProgramStatsBounds[i] / 1000000,
+                          virNetServerProgramStatsBounds[i] % 1000000,
+                          total);
+    }
+    virBufferAsprintf(buf, "%s_bucket{%s,le=\"+Inf\"} %llu\n",
+                      name, labels, count);
+    virBufferAsprintf(buf, "%s_sum{%s} %llu.%06llu\n",
+                      name, labels, sumUsec / 1000000, sumUsec % 1000000);
+    virBufferAsprintf(buf, "%s_count{%s} %llu\n", name, labels, count);
+}
+
+
+enum {
+    VIR_NET_SERVER_PROGRAM_STATS_CALLS,
+    VIR_NET_SERVER_PROGRAM_STATS_REPLY_BYTES,
+    VIR_NET_SERVER_PROGRAM_STATS_QUEUE,
+    VIR_NET_SERVER_PROGRAM_STATS_EXEC,
+
+    VIR_NET_SERVER_PROGRAM_STATS_LAST
+};
+
+static const char *virNetServerProgramStatsHeaders[] = {
+    "# HELP libvirt_rpc_calls_total Number of RPC calls dispatched.\n"
+    "# TYPE libvirt_rpc_calls_total counter\n",
+    "# HELP libvirt_rpc_reply_bytes_total Bytes of RPC replies sent.\n"
+    "# TYPE libvirt_rpc_reply_bytes_total counter\n",
+    "# HELP libvirt_rpc_queue_seconds Time RPC calls waited for a worker.\n"
+    "# TYPE libvirt_rpc_queue_seconds histogram\n",
+    "# HELP libvirt_rpc_exec_seconds Time spent executing RPC calls.\n"
+    "# TYPE libvirt_rpc_exec_seconds histogram\n",
+};
+
+
+/**
+ * virNetServerProgramFormatStats:
+ * @progs: programs to report on
+ * @nprogs: number of programs in @progs
+ * @buf: buffer to append to
+ *
+ * Format the statistics recorded for all procedures of @progs which
+ * were called at least once in the Prometheus text exposition format.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int virNetServerProgramFormatStats(virNetServerProgramPtr *progs,
+                                   size_t nprogs,
+                                   virBufferPtr buf)
+{
+    virNetServerProgramProcStatsPtr *totals = NULL;
+    int ret = -1;
+    size_t i, j, k;
+    int metric;
+
+    if (VIR_ALLOC_N(totals, nprogs) < 0)
+        goto no_memory;
+
+    /* Add up what each thread recorded */
+    for (i = 0; i < nprogs; i++) {
+        virNetServerProgramPtr prog = progs[i];
+        virNetServerProgramThreadStatsPtr stats;
+
+        if (VIR_ALLOC_N(totals[i], prog->nprocs) < 0)
+            goto no_memory;
+
+        virMutexLock(&prog->statsLock);
+        for (stats = prog->stats; stats; stats = stats->next) {
+            for (j = 0; j < prog->nprocs; j++) {
+                virNetServerProgramProcStatsPtr src = &stats->procs[j];
+                virNetServerProgramProcStatsPtr dst = &totals[i][j];
+
+                dst->calls += src->calls;
+                dst->replyBytes += src->replyBytes;
+                dst->queueUsec += src->queueUsec;
+                dst->execUsec += src->execUsec;
+                for (k = 0; k < VIR_NET_SERVER_PROGRAM_STATS_BUCKETS; k++) {
+                    dst->queue[k] += src->queue[k];
+                    dst->exec[k] += src->exec[k];
+                }
+            }
+        }
+        virMutexUnlock(&prog->statsLock);
+    }
+
+    /* All samples of one metric have to be grouped together */
+    for (metric = 0; metric < VIR_NET_SERVER_PROGRAM_STATS_LAST; metric++) {
+        virBufferAdd(buf, virNetServerProgramStatsHeaders[metric], -1);
+
+        for (i = 0; i < nprogs; i++) {
+            for (j = 0; j < progs[i]->nprocs; j++) {
+                virNetServerProgramProcStatsPtr proc = &totals[i][j];
+                char *labels;
+
+                if (!proc->calls)
+                    continue;
+
+                if (virAsprintf(&labels,
+                                "program=\"%u\",version=\"%u\",procedure=\"%zu\"",
+                                progs[i]->program, progs[i]->version, j) < 0)
+                    goto no_memory;
+
+                switch (metric) {
+                case VIR_NET_SERVER_PROGRAM_STATS_CALLS:
+                    virBufferAsprintf(buf, "libvirt_rpc_calls_total{%s} %llu\n",
+                                      labels, proc->calls);
+                    break;
+                case VIR_NET_SERVER_PROGRAM_STATS_REPLY_BYTES:
+                    virBufferAsprintf(buf, "libvirt_rpc_reply_bytes_total{%s} %llu\n",
+                                      labels, proc->replyBytes);
+                    break;
+                case VIR_NET_SERVER_PROGRAM_STATS_QUEUE:
+                    virNetServerProgramFormatHistogram(buf, "libvirt_rpc_queue_seconds",
+                                                       labels, proc->queue,
+                                                       proc->queueUsec, proc->calls);
+                    break;
+                case VIR_NET_SERVER_PROGRAM_STATS_EXEC:
+                    virNetServerProgramFormatHistogram(buf, "libvirt_rpc_exec_seconds",
+                                                       labels, proc->exec,
+                                                       proc->execUsec, proc->calls);
+                    break;
+                }
+                VIR_FREE(labels);
+            }
+        }
+    }
+
+    if (virBufferError(buf))
+        goto no_memory;
+
+    ret = 0;
+
+cleanup:
+    for (i = 0; totals && i < nprogs; i++)
+        VIR_FREE(totals[i]);
+    VIR_FREE(totals);
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    goto cleanup;
+}
+
+
 unsigned int
 virNetServerProgramGetPriority(virNetServerProgramPtr prog,
                                int procedure)
@@ -305,6 +627,8 @@ int virNetServerProgramDispatch(virNetServerProgramPtr prog,
         break;
 
     case VIR_NET_STREAM:
+    case VIR_NET_STREAM_HOLE:
+    case VIR_NET_STREAM_CREDIT:
         /* Since stream data is non-acked, async, we may continue to receive
          * stream packets after we closed down a stream. Just drop & ignore
          * these.
@@ -374,6 +698,7 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     virNetServerProgramProcPtr dispatcher;
     virNetMessageError rerr;
     size_t i;
+    unsigned long long start = virNetServerProgramStatsNow();
 
     memset(&rerr, 0, sizeof(rerr));
 
@@ -477,10 +802,16 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     VIR_FREE(arg);
     VIR_FREE(ret);
 
+    virNetServerProgramRecordStats(prog, msg->header.proc, msg->queued,
+                                   start, msg->bufferLength);
+
     /* Put reply on end of tx queue to send out  */
     return virNetServerClientSendMessage(client, msg);
 
 error:
+    virNetServerProgramRecordStats(prog, msg->header.proc, msg->queued,
+                                   start, 0);
+
     /* Bad stuff (de-)serializing message, but we have an
      * RPC error message we can send back to the client */
     rv = virNetServerProgramSendReplyError(prog, client, msg, &rerr, &msg->header);
@@ -534,6 +865,99 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
 }
 
 
-void virNetServerProgramDispose(void *obj ATTRIBUTE_UNUSED)
+/*
+ * Send a hole of @length bytes down a sparse stream, in place of
+ * the equivalent run of zero bytes.
+ */
+int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      int serial,
+                                      long long length)
 {
+    virNetStreamHole data;
+
+    VIR_DEBUG("client=%p msg=%p length=%lld", client, msg, length);
+
+    memset(&data, 0, sizeof(data));
+    data.length = length;
+
+    msg->header.prog = prog->program;
+    msg->header.vers = prog->version;
+    msg->header.proc = procedure;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = serial;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        return -1;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        return -1;
+
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
+/*
+ * Set up @msg as a stream data packet and reserve @len bytes of
+ * payload space, stored in @data, so that the caller can read the
+ * stream data directly into the message rather than copying it in
+ * from a separate buffer. The packet is sent with
+ * virNetServerProgramSendPreparedStreamData once filled in.
+ */
+int virNetServerProgramPrepareStreamData(virNetServerProgramPtr prog,
+                                         virNetMessagePtr msg,
+                                         int procedure,
+                                         int serial,
+                                         size_t len,
+                                         char **data)
+{
+    VIR_DEBUG("msg=%p len=%zu", msg, len);
+
+    msg->header.prog = prog->program;
+    msg->header.vers = prog->version;
+    msg->header.proc = procedure;
+    msg->header.type = VIR_NET_STREAM;
+    msg->header.serial = serial;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        return -1;
+
+    return virNetMessageReservePayloadRaw(msg, len, data);
+}
+
+
+/*
+ * Send a packet set up by virNetServerProgramPrepareStreamData,
+ * carrying @len bytes of data, or the read EOF if @len is 0.
+ */
+int virNetServerProgramSendPreparedStreamData(virNetServerClientPtr client,
+                                              virNetMessagePtr msg,
+                                              size_t len)
+{
+    VIR_DEBUG("client=%p msg=%p len=%zu", client, msg, len);
+
+    if (virNetMessageCommitPayloadRaw(msg, len) < 0)
+        return -1;
+
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
+void virNetServerProgramDispose(void *obj)
+{
+    virNetServerProgramPtr prog = obj;
+
+    while (prog->stats) {
+        virNetServerProgramThreadStatsPtr next = prog->stats->next;
+
+        VIR_FREE(prog->stats->procs);
+        VIR_FREE(prog->stats);
+        prog->stats = next;
+    }
+    virMutexDestroy(&prog->statsLock);
 }
@@ -27,6 +27,7 @@
 # include "virnetmessage.h"
 # include "virnetserverclient.h"
 # include "virobject.h"
+# include "buf.h"
 
 typedef struct _virNetServer virNetServer;
 typedef virNetServer *virNetServerPtr;
@@ -71,6 +72,12 @@ unsigned int virNetServerProgramGetPriority(virNetServerProgramPtr prog,
 int virNetServerProgramMatches(virNetServerProgramPtr prog,
                                virNetMessagePtr msg);
 
+void virNetServerProgramEnableStats(void);
+unsigned long long virNetServerProgramStatsNow(void);
+int virNetServerProgramFormatStats(virNetServerProgramPtr *progs,
+                                   size_t nprogs,
+                                   virBufferPtr buf);
+
 int virNetServerProgramDispatch(virNetServerProgramPtr prog,
                                 virNetServerPtr server,
                                 virNetServerClientPtr client,
@@ -101,4 +108,21 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
                                       const char *data,
                                       size_t len);
 
+int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      int serial,
+                                      long long length);
+
+int virNetServerProgramPrepareStreamData(virNetServerProgramPtr prog,
+                                         virNetMessagePtr msg,
+                                         int procedure,
+                                         int serial,
+                                         size_t len,
+                                         char **data);
+int virNetServerProgramSendPreparedStreamData(virNetServerClientPtr client,
+                                              virNetMessagePtr msg,
+                                              size_t len);
+
 #endif /* __VIR_NET_SERVER_PROGRAM_H__ */
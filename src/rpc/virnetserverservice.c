@@ -342,6 +342,14 @@ virJSONValuePtr virNetServerServicePreExecRestart(virNetServerServicePtr svc)
     if (!object)
         return NULL;
 
+    /* The TLS context can't be saved, and must not silently be
+     * lost either */
+    if (svc->tls) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Unable to save state of a TLS service"));
+        goto error;
+    }
+
     if (!(socks = virJSONValueNewArray()))
         goto error;
 
@@ -0,0 +1,557 @@
+/*
+ * virnetshmring.c: shared memory ring transport for local clients
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_EVENTFD_H
+# include <sys/eventfd.h>
+# include <sys/mman.h>
+#endif
+
+#include "virnetshmring.h"
+#include "memory.h"
+#include "virterror_internal.h"
+#include "logging.h"
+#include "virfile.h"
+#include "viratomic.h"
+#include "util.h"
+#include "threads.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+#ifdef HAVE_SYS_EVENTFD_H
+
+# define VIR_NET_SHM_RING_MAGIC 0x6c767272 /* "lvrr" */
+
+/* Each index gets a cache line to itself, so the writer and the
+ * reader of a queue do not keep stealing it from each other */
+typedef struct _virNetShmRingIndex virNetShmRingIndex;
+struct _virNetShmRingIndex {
+    volatile int value;
+    char pad[60];
+};
+
+/*
+ * One direction of the pair. @head counts the bytes ever written
+ * and is only moved by the writer, @tail counts the bytes ever read
+ * and is only moved by the reader. Both wrap around at 2^32, which
+ * the power of two data area size divides.
+ */
+typedef struct _virNetShmRingQueue virNetShmRingQueue;
+typedef virNetShmRingQueue *virNetShmRingQueuePtr;
+struct _virNetShmRingQueue {
+    virNetShmRingIndex head;
+    virNetShmRingIndex tail;
+};
+
+/* Start of the shared memory. The two data areas of @size bytes
+ * follow it, in the same order as the queues. */
+typedef struct _virNetShmRingShared virNetShmRingShared;
+typedef virNetShmRingShared *virNetShmRingSharedPtr;
+struct _virNetShmRingShared {
+    unsigned int magic;
+    unsigned int size;
+    char pad[56];
+
+    virNetShmRingQueue queues[2]; /* client to server, server to client */
+};
+
+struct _virNetShmRing {
+    virObject object;
+
+    int fds[VIR_NET_SHM_RING_FD_LAST];
+
+    virNetShmRingSharedPtr shared;
+    size_t mapLength;
+    unsigned int size;
+
+    virNetShmRingQueuePtr tx;
+    virNetShmRingQueuePtr rx;
+    char *txData;
+    char *rxData;
+    int txFD; /* the peer's doorbell */
+    int rxFD; /* our own doorbell */
+
+    /* Private copies of the indexes we move. The shared ones are
+     * only ever written from these, so a peer scribbling over the
+     * memory cannot make us read or write outside the data areas */
+    unsigned int txHead;
+    unsigned int rxTail;
+};
+
+
+static virClassPtr virNetShmRingClass;
+static void virNetShmRingDispose(void *obj);
+
+static int virNetShmRingOnceInit(void)
+{
+    if (!(virNetShmRingClass = virClassNew("virNetShmRing",
+                                           sizeof(virNetShmRing),
+                                           virNetShmRingDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetShmRing)
+
+
+static bool virNetShmRingSizeIsValid(size_t size)
+{
+    if (size < VIR_NET_SHM_RING_SIZE_MIN ||
+        size > VIR_NET_SHM_RING_SIZE_MAX ||
+        (size & (size - 1))) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("Shared memory ring size %zu must be a power of two "
+                         "between %d and %d"),
+                       size, VIR_NET_SHM_RING_SIZE_MIN,
+                       VIR_NET_SHM_RING_SIZE_MAX);
+        return false;
+    }
+
+    return true;
+}
+
+
+static virNetShmRingPtr virNetShmRingNew(void)
+{
+    virNetShmRingPtr ring;
+    size_t i;
+
+    if (virNetShmRingInitialize() < 0)
+        return NULL;
+
+    if (!(ring = virObjectNew(virNetShmRingClass)))
+        return NULL;
+
+    for (i = 0 ; i < VIR_NET_SHM_RING_FD_LAST ; i++)
+        ring->fds[i] = -1;
+
+    return ring;
+}
+
+
+static int virNetShmRingMap(virNetShmRingPtr ring,
+                            size_t size,
+                            bool server)
+{
+    void *addr;
+    char *data;
+
+    ring->size = size;
+    ring->mapLength = sizeof(virNetShmRingShared) + 2 * size;
+
+    if ((addr = mmap(NULL, ring->mapLength, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, ring->fds[VIR_NET_SHM_RING_FD_MEMORY],
+                     0)) == MAP_FAILED) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to map shared memory ring"));
+        return -1;
+    }
+    ring->shared = addr;
+    data = (char *)(ring->shared + 1);
+
+    if (server) {
+        ring->rx = &ring->shared->queues[0];
+        ring->tx = &ring->shared->queues[1];
+        ring->rxData = data;
+        ring->txData = data + size;
+        ring->rxFD = ring->fds[VIR_NET_SHM_RING_FD_SERVER];
+        ring->txFD = ring->fds[VIR_NET_SHM_RING_FD_CLIENT];
+    } else {
+        ring->tx = &ring->shared->queues[0];
+        ring->rx = &ring->shared->queues[1];
+        ring->txData = data;
+        ring->rxData = data + size;
+        ring->txFD = ring->fds[VIR_NET_SHM_RING_FD_SERVER];
+        ring->rxFD = ring->fds[VIR_NET_SHM_RING_FD_CLIENT];
+    }
+
+    ring->txHead = virAtomicIntGet(&ring->tx->head.value);
+    ring->rxTail = virAtomicIntGet(&ring->rx->tail.value);
+
+    return 0;
+}
+
+
+/*
+ * @size: bytes in each direction's ring, a power of two
+ *
+ * Creates the shared memory and doorbells for a new ring, to be
+ * handed to the server with virNetShmRingGetFDs.
+ */
+virNetShmRingPtr virNetShmRingNewClient(size_t size)
+{
+    virNetShmRingPtr ring = NULL;
+    char *path = NULL;
+    int *fds;
+
+    if (!virNetShmRingSizeIsValid(size))
+        return NULL;
+
+    if (!(ring = virNetShmRingNew()))
+        return NULL;
+    fds = ring->fds;
+
+    if (!(path = strdup("/dev/shm/libvirt-shm-ring-XXXXXX"))) {
+        virReportOOMError();
+        goto error;
+    }
+
+    if ((fds[VIR_NET_SHM_RING_FD_MEMORY] = mkostemp(path, O_CLOEXEC)) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to create shared memory file %s"),
+                             path);
+        goto error;
+    }
+    unlink(path);
+
+    if (ftruncate(fds[VIR_NET_SHM_RING_FD_MEMORY],
+                  sizeof(virNetShmRingShared) + 2 * size) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to size shared memory ring"));
+        goto error;
+    }
+
+    if ((fds[VIR_NET_SHM_RING_FD_SERVER] =
+         eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+        (fds[VIR_NET_SHM_RING_FD_CLIENT] =
+         eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create shared memory ring doorbell"));
+        goto error;
+    }
+
+    if (virNetShmRingMap(ring, size, false) < 0)
+        goto error;
+
+    ring->shared->size = size;
+    virAtomicIntSet((volatile int *)&ring->shared->magic,
+                    VIR_NET_SHM_RING_MAGIC);
+
+    VIR_DEBUG("ring=%p size=%zu", ring, size);
+    VIR_FREE(path);
+    return ring;
+
+error:
+    VIR_FREE(path);
+    virObjectUnref(ring);
+    return NULL;
+}
+
+
+/*
+ * @fds: the file descriptors sent by the client, in the order of
+ *       the VIR_NET_SHM_RING_FD_* constants
+ * @nfds: number of entries in @fds
+ * @size: ring size the client asked for
+ *
+ * Attaches to a ring set up by virNetShmRingNewClient. The file
+ * descriptors are owned by the ring from now on, even on failure,
+ * and are set to -1 in @fds.
+ */
+virNetShmRingPtr virNetShmRingNewServer(int *fds,
+                                        size_t nfds,
+                                        size_t size)
+{
+    virNetShmRingPtr ring = NULL;
+    struct stat sb;
+    size_t i;
+
+    if (!(ring = virNetShmRingNew()))
+        goto error;
+
+    for (i = 0 ; i < nfds && i < VIR_NET_SHM_RING_FD_LAST ; i++) {
+        ring->fds[i] = fds[i];
+        fds[i] = -1;
+    }
+
+    if (nfds != VIR_NET_SHM_RING_FD_LAST) {
+        virReportError(VIR_ERR_RPC,
+                       _("Expected %d file descriptors for shared memory ring, got %zu"),
+                       VIR_NET_SHM_RING_FD_LAST, nfds);
+        goto error;
+    }
+
+    if (!virNetShmRingSizeIsValid(size))
+        goto error;
+
+    if (fstat(ring->fds[VIR_NET_SHM_RING_FD_MEMORY], &sb) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to stat shared memory ring"));
+        goto error;
+    }
+
+    if (!S_ISREG(sb.st_mode) ||
+        sb.st_size < sizeof(virNetShmRingShared) + 2 * size) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Shared memory ring file is too small"));
+        goto error;
+    }
+
+    for (i = VIR_NET_SHM_RING_FD_SERVER ; i < VIR_NET_SHM_RING_FD_LAST ; i++) {
+        if (virSetNonBlock(ring->fds[i]) < 0 ||
+            virSetCloseExec(ring->fds[i]) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to set shared memory ring doorbell flags"));
+            goto error;
+        }
+    }
+
+    if (virNetShmRingMap(ring, size, true) < 0)
+        goto error;
+
+    if (virAtomicIntGet((volatile int *)&ring->shared->magic) !=
+        VIR_NET_SHM_RING_MAGIC ||
+        ring->shared->size != size) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Shared memory ring was not set up by the client"));
+        goto error;
+    }
+
+    VIR_DEBUG("ring=%p size=%zu", ring, size);
+    return ring;
+
+error:
+    for (i = 0 ; i < nfds ; i++)
+        VIR_FORCE_CLOSE(fds[i]);
+    virObjectUnref(ring);
+    return NULL;
+}
+
+
+void virNetShmRingDispose(void *obj)
+{
+    virNetShmRingPtr ring = obj;
+    size_t i;
+
+    if (ring->shared)
+        munmap(ring->shared, ring->mapLength);
+
+    for (i = 0 ; i < VIR_NET_SHM_RING_FD_LAST ; i++)
+        VIR_FORCE_CLOSE(ring->fds[i]);
+}
+
+
+/*
+ * Fills @fds with the VIR_NET_SHM_RING_FD_LAST file descriptors the
+ * server needs to attach to @ring. They remain owned by @ring.
+ */
+int virNetShmRingGetFDs(virNetShmRingPtr ring,
+                        int *fds)
+{
+    size_t i;
+
+    for (i = 0 ; i < VIR_NET_SHM_RING_FD_LAST ; i++)
+        fds[i] = ring->fds[i];
+
+    return VIR_NET_SHM_RING_FD_LAST;
+}
+
+
+size_t virNetShmRingGetSize(virNetShmRingPtr ring)
+{
+    return ring->size;
+}
+
+
+/*
+ * Returns the doorbell to poll for readability, which is rung
+ * whenever the peer has written into the ring.
+ */
+int virNetShmRingGetPollFD(virNetShmRingPtr ring)
+{
+    return ring->rxFD;
+}
+
+
+bool virNetShmRingHasData(virNetShmRingPtr ring)
+{
+    return (unsigned int)virAtomicIntGet(&ring->rx->head.value) != ring->rxTail;
+}
+
+
+/*
+ * Returns the number of bytes read, 0 if the ring is empty,
+ * or -1 on error
+ */
+ssize_t virNetShmRingRead(virNetShmRingPtr ring,
+                          char *buf,
+                          size_t len)
+{
+    uint64_t ignore;
+    unsigned int avail;
+    unsigned int offset;
+    size_t chunk;
+
+    /* Clear the doorbell before looking at the ring, so that any
+     * data written from here on rings it again */
+    if (read(ring->rxFD, &ignore, sizeof(ignore)) < 0 &&
+        errno != EAGAIN && errno != EINTR) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to read shared memory ring doorbell"));
+        return -1;
+    }
+
+    avail = (unsigned int)virAtomicIntGet(&ring->rx->head.value) - ring->rxTail;
+    if (avail > ring->size) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Shared memory ring is corrupted"));
+        return -1;
+    }
+
+    if (len > avail)
+        len = avail;
+    if (len == 0)
+        return 0;
+
+    offset = ring->rxTail & (ring->size - 1);
+    chunk = MIN(len, ring->size - offset);
+    memcpy(buf, ring->rxData + offset, chunk);
+    memcpy(buf + chunk, ring->rxData, len - chunk);
+
+    ring->rxTail += len;
+    virAtomicIntSet(&ring->rx->tail.value, ring->rxTail);
+
+    return len;
+}
+
+
+/*
+ * Returns the number of bytes written, 0 if the ring is full,
+ * or -1 on error
+ */
+ssize_t virNetShmRingWrite(virNetShmRingPtr ring,
+                           const char *buf,
+                           size_t len)
+{
+    uint64_t one = 1;
+    unsigned int used;
+    unsigned int offset;
+    size_t chunk;
+
+    used = ring->txHead - (unsigned int)virAtomicIntGet(&ring->tx->tail.value);
+    if (used > ring->size) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Shared memory ring is corrupted"));
+        return -1;
+    }
+
+    if (len > ring->size - used)
+        len = ring->size - used;
+    if (len == 0)
+        return 0;
+
+    offset = ring->txHead & (ring->size - 1);
+    chunk = MIN(len, ring->size - offset);
+    memcpy(ring->txData + offset, buf, chunk);
+    memcpy(ring->txData, buf + chunk, len - chunk);
+
+    ring->txHead += len;
+    virAtomicIntSet(&ring->tx->head.value, ring->txHead);
+
+    /* A full counter already means the peer has a wakeup pending */
+    while (write(ring->txFD, &one, sizeof(one)) < 0) {
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN)
+            break;
+        virReportSystemError(errno, "%s",
+                             _("Unable to ring shared memory ring doorbell"));
+        return -1;
+    }
+
+    return len;
+}
+
+#else /* !HAVE_SYS_EVENTFD_H */
+
+virNetShmRingPtr virNetShmRingNewClient(size_t size ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("Shared memory rings are not supported on this platform"));
+    return NULL;
+}
+
+
+virNetShmRingPtr virNetShmRingNewServer(int *fds,
+                                        size_t nfds,
+                                        size_t size ATTRIBUTE_UNUSED)
+{
+    size_t i;
+
+    for (i = 0 ; i < nfds ; i++)
+        VIR_FORCE_CLOSE(fds[i]);
+
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("Shared memory rings are not supported on this platform"));
+    return NULL;
+}
+
+
+int virNetShmRingGetFDs(virNetShmRingPtr ring ATTRIBUTE_UNUSED,
+                        int *fds ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+
+size_t virNetShmRingGetSize(virNetShmRingPtr ring ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+
+int virNetShmRingGetPollFD(virNetShmRingPtr ring ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+
+bool virNetShmRingHasData(virNetShmRingPtr ring ATTRIBUTE_UNUSED)
+{
+    return false;
+}
+
+
+ssize_t virNetShmRingRead(virNetShmRingPtr ring ATTRIBUTE_UNUSED,
+                          char *buf ATTRIBUTE_UNUSED,
+                          size_t len ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("Shared memory rings are not supported on this platform"));
+    return -1;
+}
+
+
+ssize_t virNetShmRingWrite(virNetShmRingPtr ring ATTRIBUTE_UNUSED,
+                           const char *buf ATTRIBUTE_UNUSED,
+                           size_t len ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_NO_SUPPORT, "%s",
+                   _("Shared memory rings are not supported on this platform"));
+    return -1;
+}
+
+#endif /* !HAVE_SYS_EVENTFD_H */
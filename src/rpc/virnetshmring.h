@@ -0,0 +1,77 @@
+/*
+ * virnetshmring.h: shared memory ring transport for local clients
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIR_NET_SHM_RING_H__
+# define __VIR_NET_SHM_RING_H__
+
+# include "internal.h"
+# include "virobject.h"
+
+/*
+ * A pair of byte rings in memory shared by a client and libvirtd,
+ * one per direction, with an eventfd doorbell for each side. Once a
+ * UNIX socket connection has switched to a ring, message data flows
+ * through the rings while the socket itself is only used to pass
+ * file descriptors and to notice the peer going away.
+ */
+typedef struct _virNetShmRing virNetShmRing;
+typedef virNetShmRing *virNetShmRingPtr;
+
+/* Size of each direction's ring, unless the client asks otherwise */
+# define VIR_NET_SHM_RING_SIZE (256 * 1024)
+# define VIR_NET_SHM_RING_SIZE_MIN 4096
+# define VIR_NET_SHM_RING_SIZE_MAX (16 * 1024 * 1024)
+
+/* File descriptors handed from the client to the server */
+enum {
+    VIR_NET_SHM_RING_FD_MEMORY,
+    VIR_NET_SHM_RING_FD_SERVER,     /* doorbell rung for the server */
+    VIR_NET_SHM_RING_FD_CLIENT,     /* doorbell rung for the client */
+
+    VIR_NET_SHM_RING_FD_LAST
+};
+
+virNetShmRingPtr virNetShmRingNewClient(size_t size);
+virNetShmRingPtr virNetShmRingNewServer(int *fds,
+                                        size_t nfds,
+                                        size_t size)
+    ATTRIBUTE_NONNULL(1);
+
+int virNetShmRingGetFDs(virNetShmRingPtr ring,
+                        int *fds)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+size_t virNetShmRingGetSize(virNetShmRingPtr ring)
+    ATTRIBUTE_NONNULL(1);
+int virNetShmRingGetPollFD(virNetShmRingPtr ring)
+    ATTRIBUTE_NONNULL(1);
+
+bool virNetShmRingHasData(virNetShmRingPtr ring)
+    ATTRIBUTE_NONNULL(1);
+
+ssize_t virNetShmRingRead(virNetShmRingPtr ring,
+                          char *buf,
+                          size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+ssize_t virNetShmRingWrite(virNetShmRingPtr ring,
+                           const char *buf,
+                           size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+#endif /* __VIR_NET_SHM_RING_H__ */
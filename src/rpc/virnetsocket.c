@@ -49,6 +49,7 @@
 #include "event.h"
 #include "threads.h"
 #include "virprocess.h"
+#include "virnetshmring.h"
 
 #include "passfd.h"
 
@@ -66,6 +67,7 @@ struct _virNetSocket {
 
     int fd;
     int watch;
+    int events;
     pid_t pid;
     int errfd;
     bool client;
@@ -95,6 +97,11 @@ struct _virNetSocket {
 #if HAVE_LIBSSH2
     virNetSSHSessionPtr sshSession;
 #endif
+
+    /* Once set, message data goes through the ring and the socket
+     * is only watched for passed FDs and hangup */
+    virNetShmRingPtr shmRing;
+    int ringWatch;
 };
 
 
@@ -1003,6 +1010,10 @@ void virNetSocketDispose(void *obj)
         virEventRemoveHandle(sock->watch);
         sock->watch = -1;
     }
+    if (sock->ringWatch > 0) {
+        virEventRemoveHandle(sock->ringWatch);
+        sock->ringWatch = -1;
+    }
 
 #ifdef HAVE_SYS_UN_H
     /* If a server socket, then unlink UNIX path */
@@ -1023,6 +1034,7 @@ void virNetSocketDispose(void *obj)
 #if HAVE_LIBSSH2
     virObjectUnref(sock->sshSession);
 #endif
+    virObjectUnref(sock->shmRing);
 
     VIR_FORCE_CLOSE(sock->fd);
     VIR_FORCE_CLOSE(sock->errfd);
@@ -1046,6 +1058,23 @@ int virNetSocketGetFD(virNetSocketPtr sock)
 }
 
 
+/*
+ * Returns the FD to poll for incoming message data, which is
+ * the shared memory ring's doorbell if one is in use
+ */
+int virNetSocketGetPollFD(virNetSocketPtr sock)
+{
+    int fd;
+    virMutexLock(&sock->lock);
+    if (sock->shmRing)
+        fd = virNetShmRingGetPollFD(sock->shmRing);
+    else
+        fd = sock->fd;
+    virMutexUnlock(&sock->lock);
+    return fd;
+}
+
+
 int virNetSocketDupFD(virNetSocketPtr sock, bool cloexec)
 {
     int fd;
@@ -1228,6 +1257,11 @@ bool virNetSocketHasCachedData(virNetSocketPtr sock ATTRIBUTE_UNUSED)
     bool hasCached = false;
     virMutexLock(&sock->lock);
 
+    /* The doorbell is cleared before the ring is read, so data
+     * left over by a short read would not wake us up again */
+    if (sock->shmRing && virNetShmRingHasData(sock->shmRing))
+        hasCached = true;
+
 #if HAVE_LIBSSH2
     if (virNetSSHSessionHasCachedData(sock->sshSession))
         hasCached = true;
@@ -1467,6 +1501,9 @@ ssize_t virNetSocketRead(virNetSocketPtr sock, char *buf, size_t len)
 {
     ssize_t ret;
     virMutexLock(&sock->lock);
+    if (sock->shmRing)
+        ret = virNetShmRingRead(sock->shmRing, buf, len);
+    else
 #if HAVE_SASL
     if (sock->saslSession)
         ret = virNetSocketReadSASL(sock, buf, len);
@@ -1482,6 +1519,9 @@ ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len)
     ssize_t ret;
 
     virMutexLock(&sock->lock);
+    if (sock->shmRing)
+        ret = virNetShmRingWrite(sock->shmRing, buf, len);
+    else
 #if HAVE_SASL
     if (sock->saslSession)
         ret = virNetSocketWriteSASL(sock, buf, len);
@@ -1493,6 +1533,55 @@ ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len)
 }
 
 
+/*
+ * Write the @iovcnt buffers of @iov in one go. Sockets which encode
+ * what they send through TLS, SASL, ssh or a shared memory ring can
+ * only take one buffer at a time, so on those only iov[0] is written.
+ *
+ * Returns the number of bytes written, 0 if it would block, -1 on error
+ */
+ssize_t virNetSocketWritev(virNetSocketPtr sock,
+                           const struct iovec *iov,
+                           int iovcnt)
+{
+    ssize_t ret;
+
+    virMutexLock(&sock->lock);
+    if (iovcnt == 1 ||
+        sock->shmRing ||
+        sock->tlsSession ||
+#if HAVE_SASL
+        sock->saslSession ||
+#endif
+#if HAVE_LIBSSH2
+        sock->sshSession ||
+#endif
+        false) {
+        virMutexUnlock(&sock->lock);
+        return virNetSocketWrite(sock, iov[0].iov_base, iov[0].iov_len);
+    }
+
+rewrite:
+    ret = writev(sock->fd, iov, iovcnt);
+    if (ret < 0) {
+        if (errno == EINTR)
+            goto rewrite;
+        if (errno == EAGAIN) {
+            ret = 0;
+        } else {
+            virReportSystemError(errno, "%s",
+                                 _("Cannot write data"));
+        }
+    } else if (ret == 0) {
+        virReportSystemError(EIO, "%s",
+                             _("End of file while writing data"));
+        ret = -1;
+    }
+    virMutexUnlock(&sock->lock);
+    return ret;
+}
+
+
 /*
  * Returns 1 if an FD was sent, 0 if it would block, -1 on error
  */
@@ -1658,6 +1747,33 @@ static void virNetSocketEventFree(void *opaque)
     virObjectUnref(sock);
 }
 
+
+static void virNetSocketRingEventFree(void *opaque)
+{
+    virNetSocketPtr sock = opaque;
+
+    virObjectUnref(sock);
+}
+
+
+/* Must be called with the socket lock held */
+static int virNetSocketAddRingWatch(virNetSocketPtr sock)
+{
+    virObjectRef(sock);
+    if ((sock->ringWatch = virEventAddHandle(virNetShmRingGetPollFD(sock->shmRing),
+                                             sock->events,
+                                             virNetSocketEventHandle,
+                                             sock,
+                                             virNetSocketRingEventFree)) < 0) {
+        VIR_DEBUG("Failed to register ring watch on socket %p", sock);
+        virObjectUnref(sock);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 int virNetSocketAddIOCallback(virNetSocketPtr sock,
                               int events,
                               virNetSocketIOFunc func,
@@ -1674,6 +1790,8 @@ int virNetSocketAddIOCallback(virNetSocketPtr sock,
     }
 
     if ((sock->watch = virEventAddHandle(sock->fd,
+                                         sock->shmRing ?
+                                         events & VIR_EVENT_HANDLE_READABLE :
                                          events,
                                          virNetSocketEventHandle,
                                          sock,
@@ -1681,6 +1799,18 @@ int virNetSocketAddIOCallback(virNetSocketPtr sock,
         VIR_DEBUG("Failed to register watch on socket %p", sock);
         goto cleanup;
     }
+    sock->events = events;
+
+    if (sock->shmRing &&
+        virNetSocketAddRingWatch(sock) < 0) {
+        /* The socket watch's free callback drops our reference */
+        int watch = sock->watch;
+        sock->watch = -1;
+        virMutexUnlock(&sock->lock);
+        virEventRemoveHandle(watch);
+        return -1;
+    }
+
     sock->func = func;
     sock->opaque = opaque;
     sock->ff = ff;
@@ -1704,7 +1834,13 @@ void virNetSocketUpdateIOCallback(virNetSocketPtr sock,
         return;
     }
 
-    virEventUpdateHandle(sock->watch, events);
+    sock->events = events;
+    if (sock->shmRing) {
+        virEventUpdateHandle(sock->watch, events & VIR_EVENT_HANDLE_READABLE);
+        virEventUpdateHandle(sock->ringWatch, events);
+    } else {
+        virEventUpdateHandle(sock->watch, events);
+    }
 
     virMutexUnlock(&sock->lock);
 }
@@ -1720,10 +1856,66 @@ void virNetSocketRemoveIOCallback(virNetSocketPtr sock)
     }
 
     virEventRemoveHandle(sock->watch);
+    if (sock->ringWatch > 0) {
+        virEventRemoveHandle(sock->ringWatch);
+        sock->ringWatch = -1;
+    }
 
     virMutexUnlock(&sock->lock);
 }
 
+/*
+ * Switches message data over to @ring. Any watch on the socket
+ * is moved over to the ring's doorbell, except for readability
+ * which is still needed to receive FDs and notice hangup.
+ */
+int virNetSocketSetShmRing(virNetSocketPtr sock,
+                           virNetShmRingPtr ring)
+{
+    int ret = -1;
+
+    virMutexLock(&sock->lock);
+
+    if (sock->shmRing) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Socket already uses a shared memory ring"));
+        goto cleanup;
+    }
+
+    if (sock->tlsSession ||
+#if HAVE_SASL
+        sock->saslSession ||
+#endif
+#if HAVE_LIBSSH2
+        sock->sshSession ||
+#endif
+        sock->localAddr.data.sa.sa_family != AF_UNIX) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Shared memory rings need a plain local socket"));
+        goto cleanup;
+    }
+
+    sock->shmRing = virObjectRef(ring);
+
+    if (sock->watch > 0) {
+        if (virNetSocketAddRingWatch(sock) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to watch shared memory ring"));
+            virObjectUnref(sock->shmRing);
+            sock->shmRing = NULL;
+            goto cleanup;
+        }
+        virEventUpdateHandle(sock->watch,
+                             sock->events & VIR_EVENT_HANDLE_READABLE);
+    }
+
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&sock->lock);
+    return ret;
+}
+
 void virNetSocketClose(virNetSocketPtr sock)
 {
     if (!sock)
@@ -24,6 +24,8 @@
 #ifndef __VIR_NET_SOCKET_H__
 # define __VIR_NET_SOCKET_H__
 
+# include <sys/uio.h>
+
 # include "virsocketaddr.h"
 # include "command.h"
 # include "virnettlscontext.h"
@@ -32,6 +34,7 @@
 #  include "virnetsaslcontext.h"
 # endif
 # include "json.h"
+# include "virnetshmring.h"
 
 typedef struct _virNetSocket virNetSocket;
 typedef virNetSocket *virNetSocketPtr;
@@ -100,6 +103,7 @@ virNetSocketPtr virNetSocketNewPostExecRestart(virJSONValuePtr object);
 virJSONValuePtr virNetSocketPreExecRestart(virNetSocketPtr sock);
 
 int virNetSocketGetFD(virNetSocketPtr sock);
+int virNetSocketGetPollFD(virNetSocketPtr sock);
 int virNetSocketDupFD(virNetSocketPtr sock, bool cloexec);
 
 bool virNetSocketIsLocal(virNetSocketPtr sock);
@@ -118,6 +122,9 @@ int virNetSocketSetBlocking(virNetSocketPtr sock,
 
 ssize_t virNetSocketRead(virNetSocketPtr sock, char *buf, size_t len);
 ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len);
+ssize_t virNetSocketWritev(virNetSocketPtr sock,
+                           const struct iovec *iov,
+                           int iovcnt);
 
 int virNetSocketSendFD(virNetSocketPtr sock, int fd);
 int virNetSocketRecvFD(virNetSocketPtr sock, int *fd);
@@ -129,6 +136,8 @@ void virNetSocketSetTLSSession(virNetSocketPtr sock,
 void virNetSocketSetSASLSession(virNetSocketPtr sock,
                                 virNetSASLSessionPtr sess);
 # endif
+int virNetSocketSetShmRing(virNetSocketPtr sock,
+                           virNetShmRingPtr ring);
 bool virNetSocketHasCachedData(virNetSocketPtr sock);
 bool virNetSocketHasPendingData(virNetSocketPtr sock);
 
@@ -23,6 +23,7 @@
 #include <unistd.h>
 #include <fnmatch.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
@@ -36,6 +37,8 @@
 #include "logging.h"
 #include "threads.h"
 #include "configmake.h"
+#include "virhash.h"
+#include "buf.h"
 
 #define DH_BITS 1024
 
@@ -47,6 +50,11 @@
 #define LIBVIRT_SERVERKEY LIBVIRT_PKI_DIR "/libvirt/private/serverkey.pem"
 #define LIBVIRT_SERVERCERT LIBVIRT_PKI_DIR "/libvirt/servercert.pem"
 
+/* Session tickets (RFC 5077) appeared in gnutls 2.10 */
+#if LIBGNUTLS_VERSION_NUMBER >= 0x020a00
+# define VIR_NET_TLS_SESSION_TICKETS
+#endif
+
 #define VIR_FROM_THIS VIR_FROM_RPC
 
 struct _virNetTLSContext {
@@ -57,11 +65,39 @@ struct _virNetTLSContext {
     gnutls_certificate_credentials_t x509cred;
     gnutls_dh_params_t dhParams;
 
+#ifdef VIR_NET_TLS_SESSION_TICKETS
+    /* Server: key protecting the session tickets given to clients */
+    gnutls_datum_t ticketKey;
+#endif
+    /* Client: virNetTLSSessionData of the last verified session with
+     * each host, offered to it again to skip the full handshake */
+    virHashTablePtr sessionCache;
+
     bool isServer;
     bool requireValidCert;
     const char *const*x509dnWhitelist;
 };
 
+typedef struct _virNetTLSSessionData virNetTLSSessionData;
+typedef virNetTLSSessionData *virNetTLSSessionDataPtr;
+struct _virNetTLSSessionData {
+    char *data;
+    size_t len;
+};
+
+/* Client contexts shared by all connections using the same
+ * credentials, so that the CA, CRL and certificate files are only
+ * parsed and checked again once they change */
+typedef struct _virNetTLSClientCacheEntry virNetTLSClientCacheEntry;
+typedef virNetTLSClientCacheEntry *virNetTLSClientCacheEntryPtr;
+struct _virNetTLSClientCacheEntry {
+    virNetTLSContextPtr ctxt;
+    char *stamp;            /* Identity of the files ctxt was loaded from */
+};
+
+static virMutex virNetTLSClientCacheLock;
+static virHashTablePtr virNetTLSClientCache;
+
 struct _virNetTLSSession {
     virObject object;
 
@@ -83,6 +119,31 @@ static void virNetTLSContextDispose(void *obj);
 static void virNetTLSSessionDispose(void *obj);
 
 
+static void
+virNetTLSSessionDataFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virNetTLSSessionDataPtr data = payload;
+
+    if (!data)
+        return;
+    VIR_FREE(data->data);
+    VIR_FREE(data);
+}
+
+
+static void
+virNetTLSClientCacheEntryFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virNetTLSClientCacheEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+    virObjectUnref(entry->ctxt);
+    VIR_FREE(entry->stamp);
+    VIR_FREE(entry);
+}
+
+
 static int virNetTLSContextOnceInit(void)
 {
     if (!(virNetTLSContextClass = virClassNew("virNetTLSContext",
@@ -95,6 +156,15 @@ static int virNetTLSContextOnceInit(void)
                                               virNetTLSSessionDispose)))
         return -1;
 
+    if (virMutexInit(&virNetTLSClientCacheLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Failed to initialized mutex"));
+        return -1;
+    }
+
+    if (!(virNetTLSClientCache = virHashCreate(5, virNetTLSClientCacheEntryFree)))
+        return -1;
+
     return 0;
 }
 
@@ -732,6 +802,19 @@ static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
 
         gnutls_certificate_set_dh_params(ctxt->x509cred,
                                          ctxt->dhParams);
+
+#ifdef VIR_NET_TLS_SESSION_TICKETS
+        err = gnutls_session_ticket_key_generate(&ctxt->ticketKey);
+        if (err < 0) {
+            virReportError(VIR_ERR_SYSTEM_ERROR,
+                           _("Unable to generate TLS session ticket key: %s"),
+                           gnutls_strerror(err));
+            goto error;
+        }
+#endif
+    } else {
+        if (!(ctxt->sessionCache = virHashCreate(5, virNetTLSSessionDataFree)))
+            goto error;
     }
 
     ctxt->requireValidCert = requireValidCert;
@@ -748,11 +831,108 @@ error:
     if (isServer)
         gnutls_dh_params_deinit(ctxt->dhParams);
     gnutls_certificate_free_credentials(ctxt->x509cred);
+    virHashFree(ctxt->sessionCache);
     VIR_FREE(ctxt);
     return NULL;
 }
 
 
+/* Append what identifies the current contents of @file to @buf */
+static void
+virNetTLSContextFileStamp(virBufferPtr buf, const char *file)
+{
+    struct stat sb;
+
+    if (!file || stat(file, &sb) < 0) {
+        virBufferAddLit(buf, "-;");
+        return;
+    }
+
+    virBufferAsprintf(buf, "%llu:%llu:%llu:%lld.%09ld;",
+                      (unsigned long long) sb.st_dev,
+                      (unsigned long long) sb.st_ino,
+                      (unsigned long long) sb.st_size,
+                      (long long) sb.st_mtim.tv_sec,
+                      (long) sb.st_mtim.tv_nsec);
+}
+
+
+/* Return a client context for the given credentials, reusing the one
+ * created by an earlier connection as long as none of the files has
+ * changed since.  Sharing the context also lets new connections
+ * resume the TLS sessions of earlier ones.  */
+static virNetTLSContextPtr
+virNetTLSContextNewClientShared(const char *cacert,
+                                const char *cacrl,
+                                const char *cert,
+                                const char *key,
+                                bool sanityCheckCert,
+                                bool requireValidCert)
+{
+    virBuffer namebuf = VIR_BUFFER_INITIALIZER;
+    virBuffer stampbuf = VIR_BUFFER_INITIALIZER;
+    virNetTLSClientCacheEntryPtr entry;
+    virNetTLSContextPtr ctxt = NULL;
+    char *name = NULL;
+    char *stamp = NULL;
+
+    if (virNetTLSContextInitialize() < 0)
+        return NULL;
+
+    virBufferAsprintf(&namebuf, "%s\n%s\n%s\n%s\n%d%d",
+                      NULLSTR(cacert), NULLSTR(cacrl),
+                      NULLSTR(cert), NULLSTR(key),
+                      sanityCheckCert, requireValidCert);
+    virNetTLSContextFileStamp(&stampbuf, cacert);
+    virNetTLSContextFileStamp(&stampbuf, cacrl);
+    virNetTLSContextFileStamp(&stampbuf, cert);
+    virNetTLSContextFileStamp(&stampbuf, key);
+    if (virBufferError(&namebuf) || virBufferError(&stampbuf)) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    name = virBufferContentAndReset(&namebuf);
+    stamp = virBufferContentAndReset(&stampbuf);
+
+    virMutexLock(&virNetTLSClientCacheLock);
+
+    if ((entry = virHashLookup(virNetTLSClientCache, name)) &&
+        STREQ(entry->stamp, stamp)) {
+        VIR_DEBUG("Reusing TLS client context %p", entry->ctxt);
+        ctxt = virObjectRef(entry->ctxt);
+        goto unlock;
+    }
+
+    if (!(ctxt = virNetTLSContextNew(cacert, cacrl, cert, key, NULL,
+                                     sanityCheckCert, requireValidCert,
+                                     false)))
+        goto unlock;
+
+    /* Failing to cache the context only costs the next connection */
+    if (VIR_ALLOC(entry) < 0) {
+        virReportOOMError();
+        virResetLastError();
+        goto unlock;
+    }
+    entry->ctxt = virObjectRef(ctxt);
+    entry->stamp = stamp;
+    stamp = NULL;
+    if (virHashUpdateEntry(virNetTLSClientCache, name, entry) < 0) {
+        virNetTLSClientCacheEntryFree(entry, NULL);
+        virResetLastError();
+    }
+
+unlock:
+    virMutexUnlock(&virNetTLSClientCacheLock);
+cleanup:
+    virBufferFreeAndReset(&namebuf);
+    virBufferFreeAndReset(&stampbuf);
+    VIR_FREE(name);
+    VIR_FREE(stamp);
+    return ctxt;
+}
+
+
 static int virNetTLSContextLocateCredentials(const char *pkipath,
                                              bool tryUserPkiPath,
                                              bool isServer,
@@ -893,9 +1073,14 @@ static virNetTLSContextPtr virNetTLSContextNewPath(const char *pkipath,
                                           &cacert, &cacrl, &cert, &key) < 0)
         return NULL;
 
-    ctxt = virNetTLSContextNew(cacert, cacrl, cert, key,
-                               x509dnWhitelist, sanityCheckCert,
-                               requireValidCert, isServer);
+    if (isServer)
+        ctxt = virNetTLSContextNew(cacert, cacrl, cert, key,
+                                   x509dnWhitelist, sanityCheckCert,
+                                   requireValidCert, isServer);
+    else
+        ctxt = virNetTLSContextNewClientShared(cacert, cacrl, cert, key,
+                                               sanityCheckCert,
+                                               requireValidCert);
 
     VIR_FREE(cacert);
     VIR_FREE(cacrl);
@@ -945,8 +1130,8 @@ virNetTLSContextPtr virNetTLSContextNewClient(const char *cacert,
                                               bool sanityCheckCert,
                                               bool requireValidCert)
 {
-    return virNetTLSContextNew(cacert, cacrl, cert, key, NULL,
-                               sanityCheckCert, requireValidCert, false);
+    return virNetTLSContextNewClientShared(cacert, cacrl, cert, key,
+                                           sanityCheckCert, requireValidCert);
 }
 
 
@@ -1090,6 +1275,45 @@ authfail:
     return -1;
 }
 
+/* Remember the parameters of the verified client session @sess so
+ * that the next connection to the same host can resume it.  Must be
+ * called with both locks held.  */
+static void
+virNetTLSContextSaveSession(virNetTLSContextPtr ctxt,
+                            virNetTLSSessionPtr sess)
+{
+    virNetTLSSessionDataPtr data = NULL;
+    size_t len = 0;
+
+    if (!ctxt->sessionCache || !sess->hostname)
+        return;
+
+    if (gnutls_session_get_data(sess->session, NULL, &len) < 0 || len == 0)
+        return;
+
+    if (VIR_ALLOC(data) < 0 ||
+        VIR_ALLOC_N(data->data, len) < 0)
+        goto error;
+    data->len = len;
+
+    if (gnutls_session_get_data(sess->session, data->data, &data->len) < 0)
+        goto cleanup;
+
+    if (virHashUpdateEntry(ctxt->sessionCache, sess->hostname, data) < 0)
+        goto error;
+
+    VIR_DEBUG("Saved %zu bytes of TLS session data for %s",
+              data->len, sess->hostname);
+    return;
+
+error:
+    /* resumption is an optimization only */
+    virResetLastError();
+cleanup:
+    virNetTLSSessionDataFree(data, NULL);
+}
+
+
 int virNetTLSContextCheckCertificate(virNetTLSContextPtr ctxt,
                                      virNetTLSSessionPtr sess)
 {
@@ -1107,6 +1331,9 @@ int virNetTLSContextCheckCertificate(virNetTLSContextPtr ctxt,
         }
         virResetLastError();
         VIR_INFO("Ignoring bad certificate at user request");
+    } else if (!ctxt->isServer) {
+        /* Only sessions with a verified server are worth resuming */
+        virNetTLSContextSaveSession(ctxt, sess);
     }
 
     ret = 0;
@@ -1124,6 +1351,13 @@ void virNetTLSContextDispose(void *obj)
 
     gnutls_dh_params_deinit(ctxt->dhParams);
     gnutls_certificate_free_credentials(ctxt->x509cred);
+#ifdef VIR_NET_TLS_SESSION_TICKETS
+    if (ctxt->ticketKey.data) {
+        memset(ctxt->ticketKey.data, 0, ctxt->ticketKey.size);
+        gnutls_free(ctxt->ticketKey.data);
+    }
+#endif
+    virHashFree(ctxt->sessionCache);
     virMutexDestroy(&ctxt->lock);
 }
 
@@ -1214,6 +1448,36 @@ virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
         gnutls_certificate_server_set_request(sess->session, GNUTLS_CERT_REQUEST);
 
         gnutls_dh_set_prime_bits(sess->session, DH_BITS);
+
+#ifdef VIR_NET_TLS_SESSION_TICKETS
+        if ((err = gnutls_session_ticket_enable_server(sess->session,
+                                                       &ctxt->ticketKey)) != 0) {
+            virReportError(VIR_ERR_SYSTEM_ERROR,
+                           _("Failed to enable TLS session tickets: %s"),
+                           gnutls_strerror(err));
+            goto error;
+        }
+#endif
+    } else {
+        virNetTLSSessionDataPtr data = NULL;
+
+#ifdef VIR_NET_TLS_SESSION_TICKETS
+        if ((err = gnutls_session_ticket_enable_client(sess->session)) != 0) {
+            virReportError(VIR_ERR_SYSTEM_ERROR,
+                           _("Failed to enable TLS session tickets: %s"),
+                           gnutls_strerror(err));
+            goto error;
+        }
+#endif
+
+        /* If the server no longer accepts the old session, a full
+         * handshake is done instead */
+        virMutexLock(&ctxt->lock);
+        if (hostname && ctxt->sessionCache &&
+            (data = virHashLookup(ctxt->sessionCache, hostname)) &&
+            gnutls_session_set_data(sess->session, data->data, data->len) != 0)
+            VIR_DEBUG("Unable to resume TLS session with %s", hostname);
+        virMutexUnlock(&ctxt->lock);
     }
 
     gnutls_transport_set_ptr(sess->session, sess);
@@ -1321,7 +1585,9 @@ int virNetTLSSessionHandshake(virNetTLSSessionPtr sess)
     VIR_DEBUG("Ret=%d", ret);
     if (ret == 0) {
         sess->handshakeComplete = true;
-        VIR_DEBUG("Handshake is complete");
+        VIR_DEBUG("Handshake is complete, session %s",
+                  gnutls_session_is_resumed(sess->session) ?
+                  "resumed" : "new");
         goto cleanup;
     }
     if (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN) {
@@ -41,6 +41,7 @@
 #include "uuid.h"
 #include "virterror_internal.h"
 #include "virfile.h"
+#include "virhash.h"
 #include "configmake.h"
 
 #define VIR_FROM_THIS VIR_FROM_SECRET
@@ -63,6 +64,8 @@ typedef virSecretDriverState *virSecretDriverStatePtr;
 struct _virSecretDriverState {
     virMutex lock;
     virSecretEntry *secrets;
+    virHashTablePtr secretsUUID;    /* uuid string -> virSecretEntryPtr */
+    virHashTablePtr secretsUsage;   /* usage key -> virSecretEntryPtr */
     char *directory;
 };
 
@@ -111,47 +114,124 @@ secretFree(virSecretEntryPtr secret)
     VIR_FREE(secret);
 }
 
-static virSecretEntryPtr
-secretFindByUUID(virSecretDriverStatePtr driver, const unsigned char *uuid)
+static const char *
+secretUsageIDForDef(virSecretDefPtr def)
 {
-    virSecretEntryPtr *pptr, s;
+    switch (def->usage_type) {
+    case VIR_SECRET_USAGE_TYPE_NONE:
+        return "";
+
+    case VIR_SECRET_USAGE_TYPE_VOLUME:
+        return def->usage.volume;
+
+    case VIR_SECRET_USAGE_TYPE_CEPH:
+        return def->usage.ceph;
 
-    for (pptr = &driver->secrets; *pptr != NULL; pptr = &s->next) {
-        s = *pptr;
-        if (memcmp(s->def->uuid, uuid, VIR_UUID_BUFLEN) == 0)
-            return s;
+    default:
+        return NULL;
     }
-    return NULL;
 }
 
-static virSecretEntryPtr
-secretFindByUsage(virSecretDriverStatePtr driver, int usageType, const char *usageID)
+/* Key of the usage index; secrets without usage are never matched
+ * by usage, so they are not indexed and get NULL here */
+static char *
+secretUsageKey(int usageType, const char *usageID)
 {
-    virSecretEntryPtr *pptr, s;
+    char *key;
 
-    for (pptr = &driver->secrets; *pptr != NULL; pptr = &s->next) {
-        s = *pptr;
+    if (usageType != VIR_SECRET_USAGE_TYPE_VOLUME &&
+        usageType != VIR_SECRET_USAGE_TYPE_CEPH)
+        return NULL;
 
-        if (s->def->usage_type != usageType)
-            continue;
+    if (virAsprintf(&key, "%d:%s", usageType, usageID) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+    return key;
+}
 
-        switch (usageType) {
-        case VIR_SECRET_USAGE_TYPE_NONE:
-            /* never match this */
-            break;
+static int
+secretIndexAdd(virSecretDriverStatePtr driver, virSecretEntryPtr secret)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    char *key = NULL;
+    int ret = -1;
 
-        case VIR_SECRET_USAGE_TYPE_VOLUME:
-            if (STREQ(s->def->usage.volume, usageID))
-                return s;
-            break;
+    virUUIDFormat(secret->def->uuid, uuidstr);
+    if (!virHashLookup(driver->secretsUUID, uuidstr) &&
+        virHashAddEntry(driver->secretsUUID, uuidstr, secret) < 0)
+        goto cleanup;
 
-        case VIR_SECRET_USAGE_TYPE_CEPH:
-            if (STREQ(s->def->usage.ceph, usageID))
-                return s;
-            break;
-        }
+    if ((key = secretUsageKey(secret->def->usage_type,
+                              secretUsageIDForDef(secret->def))) &&
+        !virHashLookup(driver->secretsUsage, key) &&
+        virHashAddEntry(driver->secretsUsage, key, secret) < 0) {
+        if (virHashLookup(driver->secretsUUID, uuidstr) == secret)
+            virHashRemoveEntry(driver->secretsUUID, uuidstr);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(key);
+    return ret;
+}
+
+static void
+secretIndexRemove(virSecretDriverStatePtr driver, virSecretEntryPtr secret)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    char *key;
+
+    virUUIDFormat(secret->def->uuid, uuidstr);
+    if (virHashLookup(driver->secretsUUID, uuidstr) == secret)
+        virHashRemoveEntry(driver->secretsUUID, uuidstr);
+
+    if ((key = secretUsageKey(secret->def->usage_type,
+                              secretUsageIDForDef(secret->def)))) {
+        if (virHashLookup(driver->secretsUsage, key) == secret)
+            virHashRemoveEntry(driver->secretsUsage, key);
+        VIR_FREE(key);
     }
-    return NULL;
+}
+
+static int
+secretIndexRebuild(virSecretDriverStatePtr driver)
+{
+    virSecretEntryPtr s;
+
+    virHashRemoveAll(driver->secretsUUID);
+    virHashRemoveAll(driver->secretsUsage);
+
+    for (s = driver->secrets; s != NULL; s = s->next) {
+        if (secretIndexAdd(driver, s) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static virSecretEntryPtr
+secretFindByUUID(virSecretDriverStatePtr driver, const unsigned char *uuid)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(uuid, uuidstr);
+    return virHashLookup(driver->secretsUUID, uuidstr);
+}
+
+static virSecretEntryPtr
+secretFindByUsage(virSecretDriverStatePtr driver, int usageType, const char *usageID)
+{
+    virSecretEntryPtr s;
+    char *key;
+
+    if (!(key = secretUsageKey(usageType, usageID)))
+        return NULL;
+
+    s = virHashLookup(driver->secretsUsage, key);
+    VIR_FREE(key);
+    return s;
 }
 
 /* Permament secret storage */
@@ -601,24 +681,6 @@ cleanup:
     return -1;
 }
 
-static const char *
-secretUsageIDForDef(virSecretDefPtr def)
-{
-    switch (def->usage_type) {
-    case VIR_SECRET_USAGE_TYPE_NONE:
-        return "";
-
-    case VIR_SECRET_USAGE_TYPE_VOLUME:
-        return def->usage.volume;
-
-    case VIR_SECRET_USAGE_TYPE_CEPH:
-        return def->usage.ceph;
-
-    default:
-        return NULL;
-    }
-}
-
 #define MATCH(FLAG) (flags & (FLAG))
 static int
 secretListAllSecrets(virConnectPtr conn,
@@ -793,8 +855,12 @@ secretDefineXML(virConnectPtr conn, const char *xml,
             goto cleanup;
         }
 
-        listInsert(&driver->secrets, secret);
         secret->def = new_attrs;
+        if (secretIndexAdd(driver, secret) < 0) {
+            VIR_FREE(secret);
+            goto cleanup;
+        }
+        listInsert(&driver->secrets, secret);
     } else {
         const char *newUsageID = secretUsageIDForDef(new_attrs);
         const char *oldUsageID = secretUsageIDForDef(secret->def);
@@ -855,11 +921,13 @@ restore_backup:
         secret->def = backup;
     } else {
         /* "secret" was added to the head of the list above */
-        if (listUnlink(&driverState->secrets) != secret)
+        if (listUnlink(&driverState->secrets) != secret) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("list of secrets is inconsistent"));
-        else
+        } else {
+            secretIndexRemove(driver, secret);
             secretFree(secret);
+        }
     }
 
 cleanup:
@@ -1039,6 +1107,7 @@ secretUndefine(virSecretPtr obj)
         if (tmp)
             tmp->next = secret->next;
     }
+    secretIndexRemove(driver, secret);
     secretFree(secret);
 
     ret = 0;
@@ -1063,6 +1132,8 @@ secretDriverCleanup(void)
         s = listUnlink(&driverState->secrets);
         secretFree(s);
     }
+    virHashFree(driverState->secretsUUID);
+    virHashFree(driverState->secretsUsage);
     VIR_FREE(driverState->directory);
 
     secretDriverUnlock(driverState);
@@ -1101,7 +1172,12 @@ secretDriverStartup(bool privileged,
         goto out_of_memory;
     VIR_FREE(base);
 
-    if (loadSecrets(driverState, &driverState->secrets) < 0)
+    if (!(driverState->secretsUUID = virHashCreate(50, NULL)) ||
+        !(driverState->secretsUsage = virHashCreate(50, NULL)))
+        goto error;
+
+    if (loadSecrets(driverState, &driverState->secrets) < 0 ||
+        secretIndexRebuild(driverState) < 0)
         goto error;
 
     secretDriverUnlock(driverState);
@@ -1142,6 +1218,13 @@ secretDriverReload(void)
     }
     driverState->secrets = new_secrets;
 
+    if (secretIndexRebuild(driverState) < 0) {
+        virErrorPtr err = virGetLastError();
+        VIR_ERROR(_("Failed to index secrets: %s"),
+                  err ? err->message : _("unknown error"));
+        virResetError(err);
+    }
+
  end:
     secretDriverUnlock(driverState);
     return 0;
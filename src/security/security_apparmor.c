@@ -181,13 +181,14 @@ load_profile(virSecurityManagerPtr mgr,
     const char *probe = virSecurityManagerGetAllowDiskFormatProbing(mgr)
         ? "1" : "0";
 
-    xml = virDomainDefFormat(def, VIR_DOMAIN_XML_SECURE);
-    if (!xml)
-        goto clean;
-
     if (profile_status_file(profile) >= 0)
         create = false;
 
+    /* appending a file does not need the definition */
+    if ((create || !fn || !append) &&
+        !(xml = virDomainDefFormat(def, VIR_DOMAIN_XML_SECURE)))
+        goto clean;
+
     cmd = virCommandNewArgList(VIRT_AA_HELPER, "-p", probe,
                                create ? "-c" : "-r",
                                "-u", profile, NULL);
@@ -199,10 +200,69 @@ load_profile(virSecurityManagerPtr mgr,
         }
     }
 
-    virCommandSetInputBuffer(cmd, xml);
+    if (xml)
+        virCommandSetInputBuffer(cmd, xml);
+    rc = virCommandRun(cmd, NULL);
+    virCommandFree(cmd);
+
+  clean:
+    VIR_FREE(xml);
+
+    return rc;
+}
+
+static int
+add_backing_file(virDomainDiskDefPtr disk ATTRIBUTE_UNUSED,
+                 const char *path,
+                 size_t depth,
+                 void *opaque)
+{
+    virCommandPtr cmd = opaque;
+
+    if (depth > 0)
+        virCommandAddArgList(cmd, "-b", path, NULL);
+    return 0;
+}
+
+/*
+ * Add the rules for @disk to the loaded profile, or remove them,
+ * without regenerating the rules for every other disk. The backing
+ * chain already found for @disk is passed along, so that it is not
+ * probed again.
+ */
+static int
+load_profile_disk(virSecurityManagerPtr mgr,
+                  const char *profile,
+                  virDomainDefPtr def,
+                  virDomainDiskDefPtr disk,
+                  bool add)
+{
+    int rc = -1;
+    char *xml = NULL;
+    virCommandPtr cmd;
+    const char *probe = virSecurityManagerGetAllowDiskFormatProbing(mgr)
+        ? "1" : "0";
+
+    cmd = virCommandNewArgList(VIRT_AA_HELPER, "-p", probe, "-r",
+                               "-u", profile, NULL);
+    if (add) {
+        virCommandAddArgList(cmd, "-F", disk->src, NULL);
+        if (virDomainDiskDefForeachPath(disk, true,
+                                        add_backing_file, cmd) < 0)
+            goto clean;
+    } else {
+        /* the disk may not have been added on its own, in which case
+         * the rules are regenerated from the definition without it */
+        if (!(xml = virDomainDefFormat(def, VIR_DOMAIN_XML_SECURE)))
+            goto clean;
+        virCommandAddArgList(cmd, "-x", disk->src, NULL);
+        virCommandSetInputBuffer(cmd, xml);
+    }
+
     rc = virCommandRun(cmd, NULL);
 
   clean:
+    virCommandFree(cmd);
     VIR_FREE(xml);
 
     return rc;
@@ -653,10 +713,25 @@ AppArmorRestoreSecurityImageLabel(virSecurityManagerPtr mgr,
                                   virDomainDefPtr def,
                                   virDomainDiskDefPtr disk)
 {
+    const virSecurityLabelDefPtr secdef =
+        virDomainDefGetSecurityLabelDef(def, SECURITY_APPARMOR_NAME);
+
     if (disk->type == VIR_DOMAIN_DISK_TYPE_NETWORK)
         return 0;
 
-    return reload_profile(mgr, def, NULL, false);
+    if (!disk->src || !secdef || secdef->norelabel || !secdef->imagelabel)
+        return reload_profile(mgr, def, NULL, false);
+
+    /* Update the profile only if it is loaded */
+    if (profile_loaded(secdef->imagelabel) >= 0 &&
+        load_profile_disk(mgr, secdef->imagelabel, def, disk, false) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot update AppArmor profile \'%s\'"),
+                       secdef->imagelabel);
+        return -1;
+    }
+
+    return 0;
 }
 
 /* Called when hotplugging */
@@ -691,8 +766,8 @@ AppArmorSetSecurityImageLabel(virSecurityManagerPtr mgr,
 
         /* update the profile only if it is loaded */
         if (profile_loaded(secdef->imagelabel) >= 0) {
-            if (load_profile(mgr, secdef->imagelabel, def, disk->src,
-                             false) < 0) {
+            if (load_profile_disk(mgr, secdef->imagelabel, def, disk,
+                                  true) < 0) {
                 virReportError(VIR_ERR_INTERNAL_ERROR,
                                _("cannot update AppArmor profile "
                                  "\'%s\'"),
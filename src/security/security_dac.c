@@ -267,11 +267,21 @@ static const char * virSecurityDACGetDOI(virSecurityManagerPtr mgr ATTRIBUTE_UNU
 static int
 virSecurityDACSetOwnership(const char *path, uid_t uid, gid_t gid)
 {
+    struct stat sb;
+
+    /* Shared base images are usually owned correctly already; leave
+     * them alone rather than updating their change time each start */
+    if (stat(path, &sb) >= 0 &&
+        sb.st_uid == uid && sb.st_gid == gid) {
+        VIR_DEBUG("'%s' is already owned by '%ld:%ld'",
+                  path, (long) uid, (long) gid);
+        return 0;
+    }
+
     VIR_INFO("Setting DAC user and group on '%s' to '%ld:%ld'",
              path, (long) uid, (long) gid);
 
     if (chown(path, uid, gid) < 0) {
-        struct stat sb;
         int chown_errno = errno;
 
         if (stat(path, &sb) >= 0) {
@@ -45,6 +45,8 @@
 #include "virrandom.h"
 #include "util.h"
 #include "conf.h"
+#include "threads.h"
+#include "stat-time.h"
 
 #define VIR_FROM_THIS VIR_FROM_SECURITY
 
@@ -836,6 +838,19 @@ virSecuritySELinuxSetFileconHelper(const char *path, char *tcon, bool optional)
 {
     security_context_t econ;
 
+    /* Relabelling a file which already has the right label is not
+     * free, it invalidates cached attributes and is a round trip on
+     * network file systems */
+    if (getfilecon_raw(path, &econ) >= 0) {
+        bool same = STREQ(tcon, econ);
+
+        freecon(econ);
+        if (same) {
+            VIR_DEBUG("SELinux context of '%s' is already '%s'", path, tcon);
+            return 0;
+        }
+    }
+
     VIR_INFO("Setting SELinux context on '%s' to '%s'", path, tcon);
 
     if (setfilecon_raw(path, tcon) < 0) {
@@ -896,6 +911,148 @@ virSecuritySELinuxSetFilecon(const char *path, char *tcon)
     return virSecuritySELinuxSetFileconHelper(path, tcon, false);
 }
 
+/*
+ * Labels set on shared and read-only images, such as the base images
+ * of backing chains, are remembered along with the inode and change
+ * time of the file. Changing a label updates the change time, so as
+ * long as it matches there is no need to look at the file again, not
+ * even to find out once more that its file system can't be labelled.
+ */
+#define VIR_SECURITY_SELINUX_LABEL_CACHE_MAX 1024
+
+typedef struct _virSecuritySELinuxLabelCacheEntry virSecuritySELinuxLabelCacheEntry;
+typedef virSecuritySELinuxLabelCacheEntry *virSecuritySELinuxLabelCacheEntryPtr;
+struct _virSecuritySELinuxLabelCacheEntry {
+    dev_t dev;
+    ino_t ino;
+    struct timespec ctime;
+    char *label;
+    int rc; /* as returned by virSecuritySELinuxSetFileconOptional */
+};
+
+static virMutex virSecuritySELinuxLabelCacheMutex;
+static virHashTablePtr virSecuritySELinuxLabelCacheTable;
+
+static void
+virSecuritySELinuxLabelCacheEntryFree(void *payload,
+                                      const void *name ATTRIBUTE_UNUSED)
+{
+    virSecuritySELinuxLabelCacheEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    VIR_FREE(entry->label);
+    VIR_FREE(entry);
+}
+
+static int
+virSecuritySELinuxLabelCacheOnceInit(void)
+{
+    if (virMutexInit(&virSecuritySELinuxLabelCacheMutex) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        return -1;
+    }
+
+    if (!(virSecuritySELinuxLabelCacheTable =
+          virHashCreate(64, virSecuritySELinuxLabelCacheEntryFree)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virSecuritySELinuxLabelCache)
+
+/*
+ * Look up the result of labelling @path, as it is described by @sb,
+ * with @tcon. Returns it, or -1 if the file has to be labelled.
+ */
+static int
+virSecuritySELinuxLabelCacheLookup(const char *path,
+                                   const char *tcon,
+                                   const struct stat *sb)
+{
+    virSecuritySELinuxLabelCacheEntryPtr entry;
+    struct timespec ctime = get_stat_ctime(sb);
+    int ret = -1;
+
+    virMutexLock(&virSecuritySELinuxLabelCacheMutex);
+    entry = virHashLookup(virSecuritySELinuxLabelCacheTable, path);
+    if (entry &&
+        entry->dev == sb->st_dev &&
+        entry->ino == sb->st_ino &&
+        entry->ctime.tv_sec == ctime.tv_sec &&
+        entry->ctime.tv_nsec == ctime.tv_nsec &&
+        STREQ(entry->label, tcon))
+        ret = entry->rc;
+    virMutexUnlock(&virSecuritySELinuxLabelCacheMutex);
+
+    if (ret >= 0)
+        VIR_DEBUG("using cached SELinux context '%s' of '%s'", tcon, path);
+
+    return ret;
+}
+
+/* Remember that labelling @path with @tcon gave @rc, leaving it as
+ * described by @sb. Failing to do so is not an error, the label is
+ * checked again next time. */
+static void
+virSecuritySELinuxLabelCacheStore(const char *path,
+                                  const char *tcon,
+                                  const struct stat *sb,
+                                  int rc)
+{
+    virSecuritySELinuxLabelCacheEntryPtr entry;
+
+    if (VIR_ALLOC(entry) < 0 ||
+        !(entry->label = strdup(tcon))) {
+        VIR_FREE(entry);
+        return;
+    }
+
+    entry->dev = sb->st_dev;
+    entry->ino = sb->st_ino;
+    entry->ctime = get_stat_ctime(sb);
+    entry->rc = rc;
+
+    virMutexLock(&virSecuritySELinuxLabelCacheMutex);
+    if (virHashSize(virSecuritySELinuxLabelCacheTable) >=
+        VIR_SECURITY_SELINUX_LABEL_CACHE_MAX &&
+        !virHashLookup(virSecuritySELinuxLabelCacheTable, path))
+        virHashRemoveAll(virSecuritySELinuxLabelCacheTable);
+    if (virHashUpdateEntry(virSecuritySELinuxLabelCacheTable,
+                           path, entry) < 0) {
+        virResetLastError();
+        virSecuritySELinuxLabelCacheEntryFree(entry, NULL);
+    }
+    virMutexUnlock(&virSecuritySELinuxLabelCacheMutex);
+}
+
+/* Like virSecuritySELinuxSetFileconOptional, for files that are shared
+ * with other domains and never get their label restored */
+static int
+virSecuritySELinuxSetFileconShared(const char *path, char *tcon)
+{
+    struct stat sb;
+    int rc;
+
+    if (virSecuritySELinuxLabelCacheInitialize() < 0)
+        return -1;
+
+    if (stat(path, &sb) == 0 &&
+        (rc = virSecuritySELinuxLabelCacheLookup(path, tcon, &sb)) >= 0)
+        return rc;
+
+    if ((rc = virSecuritySELinuxSetFileconOptional(path, tcon)) < 0)
+        return rc;
+
+    if (stat(path, &sb) == 0)
+        virSecuritySELinuxLabelCacheStore(path, tcon, &sb, rc);
+
+    return rc;
+}
+
 static int
 virSecuritySELinuxFSetFilecon(int fd, char *tcon)
 {
@@ -1081,16 +1238,16 @@ virSecuritySELinuxSetSecurityFileLabel(virDomainDiskDefPtr disk,
     } else if (depth == 0) {
 
         if (disk->shared) {
-            ret = virSecuritySELinuxSetFileconOptional(path, data->file_context);
+            ret = virSecuritySELinuxSetFileconShared(path, data->file_context);
         } else if (disk->readonly) {
-            ret = virSecuritySELinuxSetFileconOptional(path, data->content_context);
+            ret = virSecuritySELinuxSetFileconShared(path, data->content_context);
         } else if (secdef->imagelabel) {
             ret = virSecuritySELinuxSetFileconOptional(path, secdef->imagelabel);
         } else {
             ret = 0;
         }
     } else {
-        ret = virSecuritySELinuxSetFileconOptional(path, data->content_context);
+        ret = virSecuritySELinuxSetFileconShared(path, data->content_context);
     }
     if (ret == 1 && !disk_seclabel) {
         /* If we failed to set a label, but virt_use_nfs let us
@@ -75,11 +75,16 @@ typedef struct {
     char *arch;                 /* machine architecture */
     char *newfile;              /* newly added file */
     bool append;                /* append to .files instead of rewrite */
+    char **backing;             /* backing chain of the appended file */
+    size_t nbacking;
+    char *oldfile;              /* appended file to remove */
 } vahControl;
 
 static int
 vahDeinit(vahControl * ctl)
 {
+    size_t i;
+
     if (ctl == NULL)
         return -1;
 
@@ -89,6 +94,10 @@ vahDeinit(vahControl * ctl)
     VIR_FREE(ctl->hvm);
     VIR_FREE(ctl->arch);
     VIR_FREE(ctl->newfile);
+    for (i = 0; i < ctl->nbacking; i++)
+        VIR_FREE(ctl->backing[i]);
+    VIR_FREE(ctl->backing);
+    VIR_FREE(ctl->oldfile);
 
     return 0;
 }
@@ -106,6 +115,8 @@ vah_usage(void)
             "    -D | --delete                  unload and delete profile\n"
             "    -f | --add-file <file>         add file to profile\n"
             "    -F | --append-file <file>      append file to profile\n"
+            "    -b | --backing-file <file>     file the appended one is backed by\n"
+            "    -x | --remove-file <file>      remove appended file from profile\n"
             "    -r | --replace                 reload profile\n"
             "    -R | --remove                  unload profile\n"
             "    -h | --help                    this help\n"
@@ -252,6 +263,47 @@ cleanup:
     return result;
 }
 
+/*
+ * Write @pcontent to the include file, unless it already holds
+ * @existing of length @flen with the same content
+ */
+static int
+write_include_file(const char *include_file, const char *pcontent,
+                   const char *existing, int flen)
+{
+    int plen;
+    int fd;
+
+    plen = strlen(pcontent);
+    if (plen > MAX_FILE_LEN) {
+        vah_error(NULL, 0, _("invalid length for new profile"));
+        return -1;
+    }
+
+    /* only update the disk profile if it is different */
+    if (flen > 0 && flen == plen && STREQLEN(existing, pcontent, plen))
+        return 0;
+
+    /* write the file */
+    if ((fd = open(include_file, O_CREAT | O_TRUNC | O_WRONLY, 0644)) == -1) {
+        vah_error(NULL, 0, _("failed to create include file"));
+        return -1;
+    }
+
+    if (safewrite(fd, pcontent, plen) < 0) { /* don't write the '\0' */
+        VIR_FORCE_CLOSE(fd);
+        vah_error(NULL, 0, _("failed to write to profile"));
+        return -1;
+    }
+
+    if (VIR_CLOSE(fd) != 0) {
+        vah_error(NULL, 0, _("failed to close or write to profile"));
+        return -1;
+    }
+
+    return 0;
+}
+
 /*
  * Update the dynamic files
  */
@@ -260,8 +312,7 @@ update_include_file(const char *include_file, const char *included_files,
                     bool append)
 {
     int rc = -1;
-    int plen, flen = 0;
-    int fd;
+    int flen = 0;
     char *pcontent = NULL;
     char *existing = NULL;
     const char *warning =
@@ -285,38 +336,67 @@ update_include_file(const char *include_file, const char *included_files,
         }
     }
 
-    plen = strlen(pcontent);
-    if (plen > MAX_FILE_LEN) {
-        vah_error(NULL, 0, _("invalid length for new profile"));
-        goto clean;
-    }
+    rc = write_include_file(include_file, pcontent, existing, flen);
 
-    /* only update the disk profile if it is different */
-    if (flen > 0 && flen == plen && STREQLEN(existing, pcontent, plen)) {
-        rc = 0;
-        goto clean;
+  clean:
+    VIR_FREE(pcontent);
+    VIR_FREE(existing);
+
+    return rc;
+}
+
+/*
+ * Files appended for a single disk are kept between markers naming
+ * it, so that they can be removed again without regenerating the
+ * whole include file.  Replace the block of @file with @block, or
+ * remove it if @block is NULL.  Returns 1 if there was nothing to
+ * remove.
+ */
+static int
+update_include_block(const char *include_file, const char *file,
+                     const char *block)
+{
+    int rc = -1;
+    char *existing = NULL;
+    char *begin = NULL;
+    char *end = NULL;
+    char *start;
+    char *stop;
+    char *pcontent = NULL;
+
+    if (!virFileExists(include_file)) {
+        vah_error(NULL, 0, _("include file does not exist"));
+        return rc;
     }
 
-    /* write the file */
-    if ((fd = open(include_file, O_CREAT | O_TRUNC | O_WRONLY, 0644)) == -1) {
-        vah_error(NULL, 0, _("failed to create include file"));
+    if (virFileReadAll(include_file, MAX_FILE_LEN, &existing) < 0)
+        return rc;
+
+    if (virAsprintf(&begin, "  # begin %s\n", file) == -1 ||
+        virAsprintf(&end, "  # end %s\n", file) == -1) {
+        vah_error(NULL, 0, _("could not allocate memory for profile"));
         goto clean;
     }
 
-    if (safewrite(fd, pcontent, plen) < 0) { /* don't write the '\0' */
-        VIR_FORCE_CLOSE(fd);
-        vah_error(NULL, 0, _("failed to write to profile"));
+    if ((start = strstr(existing, begin)) &&
+        (stop = strstr(start, end))) {
+        memmove(start, stop + strlen(end), strlen(stop + strlen(end)) + 1);
+    } else if (!block) {
+        rc = 1;
         goto clean;
     }
 
-    if (VIR_CLOSE(fd) != 0) {
-        vah_error(NULL, 0, _("failed to close or write to profile"));
+    if (virAsprintf(&pcontent, "%s%s", existing, block ? block : "") == -1) {
+        vah_error(NULL, 0, _("could not allocate memory for profile"));
         goto clean;
     }
-    rc = 0;
+
+    rc = write_include_file(include_file, pcontent, NULL, 0);
 
   clean:
     VIR_FREE(pcontent);
+    VIR_FREE(begin);
+    VIR_FREE(end);
     VIR_FREE(existing);
 
     return rc;
@@ -1074,6 +1154,8 @@ vahParseArgv(vahControl * ctl, int argc, char **argv)
         {"delete", 0, 0, 'D'},
         {"add-file", 0, 0, 'f'},
         {"append-file", 0, 0, 'F'},
+        {"backing-file", 1, 0, 'b'},
+        {"remove-file", 1, 0, 'x'},
         {"help", 0, 0, 'h'},
         {"replace", 0, 0, 'r'},
         {"remove", 0, 0, 'R'},
@@ -1081,7 +1163,7 @@ vahParseArgv(vahControl * ctl, int argc, char **argv)
         {0, 0, 0, 0}
     };
 
-    while ((arg = getopt_long(argc, argv, "acdDhrRH:b:u:p:f:F:", opt,
+    while ((arg = getopt_long(argc, argv, "acdDhrRH:b:u:p:f:F:x:", opt,
             &idx)) != -1) {
         switch (arg) {
             case 'a':
@@ -1102,6 +1184,15 @@ vahParseArgv(vahControl * ctl, int argc, char **argv)
                     vah_error(ctl, 1, _("could not allocate memory for disk"));
                 ctl->append = arg == 'F';
                 break;
+            case 'b':
+                if (VIR_EXPAND_N(ctl->backing, ctl->nbacking, 1) < 0 ||
+                    !(ctl->backing[ctl->nbacking - 1] = strdup(optarg)))
+                    vah_error(ctl, 1, _("could not allocate memory for disk"));
+                break;
+            case 'x':
+                if ((ctl->oldfile = strdup(optarg)) == NULL)
+                    vah_error(ctl, 1, _("could not allocate memory for disk"));
+                break;
             case 'h':
                 vah_usage();
                 exit(EXIT_SUCCESS);
@@ -1141,7 +1232,15 @@ vahParseArgv(vahControl * ctl, int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    if (ctl->cmd == 'c' || ctl->cmd == 'r') {
+    if (ctl->nbacking && !(ctl->append && ctl->newfile))
+        vah_error(ctl, 1, _("backing files need a file to append"));
+
+    if (ctl->oldfile && (ctl->cmd != 'r' || ctl->newfile))
+        vah_error(ctl, 1, _("bad command"));
+
+    /* Appending a file needs neither the definition nor the files of
+     * the other disks, which may be many and slow to probe */
+    if (ctl->cmd == 'c' || (ctl->cmd == 'r' && !ctl->append)) {
         char *xmlStr = NULL;
         if (virFileReadLimFD(STDIN_FILENO, MAX_FILE_LEN, &xmlStr) < 0)
             vah_error(ctl, 1, _("could not read xml file"));
@@ -1152,16 +1251,71 @@ vahParseArgv(vahControl * ctl, int argc, char **argv)
         }
         VIR_FREE(xmlStr);
 
-        if (get_files(ctl) != 0)
+        /* the files are only needed if the appended one is not found */
+        if (!ctl->oldfile && get_files(ctl) != 0)
             vah_error(ctl, 1, _("invalid VM definition"));
     }
     return 0;
 }
 
+/*
+ * Append the rules for ctl->newfile and its backing files to the
+ * include file, or remove those appended for ctl->oldfile. Returns 1
+ * if ctl->oldfile was not appended, so the whole include file has to
+ * be regenerated.
+ */
+static int
+update_appended_file(vahControl * ctl, const char *include_file)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *block = NULL;
+    size_t i;
+    int rc = -1;
+
+    if (ctl->oldfile) {
+        if (ctl->dryrun) {
+            vah_info(include_file);
+            vah_info(ctl->oldfile);
+            return 0;
+        }
+        return update_include_block(include_file, ctl->oldfile, NULL);
+    }
+
+    virBufferAsprintf(&buf, "  # begin %s\n", ctl->newfile);
+    if (vah_add_file(&buf, ctl->newfile, "rw") != 0)
+        goto clean;
+    for (i = 0; i < ctl->nbacking; i++) {
+        if (vah_add_file(&buf, ctl->backing[i], "r") != 0)
+            goto clean;
+    }
+    virBufferAsprintf(&buf, "  # end %s\n", ctl->newfile);
+
+    if (virBufferError(&buf)) {
+        vah_error(NULL, 0, _("failed to allocate file buffer"));
+        goto clean;
+    }
+
+    block = virBufferContentAndReset(&buf);
+    if (ctl->dryrun) {
+        vah_info(include_file);
+        vah_info(block);
+        rc = 0;
+    } else {
+        rc = update_include_block(include_file, ctl->newfile, block);
+    }
+
+  clean:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(block);
+    return rc;
+}
+
 
 /*
  * virt-aa-helper -c -u UUID < file.xml
  * virt-aa-helper -r -u UUID [-f <file>] < file.xml
+ * virt-aa-helper -r -u UUID -F <file> [-b <file>]...
+ * virt-aa-helper -r -u UUID -x <file> < file.xml
  * virt-aa-helper -a -u UUID
  * virt-aa-helper -R -u UUID
  * virt-aa-helper -D -u UUID
@@ -1218,6 +1372,10 @@ main(int argc, char **argv)
             unlink(include_file);
             unlink(profile);
         }
+    } else if (ctl->cmd == 'r' && (ctl->append || ctl->oldfile) &&
+               (rc = update_appended_file(ctl, include_file)) <= 0) {
+        if (rc == 0 && !ctl->dryrun)
+            rc = parserReplace(ctl->uuid);
     } else if (ctl->cmd == 'c' || ctl->cmd == 'r') {
         char *included_files = NULL;
 
@@ -1225,6 +1383,11 @@ main(int argc, char **argv)
             vah_error(ctl, 1, _("profile exists"));
         }
 
+        /* the removed file was not appended but part of the files of
+         * the definition, which no longer includes it */
+        if (ctl->oldfile && (rc = get_files(ctl)) != 0)
+            goto clean;
+
         if (ctl->append && ctl->newfile) {
             if (vah_add_file(&buf, ctl->newfile, "rw") != 0)
                 goto clean;
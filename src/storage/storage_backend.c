@@ -40,6 +40,9 @@
 # include <sys/ioctl.h>
 # include <linux/fs.h>
 #endif
+#if HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
 
 #if HAVE_SELINUX
 # include <selinux/selinux.h>
@@ -56,6 +59,7 @@
 #include "storage_backend.h"
 #include "logging.h"
 #include "virfile.h"
+#include "viratomic.h"
 #include "stat-time.h"
 
 #if WITH_STORAGE_LVM
@@ -128,6 +132,170 @@ enum {
 #define READ_BLOCK_SIZE_DEFAULT  (1024 * 1024)
 #define WRITE_BLOCK_SIZE_DEFAULT (4 * 1024)
 
+/*
+ * Have the kernel copy @len bytes at @offset of @inputfd to the same
+ * offset of @fd, remembering in @noCopyRange whether copy_file_range
+ * turned out to be unusable for these files.
+ *
+ * Returns the number of bytes copied, 0 if neither copy_file_range
+ * nor sendfile can copy them, -1 with errno set on error.
+ */
+static ssize_t
+virStorageBackendCopyRange(int inputfd ATTRIBUTE_UNUSED,
+                           int fd ATTRIBUTE_UNUSED,
+                           off_t offset ATTRIBUTE_UNUSED,
+                           size_t len ATTRIBUTE_UNUSED,
+                           bool *noCopyRange ATTRIBUTE_UNUSED)
+{
+#if HAVE_COPY_FILE_RANGE || HAVE_SYS_SENDFILE_H
+    ssize_t n;
+#endif
+
+#if HAVE_COPY_FILE_RANGE
+    if (!*noCopyRange) {
+        loff_t in_off = offset, out_off = offset;
+
+        do {
+            n = copy_file_range(inputfd, &in_off, fd, &out_off, len, 0);
+        } while (n < 0 && errno == EINTR);
+
+        if (n >= 0)
+            return n;
+        if (errno != ENOSYS && errno != EXDEV &&
+            errno != EINVAL && errno != EOPNOTSUPP)
+            return -1;
+        *noCopyRange = true;
+    }
+#endif
+
+#if HAVE_SYS_SENDFILE_H
+    {
+        off_t in_off = offset;
+
+        if (lseek(fd, offset, SEEK_SET) < 0)
+            return -1;
+
+        do {
+            n = sendfile(fd, inputfd, &in_off, len);
+        } while (n < 0 && errno == EINTR);
+
+        if (n >= 0)
+            return n;
+        if (errno != ENOSYS && errno != EINVAL)
+            return -1;
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * Copy the first *total bytes of @inputfd to the start of the regular
+ * file @fd, which is already extended to the volume capacity, without
+ * passing them through libvirtd.  Where the file system can share
+ * extents the whole file is reflinked, otherwise the data extents are
+ * copied by the kernel (server side on NFS) and holes are skipped, so
+ * that they stay unallocated in @fd.
+ *
+ * Returns 0 when done, 1 if the buffered copy has to take over at the
+ * current offset of both files, -errno on error.
+ */
+static int
+virStorageBackendCopyFileOffload(virStorageVolDefPtr vol,
+                                 virStorageVolDefPtr inputvol,
+                                 int inputfd,
+                                 int fd,
+                                 unsigned long long *total)
+{
+    struct stat st;
+    off_t end;
+    off_t pos = 0;
+    bool noCopyRange = false;
+
+    if (fstat(inputfd, &st) < 0 || !S_ISREG(st.st_mode))
+        return 1;
+
+    end = st.st_size;
+    if ((unsigned long long)end > *total)
+        end = *total;
+
+#ifdef FICLONE
+    if (end == st.st_size && ioctl(fd, FICLONE, inputfd) == 0) {
+        VIR_DEBUG("Reflinked '%s' to '%s'",
+                  inputvol->target.path, vol->target.path);
+        /* The clone may have cut the file back to the input size */
+        if ((unsigned long long)st.st_size < vol->capacity &&
+            ftruncate(fd, vol->capacity) < 0) {
+            int ret = -errno;
+            virReportSystemError(errno,
+                                 _("cannot extend file '%s'"),
+                                 vol->target.path);
+            return ret;
+        }
+        *total -= end;
+        return 0;
+    }
+#endif
+
+    while (pos < end) {
+        off_t data = pos;
+        off_t hole = end;
+
+        if (virAtomicIntGet(&vol->jobAbort)) {
+            virReportError(VIR_ERR_OPERATION_ABORTED,
+                           _("copy to volume '%s' was aborted"), vol->name);
+            return -ECANCELED;
+        }
+
+#ifdef SEEK_DATA
+        if ((data = lseek(inputfd, pos, SEEK_DATA)) < 0) {
+            if (errno == ENXIO)
+                break; /* nothing but a hole up to the end */
+            data = pos;
+        } else if ((hole = lseek(inputfd, data, SEEK_HOLE)) < 0 ||
+                   hole > end) {
+            hole = end;
+        }
+        if (data >= end)
+            break;
+#endif
+
+        while (data < hole) {
+            ssize_t n = virStorageBackendCopyRange(inputfd, fd, data,
+                                                   hole - data,
+                                                   &noCopyRange);
+            if (n < 0) {
+                int ret = -errno;
+                virReportSystemError(errno,
+                                     _("failed copying '%s' to '%s'"),
+                                     inputvol->target.path,
+                                     vol->target.path);
+                return ret;
+            }
+
+            if (n == 0) {
+                if (lseek(inputfd, data, SEEK_SET) < 0 ||
+                    lseek(fd, data, SEEK_SET) < 0) {
+                    int ret = -errno;
+                    virReportSystemError(errno,
+                                         _("cannot seek in file '%s'"),
+                                         vol->target.path);
+                    return ret;
+                }
+                VIR_DEBUG("Copying '%s' through a buffer from offset %llu",
+                          inputvol->target.path, (unsigned long long)data);
+                *total -= data;
+                return 1;
+            }
+            data += n;
+        }
+        pos = hole;
+    }
+
+    *total -= end;
+    return 0;
+}
+
 static int ATTRIBUTE_NONNULL(2)
 virStorageBackendCopyToFD(virStorageVolDefPtr vol,
                           virStorageVolDefPtr inputvol,
@@ -175,9 +343,25 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
         goto cleanup;
     }
 
+    if (is_dest_file) {
+        if ((ret = virStorageBackendCopyFileOffload(vol, inputvol, inputfd,
+                                                    fd, total)) < 0)
+            goto cleanup;
+        if (ret == 0)
+            amtread = 0;
+        ret = 0;
+    }
+
     while (amtread != 0) {
         int amtleft;
 
+        if (virAtomicIntGet(&vol->jobAbort)) {
+            ret = -ECANCELED;
+            virReportError(VIR_ERR_OPERATION_ABORTED,
+                           _("copy to volume '%s' was aborted"), vol->name);
+            goto cleanup;
+        }
+
         if (*total < rbytes)
             rbytes = *total;
 
@@ -655,6 +839,246 @@ cleanup:
 }
 
 
+/*
+ * qcow2 images without encryption and without a volume to convert
+ * from are simple enough to be laid out here rather than by forking
+ * qemu-img. The layout matches what 'qemu-img create -f qcow2 -o
+ * compat=0.10' writes: the header and backing file name in the first
+ * cluster, followed by the refcount table, the refcount blocks and the
+ * L1 table, and with metadata preallocation the L2 tables and the data
+ * clusters they all point to.
+ */
+#define QCOW2_MAGIC 0x514649fb
+#define QCOW2_VERSION 2
+#define QCOW2_HEADER_SIZE 72
+#define QCOW2_CLUSTER_BITS 16
+#define QCOW2_CLUSTER_SIZE (1ULL << QCOW2_CLUSTER_BITS)
+#define QCOW2_EXT_BACKING_FORMAT 0xE2792ACA
+#define QCOW2_OFLAG_COPIED (1ULL << 63)
+#define QCOW2_MAX_BACKING_FILE_SIZE 1023
+
+static void
+virStorageBackendQcow2Put32(unsigned char *buf, uint32_t val)
+{
+    buf[0] = val >> 24;
+    buf[1] = val >> 16;
+    buf[2] = val >> 8;
+    buf[3] = val;
+}
+
+static void
+virStorageBackendQcow2Put64(unsigned char *buf, uint64_t val)
+{
+    virStorageBackendQcow2Put32(buf, val >> 32);
+    virStorageBackendQcow2Put32(buf + 4, val);
+}
+
+static int
+virStorageBackendQcow2Write(int fd, const char *path,
+                            unsigned long long offset,
+                            const unsigned char *buf, size_t len)
+{
+    if (lseek(fd, offset, SEEK_SET) < 0 ||
+        safewrite(fd, buf, len) < 0) {
+        virReportSystemError(errno, _("cannot write to '%s'"), path);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+virStorageBackendCreateQcow2(virStoragePoolObjPtr pool,
+                             virStorageVolDefPtr vol,
+                             const char *backingType,
+                             bool preallocate)
+{
+    const unsigned long long cs = QCOW2_CLUSTER_SIZE;
+    const unsigned long long tableEntries = cs / 8;
+    const unsigned long long refcountEntries = cs / 2;
+    unsigned long long dataClusters, l1Size, l1Clusters, l2Clusters;
+    unsigned long long refcountBlocks = 1, refcountTableClusters = 1;
+    unsigned long long totalClusters, usedClusters;
+    unsigned long long rtOffset, rbOffset, l1Offset, l2Offset, dataOffset;
+    unsigned long long i, j;
+    unsigned char *buf = NULL;
+    size_t pos;
+    int operation_flags;
+    int fd = -1;
+    int ret = -1;
+
+    dataClusters = VIR_DIV_UP(vol->capacity, cs);
+    l1Size = VIR_DIV_UP(dataClusters, tableEntries);
+    l1Clusters = VIR_DIV_UP(l1Size * 8, cs);
+    l2Clusters = preallocate ? l1Size : 0;
+    if (!preallocate)
+        dataClusters = 0;
+
+    /* The refcount blocks have to count themselves and the table
+     * pointing at them, so grow both until they cover everything */
+    for (;;) {
+        unsigned long long blocks, tableClusters;
+
+        totalClusters = 1 + refcountTableClusters + refcountBlocks +
+            l1Clusters + l2Clusters + dataClusters;
+        blocks = VIR_DIV_UP(totalClusters, refcountEntries);
+        tableClusters = VIR_DIV_UP(blocks * 8, cs);
+        if (blocks == refcountBlocks &&
+            tableClusters == refcountTableClusters)
+            break;
+        refcountBlocks = blocks;
+        refcountTableClusters = tableClusters;
+    }
+
+    rtOffset = cs;
+    rbOffset = rtOffset + refcountTableClusters * cs;
+    l1Offset = rbOffset + refcountBlocks * cs;
+    l2Offset = l1Offset + l1Clusters * cs;
+    dataOffset = l2Offset + l2Clusters * cs;
+
+    if (vol->backingStore.path &&
+        strlen(vol->backingStore.path) > QCOW2_MAX_BACKING_FILE_SIZE) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("backing store path '%s' is too long"),
+                       vol->backingStore.path);
+        return -1;
+    }
+
+    operation_flags = VIR_FILE_OPEN_FORCE_MODE | VIR_FILE_OPEN_FORCE_OWNER;
+    if (pool->def->type == VIR_STORAGE_POOL_NETFS)
+        operation_flags |= VIR_FILE_OPEN_FORK;
+
+    if ((fd = virFileOpenAs(vol->target.path,
+                            O_RDWR | O_CREAT | O_EXCL,
+                            vol->target.perms.mode,
+                            vol->target.perms.uid,
+                            vol->target.perms.gid,
+                            operation_flags)) < 0) {
+        virReportSystemError(-fd,
+                             _("cannot create path '%s'"),
+                             vol->target.path);
+        return -1;
+    }
+
+    /* All the metadata is written one cluster at a time */
+    if (VIR_ALLOC_N(buf, cs) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    /* Header, header extensions and backing file name */
+    virStorageBackendQcow2Put32(buf, QCOW2_MAGIC);
+    virStorageBackendQcow2Put32(buf + 4, QCOW2_VERSION);
+    virStorageBackendQcow2Put32(buf + 20, QCOW2_CLUSTER_BITS);
+    virStorageBackendQcow2Put64(buf + 24, vol->capacity);
+    virStorageBackendQcow2Put32(buf + 36, l1Size);
+    virStorageBackendQcow2Put64(buf + 40, l1Offset);
+    virStorageBackendQcow2Put64(buf + 48, rtOffset);
+    virStorageBackendQcow2Put32(buf + 56, refcountTableClusters);
+    pos = QCOW2_HEADER_SIZE;
+
+    if (vol->backingStore.path) {
+        size_t fmtlen = strlen(backingType);
+        size_t pathlen = strlen(vol->backingStore.path);
+
+        virStorageBackendQcow2Put32(buf + pos, QCOW2_EXT_BACKING_FORMAT);
+        virStorageBackendQcow2Put32(buf + pos + 4, fmtlen);
+        memcpy(buf + pos + 8, backingType, fmtlen);
+        pos += 8 + VIR_DIV_UP(fmtlen, 8) * 8;
+
+        /* end of extensions, already zeroed */
+        pos += 8;
+
+        virStorageBackendQcow2Put64(buf + 8, pos);
+        virStorageBackendQcow2Put32(buf + 16, pathlen);
+        memcpy(buf + pos, vol->backingStore.path, pathlen);
+    }
+
+    if (virStorageBackendQcow2Write(fd, vol->target.path, 0, buf, cs) < 0)
+        goto cleanup;
+
+    /* Refcount table */
+    for (i = 0; i < refcountBlocks; i += tableEntries) {
+        memset(buf, 0, cs);
+        for (j = 0; j < tableEntries && i + j < refcountBlocks; j++)
+            virStorageBackendQcow2Put64(buf + j * 8,
+                                        rbOffset + (i + j) * cs);
+        if (virStorageBackendQcow2Write(fd, vol->target.path,
+                                        rtOffset + (i / tableEntries) * cs,
+                                        buf, cs) < 0)
+            goto cleanup;
+    }
+
+    /* Refcount blocks, every cluster of the image is used once */
+    for (i = 0; i < refcountBlocks; i++) {
+        memset(buf, 0, cs);
+        usedClusters = totalClusters - i * refcountEntries;
+        if (usedClusters > refcountEntries)
+            usedClusters = refcountEntries;
+        for (j = 0; j < usedClusters; j++)
+            buf[j * 2 + 1] = 1;
+        if (virStorageBackendQcow2Write(fd, vol->target.path,
+                                        rbOffset + i * cs, buf, cs) < 0)
+            goto cleanup;
+    }
+
+    /* L1 table, left empty unless preallocating */
+    for (i = 0; i < l1Clusters; i++) {
+        memset(buf, 0, cs);
+        for (j = 0; preallocate && j < tableEntries &&
+                 i * tableEntries + j < l1Size; j++)
+            virStorageBackendQcow2Put64(buf + j * 8,
+                                        (l2Offset +
+                                         (i * tableEntries + j) * cs) |
+                                        QCOW2_OFLAG_COPIED);
+        if (virStorageBackendQcow2Write(fd, vol->target.path,
+                                        l1Offset + i * cs, buf, cs) < 0)
+            goto cleanup;
+    }
+
+    /* L2 tables mapping every data cluster */
+    for (i = 0; i < l2Clusters; i++) {
+        memset(buf, 0, cs);
+        for (j = 0; j < tableEntries && i * tableEntries + j < dataClusters; j++)
+            virStorageBackendQcow2Put64(buf + j * 8,
+                                        (dataOffset +
+                                         (i * tableEntries + j) * cs) |
+                                        QCOW2_OFLAG_COPIED);
+        if (virStorageBackendQcow2Write(fd, vol->target.path,
+                                        l2Offset + i * cs, buf, cs) < 0)
+            goto cleanup;
+    }
+
+    /* The data clusters are left sparse */
+    if (ftruncate(fd, totalClusters * cs) < 0) {
+        virReportSystemError(errno,
+                             _("cannot extend file '%s'"),
+                             vol->target.path);
+        goto cleanup;
+    }
+
+    if (fsync(fd) < 0) {
+        virReportSystemError(errno, _("cannot sync data to file '%s'"),
+                             vol->target.path);
+        goto cleanup;
+    }
+
+    if (VIR_CLOSE(fd) < 0) {
+        virReportSystemError(errno, _("cannot close file '%s'"),
+                             vol->target.path);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0) {
+        VIR_FORCE_CLOSE(fd);
+        unlink(vol->target.path);
+    }
+    VIR_FREE(buf);
+    return ret;
+}
+
 static int
 virStorageBackendCreateQemuImg(virConnectPtr conn,
                                virStoragePoolObjPtr pool,
@@ -787,6 +1211,11 @@ virStorageBackendCreateQemuImg(virConnectPtr conn,
         }
     }
 
+    if (!inputvol && !do_encryption &&
+        vol->target.format == VIR_STORAGE_FILE_QCOW2)
+        return virStorageBackendCreateQcow2(pool, vol, backingType,
+                                            preallocate);
+
     /* Size in KB */
     size_arg = VIR_DIV_UP(vol->capacity, 1024);
 
@@ -1160,6 +1589,66 @@ int virStorageBackendUpdateVolInfo(virStorageVolDefPtr vol,
                                                VIR_STORAGE_VOL_OPEN_DEFAULT);
 }
 
+/*
+ * Record the permissions, timestamps and security label of the volume
+ * @target, described by @sb.  The label is read from @fd, or from the
+ * path of @target if @fd is -1.
+ */
+static int
+virStorageBackendUpdateVolTargetPermsStat(virStorageVolTargetPtr target,
+                                          int fd,
+                                          const struct stat *sb)
+{
+#if HAVE_SELINUX
+    security_context_t filecon = NULL;
+    int rc;
+#endif
+
+    target->perms.mode = sb->st_mode & S_IRWXUGO;
+    target->perms.uid = sb->st_uid;
+    target->perms.gid = sb->st_gid;
+
+    if (!target->timestamps && VIR_ALLOC(target->timestamps) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+    target->timestamps->atime = get_stat_atime(sb);
+    target->timestamps->btime = get_stat_birthtime(sb);
+    target->timestamps->ctime = get_stat_ctime(sb);
+    target->timestamps->mtime = get_stat_mtime(sb);
+
+    VIR_FREE(target->perms.label);
+
+#if HAVE_SELINUX
+    /* XXX: make this a security driver call */
+    if (fd >= 0)
+        rc = fgetfilecon_raw(fd, &filecon);
+    else
+        rc = getfilecon_raw(target->path, &filecon);
+    if (rc == -1) {
+        if (errno != ENODATA && errno != ENOTSUP) {
+            virReportSystemError(errno,
+                                 _("cannot get file context of '%s'"),
+                                 target->path);
+            return -1;
+        } else {
+            target->perms.label = NULL;
+        }
+    } else {
+        target->perms.label = strdup(filecon);
+        freecon(filecon);
+        if (target->perms.label == NULL) {
+            virReportOOMError();
+            return -1;
+        }
+    }
+#else
+    target->perms.label = NULL;
+#endif
+
+    return 0;
+}
+
 /*
  * virStorageBackendUpdateVolTargetInfoFD:
  * @conn: connection to report errors on
@@ -1177,9 +1666,6 @@ virStorageBackendUpdateVolTargetInfoFD(virStorageVolTargetPtr target,
                                        unsigned long long *capacity)
 {
     struct stat sb;
-#if HAVE_SELINUX
-    security_context_t filecon = NULL;
-#endif
 
     if (fstat(fd, &sb) < 0) {
         virReportSystemError(errno,
@@ -1226,45 +1712,27 @@ virStorageBackendUpdateVolTargetInfoFD(virStorageVolTargetPtr target,
         }
     }
 
-    target->perms.mode = sb.st_mode & S_IRWXUGO;
-    target->perms.uid = sb.st_uid;
-    target->perms.gid = sb.st_gid;
-
-    if (!target->timestamps && VIR_ALLOC(target->timestamps) < 0) {
-        virReportOOMError();
-        return -1;
-    }
-    target->timestamps->atime = get_stat_atime(&sb);
-    target->timestamps->btime = get_stat_birthtime(&sb);
-    target->timestamps->ctime = get_stat_ctime(&sb);
-    target->timestamps->mtime = get_stat_mtime(&sb);
+    return virStorageBackendUpdateVolTargetPermsStat(target, fd, &sb);
+}
 
-    VIR_FREE(target->perms.label);
+/*
+ * Record the permissions, timestamps and security label of the volume
+ * @target without opening it, for backends that learn the size of
+ * their volumes some other way.
+ */
+int
+virStorageBackendUpdateVolTargetPerms(virStorageVolTargetPtr target)
+{
+    struct stat sb;
 
-#if HAVE_SELINUX
-    /* XXX: make this a security driver call */
-    if (fgetfilecon_raw(fd, &filecon) == -1) {
-        if (errno != ENODATA && errno != ENOTSUP) {
-            virReportSystemError(errno,
-                                 _("cannot get file context of '%s'"),
-                                 target->path);
-            return -1;
-        } else {
-            target->perms.label = NULL;
-        }
-    } else {
-        target->perms.label = strdup(filecon);
-        freecon(filecon);
-        if (target->perms.label == NULL) {
-            virReportOOMError();
-            return -1;
-        }
+    if (stat(target->path, &sb) < 0) {
+        virReportSystemError(errno,
+                             _("cannot stat file '%s'"),
+                             target->path);
+        return -1;
     }
-#else
-    target->perms.label = NULL;
-#endif
 
-    return 0;
+    return virStorageBackendUpdateVolTargetPermsStat(target, -1, &sb);
 }
 
 
@@ -33,6 +33,9 @@ typedef int (*virStorageBackendCheckPool)(virConnectPtr conn, virStoragePoolObjP
 typedef int (*virStorageBackendStartPool)(virConnectPtr conn, virStoragePoolObjPtr pool);
 typedef int (*virStorageBackendBuildPool)(virConnectPtr conn, virStoragePoolObjPtr pool, unsigned int flags);
 typedef int (*virStorageBackendRefreshPool)(virConnectPtr conn, virStoragePoolObjPtr pool);
+typedef int (*virStorageBackendRefreshPoolCapacity)(virConnectPtr conn, virStoragePoolObjPtr pool);
+typedef int (*virStorageBackendRefreshPoolEntry)(virConnectPtr conn, virStoragePoolObjPtr pool,
+                                                 const char *name);
 typedef int (*virStorageBackendStopPool)(virConnectPtr conn, virStoragePoolObjPtr pool);
 typedef int (*virStorageBackendDeletePool)(virConnectPtr conn, virStoragePoolObjPtr pool, unsigned int flags);
 
@@ -76,6 +79,19 @@ struct _virStorageBackend {
     virStorageBackendStartPool startPool;
     virStorageBackendBuildPool buildPool;
     virStorageBackendRefreshPool refreshPool;
+    /* checkPool, startPool and refreshPool may run concurrently for
+     * different pools of this type when autostarting */
+    bool parallelAutostart;
+    /* refreshPool reuses the unchanged volumes it finds in
+     * pool->volumes, so they must not be cleared before calling it */
+    bool refreshKeepsVols;
+    /* optional; only updates the capacity, allocation and available
+     * space of the pool, leaving its volumes alone */
+    virStorageBackendRefreshPoolCapacity refreshPoolCapacity;
+    /* optional; updates the single volume @name of a pool whose volumes
+     * are the entries of its target directory, allowing the driver to
+     * follow changes to that directory as they happen */
+    virStorageBackendRefreshPoolEntry refreshPoolEntry;
     virStorageBackendStopPool stopPool;
     virStorageBackendDeletePool deletePool;
 
@@ -126,6 +142,7 @@ int virStorageBackendUpdateVolTargetInfoFD(virStorageVolTargetPtr target,
                                            int fd,
                                            unsigned long long *allocation,
                                            unsigned long long *capacity);
+int virStorageBackendUpdateVolTargetPerms(virStorageVolTargetPtr target);
 int
 virStorageBackendDetectBlockVolFormatFD(virStorageVolTargetPtr target,
                                         int fd);
@@ -25,6 +25,13 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#if defined(__linux__)
+# include <linux/fs.h>
+# include <linux/hdreg.h>
+#endif
 
 #include "virterror_internal.h"
 #include "logging.h"
@@ -33,6 +40,8 @@
 #include "memory.h"
 #include "command.h"
 #include "configmake.h"
+#include "virfile.h"
+#include "c-ctype.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -46,20 +55,14 @@ virStorageBackendDiskMakeDataVol(virStoragePoolObjPtr pool,
                                  virStorageVolDefPtr vol)
 {
     char *tmp, *devpath;
+    bool is_new_vol = false;
 
     if (vol == NULL) {
         if (VIR_ALLOC(vol) < 0) {
             virReportOOMError();
             return -1;
         }
-
-        if (VIR_REALLOC_N(pool->volumes.objs,
-                          pool->volumes.count+1) < 0) {
-            virReportOOMError();
-            virStorageVolDefFree(vol);
-            return -1;
-        }
-        pool->volumes.objs[pool->volumes.count++] = vol;
+        is_new_vol = true;
 
         /* Prepended path will be same for all partitions, so we can
          * strip the path to form a reasonable pool-unique name
@@ -67,14 +70,14 @@ virStorageBackendDiskMakeDataVol(virStoragePoolObjPtr pool,
         tmp = strrchr(groups[0], '/');
         if ((vol->name = strdup(tmp ? tmp + 1 : groups[0])) == NULL) {
             virReportOOMError();
-            return -1;
+            goto free_vol;
         }
     }
 
     if (vol->target.path == NULL) {
         if ((devpath = strdup(groups[0])) == NULL) {
             virReportOOMError();
-            return -1;
+            goto free_vol;
         }
 
         /* Now figure out the stable path
@@ -86,17 +89,22 @@ virStorageBackendDiskMakeDataVol(virStoragePoolObjPtr pool,
         vol->target.path = virStorageBackendStablePath(pool, devpath, true);
         VIR_FREE(devpath);
         if (vol->target.path == NULL)
-            return -1;
+            goto free_vol;
     }
 
     if (vol->key == NULL) {
         /* XXX base off a unique key of the underlying disk */
         if ((vol->key = strdup(vol->target.path)) == NULL) {
             virReportOOMError();
-            return -1;
+            goto free_vol;
         }
     }
 
+    /* The pool indexes its volumes by name, key and path, so it only
+     * takes a new one once they are known */
+    if (is_new_vol && virStoragePoolObjAddVol(pool, vol) < 0)
+        goto free_vol;
+
     if (vol->source.extents == NULL) {
         if (VIR_ALLOC(vol->source.extents) < 0) {
             virReportOOMError();
@@ -152,6 +160,11 @@ virStorageBackendDiskMakeDataVol(virStoragePoolObjPtr pool,
         pool->def->capacity = vol->source.extents[0].end;
 
     return 0;
+
+free_vol:
+    if (is_new_vol)
+        virStorageVolDefFree(vol);
+    return -1;
 }
 
 static int
@@ -248,6 +261,506 @@ virStorageBackendDiskMakeVol(virStoragePoolObjPtr pool,
 }
 
 
+/*
+ * MS-DOS and GPT partition tables, by far the most common ones, are
+ * read straight from the device rather than by forking
+ * libvirt_parthelper on every refresh. Their partitions, the areas
+ * holding the tables and the free space in between are reported in
+ * the same form as the helper reports them, as parted would see them,
+ * so virStorageBackendDiskMakeVol handles both alike. Anything else,
+ * or any table that does not look right, is left to the helper.
+ */
+#define DISK_MBR_SIGNATURE_OFFSET 510
+#define DISK_MBR_PART_OFFSET 446
+#define DISK_MBR_PART_SIZE 16
+#define DISK_MBR_TYPE_GPT 0xee
+#define DISK_MBR_MAX_LOGICAL 128
+
+#define DISK_GPT_SIGNATURE "EFI PART"
+#define DISK_GPT_MAX_ENTRIES 1024
+
+typedef struct _virStorageBackendDiskPart virStorageBackendDiskPart;
+typedef virStorageBackendDiskPart *virStorageBackendDiskPartPtr;
+struct _virStorageBackendDiskPart {
+    int num;                    /* -1 for tables and free space */
+    const char *type;           /* "normal", "logical" or "extended" */
+    const char *content;        /* "data", "metadata" or "free" */
+    unsigned long long start;   /* First sector */
+    unsigned long long end;     /* Last sector */
+};
+
+typedef struct _virStorageBackendDiskTable virStorageBackendDiskTable;
+typedef virStorageBackendDiskTable *virStorageBackendDiskTablePtr;
+struct _virStorageBackendDiskTable {
+    int fd;
+    unsigned int sectorSize;
+    unsigned long long nsectors;
+
+    virStorageBackendDiskPartPtr parts;
+    size_t nparts;
+};
+
+static unsigned int
+virStorageBackendDiskGetLE32(const unsigned char *buf)
+{
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) |
+        ((unsigned int)buf[3] << 24);
+}
+
+static unsigned long long
+virStorageBackendDiskGetLE64(const unsigned char *buf)
+{
+    return virStorageBackendDiskGetLE32(buf) |
+        ((unsigned long long)virStorageBackendDiskGetLE32(buf + 4) << 32);
+}
+
+/* Read @count sectors from @lba on into @buf. Returns 0 on success,
+ * 1 if they lie beyond the end of the disk, -1 on error */
+static int
+virStorageBackendDiskReadSectors(virStorageBackendDiskTablePtr table,
+                                 unsigned long long lba,
+                                 size_t count,
+                                 unsigned char *buf)
+{
+    size_t len = count * table->sectorSize;
+
+    if (lba >= table->nsectors || count > table->nsectors - lba)
+        return 1;
+
+    if (lseek(table->fd, lba * table->sectorSize, SEEK_SET) < 0 ||
+        saferead(table->fd, buf, len) != len) {
+        virReportSystemError(errno,
+                             _("cannot read sector %llu of partition table"),
+                             lba);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+virStorageBackendDiskAddPart(virStorageBackendDiskTablePtr table,
+                             int num,
+                             const char *type,
+                             const char *content,
+                             unsigned long long start,
+                             unsigned long long end)
+{
+    virStorageBackendDiskPartPtr part;
+
+    if (VIR_EXPAND_N(table->parts, table->nparts, 1) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+    part = &table->parts[table->nparts - 1];
+    part->num = num;
+    part->type = type;
+    part->content = content;
+    part->start = start;
+    part->end = end;
+    return 0;
+}
+
+static int
+virStorageBackendDiskPartCompare(const void *a, const void *b)
+{
+    const virStorageBackendDiskPart *pa = a;
+    const virStorageBackendDiskPart *pb = b;
+
+    if (pa->start != pb->start)
+        return pa->start < pb->start ? -1 : 1;
+    /* an extended partition comes before what it contains */
+    if (pa->end != pb->end)
+        return pa->end > pb->end ? -1 : 1;
+    return 0;
+}
+
+/* Report the gaps between sectors @first and @last not taken by the
+ * parts of @type already in @table as free space of that type */
+static int
+virStorageBackendDiskAddFree(virStorageBackendDiskTablePtr table,
+                             const char *type,
+                             unsigned long long first,
+                             unsigned long long last)
+{
+    size_t nparts = table->nparts;
+    unsigned long long next = first;
+    size_t i;
+
+    qsort(table->parts, nparts, sizeof(*table->parts),
+          virStorageBackendDiskPartCompare);
+
+    for (i = 0; i < nparts && next <= last; i++) {
+        virStorageBackendDiskPartPtr part = &table->parts[i];
+
+        if (STRNEQ(part->type, type) &&
+            !(STREQ(type, "normal") && STREQ(part->type, "extended")))
+            continue;
+        if (part->end < next || part->start > last)
+            continue;
+
+        if (part->start > next &&
+            virStorageBackendDiskAddPart(table, -1, type, "free",
+                                         next, part->start - 1) < 0)
+            return -1;
+        /* parts may have moved if the array grew */
+        part = &table->parts[i];
+        if (part->end + 1 > next)
+            next = part->end + 1;
+    }
+
+    if (next <= last &&
+        virStorageBackendDiskAddPart(table, -1, type, "free",
+                                     next, last) < 0)
+        return -1;
+
+    return 0;
+}
+
+static bool
+virStorageBackendDiskIsExtended(unsigned char type)
+{
+    return type == 0x05 || type == 0x0f || type == 0x85;
+}
+
+/* Follow the chain of extended boot records of the extended partition
+ * spanning sectors @start to @end */
+static int
+virStorageBackendDiskReadLogical(virStorageBackendDiskTablePtr table,
+                                 unsigned char *buf,
+                                 unsigned long long start,
+                                 unsigned long long end)
+{
+    unsigned long long ebr = start;
+    int num = 5;
+    int rc;
+
+    /* an empty extended partition still starts with a boot record */
+    while (num < 5 + DISK_MBR_MAX_LOGICAL) {
+        const unsigned char *entry = buf + DISK_MBR_PART_OFFSET;
+        const unsigned char *next = entry + DISK_MBR_PART_SIZE;
+        unsigned long long first;
+        unsigned long long count;
+
+        if ((rc = virStorageBackendDiskReadSectors(table, ebr, 1, buf)) != 0)
+            return rc;
+        if (buf[DISK_MBR_SIGNATURE_OFFSET] != 0x55 ||
+            buf[DISK_MBR_SIGNATURE_OFFSET + 1] != 0xaa)
+            return ebr == start ? 0 : 1;
+
+        first = ebr + virStorageBackendDiskGetLE32(entry + 8);
+        count = virStorageBackendDiskGetLE32(entry + 12);
+
+        if (entry[4] && count) {
+            if (first <= ebr || first + count - 1 > end)
+                return 1;
+            if (virStorageBackendDiskAddPart(table, -1, "logical", "metadata",
+                                             ebr, first - 1) < 0 ||
+                virStorageBackendDiskAddPart(table, num++, "logical", "data",
+                                             first, first + count - 1) < 0)
+                return -1;
+        } else if (virStorageBackendDiskAddPart(table, -1, "logical",
+                                                "metadata", ebr, ebr) < 0) {
+            return -1;
+        }
+
+        if (!virStorageBackendDiskIsExtended(next[4]))
+            return 0;
+
+        ebr = start + virStorageBackendDiskGetLE32(next + 8);
+        if (ebr <= start || ebr > end)
+            return 1;
+    }
+
+    return 1;
+}
+
+/* Returns 0 if @table now holds the MS-DOS partitions, 1 if the disk
+ * has no such table or it is not understood, -1 on error */
+static int
+virStorageBackendDiskReadMBR(virStorageBackendDiskTablePtr table,
+                             unsigned char *buf)
+{
+    unsigned char mbr[DISK_MBR_SIGNATURE_OFFSET];
+    unsigned long long extStart = 0;
+    unsigned long long extEnd = 0;
+    bool extended = false;
+    int rc;
+    int i;
+
+    if ((rc = virStorageBackendDiskReadSectors(table, 0, 1, buf)) != 0)
+        return rc;
+    if (buf[DISK_MBR_SIGNATURE_OFFSET] != 0x55 ||
+        buf[DISK_MBR_SIGNATURE_OFFSET + 1] != 0xaa)
+        return 1;
+    memcpy(mbr, buf, sizeof(mbr));
+
+    for (i = 0; i < 4; i++) {
+        const unsigned char *entry = mbr + DISK_MBR_PART_OFFSET +
+            i * DISK_MBR_PART_SIZE;
+
+        /* boot sectors of file systems carry the signature too */
+        if (entry[0] != 0x00 && entry[0] != 0x80)
+            return 1;
+        if (entry[4] == DISK_MBR_TYPE_GPT)
+            return 1;
+    }
+
+    if (virStorageBackendDiskAddPart(table, -1, "normal", "metadata",
+                                     0, 0) < 0)
+        return -1;
+
+    for (i = 0; i < 4; i++) {
+        const unsigned char *entry = mbr + DISK_MBR_PART_OFFSET +
+            i * DISK_MBR_PART_SIZE;
+        unsigned long long first = virStorageBackendDiskGetLE32(entry + 8);
+        unsigned long long count = virStorageBackendDiskGetLE32(entry + 12);
+
+        if (!entry[4] || !count)
+            continue;
+        if (first == 0 || first + count > table->nsectors)
+            return 1;
+
+        if (virStorageBackendDiskIsExtended(entry[4])) {
+            if (extended)
+                return 1;
+            extended = true;
+            extStart = first;
+            extEnd = first + count - 1;
+            if (virStorageBackendDiskAddPart(table, i + 1, "extended",
+                                             "metadata", extStart,
+                                             extEnd) < 0)
+                return -1;
+        } else if (virStorageBackendDiskAddPart(table, i + 1, "normal", "data",
+                                                first,
+                                                first + count - 1) < 0) {
+            return -1;
+        }
+    }
+
+    if (extended) {
+        if ((rc = virStorageBackendDiskReadLogical(table, buf,
+                                                   extStart, extEnd)) != 0)
+            return rc;
+        if (virStorageBackendDiskAddFree(table, "logical",
+                                         extStart, extEnd) < 0)
+            return -1;
+    }
+
+    return virStorageBackendDiskAddFree(table, "normal",
+                                        0, table->nsectors - 1);
+}
+
+/* Returns 0 if @table now holds the GPT partitions, 1 if the disk has
+ * no such table or it is not understood, -1 on error */
+static int
+virStorageBackendDiskReadGPT(virStorageBackendDiskTablePtr table,
+                             unsigned char *buf)
+{
+    unsigned long long firstUsable;
+    unsigned long long lastUsable;
+    unsigned long long entriesLBA;
+    unsigned int nentries;
+    unsigned int entrySize;
+    unsigned char *entries = NULL;
+    size_t nsectors;
+    unsigned int i;
+    int ret = -1;
+    int rc;
+
+    if ((rc = virStorageBackendDiskReadSectors(table, 1, 1, buf)) != 0)
+        return rc;
+    if (memcmp(buf, DISK_GPT_SIGNATURE, strlen(DISK_GPT_SIGNATURE)) != 0)
+        return 1;
+
+    firstUsable = virStorageBackendDiskGetLE64(buf + 40);
+    lastUsable = virStorageBackendDiskGetLE64(buf + 48);
+    entriesLBA = virStorageBackendDiskGetLE64(buf + 72);
+    nentries = virStorageBackendDiskGetLE32(buf + 80);
+    entrySize = virStorageBackendDiskGetLE32(buf + 84);
+
+    if (firstUsable < 2 || lastUsable < firstUsable ||
+        lastUsable >= table->nsectors ||
+        entrySize < 128 || entrySize > table->sectorSize ||
+        table->sectorSize % entrySize != 0 ||
+        nentries > DISK_GPT_MAX_ENTRIES)
+        return 1;
+
+    nsectors = ((size_t)nentries * entrySize + table->sectorSize - 1) /
+        table->sectorSize;
+    if (VIR_ALLOC_N(entries, nsectors * table->sectorSize) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+    if ((rc = virStorageBackendDiskReadSectors(table, entriesLBA, nsectors,
+                                               entries)) != 0) {
+        ret = rc;
+        goto cleanup;
+    }
+
+    if (virStorageBackendDiskAddPart(table, -1, "normal", "metadata",
+                                     0, firstUsable - 1) < 0)
+        goto cleanup;
+    if (lastUsable < table->nsectors - 1 &&
+        virStorageBackendDiskAddPart(table, -1, "normal", "metadata",
+                                     lastUsable + 1,
+                                     table->nsectors - 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nentries; i++) {
+        const unsigned char *entry = entries + (size_t)i * entrySize;
+        static const unsigned char unused[16];
+        unsigned long long first;
+        unsigned long long last;
+
+        if (memcmp(entry, unused, sizeof(unused)) == 0)
+            continue;
+
+        first = virStorageBackendDiskGetLE64(entry + 32);
+        last = virStorageBackendDiskGetLE64(entry + 40);
+        if (first < firstUsable || last > lastUsable || last < first) {
+            ret = 1;
+            goto cleanup;
+        }
+
+        if (virStorageBackendDiskAddPart(table, i + 1, "normal", "data",
+                                         first, last) < 0)
+            goto cleanup;
+    }
+
+    ret = virStorageBackendDiskAddFree(table, "normal",
+                                       firstUsable, lastUsable);
+
+cleanup:
+    VIR_FREE(entries);
+    return ret;
+}
+
+/* Open @path and fill @table with its size. Returns 0 on success,
+ * 1 if the size can not be told, -1 on error */
+static int
+virStorageBackendDiskOpenTable(const char *path,
+                               virStorageBackendDiskTablePtr table)
+{
+    off_t size;
+
+    memset(table, 0, sizeof(*table));
+    table->sectorSize = SECTOR_SIZE;
+
+    if ((table->fd = open(path, O_RDONLY)) < 0) {
+        virReportSystemError(errno, _("cannot open device '%s'"), path);
+        return -1;
+    }
+
+#ifdef BLKSSZGET
+    {
+        int ssize;
+        if (ioctl(table->fd, BLKSSZGET, &ssize) == 0 &&
+            ssize >= SECTOR_SIZE && ssize <= 64 * 1024)
+            table->sectorSize = ssize;
+    }
+#endif
+
+    if ((size = lseek(table->fd, 0, SEEK_END)) <= 0)
+        return 1;
+    table->nsectors = size / table->sectorSize;
+    return 0;
+}
+
+/* Read the partition table of the disk of @pool in-process and hand
+ * each entry to virStorageBackendDiskMakeVol. Returns 1 if
+ * libvirt_parthelper has to be used instead */
+static int
+virStorageBackendDiskReadPartitionTable(virStoragePoolObjPtr pool,
+                                        virStorageVolDefPtr vol)
+{
+    const char *path = pool->def->source.devices[0].path;
+    virStorageBackendDiskTable table;
+    unsigned char *buf = NULL;
+    char *canonical = NULL;
+    const char *partsep;
+    char *groups[6] = { NULL };
+    size_t i;
+    int ret = -1;
+    int rc;
+
+    if ((rc = virStorageBackendDiskOpenTable(path, &table)) != 0) {
+        ret = rc;
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(buf, table.sectorSize) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if ((rc = virStorageBackendDiskReadMBR(&table, buf)) == 1) {
+        VIR_FREE(table.parts);
+        table.nparts = 0;
+        rc = virStorageBackendDiskReadGPT(&table, buf);
+    }
+    if (rc != 0) {
+        ret = rc;
+        goto cleanup;
+    }
+
+    /* Name the partitions the way libvirt_parthelper does */
+    if (virIsDevMapperDevice(path)) {
+        partsep = "p";
+        if (!(canonical = strdup(path))) {
+            virReportOOMError();
+            goto cleanup;
+        }
+    } else {
+        if (virFileResolveLink(path, &canonical) < 0) {
+            virReportSystemError(errno, _("cannot resolve '%s'"), path);
+            goto cleanup;
+        }
+        partsep = *canonical &&
+            c_isdigit(canonical[strlen(canonical) - 1]) ? "p" : "";
+    }
+
+    qsort(table.parts, table.nparts, sizeof(*table.parts),
+          virStorageBackendDiskPartCompare);
+
+    for (i = 0; i < table.nparts; i++) {
+        virStorageBackendDiskPartPtr part = &table.parts[i];
+        unsigned long long ssize = table.sectorSize;
+        size_t j;
+
+        if ((part->num == -1 ?
+             !(groups[0] = strdup("-")) :
+             virAsprintf(&groups[0], "%s%s%d",
+                         canonical, partsep, part->num) < 0) ||
+            !(groups[1] = strdup(part->type)) ||
+            !(groups[2] = strdup(part->content)) ||
+            virAsprintf(&groups[3], "%llu", part->start * ssize) < 0 ||
+            virAsprintf(&groups[4], "%llu", (part->end + 1) * ssize) < 0 ||
+            virAsprintf(&groups[5], "%llu",
+                        (part->end - part->start + 1) * ssize) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        rc = virStorageBackendDiskMakeVol(pool, 6, groups, vol);
+        for (j = 0; j < ARRAY_CARDINALITY(groups); j++)
+            VIR_FREE(groups[j]);
+        if (rc < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    for (i = 0; i < ARRAY_CARDINALITY(groups); i++)
+        VIR_FREE(groups[i]);
+    VIR_FORCE_CLOSE(table.fd);
+    VIR_FREE(table.parts);
+    VIR_FREE(canonical);
+    VIR_FREE(buf);
+    return ret;
+}
+
+
 /* To get a list of partitions we run an external helper
  * tool which then uses parted APIs. This is because
  * parted's API is not compatible with libvirt's license
@@ -269,13 +782,19 @@ virStorageBackendDiskReadPartitions(virStoragePoolObjPtr pool,
      * -              normal   metadata 100027630080 100030242304      2612736
      *
      */
-    virCommandPtr cmd = virCommandNewArgList(PARTHELPER,
-                                             pool->def->source.devices[0].path,
-                                             NULL);
+    virCommandPtr cmd;
     int ret;
 
     pool->def->allocation = pool->def->capacity = pool->def->available = 0;
 
+    if ((ret = virStorageBackendDiskReadPartitionTable(pool, vol)) <= 0)
+        return ret;
+
+    VIR_DEBUG("Partition table of '%s' not understood, using %s",
+              pool->def->source.devices[0].path, PARTHELPER);
+    cmd = virCommandNewArgList(PARTHELPER,
+                               pool->def->source.devices[0].path,
+                               NULL);
     ret = virStorageBackendRunProgNul(pool,
                                       cmd,
                                       6,
@@ -299,15 +818,59 @@ virStorageBackendDiskMakePoolGeometry(virStoragePoolObjPtr pool,
        return 0;
 }
 
+/* Get the geometry of the disk of @pool from the kernel, as parted
+ * does. Returns 1 if the kernel can not tell it */
+#ifdef HDIO_GETGEO
+static int
+virStorageBackendDiskGetGeometry(virStoragePoolObjPtr pool)
+{
+    virStoragePoolSourceDevicePtr dev = &pool->def->source.devices[0];
+    struct hd_geometry geo;
+    off_t size;
+    int fd;
+    int ret = 1;
+
+    if ((fd = open(dev->path, O_RDONLY)) < 0) {
+        virReportSystemError(errno, _("cannot open device '%s'"), dev->path);
+        return -1;
+    }
+
+    /* The cylinder count the kernel reports is truncated to 16 bits */
+    if (ioctl(fd, HDIO_GETGEO, &geo) == 0 &&
+        geo.heads && geo.sectors &&
+        (size = lseek(fd, 0, SEEK_END)) > 0) {
+        dev->geometry.cyliders = size / SECTOR_SIZE /
+            (geo.heads * geo.sectors);
+        dev->geometry.heads = geo.heads;
+        dev->geometry.sectors = geo.sectors;
+        ret = 0;
+    }
+
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+#else /* !HDIO_GETGEO */
+static int
+virStorageBackendDiskGetGeometry(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED)
+{
+    return 1;
+}
+#endif /* !HDIO_GETGEO */
+
 static int
 virStorageBackendDiskReadGeometry(virStoragePoolObjPtr pool)
 {
-    virCommandPtr cmd = virCommandNewArgList(PARTHELPER,
-                                             pool->def->source.devices[0].path,
-                                             "-g",
-                                             NULL);
+    virCommandPtr cmd;
     int ret;
 
+    if ((ret = virStorageBackendDiskGetGeometry(pool)) <= 0)
+        return ret;
+
+    cmd = virCommandNewArgList(PARTHELPER,
+                               pool->def->source.devices[0].path,
+                               "-g",
+                               NULL);
+
     ret = virStorageBackendRunProgNul(pool,
                                       cmd,
                                       3,
@@ -775,6 +1338,7 @@ cleanup:
 
 virStorageBackend virStorageBackendDisk = {
     .type = VIR_STORAGE_POOL_DISK,
+    .parallelAutostart = true,
 
     .buildPool = virStorageBackendDiskBuildPool,
     .refreshPool = virStorageBackendDiskRefreshPool,
@@ -50,6 +50,9 @@
 #include "xml.h"
 #include "virfile.h"
 #include "logging.h"
+#include "stat-time.h"
+#include "threadpool.h"
+#include "virhash.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -802,18 +805,252 @@ error:
 }
 
 
+/* Number of threads probing volumes in parallel during a refresh */
+#define VIR_STORAGE_FS_REFRESH_WORKERS 8
+
+typedef struct _virStorageBackendFileSystemProbeJob virStorageBackendFileSystemProbeJob;
+typedef virStorageBackendFileSystemProbeJob *virStorageBackendFileSystemProbeJobPtr;
+
+typedef struct _virStorageBackendFileSystemRefreshState virStorageBackendFileSystemRefreshState;
+typedef virStorageBackendFileSystemRefreshState *virStorageBackendFileSystemRefreshStatePtr;
+
+struct _virStorageBackendFileSystemRefreshState {
+    virMutex lock;
+    virCond cond;
+    size_t pending;
+    const char *path;
+};
+
+struct _virStorageBackendFileSystemProbeJob {
+    virStorageBackendFileSystemRefreshStatePtr state;
+    char *name;
+    /* volume of this name found by the previous refresh, or NULL */
+    virStorageVolDefPtr old;
+    virStorageVolDefPtr vol;
+    int ret;
+    virErrorPtr error;
+};
+
+
+static void
+virStorageBackendFileSystemStamp(virStorageVolProbeStampPtr stamp,
+                                 const struct stat *sb)
+{
+    stamp->valid = true;
+    stamp->dev = sb->st_dev;
+    stamp->ino = sb->st_ino;
+    stamp->size = sb->st_size;
+    stamp->mtime = get_stat_mtime(sb);
+    stamp->ctime = get_stat_ctime(sb);
+}
+
+
+static bool
+virStorageBackendFileSystemStampEqual(const virStorageVolProbeStamp *a,
+                                      const virStorageVolProbeStamp *b)
+{
+    return a->valid && b->valid &&
+        a->dev == b->dev &&
+        a->ino == b->ino &&
+        a->size == b->size &&
+        a->mtime.tv_sec == b->mtime.tv_sec &&
+        a->mtime.tv_nsec == b->mtime.tv_nsec &&
+        a->ctime.tv_sec == b->ctime.tv_sec &&
+        a->ctime.tv_nsec == b->ctime.tv_nsec;
+}
+
+
+static void
+virStorageBackendFileSystemRefreshBacking(virStorageVolDefPtr vol)
+{
+    if (vol->backingStore.path == NULL)
+        return;
+
+    if (virStorageBackendUpdateVolTargetInfo(&vol->backingStore,
+                                             NULL, NULL,
+                                             VIR_STORAGE_VOL_OPEN_DEFAULT) < 0) {
+        /* The backing file is currently unavailable, the capacity,
+         * allocation, owner, group and mode are unknown. Just log the
+         * error and continue.
+         * Unfortunately virStorageBackendProbeTarget() might already
+         * have logged a similar message for the same problem, but only
+         * if AUTO format detection was used. */
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot probe backing volume info: %s"),
+                       vol->backingStore.path);
+    }
+}
+
+
+/*
+ * Probe the volume @name of the pool directory @path.  If @old, the
+ * volume seen by the previous refresh, still refers to the very same
+ * unmodified file, it is reused instead of reading the image again.
+ *
+ * Returns 0 and sets @volret on success, -2 if @name is to be ignored,
+ * -1 on error
+ */
+static int
+virStorageBackendFileSystemProbeVol(const char *path,
+                                    const char *name,
+                                    virStorageVolDefPtr old,
+                                    virStorageVolDefPtr *volret)
+{
+    virStorageVolDefPtr vol = NULL;
+    virStorageVolProbeStamp stamp = { .valid = false };
+    struct stat sb;
+    char *backingStore;
+    int backingStoreFormat;
+    int ret;
+
+    if (VIR_ALLOC(vol) < 0)
+        goto no_memory;
+
+    if ((vol->name = strdup(name)) == NULL)
+        goto no_memory;
+
+    vol->type = VIR_STORAGE_VOL_FILE;
+    vol->target.format = VIR_STORAGE_FILE_RAW; /* Real value is filled in during probe */
+    if (virAsprintf(&vol->target.path, "%s/%s", path, vol->name) == -1)
+        goto no_memory;
+
+    /* Stat before probing, so a file changing during the probe looks
+     * modified to the next refresh */
+    if (stat(vol->target.path, &sb) == 0 && S_ISREG(sb.st_mode))
+        virStorageBackendFileSystemStamp(&stamp, &sb);
+
+    if (old && virStorageBackendFileSystemStampEqual(&stamp, &old->probed)) {
+        virStorageVolDefFree(vol);
+        virStorageBackendFileSystemRefreshBacking(old);
+        *volret = old;
+        return 0;
+    }
+
+    if ((vol->key = strdup(vol->target.path)) == NULL)
+        goto no_memory;
+
+    if ((ret = virStorageBackendProbeTarget(&vol->target,
+                                            &backingStore,
+                                            &backingStoreFormat,
+                                            &vol->allocation,
+                                            &vol->capacity,
+                                            &vol->target.encryption)) < 0) {
+        if (ret == -2) {
+            /* Silently ignore non-regular files,
+             * eg '.' '..', 'lost+found', dangling symbolic link */
+            virStorageVolDefFree(vol);
+            return -2;
+        } else if (ret == -3) {
+            /* The backing file is currently unavailable, its format is not
+             * explicitly specified, the probe to auto detect the format
+             * failed: continue with faked RAW format, since AUTO will
+             * break virStorageVolTargetDefFormat() generating the line
+             * <format type='...'/>. */
+            backingStoreFormat = VIR_STORAGE_FILE_RAW;
+        } else {
+            virStorageVolDefFree(vol);
+            return -1;
+        }
+    }
+
+    /* directory based volume */
+    if (vol->target.format == VIR_STORAGE_FILE_DIR)
+        vol->type = VIR_STORAGE_VOL_DIR;
+
+    if (backingStore != NULL) {
+        vol->backingStore.path = backingStore;
+        vol->backingStore.format = backingStoreFormat;
+        virStorageBackendFileSystemRefreshBacking(vol);
+    }
+
+    vol->probed = stamp;
+    *volret = vol;
+    return 0;
+
+no_memory:
+    virReportOOMError();
+    virStorageVolDefFree(vol);
+    return -1;
+}
+
+
+static void
+virStorageBackendFileSystemProbeWorker(void *jobdata,
+                                       void *opaque ATTRIBUTE_UNUSED)
+{
+    virStorageBackendFileSystemProbeJobPtr job = jobdata;
+    virStorageBackendFileSystemRefreshStatePtr state = job->state;
+
+    job->ret = virStorageBackendFileSystemProbeVol(state->path, job->name,
+                                                   job->old, &job->vol);
+    if (job->ret == -1)
+        job->error = virSaveLastError();
+
+    virMutexLock(&state->lock);
+    if (--state->pending == 0)
+        virCondSignal(&state->cond);
+    virMutexUnlock(&state->lock);
+}
+
+
+/**
+ * Update the size of the pool from its filesystem
+ */
+static int
+virStorageBackendFileSystemRefreshCapacity(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                           virStoragePoolObjPtr pool)
+{
+    struct statvfs sb;
+
+    if (statvfs(pool->def->target.path, &sb) < 0) {
+        virReportSystemError(errno,
+                             _("cannot statvfs path '%s'"),
+                             pool->def->target.path);
+        return -1;
+    }
+    pool->def->capacity = ((unsigned long long)sb.f_frsize *
+                           (unsigned long long)sb.f_blocks);
+    pool->def->available = ((unsigned long long)sb.f_bfree *
+                            (unsigned long long)sb.f_bsize);
+    pool->def->allocation = pool->def->capacity - pool->def->available;
+    return 0;
+}
+
+
 /**
  * Iterate over the pool's directory and enumerate all disk images
  * within it. This is non-recursive.
+ *
+ * Images are probed in parallel by a pool of worker threads.  Volumes
+ * left in pool->volumes by the previous refresh whose file is unchanged
+ * (same inode, size, mtime and ctime) are kept without being probed
+ * again.
  */
 static int
-virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
+virStorageBackendFileSystemRefresh(virConnectPtr conn,
                                    virStoragePoolObjPtr pool)
 {
-    DIR *dir;
+    DIR *dir = NULL;
     struct dirent *ent;
-    struct statvfs sb;
-    virStorageVolDefPtr vol = NULL;
+    virStorageVolDefList old = pool->volumes;
+    virHashTablePtr oldByName = NULL;
+    virStorageBackendFileSystemRefreshState state;
+    virStorageBackendFileSystemProbeJobPtr jobs = NULL;
+    size_t njobs = 0;
+    size_t maxjobs = 0;
+    virThreadPoolPtr workers = NULL;
+    bool stateInit = false;
+    int ret = -1;
+    size_t i;
+
+    memset(&pool->volumes, 0, sizeof(pool->volumes));
+
+    if (!(oldByName = virHashCreate(old.count, NULL)))
+        goto cleanup;
+    for (i = 0 ; i < old.count ; i++) {
+        if (virHashAddEntry(oldByName, old.objs[i]->name, old.objs[i]) < 0)
+            goto cleanup;
+    }
 
     if (!(dir = opendir(pool->def->target.path))) {
         virReportSystemError(errno,
@@ -823,95 +1060,84 @@ virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
     }
 
     while ((ent = readdir(dir)) != NULL) {
-        int ret;
-        char *backingStore;
-        int backingStoreFormat;
-
-        if (VIR_ALLOC(vol) < 0)
-            goto no_memory;
+        if (STREQ(ent->d_name, ".") || STREQ(ent->d_name, ".."))
+            continue;
 
-        if ((vol->name = strdup(ent->d_name)) == NULL)
+        if (VIR_RESIZE_N(jobs, maxjobs, njobs, 1) < 0)
             goto no_memory;
 
-        vol->type = VIR_STORAGE_VOL_FILE;
-        vol->target.format = VIR_STORAGE_FILE_RAW; /* Real value is filled in during probe */
-        if (virAsprintf(&vol->target.path, "%s/%s",
-                        pool->def->target.path,
-                        vol->name) == -1)
+        if (!(jobs[njobs].name = strdup(ent->d_name)))
             goto no_memory;
+        jobs[njobs].old = virHashLookup(oldByName, ent->d_name);
+        jobs[njobs].state = &state;
+        njobs++;
+    }
+    closedir(dir);
+    dir = NULL;
 
-        if ((vol->key = strdup(vol->target.path)) == NULL)
-            goto no_memory;
+    if (virMutexInit(&state.lock) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize mutex"));
+        goto cleanup;
+    }
+    if (virCondInit(&state.cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize condition variable"));
+        virMutexDestroy(&state.lock);
+        goto cleanup;
+    }
+    stateInit = true;
+    state.path = pool->def->target.path;
+    state.pending = 0;
+
+    if (njobs > 0 &&
+        !(workers = virThreadPoolNew(0, MIN(njobs,
+                                            VIR_STORAGE_FS_REFRESH_WORKERS),
+                                     0,
+                                     virStorageBackendFileSystemProbeWorker,
+                                     NULL)))
+        goto cleanup;
 
-        if ((ret = virStorageBackendProbeTarget(&vol->target,
-                                                &backingStore,
-                                                &backingStoreFormat,
-                                                &vol->allocation,
-                                                &vol->capacity,
-                                                &vol->target.encryption)) < 0) {
-            if (ret == -2) {
-                /* Silently ignore non-regular files,
-                 * eg '.' '..', 'lost+found', dangling symbolic link */
-                virStorageVolDefFree(vol);
-                vol = NULL;
-                continue;
-            } else if (ret == -3) {
-                /* The backing file is currently unavailable, its format is not
-                 * explicitly specified, the probe to auto detect the format
-                 * failed: continue with faked RAW format, since AUTO will
-                 * break virStorageVolTargetDefFormat() generating the line
-                 * <format type='...'/>. */
-                backingStoreFormat = VIR_STORAGE_FILE_RAW;
-            } else
-                goto cleanup;
-        }
+    for (i = 0 ; i < njobs ; i++) {
+        virMutexLock(&state.lock);
+        state.pending++;
+        virMutexUnlock(&state.lock);
 
-        /* directory based volume */
-        if (vol->target.format == VIR_STORAGE_FILE_DIR)
-            vol->type = VIR_STORAGE_VOL_DIR;
-
-        if (backingStore != NULL) {
-            vol->backingStore.path = backingStore;
-            vol->backingStore.format = backingStoreFormat;
-
-            if (virStorageBackendUpdateVolTargetInfo(&vol->backingStore,
-                                        NULL, NULL,
-                                        VIR_STORAGE_VOL_OPEN_DEFAULT) < 0) {
-                /* The backing file is currently unavailable, the capacity,
-                 * allocation, owner, group and mode are unknown. Just log the
-                 * error and continue.
-                 * Unfortunately virStorageBackendProbeTarget() might already
-                 * have logged a similar message for the same problem, but only
-                 * if AUTO format detection was used. */
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("cannot probe backing volume info: %s"),
-                               vol->backingStore.path);
-            }
+        if (virThreadPoolSendJob(workers, 0, &jobs[i]) < 0) {
+            /* probe it in this thread instead */
+            virResetLastError();
+            virStorageBackendFileSystemProbeWorker(&jobs[i], NULL);
         }
+    }
 
+    virMutexLock(&state.lock);
+    while (state.pending > 0)
+        ignore_value(virCondWait(&state.cond, &state.lock));
+    virMutexUnlock(&state.lock);
 
-        if (VIR_REALLOC_N(pool->volumes.objs,
-                          pool->volumes.count+1) < 0)
-            goto no_memory;
-        pool->volumes.objs[pool->volumes.count++] = vol;
-        vol = NULL;
+    /* Collect the results in directory order */
+    for (i = 0 ; i < njobs ; i++) {
+        if (jobs[i].ret == -1) {
+            virSetError(jobs[i].error);
+            goto cleanup;
+        }
     }
-    closedir(dir);
 
+    for (i = 0 ; i < njobs ; i++) {
+        if (jobs[i].ret == -2)
+            continue;
 
-    if (statvfs(pool->def->target.path, &sb) < 0) {
-        virReportSystemError(errno,
-                             _("cannot statvfs path '%s'"),
-                             pool->def->target.path);
-        return -1;
+        if (virStoragePoolObjAddVol(pool, jobs[i].vol) < 0)
+            goto cleanup;
+        if (jobs[i].vol == jobs[i].old)
+            virHashSteal(oldByName, jobs[i].old->name);
+        jobs[i].vol = NULL;
     }
-    pool->def->capacity = ((unsigned long long)sb.f_frsize *
-                           (unsigned long long)sb.f_blocks);
-    pool->def->available = ((unsigned long long)sb.f_bfree *
-                            (unsigned long long)sb.f_bsize);
-    pool->def->allocation = pool->def->capacity - pool->def->available;
 
-    return 0;
+    if (virStorageBackendFileSystemRefreshCapacity(conn, pool) < 0)
+        goto cleanup;
+
+    ret = 0;
+    goto cleanup;
 
 no_memory:
     virReportOOMError();
@@ -920,9 +1146,89 @@ no_memory:
  cleanup:
     if (dir)
         closedir(dir);
-    virStorageVolDefFree(vol);
-    virStoragePoolObjClearVols(pool);
-    return -1;
+    virThreadPoolFree(workers);
+    if (stateInit) {
+        ignore_value(virCondDestroy(&state.cond));
+        virMutexDestroy(&state.lock);
+    }
+    for (i = 0 ; i < njobs ; i++) {
+        if (jobs[i].vol != jobs[i].old)
+            virStorageVolDefFree(jobs[i].vol);
+        VIR_FREE(jobs[i].name);
+        virFreeError(jobs[i].error);
+    }
+    VIR_FREE(jobs);
+
+    /* Drop the volumes of the previous refresh which were not reused */
+    if (oldByName) {
+        for (i = 0 ; i < old.count ; i++) {
+            if (virHashLookup(oldByName, old.objs[i]->name) == old.objs[i])
+                virStorageVolDefFree(old.objs[i]);
+        }
+    } else {
+        for (i = 0 ; i < old.count ; i++)
+            virStorageVolDefFree(old.objs[i]);
+    }
+    virHashFree(oldByName);
+    VIR_FREE(old.objs);
+    virHashFree(old.byName);
+    virHashFree(old.byKey);
+    virHashFree(old.byPath);
+
+    if (ret < 0)
+        virStoragePoolObjClearVols(pool);
+    return ret;
+}
+
+
+/**
+ * Bring the single volume @name of the pool's directory up to date
+ * with the file system: add it if the file appeared, re-probe it if
+ * the file changed and drop it if the file went away.  Volumes being
+ * built or wiped are left alone, the job working on them refreshes
+ * them when it is done.
+ */
+static int
+virStorageBackendFileSystemRefreshEntry(virConnectPtr conn,
+                                        virStoragePoolObjPtr pool,
+                                        const char *name)
+{
+    virStorageVolDefPtr old = virStorageVolDefFindByName(pool, name);
+    virStorageVolDefPtr vol = NULL;
+    char *path = NULL;
+    struct stat sb;
+    int ret = -1;
+    int rc;
+
+    if (old && (old->building || old->job != VIR_STORAGE_VOL_JOB_NONE))
+        return 0;
+
+    if (virAsprintf(&path, "%s/%s", pool->def->target.path, name) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (lstat(path, &sb) < 0 && errno == ENOENT)
+        rc = -2;
+    else if ((rc = virStorageBackendFileSystemProbeVol(pool->def->target.path,
+                                                       name, old, &vol)) == -1)
+        goto cleanup;
+
+    if (old && (rc == -2 || vol != old)) {
+        virStoragePoolObjRemoveVol(pool, old);
+        virStorageVolDefFree(old);
+    }
+    if (rc != -2 && vol != old &&
+        virStoragePoolObjAddVol(pool, vol) < 0) {
+        virStorageVolDefFree(vol);
+        goto cleanup;
+    }
+
+    ret = virStorageBackendFileSystemRefreshCapacity(conn, pool);
+
+cleanup:
+    VIR_FREE(path);
+    return ret;
 }
 
 
@@ -1267,6 +1573,9 @@ virStorageBackend virStorageBackendDirectory = {
     .buildPool = virStorageBackendFileSystemBuild,
     .checkPool = virStorageBackendFileSystemCheck,
     .refreshPool = virStorageBackendFileSystemRefresh,
+    .refreshKeepsVols = true,
+    .refreshPoolCapacity = virStorageBackendFileSystemRefreshCapacity,
+    .refreshPoolEntry = virStorageBackendFileSystemRefreshEntry,
     .deletePool = virStorageBackendFileSystemDelete,
     .buildVol = virStorageBackendFileSystemVolBuild,
     .buildVolFrom = virStorageBackendFileSystemVolBuildFrom,
@@ -1284,6 +1593,9 @@ virStorageBackend virStorageBackendFileSystem = {
     .checkPool = virStorageBackendFileSystemCheck,
     .startPool = virStorageBackendFileSystemStart,
     .refreshPool = virStorageBackendFileSystemRefresh,
+    .refreshKeepsVols = true,
+    .refreshPoolCapacity = virStorageBackendFileSystemRefreshCapacity,
+    .refreshPoolEntry = virStorageBackendFileSystemRefreshEntry,
     .stopPool = virStorageBackendFileSystemStop,
     .deletePool = virStorageBackendFileSystemDelete,
     .buildVol = virStorageBackendFileSystemVolBuild,
@@ -1301,6 +1613,9 @@ virStorageBackend virStorageBackendNetFileSystem = {
     .startPool = virStorageBackendFileSystemStart,
     .findPoolSources = virStorageBackendFileSystemNetFindPoolSources,
     .refreshPool = virStorageBackendFileSystemRefresh,
+    .refreshKeepsVols = true,
+    .refreshPoolCapacity = virStorageBackendFileSystemRefreshCapacity,
+    .refreshPoolEntry = virStorageBackendFileSystemRefreshEntry,
     .stopPool = virStorageBackendFileSystemStop,
     .deletePool = virStorageBackendFileSystemDelete,
     .buildVol = virStorageBackendFileSystemVolBuild,
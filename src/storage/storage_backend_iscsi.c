@@ -43,6 +43,8 @@
 #include "virfile.h"
 #include "command.h"
 #include "virrandom.h"
+#include "virtime.h"
+#include "threads.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -117,26 +119,83 @@ virStorageBackendISCSIPortal(virStoragePoolSourcePtr source)
 }
 
 
+/*
+ * The sessions listed by 'iscsiadm --mode session' are kept for a
+ * short while, so that checking, starting and refreshing many pools
+ * at once runs and parses the command once rather than several times
+ * per pool. The lock also serializes the creation of iSCSI interfaces,
+ * so that pools sharing an initiator IQN being started concurrently do
+ * not each create one.
+ */
+#define ISCSI_SESSION_CACHE_TIME 2000 /* ms */
+
+struct virStorageBackendISCSISessionList {
+    size_t nsessions;
+    char **ids;
+    char **targets;
+};
+
+static virMutex virStorageBackendISCSILock;
+static struct virStorageBackendISCSISessionList virStorageBackendISCSISessions;
+static unsigned long long virStorageBackendISCSISessionsStamp;
+static bool virStorageBackendISCSISessionsValid;
+
 static int
-virStorageBackendISCSIExtractSession(virStoragePoolObjPtr pool,
+virStorageBackendISCSIOnceInit(void)
+{
+    if (virMutexInit(&virStorageBackendISCSILock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        return -1;
+    }
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virStorageBackendISCSI)
+
+static void
+virStorageBackendISCSISessionListClear(struct virStorageBackendISCSISessionList *list)
+{
+    size_t i;
+
+    for (i = 0; i < list->nsessions; i++) {
+        VIR_FREE(list->ids[i]);
+        VIR_FREE(list->targets[i]);
+    }
+    VIR_FREE(list->ids);
+    VIR_FREE(list->targets);
+    list->nsessions = 0;
+}
+
+static int
+virStorageBackendISCSIExtractSession(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
                                      char **const groups,
                                      void *data)
 {
-    char **session = data;
-
-    if (STREQ(groups[1], pool->def->source.devices[0].path)) {
-        if ((*session = strdup(groups[0])) == NULL) {
-            virReportOOMError();
-            return -1;
-        }
+    struct virStorageBackendISCSISessionList *list = data;
+    char *id = NULL;
+    char *target = NULL;
+
+    if (!(id = strdup(groups[0])) ||
+        !(target = strdup(groups[1])) ||
+        VIR_REALLOC_N(list->ids, list->nsessions + 1) < 0 ||
+        VIR_REALLOC_N(list->targets, list->nsessions + 1) < 0) {
+        VIR_FREE(id);
+        VIR_FREE(target);
+        virReportOOMError();
+        return -1;
     }
 
+    list->ids[list->nsessions] = id;
+    list->targets[list->nsessions] = target;
+    list->nsessions++;
+
     return 0;
 }
 
-static char *
-virStorageBackendISCSISession(virStoragePoolObjPtr pool,
-                              int probe)
+/* Must be called with virStorageBackendISCSILock held */
+static int
+virStorageBackendISCSILoadSessions(void)
 {
     /*
      * # iscsiadm --mode session
@@ -151,23 +210,106 @@ virStorageBackendISCSISession(virStoragePoolObjPtr pool,
     int vars[] = {
         2,
     };
-    char *session = NULL;
+    struct virStorageBackendISCSISessionList list = { 0, NULL, NULL };
+    unsigned long long now;
+    int ret = -1;
 
     virCommandPtr cmd = virCommandNewArgList(ISCSIADM, "--mode", "session", NULL);
 
+    if (virTimeMillisNow(&now) < 0)
+        goto cleanup;
+
     /* Note that we ignore the exitstatus.  Older versions of iscsiadm tools
      * returned an exit status of > 0, even if they succeeded.  We will just
      * rely on whether session got filled in properly.
      */
-    if (virStorageBackendRunProgRegex(pool,
+    if (virStorageBackendRunProgRegex(NULL,
                                       cmd,
                                       1,
                                       regexes,
                                       vars,
                                       virStorageBackendISCSIExtractSession,
-                                      &session, NULL) < 0)
+                                      &list, NULL) < 0)
         goto cleanup;
 
+    virStorageBackendISCSISessionListClear(&virStorageBackendISCSISessions);
+    virStorageBackendISCSISessions = list;
+    memset(&list, 0, sizeof(list));
+    virStorageBackendISCSISessionsStamp = now;
+    virStorageBackendISCSISessionsValid = true;
+    ret = 0;
+
+cleanup:
+    virStorageBackendISCSISessionListClear(&list);
+    virCommandFree(cmd);
+    return ret;
+}
+
+static void
+virStorageBackendISCSIInvalidateSessions(void)
+{
+    if (virStorageBackendISCSIInitialize() < 0)
+        return;
+
+    virMutexLock(&virStorageBackendISCSILock);
+    virStorageBackendISCSISessionsValid = false;
+    virMutexUnlock(&virStorageBackendISCSILock);
+}
+
+static int
+virStorageBackendISCSIFindSession(const char *target,
+                                  char **session)
+{
+    size_t i;
+
+    for (i = 0; i < virStorageBackendISCSISessions.nsessions; i++) {
+        if (STREQ(virStorageBackendISCSISessions.targets[i], target)) {
+            if (!(*session = strdup(virStorageBackendISCSISessions.ids[i]))) {
+                virReportOOMError();
+                return -1;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static char *
+virStorageBackendISCSISession(virStoragePoolObjPtr pool,
+                              int probe)
+{
+    const char *target = pool->def->source.devices[0].path;
+    char *session = NULL;
+    unsigned long long now;
+    bool loaded = false;
+    int found;
+
+    if (virStorageBackendISCSIInitialize() < 0)
+        return NULL;
+
+    virMutexLock(&virStorageBackendISCSILock);
+
+    if (virTimeMillisNow(&now) < 0)
+        goto cleanup;
+
+    if (!virStorageBackendISCSISessionsValid ||
+        now - virStorageBackendISCSISessionsStamp > ISCSI_SESSION_CACHE_TIME) {
+        if (virStorageBackendISCSILoadSessions() < 0)
+            goto cleanup;
+        loaded = true;
+    }
+
+    if ((found = virStorageBackendISCSIFindSession(target, &session)) < 0)
+        goto cleanup;
+
+    /* A session we need may have been logged in since the list was
+     * loaded, look again before giving up */
+    if (!found && !probe && !loaded) {
+        if (virStorageBackendISCSILoadSessions() < 0 ||
+            virStorageBackendISCSIFindSession(target, &session) < 0)
+            goto cleanup;
+    }
+
     if (session == NULL &&
         !probe) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -176,7 +318,7 @@ virStorageBackendISCSISession(virStoragePoolObjPtr pool,
     }
 
 cleanup:
-    virCommandFree(cmd);
+    virMutexUnlock(&virStorageBackendISCSILock);
     return session;
 }
 
@@ -372,20 +514,28 @@ virStorageBackendISCSIConnection(const char *portal,
     virCommandAddArgSet(cmd, extraargv);
 
     if (initiatoriqn) {
+        int rc = -1;
+
+        if (virStorageBackendISCSIInitialize() < 0)
+            goto cleanup;
+
+        virMutexLock(&virStorageBackendISCSILock);
         switch (virStorageBackendIQNFound(initiatoriqn, &ifacename)) {
         case IQN_FOUND:
             VIR_DEBUG("ifacename: '%s'", ifacename);
+            rc = 0;
             break;
         case IQN_MISSING:
-            if (virStorageBackendCreateIfaceIQN(initiatoriqn,
-                                                &ifacename) != 0) {
-                goto cleanup;
-            }
+            rc = virStorageBackendCreateIfaceIQN(initiatoriqn, &ifacename);
             break;
         case IQN_ERROR:
         default:
-            goto cleanup;
+            break;
         }
+        virMutexUnlock(&virStorageBackendISCSILock);
+
+        if (rc != 0)
+            goto cleanup;
         virCommandAddArgList(cmd, "--interface", ifacename, NULL);
     }
 
@@ -408,7 +558,6 @@ virStorageBackendISCSIFindLUs(virStoragePoolObjPtr pool,
 {
     char *sysfs_path;
     int retval = 0;
-    uint32_t host;
 
     if (virAsprintf(&sysfs_path,
                     "/sys/class/iscsi_session/session%s/device", session) < 0) {
@@ -416,19 +565,10 @@ virStorageBackendISCSIFindLUs(virStoragePoolObjPtr pool,
         return -1;
     }
 
-    if (virStorageBackendSCSIGetHostNumber(sysfs_path, &host) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to get host number for iSCSI session "
-                               "with path '%s'"),
-                             sysfs_path);
-        retval = -1;
-    }
-
-    if (virStorageBackendSCSIFindLUs(pool, host) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to find LUs on host %u"), host);
+    /* Only the targets of the session are looked at, rather than
+     * every LU of the SCSI bus */
+    if (virStorageBackendSCSIFindDeviceLUs(pool, sysfs_path) < 0)
         retval = -1;
-    }
 
     VIR_FREE(sysfs_path);
 
@@ -769,25 +909,24 @@ virStorageBackendISCSIStopPool(virConnectPtr conn ATTRIBUTE_UNUSED,
 {
     const char *logoutargv[] = { "--logout", NULL };
     char *portal;
-    int ret = -1;
+    int ret;
 
     if ((portal = virStorageBackendISCSIPortal(&pool->def->source)) == NULL)
         return -1;
 
-    if (virStorageBackendISCSIConnection(portal,
-                                         pool->def->source.initiator.iqn,
-                                         pool->def->source.devices[0].path,
-                                         logoutargv) < 0)
-        goto cleanup;
-    ret = 0;
+    ret = virStorageBackendISCSIConnection(portal,
+                                           pool->def->source.initiator.iqn,
+                                           pool->def->source.devices[0].path,
+                                           logoutargv);
+    virStorageBackendISCSIInvalidateSessions();
 
-cleanup:
     VIR_FREE(portal);
     return ret;
 }
 
 virStorageBackend virStorageBackendISCSI = {
     .type = VIR_STORAGE_POOL_ISCSI,
+    .parallelAutostart = true,
 
     .checkPool = virStorageBackendISCSICheckPool,
     .startPool = virStorageBackendISCSIStartPool,
@@ -26,7 +26,6 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <stdio.h>
-#include <regex.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -38,6 +37,7 @@
 #include "memory.h"
 #include "logging.h"
 #include "virfile.h"
+#include "c-ctype.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -62,32 +62,214 @@ virStorageBackendLogicalSetActive(virStoragePoolObjPtr pool,
 
 
 #define VIR_STORAGE_VOL_LOGICAL_SEGTYPE_STRIPED "striped"
+#define VIR_STORAGE_VOL_LOGICAL_SEGTYPE_THIN "thin"
+#define VIR_STORAGE_VOL_LOGICAL_SEGTYPE_THIN_POOL "thin-pool"
+
+/* Separator of the fields printed by lvs and vgs.  Encrypted logical
+ * volumes can print ':' in their name, so it is not a suitable
+ * separator (rhbz 470693), and the "devices" field has multiple device
+ * paths and "," if the volume is striped, so "," is not a suitable
+ * separator either (rhbz 727474).  */
+#define VIR_STORAGE_LOGICAL_SEPARATOR '#'
+
+typedef int (*virStorageBackendLogicalLineFunc)(virStoragePoolObjPtr pool,
+                                                char **const fields,
+                                                void *data);
+
+/*
+ * Split @line, printed by lvs or vgs with VIR_STORAGE_LOGICAL_SEPARATOR
+ * between its fields, into @nfields @fields, modifying it in place.
+ * Surrounding blanks are dropped, as is the trailing separator printed
+ * by some distros (e.g. SLES10 SP2).
+ *
+ * Returns true if @line has exactly @nfields fields.
+ */
+static bool
+virStorageBackendLogicalSplitLine(char *line,
+                                  char **fields,
+                                  size_t nfields)
+{
+    char *end;
+    size_t i;
+
+    while (c_isspace(*line))
+        line++;
+    end = line + strlen(line);
+    while (end > line && c_isspace(end[-1]))
+        end--;
+    if (end > line && end[-1] == VIR_STORAGE_LOGICAL_SEPARATOR)
+        end--;
+    *end = '\0';
+
+    if (!*line)
+        return false;
+
+    for (i = 0; i < nfields; i++) {
+        char *sep = strchr(line, VIR_STORAGE_LOGICAL_SEPARATOR);
+
+        fields[i] = line;
+        if (!sep)
+            return i == nfields - 1;
+        *sep = '\0';
+        line = sep + 1;
+    }
+
+    return false;
+}
+
+/*
+ * Run the lvs or vgs command @cmd and call @func with the @nfields
+ * fields of each line of its output.  Lines that don't have as many
+ * fields, such as warnings, are skipped.
+ *
+ * Returns the number of lines passed to @func, or -1 on error.
+ */
+static int
+virStorageBackendLogicalRunFields(virStoragePoolObjPtr pool,
+                                  virCommandPtr cmd,
+                                  size_t nfields,
+                                  virStorageBackendLogicalLineFunc func,
+                                  void *data)
+{
+    char *output = NULL;
+    char **fields = NULL;
+    char *line;
+    char *next;
+    int nlines = 0;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(fields, nfields) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    virCommandSetOutputBuffer(cmd, &output);
+    if (virCommandRun(cmd, NULL) < 0)
+        goto cleanup;
+
+    for (line = output; line && *line; line = next) {
+        if ((next = strchr(line, '\n')))
+            *next++ = '\0';
+
+        if (!virStorageBackendLogicalSplitLine(line, fields, nfields)) {
+            VIR_DEBUG("Ignoring line '%s'", line);
+            continue;
+        }
+
+        if (func(pool, fields, data) < 0)
+            goto cleanup;
+        nlines++;
+    }
+
+    ret = nlines;
+
+cleanup:
+    VIR_FREE(fields);
+    VIR_FREE(output);
+    return ret;
+}
+
+/*
+ * Parse the "devices" field @devices of a segment of @vol, which has a
+ * "path(extent)" pair for each of its @nextents stripes separated by
+ * ",", and add the extents to @vol.
+ */
+static int
+virStorageBackendLogicalParseExtents(virStorageVolDefPtr vol,
+                                     char *devices,
+                                     int nextents,
+                                     unsigned long long length,
+                                     unsigned long long size)
+{
+    int i;
+
+    if (VIR_REALLOC_N(vol->source.extents,
+                      vol->source.nextent + nextents) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (i = 0; i < nextents; i++) {
+        char *sep = NULL;
+        char *paren;
+        char *end;
+        unsigned long long offset;
+
+        if (i < nextents - 1) {
+            if (!(sep = strchr(devices, ',')))
+                goto malformed;
+            *sep = '\0';
+        }
+
+        /* The last '(', device paths may contain parentheses */
+        if (!(paren = strrchr(devices, '(')) || paren == devices ||
+            virStrToLong_ull(paren + 1, &end, 10, &offset) < 0 ||
+            STRNEQ(end, ")"))
+            goto malformed;
+        *paren = '\0';
+
+        if (!(vol->source.extents[vol->source.nextent].path =
+              strdup(devices))) {
+            virReportOOMError();
+            return -1;
+        }
+
+        vol->source.extents[vol->source.nextent].start = offset * size;
+        vol->source.extents[vol->source.nextent].end = (offset * size) + length;
+        vol->source.nextent++;
+
+        if (sep)
+            devices = sep + 1;
+    }
+
+    return 0;
+
+malformed:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("malformed volume extent devices value"));
+    return -1;
+}
+
+static int
+virStorageBackendLogicalUpdatePool(virStoragePoolObjPtr pool,
+                                   const char *size,
+                                   const char *avail)
+{
+    if (virStrToLong_ull(size, NULL, 10, &pool->def->capacity) < 0 ||
+        virStrToLong_ull(avail, NULL, 10, &pool->def->available) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed volume group size value"));
+        return -1;
+    }
+    pool->def->allocation = pool->def->capacity - pool->def->available;
+
+    return 0;
+}
 
 static int
 virStorageBackendLogicalMakeVol(virStoragePoolObjPtr pool,
-                                char **const groups,
+                                char **const fields,
                                 void *data)
 {
     virStorageVolDefPtr vol = NULL;
     bool is_new_vol = false;
-    unsigned long long offset, size, length;
-    const char *regex_unit = "(\\S+)\\((\\S+)\\)";
-    char *regex = NULL;
-    regex_t *reg = NULL;
-    regmatch_t *vars = NULL;
-    char *p = NULL;
-    int i, err, nextents, nvars, ret = -1;
+    unsigned long long size, length;
+    int nextents, ret = -1;
+
+    /* Every segment also describes the volume group */
+    if (virStorageBackendLogicalUpdatePool(pool, fields[10], fields[11]) < 0)
+        return -1;
 
     /* See if we're only looking for a specific volume */
     if (data != NULL) {
         vol = data;
-        if (STRNEQ(vol->name, groups[0]))
+        if (STRNEQ(vol->name, fields[0]))
             return 0;
     }
 
     /* Or filling in more data on an existing volume */
     if (vol == NULL)
-        vol = virStorageVolDefFindByName(pool, groups[0]);
+        vol = virStorageVolDefFindByName(pool, fields[0]);
 
     /* Or a completely new volume */
     if (vol == NULL) {
@@ -99,13 +281,7 @@ virStorageBackendLogicalMakeVol(virStoragePoolObjPtr pool,
         is_new_vol = true;
         vol->type = VIR_STORAGE_VOL_BLOCK;
 
-        if ((vol->name = strdup(groups[0])) == NULL) {
-            virReportOOMError();
-            goto cleanup;
-        }
-
-        if (VIR_REALLOC_N(pool->volumes.objs,
-                          pool->volumes.count + 1)) {
+        if ((vol->name = strdup(fields[0])) == NULL) {
             virReportOOMError();
             goto cleanup;
         }
@@ -126,9 +302,10 @@ virStorageBackendLogicalMakeVol(virStoragePoolObjPtr pool,
      * (lvs outputs "[$lvname_vorigin] for field "origin" if the
      *  lv is created with "--virtualsize").
      */
-    if (groups[1] && !STREQ(groups[1], "") && (groups[1][0] != '[')) {
+    if (!vol->backingStore.path &&
+        fields[1][0] != '\0' && fields[1][0] != '[') {
         if (virAsprintf(&vol->backingStore.path, "%s/%s",
-                        pool->def->target.path, groups[1]) < 0) {
+                        pool->def->target.path, fields[1]) < 0) {
             virReportOOMError();
             goto cleanup;
         }
@@ -137,170 +314,115 @@ virStorageBackendLogicalMakeVol(virStoragePoolObjPtr pool,
     }
 
     if (vol->key == NULL &&
-        (vol->key = strdup(groups[2])) == NULL) {
+        (vol->key = strdup(fields[2])) == NULL) {
         virReportOOMError();
         goto cleanup;
     }
 
-    if (virStorageBackendUpdateVolInfo(vol, 1) < 0)
+    if (virStrToLong_ull(fields[8], NULL, 10, &vol->allocation) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("malformed volume allocation value"));
         goto cleanup;
+    }
+    vol->capacity = vol->allocation;
 
-    nextents = 1;
-    if (STREQ(groups[4], VIR_STORAGE_VOL_LOGICAL_SEGTYPE_STRIPED)) {
-        if (virStrToLong_i(groups[5], NULL, 10, &nextents) < 0) {
+    /* A thin volume only uses as much of its thin pool as the data
+     * percent says, and has no extents of its own */
+    if (STREQ(fields[4], VIR_STORAGE_VOL_LOGICAL_SEGTYPE_THIN)) {
+        double percent;
+
+        if (virStrToDouble(fields[9], NULL, &percent) < 0 ||
+            percent < 0 || percent > 100) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("malformed volume extent stripes value"));
+                           _("malformed volume data percent value"));
             goto cleanup;
         }
-    }
+        vol->allocation = vol->capacity * percent / 100;
 
-    /* Finally fill in extents information */
-    if (VIR_REALLOC_N(vol->source.extents,
-                      vol->source.nextent + nextents) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
+        if (vol->source.nextent == 0 &&
+            (virStorageBackendUpdateVolTargetPerms(&vol->target) < 0 ||
+             (vol->backingStore.path &&
+              virStorageBackendUpdateVolTargetPerms(&vol->backingStore) < 0)))
+            goto cleanup;
 
-    if (virStrToLong_ull(groups[6], NULL, 10, &length) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       "%s", _("malformed volume extent length value"));
-        goto cleanup;
-    }
-    if (virStrToLong_ull(groups[7], NULL, 10, &size) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       "%s", _("malformed volume extent size value"));
-        goto cleanup;
-    }
-    if (virStrToLong_ull(groups[8], NULL, 10, &vol->allocation) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       "%s", _("malformed volume allocation value"));
-        goto cleanup;
+        goto done;
     }
 
-    /* Now parse the "devices" field separately */
-    regex = strdup(regex_unit);
+    /* The sizes come from lvs, only look at the device nodes once for
+     * their permissions rather than for every segment */
+    if (vol->source.nextent == 0 &&
+        (virStorageBackendUpdateVolTargetPerms(&vol->target) < 0 ||
+         (vol->backingStore.path &&
+          virStorageBackendUpdateVolTargetPerms(&vol->backingStore) < 0)))
+        goto cleanup;
 
-    for (i = 1; i < nextents; i++) {
-        if (VIR_REALLOC_N(regex, strlen(regex) + strlen(regex_unit) + 2) < 0) {
-            virReportOOMError();
+    nextents = 1;
+    if (STREQ(fields[4], VIR_STORAGE_VOL_LOGICAL_SEGTYPE_STRIPED)) {
+        if (virStrToLong_i(fields[5], NULL, 10, &nextents) < 0 ||
+            nextents < 1) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("malformed volume extent stripes value"));
             goto cleanup;
         }
-        /* "," is the separator of "devices" field */
-        strcat(regex, ",");
-        strncat(regex, regex_unit, strlen(regex_unit));
     }
 
-    if (VIR_ALLOC(reg) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
-    /* Each extent has a "path:offset" pair, and vars[0] will
-     * be the whole matched string.
-     */
-    nvars = (nextents * 2) + 1;
-    if (VIR_ALLOC_N(vars, nvars) < 0) {
-        virReportOOMError();
+    if (virStrToLong_ull(fields[6], NULL, 10, &length) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("malformed volume extent length value"));
         goto cleanup;
     }
-
-    err = regcomp(reg, regex, REG_EXTENDED);
-    if (err != 0) {
-        char error[100];
-        regerror(err, reg, error, sizeof(error));
+    if (virStrToLong_ull(fields[7], NULL, 10, &size) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Failed to compile regex %s"),
-                       error);
+                       "%s", _("malformed volume extent size value"));
         goto cleanup;
     }
 
-    if (regexec(reg, groups[3], nvars, vars, 0) != 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("malformed volume extent devices value"));
+    /* Finally fill in extents information */
+    if (virStorageBackendLogicalParseExtents(vol, fields[3], nextents,
+                                             length, size) < 0)
         goto cleanup;
-    }
-
-    p = groups[3];
-
-    /* vars[0] is skipped */
-    for (i = 0; i < nextents; i++) {
-        int j, len;
-        const char *offset_str = NULL;
-
-        j = (i * 2) + 1;
-        len = vars[j].rm_eo - vars[j].rm_so;
-        p[vars[j].rm_eo] = '\0';
-
-        if ((vol->source.extents[vol->source.nextent].path =
-            strndup(p + vars[j].rm_so, len)) == NULL) {
-            virReportOOMError();
-            goto cleanup;
-        }
 
-        len = vars[j + 1].rm_eo - vars[j + 1].rm_so;
-        if (!(offset_str = strndup(p + vars[j + 1].rm_so, len))) {
-            virReportOOMError();
-            goto cleanup;
-        }
-
-        if (virStrToLong_ull(offset_str, NULL, 10, &offset) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("malformed volume extent offset value"));
-            VIR_FREE(offset_str);
-            goto cleanup;
-        }
-
-        VIR_FREE(offset_str);
-
-        vol->source.extents[vol->source.nextent].start = offset * size;
-        vol->source.extents[vol->source.nextent].end = (offset * size) + length;
-        vol->source.nextent++;
-    }
-
-    if (is_new_vol)
-        pool->volumes.objs[pool->volumes.count++] = vol;
+done:
+    if (is_new_vol && virStoragePoolObjAddVol(pool, vol) < 0)
+        goto cleanup;
 
     ret = 0;
 
 cleanup:
-    VIR_FREE(regex);
-    VIR_FREE(reg);
-    VIR_FREE(vars);
     if (is_new_vol && (ret == -1))
         virStorageVolDefFree(vol);
     return ret;
 }
 
+/*
+ * Returns the number of segments found, and updates the size of the
+ * pool from them, or -1 on error.
+ */
 static int
 virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
                                 virStorageVolDefPtr vol)
 {
     /*
-     *  # lvs --separator , --noheadings --units b --unbuffered --nosuffix --options "lv_name,origin,uuid,devices,seg_size,vg_extent_size,size" VGNAME
-     *  RootLV,,06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky,/dev/hda2(0),5234491392,33554432,5234491392
-     *  SwapLV,,oHviCK-8Ik0-paqS-V20c-nkhY-Bm1e-zgzU0M,/dev/hda2(156),1040187392,33554432,1040187392
-     *  Test2,,3pg3he-mQsA-5Sui-h0i6-HNmc-Cz7W-QSndcR,/dev/hda2(219),1073741824,33554432,1073741824
-     *  Test3,,UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht,/dev/hda2(251),2181038080,33554432,2181038080
-     *  Test3,Test2,UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht,/dev/hda2(187),1040187392,33554432,1040187392
+     *  # lvs --separator # --noheadings --units b --unbuffered --nosuffix --options "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size,data_percent,vg_size,vg_free" VGNAME
+     *  RootLV##06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky#/dev/hda2(0)#linear#1#5234491392#33554432#5234491392##10603200512#4328521728
+     *  SwapLV##oHviCK-8Ik0-paqS-V20c-nkhY-Bm1e-zgzU0M#/dev/hda2(156)#linear#1#1040187392#33554432#1040187392##10603200512#4328521728
+     *  Test2##3pg3he-mQsA-5Sui-h0i6-HNmc-Cz7W-QSndcR#/dev/hda2(219)#linear#1#1073741824#33554432#1073741824##10603200512#4328521728
+     *  Test3##UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht#/dev/hda2(251)#linear#1#2181038080#33554432#2181038080##10603200512#4328521728
+     *  Test3#Test2#UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht#/dev/hda2(187)#linear#1#1040187392#33554432#1040187392##10603200512#4328521728
+     *  ThinPool##Wc2Ri8-wq7K-4gqa-f1fV-FJd3-lm5a-c3bXnV#ThinPool_tdata(0)#thin-pool#1#4294967296#33554432#4294967296#12.50#10603200512#4328521728
+     *  Golden##yC8Ilk-ZmPa-GiIm-S7ma-D6rD-ew0w-IRCfVC##thin#0#2147483648#33554432#2147483648#25.00#10603200512#4328521728
+     *  Clone1#Golden#0Njzyn-P2V6-G1Zk-s1jg-SE3d-7wWM-Lmtxdj##thin#0#2147483648#33554432#2147483648#25.10#10603200512#4328521728
      *
-     * Pull out name, origin, & uuid, device, device extent start #, segment size, extent size.
+     * Pull out name, origin, & uuid, device, device extent start #,
+     * segment size, extent size, volume size, data percent and the size
+     * & free space of the volume group, so that a single lvs call
+     * describes the whole pool.  The data percent is only set for thin
+     * pools, thin volumes and snapshots, and is what a thin volume
+     * really uses.
      *
      * NB can be multiple rows per volume if they have many extents
-     *
-     * NB lvs from some distros (e.g. SLES10 SP2) outputs trailing "," on each line
-     *
-     * NB Encrypted logical volumes can print ':' in their name, so it is
-     *    not a suitable separator (rhbz 470693).
-     * NB "devices" field has multiple device paths and "," if the volume is
-     *    striped, so "," is not a suitable separator either (rhbz 727474).
      */
-    const char *regexes[] = {
-       "^\\s*(\\S+)#(\\S*)#(\\S+)#(\\S+)#(\\S+)#([0-9]+)#(\\S+)#([0-9]+)#([0-9]+)#?\\s*$"
-    };
-    int vars[] = {
-        9
-    };
-    int ret = -1;
+    int ret;
     virCommandPtr cmd;
 
     cmd = virCommandNewArgList(LVS,
@@ -309,36 +431,22 @@ virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
                                "--units", "b",
                                "--unbuffered",
                                "--nosuffix",
-                               "--options", "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size",
+                               "--options", "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,size,data_percent,vg_size,vg_free",
                                pool->def->source.name,
                                NULL);
-    if (virStorageBackendRunProgRegex(pool,
-                                      cmd,
-                                      1,
-                                      regexes,
-                                      vars,
-                                      virStorageBackendLogicalMakeVol,
-                                      vol, "lvs") < 0)
-        goto cleanup;
-
-    ret = 0;
-cleanup:
+    ret = virStorageBackendLogicalRunFields(pool, cmd, 12,
+                                            virStorageBackendLogicalMakeVol,
+                                            vol);
     virCommandFree(cmd);
     return ret;
 }
 
 static int
-virStorageBackendLogicalRefreshPoolFunc(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
-                                        char **const groups,
+virStorageBackendLogicalRefreshPoolFunc(virStoragePoolObjPtr pool,
+                                        char **const fields,
                                         void *data ATTRIBUTE_UNUSED)
 {
-    if (virStrToLong_ull(groups[0], NULL, 10, &pool->def->capacity) < 0)
-        return -1;
-    if (virStrToLong_ull(groups[1], NULL, 10, &pool->def->available) < 0)
-        return -1;
-    pool->def->allocation = pool->def->capacity - pool->def->available;
-
-    return 0;
+    return virStorageBackendLogicalUpdatePool(pool, fields[0], fields[1]);
 }
 
 
@@ -575,35 +683,22 @@ cleanup:
 }
 
 
+/*
+ * Update the size of the pool from the volume group alone
+ */
 static int
-virStorageBackendLogicalRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
-                                    virStoragePoolObjPtr pool)
+virStorageBackendLogicalRefreshCapacity(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                        virStoragePoolObjPtr pool)
 {
+    virCommandPtr cmd;
+    int ret;
+
     /*
-     *  # vgs --separator : --noheadings --units b --unbuffered --nosuffix --options "vg_size,vg_free" VGNAME
-     *    10603200512:4328521728
-     *
-     * Pull out size & free
-     *
-     * NB vgs from some distros (e.g. SLES10 SP2) outputs trailing ":" on each line
+     *  # vgs --separator # --noheadings --units b --unbuffered --nosuffix --options "vg_size,vg_free" VGNAME
+     *    10603200512#4328521728
      */
-    const char *regexes[] = {
-        "^\\s*(\\S+):([0-9]+):?\\s*$"
-    };
-    int vars[] = {
-        2
-    };
-    virCommandPtr cmd = NULL;
-    int ret = -1;
-
-    virFileWaitForDevices();
-
-    /* Get list of all logical volumes */
-    if (virStorageBackendLogicalFindLVs(pool, NULL) < 0)
-        goto cleanup;
-
     cmd = virCommandNewArgList(VGS,
-                               "--separator", ":",
+                               "--separator", "#",
                                "--noheadings",
                                "--units", "b",
                                "--unbuffered",
@@ -612,20 +707,35 @@ virStorageBackendLogicalRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
                                pool->def->source.name,
                                NULL);
 
-    /* Now get basic volgrp metadata */
-    if (virStorageBackendRunProgRegex(pool,
-                                      cmd,
-                                      1,
-                                      regexes,
-                                      vars,
-                                      virStorageBackendLogicalRefreshPoolFunc,
-                                      NULL, "vgs") < 0)
+    ret = virStorageBackendLogicalRunFields(pool, cmd, 2,
+                                            virStorageBackendLogicalRefreshPoolFunc,
+                                            NULL);
+    virCommandFree(cmd);
+    return ret < 0 ? -1 : 0;
+}
+
+static int
+virStorageBackendLogicalRefreshPool(virConnectPtr conn,
+                                    virStoragePoolObjPtr pool)
+{
+    int nsegments;
+    int ret = -1;
+
+    virFileWaitForDevices();
+
+    /* Get list of all logical volumes, along with the size of the
+     * volume group */
+    if ((nsegments = virStorageBackendLogicalFindLVs(pool, NULL)) < 0)
+        goto cleanup;
+
+    /* Without any volume, ask for the size & free space separately */
+    if (nsegments == 0 &&
+        virStorageBackendLogicalRefreshCapacity(conn, pool) < 0)
         goto cleanup;
 
     ret = 0;
 
 cleanup:
-    virCommandFree(cmd);
     if (ret < 0)
         virStoragePoolObjClearVols(pool);
     return ret;
@@ -692,6 +802,58 @@ virStorageBackendLogicalDeleteVol(virConnectPtr conn,
                                   unsigned int flags);
 
 
+struct virStorageBackendLogicalThinData {
+    const char *origin;
+    bool originThin;
+    char *thinpool;
+};
+
+static int
+virStorageBackendLogicalFindThinFunc(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                                     char **const fields,
+                                     void *opaque)
+{
+    struct virStorageBackendLogicalThinData *data = opaque;
+
+    if (STREQ(fields[1], VIR_STORAGE_VOL_LOGICAL_SEGTYPE_THIN_POOL) &&
+        !data->thinpool &&
+        !(data->thinpool = strdup(fields[0]))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (data->origin && STREQ(fields[0], data->origin) &&
+        STREQ(fields[1], VIR_STORAGE_VOL_LOGICAL_SEGTYPE_THIN))
+        data->originThin = true;
+
+    return 0;
+}
+
+/*
+ * Look for the first thin pool of the volume group, and whether the
+ * logical volume @data->origin, if any, is a thin volume.
+ */
+static int
+virStorageBackendLogicalFindThin(virStoragePoolObjPtr pool,
+                                 struct virStorageBackendLogicalThinData *data)
+{
+    int ret;
+    virCommandPtr cmd;
+
+    cmd = virCommandNewArgList(LVS,
+                               "--separator", "#",
+                               "--noheadings",
+                               "--unbuffered",
+                               "--options", "lv_name,segtype",
+                               pool->def->source.name,
+                               NULL);
+    ret = virStorageBackendLogicalRunFields(pool, cmd, 2,
+                                            virStorageBackendLogicalFindThinFunc,
+                                            data);
+    virCommandFree(cmd);
+    return ret < 0 ? -1 : 0;
+}
+
 static int
 virStorageBackendLogicalCreateVol(virConnectPtr conn,
                                   virStoragePoolObjPtr pool,
@@ -700,6 +862,7 @@ virStorageBackendLogicalCreateVol(virConnectPtr conn,
     int fdret, fd = -1;
     virCommandPtr cmd = NULL;
     virErrorPtr err;
+    struct virStorageBackendLogicalThinData thin = { NULL, false, NULL };
 
     if (vol->target.encryption != NULL) {
         virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
@@ -722,20 +885,45 @@ virStorageBackendLogicalCreateVol(virConnectPtr conn,
         return -1;
     }
 
+    /* Snapshots of thin volumes and sparse volumes go to a thin pool
+     * when the volume group has one: they are created instantly and,
+     * unlike old-style snapshots, don't slow down writes */
+    if (vol->backingStore.path) {
+        if ((thin.origin = strrchr(vol->backingStore.path, '/')))
+            thin.origin++;
+        else
+            thin.origin = vol->backingStore.path;
+    }
+    if ((vol->backingStore.path || vol->capacity != vol->allocation) &&
+        virStorageBackendLogicalFindThin(pool, &thin) < 0)
+        goto cleanup;
+
     cmd = virCommandNewArgList(LVCREATE,
                                "--name", vol->name,
                                NULL);
-    virCommandAddArg(cmd, "-L");
-    if (vol->capacity != vol->allocation) {
-        virCommandAddArgFormat(cmd, "%lluK",
-                VIR_DIV_UP(vol->allocation ? vol->allocation : 1, 1024));
-        virCommandAddArg(cmd, "--virtualsize");
-    }
-    virCommandAddArgFormat(cmd, "%lluK", VIR_DIV_UP(vol->capacity, 1024));
-    if (vol->backingStore.path)
-        virCommandAddArgPair(cmd, "-s", vol->backingStore.path);
-    else
-        virCommandAddArg(cmd, pool->def->source.name);
+    if (thin.originThin) {
+        /* Shares the thin pool and size of its origin */
+        virCommandAddArgList(cmd, "-s", vol->backingStore.path, NULL);
+    } else if (!vol->backingStore.path &&
+               vol->capacity != vol->allocation && thin.thinpool) {
+        virCommandAddArg(cmd, "-V");
+        virCommandAddArgFormat(cmd, "%lluK", VIR_DIV_UP(vol->capacity, 1024));
+        virCommandAddArg(cmd, "-T");
+        virCommandAddArgFormat(cmd, "%s/%s",
+                               pool->def->source.name, thin.thinpool);
+    } else {
+        virCommandAddArg(cmd, "-L");
+        if (vol->capacity != vol->allocation) {
+            virCommandAddArgFormat(cmd, "%lluK",
+                    VIR_DIV_UP(vol->allocation ? vol->allocation : 1, 1024));
+            virCommandAddArg(cmd, "--virtualsize");
+        }
+        virCommandAddArgFormat(cmd, "%lluK", VIR_DIV_UP(vol->capacity, 1024));
+        if (vol->backingStore.path)
+            virCommandAddArgList(cmd, "-s", vol->backingStore.path, NULL);
+        else
+            virCommandAddArg(cmd, pool->def->source.name);
+    }
 
     if (virCommandRun(cmd, NULL) < 0)
         goto cleanup;
@@ -776,6 +964,8 @@ virStorageBackendLogicalCreateVol(virConnectPtr conn,
         goto cleanup;
     }
 
+    virCommandFree(cmd);
+    VIR_FREE(thin.thinpool);
     return 0;
 
  cleanup:
@@ -783,7 +973,9 @@ virStorageBackendLogicalCreateVol(virConnectPtr conn,
     VIR_FORCE_CLOSE(fd);
     virStorageBackendLogicalDeleteVol(conn, pool, vol, 0);
     virCommandFree(cmd);
+    VIR_FREE(thin.thinpool);
     virSetError(err);
+    virFreeError(err);
     return -1;
 }
 
@@ -853,6 +1045,7 @@ virStorageBackend virStorageBackendLogical = {
     .startPool = virStorageBackendLogicalStartPool,
     .buildPool = virStorageBackendLogicalBuildPool,
     .refreshPool = virStorageBackendLogicalRefreshPool,
+    .refreshPoolCapacity = virStorageBackendLogicalRefreshCapacity,
     .stopPool = virStorageBackendLogicalStopPool,
     .deletePool = virStorageBackendLogicalDeletePool,
     .buildVol = NULL,
@@ -104,12 +104,8 @@ virStorageBackendMpathNewVol(virStoragePoolObjPtr pool,
         goto cleanup;
     }
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count + 1) < 0) {
-        virReportOOMError();
+    if (virStoragePoolObjAddVol(pool, vol) < 0)
         goto cleanup;
-    }
-    pool->volumes.objs[pool->volumes.count++] = vol;
     pool->def->capacity += vol->capacity;
     pool->def->allocation += vol->allocation;
     ret = 0;
@@ -30,6 +30,8 @@
 #include "logging.h"
 #include "base64.h"
 #include "uuid.h"
+#include "threads.h"
+#include "virhash.h"
 #include "rados/librados.h"
 #include "rbd/librbd.h"
 
@@ -42,9 +44,12 @@ struct _virStorageBackendRBDState {
 };
 
 typedef struct _virStorageBackendRBDState virStorageBackendRBDState;
-typedef virStorageBackendRBDState virStorageBackendRBDStatePtr;
+typedef virStorageBackendRBDState *virStorageBackendRBDStatePtr;
 
-static int virStorageBackendRBDOpenRADOSConn(virStorageBackendRBDStatePtr *ptr,
+static virMutex virStorageBackendRBDLock;
+static virHashTablePtr virStorageBackendRBDStates; /* by pool UUID */
+
+static int virStorageBackendRBDOpenRADOSConn(virStorageBackendRBDStatePtr ptr,
                                              virConnectPtr conn,
                                              virStoragePoolObjPtr pool)
 {
@@ -181,28 +186,129 @@ cleanup:
     return ret;
 }
 
-static int virStorageBackendRBDCloseRADOSConn(virStorageBackendRBDStatePtr ptr)
+static void
+virStorageBackendRBDStateFree(void *payload,
+                              const void *name ATTRIBUTE_UNUSED)
 {
-    int ret = 0;
+    virStorageBackendRBDStatePtr ptr = payload;
+    time_t runtime;
+
+    if (!ptr)
+        return;
 
-    if (ptr.ioctx != NULL) {
+    if (ptr->ioctx != NULL) {
         VIR_DEBUG("Closing RADOS IoCTX");
-        rados_ioctx_destroy(ptr.ioctx);
-        ret = -1;
+        rados_ioctx_destroy(ptr->ioctx);
     }
-    ptr.ioctx = NULL;
 
-    if (ptr.cluster != NULL) {
+    if (ptr->cluster != NULL) {
         VIR_DEBUG("Closing RADOS connection");
-        rados_shutdown(ptr.cluster);
-        ret = -2;
+        rados_shutdown(ptr->cluster);
     }
-    ptr.cluster = NULL;
 
-    time_t runtime = time(0) - ptr.starttime;
-    VIR_DEBUG("RADOS connection existed for %ld seconds", runtime);
+    runtime = time(0) - ptr->starttime;
+    VIR_DEBUG("RADOS connection existed for %ld seconds", (long)runtime);
 
-    return ret;
+    VIR_FREE(ptr);
+}
+
+static int
+virStorageBackendRBDOnceInit(void)
+{
+    if (virMutexInit(&virStorageBackendRBDLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        return -1;
+    }
+
+    if (!(virStorageBackendRBDStates =
+          virHashCreate(8, virStorageBackendRBDStateFree)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virStorageBackendRBD)
+
+/*
+ * Get the connection to the cluster of @pool, along with an I/O context
+ * for its RADOS pool, connecting the first time.  The connection is
+ * kept until the pool is stopped, so that refreshing the pool or
+ * working on its volumes does not have to wait for the monitors each
+ * time.  It remains valid as long as the pool is active, which is
+ * guaranteed by the pool lock or by a job running on the pool.
+ */
+static virStorageBackendRBDStatePtr
+virStorageBackendRBDGetState(virConnectPtr conn,
+                             virStoragePoolObjPtr pool)
+{
+    char uuid[VIR_UUID_STRING_BUFLEN];
+    virStorageBackendRBDStatePtr ptr;
+    virStorageBackendRBDStatePtr other;
+
+    if (virStorageBackendRBDInitialize() < 0)
+        return NULL;
+
+    virUUIDFormat(pool->def->uuid, uuid);
+
+    virMutexLock(&virStorageBackendRBDLock);
+    ptr = virHashLookup(virStorageBackendRBDStates, uuid);
+    virMutexUnlock(&virStorageBackendRBDLock);
+
+    if (ptr)
+        return ptr;
+
+    if (VIR_ALLOC(ptr) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (virStorageBackendRBDOpenRADOSConn(ptr, conn, pool) < 0)
+        goto error;
+
+    if (rados_ioctx_create(ptr->cluster,
+        pool->def->source.name, &ptr->ioctx) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("failed to create the RBD IoCTX. Does the pool '%s' exist?"),
+                       pool->def->source.name);
+        goto error;
+    }
+
+    /* Connecting takes a while and is done unlocked, a job running on
+     * the pool may have connected in the meantime */
+    virMutexLock(&virStorageBackendRBDLock);
+    if ((other = virHashLookup(virStorageBackendRBDStates, uuid))) {
+        virMutexUnlock(&virStorageBackendRBDLock);
+        virStorageBackendRBDStateFree(ptr, NULL);
+        return other;
+    }
+    if (virHashAddEntry(virStorageBackendRBDStates, uuid, ptr) < 0) {
+        virMutexUnlock(&virStorageBackendRBDLock);
+        goto error;
+    }
+    virMutexUnlock(&virStorageBackendRBDLock);
+
+    return ptr;
+
+error:
+    virStorageBackendRBDStateFree(ptr, NULL);
+    return NULL;
+}
+
+/* Close the connection to the cluster of @pool, if there is one */
+static void
+virStorageBackendRBDDropState(virStoragePoolObjPtr pool)
+{
+    char uuid[VIR_UUID_STRING_BUFLEN];
+
+    if (virStorageBackendRBDInitialize() < 0)
+        return;
+
+    virUUIDFormat(pool->def->uuid, uuid);
+
+    virMutexLock(&virStorageBackendRBDLock);
+    ignore_value(virHashRemoveEntry(virStorageBackendRBDStates, uuid));
+    virMutexUnlock(&virStorageBackendRBDLock);
 }
 
 static int volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
@@ -211,7 +317,7 @@ static int volStorageBackendRBDRefreshVolInfo(virStorageVolDefPtr vol,
 {
     int ret = -1;
     rbd_image_t image;
-    if (rbd_open(ptr.ioctx, vol->name, &image, NULL) < 0) {
+    if (rbd_open(ptr->ioctx, vol->name, &image, NULL) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("failed to open the RBD image '%s'"),
                        vol->name);
@@ -257,7 +363,7 @@ cleanup:
     return ret;
 }
 
-static int virStorageBackendRBDRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
+static int virStorageBackendRBDRefreshPool(virConnectPtr conn,
                                            virStoragePoolObjPtr pool)
 {
     size_t max_size = 1024;
@@ -266,30 +372,19 @@ static int virStorageBackendRBDRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
     int i;
     char *name, *names = NULL;
     virStorageBackendRBDStatePtr ptr;
-    ptr.cluster = NULL;
-    ptr.ioctx = NULL;
 
-    if (virStorageBackendRBDOpenRADOSConn(&ptr, conn, pool) < 0) {
+    if (!(ptr = virStorageBackendRBDGetState(conn, pool)))
         goto cleanup;
-    }
-
-    if (rados_ioctx_create(ptr.cluster,
-        pool->def->source.name, &ptr.ioctx) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("failed to create the RBD IoCTX. Does the pool '%s' exist?"),
-                       pool->def->source.name);
-        goto cleanup;
-    }
 
     struct rados_cluster_stat_t stat;
-    if (rados_cluster_stat(ptr.cluster, &stat) < 0) {
+    if (rados_cluster_stat(ptr->cluster, &stat) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("failed to stat the RADOS cluster"));
         goto cleanup;
     }
 
     struct rados_pool_stat_t poolstat;
-    if (rados_ioctx_pool_stat(ptr.ioctx, &poolstat) < 0) {
+    if (rados_ioctx_pool_stat(ptr->ioctx, &poolstat) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("failed to stat the RADOS pool '%s'"),
                        pool->def->source.name);
@@ -309,21 +404,17 @@ static int virStorageBackendRBDRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
         if (VIR_ALLOC_N(names, max_size) < 0)
             goto out_of_memory;
 
-        len = rbd_list(ptr.ioctx, names, &max_size);
+        len = rbd_list(ptr->ioctx, names, &max_size);
         if (len >= 0)
             break;
         if (len != -ERANGE) {
             VIR_WARN("%s", _("A problem occurred while listing RBD images"));
             goto cleanup;
         }
+        VIR_FREE(names);
     }
 
     for (i = 0, name = names; name < names + max_size; i++) {
-        if (VIR_REALLOC_N(pool->volumes.objs, pool->volumes.count + 1) < 0) {
-            virStoragePoolObjClearVols(pool);
-            goto out_of_memory;
-        }
-
         virStorageVolDefPtr vol;
         if (VIR_ALLOC(vol) < 0)
             goto out_of_memory;
@@ -340,7 +431,11 @@ static int virStorageBackendRBDRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
         if (volStorageBackendRBDRefreshVolInfo(vol, pool, ptr) < 0)
             goto cleanup;
 
-        pool->volumes.objs[pool->volumes.count++] = vol;
+        if (virStoragePoolObjAddVol(pool, vol) < 0) {
+            virStorageVolDefFree(vol);
+            virStoragePoolObjClearVols(pool);
+            goto cleanup;
+        }
     }
 
     VIR_DEBUG("Found %d images in RBD pool %s",
@@ -350,7 +445,9 @@ static int virStorageBackendRBDRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
 
 cleanup:
     VIR_FREE(names);
-    virStorageBackendRBDCloseRADOSConn(ptr);
+    /* Connect again next time, in case the cluster went away */
+    if (ret < 0)
+        virStorageBackendRBDDropState(pool);
     return ret;
 
 out_of_memory:
@@ -358,6 +455,55 @@ out_of_memory:
     goto cleanup;
 }
 
+static int virStorageBackendRBDStopPool(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                        virStoragePoolObjPtr pool)
+{
+    virStorageBackendRBDDropState(pool);
+    return 0;
+}
+
+#ifdef RBD_FEATURE_LAYERING
+# define VIR_STORAGE_RBD_CLONE_SNAP_PREFIX "libvirt-clone-"
+
+/*
+ * Have the parent snapshot of the image @name, if it is one libvirt
+ * took to clone @name from, removed along with @name.
+ */
+static void
+virStorageBackendRBDRemoveCloneSnap(virStorageBackendRBDStatePtr ptr,
+                                    rbd_image_t image,
+                                    const char *name)
+{
+    char parent_pool[128];
+    char parent_name[RBD_MAX_IMAGE_NAME_SIZE];
+    char parent_snap[RBD_MAX_IMAGE_NAME_SIZE +
+                     sizeof(VIR_STORAGE_RBD_CLONE_SNAP_PREFIX)];
+    rbd_image_t parent = NULL;
+    const char *snapname;
+
+    if (rbd_get_parent_info(image, parent_pool, sizeof(parent_pool),
+                            parent_name, sizeof(parent_name),
+                            parent_snap, sizeof(parent_snap)) < 0)
+        return;
+
+    if (!(snapname = STRSKIP(parent_snap, VIR_STORAGE_RBD_CLONE_SNAP_PREFIX)) ||
+        STRNEQ(snapname, name))
+        return;
+
+    if (rbd_open(ptr->ioctx, parent_name, &parent, NULL) < 0)
+        return;
+
+    VIR_DEBUG("Removing snapshot %s@%s cloned to %s",
+              parent_name, parent_snap, name);
+    if (rbd_snap_unprotect(parent, parent_snap) < 0 ||
+        rbd_snap_remove(parent, parent_snap) < 0)
+        VIR_WARN("cannot remove snapshot '%s@%s' of RBD image",
+                 parent_name, parent_snap);
+
+    rbd_close(parent);
+}
+#endif
+
 static int virStorageBackendRBDDeleteVol(virConnectPtr conn,
                                          virStoragePoolObjPtr pool,
                                          virStorageVolDefPtr vol,
@@ -365,8 +511,9 @@ static int virStorageBackendRBDDeleteVol(virConnectPtr conn,
 {
     int ret = -1;
     virStorageBackendRBDStatePtr ptr;
-    ptr.cluster = NULL;
-    ptr.ioctx = NULL;
+#ifdef RBD_FEATURE_LAYERING
+    rbd_image_t image = NULL;
+#endif
 
     VIR_DEBUG("Removing RBD image %s/%s", pool->def->source.name, vol->name);
 
@@ -374,19 +521,16 @@ static int virStorageBackendRBDDeleteVol(virConnectPtr conn,
         VIR_WARN("%s", _("This storage backend does not supported zeroed removal of volumes"));
     }
 
-    if (virStorageBackendRBDOpenRADOSConn(&ptr, conn, pool) < 0) {
+    if (!(ptr = virStorageBackendRBDGetState(conn, pool)))
         goto cleanup;
-    }
 
-    if (rados_ioctx_create(ptr.cluster,
-        pool->def->source.name, &ptr.ioctx) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("failed to create the RBD IoCTX. Does the pool '%s' exist?"),
-                       pool->def->source.name);
-        goto cleanup;
-    }
+#ifdef RBD_FEATURE_LAYERING
+    /* Keep the image open, its parent is only known until it is gone */
+    if (rbd_open(ptr->ioctx, vol->name, &image, NULL) < 0)
+        image = NULL;
+#endif
 
-    if (rbd_remove(ptr.ioctx, vol->name) < 0) {
+    if (rbd_remove(ptr->ioctx, vol->name) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("failed to remove volume '%s/%s'"),
                        pool->def->source.name,
@@ -394,10 +538,18 @@ static int virStorageBackendRBDDeleteVol(virConnectPtr conn,
         goto cleanup;
     }
 
+#ifdef RBD_FEATURE_LAYERING
+    if (image)
+        virStorageBackendRBDRemoveCloneSnap(ptr, image, vol->name);
+#endif
+
     ret = 0;
 
 cleanup:
-    virStorageBackendRBDCloseRADOSConn(ptr);
+#ifdef RBD_FEATURE_LAYERING
+    if (image)
+        rbd_close(image);
+#endif
     return ret;
 }
 
@@ -406,8 +558,6 @@ static int virStorageBackendRBDCreateVol(virConnectPtr conn,
                                          virStorageVolDefPtr vol)
 {
     virStorageBackendRBDStatePtr ptr;
-    ptr.cluster = NULL;
-    ptr.ioctx = NULL;
     int order = 0;
     int ret = -1;
 
@@ -415,17 +565,8 @@ static int virStorageBackendRBDCreateVol(virConnectPtr conn,
               pool->def->source.name,
               vol->name, vol->capacity);
 
-    if (virStorageBackendRBDOpenRADOSConn(&ptr, conn, pool) < 0) {
+    if (!(ptr = virStorageBackendRBDGetState(conn, pool)))
         goto cleanup;
-    }
-
-    if (rados_ioctx_create(ptr.cluster,
-        pool->def->source.name,&ptr.ioctx) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("failed to create the RBD IoCTX. Does the pool '%s' exist?"),
-                       pool->def->source.name);
-        goto cleanup;
-    }
 
     if (vol->target.encryption != NULL) {
         virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
@@ -433,7 +574,7 @@ static int virStorageBackendRBDCreateVol(virConnectPtr conn,
         goto cleanup;
     }
 
-    if (rbd_create(ptr.ioctx, vol->name, vol->capacity, &order) < 0) {
+    if (rbd_create(ptr->ioctx, vol->name, vol->capacity, &order) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("failed to create volume '%s/%s'"),
                        pool->def->source.name,
@@ -448,69 +589,228 @@ static int virStorageBackendRBDCreateVol(virConnectPtr conn,
     ret = 0;
 
 cleanup:
-    virStorageBackendRBDCloseRADOSConn(ptr);
     return ret;
 }
 
-static int virStorageBackendRBDRefreshVol(virConnectPtr conn,
-                                          virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
-                                          virStorageVolDefPtr vol)
+#ifdef RBD_FEATURE_LAYERING
+/*
+ * Create @dest as a copy on write clone of a snapshot of @src, taken
+ * for the purpose.  This needs @src to be a format 2 image with the
+ * layering feature.
+ *
+ * Returns 0 on success, 1 if @src can't be cloned, -1 on error.
+ */
+static int
+virStorageBackendRBDCloneImage(virStorageBackendRBDStatePtr ptr,
+                               const char *src,
+                               const char *dest)
 {
-    virStorageBackendRBDStatePtr ptr;
-    ptr.cluster = NULL;
-    ptr.ioctx = NULL;
+    rbd_image_t image = NULL;
+    uint64_t features;
+    char *snap = NULL;
+    bool snapped = false;
+    bool protected = false;
+    int order = 0;
     int ret = -1;
 
-    if (virStorageBackendRBDOpenRADOSConn(&ptr, conn, pool) < 0) {
+    if (rbd_open(ptr->ioctx, src, &image, NULL) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("failed to open the RBD image '%s'"), src);
+        return -1;
+    }
+
+    if (rbd_get_features(image, &features) < 0 ||
+        !(features & RBD_FEATURE_LAYERING)) {
+        VIR_DEBUG("RBD image '%s' does not support cloning", src);
+        ret = 1;
         goto cleanup;
     }
 
-    if (rados_ioctx_create(ptr.cluster,
-        pool->def->source.name, &ptr.ioctx) < 0) {
+    if (virAsprintf(&snap, "%s%s",
+                    VIR_STORAGE_RBD_CLONE_SNAP_PREFIX, dest) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (rbd_snap_create(image, snap) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("failed to create the RBD IoCTX. Does the pool '%s' exist?"),
-                       pool->def->source.name);
+                       _("failed to create snapshot '%s@%s'"), src, snap);
         goto cleanup;
     }
+    snapped = true;
 
-    if (volStorageBackendRBDRefreshVolInfo(vol, pool, ptr) < 0) {
+    if (rbd_snap_protect(image, snap) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("failed to protect snapshot '%s@%s'"), src, snap);
         goto cleanup;
     }
+    protected = true;
 
+    if (rbd_clone(ptr->ioctx, src, snap, ptr->ioctx, dest,
+                  features, &order) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("failed to clone RBD image '%s' to '%s'"),
+                       src, dest);
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Cloned RBD image %s@%s to %s", src, snap, dest);
     ret = 0;
 
 cleanup:
-    virStorageBackendRBDCloseRADOSConn(ptr);
+    if (ret < 0) {
+        if (protected)
+            rbd_snap_unprotect(image, snap);
+        if (snapped)
+            rbd_snap_remove(image, snap);
+    }
+    VIR_FREE(snap);
+    rbd_close(image);
     return ret;
 }
+#endif
 
-static int virStorageBackendRBDResizeVol(virConnectPtr conn ATTRIBUTE_UNUSED,
-                                     virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
-                                     virStorageVolDefPtr vol,
-                                     unsigned long long capacity,
-                                     unsigned int flags)
+static int
+virStorageBackendRBDCopyImage(virStorageBackendRBDStatePtr ptr,
+                              const char *src,
+                              const char *dest)
+{
+    rbd_image_t image = NULL;
+    int ret = -1;
+
+    if (rbd_open(ptr->ioctx, src, &image, NULL) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("failed to open the RBD image '%s'"), src);
+        return -1;
+    }
+
+    if (rbd_copy(image, ptr->ioctx, dest) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("failed to copy RBD image '%s' to '%s'"),
+                       src, dest);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    rbd_close(image);
+    return ret;
+}
+
+/*
+ * Create @vol from @inputvol, a volume of the same RADOS pool, with
+ * librbd rather than by copying the data through libvirtd: as a copy
+ * on write clone if @inputvol supports it, or else by a copy done by
+ * the cluster.
+ */
+static int
+virStorageBackendRBDBuildVolFrom(virConnectPtr conn,
+                                 virStoragePoolObjPtr pool,
+                                 virStorageVolDefPtr vol,
+                                 virStorageVolDefPtr inputvol,
+                                 unsigned int flags)
 {
     virStorageBackendRBDStatePtr ptr;
-    ptr.cluster = NULL;
-    ptr.ioctx = NULL;
     rbd_image_t image = NULL;
+    char *key = NULL;
+    int rc = 1;
     int ret = -1;
 
     virCheckFlags(0, -1);
 
-    if (virStorageBackendRBDOpenRADOSConn(&ptr, conn, pool) < 0) {
+    if (virAsprintf(&key, "%s/%s",
+                    pool->def->source.name, inputvol->name) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (inputvol->type != VIR_STORAGE_VOL_NETWORK ||
+        STRNEQ_NULLABLE(inputvol->key, key)) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("RBD volumes can only be created from volumes "
+                         "of the same RBD pool"));
         goto cleanup;
     }
 
-    if (rados_ioctx_create(ptr.cluster,
-        pool->def->source.name, &ptr.ioctx) < 0) {
+    if (!(ptr = virStorageBackendRBDGetState(conn, pool)))
+        goto cleanup;
+
+    /* createVol made an empty image, replace it by the copy */
+    if (rbd_remove(ptr->ioctx, vol->name) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("failed to create the RBD IoCTX. Does the pool '%s' exist?"),
-                       pool->def->source.name);
+                       _("failed to remove volume '%s/%s'"),
+                       pool->def->source.name, vol->name);
+        goto cleanup;
+    }
+
+#ifdef RBD_FEATURE_LAYERING
+    if ((rc = virStorageBackendRBDCloneImage(ptr, inputvol->name,
+                                             vol->name)) < 0)
+        goto cleanup;
+#endif
+    if (rc == 1 &&
+        virStorageBackendRBDCopyImage(ptr, inputvol->name, vol->name) < 0)
         goto cleanup;
+
+    if (vol->capacity > inputvol->capacity) {
+        if (rbd_open(ptr->ioctx, vol->name, &image, NULL) < 0 ||
+            rbd_resize(image, vol->capacity) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("failed to resize the RBD image '%s'"),
+                           vol->name);
+            goto cleanup;
+        }
     }
 
-    if (rbd_open(ptr.ioctx, vol->name, &image, NULL) < 0) {
+    if (volStorageBackendRBDRefreshVolInfo(vol, pool, ptr) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (image != NULL)
+        rbd_close(image);
+    VIR_FREE(key);
+    return ret;
+}
+
+static int virStorageBackendRBDRefreshVol(virConnectPtr conn,
+                                          virStoragePoolObjPtr pool,
+                                          virStorageVolDefPtr vol)
+{
+    virStorageBackendRBDStatePtr ptr;
+    int ret = -1;
+
+    if (!(ptr = virStorageBackendRBDGetState(conn, pool)))
+        goto cleanup;
+
+    if (volStorageBackendRBDRefreshVolInfo(vol, pool, ptr) < 0) {
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    return ret;
+}
+
+static int virStorageBackendRBDResizeVol(virConnectPtr conn,
+                                     virStoragePoolObjPtr pool,
+                                     virStorageVolDefPtr vol,
+                                     unsigned long long capacity,
+                                     unsigned int flags)
+{
+    virStorageBackendRBDStatePtr ptr;
+    rbd_image_t image = NULL;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!(ptr = virStorageBackendRBDGetState(conn, pool)))
+        goto cleanup;
+
+    if (rbd_open(ptr->ioctx, vol->name, &image, NULL) < 0) {
        virReportError(VIR_ERR_INTERNAL_ERROR,
                       _("failed to open the RBD image '%s'"),
                       vol->name);
@@ -529,7 +829,6 @@ static int virStorageBackendRBDResizeVol(virConnectPtr conn ATTRIBUTE_UNUSED,
 cleanup:
     if (image != NULL)
        rbd_close(image);
-    virStorageBackendRBDCloseRADOSConn(ptr);
     return ret;
 }
 
@@ -537,7 +836,9 @@ virStorageBackend virStorageBackendRBD = {
     .type = VIR_STORAGE_POOL_RBD,
 
     .refreshPool = virStorageBackendRBDRefreshPool,
+    .stopPool = virStorageBackendRBDStopPool,
     .createVol = virStorageBackendRBDCreateVol,
+    .buildVolFrom = virStorageBackendRBDBuildVolFrom,
     .refreshVol = virStorageBackendRBDRefreshVol,
     .deleteVol = virStorageBackendRBDDeleteVol,
     .resizeVol = virStorageBackendRBDResizeVol,
@@ -282,13 +282,10 @@ virStorageBackendSCSINewLun(virStoragePoolObjPtr pool,
     pool->def->capacity += vol->capacity;
     pool->def->allocation += vol->allocation;
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count + 1) < 0) {
-        virReportOOMError();
+    if (virStoragePoolObjAddVol(pool, vol) < 0) {
         retval = -1;
         goto free_vol;
     }
-    pool->volumes.objs[pool->volumes.count++] = vol;
 
     goto out;
 
@@ -548,6 +545,73 @@ out:
 }
 
 
+/*
+ * Discover the LUs of the targets below @sysfs_path, the device
+ * directory of a SCSI host or iSCSI session, instead of looking
+ * through every device of the SCSI bus.
+ */
+int
+virStorageBackendSCSIFindDeviceLUs(virStoragePoolObjPtr pool,
+                                   const char *sysfs_path)
+{
+    int retval = 0;
+    DIR *sysdir = NULL;
+    struct dirent *dirent = NULL;
+
+    VIR_DEBUG("Discovering LUs below '%s'", sysfs_path);
+
+    virFileWaitForDevices();
+
+    if (!(sysdir = opendir(sysfs_path))) {
+        virReportSystemError(errno,
+                             _("Failed to opendir path '%s'"), sysfs_path);
+        return -1;
+    }
+
+    while ((dirent = readdir(sysdir))) {
+        uint32_t host, bus, target, lun;
+        char *target_path = NULL;
+        DIR *targetdir;
+        struct dirent *lun_dirent;
+
+        if (!STRPREFIX(dirent->d_name, "target"))
+            continue;
+
+        if (virAsprintf(&target_path, "%s/%s",
+                        sysfs_path, dirent->d_name) < 0) {
+            virReportOOMError();
+            retval = -1;
+            break;
+        }
+
+        if (!(targetdir = opendir(target_path))) {
+            virReportSystemError(errno,
+                                 _("Failed to opendir path '%s'"),
+                                 target_path);
+            VIR_FREE(target_path);
+            retval = -1;
+            break;
+        }
+
+        while ((lun_dirent = readdir(targetdir))) {
+            if (sscanf(lun_dirent->d_name, "%u:%u:%u:%u",
+                       &host, &bus, &target, &lun) != 4)
+                continue;
+
+            VIR_DEBUG("Found LU '%s'", lun_dirent->d_name);
+
+            processLU(pool, host, bus, target, lun);
+        }
+
+        closedir(targetdir);
+        VIR_FREE(target_path);
+    }
+
+    closedir(sysdir);
+    return retval;
+}
+
+
 int
 virStorageBackendSCSIGetHostNumber(const char *sysfs_path,
                                    uint32_t *host)
@@ -38,5 +38,8 @@ virStorageBackendSCSIGetHostNumber(const char *sysfs_path,
 int
 virStorageBackendSCSIFindLUs(virStoragePoolObjPtr pool,
                              uint32_t scanhost);
+int
+virStorageBackendSCSIFindDeviceLUs(virStoragePoolObjPtr pool,
+                                   const char *sysfs_path);
 
 #endif /* __VIR_STORAGE_BACKEND_SCSI_H__ */
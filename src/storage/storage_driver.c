@@ -35,6 +35,16 @@
 #endif
 #include <errno.h>
 #include <string.h>
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+#endif
+#if HAVE_LINUX_FALLOC_H
+# include <linux/falloc.h>
+#endif
 
 #include "virterror_internal.h"
 #include "datatypes.h"
@@ -47,6 +57,7 @@
 #include "logging.h"
 #include "virfile.h"
 #include "fdstream.h"
+#include "viratomic.h"
 #include "configmake.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
@@ -64,62 +75,283 @@ static void storageDriverUnlock(virStorageDriverStatePtr driver)
     virMutexUnlock(&driver->lock);
 }
 
+#if HAVE_SYS_INOTIFY_H
 static void
-storageDriverAutostart(virStorageDriverStatePtr driver) {
+storageDriverRefreshWatched(virStorageDriverStatePtr driver)
+{
     unsigned int i;
 
     for (i = 0 ; i < driver->pools.count ; i++) {
         virStoragePoolObjPtr pool = driver->pools.objs[i];
         virStorageBackendPtr backend;
-        bool started = false;
 
         virStoragePoolObjLock(pool);
-        if ((backend = virStorageBackendForType(pool->def->type)) == NULL) {
-            VIR_ERROR(_("Missing backend %d"), pool->def->type);
-            virStoragePoolObjUnlock(pool);
+        if (pool->watch >= 0 && pool->asyncjobs == 0 &&
+            (backend = virStorageBackendForType(pool->def->type)) &&
+            backend->refreshKeepsVols &&
+            backend->refreshPool(NULL, pool) < 0) {
+            virErrorPtr err = virGetLastError();
+            VIR_WARN("Failed to refresh storage pool '%s': %s",
+                     pool->def->name, err ? err->message :
+                     _("no error message found"));
+        }
+        virStoragePoolObjUnlock(pool);
+    }
+}
+
+
+static void
+storageDriverInotifyEvent(int watch,
+                          int fd,
+                          int events ATTRIBUTE_UNUSED,
+                          void *opaque)
+{
+    union {
+        struct inotify_event e; /* keeps buf suitably aligned */
+        char buf[4096];
+    } data;
+    struct inotify_event *e;
+    ssize_t got;
+    char *tmp;
+    virStorageDriverStatePtr driver = opaque;
+    unsigned int i;
+
+    storageDriverLock(driver);
+    if (watch != driver->inotifyWatch)
+        goto cleanup;
+
+reread:
+    got = read(fd, data.buf, sizeof(data.buf));
+    if (got == -1) {
+        if (errno == EINTR)
+            goto reread;
+        goto cleanup;
+    }
+
+    tmp = data.buf;
+    while (got) {
+        if (got < sizeof(struct inotify_event))
+            goto cleanup; /* bad */
+
+        e = (struct inotify_event *)tmp;
+        tmp += sizeof(struct inotify_event);
+        got -= sizeof(struct inotify_event);
+
+        if (got < e->len)
+            goto cleanup;
+
+        tmp += e->len;
+        got -= e->len;
+
+        if (e->mask & IN_Q_OVERFLOW) {
+            VIR_DEBUG("inotify queue overflow, refreshing watched pools");
+            storageDriverRefreshWatched(driver);
             continue;
         }
 
-        if (backend->checkPool &&
-            backend->checkPool(NULL, pool, &started) < 0) {
+        for (i = 0 ; i < driver->pools.count ; i++) {
+            virStoragePoolObjPtr pool = driver->pools.objs[i];
+            virStorageBackendPtr backend;
+
+            virStoragePoolObjLock(pool);
+            if (pool->watch != e->wd) {
+                virStoragePoolObjUnlock(pool);
+                continue;
+            }
+
+            if (e->mask & IN_IGNORED) {
+                VIR_DEBUG("inotify watch on storage pool '%s' went away",
+                          pool->def->name);
+                pool->watch = -1;
+            } else if (e->len &&
+                       (backend = virStorageBackendForType(pool->def->type)) &&
+                       backend->refreshPoolEntry) {
+                VIR_DEBUG("Got inotify event 0x%x for '%s' in storage pool '%s'",
+                          e->mask, e->name, pool->def->name);
+                if (backend->refreshPoolEntry(NULL, pool, e->name) < 0) {
+                    virErrorPtr err = virGetLastError();
+                    VIR_WARN("Failed to update volume '%s' of storage pool '%s': %s",
+                             e->name, pool->def->name, err ? err->message :
+                             _("no error message found"));
+                    virResetLastError();
+                }
+            }
+            virStoragePoolObjUnlock(pool);
+        }
+    }
+
+cleanup:
+    storageDriverUnlock(driver);
+}
+#endif /* HAVE_SYS_INOTIFY_H */
+
+
+/*
+ * Start following changes to the target directory of a freshly
+ * started @pool, if its backend can update single volumes.  Failing
+ * to do so is not fatal, the pool then only changes on refresh.
+ */
+static void
+storagePoolWatch(virStorageDriverStatePtr driver ATTRIBUTE_UNUSED,
+                 virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                 virStorageBackendPtr backend ATTRIBUTE_UNUSED)
+{
+#if HAVE_SYS_INOTIFY_H
+    if (driver->inotifyFD < 0 || !backend->refreshPoolEntry ||
+        pool->watch >= 0)
+        return;
+
+    if ((pool->watch = inotify_add_watch(driver->inotifyFD,
+                                         pool->def->target.path,
+                                         IN_CREATE | IN_CLOSE_WRITE |
+                                         IN_ATTRIB | IN_DELETE |
+                                         IN_MOVED_FROM | IN_MOVED_TO |
+                                         IN_ONLYDIR)) < 0) {
+        char ebuf[1024];
+        VIR_WARN("Failed to watch storage pool '%s' path '%s': %s",
+                 pool->def->name, pool->def->target.path,
+                 virStrerror(errno, ebuf, sizeof(ebuf)));
+        pool->watch = -1;
+        return;
+    }
+    VIR_DEBUG("Watching storage pool '%s' at '%s'",
+              pool->def->name, pool->def->target.path);
+#endif
+}
+
+
+/*
+ * Stop following changes to the target directory of @pool.  Pools
+ * sharing a directory share the kernel's watch on it, which is only
+ * removed along with the last of them.  The watches of all pools are
+ * only changed with the driver lock held.
+ */
+static void
+storagePoolUnwatch(virStorageDriverStatePtr driver ATTRIBUTE_UNUSED,
+                   virStoragePoolObjPtr pool ATTRIBUTE_UNUSED)
+{
+#if HAVE_SYS_INOTIFY_H
+    unsigned int i;
+
+    if (pool->watch < 0)
+        return;
+
+    for (i = 0 ; i < driver->pools.count ; i++) {
+        if (driver->pools.objs[i] != pool &&
+            driver->pools.objs[i]->watch == pool->watch)
+            break;
+    }
+    if (i == driver->pools.count)
+        inotify_rm_watch(driver->inotifyFD, pool->watch);
+    pool->watch = -1;
+#endif
+}
+
+
+struct storageDriverAutostartData {
+    virStoragePoolObjPtr pool;
+    virStorageBackendPtr backend;
+    virThread thread;
+    bool threaded;
+    bool started;
+};
+
+/* Check, start and refresh a pool that is locked by the caller */
+static void
+storageDriverAutostartPool(void *opaque)
+{
+    struct storageDriverAutostartData *data = opaque;
+    virStoragePoolObjPtr pool = data->pool;
+    virStorageBackendPtr backend = data->backend;
+    bool started = false;
+
+    if (backend->checkPool &&
+        backend->checkPool(NULL, pool, &started) < 0) {
+        virErrorPtr err = virGetLastError();
+        VIR_ERROR(_("Failed to initialize storage pool '%s': %s"),
+                  pool->def->name, err ? err->message :
+                  _("no error message found"));
+        return;
+    }
+
+    if (!started &&
+        pool->autostart &&
+        !virStoragePoolObjIsActive(pool)) {
+        if (backend->startPool &&
+            backend->startPool(NULL, pool) < 0) {
             virErrorPtr err = virGetLastError();
-            VIR_ERROR(_("Failed to initialize storage pool '%s': %s"),
+            VIR_ERROR(_("Failed to autostart storage pool '%s': %s"),
                       pool->def->name, err ? err->message :
                       _("no error message found"));
-            virStoragePoolObjUnlock(pool);
+            return;
+        }
+        started = true;
+    }
+
+    if (started) {
+        if (backend->refreshPool(NULL, pool) < 0) {
+            virErrorPtr err = virGetLastError();
+            if (backend->stopPool)
+                backend->stopPool(NULL, pool);
+            VIR_ERROR(_("Failed to autostart storage pool '%s': %s"),
+                      pool->def->name, err ? err->message :
+                      _("no error message found"));
+            return;
+        }
+        data->started = true;
+    }
+}
+
+static void
+storageDriverAutostart(virStorageDriverStatePtr driver) {
+    struct storageDriverAutostartData *data;
+    unsigned int count = driver->pools.count;
+    unsigned int i;
+
+    if (VIR_ALLOC_N(data, count) < 0) {
+        virReportOOMError();
+        return;
+    }
+
+    /* Pools whose backend allows it are brought up by a thread of
+     * their own, as logging into remote storage may take a while */
+    for (i = 0 ; i < count ; i++) {
+        virStoragePoolObjPtr pool = driver->pools.objs[i];
+
+        virStoragePoolObjLock(pool);
+        data[i].pool = pool;
+        if ((data[i].backend = virStorageBackendForType(pool->def->type)) == NULL) {
+            VIR_ERROR(_("Missing backend %d"), pool->def->type);
             continue;
         }
 
-        if (!started &&
-            pool->autostart &&
-            !virStoragePoolObjIsActive(pool)) {
-            if (backend->startPool &&
-                backend->startPool(NULL, pool) < 0) {
-                virErrorPtr err = virGetLastError();
-                VIR_ERROR(_("Failed to autostart storage pool '%s': %s"),
-                          pool->def->name, err ? err->message :
-                          _("no error message found"));
-                virStoragePoolObjUnlock(pool);
+        if (data[i].backend->parallelAutostart) {
+            if (virThreadCreate(&data[i].thread, true,
+                                storageDriverAutostartPool, &data[i]) == 0) {
+                data[i].threaded = true;
                 continue;
             }
-            started = true;
+            VIR_WARN("Unable to create a thread to autostart storage pool '%s'",
+                     pool->def->name);
         }
+        storageDriverAutostartPool(&data[i]);
+    }
 
-        if (started) {
-            if (backend->refreshPool(NULL, pool) < 0) {
-                virErrorPtr err = virGetLastError();
-                if (backend->stopPool)
-                    backend->stopPool(NULL, pool);
-                VIR_ERROR(_("Failed to autostart storage pool '%s': %s"),
-                          pool->def->name, err ? err->message :
-                          _("no error message found"));
-                virStoragePoolObjUnlock(pool);
-                continue;
-            }
+    for (i = 0 ; i < count ; i++) {
+        virStoragePoolObjPtr pool = data[i].pool;
+
+        if (data[i].threaded)
+            virThreadJoin(&data[i].thread);
+
+        if (data[i].started) {
             pool->active = 1;
+            driver->pools.generation++;
+            storagePoolWatch(driver, pool, data[i].backend);
         }
         virStoragePoolObjUnlock(pool);
     }
+
+    VIR_FREE(data);
 }
 
 /**
@@ -137,6 +369,9 @@ storageDriverStartup(bool privileged,
     if (VIR_ALLOC(driverState) < 0)
         return -1;
 
+    driverState->inotifyFD = -1;
+    driverState->inotifyWatch = -1;
+
     if (virMutexInit(&driverState->lock) < 0) {
         VIR_FREE(driverState);
         return -1;
@@ -169,6 +404,21 @@ storageDriverStartup(bool privileged,
                                      driverState->configDir,
                                      driverState->autostartDir) < 0)
         goto error;
+
+#if HAVE_SYS_INOTIFY_H
+    if ((driverState->inotifyFD = inotify_init()) < 0 ||
+        virSetNonBlock(driverState->inotifyFD) < 0 ||
+        virSetCloseExec(driverState->inotifyFD) < 0 ||
+        (driverState->inotifyWatch =
+         virEventAddHandle(driverState->inotifyFD, VIR_EVENT_HANDLE_READABLE,
+                           storageDriverInotifyEvent, driverState, NULL)) < 0) {
+        VIR_WARN("Cannot watch storage pools for changes, "
+                 "they will only be updated on refresh");
+        VIR_FORCE_CLOSE(driverState->inotifyFD);
+        driverState->inotifyWatch = -1;
+    }
+#endif
+
     storageDriverAutostart(driverState);
 
     storageDriverUnlock(driverState);
@@ -205,6 +455,39 @@ storageDriverReload(void) {
 }
 
 
+/**
+ * storageDriverPreExecRestart:
+ *
+ * Refuse to let the daemon re-execute itself while volume jobs
+ * are running in the background, as they would be killed.
+ */
+static int
+storageDriverPreExecRestart(void) {
+    unsigned int i;
+    int ret = 0;
+
+    if (!driverState)
+        return 0;
+
+    storageDriverLock(driverState);
+    for (i = 0 ; i < driverState->pools.count && ret == 0 ; i++) {
+        virStoragePoolObjPtr pool = driverState->pools.objs[i];
+
+        virStoragePoolObjLock(pool);
+        if (pool->asyncjobs > 0) {
+            virReportError(VIR_ERR_OPERATION_INVALID,
+                           _("pool '%s' has asynchronous jobs running."),
+                           pool->def->name);
+            ret = -1;
+        }
+        virStoragePoolObjUnlock(pool);
+    }
+    storageDriverUnlock(driverState);
+
+    return ret;
+}
+
+
 /**
  * virStorageShutdown:
  *
@@ -217,6 +500,10 @@ storageDriverShutdown(void) {
 
     storageDriverLock(driverState);
 
+    if (driverState->inotifyWatch != -1)
+        virEventRemoveHandle(driverState->inotifyWatch);
+    VIR_FORCE_CLOSE(driverState->inotifyFD);
+
     /* free inactive pools */
     virStoragePoolObjListFree(&driverState->pools);
 
@@ -531,6 +818,8 @@ storagePoolCreate(virConnectPtr conn,
     }
     VIR_INFO("Creating storage pool '%s'", pool->def->name);
     pool->active = 1;
+    driver->pools.generation++;
+    storagePoolWatch(driver, pool, backend);
 
     ret = virGetStoragePool(conn, pool->def->name, pool->def->uuid,
                             NULL, NULL);
@@ -655,7 +944,6 @@ storagePoolStart(virStoragePoolPtr obj,
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByUUID(&driver->pools, obj->uuid);
-    storageDriverUnlock(driver);
 
     if (!pool) {
         virReportError(VIR_ERR_NO_STORAGE_POOL,
@@ -684,11 +972,14 @@ storagePoolStart(virStoragePoolPtr obj,
 
     VIR_INFO("Starting up storage pool '%s'", pool->def->name);
     pool->active = 1;
+    driver->pools.generation++;
+    storagePoolWatch(driver, pool, backend);
     ret = 0;
 
 cleanup:
     if (pool)
         virStoragePoolObjUnlock(pool);
+    storageDriverUnlock(driver);
     return ret;
 }
 
@@ -764,6 +1055,8 @@ storagePoolDestroy(virStoragePoolPtr obj) {
         goto cleanup;
     }
 
+    storagePoolUnwatch(driver, pool);
+
     if (backend->stopPool &&
         backend->stopPool(obj->conn, pool) < 0)
         goto cleanup;
@@ -771,6 +1064,7 @@ storagePoolDestroy(virStoragePoolPtr obj) {
     virStoragePoolObjClearVols(pool);
 
     pool->active = 0;
+    driver->pools.generation++;
     VIR_INFO("Shutting down storage pool '%s'", pool->def->name);
 
     if (pool->configFile == NULL) {
@@ -851,7 +1145,7 @@ storagePoolRefresh(virStoragePoolPtr obj,
     virStorageBackendPtr backend;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_POOL_REFRESH_CAPACITY, -1);
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByUUID(&driver->pools, obj->uuid);
@@ -871,6 +1165,14 @@ storagePoolRefresh(virStoragePoolPtr obj,
         goto cleanup;
     }
 
+    /* The volumes are left alone, so there is no need to wait for the
+     * jobs working on them, nor to give up on the pool on failure */
+    if ((flags & VIR_STORAGE_POOL_REFRESH_CAPACITY) &&
+        backend->refreshPoolCapacity) {
+        ret = backend->refreshPoolCapacity(obj->conn, pool);
+        goto cleanup;
+    }
+
     if (pool->asyncjobs > 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("pool '%s' has asynchronous jobs running."),
@@ -878,12 +1180,15 @@ storagePoolRefresh(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    virStoragePoolObjClearVols(pool);
+    if (!backend->refreshKeepsVols)
+        virStoragePoolObjClearVols(pool);
     if (backend->refreshPool(obj->conn, pool) < 0) {
+        storagePoolUnwatch(driver, pool);
         if (backend->stopPool)
             backend->stopPool(obj->conn, pool);
 
         pool->active = 0;
+        driver->pools.generation++;
 
         if (pool->configFile == NULL) {
             virStoragePoolObjRemove(&driver->pools, pool);
@@ -1336,6 +1641,195 @@ storageVolumeLookupByPath(virConnectPtr conn,
 }
 
 static int storageVolumeDelete(virStorageVolPtr obj, unsigned int flags);
+static int storageVolumeWipeInternal(virStoragePoolObjPtr pool,
+                                     virStorageVolDefPtr def,
+                                     unsigned int algorithm);
+
+/* A long running operation on a volume, run with its pool unlocked
+ * either by the API call that started it or, for asynchronous jobs,
+ * by a thread of its own */
+typedef struct _storageVolJob storageVolJob;
+typedef storageVolJob *storageVolJobPtr;
+struct _storageVolJob {
+    int type; /* virStorageVolJobType */
+    virStorageDriverStatePtr driver;
+    virStorageBackendPtr backend;
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+    virStorageVolPtr volobj; /* keeps the connection around */
+
+    /* VIR_STORAGE_VOL_JOB_BUILD */
+    virStoragePoolObjPtr origpool; /* NULL if the same as pool */
+    virStorageVolDefPtr origvol;
+
+    unsigned int algorithm; /* VIR_STORAGE_VOL_JOB_WIPE */
+    unsigned long long capacity; /* VIR_STORAGE_VOL_JOB_RESIZE */
+    unsigned int flags; /* for the backend */
+};
+
+static storageVolJobPtr
+storageVolJobNew(int type,
+                 virStoragePoolObjPtr pool,
+                 virStorageVolDefPtr vol,
+                 virStorageVolPtr volobj)
+{
+    storageVolJobPtr job;
+
+    if (VIR_ALLOC(job) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    job->type = type;
+    job->driver = volobj->conn->storagePrivateData;
+    job->pool = pool;
+    job->vol = vol;
+    job->volobj = virObjectRef(volobj);
+
+    return job;
+}
+
+static void
+storageVolJobFree(storageVolJobPtr job)
+{
+    if (!job)
+        return;
+
+    virObjectUnref(job->volobj);
+    VIR_FREE(job);
+}
+
+static int
+storageVolJobRun(storageVolJobPtr job)
+{
+    virConnectPtr conn = job->volobj->conn;
+
+    switch ((virStorageVolJobType) job->type) {
+    case VIR_STORAGE_VOL_JOB_BUILD:
+        return job->backend->buildVolFrom(conn, job->pool, job->vol,
+                                          job->origvol, job->flags);
+    case VIR_STORAGE_VOL_JOB_WIPE:
+        return storageVolumeWipeInternal(job->pool, job->vol,
+                                         job->algorithm);
+    case VIR_STORAGE_VOL_JOB_RESIZE:
+        return job->backend->resizeVol(conn, job->pool, job->vol,
+                                       job->capacity, job->flags);
+    case VIR_STORAGE_VOL_JOB_NONE:
+    case VIR_STORAGE_VOL_JOB_LAST:
+        break;
+    }
+
+    virReportError(VIR_ERR_INTERNAL_ERROR,
+                   _("unexpected volume job type %d"), job->type);
+    return -1;
+}
+
+/*
+ * Finish @job, which ended with @ret: mark the volume idle again and,
+ * should building it have failed, delete it.  Both pools are unlocked
+ * on return.
+ */
+static int
+storageVolJobEnd(storageVolJobPtr job,
+                 int ret)
+{
+    virStorageVolDefPtr vol = job->vol;
+
+    storageDriverLock(job->driver);
+    virStoragePoolObjLock(job->pool);
+    if (job->origpool)
+        virStoragePoolObjLock(job->origpool);
+    storageDriverUnlock(job->driver);
+
+    vol->job = VIR_STORAGE_VOL_JOB_NONE;
+    vol->jobProcessed = vol->jobTotal = 0;
+    virAtomicIntSet(&vol->jobAbort, 0);
+    job->pool->asyncjobs--;
+
+    if (job->type == VIR_STORAGE_VOL_JOB_BUILD) {
+        job->origvol->building = 0;
+        vol->building = 0;
+    } else if (job->type == VIR_STORAGE_VOL_JOB_RESIZE && ret == 0) {
+        vol->capacity = job->capacity;
+    }
+
+    if (job->origpool) {
+        job->origpool->asyncjobs--;
+        virStoragePoolObjUnlock(job->origpool);
+    }
+    virStoragePoolObjUnlock(job->pool);
+
+    if (job->type == VIR_STORAGE_VOL_JOB_BUILD && ret < 0)
+        storageVolumeDelete(job->volobj, 0);
+
+    return ret;
+}
+
+static void
+storageVolJobThread(void *opaque)
+{
+    storageVolJobPtr job = opaque;
+
+    if (storageVolJobEnd(job, storageVolJobRun(job)) < 0) {
+        virErrorPtr err = virGetLastError();
+
+        VIR_WARN("Job on volume '%s' in storage pool '%s' failed: %s",
+                 job->volobj->name, job->volobj->pool,
+                 err ? err->message : _("unknown error"));
+    } else {
+        VIR_INFO("Job on volume '%s' in storage pool '%s' completed",
+                 job->volobj->name, job->volobj->pool);
+    }
+
+    storageVolJobFree(job);
+}
+
+/*
+ * Mark the volume busy with @job and run it with the pools unlocked:
+ * in a thread of its own if @async, in which case only starting it
+ * can fail, or else right away.  The pools must be locked on entry
+ * and are unlocked on return, @job is consumed.
+ */
+static int
+storageVolJobStart(storageVolJobPtr job,
+                   bool async)
+{
+    virStorageVolDefPtr vol = job->vol;
+    virThread thread;
+    int ret;
+
+    vol->job = job->type;
+    vol->jobProcessed = 0;
+    vol->jobTotal = job->type == VIR_STORAGE_VOL_JOB_BUILD ?
+                    vol->capacity : 0;
+    virAtomicIntSet(&vol->jobAbort, 0);
+    job->pool->asyncjobs++;
+
+    if (job->type == VIR_STORAGE_VOL_JOB_BUILD) {
+        job->origvol->building = 1;
+        vol->building = 1;
+    }
+
+    virStoragePoolObjUnlock(job->pool);
+    if (job->origpool) {
+        job->origpool->asyncjobs++;
+        virStoragePoolObjUnlock(job->origpool);
+    }
+
+    if (!async) {
+        ret = storageVolJobEnd(job, storageVolJobRun(job));
+    } else if (virThreadCreate(&thread, false, storageVolJobThread, job) < 0) {
+        virReportSystemError(errno,
+                             _("cannot start job on volume '%s'"),
+                             job->volobj->name);
+        ret = storageVolJobEnd(job, -1);
+    } else {
+        return 0;
+    }
+
+    storageVolJobFree(job);
+    return ret;
+}
 
 static virStorageVolPtr
 storageVolumeCreateXML(virStoragePoolPtr obj,
@@ -1379,12 +1873,6 @@ storageVolumeCreateXML(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
     if (!backend->createVol) {
         virReportError(VIR_ERR_NO_SUPPORT,
                        "%s", _("storage pool does not support volume "
@@ -1396,11 +1884,12 @@ storageVolumeCreateXML(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    pool->volumes.objs[pool->volumes.count++] = voldef;
+    if (virStoragePoolObjAddVol(pool, voldef) < 0)
+        goto cleanup;
     volobj = virGetStorageVol(obj->conn, pool->def->name, voldef->name,
                               voldef->key, NULL, NULL);
     if (!volobj) {
-        pool->volumes.count--;
+        virStoragePoolObjRemoveVol(pool, voldef);
         goto cleanup;
     }
 
@@ -1471,9 +1960,10 @@ storageVolumeCreateXMLFrom(virStoragePoolPtr obj,
     virStorageBackendPtr backend;
     virStorageVolDefPtr origvol = NULL, newvol = NULL;
     virStorageVolPtr ret = NULL, volobj = NULL;
-    int buildret;
+    storageVolJobPtr job = NULL;
 
-    virCheckFlags(VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA, NULL);
+    virCheckFlags(VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA |
+                  VIR_STORAGE_VOL_CREATE_ASYNC, NULL);
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByUUID(&driver->pools, obj->uuid);
@@ -1553,64 +2043,46 @@ storageVolumeCreateXMLFrom(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    if (backend->refreshVol &&
-        backend->refreshVol(obj->conn, pool, origvol) < 0)
+    if (origvol->job != VIR_STORAGE_VOL_JOB_NONE) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is busy with another job"),
+                       origvol->name);
         goto cleanup;
+    }
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0) {
-        virReportOOMError();
+    if (backend->refreshVol &&
+        backend->refreshVol(obj->conn, pool, origvol) < 0)
         goto cleanup;
-    }
 
     /* 'Define' the new volume so we get async progress reporting */
     if (backend->createVol(obj->conn, pool, newvol) < 0) {
         goto cleanup;
     }
 
-    pool->volumes.objs[pool->volumes.count++] = newvol;
+    if (virStoragePoolObjAddVol(pool, newvol) < 0)
+        goto cleanup;
     volobj = virGetStorageVol(obj->conn, pool->def->name, newvol->name,
                               newvol->key, NULL, NULL);
-
-    /* Drop the pool lock during volume allocation */
-    pool->asyncjobs++;
-    origvol->building = 1;
-    newvol->building = 1;
-    virStoragePoolObjUnlock(pool);
-
-    if (origpool) {
-        origpool->asyncjobs++;
-        virStoragePoolObjUnlock(origpool);
+    if (!volobj ||
+        !(job = storageVolJobNew(VIR_STORAGE_VOL_JOB_BUILD, pool,
+                                 newvol, volobj))) {
+        virStoragePoolObjRemoveVol(pool, newvol);
+        goto cleanup;
     }
 
-    buildret = backend->buildVolFrom(obj->conn, pool, newvol, origvol, flags);
+    job->backend = backend;
+    job->origpool = origpool;
+    job->origvol = origvol;
+    job->flags = flags & ~VIR_STORAGE_VOL_CREATE_ASYNC;
 
-    storageDriverLock(driver);
-    virStoragePoolObjLock(pool);
-    if (origpool)
-        virStoragePoolObjLock(origpool);
-    storageDriverUnlock(driver);
-
-    origvol->building = 0;
-    newvol->building = 0;
+    /* Drop the pool lock during volume allocation */
     newvol = NULL;
-    pool->asyncjobs--;
-
-    if (origpool) {
-        origpool->asyncjobs--;
-        virStoragePoolObjUnlock(origpool);
-        origpool = NULL;
-    }
-
-    if (buildret < 0) {
-        virStoragePoolObjUnlock(pool);
-        storageVolumeDelete(volobj, 0);
-        pool = NULL;
+    pool = origpool = NULL;
+    if (storageVolJobStart(job, flags & VIR_STORAGE_VOL_CREATE_ASYNC) < 0)
         goto cleanup;
-    }
 
     VIR_INFO("Creating volume '%s' in storage pool '%s'",
-             volobj->name, pool->def->name);
+             volobj->name, obj->name);
     ret = volobj;
     volobj = NULL;
 
@@ -1637,7 +2109,7 @@ storageVolumeDownload(virStorageVolPtr obj,
     virStorageVolDefPtr vol = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM, -1);
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
@@ -1672,11 +2144,25 @@ storageVolumeDownload(virStorageVolPtr obj,
         goto out;
     }
 
-    if (virFDStreamOpenFile(stream,
-                            vol->target.path,
-                            offset, length,
-                            O_RDONLY) < 0)
+    if (vol->job != VIR_STORAGE_VOL_JOB_NONE) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is busy with another job"),
+                       vol->name);
+        goto out;
+    }
+
+    if (flags & VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM) {
+        if (virFDStreamOpenFileSparse(stream,
+                                      vol->target.path,
+                                      offset, length,
+                                      O_RDONLY) < 0)
+            goto out;
+    } else if (virFDStreamOpenFile(stream,
+                                   vol->target.path,
+                                   offset, length,
+                                   O_RDONLY) < 0) {
         goto out;
+    }
 
     ret = 0;
 
@@ -1700,7 +2186,7 @@ storageVolumeUpload(virStorageVolPtr obj,
     virStorageVolDefPtr vol = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, -1);
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
@@ -1735,13 +2221,27 @@ storageVolumeUpload(virStorageVolPtr obj,
         goto out;
     }
 
+    if (vol->job != VIR_STORAGE_VOL_JOB_NONE) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is busy with another job"),
+                       vol->name);
+        goto out;
+    }
+
     /* Not using O_CREAT because the file is required to
      * already exist at this point */
-    if (virFDStreamOpenFile(stream,
-                            vol->target.path,
-                            offset, length,
-                            O_WRONLY) < 0)
+    if (flags & VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM) {
+        if (virFDStreamOpenFileSparse(stream,
+                                      vol->target.path,
+                                      offset, length,
+                                      O_WRONLY) < 0)
+            goto out;
+    } else if (virFDStreamOpenFile(stream,
+                                   vol->target.path,
+                                   offset, length,
+                                   O_WRONLY) < 0) {
         goto out;
+    }
 
     ret = 0;
 
@@ -1762,9 +2262,11 @@ storageVolumeResize(virStorageVolPtr obj,
     virStoragePoolObjPtr pool = NULL;
     virStorageVolDefPtr vol = NULL;
     unsigned long long abs_capacity;
+    storageVolJobPtr job;
     int ret = -1;
 
-    virCheckFlags(VIR_STORAGE_VOL_RESIZE_DELTA, -1);
+    virCheckFlags(VIR_STORAGE_VOL_RESIZE_DELTA |
+                  VIR_STORAGE_VOL_RESIZE_ASYNC, -1);
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
@@ -1802,6 +2304,13 @@ storageVolumeResize(virStorageVolPtr obj,
         goto out;
     }
 
+    if (vol->job != VIR_STORAGE_VOL_JOB_NONE) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is busy with another job"),
+                       vol->name);
+        goto out;
+    }
+
     if (flags & VIR_STORAGE_VOL_RESIZE_DELTA) {
         abs_capacity = vol->capacity + capacity;
         flags &= ~VIR_STORAGE_VOL_RESIZE_DELTA;
@@ -1829,11 +2338,15 @@ storageVolumeResize(virStorageVolPtr obj,
         goto out;
     }
 
-    if (backend->resizeVol(obj->conn, pool, vol, abs_capacity, flags) < 0)
+    if (!(job = storageVolJobNew(VIR_STORAGE_VOL_JOB_RESIZE, pool, vol, obj)))
         goto out;
 
-   vol->capacity = abs_capacity;
-   ret = 0;
+    job->backend = backend;
+    job->capacity = abs_capacity;
+    job->flags = flags & ~VIR_STORAGE_VOL_RESIZE_ASYNC;
+
+    pool = NULL;
+    ret = storageVolJobStart(job, flags & VIR_STORAGE_VOL_RESIZE_ASYNC);
 
 out:
     if (pool)
@@ -1842,6 +2355,34 @@ out:
     return ret;
 }
 
+/* How often a wipe updates its progress, in bytes */
+#define VIR_STORAGE_WIPE_PROGRESS_STEP (64 * 1024 * 1024)
+
+/*
+ * Record the progress of the job running on @vol, which runs with the
+ * pool unlocked.  Returns -1 if the job was asked to stop, 0 if it
+ * can carry on.
+ */
+static int
+storageVolumeJobProgress(virStoragePoolObjPtr pool,
+                         virStorageVolDefPtr vol,
+                         unsigned long long processed,
+                         unsigned long long total)
+{
+    virStoragePoolObjLock(pool);
+    vol->jobProcessed = processed;
+    vol->jobTotal = total;
+    virStoragePoolObjUnlock(pool);
+
+    if (virAtomicIntGet(&vol->jobAbort)) {
+        virReportError(VIR_ERR_OPERATION_ABORTED,
+                       _("job on volume '%s' was aborted"), vol->name);
+        return -1;
+    }
+
+    return 0;
+}
+
 /* If the volume we're wiping is already a sparse file, we simply
  * truncate and extend it to its original size, filling it with
  * zeroes.  This behavior is guaranteed by POSIX:
@@ -1886,7 +2427,8 @@ out:
 
 
 static int
-storageWipeExtent(virStorageVolDefPtr vol,
+storageWipeExtent(virStoragePoolObjPtr pool,
+                  virStorageVolDefPtr vol,
                   int fd,
                   off_t extent_start,
                   off_t extent_length,
@@ -1897,6 +2439,7 @@ storageWipeExtent(virStorageVolDefPtr vol,
     int ret = -1, written = 0;
     off_t remaining = 0;
     size_t write_size = 0;
+    size_t reported = *bytes_wiped;
 
     VIR_DEBUG("extent logical start: %ju len: %ju",
               (uintmax_t)extent_start, (uintmax_t)extent_length);
@@ -1925,6 +2468,15 @@ storageWipeExtent(virStorageVolDefPtr vol,
 
         *bytes_wiped += written;
         remaining -= written;
+
+        if (*bytes_wiped - reported >= VIR_STORAGE_WIPE_PROGRESS_STEP) {
+            reported = *bytes_wiped;
+            if (storageVolumeJobProgress(pool, vol, reported,
+                                         vol->jobTotal) < 0) {
+                ret = -1;
+                goto out;
+            }
+        }
     }
 
     if (fdatasync(fd) < 0) {
@@ -1945,8 +2497,85 @@ out:
 }
 
 
+/*
+ * Have the kernel zero, or if @discard just deallocate, the first
+ * @length bytes of the volume open as @fd: with BLKZEROOUT and
+ * BLKDISCARD on block devices, which the device may carry out itself,
+ * and by punching holes into files.  This is done in steps that
+ * update the progress of the job.
+ *
+ * Returns 0 on success, 1 if the volume does not support it (and
+ * nothing was done), -1 on error.
+ */
+static int
+storageWipeOffload(virStoragePoolObjPtr pool,
+                   virStorageVolDefPtr vol,
+                   int fd,
+                   bool isblock,
+                   bool discard,
+                   unsigned long long length)
+{
+    unsigned long long offset = 0;
+
+    while (offset < length) {
+        unsigned long long len = length - offset;
+        int rc = -1;
+
+        if (len > VIR_STORAGE_WIPE_PROGRESS_STEP)
+            len = VIR_STORAGE_WIPE_PROGRESS_STEP;
+
+        errno = EOPNOTSUPP;
+        if (isblock) {
+#if defined(BLKZEROOUT) && defined(BLKDISCARD)
+            uint64_t range[2] = { offset, len };
+
+            rc = ioctl(fd, discard ? BLKDISCARD : BLKZEROOUT, range);
+#endif
+        } else {
+#if HAVE_FALLOCATE && defined(FALLOC_FL_PUNCH_HOLE) && \
+    defined(FALLOC_FL_ZERO_RANGE)
+            rc = fallocate(fd,
+                           FALLOC_FL_KEEP_SIZE |
+                           (discard ? FALLOC_FL_PUNCH_HOLE :
+                            FALLOC_FL_ZERO_RANGE),
+                           offset, len);
+#endif
+        }
+
+        if (rc < 0) {
+            if (offset == 0 &&
+                (errno == EOPNOTSUPP || errno == ENOTTY ||
+                 errno == ENOSYS || errno == EINVAL)) {
+                VIR_DEBUG("Volume with path '%s' cannot be %s by the kernel",
+                          vol->target.path, discard ? "discarded" : "zeroed");
+                return 1;
+            }
+            virReportSystemError(errno,
+                                 _("Failed to wipe %llu bytes at offset %llu "
+                                   "of volume with path '%s'"),
+                                 len, offset, vol->target.path);
+            return -1;
+        }
+
+        offset += len;
+        if (storageVolumeJobProgress(pool, vol, offset, length) < 0)
+            return -1;
+    }
+
+    if (fdatasync(fd) < 0) {
+        virReportSystemError(errno,
+                             _("cannot sync data to volume with path '%s'"),
+                             vol->target.path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static int
-storageVolumeWipeInternal(virStorageVolDefPtr def,
+storageVolumeWipeInternal(virStoragePoolObjPtr pool,
+                          virStorageVolDefPtr def,
                           unsigned int algorithm)
 {
     int ret = -1, fd = -1;
@@ -1973,7 +2602,20 @@ storageVolumeWipeInternal(virStorageVolDefPtr def,
         goto out;
     }
 
-    if (algorithm != VIR_STORAGE_VOL_WIPE_ALG_ZERO) {
+    if (algorithm == VIR_STORAGE_VOL_WIPE_ALG_TRIM) {
+        unsigned long long length = S_ISREG(st.st_mode) ? st.st_size :
+                                                          def->allocation;
+
+        if ((ret = storageWipeOffload(pool, def, fd, S_ISBLK(st.st_mode),
+                                      true, length)) == 1) {
+            virReportError(VIR_ERR_NO_SUPPORT,
+                           _("volume with path '%s' does not support "
+                             "discarding its data"),
+                           def->target.path);
+            ret = -1;
+        }
+        goto out;
+    } else if (algorithm != VIR_STORAGE_VOL_WIPE_ALG_ZERO) {
         const char *alg_char ATTRIBUTE_UNUSED = NULL;
         switch (algorithm) {
         case VIR_STORAGE_VOL_WIPE_ALG_NNSA:
@@ -2017,14 +2659,24 @@ storageVolumeWipeInternal(virStorageVolDefPtr def,
     } else {
         if (S_ISREG(st.st_mode) && st.st_blocks < (st.st_size / DEV_BSIZE)) {
             ret = storageVolumeZeroSparseFile(def, st.st_size, fd);
-        } else {
+        } else if ((ret = storageWipeOffload(pool, def, fd,
+                                             S_ISBLK(st.st_mode), false,
+                                             S_ISREG(st.st_mode) ?
+                                             st.st_size :
+                                             def->allocation)) == 1) {
 
             if (VIR_ALLOC_N(writebuf, st.st_blksize) != 0) {
                 virReportOOMError();
+                ret = -1;
                 goto out;
             }
 
-            ret = storageWipeExtent(def,
+            if (storageVolumeJobProgress(pool, def, 0, def->allocation) < 0) {
+                ret = -1;
+                goto out;
+            }
+            ret = storageWipeExtent(pool,
+                                    def,
                                     fd,
                                     0,
                                     def->allocation,
@@ -2050,9 +2702,10 @@ storageVolumeWipePattern(virStorageVolPtr obj,
     virStorageDriverStatePtr driver = obj->conn->storagePrivateData;
     virStoragePoolObjPtr pool = NULL;
     virStorageVolDefPtr vol = NULL;
+    storageVolJobPtr job;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_WIPE_ASYNC, -1);
 
     if (algorithm >= VIR_STORAGE_VOL_WIPE_ALG_LAST) {
         virReportError(VIR_ERR_INVALID_ARG,
@@ -2094,11 +2747,22 @@ storageVolumeWipePattern(virStorageVolPtr obj,
         goto out;
     }
 
-    if (storageVolumeWipeInternal(vol, algorithm) == -1) {
+    if (vol->job != VIR_STORAGE_VOL_JOB_NONE) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is busy with another job"),
+                       vol->name);
         goto out;
     }
 
-    ret = 0;
+    if (!(job = storageVolJobNew(VIR_STORAGE_VOL_JOB_WIPE, pool, vol, obj)))
+        goto out;
+
+    job->algorithm = algorithm;
+
+    /* Drop the pool lock during the wipe, so that its progress can be
+     * queried */
+    pool = NULL;
+    ret = storageVolJobStart(job, flags & VIR_STORAGE_VOL_WIPE_ASYNC);
 
 out:
     if (pool) {
@@ -2116,6 +2780,120 @@ storageVolumeWipe(virStorageVolPtr obj,
     return storageVolumeWipePattern(obj, VIR_STORAGE_VOL_WIPE_ALG_ZERO, flags);
 }
 
+static int
+storageVolumeGetJobInfo(virStorageVolPtr obj,
+                        virStorageVolJobInfoPtr info,
+                        unsigned int flags)
+{
+    virStorageDriverStatePtr driver = obj->conn->storagePrivateData;
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    storageDriverLock(driver);
+    pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
+    storageDriverUnlock(driver);
+
+    if (!pool) {
+        virReportError(VIR_ERR_NO_STORAGE_POOL,
+                       _("no storage pool with matching name '%s'"),
+                       obj->pool);
+        goto cleanup;
+    }
+
+    if (!virStoragePoolObjIsActive(pool)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("storage pool '%s' is not active"), pool->def->name);
+        goto cleanup;
+    }
+
+    vol = virStorageVolDefFindByName(pool, obj->name);
+
+    if (!vol) {
+        virReportError(VIR_ERR_NO_STORAGE_VOL,
+                       _("no storage vol with matching name '%s'"),
+                       obj->name);
+        goto cleanup;
+    }
+
+    if (vol->job == VIR_STORAGE_VOL_JOB_NONE) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    info->type = vol->job;
+    info->processed = vol->jobProcessed;
+    info->total = vol->jobTotal;
+    ret = 1;
+
+cleanup:
+    if (pool)
+        virStoragePoolObjUnlock(pool);
+    return ret;
+}
+static int
+storageVolumeAbortJob(virStorageVolPtr obj,
+                      unsigned int flags)
+{
+    virStorageDriverStatePtr driver = obj->conn->storagePrivateData;
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    storageDriverLock(driver);
+    pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
+    storageDriverUnlock(driver);
+
+    if (!pool) {
+        virReportError(VIR_ERR_NO_STORAGE_POOL,
+                       _("no storage pool with matching name '%s'"),
+                       obj->pool);
+        goto cleanup;
+    }
+
+    if (!virStoragePoolObjIsActive(pool)) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("storage pool '%s' is not active"), pool->def->name);
+        goto cleanup;
+    }
+
+    vol = virStorageVolDefFindByName(pool, obj->name);
+
+    if (!vol) {
+        virReportError(VIR_ERR_NO_STORAGE_VOL,
+                       _("no storage vol with matching name '%s'"),
+                       obj->name);
+        goto cleanup;
+    }
+
+    if (vol->job == VIR_STORAGE_VOL_JOB_NONE) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("no job is running on volume '%s'"), vol->name);
+        goto cleanup;
+    }
+
+    /* Resizing is one quick call into the backend */
+    if (vol->job == VIR_STORAGE_VOL_JOB_RESIZE) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED,
+                       _("resizing volume '%s' cannot be aborted"),
+                       vol->name);
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Aborting job %d on volume '%s'", vol->job, vol->name);
+    virAtomicIntSet(&vol->jobAbort, 1);
+    ret = 0;
+
+cleanup:
+    if (pool)
+        virStoragePoolObjUnlock(pool);
+    return ret;
+}
+
 static int
 storageVolumeDelete(virStorageVolPtr obj,
                     unsigned int flags) {
@@ -2123,7 +2901,6 @@ storageVolumeDelete(virStorageVolPtr obj,
     virStoragePoolObjPtr pool;
     virStorageBackendPtr backend;
     virStorageVolDefPtr vol = NULL;
-    unsigned int i;
     int ret = -1;
 
     storageDriverLock(driver);
@@ -2162,6 +2939,13 @@ storageVolumeDelete(virStorageVolPtr obj,
         goto cleanup;
     }
 
+    if (vol->job != VIR_STORAGE_VOL_JOB_NONE) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is busy with another job"),
+                       vol->name);
+        goto cleanup;
+    }
+
     if (!backend->deleteVol) {
         virReportError(VIR_ERR_NO_SUPPORT,
                        "%s", _("storage pool does not support vol deletion"));
@@ -2172,25 +2956,11 @@ storageVolumeDelete(virStorageVolPtr obj,
     if (backend->deleteVol(obj->conn, pool, vol, flags) < 0)
         goto cleanup;
 
-    for (i = 0 ; i < pool->volumes.count ; i++) {
-        if (pool->volumes.objs[i] == vol) {
-            VIR_INFO("Deleting volume '%s' from storage pool '%s'",
-                     vol->name, pool->def->name);
-            virStorageVolDefFree(vol);
-            vol = NULL;
-
-            if (i < (pool->volumes.count - 1))
-                memmove(pool->volumes.objs + i, pool->volumes.objs + i + 1,
-                        sizeof(*(pool->volumes.objs)) * (pool->volumes.count - (i + 1)));
-
-            if (VIR_REALLOC_N(pool->volumes.objs, pool->volumes.count - 1) < 0) {
-                ; /* Failure to reduce memory allocation isn't fatal */
-            }
-            pool->volumes.count--;
-
-            break;
-        }
-    }
+    VIR_INFO("Deleting volume '%s' from storage pool '%s'",
+             vol->name, pool->def->name);
+    virStoragePoolObjRemoveVol(pool, vol);
+    virStorageVolDefFree(vol);
+    vol = NULL;
     ret = 0;
 
 cleanup:
@@ -2366,6 +3136,23 @@ storageListAllPools(virConnectPtr conn,
     return ret;
 }
 
+static int
+storageGetListGeneration(virConnectPtr conn,
+                         unsigned int type ATTRIBUTE_UNUSED,
+                         unsigned long long *generation,
+                         unsigned int flags)
+{
+    virStorageDriverStatePtr driver = conn->storagePrivateData;
+
+    virCheckFlags(0, -1);
+
+    storageDriverLock(driver);
+    *generation = driver->pools.generation;
+    storageDriverUnlock(driver);
+
+    return 0;
+}
+
 static virStorageDriver storageDriver = {
     .name = "storage",
     .open = storageOpen, /* 0.4.0 */
@@ -2409,9 +3196,12 @@ static virStorageDriver storageDriver = {
     .volGetXMLDesc = storageVolumeGetXMLDesc, /* 0.4.0 */
     .volGetPath = storageVolumeGetPath, /* 0.4.0 */
     .volResize = storageVolumeResize, /* 0.9.10 */
+    .volGetJobInfo = storageVolumeGetJobInfo, /* 1.0.2 */
+    .volAbortJob = storageVolumeAbortJob, /* 1.0.2 */
 
     .poolIsActive = storagePoolIsActive, /* 0.7.3 */
     .poolIsPersistent = storagePoolIsPersistent, /* 0.7.3 */
+    .connectGetListGeneration = storageGetListGeneration, /* 1.0.2 */
 };
 
 
@@ -2420,6 +3210,7 @@ static virStateDriver stateDriver = {
     .initialize = storageDriverStartup,
     .cleanup = storageDriverShutdown,
     .reload = storageDriverReload,
+    .preExecRestart = storageDriverPreExecRestart,
 };
 
 int storageRegister(void) {
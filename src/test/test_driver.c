@@ -94,6 +94,14 @@ struct _testConn {
     testCell cells[MAX_CELLS];
 
     virDomainEventStatePtr domainEventState;
+
+    /* Simulated hypervisor behaviour, from test:///scale parameters */
+    unsigned int latency;       /* milliseconds added to each API call */
+    size_t nscaleDomains;       /* number of synthesized "test-N" domains */
+    unsigned int eventRate;     /* lifecycle events per second, 0 for none */
+    unsigned int eventsPerTick;
+    int eventTimer;
+    size_t eventNext;
 };
 typedef struct _testConn testConn;
 typedef struct _testConn *testConnPtr;
@@ -102,6 +110,9 @@ typedef struct _testConn *testConnPtr;
 #define TEST_MODEL_WORDSIZE 32
 #define TEST_EMULATOR "/usr/bin/test-hv"
 
+/* Upper bound on each test:///scale object count, to catch typos */
+#define TEST_SCALE_MAX 100000
+
 static const virNodeInfo defaultNodeInfo = {
     TEST_MODEL,
     1024*1024*3, /* 3 GB */
@@ -121,6 +132,11 @@ static void testDomainEventQueue(testConnPtr driver,
 
 static void testDriverLock(testConnPtr driver)
 {
+    /* Every API call takes the driver lock, so this is where the
+     * simulated hypervisor round trip goes. Sleep before locking so
+     * slow calls overlap rather than queue behind each other. */
+    if (driver->latency)
+        usleep(driver->latency * 1000);
     virMutexLock(&driver->lock);
 }
 
@@ -313,6 +329,38 @@ static const char *defaultNodeXML =
 "  </capability>"
 "</device>";
 
+/* Templates for the objects synthesized by test:///scale */
+static const char *scaleDomainXML =
+"<domain type='test'>"
+"  <name>test-%zu</name>"
+"  <memory>1048576</memory>"
+"  <currentMemory>1048576</currentMemory>"
+"  <vcpu>1</vcpu>"
+"  <os>"
+"    <type>hvm</type>"
+"  </os>"
+"</domain>";
+
+static const char *scaleNetworkXML =
+"<network>"
+"  <name>net-%zu</name>"
+"  <bridge name='testbr%zu' />"
+"</network>";
+
+static const char *scalePoolXML =
+"<pool type='dir'>"
+"  <name>pool-%zu</name>"
+"  <target>"
+"    <path>/pool-%zu</path>"
+"  </target>"
+"</pool>";
+
+static const char *scaleVolumeXML =
+"<volume>"
+"  <name>vol-%zu</name>"
+"  <capacity>1073741824</capacity>"
+"</volume>";
+
 static const unsigned long long defaultPoolCap = (100 * 1024 * 1024 * 1024ull);
 static const unsigned long long defaultPoolAlloc = 0;
 
@@ -641,6 +689,273 @@ error:
 }
 
 
+/* Add @count domains "test-0".."test-N" to a freshly opened connection;
+ * every other one is left running */
+static int
+testScaleAddDomains(virConnectPtr conn, size_t count)
+{
+    testConnPtr privconn = conn->privateData;
+    virDomainDefPtr def = NULL;
+    virDomainObjPtr obj;
+    char *xml = NULL;
+    size_t i;
+    int ret = -1;
+
+    for (i = 0; i < count; i++) {
+        if (virAsprintf(&xml, scaleDomainXML, i) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        if (!(def = virDomainDefParseString(privconn->caps, xml,
+                                            1 << VIR_DOMAIN_VIRT_TEST,
+                                            VIR_DOMAIN_XML_INACTIVE)))
+            goto cleanup;
+        VIR_FREE(xml);
+
+        if (virDomainObjIsDuplicate(&privconn->domains, def, 0) < 0)
+            goto cleanup;
+        if (!(obj = virDomainAssignDef(privconn->caps,
+                                       &privconn->domains, def, false)))
+            goto cleanup;
+        def = NULL;
+
+        obj->persistent = 1;
+        if (i % 2 == 0 &&
+            testDomainStartState(conn, obj, VIR_DOMAIN_RUNNING_BOOTED) < 0) {
+            virDomainObjUnlock(obj);
+            goto cleanup;
+        }
+        virDomainObjUnlock(obj);
+    }
+
+    privconn->nscaleDomains = count;
+    ret = 0;
+
+cleanup:
+    VIR_FREE(xml);
+    virDomainDefFree(def);
+    return ret;
+}
+
+static int
+testScaleAddNetworks(testConnPtr privconn, size_t count)
+{
+    virNetworkDefPtr def;
+    virNetworkObjPtr obj;
+    char *xml = NULL;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (virAsprintf(&xml, scaleNetworkXML, i, i) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+        def = virNetworkDefParseString(xml);
+        VIR_FREE(xml);
+        if (!def)
+            return -1;
+
+        if (!(obj = virNetworkAssignDef(&privconn->networks, def, false))) {
+            virNetworkDefFree(def);
+            return -1;
+        }
+        obj->active = 1;
+        obj->persistent = 1;
+        virNetworkObjUnlock(obj);
+    }
+
+    return 0;
+}
+
+/* Add @count pools "pool-0".."pool-N", each holding @nvolumes volumes */
+static int
+testScaleAddPools(testConnPtr privconn, size_t count, size_t nvolumes)
+{
+    virStoragePoolDefPtr def;
+    virStoragePoolObjPtr obj = NULL;
+    virStorageVolDefPtr vol = NULL;
+    char *xml = NULL;
+    size_t i, j;
+    int ret = -1;
+
+    for (i = 0; i < count; i++) {
+        if (virAsprintf(&xml, scalePoolXML, i, i) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        def = virStoragePoolDefParseString(xml);
+        VIR_FREE(xml);
+        if (!def)
+            goto cleanup;
+
+        if (!(obj = virStoragePoolObjAssignDef(&privconn->pools, def))) {
+            virStoragePoolDefFree(def);
+            goto cleanup;
+        }
+        if (testStoragePoolObjSetDefaults(obj) < 0)
+            goto cleanup;
+        obj->active = 1;
+
+        for (j = 0; j < nvolumes; j++) {
+            if (virAsprintf(&xml, scaleVolumeXML, j) < 0) {
+                virReportOOMError();
+                goto cleanup;
+            }
+            vol = virStorageVolDefParseString(obj->def, xml);
+            VIR_FREE(xml);
+            if (!vol)
+                goto cleanup;
+
+            if (virAsprintf(&vol->target.path, "%s/%s",
+                            obj->def->target.path, vol->name) < 0 ||
+                !(vol->key = strdup(vol->target.path))) {
+                virReportOOMError();
+                goto cleanup;
+            }
+
+            if (virStoragePoolObjAddVol(obj, vol) < 0)
+                goto cleanup;
+
+            obj->def->allocation += vol->allocation;
+            obj->def->available = (obj->def->capacity -
+                                   obj->def->allocation);
+            vol = NULL;
+        }
+
+        virStoragePoolObjUnlock(obj);
+        obj = NULL;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (obj)
+        virStoragePoolObjUnlock(obj);
+    virStorageVolDefFree(vol);
+    VIR_FREE(xml);
+    return ret;
+}
+
+/* Flip the next synthesized domain between running and paused */
+static void
+testScaleEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
+{
+    testConnPtr privconn = opaque;
+    virDomainObjPtr obj;
+    virDomainEventPtr event;
+    char name[64];
+    unsigned int i;
+
+    /* This runs in the event loop, so skip the simulated latency */
+    virMutexLock(&privconn->lock);
+    for (i = 0; i < privconn->eventsPerTick; i++) {
+        snprintf(name, sizeof(name), "test-%zu",
+                 privconn->eventNext++ % privconn->nscaleDomains);
+        if (!(obj = virDomainFindByName(&privconn->domains, name)))
+            continue;
+
+        event = NULL;
+        switch (virDomainObjGetState(obj, NULL)) {
+        case VIR_DOMAIN_RUNNING:
+            virDomainObjSetState(obj, VIR_DOMAIN_PAUSED,
+                                 VIR_DOMAIN_PAUSED_USER);
+            event = virDomainEventNewFromObj(obj,
+                                             VIR_DOMAIN_EVENT_SUSPENDED,
+                                             VIR_DOMAIN_EVENT_SUSPENDED_PAUSED);
+            break;
+        case VIR_DOMAIN_PAUSED:
+            virDomainObjSetState(obj, VIR_DOMAIN_RUNNING,
+                                 VIR_DOMAIN_RUNNING_UNPAUSED);
+            event = virDomainEventNewFromObj(obj,
+                                             VIR_DOMAIN_EVENT_RESUMED,
+                                             VIR_DOMAIN_EVENT_RESUMED_UNPAUSED);
+            break;
+        default:
+            break;
+        }
+        virDomainObjUnlock(obj);
+
+        if (event)
+            testDomainEventQueue(privconn, event);
+    }
+    virMutexUnlock(&privconn->lock);
+}
+
+/*
+ * test:///scale starts from the default config and adds the objects
+ * and behaviour named by the URI parameters, e.g.
+ *
+ *   test:///scale?domains=1000&pools=10&volumes=100&latency=5&events=50
+ */
+static int
+testOpenScale(virConnectPtr conn)
+{
+    testConnPtr privconn;
+    unsigned int domains = 0, networks = 0, pools = 0, volumes = 0;
+    unsigned int latency = 0, events = 0;
+    int ret;
+    size_t i;
+
+    for (i = 0; i < conn->uri->paramsCount; i++) {
+        virURIParamPtr param = &conn->uri->params[i];
+        unsigned int *value;
+
+        if (STREQ(param->name, "domains")) {
+            value = &domains;
+        } else if (STREQ(param->name, "networks")) {
+            value = &networks;
+        } else if (STREQ(param->name, "pools")) {
+            value = &pools;
+        } else if (STREQ(param->name, "volumes")) {
+            value = &volumes;
+        } else if (STREQ(param->name, "latency")) {
+            value = &latency;
+        } else if (STREQ(param->name, "events")) {
+            value = &events;
+        } else {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("unknown test:///scale parameter '%s'"),
+                           param->name);
+            return VIR_DRV_OPEN_ERROR;
+        }
+
+        if (virStrToLong_ui(param->value, NULL, 10, value) < 0 ||
+            *value > TEST_SCALE_MAX) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("invalid value '%s' for test:///scale parameter '%s'"),
+                           param->value, param->name);
+            return VIR_DRV_OPEN_ERROR;
+        }
+    }
+
+    if ((ret = testOpenDefault(conn)) != VIR_DRV_OPEN_SUCCESS)
+        return ret;
+
+    privconn = conn->privateData;
+    testDriverLock(privconn);
+
+    if (testScaleAddDomains(conn, domains) < 0 ||
+        testScaleAddNetworks(privconn, networks) < 0 ||
+        testScaleAddPools(privconn, pools, volumes) < 0)
+        goto error;
+
+    /* Events are generated by the synthesized domains */
+    if (privconn->nscaleDomains) {
+        privconn->eventRate = events;
+        privconn->eventsPerTick = (events + 999) / 1000;
+    }
+    privconn->latency = latency;
+
+    testDriverUnlock(privconn);
+    return VIR_DRV_OPEN_SUCCESS;
+
+error:
+    testDriverUnlock(privconn);
+    testClose(conn);
+    return VIR_DRV_OPEN_ERROR;
+}
+
+
 static char *testBuildFilename(const char *relativeTo,
                                const char *filename) {
     char *offset;
@@ -711,12 +1026,6 @@ static int testOpenVolumesForPool(xmlDocPtr xml,
             }
         }
 
-        if (VIR_REALLOC_N(pool->volumes.objs,
-                          pool->volumes.count+1) < 0) {
-            virReportOOMError();
-            goto error;
-        }
-
         if (def->target.path == NULL) {
             if (virAsprintf(&def->target.path, "%s/%s",
                             pool->def->target.path,
@@ -734,11 +1043,13 @@ static int testOpenVolumesForPool(xmlDocPtr xml,
             }
         }
 
+        if (virStoragePoolObjAddVol(pool, def) < 0)
+            goto error;
+
         pool->def->allocation += def->allocation;
         pool->def->available = (pool->def->capacity -
                                 pool->def->allocation);
 
-        pool->volumes.objs[pool->volumes.count++] = def;
         def = NULL;
     }
 
@@ -1137,6 +1448,8 @@ static virDrvOpenStatus testOpen(virConnectPtr conn,
 
     if (STREQ(conn->uri->path, "/default"))
         ret = testOpenDefault(conn);
+    else if (STREQ(conn->uri->path, "/scale"))
+        ret = testOpenScale(conn);
     else
         ret = testOpenFromFile(conn,
                                conn->uri->path);
@@ -1154,6 +1467,22 @@ static virDrvOpenStatus testOpen(virConnectPtr conn,
         return VIR_DRV_OPEN_ERROR;
     }
 
+    if (privconn->eventRate) {
+        int period = privconn->eventRate >= 1000 ?
+            1 : 1000 / privconn->eventRate;
+
+        if ((privconn->eventTimer = virEventAddTimeout(period,
+                                                       testScaleEventTimer,
+                                                       privconn, NULL)) < 0) {
+            privconn->eventRate = 0;
+            testDriverUnlock(privconn);
+            virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                           _("simulated events need a registered event loop"));
+            testClose(conn);
+            return VIR_DRV_OPEN_ERROR;
+        }
+    }
+
     testDriverUnlock(privconn);
 
     return VIR_DRV_OPEN_SUCCESS;
@@ -1162,6 +1491,10 @@ static virDrvOpenStatus testOpen(virConnectPtr conn,
 static int testClose(virConnectPtr conn)
 {
     testConnPtr privconn = conn->privateData;
+
+    if (privconn->eventRate)
+        virEventRemoveTimeout(privconn->eventTimer);
+
     testDriverLock(privconn);
     virCapabilitiesFree(privconn->caps);
     virDomainObjListDeinit(&privconn->domains);
@@ -1500,11 +1833,8 @@ static int testResumeDomain(virDomainPtr domain)
 cleanup:
     if (privdom)
         virDomainObjUnlock(privdom);
-    if (event) {
-        testDriverLock(privconn);
+    if (event)
         testDomainEventQueue(privconn, event);
-        testDriverUnlock(privconn);
-    }
     return ret;
 }
 
@@ -1543,11 +1873,8 @@ cleanup:
     if (privdom)
         virDomainObjUnlock(privdom);
 
-    if (event) {
-        testDriverLock(privconn);
+    if (event)
         testDomainEventQueue(privconn, event);
-        testDriverUnlock(privconn);
-    }
     return ret;
 }
 
@@ -4856,12 +5183,6 @@ testStorageVolumeCreateXML(virStoragePoolPtr pool,
         goto cleanup;
     }
 
-    if (VIR_REALLOC_N(privpool->volumes.objs,
-                      privpool->volumes.count+1) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
     if (virAsprintf(&privvol->target.path, "%s/%s",
                     privpool->def->target.path,
                     privvol->name) == -1) {
@@ -4875,12 +5196,13 @@ testStorageVolumeCreateXML(virStoragePoolPtr pool,
         goto cleanup;
     }
 
+    if (virStoragePoolObjAddVol(privpool, privvol) < 0)
+        goto cleanup;
+
     privpool->def->allocation += privvol->allocation;
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    privpool->volumes.objs[privpool->volumes.count++] = privvol;
-
     ret = virGetStorageVol(pool->conn, privpool->def->name,
                            privvol->name, privvol->key,
                            NULL, NULL);
@@ -4951,12 +5273,6 @@ testStorageVolumeCreateXMLFrom(virStoragePoolPtr pool,
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    if (VIR_REALLOC_N(privpool->volumes.objs,
-                      privpool->volumes.count+1) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
     if (virAsprintf(&privvol->target.path, "%s/%s",
                     privpool->def->target.path,
                     privvol->name) == -1) {
@@ -4970,12 +5286,13 @@ testStorageVolumeCreateXMLFrom(virStoragePoolPtr pool,
         goto cleanup;
     }
 
+    if (virStoragePoolObjAddVol(privpool, privvol) < 0)
+        goto cleanup;
+
     privpool->def->allocation += privvol->allocation;
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    privpool->volumes.objs[privpool->volumes.count++] = privvol;
-
     ret = virGetStorageVol(pool->conn, privpool->def->name,
                            privvol->name, privvol->key,
                            NULL, NULL);
@@ -4995,7 +5312,6 @@ testStorageVolumeDelete(virStorageVolPtr vol,
     testConnPtr privconn = vol->conn->privateData;
     virStoragePoolObjPtr privpool;
     virStorageVolDefPtr privvol;
-    int i;
     int ret = -1;
 
     virCheckFlags(0, -1);
@@ -5031,25 +5347,8 @@ testStorageVolumeDelete(virStorageVolPtr vol,
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    for (i = 0 ; i < privpool->volumes.count ; i++) {
-        if (privpool->volumes.objs[i] == privvol) {
-            virStorageVolDefFree(privvol);
-
-            if (i < (privpool->volumes.count - 1))
-                memmove(privpool->volumes.objs + i,
-                        privpool->volumes.objs + i + 1,
-                        sizeof(*(privpool->volumes.objs)) *
-                                (privpool->volumes.count - (i + 1)));
-
-            if (VIR_REALLOC_N(privpool->volumes.objs,
-                              privpool->volumes.count - 1) < 0) {
-                ; /* Failure to reduce memory allocation isn't fatal */
-            }
-            privpool->volumes.count--;
-
-            break;
-        }
-    }
+    virStoragePoolObjRemoveVol(privpool, privvol);
+    virStorageVolDefFree(privvol);
     ret = 0;
 
 cleanup:
@@ -5637,7 +5936,7 @@ testDomainEventDeregisterAny(virConnectPtr conn,
 }
 
 
-/* driver must be locked before calling */
+/* The event state has its own lock, so the driver lock need not be held */
 static void testDomainEventQueue(testConnPtr driver,
                                  virDomainEventPtr event)
 {
@@ -5691,7 +5990,7 @@ static int testListAllDomains(virConnectPtr conn,
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
 
     testDriverLock(privconn);
-    ret = virDomainList(conn, privconn->domains.objs, domains, flags);
+    ret = virDomainList(conn, &privconn->domains, domains, flags);
     testDriverUnlock(privconn);
 
     return ret;
@@ -5728,9 +6027,12 @@ cleanup:
 }
 
 
+static const char *testURISchemes[] = { "test", NULL };
+
 static virDriver testDriver = {
     .no = VIR_DRV_TEST,
     .name = "Test",
+    .uriSchemes = testURISchemes,
     .open = testOpen, /* 0.1.1 */
     .close = testClose, /* 0.1.1 */
     .version = testGetVersion, /* 0.1.1 */
@@ -2555,7 +2555,7 @@ static int umlListAllDomains(virConnectPtr conn,
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ALL, -1);
 
     umlDriverLock(driver);
-    ret = virDomainList(conn, driver->domains.objs, domains, flags);
+    ret = virDomainList(conn, &driver->domains, domains, flags);
     umlDriverUnlock(driver);
 
     return ret;
@@ -2563,9 +2563,12 @@ static int umlListAllDomains(virConnectPtr conn,
 
 
 
+static const char *umlURISchemes[] = { "uml", NULL };
+
 static virDriver umlDriver = {
     .no = VIR_DRV_UML,
     .name = "UML",
+    .uriSchemes = umlURISchemes,
     .open = umlOpen, /* 0.5.0 */
     .close = umlClose, /* 0.5.0 */
     .type = umlGetType, /* 0.5.0 */
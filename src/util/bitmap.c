@@ -154,6 +154,38 @@ static bool virBitmapIsSet(virBitmapPtr bitmap, size_t b)
     return !!(bitmap->map[VIR_BITMAP_UNIT_OFFSET(b)] & VIR_BITMAP_BIT(b));
 }
 
+/* Helper function. Set bits @start to @last inclusive in @bitmap,
+ * silently ignoring those beyond its size, and return the number of
+ * bits which were not already set */
+static size_t virBitmapSetRange(virBitmapPtr bitmap, size_t start, size_t last)
+{
+    size_t first, nl, ll;
+    size_t ret = 0;
+    unsigned long mask;
+
+    if (start >= bitmap->max_bit)
+        return 0;
+    if (last >= bitmap->max_bit)
+        last = bitmap->max_bit - 1;
+
+    first = VIR_BITMAP_UNIT_OFFSET(start);
+    ll = VIR_BITMAP_UNIT_OFFSET(last);
+
+    for (nl = first; nl <= ll; nl++) {
+        mask = -1UL;
+        if (nl == first)
+            mask &= ~(VIR_BITMAP_BIT(start) - 1);
+        if (nl == ll)
+            mask &= -1UL >> (VIR_BITMAP_BITS_PER_UNIT - 1 -
+                             VIR_BITMAP_BIT_OFFSET(last));
+
+        ret += count_one_bits_l(mask & ~bitmap->map[nl]);
+        bitmap->map[nl] |= mask;
+    }
+
+    return ret;
+}
+
 /**
  * virBitmapGetBit:
  * @bitmap: Pointer to bitmap
@@ -230,16 +262,12 @@ char *virBitmapFormat(virBitmapPtr bitmap)
     if (cur < 0)
         return strdup("");
 
-    start = prev = cur;
-    while (prev >= 0) {
-        cur = virBitmapNextSetBit(bitmap, prev);
-
-        if (cur == prev + 1) {
-            prev = cur;
-            continue;
-        }
-
-        /* cur < 0 or cur > prev + 1 */
+    start = cur;
+    while (start >= 0) {
+        /* Whole words of set bits are skipped at once */
+        if ((cur = virBitmapNextClearBit(bitmap, start)) < 0)
+            cur = bitmap->max_bit;
+        prev = cur - 1;
 
         if (!first)
             virBufferAddLit(&buf, ",");
@@ -251,7 +279,7 @@ char *virBitmapFormat(virBitmapPtr bitmap)
         else
             virBufferAsprintf(&buf, "%d-%d", start, prev);
 
-        start = prev = cur;
+        start = virBitmapNextSetBit(bitmap, prev);
     }
 
     if (virBufferError(&buf)) {
@@ -287,7 +315,7 @@ int virBitmapParse(const char *str,
     bool neg = false;
     const char *cur;
     char *tmp;
-    int i, start, last;
+    int start, last;
 
     if (!str)
         return -1;
@@ -352,12 +380,7 @@ int virBitmapParse(const char *str,
 
             cur = tmp;
 
-            for (i = start; i <= last; i++) {
-                if (!virBitmapIsSet(*bitmap, i)) {
-                    ignore_value(virBitmapSetBit(*bitmap, i));
-                    ret++;
-                }
-            }
+            ret += virBitmapSetRange(*bitmap, start, last);
 
             virSkipSpaces(&cur);
         }
@@ -622,6 +645,51 @@ ssize_t virBitmapNextSetBit(virBitmapPtr bitmap, ssize_t pos)
     return ffsl(bits) - 1 + nl * VIR_BITMAP_BITS_PER_UNIT;
 }
 
+/**
+ * virBitmapNextClearBit:
+ * @bitmap: the bitmap
+ * @pos: the position after which to search for a clear bit
+ *
+ * search the first clear bit after position @pos in bitmap @bitmap.
+ * @pos can be -1 to search for the first clear bit. Position starts
+ * at 0.
+ *
+ * returns the position of the found bit, or -1 if no bit found.
+ */
+ssize_t virBitmapNextClearBit(virBitmapPtr bitmap, ssize_t pos)
+{
+    size_t nl;
+    size_t nb;
+    unsigned long bits;
+
+    if (pos < 0)
+        pos = -1;
+
+    pos++;
+
+    if (pos >= bitmap->max_bit)
+        return -1;
+
+    nl = pos / VIR_BITMAP_BITS_PER_UNIT;
+    nb = pos % VIR_BITMAP_BITS_PER_UNIT;
+
+    bits = ~bitmap->map[nl] & ~((1UL << nb) - 1);
+
+    while (bits == 0 && ++nl < bitmap->map_len) {
+        bits = ~bitmap->map[nl];
+    }
+
+    if (bits == 0)
+        return -1;
+
+    /* the unused tail of the last unit is always clear */
+    pos = ffsl(bits) - 1 + nl * VIR_BITMAP_BITS_PER_UNIT;
+    if (pos >= bitmap->max_bit)
+        return -1;
+
+    return pos;
+}
+
 /* Return the number of bits currently set in the map.  */
 size_t
 virBitmapCountBits(virBitmapPtr bitmap)
@@ -634,3 +702,88 @@ virBitmapCountBits(virBitmapPtr bitmap)
 
     return ret;
 }
+
+/**
+ * virBitmapIntersect:
+ * @dst: the bitmap to modify
+ * @src: the bitmap to intersect with
+ *
+ * Clear every bit in @dst which is not also set in @src. The
+ * bitmaps may have different sizes.
+ */
+void virBitmapIntersect(virBitmapPtr dst, virBitmapPtr src)
+{
+    size_t i;
+
+    for (i = 0; i < dst->map_len; i++) {
+        if (i < src->map_len)
+            dst->map[i] &= src->map[i];
+        else
+            dst->map[i] = 0;
+    }
+}
+
+/**
+ * virBitmapUnion:
+ * @dst: the bitmap to modify
+ * @src: the bitmap to merge in
+ *
+ * Set every bit in @dst which is set in @src. The bitmaps may have
+ * different sizes, as long as all bits set in @src fit in @dst.
+ *
+ * Returns 0 on success, -1 (leaving @dst untouched) if @src has a
+ * bit set beyond the size of @dst.
+ */
+int virBitmapUnion(virBitmapPtr dst, virBitmapPtr src)
+{
+    size_t i;
+
+    if (src->max_bit > dst->max_bit &&
+        virBitmapNextSetBit(src, dst->max_bit - 1) >= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < dst->map_len && i < src->map_len; i++)
+        dst->map[i] |= src->map[i];
+
+    return 0;
+}
+
+/**
+ * virBitmapSubtract:
+ * @dst: the bitmap to modify
+ * @src: the bits to remove
+ *
+ * Clear every bit in @dst which is set in @src. The bitmaps may
+ * have different sizes.
+ */
+void virBitmapSubtract(virBitmapPtr dst, virBitmapPtr src)
+{
+    size_t i;
+
+    for (i = 0; i < dst->map_len && i < src->map_len; i++)
+        dst->map[i] &= ~src->map[i];
+}
+
+/**
+ * virBitmapOverlaps:
+ * @b1: bitmap 1
+ * @b2: bitmap 2
+ *
+ * Checks whether two bitmaps, whose lengths can be different from
+ * each other, have at least one bit set in common.
+ *
+ * Returns true if they do, otherwise false.
+ */
+bool virBitmapOverlaps(virBitmapPtr b1, virBitmapPtr b2)
+{
+    size_t i;
+
+    for (i = 0; i < b1->map_len && i < b2->map_len; i++) {
+        if (b1->map[i] & b2->map[i])
+            return true;
+    }
+
+    return false;
+}
@@ -126,6 +126,12 @@ virBufferGrow(virBufferPtr buf, unsigned int len)
 
     size = buf->use + len + 1000;
 
+    /* Grow geometrically so that a long sequence of small appends,
+     * such as formatting a large domain XML, needs only a logarithmic
+     * number of reallocations */
+    if (buf->size <= INT_MAX / 2 && size < buf->size * 2)
+        size = buf->size * 2;
+
     if (VIR_REALLOC_N(buf->content, size) < 0) {
         virBufferSetError(buf, errno);
         return -1;
@@ -296,6 +302,127 @@ virBufferAsprintf(virBufferPtr buf, const char *format, ...)
     va_end(argptr);
 }
 
+/**
+ * virBufferAddFormatted:
+ * @buf: the buffer to append to
+ * @prefix: text to add first
+ * @prefixlen: length of @prefix
+ * @str: the expanded conversion
+ * @len: length of @str
+ * @suffix: NUL-terminated text to add last
+ *
+ * Append the three pieces of an expanded format with a single grow.
+ * Auto indentation must already have been applied.
+ */
+static void
+virBufferAddFormatted(virBufferPtr buf, const char *prefix, size_t prefixlen,
+                      const char *str, size_t len, const char *suffix)
+{
+    size_t suffixlen = strlen(suffix);
+    size_t need = prefixlen + len + suffixlen;
+
+    if (need > INT_MAX - 1 - buf->use) {
+        virBufferSetError(buf, ERANGE);
+        return;
+    }
+    if (virBufferGrow(buf, need + 1) < 0)
+        return;
+
+    memcpy(&buf->content[buf->use], prefix, prefixlen);
+    buf->use += prefixlen;
+    memcpy(&buf->content[buf->use], str, len);
+    buf->use += len;
+    memcpy(&buf->content[buf->use], suffix, suffixlen + 1);
+    buf->use += suffixlen;
+}
+
+/**
+ * virBufferFormatFast:
+ * @buf: the buffer to append to
+ * @format: the format
+ * @argptr: the variable list of arguments
+ *
+ * Most formats used while generating XML have a single plain %s or
+ * integer conversion.  Expand those without the cost of vsnprintf.
+ *
+ * Returns true if @format was handled, false if it needs vsnprintf.
+ */
+static bool
+virBufferFormatFast(virBufferPtr buf, const char *format, va_list argptr)
+{
+    const char *conv = strchr(format, '%');
+    const char *spec;
+    const char *str;
+    char digits[3 * sizeof(unsigned long long) + 2];
+    char *end = digits + sizeof(digits);
+    unsigned long long value;
+    bool negative = false;
+    va_list copy;
+
+    if (!conv)
+        return false;
+
+    /* Length modifier, then conversion; nothing else is accepted */
+    spec = conv + 1;
+    if (spec[0] == 'l' && spec[1] == 'l')
+        spec += 2;
+    else if (spec[0] == 'l' || spec[0] == 'z')
+        spec++;
+    if (spec[0] == '\0' || !strchr("sdiu", spec[0]) ||
+        (spec[0] == 's' && spec != conv + 1) ||
+        strchr(spec + 1, '%'))
+        return false;
+
+    va_copy(copy, argptr);
+    if (spec[0] == 's') {
+        str = va_arg(copy, const char *);
+        va_end(copy);
+        if (!str)
+            return false;
+        virBufferAddFormatted(buf, format, conv - format,
+                              str, strlen(str), spec + 1);
+        return true;
+    }
+
+    if (spec[0] == 'u') {
+        if (spec - conv == 3)
+            value = va_arg(copy, unsigned long long);
+        else if (conv[1] == 'z')
+            value = va_arg(copy, size_t);
+        else if (conv[1] == 'l')
+            value = va_arg(copy, unsigned long);
+        else
+            value = va_arg(copy, unsigned int);
+    } else {
+        long long svalue;
+
+        if (conv[1] == 'z') {
+            va_end(copy);
+            return false;
+        }
+        if (spec - conv == 3)
+            svalue = va_arg(copy, long long);
+        else if (conv[1] == 'l')
+            svalue = va_arg(copy, long);
+        else
+            svalue = va_arg(copy, int);
+        negative = svalue < 0;
+        value = negative ? -(unsigned long long)svalue : svalue;
+    }
+    va_end(copy);
+
+    do {
+        *--end = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    if (negative)
+        *--end = '-';
+
+    virBufferAddFormatted(buf, format, conv - format,
+                          end, digits + sizeof(digits) - end, spec + 1);
+    return true;
+}
+
 /**
  * virBufferVasprintf:
  * @buf: the buffer to append to
@@ -318,6 +445,9 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
 
     virBufferAddLit(buf, ""); /* auto-indent */
 
+    if (buf->error || virBufferFormatFast(buf, format, argptr))
+        return;
+
     if (buf->size == 0 &&
         virBufferGrow(buf, 100) < 0)
         return;
@@ -352,6 +482,124 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
     buf->use += count;
 }
 
+/**
+ * virBufferSplitFormat:
+ * @format: a printf like format string
+ * @prefixlen: set to the length of the text before the conversion
+ *
+ * Check whether @format contains exactly one "%s" conversion and no
+ * other directive, so that it can be expanded without going through
+ * vsnprintf.
+ *
+ * Returns the text following the conversion, or NULL if @format is
+ * anything more complex.
+ */
+static const char *
+virBufferSplitFormat(const char *format, size_t *prefixlen)
+{
+    const char *conv = strchr(format, '%');
+
+    if (!conv || conv[1] != 's' || strchr(conv + 2, '%'))
+        return NULL;
+
+    *prefixlen = conv - format;
+    return conv + 2;
+}
+
+/**
+ * virBufferEscapeReserve:
+ * @buf: the buffer to append to
+ * @format: a printf like format string with a single %s
+ * @maxlen: upper bound on the length of the escaped string
+ * @suffix: set to the text following the conversion in @format
+ *
+ * Apply auto indentation, and grow @buf so that @format can be
+ * expanded directly in place with an escaped string of at most
+ * @maxlen bytes.  The prefix of @format is copied in.  This avoids
+ * allocating a temporary copy of the escaped string.
+ *
+ * Returns the location to write the escaped string to, or NULL if
+ * @format is not simple enough or on error (in which case the
+ * buffer error indicator is set).
+ */
+static char *
+virBufferEscapeReserve(virBufferPtr buf, const char *format,
+                       size_t maxlen, const char **suffix)
+{
+    size_t prefixlen;
+    size_t need;
+
+    if (!(*suffix = virBufferSplitFormat(format, &prefixlen)))
+        return NULL;
+
+    virBufferAddLit(buf, ""); /* auto-indent */
+    if (buf->error)
+        return NULL;
+
+    need = prefixlen + strlen(*suffix);
+    if (maxlen > INT_MAX - need - 1 - buf->use) {
+        virBufferSetError(buf, ERANGE);
+        return NULL;
+    }
+    need += maxlen + 1;
+
+    if (virBufferGrow(buf, need) < 0)
+        return NULL;
+
+    memcpy(&buf->content[buf->use], format, prefixlen);
+    return &buf->content[buf->use + prefixlen];
+}
+
+/**
+ * virBufferEscapeCommit:
+ * @buf: the buffer written to by virBufferEscapeReserve
+ * @end: the end of the escaped string
+ * @suffix: the text following the conversion in the format
+ *
+ * Complete an in-place expansion started by virBufferEscapeReserve.
+ */
+static void
+virBufferEscapeCommit(virBufferPtr buf, char *end, const char *suffix)
+{
+    size_t len = strlen(suffix);
+
+    memcpy(end, suffix, len + 1);
+    buf->use = end + len - buf->content;
+}
+
+/* How each byte is written in XML text: unlisted bytes are copied as
+ * is, and control characters that XML cannot carry are dropped */
+typedef struct _virBufferXMLEscape virBufferXMLEscape;
+struct _virBufferXMLEscape {
+    const char *rep;
+    size_t len;
+};
+
+#define VIR_BUFFER_XML_ESCAPE(str) { str, sizeof(str) - 1 }
+#define VIR_BUFFER_XML_DROP VIR_BUFFER_XML_ESCAPE("")
+
+static const virBufferXMLEscape virBufferXMLEscapes[256] = {
+    [0x01] = VIR_BUFFER_XML_DROP, [0x02] = VIR_BUFFER_XML_DROP,
+    [0x03] = VIR_BUFFER_XML_DROP, [0x04] = VIR_BUFFER_XML_DROP,
+    [0x05] = VIR_BUFFER_XML_DROP, [0x06] = VIR_BUFFER_XML_DROP,
+    [0x07] = VIR_BUFFER_XML_DROP, [0x08] = VIR_BUFFER_XML_DROP,
+    [0x0b] = VIR_BUFFER_XML_DROP, [0x0c] = VIR_BUFFER_XML_DROP,
+    [0x0e] = VIR_BUFFER_XML_DROP, [0x0f] = VIR_BUFFER_XML_DROP,
+    [0x10] = VIR_BUFFER_XML_DROP, [0x11] = VIR_BUFFER_XML_DROP,
+    [0x12] = VIR_BUFFER_XML_DROP, [0x13] = VIR_BUFFER_XML_DROP,
+    [0x14] = VIR_BUFFER_XML_DROP, [0x15] = VIR_BUFFER_XML_DROP,
+    [0x16] = VIR_BUFFER_XML_DROP, [0x17] = VIR_BUFFER_XML_DROP,
+    [0x18] = VIR_BUFFER_XML_DROP, [0x19] = VIR_BUFFER_XML_DROP,
+    [0x1a] = VIR_BUFFER_XML_DROP, [0x1b] = VIR_BUFFER_XML_DROP,
+    [0x1c] = VIR_BUFFER_XML_DROP, [0x1d] = VIR_BUFFER_XML_DROP,
+    [0x1e] = VIR_BUFFER_XML_DROP, [0x1f] = VIR_BUFFER_XML_DROP,
+    ['<'] = VIR_BUFFER_XML_ESCAPE("&lt;"),
+    ['>'] = VIR_BUFFER_XML_ESCAPE("&gt;"),
+    ['&'] = VIR_BUFFER_XML_ESCAPE("&amp;"),
+    ['"'] = VIR_BUFFER_XML_ESCAPE("&quot;"),
+    ['\''] = VIR_BUFFER_XML_ESCAPE("&apos;"),
+};
+
 /**
  * virBufferEscapeString:
  * @buf: the buffer to append to
@@ -366,9 +614,11 @@ virBufferVasprintf(virBufferPtr buf, const char *format, va_list argptr)
 void
 virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
 {
-    int len;
-    char *escaped, *out;
-    const char *cur;
+    size_t len = 0;
+    char *escaped = NULL, *out;
+    const unsigned char *cur;
+    const char *suffix;
+    bool changed = false;
 
     if ((format == NULL) || (buf == NULL) || (str == NULL))
         return;
@@ -376,62 +626,48 @@ virBufferEscapeString(virBufferPtr buf, const char *format, const char *str)
     if (buf->error)
         return;
 
-    len = strlen(str);
-    if (strcspn(str, "<>&'\"") == len) {
+    /* Size the result exactly, so the common case of nothing to
+     * escape is a plain copy */
+    for (cur = (const unsigned char *)str; *cur; cur++) {
+        const virBufferXMLEscape *esc = &virBufferXMLEscapes[*cur];
+
+        if (esc->rep) {
+            len += esc->len;
+            changed = true;
+        } else {
+            len++;
+        }
+    }
+
+    if (!changed) {
         virBufferAsprintf(buf, format, str);
         return;
     }
 
-    if (xalloc_oversized(6, len) ||
-        VIR_ALLOC_N(escaped, 6 * len + 1) < 0) {
-        virBufferSetError(buf, errno);
-        return;
+    if (!(out = virBufferEscapeReserve(buf, format, len, &suffix))) {
+        if (buf->error)
+            return;
+        if (VIR_ALLOC_N(escaped, len + 1) < 0) {
+            virBufferSetError(buf, errno);
+            return;
+        }
+        out = escaped;
     }
 
-    cur = str;
-    out = escaped;
-    while (*cur != 0) {
-        if (*cur == '<') {
-            *out++ = '&';
-            *out++ = 'l';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '>') {
-            *out++ = '&';
-            *out++ = 'g';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '&') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'm';
-            *out++ = 'p';
-            *out++ = ';';
-        } else if (*cur == '"') {
-            *out++ = '&';
-            *out++ = 'q';
-            *out++ = 'u';
-            *out++ = 'o';
-            *out++ = 't';
-            *out++ = ';';
-        } else if (*cur == '\'') {
-            *out++ = '&';
-            *out++ = 'a';
-            *out++ = 'p';
-            *out++ = 'o';
-            *out++ = 's';
-            *out++ = ';';
-        } else if (((unsigned char)*cur >= 0x20) || (*cur == '\n') || (*cur == '\t') ||
-                   (*cur == '\r')) {
-            /*
-             * default case, just copy !
-             * Note that character over 0x80 are likely to give problem
-             * with UTF-8 XML, but since our string don't have an encoding
-             * it's hard to handle properly we have to assume it's UTF-8 too
-             */
+    for (cur = (const unsigned char *)str; *cur; cur++) {
+        const virBufferXMLEscape *esc = &virBufferXMLEscapes[*cur];
+
+        if (!esc->rep) {
             *out++ = *cur;
+        } else {
+            memcpy(out, esc->rep, esc->len);
+            out += esc->len;
         }
-        cur++;
+    }
+
+    if (!escaped) {
+        virBufferEscapeCommit(buf, out, suffix);
+        return;
     }
     *out = 0;
 
@@ -475,8 +711,10 @@ virBufferEscape(virBufferPtr buf, char escape, const char *toescape,
                 const char *format, const char *str)
 {
     int len;
-    char *escaped, *out;
+    char *escaped = NULL, *out;
     const char *cur;
+    const char *suffix;
+    bool needs[256] = { false };
 
     if ((format == NULL) || (buf == NULL) || (str == NULL))
         return;
@@ -490,23 +728,33 @@ virBufferEscape(virBufferPtr buf, char escape, const char *toescape,
         return;
     }
 
-    if (xalloc_oversized(2, len) ||
-        VIR_ALLOC_N(escaped, 2 * len + 1) < 0) {
-        virBufferSetError(buf, errno);
+    if (xalloc_oversized(2, len)) {
+        virBufferSetError(buf, ERANGE);
         return;
     }
 
-    cur = str;
-    out = escaped;
-    while (*cur != 0) {
-        /* strchr work-around for gcc 4.3 & 4.4 bug with -Wlogical-op
-         * http://gcc.gnu.org/bugzilla/show_bug.cgi?id=36513
-         */
-        char needle[2] = { *cur, 0 };
-        if (strstr(toescape, needle))
+    if (!(out = virBufferEscapeReserve(buf, format, 2 * len, &suffix))) {
+        if (buf->error)
+            return;
+        if (VIR_ALLOC_N(escaped, 2 * len + 1) < 0) {
+            virBufferSetError(buf, errno);
+            return;
+        }
+        out = escaped;
+    }
+
+    for (cur = toescape; *cur; cur++)
+        needs[(unsigned char)*cur] = true;
+
+    for (cur = str; *cur; cur++) {
+        if (needs[(unsigned char)*cur])
             *out++ = escape;
         *out++ = *cur;
-        cur++;
+    }
+
+    if (!escaped) {
+        virBufferEscapeCommit(buf, out, suffix);
+        return;
     }
     *out = 0;
 
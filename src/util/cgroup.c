@@ -45,9 +45,22 @@
 #include "virfile.h"
 #include "virhash.h"
 #include "virhashcode.h"
+#include "viratomic.h"
+#include "virstatfile.h"
 
 #define CGROUP_MAX_VAL 512
 
+/* Statistics files are re-read far more often than anything else in
+ * a group, so a few of them are kept open per group and re-read with
+ * pread() from offset zero.  The process-wide cap keeps a daemon with
+ * many long-lived groups from running out of descriptors; beyond it
+ * files are simply opened and closed again on every read.  */
+#define CGROUP_MAX_OPEN_FILES 4
+#define CGROUP_MAX_OPEN_FILES_TOTAL 512
+#define CGROUP_MAX_FILE_SIZE (1024 * 1024)
+
+static volatile int virCgroupOpenFiles = 0;
+
 VIR_ENUM_IMPL(virCgroupController, VIR_CGROUP_CONTROLLER_LAST,
               "cpu", "cpuacct", "cpuset", "memory", "devices",
               "freezer", "blkio");
@@ -58,10 +71,19 @@ struct virCgroupController {
     char *placement;
 };
 
+struct virCgroupFile {
+    int controller;
+    char *key;
+    int fd;
+};
+
 struct virCgroup {
     char *path;
 
     struct virCgroupController controllers[VIR_CGROUP_CONTROLLER_LAST];
+
+    struct virCgroupFile files[CGROUP_MAX_OPEN_FILES];
+    size_t nfiles;
 };
 
 typedef enum {
@@ -74,6 +96,22 @@ typedef enum {
                                * cpuacct and cpuset if possible. */
 } virCgroupFlags;
 
+static void virCgroupCloseFile(struct virCgroupFile *file)
+{
+    VIR_FORCE_CLOSE(file->fd);
+    VIR_FREE(file->key);
+    virAtomicIntAdd(&virCgroupOpenFiles, -1);
+}
+
+static void virCgroupCloseFiles(virCgroupPtr group)
+{
+    size_t i;
+
+    for (i = 0 ; i < group->nfiles ; i++)
+        virCgroupCloseFile(&group->files[i]);
+    group->nfiles = 0;
+}
+
 /**
  * virCgroupFree:
  *
@@ -91,6 +129,8 @@ void virCgroupFree(virCgroupPtr *group)
         VIR_FREE((*group)->controllers[i].placement);
     }
 
+    virCgroupCloseFiles(*group);
+
     VIR_FREE((*group)->path);
     VIR_FREE(*group);
 }
@@ -342,6 +382,107 @@ static int virCgroupSetValueStr(virCgroupPtr group,
     return rc;
 }
 
+/* Read the whole of @fd from offset zero into a newly allocated,
+ * NUL terminated *@value.  Returns the number of bytes read, or -1
+ * with errno set.  */
+static ssize_t virCgroupReadFd(int fd, char **value)
+{
+    size_t size = CGROUP_MAX_VAL;
+    size_t len = 0;
+    char *buf = NULL;
+
+    if (VIR_ALLOC_N(buf, size) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (;;) {
+        ssize_t got = pread(fd, buf + len, size - len - 1, len);
+
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            goto error;
+        }
+        if (got == 0)
+            break;
+
+        len += got;
+        if (len == size - 1) {
+            if (size >= CGROUP_MAX_FILE_SIZE) {
+                errno = EFBIG;
+                goto error;
+            }
+            size *= 2;
+            if (VIR_REALLOC_N(buf, size) < 0) {
+                errno = ENOMEM;
+                goto error;
+            }
+        }
+    }
+
+    buf[len] = '\0';
+    *value = buf;
+    return len;
+
+error:
+    VIR_FREE(buf);
+    return -1;
+}
+
+/* Read @key of @controller through the descriptor cached in @group,
+ * opening and, room permitting, caching it first.  A cached
+ * descriptor that fails is dropped and the file opened afresh once,
+ * since the group may have been removed and re-created under us.  */
+static ssize_t virCgroupReadFile(virCgroupPtr group,
+                                 int controller,
+                                 const char *key,
+                                 const char *keypath,
+                                 char **value)
+{
+    struct virCgroupFile *file = NULL;
+    ssize_t rc;
+    size_t i;
+    int fd;
+
+    for (i = 0 ; i < group->nfiles ; i++) {
+        if (group->files[i].controller == controller &&
+            STREQ(group->files[i].key, key)) {
+            file = &group->files[i];
+            break;
+        }
+    }
+
+    if (file) {
+        if ((rc = virCgroupReadFd(file->fd, value)) >= 0)
+            return rc;
+
+        VIR_DEBUG("Cached descriptor for %s failed, reopening: %m", keypath);
+        virCgroupCloseFile(file);
+        group->files[i] = group->files[--group->nfiles];
+    }
+
+    if ((fd = open(keypath, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+
+    rc = virCgroupReadFd(fd, value);
+
+    if (rc >= 0 &&
+        group->nfiles < CGROUP_MAX_OPEN_FILES) {
+        if (virAtomicIntInc(&virCgroupOpenFiles) <= CGROUP_MAX_OPEN_FILES_TOTAL &&
+            (group->files[group->nfiles].key = strdup(key))) {
+            group->files[group->nfiles].controller = controller;
+            group->files[group->nfiles].fd = fd;
+            group->nfiles++;
+            return rc;
+        }
+        virAtomicIntAdd(&virCgroupOpenFiles, -1);
+    }
+
+    VIR_FORCE_CLOSE(fd);
+    return rc;
+}
+
 static int virCgroupGetValueStr(virCgroupPtr group,
                                 int controller,
                                 const char *key,
@@ -360,13 +501,13 @@ static int virCgroupGetValueStr(virCgroupPtr group,
 
     VIR_DEBUG("Get value %s", keypath);
 
-    rc = virFileReadAll(keypath, 1024*1024, value);
+    rc = virCgroupReadFile(group, controller, key, keypath, value);
     if (rc < 0) {
         rc = -errno;
         VIR_DEBUG("Failed to read %s: %m\n", keypath);
     } else {
         /* Terminated with '\n' has sometimes harmful effects to the caller */
-        if ((*value)[rc - 1] == '\n')
+        if (rc > 0 && (*value)[rc - 1] == '\n')
             (*value)[rc - 1] = '\0';
 
         rc = 0;
@@ -760,6 +901,8 @@ int virCgroupRemove(virCgroupPtr group)
     int i;
     char *grppath = NULL;
 
+    virCgroupCloseFiles(group);
+
     for (i = 0 ; i < VIR_CGROUP_CONTROLLER_LAST ; i++) {
         /* Skip over controllers not mounted */
         if (!group->controllers[i].mountPoint)
@@ -1128,6 +1271,52 @@ int virCgroupForEmulator(virCgroupPtr driver ATTRIBUTE_UNUSED,
 }
 
 #endif
+
+/**
+ * virCgroupForIOThread:
+ *
+ * @driver: group for the domain
+ * @iothreadid: id of the iothread
+ * @group: Pointer to returned virCgroupPtr
+ *
+ * Returns: 0 on success or -errno on failure
+ */
+#if defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R
+int virCgroupForIOThread(virCgroupPtr driver,
+                         int iothreadid,
+                         virCgroupPtr *group,
+                         bool create)
+{
+    int rc;
+    char *path;
+
+    if (driver == NULL)
+        return -EINVAL;
+
+    if (virAsprintf(&path, "%s/iothread%d", driver->path, iothreadid) < 0)
+        return -ENOMEM;
+
+    rc = virCgroupNew(path, group);
+    VIR_FREE(path);
+
+    if (rc == 0) {
+        rc = virCgroupMakeGroup(driver, *group, create, VIR_CGROUP_VCPU);
+        if (rc != 0)
+            virCgroupFree(group);
+    }
+
+    return rc;
+}
+#else
+int virCgroupForIOThread(virCgroupPtr driver ATTRIBUTE_UNUSED,
+                         int iothreadid ATTRIBUTE_UNUSED,
+                         virCgroupPtr *group ATTRIBUTE_UNUSED,
+                         bool create ATTRIBUTE_UNUSED)
+{
+    return -ENXIO;
+}
+#endif
+
 /**
  * virCgroupSetBlkioWeight:
  *
@@ -1167,57 +1356,144 @@ int virCgroupGetBlkioWeight(virCgroupPtr group, unsigned int *weight)
     return ret;
 }
 
-/**
- * virCgroupSetBlkioDeviceWeight:
- *
- * @group: The cgroup to change io device weight device for
- * @path: The device with a weight to alter
- * @weight: The new device weight (100-1000), or 0 to clear
- *
- * device_weight is treated as a write-only parameter, so
- * there isn't a getter counterpart.
- *
- * Returns: 0 on success, -errno on failure
- */
 #if defined(major) && defined(minor)
-int virCgroupSetBlkioDeviceWeight(virCgroupPtr group,
-                                  const char *path,
-                                  unsigned int weight)
+/* Write "major:minor value" for the block device @path to the blkio
+ * control file @key. */
+static int
+virCgroupSetBlkioDeviceValue(virCgroupPtr group,
+                             const char *path,
+                             const char *key,
+                             unsigned long long value)
 {
     char *str;
     struct stat sb;
     int ret;
 
-    if (weight && (weight > 1000 || weight < 100))
-        return -EINVAL;
-
     if (stat(path, &sb) < 0)
         return -errno;
 
     if (!S_ISBLK(sb.st_mode))
         return -EINVAL;
 
-    if (virAsprintf(&str, "%d:%d %d", major(sb.st_rdev), minor(sb.st_rdev),
-                    weight) < 0)
+    if (virAsprintf(&str, "%d:%d %llu", major(sb.st_rdev), minor(sb.st_rdev),
+                    value) < 0)
         return -errno;
 
     ret = virCgroupSetValueStr(group,
                                VIR_CGROUP_CONTROLLER_BLKIO,
-                               "blkio.weight_device",
+                               key,
                                str);
     VIR_FREE(str);
     return ret;
 }
 #else
-int
-virCgroupSetBlkioDeviceWeight(virCgroupPtr group ATTRIBUTE_UNUSED,
-                              const char *path ATTRIBUTE_UNUSED,
-                              unsigned int weight ATTRIBUTE_UNUSED)
+static int
+virCgroupSetBlkioDeviceValue(virCgroupPtr group ATTRIBUTE_UNUSED,
+                             const char *path ATTRIBUTE_UNUSED,
+                             const char *key ATTRIBUTE_UNUSED,
+                             unsigned long long value ATTRIBUTE_UNUSED)
 {
     return -ENOSYS;
 }
 #endif
 
+/**
+ * virCgroupSetBlkioDeviceWeight:
+ *
+ * @group: The cgroup to change io weight device for
+ * @path: The device with a weight to alter
+ * @weight: The new device weight (100-1000), or 0 to clear
+ *
+ * device_weight is treated as a write-only parameter, so
+ * there isn't a getter counterpart.
+ *
+ * Returns: 0 on success, -errno on failure
+ */
+int virCgroupSetBlkioDeviceWeight(virCgroupPtr group,
+                                  const char *path,
+                                  unsigned int weight)
+{
+    if (weight && (weight > 1000 || weight < 100))
+        return -EINVAL;
+
+    return virCgroupSetBlkioDeviceValue(group, path,
+                                        "blkio.weight_device", weight);
+}
+
+/**
+ * virCgroupSetBlkioDeviceReadIops:
+ *
+ * @group: The cgroup to change block io setting for
+ * @path: The path of device
+ * @riops: The new device read iops throttle, or 0 to clear
+ *
+ * Like device_weight, the throttle settings are write-only.
+ *
+ * Returns: 0 on success, -errno on failure
+ */
+int virCgroupSetBlkioDeviceReadIops(virCgroupPtr group,
+                                    const char *path,
+                                    unsigned int riops)
+{
+    return virCgroupSetBlkioDeviceValue(group, path,
+                                        "blkio.throttle.read_iops_device",
+                                        riops);
+}
+
+/**
+ * virCgroupSetBlkioDeviceWriteIops:
+ *
+ * @group: The cgroup to change block io setting for
+ * @path: The path of device
+ * @wiops: The new device write iops throttle, or 0 to clear
+ *
+ * Returns: 0 on success, -errno on failure
+ */
+int virCgroupSetBlkioDeviceWriteIops(virCgroupPtr group,
+                                     const char *path,
+                                     unsigned int wiops)
+{
+    return virCgroupSetBlkioDeviceValue(group, path,
+                                        "blkio.throttle.write_iops_device",
+                                        wiops);
+}
+
+/**
+ * virCgroupSetBlkioDeviceReadBps:
+ *
+ * @group: The cgroup to change block io setting for
+ * @path: The path of device
+ * @rbps: The new device read bytes per second throttle, or 0 to clear
+ *
+ * Returns: 0 on success, -errno on failure
+ */
+int virCgroupSetBlkioDeviceReadBps(virCgroupPtr group,
+                                   const char *path,
+                                   unsigned long long rbps)
+{
+    return virCgroupSetBlkioDeviceValue(group, path,
+                                        "blkio.throttle.read_bps_device",
+                                        rbps);
+}
+
+/**
+ * virCgroupSetBlkioDeviceWriteBps:
+ *
+ * @group: The cgroup to change block io setting for
+ * @path: The path of device
+ * @wbps: The new device write bytes per second throttle, or 0 to clear
+ *
+ * Returns: 0 on success, -errno on failure
+ */
+int virCgroupSetBlkioDeviceWriteBps(virCgroupPtr group,
+                                    const char *path,
+                                    unsigned long long wbps)
+{
+    return virCgroupSetBlkioDeviceValue(group, path,
+                                        "blkio.throttle.write_bps_device",
+                                        wbps);
+}
+
 /**
  * virCgroupSetMemory:
  *
@@ -1410,6 +1686,34 @@ int virCgroupGetMemSwapUsage(virCgroupPtr group, unsigned long long *kb)
     return ret;
 }
 
+/**
+ * virCgroupGetMemoryStat:
+ *
+ * @group: The cgroup to query
+ * @fields: table of memory.stat keys to fetch, zeroed by the caller
+ * @nfields: number of entries in @fields
+ *
+ * Parse memory.stat of @group in one pass, filling in those of
+ * @fields it lists.  Values are in bytes.
+ *
+ * Returns: 0 on success, -errno on failure
+ */
+int virCgroupGetMemoryStat(virCgroupPtr group,
+                           virStatFileFieldPtr fields,
+                           size_t nfields)
+{
+    char *str;
+    int ret;
+
+    if ((ret = virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_MEMORY,
+                                    "memory.stat", &str)) < 0)
+        return ret;
+
+    ret = virStatFileScan(str, 0, fields, nfields) < 0 ? -errno : 0;
+    VIR_FREE(str);
+    return ret;
+}
+
 /**
  * virCgroupSetCpusetMems:
  *
@@ -1474,6 +1778,22 @@ int virCgroupGetCpusetCpus(virCgroupPtr group, char **cpus)
                                 cpus);
 }
 
+/**
+ * virCgroupSetCpusetMemoryMigrate:
+ *
+ * @group: The cgroup to set cpuset.memory_migrate for
+ * @migrate: whether pages should follow later changes of cpuset.mems
+ *
+ * Returns: 0 on success
+ */
+int virCgroupSetCpusetMemoryMigrate(virCgroupPtr group, bool migrate)
+{
+    return virCgroupSetValueStr(group,
+                                VIR_CGROUP_CONTROLLER_CPUSET,
+                                "cpuset.memory_migrate",
+                                migrate ? "1" : "0");
+}
+
 /**
  * virCgroupDenyAllDevices:
  *
@@ -1785,6 +2105,50 @@ int virCgroupGetCpuCfsQuota(virCgroupPtr group, long long *cfs_quota)
                                 "cpu.cfs_quota_us", cfs_quota);
 }
 
+/**
+ * virCgroupGetCpuStat:
+ *
+ * @group: The cgroup to get cpu.stat for
+ * @nr_periods: filled with the number of elapsed enforcement periods
+ * @nr_throttled: filled with the number of periods @group was throttled in
+ * @throttled_time: filled with the total time @group was throttled, in
+ *                  nanoseconds
+ *
+ * Returns: 0 on success, -errno on failure
+ */
+int virCgroupGetCpuStat(virCgroupPtr group,
+                        unsigned long long *nr_periods,
+                        unsigned long long *nr_throttled,
+                        unsigned long long *throttled_time)
+{
+    virStatFileField fields[] = {
+        { "nr_periods", 0, false },
+        { "nr_throttled", 0, false },
+        { "throttled_time", 0, false },
+    };
+    char *str;
+    int ret;
+
+    if ((ret = virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPU,
+                                    "cpu.stat", &str)) < 0)
+        return ret;
+
+    if (virStatFileScan(str, 0, fields, ARRAY_CARDINALITY(fields)) !=
+        ARRAY_CARDINALITY(fields)) {
+        ret = -EINVAL;
+        goto cleanup;
+    }
+
+    *nr_periods = fields[0].value;
+    *nr_throttled = fields[1].value;
+    *throttled_time = fields[2].value;
+    ret = 0;
+
+cleanup:
+    VIR_FREE(str);
+    return ret;
+}
+
 int virCgroupGetCpuacctUsage(virCgroupPtr group, unsigned long long *usage)
 {
     return virCgroupGetValueU64(group,
@@ -1799,41 +2163,110 @@ int virCgroupGetCpuacctPercpuUsage(virCgroupPtr group, char **usage)
 }
 
 #ifdef _SC_CLK_TCK
+static int virCgroupParseCpuacctStat(const char *str,
+                                     unsigned long long *user,
+                                     unsigned long long *sys)
+{
+    virStatFileField fields[] = {
+        { "user", 0, false },
+        { "system", 0, false },
+    };
+    static double scale = -1.0;
+
+    if (virStatFileScan(str, 0, fields, ARRAY_CARDINALITY(fields)) !=
+        ARRAY_CARDINALITY(fields))
+        return -EINVAL;
+    *user = fields[0].value;
+    *sys = fields[1].value;
+
+    /* times reported are in system ticks (generally 100 Hz), but that
+     * rate can theoretically vary between machines.  Scale things
+     * into approximate nanoseconds.  */
+    if (scale < 0) {
+        long ticks_per_sec = sysconf(_SC_CLK_TCK);
+        if (ticks_per_sec == -1)
+            return -errno;
+        scale = 1000000000.0 / ticks_per_sec;
+    }
+    *user *= scale;
+    *sys *= scale;
+
+    return 0;
+}
+
 int virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
                             unsigned long long *sys)
 {
     char *str;
-    char *p;
     int ret;
-    static double scale = -1.0;
 
     if ((ret = virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
                                     "cpuacct.stat", &str)) < 0)
         return ret;
-    if (!(p = STRSKIP(str, "user ")) ||
-        virStrToLong_ull(p, &p, 10, user) < 0 ||
-        !(p = STRSKIP(p, "\nsystem ")) ||
-        virStrToLong_ull(p, NULL, 10, sys) < 0) {
+
+    ret = virCgroupParseCpuacctStat(str, user, sys);
+    VIR_FREE(str);
+    return ret;
+}
+
+/**
+ * virCgroupGetCpuacctTimes:
+ *
+ * @group: The cgroup to query
+ * @usage: filled with the total cpu time, in nanoseconds
+ * @user: filled with the user time, in nanoseconds
+ * @sys: filled with the system time, in nanoseconds
+ *
+ * Fetch all of the cpuacct counters of @group in one go, resolving
+ * the controller path only once.
+ *
+ * Returns: 0 on success, -errno on failure
+ */
+int virCgroupGetCpuacctTimes(virCgroupPtr group,
+                             unsigned long long *usage,
+                             unsigned long long *user,
+                             unsigned long long *sys)
+{
+    char *base = NULL;
+    char *keypath = NULL;
+    char *str = NULL;
+    int ret;
+
+    if ((ret = virCgroupPathOfController(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                                         NULL, &base)) < 0)
+        return ret;
+
+    if (virAsprintf(&keypath, "%scpuacct.usage", base) < 0) {
+        ret = -ENOMEM;
+        goto cleanup;
+    }
+    if (virCgroupReadFile(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                          "cpuacct.usage", keypath, &str) < 0) {
+        ret = -errno;
+        goto cleanup;
+    }
+    if (virStrToLong_ull(str, NULL, 10, usage) < 0) {
         ret = -EINVAL;
         goto cleanup;
     }
-    /* times reported are in system ticks (generally 100 Hz), but that
-     * rate can theoretically vary between machines.  Scale things
-     * into approximate nanoseconds.  */
-    if (scale < 0) {
-        long ticks_per_sec = sysconf(_SC_CLK_TCK);
-        if (ticks_per_sec == -1) {
-            ret = -errno;
-            goto cleanup;
-        }
-        scale = 1000000000.0 / ticks_per_sec;
+    VIR_FREE(str);
+    VIR_FREE(keypath);
+
+    if (virAsprintf(&keypath, "%scpuacct.stat", base) < 0) {
+        ret = -ENOMEM;
+        goto cleanup;
     }
-    *user *= scale;
-    *sys *= scale;
+    if (virCgroupReadFile(group, VIR_CGROUP_CONTROLLER_CPUACCT,
+                          "cpuacct.stat", keypath, &str) < 0) {
+        ret = -errno;
+        goto cleanup;
+    }
+    ret = virCgroupParseCpuacctStat(str, user, sys);
 
-    ret = 0;
 cleanup:
     VIR_FREE(str);
+    VIR_FREE(keypath);
+    VIR_FREE(base);
     return ret;
 }
 #else
@@ -1843,6 +2276,14 @@ int virCgroupGetCpuacctStat(virCgroupPtr group ATTRIBUTE_UNUSED,
 {
     return -ENOSYS;
 }
+
+int virCgroupGetCpuacctTimes(virCgroupPtr group ATTRIBUTE_UNUSED,
+                             unsigned long long *usage ATTRIBUTE_UNUSED,
+                             unsigned long long *user ATTRIBUTE_UNUSED,
+                             unsigned long long *sys ATTRIBUTE_UNUSED)
+{
+    return -ENOSYS;
+}
 #endif
 
 int virCgroupSetFreezerState(virCgroupPtr group, const char *state)
@@ -25,6 +25,8 @@
 #ifndef CGROUP_H
 # define CGROUP_H
 
+# include "virstatfile.h"
+
 struct virCgroup;
 typedef struct virCgroup *virCgroupPtr;
 
@@ -63,6 +65,11 @@ int virCgroupForEmulator(virCgroupPtr driver,
                          virCgroupPtr *group,
                          bool create);
 
+int virCgroupForIOThread(virCgroupPtr driver,
+                         int iothreadid,
+                         virCgroupPtr *group,
+                         bool create);
+
 int virCgroupPathOfController(virCgroupPtr group,
                               int controller,
                               const char *key,
@@ -84,6 +91,18 @@ int virCgroupGetBlkioWeight(virCgroupPtr group, unsigned int *weight);
 int virCgroupSetBlkioDeviceWeight(virCgroupPtr group,
                                   const char *path,
                                   unsigned int weight);
+int virCgroupSetBlkioDeviceReadIops(virCgroupPtr group,
+                                    const char *path,
+                                    unsigned int riops);
+int virCgroupSetBlkioDeviceWriteIops(virCgroupPtr group,
+                                     const char *path,
+                                     unsigned int wiops);
+int virCgroupSetBlkioDeviceReadBps(virCgroupPtr group,
+                                   const char *path,
+                                   unsigned long long rbps);
+int virCgroupSetBlkioDeviceWriteBps(virCgroupPtr group,
+                                    const char *path,
+                                    unsigned long long wbps);
 
 int virCgroupSetMemory(virCgroupPtr group, unsigned long long kb);
 int virCgroupGetMemoryUsage(virCgroupPtr group, unsigned long *kb);
@@ -96,6 +115,10 @@ int virCgroupSetMemSwapHardLimit(virCgroupPtr group, unsigned long long kb);
 int virCgroupGetMemSwapHardLimit(virCgroupPtr group, unsigned long long *kb);
 int virCgroupGetMemSwapUsage(virCgroupPtr group, unsigned long long *kb);
 
+int virCgroupGetMemoryStat(virCgroupPtr group,
+                           virStatFileFieldPtr fields,
+                           size_t nfields);
+
 enum {
     VIR_CGROUP_DEVICE_READ  = 1,
     VIR_CGROUP_DEVICE_WRITE = 2,
@@ -140,11 +163,19 @@ int virCgroupGetCpuCfsPeriod(virCgroupPtr group, unsigned long long *cfs_period)
 
 int virCgroupSetCpuCfsQuota(virCgroupPtr group, long long cfs_quota);
 int virCgroupGetCpuCfsQuota(virCgroupPtr group, long long *cfs_quota);
+int virCgroupGetCpuStat(virCgroupPtr group,
+                        unsigned long long *nr_periods,
+                        unsigned long long *nr_throttled,
+                        unsigned long long *throttled_time);
 
 int virCgroupGetCpuacctUsage(virCgroupPtr group, unsigned long long *usage);
 int virCgroupGetCpuacctPercpuUsage(virCgroupPtr group, char **usage);
 int virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
                             unsigned long long *sys);
+int virCgroupGetCpuacctTimes(virCgroupPtr group,
+                             unsigned long long *usage,
+                             unsigned long long *user,
+                             unsigned long long *sys);
 
 int virCgroupSetFreezerState(virCgroupPtr group, const char *state);
 int virCgroupGetFreezerState(virCgroupPtr group, char **state);
@@ -154,6 +185,7 @@ int virCgroupGetCpusetMems(virCgroupPtr group, char **mems);
 
 int virCgroupSetCpusetCpus(virCgroupPtr group, const char *cpus);
 int virCgroupGetCpusetCpus(virCgroupPtr group, char **cpus);
+int virCgroupSetCpusetMemoryMigrate(virCgroupPtr group, bool migrate);
 
 int virCgroupRemove(virCgroupPtr group);
 
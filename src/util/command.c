@@ -28,6 +28,10 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <dirent.h>
+#if HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+# include <spawn.h>
+#endif
 
 #if HAVE_CAPNG
 # include <cap-ng.h>
@@ -369,6 +373,164 @@ prepareStdFd(int fd, int std)
     return 0;
 }
 
+/*
+ * Close every file descriptor above stderr in the child, other than
+ * the ones about to become its stdio and those in @keepfd, which are
+ * made inheritable instead. Walking /proc/self/fd only touches the
+ * descriptors which are actually open, rather than every number up
+ * to the (possibly huge) open file limit.
+ */
+static int
+virExecCloseFDs(int infd, int childout, int childerr,
+                const int *keepfd, int keepfd_size)
+{
+    DIR *dh;
+    struct dirent *de;
+    int i, openmax, tmpfd;
+
+    if ((dh = opendir("/proc/self/fd"))) {
+        while ((de = readdir(dh))) {
+            if (virStrToLong_i(de->d_name, NULL, 10, &i) < 0 ||
+                i <= STDERR_FILENO || i == dirfd(dh) ||
+                i == infd || i == childout || i == childerr)
+                continue;
+            if (!keepfd || !virCommandFDIsSet(i, keepfd, keepfd_size)) {
+                tmpfd = i;
+                VIR_MASS_CLOSE(tmpfd);
+            } else if (virSetInherit(i, true) < 0) {
+                virReportSystemError(errno, _("failed to preserve fd %d"), i);
+                closedir(dh);
+                return -1;
+            }
+        }
+        closedir(dh);
+        return 0;
+    }
+
+    openmax = sysconf(_SC_OPEN_MAX);
+    for (i = 3; i < openmax; i++) {
+        if (i == infd || i == childout || i == childerr)
+            continue;
+        if (!keepfd || !virCommandFDIsSet(i, keepfd, keepfd_size)) {
+            tmpfd = i;
+            VIR_MASS_CLOSE(tmpfd);
+        } else if (virSetInherit(i, true) < 0) {
+            virReportSystemError(errno, _("failed to preserve fd %d"), i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * A child which needs nothing more than its stdio set up, the rest
+ * of its FDs closed and its signal state reset before exec can be
+ * started with posix_spawn(), which avoids copying the page tables
+ * of a large daemon the way fork() does.
+ */
+static bool
+virExecCanSpawn(int keepfd_size ATTRIBUTE_UNUSED,
+                unsigned int flags ATTRIBUTE_UNUSED,
+                virExecHook hook ATTRIBUTE_UNUSED,
+                unsigned long long capabilities ATTRIBUTE_UNUSED)
+{
+#if HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+    /* posix_spawn can only close a contiguous range of FDs, so
+     * anything we have to keep open rules it out */
+    return keepfd_size == 0 && !hook && !capabilities &&
+        !(flags & (VIR_EXEC_DAEMON | VIR_EXEC_CLEAR_CAPS));
+#else
+    return false;
+#endif
+}
+
+#if HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+static int
+virExecSpawn(const char *binary,
+             const char *const*argv,
+             const char *const*envp,
+             pid_t *retpid,
+             int infd, int childout, int childerr)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t mask;
+    int err;
+    int ret = -1;
+
+    if ((err = posix_spawn_file_actions_init(&actions)) != 0) {
+        virReportSystemError(err, "%s", _("cannot set up child process"));
+        return -1;
+    }
+    if ((err = posix_spawnattr_init(&attr)) != 0) {
+        virReportSystemError(err, "%s", _("cannot set up child process"));
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+
+    /* Same signal state as virFork leaves behind */
+    sigfillset(&mask);
+    if ((err = posix_spawnattr_setsigdefault(&attr, &mask)) != 0)
+        goto error;
+    sigemptyset(&mask);
+    if ((err = posix_spawnattr_setsigmask(&attr, &mask)) != 0)
+        goto error;
+    if ((err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF |
+                                        POSIX_SPAWN_SETSIGMASK)) != 0)
+        goto error;
+
+    /* dup2 onto itself clears close-on-exec, like prepareStdFd */
+    if ((err = posix_spawn_file_actions_adddup2(&actions, infd,
+                                                STDIN_FILENO)) != 0)
+        goto error;
+    if (childout > 0 &&
+        (err = posix_spawn_file_actions_adddup2(&actions, childout,
+                                                STDOUT_FILENO)) != 0)
+        goto error;
+    if (childerr > 0 &&
+        (err = posix_spawn_file_actions_adddup2(&actions, childerr,
+                                                STDERR_FILENO)) != 0)
+        goto error;
+    if ((err = posix_spawn_file_actions_addclosefrom_np(&actions,
+                                                        STDERR_FILENO + 1)) != 0)
+        goto error;
+
+    if ((err = posix_spawn(retpid, binary, &actions, &attr,
+                           (char **) argv,
+                           envp ? (char **) envp : environ)) != 0) {
+        virReportSystemError(err,
+                             _("cannot execute binary %s"),
+                             argv[0]);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return ret;
+
+error:
+    virReportSystemError(err, "%s", _("cannot set up child process"));
+    goto cleanup;
+}
+#else
+static int
+virExecSpawn(const char *binary ATTRIBUTE_UNUSED,
+             const char *const*argv ATTRIBUTE_UNUSED,
+             const char *const*envp ATTRIBUTE_UNUSED,
+             pid_t *retpid,
+             int infd ATTRIBUTE_UNUSED,
+             int childout ATTRIBUTE_UNUSED,
+             int childerr ATTRIBUTE_UNUSED)
+{
+    *retpid = -1;
+    virReportSystemError(ENOSYS, "%s", _("posix_spawn is not available"));
+    return -1;
+}
+#endif
+
 /*
  * @argv argv to exec
  * @envp optional environment to use for exec
@@ -403,12 +565,11 @@ virExecWithHook(const char *const*argv,
                 unsigned long long capabilities)
 {
     pid_t pid;
-    int null = -1, i, openmax;
+    int null = -1;
     int pipeout[2] = {-1,-1};
     int pipeerr[2] = {-1,-1};
     int childout = -1;
     int childerr = -1;
-    int tmpfd;
     const char *binary = NULL;
     int forkRet;
 
@@ -481,10 +642,17 @@ virExecWithHook(const char *const*argv,
         childerr = null;
     }
 
-    forkRet = virFork(&pid);
+    if (virExecCanSpawn(keepfd_size, flags, hook, capabilities)) {
+        if (virExecSpawn(binary, argv, envp, &pid,
+                         infd, childout, childerr) < 0)
+            goto cleanup;
+        forkRet = 0;
+    } else {
+        forkRet = virFork(&pid);
 
-    if (pid < 0) {
-        goto cleanup;
+        if (pid < 0) {
+            goto cleanup;
+        }
     }
 
     if (pid) { /* parent */
@@ -519,18 +687,8 @@ virExecWithHook(const char *const*argv,
         goto fork_error;
     }
 
-    openmax = sysconf(_SC_OPEN_MAX);
-    for (i = 3; i < openmax; i++) {
-        if (i == infd || i == childout || i == childerr)
-            continue;
-        if (!keepfd || !virCommandFDIsSet(i, keepfd, keepfd_size)) {
-            tmpfd = i;
-            VIR_MASS_CLOSE(tmpfd);
-        } else if (virSetInherit(i, true) < 0) {
-            virReportSystemError(errno, _("failed to preserve fd %d"), i);
-            goto fork_error;
-        }
-    }
+    if (virExecCloseFDs(infd, childout, childerr, keepfd, keepfd_size) < 0)
+        goto fork_error;
 
     if (prepareStdFd(infd, STDIN_FILENO) < 0) {
         virReportSystemError(errno,
@@ -2200,6 +2358,8 @@ virCommandRunAsync(virCommandPtr cmd, pid_t *pid)
     VIR_DEBUG("About to run %s", str ? str : cmd->args[0]);
     VIR_FREE(str);
 
+    /* Without any work for the hook to do, the child may be
+     * eligible for the cheaper posix_spawn path */
     ret = virExecWithHook((const char *const *)cmd->args,
                           (const char *const *)cmd->env,
                           cmd->preserve,
@@ -2209,7 +2369,8 @@ virCommandRunAsync(virCommandPtr cmd, pid_t *pid)
                           cmd->outfdptr,
                           cmd->errfdptr,
                           cmd->flags,
-                          virCommandHook,
+                          (cmd->hook || cmd->pwd || cmd->handshake) ?
+                          virCommandHook : NULL,
                           cmd,
                           cmd->pidfile,
                           cmd->capabilities);
@@ -47,11 +47,216 @@
 #include "virterror_internal.h"
 #include "logging.h"
 #include "virfile.h"
+#include "virhash.h"
+#include "buf.h"
 
 #define VIR_FROM_THIS VIR_FROM_NETWORK
 #define DNSMASQ_HOSTSFILE_SUFFIX "hostsfile"
 #define DNSMASQ_ADDNHOSTSFILE_SUFFIX "addnhosts"
 
+/* larger files are rewritten instead of being compared */
+#define DNSMASQ_FILE_MAX_LEN (16 * 1024 * 1024)
+
+static int
+dnsmasqFileWrite(const char *path,
+                 char **lines,
+                 size_t nlines)
+{
+    char *tmp;
+    FILE *f;
+    bool istmp = true;
+    size_t i;
+    int rc = 0;
+
+    /* even if there are 0 hosts, create a 0 length file, to allow
+     * for runtime addition.
+     */
+
+    if (virAsprintf(&tmp, "%s.new", path) < 0)
+        return -ENOMEM;
+
+    if (!(f = fopen(tmp, "w"))) {
+        istmp = false;
+        if (!(f = fopen(path, "w"))) {
+            rc = -errno;
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < nlines; i++) {
+        if (fputs(lines[i], f) == EOF || fputc('\n', f) == EOF) {
+            rc = -errno;
+            VIR_FORCE_FCLOSE(f);
+
+            if (istmp)
+                unlink(tmp);
+
+            goto cleanup;
+        }
+    }
+
+    if (VIR_FCLOSE(f) == EOF) {
+        rc = -errno;
+        goto cleanup;
+    }
+
+    if (istmp && rename(tmp, path) < 0) {
+        rc = -errno;
+        unlink(tmp);
+        goto cleanup;
+    }
+
+ cleanup:
+    VIR_FREE(tmp);
+
+    return rc;
+}
+
+/*
+ * Compare the file at @path against @lines, ignoring the order of
+ * the lines, which does not matter to dnsmasq. On return, @missing
+ * holds the indexes of the lines the file lacks.
+ *
+ * Returns 0 if the file holds a subset of @lines, 1 if it holds other
+ * lines, cannot be read or does not exist, and -1 on OOM.
+ */
+static int
+dnsmasqFileCompare(const char *path,
+                   char **lines,
+                   size_t nlines,
+                   size_t **missing,
+                   size_t *nmissing)
+{
+    virHashTablePtr wanted = NULL;
+    char *content = NULL;
+    char *line, *eol;
+    bool *found = NULL;
+    size_t i;
+    int fd = -1;
+    int ret = 1;
+
+    *missing = NULL;
+    *nmissing = 0;
+
+    if ((fd = open(path, O_RDONLY)) < 0 ||
+        virFileReadLimFD(fd, DNSMASQ_FILE_MAX_LEN, &content) < 0)
+        goto cleanup;
+
+    if (!(wanted = virHashCreate(nlines, NULL)) ||
+        VIR_ALLOC_N(found, nlines) < 0)
+        goto no_memory;
+
+    /* the index is stored off by one so that it is never NULL */
+    for (i = 0; i < nlines; i++) {
+        if (virHashLookup(wanted, lines[i]))
+            goto cleanup;
+        if (virHashAddEntry(wanted, lines[i], (void *)(i + 1)) < 0)
+            goto no_memory;
+    }
+
+    for (line = content; *line; line = eol + 1) {
+        size_t idx;
+
+        /* a line without newline can't be appended to */
+        if (!(eol = strchr(line, '\n')))
+            goto cleanup;
+        *eol = '\0';
+
+        idx = (size_t)virHashLookup(wanted, line);
+        if (idx == 0 || found[idx - 1])
+            goto cleanup;
+        found[idx - 1] = true;
+    }
+
+    for (i = 0; i < nlines; i++) {
+        if (!found[i] &&
+            VIR_APPEND_ELEMENT_COPY(*missing, *nmissing, i) < 0)
+            goto no_memory;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (ret != 0) {
+        VIR_FREE(*missing);
+        *nmissing = 0;
+    }
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(content);
+    VIR_FREE(found);
+    virHashFree(wanted);
+    return ret;
+
+ no_memory:
+    virReportOOMError();
+    ret = -1;
+    goto cleanup;
+}
+
+/*
+ * Bring the file at @path in line with @lines without rewriting it
+ * needlessly: an up to date file is left alone and lines new to the
+ * file are appended to it. Only if lines have to be removed from the
+ * file is it rewritten as a whole.
+ *
+ * Returns 1 if the file was modified, 0 if it already was up to date
+ * and -1 on error.
+ */
+static int
+dnsmasqFileSync(const char *path,
+                char **lines,
+                size_t nlines)
+{
+    size_t *missing = NULL;
+    size_t nmissing = 0;
+    size_t i;
+    int fd = -1;
+    int rc;
+    int ret = -1;
+
+    if ((rc = dnsmasqFileCompare(path, lines, nlines,
+                                 &missing, &nmissing)) < 0)
+        return -1;
+
+    if (rc > 0) {
+        if ((rc = dnsmasqFileWrite(path, lines, nlines)) < 0) {
+            virReportSystemError(-rc, _("cannot write config file '%s'"),
+                                 path);
+            return -1;
+        }
+        return 1;
+    }
+
+    if (nmissing == 0)
+        return 0;
+
+    if ((fd = open(path, O_WRONLY | O_APPEND)) < 0)
+        goto error;
+
+    for (i = 0; i < nmissing; i++) {
+        const char *line = lines[missing[i]];
+        size_t len = strlen(line);
+
+        if (safewrite(fd, line, len) != len ||
+            safewrite(fd, "\n", 1) != 1)
+            goto error;
+    }
+
+    if (VIR_CLOSE(fd) < 0)
+        goto error;
+
+    ret = 1;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(missing);
+    return ret;
+
+ error:
+    virReportSystemError(errno, _("cannot write config file '%s'"), path);
+    goto cleanup;
+}
+
 static void
 dhcphostFree(dnsmasqDhcpHost *host)
 {
@@ -168,95 +373,42 @@ addnhostsNew(const char *name,
 }
 
 static int
-addnhostsWrite(const char *path,
-               dnsmasqAddnHost *hosts,
-               unsigned int nhosts)
+addnhostsSave(dnsmasqAddnHostsfile *addnhostsfile)
 {
-    char *tmp;
-    FILE *f;
-    bool istmp = true;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char **lines = NULL;
     unsigned int i, ii;
-    int rc = 0;
-
-    /* even if there are 0 hosts, create a 0 length file, to allow
-     * for runtime addition.
-     */
-
-    if (virAsprintf(&tmp, "%s.new", path) < 0)
-        return -ENOMEM;
-
-    if (!(f = fopen(tmp, "w"))) {
-        istmp = false;
-        if (!(f = fopen(path, "w"))) {
-            rc = -errno;
-            goto cleanup;
-        }
-    }
-
-    for (i = 0; i < nhosts; i++) {
-        if (fputs(hosts[i].ip, f) == EOF || fputc('\t', f) == EOF) {
-            rc = -errno;
-            VIR_FORCE_FCLOSE(f);
-
-            if (istmp)
-                unlink(tmp);
-
-            goto cleanup;
-        }
-
-        for (ii = 0; ii < hosts[i].nhostnames; ii++) {
-            if (fputs(hosts[i].hostnames[ii], f) == EOF || fputc('\t', f) == EOF) {
-                rc = -errno;
-                VIR_FORCE_FCLOSE(f);
-
-                if (istmp)
-                    unlink(tmp);
-
-                goto cleanup;
-            }
-        }
+    int ret = -1;
 
-        if (fputc('\n', f) == EOF) {
-            rc = -errno;
-            VIR_FORCE_FCLOSE(f);
+    if (VIR_ALLOC_N(lines, addnhostsfile->nhosts) < 0)
+        goto no_memory;
 
-            if (istmp)
-                unlink(tmp);
+    for (i = 0; i < addnhostsfile->nhosts; i++) {
+        dnsmasqAddnHost *host = &addnhostsfile->hosts[i];
 
-            goto cleanup;
-        }
-    }
+        virBufferAsprintf(&buf, "%s\t", host->ip);
+        for (ii = 0; ii < host->nhostnames; ii++)
+            virBufferAsprintf(&buf, "%s\t", host->hostnames[ii]);
 
-    if (VIR_FCLOSE(f) == EOF) {
-        rc = -errno;
-        goto cleanup;
+        if (virBufferError(&buf))
+            goto no_memory;
+        lines[i] = virBufferContentAndReset(&buf);
     }
 
-    if (istmp && rename(tmp, path) < 0) {
-        rc = -errno;
-        unlink(tmp);
-        goto cleanup;
-    }
+    ret = dnsmasqFileSync(addnhostsfile->path, lines, addnhostsfile->nhosts);
 
  cleanup:
-    VIR_FREE(tmp);
-
-    return rc;
-}
-
-static int
-addnhostsSave(dnsmasqAddnHostsfile *addnhostsfile)
-{
-    int err = addnhostsWrite(addnhostsfile->path, addnhostsfile->hosts,
-                             addnhostsfile->nhosts);
-
-    if (err < 0) {
-        virReportSystemError(-err, _("cannot write config file '%s'"),
-                             addnhostsfile->path);
-        return -1;
+    if (lines) {
+        for (i = 0; i < addnhostsfile->nhosts; i++)
+            VIR_FREE(lines[i]);
+        VIR_FREE(lines);
     }
+    return ret;
 
-    return 0;
+ no_memory:
+    virBufferFreeAndReset(&buf);
+    virReportOOMError();
+    goto cleanup;
 }
 
 static int
@@ -369,73 +521,24 @@ hostsfileNew(const char *name,
 }
 
 static int
-hostsfileWrite(const char *path,
-               dnsmasqDhcpHost *hosts,
-               unsigned int nhosts)
+hostsfileSave(dnsmasqHostsfile *hostsfile)
 {
-    char *tmp;
-    FILE *f;
-    bool istmp = true;
+    char **lines = NULL;
     unsigned int i;
-    int rc = 0;
-
-    /* even if there are 0 hosts, create a 0 length file, to allow
-     * for runtime addition.
-     */
+    int ret;
 
-    if (virAsprintf(&tmp, "%s.new", path) < 0)
-        return -ENOMEM;
-
-    if (!(f = fopen(tmp, "w"))) {
-        istmp = false;
-        if (!(f = fopen(path, "w"))) {
-            rc = -errno;
-            goto cleanup;
-        }
-    }
-
-    for (i = 0; i < nhosts; i++) {
-        if (fputs(hosts[i].host, f) == EOF || fputc('\n', f) == EOF) {
-            rc = -errno;
-            VIR_FORCE_FCLOSE(f);
-
-            if (istmp)
-                unlink(tmp);
-
-            goto cleanup;
-        }
-    }
-
-    if (VIR_FCLOSE(f) == EOF) {
-        rc = -errno;
-        goto cleanup;
-    }
-
-    if (istmp && rename(tmp, path) < 0) {
-        rc = -errno;
-        unlink(tmp);
-        goto cleanup;
+    if (VIR_ALLOC_N(lines, hostsfile->nhosts) < 0) {
+        virReportOOMError();
+        return -1;
     }
 
- cleanup:
-    VIR_FREE(tmp);
-
-    return rc;
-}
-
-static int
-hostsfileSave(dnsmasqHostsfile *hostsfile)
-{
-    int err = hostsfileWrite(hostsfile->path, hostsfile->hosts,
-                             hostsfile->nhosts);
+    for (i = 0; i < hostsfile->nhosts; i++)
+        lines[i] = hostsfile->hosts[i].host;
 
-    if (err < 0) {
-        virReportSystemError(-err, _("cannot write config file '%s'"),
-                             hostsfile->path);
-        return -1;
-    }
+    ret = dnsmasqFileSync(hostsfile->path, lines, hostsfile->nhosts);
 
-    return 0;
+    VIR_FREE(lines);
+    return ret;
 }
 
 /**
@@ -532,15 +635,22 @@ dnsmasqAddHost(dnsmasqContext *ctx,
 }
 
 /**
- * dnsmasqSave:
+ * dnsmasqUpdate:
  * @ctx: pointer to the dnsmasq context for each network
  *
- * Saves all the configurations associated with a context to disk.
+ * Brings the configuration files on disk in line with the context.
+ * Files that are up to date are not written, and entries that are new
+ * to a file are appended to it; a file is only rewritten if entries
+ * have to be removed from it.
+ *
+ * Returns 1 if any file was modified, i.e. dnsmasq has to be told to
+ * reload them, 0 if all files were up to date and -1 on error.
  */
 int
-dnsmasqSave(const dnsmasqContext *ctx)
+dnsmasqUpdate(const dnsmasqContext *ctx)
 {
     int ret = 0;
+    int rc;
 
     if (virFileMakePath(ctx->config_dir) < 0) {
         virReportSystemError(errno, _("cannot create config directory '%s'"),
@@ -548,16 +658,32 @@ dnsmasqSave(const dnsmasqContext *ctx)
         return -1;
     }
 
-    if (ctx->hostsfile)
-        ret = hostsfileSave(ctx->hostsfile);
-    if (ret == 0) {
-        if (ctx->addnhostsfile)
-            ret = addnhostsSave(ctx->addnhostsfile);
+    if (ctx->hostsfile) {
+        if ((rc = hostsfileSave(ctx->hostsfile)) < 0)
+            return -1;
+        ret |= rc;
+    }
+    if (ctx->addnhostsfile) {
+        if ((rc = addnhostsSave(ctx->addnhostsfile)) < 0)
+            return -1;
+        ret |= rc;
     }
 
     return ret;
 }
 
+/**
+ * dnsmasqSave:
+ * @ctx: pointer to the dnsmasq context for each network
+ *
+ * Saves all the configurations associated with a context to disk.
+ */
+int
+dnsmasqSave(const dnsmasqContext *ctx)
+{
+    return dnsmasqUpdate(ctx) < 0 ? -1 : 0;
+}
+
 
 /**
  * dnsmasqDelete:
@@ -599,6 +725,200 @@ dnsmasqReload(pid_t pid ATTRIBUTE_UNUSED)
     return 0;
 }
 
+/*
+ * dnsmasqLeaseIndex functions - an in-memory copy of a dnsmasq lease
+ * file, indexed by MAC address.
+ */
+struct _dnsmasqLeaseIndex {
+    size_t nleases;
+    dnsmasqLeasePtr *leases;
+
+    virHashTablePtr byMac;  /* MAC address => first lease of the MAC */
+};
+
+static void
+dnsmasqLeaseFree(dnsmasqLeasePtr lease)
+{
+    if (!lease)
+        return;
+
+    VIR_FREE(lease->mac);
+    VIR_FREE(lease->iaid);
+    VIR_FREE(lease->ipaddr);
+    VIR_FREE(lease->hostname);
+    VIR_FREE(lease->clientid);
+    VIR_FREE(lease);
+}
+
+void
+dnsmasqLeaseIndexFree(dnsmasqLeaseIndexPtr idx)
+{
+    size_t i;
+
+    if (!idx)
+        return;
+
+    for (i = 0; i < idx->nleases; i++)
+        dnsmasqLeaseFree(idx->leases[i]);
+    VIR_FREE(idx->leases);
+    virHashFree(idx->byMac);
+    VIR_FREE(idx);
+}
+
+/*
+ * Parses one line of a lease file, which reads
+ *
+ *   <expiry> <mac> <ip> <hostname|*> <clientid|*>
+ *
+ * for DHCPv4 leases and
+ *
+ *   <expiry> <iaid> <ip> <hostname|*> <duid|*>
+ *
+ * for DHCPv6 leases. Lines in neither format, such as the one holding
+ * the DUID of the server, are ignored by returning 0 with @lease left
+ * NULL.
+ */
+static int
+dnsmasqLeaseParse(char *line,
+                  dnsmasqLeasePtr *lease)
+{
+    char *fields[5];
+    char *saveptr = NULL;
+    dnsmasqLeasePtr tmp = NULL;
+    size_t i;
+
+    *lease = NULL;
+
+    for (i = 0; i < ARRAY_CARDINALITY(fields); i++) {
+        if (!(fields[i] = strtok_r(i == 0 ? line : NULL, " \t", &saveptr)))
+            return 0;
+    }
+
+    if (VIR_ALLOC(tmp) < 0)
+        goto no_memory;
+
+    if (virStrToLong_ll(fields[0], NULL, 10, &tmp->expirytime) < 0) {
+        dnsmasqLeaseFree(tmp);
+        return 0;
+    }
+    tmp->ipv6 = strchr(fields[2], ':') != NULL;
+
+    if (!(tmp->ipaddr = strdup(fields[2])))
+        goto no_memory;
+    if (tmp->ipv6) {
+        if (!(tmp->iaid = strdup(fields[1])))
+            goto no_memory;
+    } else {
+        if (!(tmp->mac = strdup(fields[1])))
+            goto no_memory;
+    }
+    if (STRNEQ(fields[3], "*") && !(tmp->hostname = strdup(fields[3])))
+        goto no_memory;
+    if (STRNEQ(fields[4], "*") && !(tmp->clientid = strdup(fields[4])))
+        goto no_memory;
+
+    *lease = tmp;
+    return 0;
+
+no_memory:
+    virReportOOMError();
+    dnsmasqLeaseFree(tmp);
+    return -1;
+}
+
+/**
+ * dnsmasqLeaseIndexNewFromFile:
+ * @path: path of the lease file maintained by dnsmasq
+ *
+ * Parses the lease file at @path once and indexes its leases, so that
+ * they can be looked up without touching the file again. A missing
+ * file yields an empty index, as dnsmasq only creates it once the
+ * first lease is handed out.
+ *
+ * Returns the index, or NULL on error.
+ */
+dnsmasqLeaseIndexPtr
+dnsmasqLeaseIndexNewFromFile(const char *path)
+{
+    dnsmasqLeaseIndexPtr idx = NULL;
+    char *content = NULL;
+    char *line, *eol;
+
+    if (VIR_ALLOC(idx) < 0)
+        goto no_memory;
+    if (!(idx->byMac = virHashCreate(32, NULL)))
+        goto error;
+
+    if (!virFileExists(path))
+        return idx;
+
+    if (virFileReadAll(path, DNSMASQ_FILE_MAX_LEN, &content) < 0)
+        goto error;
+
+    for (line = content; line && *line; line = eol) {
+        dnsmasqLeasePtr lease;
+
+        if ((eol = strchr(line, '\n')))
+            *eol++ = '\0';
+
+        if (dnsmasqLeaseParse(line, &lease) < 0)
+            goto error;
+        if (!lease)
+            continue;
+
+        if (VIR_APPEND_ELEMENT(idx->leases, idx->nleases, lease) < 0) {
+            dnsmasqLeaseFree(lease);
+            goto no_memory;
+        }
+
+        if (lease->mac) {
+            lease->nextByMac = virHashLookup(idx->byMac, lease->mac);
+            if (virHashUpdateEntry(idx->byMac, lease->mac, lease) < 0)
+                goto error;
+        }
+    }
+
+    VIR_FREE(content);
+    return idx;
+
+no_memory:
+    virReportOOMError();
+error:
+    VIR_FREE(content);
+    dnsmasqLeaseIndexFree(idx);
+    return NULL;
+}
+
+size_t
+dnsmasqLeaseIndexCount(dnsmasqLeaseIndexPtr idx)
+{
+    return idx->nleases;
+}
+
+dnsmasqLeasePtr
+dnsmasqLeaseIndexGet(dnsmasqLeaseIndexPtr idx,
+                     size_t i)
+{
+    if (i >= idx->nleases)
+        return NULL;
+    return idx->leases[i];
+}
+
+/**
+ * dnsmasqLeaseIndexLookupByMac:
+ * @idx: lease index
+ * @mac: MAC address in the lower case format used by dnsmasq
+ *
+ * Returns the first lease held by @mac, the remaining ones are chained
+ * through the nextByMac member; or NULL if @mac holds no lease.
+ */
+dnsmasqLeasePtr
+dnsmasqLeaseIndexLookupByMac(dnsmasqLeaseIndexPtr idx,
+                             const char *mac)
+{
+    return virHashLookup(idx->byMac, mac);
+}
+
 /*
  * dnsmasqCapabilities functions - provide useful information about the
  * version of dnsmasq on this machine.
@@ -607,6 +927,7 @@ dnsmasqReload(pid_t pid ATTRIBUTE_UNUSED)
 struct _dnsmasqCaps {
     virObject object;
     char *binaryPath;
+    char *cachePath;
     bool noRefresh;
     time_t mtime;
     virBitmapPtr flags;
@@ -622,6 +943,7 @@ dnsmasqCapsDispose(void *obj)
 
     virBitmapFree(caps->flags);
     VIR_FREE(caps->binaryPath);
+    VIR_FREE(caps->cachePath);
 }
 
 static int dnsmasqCapsOnceInit(void)
@@ -705,6 +1027,79 @@ cleanup:
     return ret;
 }
 
+/*
+ * The output of --version and --help is kept in caps->cachePath, if
+ * set, behind a header identifying the binary it was taken from, so
+ * a restarted daemon does not need to run dnsmasq again.
+ */
+static char *
+dnsmasqCapsCacheHeader(dnsmasqCapsPtr caps, struct stat *sb)
+{
+    char *header;
+
+    if (virAsprintf(&header, "%s %lld %lld\n", caps->binaryPath,
+                    (long long)sb->st_mtime, (long long)sb->st_size) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+    return header;
+}
+
+static int
+dnsmasqCapsCacheWrite(int fd, void *opaque)
+{
+    const char *data = opaque;
+
+    if (safewrite(fd, data, strlen(data)) < 0)
+        return -1;
+
+    return 0;
+}
+
+static char *
+dnsmasqCapsLoadCache(dnsmasqCapsPtr caps, const char *header)
+{
+    char *buf = NULL;
+    char *ret = NULL;
+    const char *data;
+
+    if (!virFileExists(caps->cachePath))
+        return NULL;
+
+    if (virFileReadAll(caps->cachePath, 1024 * 1024, &buf) < 0) {
+        virResetLastError();
+        return NULL;
+    }
+
+    if (!(data = STRSKIP(buf, header))) {
+        VIR_DEBUG("Cached capabilities in %s are stale", caps->cachePath);
+        goto cleanup;
+    }
+
+    if (!(ret = strdup(data)))
+        virReportOOMError();
+
+cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
+static void
+dnsmasqCapsSaveCache(dnsmasqCapsPtr caps, const char *header,
+                     const char *complete)
+{
+    char *data = NULL;
+
+    if (virAsprintf(&data, "%s%s", header, complete) < 0 ||
+        virFileRewrite(caps->cachePath, S_IRUSR | S_IWUSR,
+                       dnsmasqCapsCacheWrite, data) < 0) {
+        VIR_WARN("Unable to cache dnsmasq capabilities in %s",
+                 caps->cachePath);
+        virResetLastError();
+    }
+    VIR_FREE(data);
+}
+
 static int
 dnsmasqCapsRefreshInternal(dnsmasqCapsPtr caps, bool force)
 {
@@ -712,6 +1107,7 @@ dnsmasqCapsRefreshInternal(dnsmasqCapsPtr caps, bool force)
     struct stat sb;
     virCommandPtr cmd = NULL;
     char *help = NULL, *version = NULL, *complete = NULL;
+    char *header = NULL;
 
     if (!caps || caps->noRefresh)
         return 0;
@@ -726,6 +1122,17 @@ dnsmasqCapsRefreshInternal(dnsmasqCapsPtr caps, bool force)
     }
     caps->mtime = sb.st_mtime;
 
+    if (caps->cachePath) {
+        if (!(header = dnsmasqCapsCacheHeader(caps, &sb)))
+            goto cleanup;
+        if ((complete = dnsmasqCapsLoadCache(caps, header))) {
+            VIR_DEBUG("Using dnsmasq capabilities cached in %s",
+                      caps->cachePath);
+            ret = dnsmasqCapsSetFromBuffer(caps, complete);
+            goto cleanup;
+        }
+    }
+
     /* Make sure the binary we are about to try exec'ing exists.
      * Technically we could catch the exec() failure, but that's
      * in a sub-process so it's hard to feed back a useful error.
@@ -764,8 +1171,12 @@ dnsmasqCapsRefreshInternal(dnsmasqCapsPtr caps, bool force)
 
     ret = dnsmasqCapsSetFromBuffer(caps, complete);
 
+    if (ret == 0 && header)
+        dnsmasqCapsSaveCache(caps, header, complete);
+
 cleanup:
     virCommandFree(cmd);
+    VIR_FREE(header);
     VIR_FREE(help);
     VIR_FREE(version);
     VIR_FREE(complete);
@@ -825,12 +1236,30 @@ dnsmasqCapsNewFromFile(const char *dataPath, const char *binaryPath)
 
 dnsmasqCapsPtr
 dnsmasqCapsNewFromBinary(const char *binaryPath)
+{
+    return dnsmasqCapsNewFromBinaryCached(binaryPath, NULL);
+}
+
+/** dnsmasqCapsNewFromBinaryCached:
+ *
+ *   Like dnsmasqCapsNewFromBinary, but keeps what was learnt from the
+ *   binary in @cachePath and reuses it as long as the binary does not
+ *   change, so that dnsmasq is not run every time the daemon starts.
+ */
+dnsmasqCapsPtr
+dnsmasqCapsNewFromBinaryCached(const char *binaryPath, const char *cachePath)
 {
     dnsmasqCapsPtr caps = dnsmasqCapsNewEmpty(binaryPath);
 
     if (!caps)
         return NULL;
 
+    if (cachePath && !(caps->cachePath = strdup(cachePath))) {
+        virReportOOMError();
+        virObjectUnref(caps);
+        return NULL;
+    }
+
     if (dnsmasqCapsRefreshInternal(caps, true) < 0) {
         virObjectUnref(caps);
         return NULL;
@@ -66,6 +66,23 @@ typedef struct
     dnsmasqAddnHostsfile *addnhostsfile;
 } dnsmasqContext;
 
+typedef struct _dnsmasqLease dnsmasqLease;
+typedef dnsmasqLease *dnsmasqLeasePtr;
+struct _dnsmasqLease {
+    long long expirytime;   /* seconds since epoch, 0 if infinite */
+    bool ipv6;
+    char *mac;              /* DHCPv4 leases only */
+    char *iaid;             /* DHCPv6 leases only */
+    char *ipaddr;
+    char *hostname;         /* NULL if unknown */
+    char *clientid;         /* client ID or DUID, NULL if unknown */
+
+    dnsmasqLeasePtr nextByMac;  /* next lease of the same MAC */
+};
+
+typedef struct _dnsmasqLeaseIndex dnsmasqLeaseIndex;
+typedef dnsmasqLeaseIndex *dnsmasqLeaseIndexPtr;
+
 typedef enum {
    DNSMASQ_CAPS_BIND_DYNAMIC = 0, /* support for --bind-dynamic */
    DNSMASQ_CAPS_BINDTODEVICE = 1, /* uses SO_BINDTODEVICE for --bind-interfaces */
@@ -89,14 +106,24 @@ int              dnsmasqAddHost(dnsmasqContext *ctx,
                                 virSocketAddr *ip,
                                 const char *name);
 int              dnsmasqSave(const dnsmasqContext *ctx);
+int              dnsmasqUpdate(const dnsmasqContext *ctx);
 int              dnsmasqDelete(const dnsmasqContext *ctx);
 int              dnsmasqReload(pid_t pid);
 
+dnsmasqLeaseIndexPtr dnsmasqLeaseIndexNewFromFile(const char *path);
+void dnsmasqLeaseIndexFree(dnsmasqLeaseIndexPtr idx);
+size_t dnsmasqLeaseIndexCount(dnsmasqLeaseIndexPtr idx);
+dnsmasqLeasePtr dnsmasqLeaseIndexGet(dnsmasqLeaseIndexPtr idx, size_t i);
+dnsmasqLeasePtr dnsmasqLeaseIndexLookupByMac(dnsmasqLeaseIndexPtr idx,
+                                             const char *mac);
+
 dnsmasqCapsPtr dnsmasqCapsNewFromBuffer(const char *buf,
                                         const char *binaryPath);
 dnsmasqCapsPtr dnsmasqCapsNewFromFile(const char *dataPath,
                                       const char *binaryPath);
 dnsmasqCapsPtr dnsmasqCapsNewFromBinary(const char *binaryPath);
+dnsmasqCapsPtr dnsmasqCapsNewFromBinaryCached(const char *binaryPath,
+                                             const char *cachePath);
 int dnsmasqCapsRefresh(dnsmasqCapsPtr *caps, const char *binaryPath);
 bool dnsmasqCapsGet(dnsmasqCapsPtr caps, dnsmasqCapsFlags flag);
 const char *dnsmasqCapsGetBinaryPath(dnsmasqCapsPtr caps);
@@ -30,6 +30,9 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#if WITH_EPOLL
+# include <sys/epoll.h>
+#endif
 
 #include "threads.h"
 #include "logging.h"
@@ -66,8 +69,33 @@ struct virEventPollTimeout {
     virFreeCallback ff;
     void *opaque;
     int deleted;
+    /* Position in the expiry heap, or -1 if the timer is not armed */
+    ssize_t heapIndex;
+    /* Index in the timer sources, or -1 if it could not be recorded */
+    ssize_t source;
 };
 
+/* Counters for all the timers sharing one callback, kept once the
+ * timers are gone so that short lived ones add up */
+struct virEventPollTimerSource {
+    virEventTimeoutCallback cb;
+    unsigned long long wakeups;     /* loop iterations it woke up */
+    unsigned long long dispatches;  /* callback runs */
+};
+
+#if WITH_EPOLL
+/* State for a single file descriptor registered with epoll. More
+ * than one handle may watch the same file descriptor, so epoll is
+ * given the union of the events they are interested in */
+struct virEventPollFD {
+    int *watches;
+    size_t nwatches;
+    size_t nwatchesAlloc;
+    int events;         /* Native events currently registered */
+    bool alwaysReady;   /* epoll refused the fd, eg a regular file */
+};
+#endif
+
 /* Allocate extra slots for virEventPollHandle/virEventPollTimeout
    records in this multiple */
 #define EVENT_ALLOC_EXTENT 10
@@ -78,12 +106,37 @@ struct virEventPollLoop {
     int running;
     virThread leader;
     int wakeupfd[2];
+    /* Sorted by watch, since watches are only ever appended */
     size_t handlesCount;
     size_t handlesAlloc;
+    size_t handlesDeleted;
     struct virEventPollHandle *handles;
+    /* Sorted by timer, since timers are only ever appended */
     size_t timeoutsCount;
     size_t timeoutsAlloc;
+    size_t timeoutsDeleted;
     struct virEventPollTimeout *timeouts;
+    /* Binary min-heap of indexes into timeouts[], ordered by expiry.
+     * Both arrays below are sized to hold every timeout */
+    size_t timeoutsHeapCount;
+    size_t timeoutsHeapAlloc;
+    size_t *timeoutsHeap;
+    int *timeoutsExpired;
+    /* Milliseconds a wakeup may be delayed to run timers together */
+    int timerSlack;
+    size_t ntimerSources;
+    struct virEventPollTimerSource *timerSources;
+    unsigned long long iterations;
+    unsigned long long timerWakeups;
+#if WITH_EPOLL
+    int epollfd;
+    /* Indexed by file descriptor number */
+    size_t fdsAlloc;
+    struct virEventPollFD *fds;
+    size_t fdsAlwaysReady;
+    size_t epollEventsAlloc;
+    struct epoll_event *epollEvents;
+#endif
 };
 
 /* Only have one event loop */
@@ -95,6 +148,306 @@ static int nextWatch = 1;
 /* Unique ID for the next timer to be registered */
 static int nextTimer = 1;
 
+
+/*
+ * Find the index of the handle with a given watch, or -1 if
+ * there is none. Relies on the handles list being sorted.
+ */
+static ssize_t virEventPollFindHandle(int watch)
+{
+    size_t lo = 0;
+    size_t hi = eventLoop.handlesCount;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (eventLoop.handles[mid].watch == watch)
+            return mid;
+        if (eventLoop.handles[mid].watch < watch)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
+
+/*
+ * Find the index of the timeout with a given timer, or -1 if
+ * there is none. Relies on the timeouts list being sorted.
+ */
+static ssize_t virEventPollFindTimeout(int timer)
+{
+    size_t lo = 0;
+    size_t hi = eventLoop.timeoutsCount;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (eventLoop.timeouts[mid].timer == timer)
+            return mid;
+        if (eventLoop.timeouts[mid].timer < timer)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
+
+
+/*
+ * Helpers for maintaining the heap of armed timers, so the
+ * soonest expiry can be found without scanning every timer.
+ * Ties are broken on timer ID so that timers expiring at the
+ * same moment dispatch in the order they were registered.
+ */
+static bool virEventPollTimeoutBefore(size_t a, size_t b)
+{
+    struct virEventPollTimeout *ta = &eventLoop.timeouts[a];
+    struct virEventPollTimeout *tb = &eventLoop.timeouts[b];
+
+    if (ta->expiresAt != tb->expiresAt)
+        return ta->expiresAt < tb->expiresAt;
+    return ta->timer < tb->timer;
+}
+
+static void virEventPollTimeoutHeapSet(size_t pos, size_t idx)
+{
+    eventLoop.timeoutsHeap[pos] = idx;
+    eventLoop.timeouts[idx].heapIndex = pos;
+}
+
+static void virEventPollTimeoutHeapUp(size_t pos)
+{
+    size_t idx = eventLoop.timeoutsHeap[pos];
+
+    while (pos > 0) {
+        size_t parent = (pos - 1) / 2;
+        if (!virEventPollTimeoutBefore(idx, eventLoop.timeoutsHeap[parent]))
+            break;
+        virEventPollTimeoutHeapSet(pos, eventLoop.timeoutsHeap[parent]);
+        pos = parent;
+    }
+    virEventPollTimeoutHeapSet(pos, idx);
+}
+
+static void virEventPollTimeoutHeapDown(size_t pos)
+{
+    size_t idx = eventLoop.timeoutsHeap[pos];
+
+    for (;;) {
+        size_t child = (2 * pos) + 1;
+        if (child >= eventLoop.timeoutsHeapCount)
+            break;
+        if ((child + 1) < eventLoop.timeoutsHeapCount &&
+            virEventPollTimeoutBefore(eventLoop.timeoutsHeap[child + 1],
+                                      eventLoop.timeoutsHeap[child]))
+            child++;
+        if (!virEventPollTimeoutBefore(eventLoop.timeoutsHeap[child], idx))
+            break;
+        virEventPollTimeoutHeapSet(pos, eventLoop.timeoutsHeap[child]);
+        pos = child;
+    }
+    virEventPollTimeoutHeapSet(pos, idx);
+}
+
+/* Space for the entry is guaranteed by virEventPollAddTimeout */
+static void virEventPollTimeoutHeapInsert(size_t idx)
+{
+    size_t pos = eventLoop.timeoutsHeapCount++;
+
+    eventLoop.timeoutsHeap[pos] = idx;
+    virEventPollTimeoutHeapUp(pos);
+}
+
+static void virEventPollTimeoutHeapRemove(size_t idx)
+{
+    ssize_t pos = eventLoop.timeouts[idx].heapIndex;
+    size_t last;
+
+    if (pos < 0)
+        return;
+
+    eventLoop.timeouts[idx].heapIndex = -1;
+    eventLoop.timeoutsHeapCount--;
+    if ((size_t)pos == eventLoop.timeoutsHeapCount)
+        return;
+
+    last = eventLoop.timeoutsHeap[eventLoop.timeoutsHeapCount];
+    virEventPollTimeoutHeapSet(pos, last);
+    virEventPollTimeoutHeapUp(pos);
+    virEventPollTimeoutHeapDown(eventLoop.timeouts[last].heapIndex);
+}
+
+/* Re-position or (dis)arm a timer after its expiry changed */
+static void virEventPollTimeoutHeapUpdate(size_t idx)
+{
+    struct virEventPollTimeout *t = &eventLoop.timeouts[idx];
+
+    if (t->deleted || t->frequency < 0) {
+        virEventPollTimeoutHeapRemove(idx);
+    } else if (t->heapIndex < 0) {
+        virEventPollTimeoutHeapInsert(idx);
+    } else {
+        virEventPollTimeoutHeapUp(t->heapIndex);
+        virEventPollTimeoutHeapDown(t->heapIndex);
+    }
+}
+
+
+#if WITH_EPOLL
+static int
+virEventPollNativeToEpoll(int events)
+{
+    int ret = 0;
+    if (events & POLLIN)
+        ret |= EPOLLIN;
+    if (events & POLLOUT)
+        ret |= EPOLLOUT;
+    if (events & POLLERR)
+        ret |= EPOLLERR;
+    if (events & POLLHUP)
+        ret |= EPOLLHUP;
+    return ret;
+}
+
+static int
+virEventPollNativeFromEpoll(int events)
+{
+    int ret = 0;
+    if (events & EPOLLIN)
+        ret |= POLLIN;
+    if (events & EPOLLOUT)
+        ret |= POLLOUT;
+    if (events & EPOLLERR)
+        ret |= POLLERR;
+    if (events & EPOLLHUP)
+        ret |= POLLHUP;
+    return ret;
+}
+
+/*
+ * Push the union of events wanted by all live handles on @fd
+ * into the epoll set. @added is true if a new watch was just
+ * registered against @fd, in which case the kernel is always
+ * told since the fd number may have been closed and reused
+ * behind our back.
+ */
+static void virEventPollUpdateFD(int fd, bool added)
+{
+    struct virEventPollFD *info;
+    struct epoll_event ev;
+    char ebuf[1024];
+    int events = 0;
+    int op;
+    size_t i;
+
+    if (fd < 0 || fd >= eventLoop.fdsAlloc)
+        return;
+    info = &eventLoop.fds[fd];
+
+    for (i = 0 ; i < info->nwatches ; i++) {
+        ssize_t idx = virEventPollFindHandle(info->watches[i]);
+        if (idx < 0 || eventLoop.handles[idx].deleted)
+            continue;
+        events |= eventLoop.handles[idx].events;
+    }
+
+    if (info->alwaysReady) {
+        info->events = events;
+        return;
+    }
+
+    if (events == info->events && !(added && events))
+        return;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = virEventPollNativeToEpoll(events);
+    ev.data.fd = fd;
+
+    if (events == 0)
+        op = EPOLL_CTL_DEL;
+    else if (info->events == 0 || added)
+        op = EPOLL_CTL_ADD;
+    else
+        op = EPOLL_CTL_MOD;
+
+    if (epoll_ctl(eventLoop.epollfd, op, fd, &ev) < 0) {
+        if (op == EPOLL_CTL_ADD && errno == EEXIST) {
+            op = EPOLL_CTL_MOD;
+        } else if (op == EPOLL_CTL_MOD && errno == ENOENT) {
+            op = EPOLL_CTL_ADD;
+        } else if (op == EPOLL_CTL_DEL && (errno == ENOENT || errno == EBADF)) {
+            /* Already gone, eg fd was closed before the watch was removed */
+            goto done;
+        } else if (op == EPOLL_CTL_ADD && errno == EPERM) {
+            /* Regular files and some devices can't be used with
+             * epoll, but poll() always reports them as ready */
+            EVENT_DEBUG("fd %d not pollable with epoll, treating as ready", fd);
+            info->alwaysReady = true;
+            eventLoop.fdsAlwaysReady++;
+            goto done;
+        } else {
+            goto error;
+        }
+        if (epoll_ctl(eventLoop.epollfd, op, fd, &ev) < 0)
+            goto error;
+    }
+
+done:
+    info->events = events;
+    return;
+
+error:
+    VIR_WARN("Unable to update epoll registration of fd %d: %s",
+             fd, virStrerror(errno, ebuf, sizeof(ebuf)));
+    info->events = events;
+}
+
+/* Make room to track a new watch against @fd */
+static int virEventPollReserveFD(int fd)
+{
+    struct virEventPollFD *info;
+
+    if (fd >= eventLoop.fdsAlloc &&
+        VIR_RESIZE_N(eventLoop.fds, eventLoop.fdsAlloc,
+                     eventLoop.fdsAlloc, fd + 1 - eventLoop.fdsAlloc) < 0)
+        return -1;
+
+    info = &eventLoop.fds[fd];
+    if (VIR_RESIZE_N(info->watches, info->nwatchesAlloc,
+                     info->nwatches, 1) < 0)
+        return -1;
+
+    return 0;
+}
+
+/* Forget a watch purged from the handles list */
+static void virEventPollReleaseFD(int fd, int watch)
+{
+    struct virEventPollFD *info;
+    size_t i;
+
+    if (fd < 0 || fd >= eventLoop.fdsAlloc)
+        return;
+    info = &eventLoop.fds[fd];
+
+    for (i = 0 ; i < info->nwatches ; i++) {
+        if (info->watches[i] == watch) {
+            VIR_DELETE_ELEMENT_INPLACE(info->watches, i, info->nwatches);
+            break;
+        }
+    }
+
+    if (info->nwatches == 0) {
+        VIR_FREE(info->watches);
+        info->nwatchesAlloc = 0;
+        if (info->alwaysReady) {
+            info->alwaysReady = false;
+            eventLoop.fdsAlwaysReady--;
+        }
+    }
+}
+#endif /* WITH_EPOLL */
+
+
 /*
  * Register a callback for monitoring file handle events.
  * NB, it *must* be safe to call this from within a callback
@@ -115,6 +468,12 @@ int virEventPollAddHandle(int fd, int events,
             return -1;
         }
     }
+#if WITH_EPOLL
+    if (fd < 0 || virEventPollReserveFD(fd) < 0) {
+        virMutexUnlock(&eventLoop.lock);
+        return -1;
+    }
+#endif
 
     watch = nextWatch++;
 
@@ -129,6 +488,11 @@ int virEventPollAddHandle(int fd, int events,
 
     eventLoop.handlesCount++;
 
+#if WITH_EPOLL
+    eventLoop.fds[fd].watches[eventLoop.fds[fd].nwatches++] = watch;
+    virEventPollUpdateFD(fd, true);
+#endif
+
     virEventPollInterruptLocked();
 
     PROBE(EVENT_POLL_ADD_HANDLE,
@@ -140,7 +504,7 @@ int virEventPollAddHandle(int fd, int events,
 }
 
 void virEventPollUpdateHandle(int watch, int events) {
-    int i;
+    ssize_t i;
     bool found = false;
     PROBE(EVENT_POLL_UPDATE_HANDLE,
           "watch=%d events=%d",
@@ -152,14 +516,14 @@ void virEventPollUpdateHandle(int watch, int events) {
     }
 
     virMutexLock(&eventLoop.lock);
-    for (i = 0 ; i < eventLoop.handlesCount ; i++) {
-        if (eventLoop.handles[i].watch == watch) {
-            eventLoop.handles[i].events =
-                    virEventPollToNativeEvents(events);
-            virEventPollInterruptLocked();
-            found = true;
-            break;
-        }
+    if ((i = virEventPollFindHandle(watch)) >= 0) {
+        eventLoop.handles[i].events =
+                virEventPollToNativeEvents(events);
+#if WITH_EPOLL
+        virEventPollUpdateFD(eventLoop.handles[i].fd, false);
+#endif
+        virEventPollInterruptLocked();
+        found = true;
     }
     virMutexUnlock(&eventLoop.lock);
 
@@ -174,7 +538,7 @@ void virEventPollUpdateHandle(int watch, int events) {
  * Actual deletion will be done out-of-band
  */
 int virEventPollRemoveHandle(int watch) {
-    int i;
+    ssize_t i;
     PROBE(EVENT_POLL_REMOVE_HANDLE,
           "watch=%d",
           watch);
@@ -185,23 +549,41 @@ int virEventPollRemoveHandle(int watch) {
     }
 
     virMutexLock(&eventLoop.lock);
-    for (i = 0 ; i < eventLoop.handlesCount ; i++) {
-        if (eventLoop.handles[i].deleted)
-            continue;
-
-        if (eventLoop.handles[i].watch == watch) {
-            EVENT_DEBUG("mark delete %d %d", i, eventLoop.handles[i].fd);
-            eventLoop.handles[i].deleted = 1;
-            virEventPollInterruptLocked();
-            virMutexUnlock(&eventLoop.lock);
-            return 0;
-        }
+    if ((i = virEventPollFindHandle(watch)) >= 0 &&
+        !eventLoop.handles[i].deleted) {
+        EVENT_DEBUG("mark delete %zd %d", i, eventLoop.handles[i].fd);
+        eventLoop.handles[i].deleted = 1;
+        eventLoop.handlesDeleted++;
+#if WITH_EPOLL
+        /* Drop the registration now, while the caller
+         * still guarantees the fd is open */
+        virEventPollUpdateFD(eventLoop.handles[i].fd, false);
+#endif
+        virEventPollInterruptLocked();
+        virMutexUnlock(&eventLoop.lock);
+        return 0;
     }
     virMutexUnlock(&eventLoop.lock);
     return -1;
 }
 
 
+/* Find or add the timer source counting the timers running @cb */
+static ssize_t virEventPollTimerSourceIndex(virEventTimeoutCallback cb)
+{
+    size_t i;
+
+    for (i = 0 ; i < eventLoop.ntimerSources ; i++) {
+        if (eventLoop.timerSources[i].cb == cb)
+            return i;
+    }
+
+    if (VIR_EXPAND_N(eventLoop.timerSources, eventLoop.ntimerSources, 1) < 0)
+        return -1;
+    eventLoop.timerSources[i].cb = cb;
+    return i;
+}
+
 /*
  * Register a callback for a timer event
  * NB, it *must* be safe to call this from within a callback
@@ -215,7 +597,7 @@ int virEventPollAddTimeout(int frequency,
     unsigned long long now;
     int ret;
 
-    if (virTimeMillisNow(&now) < 0) {
+    if (virTimeMillisMonotonic(&now) < 0) {
         return -1;
     }
 
@@ -229,6 +611,17 @@ int virEventPollAddTimeout(int frequency,
             return -1;
         }
     }
+    if (eventLoop.timeoutsHeapAlloc < eventLoop.timeoutsAlloc) {
+        if (VIR_REALLOC_N(eventLoop.timeoutsHeap,
+                          eventLoop.timeoutsAlloc) < 0 ||
+            VIR_REALLOC_N(eventLoop.timeoutsExpired,
+                          eventLoop.timeoutsAlloc) < 0) {
+            virReportOOMError();
+            virMutexUnlock(&eventLoop.lock);
+            return -1;
+        }
+        eventLoop.timeoutsHeapAlloc = eventLoop.timeoutsAlloc;
+    }
 
     eventLoop.timeouts[eventLoop.timeoutsCount].timer = nextTimer++;
     eventLoop.timeouts[eventLoop.timeoutsCount].frequency = frequency;
@@ -238,6 +631,11 @@ int virEventPollAddTimeout(int frequency,
     eventLoop.timeouts[eventLoop.timeoutsCount].deleted = 0;
     eventLoop.timeouts[eventLoop.timeoutsCount].expiresAt =
         frequency >= 0 ? frequency + now : 0;
+    eventLoop.timeouts[eventLoop.timeoutsCount].heapIndex = -1;
+    eventLoop.timeouts[eventLoop.timeoutsCount].source =
+        virEventPollTimerSourceIndex(cb);
+    if (frequency >= 0)
+        virEventPollTimeoutHeapInsert(eventLoop.timeoutsCount);
 
     eventLoop.timeoutsCount++;
     ret = nextTimer-1;
@@ -253,7 +651,7 @@ int virEventPollAddTimeout(int frequency,
 void virEventPollUpdateTimeout(int timer, int frequency)
 {
     unsigned long long now;
-    int i;
+    ssize_t i;
     bool found = false;
     PROBE(EVENT_POLL_UPDATE_TIMEOUT,
           "timer=%d frequency=%d",
@@ -264,22 +662,20 @@ void virEventPollUpdateTimeout(int timer, int frequency)
         return;
     }
 
-    if (virTimeMillisNow(&now) < 0) {
+    if (virTimeMillisMonotonic(&now) < 0) {
         return;
     }
 
     virMutexLock(&eventLoop.lock);
-    for (i = 0 ; i < eventLoop.timeoutsCount ; i++) {
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].frequency = frequency;
-            eventLoop.timeouts[i].expiresAt =
-                frequency >= 0 ? frequency + now : 0;
-            VIR_DEBUG("Set timer freq=%d expires=%llu", frequency,
-                      eventLoop.timeouts[i].expiresAt);
-            virEventPollInterruptLocked();
-            found = true;
-            break;
-        }
+    if ((i = virEventPollFindTimeout(timer)) >= 0) {
+        eventLoop.timeouts[i].frequency = frequency;
+        eventLoop.timeouts[i].expiresAt =
+            frequency >= 0 ? frequency + now : 0;
+        VIR_DEBUG("Set timer freq=%d expires=%llu", frequency,
+                  eventLoop.timeouts[i].expiresAt);
+        virEventPollTimeoutHeapUpdate(i);
+        virEventPollInterruptLocked();
+        found = true;
     }
     virMutexUnlock(&eventLoop.lock);
 
@@ -294,7 +690,7 @@ void virEventPollUpdateTimeout(int timer, int frequency)
  * Actual deletion will be done out-of-band
  */
 int virEventPollRemoveTimeout(int timer) {
-    int i;
+    ssize_t i;
     PROBE(EVENT_POLL_REMOVE_TIMEOUT,
           "timer=%d",
           timer);
@@ -305,51 +701,44 @@ int virEventPollRemoveTimeout(int timer) {
     }
 
     virMutexLock(&eventLoop.lock);
-    for (i = 0 ; i < eventLoop.timeoutsCount ; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].deleted = 1;
-            virEventPollInterruptLocked();
-            virMutexUnlock(&eventLoop.lock);
-            return 0;
-        }
+    if ((i = virEventPollFindTimeout(timer)) >= 0 &&
+        !eventLoop.timeouts[i].deleted) {
+        eventLoop.timeouts[i].deleted = 1;
+        eventLoop.timeoutsDeleted++;
+        virEventPollTimeoutHeapRemove(i);
+        virEventPollInterruptLocked();
+        virMutexUnlock(&eventLoop.lock);
+        return 0;
     }
     virMutexUnlock(&eventLoop.lock);
     return -1;
 }
 
-/* Iterates over all registered timeouts and determine which
- * will be the first to expire.
+/* Determine which of the registered timeouts will be the
+ * first to expire.
  * @timeout: filled with expiry time of soonest timer, or -1 if
  *           no timeout is pending
  * returns: 0 on success, -1 on error
  */
 static int virEventPollCalculateTimeout(int *timeout) {
     unsigned long long then = 0;
-    int i;
-    EVENT_DEBUG("Calculate expiry of %zu timers", eventLoop.timeoutsCount);
-    /* Figure out if we need a timeout */
-    for (i = 0 ; i < eventLoop.timeoutsCount ; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-        if (eventLoop.timeouts[i].frequency < 0)
-            continue;
+    EVENT_DEBUG("Calculate expiry of %zu timers", eventLoop.timeoutsHeapCount);
 
-        EVENT_DEBUG("Got a timeout scheduled for %llu", eventLoop.timeouts[i].expiresAt);
-        if (then == 0 ||
-            eventLoop.timeouts[i].expiresAt < then)
-            then = eventLoop.timeouts[i].expiresAt;
-    }
+    /* Deleted and disabled timers are never in the heap */
+    if (eventLoop.timeoutsHeapCount)
+        then = eventLoop.timeouts[eventLoop.timeoutsHeap[0]].expiresAt;
 
     /* Calculate how long we should wait for a timeout if needed */
     if (then > 0) {
         unsigned long long now;
 
-        if (virTimeMillisNow(&now) < 0)
+        if (virTimeMillisMonotonic(&now) < 0)
             return -1;
 
+        /* Sleeping up to the slack longer lets timers which expire
+         * shortly after this one be dispatched in the same wakeup */
+        then += eventLoop.timerSlack;
+
         EVENT_DEBUG("Schedule timeout then=%llu now=%llu", then, now);
         *timeout = then - now;
         if (*timeout < 0)
@@ -363,6 +752,7 @@ static int virEventPollCalculateTimeout(int *timeout) {
     return 0;
 }
 
+#if !WITH_EPOLL
 /*
  * Allocate a pollfd array containing data for all registered
  * file handles. The caller must free the returned data struct
@@ -402,14 +792,14 @@ static struct pollfd *virEventPollMakePollFDs(int *nfds) {
 
     return fds;
 }
+#endif /* !WITH_EPOLL */
 
 
 /*
- * Iterate over all timers and determine if any have expired.
- * Invoke the user supplied callback for each timer whose
- * expiry time is met, and schedule the next timeout. Does
- * not try to 'catch up' on time if the actual expiry time
- * was later than the requested time.
+ * Determine which timers have expired and invoke the user
+ * supplied callback for each of them, scheduling the next
+ * timeout. Does not try to 'catch up' on time if the actual
+ * expiry time was later than the requested time.
  *
  * This method must cope with new timers being registered
  * by a callback, and must skip any timers marked as deleted.
@@ -419,41 +809,154 @@ static struct pollfd *virEventPollMakePollFDs(int *nfds) {
 static int virEventPollDispatchTimeouts(void)
 {
     unsigned long long now;
-    int i;
-    /* Save this now - it may be changed during dispatch */
-    int ntimeouts = eventLoop.timeoutsCount;
-    VIR_DEBUG("Dispatch %d", ntimeouts);
+    size_t i;
+    size_t nexpired = 0;
 
-    if (virTimeMillisNow(&now) < 0)
+    if (virTimeMillisMonotonic(&now) < 0)
         return -1;
 
-    for (i = 0 ; i < ntimeouts ; i++) {
-        if (eventLoop.timeouts[i].deleted || eventLoop.timeouts[i].frequency < 0)
+    /* Take every expired timer off the heap before running any
+     * callbacks, so each fires at most once per iteration even
+     * if it is rescheduled to expire immediately.
+     *
+     * Add 20ms fuzz so we don't pointlessly spin doing
+     * <10ms sleeps, particularly on kernels with low HZ
+     * it is fine that a timer expires 20ms earlier than
+     * requested
+     */
+    while (eventLoop.timeoutsHeapCount) {
+        size_t idx = eventLoop.timeoutsHeap[0];
+        if (eventLoop.timeouts[idx].expiresAt > (now+20))
+            break;
+        eventLoop.timeoutsExpired[nexpired++] = eventLoop.timeouts[idx].timer;
+        virEventPollTimeoutHeapRemove(idx);
+    }
+    VIR_DEBUG("Dispatch %zu", nexpired);
+
+    for (i = 0 ; i < nexpired ; i++) {
+        ssize_t idx = virEventPollFindTimeout(eventLoop.timeoutsExpired[i]);
+        virEventTimeoutCallback cb;
+        int timer;
+        void *opaque;
+
+        if (idx < 0 ||
+            eventLoop.timeouts[idx].deleted ||
+            eventLoop.timeouts[idx].frequency < 0)
             continue;
 
-        /* Add 20ms fuzz so we don't pointlessly spin doing
-         * <10ms sleeps, particularly on kernels with low HZ
-         * it is fine that a timer expires 20ms earlier than
-         * requested
-         */
-        if (eventLoop.timeouts[i].expiresAt <= (now+20)) {
-            virEventTimeoutCallback cb = eventLoop.timeouts[i].cb;
-            int timer = eventLoop.timeouts[i].timer;
-            void *opaque = eventLoop.timeouts[i].opaque;
-            eventLoop.timeouts[i].expiresAt =
-                now + eventLoop.timeouts[i].frequency;
+        /* An earlier callback may have re-armed it */
+        if (eventLoop.timeouts[idx].heapIndex >= 0 &&
+            eventLoop.timeouts[idx].expiresAt > (now+20))
+            continue;
 
-            PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
-                  "timer=%d",
-                  timer);
-            virMutexUnlock(&eventLoop.lock);
-            (cb)(timer, opaque);
-            virMutexLock(&eventLoop.lock);
+        cb = eventLoop.timeouts[idx].cb;
+        timer = eventLoop.timeouts[idx].timer;
+        opaque = eventLoop.timeouts[idx].opaque;
+        eventLoop.timeouts[idx].expiresAt =
+            now + eventLoop.timeouts[idx].frequency;
+        virEventPollTimeoutHeapUpdate(idx);
+
+        if (eventLoop.timeouts[idx].source >= 0)
+            eventLoop.timerSources[eventLoop.timeouts[idx].source].dispatches++;
+
+        PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
+              "timer=%d",
+              timer);
+        virMutexUnlock(&eventLoop.lock);
+        (cb)(timer, opaque);
+        virMutexLock(&eventLoop.lock);
+    }
+    return 0;
+}
+
+
+#if WITH_EPOLL
+/* Invoke the callback of every handle on @fd interested in
+ * the native events @revents. Handles registered against
+ * @fd by a callback are not considered until the next
+ * iteration, matching the poll() implementation.
+ */
+static void virEventPollDispatchFD(int fd, int revents)
+{
+    size_t i, nwatches;
+
+    if (fd < 0 || fd >= eventLoop.fdsAlloc)
+        return;
+
+    nwatches = eventLoop.fds[fd].nwatches;
+    if (nwatches == 0 && !eventLoop.fds[fd].alwaysReady) {
+        /* Stale registration for an fd closed without removing
+         * its watch, which the kernel has not dropped */
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ignore_value(epoll_ctl(eventLoop.epollfd, EPOLL_CTL_DEL, fd, &ev));
+        eventLoop.fds[fd].events = 0;
+        return;
+    }
+
+    for (i = 0 ; i < nwatches && i < eventLoop.fds[fd].nwatches ; i++) {
+        ssize_t idx = virEventPollFindHandle(eventLoop.fds[fd].watches[i]);
+        virEventHandleCallback cb;
+        int watch;
+        void *opaque;
+        int hEvents;
+
+        if (idx < 0)
+            continue;
+
+        VIR_DEBUG("i=%zd w=%d", idx, eventLoop.handles[idx].watch);
+        if (eventLoop.handles[idx].deleted) {
+            EVENT_DEBUG("Skip deleted n=%zd w=%d f=%d", idx,
+                        eventLoop.handles[idx].watch, fd);
+            continue;
+        }
+        if (!eventLoop.handles[idx].events)
+            continue;
+
+        hEvents = revents & (eventLoop.handles[idx].events | POLLERR | POLLHUP);
+        if (!hEvents)
+            continue;
+
+        cb = eventLoop.handles[idx].cb;
+        watch = eventLoop.handles[idx].watch;
+        opaque = eventLoop.handles[idx].opaque;
+        hEvents = virEventPollFromNativeEvents(hEvents);
+        PROBE(EVENT_POLL_DISPATCH_HANDLE,
+              "watch=%d events=%d",
+              watch, hEvents);
+        virMutexUnlock(&eventLoop.lock);
+        (cb)(watch, fd, hEvents, opaque);
+        virMutexLock(&eventLoop.lock);
+    }
+}
+
+/* Dispatch the events reported by epoll_wait(), along with any
+ * file descriptors epoll could not monitor, which are always
+ * ready for whatever events were requested.
+ *
+ * Returns 0 upon success, -1 if an error occurred
+ */
+static int virEventPollDispatchHandles(int nevents,
+                                       struct epoll_event *events) {
+    int i;
+    VIR_DEBUG("Dispatch %d", nevents);
+
+    for (i = 0 ; i < nevents ; i++)
+        virEventPollDispatchFD(events[i].data.fd,
+                               virEventPollNativeFromEpoll(events[i].events));
+
+    if (eventLoop.fdsAlwaysReady) {
+        size_t nfds = eventLoop.fdsAlloc;
+        for (i = 0 ; i < nfds && i < eventLoop.fdsAlloc ; i++) {
+            if (eventLoop.fds[i].alwaysReady && eventLoop.fds[i].events)
+                virEventPollDispatchFD(i, POLLIN | POLLOUT);
         }
     }
+
     return 0;
 }
 
+#else /* !WITH_EPOLL */
 
 /* Iterate over all file handles and dispatch any which
  * have pending events listed in the poll() data. Invoke
@@ -504,6 +1007,7 @@ static int virEventPollDispatchHandles(int nfds, struct pollfd *fds) {
 
     return 0;
 }
+#endif /* !WITH_EPOLL */
 
 
 /* Used post dispatch to actually remove any timers that
@@ -513,6 +1017,10 @@ static int virEventPollDispatchHandles(int nfds, struct pollfd *fds) {
 static void virEventPollCleanupTimeouts(void) {
     int i;
     size_t gap;
+
+    if (!eventLoop.timeoutsDeleted)
+        return;
+
     VIR_DEBUG("Cleanup %zu", eventLoop.timeoutsCount);
 
     /* Remove deleted entries, shuffling down remaining
@@ -543,6 +1051,15 @@ static void virEventPollCleanupTimeouts(void) {
         }
         eventLoop.timeoutsCount--;
     }
+    eventLoop.timeoutsDeleted = 0;
+
+    /* Shuffling invalidated the indexes held in the heap */
+    eventLoop.timeoutsHeapCount = 0;
+    for (i = 0 ; i < eventLoop.timeoutsCount ; i++) {
+        eventLoop.timeouts[i].heapIndex = -1;
+        if (eventLoop.timeouts[i].frequency >= 0)
+            virEventPollTimeoutHeapInsert(i);
+    }
 
     /* Release some memory if we've got a big chunk free */
     gap = eventLoop.timeoutsAlloc - eventLoop.timeoutsCount;
@@ -561,6 +1078,10 @@ static void virEventPollCleanupTimeouts(void) {
 static void virEventPollCleanupHandles(void) {
     int i;
     size_t gap;
+
+    if (!eventLoop.handlesDeleted)
+        return;
+
     VIR_DEBUG("Cleanup %zu", eventLoop.handlesCount);
 
     /* Remove deleted entries, shuffling down remaining
@@ -575,6 +1096,10 @@ static void virEventPollCleanupHandles(void) {
         PROBE(EVENT_POLL_PURGE_HANDLE,
               "watch=%d",
               eventLoop.handles[i].watch);
+#if WITH_EPOLL
+        virEventPollReleaseFD(eventLoop.handles[i].fd,
+                              eventLoop.handles[i].watch);
+#endif
         if (eventLoop.handles[i].ff) {
             virFreeCallback ff = eventLoop.handles[i].ff;
             void *opaque = eventLoop.handles[i].opaque;
@@ -591,6 +1116,7 @@ static void virEventPollCleanupHandles(void) {
         }
         eventLoop.handlesCount--;
     }
+    eventLoop.handlesDeleted = 0;
 
     /* Release some memory if we've got a big chunk free */
     gap = eventLoop.handlesAlloc - eventLoop.handlesCount;
@@ -607,8 +1133,13 @@ static void virEventPollCleanupHandles(void) {
  * at least one file handle has an event, or a timer expires
  */
 int virEventPollRunOnce(void) {
+#if WITH_EPOLL
+    struct epoll_event *fds;
+#else
     struct pollfd *fds = NULL;
+#endif
     int ret, timeout, nfds;
+    bool timedOut;
 
     virMutexLock(&eventLoop.lock);
     eventLoop.running = 1;
@@ -617,9 +1148,28 @@ int virEventPollRunOnce(void) {
     virEventPollCleanupTimeouts();
     virEventPollCleanupHandles();
 
+#if WITH_EPOLL
+    /* Registration is persistent, so all we need is space to
+     * receive one event per watched file descriptor */
+    nfds = eventLoop.handlesCount ? eventLoop.handlesCount : 1;
+    if (nfds > eventLoop.epollEventsAlloc) {
+        if (VIR_REALLOC_N(eventLoop.epollEvents, nfds) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+        eventLoop.epollEventsAlloc = nfds;
+    }
+    fds = eventLoop.epollEvents;
+
+    if (virEventPollCalculateTimeout(&timeout) < 0)
+        goto error;
+    if (eventLoop.fdsAlwaysReady)
+        timeout = 0;
+#else
     if (!(fds = virEventPollMakePollFDs(&nfds)) ||
         virEventPollCalculateTimeout(&timeout) < 0)
         goto error;
+#endif
 
     virMutexUnlock(&eventLoop.lock);
 
@@ -627,7 +1177,11 @@ int virEventPollRunOnce(void) {
     PROBE(EVENT_POLL_RUN,
           "nhandles=%d timeout=%d",
           nfds, timeout);
+#if WITH_EPOLL
+    ret = epoll_wait(eventLoop.epollfd, fds, nfds, timeout);
+#else
     ret = poll(fds, nfds, timeout);
+#endif
     if (ret < 0) {
         EVENT_DEBUG("Poll got error event %d", errno);
         if (errno == EINTR || errno == EAGAIN) {
@@ -640,25 +1194,48 @@ int virEventPollRunOnce(void) {
     EVENT_DEBUG("Poll got %d event(s)", ret);
 
     virMutexLock(&eventLoop.lock);
+
+    /* Account the wakeup to the timer it was waiting for, if that
+     * is what ended the wait */
+    timedOut = ret == 0 && timeout > 0;
+    eventLoop.iterations++;
+    if (timedOut && eventLoop.timeoutsHeapCount) {
+        ssize_t source = eventLoop.timeouts[eventLoop.timeoutsHeap[0]].source;
+
+        eventLoop.timerWakeups++;
+        if (source >= 0)
+            eventLoop.timerSources[source].wakeups++;
+    }
+
     if (virEventPollDispatchTimeouts() < 0)
         goto error;
 
+#if WITH_EPOLL
+    if ((ret > 0 || eventLoop.fdsAlwaysReady) &&
+        virEventPollDispatchHandles(ret, fds) < 0)
+        goto error;
+#else
     if (ret > 0 &&
         virEventPollDispatchHandles(nfds, fds) < 0)
         goto error;
+#endif
 
     virEventPollCleanupTimeouts();
     virEventPollCleanupHandles();
 
     eventLoop.running = 0;
     virMutexUnlock(&eventLoop.lock);
+#if !WITH_EPOLL
     VIR_FREE(fds);
+#endif
     return 0;
 
 error:
     virMutexUnlock(&eventLoop.lock);
 error_unlocked:
+#if !WITH_EPOLL
     VIR_FREE(fds);
+#endif
     return -1;
 }
 
@@ -682,6 +1259,14 @@ int virEventPollInit(void)
         return -1;
     }
 
+#if WITH_EPOLL
+    if ((eventLoop.epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create epoll instance"));
+        return -1;
+    }
+#endif
+
     if (pipe2(eventLoop.wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to setup wakeup pipe"));
@@ -719,6 +1304,80 @@ static int virEventPollInterruptLocked(void)
     return 0;
 }
 
+/**
+ * virEventPollSetTimerSlack:
+ * @slack: milliseconds
+ *
+ * Allow the event loop to oversleep timers by up to @slack
+ * milliseconds, so that timers expiring close to each other are
+ * dispatched from a single wakeup rather than one each.
+ */
+void virEventPollSetTimerSlack(int slack)
+{
+    virMutexLock(&eventLoop.lock);
+    eventLoop.timerSlack = slack > 0 ? slack : 0;
+    virEventPollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+}
+
+/**
+ * virEventPollFormatStats:
+ * @buf: buffer to append to
+ *
+ * Format the number of event loop iterations, how many of them
+ * were ended by a timer expiring, and the wakeups and callback runs
+ * of each timer source, in the Prometheus text exposition format.
+ * Timer sources are identified by the address of their callback.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int virEventPollFormatStats(virBufferPtr buf)
+{
+    size_t i;
+
+    virMutexLock(&eventLoop.lock);
+
+    virBufferAddLit(buf,
+                    "# HELP libvirt_event_loop_iterations_total Event loop iterations.\n"
+                    "# TYPE libvirt_event_loop_iterations_total counter\n");
+    virBufferAsprintf(buf, "libvirt_event_loop_iterations_total %llu\n",
+                      eventLoop.iterations);
+    virBufferAddLit(buf,
+                    "# HELP libvirt_event_loop_timer_wakeups_total Event loop "
+                    "iterations started by a timer expiring.\n"
+                    "# TYPE libvirt_event_loop_timer_wakeups_total counter\n");
+    virBufferAsprintf(buf, "libvirt_event_loop_timer_wakeups_total %llu\n",
+                      eventLoop.timerWakeups);
+
+    virBufferAddLit(buf,
+                    "# HELP libvirt_event_timer_wakeups_total Event loop "
+                    "wakeups caused by a timer source.\n"
+                    "# TYPE libvirt_event_timer_wakeups_total counter\n");
+    for (i = 0 ; i < eventLoop.ntimerSources ; i++)
+        virBufferAsprintf(buf,
+                          "libvirt_event_timer_wakeups_total{callback=\"%p\"} %llu\n",
+                          (void *)eventLoop.timerSources[i].cb,
+                          eventLoop.timerSources[i].wakeups);
+
+    virBufferAddLit(buf,
+                    "# HELP libvirt_event_timer_dispatches_total Callback "
+                    "runs of a timer source.\n"
+                    "# TYPE libvirt_event_timer_dispatches_total counter\n");
+    for (i = 0 ; i < eventLoop.ntimerSources ; i++)
+        virBufferAsprintf(buf,
+                          "libvirt_event_timer_dispatches_total{callback=\"%p\"} %llu\n",
+                          (void *)eventLoop.timerSources[i].cb,
+                          eventLoop.timerSources[i].dispatches);
+
+    virMutexUnlock(&eventLoop.lock);
+
+    if (virBufferError(buf)) {
+        virReportOOMError();
+        return -1;
+    }
+    return 0;
+}
+
 int virEventPollInterrupt(void)
 {
     int ret;
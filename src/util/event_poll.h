@@ -25,6 +25,7 @@
 # define __VIR_EVENT_POLL_H__
 
 # include "internal.h"
+# include "buf.h"
 
 /**
  * virEventPollAddHandle: register a callback for monitoring file handle events
@@ -120,6 +121,20 @@ int virEventPollRunOnce(void);
 int virEventPollFromNativeEvents(int events);
 int virEventPollToNativeEvents(int events);
 
+/**
+ * virEventPollSetTimerSlack: let timers be dispatched up to @slack
+ * milliseconds late, so that close ones share a wakeup
+ */
+void virEventPollSetTimerSlack(int slack);
+
+/**
+ * virEventPollFormatStats: append the wakeup and dispatch counters
+ * of the event loop and its timers to @buf
+ *
+ * returns -1 on failure
+ */
+int virEventPollFormatStats(virBufferPtr buf);
+
 
 /**
  * virEventPollInterrupt: wakeup any thread waiting in poll()
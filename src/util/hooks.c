@@ -38,6 +38,10 @@
 #include "virfile.h"
 #include "configmake.h"
 #include "command.h"
+#include "threadpool.h"
+#include "threads.h"
+#include "virhash.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_HOOK
 
@@ -85,6 +89,69 @@ VIR_ENUM_IMPL(virHookLxcOp, VIR_HOOK_LXC_OP_LAST,
 
 static int virHooksFound = -1;
 
+/*
+ * Hooks for events which cannot stop the operation can be run from a
+ * pool of workers, so a slow script does not hold up its caller. The
+ * hooks queued for one object still run one after the other, in the
+ * order they were queued, and a synchronous hook for that object
+ * waits for them to complete first.
+ */
+typedef struct _virHookJob virHookJob;
+typedef virHookJob *virHookJobPtr;
+struct _virHookJob {
+    int driver;
+    char *id;
+    int op;
+    int sub_op;
+    char *extra;
+    char *input;
+
+    virHookJobPtr next;
+};
+
+/* Jobs waiting behind the one being run for an object */
+typedef struct _virHookQueue virHookQueue;
+typedef virHookQueue *virHookQueuePtr;
+struct _virHookQueue {
+    virHookJobPtr head;
+    virHookJobPtr tail;
+};
+
+typedef struct _virHookStats virHookStats;
+typedef virHookStats *virHookStatsPtr;
+struct _virHookStats {
+    unsigned long long calls;
+    unsigned long long failures;
+    unsigned long long timeouts;
+    unsigned long long msecTotal;
+    unsigned long long msecMax;
+};
+
+#define VIR_HOOK_STATS_OPS 16
+verify(VIR_HOOK_DAEMON_OP_LAST <= VIR_HOOK_STATS_OPS);
+verify(VIR_HOOK_QEMU_OP_LAST <= VIR_HOOK_STATS_OPS);
+verify(VIR_HOOK_LXC_OP_LAST <= VIR_HOOK_STATS_OPS);
+
+static virMutex virHookLock;
+static virCond virHookCond;
+static virThreadPoolPtr virHookPool;
+static virHashTablePtr virHookPending; /* id -> virHookQueuePtr */
+static unsigned int virHookTimeout;
+static virHookStats virHookStatsTable[VIR_HOOK_DRIVER_LAST][VIR_HOOK_STATS_OPS];
+
+static int virHookStateOnceInit(void)
+{
+    if (virMutexInit(&virHookLock) < 0 ||
+        virCondInit(&virHookCond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize hook state"));
+        return -1;
+    }
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virHookState)
+
 /**
  * virHookCheck:
  * @driver: the driver name "daemon", "qemu", "lxc"...
@@ -177,33 +244,63 @@ virHookPresent(int driver) {
     return 1;
 }
 
-/**
- * virHookCall:
- * @driver: the driver number (from virHookDriver enum)
- * @id: an id for the object '-' if non available for example on daemon hooks
- * @op: the operation on the id e.g. VIR_HOOK_QEMU_OP_START
- * @sub_op: a sub_operation, currently unused
- * @extra: optional string information
- * @input: extra input given to the script on stdin
- * @output: optional address of variable to store malloced result buffer
- *
- * Implement a hook call, where the external script for the driver is
- * called with the given information. This is a synchronous call, we wait for
- * execution completion. If @output is non-NULL, *output is guaranteed to be
- * allocated after successful virHookCall, and is best-effort allocated after
- * failed virHookCall; the caller is responsible for freeing *output.
- *
- * Returns: 0 if the execution succeeded, 1 if the script was not found or
- *          invalid parameters, and -1 if script returned an error
- */
-int
-virHookCall(int driver,
-            const char *id,
-            int op,
-            int sub_op,
-            const char *extra,
-            const char *input,
-            char **output)
+static const char *
+virHookOpTypeToString(int driver, int op)
+{
+    switch (driver) {
+        case VIR_HOOK_DRIVER_DAEMON:
+            return virHookDaemonOpTypeToString(op);
+        case VIR_HOOK_DRIVER_QEMU:
+            return virHookQemuOpTypeToString(op);
+        case VIR_HOOK_DRIVER_LXC:
+            return virHookLxcOpTypeToString(op);
+    }
+    return NULL;
+}
+
+#ifndef WIN32
+/* Run in the child: the alarm survives exec and, unless the script
+ * handles SIGALRM itself, kills it once the timeout expires */
+static int
+virHookSetAlarm(void *opaque)
+{
+    unsigned int *timeout = opaque;
+
+    alarm(*timeout);
+    return 0;
+}
+#endif
+
+static void
+virHookRecordStats(int driver, int op, unsigned long long msec,
+                   int ret, bool timedout)
+{
+    virHookStatsPtr stats;
+
+    if (op < 0 || op >= VIR_HOOK_STATS_OPS)
+        return;
+    stats = &virHookStatsTable[driver][op];
+
+    virMutexLock(&virHookLock);
+    stats->calls++;
+    if (ret < 0)
+        stats->failures++;
+    if (timedout)
+        stats->timeouts++;
+    stats->msecTotal += msec;
+    if (msec > stats->msecMax)
+        stats->msecMax = msec;
+    virMutexUnlock(&virHookLock);
+}
+
+static int
+virHookRun(int driver,
+           const char *id,
+           int op,
+           int sub_op,
+           const char *extra,
+           const char *input,
+           char **output)
 {
     int ret;
     char *path;
@@ -211,41 +308,12 @@ virHookCall(int driver,
     const char *drvstr;
     const char *opstr;
     const char *subopstr;
-
-    if (output)
-        *output = NULL;
-
-    if ((driver < VIR_HOOK_DRIVER_DAEMON) ||
-        (driver >= VIR_HOOK_DRIVER_LAST))
-        return 1;
-
-    /*
-     * We cache the availability of the script to minimize impact at
-     * runtime if no script is defined, this is being reset on SIGHUP
-     */
-    if ((virHooksFound == -1) ||
-        ((driver == VIR_HOOK_DRIVER_DAEMON) &&
-         (op == VIR_HOOK_DAEMON_OP_RELOAD ||
-         op == VIR_HOOK_DAEMON_OP_SHUTDOWN)))
-        virHookInitialize();
-
-    if ((virHooksFound & (1 << driver)) == 0)
-        return 1;
+    unsigned long long start = 0, end = 0;
+    bool timedout = false;
 
     drvstr = virHookDriverTypeToString(driver);
 
-    opstr = NULL;
-    switch (driver) {
-        case VIR_HOOK_DRIVER_DAEMON:
-            opstr = virHookDaemonOpTypeToString(op);
-            break;
-        case VIR_HOOK_DRIVER_QEMU:
-            opstr = virHookQemuOpTypeToString(op);
-            break;
-        case VIR_HOOK_DRIVER_LXC:
-            opstr = virHookLxcOpTypeToString(op);
-            break;
-    }
+    opstr = virHookOpTypeToString(driver, op);
     if (opstr == NULL) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Hook for %s, failed to find operation #%d"),
@@ -277,17 +345,384 @@ virHookCall(int driver,
         virCommandSetInputBuffer(cmd, input);
     if (output)
         virCommandSetOutputBuffer(cmd, output);
+#ifndef WIN32
+    if (virHookTimeout)
+        virCommandSetPreExecHook(cmd, virHookSetAlarm, &virHookTimeout);
+#endif
 
+    ignore_value(virTimeMillisNow(&start));
     ret = virCommandRun(cmd, NULL);
+    ignore_value(virTimeMillisNow(&end));
+    if (end < start)
+        end = start;
+
     if (ret < 0) {
         /* Convert INTERNAL_ERROR into known error.  */
         virErrorPtr err = virGetLastError();
-        virReportError(VIR_ERR_HOOK_SCRIPT_FAILED, "%s", err->message);
+
+        if (virHookTimeout &&
+            end - start >= virHookTimeout * 1000ULL) {
+            timedout = true;
+            virReportError(VIR_ERR_HOOK_SCRIPT_FAILED,
+                           _("Hook script %s %s timed out after %u seconds"),
+                           path, opstr, virHookTimeout);
+        } else {
+            virReportError(VIR_ERR_HOOK_SCRIPT_FAILED, "%s", err->message);
+        }
     }
 
+    VIR_DEBUG("Hook %s %s %s took %llu ms", drvstr, id, opstr, end - start);
+    virHookRecordStats(driver, op, end - start, ret, timedout);
+
     virCommandFree(cmd);
 
     VIR_FREE(path);
 
     return ret;
 }
+
+/*
+ * Check that a hook is to be run for @driver, and rescan the hook
+ * directory where needed. Returns true if it should be run.
+ */
+static bool
+virHookEnabled(int driver, int op)
+{
+    if ((driver < VIR_HOOK_DRIVER_DAEMON) ||
+        (driver >= VIR_HOOK_DRIVER_LAST))
+        return false;
+
+    /*
+     * We cache the availability of the script to minimize impact at
+     * runtime if no script is defined, this is being reset on SIGHUP
+     */
+    if ((virHooksFound == -1) ||
+        ((driver == VIR_HOOK_DRIVER_DAEMON) &&
+         (op == VIR_HOOK_DAEMON_OP_RELOAD ||
+         op == VIR_HOOK_DAEMON_OP_SHUTDOWN)))
+        virHookInitialize();
+
+    if ((virHooksFound & (1 << driver)) == 0)
+        return false;
+
+    return true;
+}
+
+/**
+ * virHookCall:
+ * @driver: the driver number (from virHookDriver enum)
+ * @id: an id for the object '-' if non available for example on daemon hooks
+ * @op: the operation on the id e.g. VIR_HOOK_QEMU_OP_START
+ * @sub_op: a sub_operation, currently unused
+ * @extra: optional string information
+ * @input: extra input given to the script on stdin
+ * @output: optional address of variable to store malloced result buffer
+ *
+ * Implement a hook call, where the external script for the driver is
+ * called with the given information. This is a synchronous call, we wait for
+ * execution completion, and for that of any hook queued for @id with
+ * virHookCallAsync. If @output is non-NULL, *output is guaranteed to be
+ * allocated after successful virHookCall, and is best-effort allocated after
+ * failed virHookCall; the caller is responsible for freeing *output.
+ *
+ * Returns: 0 if the execution succeeded, 1 if the script was not found or
+ *          invalid parameters, and -1 if script returned an error
+ */
+int
+virHookCall(int driver,
+            const char *id,
+            int op,
+            int sub_op,
+            const char *extra,
+            const char *input,
+            char **output)
+{
+    if (output)
+        *output = NULL;
+
+    if (!virHookEnabled(driver, op))
+        return 1;
+
+    if (virHookStateInitialize() < 0)
+        return -1;
+
+    if (virHookPool && id) {
+        virMutexLock(&virHookLock);
+        while (virHashLookup(virHookPending, id)) {
+            if (virCondWait(&virHookCond, &virHookLock) < 0) {
+                virMutexUnlock(&virHookLock);
+                virReportSystemError(errno, "%s",
+                                     _("Unable to wait for queued hooks"));
+                return -1;
+            }
+        }
+        virMutexUnlock(&virHookLock);
+    }
+
+    return virHookRun(driver, id, op, sub_op, extra, input, output);
+}
+
+static void
+virHookJobFree(virHookJobPtr job)
+{
+    if (!job)
+        return;
+    VIR_FREE(job->id);
+    VIR_FREE(job->extra);
+    VIR_FREE(job->input);
+    VIR_FREE(job);
+}
+
+static void
+virHookQueueFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virHookQueuePtr queue = payload;
+
+    while (queue->head) {
+        virHookJobPtr job = queue->head;
+        queue->head = job->next;
+        virHookJobFree(job);
+    }
+    VIR_FREE(queue);
+}
+
+static void
+virHookWorker(void *jobdata, void *opaque ATTRIBUTE_UNUSED)
+{
+    virHookJobPtr job = jobdata;
+
+    while (job) {
+        virHookQueuePtr queue;
+        virHookJobPtr next;
+
+        if (virHookRun(job->driver, job->id, job->op, job->sub_op,
+                       job->extra, job->input, NULL) < 0) {
+            virErrorPtr err = virGetLastError();
+            VIR_WARN("Hook %s for %s failed: %s",
+                     virHookOpTypeToString(job->driver, job->op), job->id,
+                     err && err->message ? err->message : "unknown error");
+        }
+        virResetLastError();
+
+        virMutexLock(&virHookLock);
+        queue = virHashLookup(virHookPending, job->id);
+        if ((next = queue->head)) {
+            queue->head = next->next;
+            if (!queue->head)
+                queue->tail = NULL;
+        } else {
+            virHashRemoveEntry(virHookPending, job->id);
+            virCondBroadcast(&virHookCond);
+        }
+        virMutexUnlock(&virHookLock);
+
+        virHookJobFree(job);
+        job = next;
+    }
+}
+
+/**
+ * virHookCallAsync:
+ * @driver: the driver number (from virHookDriver enum)
+ * @id: an id for the object
+ * @op: the operation on the id e.g. VIR_HOOK_QEMU_OP_STOPPED
+ * @sub_op: a sub_operation, currently unused
+ * @extra: optional string information
+ * @input: extra input given to the script on stdin
+ *
+ * Queue a hook call whose result does not matter to the caller. It
+ * is run by one of the hook workers if they were enabled with
+ * virHookSetup, after any other hook queued for @id, and
+ * synchronously otherwise. Failures of queued hooks are only logged.
+ *
+ * Returns: 0 if the hook was queued or run successfully, 1 if the
+ *          script was not found or invalid parameters, and -1 on error
+ */
+int
+virHookCallAsync(int driver,
+                 const char *id,
+                 int op,
+                 int sub_op,
+                 const char *extra,
+                 const char *input)
+{
+    virHookJobPtr job = NULL;
+    virHookQueuePtr queue = NULL;
+
+    if (!virHookPool)
+        return virHookCall(driver, id, op, sub_op, extra, input, NULL);
+
+    if (!virHookEnabled(driver, op))
+        return 1;
+
+    if (VIR_ALLOC(job) < 0 ||
+        !(job->id = strdup(id)) ||
+        (extra && !(job->extra = strdup(extra))) ||
+        (input && !(job->input = strdup(input)))) {
+        virReportOOMError();
+        virHookJobFree(job);
+        return -1;
+    }
+    job->driver = driver;
+    job->op = op;
+    job->sub_op = sub_op;
+
+    virMutexLock(&virHookLock);
+    if ((queue = virHashLookup(virHookPending, id))) {
+        if (queue->tail)
+            queue->tail->next = job;
+        else
+            queue->head = job;
+        queue->tail = job;
+        virMutexUnlock(&virHookLock);
+        return 0;
+    }
+
+    if (VIR_ALLOC(queue) < 0) {
+        virMutexUnlock(&virHookLock);
+        virReportOOMError();
+        virHookJobFree(job);
+        return -1;
+    }
+    if (virHashAddEntry(virHookPending, id, queue) < 0) {
+        virMutexUnlock(&virHookLock);
+        VIR_FREE(queue);
+        virHookJobFree(job);
+        return -1;
+    }
+    if (virThreadPoolSendJob(virHookPool, 0, job) < 0) {
+        virHashRemoveEntry(virHookPending, id);
+        virCondBroadcast(&virHookCond);
+        virMutexUnlock(&virHookLock);
+        virHookJobFree(job);
+        return -1;
+    }
+    virMutexUnlock(&virHookLock);
+
+    return 0;
+}
+
+/**
+ * virHookSetup:
+ * @workers: maximum number of threads running queued hooks, or 0
+ * @timeout: seconds after which a hook script is killed, or 0
+ *
+ * Configure how hooks are run. With @workers set to 0, hooks queued
+ * with virHookCallAsync are run synchronously. The number of workers
+ * can only be set once.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+virHookSetup(unsigned int workers, unsigned int timeout)
+{
+    if (virHookStateInitialize() < 0)
+        return -1;
+
+    virHookTimeout = timeout;
+
+    if (workers == 0 || virHookPool)
+        return 0;
+
+    if (!(virHookPending = virHashCreate(32, virHookQueueFree)))
+        return -1;
+
+    if (!(virHookPool = virThreadPoolNew(0, workers, 0,
+                                         virHookWorker, NULL))) {
+        virHashFree(virHookPending);
+        virHookPending = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * virHookFormatStats:
+ * @buf: buffer to append to
+ *
+ * Format the number of runs, failures and timeouts and the time spent
+ * for each hook operation which ran at least once, in the Prometheus
+ * text exposition format.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+virHookFormatStats(virBufferPtr buf)
+{
+    static const char *const headers[] = {
+        "# HELP libvirt_hook_calls_total Hook script runs.\n"
+        "# TYPE libvirt_hook_calls_total counter\n",
+        "# HELP libvirt_hook_failures_total Hook script runs which failed.\n"
+        "# TYPE libvirt_hook_failures_total counter\n",
+        "# HELP libvirt_hook_timeouts_total Hook script runs which timed out.\n"
+        "# TYPE libvirt_hook_timeouts_total counter\n",
+        "# HELP libvirt_hook_seconds_total Time spent running hook scripts.\n"
+        "# TYPE libvirt_hook_seconds_total counter\n",
+        "# HELP libvirt_hook_seconds_max Longest hook script run.\n"
+        "# TYPE libvirt_hook_seconds_max gauge\n",
+    };
+    virHookStats stats[VIR_HOOK_DRIVER_LAST][VIR_HOOK_STATS_OPS];
+    size_t metric;
+    int driver, op;
+
+    if (virHookStateInitialize() < 0)
+        return -1;
+
+    virMutexLock(&virHookLock);
+    memcpy(stats, virHookStatsTable, sizeof(stats));
+    virMutexUnlock(&virHookLock);
+
+    /* All samples of one metric have to be grouped together */
+    for (metric = 0; metric < ARRAY_CARDINALITY(headers); metric++) {
+        virBufferAdd(buf, headers[metric], -1);
+
+        for (driver = 0; driver < VIR_HOOK_DRIVER_LAST; driver++) {
+            for (op = 0; op < VIR_HOOK_STATS_OPS; op++) {
+                virHookStatsPtr st = &stats[driver][op];
+                const char *drvstr = virHookDriverTypeToString(driver);
+                const char *opstr = virHookOpTypeToString(driver, op);
+
+                if (!st->calls || !opstr)
+                    continue;
+
+                switch (metric) {
+                case 0:
+                    virBufferAsprintf(buf, "libvirt_hook_calls_total"
+                                      "{driver=\"%s\",operation=\"%s\"} %llu\n",
+                                      drvstr, opstr, st->calls);
+                    break;
+                case 1:
+                    virBufferAsprintf(buf, "libvirt_hook_failures_total"
+                                      "{driver=\"%s\",operation=\"%s\"} %llu\n",
+                                      drvstr, opstr, st->failures);
+                    break;
+                case 2:
+                    virBufferAsprintf(buf, "libvirt_hook_timeouts_total"
+                                      "{driver=\"%s\",operation=\"%s\"} %llu\n",
+                                      drvstr, opstr, st->timeouts);
+                    break;
+                case 3:
+                    virBufferAsprintf(buf, "libvirt_hook_seconds_total"
+                                      "{driver=\"%s\",operation=\"%s\"} %llu.%03llu\n",
+                                      drvstr, opstr, st->msecTotal / 1000,
+                                      st->msecTotal % 1000);
+                    break;
+                case 4:
+                    virBufferAsprintf(buf, "libvirt_hook_seconds_max"
+                                      "{driver=\"%s\",operation=\"%s\"} %llu.%03llu\n",
+                                      drvstr, opstr, st->msecMax / 1000,
+                                      st->msecMax % 1000);
+                    break;
+                }
+            }
+        }
+    }
+
+    if (virBufferError(buf)) {
+        virReportOOMError();
+        return -1;
+    }
+
+    return 0;
+}
@@ -26,6 +26,7 @@
 
 # include "internal.h"
 # include "util.h"
+# include "buf.h"
 
 enum virHookDriverType {
     VIR_HOOK_DRIVER_DAEMON = 0,        /* Daemon related events */
@@ -82,4 +83,13 @@ int virHookPresent(int driver);
 int virHookCall(int driver, const char *id, int op, int sub_op,
                 const char *extra, const char *input, char **output);
 
+int virHookCallAsync(int driver, const char *id, int op, int sub_op,
+                     const char *extra, const char *input)
+    ATTRIBUTE_NONNULL(2);
+
+int virHookSetup(unsigned int workers, unsigned int timeout);
+
+int virHookFormatStats(virBufferPtr buf)
+    ATTRIBUTE_NONNULL(1);
+
 #endif /* __VIR_HOOKS_H__ */
@@ -23,6 +23,7 @@
  *   - Read existing file
  *   - Write existing file
  *   - Create & write new file
+ *   - Compress & decompress stdin to stdout in parallel
  */
 
 #include <config.h>
@@ -32,6 +33,8 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "util.h"
 #include "threads.h"
@@ -40,6 +43,11 @@
 #include "virterror_internal.h"
 #include "configmake.h"
 #include "virrandom.h"
+#include "virtime.h"
+
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -72,35 +80,292 @@ cleanup:
     return fd;
 }
 
+/* The copy loop keeps several buffers in flight: a reader thread fills
+ * them while the main thread writes them out, so that waiting for the
+ * disk on the O_DIRECT side does not stall the pipe side and the other
+ * way round. */
+#define IO_BUFFERS 4
+#define IO_BUFFER_SIZE (1024 * 1024)
+#define IO_ALIGN (64 * 1024)
+
+/* Largest request passed to one splice() call */
+#define IO_SPLICE_MAX (16 * 1024 * 1024)
+
+typedef struct _ioBuffer ioBuffer;
+struct _ioBuffer {
+    char *data;     /* aligned to IO_ALIGN */
+    size_t len;
+    bool full;      /* filled by the reader, waiting to be written */
+};
+
+typedef struct _ioRing ioRing;
+struct _ioRing {
+    virMutex lock;
+    virCond cond;
+
+    int fdin;
+    unsigned long long length; /* bytes to read, 0 for all */
+    unsigned long long nread;
+
+    /* buffer number N lives in slot N % IO_BUFFERS */
+    ioBuffer bufs[IO_BUFFERS];
+    unsigned long long nfilled;
+    unsigned long long nwritten;
+
+    bool eof;
+    bool quit;
+    int errnum;     /* set if the reader failed */
+};
+
+static void
+ringReader(void *opaque)
+{
+    ioRing *ring = opaque;
+
+    while (1) {
+        ioBuffer *buf;
+        size_t want = IO_BUFFER_SIZE;
+        ssize_t got = 0;
+
+        virMutexLock(&ring->lock);
+        buf = &ring->bufs[ring->nfilled % IO_BUFFERS];
+        while (!ring->quit && buf->full)
+            ignore_value(virCondWait(&ring->cond, &ring->lock));
+        virMutexUnlock(&ring->lock);
+
+        if (ring->quit)
+            return;
+
+        if (ring->length && ring->length - ring->nread < want)
+            want = ring->length - ring->nread;
+        if (want)
+            got = saferead(ring->fdin, buf->data, want);
+
+        virMutexLock(&ring->lock);
+        if (got < 0) {
+            ring->errnum = errno;
+        } else if (got == 0) {
+            ring->eof = true;
+        } else {
+            buf->len = got;
+            buf->full = true;
+            ring->nfilled++;
+            ring->nread += got;
+        }
+        virCondBroadcast(&ring->cond);
+        virMutexUnlock(&ring->lock);
+
+        if (got <= 0)
+            return;
+    }
+}
+
+#if HAVE_SPLICE
+/* Move the data between @fdin and @fdout inside the kernel, which is
+ * possible when at least one of them is a pipe.
+ *
+ * Returns 1 when done, 0 if splice() can't be used for these fds and
+ * nothing was moved yet, -1 on error */
+static int
+runSplice(int fdin, const char *fdinname,
+          int fdout, const char *fdoutname,
+          unsigned long long length,
+          unsigned long long *total)
+{
+    struct stat sbin, sbout;
+
+    if (fstat(fdin, &sbin) < 0 || fstat(fdout, &sbout) < 0 ||
+        (!S_ISFIFO(sbin.st_mode) && !S_ISFIFO(sbout.st_mode)))
+        return 0;
+
+    while (1) {
+        size_t want = IO_SPLICE_MAX;
+        ssize_t got;
+
+        if (length && length - *total < want)
+            want = length - *total;
+        if (want == 0)
+            break; /* End of requested data from client */
+
+        got = splice(fdin, NULL, fdout, NULL, want,
+                     SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            if (*total == 0 && (errno == EINVAL || errno == ENOSYS))
+                return 0;
+            virReportSystemError(errno, _("Unable to copy %s to %s"),
+                                 fdinname, fdoutname);
+            return -1;
+        }
+        if (got == 0)
+            break; /* End of file before end of requested data */
+
+        *total += got;
+    }
+
+    return 1;
+}
+#endif /* HAVE_SPLICE */
+
+static int
+runCopy(const char *path, int fd, bool direct,
+        int fdin, const char *fdinname,
+        int fdout, const char *fdoutname,
+        unsigned long long length,
+        unsigned long long *total)
+{
+    ioRing ring;
+    virThread reader;
+    bool haveReader = false;
+    bool shortRead = false; /* true if we hit a short read */
+    off_t end = 0;
+    size_t i;
+    int ret = -1;
+
+    memset(&ring, 0, sizeof(ring));
+    ring.fdin = fdin;
+    ring.length = length;
+
+    if (virMutexInit(&ring.lock) < 0 ||
+        virCondInit(&ring.cond) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize mutex"));
+        return -1;
+    }
+
+    for (i = 0; i < IO_BUFFERS; i++) {
+#if HAVE_POSIX_MEMALIGN
+        void *base;
+
+        if (posix_memalign(&base, IO_ALIGN, IO_BUFFER_SIZE)) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        ring.bufs[i].data = base;
+#else
+        /* Without posix_memalign O_DIRECT is not available either */
+        if (VIR_ALLOC_N(ring.bufs[i].data, IO_BUFFER_SIZE) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+#endif
+    }
+
+    if (virThreadCreate(&reader, true, ringReader, &ring) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to create thread"));
+        goto cleanup;
+    }
+    haveReader = true;
+
+    while (1) {
+        ioBuffer *buf;
+        ssize_t got;
+
+        virMutexLock(&ring.lock);
+        buf = &ring.bufs[ring.nwritten % IO_BUFFERS];
+        while (!ring.errnum && !buf->full && !ring.eof)
+            ignore_value(virCondWait(&ring.cond, &ring.lock));
+        virMutexUnlock(&ring.lock);
+
+        if (!buf->full) {
+            if (ring.errnum) {
+                virReportSystemError(ring.errnum, _("Unable to read %s"),
+                                     fdinname);
+                goto cleanup;
+            }
+            break; /* End of data */
+        }
+
+        got = buf->len;
+        if (got < IO_BUFFER_SIZE) {
+            /* O_DIRECT can handle at most one short read, at end of file */
+            if (direct && shortRead) {
+                virReportSystemError(EINVAL, "%s",
+                                     _("Too many short reads for O_DIRECT"));
+                goto cleanup;
+            }
+            shortRead = true;
+        }
+
+        *total += got;
+        if (fdout == fd && direct && shortRead) {
+            end = *total;
+            memset(buf->data + got, 0, IO_BUFFER_SIZE - got);
+            got = (got + IO_ALIGN - 1) & ~(IO_ALIGN - 1);
+        }
+        if (safewrite(fdout, buf->data, got) < 0) {
+            virReportSystemError(errno, _("Unable to write %s"), fdoutname);
+            goto cleanup;
+        }
+        if (end && ftruncate(fd, end) < 0) {
+            virReportSystemError(errno, _("Unable to truncate %s"), path);
+            goto cleanup;
+        }
+
+        virMutexLock(&ring.lock);
+        buf->full = false;
+        ring.nwritten++;
+        virCondBroadcast(&ring.cond);
+        virMutexUnlock(&ring.lock);
+    }
+
+    ret = 0;
+
+cleanup:
+    /* On failure the reader may be stuck reading its input, so it is
+     * only joined once all data went through; the process exits anyway */
+    if (ret == 0) {
+        virThreadJoin(&reader);
+    } else if (haveReader) {
+        virMutexLock(&ring.lock);
+        ring.quit = true;
+        virCondBroadcast(&ring.cond);
+        virMutexUnlock(&ring.lock);
+        return ret;
+    }
+
+    for (i = 0; i < IO_BUFFERS; i++)
+        VIR_FREE(ring.bufs[i].data);
+    virCondDestroy(&ring.cond);
+    virMutexDestroy(&ring.lock);
+    return ret;
+}
+
+/* Tell virFileWrapperFd how much data went through and how long it
+ * took, if it asked for it */
+static void
+reportStats(unsigned long long total, unsigned long long start)
+{
+    const char *env = getenv("LIBVIRT_IOHELPER_STATS_FD");
+    unsigned long long now;
+    char *stats = NULL;
+    int fd;
+
+    if (!env || virStrToLong_i(env, NULL, 10, &fd) < 0 || fd < 0)
+        return;
+
+    if (virTimeMillisNow(&now) < 0)
+        now = start;
+
+    if (virAsprintf(&stats, "%llu %llu\n", total, now - start) >= 0)
+        ignore_value(safewrite(fd, stats, strlen(stats)));
+    VIR_FREE(stats);
+    VIR_FORCE_CLOSE(fd);
+}
+
 static int
 runIO(const char *path, int fd, int oflags, unsigned long long length)
 {
-    void *base = NULL; /* Location to be freed */
-    char *buf = NULL; /* Aligned location within base */
-    size_t buflen = 1024*1024;
-    intptr_t alignMask = 64*1024 - 1;
     int ret = -1;
     int fdin, fdout;
     const char *fdinname, *fdoutname;
     unsigned long long total = 0;
+    unsigned long long start = 0;
     bool direct = O_DIRECT && ((oflags & O_DIRECT) != 0);
-    bool shortRead = false; /* true if we hit a short read */
     off_t end = 0;
+    int rc = 0;
 
-#if HAVE_POSIX_MEMALIGN
-    if (posix_memalign(&base, alignMask + 1, buflen)) {
-        virReportOOMError();
-        goto cleanup;
-    }
-    buf = base;
-#else
-    if (VIR_ALLOC_N(buf, buflen + alignMask) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-    base = buf;
-    buf = (char *) (((intptr_t) base + alignMask) & ~alignMask);
-#endif
+    ignore_value(virTimeMillisNow(&start));
 
     switch (oflags & O_ACCMODE) {
     case O_RDONLY:
@@ -138,68 +403,487 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         goto cleanup;
     }
 
+#if HAVE_SPLICE
+    /* O_DIRECT needs the aligned buffers of the copy loop */
+    if (!direct &&
+        (rc = runSplice(fdin, fdinname, fdout, fdoutname,
+                        length, &total)) < 0)
+        goto cleanup;
+#endif
+
+    if (rc == 0 &&
+        runCopy(path, fd, direct, fdin, fdinname, fdout, fdoutname,
+                length, &total) < 0)
+        goto cleanup;
+
+    /* Ensure all data is written */
+    if (fdatasync(fdout) < 0) {
+        if (errno != EINVAL && errno != EROFS) {
+            /* fdatasync() may fail on some special FDs, e.g. pipes */
+            virReportSystemError(errno, _("unable to fsync %s"), fdoutname);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    if (VIR_CLOSE(fd) < 0 &&
+        ret == 0) {
+        virReportSystemError(errno, _("Unable to close %s"), path);
+        ret = -1;
+    }
+
+    if (ret == 0)
+        reportStats(total, start);
+    return ret;
+}
+
+#if HAVE_ZLIB
+/* The parallel compression format splits the data into chunks which are
+ * compressed independently, so that both saving and restoring can be
+ * spread over all host CPUs:
+ *
+ *   header: "LibvirtZ" | version (4 bytes) | chunk size (4 bytes)
+ *   chunk:  raw length (4 bytes) | stored length (4 bytes) | data
+ *
+ * All numbers are big endian. A stored length of 0 means the chunk did
+ * not compress and its data is stored as is. A chunk with a raw length
+ * of 0 terminates the stream, so that truncated images are detected.
+ */
+# define CHUNK_MAGIC "LibvirtZ"
+# define CHUNK_MAGIC_LEN (sizeof(CHUNK_MAGIC) - 1)
+# define CHUNK_VERSION 1
+# define CHUNK_SIZE (1024 * 1024)
+# define CHUNK_SIZE_MAX (64 * 1024 * 1024)
+# define CHUNK_WORKERS_MAX 16
+
+enum {
+    CHUNK_FREE,     /* slot may be filled by the reader */
+    CHUNK_FILLED,   /* input read, waiting for a worker */
+    CHUNK_BUSY,     /* being processed by a worker */
+    CHUNK_DONE,     /* output ready to be written */
+};
+
+typedef struct _ioChunk ioChunk;
+struct _ioChunk {
+    int state;
+    char *in;
+    size_t inlen;
+    char *out;
+    size_t outlen;
+    uint32_t rawlen;
+    bool stored;    /* data is not compressed */
+};
+
+typedef struct _ioPipeline ioPipeline;
+struct _ioPipeline {
+    virMutex lock;
+    virCond cond;
+
+    bool decompress;
+    size_t chunkSize;
+    size_t maxStored;
+
+    /* chunk number N lives in slot N % nchunks */
+    ioChunk *chunks;
+    size_t nchunks;
+    unsigned long long nfilled;
+    unsigned long long nstarted;
+    unsigned long long nwritten;
+
+    bool eof;
+    bool failed;
+    int errnum;
+    const char *errmsg;
+};
+
+static void
+putUint32(char *buf, uint32_t val)
+{
+    buf[0] = (val >> 24) & 0xff;
+    buf[1] = (val >> 16) & 0xff;
+    buf[2] = (val >> 8) & 0xff;
+    buf[3] = val & 0xff;
+}
+
+static uint32_t
+getUint32(const char *buf)
+{
+    const unsigned char *b = (const unsigned char *)buf;
+
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) |
+           ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+}
+
+/* Errors can't be reported from the helper threads since the error
+ * object is thread local; record the first one for the main thread */
+static void
+pipelineFail(ioPipeline *pl, int errnum, const char *msg)
+{
+    virMutexLock(&pl->lock);
+    if (!pl->failed) {
+        pl->failed = true;
+        pl->errnum = errnum;
+        pl->errmsg = msg;
+    }
+    virCondBroadcast(&pl->cond);
+    virMutexUnlock(&pl->lock);
+}
+
+/* Read the input of one chunk; returns 1 on success, 0 at the end of the
+ * stream and -1 on error */
+static int
+pipelineReadChunk(ioPipeline *pl, ioChunk *chunk)
+{
+    char hdr[8];
+    ssize_t got;
+    uint32_t len;
+
+    if (!pl->decompress) {
+        if ((got = saferead(STDIN_FILENO, chunk->in, pl->chunkSize)) < 0) {
+            pipelineFail(pl, errno, _("Unable to read stdin"));
+            return -1;
+        }
+        chunk->inlen = got;
+        chunk->rawlen = got;
+        return got > 0;
+    }
+
+    if ((got = saferead(STDIN_FILENO, hdr, sizeof(hdr))) < 0) {
+        pipelineFail(pl, errno, _("Unable to read stdin"));
+        return -1;
+    }
+    if (got != sizeof(hdr)) {
+        pipelineFail(pl, 0, _("compressed stream is truncated"));
+        return -1;
+    }
+
+    chunk->rawlen = getUint32(hdr);
+    len = getUint32(hdr + 4);
+    if (chunk->rawlen == 0)
+        return 0;
+
+    chunk->stored = len == 0;
+    if (chunk->stored)
+        len = chunk->rawlen;
+
+    if (chunk->rawlen > pl->chunkSize || len > pl->maxStored) {
+        pipelineFail(pl, 0, _("compressed stream is corrupt"));
+        return -1;
+    }
+
+    if ((got = saferead(STDIN_FILENO, chunk->in, len)) < 0) {
+        pipelineFail(pl, errno, _("Unable to read stdin"));
+        return -1;
+    }
+    if (got != len) {
+        pipelineFail(pl, 0, _("compressed stream is truncated"));
+        return -1;
+    }
+    chunk->inlen = len;
+
+    return 1;
+}
+
+static void
+pipelineReader(void *opaque)
+{
+    ioPipeline *pl = opaque;
+
     while (1) {
-        ssize_t got;
+        ioChunk *chunk;
+        int rc;
+
+        virMutexLock(&pl->lock);
+        chunk = &pl->chunks[pl->nfilled % pl->nchunks];
+        while (!pl->failed && chunk->state != CHUNK_FREE)
+            ignore_value(virCondWait(&pl->cond, &pl->lock));
+        virMutexUnlock(&pl->lock);
+
+        if (pl->failed)
+            return;
+
+        rc = pipelineReadChunk(pl, chunk);
+
+        virMutexLock(&pl->lock);
+        if (rc > 0) {
+            chunk->state = CHUNK_FILLED;
+            pl->nfilled++;
+        } else if (rc == 0) {
+            pl->eof = true;
+        }
+        virCondBroadcast(&pl->cond);
+        virMutexUnlock(&pl->lock);
 
-        if (length &&
-            (length - total) < buflen)
-            buflen = length - total;
+        if (rc <= 0)
+            return;
+    }
+}
 
-        if (buflen == 0)
-            break; /* End of requested data from client */
+static int
+pipelineProcessChunk(ioPipeline *pl, ioChunk *chunk)
+{
+    uLongf len = pl->maxStored;
+
+    if (!pl->decompress) {
+        /* Z_BEST_SPEED: the point is to keep up with the guest's memory
+         * being streamed, not to squeeze out the last few bytes */
+        chunk->stored = compress2((Bytef *)chunk->out, &len,
+                                  (Bytef *)chunk->in, chunk->inlen,
+                                  Z_BEST_SPEED) != Z_OK ||
+                        len >= chunk->inlen;
+        chunk->outlen = chunk->stored ? chunk->inlen : len;
+        return 0;
+    }
 
-        if ((got = saferead(fdin, buf, buflen)) < 0) {
-            virReportSystemError(errno, _("Unable to read %s"), fdinname);
-            goto cleanup;
+    if (chunk->stored) {
+        chunk->outlen = chunk->inlen;
+        return 0;
+    }
+
+    len = chunk->rawlen;
+    if (uncompress((Bytef *)chunk->out, &len,
+                   (Bytef *)chunk->in, chunk->inlen) != Z_OK ||
+        len != chunk->rawlen) {
+        pipelineFail(pl, 0, _("compressed stream is corrupt"));
+        return -1;
+    }
+    chunk->outlen = len;
+    return 0;
+}
+
+static void
+pipelineWorker(void *opaque)
+{
+    ioPipeline *pl = opaque;
+
+    while (1) {
+        ioChunk *chunk;
+
+        virMutexLock(&pl->lock);
+        while (!pl->failed && pl->nstarted == pl->nfilled && !pl->eof)
+            ignore_value(virCondWait(&pl->cond, &pl->lock));
+        if (pl->failed || pl->nstarted == pl->nfilled) {
+            virMutexUnlock(&pl->lock);
+            return;
         }
-        if (got == 0)
-            break; /* End of file before end of requested data */
-        if (got < buflen || (buflen & alignMask)) {
-            /* O_DIRECT can handle at most one short read, at end of file */
-            if (direct && shortRead) {
-                virReportSystemError(EINVAL, "%s",
-                                     _("Too many short reads for O_DIRECT"));
-            }
-            shortRead = true;
+        chunk = &pl->chunks[pl->nstarted++ % pl->nchunks];
+        chunk->state = CHUNK_BUSY;
+        virMutexUnlock(&pl->lock);
+
+        if (pipelineProcessChunk(pl, chunk) < 0)
+            return;
+
+        virMutexLock(&pl->lock);
+        chunk->state = CHUNK_DONE;
+        virCondBroadcast(&pl->cond);
+        virMutexUnlock(&pl->lock);
+    }
+}
+
+static int
+pipelineWriteChunk(ioPipeline *pl, ioChunk *chunk)
+{
+    const char *data = chunk->stored ? chunk->in : chunk->out;
+
+    if (!pl->decompress) {
+        char hdr[8];
+
+        putUint32(hdr, chunk->rawlen);
+        putUint32(hdr + 4, chunk->stored ? 0 : chunk->outlen);
+        if (safewrite(STDOUT_FILENO, hdr, sizeof(hdr)) < 0)
+            goto error;
+    }
+
+    if (safewrite(STDOUT_FILENO, data, chunk->outlen) < 0)
+        goto error;
+
+    return 0;
+
+error:
+    virReportSystemError(errno, "%s", _("Unable to write stdout"));
+    return -1;
+}
+
+/* Write the stream header, or read and check it when decompressing */
+static int
+pipelineHeader(ioPipeline *pl)
+{
+    char hdr[CHUNK_MAGIC_LEN + 8];
+    ssize_t got;
+
+    if (!pl->decompress) {
+        memcpy(hdr, CHUNK_MAGIC, CHUNK_MAGIC_LEN);
+        putUint32(hdr + CHUNK_MAGIC_LEN, CHUNK_VERSION);
+        putUint32(hdr + CHUNK_MAGIC_LEN + 4, pl->chunkSize);
+        if (safewrite(STDOUT_FILENO, hdr, sizeof(hdr)) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to write stdout"));
+            return -1;
         }
+        return 0;
+    }
 
-        total += got;
-        if (fdout == fd && direct && shortRead) {
-            end = total;
-            memset(buf + got, 0, buflen - got);
-            got = (got + alignMask) & ~alignMask;
+    if ((got = saferead(STDIN_FILENO, hdr, sizeof(hdr))) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to read stdin"));
+        return -1;
+    }
+    if (got != sizeof(hdr) ||
+        memcmp(hdr, CHUNK_MAGIC, CHUNK_MAGIC_LEN) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("input is not a compressed stream"));
+        return -1;
+    }
+    if (getUint32(hdr + CHUNK_MAGIC_LEN) != CHUNK_VERSION) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unsupported compressed stream version %u"),
+                       getUint32(hdr + CHUNK_MAGIC_LEN));
+        return -1;
+    }
+    pl->chunkSize = getUint32(hdr + CHUNK_MAGIC_LEN + 4);
+    if (pl->chunkSize == 0 || pl->chunkSize > CHUNK_SIZE_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("invalid compressed stream chunk size %zu"),
+                       pl->chunkSize);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+runPipeline(bool decompress)
+{
+    ioPipeline pl;
+    virThread reader;
+    virThreadPtr workers = NULL;
+    size_t nworkers = 0;
+    long ncpus;
+    bool haveReader = false;
+    size_t i;
+    int ret = -1;
+
+    memset(&pl, 0, sizeof(pl));
+    pl.decompress = decompress;
+    pl.chunkSize = CHUNK_SIZE;
+
+    if (virMutexInit(&pl.lock) < 0 ||
+        virCondInit(&pl.cond) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize mutex"));
+        return -1;
+    }
+
+    if (pipelineHeader(&pl) < 0)
+        goto cleanup;
+    pl.maxStored = compressBound(pl.chunkSize);
+
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus < 1)
+        ncpus = 1;
+    if (ncpus > CHUNK_WORKERS_MAX)
+        ncpus = CHUNK_WORKERS_MAX;
+
+    /* two slots per worker lets reading and writing overlap with
+     * the processing of the chunks in between */
+    pl.nchunks = ncpus * 2;
+    if (VIR_ALLOC_N(pl.chunks, pl.nchunks) < 0 ||
+        VIR_ALLOC_N(workers, ncpus) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    for (i = 0; i < pl.nchunks; i++) {
+        if (VIR_ALLOC_N(pl.chunks[i].in, pl.maxStored) < 0 ||
+            VIR_ALLOC_N(pl.chunks[i].out, pl.maxStored) < 0) {
+            virReportOOMError();
+            goto cleanup;
         }
-        if (safewrite(fdout, buf, got) < 0) {
-            virReportSystemError(errno, _("Unable to write %s"), fdoutname);
+    }
+
+    if (virThreadCreate(&reader, true, pipelineReader, &pl) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to create thread"));
+        goto cleanup;
+    }
+    haveReader = true;
+
+    for (nworkers = 0; nworkers < ncpus; nworkers++) {
+        if (virThreadCreate(&workers[nworkers], true,
+                            pipelineWorker, &pl) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to create thread"));
+            pipelineFail(&pl, 0, NULL);
             goto cleanup;
         }
-        if (end && ftruncate(fd, end) < 0) {
-            virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
+    }
+
+    while (1) {
+        ioChunk *chunk;
+
+        virMutexLock(&pl.lock);
+        chunk = &pl.chunks[pl.nwritten % pl.nchunks];
+        while (!pl.failed && chunk->state != CHUNK_DONE &&
+               !(pl.eof && pl.nwritten == pl.nfilled))
+            ignore_value(virCondWait(&pl.cond, &pl.lock));
+        virMutexUnlock(&pl.lock);
+
+        if (pl.failed || chunk->state != CHUNK_DONE)
+            break;
+
+        if (pipelineWriteChunk(&pl, chunk) < 0) {
+            pipelineFail(&pl, 0, NULL);
             goto cleanup;
         }
+
+        virMutexLock(&pl.lock);
+        chunk->state = CHUNK_FREE;
+        pl.nwritten++;
+        virCondBroadcast(&pl.cond);
+        virMutexUnlock(&pl.lock);
     }
 
-    /* Ensure all data is written */
-    if (fdatasync(fdout) < 0) {
-        if (errno != EINVAL && errno != EROFS) {
-            /* fdatasync() may fail on some special FDs, e.g. pipes */
-            virReportSystemError(errno, _("unable to fsync %s"), fdoutname);
+    if (pl.failed) {
+        if (pl.errnum)
+            virReportSystemError(pl.errnum, "%s", pl.errmsg);
+        else
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s", pl.errmsg);
+        goto cleanup;
+    }
+
+    if (!decompress) {
+        char end[8] = { 0 };
+
+        if (safewrite(STDOUT_FILENO, end, sizeof(end)) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to write stdout"));
             goto cleanup;
         }
     }
 
+    if (fdatasync(STDOUT_FILENO) < 0 &&
+        errno != EINVAL && errno != EROFS) {
+        virReportSystemError(errno, "%s", _("unable to fsync stdout"));
+        goto cleanup;
+    }
+
     ret = 0;
 
 cleanup:
-    if (VIR_CLOSE(fd) < 0 &&
-        ret == 0) {
-        virReportSystemError(errno, _("Unable to close %s"), path);
-        ret = -1;
+    /* On failure the reader may be stuck reading stdin, so the threads are
+     * only joined once all data went through; the process exits anyway */
+    if (ret == 0) {
+        if (haveReader)
+            virThreadJoin(&reader);
+        for (i = 0; i < nworkers; i++)
+            virThreadJoin(&workers[i]);
+
+        for (i = 0; i < pl.nchunks; i++) {
+            VIR_FREE(pl.chunks[i].in);
+            VIR_FREE(pl.chunks[i].out);
+        }
+        VIR_FREE(pl.chunks);
+        VIR_FREE(workers);
+        virCondDestroy(&pl.cond);
+        virMutexDestroy(&pl.lock);
     }
-
-    VIR_FREE(base);
     return ret;
 }
+#endif /* HAVE_ZLIB */
 
 static const char *program_name;
 
@@ -210,8 +894,9 @@ usage(int status)
         fprintf(stderr, _("%s: try --help for more details"), program_name);
     } else {
         printf(_("Usage: %s FILENAME OFLAGS MODE OFFSET LENGTH DELETE\n"
-                 "   or: %s FILENAME LENGTH FD\n"),
-               program_name, program_name);
+                 "   or: %s FILENAME LENGTH FD\n"
+                 "   or: %s -c|-dc\n"),
+               program_name, program_name, program_name);
     }
     exit(status);
 }
@@ -248,7 +933,20 @@ main(int argc, char **argv)
 
     if (argc > 1 && STREQ(argv[1], "--help"))
         usage(EXIT_SUCCESS);
-    if (argc == 7) { /* FILENAME OFLAGS MODE OFFSET LENGTH DELETE */
+    if (argc == 2 &&
+        (STREQ(argv[1], "-c") || STREQ(argv[1], "-dc"))) {
+        /* compress or decompress stdin to stdout */
+        path = "stdin";
+#if HAVE_ZLIB
+        if (runPipeline(STREQ(argv[1], "-dc")) < 0)
+            goto error;
+        return 0;
+#else
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("compression support was not compiled in"));
+        goto error;
+#endif
+    } else if (argc == 7) { /* FILENAME OFLAGS MODE OFFSET LENGTH DELETE */
         lengthIndex = 5;
         if (virStrToLong_i(argv[2], NULL, 10, &oflags) < 0) {
             fprintf(stderr, _("%s: malformed file flags %s"),
@@ -44,6 +44,8 @@
 #include "virterror_internal.h"
 #include "logging.h"
 #include "threads.h"
+#include "buf.h"
+#include "util.h"
 
 #if HAVE_FIREWALLD
 static char *firewall_cmd_path = NULL;
@@ -85,16 +87,31 @@ enum {
 
 typedef struct
 {
+    iptablesContext *ctx;
     char  *table;
     char  *chain;
 } iptRules;
 
+/* A rule change recorded while a batch is open */
+typedef struct
+{
+    iptRules *rules;
+    int family;
+    int action;
+    size_t nargs;
+    char **args;
+} iptBatchRule;
+
 struct _iptablesContext
 {
     iptRules *input_filter;
     iptRules *forward_filter;
     iptRules *nat_postrouting;
     iptRules *mangle_postrouting;
+
+    bool batching;
+    size_t nbatch;
+    iptBatchRule *batch;
 };
 
 static void
@@ -106,7 +123,8 @@ iptRulesFree(iptRules *rules)
 }
 
 static iptRules *
-iptRulesNew(const char *table,
+iptRulesNew(iptablesContext *ctx,
+            const char *table,
             const char *chain)
 {
     iptRules *rules;
@@ -114,6 +132,8 @@ iptRulesNew(const char *table,
     if (VIR_ALLOC(rules) < 0)
         return NULL;
 
+    rules->ctx = ctx;
+
     if (!(rules->table = strdup(table)))
         goto error;
 
@@ -127,14 +147,10 @@ iptRulesNew(const char *table,
     return NULL;
 }
 
-static int ATTRIBUTE_SENTINEL
-iptablesAddRemoveRule(iptRules *rules, int family, int action,
-                      const char *arg, ...)
+static virCommandPtr
+iptablesCommandNew(int family)
 {
-    va_list args;
-    int ret;
     virCommandPtr cmd = NULL;
-    const char *s;
 
 #if HAVE_FIREWALLD
     virIpTablesInitialize();
@@ -150,6 +166,79 @@ iptablesAddRemoveRule(iptRules *rules, int family, int action,
                         ? IP6TABLES_PATH : IPTABLES_PATH);
     }
 
+    return cmd;
+}
+
+static void
+iptBatchRuleClear(iptBatchRule *rule)
+{
+    size_t i;
+
+    for (i = 0; i < rule->nargs; i++)
+        VIR_FREE(rule->args[i]);
+    VIR_FREE(rule->args);
+    rule->nargs = 0;
+}
+
+static void
+iptablesBatchClear(iptablesContext *ctx)
+{
+    size_t i;
+
+    for (i = 0; i < ctx->nbatch; i++)
+        iptBatchRuleClear(&ctx->batch[i]);
+    VIR_FREE(ctx->batch);
+    ctx->nbatch = 0;
+}
+
+static int
+iptablesBatchAddRule(iptRules *rules, int family, int action,
+                     const char *arg, va_list args)
+{
+    iptablesContext *ctx = rules->ctx;
+    iptBatchRule rule = { rules, family, action, 0, NULL };
+    const char *s = arg;
+
+    while (s) {
+        char *tmp;
+
+        if (!(tmp = strdup(s)) ||
+            VIR_APPEND_ELEMENT(rule.args, rule.nargs, tmp) < 0) {
+            VIR_FREE(tmp);
+            goto no_memory;
+        }
+        s = va_arg(args, const char *);
+    }
+
+    if (VIR_APPEND_ELEMENT(ctx->batch, ctx->nbatch, rule) < 0)
+        goto no_memory;
+
+    return 0;
+
+no_memory:
+    iptBatchRuleClear(&rule);
+    virReportOOMError();
+    return -1;
+}
+
+static int ATTRIBUTE_SENTINEL
+iptablesAddRemoveRule(iptRules *rules, int family, int action,
+                      const char *arg, ...)
+{
+    va_list args;
+    int ret;
+    virCommandPtr cmd = NULL;
+    const char *s;
+
+    if (rules->ctx->batching) {
+        va_start(args, arg);
+        ret = iptablesBatchAddRule(rules, family, action, arg, args);
+        va_end(args);
+        return ret;
+    }
+
+    cmd = iptablesCommandNew(family);
+
     virCommandAddArgList(cmd, "--table", rules->table,
                          action == ADD ? "--insert" : "--delete",
                          rules->chain, arg, NULL);
@@ -179,16 +268,16 @@ iptablesContextNew(void)
     if (VIR_ALLOC(ctx) < 0)
         return NULL;
 
-    if (!(ctx->input_filter = iptRulesNew("filter", "INPUT")))
+    if (!(ctx->input_filter = iptRulesNew(ctx, "filter", "INPUT")))
         goto error;
 
-    if (!(ctx->forward_filter = iptRulesNew("filter", "FORWARD")))
+    if (!(ctx->forward_filter = iptRulesNew(ctx, "filter", "FORWARD")))
         goto error;
 
-    if (!(ctx->nat_postrouting = iptRulesNew("nat", "POSTROUTING")))
+    if (!(ctx->nat_postrouting = iptRulesNew(ctx, "nat", "POSTROUTING")))
         goto error;
 
-    if (!(ctx->mangle_postrouting = iptRulesNew("mangle", "POSTROUTING")))
+    if (!(ctx->mangle_postrouting = iptRulesNew(ctx, "mangle", "POSTROUTING")))
         goto error;
 
     return ctx;
@@ -215,9 +304,275 @@ iptablesContextFree(iptablesContext *ctx)
         iptRulesFree(ctx->nat_postrouting);
     if (ctx->mangle_postrouting)
         iptRulesFree(ctx->mangle_postrouting);
+    iptablesBatchClear(ctx);
     VIR_FREE(ctx);
 }
 
+/**
+ * iptablesContextBeginBatch:
+ * @ctx: pointer to the IP table context
+ *
+ * Start recording rule changes instead of applying them one by one.
+ * The recorded changes are applied by iptablesContextCommitBatch.
+ */
+void
+iptablesContextBeginBatch(iptablesContext *ctx)
+{
+    iptablesBatchClear(ctx);
+    ctx->batching = true;
+}
+
+static bool
+iptBatchRuleEqual(const iptBatchRule *a, const iptBatchRule *b)
+{
+    size_t i;
+
+    if (a->rules != b->rules ||
+        a->family != b->family ||
+        a->nargs != b->nargs)
+        return false;
+
+    for (i = 0; i < a->nargs; i++) {
+        if (STRNEQ(a->args[i], b->args[i]))
+            return false;
+    }
+
+    return true;
+}
+
+/* Returns the index of a rule among the first @end recorded ones,
+ * other than @n itself, that matches ctx->batch[n] and was recorded
+ * with @action, or -1 */
+static ssize_t
+iptablesBatchFind(iptablesContext *ctx, size_t n, int action, size_t end)
+{
+    size_t i;
+
+    for (i = 0; i < end; i++) {
+        if (i != n &&
+            ctx->batch[i].action == action &&
+            iptBatchRuleEqual(&ctx->batch[i], &ctx->batch[n]))
+            return i;
+    }
+    return -1;
+}
+
+static virCommandPtr
+iptablesBatchRuleCommand(iptBatchRule *rule, const char *op)
+{
+    virCommandPtr cmd = iptablesCommandNew(rule->family);
+    size_t i;
+
+    virCommandAddArgList(cmd, "--table", rule->rules->table,
+                         op, rule->rules->chain, NULL);
+    for (i = 0; i < rule->nargs; i++)
+        virCommandAddArg(cmd, rule->args[i]);
+
+    return cmd;
+}
+
+/* Returns 1 if @rule is currently installed, 0 if it is not and -1 if
+ * that cannot be determined */
+static int
+iptablesBatchRuleInstalled(iptBatchRule *rule)
+{
+    virCommandPtr cmd = iptablesBatchRuleCommand(rule, "--check");
+    int status;
+    int ret = -1;
+
+    if (virCommandRun(cmd, &status) == 0) {
+        if (status == 0)
+            ret = 1;
+        else if (status == 1)
+            ret = 0;
+    }
+
+    virCommandFree(cmd);
+    return ret;
+}
+
+static int
+iptablesBatchRun(iptBatchRule *rule, int action)
+{
+    virCommandPtr cmd;
+    int ret;
+
+    cmd = iptablesBatchRuleCommand(rule,
+                                   action == ADD ? "--insert" : "--delete");
+    ret = virCommandRun(cmd, NULL);
+    virCommandFree(cmd);
+    return ret;
+}
+
+/* Apply the changes in @todo, which have already been filtered against
+ * the installed rules, with one iptables-restore call per family */
+static int
+iptablesBatchRestore(iptablesContext *ctx, int *todo, bool useRestore)
+{
+    static const int families[] = { AF_INET, AF_INET6 };
+    iptRules *tables[] = { ctx->input_filter, ctx->forward_filter,
+                           ctx->nat_postrouting, ctx->mangle_postrouting };
+    size_t f, t, u, i;
+    int ret = 0;
+
+    for (f = 0; f < ARRAY_CARDINALITY(families); f++) {
+        const char *restore = (families[f] == AF_INET6)
+                              ? IP6TABLES_RESTORE_PATH
+                              : IPTABLES_RESTORE_PATH;
+        virBuffer buf = VIR_BUFFER_INITIALIZER;
+        virCommandPtr cmd;
+        char *input;
+
+        if (!useRestore || !virFileIsExecutable(restore)) {
+            for (i = 0; i < ctx->nbatch; i++) {
+                if (todo[i] >= 0 &&
+                    ctx->batch[i].family == families[f] &&
+                    iptablesBatchRun(&ctx->batch[i], todo[i]) < 0)
+                    ret = -1;
+            }
+            continue;
+        }
+
+        for (t = 0; t < ARRAY_CARDINALITY(tables); t++) {
+            bool started = false;
+
+            /* chains of the same table go into one section */
+            for (u = 0; u < t; u++) {
+                if (STREQ(tables[u]->table, tables[t]->table))
+                    break;
+            }
+            if (u < t)
+                continue;
+
+            for (i = 0; i < ctx->nbatch; i++) {
+                iptBatchRule *rule = &ctx->batch[i];
+                size_t j;
+
+                if (todo[i] < 0 ||
+                    rule->family != families[f] ||
+                    STRNEQ(rule->rules->table, tables[t]->table))
+                    continue;
+
+                if (!started) {
+                    virBufferAsprintf(&buf, "*%s\n", tables[t]->table);
+                    started = true;
+                }
+                virBufferAsprintf(&buf, "%s %s",
+                                  todo[i] == ADD ? "-I" : "-D",
+                                  rule->rules->chain);
+                for (j = 0; j < rule->nargs; j++)
+                    virBufferAsprintf(&buf, " %s", rule->args[j]);
+                virBufferAddLit(&buf, "\n");
+            }
+
+            if (started)
+                virBufferAddLit(&buf, "COMMIT\n");
+        }
+
+        if (virBufferError(&buf)) {
+            virBufferFreeAndReset(&buf);
+            virReportOOMError();
+            return -1;
+        }
+
+        if (!virBufferUse(&buf))
+            continue;
+
+        input = virBufferContentAndReset(&buf);
+        cmd = virCommandNewArgList(restore, "--noflush", NULL);
+        virCommandSetInputBuffer(cmd, input);
+        if (virCommandRun(cmd, NULL) < 0)
+            ret = -1;
+        virCommandFree(cmd);
+        VIR_FREE(input);
+    }
+
+    return ret;
+}
+
+/**
+ * iptablesContextCommitBatch:
+ * @ctx: pointer to the IP table context
+ *
+ * Apply the rule changes recorded since iptablesContextBeginBatch.
+ * Rather than executing them in order, the desired result is compared
+ * against the rules that are installed: a rule which is removed and
+ * added again is left untouched if present, and only the remaining
+ * differences are applied. Unless firewalld is in use, they are applied
+ * in a single iptables-restore transaction per address family.
+ *
+ * Returns 0 in case of success or -1 in case of error
+ */
+int
+iptablesContextCommitBatch(iptablesContext *ctx)
+{
+    int *todo = NULL;
+    bool haveCheck = true;
+    bool useRestore = true;
+    size_t i;
+    int ret = -1;
+
+    ctx->batching = false;
+
+    if (ctx->nbatch == 0)
+        return 0;
+
+    if (VIR_ALLOC_N(todo, ctx->nbatch) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0; i < ctx->nbatch; i++) {
+        iptBatchRule *rule = &ctx->batch[i];
+        int installed;
+
+        todo[i] = -1;
+
+        if (rule->action == ADD) {
+            /* adding the same rule twice yields the same result */
+            if (iptablesBatchFind(ctx, i, ADD, i) >= 0)
+                continue;
+        } else {
+            /* removing a rule that is wanted in the end is a no-op */
+            if (iptablesBatchFind(ctx, i, ADD, ctx->nbatch) >= 0 ||
+                iptablesBatchFind(ctx, i, REMOVE, i) >= 0)
+                continue;
+        }
+
+        if ((installed = iptablesBatchRuleInstalled(rule)) < 0) {
+            haveCheck = false;
+            break;
+        }
+
+        if ((rule->action == ADD) != (installed == 1))
+            todo[i] = rule->action;
+    }
+
+    if (!haveCheck) {
+        /* iptables too old to support --check, replay everything */
+        VIR_DEBUG("iptables --check not supported, applying rules in order");
+        for (i = 0; i < ctx->nbatch; i++)
+            ignore_value(iptablesBatchRun(&ctx->batch[i],
+                                          ctx->batch[i].action));
+        ret = 0;
+        goto cleanup;
+    }
+
+#if HAVE_FIREWALLD
+    /* changing the rules behind firewalld's back would go unnoticed */
+    virIpTablesInitialize();
+    if (firewall_cmd_path)
+        useRestore = false;
+#endif
+
+    ret = iptablesBatchRestore(ctx, todo, useRestore);
+
+cleanup:
+    VIR_FREE(todo);
+    iptablesBatchClear(ctx);
+    return ret;
+}
+
 static int
 iptablesInput(iptablesContext *ctx,
               int family,
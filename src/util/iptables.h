@@ -29,6 +29,9 @@ typedef struct _iptablesContext iptablesContext;
 iptablesContext *iptablesContextNew              (void);
 void             iptablesContextFree             (iptablesContext *ctx);
 
+void             iptablesContextBeginBatch       (iptablesContext *ctx);
+int              iptablesContextCommitBatch      (iptablesContext *ctx);
+
 int              iptablesAddTcpInput             (iptablesContext *ctx,
                                                   int family,
                                                   const char *iface,
@@ -57,10 +57,67 @@ typedef virJSONParser *virJSONParserPtr;
 struct _virJSONParser {
     virJSONValuePtr head;
     virJSONParserStatePtr state;
-    unsigned int nstate;
+    size_t nstate;
+    size_t nstate_max;
+
+    virJSONValueFilter filter;
+    void *opaque;
+    /* Nesting depth within a container being dropped */
+    unsigned int skip;
+    /* The next value was rejected by the filter */
+    bool skipNext;
 };
 
 
+/* Objects with fewer pairs than this are searched linearly */
+#define VIR_JSON_OBJECT_INDEX_MIN 16
+
+/* Record the last pair appended to @object in its index, if it has one.
+ * Keys are unique within an object, so the entry can't clash. */
+static void virJSONObjectIndexAppend(virJSONObjectPtr object)
+{
+    virJSONObjectPairPtr pair;
+
+    if (!object->index)
+        return;
+
+    pair = &object->pairs[object->npairs - 1];
+    if (virHashAddEntry(object->index, pair->key, pair->value) < 0) {
+        /* Lookups simply go back to scanning the pairs */
+        virHashFree(object->index);
+        object->index = NULL;
+    }
+}
+
+static virJSONValuePtr virJSONObjectLookup(virJSONObjectPtr object,
+                                           const char *key)
+{
+    int i;
+
+    if (!object->index && object->npairs >= VIR_JSON_OBJECT_INDEX_MIN &&
+        (object->index = virHashCreate(object->npairs, NULL))) {
+        for (i = 0 ; i < object->npairs ; i++) {
+            if (virHashAddEntry(object->index, object->pairs[i].key,
+                                object->pairs[i].value) < 0) {
+                virHashFree(object->index);
+                object->index = NULL;
+                break;
+            }
+        }
+    }
+
+    if (object->index)
+        return virHashLookup(object->index, key);
+
+    for (i = 0 ; i < object->npairs ; i++) {
+        if (STREQ(object->pairs[i].key, key))
+            return object->pairs[i].value;
+    }
+
+    return NULL;
+}
+
+
 void virJSONValueFree(virJSONValuePtr value)
 {
     int i;
@@ -74,6 +131,7 @@ void virJSONValueFree(virJSONValuePtr value)
             virJSONValueFree(value->data.object.pairs[i].value);
         }
         VIR_FREE(value->data.object.pairs);
+        virHashFree(value->data.object.index);
         break;
     case VIR_JSON_TYPE_ARRAY:
         for (i = 0 ; i < value->data.array.nvalues ; i++)
@@ -149,6 +207,25 @@ static virJSONValuePtr virJSONValueNewNumber(const char *data)
     return val;
 }
 
+#if HAVE_YAJL
+static virJSONValuePtr virJSONValueNewNumberLen(const char *data,
+                                                size_t length)
+{
+    virJSONValuePtr val;
+
+    if (VIR_ALLOC(val) < 0)
+        return NULL;
+
+    val->type = VIR_JSON_TYPE_NUMBER;
+    if (!(val->data.number = strndup(data, length))) {
+        VIR_FREE(val);
+        return NULL;
+    }
+
+    return val;
+}
+#endif
+
 virJSONValuePtr virJSONValueNewNumberInt(int data)
 {
     virJSONValuePtr val = NULL;
@@ -280,6 +357,7 @@ int virJSONValueObjectAppend(virJSONValuePtr object, const char *key, virJSONVal
     object->data.object.pairs[object->data.object.npairs].key = newkey;
     object->data.object.pairs[object->data.object.npairs].value = value;
     object->data.object.npairs++;
+    virJSONObjectIndexAppend(&object->data.object);
 
     return 0;
 }
@@ -400,32 +478,105 @@ int virJSONValueArrayAppend(virJSONValuePtr array, virJSONValuePtr value)
 
 int virJSONValueObjectHasKey(virJSONValuePtr object, const char *key)
 {
+    if (object->type != VIR_JSON_TYPE_OBJECT)
+        return -1;
+
+    return virJSONObjectLookup(&object->data.object, key) != NULL;
+}
+
+virJSONValuePtr virJSONValueObjectGet(virJSONValuePtr object, const char *key)
+{
+    if (object->type != VIR_JSON_TYPE_OBJECT)
+        return NULL;
+
+    return virJSONObjectLookup(&object->data.object, key);
+}
+
+/*
+ * virJSONValueObjectRemoveKey:
+ * @object: the object to remove @key from
+ * @key: the key to remove
+ * @value: filled in with the value of @key, which the caller then
+ *         owns, or NULL to free it
+ *
+ * Returns 1 if @key was removed, 0 if it was not present, and -1
+ * if @object is not an object
+ */
+int virJSONValueObjectRemoveKey(virJSONValuePtr object,
+                                const char *key,
+                                virJSONValuePtr *value)
+{
+    virJSONObjectPtr obj;
     int i;
 
+    if (value)
+        *value = NULL;
+
     if (object->type != VIR_JSON_TYPE_OBJECT)
         return -1;
 
-    for (i = 0 ; i < object->data.object.npairs ; i++) {
-        if (STREQ(object->data.object.pairs[i].key, key))
-            return 1;
+    obj = &object->data.object;
+    for (i = 0 ; i < obj->npairs ; i++) {
+        if (STRNEQ(obj->pairs[i].key, key))
+            continue;
+
+        if (obj->index)
+            virHashRemoveEntry(obj->index, key);
+        if (value)
+            *value = obj->pairs[i].value;
+        else
+            virJSONValueFree(obj->pairs[i].value);
+        VIR_FREE(obj->pairs[i].key);
+
+        memmove(obj->pairs + i, obj->pairs + i + 1,
+                sizeof(*obj->pairs) * (obj->npairs - i - 1));
+        if (--obj->npairs == 0)
+            VIR_FREE(obj->pairs);
+        return 1;
     }
 
     return 0;
 }
 
-virJSONValuePtr virJSONValueObjectGet(virJSONValuePtr object, const char *key)
+/*
+ * virJSONValueObjectGetFields:
+ * @object: the object to search
+ * @fields: keys to look up, with their values to fill in
+ * @nfields: number of elements in @fields
+ *
+ * Looks up all of @fields with a single pass over @object, which is
+ * cheaper than a virJSONValueObjectGet() call per key when reading
+ * several members of one object. Keys which are not present have
+ * their value set to NULL.
+ *
+ * Returns the number of keys found, or -1 if @object is not an object.
+ */
+int virJSONValueObjectGetFields(virJSONValuePtr object,
+                                virJSONValueObjectFieldPtr fields,
+                                size_t nfields)
 {
-    int i;
+    size_t found = 0;
+    size_t i, j;
 
     if (object->type != VIR_JSON_TYPE_OBJECT)
-        return NULL;
+        return -1;
+
+    for (j = 0 ; j < nfields ; j++)
+        fields[j].value = NULL;
+
+    for (i = 0 ; i < object->data.object.npairs && found < nfields ; i++) {
+        virJSONObjectPairPtr pair = &object->data.object.pairs[i];
 
-    for (i = 0 ; i < object->data.object.npairs ; i++) {
-        if (STREQ(object->data.object.pairs[i].key, key))
-            return object->data.object.pairs[i].value;
+        for (j = 0 ; j < nfields ; j++) {
+            if (!fields[j].value && STREQ(fields[j].key, pair->key)) {
+                fields[j].value = pair->value;
+                found++;
+                break;
+            }
+        }
     }
 
-    return NULL;
+    return found;
 }
 
 int virJSONValueObjectKeysNumber(virJSONValuePtr object)
@@ -660,6 +811,40 @@ int virJSONValueObjectIsNull(virJSONValuePtr object, const char *key)
 
 
 #if HAVE_YAJL
+/*
+ * Returns true if the value about to be parsed must be dropped,
+ * either because it is nested in a value being skipped or because
+ * the filter rejected the key it is stored under. In both cases
+ * containers only update the skip depth.
+ */
+static bool virJSONParserSkipping(virJSONParserPtr parser,
+                                  bool container)
+{
+    if (parser->skip) {
+        if (container)
+            parser->skip++;
+        return true;
+    }
+
+    if (parser->skipNext) {
+        parser->skipNext = false;
+        if (container)
+            parser->skip = 1;
+        return true;
+    }
+
+    return false;
+}
+
+static bool virJSONParserSkippingEnd(virJSONParserPtr parser)
+{
+    if (parser->skip) {
+        parser->skip--;
+        return true;
+    }
+    return false;
+}
+
 static int virJSONParserInsertValue(virJSONParserPtr parser,
                                     virJSONValuePtr value)
 {
@@ -676,17 +861,26 @@ static int virJSONParserInsertValue(virJSONParserPtr parser,
 
         switch (state->value->type) {
         case VIR_JSON_TYPE_OBJECT: {
+            virJSONObjectPtr object = &state->value->data.object;
+
             if (!state->key) {
                 VIR_DEBUG("missing key when inserting object value");
                 return -1;
             }
 
-            if (virJSONValueObjectAppend(state->value,
-                                         state->key,
-                                         value) < 0)
+            if (virJSONValueObjectHasKey(state->value, state->key))
+                return -1;
+
+            if (VIR_REALLOC_N(object->pairs, object->npairs + 1) < 0)
                 return -1;
 
-            VIR_FREE(state->key);
+            /* the key was allocated for us by the map key callback,
+             * so hand it over instead of copying it once more */
+            object->pairs[object->npairs].key = state->key;
+            object->pairs[object->npairs].value = value;
+            object->npairs++;
+            virJSONObjectIndexAppend(object);
+            state->key = NULL;
         }   break;
 
         case VIR_JSON_TYPE_ARRAY: {
@@ -712,11 +906,14 @@ static int virJSONParserInsertValue(virJSONParserPtr parser,
 static int virJSONParserHandleNull(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewNull();
+    virJSONValuePtr value;
 
     VIR_DEBUG("parser=%p", parser);
 
-    if (!value)
+    if (virJSONParserSkipping(parser, false))
+        return 1;
+
+    if (!(value = virJSONValueNewNull()))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -730,11 +927,14 @@ static int virJSONParserHandleNull(void *ctx)
 static int virJSONParserHandleBoolean(void *ctx, int boolean_)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewBoolean(boolean_);
+    virJSONValuePtr value;
 
     VIR_DEBUG("parser=%p boolean=%d", parser, boolean_);
 
-    if (!value)
+    if (virJSONParserSkipping(parser, false))
+        return 1;
+
+    if (!(value = virJSONValueNewBoolean(boolean_)))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -750,17 +950,14 @@ static int virJSONParserHandleNumber(void *ctx,
                                      yajl_size_t l)
 {
     virJSONParserPtr parser = ctx;
-    char *str = strndup(s, l);
     virJSONValuePtr value;
 
-    if (!str)
-        return -1;
-    value = virJSONValueNewNumber(str);
-    VIR_FREE(str);
+    VIR_DEBUG("parser=%p str=%.*s", parser, (int)l, s);
 
-    VIR_DEBUG("parser=%p str=%s", parser, str);
+    if (virJSONParserSkipping(parser, false))
+        return 1;
 
-    if (!value)
+    if (!(value = virJSONValueNewNumberLen(s, l)))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -776,12 +973,15 @@ static int virJSONParserHandleString(void *ctx,
                                      yajl_size_t stringLen)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewStringLen((const char *)stringVal,
-                                                     stringLen);
+    virJSONValuePtr value;
 
     VIR_DEBUG("parser=%p str=%p", parser, (const char *)stringVal);
 
-    if (!value)
+    if (virJSONParserSkipping(parser, false))
+        return 1;
+
+    if (!(value = virJSONValueNewStringLen((const char *)stringVal,
+                                           stringLen)))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -801,6 +1001,9 @@ static int virJSONParserHandleMapKey(void *ctx,
 
     VIR_DEBUG("parser=%p key=%p", parser, (const char *)stringVal);
 
+    if (parser->skip)
+        return 1;
+
     if (!parser->nstate)
         return 0;
 
@@ -810,17 +1013,61 @@ static int virJSONParserHandleMapKey(void *ctx,
     state->key = strndup((const char *)stringVal, stringLen);
     if (!state->key)
         return 0;
+
+    if (parser->filter &&
+        !parser->filter(state->key, parser->nstate, parser->opaque)) {
+        VIR_FREE(state->key);
+        parser->skipNext = true;
+    }
+
     return 1;
 }
 
+static int virJSONParserPushState(virJSONParserPtr parser,
+                                  virJSONValuePtr value)
+{
+    /* Containers are entered and left all the time, so keep the
+     * stack allocated rather than resizing it on every change */
+    if (VIR_RESIZE_N(parser->state, parser->nstate_max,
+                     parser->nstate, 1) < 0)
+        return -1;
+
+    parser->state[parser->nstate].value = value;
+    parser->state[parser->nstate].key = NULL;
+    parser->nstate++;
+
+    return 0;
+}
+
+static int virJSONParserPopState(virJSONParserPtr parser)
+{
+    virJSONParserStatePtr state;
+
+    if (!parser->nstate)
+        return -1;
+
+    state = &(parser->state[parser->nstate-1]);
+    if (state->key) {
+        VIR_FREE(state->key);
+        return -1;
+    }
+
+    parser->nstate--;
+
+    return 0;
+}
+
 static int virJSONParserHandleStartMap(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewObject();
+    virJSONValuePtr value;
 
     VIR_DEBUG("parser=%p", parser);
 
-    if (!value)
+    if (virJSONParserSkipping(parser, true))
+        return 1;
+
+    if (!(value = virJSONValueNewObject()))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -828,15 +1075,9 @@ static int virJSONParserHandleStartMap(void *ctx)
         return 0;
     }
 
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate + 1) < 0) {
-        virJSONValueFree(value);
+    /* @value is owned by its parent, or by parser->head, by now */
+    if (virJSONParserPushState(parser, value) < 0)
         return 0;
-    }
-
-    parser->state[parser->nstate].value = value;
-    parser->state[parser->nstate].key = NULL;
-    parser->nstate++;
 
     return 1;
 }
@@ -845,23 +1086,14 @@ static int virJSONParserHandleStartMap(void *ctx)
 static int virJSONParserHandleEndMap(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONParserStatePtr state;
 
     VIR_DEBUG("parser=%p", parser);
 
-    if (!parser->nstate)
-        return 0;
+    if (virJSONParserSkippingEnd(parser))
+        return 1;
 
-    state = &(parser->state[parser->nstate-1]);
-    if (state->key) {
-        VIR_FREE(state->key);
+    if (virJSONParserPopState(parser) < 0)
         return 0;
-    }
-
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate - 1) < 0)
-        return 0;
-    parser->nstate--;
 
     return 1;
 }
@@ -869,11 +1101,14 @@ static int virJSONParserHandleEndMap(void *ctx)
 static int virJSONParserHandleStartArray(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewArray();
+    virJSONValuePtr value;
 
     VIR_DEBUG("parser=%p", parser);
 
-    if (!value)
+    if (virJSONParserSkipping(parser, true))
+        return 1;
+
+    if (!(value = virJSONValueNewArray()))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -881,37 +1116,23 @@ static int virJSONParserHandleStartArray(void *ctx)
         return 0;
     }
 
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate + 1) < 0)
+    if (virJSONParserPushState(parser, value) < 0)
         return 0;
 
-    parser->state[parser->nstate].value = value;
-    parser->state[parser->nstate].key = NULL;
-    parser->nstate++;
-
     return 1;
 }
 
 static int virJSONParserHandleEndArray(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONParserStatePtr state;
 
     VIR_DEBUG("parser=%p", parser);
 
-    if (!parser->nstate)
-        return 0;
-
-    state = &(parser->state[parser->nstate-1]);
-    if (state->key) {
-        VIR_FREE(state->key);
-        return 0;
-    }
+    if (virJSONParserSkippingEnd(parser))
+        return 1;
 
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate - 1) < 0)
+    if (virJSONParserPopState(parser) < 0)
         return 0;
-    parser->nstate--;
 
     return 1;
 }
@@ -931,11 +1152,32 @@ static const yajl_callbacks parserCallbacks = {
 };
 
 
-/* XXX add an incremental streaming parser - yajl trivially supports it */
 virJSONValuePtr virJSONValueFromString(const char *jsonstring)
+{
+    return virJSONValueFromStringFiltered(jsonstring, NULL, NULL);
+}
+
+
+/**
+ * virJSONValueFromStringFiltered:
+ * @jsonstring: the JSON document to parse
+ * @filter: callback deciding which object members to keep, or NULL
+ * @opaque: data passed to @filter
+ *
+ * Parse @jsonstring like virJSONValueFromString, except that @filter
+ * is asked about each object member as its key is seen, along with
+ * the number of containers enclosing it (1 for the members of the
+ * top level object). Members it returns false for are dropped
+ * without allocating anything for their values, however large.
+ *
+ * Returns the parsed value, or NULL on error.
+ */
+virJSONValuePtr virJSONValueFromStringFiltered(const char *jsonstring,
+                                               virJSONValueFilter filter,
+                                               void *opaque)
 {
     yajl_handle hand;
-    virJSONParser parser = { NULL, NULL, 0 };
+    virJSONParser parser;
     virJSONValuePtr ret = NULL;
 # ifndef HAVE_YAJL2
     yajl_parser_config cfg = { 1, 1 };
@@ -943,6 +1185,10 @@ virJSONValuePtr virJSONValueFromString(const char *jsonstring)
 
     VIR_DEBUG("string=%s", jsonstring);
 
+    memset(&parser, 0, sizeof(parser));
+    parser.filter = filter;
+    parser.opaque = opaque;
+
 # ifdef HAVE_YAJL2
     hand = yajl_alloc(&parserCallbacks, NULL, &parser);
     if (hand) {
@@ -984,6 +1230,7 @@ cleanup:
             VIR_FREE(parser.state[i].key);
         }
     }
+    VIR_FREE(parser.state);
 
     VIR_DEBUG("result=%p", parser.head);
 
@@ -1112,6 +1359,14 @@ virJSONValuePtr virJSONValueFromString(const char *jsonstring ATTRIBUTE_UNUSED)
                    _("No JSON parser implementation is available"));
     return NULL;
 }
+virJSONValuePtr virJSONValueFromStringFiltered(const char *jsonstring ATTRIBUTE_UNUSED,
+                                               virJSONValueFilter filter ATTRIBUTE_UNUSED,
+                                               void *opaque ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("No JSON parser implementation is available"));
+    return NULL;
+}
 char *virJSONValueToString(virJSONValuePtr object ATTRIBUTE_UNUSED,
                            bool pretty ATTRIBUTE_UNUSED)
 {
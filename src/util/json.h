@@ -25,6 +25,7 @@
 # define __VIR_JSON_H_
 
 # include "internal.h"
+# include "virhash.h"
 
 
 typedef enum {
@@ -57,6 +58,7 @@ struct _virJSONObjectPair {
 struct _virJSONObject {
     unsigned int npairs;
     virJSONObjectPairPtr pairs;
+    virHashTablePtr index; /* key -> value, built once an object grows large */
 };
 
 struct _virJSONArray {
@@ -96,6 +98,19 @@ int virJSONValueArrayAppend(virJSONValuePtr object, virJSONValuePtr value);
 
 int virJSONValueObjectHasKey(virJSONValuePtr object, const char *key);
 virJSONValuePtr virJSONValueObjectGet(virJSONValuePtr object, const char *key);
+int virJSONValueObjectRemoveKey(virJSONValuePtr object, const char *key,
+                                virJSONValuePtr *value);
+
+typedef struct _virJSONValueObjectField virJSONValueObjectField;
+typedef virJSONValueObjectField *virJSONValueObjectFieldPtr;
+struct _virJSONValueObjectField {
+    const char *key;
+    virJSONValuePtr value; /* filled in, NULL if @key is not present */
+};
+
+int virJSONValueObjectGetFields(virJSONValuePtr object,
+                                virJSONValueObjectFieldPtr fields,
+                                size_t nfields);
 
 int virJSONValueArraySize(virJSONValuePtr object);
 virJSONValuePtr virJSONValueArrayGet(virJSONValuePtr object, unsigned int element);
@@ -132,6 +147,16 @@ int virJSONValueObjectAppendBoolean(virJSONValuePtr object, const char *key, int
 int virJSONValueObjectAppendNull(virJSONValuePtr object, const char *key);
 
 virJSONValuePtr virJSONValueFromString(const char *jsonstring);
+
+/* Return false to drop the object member @key, which is
+ * enclosed by @depth containers, while parsing */
+typedef bool (*virJSONValueFilter)(const char *key,
+                                   unsigned int depth,
+                                   void *opaque);
+
+virJSONValuePtr virJSONValueFromStringFiltered(const char *jsonstring,
+                                               virJSONValueFilter filter,
+                                               void *opaque);
 char *virJSONValueToString(virJSONValuePtr object,
                            bool pretty);
 
@@ -36,6 +36,7 @@
 # include <syslog.h>
 #endif
 #include <sys/socket.h>
+#include <sys/uio.h>
 #if HAVE_SYS_UN_H
 # include <sys/un.h>
 #endif
@@ -115,8 +116,16 @@ static int virLogNbOutputs = 0;
  */
 static virLogPriority virLogDefaultPriority = VIR_LOG_DEFAULT;
 
+/*
+ * Bumped whenever the outcome of filtering may change, see
+ * virLogSiteEnabled(). Call sites start out with a state of 0
+ * so this must never be 0.
+ */
+int virLogSiteGeneration = 1;
+
 static int virLogResetFilters(void);
 static int virLogResetOutputs(void);
+static void virLogDiscardQueue(void);
 static void virLogOutputToFd(virLogSource src,
                              virLogPriority priority,
                              const char *filename,
@@ -130,24 +139,104 @@ static void virLogOutputToFd(virLogSource src,
                              void *data);
 
 /*
- * Logs accesses must be serialized though a mutex
+ * Messages waiting for the writer thread, see virLogStartWriter()
+ */
+typedef struct _virLogRecord virLogRecord;
+typedef virLogRecord *virLogRecordPtr;
+
+struct _virLogRecord {
+    virLogRecordPtr next;
+    virLogSource source;
+    virLogPriority priority;
+    const char *filename;
+    int linenr;
+    const char *funcname;
+    unsigned int flags;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    unsigned long long when; /* microseconds since the epoch */
+    int thread;
+    char *str;
+    char *msg;
+    char names[]; /* storage for filename and funcname */
+};
+
+static bool virLogAsync = false;
+static pid_t virLogWriterPid;
+static virThread virLogWriter;
+static virCond virLogWriterCond;
+static bool virLogWriterQuit = false;
+static virLogRecordPtr virLogQueue = NULL;
+static virLogRecordPtr *virLogQueueTail = &virLogQueue;
+static size_t virLogQueued = 0;
+static size_t virLogQueueMax = 0;
+static unsigned long long virLogDropped = 0;
+static unsigned long long virLogDroppedTotal = 0;
+
+/* Whether the version still needs logging when there are no outputs */
+static bool virLogVersionStderr = true;
+
+/* Most iovecs passed to one writev() by the writer thread */
+#define VIR_LOG_WRITEV_MAX 192
+
+/* The queued message being written by the writer thread, so that
+ * outputs recording the time and thread of their own can use the
+ * values from when it was logged. Protected by the output lock. */
+static virLogRecordPtr virLogEmitting = NULL;
+
+/*
+ * Logs accesses must be serialized though a mutex. The state lock
+ * covers the filters, the history buffer and the writer queue, and
+ * is only held briefly. The output lock is held while messages are
+ * written to the outputs, and is taken after the state lock.
  */
 virMutex virLogMutex;
+static virMutex virLogOutputMutex;
+
+static void
+virLogStateLock(void)
+{
+    virMutexLock(&virLogMutex);
+}
+
+
+static void
+virLogStateUnlock(void)
+{
+    virMutexUnlock(&virLogMutex);
+}
+
 
 void
 virLogLock(void)
 {
     virMutexLock(&virLogMutex);
+    virMutexLock(&virLogOutputMutex);
 }
 
 
 void
 virLogUnlock(void)
 {
+    virMutexUnlock(&virLogOutputMutex);
     virMutexUnlock(&virLogMutex);
 }
 
 
+/*
+ * Make all call sites recompute their cached filter decision.
+ * Called with the state lock held.
+ */
+static void
+virLogSiteInvalidate(void)
+{
+    int generation = virLogSiteGeneration + 1;
+
+    if (generation > (INT_MAX >> 3))
+        generation = 1;
+    virLogSiteGeneration = generation;
+}
+
+
 static const char *
 virLogOutputString(virLogDestination ldest)
 {
@@ -160,6 +249,8 @@ virLogOutputString(virLogDestination ldest)
         return "file";
     case VIR_LOG_TO_JOURNALD:
         return "journald";
+    case VIR_LOG_TO_TRACE:
+        return "trace";
     }
     return "unknown";
 }
@@ -187,7 +278,9 @@ virLogOnceInit(void)
 {
     const char *pbm = NULL;
 
-    if (virMutexInit(&virLogMutex) < 0)
+    if (virMutexInit(&virLogMutex) < 0 ||
+        virMutexInit(&virLogOutputMutex) < 0 ||
+        virCondInit(&virLogWriterCond) < 0)
         return -1;
 
     virLogLock();
@@ -209,6 +302,7 @@ virLogOnceInit(void)
     virLogStart = 0;
     virLogEnd = 0;
     virLogDefaultPriority = VIR_LOG_DEFAULT;
+    virLogSiteInvalidate();
     virLogUnlock();
     if (pbm)
         VIR_WARN("%s", pbm);
@@ -245,7 +339,7 @@ virLogSetBufferSize(int size)
     if (size * 1024 == virLogSize)
         return ret;
 
-    virLogLock();
+    virLogStateLock();
 
     oldsize = virLogSize;
     oldLogBuffer = virLogBuffer;
@@ -268,9 +362,10 @@ virLogSetBufferSize(int size)
     virLogLen = 0;
     virLogStart = 0;
     virLogEnd = 0;
+    virLogSiteInvalidate();
 
 error:
-    virLogUnlock();
+    virLogStateUnlock();
     if (pbm)
         VIR_ERROR(pbm, size);
     return ret;
@@ -291,12 +386,19 @@ virLogReset(void)
         return -1;
 
     virLogLock();
+    /* A child process does not inherit the writer thread, so
+     * anything it logs has to be written directly */
+    if (virLogAsync && getpid() != virLogWriterPid) {
+        virLogAsync = false;
+        virLogDiscardQueue();
+    }
     virLogResetFilters();
     virLogResetOutputs();
     virLogLen = 0;
     virLogStart = 0;
     virLogEnd = 0;
     virLogDefaultPriority = VIR_LOG_DEFAULT;
+    virLogSiteInvalidate();
     virLogUnlock();
     return 0;
 }
@@ -478,7 +580,10 @@ virLogSetDefaultPriority(virLogPriority priority)
     if (virLogInitialize() < 0)
         return -1;
 
+    virLogStateLock();
     virLogDefaultPriority = priority;
+    virLogSiteInvalidate();
+    virLogStateUnlock();
     return 0;
 }
 
@@ -530,7 +635,7 @@ virLogDefineFilter(const char *match,
         (priority > VIR_LOG_ERROR))
         return -1;
 
-    virLogLock();
+    virLogStateLock();
     for (i = 0;i < virLogNbFilters;i++) {
         if (STREQ(virLogFilters[i].match, match)) {
             virLogFilters[i].priority = priority;
@@ -554,7 +659,8 @@ virLogDefineFilter(const char *match,
     virLogFilters[i].flags = flags;
     virLogNbFilters++;
 cleanup:
-    virLogUnlock();
+    virLogSiteInvalidate();
+    virLogStateUnlock();
     return i;
 }
 
@@ -576,7 +682,7 @@ virLogFiltersCheck(const char *input,
     int ret = 0;
     int i;
 
-    virLogLock();
+    virLogStateLock();
     for (i = 0;i < virLogNbFilters;i++) {
         if (strstr(input, virLogFilters[i].match)) {
             ret = virLogFilters[i].priority;
@@ -584,11 +690,53 @@ virLogFiltersCheck(const char *input,
             break;
         }
     }
-    virLogUnlock();
+    virLogStateUnlock();
     return ret;
 }
 
 
+/**
+ * virLogSiteUpdate:
+ * @site: the cached state of a logging statement
+ * @filename: the file the statement is in
+ *
+ * Work out the lowest priority of the messages from @filename which
+ * virLogVMessage() would not throw away, and cache it in @site.
+ *
+ * Returns that priority
+ */
+virLogPriority
+virLogSiteUpdate(virLogSitePtr site,
+                 const char *filename)
+{
+    virLogPriority priority = 0;
+    int i;
+
+    /* Let virLogVMessage() deal with it */
+    if (virLogInitialize() < 0)
+        return VIR_LOG_DEBUG;
+
+    virLogStateLock();
+    for (i = 0; i < virLogNbFilters; i++) {
+        if (strstr(filename, virLogFilters[i].match)) {
+            priority = virLogFilters[i].priority;
+            break;
+        }
+    }
+    if (priority == 0)
+        priority = virLogDefaultPriority;
+
+    /* All messages are kept in the history buffer, if there is one */
+    if (virLogBuffer != NULL && virLogSize > 0)
+        priority = VIR_LOG_DEBUG;
+
+    site->state = (virLogSiteGeneration << 3) | priority;
+    virLogStateUnlock();
+
+    return priority;
+}
+
+
 /**
  * virLogResetOutputs:
  *
@@ -645,7 +793,8 @@ virLogDefineOutput(virLogOutputFunc f,
     if (f == NULL)
         return -1;
 
-    if (dest == VIR_LOG_TO_SYSLOG || dest == VIR_LOG_TO_FILE) {
+    if (dest == VIR_LOG_TO_SYSLOG || dest == VIR_LOG_TO_FILE ||
+        dest == VIR_LOG_TO_TRACE) {
         if (name == NULL)
             return -1;
         ndup = strdup(name);
@@ -755,6 +904,403 @@ virLogMessage(virLogSource source,
 }
 
 
+/*
+ * Log the version string to output @i, or to stderr if @i is -1.
+ * Called with the output lock held.
+ */
+static void
+virLogEmitVersion(int i, const char *timestamp)
+{
+    const char *rawver;
+    char *ver = NULL;
+
+    if (virLogVersionString(&rawver, &ver) >= 0) {
+        if (i < 0)
+            virLogOutputToFd(VIR_LOG_FROM_FILE, VIR_LOG_INFO,
+                             __FILE__, __LINE__, __func__,
+                             timestamp, NULL, 0, rawver, ver,
+                             (void *) STDERR_FILENO);
+        else
+            virLogOutputs[i].f(VIR_LOG_FROM_FILE, VIR_LOG_INFO,
+                               __FILE__, __LINE__, __func__,
+                               timestamp, NULL, 0, rawver, ver,
+                               virLogOutputs[i].data);
+    }
+    VIR_FREE(ver);
+
+    if (i < 0)
+        virLogVersionStderr = false;
+    else
+        virLogOutputs[i].logVersion = false;
+}
+
+
+/*
+ * Send a message to all outputs of a high enough priority, or
+ * to stderr if there are none. Called with the output lock held.
+ */
+static void
+virLogEmit(virLogSource source,
+           virLogPriority priority,
+           const char *filename,
+           int linenr,
+           const char *funcname,
+           const char *timestamp,
+           virLogMetadataPtr metadata,
+           unsigned int flags,
+           const char *str,
+           const char *msg)
+{
+    int i;
+
+    for (i = 0; i < virLogNbOutputs; i++) {
+        if (priority >= virLogOutputs[i].priority) {
+            if (virLogOutputs[i].logVersion)
+                virLogEmitVersion(i, timestamp);
+            virLogOutputs[i].f(source, priority,
+                               filename, linenr, funcname,
+                               timestamp, metadata, flags,
+                               str, msg, virLogOutputs[i].data);
+        }
+    }
+    if ((virLogNbOutputs == 0) && (source != VIR_LOG_FROM_ERROR)) {
+        if (virLogVersionStderr)
+            virLogEmitVersion(-1, timestamp);
+        virLogOutputToFd(source, priority,
+                         filename, linenr, funcname,
+                         timestamp, metadata, flags,
+                         str, msg, (void *) STDERR_FILENO);
+    }
+}
+
+
+static void
+virLogRecordFree(virLogRecordPtr rec)
+{
+    VIR_FREE(rec->str);
+    VIR_FREE(rec->msg);
+    VIR_FREE(rec);
+}
+
+
+/*
+ * Free all queued messages. Called with the state lock held.
+ */
+static void
+virLogDiscardQueue(void)
+{
+    while (virLogQueue) {
+        virLogRecordPtr rec = virLogQueue;
+        virLogQueue = rec->next;
+        virLogRecordFree(rec);
+    }
+    virLogQueueTail = &virLogQueue;
+    virLogQueued = 0;
+}
+
+
+/*
+ * Hand a message over to the writer thread, taking ownership of
+ * @str and @msg. Called with the state lock held, so this must not
+ * log anything itself.
+ *
+ * Returns 0 if the message was queued or dropped, -1 if the caller
+ * has to write it out itself
+ */
+static int
+virLogQueueMessage(virLogSource source,
+                   virLogPriority priority,
+                   const char *filename,
+                   int linenr,
+                   const char *funcname,
+                   const char *timestamp,
+                   unsigned int flags,
+                   char **str,
+                   char **msg)
+{
+    virLogRecordPtr rec;
+    struct timeval tv;
+    size_t filelen = strlen(filename) + 1;
+    size_t funclen = funcname ? strlen(funcname) + 1 : 0;
+    size_t size;
+
+    size = sizeof(*rec) + filelen + funclen +
+        strlen(*str) + strlen(*msg) + 2;
+
+    /* Warnings and errors are rare and too important to lose, so
+     * have the caller block on writing them instead */
+    if (virLogQueued + size > virLogQueueMax) {
+        if (priority >= VIR_LOG_WARN)
+            return -1;
+        virLogDropped++;
+        virLogDroppedTotal++;
+        return 0;
+    }
+
+    if (VIR_ALLOC_VAR(rec, char, filelen + funclen) < 0)
+        return -1;
+
+    rec->source = source;
+    rec->priority = priority;
+    rec->filename = memcpy(rec->names, filename, filelen);
+    rec->linenr = linenr;
+    if (funcname)
+        rec->funcname = memcpy(rec->names + filelen, funcname, funclen);
+    rec->flags = flags;
+    ignore_value(virStrcpyStatic(rec->timestamp, timestamp));
+    if (gettimeofday(&tv, NULL) == 0)
+        rec->when = tv.tv_sec * 1000000ULL + tv.tv_usec;
+    rec->thread = virThreadSelfID();
+    rec->str = *str;
+    rec->msg = *msg;
+    *str = *msg = NULL;
+
+    *virLogQueueTail = rec;
+    virLogQueueTail = &rec->next;
+    virLogQueued += size;
+    virCondSignal(&virLogWriterCond);
+    return 0;
+}
+
+
+/*
+ * Write @iov to @fd, carrying on after partial writes
+ */
+static void
+virLogWritevAll(int fd, struct iovec *iov, int niov)
+{
+    while (niov > 0) {
+        ssize_t done = writev(fd, iov, niov);
+
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        while (niov > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            niov--;
+        }
+        if (niov > 0) {
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+}
+
+
+/*
+ * Write all messages of @batch which are at least of @priority to
+ * @fd, in the same format as virLogOutputToFd() but with as few
+ * system calls as possible
+ */
+static void
+virLogOutputBatchToFd(int fd,
+                      virLogRecordPtr batch,
+                      virLogPriority priority,
+                      bool skipErrors)
+{
+    static char sep[] = ": ";
+    struct iovec iov[VIR_LOG_WRITEV_MAX];
+    int niov = 0;
+    virLogRecordPtr rec;
+
+    if (fd < 0)
+        return;
+
+    for (rec = batch; rec; rec = rec->next) {
+        if (rec->priority < priority ||
+            (skipErrors && rec->source == VIR_LOG_FROM_ERROR))
+            continue;
+
+        if (niov + 3 > ARRAY_CARDINALITY(iov)) {
+            virLogWritevAll(fd, iov, niov);
+            niov = 0;
+        }
+        iov[niov].iov_base = rec->timestamp;
+        iov[niov++].iov_len = strlen(rec->timestamp);
+        iov[niov].iov_base = sep;
+        iov[niov++].iov_len = strlen(sep);
+        iov[niov].iov_base = rec->msg;
+        iov[niov++].iov_len = strlen(rec->msg);
+    }
+
+    if (niov)
+        virLogWritevAll(fd, iov, niov);
+}
+
+
+/*
+ * Send a batch of queued messages to the outputs. Called with the
+ * output lock held.
+ */
+static void
+virLogEmitBatch(virLogRecordPtr batch)
+{
+    virLogRecordPtr rec;
+    int i;
+
+    /* Messages for file descriptors are written in one go below,
+     * all other outputs get them one by one */
+    for (rec = batch; rec; rec = rec->next) {
+        for (i = 0; i < virLogNbOutputs; i++) {
+            if (rec->priority < virLogOutputs[i].priority)
+                continue;
+            if (virLogOutputs[i].logVersion)
+                virLogEmitVersion(i, rec->timestamp);
+            if (virLogOutputs[i].f != virLogOutputToFd) {
+                virLogEmitting = rec;
+                virLogOutputs[i].f(rec->source, rec->priority,
+                                   rec->filename, rec->linenr, rec->funcname,
+                                   rec->timestamp, NULL, rec->flags,
+                                   rec->str, rec->msg,
+                                   virLogOutputs[i].data);
+                virLogEmitting = NULL;
+            }
+        }
+    }
+
+    for (i = 0; i < virLogNbOutputs; i++) {
+        if (virLogOutputs[i].f == virLogOutputToFd)
+            virLogOutputBatchToFd((intptr_t) virLogOutputs[i].data, batch,
+                                  virLogOutputs[i].priority, false);
+    }
+    if (virLogNbOutputs == 0) {
+        if (virLogVersionStderr)
+            virLogEmitVersion(-1, batch->timestamp);
+        virLogOutputBatchToFd(STDERR_FILENO, batch, VIR_LOG_DEBUG, true);
+    }
+}
+
+
+static void
+virLogWriterMain(void *opaque ATTRIBUTE_UNUSED)
+{
+    virLogStateLock();
+    for (;;) {
+        virLogRecordPtr batch;
+        unsigned long long dropped;
+        unsigned long long droppedTotal;
+
+        while (!virLogQueue && !virLogDropped && !virLogWriterQuit)
+            ignore_value(virCondWait(&virLogWriterCond, &virLogMutex));
+
+        if (!virLogQueue && !virLogDropped)
+            break;
+
+        batch = virLogQueue;
+        virLogQueue = NULL;
+        virLogQueueTail = &virLogQueue;
+        virLogQueued = 0;
+        dropped = virLogDropped;
+        droppedTotal = virLogDroppedTotal;
+        virLogDropped = 0;
+        virLogStateUnlock();
+
+        virMutexLock(&virLogOutputMutex);
+        virLogEmitBatch(batch);
+        if (dropped) {
+            char timestamp[VIR_TIME_STRING_BUFLEN];
+            char *str = NULL;
+            char *msg = NULL;
+
+            if (virTimeStringNowRaw(timestamp) < 0)
+                timestamp[0] = '\0';
+            if (virAsprintf(&str, "Dropped %llu log messages (%llu in total) "
+                            "because they were logged faster than they "
+                            "could be written", dropped, droppedTotal) >= 0 &&
+                virLogFormatString(&msg, __LINE__, __func__,
+                                   VIR_LOG_WARN, str) >= 0)
+                virLogEmit(VIR_LOG_FROM_FILE, VIR_LOG_WARN,
+                           __FILE__, __LINE__, __func__,
+                           timestamp, NULL, 0, str, msg);
+            VIR_FREE(str);
+            VIR_FREE(msg);
+        }
+        virMutexUnlock(&virLogOutputMutex);
+
+        while (batch) {
+            virLogRecordPtr rec = batch;
+            batch = rec->next;
+            virLogRecordFree(rec);
+        }
+
+        virLogStateLock();
+    }
+    virLogStateUnlock();
+}
+
+
+/**
+ * virLogStartWriter:
+ * @maxQueued: most bytes of messages to queue
+ *
+ * Have a separate thread write messages to the outputs, so that
+ * threads logging a message only need to queue it. Once @maxQueued
+ * bytes are waiting to be written, further debug and info messages
+ * are dropped and warnings and errors are written directly. Messages
+ * requesting a stack trace are also written directly, and so may
+ * get ahead of messages that are still queued.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+virLogStartWriter(size_t maxQueued)
+{
+    int ret = -1;
+
+    if (virLogInitialize() < 0)
+        return -1;
+
+    virLogStateLock();
+    if (virLogAsync) {
+        virLogQueueMax = maxQueued;
+        ret = 0;
+        goto cleanup;
+    }
+
+    virLogWriterQuit = false;
+    virLogQueueMax = maxQueued;
+    if (virThreadCreate(&virLogWriter, true, virLogWriterMain, NULL) < 0)
+        goto cleanup;
+    virLogWriterPid = getpid();
+    virLogAsync = true;
+    ret = 0;
+
+cleanup:
+    virLogStateUnlock();
+    return ret;
+}
+
+
+/**
+ * virLogStopWriter:
+ *
+ * Write out all queued messages and stop the thread started by
+ * virLogStartWriter(). Messages are written directly again afterwards.
+ */
+void
+virLogStopWriter(void)
+{
+    if (virLogInitialize() < 0)
+        return;
+
+    virLogStateLock();
+    if (!virLogAsync) {
+        virLogStateUnlock();
+        return;
+    }
+    virLogAsync = false;
+    virLogWriterQuit = true;
+    virCondSignal(&virLogWriterCond);
+    virLogStateUnlock();
+
+    virThreadJoin(&virLogWriter);
+}
+
+
 /**
  * virLogVMessage:
  * @source: where is that message coming from
@@ -779,11 +1325,11 @@ virLogVMessage(virLogSource source,
                const char *fmt,
                va_list vargs)
 {
-    static bool logVersionStderr = true;
     char *str = NULL;
     char *msg = NULL;
     char timestamp[VIR_TIME_STRING_BUFLEN];
-    int fprio, i, ret;
+    int fprio, ret;
+    bool queued = false;
     int saved_errno = errno;
     int emit = 1;
     unsigned int filterflags = 0;
@@ -827,53 +1373,26 @@ virLogVMessage(virLogSource source,
      * then if emit push the message on the outputs defined, if none
      * use stderr.
      * NOTE: the locking is a single point of contention for multiple
-     *       threads, but avoid intermixing. Maybe set up locks per output
-     *       to improve paralellism.
+     *       threads, but avoid intermixing. With a writer thread the
+     *       lock is only held to queue the message, the writer does
+     *       the I/O without blocking the logging threads.
      */
-    virLogLock();
+    virLogStateLock();
     virLogStr(timestamp);
     virLogStr(msg);
-    virLogUnlock();
-    if (emit == 0)
+    if (emit && virLogAsync && !metadata &&
+        !(filterflags & VIR_LOG_STACK_TRACE))
+        queued = virLogQueueMessage(source, priority,
+                                    filename, linenr, funcname,
+                                    timestamp, filterflags,
+                                    &str, &msg) == 0;
+    virLogStateUnlock();
+    if (emit == 0 || queued)
         goto cleanup;
 
     virLogLock();
-    for (i = 0; i < virLogNbOutputs; i++) {
-        if (priority >= virLogOutputs[i].priority) {
-            if (virLogOutputs[i].logVersion) {
-                const char *rawver;
-                char *ver = NULL;
-                if (virLogVersionString(&rawver, &ver) >= 0)
-                    virLogOutputs[i].f(VIR_LOG_FROM_FILE, VIR_LOG_INFO,
-                                       __FILE__, __LINE__, __func__,
-                                       timestamp, NULL, 0, rawver, ver,
-                                       virLogOutputs[i].data);
-                VIR_FREE(ver);
-                virLogOutputs[i].logVersion = false;
-            }
-            virLogOutputs[i].f(source, priority,
-                               filename, linenr, funcname,
-                               timestamp, metadata, filterflags,
-                               str, msg, virLogOutputs[i].data);
-        }
-    }
-    if ((virLogNbOutputs == 0) && (source != VIR_LOG_FROM_ERROR)) {
-        if (logVersionStderr) {
-            const char *rawver;
-            char *ver = NULL;
-            if (virLogVersionString(&rawver, &ver) >= 0)
-                virLogOutputToFd(VIR_LOG_FROM_FILE, VIR_LOG_INFO,
-                                 __FILE__, __LINE__, __func__,
-                                 timestamp, NULL, 0, rawver, ver,
-                                 (void *) STDERR_FILENO);
-            VIR_FREE(ver);
-            logVersionStderr = false;
-        }
-        virLogOutputToFd(source, priority,
-                         filename, linenr, funcname,
-                         timestamp, metadata, filterflags,
-                         str, msg, (void *) STDERR_FILENO);
-    }
+    virLogEmit(source, priority, filename, linenr, funcname,
+               timestamp, metadata, filterflags, str, msg);
     virLogUnlock();
 
 cleanup:
@@ -971,6 +1490,213 @@ virLogAddOutputToFile(virLogPriority priority,
 }
 
 
+/*
+ * State of a binary trace output. File and function names are
+ * interned in an open addressing hash table so that each message
+ * only carries their IDs. This is used with the output lock held,
+ * so it must not log anything, which rules out virHash.
+ */
+typedef struct _virLogTrace virLogTrace;
+typedef virLogTrace *virLogTracePtr;
+struct _virLogTrace {
+    int fd;
+    size_t nstrings;
+    size_t nslots; /* power of two */
+    char **slots;
+    uint32_t *ids;
+};
+
+
+static uint32_t
+virLogTraceHash(const char *str)
+{
+    uint32_t hash = 2166136261U;
+
+    while (*str) {
+        hash ^= (unsigned char) *str++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+
+static size_t
+virLogTraceSlot(char **slots, size_t nslots, const char *str)
+{
+    size_t i = virLogTraceHash(str) & (nslots - 1);
+
+    while (slots[i] && STRNEQ(slots[i], str))
+        i = (i + 1) & (nslots - 1);
+    return i;
+}
+
+
+static int
+virLogTraceGrow(virLogTracePtr trace)
+{
+    size_t nslots = trace->nslots ? trace->nslots * 2 : 256;
+    char **slots;
+    uint32_t *ids;
+    size_t i;
+
+    if (VIR_ALLOC_N(slots, nslots) < 0)
+        return -1;
+    if (VIR_ALLOC_N(ids, nslots) < 0) {
+        VIR_FREE(slots);
+        return -1;
+    }
+
+    for (i = 0; i < trace->nslots; i++) {
+        if (trace->slots[i]) {
+            size_t j = virLogTraceSlot(slots, nslots, trace->slots[i]);
+            slots[j] = trace->slots[i];
+            ids[j] = trace->ids[i];
+        }
+    }
+
+    VIR_FREE(trace->slots);
+    VIR_FREE(trace->ids);
+    trace->slots = slots;
+    trace->ids = ids;
+    trace->nslots = nslots;
+    return 0;
+}
+
+
+/*
+ * Look up the ID of @str, writing a string record for it first if
+ * it has not been seen yet. Returns 0 if @str could not be interned.
+ */
+static uint32_t
+virLogTraceIntern(virLogTracePtr trace, const char *str)
+{
+    virLogTraceRecord hdr;
+    virLogTraceString rec;
+    struct iovec iov[3];
+    size_t len;
+    size_t i;
+
+    if (!str)
+        return 0;
+
+    if (trace->nstrings >= trace->nslots / 2 &&
+        virLogTraceGrow(trace) < 0)
+        return 0;
+
+    i = virLogTraceSlot(trace->slots, trace->nslots, str);
+    if (trace->slots[i])
+        return trace->ids[i];
+
+    if (!(trace->slots[i] = strdup(str)))
+        return 0;
+    trace->ids[i] = ++trace->nstrings;
+
+    len = strlen(str);
+    hdr.type = VIR_LOG_TRACE_RECORD_STRING;
+    hdr.length = sizeof(rec) + len;
+    rec.id = trace->ids[i];
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = &rec;
+    iov[1].iov_len = sizeof(rec);
+    iov[2].iov_base = (char *) str;
+    iov[2].iov_len = len;
+    virLogWritevAll(trace->fd, iov, ARRAY_CARDINALITY(iov));
+
+    return trace->ids[i];
+}
+
+
+static void
+virLogOutputToTrace(virLogSource source,
+                    virLogPriority priority,
+                    const char *filename,
+                    int linenr,
+                    const char *funcname,
+                    const char *timestamp ATTRIBUTE_UNUSED,
+                    virLogMetadataPtr metadata ATTRIBUTE_UNUSED,
+                    unsigned int flags ATTRIBUTE_UNUSED,
+                    const char *rawstr,
+                    const char *str ATTRIBUTE_UNUSED,
+                    void *data)
+{
+    virLogTracePtr trace = data;
+    virLogTraceRecord hdr;
+    virLogTraceMessage rec;
+    struct iovec iov[3];
+    size_t len = strlen(rawstr);
+
+    memset(&rec, 0, sizeof(rec));
+    if (virLogEmitting) {
+        rec.usec = virLogEmitting->when;
+        rec.thread = virLogEmitting->thread;
+    } else {
+        struct timeval tv;
+
+        if (gettimeofday(&tv, NULL) == 0)
+            rec.usec = tv.tv_sec * 1000000ULL + tv.tv_usec;
+        rec.thread = virThreadSelfID();
+    }
+    rec.file = virLogTraceIntern(trace, filename);
+    rec.func = virLogTraceIntern(trace, funcname);
+    rec.line = linenr;
+    rec.priority = priority;
+    rec.source = source;
+
+    /* Drop any trailing newline, the decoder adds its own */
+    if (len && rawstr[len - 1] == '\n')
+        len--;
+
+    hdr.type = VIR_LOG_TRACE_RECORD_MESSAGE;
+    hdr.length = sizeof(rec) + len;
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = &rec;
+    iov[1].iov_len = sizeof(rec);
+    iov[2].iov_base = (char *) rawstr;
+    iov[2].iov_len = len;
+    virLogWritevAll(trace->fd, iov, ARRAY_CARDINALITY(iov));
+}
+
+
+static void
+virLogCloseTrace(void *data)
+{
+    virLogTracePtr trace = data;
+    size_t i;
+
+    for (i = 0; i < trace->nslots; i++)
+        VIR_FREE(trace->slots[i]);
+    VIR_FREE(trace->slots);
+    VIR_FREE(trace->ids);
+    VIR_LOG_CLOSE(trace->fd);
+    VIR_FREE(trace);
+}
+
+
+static int
+virLogAddOutputToTrace(virLogPriority priority,
+                       const char *file)
+{
+    virLogTracePtr trace;
+
+    if (VIR_ALLOC(trace) < 0)
+        return -1;
+
+    trace->fd = open(file, O_CREAT | O_APPEND | O_WRONLY, S_IRUSR | S_IWUSR);
+    if (trace->fd < 0 ||
+        safewrite(trace->fd, VIR_LOG_TRACE_MAGIC,
+                  VIR_LOG_TRACE_MAGIC_LEN) != VIR_LOG_TRACE_MAGIC_LEN ||
+        virLogDefineOutput(virLogOutputToTrace, virLogCloseTrace, trace,
+                           priority, VIR_LOG_TO_TRACE, file, 0) < 0) {
+        VIR_FORCE_CLOSE(trace->fd);
+        VIR_FREE(trace);
+        return -1;
+    }
+    return 0;
+}
+
+
 #if HAVE_SYSLOG_H
 static int
 virLogPrioritySyslog(virLogPriority priority)
@@ -1260,6 +1986,9 @@ static int virLogAddOutputToJournald(int priority)
  *       use syslog for the output and use the given name as the ident
  *    x:file:file_path
  *       output to a file, with the given filepath
+ *    x:trace:file_path
+ *       output to a file in the binary trace format, to be read
+ *       with virt-trace-decode
  * In all case the x prefix is the minimal level, acting as a filter
  *    0: everything
  *    1: DEBUG
@@ -1338,6 +2067,27 @@ virLogParseOutputs(const char *outputs)
                 count++;
             VIR_FREE(name);
             VIR_FREE(abspath);
+        } else if (STREQLEN(cur, "trace", 5)) {
+            cur += 5;
+            if (*cur != ':')
+                goto cleanup;
+            cur++;
+            str = cur;
+            while ((*cur != 0) && (!IS_SPACE(cur)))
+                cur++;
+            if (str == cur)
+                goto cleanup;
+            name = strndup(str, cur - str);
+            if (name == NULL)
+                goto cleanup;
+            if (virFileAbsPath(name, &abspath) < 0) {
+                VIR_FREE(name);
+                return -1; /* skip warning here because setting was fine */
+            }
+            if (virLogAddOutputToTrace(prio, abspath) == 0)
+                count++;
+            VIR_FREE(name);
+            VIR_FREE(abspath);
         } else if (STREQLEN(cur, "journald", 8)) {
             cur += 8;
 #if USE_JOURNALD
@@ -1446,7 +2196,7 @@ virLogGetFilters(void)
     int i;
     virBuffer filterbuf = VIR_BUFFER_INITIALIZER;
 
-    virLogLock();
+    virLogStateLock();
     for (i = 0; i < virLogNbFilters; i++) {
         const char *sep = ":";
         if (virLogFilters[i].flags & VIR_LOG_STACK_TRACE)
@@ -1456,7 +2206,7 @@ virLogGetFilters(void)
                           sep,
                           virLogFilters[i].match);
     }
-    virLogUnlock();
+    virLogStateUnlock();
 
     if (virBufferError(&filterbuf)) {
         virBufferFreeAndReset(&filterbuf);
@@ -1488,6 +2238,7 @@ virLogGetOutputs(void)
         switch (dest) {
             case VIR_LOG_TO_SYSLOG:
             case VIR_LOG_TO_FILE:
+            case VIR_LOG_TO_TRACE:
                 virBufferAsprintf(&outputbuf, "%d:%s:%s",
                                   virLogOutputs[i].priority,
                                   virLogOutputString(dest),
@@ -25,6 +25,8 @@
 # include "internal.h"
 # include "buf.h"
 
+# include <stdint.h>
+
 /*
  * To be made public
  */
@@ -42,6 +44,7 @@ typedef enum {
     VIR_LOG_TO_SYSLOG,
     VIR_LOG_TO_FILE,
     VIR_LOG_TO_JOURNALD,
+    VIR_LOG_TO_TRACE,
 } virLogDestination;
 
 typedef enum {
@@ -54,6 +57,53 @@ typedef enum {
     VIR_LOG_FROM_LAST,
 } virLogSource;
 
+/*
+ * Binary trace output format
+ *
+ * A trace file is a sequence of records, each a virLogTraceRecord
+ * header followed by 'length' bytes of payload, all in host byte
+ * order. Every time the output is opened VIR_LOG_TRACE_MAGIC is
+ * written first; it starts a new string table, so string IDs are
+ * only valid up to the next magic.
+ *
+ * VIR_LOG_TRACE_RECORD_STRING payload is a virLogTraceString
+ * followed by the string bytes, not NUL terminated. It is written
+ * before the first message referring to the string.
+ *
+ * VIR_LOG_TRACE_RECORD_MESSAGE payload is a virLogTraceMessage
+ * followed by the unformatted message text.
+ */
+# define VIR_LOG_TRACE_MAGIC "LVTRACE1"
+# define VIR_LOG_TRACE_MAGIC_LEN 8
+
+enum {
+    VIR_LOG_TRACE_RECORD_STRING = 1,
+    VIR_LOG_TRACE_RECORD_MESSAGE,
+};
+
+typedef struct _virLogTraceRecord virLogTraceRecord;
+struct _virLogTraceRecord {
+    uint32_t type;
+    uint32_t length;
+};
+
+typedef struct _virLogTraceString virLogTraceString;
+struct _virLogTraceString {
+    uint32_t id;
+};
+
+typedef struct _virLogTraceMessage virLogTraceMessage;
+struct _virLogTraceMessage {
+    uint64_t usec;      /* microseconds since the epoch */
+    uint32_t thread;
+    uint32_t file;      /* string ID */
+    uint32_t func;      /* string ID, 0 if unknown */
+    uint32_t line;
+    uint8_t priority;   /* virLogPriority */
+    uint8_t source;     /* virLogSource */
+    uint8_t padding[6];
+};
+
 /*
  * If configured with --enable-debug=yes then library calls
  * are printed to stderr for debugging or to an appropriate channel
@@ -84,14 +134,60 @@ static inline void virLogEatParams(virLogSource unused, ...)
 # define VIR_ERROR_INT(src, filename, linenr, funcname, ...)            \
     virLogMessage(src, VIR_LOG_ERROR, filename, linenr, funcname, NULL, __VA_ARGS__)
 
-# define VIR_DEBUG(...)                                                 \
+/*
+ * Each VIR_DEBUG, VIR_INFO, VIR_WARN and VIR_ERROR statement caches
+ * the lowest priority that is logged from its file, so that a
+ * statement which is filtered out costs a single comparison and does
+ * not even evaluate its arguments. The cache is keyed by a generation
+ * counter which is bumped whenever the filters, the default priority
+ * or the history buffer change.
+ *
+ * The generation and the priority are packed into one int so that
+ * a racing update can't mix the two up.
+ */
+typedef struct _virLogSite virLogSite;
+typedef virLogSite *virLogSitePtr;
+struct _virLogSite {
+    int state;                  /* generation << 3 | priority */
+};
+
+extern int virLogSiteGeneration;
+extern virLogPriority virLogSiteUpdate(virLogSitePtr site,
+                                       const char *filename);
+
+static inline bool
+virLogSiteEnabled(virLogSitePtr site,
+                  virLogPriority priority,
+                  const char *filename)
+{
+    int state = site->state;
+
+    if ((state >> 3) == virLogSiteGeneration)
+        return priority >= (state & 7);
+    return priority >= virLogSiteUpdate(site, filename);
+}
+
+# define VIR_LOG_SITE(INT, priority, ...)                               \
+    do {                                                                \
+        static virLogSite virLogSiteLocal;                              \
+        if (virLogSiteEnabled(&virLogSiteLocal, priority, __FILE__))    \
+            INT(VIR_LOG_FROM_FILE, __FILE__, __LINE__, __func__,        \
+                __VA_ARGS__);                                           \
+    } while (0)
+
+# ifdef ENABLE_DEBUG
+#  define VIR_DEBUG(...)                                                \
+    VIR_LOG_SITE(VIR_DEBUG_INT, VIR_LOG_DEBUG, __VA_ARGS__)
+# else
+#  define VIR_DEBUG(...)                                                \
     VIR_DEBUG_INT(VIR_LOG_FROM_FILE, __FILE__, __LINE__, __func__, __VA_ARGS__)
+# endif
 # define VIR_INFO(...)                                                  \
-    VIR_INFO_INT(VIR_LOG_FROM_FILE, __FILE__, __LINE__, __func__, __VA_ARGS__)
+    VIR_LOG_SITE(VIR_INFO_INT, VIR_LOG_INFO, __VA_ARGS__)
 # define VIR_WARN(...)                                                  \
-    VIR_WARN_INT(VIR_LOG_FROM_FILE, __FILE__, __LINE__, __func__, __VA_ARGS__)
+    VIR_LOG_SITE(VIR_WARN_INT, VIR_LOG_WARN, __VA_ARGS__)
 # define VIR_ERROR(...)                                                 \
-    VIR_ERROR_INT(VIR_LOG_FROM_FILE, __FILE__, __LINE__, __func__, __VA_ARGS__)
+    VIR_LOG_SITE(VIR_ERROR_INT, VIR_LOG_ERROR, __VA_ARGS__)
 
 
 struct _virLogMetadata {
@@ -187,5 +283,7 @@ extern void virLogVMessage(virLogSource src,
                            const char *fmt,
                            va_list vargs) ATTRIBUTE_FMT_PRINTF(7, 0);
 extern int virLogSetBufferSize(int size);
+extern int virLogStartWriter(size_t maxQueued);
+extern void virLogStopWriter(void);
 extern void virLogEmergencyDumpAll(int signum);
 #endif
@@ -39,6 +39,8 @@
 #include "command.h"
 #include "virterror_internal.h"
 #include "virfile.h"
+#include "virhash.h"
+#include "threads.h"
 
 #define PCI_SYSFS "/sys/bus/pci/"
 #define PCI_ID_LEN 10   /* "XXXX XXXX" */
@@ -74,6 +76,7 @@ struct _pciDevice {
 struct _pciDeviceList {
     unsigned count;
     pciDevice **devs;
+    virHashTablePtr hash;   /* dev->name -> pciDevice */
 };
 
 
@@ -814,6 +817,120 @@ cleanup:
 }
 
 
+/* Devices sharing a bus are reset one after another, as a secondary
+ * bus reset of one of them affects all the others.
+ */
+typedef struct _pciResetBus pciResetBus;
+struct _pciResetBus {
+    unsigned domain;
+    unsigned bus;
+    pciDevice **devs;
+    size_t ndevs;
+    pciDeviceList *activeDevs;
+    pciDeviceList *inactiveDevs;
+    virThread thread;
+    bool threaded;
+    virErrorPtr err;
+};
+
+static void
+pciResetBusDevices(void *opaque)
+{
+    pciResetBus *bus = opaque;
+    size_t i;
+
+    for (i = 0; i < bus->ndevs; i++) {
+        if (pciResetDevice(bus->devs[i],
+                           bus->activeDevs, bus->inactiveDevs) < 0) {
+            if (!bus->err)
+                bus->err = virSaveLastError();
+            virResetLastError();
+        }
+    }
+}
+
+/*
+ * Reset all the devices of @list. A device reset may take several
+ * hundred milliseconds, so the devices of each bus are reset by their
+ * own thread. Every device is tried even if some fail; returns -1 with
+ * the first error reported in that case.
+ */
+int
+pciResetDeviceList(pciDeviceList *list,
+                   pciDeviceList *activeDevs,
+                   pciDeviceList *inactiveDevs)
+{
+    pciResetBus *buses = NULL;
+    size_t nbuses = 0;
+    size_t i, j;
+    int ret = -1;
+
+    for (i = 0; i < list->count; i++) {
+        pciDevice *dev = list->devs[i];
+
+        for (j = 0; j < nbuses; j++) {
+            if (buses[j].domain == dev->domain &&
+                buses[j].bus == dev->bus)
+                break;
+        }
+
+        if (j == nbuses) {
+            if (VIR_EXPAND_N(buses, nbuses, 1) < 0)
+                goto no_memory;
+            buses[j].domain = dev->domain;
+            buses[j].bus = dev->bus;
+            buses[j].activeDevs = activeDevs;
+            buses[j].inactiveDevs = inactiveDevs;
+        }
+
+        if (VIR_EXPAND_N(buses[j].devs, buses[j].ndevs, 1) < 0)
+            goto no_memory;
+        buses[j].devs[buses[j].ndevs - 1] = dev;
+    }
+
+    /* The first bus is handled by this thread */
+    for (i = 1; i < nbuses; i++) {
+        if (virThreadCreate(&buses[i].thread, true,
+                            pciResetBusDevices, &buses[i]) < 0)
+            VIR_WARN("Unable to create a thread to reset PCI bus %.4x:%.2x",
+                     buses[i].domain, buses[i].bus);
+        else
+            buses[i].threaded = true;
+    }
+
+    if (nbuses)
+        pciResetBusDevices(&buses[0]);
+
+    for (i = 1; i < nbuses; i++) {
+        if (buses[i].threaded)
+            virThreadJoin(&buses[i].thread);
+        else
+            pciResetBusDevices(&buses[i]);
+    }
+
+    ret = 0;
+    for (i = 0; i < nbuses; i++) {
+        if (buses[i].err) {
+            if (ret == 0)
+                virSetError(buses[i].err);
+            ret = -1;
+        }
+    }
+
+cleanup:
+    for (i = 0; i < nbuses; i++) {
+        VIR_FREE(buses[i].devs);
+        virFreeError(buses[i].err);
+    }
+    VIR_FREE(buses);
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    goto cleanup;
+}
+
+
 static int
 pciDriverDir(char **buffer, const char *driver)
 {
@@ -1530,6 +1647,11 @@ pciDeviceListNew(void)
         return NULL;
     }
 
+    if (!(list->hash = virHashCreate(16, NULL))) {
+        VIR_FREE(list);
+        return NULL;
+    }
+
     return list;
 }
 
@@ -1548,6 +1670,7 @@ pciDeviceListFree(pciDeviceList *list)
 
     list->count = 0;
     VIR_FREE(list->devs);
+    virHashFree(list->hash);
     VIR_FREE(list);
 }
 
@@ -1566,6 +1689,9 @@ pciDeviceListAdd(pciDeviceList *list,
         return -1;
     }
 
+    if (virHashAddEntry(list->hash, dev->name, dev) < 0)
+        return -1;
+
     list->devs[list->count++] = dev;
 
     return 0;
@@ -1599,6 +1725,7 @@ pciDeviceListStealIndex(pciDeviceList *list,
         return NULL;
 
     ret = list->devs[idx];
+    virHashRemoveEntry(list->hash, ret->name);
 
     if (idx != --list->count) {
         memmove(&list->devs[idx],
@@ -1632,13 +1759,16 @@ pciDeviceListDel(pciDeviceList *list,
 int
 pciDeviceListFindIndex(pciDeviceList *list, pciDevice *dev)
 {
+    pciDevice *found;
     int i;
 
+    /* The name encodes domain:bus:slot.function, so the hash
+     * answers the common "not in this list" case directly */
+    if (!(found = virHashLookup(list->hash, dev->name)))
+        return -1;
+
     for (i = 0; i < list->count; i++)
-        if (list->devs[i]->domain   == dev->domain &&
-            list->devs[i]->bus      == dev->bus    &&
-            list->devs[i]->slot     == dev->slot   &&
-            list->devs[i]->function == dev->function)
+        if (list->devs[i] == found)
             return i;
     return -1;
 }
@@ -1646,12 +1776,7 @@ pciDeviceListFindIndex(pciDeviceList *list, pciDevice *dev)
 pciDevice *
 pciDeviceListFind(pciDeviceList *list, pciDevice *dev)
 {
-    int i;
-
-    if ((i = pciDeviceListFindIndex(list, dev)) >= 0)
-        return list->devs[i];
-    else
-        return NULL;
+    return virHashLookup(list->hash, dev->name);
 }
 
 
@@ -49,6 +49,9 @@ int        pciReAttachDevice (pciDevice     *dev,
 int        pciResetDevice    (pciDevice     *dev,
                               pciDeviceList *activeDevs,
                               pciDeviceList *inactiveDevs);
+int        pciResetDeviceList(pciDeviceList *list,
+                              pciDeviceList *activeDevs,
+                              pciDeviceList *inactiveDevs);
 void      pciDeviceSetManaged(pciDevice     *dev,
                               unsigned       managed);
 unsigned  pciDeviceGetManaged(pciDevice     *dev);
@@ -23,9 +23,13 @@
 
 #include <stdlib.h>
 #include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "processinfo.h"
 #include "virterror_internal.h"
+#include "virfile.h"
+#include "util.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -187,3 +191,121 @@ int virProcessInfoGetAffinity(pid_t pid ATTRIBUTE_UNUSED,
     return -1;
 }
 #endif /* HAVE_SCHED_GETAFFINITY */
+
+
+#ifdef __linux__
+
+/* Read the file @name of the thread directory @taskfd points to, which
+ * is small enough to fit @buf. Returns -1 if the thread is gone. */
+static int
+virProcessInfoReadTaskFile(int taskfd, int tid, const char *name,
+                           char *buf, size_t buflen)
+{
+    char path[64];
+    ssize_t len;
+    int fd;
+
+    snprintf(path, sizeof(path), "%d/%s", tid, name);
+    if ((fd = openat(taskfd, path, O_RDONLY)) < 0)
+        return -1;
+
+    len = saferead(fd, buf, buflen - 1);
+    VIR_FORCE_CLOSE(fd);
+    if (len < 0)
+        return -1;
+    buf[len] = '\0';
+
+    return 0;
+}
+
+/**
+ * virProcessInfoGetThreadStats:
+ * @pid: process the threads belong to
+ * @tids: threads to look at
+ * @ntids: number of @tids
+ * @stats: array of @ntids entries to fill in
+ *
+ * Collect the statistics of the @tids of @pid, opening the task
+ * directory of @pid only once for all of them. Threads which are
+ * gone, as happens when the process is shutting down, are reported
+ * with zeroed statistics.
+ *
+ * Returns 0 on success, -1 with an error reported on failure.
+ */
+int virProcessInfoGetThreadStats(pid_t pid,
+                                 const int *tids,
+                                 size_t ntids,
+                                 virProcessInfoThreadStatsPtr stats)
+{
+    unsigned long long tick = sysconf(_SC_CLK_TCK);
+    char path[64];
+    char buf[1024];
+    int taskfd;
+    size_t i;
+
+    memset(stats, 0, sizeof(*stats) * ntids);
+
+    snprintf(path, sizeof(path), "/proc/%d/task", (int) pid);
+    if ((taskfd = open(path, O_RDONLY | O_DIRECTORY)) < 0) {
+        /* VM probably shut down, so fake 0 */
+        return 0;
+    }
+
+    for (i = 0; i < ntids; i++) {
+        unsigned long long usertime, systime;
+        unsigned long long runtime, waittime;
+        const char *fields;
+        int cpu;
+
+        stats[i].tid = tids[i];
+
+        if (virProcessInfoReadTaskFile(taskfd, tids[i], "stat",
+                                       buf, sizeof(buf)) < 0)
+            continue;
+
+        /* The thread name may contain anything, so start after it. See
+         * 'man proc' for what these fields are. */
+        if (!(fields = strrchr(buf, ')')) ||
+            sscanf(fields + 1,
+                   /* state -> stime */
+                   " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu"
+                   /* cutime -> endcode */
+                   "%*d %*d %*d %*d %*d %*d %*u %*u %*d %*u %*u %*u"
+                   /* startstack -> processor */
+                   "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d",
+                   &usertime, &systime, &cpu) != 3) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("cannot parse status of thread %d"), tids[i]);
+            VIR_FORCE_CLOSE(taskfd);
+            return -1;
+        }
+
+        /* Jiffies to nanoseconds */
+        stats[i].cpuTime = 1000ull * 1000ull * 1000ull *
+            (usertime + systime) / tick;
+        stats[i].lastCpu = cpu;
+
+        /* Time spent runnable but waiting for a host CPU, which the
+         * guest sees as steal time; not every kernel keeps it */
+        if (virProcessInfoReadTaskFile(taskfd, tids[i], "schedstat",
+                                       buf, sizeof(buf)) == 0 &&
+            sscanf(buf, "%llu %llu", &runtime, &waittime) == 2)
+            stats[i].waitTime = waittime;
+    }
+
+    VIR_FORCE_CLOSE(taskfd);
+    return 0;
+}
+
+#else /* !__linux__ */
+
+int virProcessInfoGetThreadStats(pid_t pid ATTRIBUTE_UNUSED,
+                                 const int *tids ATTRIBUTE_UNUSED,
+                                 size_t ntids ATTRIBUTE_UNUSED,
+                                 virProcessInfoThreadStatsPtr stats ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Thread statistics are not supported on this platform"));
+    return -1;
+}
+#endif /* !__linux__ */
@@ -31,4 +31,18 @@ int virProcessInfoGetAffinity(pid_t pid,
                               virBitmapPtr *map,
                               int maxcpu);
 
+typedef struct _virProcessInfoThreadStats virProcessInfoThreadStats;
+typedef virProcessInfoThreadStats *virProcessInfoThreadStatsPtr;
+struct _virProcessInfoThreadStats {
+    int tid;
+    unsigned long long cpuTime;  /* user + system time in nanoseconds */
+    unsigned long long waitTime; /* nanoseconds spent waiting to run */
+    int lastCpu;                 /* physical CPU the thread last ran on */
+};
+
+int virProcessInfoGetThreadStats(pid_t pid,
+                                 const int *tids,
+                                 size_t ntids,
+                                 virProcessInfoThreadStatsPtr stats);
+
 #endif /* __VIR_PROCESSINFO_H__ */
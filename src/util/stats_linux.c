@@ -38,6 +38,13 @@
 # include "stats_linux.h"
 # include "memory.h"
 # include "virfile.h"
+# include "virhash.h"
+
+# ifdef HAVE_LIBNL
+#  include <linux/rtnetlink.h>
+#  include "virnetlink.h"
+#  include "virnetdev.h"
+# endif
 
 # define VIR_FROM_THIS VIR_FROM_STATS_LINUX
 
@@ -46,15 +53,207 @@
 /* Just reads the named interface, so not Xen or QEMU-specific.
  * NB. Caller must check that libvirt user is trying to query
  * the interface of a domain they own.  We do no such checking.
+ *
+ * IMPORTANT NOTE!
+ * The host sees the network of vif<domid>.nn / vnetN from the point
+ * of view of dom0 / hypervisor.  So bytes TRANSMITTED by dom0 are
+ * bytes RECEIVED by the domain.  That's why the TX/RX fields appear
+ * to be swapped in here.
  */
 
+# ifdef HAVE_LIBNL
+/* The kernel counts missed packets apart, /proc/net/dev adds them to
+ * the dropped ones; do the same */
+#  define LINUX_IFSTATS_FROM_LINK(stats, link)                         \
+    do {                                                               \
+        (stats)->rx_bytes = (link)->tx_bytes;                          \
+        (stats)->rx_packets = (link)->tx_packets;                      \
+        (stats)->rx_errs = (link)->tx_errors;                          \
+        (stats)->rx_drop = (link)->tx_dropped;                         \
+        (stats)->tx_bytes = (link)->rx_bytes;                          \
+        (stats)->tx_packets = (link)->rx_packets;                      \
+        (stats)->tx_errs = (link)->rx_errors;                          \
+        (stats)->tx_drop = (link)->rx_dropped + (link)->rx_missed_errors; \
+    } while (0)
+
+static int
+linuxInterfaceStatsFromLink(struct nlattr **tb,
+                            struct _virDomainInterfaceStats *stats)
+{
+#  if HAVE_DECL_IFLA_STATS64
+    if (tb[IFLA_STATS64] &&
+        nla_len(tb[IFLA_STATS64]) >= sizeof(struct rtnl_link_stats64)) {
+        struct rtnl_link_stats64 link;
+
+        memcpy(&link, nla_data(tb[IFLA_STATS64]), sizeof(link));
+        LINUX_IFSTATS_FROM_LINK(stats, &link);
+        return 0;
+    }
+#  endif
+
+    if (tb[IFLA_STATS] &&
+        nla_len(tb[IFLA_STATS]) >= sizeof(struct rtnl_link_stats)) {
+        struct rtnl_link_stats link;
+
+        memcpy(&link, nla_data(tb[IFLA_STATS]), sizeof(link));
+        LINUX_IFSTATS_FROM_LINK(stats, &link);
+        return 0;
+    }
+
+    return -1;
+}
+
+/* Ask the kernel for the counters of the interface @path alone, which
+ * unlike /proc/net/dev does not cost more the more interfaces exist. */
+static int
+linuxDomainInterfaceStatsNetlink(const char *path,
+                                 struct _virDomainInterfaceStats *stats)
+{
+    struct nlattr *tb[IFLA_MAX + 1] = { NULL, };
+    unsigned char *recvbuf = NULL;
+    int ret = -1;
+
+    if (virNetDevLinkDump(path, -1, tb, &recvbuf, 0, 0) < 0)
+        goto cleanup;
+
+    ret = linuxInterfaceStatsFromLink(tb, stats);
+
+cleanup:
+    VIR_FREE(recvbuf);
+    return ret;
+}
+
+static int
+linuxDomainInterfaceStatsAllCallback(const struct nlmsghdr *resp,
+                                     void *opaque)
+{
+    virHashTablePtr table = opaque;
+    struct nlattr *tb[IFLA_MAX + 1] = { NULL, };
+    struct _virDomainInterfaceStats *stats;
+    const char *ifname;
+
+    if (resp->nlmsg_type != RTM_NEWLINK)
+        return 0;
+
+    if (nlmsg_parse((struct nlmsghdr *)resp, sizeof(struct ifinfomsg),
+                    tb, IFLA_MAX, NULL) < 0 ||
+        !tb[IFLA_IFNAME])
+        return 0;
+    ifname = nla_data(tb[IFLA_IFNAME]);
+
+    if (VIR_ALLOC(stats) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (linuxInterfaceStatsFromLink(tb, stats) < 0) {
+        VIR_FREE(stats);
+        return 0;
+    }
+
+    if (virHashUpdateEntry(table, ifname, stats) < 0) {
+        VIR_FREE(stats);
+        return -1;
+    }
+
+    return 0;
+}
+
+static virHashTablePtr
+linuxDomainInterfaceStatsAllNetlink(void)
+{
+    virHashTablePtr table = NULL;
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nl_msg *nl_msg;
+
+    if (!(nl_msg = nlmsg_alloc_simple(RTM_GETLINK, NLM_F_REQUEST))) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        goto error;
+    }
+
+    if (!(table = virHashCreate(64, (virHashDataFree) free)))
+        goto error;
+
+    if (virNetlinkDumpCommand(nl_msg, linuxDomainInterfaceStatsAllCallback,
+                              table, NETLINK_ROUTE) < 0)
+        goto error;
+
+    nlmsg_free(nl_msg);
+    return table;
+
+error:
+    virHashFree(table);
+    nlmsg_free(nl_msg);
+    return NULL;
+}
+# endif /* HAVE_LIBNL */
+
+/* Parse one @line of /proc/net/dev, returning the interface name it
+ * is about, or NULL if it is a header line. @line is modified. */
+static const char *
+linuxParseProcNetDevLine(char *line,
+                         struct _virDomainInterfaceStats *stats)
+{
+    long long dummy;
+    long long rx_bytes;
+    long long rx_packets;
+    long long rx_errs;
+    long long rx_drop;
+    long long tx_bytes;
+    long long tx_packets;
+    long long tx_errs;
+    long long tx_drop;
+    char *colon;
+
+    /* The line looks like:
+     *   "   eth0:..."
+     * Split it at the colon.
+     */
+    if (!(colon = strchr(line, ':')))
+        return NULL;
+    *colon = '\0';
+
+    if (sscanf(colon+1,
+               "%lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld",
+               &tx_bytes, &tx_packets, &tx_errs, &tx_drop,
+               &dummy, &dummy, &dummy, &dummy,
+               &rx_bytes, &rx_packets, &rx_errs, &rx_drop,
+               &dummy, &dummy, &dummy, &dummy) != 16)
+        return NULL;
+
+    stats->rx_bytes = rx_bytes;
+    stats->rx_packets = rx_packets;
+    stats->rx_errs = rx_errs;
+    stats->rx_drop = rx_drop;
+    stats->tx_bytes = tx_bytes;
+    stats->tx_packets = tx_packets;
+    stats->tx_errs = tx_errs;
+    stats->tx_drop = tx_drop;
+
+    line += strspn(line, " \t");
+    return line;
+}
+
 int
 linuxDomainInterfaceStats(const char *path,
                           struct _virDomainInterfaceStats *stats)
 {
-    int path_len;
     FILE *fp;
-    char line[256], *colon;
+    char line[256];
+
+# ifdef HAVE_LIBNL
+    if (linuxDomainInterfaceStatsNetlink(path, stats) == 0)
+        return 0;
+    /* Netlink may be unusable here, /proc/net/dev will report any
+     * real problem */
+    virResetLastError();
+# endif
 
     fp = fopen("/proc/net/dev", "r");
     if (!fp) {
@@ -63,52 +262,12 @@ linuxDomainInterfaceStats(const char *path,
         return -1;
     }
 
-    path_len = strlen(path);
-
     while (fgets(line, sizeof(line), fp)) {
-        long long dummy;
-        long long rx_bytes;
-        long long rx_packets;
-        long long rx_errs;
-        long long rx_drop;
-        long long tx_bytes;
-        long long tx_packets;
-        long long tx_errs;
-        long long tx_drop;
-
-        /* The line looks like:
-         *   "   eth0:..."
-         * Split it at the colon.
-         */
-        colon = strchr(line, ':');
-        if (!colon) continue;
-        *colon = '\0';
-        if (colon-path_len >= line &&
-            STREQ(colon-path_len, path)) {
-            /* IMPORTANT NOTE!
-             * /proc/net/dev vif<domid>.nn sees the network from the point
-             * of view of dom0 / hypervisor.  So bytes TRANSMITTED by dom0
-             * are bytes RECEIVED by the domain.  That's why the TX/RX fields
-             * appear to be swapped here.
-             */
-            if (sscanf(colon+1,
-                       "%lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld %lld",
-                       &tx_bytes, &tx_packets, &tx_errs, &tx_drop,
-                       &dummy, &dummy, &dummy, &dummy,
-                       &rx_bytes, &rx_packets, &rx_errs, &rx_drop,
-                       &dummy, &dummy, &dummy, &dummy) != 16)
-                continue;
-
-            stats->rx_bytes = rx_bytes;
-            stats->rx_packets = rx_packets;
-            stats->rx_errs = rx_errs;
-            stats->rx_drop = rx_drop;
-            stats->tx_bytes = tx_bytes;
-            stats->tx_packets = tx_packets;
-            stats->tx_errs = tx_errs;
-            stats->tx_drop = tx_drop;
-            VIR_FORCE_FCLOSE(fp);
+        const char *ifname;
 
+        if ((ifname = linuxParseProcNetDevLine(line, stats)) &&
+            STREQ(ifname, path)) {
+            VIR_FORCE_FCLOSE(fp);
             return 0;
         }
     }
@@ -119,4 +278,66 @@ linuxDomainInterfaceStats(const char *path,
     return -1;
 }
 
+/**
+ * linuxDomainInterfaceStatsAll:
+ *
+ * Fetch the counters of all host interfaces at once, for callers which
+ * need those of many interfaces.
+ *
+ * Returns a hash table of struct _virDomainInterfaceStats keyed by
+ * interface name, or NULL with an error reported.
+ */
+virHashTablePtr
+linuxDomainInterfaceStatsAll(void)
+{
+    virHashTablePtr table = NULL;
+    FILE *fp;
+    char line[256];
+
+# ifdef HAVE_LIBNL
+    if ((table = linuxDomainInterfaceStatsAllNetlink()))
+        return table;
+    virResetLastError();
+# endif
+
+    fp = fopen("/proc/net/dev", "r");
+    if (!fp) {
+        virReportSystemError(errno, "%s",
+                             _("Could not open /proc/net/dev"));
+        return NULL;
+    }
+
+    if (!(table = virHashCreate(64, (virHashDataFree) free)))
+        goto cleanup;
+
+    while (fgets(line, sizeof(line), fp)) {
+        struct _virDomainInterfaceStats stats;
+        struct _virDomainInterfaceStats *entry;
+        const char *ifname;
+
+        if (!(ifname = linuxParseProcNetDevLine(line, &stats)))
+            continue;
+
+        if (VIR_ALLOC(entry) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+        *entry = stats;
+
+        if (virHashUpdateEntry(table, ifname, entry) < 0) {
+            VIR_FREE(entry);
+            goto error;
+        }
+    }
+
+cleanup:
+    VIR_FORCE_FCLOSE(fp);
+    return table;
+
+error:
+    virHashFree(table);
+    table = NULL;
+    goto cleanup;
+}
+
 #endif /* __linux__ */
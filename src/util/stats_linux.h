@@ -26,10 +26,13 @@
 # ifdef __linux__
 
 #  include "internal.h"
+#  include "virhash.h"
 
 extern int linuxDomainInterfaceStats(const char *path,
                                      struct _virDomainInterfaceStats *stats);
 
+extern virHashTablePtr linuxDomainInterfaceStatsAll(void);
+
 # endif /* __linux__ */
 
 #endif /* __STATS_LINUX_H__ */
@@ -42,6 +42,8 @@
 #include "virfile.h"
 #include "c-ctype.h"
 #include "virhash.h"
+#include "threads.h"
+#include "stat-time.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -966,6 +968,177 @@ cleanup:
     return ret;
 }
 
+/* The headers of image files that did not change since they were last
+ * read are taken from this cache, so that the base images shared by
+ * many domains are not reopened and parsed again every time the backing
+ * chain of one of them is looked up.  Entries are keyed by path, since
+ * relative backing store names are resolved against it, and are only
+ * trusted while the identity, size and timestamps of the file stay the
+ * same.  Only regular files are cached, writing to a block device does
+ * not touch the timestamps of its node.  */
+#define VIR_STORAGE_FILE_CACHE_MAX 1024
+
+typedef struct _virStorageFileCacheEntry virStorageFileCacheEntry;
+typedef virStorageFileCacheEntry *virStorageFileCacheEntryPtr;
+struct _virStorageFileCacheEntry {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+    int format; /* format the header was parsed as */
+    virStorageFileMetadataPtr meta; /* without backingMeta */
+};
+
+static virMutex virStorageFileCacheMutex;
+static virHashTablePtr virStorageFileCacheTable;
+
+static void
+virStorageFileCacheEntryFree(void *payload,
+                             const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageFileCacheEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    virStorageFileFreeMetadata(entry->meta);
+    VIR_FREE(entry);
+}
+
+static int
+virStorageFileCacheOnceInit(void)
+{
+    if (virMutexInit(&virStorageFileCacheMutex) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize mutex"));
+        return -1;
+    }
+
+    if (!(virStorageFileCacheTable =
+          virHashCreate(64, virStorageFileCacheEntryFree)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virStorageFileCache)
+
+/* Copy @src, without the metadata of its backing store */
+static virStorageFileMetadataPtr
+virStorageFileCopyMetadata(virStorageFileMetadataPtr src)
+{
+    virStorageFileMetadataPtr ret;
+
+    if (VIR_ALLOC(ret) < 0)
+        goto no_memory;
+
+    if ((src->backingStore &&
+         !(ret->backingStore = strdup(src->backingStore))) ||
+        (src->backingStoreRaw &&
+         !(ret->backingStoreRaw = strdup(src->backingStoreRaw))))
+        goto no_memory;
+
+    ret->backingStoreFormat = src->backingStoreFormat;
+    ret->backingStoreIsFile = src->backingStoreIsFile;
+    ret->capacity = src->capacity;
+    ret->encrypted = src->encrypted;
+
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    virStorageFileFreeMetadata(ret);
+    return NULL;
+}
+
+static bool
+virStorageFileCacheEntryMatches(virStorageFileCacheEntryPtr entry,
+                                const struct stat *sb,
+                                int format)
+{
+    struct timespec mtime = get_stat_mtime(sb);
+    struct timespec ctime = get_stat_ctime(sb);
+
+    return entry->format == format &&
+        entry->dev == sb->st_dev &&
+        entry->ino == sb->st_ino &&
+        entry->size == sb->st_size &&
+        entry->mtime.tv_sec == mtime.tv_sec &&
+        entry->mtime.tv_nsec == mtime.tv_nsec &&
+        entry->ctime.tv_sec == ctime.tv_sec &&
+        entry->ctime.tv_nsec == ctime.tv_nsec;
+}
+
+/*
+ * Look up the header of @path, as it is described by @sb, in the cache.
+ *
+ * Returns 1 and a copy of it in @meta if found, 0 if it has to be
+ * read, -1 on error.
+ */
+static int
+virStorageFileCacheLookup(const char *path,
+                          int format,
+                          const struct stat *sb,
+                          virStorageFileMetadataPtr *meta)
+{
+    virStorageFileCacheEntryPtr entry;
+    int ret = 0;
+
+    *meta = NULL;
+
+    virMutexLock(&virStorageFileCacheMutex);
+    entry = virHashLookup(virStorageFileCacheTable, path);
+    if (entry && virStorageFileCacheEntryMatches(entry, sb, format)) {
+        if ((*meta = virStorageFileCopyMetadata(entry->meta)))
+            ret = 1;
+        else
+            ret = -1;
+    }
+    virMutexUnlock(&virStorageFileCacheMutex);
+
+    if (ret == 1)
+        VIR_DEBUG("using cached metadata of '%s'", path);
+
+    return ret;
+}
+
+/* Remember @meta as the header of @path, read while @sb described it.
+ * Failing to do so is not an error, the header is read again next
+ * time.  */
+static void
+virStorageFileCacheStore(const char *path,
+                         int format,
+                         const struct stat *sb,
+                         virStorageFileMetadataPtr meta)
+{
+    virStorageFileCacheEntryPtr entry;
+
+    if (VIR_ALLOC(entry) < 0 ||
+        !(entry->meta = virStorageFileCopyMetadata(meta))) {
+        virResetLastError();
+        VIR_FREE(entry);
+        return;
+    }
+
+    entry->dev = sb->st_dev;
+    entry->ino = sb->st_ino;
+    entry->size = sb->st_size;
+    entry->mtime = get_stat_mtime(sb);
+    entry->ctime = get_stat_ctime(sb);
+    entry->format = format;
+
+    virMutexLock(&virStorageFileCacheMutex);
+    if (virHashSize(virStorageFileCacheTable) >= VIR_STORAGE_FILE_CACHE_MAX &&
+        !virHashLookup(virStorageFileCacheTable, path))
+        virHashRemoveAll(virStorageFileCacheTable);
+    if (virHashUpdateEntry(virStorageFileCacheTable, path, entry) < 0) {
+        virResetLastError();
+        virStorageFileCacheEntryFree(entry, NULL);
+    }
+    virMutexUnlock(&virStorageFileCacheMutex);
+}
+
 /* Recursive workhorse for virStorageFileGetMetadata.  */
 static virStorageFileMetadataPtr
 virStorageFileGetMetadataRecurse(const char *path, int format,
@@ -973,6 +1146,8 @@ virStorageFileGetMetadataRecurse(const char *path, int format,
                                  bool allow_probe, virHashTablePtr cycle)
 {
     int fd;
+    struct stat sb;
+    int cached = 0;
     VIR_DEBUG("path=%s format=%d uid=%d gid=%d probe=%d",
               path, format, (int)uid, (int)gid, allow_probe);
 
@@ -987,15 +1162,34 @@ virStorageFileGetMetadataRecurse(const char *path, int format,
     if (virHashAddEntry(cycle, path, (void *)1) < 0)
         return NULL;
 
-    if ((fd = virFileOpenAs(path, O_RDONLY, 0, uid, gid, 0)) < 0) {
-        virReportSystemError(-fd, _("cannot open file '%s'"), path);
+    if (virStorageFileCacheInitialize() < 0)
         return NULL;
-    }
 
-    ret = virStorageFileGetMetadataFromFD(path, fd, format);
+    /* A file we cannot stat, such as one on root squashed NFS, is
+     * simply not looked up in the cache */
+    if (stat(path, &sb) == 0 && S_ISREG(sb.st_mode) &&
+        (cached = virStorageFileCacheLookup(path, format, &sb, &ret)) < 0)
+        return NULL;
+
+    if (!cached) {
+        if ((fd = virFileOpenAs(path, O_RDONLY, 0, uid, gid, 0)) < 0) {
+            virReportSystemError(-fd, _("cannot open file '%s'"), path);
+            return NULL;
+        }
+
+        /* Stat the file before reading it: a change that happens in
+         * between leaves an entry that the next lookup won't match */
+        if (fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode))
+            sb.st_mode = 0;
+
+        ret = virStorageFileGetMetadataFromFD(path, fd, format);
 
-    if (VIR_CLOSE(fd) < 0)
-        VIR_WARN("could not close file %s", path);
+        if (ret && sb.st_mode)
+            virStorageFileCacheStore(path, format, &sb, ret);
+
+        if (VIR_CLOSE(fd) < 0)
+            VIR_WARN("could not close file %s", path);
+    }
 
     if (ret && ret->backingStoreIsFile) {
         if (ret->backingStoreFormat == VIR_STORAGE_FILE_AUTO && !allow_probe)
@@ -36,6 +36,7 @@
 #include "logging.h"
 #include "memory.h"
 #include "command.h"
+#include "virfile.h"
 
 #define VIR_FROM_THIS VIR_FROM_SYSINFO
 
@@ -756,26 +757,34 @@ no_memory:
     return -1;
 }
 
-virSysinfoDefPtr
-virSysinfoRead(void) {
+static int
+virSysinfoRunDecoder(char **outbuf)
+{
     char *path;
-    virSysinfoDefPtr ret = NULL;
-    char *outbuf = NULL;
     virCommandPtr cmd;
+    int ret;
 
     path = virFindFileInPath(SYSINFO_SMBIOS_DECODER);
     if (path == NULL) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Failed to find path for %s binary"),
                        SYSINFO_SMBIOS_DECODER);
-        return NULL;
+        return -1;
     }
 
     cmd = virCommandNewArgList(path, "-q", "-t", "0,1,4,17", NULL);
     VIR_FREE(path);
-    virCommandSetOutputBuffer(cmd, &outbuf);
-    if (virCommandRun(cmd, NULL) < 0)
-        goto cleanup;
+    virCommandSetOutputBuffer(cmd, outbuf);
+    ret = virCommandRun(cmd, NULL);
+    virCommandFree(cmd);
+
+    return ret;
+}
+
+static virSysinfoDefPtr
+virSysinfoParseSMBIOS(const char *outbuf)
+{
+    virSysinfoDefPtr ret = NULL;
 
     if (VIR_ALLOC(ret) < 0)
         goto no_memory;
@@ -798,21 +807,163 @@ virSysinfoRead(void) {
     if (virSysinfoParseMemory(outbuf, ret) < 0)
         goto no_memory;
 
-cleanup:
-    VIR_FREE(outbuf);
-    virCommandFree(cmd);
-
     return ret;
 
 no_memory:
     virReportOOMError();
 
     virSysinfoDefFree(ret);
-    ret = NULL;
-    goto cleanup;
+    return NULL;
+}
+
+virSysinfoDefPtr
+virSysinfoRead(void) {
+    virSysinfoDefPtr ret = NULL;
+    char *outbuf = NULL;
+
+    if (virSysinfoRunDecoder(&outbuf) == 0)
+        ret = virSysinfoParseSMBIOS(outbuf);
+
+    VIR_FREE(outbuf);
+    return ret;
+}
+
+# define SYSINFO_SMBIOS_CACHE 1
+# define SYSINFO_CACHE_MAX (1024 * 1024)
+
+static const char *sysinfoCacheFiles[] = {
+    "/sys/class/dmi/id/bios_vendor",
+    "/sys/class/dmi/id/bios_version",
+    "/sys/class/dmi/id/bios_date",
+    "/sys/class/dmi/id/product_uuid",
+    "/sys/devices/system/cpu/present",
+};
+
+/*
+ * Build the signature a cached dmidecode output must carry to be
+ * reused: the decoder binary, the firmware identity exposed in sysfs,
+ * the set of CPUs and the amount of RAM. Returns NULL, without
+ * reporting an error, if the host gives us nothing cheap to check.
+ */
+static char *
+virSysinfoCacheSignature(void)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *path = NULL;
+    char *data = NULL;
+    struct stat sb;
+    size_t i;
+
+    if (!(path = virFindFileInPath(SYSINFO_SMBIOS_DECODER)) ||
+        stat(path, &sb) < 0)
+        goto error;
+
+    virBufferAsprintf(&buf, "decoder %s %lld %lld\n", path,
+                      (long long)sb.st_mtime, (long long)sb.st_size);
+
+    for (i = 0; i < ARRAY_CARDINALITY(sysinfoCacheFiles); i++) {
+        if (!virFileExists(sysinfoCacheFiles[i])) {
+            virBufferAsprintf(&buf, "%s -\n", sysinfoCacheFiles[i]);
+            continue;
+        }
+        if (virFileReadAll(sysinfoCacheFiles[i], 1024, &data) < 0) {
+            virResetLastError();
+            goto error;
+        }
+        virBufferAsprintf(&buf, "%s %s", sysinfoCacheFiles[i], data);
+        VIR_FREE(data);
+    }
+
+    virBufferAsprintf(&buf, "pages %ld\n", sysconf(_SC_PHYS_PAGES));
+
+    VIR_FREE(path);
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        return NULL;
+    }
+    return virBufferContentAndReset(&buf);
+
+error:
+    VIR_FREE(path);
+    VIR_FREE(data);
+    virBufferFreeAndReset(&buf);
+    return NULL;
+}
+
+static int
+virSysinfoCacheWrite(int fd, void *opaque)
+{
+    const char *data = opaque;
+
+    if (safewrite(fd, data, strlen(data)) < 0)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * virSysinfoReadCached:
+ * @cachePath: file to keep the decoder output in, or NULL
+ *
+ * Like virSysinfoRead, but reuses the decoder output stored in
+ * @cachePath by a previous call if the host still looks the same,
+ * which saves running dmidecode each time the daemon starts. The
+ * cache is refreshed whenever the decoder has to be run.
+ */
+virSysinfoDefPtr
+virSysinfoReadCached(const char *cachePath)
+{
+    virSysinfoDefPtr ret = NULL;
+    char *signature = NULL;
+    char *cached = NULL;
+    char *outbuf = NULL;
+    char *data = NULL;
+    const char *tmp;
+
+    if (!cachePath || !(signature = virSysinfoCacheSignature()))
+        return virSysinfoRead();
+
+    if (virFileExists(cachePath)) {
+        if (virFileReadAll(cachePath, SYSINFO_CACHE_MAX, &cached) < 0)
+            virResetLastError();
+        else if ((tmp = STRSKIP(cached, signature)) && *tmp == '\n')
+            ret = virSysinfoParseSMBIOS(tmp + 1);
+
+        if (ret) {
+            VIR_DEBUG("Using host sysinfo cached in %s", cachePath);
+            goto cleanup;
+        }
+        VIR_DEBUG("Host sysinfo cached in %s is stale", cachePath);
+    }
+
+    if (virSysinfoRunDecoder(&outbuf) < 0 ||
+        !(ret = virSysinfoParseSMBIOS(outbuf)))
+        goto cleanup;
+
+    if (virAsprintf(&data, "%s\n%s", signature, outbuf) < 0 ||
+        virFileRewrite(cachePath, S_IRUSR | S_IWUSR,
+                       virSysinfoCacheWrite, data) < 0) {
+        VIR_WARN("Unable to cache host sysinfo in %s", cachePath);
+        virResetLastError();
+    }
+
+cleanup:
+    VIR_FREE(signature);
+    VIR_FREE(cached);
+    VIR_FREE(outbuf);
+    VIR_FREE(data);
+    return ret;
 }
 #endif /* !WIN32 && x86 */
 
+#ifndef SYSINFO_SMBIOS_CACHE
+virSysinfoDefPtr
+virSysinfoReadCached(const char *cachePath ATTRIBUTE_UNUSED)
+{
+    return virSysinfoRead();
+}
+#endif
+
 static void
 virSysinfoBIOSFormat(virBufferPtr buf, virSysinfoDefPtr def)
 {
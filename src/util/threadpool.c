@@ -29,17 +29,29 @@
 #include "memory.h"
 #include "threads.h"
 #include "virterror_internal.h"
+#include "virtime.h"
+#include "util.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
 typedef struct _virThreadPoolJob virThreadPoolJob;
 typedef virThreadPoolJob *virThreadPoolJobPtr;
 
+typedef struct _virThreadPoolGroup virThreadPoolGroup;
+typedef virThreadPoolGroup *virThreadPoolGroupPtr;
+
 struct _virThreadPoolJob {
     virThreadPoolJobPtr prev;
     virThreadPoolJobPtr next;
     unsigned int priority;
 
+    /* position within the queue of its group */
+    virThreadPoolGroupPtr group;
+    virThreadPoolJobPtr groupPrev;
+    virThreadPoolJobPtr groupNext;
+
+    unsigned long long queued;  /* time of submission, in ms */
+
     void *data;
 };
 
@@ -52,6 +64,25 @@ struct _virThreadPoolJobList {
     virThreadPoolJobPtr firstPrio;
 };
 
+/* The pending jobs of one submitter, eg. one RPC client. Groups with
+ * pending jobs form a ring which the workers serve round robin, so that
+ * a submitter queueing many jobs can't delay those of the others. */
+struct _virThreadPoolGroup {
+    const void *key;
+    virThreadPoolJobPtr head;
+    virThreadPoolJobPtr tail;
+
+    virThreadPoolGroupPtr prev;
+    virThreadPoolGroupPtr next;
+};
+
+typedef struct _virThreadPoolGroupRing virThreadPoolGroupRing;
+struct _virThreadPoolGroupRing {
+    virThreadPoolGroupPtr head;
+    virThreadPoolGroupPtr tail;
+    size_t count;
+};
+
 
 struct _virThreadPool {
     bool quit;
@@ -59,8 +90,14 @@ struct _virThreadPool {
     virThreadPoolJobFunc jobFunc;
     void *jobOpaque;
     virThreadPoolJobList jobList;
+    virThreadPoolGroupRing groups;
     size_t jobQueueDepth;
 
+    /* statistics */
+    unsigned long long jobsDone;
+    unsigned long long jobWaitTotal;
+    unsigned long long jobWaitMax;
+
     virMutex mutex;
     virCond cond;
     virCond quit_cond;
@@ -82,6 +119,93 @@ struct virThreadPoolWorkerData {
     bool priority;
 };
 
+
+static virThreadPoolGroupPtr
+virThreadPoolGroupFind(virThreadPoolPtr pool, const void *key)
+{
+    virThreadPoolGroupPtr group;
+
+    for (group = pool->groups.head; group; group = group->next) {
+        if (group->key == key)
+            return group;
+    }
+    return NULL;
+}
+
+static void
+virThreadPoolGroupAppend(virThreadPoolPtr pool, virThreadPoolGroupPtr group)
+{
+    group->next = NULL;
+    group->prev = pool->groups.tail;
+    if (pool->groups.tail)
+        pool->groups.tail->next = group;
+    else
+        pool->groups.head = group;
+    pool->groups.tail = group;
+    pool->groups.count++;
+}
+
+static void
+virThreadPoolGroupUnlink(virThreadPoolPtr pool, virThreadPoolGroupPtr group)
+{
+    if (group->prev)
+        group->prev->next = group->next;
+    else
+        pool->groups.head = group->next;
+    if (group->next)
+        group->next->prev = group->prev;
+    else
+        pool->groups.tail = group->prev;
+    group->prev = group->next = NULL;
+    pool->groups.count--;
+}
+
+/* Take @job off all queues; the pool mutex must be held */
+static void
+virThreadPoolJobUnlink(virThreadPoolPtr pool, virThreadPoolJobPtr job)
+{
+    virThreadPoolGroupPtr group = job->group;
+
+    if (job == pool->jobList.firstPrio) {
+        virThreadPoolJobPtr tmp = job->next;
+        while (tmp) {
+            if (tmp->priority) {
+                break;
+            }
+            tmp = tmp->next;
+        }
+        pool->jobList.firstPrio = tmp;
+    }
+
+    if (job->prev)
+        job->prev->next = job->next;
+    else
+        pool->jobList.head = job->next;
+    if (job->next)
+        job->next->prev = job->prev;
+    else
+        pool->jobList.tail = job->prev;
+
+    if (job->groupPrev)
+        job->groupPrev->groupNext = job->groupNext;
+    else
+        group->head = job->groupNext;
+    if (job->groupNext)
+        job->groupNext->groupPrev = job->groupPrev;
+    else
+        group->tail = job->groupPrev;
+
+    virThreadPoolGroupUnlink(pool, group);
+    if (group->head) {
+        /* the group was just served, so it goes to the back */
+        virThreadPoolGroupAppend(pool, group);
+    } else {
+        VIR_FREE(group);
+    }
+
+    pool->jobQueueDepth--;
+}
+
 static void virThreadPoolWorker(void *opaque)
 {
     struct virThreadPoolWorkerData *data = opaque;
@@ -89,6 +213,7 @@ static void virThreadPoolWorker(void *opaque)
     virCondPtr cond = data->cond;
     bool priority = data->priority;
     virThreadPoolJobPtr job = NULL;
+    unsigned long long now;
 
     VIR_FREE(data);
 
@@ -115,35 +240,23 @@ static void virThreadPoolWorker(void *opaque)
         if (priority) {
             job = pool->jobList.firstPrio;
         } else {
-            job = pool->jobList.head;
-        }
-
-        if (job == pool->jobList.firstPrio) {
-            virThreadPoolJobPtr tmp = job->next;
-            while (tmp) {
-                if (tmp->priority) {
-                    break;
-                }
-                tmp = tmp->next;
-            }
-            pool->jobList.firstPrio = tmp;
+            job = pool->groups.head->head;
         }
 
-        if (job->prev)
-            job->prev->next = job->next;
-        else
-            pool->jobList.head = job->next;
-        if (job->next)
-            job->next->prev = job->prev;
-        else
-            pool->jobList.tail = job->prev;
+        virThreadPoolJobUnlink(pool, job);
 
-        pool->jobQueueDepth--;
+        if (virTimeMillisNow(&now) == 0 && now > job->queued) {
+            now -= job->queued;
+            pool->jobWaitTotal += now;
+            if (now > pool->jobWaitMax)
+                pool->jobWaitMax = now;
+        }
 
         virMutexUnlock(&pool->mutex);
         (pool->jobFunc)(job->data, pool->jobOpaque);
         VIR_FREE(job);
         virMutexLock(&pool->mutex);
+        pool->jobsDone++;
     }
 
 out:
@@ -264,7 +377,7 @@ void virThreadPoolFree(virThreadPoolPtr pool)
         ignore_value(virCondWait(&pool->quit_cond, &pool->mutex));
 
     while ((job = pool->jobList.head)) {
-        pool->jobList.head = pool->jobList.head->next;
+        virThreadPoolJobUnlink(pool, job);
         VIR_FREE(job);
     }
 
@@ -296,6 +409,26 @@ size_t virThreadPoolGetPriorityWorkers(virThreadPoolPtr pool)
     return pool->nPrioWorkers;
 }
 
+/*
+ * virThreadPoolGetStats:
+ * @pool: the thread pool
+ * @stats: filled with the current counters
+ *
+ * Report the jobs currently queued, the number of submitters they come
+ * from, and how long jobs have been waiting for a worker.
+ */
+void virThreadPoolGetStats(virThreadPoolPtr pool,
+                           virThreadPoolStatsPtr stats)
+{
+    virMutexLock(&pool->mutex);
+    stats->jobQueueDepth = pool->jobQueueDepth;
+    stats->jobGroups = pool->groups.count;
+    stats->jobsDone = pool->jobsDone;
+    stats->jobWaitTotal = pool->jobWaitTotal;
+    stats->jobWaitMax = pool->jobWaitMax;
+    virMutexUnlock(&pool->mutex);
+}
+
 /*
  * @priority - job priority
  * Return: 0 on success, -1 otherwise
@@ -303,8 +436,26 @@ size_t virThreadPoolGetPriorityWorkers(virThreadPoolPtr pool)
 int virThreadPoolSendJob(virThreadPoolPtr pool,
                          unsigned int priority,
                          void *jobData)
+{
+    return virThreadPoolSendGroupJob(pool, priority, NULL, jobData);
+}
+
+/*
+ * @priority - job priority
+ * @group - identifies the submitter of the job
+ *
+ * Jobs from different groups are run round robin, jobs of the same
+ * group in the order in which they were submitted.
+ *
+ * Return: 0 on success, -1 otherwise
+ */
+int virThreadPoolSendGroupJob(virThreadPoolPtr pool,
+                              unsigned int priority,
+                              const void *group,
+                              void *jobData)
 {
     virThreadPoolJobPtr job;
+    virThreadPoolGroupPtr grp;
     struct virThreadPoolWorkerData *data = NULL;
 
     virMutexLock(&pool->mutex);
@@ -342,8 +493,28 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
         goto error;
     }
 
+    if (!(grp = virThreadPoolGroupFind(pool, group))) {
+        if (VIR_ALLOC(grp) < 0) {
+            VIR_FREE(job);
+            virReportOOMError();
+            goto error;
+        }
+        grp->key = group;
+        virThreadPoolGroupAppend(pool, grp);
+    }
+
     job->data = jobData;
     job->priority = priority;
+    if (virTimeMillisNow(&job->queued) < 0)
+        job->queued = 0;
+
+    job->group = grp;
+    job->groupPrev = grp->tail;
+    if (grp->tail)
+        grp->tail->groupNext = job;
+    else
+        grp->head = job;
+    grp->tail = job;
 
     job->prev = pool->jobList.tail;
     if (pool->jobList.tail)
@@ -369,3 +540,101 @@ error:
     virMutexUnlock(&pool->mutex);
     return -1;
 }
+
+
+typedef struct _virThreadPoolBatch virThreadPoolBatch;
+typedef virThreadPoolBatch *virThreadPoolBatchPtr;
+struct _virThreadPoolBatch {
+    virMutex lock;
+    virCond cond;
+    size_t pending;
+
+    virThreadPoolJobFunc func;
+    void *opaque;
+};
+
+static void
+virThreadPoolBatchWorker(void *jobdata, void *opaque)
+{
+    virThreadPoolBatchPtr batch = opaque;
+
+    batch->func(jobdata, batch->opaque);
+
+    virMutexLock(&batch->lock);
+    if (--batch->pending == 0)
+        virCondSignal(&batch->cond);
+    virMutexUnlock(&batch->lock);
+}
+
+/*
+ * virThreadPoolRunJobs:
+ * @maxWorkers: the most threads to run jobs on
+ * @func: called once for every job
+ * @opaque: passed to every call of @func
+ * @jobs: array of @njobs jobs, @jobsize bytes each
+ * @njobs: number of jobs
+ * @jobsize: size of each job
+ *
+ * Run @func over a batch of independent jobs on a short-lived pool of
+ * up to @maxWorkers threads and return once all of them are done.
+ * Jobs the pool can't take are run in the calling thread instead, so
+ * each job is always run exactly once.
+ */
+void virThreadPoolRunJobs(size_t maxWorkers,
+                          virThreadPoolJobFunc func,
+                          void *opaque,
+                          void *jobs,
+                          size_t njobs,
+                          size_t jobsize)
+{
+    virThreadPoolBatch batch;
+    virThreadPoolPtr pool = NULL;
+    char *job = jobs;
+    size_t i;
+
+    if (njobs == 0)
+        return;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.func = func;
+    batch.opaque = opaque;
+
+    if (njobs == 1 || maxWorkers <= 1)
+        goto serial;
+
+    if (virMutexInit(&batch.lock) < 0)
+        goto serial;
+    if (virCondInit(&batch.cond) < 0) {
+        virMutexDestroy(&batch.lock);
+        goto serial;
+    }
+
+    if (!(pool = virThreadPoolNew(0, MIN(njobs, maxWorkers), 0,
+                                  virThreadPoolBatchWorker, &batch)))
+        virResetLastError();
+
+    for (i = 0; i < njobs; i++, job += jobsize) {
+        virMutexLock(&batch.lock);
+        batch.pending++;
+        virMutexUnlock(&batch.lock);
+
+        if (!pool || virThreadPoolSendJob(pool, 0, job) < 0) {
+            virResetLastError();
+            virThreadPoolBatchWorker(job, &batch);
+        }
+    }
+
+    virMutexLock(&batch.lock);
+    while (batch.pending > 0)
+        ignore_value(virCondWait(&batch.cond, &batch.lock));
+    virMutexUnlock(&batch.lock);
+
+    virThreadPoolFree(pool);
+    ignore_value(virCondDestroy(&batch.cond));
+    virMutexDestroy(&batch.lock);
+    return;
+
+serial:
+    for (i = 0; i < njobs; i++, job += jobsize)
+        func(job, opaque);
+}
@@ -33,6 +33,16 @@ typedef virThreadPool *virThreadPoolPtr;
 
 typedef void (*virThreadPoolJobFunc)(void *jobdata, void *opaque);
 
+typedef struct _virThreadPoolStats virThreadPoolStats;
+typedef virThreadPoolStats *virThreadPoolStatsPtr;
+struct _virThreadPoolStats {
+    size_t jobQueueDepth;               /* jobs waiting for a worker */
+    size_t jobGroups;                   /* submitters with waiting jobs */
+    unsigned long long jobsDone;        /* jobs completed so far */
+    unsigned long long jobWaitTotal;    /* total time jobs waited, in ms */
+    unsigned long long jobWaitMax;      /* longest time a job waited, in ms */
+};
+
 virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
                                   size_t maxWorkers,
                                   size_t prioWorkers,
@@ -50,4 +60,22 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
                          void *jobdata) ATTRIBUTE_NONNULL(1)
                                         ATTRIBUTE_RETURN_CHECK;
 
+int virThreadPoolSendGroupJob(virThreadPoolPtr pool,
+                              unsigned int priority,
+                              const void *group,
+                              void *jobdata) ATTRIBUTE_NONNULL(1)
+                                             ATTRIBUTE_RETURN_CHECK;
+
+void virThreadPoolGetStats(virThreadPoolPtr pool,
+                           virThreadPoolStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+void virThreadPoolRunJobs(size_t maxWorkers,
+                          virThreadPoolJobFunc func,
+                          void *opaque,
+                          void *jobs,
+                          size_t njobs,
+                          size_t jobsize)
+    ATTRIBUTE_NONNULL(2);
+
 #endif
@@ -45,6 +45,9 @@
 #include <termios.h>
 #include <pty.h>
 #include <locale.h>
+#ifdef __linux__
+# include <sys/statfs.h>
+#endif
 
 #if HAVE_LIBDEVMAPPER_H
 # include <libdevmapper.h>
@@ -3027,6 +3030,183 @@ virFileFindMountPoint(const char *type ATTRIBUTE_UNUSED)
 
 #endif /* defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R */
 
+#ifdef __linux__
+# define HUGETLBFS_MAGIC_NUMBER 0x958458f6
+
+/**
+ * virFileGetHugepageSize:
+ * @path: mount point of a hugetlbfs
+ * @size: returned page size in KiB
+ *
+ * Returns 0 on success, -1 with an error reported if @path can't be
+ * examined or is not a hugetlbfs.
+ */
+int
+virFileGetHugepageSize(const char *path,
+                       unsigned long long *size)
+{
+    struct statfs fs;
+
+    if (statfs(path, &fs) < 0) {
+        virReportSystemError(errno,
+                             _("cannot determine filesystem for '%s'"),
+                             path);
+        return -1;
+    }
+
+    if (fs.f_type != HUGETLBFS_MAGIC_NUMBER) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("not a hugetlbfs mount: '%s'"), path);
+        return -1;
+    }
+
+    *size = fs.f_bsize / 1024;
+    return 0;
+}
+
+/* The page size of hugetlbfs mounts without a pagesize option */
+static int
+virFileGetDefaultHugepageSize(unsigned long long *size)
+{
+    char *meminfo = NULL;
+    char *c;
+    int ret = -1;
+
+    if (virFileReadAll("/proc/meminfo", 4096, &meminfo) < 0)
+        goto cleanup;
+
+    if (!(c = strstr(meminfo, "Hugepagesize:")) ||
+        virStrToLong_ull(c + strlen("Hugepagesize:"), &c, 10, size) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("unable to parse Hugepagesize from /proc/meminfo"));
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    VIR_FREE(meminfo);
+    return ret;
+}
+#else /* !__linux__ */
+int
+virFileGetHugepageSize(const char *path ATTRIBUTE_UNUSED,
+                       unsigned long long *size ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("hugetlbfs is not supported on this platform"));
+    return -1;
+}
+
+static int
+virFileGetDefaultHugepageSize(unsigned long long *size ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("hugetlbfs is not supported on this platform"));
+    return -1;
+}
+#endif /* !__linux__ */
+
+/**
+ * virFileSetupHugeTLBFS:
+ * @fs: hugetlbfs to fill in
+ * @mnt_dir: mount point of the hugetlbfs
+ *
+ * Record @mnt_dir along with its page size, and whether that is the
+ * default huge page size of the host.
+ *
+ * Returns 0 on success, -1 with an error reported otherwise.
+ */
+int
+virFileSetupHugeTLBFS(virHugeTLBFSPtr fs,
+                      const char *mnt_dir)
+{
+    unsigned long long deflt;
+
+    if (virFileGetHugepageSize(mnt_dir, &fs->size) < 0 ||
+        virFileGetDefaultHugepageSize(&deflt) < 0)
+        return -1;
+
+    if (!(fs->mnt_dir = strdup(mnt_dir))) {
+        virReportOOMError();
+        return -1;
+    }
+    fs->deflt = fs->size == deflt;
+
+    return 0;
+}
+
+void
+virHugeTLBFSArrayFree(virHugeTLBFSPtr fs, size_t nfs)
+{
+    size_t i;
+
+    for (i = 0; i < nfs; i++)
+        VIR_FREE(fs[i].mnt_dir);
+    VIR_FREE(fs);
+}
+
+#if defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R
+/**
+ * virFileFindHugeTLBFS:
+ * @ret_fs: returned array of hugetlbfs mounts
+ * @ret_nfs: returned number of mounts
+ *
+ * Search /proc/mounts for every hugetlbfs, as the host may have one
+ * mount per huge page size.
+ *
+ * Returns 0 on success (possibly finding nothing), -1 on error.
+ */
+int
+virFileFindHugeTLBFS(virHugeTLBFSPtr *ret_fs,
+                     size_t *ret_nfs)
+{
+    FILE *f;
+    struct mntent mb;
+    char mntbuf[1024];
+    virHugeTLBFSPtr fs = NULL;
+    size_t nfs = 0;
+    int ret = -1;
+
+    if (!(f = setmntent("/proc/mounts", "r"))) {
+        virReportSystemError(errno, "%s", _("cannot open /proc/mounts"));
+        return -1;
+    }
+
+    while (getmntent_r(f, &mb, mntbuf, sizeof(mntbuf))) {
+        if (STRNEQ(mb.mnt_type, "hugetlbfs"))
+            continue;
+
+        if (VIR_EXPAND_N(fs, nfs, 1) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        if (virFileSetupHugeTLBFS(&fs[nfs - 1], mb.mnt_dir) < 0)
+            goto cleanup;
+    }
+
+    *ret_fs = fs;
+    *ret_nfs = nfs;
+    fs = NULL;
+    nfs = 0;
+    ret = 0;
+
+cleanup:
+    endmntent(f);
+    virHugeTLBFSArrayFree(fs, nfs);
+    return ret;
+}
+#else /* defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R */
+int
+virFileFindHugeTLBFS(virHugeTLBFSPtr *ret_fs,
+                     size_t *ret_nfs)
+{
+    *ret_fs = NULL;
+    *ret_nfs = 0;
+    return 0;
+}
+#endif /* defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R */
+
 #if defined(UDEVADM) || defined(UDEVSETTLE)
 void virFileWaitForDevices(void)
 {
@@ -271,6 +271,25 @@ int virGetGroupID(const char *name,
 
 char *virFileFindMountPoint(const char *type);
 
+typedef struct _virHugeTLBFS virHugeTLBFS;
+typedef virHugeTLBFS *virHugeTLBFSPtr;
+struct _virHugeTLBFS {
+    char *mnt_dir;              /* where the hugetlbfs is mounted */
+    unsigned long long size;    /* page size in KiB */
+    bool deflt;                 /* is this the default huge page size */
+};
+
+int virFileGetHugepageSize(const char *path,
+                           unsigned long long *size)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int virFileSetupHugeTLBFS(virHugeTLBFSPtr fs,
+                          const char *mnt_dir)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int virFileFindHugeTLBFS(virHugeTLBFSPtr *ret_fs,
+                         size_t *ret_nfs)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+void virHugeTLBFSArrayFree(virHugeTLBFSPtr fs, size_t nfs);
+
 void virFileWaitForDevices(void);
 
 # define virBuildPath(path, ...) virBuildPathInternal(path, __VA_ARGS__, NULL)
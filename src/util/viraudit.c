@@ -33,6 +33,7 @@
 #include "util.h"
 #include "virfile.h"
 #include "memory.h"
+#include "threads.h"
 
 /* Provide the macros in case the header file is old.
    FIXME: should be removed. */
@@ -50,9 +51,146 @@
 
 #if HAVE_AUDIT
 static int auditfd = -1;
+
+/* Records are sent to auditd from a thread of their own, so that the
+ * netlink round trip of each record is not made by callers, which
+ * usually hold a domain lock and can audit hundreds of devices at
+ * once. When the queue is full, callers send their records themselves
+ * rather than losing them. */
+# define VIR_AUDIT_QUEUE_MAX 1024
+
+typedef struct _virAuditRecord virAuditRecord;
+typedef virAuditRecord *virAuditRecordPtr;
+struct _virAuditRecord {
+    int type;
+    bool success;
+    char *str;
+    char *clienttty;
+    char *clientaddr;
+    virAuditRecordPtr next;
+};
+
+static virMutex auditLock;
+static virCond auditCond;
+static virThread auditThread;
+static bool auditThreadActive;
+static bool auditQuit;
+static virAuditRecordPtr auditHead;
+static virAuditRecordPtr auditTail;
+static size_t auditQueued;
+static unsigned long long auditDelayed;
+static unsigned long long auditFailed;
 #endif
 static int auditlog = 0;
 
+#if HAVE_AUDIT
+static void
+virAuditRecordFree(virAuditRecordPtr rec)
+{
+    if (!rec)
+        return;
+    VIR_FREE(rec->str);
+    VIR_FREE(rec->clienttty);
+    VIR_FREE(rec->clientaddr);
+    VIR_FREE(rec);
+}
+
+static void
+virAuditRecordSend(int type, const char *str, const char *clientaddr,
+                   const char *clienttty, bool success)
+{
+    if (audit_log_user_message(auditfd, type, str, NULL,
+                               clientaddr, clienttty, success) < 0) {
+        char ebuf[1024];
+        VIR_WARN("Failed to send audit message %s: %s",
+                 NULLSTR(str), virStrerror(errno, ebuf, sizeof(ebuf)));
+        virMutexLock(&auditLock);
+        auditFailed++;
+        virMutexUnlock(&auditLock);
+    }
+}
+
+static void
+virAuditWorker(void *opaque ATTRIBUTE_UNUSED)
+{
+    virMutexLock(&auditLock);
+    for (;;) {
+        virAuditRecordPtr rec;
+
+        while (!auditHead && !auditQuit) {
+            if (virCondWait(&auditCond, &auditLock) < 0) {
+                VIR_WARN("Unable to wait on audit queue");
+                goto cleanup;
+            }
+        }
+
+        /* The queue is flushed before quitting */
+        if (!(rec = auditHead))
+            break;
+        if (!(auditHead = rec->next))
+            auditTail = NULL;
+        auditQueued--;
+
+        virMutexUnlock(&auditLock);
+        virAuditRecordSend(rec->type, rec->str, rec->clientaddr,
+                           rec->clienttty, rec->success);
+        virAuditRecordFree(rec);
+        virMutexLock(&auditLock);
+    }
+
+cleanup:
+    virMutexUnlock(&auditLock);
+}
+
+/*
+ * Queue a record for the audit thread. Returns -1 if the caller has
+ * to send it itself.
+ */
+static int
+virAuditQueue(int type, char **str, const char *clientaddr,
+              const char *clienttty, bool success)
+{
+    virAuditRecordPtr rec = NULL;
+    bool warn = false;
+
+    if (!auditThreadActive)
+        return -1;
+
+    virMutexLock(&auditLock);
+    if (auditQueued >= VIR_AUDIT_QUEUE_MAX) {
+        warn = auditDelayed++ == 0;
+        goto error;
+    }
+
+    if (VIR_ALLOC(rec) < 0 ||
+        (clienttty && !(rec->clienttty = strdup(clienttty))) ||
+        (clientaddr && !(rec->clientaddr = strdup(clientaddr))))
+        goto error;
+    rec->type = type;
+    rec->success = success;
+    rec->str = *str;
+    *str = NULL;
+
+    if (auditTail)
+        auditTail->next = rec;
+    else
+        auditHead = rec;
+    auditTail = rec;
+    auditQueued++;
+
+    virCondSignal(&auditCond);
+    virMutexUnlock(&auditLock);
+    return 0;
+
+error:
+    virMutexUnlock(&auditLock);
+    virAuditRecordFree(rec);
+    if (warn)
+        VIR_WARN("Audit queue is full, sending records synchronously");
+    return -1;
+}
+#endif
+
 int virAuditOpen(void)
 {
 #if HAVE_AUDIT
@@ -61,6 +199,20 @@ int virAuditOpen(void)
         return -1;
     }
 
+    if (virMutexInit(&auditLock) < 0 ||
+        virCondInit(&auditCond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize audit queue"));
+        VIR_FORCE_CLOSE(auditfd);
+        return -1;
+    }
+
+    /* Without the thread, records are just sent synchronously */
+    if (virThreadCreate(&auditThread, true, virAuditWorker, NULL) < 0)
+        VIR_WARN("Unable to create audit thread, sending records synchronously");
+    else
+        auditThreadActive = true;
+
     return 0;
 #else
     return -1;
@@ -128,12 +280,10 @@ void virAuditSend(const char *filename,
 
         if (type >= ARRAY_CARDINALITY(record_types) || record_types[type] == 0)
             VIR_WARN("Unknown audit record type %d", type);
-        else if (audit_log_user_message(auditfd, record_types[type], str, NULL,
-                                        clientaddr, clienttty, success) < 0) {
-            char ebuf[1024];
-            VIR_WARN("Failed to send audit message %s: %s",
-                     NULLSTR(str), virStrerror(errno, ebuf, sizeof(ebuf)));
-        }
+        else if (virAuditQueue(record_types[type], &str, clientaddr,
+                               clienttty, success) < 0)
+            virAuditRecordSend(record_types[type], str, clientaddr,
+                               clienttty, success);
         VIR_FREE(str);
     }
 #endif
@@ -142,10 +292,42 @@ void virAuditSend(const char *filename,
 void virAuditClose(void)
 {
 #if HAVE_AUDIT
+    if (auditThreadActive) {
+        virMutexLock(&auditLock);
+        auditQuit = true;
+        virCondSignal(&auditCond);
+        virMutexUnlock(&auditLock);
+
+        virThreadJoin(&auditThread);
+        auditThreadActive = false;
+    }
     VIR_FORCE_CLOSE(auditfd);
 #endif
 }
 
+/*
+ * Get the number of audit records that could not be queued and were
+ * sent synchronously by their caller, and of those auditd did not
+ * accept.
+ */
+void virAuditGetStats(unsigned long long *delayed,
+                      unsigned long long *failed)
+{
+#if HAVE_AUDIT
+    if (auditfd < 0) {
+        *delayed = *failed = 0;
+        return;
+    }
+
+    virMutexLock(&auditLock);
+    *delayed = auditDelayed;
+    *failed = auditFailed;
+    virMutexUnlock(&auditLock);
+#else
+    *delayed = *failed = 0;
+#endif
+}
+
 char *virAuditEncode(const char *key, const char *value)
 {
 #if HAVE_AUDIT
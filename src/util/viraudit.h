@@ -45,6 +45,10 @@ char *virAuditEncode(const char *key, const char *value);
 
 void virAuditClose(void);
 
+void virAuditGetStats(unsigned long long *delayed,
+                      unsigned long long *failed)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 # define VIR_AUDIT(type, success, ...)				\
     virAuditSend(__FILE__, __LINE__, __func__,                  \
                  NULL, NULL, type, success, __VA_ARGS__);
@@ -0,0 +1,494 @@
+/*
+ * vireventthread.c: file handle watches serviced by a dedicated thread
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vireventthread.h"
+#include "event_poll.h"
+#include "logging.h"
+#include "memory.h"
+#include "threads.h"
+#include "util.h"
+#include "virfile.h"
+#include "virobject.h"
+#include "virterror_internal.h"
+
+#define VIR_FROM_THIS VIR_FROM_EVENT
+
+/* Allocate extra slots for virEventThreadHandle records in this multiple */
+#define VIR_EVENT_THREAD_ALLOC_EXTENT 10
+
+struct virEventThreadHandle {
+    int watch;
+    int fd;
+    int events;
+    virEventHandleCallback cb;
+    virFreeCallback ff;
+    void *opaque;
+    bool deleted;
+};
+
+/*
+ * A private poll loop run by one thread, for file handles which must
+ * not wait behind everything else registered with the main event loop.
+ * Unlike the main loop it has no timers.  Handles follow the rules of
+ * virEventAddHandle: callbacks run in the loop thread without the loop
+ * lock held, a handle may be removed from its own callback, and the
+ * free callback is run by the loop thread once the handle can no
+ * longer be dispatched.
+ */
+struct _virEventThread {
+    virObject object;
+
+    virMutex lock;
+    char *name;
+    virThread thread;
+    bool running;
+    bool quit;
+    int wakeupfd[2];
+
+    int nextWatch;
+    /* Sorted by watch, since watches are only ever appended */
+    size_t nhandles;
+    size_t handlesAlloc;
+    size_t handlesDeleted;
+    struct virEventThreadHandle *handles;
+};
+
+static virClassPtr virEventThreadClass;
+static void virEventThreadDispose(void *obj);
+
+static int virEventThreadOnceInit(void)
+{
+    if (!(virEventThreadClass = virClassNew("virEventThread",
+                                            sizeof(virEventThread),
+                                            virEventThreadDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virEventThread)
+
+
+static ssize_t
+virEventThreadFindHandle(virEventThreadPtr evt, int watch)
+{
+    size_t lo = 0;
+    size_t hi = evt->nhandles;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (evt->handles[mid].watch == watch)
+            return mid;
+        if (evt->handles[mid].watch < watch)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
+
+
+static void
+virEventThreadWakeupLocked(virEventThreadPtr evt)
+{
+    char c = '\0';
+
+    if (!evt->running || virThreadIsSelf(&evt->thread))
+        return;
+
+    if (safewrite(evt->wakeupfd[1], &c, sizeof(c)) != sizeof(c) &&
+        errno != EAGAIN)
+        VIR_WARN("Unable to wake up event thread %s", evt->name);
+}
+
+
+/*
+ * Must be called with the loop lock held, which is dropped while
+ * free callbacks run.  Handles may be removed meanwhile, including
+ * ones already scanned, hence the rescan until none are left.
+ */
+static void
+virEventThreadCleanupHandles(virEventThreadPtr evt)
+{
+    size_t i;
+    size_t gap;
+
+    if (!evt->handlesDeleted)
+        return;
+
+    for (i = 0 ; evt->handlesDeleted ;) {
+        if (i >= evt->nhandles) {
+            i = 0;
+            continue;
+        }
+
+        if (!evt->handles[i].deleted) {
+            i++;
+            continue;
+        }
+
+        if (evt->handles[i].ff) {
+            virFreeCallback ff = evt->handles[i].ff;
+            void *opaque = evt->handles[i].opaque;
+            evt->handles[i].ff = NULL;
+            virMutexUnlock(&evt->lock);
+            ff(opaque);
+            virMutexLock(&evt->lock);
+        }
+
+        if ((i + 1) < evt->nhandles)
+            memmove(evt->handles + i, evt->handles + i + 1,
+                    sizeof(*evt->handles) * (evt->nhandles - (i + 1)));
+        evt->nhandles--;
+        evt->handlesDeleted--;
+    }
+
+    gap = evt->handlesAlloc - evt->nhandles;
+    if (evt->nhandles == 0 ||
+        (gap > evt->nhandles && gap > VIR_EVENT_THREAD_ALLOC_EXTENT))
+        VIR_SHRINK_N(evt->handles, evt->handlesAlloc, gap);
+}
+
+
+static void
+virEventThreadWorker(void *opaque)
+{
+    virEventThreadPtr evt = opaque;
+    struct pollfd *fds = NULL;
+    size_t fdsAlloc = 0;
+    int *watches = NULL;
+    size_t watchesAlloc = 0;
+
+    virMutexLock(&evt->lock);
+    while (!evt->quit) {
+        size_t nfds = 1;
+        size_t i;
+        int ret;
+
+        virEventThreadCleanupHandles(evt);
+        if (evt->quit)
+            break;
+
+        if (evt->nhandles + 1 > fdsAlloc &&
+            (VIR_RESIZE_N(fds, fdsAlloc, 0, evt->nhandles + 1) < 0 ||
+             VIR_RESIZE_N(watches, watchesAlloc, 0, evt->nhandles + 1) < 0)) {
+            /* Only wait for a wakeup and retry, rather than dropping
+             * some of the handles */
+            VIR_WARN("Out of memory polling %zu handles in event thread %s",
+                     evt->nhandles, evt->name);
+            virMutexUnlock(&evt->lock);
+            usleep(100 * 1000);
+            virMutexLock(&evt->lock);
+            continue;
+        }
+
+        fds[0].fd = evt->wakeupfd[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        for (i = 0 ; i < evt->nhandles ; i++) {
+            if (evt->handles[i].deleted || !evt->handles[i].events)
+                continue;
+            fds[nfds].fd = evt->handles[i].fd;
+            fds[nfds].events =
+                virEventPollToNativeEvents(evt->handles[i].events);
+            fds[nfds].revents = 0;
+            watches[nfds] = evt->handles[i].watch;
+            nfds++;
+        }
+
+        virMutexUnlock(&evt->lock);
+        ret = poll(fds, nfds, -1);
+        virMutexLock(&evt->lock);
+
+        if (ret < 0) {
+            if (errno != EINTR && errno != EAGAIN)
+                VIR_WARN("Polling failed in event thread %s: %s",
+                         evt->name, strerror(errno));
+            continue;
+        }
+
+        if (fds[0].revents) {
+            char buf[64];
+            while (saferead(evt->wakeupfd[0], buf, sizeof(buf)) > 0)
+                ;
+        }
+
+        for (i = 1 ; i < nfds && !evt->quit ; i++) {
+            virEventHandleCallback cb;
+            void *cbopaque;
+            ssize_t idx;
+
+            if (!fds[i].revents)
+                continue;
+
+            /* The handle may have gone while the lock was dropped */
+            if ((idx = virEventThreadFindHandle(evt, watches[i])) < 0 ||
+                evt->handles[idx].deleted)
+                continue;
+
+            cb = evt->handles[idx].cb;
+            cbopaque = evt->handles[idx].opaque;
+            virMutexUnlock(&evt->lock);
+            (cb)(watches[i], fds[i].fd,
+                 virEventPollFromNativeEvents(fds[i].revents), cbopaque);
+            virMutexLock(&evt->lock);
+        }
+    }
+    virMutexUnlock(&evt->lock);
+
+    VIR_FREE(fds);
+    VIR_FREE(watches);
+}
+
+
+/**
+ * virEventThreadNew:
+ * @name: name of the thread, for logging
+ *
+ * Start a thread running its own poll loop.  Releasing the last
+ * reference stops it, which must not be done from one of the handle
+ * callbacks it runs.
+ *
+ * Returns the new loop or NULL on error
+ */
+virEventThreadPtr
+virEventThreadNew(const char *name)
+{
+    virEventThreadPtr evt;
+
+    if (virEventThreadInitialize() < 0)
+        return NULL;
+
+    if (!(evt = virObjectNew(virEventThreadClass)))
+        return NULL;
+
+    if (virMutexInit(&evt->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        VIR_FREE(evt);
+        return NULL;
+    }
+    evt->wakeupfd[0] = evt->wakeupfd[1] = -1;
+    evt->nextWatch = 1;
+
+    if (!(evt->name = strdup(name))) {
+        virReportOOMError();
+        goto error;
+    }
+
+    if (pipe2(evt->wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to setup wakeup pipe"));
+        goto error;
+    }
+
+    if (virThreadCreate(&evt->thread, true, virEventThreadWorker, evt) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to create event thread %s"), name);
+        goto error;
+    }
+    evt->running = true;
+
+    VIR_DEBUG("Started event thread %s %p", evt->name, evt);
+    return evt;
+
+error:
+    virObjectUnref(evt);
+    return NULL;
+}
+
+
+/**
+ * virEventThreadStop:
+ * @evt: the event thread
+ *
+ * Stop the thread and wait for it to exit, after which no callback
+ * is run any more.  Handles may still be removed, but their free
+ * callbacks are only run once the last reference is released.  Must
+ * not be called from one of the handle callbacks run by @evt.
+ */
+void
+virEventThreadStop(virEventThreadPtr evt)
+{
+    virMutexLock(&evt->lock);
+    if (!evt->running) {
+        virMutexUnlock(&evt->lock);
+        return;
+    }
+
+    VIR_DEBUG("Stopping event thread %s %p", NULLSTR(evt->name), evt);
+
+    evt->quit = true;
+    virEventThreadWakeupLocked(evt);
+    evt->running = false;
+    virMutexUnlock(&evt->lock);
+
+    virThreadJoin(&evt->thread);
+}
+
+
+static void
+virEventThreadDispose(void *obj)
+{
+    virEventThreadPtr evt = obj;
+    size_t i;
+
+    virEventThreadStop(evt);
+
+    for (i = 0 ; i < evt->nhandles ; i++) {
+        if (evt->handles[i].ff)
+            (evt->handles[i].ff)(evt->handles[i].opaque);
+    }
+    VIR_FREE(evt->handles);
+
+    VIR_FORCE_CLOSE(evt->wakeupfd[0]);
+    VIR_FORCE_CLOSE(evt->wakeupfd[1]);
+    VIR_FREE(evt->name);
+    virMutexDestroy(&evt->lock);
+}
+
+
+/**
+ * virEventThreadAddHandle:
+ * @evt: the event thread
+ * @fd: file handle to monitor
+ * @events: bitset of VIR_EVENT_HANDLE_* to watch for
+ * @cb: callback run in the event thread when an event occurs
+ * @opaque: user data to pass to @cb
+ * @ff: callback to free @opaque once the handle is removed
+ *
+ * The equivalent of virEventAddHandle for the loop run by @evt.
+ *
+ * Returns a watch number, or -1 on error
+ */
+int
+virEventThreadAddHandle(virEventThreadPtr evt,
+                        int fd,
+                        int events,
+                        virEventHandleCallback cb,
+                        void *opaque,
+                        virFreeCallback ff)
+{
+    int watch;
+
+    virMutexLock(&evt->lock);
+    if (VIR_RESIZE_N(evt->handles, evt->handlesAlloc,
+                     evt->nhandles, 1) < 0) {
+        virMutexUnlock(&evt->lock);
+        virReportOOMError();
+        return -1;
+    }
+
+    watch = evt->nextWatch++;
+    evt->handles[evt->nhandles].watch = watch;
+    evt->handles[evt->nhandles].fd = fd;
+    evt->handles[evt->nhandles].events = events;
+    evt->handles[evt->nhandles].cb = cb;
+    evt->handles[evt->nhandles].ff = ff;
+    evt->handles[evt->nhandles].opaque = opaque;
+    evt->handles[evt->nhandles].deleted = false;
+    evt->nhandles++;
+
+    VIR_DEBUG("Added watch %d fd %d events %d to event thread %s",
+              watch, fd, events, evt->name);
+
+    virEventThreadWakeupLocked(evt);
+    virMutexUnlock(&evt->lock);
+
+    return watch;
+}
+
+
+/**
+ * virEventThreadUpdateHandle:
+ * @evt: the event thread
+ * @watch: watch returned by virEventThreadAddHandle
+ * @events: new bitset of VIR_EVENT_HANDLE_* to watch for
+ *
+ * Change the events watched for on @watch
+ */
+void
+virEventThreadUpdateHandle(virEventThreadPtr evt,
+                           int watch,
+                           int events)
+{
+    ssize_t idx;
+
+    virMutexLock(&evt->lock);
+    if ((idx = virEventThreadFindHandle(evt, watch)) < 0 ||
+        evt->handles[idx].deleted) {
+        VIR_WARN("Ignoring update of unknown watch %d in event thread %s",
+                 watch, evt->name);
+        goto cleanup;
+    }
+
+    if (evt->handles[idx].events != events) {
+        evt->handles[idx].events = events;
+        virEventThreadWakeupLocked(evt);
+    }
+
+cleanup:
+    virMutexUnlock(&evt->lock);
+}
+
+
+/**
+ * virEventThreadRemoveHandle:
+ * @evt: the event thread
+ * @watch: watch returned by virEventThreadAddHandle
+ *
+ * Stop watching @watch.  Its callback is not invoked again once this
+ * returns, unless it is already running in the event thread.
+ *
+ * Returns 0 on success, -1 if @watch is unknown
+ */
+int
+virEventThreadRemoveHandle(virEventThreadPtr evt,
+                           int watch)
+{
+    ssize_t idx;
+    int ret = -1;
+
+    virMutexLock(&evt->lock);
+    if ((idx = virEventThreadFindHandle(evt, watch)) < 0 ||
+        evt->handles[idx].deleted) {
+        VIR_WARN("Ignoring removal of unknown watch %d in event thread %s",
+                 watch, evt->name);
+        goto cleanup;
+    }
+
+    evt->handles[idx].deleted = true;
+    evt->handlesDeleted++;
+    virEventThreadWakeupLocked(evt);
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&evt->lock);
+    return ret;
+}
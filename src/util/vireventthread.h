@@ -0,0 +1,53 @@
+/*
+ * vireventthread.h: file handle watches serviced by a dedicated thread
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_EVENT_THREAD_H__
+# define __VIR_EVENT_THREAD_H__
+
+# include "internal.h"
+
+typedef struct _virEventThread virEventThread;
+typedef virEventThread *virEventThreadPtr;
+
+virEventThreadPtr virEventThreadNew(const char *name)
+    ATTRIBUTE_NONNULL(1);
+
+void virEventThreadStop(virEventThreadPtr evt)
+    ATTRIBUTE_NONNULL(1);
+
+int virEventThreadAddHandle(virEventThreadPtr evt,
+                            int fd,
+                            int events,
+                            virEventHandleCallback cb,
+                            void *opaque,
+                            virFreeCallback ff)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(4);
+
+void virEventThreadUpdateHandle(virEventThreadPtr evt,
+                                int watch,
+                                int events)
+    ATTRIBUTE_NONNULL(1);
+
+int virEventThreadRemoveHandle(virEventThreadPtr evt,
+                               int watch)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_EVENT_THREAD_H__ */
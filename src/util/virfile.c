@@ -140,6 +140,10 @@ struct _virFileWrapperFd {
     size_t err_msg_len; /* strlen of err_msg so we don't
                            have to compute it every time */
     int err_watch; /* ID of watch in the event loop */
+    int stats_fd; /* FD to read transfer statistics of @cmd */
+    bool have_stats;
+    unsigned long long bytes; /* bytes copied by @cmd */
+    unsigned long long msecs; /* time it took to copy them */
 };
 
 #ifndef WIN32
@@ -219,6 +223,7 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
     virFileWrapperFdPtr ret = NULL;
     bool output = false;
     int pipefd[2] = { -1, -1 };
+    int statsfd[2] = { -1, -1 };
     int mode = -1;
 
     if (!flags) {
@@ -246,6 +251,7 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
     }
 
     ret->err_watch = -1;
+    ret->stats_fd = -1;
 
     mode = fcntl(*fd, F_GETFL);
 
@@ -279,6 +285,19 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
         virCommandAddArg(ret->cmd, "0");
     }
 
+    /* iohelper reports how much it copied, and how fast, on a pipe of
+     * its own, so that it can't be confused with error messages */
+    if (pipe2(statsfd, O_CLOEXEC) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unable to create pipe for %s"), name);
+        goto error;
+    }
+    virCommandTransferFD(ret->cmd, statsfd[1]);
+    virCommandAddEnvFormat(ret->cmd, "LIBVIRT_IOHELPER_STATS_FD=%d",
+                           statsfd[1]);
+    ret->stats_fd = statsfd[0];
+    statsfd[1] = -1;
+
     /* In order to catch iohelper stderr, we must:
      * - pass a FD to virCommand (-1 to auto-allocate one)
      * - change iohelper's env so virLog functions print to stderr
@@ -323,6 +342,7 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
 error:
     VIR_FORCE_CLOSE(pipefd[0]);
     VIR_FORCE_CLOSE(pipefd[1]);
+    VIR_FORCE_CLOSE(statsfd[1]);
     virFileWrapperFdFree(ret);
     return NULL;
 }
@@ -353,10 +373,53 @@ virFileWrapperFdNew(int *fd ATTRIBUTE_UNUSED,
 int
 virFileWrapperFdClose(virFileWrapperFdPtr wfd)
 {
+    char buf[64];
+    ssize_t nread;
+
     if (!wfd)
         return 0;
 
-    return virCommandWait(wfd->cmd, NULL);
+    if (virCommandWait(wfd->cmd, NULL) < 0)
+        return -1;
+
+    /* iohelper has exited, so its statistics are complete by now */
+    if (wfd->stats_fd >= 0 &&
+        (nread = saferead(wfd->stats_fd, buf, sizeof(buf) - 1)) > 0) {
+        buf[nread] = '\0';
+        if (sscanf(buf, "%llu %llu", &wfd->bytes, &wfd->msecs) == 2) {
+            wfd->have_stats = true;
+            VIR_DEBUG("iohelper copied %llu bytes in %llu ms (%llu KiB/s)",
+                      wfd->bytes, wfd->msecs,
+                      wfd->bytes * 1000 / 1024 / (wfd->msecs ? wfd->msecs : 1));
+        }
+    }
+    VIR_FORCE_CLOSE(wfd->stats_fd);
+
+    return 0;
+}
+
+
+/**
+ * virFileWrapperFdGetStats:
+ * @wfd: fd wrapper, or NULL
+ * @bytes: filled with the number of bytes copied
+ * @msecs: filled with the time the copy took, in milliseconds
+ *
+ * Report how much data went through @wfd, once virFileWrapperFdClose()
+ * succeeded. Returns 0 on success, -1 if the statistics are not
+ * available.
+ */
+int
+virFileWrapperFdGetStats(virFileWrapperFdPtr wfd,
+                         unsigned long long *bytes,
+                         unsigned long long *msecs)
+{
+    if (!wfd || !wfd->have_stats)
+        return -1;
+
+    *bytes = wfd->bytes;
+    *msecs = wfd->msecs;
+    return 0;
 }
 
 
@@ -390,6 +453,7 @@ virFileWrapperFdFree(virFileWrapperFdPtr wfd)
         return;
 
     VIR_FORCE_CLOSE(wfd->err_fd);
+    VIR_FORCE_CLOSE(wfd->stats_fd);
     if (wfd->err_watch != -1)
         virEventRemoveHandle(wfd->err_watch);
     VIR_FREE(wfd->err_msg);
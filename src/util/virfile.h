@@ -88,6 +88,11 @@ virFileWrapperFdPtr virFileWrapperFdNew(int *fd,
 
 int virFileWrapperFdClose(virFileWrapperFdPtr dfd);
 
+int virFileWrapperFdGetStats(virFileWrapperFdPtr dfd,
+                             unsigned long long *bytes,
+                             unsigned long long *msecs)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+
 void virFileWrapperFdFree(virFileWrapperFdPtr dfd);
 
 void virFileWrapperFdCatchError(virFileWrapperFdPtr dfd);
@@ -52,10 +52,13 @@ struct _virHashEntry {
     struct _virHashEntry *next;
     void *name;
     void *payload;
+    /* Unreduced keyCode() value, kept so that growing the table
+     * and walking a chain don't need to hash or compare every key */
+    uint32_t code;
 };
 
 /*
- * The entire hash table
+ * The entire hash table; @size is always a power of two
  */
 struct _virHashTable {
     virHashEntryPtr *table;
@@ -94,11 +97,16 @@ static void virHashStrFree(void *name)
 }
 
 
+static uint32_t
+virHashComputeCode(virHashTablePtr table, const void *name)
+{
+    return table->keyCode(name, table->seed);
+}
+
 static size_t
-virHashComputeKey(virHashTablePtr table, const void *name)
+virHashBucket(virHashTablePtr table, uint32_t code)
 {
-    uint32_t value = table->keyCode(name, table->seed);
-    return value % table->size;
+    return code & (table->size - 1);
 }
 
 /**
@@ -123,16 +131,22 @@ virHashTablePtr virHashCreateFull(ssize_t size,
 {
     virHashTablePtr table = NULL;
 
+    size_t realsize = 1;
+
     if (size <= 0)
         size = 256;
 
+    /* round up so that buckets can be picked by masking */
+    while (realsize < size)
+        realsize <<= 1;
+
     if (VIR_ALLOC(table) < 0) {
         virReportOOMError();
         return NULL;
     }
 
     table->seed = virRandomBits(32);
-    table->size = size;
+    table->size = realsize;
     table->nbElems = 0;
     table->dataFree = dataFree;
     table->keyCode = keyCode;
@@ -140,7 +154,7 @@ virHashTablePtr virHashCreateFull(ssize_t size,
     table->keyCopy = keyCopy;
     table->keyFree = keyFree;
 
-    if (VIR_ALLOC_N(table->table, size) < 0) {
+    if (VIR_ALLOC_N(table->table, table->size) < 0) {
         virReportOOMError();
         VIR_FREE(table);
         return NULL;
@@ -172,9 +186,10 @@ virHashTablePtr virHashCreate(ssize_t size, virHashDataFree dataFree)
 /**
  * virHashGrow:
  * @table: the hash table
- * @size: the new size of the hash table
+ * @size: the new size of the hash table, a power of two
  *
- * resize the hash table
+ * resize the hash table; entries are redistributed using their
+ * cached hash code, so no key is hashed again
  *
  * Returns 0 in case of success, -1 in case of failure
  */
@@ -190,9 +205,7 @@ virHashGrow(virHashTablePtr table, size_t size)
 
     if (table == NULL)
         return -1;
-    if (size < 8)
-        return -1;
-    if (size > 8 * 2048)
+    if (size < 8 || (size & (size - 1)) != 0)
         return -1;
 
     oldsize = table->size;
@@ -211,7 +224,7 @@ virHashGrow(virHashTablePtr table, size_t size)
         virHashEntryPtr iter = oldtable[i];
         while (iter) {
             virHashEntryPtr next = iter->next;
-            size_t key = virHashComputeKey(table, iter->name);
+            size_t key = virHashBucket(table, iter->code);
 
             iter->next = table->table[key];
             table->table[key] = iter;
@@ -272,6 +285,7 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
                         bool is_update)
 {
     size_t key, len = 0;
+    uint32_t code;
     virHashEntryPtr entry;
     char *new_name;
 
@@ -281,11 +295,12 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
     if (table->iterating)
         virHashIterationError(-1);
 
-    key = virHashComputeKey(table, name);
+    code = virHashComputeCode(table, name);
+    key = virHashBucket(table, code);
 
     /* Check for duplicate entry */
     for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
+        if (entry->code == code && table->keyEqual(entry->name, name)) {
             if (is_update) {
                 if (table->dataFree)
                     table->dataFree(entry->payload, entry->name);
@@ -306,12 +321,13 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
 
     entry->name = new_name;
     entry->payload = userdata;
+    entry->code = code;
     entry->next = table->table[key];
     table->table[key] = entry;
 
     table->nbElems++;
 
-    if (len > MAX_HASH_LEN)
+    if (len > MAX_HASH_LEN && table->size <= SIZE_MAX / MAX_HASH_LEN)
         virHashGrow(table, MAX_HASH_LEN * table->size);
 
     return 0;
@@ -365,15 +381,16 @@ virHashUpdateEntry(virHashTablePtr table, const void *name,
 void *
 virHashLookup(virHashTablePtr table, const void *name)
 {
-    size_t key;
+    uint32_t code;
     virHashEntryPtr entry;
 
     if (!table || !name)
         return NULL;
 
-    key = virHashComputeKey(table, name);
-    for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name))
+    code = virHashComputeCode(table, name);
+    for (entry = table->table[virHashBucket(table, code)];
+         entry; entry = entry->next) {
+        if (entry->code == code && table->keyEqual(entry->name, name))
             return entry->payload;
     }
     return NULL;
@@ -454,13 +471,15 @@ virHashRemoveEntry(virHashTablePtr table, const void *name)
 {
     virHashEntryPtr entry;
     virHashEntryPtr *nextptr;
+    uint32_t code;
 
     if (table == NULL || name == NULL)
         return -1;
 
-    nextptr = table->table + virHashComputeKey(table, name);
+    code = virHashComputeCode(table, name);
+    nextptr = table->table + virHashBucket(table, code);
     for (entry = *nextptr; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
+        if (entry->code == code && table->keyEqual(entry->name, name)) {
             if (table->iterating && table->current != entry)
                 virHashIterationError(-1);
 
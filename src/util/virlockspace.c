@@ -28,6 +28,7 @@
 #include "util.h"
 #include "virfile.h"
 #include "virhash.h"
+#include "virhashcode.h"
 #include "threads.h"
 
 #include <fcntl.h>
@@ -38,6 +39,11 @@
 
 #define VIR_LOCKSPACE_TABLE_SIZE 10
 
+/* Resources are spread over several independently locked tables, so
+ * that acquiring one lease, which means opening and locking its file,
+ * does not hold up requests for unrelated leases */
+#define VIR_LOCKSPACE_SHARDS 16
+
 typedef struct _virLockSpaceResource virLockSpaceResource;
 typedef virLockSpaceResource *virLockSpaceResourcePtr;
 
@@ -51,14 +57,31 @@ struct _virLockSpaceResource {
     pid_t *owners;
 };
 
+typedef struct _virLockSpaceShard virLockSpaceShard;
+typedef virLockSpaceShard *virLockSpaceShardPtr;
+
+struct _virLockSpaceShard {
+    virMutex lock;
+    virHashTablePtr resources;
+};
+
 struct _virLockSpace {
     char *dir;
-    virMutex lock;
 
-    virHashTablePtr resources;
+    virLockSpaceShard shards[VIR_LOCKSPACE_SHARDS];
+    size_t nshards; /* number of shards initialized */
 };
 
 
+static virLockSpaceShardPtr
+virLockSpaceGetShard(virLockSpacePtr lockspace, const char *resname)
+{
+    uint32_t hash = virHashCodeGen(resname, strlen(resname), 0);
+
+    return &lockspace->shards[hash % VIR_LOCKSPACE_SHARDS];
+}
+
+
 static char *virLockSpaceGetResourcePath(virLockSpacePtr lockspace,
                                          const char *resname)
 {
@@ -245,6 +268,30 @@ static void virLockSpaceResourceDataFree(void *opaque, const void *name ATTRIBUT
 }
 
 
+static int virLockSpaceInitShards(virLockSpacePtr lockspace)
+{
+    for (lockspace->nshards = 0;
+         lockspace->nshards < VIR_LOCKSPACE_SHARDS;
+         lockspace->nshards++) {
+        virLockSpaceShardPtr shard = &lockspace->shards[lockspace->nshards];
+
+        if (virMutexInit(&shard->lock) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to initialize lockspace mutex"));
+            return -1;
+        }
+
+        if (!(shard->resources = virHashCreate(VIR_LOCKSPACE_TABLE_SIZE,
+                                               virLockSpaceResourceDataFree))) {
+            virMutexDestroy(&shard->lock);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 virLockSpacePtr virLockSpaceNew(const char *directory)
 {
     virLockSpacePtr lockspace;
@@ -254,21 +301,13 @@ virLockSpacePtr virLockSpaceNew(const char *directory)
     if (VIR_ALLOC(lockspace) < 0)
         return NULL;
 
-    if (virMutexInit(&lockspace->lock) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Unable to initialize lockspace mutex"));
-        VIR_FREE(lockspace);
-        return NULL;
-    }
+    if (virLockSpaceInitShards(lockspace) < 0)
+        goto error;
 
     if (directory &&
         !(lockspace->dir = strdup(directory)))
         goto no_memory;
 
-    if (!(lockspace->resources = virHashCreate(VIR_LOCKSPACE_TABLE_SIZE,
-                                               virLockSpaceResourceDataFree)))
-        goto error;
-
     if (directory) {
         if (virFileExists(directory)) {
             if (!virFileIsDir(directory)) {
@@ -310,15 +349,7 @@ virLockSpacePtr virLockSpaceNewPostExecRestart(virJSONValuePtr object)
     if (VIR_ALLOC(lockspace) < 0)
         return NULL;
 
-    if (virMutexInit(&lockspace->lock) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Unable to initialize lockspace mutex"));
-        VIR_FREE(lockspace);
-        return NULL;
-    }
-
-    if (!(lockspace->resources = virHashCreate(VIR_LOCKSPACE_TABLE_SIZE,
-                                               virLockSpaceResourceDataFree)))
+    if (virLockSpaceInitShards(lockspace) < 0)
         goto error;
 
     if (virJSONValueObjectHasKey(object, "directory")) {
@@ -438,7 +469,9 @@ virLockSpacePtr virLockSpaceNewPostExecRestart(virJSONValuePtr object)
             res->owners[j] = (pid_t)owner;
         }
 
-        if (virHashAddEntry(lockspace->resources, res->name, res) < 0) {
+        if (virHashAddEntry(virLockSpaceGetShard(lockspace,
+                                                 res->name)->resources,
+                            res->name, res) < 0) {
             virLockSpaceResourceFree(res);
             goto error;
         }
@@ -452,30 +485,13 @@ error:
 }
 
 
-virJSONValuePtr virLockSpacePreExecRestart(virLockSpacePtr lockspace)
+static int
+virLockSpaceShardPreExecRestart(virLockSpaceShardPtr shard,
+                                virJSONValuePtr resources)
 {
-    virJSONValuePtr object = virJSONValueNewObject();
-    virJSONValuePtr resources;
     virHashKeyValuePairPtr pairs = NULL, tmp;
 
-    if (!object)
-        return NULL;
-
-    virMutexLock(&lockspace->lock);
-
-    if (lockspace->dir &&
-        virJSONValueObjectAppendString(object, "directory", lockspace->dir) < 0)
-        goto error;
-
-    if (!(resources = virJSONValueNewArray()))
-        goto error;
-
-    if (virJSONValueObjectAppend(object, "resources", resources) < 0) {
-        virJSONValueFree(resources);
-        goto error;
-    }
-
-    tmp = pairs = virHashGetItems(lockspace->resources, NULL);
+    tmp = pairs = virHashGetItems(shard->resources, NULL);
     while (tmp && tmp->value) {
         virLockSpaceResourcePtr res = (virLockSpaceResourcePtr)tmp->value;
         virJSONValuePtr child = virJSONValueNewObject();
@@ -522,26 +538,68 @@ virJSONValuePtr virLockSpacePreExecRestart(virLockSpacePtr lockspace)
         tmp++;
     }
     VIR_FREE(pairs);
+    return 0;
+
+error:
+    VIR_FREE(pairs);
+    return -1;
+}
+
+
+virJSONValuePtr virLockSpacePreExecRestart(virLockSpacePtr lockspace)
+{
+    virJSONValuePtr object = virJSONValueNewObject();
+    virJSONValuePtr resources;
+    size_t n;
+
+    if (!object)
+        return NULL;
+
+    for (n = 0 ; n < lockspace->nshards ; n++)
+        virMutexLock(&lockspace->shards[n].lock);
+
+    if (lockspace->dir &&
+        virJSONValueObjectAppendString(object, "directory", lockspace->dir) < 0)
+        goto error;
 
-    virMutexUnlock(&lockspace->lock);
+    if (!(resources = virJSONValueNewArray()))
+        goto error;
+
+    if (virJSONValueObjectAppend(object, "resources", resources) < 0) {
+        virJSONValueFree(resources);
+        goto error;
+    }
+
+    for (n = 0 ; n < lockspace->nshards ; n++) {
+        if (virLockSpaceShardPreExecRestart(&lockspace->shards[n],
+                                            resources) < 0)
+            goto error;
+    }
+
+    for (n = 0 ; n < lockspace->nshards ; n++)
+        virMutexUnlock(&lockspace->shards[n].lock);
     return object;
 
   error:
-    VIR_FREE(pairs);
     virJSONValueFree(object);
-    virMutexUnlock(&lockspace->lock);
+    for (n = 0 ; n < lockspace->nshards ; n++)
+        virMutexUnlock(&lockspace->shards[n].lock);
     return NULL;
 }
 
 
 void virLockSpaceFree(virLockSpacePtr lockspace)
 {
+    size_t i;
+
     if (!lockspace)
         return;
 
-    virHashFree(lockspace->resources);
+    for (i = 0 ; i < lockspace->nshards ; i++) {
+        virHashFree(lockspace->shards[i].resources);
+        virMutexDestroy(&lockspace->shards[i].lock);
+    }
     VIR_FREE(lockspace->dir);
-    virMutexDestroy(&lockspace->lock);
     VIR_FREE(lockspace);
 }
 
@@ -557,13 +615,14 @@ int virLockSpaceCreateResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     char *respath = NULL;
+    virLockSpaceShardPtr shard = virLockSpaceGetShard(lockspace, resname);
     virLockSpaceResourcePtr res;
 
     VIR_DEBUG("lockspace=%p resname=%s", lockspace, resname);
 
-    virMutexLock(&lockspace->lock);
+    virMutexLock(&shard->lock);
 
-    if ((res = virHashLookup(lockspace->resources, resname))) {
+    if ((res = virHashLookup(shard->resources, resname))) {
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is locked"),
                        resname);
@@ -579,7 +638,7 @@ int virLockSpaceCreateResource(virLockSpacePtr lockspace,
     ret = 0;
 
 cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virMutexUnlock(&shard->lock);
     VIR_FREE(respath);
     return ret;
 }
@@ -590,13 +649,14 @@ int virLockSpaceDeleteResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     char *respath = NULL;
+    virLockSpaceShardPtr shard = virLockSpaceGetShard(lockspace, resname);
     virLockSpaceResourcePtr res;
 
     VIR_DEBUG("lockspace=%p resname=%s", lockspace, resname);
 
-    virMutexLock(&lockspace->lock);
+    virMutexLock(&shard->lock);
 
-    if ((res = virHashLookup(lockspace->resources, resname))) {
+    if ((res = virHashLookup(shard->resources, resname))) {
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is locked"),
                        resname);
@@ -617,7 +677,7 @@ int virLockSpaceDeleteResource(virLockSpacePtr lockspace,
     ret = 0;
 
 cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virMutexUnlock(&shard->lock);
     VIR_FREE(respath);
     return ret;
 }
@@ -629,6 +689,7 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
                                 unsigned int flags)
 {
     int ret = -1;
+    virLockSpaceShardPtr shard = virLockSpaceGetShard(lockspace, resname);
     virLockSpaceResourcePtr res;
 
     VIR_DEBUG("lockspace=%p resname=%s flags=%x owner=%lld",
@@ -637,9 +698,9 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
     virCheckFlags(VIR_LOCK_SPACE_ACQUIRE_SHARED |
                   VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE, -1);
 
-    virMutexLock(&lockspace->lock);
+    virMutexLock(&shard->lock);
 
-    if ((res = virHashLookup(lockspace->resources, resname))) {
+    if ((res = virHashLookup(shard->resources, resname))) {
         if ((res->flags & VIR_LOCK_SPACE_ACQUIRE_SHARED) &&
             (flags & VIR_LOCK_SPACE_ACQUIRE_SHARED)) {
 
@@ -660,7 +721,7 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
     if (!(res = virLockSpaceResourceNew(lockspace, resname, flags, owner)))
         goto cleanup;
 
-    if (virHashAddEntry(lockspace->resources, resname, res) < 0) {
+    if (virHashAddEntry(shard->resources, resname, res) < 0) {
         virLockSpaceResourceFree(res);
         goto cleanup;
     }
@@ -669,7 +730,7 @@ done:
     ret = 0;
 
 cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virMutexUnlock(&shard->lock);
     return ret;
 }
 
@@ -679,15 +740,16 @@ int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
                                 pid_t owner)
 {
     int ret = -1;
+    virLockSpaceShardPtr shard = virLockSpaceGetShard(lockspace, resname);
     virLockSpaceResourcePtr res;
     size_t i;
 
     VIR_DEBUG("lockspace=%p resname=%s owner=%lld",
               lockspace, resname, (unsigned long long)owner);
 
-    virMutexLock(&lockspace->lock);
+    virMutexLock(&shard->lock);
 
-    if (!(res = virHashLookup(lockspace->resources, resname))) {
+    if (!(res = virHashLookup(shard->resources, resname))) {
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is not locked"),
                        resname);
@@ -714,13 +776,13 @@ int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
     VIR_SHRINK_N(res->owners, res->nOwners, 1);
 
     if ((res->nOwners == 0) &&
-        virHashRemoveEntry(lockspace->resources, resname) < 0)
+        virHashRemoveEntry(shard->resources, resname) < 0)
         goto cleanup;
 
     ret = 0;
 
 cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virMutexUnlock(&shard->lock);
     return ret;
 }
 
@@ -777,21 +839,23 @@ int virLockSpaceReleaseResourcesForOwner(virLockSpacePtr lockspace,
         owner, 0
     };
 
+    size_t i;
+
     VIR_DEBUG("lockspace=%p owner=%lld", lockspace, (unsigned long long)owner);
 
-    virMutexLock(&lockspace->lock);
+    for (i = 0 ; i < lockspace->nshards ; i++) {
+        virLockSpaceShardPtr shard = &lockspace->shards[i];
 
-    if (virHashRemoveSet(lockspace->resources,
-                         virLockSpaceRemoveResourcesForOwner,
-                         &data) < 0)
-        goto error;
+        virMutexLock(&shard->lock);
+        if (virHashRemoveSet(shard->resources,
+                             virLockSpaceRemoveResourcesForOwner,
+                             &data) < 0) {
+            virMutexUnlock(&shard->lock);
+            return -1;
+        }
+        virMutexUnlock(&shard->lock);
+    }
 
     ret = data.count;
-
-    virMutexUnlock(&lockspace->lock);
     return ret;
-
-error:
-    virMutexUnlock(&lockspace->lock);
-    return -1;
 }
@@ -23,6 +23,7 @@
 #include <config.h>
 
 #include "virnetdev.h"
+#include "virnetdevbridge.h"
 #include "virmacaddr.h"
 #include "virfile.h"
 #include "virterror_internal.h"
@@ -30,6 +31,8 @@
 #include "memory.h"
 #include "pci.h"
 #include "logging.h"
+#include "threads.h"
+#include "virhash.h"
 
 #include <sys/ioctl.h>
 #include <net/if.h>
@@ -86,6 +89,465 @@ static int virNetDevSetupControl(const char *ifname,
 #endif
 
 
+typedef struct _virNetDevLinkState virNetDevLinkState;
+typedef virNetDevLinkState *virNetDevLinkStatePtr;
+struct _virNetDevLinkState {
+    bool exists;
+    int ifindex;
+    unsigned int flags;
+    int mtu;
+};
+
+#if defined(__linux__) && defined(HAVE_LIBNL) && defined(HAVE_STRUCT_IFREQ)
+/*
+ * Interface state cache. Once virNetDevLinkCacheStart() has hooked it
+ * into the NETLINK_ROUTE event service, RTM_NEWLINK and RTM_DELLINK
+ * broadcasts from the kernel keep it up to date and existence, state,
+ * index and MTU lookups are answered from memory instead of an ioctl()
+ * on a fresh control socket each. Interfaces are added to the cache
+ * on their first lookup or event.
+ */
+typedef struct _virNetDevLinkWatch virNetDevLinkWatch;
+typedef virNetDevLinkWatch *virNetDevLinkWatchPtr;
+struct _virNetDevLinkWatch {
+    int watch;
+    virNetDevLinkEventCallback cb;
+    void *opaque;
+};
+
+static virMutex linkCacheLock;
+static virHashTablePtr linkCache; /* ifname -> virNetDevLinkState */
+static unsigned long long linkCacheSerial; /* bumped by every event */
+static int linkCacheWatch = -1;
+
+static virMutex linkWatchLock;
+static virNetDevLinkWatchPtr linkWatches;
+static size_t nlinkWatches;
+static int linkNextWatch = 1;
+
+static int
+virNetDevLinkCacheOnceInit(void)
+{
+    if (virMutexInit(&linkCacheLock) < 0 ||
+        virMutexInit(&linkWatchLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetDevLinkCache)
+
+
+static void
+virNetDevLinkStateFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    VIR_FREE(payload);
+}
+
+
+static int
+virNetDevLinkStateQuery(const char *ifname, virNetDevLinkStatePtr state)
+{
+    int fd = -1;
+    int ret = -1;
+    struct ifreq ifr;
+
+    memset(state, 0, sizeof(*state));
+
+    if ((fd = virNetDevSetupControl(ifname, &ifr)) < 0)
+        return -1;
+
+    if (ioctl(fd, SIOCGIFFLAGS, &ifr) < 0) {
+        if (errno == ENODEV)
+            ret = 0;
+        else
+            virReportSystemError(errno,
+                                 _("Cannot get interface flags on '%s'"),
+                                 ifname);
+        goto cleanup;
+    }
+    state->flags = (unsigned short) ifr.ifr_flags;
+
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+        if (errno == ENODEV)
+            ret = 0;
+        else
+            virReportSystemError(errno,
+                                 _("Unable to get index for interface %s"),
+                                 ifname);
+        goto cleanup;
+    }
+    state->ifindex = ifr.ifr_ifindex;
+
+    if (ioctl(fd, SIOCGIFMTU, &ifr) < 0) {
+        if (errno == ENODEV)
+            ret = 0;
+        else
+            virReportSystemError(errno,
+                                 _("Cannot get interface MTU on '%s'"),
+                                 ifname);
+        goto cleanup;
+    }
+    state->mtu = ifr.ifr_mtu;
+
+    state->exists = true;
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+
+/*
+ * virNetDevLinkCacheGet:
+ *
+ * Returns 1 if @state was filled in, 0 if the cache is not running
+ * and the caller has to ask the kernel itself, -1 on error.
+ */
+static int
+virNetDevLinkCacheGet(const char *ifname, virNetDevLinkStatePtr state)
+{
+    virNetDevLinkStatePtr cached;
+    unsigned long long serial;
+
+    if (virNetDevLinkCacheInitialize() < 0)
+        return -1;
+
+    virMutexLock(&linkCacheLock);
+    if (!linkCache) {
+        virMutexUnlock(&linkCacheLock);
+        return 0;
+    }
+    if ((cached = virHashLookup(linkCache, ifname))) {
+        *state = *cached;
+        virMutexUnlock(&linkCacheLock);
+        return 1;
+    }
+    serial = linkCacheSerial;
+    virMutexUnlock(&linkCacheLock);
+
+    if (virNetDevLinkStateQuery(ifname, state) < 0)
+        return -1;
+
+    /* Only remember the answer if no event arrived while asking the
+     * kernel, since it could have been made stale by that event. */
+    virMutexLock(&linkCacheLock);
+    if (linkCache && linkCacheSerial == serial &&
+        VIR_ALLOC(cached) == 0) {
+        *cached = *state;
+        if (virHashAddEntry(linkCache, ifname, cached) < 0) {
+            VIR_FREE(cached);
+            virResetLastError();
+        }
+    }
+    virMutexUnlock(&linkCacheLock);
+
+    return 1;
+}
+
+
+struct virNetDevLinkRename {
+    int ifindex;
+    const char *ifname;
+};
+
+static int
+virNetDevLinkStateIsRenamed(const void *payload,
+                            const void *name,
+                            const void *data)
+{
+    const virNetDevLinkState *state = payload;
+    const struct virNetDevLinkRename *rename = data;
+
+    return state->exists && state->ifindex == rename->ifindex &&
+        STRNEQ(name, rename->ifname);
+}
+
+
+static void
+virNetDevLinkCacheEvent(unsigned char *msg,
+                        int length,
+                        struct sockaddr_nl *peer,
+                        bool *handled ATTRIBUTE_UNUSED,
+                        void *opaque ATTRIBUTE_UNUSED)
+{
+    struct nlmsghdr *hdr;
+    size_t i;
+
+    /* only kernel broadcasts describe the current link state */
+    if (peer->nl_pid != 0)
+        return;
+
+    for (hdr = (struct nlmsghdr *) msg;
+         NLMSG_OK(hdr, length);
+         hdr = NLMSG_NEXT(hdr, length)) {
+        struct nlattr *tb[IFLA_MAX + 1];
+        struct ifinfomsg *ifinfo;
+        virNetDevLinkStatePtr state;
+        virNetDevLinkStatePtr cached;
+        const char *ifname;
+
+        if (hdr->nlmsg_type != RTM_NEWLINK &&
+            hdr->nlmsg_type != RTM_DELLINK)
+            continue;
+
+        if (nlmsg_parse(hdr, sizeof(*ifinfo), tb, IFLA_MAX, NULL) < 0 ||
+            !tb[IFLA_IFNAME])
+            continue;
+
+        ifinfo = NLMSG_DATA(hdr);
+        ifname = nla_data(tb[IFLA_IFNAME]);
+
+        if (VIR_ALLOC(state) < 0)
+            continue;
+        state->exists = hdr->nlmsg_type == RTM_NEWLINK;
+        state->ifindex = ifinfo->ifi_index;
+        state->flags = ifinfo->ifi_flags;
+        if (tb[IFLA_MTU])
+            state->mtu = nla_get_u32(tb[IFLA_MTU]);
+
+        virMutexLock(&linkCacheLock);
+        cached = linkCache ? virHashLookup(linkCache, ifname) : NULL;
+        if (!linkCache ||
+            (cached && state->ifindex < cached->ifindex)) {
+            /* interface indexes only grow, so this event is about an
+             * interface that has since been replaced by one of the
+             * same name */
+            VIR_FREE(state);
+        } else {
+            linkCacheSerial++;
+
+            /* a new name for a known index means the interface was
+             * renamed and its old name is gone */
+            if (state->exists &&
+                (!cached || !cached->exists ||
+                 cached->ifindex != state->ifindex)) {
+                struct virNetDevLinkRename rename = {
+                    state->ifindex, ifname
+                };
+                virHashRemoveSet(linkCache, virNetDevLinkStateIsRenamed,
+                                 &rename);
+            }
+
+            /* without an MTU the entry is incomplete, so let the next
+             * lookup ask the kernel */
+            if (state->exists && !tb[IFLA_MTU]) {
+                virHashRemoveEntry(linkCache, ifname);
+                VIR_FREE(state);
+            } else if (virHashUpdateEntry(linkCache, ifname, state) < 0) {
+                VIR_FREE(state);
+                virResetLastError();
+            }
+        }
+        virMutexUnlock(&linkCacheLock);
+
+        virMutexLock(&linkWatchLock);
+        for (i = 0; i < nlinkWatches; i++)
+            (linkWatches[i].cb)(ifname, ifinfo->ifi_index,
+                                hdr->nlmsg_type == RTM_NEWLINK,
+                                !!(ifinfo->ifi_flags & IFF_UP),
+                                linkWatches[i].opaque);
+        virMutexUnlock(&linkWatchLock);
+    }
+}
+
+
+static void
+virNetDevLinkCacheRemoved(int watch ATTRIBUTE_UNUSED,
+                          const virMacAddrPtr macaddr ATTRIBUTE_UNUSED,
+                          void *opaque ATTRIBUTE_UNUSED)
+{
+    virMutexLock(&linkCacheLock);
+    virHashFree(linkCache);
+    linkCache = NULL;
+    linkCacheWatch = -1;
+    virMutexUnlock(&linkCacheLock);
+}
+
+
+/**
+ * virNetDevLinkCacheStart:
+ *
+ * Start serving interface lookups from a cache kept up to date by
+ * the NETLINK_ROUTE event service, which must have been started with
+ * membership of the RTNLGRP_LINK group. The cache is dropped again
+ * when the event service is stopped.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int virNetDevLinkCacheStart(void)
+{
+    int ret = -1;
+
+    if (virNetDevLinkCacheInitialize() < 0)
+        return -1;
+
+    virMutexLock(&linkCacheLock);
+    if (linkCache) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!(linkCache = virHashCreate(64, virNetDevLinkStateFree)))
+        goto cleanup;
+
+    /* the event service delivers events with the client list locked,
+     * so linkCacheLock must not be held while registering */
+    virMutexUnlock(&linkCacheLock);
+    linkCacheWatch = virNetlinkEventAddClient(virNetDevLinkCacheEvent,
+                                              virNetDevLinkCacheRemoved,
+                                              NULL, NULL, NETLINK_ROUTE);
+    virMutexLock(&linkCacheLock);
+    if (linkCacheWatch < 0) {
+        virHashFree(linkCache);
+        linkCache = NULL;
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&linkCacheLock);
+    return ret;
+}
+
+
+/**
+ * virNetDevLinkCacheInvalidate:
+ * @ifname: interface that was just created, removed or changed
+ *
+ * Forget what the interface state cache knows about @ifname, so the
+ * next lookup asks the kernel rather than returning state that the
+ * not yet processed link event would have corrected.
+ */
+void virNetDevLinkCacheInvalidate(const char *ifname)
+{
+    if (virNetDevLinkCacheInitialize() < 0)
+        return;
+
+    virMutexLock(&linkCacheLock);
+    if (linkCache) {
+        linkCacheSerial++;
+        virHashRemoveEntry(linkCache, ifname);
+    }
+    virMutexUnlock(&linkCacheLock);
+}
+
+
+/**
+ * virNetDevLinkEventAddCallback:
+ * @cb: function to call on link changes
+ * @opaque: data passed to @cb
+ *
+ * Register @cb to be called from the event loop whenever an interface
+ * is added, removed or changes state, so that callers can react to it
+ * instead of polling. @cb must not add or remove callbacks itself.
+ *
+ * Returns a watch number for virNetDevLinkEventRemoveCallback(), or -1
+ * if the interface state cache is not running.
+ */
+int virNetDevLinkEventAddCallback(virNetDevLinkEventCallback cb,
+                                  void *opaque)
+{
+    virNetDevLinkWatch watch = { 0, cb, opaque };
+    int ret = -1;
+
+    if (virNetDevLinkCacheInitialize() < 0)
+        return -1;
+
+    virMutexLock(&linkCacheLock);
+    if (!linkCache) {
+        virMutexUnlock(&linkCacheLock);
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("interface state cache is not running"));
+        return -1;
+    }
+    virMutexUnlock(&linkCacheLock);
+
+    virMutexLock(&linkWatchLock);
+    watch.watch = linkNextWatch++;
+    if (VIR_APPEND_ELEMENT(linkWatches, nlinkWatches, watch) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    ret = watch.watch;
+
+cleanup:
+    virMutexUnlock(&linkWatchLock);
+    return ret;
+}
+
+
+/**
+ * virNetDevLinkEventRemoveCallback:
+ * @watch: number returned by virNetDevLinkEventAddCallback()
+ *
+ * Returns 0 on success, -1 if @watch is unknown
+ */
+int virNetDevLinkEventRemoveCallback(int watch)
+{
+    size_t i;
+    int ret = -1;
+
+    if (virNetDevLinkCacheInitialize() < 0)
+        return -1;
+
+    virMutexLock(&linkWatchLock);
+    for (i = 0; i < nlinkWatches; i++) {
+        if (linkWatches[i].watch == watch) {
+            VIR_DELETE_ELEMENT(linkWatches, i, nlinkWatches);
+            ret = 0;
+            break;
+        }
+    }
+    virMutexUnlock(&linkWatchLock);
+
+    if (ret < 0)
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("no interface event callback with watch %d"), watch);
+    return ret;
+}
+#else /* !(__linux__ && HAVE_LIBNL && HAVE_STRUCT_IFREQ) */
+static inline int
+virNetDevLinkCacheGet(const char *ifname ATTRIBUTE_UNUSED,
+                      virNetDevLinkStatePtr state ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+
+int virNetDevLinkCacheStart(void)
+{
+    return 0;
+}
+
+
+void virNetDevLinkCacheInvalidate(const char *ifname ATTRIBUTE_UNUSED)
+{
+}
+
+
+int virNetDevLinkEventAddCallback(virNetDevLinkEventCallback cb ATTRIBUTE_UNUSED,
+                                  void *opaque ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Unable to watch interfaces on this platform"));
+    return -1;
+}
+
+
+int virNetDevLinkEventRemoveCallback(int watch ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Unable to watch interfaces on this platform"));
+    return -1;
+}
+#endif /* !(__linux__ && HAVE_LIBNL && HAVE_STRUCT_IFREQ) */
+
+
 #if defined(SIOCGIFFLAGS) && defined(HAVE_STRUCT_IFREQ)
 /**
  * virNetDevExists:
@@ -100,6 +562,11 @@ int virNetDevExists(const char *ifname)
     int fd = -1;
     int ret = -1;
     struct ifreq ifr;
+    virNetDevLinkState state;
+
+    if ((ret = virNetDevLinkCacheGet(ifname, &state)) != 0)
+        return ret < 0 ? -1 : state.exists;
+    ret = -1;
 
     if ((fd = virNetDevSetupControl(ifname, &ifr)) < 0)
         return -1;
@@ -333,6 +800,20 @@ int virNetDevGetMTU(const char *ifname)
     int fd = -1;
     int ret = -1;
     struct ifreq ifr;
+    virNetDevLinkState state;
+
+    if ((ret = virNetDevLinkCacheGet(ifname, &state)) < 0)
+        return -1;
+    if (ret > 0) {
+        if (!state.exists) {
+            virReportSystemError(ENODEV,
+                                 _("Cannot get interface MTU on '%s'"),
+                                 ifname);
+            return -1;
+        }
+        return state.mtu;
+    }
+    ret = -1;
 
     if ((fd = virNetDevSetupControl(ifname, &ifr)) < 0)
         return -1;
@@ -393,6 +874,7 @@ int virNetDevSetMTU(const char *ifname, int mtu)
     ret = 0;
 
 cleanup:
+    virNetDevLinkCacheInvalidate(ifname);
     VIR_FORCE_CLOSE(fd);
     return ret;
 }
@@ -454,6 +936,7 @@ int virNetDevSetNamespace(const char *ifname, pid_t pidInNs)
 
     argv[5] = pid;
     rc = virRun(argv, NULL);
+    virNetDevLinkCacheInvalidate(ifname);
 
     VIR_FREE(pid);
     return rc;
@@ -495,6 +978,8 @@ int virNetDevSetName(const char* ifname, const char *newifname)
     ret = 0;
 
 cleanup:
+    virNetDevLinkCacheInvalidate(ifname);
+    virNetDevLinkCacheInvalidate(newifname);
     VIR_FORCE_CLOSE(fd);
     return ret;
 }
@@ -555,6 +1040,7 @@ int virNetDevSetOnline(const char *ifname,
     ret = 0;
 
 cleanup:
+    virNetDevLinkCacheInvalidate(ifname);
     VIR_FORCE_CLOSE(fd);
     return ret;
 }
@@ -586,6 +1072,21 @@ int virNetDevIsOnline(const char *ifname,
     int fd = -1;
     int ret = -1;
     struct ifreq ifr;
+    virNetDevLinkState state;
+
+    if ((ret = virNetDevLinkCacheGet(ifname, &state)) < 0)
+        return -1;
+    if (ret > 0) {
+        if (!state.exists) {
+            virReportSystemError(ENODEV,
+                                 _("Cannot get interface flags on '%s'"),
+                                 ifname);
+            return -1;
+        }
+        *online = (state.flags & IFF_UP) ? true : false;
+        return 0;
+    }
+    ret = -1;
 
     if ((fd = virNetDevSetupControl(ifname, &ifr)) < 0)
         return -1;
@@ -630,9 +1131,24 @@ int virNetDevGetIndex(const char *ifname, int *ifindex)
 {
     int ret = -1;
     struct ifreq ifreq;
-    int fd = socket(PF_PACKET, SOCK_DGRAM, 0);
+    virNetDevLinkState state;
+    int fd;
 
-    if (fd < 0) {
+    if ((ret = virNetDevLinkCacheGet(ifname, &state)) < 0)
+        return -1;
+    if (ret > 0) {
+        if (!state.exists) {
+            virReportSystemError(ENODEV,
+                                 _("Unable to get index for interface %s"),
+                                 ifname);
+            return -1;
+        }
+        *ifindex = state.ifindex;
+        return 0;
+    }
+    ret = -1;
+
+    if ((fd = socket(PF_PACKET, SOCK_DGRAM, 0)) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to open control socket"));
         return -1;
@@ -936,6 +1452,107 @@ int virNetDevValidateConfig(const char *ifname ATTRIBUTE_UNUSED,
 #endif /* ! HAVE_STRUCT_IFREQ */
 
 
+/**
+ * virNetDevSetupLink:
+ * @ifname: name of the interface
+ * @macaddr: MAC address to assign; left alone if NULL
+ * @mtu: MTU to assign; left alone if 0
+ * @master: bridge to add the interface to; none if NULL
+ * @online: whether to bring the interface up or down
+ *
+ * Configure a freshly created interface in one go. Where netlink is
+ * available all settings are sent to the kernel as a single RTM_SETLINK
+ * message, which applies the MAC address and MTU before enslaving the
+ * interface to @master and changing its state; that is the same order
+ * as the one step per setting fallback uses. This saves a control
+ * socket and ioctl() per setting, which adds up when many guests start
+ * at once.
+ *
+ * Returns 0 in case of success or -1 on failure
+ */
+#if defined(__linux__) && defined(HAVE_LIBNL)
+int virNetDevSetupLink(const char *ifname,
+                       const virMacAddrPtr macaddr,
+                       int mtu,
+                       const char *master,
+                       bool online)
+{
+    struct nl_msg *nl_msg;
+    struct ifinfomsg ifinfo = {
+        .ifi_family = AF_UNSPEC,
+        .ifi_flags = online ? IFF_UP : 0,
+        .ifi_change = IFF_UP,
+    };
+    int masterindex;
+    int error = 0;
+    int ret = -1;
+
+    if (master && virNetDevGetIndex(master, &masterindex) < 0)
+        return -1;
+
+    if (!(nl_msg = nlmsg_alloc_simple(RTM_SETLINK, NLM_F_REQUEST))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0 ||
+        nla_put(nl_msg, IFLA_IFNAME, strlen(ifname) + 1, ifname) < 0)
+        goto buffer_too_small;
+
+    if (macaddr &&
+        nla_put(nl_msg, IFLA_ADDRESS, VIR_MAC_BUFLEN, macaddr->addr) < 0)
+        goto buffer_too_small;
+
+    if (mtu > 0 &&
+        nla_put_u32(nl_msg, IFLA_MTU, mtu) < 0)
+        goto buffer_too_small;
+
+    if (master &&
+        nla_put_u32(nl_msg, IFLA_MASTER, masterindex) < 0)
+        goto buffer_too_small;
+
+    if (virNetlinkCommandBatch(&nl_msg, 1, &error, NETLINK_ROUTE) < 0)
+        goto cleanup;
+
+    if (error) {
+        virReportSystemError(error, _("Unable to set up interface %s"),
+                             ifname);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virNetDevLinkCacheInvalidate(ifname);
+    nlmsg_free(nl_msg);
+    return ret;
+
+buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    goto cleanup;
+}
+#else /* !(__linux__ && HAVE_LIBNL) */
+int virNetDevSetupLink(const char *ifname,
+                       const virMacAddrPtr macaddr,
+                       int mtu,
+                       const char *master,
+                       bool online)
+{
+    if (macaddr && virNetDevSetMAC(ifname, macaddr) < 0)
+        return -1;
+
+    if (mtu > 0 && virNetDevSetMTU(ifname, mtu) < 0)
+        return -1;
+
+    if (master && virNetDevBridgeAddPort(master, ifname) < 0)
+        return -1;
+
+    return virNetDevSetOnline(ifname, online);
+}
+#endif /* !(__linux__ && HAVE_LIBNL) */
+
+
 #ifdef __linux__
 # define NET_SYSFS "/sys/class/net/"
 
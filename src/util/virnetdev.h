@@ -71,6 +71,13 @@ int virNetDevRestoreMacAddress(const char *linkdev,
 int virNetDevSetMTU(const char *ifname,
                     int mtu)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetDevSetupLink(const char *ifname,
+                       const virMacAddrPtr macaddr,
+                       int mtu,
+                       const char *master,
+                       bool online)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
 int virNetDevSetMTUFromDevice(const char *ifname,
                               const char *otherifname)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
@@ -91,6 +98,20 @@ int virNetDevValidateConfig(const char *ifname,
                             const virMacAddrPtr macaddr, int ifindex)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
+typedef void (*virNetDevLinkEventCallback)(const char *ifname,
+                                           int ifindex,
+                                           bool exists,
+                                           bool online,
+                                           void *opaque);
+
+int virNetDevLinkCacheStart(void);
+void virNetDevLinkCacheInvalidate(const char *ifname)
+    ATTRIBUTE_NONNULL(1);
+int virNetDevLinkEventAddCallback(virNetDevLinkEventCallback cb,
+                                  void *opaque)
+    ATTRIBUTE_NONNULL(1);
+int virNetDevLinkEventRemoveCallback(int watch);
+
 int virNetDevIsVirtualFunction(const char *ifname)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
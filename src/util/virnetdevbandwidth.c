@@ -27,6 +27,20 @@
 #include "memory.h"
 #include "virterror_internal.h"
 
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <arpa/inet.h>
+# include <linux/if_ether.h>
+# include <linux/pkt_cls.h>
+# include <linux/pkt_sched.h>
+# include <linux/rtnetlink.h>
+
+# include "logging.h"
+# include "threads.h"
+# include "util.h"
+# include "virnetdev.h"
+# include "virnetlink.h"
+#endif
+
 #define VIR_FROM_THIS VIR_FROM_NONE
 
 void
@@ -41,6 +55,898 @@ virNetDevBandwidthFree(virNetDevBandwidthPtr def)
 }
 
 
+/*
+ * virNetDevBandwidthCopy:
+ * @dest: destination
+ * @src:  source (may be NULL)
+ *
+ * Returns -1 on OOM error (which gets reported),
+ * 0 otherwise.
+ */
+int
+virNetDevBandwidthCopy(virNetDevBandwidthPtr *dest,
+                       const virNetDevBandwidthPtr src)
+{
+    int ret = -1;
+
+    *dest = NULL;
+    if (!src) {
+        /* nothing to be copied */
+        return 0;
+    }
+
+    if (VIR_ALLOC(*dest) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (src->in) {
+        if (VIR_ALLOC((*dest)->in) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        memcpy((*dest)->in, src->in, sizeof(*src->in));
+    }
+
+    if (src->out) {
+        if (VIR_ALLOC((*dest)->out) < 0) {
+            virReportOOMError();
+            VIR_FREE((*dest)->in);
+            goto cleanup;
+        }
+        memcpy((*dest)->out, src->out, sizeof(*src->out));
+    }
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0) {
+        virNetDevBandwidthFree(*dest);
+        *dest = NULL;
+    }
+    return ret;
+}
+
+bool
+virNetDevBandwidthEqual(virNetDevBandwidthPtr a,
+                        virNetDevBandwidthPtr b)
+{
+    if (!a && !b)
+        return true;
+
+    if (!a || !b)
+        return false;
+
+    /* in */
+    if (a->in->average != b->in->average ||
+        a->in->peak != b->in->peak ||
+        a->in->burst != b->in->burst)
+        return false;
+
+    /*out*/
+    if (a->out->average != b->out->average ||
+        a->out->peak != b->out->peak ||
+        a->out->burst != b->out->burst)
+        return false;
+
+    return true;
+}
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+/*
+ * Traffic control is programmed over rtnetlink, with the same qdiscs,
+ * classes and filters the tc commands below the #else would create.
+ * All the changes to one interface are sent to the kernel together.
+ */
+
+/* Rates are given in kilobytes per second and sizes in kilobytes,
+ * with the same units as tc's "kbps" and "kb" */
+# define VIR_NETDEV_BANDWIDTH_RATE_UNIT 1000
+# define VIR_NETDEV_BANDWIDTH_SIZE_UNIT 1024
+
+/* Packet size assumed by tc for HTB classes */
+# define VIR_NETDEV_BANDWIDTH_HTB_MTU 1600
+
+/* Packet size given to the policer of outgoing traffic */
+# define VIR_NETDEV_BANDWIDTH_POLICE_MTU (64 * 1024)
+
+/* Entries in the rate tables of HTB classes and policers */
+# define VIR_NETDEV_BANDWIDTH_RTAB_SIZE 256
+
+/* Most messages ever sent about a single interface */
+# define VIR_NETDEV_BANDWIDTH_MAX_MSGS 10
+
+/* The packet scheduler clock, see /proc/net/psched */
+static double virNetDevBandwidthTickInUsec;
+static unsigned int virNetDevBandwidthHz;
+
+static int
+virNetDevBandwidthOnceInit(void)
+{
+    char *buf = NULL;
+    unsigned int t2us;
+    unsigned int us2t;
+    unsigned int clockRes;
+    unsigned int hz;
+    int n;
+
+    if (virFileReadAll("/proc/net/psched", 1024, &buf) < 0)
+        return -1;
+
+    n = sscanf(buf, "%08x%08x%08x%08x", &t2us, &us2t, &clockRes, &hz);
+    VIR_FREE(buf);
+
+    if (n < 3 || us2t == 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot parse /proc/net/psched"));
+        return -1;
+    }
+
+    /* Like tc, treat the multiplier advertised for nanosecond clocks
+     * as 1 */
+    if (clockRes == 1000000000)
+        t2us = us2t;
+
+    virNetDevBandwidthTickInUsec = (double)t2us / us2t *
+        ((double)clockRes / 1000000);
+    virNetDevBandwidthHz = (n == 4 && clockRes == 1000000 && hz) ? hz : 100;
+
+    VIR_DEBUG("tickInUsec=%f hz=%u",
+              virNetDevBandwidthTickInUsec, virNetDevBandwidthHz);
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetDevBandwidth)
+
+
+typedef struct _virNetDevBandwidthBatch virNetDevBandwidthBatch;
+typedef virNetDevBandwidthBatch *virNetDevBandwidthBatchPtr;
+struct _virNetDevBandwidthBatch {
+    const char *ifname;
+    int ifindex;
+    struct nl_msg *msgs[VIR_NETDEV_BANDWIDTH_MAX_MSGS];
+    size_t nmsgs;
+};
+
+static int
+virNetDevBandwidthBatchInit(virNetDevBandwidthBatchPtr batch,
+                            const char *ifname)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->ifname = ifname;
+
+    if (virNetDevBandwidthInitialize() < 0)
+        return -1;
+
+    return virNetDevGetIndex(ifname, &batch->ifindex);
+}
+
+static void
+virNetDevBandwidthBatchFree(virNetDevBandwidthBatchPtr batch)
+{
+    size_t i;
+
+    for (i = 0; i < batch->nmsgs; i++)
+        nlmsg_free(batch->msgs[i]);
+    batch->nmsgs = 0;
+}
+
+/*
+ * Send the messages queued on @batch.  Failures of the first @nignore
+ * messages, which remove settings that may not exist, are ignored.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+static int
+virNetDevBandwidthBatchRun(virNetDevBandwidthBatchPtr batch,
+                           size_t nignore)
+{
+    int errors[VIR_NETDEV_BANDWIDTH_MAX_MSGS];
+    size_t i;
+
+    if (batch->nmsgs == 0)
+        return 0;
+
+    if (virNetlinkCommandBatch(batch->msgs, batch->nmsgs, errors,
+                               NETLINK_ROUTE) < 0)
+        return -1;
+
+    for (i = nignore; i < batch->nmsgs; i++) {
+        if (errors[i]) {
+            virReportSystemError(errors[i],
+                                 _("Unable to set QoS on interface '%s'"),
+                                 batch->ifname);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Queue a new traffic control message of @type on @batch, about the
+ * object @handle under @parent.  @info carries the priority and the
+ * protocol of filters.  Attributes can then be added to the returned
+ * message.
+ */
+static struct nl_msg *
+virNetDevBandwidthBatchAdd(virNetDevBandwidthBatchPtr batch,
+                           int type,
+                           int flags,
+                           uint32_t parent,
+                           uint32_t handle,
+                           uint32_t info,
+                           const char *kind)
+{
+    struct tcmsg tcm = {
+        .tcm_family = AF_UNSPEC,
+        .tcm_ifindex = batch->ifindex,
+        .tcm_handle = handle,
+        .tcm_parent = parent,
+        .tcm_info = info,
+    };
+    struct nl_msg *nl_msg;
+
+    if (batch->nmsgs == VIR_NETDEV_BANDWIDTH_MAX_MSGS) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("too many QoS changes for one interface"));
+        return NULL;
+    }
+
+    if (!(nl_msg = nlmsg_alloc_simple(type, NLM_F_REQUEST | flags))) {
+        virReportOOMError();
+        return NULL;
+    }
+    batch->msgs[batch->nmsgs++] = nl_msg;
+
+    if (nlmsg_append(nl_msg, &tcm, sizeof(tcm), NLMSG_ALIGNTO) < 0 ||
+        (kind && nla_put_string(nl_msg, TCA_KIND, kind) < 0)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        return NULL;
+    }
+
+    return nl_msg;
+}
+
+static int
+virNetDevBandwidthToBytes(unsigned long long value,
+                          unsigned int unit,
+                          uint32_t *bytes)
+{
+    if (value > UINT32_MAX / unit) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("QoS value %llu is too large"), value);
+        return -1;
+    }
+
+    *bytes = value * unit;
+    return 0;
+}
+
+/* Time to send @size bytes at @rate bytes per second, in scheduler ticks */
+static uint32_t
+virNetDevBandwidthXmitTime(uint32_t rate, uint32_t size)
+{
+    return virNetDevBandwidthTickInUsec * (1000000.0 * size / rate);
+}
+
+/* Fill the rate table of @spec for packets of up to @mtu bytes */
+static void
+virNetDevBandwidthRateTable(struct tc_ratespec *spec,
+                            uint32_t *rtab,
+                            unsigned int mtu)
+{
+    int cellLog = 0;
+    int i;
+
+    while ((mtu >> cellLog) > VIR_NETDEV_BANDWIDTH_RTAB_SIZE - 1)
+        cellLog++;
+
+    for (i = 0; i < VIR_NETDEV_BANDWIDTH_RTAB_SIZE; i++)
+        rtab[i] = virNetDevBandwidthXmitTime(spec->rate, (i + 1) << cellLog);
+
+    spec->cell_align = -1;
+    spec->cell_log = cellLog;
+}
+
+static int
+virNetDevBandwidthBatchDelQdisc(virNetDevBandwidthBatchPtr batch,
+                                uint32_t parent,
+                                uint32_t handle,
+                                const char *kind)
+{
+    if (!virNetDevBandwidthBatchAdd(batch, RTM_DELQDISC, 0,
+                                    parent, handle, 0, kind))
+        return -1;
+    return 0;
+}
+
+static int
+virNetDevBandwidthBatchAddHTB(virNetDevBandwidthBatchPtr batch,
+                              uint32_t defcls)
+{
+    struct tc_htb_glob glob = {
+        .version = TC_HTB_PROTOVER,
+        .rate2quantum = 10,
+        .defcls = defcls,
+    };
+    struct nl_msg *nl_msg;
+    struct nlattr *opts;
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWQDISC,
+                                              NLM_F_CREATE | NLM_F_EXCL,
+                                              TC_H_ROOT, TC_H_MAKE(1 << 16, 0),
+                                              0, "htb")))
+        return -1;
+
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put(nl_msg, TCA_HTB_INIT, sizeof(glob), &glob) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, opts);
+
+    return 0;
+
+buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+/*
+ * Add, or change when @flags has no NLM_F_CREATE, the HTB class
+ * @classid with the given @rate and @ceil in bytes per second.  A
+ * @burst of 0 bytes lets the kernel send at least one full packet per
+ * timer tick, like tc does.
+ */
+static int
+virNetDevBandwidthBatchHTBClass(virNetDevBandwidthBatchPtr batch,
+                                int flags,
+                                uint32_t parent,
+                                uint32_t classid,
+                                uint32_t rate,
+                                uint32_t ceil,
+                                uint32_t burst)
+{
+    struct tc_htb_opt opt;
+    uint32_t rtab[VIR_NETDEV_BANDWIDTH_RTAB_SIZE];
+    uint32_t ctab[VIR_NETDEV_BANDWIDTH_RTAB_SIZE];
+    struct nl_msg *nl_msg;
+    struct nlattr *opts;
+
+    if (!rate || !ceil) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("QoS rate on interface '%s' must not be zero"),
+                       batch->ifname);
+        return -1;
+    }
+
+    memset(&opt, 0, sizeof(opt));
+    opt.rate.rate = rate;
+    opt.ceil.rate = ceil;
+
+    if (!burst)
+        burst = rate / virNetDevBandwidthHz + VIR_NETDEV_BANDWIDTH_HTB_MTU;
+
+    virNetDevBandwidthRateTable(&opt.rate, rtab, VIR_NETDEV_BANDWIDTH_HTB_MTU);
+    opt.buffer = virNetDevBandwidthXmitTime(rate, burst);
+    virNetDevBandwidthRateTable(&opt.ceil, ctab, VIR_NETDEV_BANDWIDTH_HTB_MTU);
+    opt.cbuffer = virNetDevBandwidthXmitTime(ceil,
+                                             ceil / virNetDevBandwidthHz +
+                                             VIR_NETDEV_BANDWIDTH_HTB_MTU);
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWTCLASS, flags,
+                                              parent, classid, 0, "htb")))
+        return -1;
+
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put(nl_msg, TCA_HTB_PARMS, sizeof(opt), &opt) < 0 ||
+        nla_put(nl_msg, TCA_HTB_RTAB, sizeof(rtab), rtab) < 0 ||
+        nla_put(nl_msg, TCA_HTB_CTAB, sizeof(ctab), ctab) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, opts);
+
+    return 0;
+
+buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+static int
+virNetDevBandwidthBatchAddSFQ(virNetDevBandwidthBatchPtr batch,
+                              uint32_t parent,
+                              uint32_t handle)
+{
+    struct tc_sfq_qopt opt = {
+        .perturb_period = 10,
+    };
+    struct nl_msg *nl_msg;
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWQDISC,
+                                              NLM_F_CREATE | NLM_F_EXCL,
+                                              parent, handle, 0, "sfq")))
+        return -1;
+
+    if (nla_put(nl_msg, TCA_OPTIONS, sizeof(opt), &opt) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Send IPv4 packets marked 1 by the firewall to class 1 */
+static int
+virNetDevBandwidthBatchAddFwFilter(virNetDevBandwidthBatchPtr batch)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *opts;
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWTFILTER,
+                                              NLM_F_CREATE | NLM_F_EXCL,
+                                              TC_H_MAKE(1 << 16, 0), 1,
+                                              TC_H_MAKE(0, htons(ETH_P_IP)),
+                                              "fw")))
+        return -1;
+
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put_u32(nl_msg, TCA_FW_CLASSID, 1) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, opts);
+
+    return 0;
+
+buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+/* Add a 32 bit key of a u32 selector, in host byte order */
+static void
+virNetDevBandwidthU32Key(struct tc_u32_sel *sel,
+                         uint32_t val,
+                         uint32_t mask,
+                         int off)
+{
+    struct tc_u32_key *key = &sel->keys[sel->nkeys++];
+
+    key->mask = htonl(mask);
+    key->val = htonl(val & mask);
+    key->off = off;
+}
+
+/*
+ * Add a u32 filter under @parent sending the IPv4 packets matched by
+ * @sel to @classid, and dropping those above @rate bytes per second
+ * with bursts of @burst bytes if @rate is not 0.
+ */
+static int
+virNetDevBandwidthBatchAddU32Filter(virNetDevBandwidthBatchPtr batch,
+                                    uint32_t parent,
+                                    uint32_t prio,
+                                    uint32_t classid,
+                                    struct tc_u32_sel *sel,
+                                    uint32_t rate,
+                                    uint32_t burst)
+{
+    struct nl_msg *nl_msg;
+    struct nlattr *opts;
+    struct nlattr *police;
+
+    sel->flags |= TC_U32_TERMINAL;
+
+    if (!(nl_msg = virNetDevBandwidthBatchAdd(batch, RTM_NEWTFILTER,
+                                              NLM_F_CREATE | NLM_F_EXCL,
+                                              parent, 0,
+                                              TC_H_MAKE(prio << 16,
+                                                        htons(ETH_P_IP)),
+                                              "u32")))
+        return -1;
+
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put_u32(nl_msg, TCA_U32_CLASSID, classid) < 0)
+        goto buffer_too_small;
+
+    if (rate) {
+        struct tc_police p;
+        uint32_t rtab[VIR_NETDEV_BANDWIDTH_RTAB_SIZE];
+
+        memset(&p, 0, sizeof(p));
+        p.action = TC_POLICE_SHOT;
+        p.mtu = VIR_NETDEV_BANDWIDTH_POLICE_MTU;
+        p.rate.rate = rate;
+        virNetDevBandwidthRateTable(&p.rate, rtab, p.mtu);
+        p.burst = virNetDevBandwidthXmitTime(rate, burst);
+
+        if (!(police = nla_nest_start(nl_msg, TCA_U32_POLICE)) ||
+            nla_put(nl_msg, TCA_POLICE_TBF, sizeof(p), &p) < 0 ||
+            nla_put(nl_msg, TCA_POLICE_RATE, sizeof(rtab), rtab) < 0)
+            goto buffer_too_small;
+        nla_nest_end(nl_msg, police);
+    }
+
+    if (nla_put(nl_msg, TCA_U32_SEL,
+                sizeof(*sel) + sel->nkeys * sizeof(sel->keys[0]), sel) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, opts);
+
+    return 0;
+
+buffer_too_small:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+
+/**
+ * virNetDevBandwidthSet:
+ * @ifname: on which interface
+ * @bandwidth: rates to set (may be NULL)
+ * @hierarchical_class: whether to create hierarchical class
+ *
+ * This function enables QoS on specified interface
+ * and set given traffic limits for both, incoming
+ * and outgoing traffic. Any previous setting get
+ * overwritten. If @hierarchical_class is TRUE, create
+ * hierarchical class. It is used to guarantee minimal
+ * throughput ('floor' attribute in NIC).
+ *
+ * The layout of the classes is described along the
+ * tc based implementation of this function.
+ *
+ * Return 0 on success, -1 otherwise.
+ */
+int
+virNetDevBandwidthSet(const char *ifname,
+                      virNetDevBandwidthPtr bandwidth,
+                      bool hierarchical_class)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+    uint32_t average;
+    uint32_t peak;
+    uint32_t burst;
+
+    if (!bandwidth) {
+        /* nothing to be enabled */
+        return 0;
+    }
+
+    if (virNetDevBandwidthBatchInit(&batch, ifname) < 0)
+        return -1;
+
+    /* Replace any previous setting */
+    if (virNetDevBandwidthBatchDelQdisc(&batch, TC_H_ROOT, 0, NULL) < 0 ||
+        virNetDevBandwidthBatchDelQdisc(&batch, TC_H_INGRESS,
+                                        TC_H_MAKE(TC_H_INGRESS, 0),
+                                        "ingress") < 0)
+        goto cleanup;
+
+    if (bandwidth->in && bandwidth->in->average) {
+        if (virNetDevBandwidthToBytes(bandwidth->in->average,
+                                      VIR_NETDEV_BANDWIDTH_RATE_UNIT,
+                                      &average) < 0 ||
+            virNetDevBandwidthToBytes(bandwidth->in->peak,
+                                      VIR_NETDEV_BANDWIDTH_RATE_UNIT,
+                                      &peak) < 0 ||
+            virNetDevBandwidthToBytes(bandwidth->in->burst,
+                                      VIR_NETDEV_BANDWIDTH_SIZE_UNIT,
+                                      &burst) < 0)
+            goto cleanup;
+
+        if (virNetDevBandwidthBatchAddHTB(&batch,
+                                          hierarchical_class ? 2 : 1) < 0)
+            goto cleanup;
+
+        if (hierarchical_class &&
+            virNetDevBandwidthBatchHTBClass(&batch, NLM_F_CREATE | NLM_F_EXCL,
+                                            TC_H_MAKE(1 << 16, 0),
+                                            TC_H_MAKE(1 << 16, 1),
+                                            average, peak ? peak : average,
+                                            0) < 0)
+            goto cleanup;
+
+        if (virNetDevBandwidthBatchHTBClass(&batch, NLM_F_CREATE | NLM_F_EXCL,
+                                            TC_H_MAKE(1 << 16,
+                                                      hierarchical_class ? 1 : 0),
+                                            TC_H_MAKE(1 << 16,
+                                                      hierarchical_class ? 2 : 1),
+                                            average, peak ? peak : average,
+                                            burst) < 0)
+            goto cleanup;
+
+        if (virNetDevBandwidthBatchAddSFQ(&batch,
+                                          TC_H_MAKE(1 << 16,
+                                                    hierarchical_class ? 2 : 1),
+                                          TC_H_MAKE(2 << 16, 0)) < 0)
+            goto cleanup;
+
+        if (virNetDevBandwidthBatchAddFwFilter(&batch) < 0)
+            goto cleanup;
+    }
+
+    if (bandwidth->out && bandwidth->out->average) {
+        struct {
+            struct tc_u32_sel sel;
+            struct tc_u32_key keys[1];
+        } match;
+
+        if (virNetDevBandwidthToBytes(bandwidth->out->average,
+                                      VIR_NETDEV_BANDWIDTH_RATE_UNIT,
+                                      &average) < 0 ||
+            virNetDevBandwidthToBytes(bandwidth->out->burst ?
+                                      bandwidth->out->burst :
+                                      bandwidth->out->average,
+                                      VIR_NETDEV_BANDWIDTH_SIZE_UNIT,
+                                      &burst) < 0)
+            goto cleanup;
+
+        if (!virNetDevBandwidthBatchAdd(&batch, RTM_NEWQDISC,
+                                        NLM_F_CREATE | NLM_F_EXCL,
+                                        TC_H_INGRESS,
+                                        TC_H_MAKE(TC_H_INGRESS, 0),
+                                        0, "ingress"))
+            goto cleanup;
+
+        /* Police every IPv4 source address */
+        memset(&match, 0, sizeof(match));
+        virNetDevBandwidthU32Key(&match.sel, 0, 0, 12);
+
+        if (virNetDevBandwidthBatchAddU32Filter(&batch,
+                                                TC_H_MAKE(TC_H_INGRESS, 0),
+                                                0, 1, &match.sel,
+                                                average, burst) < 0)
+            goto cleanup;
+    }
+
+    ret = virNetDevBandwidthBatchRun(&batch, 2);
+
+cleanup:
+    virNetDevBandwidthBatchFree(&batch);
+    return ret;
+}
+
+/**
+ * virNetDevBandwidthClear:
+ * @ifname: on which interface
+ *
+ * This function tries to disable QoS on specified interface
+ * by deleting root and ingress qdisc. However, this may fail
+ * if we try to remove the default one.
+ *
+ * Return 0 on success, -1 otherwise.
+ */
+int
+virNetDevBandwidthClear(const char *ifname)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+
+    if (virNetDevBandwidthBatchInit(&batch, ifname) < 0)
+        return -1;
+
+    if (virNetDevBandwidthBatchDelQdisc(&batch, TC_H_ROOT, 0, NULL) < 0 ||
+        virNetDevBandwidthBatchDelQdisc(&batch, TC_H_INGRESS,
+                                        TC_H_MAKE(TC_H_INGRESS, 0),
+                                        "ingress") < 0)
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchRun(&batch, batch.nmsgs);
+
+cleanup:
+    virNetDevBandwidthBatchFree(&batch);
+    return ret;
+}
+
+/*
+ * virNetDevBandwidthPlug:
+ * @brname: name of the bridge
+ * @net_bandwidth: QoS settings on @brname
+ * @ifmac: MAC of interface
+ * @bandwidth: QoS settings for interface
+ * @id: unique ID (MUST be greater than 2)
+ *
+ * Set bridge part of interface QoS settings, e.g. guaranteed
+ * bandwidth.  @id is an unique ID (among @brname) from which
+ * other identifiers for class, qdisc and filter are derived.
+ * However, two classes were already set up (by
+ * virNetDevBandwidthSet). That's why this @id MUST be greater
+ * than 2. You may want to keep passed @id, as it is used later
+ * by virNetDevBandwidthUnplug.
+ *
+ * Returns:
+ * 0 if QoS set successfully
+ * -1 otherwise.
+ */
+int
+virNetDevBandwidthPlug(const char *brname,
+                       virNetDevBandwidthPtr net_bandwidth,
+                       const virMacAddrPtr ifmac_ptr,
+                       virNetDevBandwidthPtr bandwidth,
+                       unsigned int id)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+    unsigned char ifmac[VIR_MAC_BUFLEN];
+    char ifmacStr[VIR_MAC_STRING_BUFLEN];
+    uint32_t floor;
+    uint32_t ceil;
+    struct {
+        struct tc_u32_sel sel;
+        struct tc_u32_key keys[3];
+    } match;
+
+    if (id <= 2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, _("Invalid class ID %d"), id);
+        return -1;
+    }
+
+    virMacAddrGetRaw(ifmac_ptr, ifmac);
+    virMacAddrFormat(ifmac_ptr, ifmacStr);
+
+    if (!net_bandwidth || !net_bandwidth->in) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("Bridge '%s' has no QoS set, therefore "
+                         "unable to set 'floor' on '%s'"),
+                       brname, ifmacStr);
+        return -1;
+    }
+
+    if (virNetDevBandwidthBatchInit(&batch, brname) < 0)
+        return -1;
+
+    if (virNetDevBandwidthToBytes(bandwidth->in->floor,
+                                  VIR_NETDEV_BANDWIDTH_RATE_UNIT,
+                                  &floor) < 0 ||
+        virNetDevBandwidthToBytes(net_bandwidth->in->peak ?
+                                  net_bandwidth->in->peak :
+                                  net_bandwidth->in->average,
+                                  VIR_NETDEV_BANDWIDTH_RATE_UNIT,
+                                  &ceil) < 0)
+        goto cleanup;
+
+    if (virNetDevBandwidthBatchHTBClass(&batch, NLM_F_CREATE | NLM_F_EXCL,
+                                        TC_H_MAKE(1 << 16, 1),
+                                        TC_H_MAKE(1 << 16, id),
+                                        floor, ceil, 0) < 0)
+        goto cleanup;
+
+    if (virNetDevBandwidthBatchAddSFQ(&batch, TC_H_MAKE(1 << 16, id),
+                                      TC_H_MAKE(id << 16, 0)) < 0)
+        goto cleanup;
+
+    /* Match the ethertype and the destination MAC address, counting
+     * back from the start of the IP header */
+    memset(&match, 0, sizeof(match));
+    virNetDevBandwidthU32Key(&match.sel, ETH_P_IP, 0xffff, -4);
+    virNetDevBandwidthU32Key(&match.sel,
+                             ifmac[2] << 24 | ifmac[3] << 16 |
+                             ifmac[4] << 8 | ifmac[5],
+                             0xffffffff, -12);
+    virNetDevBandwidthU32Key(&match.sel, ifmac[0] << 8 | ifmac[1],
+                             0xffff, -16);
+
+    if (virNetDevBandwidthBatchAddU32Filter(&batch, 0, id,
+                                            TC_H_MAKE(1 << 16, id),
+                                            &match.sel, 0, 0) < 0)
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchRun(&batch, 0);
+
+cleanup:
+    virNetDevBandwidthBatchFree(&batch);
+    return ret;
+}
+
+/*
+ * virNetDevBandwidthUnplug:
+ * @brname: from which bridge are we unplugging
+ * @id: unique identifier (MUST be greater than 2)
+ *
+ * Remove QoS settings from bridge.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int
+virNetDevBandwidthUnplug(const char *brname,
+                         unsigned int id)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+
+    if (id <= 2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, _("Invalid class ID %d"), id);
+        return -1;
+    }
+
+    if (virNetDevBandwidthBatchInit(&batch, brname) < 0)
+        return -1;
+
+    if (virNetDevBandwidthBatchDelQdisc(&batch, 0,
+                                        TC_H_MAKE(id << 16, 0), NULL) < 0 ||
+        !virNetDevBandwidthBatchAdd(&batch, RTM_DELTFILTER, 0, 0, 0,
+                                    TC_H_MAKE(id << 16, 0), NULL) ||
+        !virNetDevBandwidthBatchAdd(&batch, RTM_DELTCLASS, 0, 0,
+                                    TC_H_MAKE(1 << 16, id), 0, NULL))
+        goto cleanup;
+
+    /* Don't treat errors as fatal, but
+     * try to remove as much as possible */
+    ret = virNetDevBandwidthBatchRun(&batch, batch.nmsgs);
+
+cleanup:
+    virNetDevBandwidthBatchFree(&batch);
+    return ret;
+}
+
+/**
+ * virNetDevBandwidthUpdateRate:
+ * @ifname: interface name
+ * @classid: ID of class to update
+ * @new_rate: new rate
+ *
+ * This function updates the 'rate' attribute of HTB class.
+ * It can be used whenever a new interface is plugged to a
+ * bridge to adjust average throughput of non guaranteed
+ * NICs.
+ *
+ * Returns 0 on success, -1 otherwise.
+ */
+int
+virNetDevBandwidthUpdateRate(const char *ifname,
+                             const char *class_id,
+                             virNetDevBandwidthPtr bandwidth,
+                             unsigned long long new_rate)
+{
+    int ret = -1;
+    virNetDevBandwidthBatch batch;
+    unsigned int major;
+    unsigned int minor;
+    char *end;
+    uint32_t rate;
+    uint32_t ceil;
+
+    if (virStrToLong_ui(class_id, &end, 16, &major) < 0 || *end != ':' ||
+        virStrToLong_ui(end + 1, NULL, 16, &minor) < 0 ||
+        major > 0xffff || minor > 0xffff) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Invalid class ID %s"), class_id);
+        return -1;
+    }
+
+    if (virNetDevBandwidthBatchInit(&batch, ifname) < 0)
+        return -1;
+
+    if (virNetDevBandwidthToBytes(new_rate,
+                                  VIR_NETDEV_BANDWIDTH_RATE_UNIT,
+                                  &rate) < 0 ||
+        virNetDevBandwidthToBytes(bandwidth->in->peak ?
+                                  bandwidth->in->peak :
+                                  bandwidth->in->average,
+                                  VIR_NETDEV_BANDWIDTH_RATE_UNIT,
+                                  &ceil) < 0)
+        goto cleanup;
+
+    if (virNetDevBandwidthBatchHTBClass(&batch, 0, 0,
+                                        TC_H_MAKE(major << 16, minor),
+                                        rate, ceil, 0) < 0)
+        goto cleanup;
+
+    ret = virNetDevBandwidthBatchRun(&batch, 0);
+
+cleanup:
+    virNetDevBandwidthBatchFree(&batch);
+    return ret;
+}
+
+#else /* !(defined(__linux__) && defined(HAVE_LIBNL)) */
+
 /**
  * virNetDevBandwidthSet:
  * @ifname: on which interface
@@ -276,83 +1182,6 @@ virNetDevBandwidthClear(const char *ifname)
     return ret;
 }
 
-/*
- * virNetDevBandwidthCopy:
- * @dest: destination
- * @src:  source (may be NULL)
- *
- * Returns -1 on OOM error (which gets reported),
- * 0 otherwise.
- */
-int
-virNetDevBandwidthCopy(virNetDevBandwidthPtr *dest,
-                       const virNetDevBandwidthPtr src)
-{
-    int ret = -1;
-
-    *dest = NULL;
-    if (!src) {
-        /* nothing to be copied */
-        return 0;
-    }
-
-    if (VIR_ALLOC(*dest) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
-    if (src->in) {
-        if (VIR_ALLOC((*dest)->in) < 0) {
-            virReportOOMError();
-            goto cleanup;
-        }
-        memcpy((*dest)->in, src->in, sizeof(*src->in));
-    }
-
-    if (src->out) {
-        if (VIR_ALLOC((*dest)->out) < 0) {
-            virReportOOMError();
-            VIR_FREE((*dest)->in);
-            goto cleanup;
-        }
-        memcpy((*dest)->out, src->out, sizeof(*src->out));
-    }
-
-    ret = 0;
-
-cleanup:
-    if (ret < 0) {
-        virNetDevBandwidthFree(*dest);
-        *dest = NULL;
-    }
-    return ret;
-}
-
-bool
-virNetDevBandwidthEqual(virNetDevBandwidthPtr a,
-                        virNetDevBandwidthPtr b)
-{
-    if (!a && !b)
-        return true;
-
-    if (!a || !b)
-        return false;
-
-    /* in */
-    if (a->in->average != b->in->average ||
-        a->in->peak != b->in->peak ||
-        a->in->burst != b->in->burst)
-        return false;
-
-    /*out*/
-    if (a->out->average != b->out->average ||
-        a->out->peak != b->out->peak ||
-        a->out->burst != b->out->burst)
-        return false;
-
-    return true;
-}
-
 /*
  * virNetDevBandwidthPlug:
  * @brname: name of the bridge
@@ -583,3 +1412,5 @@ cleanup:
     VIR_FREE(ceil);
     return ret;
 }
+
+#endif /* !(defined(__linux__) && defined(HAVE_LIBNL)) */
@@ -23,6 +23,7 @@
 #include <config.h>
 
 #include "virnetdevbridge.h"
+#include "virnetdev.h"
 #include "virterror_internal.h"
 #include "util.h"
 #include "virfile.h"
@@ -228,6 +229,7 @@ int virNetDevBridgeCreate(const char *brname)
     ret = 0;
 
 cleanup:
+    virNetDevLinkCacheInvalidate(brname);
     VIR_FORCE_CLOSE(fd);
     return ret;
 }
@@ -266,6 +268,7 @@ int virNetDevBridgeDelete(const char *brname)
     ret = 0;
 
 cleanup:
+    virNetDevLinkCacheInvalidate(brname);
     VIR_FORCE_CLOSE(fd);
     return ret;
 }
@@ -191,6 +191,7 @@ virNetDevMacVLanCreate(const char *ifname,
 
     rc = 0;
 cleanup:
+    virNetDevLinkCacheInvalidate(ifname);
     nlmsg_free(nl_msg);
     VIR_FREE(recvbuf);
     return rc;
@@ -271,6 +272,7 @@ int virNetDevMacVLanDelete(const char *ifname)
 
     rc = 0;
 cleanup:
+    virNetDevLinkCacheInvalidate(ifname);
     nlmsg_free(nl_msg);
     VIR_FREE(recvbuf);
     return rc;
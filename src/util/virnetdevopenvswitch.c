@@ -181,66 +181,140 @@ cleanup:
 }
 
 /**
- * virNetDevOpenvswitchGetMigrateData:
- * @migrate: a pointer to store the data into, allocated by this function
- * @ifname: name of the interface for which data is being migrated
+ * virNetDevOpenvswitchGetMigrateDataList:
+ * @migrate: array of @nifnames pointers to store the data into
+ * @ifnames: names of the interfaces for which data is being migrated
+ * @nifnames: number of interfaces
  *
- * Allocates data to be migrated specific to Open vSwitch
+ * Allocates data to be migrated specific to Open vSwitch for several
+ * interfaces at once. ovs-vsctl accepts any number of commands
+ * separated by "--" and prints one line per "get", so a single run
+ * serves a guest with many ports.
  *
  * Returns 0 in case of success or -1 in case of failure
  */
-int virNetDevOpenvswitchGetMigrateData(char **migrate, const char *ifname)
+int virNetDevOpenvswitchGetMigrateDataList(char **migrate,
+                                           const char **ifnames,
+                                           size_t nifnames)
 {
     virCommandPtr cmd = NULL;
+    char *output = NULL;
+    char *line;
+    char *next;
+    size_t i;
     int ret = -1;
 
-    cmd = virCommandNewArgList(OVSVSCTL, "--timeout=5", "get", "Interface",
-                               ifname, "external_ids:PortData", NULL);
+    if (nifnames == 0)
+        return 0;
+
+    cmd = virCommandNewArgList(OVSVSCTL, "--timeout=5", NULL);
+    for (i = 0; i < nifnames; i++)
+        virCommandAddArgList(cmd, "--", "get", "Interface", ifnames[i],
+                             "external_ids:PortData", NULL);
 
-    virCommandSetOutputBuffer(cmd, migrate);
+    virCommandSetOutputBuffer(cmd, &output);
 
     /* Run the command */
     if (virCommandRun(cmd, NULL) < 0) {
         virReportSystemError(VIR_ERR_INTERNAL_ERROR,
                              _("Unable to run command to get OVS port data for "
-                             "interface %s"), ifname);
+                             "interface %s"), ifnames[0]);
         goto cleanup;
     }
 
-    /* Wipeout the newline */
-    (*migrate)[strlen(*migrate) - 1] = '\0';
+    line = output;
+    for (i = 0; i < nifnames; i++) {
+        if (!line || !(next = strchr(line, '\n'))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Missing OVS port data for interface %s"),
+                           ifnames[i]);
+            goto cleanup;
+        }
+        *next = '\0';
+        if (!(migrate[i] = strdup(line))) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        line = next + 1;
+    }
+
     ret = 0;
 cleanup:
+    if (ret < 0) {
+        for (i = 0; i < nifnames; i++)
+            VIR_FREE(migrate[i]);
+    }
+    VIR_FREE(output);
+    virCommandFree(cmd);
     return ret;
 }
 
 /**
- * virNetDevOpenvswitchSetMigrateData:
- * @migrate: the data which was transferred during migration
- * @ifname: the name of the interface the data is associated with
+ * virNetDevOpenvswitchGetMigrateData:
+ * @migrate: a pointer to store the data into, allocated by this function
+ * @ifname: name of the interface for which data is being migrated
  *
- * Repopulates OVS per-port data on destination host
+ * Allocates data to be migrated specific to Open vSwitch
  *
  * Returns 0 in case of success or -1 in case of failure
  */
-int virNetDevOpenvswitchSetMigrateData(char *migrate, const char *ifname)
+int virNetDevOpenvswitchGetMigrateData(char **migrate, const char *ifname)
+{
+    return virNetDevOpenvswitchGetMigrateDataList(migrate, &ifname, 1);
+}
+
+/**
+ * virNetDevOpenvswitchSetMigrateDataList:
+ * @migrate: the data which was transferred during migration, per interface
+ * @ifnames: the names of the interfaces the data is associated with
+ * @nifnames: number of interfaces
+ *
+ * Repopulates OVS per-port data on destination host for several
+ * interfaces with a single ovs-vsctl transaction
+ *
+ * Returns 0 in case of success or -1 in case of failure
+ */
+int virNetDevOpenvswitchSetMigrateDataList(char **migrate,
+                                           const char **ifnames,
+                                           size_t nifnames)
 {
     virCommandPtr cmd = NULL;
+    size_t i;
     int ret = -1;
 
-    cmd = virCommandNewArgList(OVSVSCTL, "--timeout=5", "set",
-                               "Interface", ifname, NULL);
-    virCommandAddArgFormat(cmd, "external_ids:PortData=%s", migrate);
+    if (nifnames == 0)
+        return 0;
+
+    cmd = virCommandNewArgList(OVSVSCTL, "--timeout=5", NULL);
+    for (i = 0; i < nifnames; i++) {
+        virCommandAddArgList(cmd, "--", "set", "Interface", ifnames[i], NULL);
+        virCommandAddArgFormat(cmd, "external_ids:PortData=%s", migrate[i]);
+    }
 
     /* Run the command */
     if (virCommandRun(cmd, NULL) < 0) {
         virReportSystemError(VIR_ERR_INTERNAL_ERROR,
                              _("Unable to run command to set OVS port data for "
-                             "interface %s"), ifname);
+                             "interface %s"), ifnames[0]);
         goto cleanup;
     }
 
     ret = 0;
 cleanup:
+    virCommandFree(cmd);
     return ret;
 }
+
+/**
+ * virNetDevOpenvswitchSetMigrateData:
+ * @migrate: the data which was transferred during migration
+ * @ifname: the name of the interface the data is associated with
+ *
+ * Repopulates OVS per-port data on destination host
+ *
+ * Returns 0 in case of success or -1 in case of failure
+ */
+int virNetDevOpenvswitchSetMigrateData(char *migrate, const char *ifname)
+{
+    return virNetDevOpenvswitchSetMigrateDataList(&migrate, &ifname, 1);
+}
@@ -107,7 +107,8 @@ virNetDevProbeVnetHdr(int tapfd)
 /**
  * virNetDevTapCreate:
  * @ifname: the interface name
- * @tapfd: file descriptor return value for the new tap device
+ * @tapfd: array of file descriptor return value for the new tap device
+ * @tapfdSize: number of file descriptors in @tapfd
  * @flags: OR of virNetDevTapCreateFlags. Only one flag is recognized:
  *
  *   VIR_NETDEV_TAP_CREATE_VNET_HDR
@@ -115,59 +116,88 @@ virNetDevProbeVnetHdr(int tapfd)
  *   VIR_NETDEV_TAP_CREATE_PERSIST
  *     - The device will persist after the file descriptor is closed
  *
- * Creates a tap interface.
- * If the @tapfd parameter is supplied, the open tap device file descriptor
- * will be returned, otherwise the TAP device will be closed. The caller must
- * use virNetDevTapDelete to remove a persistent TAP device when it is no
- * longer needed.
+ * Creates a tap interface. The caller must use virNetDevTapDelete to
+ * remove a persistent TAP device when it is no longer needed. In case
+ * @tapfdSize is greater than one, a multiqueue TAP device is created,
+ * with one queue per file descriptor stored into @tapfd. If @tapfd is
+ * NULL, the TAP device is closed once created.
  *
  * Returns 0 in case of success or -1 on failure.
  */
 int virNetDevTapCreate(char **ifname,
                        int *tapfd,
+                       int tapfdSize,
                        unsigned int flags)
 {
-    int fd;
+    int fd = -1;
     struct ifreq ifr;
     int ret = -1;
+    int i;
 
-    if ((fd = open("/dev/net/tun", O_RDWR)) < 0) {
-        virReportSystemError(errno, "%s",
-                             _("Unable to open /dev/net/tun, is tun module loaded?"));
+    if (!tapfd)
+        tapfdSize = 1;
+
+# ifndef IFF_MULTI_QUEUE
+    if (tapfdSize > 1) {
+        virReportSystemError(EINVAL, "%s",
+                             _("Multiqueue devices are not supported "
+                               "on this system"));
         return -1;
     }
+# endif
 
     memset(&ifr, 0, sizeof(ifr));
 
-    ifr.ifr_flags = IFF_TAP|IFF_NO_PI;
-
-# ifdef IFF_VNET_HDR
-    if ((flags &  VIR_NETDEV_TAP_CREATE_VNET_HDR) &&
-        virNetDevProbeVnetHdr(fd))
-        ifr.ifr_flags |= IFF_VNET_HDR;
-# endif
-
+    /* The first queue may be created from a name template, all other
+     * ones attach to the device it ended up with. */
     if (virStrcpyStatic(ifr.ifr_name, *ifname) == NULL) {
         virReportSystemError(ERANGE,
                              _("Network interface name '%s' is too long"),
                              *ifname);
-        goto cleanup;
-
+        return -1;
     }
 
-    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
-        virReportSystemError(errno,
-                             _("Unable to create tap device %s"),
-                             NULLSTR(*ifname));
-        goto cleanup;
-    }
+    for (i = 0; i < tapfdSize; i++) {
+        if ((fd = open("/dev/net/tun", O_RDWR)) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to open /dev/net/tun, is tun module loaded?"));
+            goto cleanup;
+        }
 
-    if ((flags & VIR_NETDEV_TAP_CREATE_PERSIST) &&
-        (errno = ioctl(fd, TUNSETPERSIST, 1))) {
-        virReportSystemError(errno,
-                             _("Unable to set tap device %s to persistent"),
-                             NULLSTR(*ifname));
-        goto cleanup;
+        ifr.ifr_flags = IFF_TAP|IFF_NO_PI;
+
+# ifdef IFF_MULTI_QUEUE
+        if (tapfdSize > 1)
+            ifr.ifr_flags |= IFF_MULTI_QUEUE;
+# endif
+
+# ifdef IFF_VNET_HDR
+        if ((flags &  VIR_NETDEV_TAP_CREATE_VNET_HDR) &&
+            virNetDevProbeVnetHdr(fd))
+            ifr.ifr_flags |= IFF_VNET_HDR;
+# endif
+
+        if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to create tap device %s"),
+                                 NULLSTR(*ifname));
+            goto cleanup;
+        }
+
+        if (i == 0 &&
+            (flags & VIR_NETDEV_TAP_CREATE_PERSIST) &&
+            (errno = ioctl(fd, TUNSETPERSIST, 1))) {
+            virReportSystemError(errno,
+                                 _("Unable to set tap device %s to persistent"),
+                                 NULLSTR(*ifname));
+            goto cleanup;
+        }
+
+        if (tapfd)
+            tapfd[i] = fd;
+        else
+            VIR_FORCE_CLOSE(fd);
+        fd = -1;
     }
 
     VIR_FREE(*ifname);
@@ -175,16 +205,16 @@ int virNetDevTapCreate(char **ifname,
         virReportOOMError();
         goto cleanup;
     }
-    if (tapfd)
-        *tapfd = fd;
-    else
-        VIR_FORCE_CLOSE(fd);
 
+    virNetDevLinkCacheInvalidate(*ifname);
     ret = 0;
 
 cleanup:
-    if (ret < 0)
+    if (ret < 0) {
         VIR_FORCE_CLOSE(fd);
+        while (tapfd && i--)
+            VIR_FORCE_CLOSE(tapfd[i]);
+    }
 
     return ret;
 }
@@ -227,12 +257,14 @@ int virNetDevTapDelete(const char *ifname)
     ret = 0;
 
 cleanup:
+    virNetDevLinkCacheInvalidate(ifname);
     VIR_FORCE_CLOSE(fd);
     return ret;
 }
 #else /* ! TUNSETIFF */
 int virNetDevTapCreate(char **ifname ATTRIBUTE_UNUSED,
                        int *tapfd ATTRIBUTE_UNUSED,
+                       int tapfdSize ATTRIBUTE_UNUSED,
                        unsigned int flags ATTRIBUTE_UNUSED)
 {
     virReportSystemError(ENOSYS, "%s",
@@ -253,7 +285,8 @@ int virNetDevTapDelete(const char *ifname ATTRIBUTE_UNUSED)
  * @brname: the bridge name
  * @ifname: the interface name (or name template)
  * @macaddr: desired MAC address
- * @tapfd: file descriptor return value for the new tap device
+ * @tapfd: array of file descriptor return value for the new tap device
+ * @tapfdSize: number of file descriptors in @tapfd
  * @virtPortProfile: bridge/port specific configuration
  * @flags: OR of virNetDevTapCreateFlags:
 
@@ -269,10 +302,11 @@ int virNetDevTapDelete(const char *ifname ATTRIBUTE_UNUSED)
  * This function creates a new tap device on a bridge. @ifname can be either
  * a fixed name or a name template with '%d' for dynamic name allocation.
  * in either case the final name for the bridge will be stored in @ifname.
- * If the @tapfd parameter is supplied, the open tap device file descriptor
- * will be returned, otherwise the TAP device will be closed. The caller must
- * use virNetDevTapDelete to remove a persistent TAP device when it is no
- * longer needed.
+ * If the @tapfd parameter is supplied, the open tap device file descriptors
+ * will be returned, otherwise the TAP device will be closed. A @tapfdSize
+ * greater than one creates a multiqueue TAP device. The caller must use
+ * virNetDevTapDelete to remove a persistent TAP device when it is no longer
+ * needed.
  *
  * Returns 0 in case of success or -1 on failure
  */
@@ -281,13 +315,15 @@ int virNetDevTapCreateInBridgePort(const char *brname,
                                    const virMacAddrPtr macaddr,
                                    const unsigned char *vmuuid,
                                    int *tapfd,
+                                   int tapfdSize,
                                    virNetDevVPortProfilePtr virtPortProfile,
                                    virNetDevVlanPtr virtVlan,
                                    unsigned int flags)
 {
     virMacAddr tapmac;
+    int mtu;
 
-    if (virNetDevTapCreate(ifname, tapfd, flags) < 0)
+    if (virNetDevTapCreate(ifname, tapfd, tapfdSize, flags) < 0)
         return -1;
 
     /* We need to set the interface MAC before adding it
@@ -315,34 +351,32 @@ int virNetDevTapCreateInBridgePort(const char *brname,
         tapmac.addr[0] = 0xFE; /* Discourage bridge from using TAP dev MAC */
     }
 
-    if (virNetDevSetMAC(*ifname, &tapmac) < 0)
-        goto error;
-
     /* We need to set the interface MTU before adding it
      * to the bridge, because the bridge will have its
      * MTU adjusted automatically when we add the new interface.
      */
-    if (virNetDevSetMTUFromDevice(*ifname, brname) < 0)
+    if ((mtu = virNetDevGetMTU(brname)) < 0)
         goto error;
 
     if (virtPortProfile) {
-        if (virNetDevOpenvswitchAddPort(brname, *ifname, macaddr, vmuuid,
-                                        virtPortProfile, virtVlan) < 0) {
+        if (virNetDevSetupLink(*ifname, &tapmac, mtu, NULL, false) < 0 ||
+            virNetDevOpenvswitchAddPort(brname, *ifname, macaddr, vmuuid,
+                                        virtPortProfile, virtVlan) < 0 ||
+            virNetDevSetOnline(*ifname,
+                               !!(flags & VIR_NETDEV_TAP_CREATE_IFUP)) < 0)
             goto error;
-        }
     } else {
-        if (virNetDevBridgeAddPort(brname, *ifname) < 0)
+        /* MAC address, MTU, bridge port and link state in one request */
+        if (virNetDevSetupLink(*ifname, &tapmac, mtu, brname,
+                               !!(flags & VIR_NETDEV_TAP_CREATE_IFUP)) < 0)
             goto error;
     }
 
-    if (virNetDevSetOnline(*ifname, !!(flags & VIR_NETDEV_TAP_CREATE_IFUP)) < 0)
-        goto error;
-
     return 0;
 
  error:
-    if (tapfd)
-        VIR_FORCE_CLOSE(*tapfd);
+    while (tapfd && tapfdSize--)
+        VIR_FORCE_CLOSE(tapfd[tapfdSize]);
 
     return -1;
 }
@@ -26,6 +26,7 @@
 #include <sys/wait.h>
 
 #include "virnetdevveth.h"
+#include "virnetdev.h"
 #include "memory.h"
 #include "logging.h"
 #include "command.h"
@@ -143,6 +144,8 @@ int virNetDevVethCreate(char** veth1, char** veth2)
         goto cleanup;
     }
 
+    virNetDevLinkCacheInvalidate(*veth1);
+    virNetDevLinkCacheInvalidate(*veth2);
     rc = 0;
 
 cleanup:
@@ -163,8 +166,11 @@ cleanup:
 int virNetDevVethDelete(const char *veth)
 {
     const char *argv[] = {"ip", "link", "del", veth, NULL};
+    int rc;
 
     VIR_DEBUG("veth: %s", veth);
 
-    return virRun(argv, NULL);
+    rc = virRun(argv, NULL);
+    virNetDevLinkCacheInvalidate(veth);
+    return rc;
 }
@@ -274,6 +274,282 @@ error:
     return rc;
 }
 
+/**
+ * virNetlinkCommandBatch:
+ * @msgs: netlink messages to send to the kernel
+ * @nmsgs: number of @msgs
+ * @errors: array of @nmsgs integers receiving the outcome of each message
+ * @protocol: netlink protocol
+ *
+ * Send all @msgs to the kernel in a single datagram and wait for the
+ * acknowledgement of each of them.  The kernel processes the messages
+ * in order, each one regardless of the outcome of the previous ones.
+ * @errors[i] is set to 0 if @msgs[i] succeeded, or to the errno value
+ * it failed with.
+ *
+ * Returns 0 once every message was acknowledged, -1 with an error
+ * reported if the exchange with the kernel failed.
+ */
+int virNetlinkCommandBatch(struct nl_msg **msgs, size_t nmsgs, int *errors,
+                           unsigned int protocol)
+{
+    int ret = -1;
+    struct sockaddr_nl nladdr;
+    virNetlinkHandle *nlhandle = NULL;
+    unsigned char *buf = NULL;
+    size_t buflen = 0;
+    size_t nacked = 0;
+    size_t i;
+    int fd;
+
+    if (protocol >= MAX_LINKS) {
+        virReportSystemError(EINVAL,
+                             _("invalid protocol argument: %d"), protocol);
+        return -1;
+    }
+
+    /* Number the messages so that acknowledgements can be matched */
+    for (i = 0; i < nmsgs; i++) {
+        struct nlmsghdr *nlmsg = nlmsg_hdr(msgs[i]);
+
+        nlmsg->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+        nlmsg->nlmsg_seq = i + 1;
+        nlmsg->nlmsg_pid = getpid();
+        buflen += NLMSG_ALIGN(nlmsg->nlmsg_len);
+        errors[i] = ETIMEDOUT;
+    }
+
+    if (VIR_ALLOC_N(buf, buflen) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    buflen = 0;
+    for (i = 0; i < nmsgs; i++) {
+        struct nlmsghdr *nlmsg = nlmsg_hdr(msgs[i]);
+
+        memcpy(buf + buflen, nlmsg, nlmsg->nlmsg_len);
+        buflen += NLMSG_ALIGN(nlmsg->nlmsg_len);
+    }
+
+    nlhandle = virNetlinkAlloc();
+    if (!nlhandle) {
+        virReportSystemError(errno,
+                             "%s", _("cannot allocate nlhandle for netlink"));
+        goto cleanup;
+    }
+
+    if (nl_connect(nlhandle, protocol) < 0) {
+        virReportSystemError(errno,
+                        _("cannot connect to netlink socket with protocol %d"),
+                             protocol);
+        goto cleanup;
+    }
+
+    fd = nl_socket_get_fd(nlhandle);
+    if (fd < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot get netlink socket fd"));
+        goto cleanup;
+    }
+
+    if (nl_sendto(nlhandle, buf, buflen) < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot send to netlink socket"));
+        goto cleanup;
+    }
+
+    while (nacked < nmsgs) {
+        struct timeval tv = {
+            .tv_sec = NETLINK_ACK_TIMEOUT_S,
+        };
+        unsigned char *resp = NULL;
+        struct nlmsghdr *hdr;
+        fd_set readfds;
+        int len;
+        int n;
+
+        FD_ZERO(&readfds);
+        FD_SET(fd, &readfds);
+
+        n = select(fd + 1, &readfds, NULL, NULL, &tv);
+        if (n <= 0) {
+            if (n < 0)
+                virReportSystemError(errno, "%s",
+                                     _("error in select call"));
+            if (n == 0)
+                virReportSystemError(ETIMEDOUT, "%s",
+                                     _("no valid netlink response was received"));
+            goto cleanup;
+        }
+
+        len = nl_recv(nlhandle, &nladdr, &resp, NULL);
+        if (len <= 0) {
+            virReportSystemError(errno,
+                                 "%s", _("nl_recv failed"));
+            VIR_FREE(resp);
+            goto cleanup;
+        }
+
+        for (hdr = (struct nlmsghdr *)resp; NLMSG_OK(hdr, len);
+             hdr = NLMSG_NEXT(hdr, len)) {
+            struct nlmsgerr *err = NLMSG_DATA(hdr);
+
+            if (hdr->nlmsg_type != NLMSG_ERROR ||
+                hdr->nlmsg_len < NLMSG_LENGTH(sizeof(*err)) ||
+                hdr->nlmsg_seq < 1 || hdr->nlmsg_seq > nmsgs)
+                continue;
+
+            errors[hdr->nlmsg_seq - 1] = -err->error;
+            nacked++;
+        }
+        VIR_FREE(resp);
+    }
+
+    ret = 0;
+
+cleanup:
+    if (nlhandle)
+        virNetlinkFree(nlhandle);
+    VIR_FREE(buf);
+    return ret;
+}
+
+/**
+ * virNetlinkDumpCommand:
+ * @nl_msg: netlink dump request, such as RTM_GETLINK
+ * @callback: called for every message of the reply
+ * @opaque: passed to @callback
+ * @protocol: netlink protocol
+ *
+ * Send the dump request @nl_msg to the kernel and hand each message of
+ * the multipart reply to @callback, until the kernel signals the end of
+ * the dump.
+ *
+ * Returns 0 on success, -1 with an error reported if the exchange with
+ * the kernel failed or @callback returned -1.
+ */
+int virNetlinkDumpCommand(struct nl_msg *nl_msg,
+                          virNetlinkDumpCallback callback,
+                          void *opaque,
+                          unsigned int protocol)
+{
+    int ret = -1;
+    struct sockaddr_nl nladdr = {
+            .nl_family = AF_NETLINK,
+            .nl_pid    = 0,
+            .nl_groups = 0,
+    };
+    struct nlmsghdr *nlmsg = nlmsg_hdr(nl_msg);
+    virNetlinkHandle *nlhandle = NULL;
+    bool done = false;
+    int fd;
+
+    if (protocol >= MAX_LINKS) {
+        virReportSystemError(EINVAL,
+                             _("invalid protocol argument: %d"), protocol);
+        return -1;
+    }
+
+    nlhandle = virNetlinkAlloc();
+    if (!nlhandle) {
+        virReportSystemError(errno,
+                             "%s", _("cannot allocate nlhandle for netlink"));
+        return -1;
+    }
+
+    if (nl_connect(nlhandle, protocol) < 0) {
+        virReportSystemError(errno,
+                        _("cannot connect to netlink socket with protocol %d"),
+                             protocol);
+        goto cleanup;
+    }
+
+    fd = nl_socket_get_fd(nlhandle);
+    if (fd < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot get netlink socket fd"));
+        goto cleanup;
+    }
+
+    nlmsg_set_dst(nl_msg, &nladdr);
+
+    nlmsg->nlmsg_flags |= NLM_F_REQUEST | NLM_F_DUMP;
+    nlmsg->nlmsg_pid = getpid();
+
+    if (nl_send_auto_complete(nlhandle, nl_msg) < 0) {
+        virReportSystemError(errno,
+                             "%s", _("cannot send to netlink socket"));
+        goto cleanup;
+    }
+
+    while (!done) {
+        struct timeval tv = {
+            .tv_sec = NETLINK_ACK_TIMEOUT_S,
+        };
+        unsigned char *resp = NULL;
+        struct nlmsghdr *hdr;
+        fd_set readfds;
+        int len;
+        int n;
+
+        FD_ZERO(&readfds);
+        FD_SET(fd, &readfds);
+
+        n = select(fd + 1, &readfds, NULL, NULL, &tv);
+        if (n <= 0) {
+            if (n < 0)
+                virReportSystemError(errno, "%s",
+                                     _("error in select call"));
+            if (n == 0)
+                virReportSystemError(ETIMEDOUT, "%s",
+                                     _("no valid netlink response was received"));
+            goto cleanup;
+        }
+
+        len = nl_recv(nlhandle, &nladdr, &resp, NULL);
+        if (len <= 0) {
+            virReportSystemError(errno,
+                                 "%s", _("nl_recv failed"));
+            VIR_FREE(resp);
+            goto cleanup;
+        }
+
+        for (hdr = (struct nlmsghdr *)resp; NLMSG_OK(hdr, len);
+             hdr = NLMSG_NEXT(hdr, len)) {
+            if (hdr->nlmsg_type == NLMSG_DONE) {
+                done = true;
+                break;
+            }
+
+            if (hdr->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *err = NLMSG_DATA(hdr);
+
+                if (hdr->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+                    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                   _("malformed netlink response message"));
+                else
+                    virReportSystemError(-err->error, "%s",
+                                         _("netlink dump request failed"));
+                VIR_FREE(resp);
+                goto cleanup;
+            }
+
+            if (callback(hdr, opaque) < 0) {
+                VIR_FREE(resp);
+                goto cleanup;
+            }
+        }
+        VIR_FREE(resp);
+    }
+
+    ret = 0;
+
+cleanup:
+    virNetlinkFree(nlhandle);
+    return ret;
+}
+
 static void
 virNetlinkEventServerLock(virNetlinkEventSrvPrivatePtr driver)
 {
@@ -761,6 +1037,24 @@ int virNetlinkCommand(struct nl_msg *nl_msg ATTRIBUTE_UNUSED,
     return -1;
 }
 
+int virNetlinkCommandBatch(struct nl_msg **msgs ATTRIBUTE_UNUSED,
+                           size_t nmsgs ATTRIBUTE_UNUSED,
+                           int *errors ATTRIBUTE_UNUSED,
+                           unsigned int protocol ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
+int virNetlinkDumpCommand(struct nl_msg *nl_msg ATTRIBUTE_UNUSED,
+                          virNetlinkDumpCallback callback ATTRIBUTE_UNUSED,
+                          void *opaque ATTRIBUTE_UNUSED,
+                          unsigned int protocol ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
 /**
  * stopNetlinkEventServer: stop the monitor to receive netlink
  * messages for libvirtd
@@ -38,8 +38,35 @@ struct _virClass {
     size_t objectSize;
 
     virObjectDisposeCallback dispose;
+
+    /* Objects currently allocated and allocations ever made */
+    int live;
+    int allocs;
+
+    /* Per thread caches of freed objects, see virClassSetCache */
+    size_t cacheSize;
+    virThreadLocal cache;
 };
 
+/* Memory of disposed objects kept by one thread for reuse */
+typedef struct _virObjectCache virObjectCache;
+typedef virObjectCache *virObjectCachePtr;
+struct _virObjectCache {
+    size_t nobjs;
+    void *objs[];
+};
+
+
+static void virObjectCacheFree(void *opaque)
+{
+    virObjectCachePtr cache = opaque;
+    size_t i;
+
+    for (i = 0; i < cache->nobjs; i++)
+        VIR_FREE(cache->objs[i]);
+    VIR_FREE(cache);
+}
+
 
 /**
  * virClassNew:
@@ -80,6 +107,73 @@ no_memory:
 }
 
 
+/**
+ * virClassSetCache:
+ * @klass: the object class
+ * @cacheSize: number of objects to keep per thread
+ *
+ * Make each thread keep the memory of up to @cacheSize disposed
+ * objects of @klass for reuse by virObjectNew, instead of returning
+ * it to the heap.  Meant for classes whose objects are created and
+ * released at a high rate, and to be called once, right after
+ * virClassNew.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int virClassSetCache(virClassPtr klass,
+                     size_t cacheSize)
+{
+    if (virThreadLocalInit(&klass->cache, virObjectCacheFree) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize object cache"));
+        return -1;
+    }
+    klass->cacheSize = cacheSize;
+    return 0;
+}
+
+
+/* Take the memory of a disposed object of @klass from the cache of
+ * the calling thread, or NULL if there is none */
+static void *virObjectCacheGet(virClassPtr klass)
+{
+    virObjectCachePtr cache;
+
+    if (!klass->cacheSize ||
+        !(cache = virThreadLocalGet(&klass->cache)) ||
+        !cache->nobjs)
+        return NULL;
+
+    return cache->objs[--cache->nobjs];
+}
+
+
+/* Keep the memory of @obj, a disposed object of @klass, in the cache
+ * of the calling thread.  Returns false if it has to be freed */
+static bool virObjectCachePut(virClassPtr klass, void *obj)
+{
+    virObjectCachePtr cache;
+
+    if (!klass->cacheSize)
+        return false;
+
+    if (!(cache = virThreadLocalGet(&klass->cache))) {
+        if (VIR_ALLOC_VAR(cache, void *, klass->cacheSize) < 0)
+            return false;
+        if (virThreadLocalSet(&klass->cache, cache) < 0) {
+            VIR_FREE(cache);
+            return false;
+        }
+    }
+
+    if (cache->nobjs == klass->cacheSize)
+        return false;
+
+    cache->objs[cache->nobjs++] = obj;
+    return true;
+}
+
+
 /**
  * virObjectNew:
  * @klass: the klass of object to create
@@ -96,8 +190,14 @@ void *virObjectNew(virClassPtr klass)
 {
     virObjectPtr obj = NULL;
     char *somebytes;
-
-    if (VIR_ALLOC_N(somebytes, klass->objectSize) < 0) {
+    bool cached = false;
+    int live;
+    int allocs;
+
+    if ((somebytes = virObjectCacheGet(klass))) {
+        memset(somebytes, 0, klass->objectSize);
+        cached = true;
+    } else if (VIR_ALLOC_N(somebytes, klass->objectSize) < 0) {
         virReportOOMError();
         return NULL;
     }
@@ -107,7 +207,10 @@ void *virObjectNew(virClassPtr klass)
     obj->klass = klass;
     virAtomicIntSet(&obj->refs, 1);
 
-    PROBE(OBJECT_NEW, "obj=%p classname=%s", obj, obj->klass->name);
+    live = virAtomicIntInc(&klass->live);
+    allocs = virAtomicIntInc(&klass->allocs);
+    PROBE(OBJECT_NEW, "obj=%p classname=%s live=%d allocs=%d cached=%d",
+          obj, obj->klass->name, live, allocs, cached);
 
     return obj;
 }
@@ -134,15 +237,20 @@ bool virObjectUnref(void *anyobj)
     bool lastRef = virAtomicIntDecAndTest(&obj->refs);
     PROBE(OBJECT_UNREF, "obj=%p", obj);
     if (lastRef) {
-        PROBE(OBJECT_DISPOSE, "obj=%p", obj);
-        if (obj->klass->dispose)
-            obj->klass->dispose(obj);
+        virClassPtr klass = obj->klass;
+        int live = virAtomicIntAdd(&klass->live, -1) - 1;
+
+        PROBE(OBJECT_DISPOSE, "obj=%p classname=%s live=%d",
+              obj, klass->name, live);
+        if (klass->dispose)
+            klass->dispose(obj);
 
         /* Clear & poison object */
-        memset(obj, 0, obj->klass->objectSize);
+        memset(obj, 0, klass->objectSize);
         obj->magic = 0xDEADBEEF;
         obj->klass = (void*)0xDEADBEEF;
-        VIR_FREE(obj);
+        if (!virObjectCachePut(klass, obj))
+            VIR_FREE(obj);
     }
 
     return !lastRef;
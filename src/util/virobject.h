@@ -43,6 +43,10 @@ virClassPtr virClassNew(const char *name,
                         virObjectDisposeCallback dispose)
     ATTRIBUTE_NONNULL(1);
 
+int virClassSetCache(virClassPtr klass,
+                     size_t cacheSize)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
 const char *virClassName(virClassPtr klass)
     ATTRIBUTE_NONNULL(1);
 
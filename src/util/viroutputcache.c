@@ -0,0 +1,226 @@
+/*
+ * viroutputcache.c: caching of command output for a limited time
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "viroutputcache.h"
+#include "logging.h"
+#include "memory.h"
+#include "virterror_internal.h"
+#include "virhash.h"
+#include "virtime.h"
+#include "threads.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define VIR_OUTPUT_CACHE_TABLE_SIZE 8
+
+typedef struct _virOutputCacheEntry virOutputCacheEntry;
+typedef virOutputCacheEntry *virOutputCacheEntryPtr;
+
+struct _virOutputCacheEntry {
+    char *output;
+    unsigned long long expires;
+};
+
+struct _virOutputCache {
+    virMutex lock;
+    unsigned long long ttl; /* milliseconds, 0 disables caching */
+    virHashTablePtr entries;
+};
+
+
+static void
+virOutputCacheEntryFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virOutputCacheEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    VIR_FREE(entry->output);
+    VIR_FREE(entry);
+}
+
+
+/**
+ * virOutputCacheNew:
+ * @ttl: how long output stays valid, in milliseconds
+ *
+ * Returns a new, empty cache or NULL on error. With a @ttl of zero
+ * nothing is kept, so every lookup runs the command.
+ */
+virOutputCachePtr
+virOutputCacheNew(unsigned long long ttl)
+{
+    virOutputCachePtr cache;
+
+    if (VIR_ALLOC(cache) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (virMutexInit(&cache->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to initialize mutex"));
+        VIR_FREE(cache);
+        return NULL;
+    }
+
+    cache->ttl = ttl;
+
+    if (!(cache->entries = virHashCreate(VIR_OUTPUT_CACHE_TABLE_SIZE,
+                                         virOutputCacheEntryFree))) {
+        virOutputCacheFree(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+
+void
+virOutputCacheFree(virOutputCachePtr cache)
+{
+    if (!cache)
+        return;
+
+    virHashFree(cache->entries);
+    virMutexDestroy(&cache->lock);
+    VIR_FREE(cache);
+}
+
+
+/**
+ * virOutputCacheGet:
+ * @cache: the cache
+ * @key: identifies the output, usually the command line
+ * @fill: produces the output if there is no valid copy
+ * @opaque: passed on to @fill
+ *
+ * Returns a copy of the output for @key, which the caller must free,
+ * or NULL on error. The cache stays locked while @fill runs, so
+ * concurrent callers wait for its result instead of running the same
+ * command again. Failures are not cached.
+ */
+char *
+virOutputCacheGet(virOutputCachePtr cache,
+                  const char *key,
+                  virOutputCacheFillFunc fill,
+                  void *opaque)
+{
+    virOutputCacheEntryPtr entry;
+    unsigned long long now;
+    char *output = NULL;
+
+    if (virTimeMillisNow(&now) < 0)
+        return NULL;
+
+    virMutexLock(&cache->lock);
+
+    entry = virHashLookup(cache->entries, key);
+    if (entry && now < entry->expires) {
+        VIR_DEBUG("Using cached output for '%s'", key);
+        if (!(output = strdup(entry->output)))
+            virReportOOMError();
+        goto cleanup;
+    }
+
+    if (!(output = fill(key, opaque)))
+        goto cleanup;
+
+    if (cache->ttl == 0)
+        goto cleanup;
+
+    /* Failing to remember the output is not an error for the caller */
+    if (VIR_ALLOC(entry) < 0 ||
+        !(entry->output = strdup(output))) {
+        virOutputCacheEntryFree(entry, NULL);
+        goto cleanup;
+    }
+    entry->expires = now + cache->ttl;
+
+    if (virHashUpdateEntry(cache->entries, key, entry) < 0) {
+        virOutputCacheEntryFree(entry, NULL);
+        virResetLastError();
+    }
+
+cleanup:
+    virMutexUnlock(&cache->lock);
+    return output;
+}
+
+
+static char *
+virOutputCacheRunCommandFill(const char *key ATTRIBUTE_UNUSED, void *opaque)
+{
+    virCommandPtr cmd = opaque;
+    char *output = NULL;
+
+    virCommandSetOutputBuffer(cmd, &output);
+    if (virCommandRun(cmd, NULL) < 0) {
+        VIR_FREE(output);
+        return NULL;
+    }
+
+    return output;
+}
+
+
+/**
+ * virOutputCacheRunCommand:
+ * @cache: the cache
+ * @cmd: the command to run if its output is not cached
+ *
+ * Like virOutputCacheGet(), keyed by the command line of @cmd, which
+ * must not have an output buffer or file descriptor set. @cmd is left
+ * for the caller to free, whether it was run or not.
+ */
+char *
+virOutputCacheRunCommand(virOutputCachePtr cache,
+                         virCommandPtr cmd)
+{
+    char *key;
+    char *output;
+
+    if (!(key = virCommandToString(cmd)))
+        return NULL;
+
+    output = virOutputCacheGet(cache, key, virOutputCacheRunCommandFill, cmd);
+
+    VIR_FREE(key);
+    return output;
+}
+
+
+/**
+ * virOutputCacheInvalidate:
+ * @cache: the cache
+ *
+ * Forget all cached output, for example because the driver has just
+ * started or stopped a domain.
+ */
+void
+virOutputCacheInvalidate(virOutputCachePtr cache)
+{
+    virMutexLock(&cache->lock);
+    virHashRemoveAll(cache->entries);
+    virMutexUnlock(&cache->lock);
+}
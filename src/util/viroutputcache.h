@@ -0,0 +1,57 @@
+/*
+ * viroutputcache.h: caching of command output for a limited time
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIR_OUTPUT_CACHE_H__
+# define __VIR_OUTPUT_CACHE_H__
+
+# include "internal.h"
+# include "command.h"
+
+/*
+ * Drivers that learn about their domains by running a listing tool,
+ * locally or over SSH, can keep the tool's output here and parse it
+ * again for each API call instead of running the tool again. Entries
+ * are keyed by the command line, expire after a fixed time and are
+ * dropped all at once by virOutputCacheInvalidate() whenever the
+ * driver changes something the output describes.
+ */
+typedef struct _virOutputCache virOutputCache;
+typedef virOutputCache *virOutputCachePtr;
+
+/* Produce the output for @key, or report an error and return NULL */
+typedef char *(*virOutputCacheFillFunc)(const char *key, void *opaque);
+
+virOutputCachePtr virOutputCacheNew(unsigned long long ttl);
+void virOutputCacheFree(virOutputCachePtr cache);
+
+char *virOutputCacheGet(virOutputCachePtr cache,
+                        const char *key,
+                        virOutputCacheFillFunc fill,
+                        void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+
+char *virOutputCacheRunCommand(virOutputCachePtr cache,
+                               virCommandPtr cmd)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+void virOutputCacheInvalidate(virOutputCachePtr cache)
+    ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_OUTPUT_CACHE_H__ */
@@ -300,3 +300,69 @@ virProcessKillPainfully(pid_t pid, bool force)
 cleanup:
     return ret;
 }
+
+
+/*
+ * Same as virProcessKillPainfully, but for @npids processes at once:
+ * they are all signalled together and share the same grace periods,
+ * so the time spent waiting does not grow with their number.  @pids
+ * is reordered, leaving the processes still alive at its start.
+ *
+ * Returns the number of processes still alive, or -1 if one of them
+ * could not be signalled.
+ */
+int
+virProcessKillPainfullyAll(pid_t *pids, size_t npids, bool force)
+{
+    int i;
+    size_t j;
+    size_t alive = npids;
+    const char *signame = "TERM";
+
+    VIR_DEBUG("npids=%zu force=%d", npids, force);
+
+    for (i = 0 ; i < 75 && alive > 0; i++) {
+        int signum;
+        if (i == 0) {
+            signum = SIGTERM;
+        } else if ((i == 50) & force) {
+            VIR_DEBUG("Timed out waiting after SIGTERM to %zu processes, "
+                      "sending SIGKILL", alive);
+#ifdef WIN32
+            signum = SIGABRT;
+            signame = "ABRT";
+#else
+            signum = SIGKILL;
+            signame = "KILL";
+#endif
+        } else {
+            signum = 0;
+        }
+
+        for (j = 0; j < alive;) {
+            if (virProcessKill(pids[j], signum) < 0) {
+                pid_t dead = pids[j];
+
+                if (errno != ESRCH) {
+                    virReportSystemError(errno,
+                                         _("Failed to terminate process %lld with SIG%s"),
+                                         (long long)pids[j], signame);
+                    return -1;
+                }
+                /* keep the survivors together at the start */
+                pids[j] = pids[--alive];
+                pids[alive] = dead;
+                continue;
+            }
+            j++;
+        }
+
+        if (alive > 0)
+            usleep(200 * 1000);
+    }
+
+    if (alive > 0)
+        VIR_DEBUG("Timed out waiting for %zu processes", alive);
+
+    return alive;
+}
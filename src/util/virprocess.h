@@ -40,5 +40,7 @@ int virProcessKill(pid_t pid, int sig);
 
 int virProcessKillPainfully(pid_t pid, bool force);
 
+int virProcessKillPainfullyAll(pid_t *pids, size_t npids, bool force);
+
 
 #endif /* __VIR_PROCESS_H__ */
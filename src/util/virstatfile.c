@@ -0,0 +1,139 @@
+/*
+ * virstatfile.c: parsing of key/value statistics files
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include "virstatfile.h"
+#include "util.h"
+#include "c-ctype.h"
+
+/* Find the word starting at or after @p, not going past @end.  Its
+ * length is stored in @len, which is zero if there is none left.  */
+static const char *
+virStatFileNextWord(const char *p, const char *end, size_t *len)
+{
+    while (p < end && c_isspace(*p))
+        p++;
+
+    *len = 0;
+    while (p + *len < end && !c_isspace(p[*len]))
+        (*len)++;
+
+    return p;
+}
+
+static virStatFileFieldPtr
+virStatFileFind(virStatFileFieldPtr fields,
+                size_t nfields,
+                const char *key,
+                size_t keylen)
+{
+    size_t i;
+
+    for (i = 0; i < nfields; i++) {
+        if (STREQLEN(fields[i].key, key, keylen) &&
+            fields[i].key[keylen] == '\0')
+            return &fields[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * virStatFileScan:
+ * @buf: NUL terminated contents of the file
+ * @skip: number of words to ignore at the start of each line
+ * @fields: table of keys to look for
+ * @nfields: number of entries in @fields
+ *
+ * Parse files made of lines of the form
+ *
+ *   [skipped words] key[:] value [unit]
+ *
+ * such as /proc/meminfo, the per node meminfo files, memory.stat,
+ * cpuacct.stat or the blkio statistics, in a single pass and without
+ * allocating anything.  Lines whose key is not in @fields, or which
+ * carry no value, are ignored.  Repeated keys have their values
+ * summed, so that for instance the per device lines of a blkio file
+ * add up.  The caller is expected to zero @fields before the first
+ * call, which allows parsing a file piecemeal.
+ *
+ * Returns the number of entries of @fields found so far, or -1 with
+ * errno set to EINVAL if the value of a wanted key is not a number.
+ */
+int
+virStatFileScan(const char *buf,
+                unsigned int skip,
+                virStatFileFieldPtr fields,
+                size_t nfields)
+{
+    const char *line = buf;
+    size_t i;
+    int nfound = 0;
+
+    while (*line) {
+        const char *end = strchrnul(line, '\n');
+        const char *p = line;
+        const char *key;
+        size_t len;
+        unsigned int n;
+        unsigned long long value;
+        virStatFileFieldPtr field;
+        char *valend;
+
+        line = *end ? end + 1 : end;
+
+        for (n = 0; n < skip; n++) {
+            p = virStatFileNextWord(p, end, &len);
+            p += len;
+        }
+
+        key = virStatFileNextWord(p, end, &len);
+        p = key + len;
+        if (len && key[len - 1] == ':')
+            len--;
+        if (!len ||
+            !(field = virStatFileFind(fields, nfields, key, len)))
+            continue;
+
+        p = virStatFileNextWord(p, end, &len);
+        if (!len)
+            continue;
+
+        if (virStrToLong_ull(p, &valend, 10, &value) < 0 ||
+            valend != p + len) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        field->value += value;
+        field->found = true;
+    }
+
+    for (i = 0; i < nfields; i++) {
+        if (fields[i].found)
+            nfound++;
+    }
+
+    return nfound;
+}
@@ -0,0 +1,45 @@
+/*
+ * virstatfile.h: parsing of key/value statistics files
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIR_STAT_FILE_H__
+# define __VIR_STAT_FILE_H__
+
+# include "internal.h"
+
+/**
+ * virStatFileField:
+ * one key looked for in a statistics file, along with the value
+ * found for it
+ */
+typedef struct _virStatFileField virStatFileField;
+typedef virStatFileField *virStatFileFieldPtr;
+struct _virStatFileField {
+    const char *key;            /* line name, without any trailing ':' */
+    unsigned long long value;   /* summed over all lines named @key */
+    bool found;
+};
+
+int virStatFileScan(const char *buf,
+                    unsigned int skip,
+                    virStatFileFieldPtr fields,
+                    size_t nfields)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(3) ATTRIBUTE_RETURN_CHECK;
+
+#endif /* __VIR_STAT_FILE_H__ */
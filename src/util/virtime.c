@@ -79,6 +79,33 @@ int virTimeMillisNowRaw(unsigned long long *now)
 }
 
 
+/**
+ * virTimeMillisMonotonicRaw:
+ * @now: filled with current time in milliseconds
+ *
+ * Retrieves the current time in milliseconds from a clock which is
+ * not affected by changes of the system time, for measuring
+ * intervals.  Falls back to the system time where no such clock
+ * exists.
+ *
+ * Returns 0 on success, -1 on error with errno set
+ */
+int virTimeMillisMonotonicRaw(unsigned long long *now)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return -1;
+
+    *now = (ts.tv_sec * 1000ull) + (ts.tv_nsec / (1000ull * 1000ull));
+    return 0;
+#else
+    return virTimeMillisNowRaw(now);
+#endif
+}
+
+
 /**
  * virTimeFieldsNowRaw:
  * @fields: filled with current time fields
@@ -249,6 +276,26 @@ int virTimeMillisNow(unsigned long long *now)
 }
 
 
+/**
+ * virTimeMillisMonotonic:
+ * @now: filled with current time in milliseconds
+ *
+ * Retrieves the current time in milliseconds from a clock which is
+ * not affected by changes of the system time
+ *
+ * Returns 0 on success, -1 on error with error reported
+ */
+int virTimeMillisMonotonic(unsigned long long *now)
+{
+    if (virTimeMillisMonotonicRaw(now) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to get current time"));
+        return -1;
+    }
+    return 0;
+}
+
+
 /**
  * virTimeFieldsNowRaw:
  * @fields: filled with current time fields
@@ -41,6 +41,8 @@
  * errno on failure */
 int virTimeMillisNowRaw(unsigned long long *now)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virTimeMillisMonotonicRaw(unsigned long long *now)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virTimeFieldsNowRaw(struct tm *fields)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virTimeFieldsThenRaw(unsigned long long when, struct tm *fields)
@@ -56,6 +58,8 @@ int virTimeStringThenRaw(unsigned long long when, char *buf)
  */
 int virTimeMillisNow(unsigned long long *now)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virTimeMillisMonotonic(unsigned long long *now)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virTimeFieldsNow(struct tm *fields)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virTimeFieldsThen(unsigned long long when, struct tm *fields)
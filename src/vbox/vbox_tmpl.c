@@ -57,6 +57,8 @@
 #include "virfile.h"
 #include "fdstream.h"
 #include "viruri.h"
+#include "virhash.h"
+#include "virtime.h"
 
 /* This one changes from version to version. */
 #if VBOX_API_VERSION == 2002
@@ -167,6 +169,31 @@ if (strUtf16) {\
           (unsigned)(iid)->m3[7]);\
 }\
 
+/* How long the machine list may be used without a callback telling
+ * us about changes, in milliseconds */
+#define VBOX_MACHINE_CACHE_TTL 2000
+
+typedef struct _vboxMachineCacheEntry vboxMachineCacheEntry;
+typedef vboxMachineCacheEntry *vboxMachineCacheEntryPtr;
+struct _vboxMachineCacheEntry {
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char *name;
+    int id;             /* index in GetMachines + 1, as used for domain IDs */
+    PRUint32 state;
+};
+
+/* The accessible machines from a single GetMachines call, indexed by
+ * UUID and name */
+typedef struct {
+    virMutex lock;
+    vboxMachineCacheEntryPtr entries;
+    size_t nentries;
+    virHashTablePtr byUUID;
+    virHashTablePtr byName;
+    bool valid;
+    unsigned long long expires;
+} vboxMachineCache;
+
 typedef struct {
     virMutex lock;
     unsigned long version;
@@ -179,6 +206,8 @@ typedef struct {
     /** Our version specific API table pointer. */
     PCVBOXXPCOM pFuncs;
 
+    vboxMachineCache machines;
+
 #if VBOX_API_VERSION == 2002
 
 } vboxGlobalData;
@@ -948,6 +977,216 @@ static int vboxExtractVersion(vboxGlobalData *data) {
     return ret;
 }
 
+static int
+vboxMachineCacheInit(vboxMachineCache *cache)
+{
+    if (virMutexInit(&cache->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return -1;
+    }
+
+    if (!(cache->byUUID = virHashCreate(16, NULL)) ||
+        !(cache->byName = virHashCreate(16, NULL))) {
+        virHashFree(cache->byUUID);
+        cache->byUUID = NULL;
+        virMutexDestroy(&cache->lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+vboxMachineCacheClear(vboxMachineCache *cache)
+{
+    size_t i;
+
+    virHashRemoveAll(cache->byUUID);
+    virHashRemoveAll(cache->byName);
+
+    for (i = 0; i < cache->nentries; i++)
+        VIR_FREE(cache->entries[i].name);
+    VIR_FREE(cache->entries);
+    cache->nentries = 0;
+    cache->valid = false;
+}
+
+static void
+vboxMachineCacheDispose(vboxMachineCache *cache)
+{
+    if (!cache->byUUID)
+        return;
+
+    vboxMachineCacheClear(cache);
+    virHashFree(cache->byUUID);
+    virHashFree(cache->byName);
+    virMutexDestroy(&cache->lock);
+}
+
+static void
+vboxMachineCacheLock(vboxGlobalData *data)
+{
+    virMutexLock(&data->machines.lock);
+}
+
+static void
+vboxMachineCacheUnlock(vboxGlobalData *data)
+{
+    virMutexUnlock(&data->machines.lock);
+}
+
+/* Drop the cached machine list after changing a machine's state or
+ * configuration, so the next lookup sees the change */
+static void
+vboxMachineCacheInvalidate(vboxGlobalData *data)
+{
+    vboxMachineCacheLock(data);
+    vboxMachineCacheClear(&data->machines);
+    vboxMachineCacheUnlock(data);
+}
+
+/* Whether the VirtualBox callbacks keep the cache of @data current */
+static bool
+vboxMachineCacheIsTracked(vboxGlobalData *data ATTRIBUTE_UNUSED)
+{
+#if VBOX_API_VERSION <= 2002 || VBOX_API_VERSION >= 4000
+    return false;
+#else
+    /* Callbacks are delivered to g_pVBoxGlobalData only */
+    return data == g_pVBoxGlobalData &&
+           data->vboxCallback != NULL &&
+           data->fdWatch >= 0;
+#endif
+}
+
+static int
+vboxMachineCacheRefresh(vboxGlobalData *data)
+{
+    vboxMachineCache *cache = &data->machines;
+    vboxArray machines = VBOX_ARRAY_INITIALIZER;
+    vboxIID iid = VBOX_IID_INITIALIZER;
+    unsigned long long now;
+    nsresult rc;
+    int i;
+    int ret = -1;
+
+    vboxMachineCacheClear(cache);
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    rc = vboxArrayGet(&machines, data->vboxObj, data->vboxObj->vtbl->GetMachines);
+    if (NS_FAILED(rc)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Could not get list of machines, rc=%08x"), (unsigned)rc);
+        return -1;
+    }
+
+    if (machines.count > 0 &&
+        VIR_ALLOC_N(cache->entries, machines.count) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0; i < machines.count; ++i) {
+        IMachine *machine = machines.items[i];
+        vboxMachineCacheEntryPtr entry = &cache->entries[cache->nentries];
+        PRBool isAccessible = PR_FALSE;
+        PRUnichar *machineNameUtf16 = NULL;
+        char *machineNameUtf8 = NULL;
+        char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+        if (!machine)
+            continue;
+
+        machine->vtbl->GetAccessible(machine, &isAccessible);
+        if (!isAccessible)
+            continue;
+
+        rc = machine->vtbl->GetId(machine, &iid.value);
+        if (NS_FAILED(rc))
+            continue;
+        vboxIIDToUUID(&iid, entry->uuid);
+        vboxIIDUnalloc(&iid);
+
+        machine->vtbl->GetName(machine, &machineNameUtf16);
+        VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineNameUtf8);
+        VBOX_UTF16_FREE(machineNameUtf16);
+        if (!machineNameUtf8)
+            continue;
+
+        entry->name = strdup(machineNameUtf8);
+        VBOX_UTF8_FREE(machineNameUtf8);
+        if (!entry->name) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        cache->nentries++;
+
+        entry->state = MachineState_Null;
+        machine->vtbl->GetState(machine, &entry->state);
+        entry->id = i + 1;
+
+        virUUIDFormat(entry->uuid, uuidstr);
+        if (virHashUpdateEntry(cache->byUUID, uuidstr, entry) < 0 ||
+            virHashUpdateEntry(cache->byName, entry->name, entry) < 0)
+            goto cleanup;
+    }
+
+    cache->valid = true;
+    cache->expires = now + VBOX_MACHINE_CACHE_TTL;
+    ret = 0;
+
+cleanup:
+    if (ret < 0)
+        vboxMachineCacheClear(cache);
+    vboxArrayRelease(&machines);
+    return ret;
+}
+
+/* Make sure the machine list is usable. Must be called with the cache
+ * locked */
+static int
+vboxMachineCacheUpdate(vboxGlobalData *data)
+{
+    vboxMachineCache *cache = &data->machines;
+    unsigned long long now;
+
+    if (cache->valid) {
+        if (vboxMachineCacheIsTracked(data))
+            return 0;
+        if (virTimeMillisNow(&now) < 0)
+            return -1;
+        if (now < cache->expires)
+            return 0;
+    }
+
+    return vboxMachineCacheRefresh(data);
+}
+
+static vboxMachineCacheEntryPtr
+vboxMachineCacheFindByUUID(vboxGlobalData *data, const unsigned char *uuid)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(uuid, uuidstr);
+    return virHashLookup(data->machines.byUUID, uuidstr);
+}
+
+static vboxMachineCacheEntryPtr
+vboxMachineCacheFindByName(vboxGlobalData *data, const char *name)
+{
+    return virHashLookup(data->machines.byName, name);
+}
+
+static bool
+vboxMachineStateIsOnline(PRUint32 state)
+{
+    return state >= MachineState_FirstOnline &&
+           state <= MachineState_LastOnline;
+}
+
 static void vboxUninitialize(vboxGlobalData *data) {
     if (!data)
         return;
@@ -955,6 +1194,8 @@ static void vboxUninitialize(vboxGlobalData *data) {
     if (data->pFuncs)
         data->pFuncs->pfnComUninitialize();
 
+    vboxMachineCacheDispose(&data->machines);
+
     virCapabilitiesFree(data->caps);
 #if VBOX_API_VERSION == 2002
     /* No domainEventCallbacks in 2.2.* version */
@@ -1012,7 +1253,8 @@ static virDrvOpenStatus vboxOpen(virConnectPtr conn,
         return VIR_DRV_OPEN_ERROR;
     }
 
-    if (!(data->caps = vboxCapsInit()) ||
+    if (vboxMachineCacheInit(&data->machines) < 0 ||
+        !(data->caps = vboxCapsInit()) ||
         vboxInitialize(data) < 0 ||
         vboxExtractVersion(data) < 0) {
         vboxUninitialize(data);
@@ -1111,73 +1353,46 @@ static char *vboxGetCapabilities(virConnectPtr conn) {
 
 static int vboxListDomains(virConnectPtr conn, int *ids, int nids) {
     VBOX_OBJECT_CHECK(conn, int, -1);
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    PRUint32 state;
-    nsresult rc;
-    int i, j;
+    size_t i;
+    int j;
 
-    rc = vboxArrayGet(&machines, data->vboxObj, data->vboxObj->vtbl->GetMachines);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of Domains, rc=%08x"),(unsigned)rc);
+    vboxMachineCacheLock(data);
+
+    if (vboxMachineCacheUpdate(data) < 0)
         goto cleanup;
-    }
 
     ret = 0;
-    for (i = 0, j = 0; (i < machines.count) && (j < nids); ++i) {
-        IMachine *machine = machines.items[i];
+    for (i = 0, j = 0; (i < data->machines.nentries) && (j < nids); ++i) {
+        vboxMachineCacheEntryPtr entry = &data->machines.entries[i];
 
-        if (machine) {
-            PRBool isAccessible = PR_FALSE;
-            machine->vtbl->GetAccessible(machine, &isAccessible);
-            if (isAccessible) {
-                machine->vtbl->GetState(machine, &state);
-                if ((state >= MachineState_FirstOnline) &&
-                    (state <= MachineState_LastOnline)) {
-                    ret++;
-                    ids[j++] = i + 1;
-                }
-            }
+        if (vboxMachineStateIsOnline(entry->state)) {
+            ret++;
+            ids[j++] = entry->id;
         }
     }
 
 cleanup:
-    vboxArrayRelease(&machines);
+    vboxMachineCacheUnlock(data);
     return ret;
 }
 
 static int vboxNumOfDomains(virConnectPtr conn) {
     VBOX_OBJECT_CHECK(conn, int, -1);
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    PRUint32 state;
-    nsresult rc;
-    int i;
+    size_t i;
 
-    rc = vboxArrayGet(&machines, data->vboxObj, data->vboxObj->vtbl->GetMachines);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get number of Domains, rc=%08x"), (unsigned)rc);
+    vboxMachineCacheLock(data);
+
+    if (vboxMachineCacheUpdate(data) < 0)
         goto cleanup;
-    }
 
     ret = 0;
-    for (i = 0; i < machines.count; ++i) {
-        IMachine *machine = machines.items[i];
-
-        if (machine) {
-            PRBool isAccessible = PR_FALSE;
-            machine->vtbl->GetAccessible(machine, &isAccessible);
-            if (isAccessible) {
-                machine->vtbl->GetState(machine, &state);
-                if ((state >= MachineState_FirstOnline) &&
-                    (state <= MachineState_LastOnline))
-                    ret++;
-            }
-        }
+    for (i = 0; i < data->machines.nentries; ++i) {
+        if (vboxMachineStateIsOnline(data->machines.entries[i].state))
+            ret++;
     }
 
 cleanup:
-    vboxArrayRelease(&machines);
+    vboxMachineCacheUnlock(data);
     return ret;
 }
 
@@ -1210,276 +1425,117 @@ static virDomainPtr vboxDomainCreateXML(virConnectPtr conn, const char *xml,
 
 static virDomainPtr vboxDomainLookupByID(virConnectPtr conn, int id) {
     VBOX_OBJECT_CHECK(conn, virDomainPtr, NULL);
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    vboxIID iid = VBOX_IID_INITIALIZER;
-    unsigned char uuid[VIR_UUID_BUFLEN];
-    PRUint32 state;
-    nsresult rc;
+    vboxMachineCacheEntryPtr entry = NULL;
+    size_t i;
 
     /* Internal vbox IDs start from 0, the public libvirt ID
-     * starts from 1, so refuse id==0, and adjust the rest*/
-    if (id == 0) {
+     * starts from 1, so refuse id==0 */
+    if (id <= 0) {
         virReportError(VIR_ERR_NO_DOMAIN,
                        _("no domain with matching id %d"), id);
         return NULL;
     }
-    id = id - 1;
 
-    rc = vboxArrayGet(&machines, data->vboxObj, data->vboxObj->vtbl->GetMachines);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of machines, rc=%08x"), (unsigned)rc);
-        return NULL;
-    }
+    vboxMachineCacheLock(data);
 
-    if (id < machines.count) {
-        IMachine *machine = machines.items[id];
+    if (vboxMachineCacheUpdate(data) < 0)
+        goto cleanup;
 
-        if (machine) {
-            PRBool isAccessible = PR_FALSE;
-            machine->vtbl->GetAccessible(machine, &isAccessible);
-            if (isAccessible) {
-                machine->vtbl->GetState(machine, &state);
-                if ((state >= MachineState_FirstOnline) &&
-                    (state <= MachineState_LastOnline)) {
-                    PRUnichar *machineNameUtf16 = NULL;
-                    char      *machineNameUtf8  = NULL;
-
-                    machine->vtbl->GetName(machine, &machineNameUtf16);
-                    VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineNameUtf8);
-
-                    machine->vtbl->GetId(machine, &iid.value);
-                    vboxIIDToUUID(&iid, uuid);
-                    vboxIIDUnalloc(&iid);
-
-                    /* get a new domain pointer from virGetDomain, if it fails
-                     * then no need to assign the id, else assign the id, cause
-                     * it is -1 by default. rest is taken care by virGetDomain
-                     * itself, so need not worry.
-                     */
+    /* Entries are in ID order but skip inaccessible machines, so the
+     * one with this ID is at index id - 1 or before it */
+    i = MIN(data->machines.nentries, id);
+    while (i > 0) {
+        entry = &data->machines.entries[--i];
+        if (entry->id <= id)
+            break;
+    }
 
-                    ret = virGetDomain(conn, machineNameUtf8, uuid);
-                    if (ret)
-                        ret->id = id + 1;
+    if (entry && entry->id == id && vboxMachineStateIsOnline(entry->state)) {
+        /* get a new domain pointer from virGetDomain, if it fails
+         * then no need to assign the id, else assign the id, cause
+         * it is -1 by default. rest is taken care by virGetDomain
+         * itself, so need not worry.
+         */
 
-                    /* Cleanup all the XPCOM allocated stuff here */
-                    VBOX_UTF8_FREE(machineNameUtf8);
-                    VBOX_UTF16_FREE(machineNameUtf16);
-                }
-            }
-        }
+        ret = virGetDomain(conn, entry->name, entry->uuid);
+        if (ret)
+            ret->id = id;
     }
 
-    vboxArrayRelease(&machines);
-
+cleanup:
+    vboxMachineCacheUnlock(data);
     return ret;
 }
 
 static virDomainPtr vboxDomainLookupByUUID(virConnectPtr conn, const unsigned char *uuid) {
     VBOX_OBJECT_CHECK(conn, virDomainPtr, NULL);
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    vboxIID iid = VBOX_IID_INITIALIZER;
-    char      *machineNameUtf8  = NULL;
-    PRUnichar *machineNameUtf16 = NULL;
-    unsigned char iid_as_uuid[VIR_UUID_BUFLEN];
-    int i, matched = 0;
-    nsresult rc;
-
-    rc = vboxArrayGet(&machines, data->vboxObj, data->vboxObj->vtbl->GetMachines);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of machines, rc=%08x"), (unsigned)rc);
-        return NULL;
-    }
-
-    for (i = 0; i < machines.count; ++i) {
-        IMachine *machine = machines.items[i];
-        PRBool isAccessible = PR_FALSE;
-
-        if (!machine)
-            continue;
-
-        machine->vtbl->GetAccessible(machine, &isAccessible);
-        if (isAccessible) {
-
-            rc = machine->vtbl->GetId(machine, &iid.value);
-            if (NS_FAILED(rc))
-                continue;
-            vboxIIDToUUID(&iid, iid_as_uuid);
-            vboxIIDUnalloc(&iid);
-
-            if (memcmp(uuid, iid_as_uuid, VIR_UUID_BUFLEN) == 0) {
-
-                PRUint32 state;
-
-                matched = 1;
-
-                machine->vtbl->GetName(machine, &machineNameUtf16);
-                VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineNameUtf8);
+    vboxMachineCacheEntryPtr entry;
 
-                machine->vtbl->GetState(machine, &state);
+    vboxMachineCacheLock(data);
 
-                /* get a new domain pointer from virGetDomain, if it fails
-                 * then no need to assign the id, else assign the id, cause
-                 * it is -1 by default. rest is taken care by virGetDomain
-                 * itself, so need not worry.
-                 */
+    if (vboxMachineCacheUpdate(data) < 0)
+        goto cleanup;
 
-                ret = virGetDomain(conn, machineNameUtf8, iid_as_uuid);
-                if (ret &&
-                    (state >= MachineState_FirstOnline) &&
-                    (state <= MachineState_LastOnline))
-                    ret->id = i + 1;
-            }
+    if (!(entry = vboxMachineCacheFindByUUID(data, uuid)))
+        goto cleanup;
 
-            if (matched == 1)
-                break;
-        }
-    }
+    /* get a new domain pointer from virGetDomain, if it fails
+     * then no need to assign the id, else assign the id, cause
+     * it is -1 by default. rest is taken care by virGetDomain
+     * itself, so need not worry.
+     */
 
-    /* Do the cleanup and take care you dont leak any memory */
-    VBOX_UTF8_FREE(machineNameUtf8);
-    VBOX_COM_UNALLOC_MEM(machineNameUtf16);
-    vboxArrayRelease(&machines);
+    ret = virGetDomain(conn, entry->name, entry->uuid);
+    if (ret && vboxMachineStateIsOnline(entry->state))
+        ret->id = entry->id;
 
+cleanup:
+    vboxMachineCacheUnlock(data);
     return ret;
 }
 
 static virDomainPtr vboxDomainLookupByName(virConnectPtr conn, const char *name) {
     VBOX_OBJECT_CHECK(conn, virDomainPtr, NULL);
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    vboxIID iid = VBOX_IID_INITIALIZER;
-    char      *machineNameUtf8  = NULL;
-    PRUnichar *machineNameUtf16 = NULL;
-    unsigned char uuid[VIR_UUID_BUFLEN];
-    int i, matched = 0;
-    nsresult rc;
-
-    rc = vboxArrayGet(&machines, data->vboxObj, data->vboxObj->vtbl->GetMachines);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of machines, rc=%08x"), (unsigned)rc);
-        return NULL;
-    }
-
-    for (i = 0; i < machines.count; ++i) {
-        IMachine *machine = machines.items[i];
-        PRBool isAccessible = PR_FALSE;
-
-        if (!machine)
-            continue;
-
-        machine->vtbl->GetAccessible(machine, &isAccessible);
-        if (isAccessible) {
-
-            machine->vtbl->GetName(machine, &machineNameUtf16);
-            VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineNameUtf8);
-
-            if (STREQ(name, machineNameUtf8)) {
-
-                PRUint32 state;
+    vboxMachineCacheEntryPtr entry;
 
-                matched = 1;
-
-                machine->vtbl->GetId(machine, &iid.value);
-                vboxIIDToUUID(&iid, uuid);
-                vboxIIDUnalloc(&iid);
+    vboxMachineCacheLock(data);
 
-                machine->vtbl->GetState(machine, &state);
+    if (vboxMachineCacheUpdate(data) < 0)
+        goto cleanup;
 
-                /* get a new domain pointer from virGetDomain, if it fails
-                 * then no need to assign the id, else assign the id, cause
-                 * it is -1 by default. rest is taken care by virGetDomain
-                 * itself, so need not worry.
-                 */
+    if (!(entry = vboxMachineCacheFindByName(data, name)))
+        goto cleanup;
 
-                ret = virGetDomain(conn, machineNameUtf8, uuid);
-                if (ret &&
-                    (state >= MachineState_FirstOnline) &&
-                    (state <= MachineState_LastOnline))
-                    ret->id = i + 1;
-            }
+    /* get a new domain pointer from virGetDomain, if it fails
+     * then no need to assign the id, else assign the id, cause
+     * it is -1 by default. rest is taken care by virGetDomain
+     * itself, so need not worry.
+     */
 
-            if (machineNameUtf8) {
-                VBOX_UTF8_FREE(machineNameUtf8);
-                machineNameUtf8 = NULL;
-            }
-            if (machineNameUtf16) {
-                VBOX_COM_UNALLOC_MEM(machineNameUtf16);
-                machineNameUtf16 = NULL;
-            }
-            if (matched == 1)
-                break;
-        }
-    }
-
-    vboxArrayRelease(&machines);
+    ret = virGetDomain(conn, entry->name, entry->uuid);
+    if (ret && vboxMachineStateIsOnline(entry->state))
+        ret->id = entry->id;
 
+cleanup:
+    vboxMachineCacheUnlock(data);
     return ret;
 }
 
 
 static int vboxDomainIsActive(virDomainPtr dom) {
     VBOX_OBJECT_CHECK(dom->conn, int, -1);
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    vboxIID iid = VBOX_IID_INITIALIZER;
-    char      *machineNameUtf8  = NULL;
-    PRUnichar *machineNameUtf16 = NULL;
-    unsigned char uuid[VIR_UUID_BUFLEN];
-    int i, matched = 0;
-    nsresult rc;
-
-    rc = vboxArrayGet(&machines, data->vboxObj, data->vboxObj->vtbl->GetMachines);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of machines, rc=%08x"), (unsigned)rc);
-        return ret;
-    }
-
-    for (i = 0; i < machines.count; ++i) {
-        IMachine *machine = machines.items[i];
-        PRBool isAccessible = PR_FALSE;
-
-        if (!machine)
-            continue;
+    vboxMachineCacheEntryPtr entry;
 
-        machine->vtbl->GetAccessible(machine, &isAccessible);
-        if (isAccessible) {
+    vboxMachineCacheLock(data);
 
-            rc = machine->vtbl->GetId(machine, &iid.value);
-            if (NS_FAILED(rc))
-                continue;
-            vboxIIDToUUID(&iid, uuid);
-            vboxIIDUnalloc(&iid);
-
-            if (memcmp(dom->uuid, uuid, VIR_UUID_BUFLEN) == 0) {
-
-                PRUint32 state;
-
-                matched = 1;
-
-                machine->vtbl->GetName(machine, &machineNameUtf16);
-                VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineNameUtf8);
-
-                machine->vtbl->GetState(machine, &state);
-
-                if ((state >= MachineState_FirstOnline) &&
-                    (state <= MachineState_LastOnline))
-                    ret = 1;
-                else
-                    ret = 0;
-            }
-
-            if (matched == 1)
-                break;
-        }
-    }
+    if (vboxMachineCacheUpdate(data) < 0)
+        goto cleanup;
 
-    /* Do the cleanup and take care you dont leak any memory */
-    VBOX_UTF8_FREE(machineNameUtf8);
-    VBOX_COM_UNALLOC_MEM(machineNameUtf16);
-    vboxArrayRelease(&machines);
+    if ((entry = vboxMachineCacheFindByUUID(data, dom->uuid)))
+        ret = vboxMachineStateIsOnline(entry->state) ? 1 : 0;
 
+cleanup:
+    vboxMachineCacheUnlock(data);
     return ret;
 }
 
@@ -1582,6 +1638,7 @@ static int vboxDomainSuspend(virDomainPtr dom) {
 cleanup:
     VBOX_RELEASE(machine);
     vboxIIDUnalloc(&iid);
+    vboxMachineCacheInvalidate(data);
     return ret;
 }
 
@@ -1634,6 +1691,7 @@ static int vboxDomainResume(virDomainPtr dom) {
 cleanup:
     VBOX_RELEASE(machine);
     vboxIIDUnalloc(&iid);
+    vboxMachineCacheInvalidate(data);
     return ret;
 }
 
@@ -1687,6 +1745,7 @@ static int vboxDomainShutdownFlags(virDomainPtr dom,
 cleanup:
     VBOX_RELEASE(machine);
     vboxIIDUnalloc(&iid);
+    vboxMachineCacheInvalidate(data);
     return ret;
 }
 
@@ -1741,6 +1800,7 @@ static int vboxDomainReboot(virDomainPtr dom, unsigned int flags)
 cleanup:
     VBOX_RELEASE(machine);
     vboxIIDUnalloc(&iid);
+    vboxMachineCacheInvalidate(data);
     return ret;
 }
 
@@ -1803,6 +1863,7 @@ vboxDomainDestroyFlags(virDomainPtr dom,
 cleanup:
     VBOX_RELEASE(machine);
     vboxIIDUnalloc(&iid);
+    vboxMachineCacheInvalidate(data);
     return ret;
 }
 
@@ -1884,105 +1945,80 @@ cleanup:
 
 static int vboxDomainGetInfo(virDomainPtr dom, virDomainInfoPtr info) {
     VBOX_OBJECT_CHECK(dom->conn, int, -1);
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    char *machineName    = NULL;
-    PRUnichar *machineNameUtf16 = NULL;
+    vboxIID iid = VBOX_IID_INITIALIZER;
+    IMachine *machine = NULL;
+    ISystemProperties *systemProperties = NULL;
+    PRBool isAccessible = PR_FALSE;
+    PRUint32 CPUCount   = 0;
+    PRUint32 memorySize = 0;
+    PRUint32 state      = MachineState_Null;
+    PRUint32 maxMemorySize = 4 * 1024;
     nsresult rc;
-    int i = 0;
 
-    rc = vboxArrayGet(&machines, data->vboxObj, data->vboxObj->vtbl->GetMachines);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of machines, rc=%08x"), (unsigned)rc);
+    vboxIIDFromUUID(&iid, dom->uuid);
+    rc = VBOX_OBJECT_GET_MACHINE(iid.value, &machine);
+    if (NS_FAILED(rc) || !machine) {
+        virReportError(VIR_ERR_NO_DOMAIN, "%s",
+                       _("no domain with matching UUID"));
         goto cleanup;
     }
 
-    info->nrVirtCpu = 0;
-    for (i = 0; i < machines.count; ++i) {
-        IMachine *machine = machines.items[i];
-        PRBool isAccessible = PR_FALSE;
-
-        if (!machine)
-            continue;
-
-        machine->vtbl->GetAccessible(machine, &isAccessible);
-        if (isAccessible) {
-
-            machine->vtbl->GetName(machine, &machineNameUtf16);
-            VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineName);
-
-            if (STREQ(dom->name, machineName)) {
-                /* Get the Machine State (also match it with
-                * virDomainState). Get the Machine memory and
-                * for time being set max_balloon and cur_balloon to same
-                * Also since there is no direct way of checking
-                * the cputime required (one condition being the
-                * VM is remote), return zero for cputime. Get the
-                * number of CPU.
-                */
-                PRUint32 CPUCount   = 0;
-                PRUint32 memorySize = 0;
-                PRUint32 state      = MachineState_Null;
-                PRUint32 maxMemorySize = 4 * 1024;
-                ISystemProperties *systemProperties = NULL;
-
-                data->vboxObj->vtbl->GetSystemProperties(data->vboxObj, &systemProperties);
-                if (systemProperties) {
-                    systemProperties->vtbl->GetMaxGuestRAM(systemProperties, &maxMemorySize);
-                    VBOX_RELEASE(systemProperties);
-                    systemProperties = NULL;
-                }
-
-
-                machine->vtbl->GetCPUCount(machine, &CPUCount);
-                machine->vtbl->GetMemorySize(machine, &memorySize);
-                machine->vtbl->GetState(machine, &state);
-
-                info->cpuTime = 0;
-                info->nrVirtCpu = CPUCount;
-                info->memory = memorySize * 1024;
-                info->maxMem = maxMemorySize * 1024;
-                switch (state) {
-                    case MachineState_Running:
-                        info->state = VIR_DOMAIN_RUNNING;
-                        break;
-                    case MachineState_Stuck:
-                        info->state = VIR_DOMAIN_BLOCKED;
-                        break;
-                    case MachineState_Paused:
-                        info->state = VIR_DOMAIN_PAUSED;
-                        break;
-                    case MachineState_Stopping:
-                        info->state = VIR_DOMAIN_SHUTDOWN;
-                        break;
-                    case MachineState_PoweredOff:
-                        info->state = VIR_DOMAIN_SHUTOFF;
-                        break;
-                    case MachineState_Aborted:
-                        info->state = VIR_DOMAIN_CRASHED;
-                        break;
-                    case MachineState_Null:
-                    default:
-                        info->state = VIR_DOMAIN_NOSTATE;
-                        break;
-                }
+    machine->vtbl->GetAccessible(machine, &isAccessible);
+    if (!isAccessible)
+        goto cleanup;
 
-                ret = 0;
-            }
+    /* Get the Machine State (also match it with
+     * virDomainState). Get the Machine memory and
+     * for time being set max_balloon and cur_balloon to same
+     * Also since there is no direct way of checking
+     * the cputime required (one condition being the
+     * VM is remote), return zero for cputime. Get the
+     * number of CPU.
+     */
+    data->vboxObj->vtbl->GetSystemProperties(data->vboxObj, &systemProperties);
+    if (systemProperties) {
+        systemProperties->vtbl->GetMaxGuestRAM(systemProperties, &maxMemorySize);
+        VBOX_RELEASE(systemProperties);
+    }
 
-            if (machineName)
-                VBOX_UTF8_FREE(machineName);
-            if (machineNameUtf16)
-                VBOX_COM_UNALLOC_MEM(machineNameUtf16);
-            if (info->nrVirtCpu)
-                break;
-        }
+    machine->vtbl->GetCPUCount(machine, &CPUCount);
+    machine->vtbl->GetMemorySize(machine, &memorySize);
+    machine->vtbl->GetState(machine, &state);
 
+    info->cpuTime = 0;
+    info->nrVirtCpu = CPUCount;
+    info->memory = memorySize * 1024;
+    info->maxMem = maxMemorySize * 1024;
+    switch (state) {
+        case MachineState_Running:
+            info->state = VIR_DOMAIN_RUNNING;
+            break;
+        case MachineState_Stuck:
+            info->state = VIR_DOMAIN_BLOCKED;
+            break;
+        case MachineState_Paused:
+            info->state = VIR_DOMAIN_PAUSED;
+            break;
+        case MachineState_Stopping:
+            info->state = VIR_DOMAIN_SHUTDOWN;
+            break;
+        case MachineState_PoweredOff:
+            info->state = VIR_DOMAIN_SHUTOFF;
+            break;
+        case MachineState_Aborted:
+            info->state = VIR_DOMAIN_CRASHED;
+            break;
+        case MachineState_Null:
+        default:
+            info->state = VIR_DOMAIN_NOSTATE;
+            break;
     }
 
-    vboxArrayRelease(&machines);
+    ret = 0;
 
 cleanup:
+    VBOX_RELEASE(machine);
+    vboxIIDUnalloc(&iid);
     return ret;
 }
 
@@ -2102,6 +2138,7 @@ static int vboxDomainSave(virDomainPtr dom, const char *path ATTRIBUTE_UNUSED) {
 
     VBOX_RELEASE(machine);
     vboxIIDUnalloc(&iid);
+    vboxMachineCacheInvalidate(data);
     return ret;
 }
 
@@ -3433,90 +3470,53 @@ cleanup:
 
 static int vboxListDefinedDomains(virConnectPtr conn, char ** const names, int maxnames) {
     VBOX_OBJECT_CHECK(conn, int, -1);
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    char *machineName    = NULL;
-    PRUnichar *machineNameUtf16 = NULL;
-    PRUint32 state;
-    nsresult rc;
-    int i, j;
+    size_t i;
+    int j;
 
-    rc = vboxArrayGet(&machines, data->vboxObj, data->vboxObj->vtbl->GetMachines);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get list of Defined Domains, rc=%08x"),
-                       (unsigned)rc);
+    vboxMachineCacheLock(data);
+
+    if (vboxMachineCacheUpdate(data) < 0)
         goto cleanup;
-    }
 
     ret = 0;
-    for (i = 0, j = 0; (i < machines.count) && (j < maxnames); i++) {
-        IMachine *machine = machines.items[i];
+    for (i = 0, j = 0; (i < data->machines.nentries) && (j < maxnames); i++) {
+        vboxMachineCacheEntryPtr entry = &data->machines.entries[i];
 
-        if (machine) {
-            PRBool isAccessible = PR_FALSE;
-            machine->vtbl->GetAccessible(machine, &isAccessible);
-            if (isAccessible) {
-                machine->vtbl->GetState(machine, &state);
-                if ((state < MachineState_FirstOnline) ||
-                    (state > MachineState_LastOnline)) {
-                    machine->vtbl->GetName(machine, &machineNameUtf16);
-                    VBOX_UTF16_TO_UTF8(machineNameUtf16, &machineName);
-                    names[j] = strdup(machineName);
-                    VBOX_UTF16_FREE(machineNameUtf16);
-                    VBOX_UTF8_FREE(machineName);
-                    if (!names[j]) {
-                        virReportOOMError();
-                        for (; j >= 0 ; j--)
-                            VIR_FREE(names[j]);
-                        ret = -1;
-                        goto cleanup;
-                    }
-                    j++;
-                    ret++;
-                }
+        if (!vboxMachineStateIsOnline(entry->state)) {
+            if (!(names[j] = strdup(entry->name))) {
+                virReportOOMError();
+                for (; j >= 0 ; j--)
+                    VIR_FREE(names[j]);
+                ret = -1;
+                goto cleanup;
             }
+            j++;
+            ret++;
         }
     }
 
 cleanup:
-    vboxArrayRelease(&machines);
+    vboxMachineCacheUnlock(data);
     return ret;
 }
 
 static int vboxNumOfDefinedDomains(virConnectPtr conn) {
     VBOX_OBJECT_CHECK(conn, int, -1);
-    vboxArray machines = VBOX_ARRAY_INITIALIZER;
-    PRUint32 state       = MachineState_Null;
-    nsresult rc;
-    int i;
+    size_t i;
 
-    rc = vboxArrayGet(&machines, data->vboxObj, data->vboxObj->vtbl->GetMachines);
-    if (NS_FAILED(rc)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Could not get number of Defined Domains, rc=%08x"),
-                       (unsigned)rc);
+    vboxMachineCacheLock(data);
+
+    if (vboxMachineCacheUpdate(data) < 0)
         goto cleanup;
-    }
 
     ret = 0;
-    for (i = 0; i < machines.count; ++i) {
-        IMachine *machine = machines.items[i];
-
-        if (machine) {
-            PRBool isAccessible = PR_FALSE;
-            machine->vtbl->GetAccessible(machine, &isAccessible);
-            if (isAccessible) {
-                machine->vtbl->GetState(machine, &state);
-                if ((state < MachineState_FirstOnline) ||
-                    (state > MachineState_LastOnline)) {
-                    ret++;
-                }
-            }
-        }
+    for (i = 0; i < data->machines.nentries; ++i) {
+        if (!vboxMachineStateIsOnline(data->machines.entries[i].state))
+            ret++;
     }
 
 cleanup:
-    vboxArrayRelease(&machines);
+    vboxMachineCacheUnlock(data);
     return ret;
 }
 
@@ -3763,6 +3763,7 @@ static int vboxDomainCreateWithFlags(virDomainPtr dom, unsigned int flags) {
     vboxArrayRelease(&machines);
 
 cleanup:
+    vboxMachineCacheInvalidate(data);
     return ret;
 }
 
@@ -5179,6 +5180,7 @@ static virDomainPtr vboxDomainDefineXML(virConnectPtr conn, const char *xml) {
 
     vboxIIDUnalloc(&iid);
     virDomainDefFree(def);
+    vboxMachineCacheInvalidate(data);
 
     return ret;
 
@@ -5186,6 +5188,7 @@ cleanup:
     VBOX_RELEASE(machine);
     vboxIIDUnalloc(&iid);
     virDomainDefFree(def);
+    vboxMachineCacheInvalidate(data);
     return NULL;
 }
 
@@ -5352,6 +5355,7 @@ vboxDomainUndefineFlags(virDomainPtr dom, unsigned int flags)
     vboxIIDUnalloc(&iid);
     VBOX_RELEASE(machine);
 
+    vboxMachineCacheInvalidate(data);
     return ret;
 }
 
@@ -6738,6 +6742,7 @@ cleanup:
     VBOX_RELEASE(prevSnapshot);
     VBOX_RELEASE(newSnapshot);
     vboxIIDUnalloc(&domiid);
+    vboxMachineCacheInvalidate(data);
     return ret;
 }
 
@@ -6901,6 +6906,20 @@ cleanup:
     /* No Callback support for VirtualBox 4.* series */
 #else /* !(VBOX_API_VERSION == 2002 || VBOX_API_VERSION >= 4000) */
 
+/* Keep the machine list current without fetching it again */
+static void
+vboxMachineCacheSetState(vboxGlobalData *data, const unsigned char *uuid,
+                         PRUint32 state)
+{
+    vboxMachineCacheEntryPtr entry;
+
+    vboxMachineCacheLock(data);
+    if (data->machines.valid &&
+        (entry = vboxMachineCacheFindByUUID(data, uuid)))
+        entry->state = state;
+    vboxMachineCacheUnlock(data);
+}
+
 /* Functions needed for Callbacks */
 static nsresult PR_COM_METHOD
 vboxCallbackOnMachineStateChange(IVirtualBoxCallback *pThis ATTRIBUTE_UNUSED,
@@ -6922,6 +6941,8 @@ vboxCallbackOnMachineStateChange(IVirtualBoxCallback *pThis ATTRIBUTE_UNUSED,
         g_pVBoxGlobalData->pFuncs->pfnUtf16ToUtf8(machineId, &machineIdUtf8);
         ignore_value(virUUIDParse(machineIdUtf8, uuid));
 
+        vboxMachineCacheSetState(g_pVBoxGlobalData, uuid, state);
+
         dom = vboxDomainLookupByUUID(g_pVBoxGlobalData->conn, uuid);
         if (dom) {
             virDomainEventPtr ev;
@@ -6974,6 +6995,9 @@ vboxCallbackOnMachineDataChange(IVirtualBoxCallback *pThis ATTRIBUTE_UNUSED,
     VIR_DEBUG("IVirtualBoxCallback: %p", pThis);
     DEBUGPRUnichar("machineId", machineId);
 
+    /* The machine may have been renamed */
+    vboxMachineCacheInvalidate(g_pVBoxGlobalData);
+
     return NS_OK;
 }
 
@@ -7034,6 +7058,8 @@ vboxCallbackOnMachineRegistered(IVirtualBoxCallback *pThis ATTRIBUTE_UNUSED,
     VIR_DEBUG("IVirtualBoxCallback: %p, registered: %s", pThis, registered ? "true" : "false");
     DEBUGPRUnichar("machineId", machineId);
 
+    vboxMachineCacheInvalidate(g_pVBoxGlobalData);
+
     if (machineId) {
         char *machineIdUtf8       = NULL;
         unsigned char uuid[VIR_UUID_BUFLEN];
@@ -7262,6 +7288,10 @@ static int vboxDomainEventRegister(virConnectPtr conn,
         if (data->vboxCallback != NULL) {
             rc = data->vboxObj->vtbl->RegisterCallback(data->vboxObj, data->vboxCallback);
             if (NS_SUCCEEDED(rc)) {
+                /* Changes made until now were missed, so fetch the
+                 * machine list again before trusting the callback to
+                 * keep it current */
+                vboxMachineCacheInvalidate(data);
                 vboxRet = 0;
             }
         }
@@ -7288,6 +7318,7 @@ static int vboxDomainEventRegister(virConnectPtr conn,
 
             ret = virDomainEventStateRegister(conn, data->domainEvents,
                                               callback, opaque, freecb);
+
             VIR_DEBUG("virDomainEventStateRegister (ret = %d) (conn: %p, "
                       "callback: %p, opaque: %p, "
                       "freecb: %p)", ret, conn, callback,
@@ -7354,6 +7385,10 @@ static int vboxDomainEventRegisterAny(virConnectPtr conn,
         if (data->vboxCallback != NULL) {
             rc = data->vboxObj->vtbl->RegisterCallback(data->vboxObj, data->vboxCallback);
             if (NS_SUCCEEDED(rc)) {
+                /* Changes made until now were missed, so fetch the
+                 * machine list again before trusting the callback to
+                 * keep it current */
+                vboxMachineCacheInvalidate(data);
                 vboxRet = 0;
             }
         }
@@ -29,6 +29,7 @@
 #include "memory.h"
 #include "nodeinfo.h"
 #include "virfile.h"
+#include "virstring.h"
 #include "uuid.h"
 #include "virterror_internal.h"
 #include "vmx.h"
@@ -43,6 +44,8 @@ vmwareFreeDriver(struct vmware_driver *driver)
         return;
 
     virMutexDestroy(&driver->lock);
+    virOutputCacheFree(driver->vmrunListCache);
+    virHashFree(driver->vmxCache);
     virDomainObjListDeinit(&driver->domains);
     virCapabilitiesFree(driver->caps);
     VIR_FREE(driver);
@@ -136,37 +139,135 @@ error:
     goto cleanup;
 }
 
+/*
+ * Store in @paths a NULL terminated list of the vmx paths of the
+ * running VMs, to be freed with virStringFreeList. The output of
+ * "vmrun list" is shared for VMWARE_VMRUN_LIST_CACHE_TTL, so that a
+ * burst of API calls (listing followed by a state query per domain,
+ * or several clients polling at once) forks it only once.
+ */
+int
+vmwareGetRunning(struct vmware_driver *driver, char ***paths)
+{
+    virCommandPtr cmd;
+    char *outbuf = NULL;
+    char **lines = NULL;
+    char **running = NULL;
+    size_t nrunning = 0;
+    size_t nlines = 0;
+    size_t i;
+    int ret = -1;
+
+    cmd = virCommandNewArgList(VMRUN, "-T",
+                               driver->type == TYPE_PLAYER ? "player" : "ws",
+                               "list", NULL);
+    if (!(outbuf = virOutputCacheRunCommand(driver->vmrunListCache, cmd)))
+        goto cleanup;
+
+    if (!(lines = virStringSplit(outbuf, "\n", 0)))
+        goto cleanup;
+    while (lines[nlines])
+        nlines++;
+
+    /* The first line is a "Total running VMs" header */
+    for (i = 0; i < nlines; i++) {
+        if (lines[i][0] != '/')
+            continue;
+        if (VIR_EXPAND_N(running, nrunning, 1) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        running[nrunning - 1] = lines[i];
+        lines[i] = NULL;
+    }
+
+    /* Keep the list NULL terminated */
+    if (VIR_EXPAND_N(running, nrunning, 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    *paths = running;
+    running = NULL;
+    ret = 0;
+
+cleanup:
+    if (lines) {
+        for (i = 0; i < nlines; i++)
+            VIR_FREE(lines[i]);
+        VIR_FREE(lines);
+    }
+    if (running) {
+        for (i = 0; i < nrunning; i++)
+            VIR_FREE(running[i]);
+        VIR_FREE(running);
+    }
+    virCommandFree(cmd);
+    VIR_FREE(outbuf);
+    return ret;
+}
+
+/*
+ * Returns 1 if @vmxPath, which must be fully resolved, is listed as
+ * running, 0 if not, -1 on error.
+ */
+int
+vmwareIsRunning(struct vmware_driver *driver, const char *vmxPath)
+{
+    char **paths = NULL;
+    size_t i;
+    int ret = 0;
+
+    if (vmwareGetRunning(driver, &paths) < 0)
+        return -1;
+
+    for (i = 0; paths[i]; i++) {
+        if (STREQ(paths[i], vmxPath)) {
+            ret = 1;
+            break;
+        }
+    }
+
+    virStringFreeList(paths);
+    return ret;
+}
+
+/*
+ * Add a domain for every running VM not known yet, such as the VMs
+ * started outside of libvirt. Domains already in driver->domains,
+ * whether loaded earlier or defined through libvirt, are left alone,
+ * their state included. The vmx file of a running VM is only parsed
+ * until it is matched to a domain, so this is cheap enough to call
+ * whenever domains are listed.
+ */
 int
 vmwareLoadDomains(struct vmware_driver *driver)
 {
     virDomainDefPtr vmdef = NULL;
+    virDomainDefPtr def;
     virDomainObjPtr vm = NULL;
-    char *vmxPath = NULL;
     char *vmx = NULL;
     vmwareDomainPtr pDomain;
-    char *directoryName = NULL;
-    char *fileName = NULL;
+    vmwareVmxCacheEntryPtr entry;
     int ret = -1;
     virVMXContext ctx;
-    char *outbuf = NULL;
-    char *str;
-    char *saveptr = NULL;
-    virCommandPtr cmd;
+    char **paths = NULL;
+    size_t i;
 
     ctx.parseFileName = vmwareCopyVMXFileName;
 
-    cmd = virCommandNewArgList(VMRUN, "-T",
-                               driver->type == TYPE_PLAYER ? "player" : "ws",
-                               "list", NULL);
-    virCommandSetOutputBuffer(cmd, &outbuf);
-    if (virCommandRun(cmd, NULL) < 0)
+    if (vmwareGetRunning(driver, &paths) < 0)
         goto cleanup;
 
-    for (str = outbuf ; (vmxPath = strtok_r(str, "\n", &saveptr)) != NULL;
-        str = NULL) {
+    for (i = 0; paths[i]; i++) {
+        const char *vmxPath = paths[i];
 
-        if (vmxPath[0] != '/')
+        if ((entry = virHashLookup(driver->vmxCache, vmxPath)) &&
+            (vm = virDomainFindByUUID(&driver->domains, entry->uuid))) {
+            virDomainObjUnlock(vm);
+            vm = NULL;
             continue;
+        }
 
         if (virFileReadAll(vmxPath, 10000, &vmx) < 0)
             goto cleanup;
@@ -175,20 +276,47 @@ vmwareLoadDomains(struct vmware_driver *driver)
              virVMXParseConfig(&ctx, driver->caps, vmx)) == NULL) {
             goto cleanup;
         }
+        VIR_FREE(vmx);
+
+        if (!entry) {
+            if (VIR_ALLOC(entry) < 0) {
+                virReportOOMError();
+                goto cleanup;
+            }
+            if (virHashAddEntry(driver->vmxCache, vmxPath, entry) < 0) {
+                VIR_FREE(entry);
+                goto cleanup;
+            }
+        }
+
+        /* Defined through libvirt, or known from another path */
+        if ((vm = virDomainFindByUUID(&driver->domains, vmdef->uuid)) ||
+            (vm = virDomainFindByName(&driver->domains, vmdef->name))) {
+            memcpy(entry->uuid, vm->def->uuid, VIR_UUID_BUFLEN);
+            virDomainObjUnlock(vm);
+            vm = NULL;
+            virDomainDefFree(vmdef);
+            vmdef = NULL;
+            continue;
+        }
 
         if (!(vm = virDomainAssignDef(driver->caps,
                                       &driver->domains, vmdef, false)))
             goto cleanup;
+        def = vmdef;
+        vmdef = NULL;
+        memcpy(entry->uuid, vm->def->uuid, VIR_UUID_BUFLEN);
 
         pDomain = vm->privateData;
 
+        VIR_FREE(pDomain->vmxPath);
         pDomain->vmxPath = strdup(vmxPath);
         if (pDomain->vmxPath == NULL) {
             virReportOOMError();
             goto cleanup;
         }
 
-        vmwareDomainConfigDisplay(pDomain, vmdef);
+        vmwareDomainConfigDisplay(pDomain, def);
 
         if ((vm->def->id = vmwareExtractPid(vmxPath)) < 0)
             goto cleanup;
@@ -198,21 +326,17 @@ vmwareLoadDomains(struct vmware_driver *driver)
         vm->persistent = 1;
 
         virDomainObjUnlock(vm);
-
-        vmdef = NULL;
         vm = NULL;
     }
 
     ret = 0;
 
 cleanup:
-    virCommandFree(cmd);
-    VIR_FREE(outbuf);
+    virStringFreeList(paths);
     virDomainDefFree(vmdef);
-    VIR_FREE(directoryName);
-    VIR_FREE(fileName);
     VIR_FREE(vmx);
-    virObjectUnref(vm);
+    if (vm)
+        virDomainObjUnlock(vm);
     return ret;
 }
 
@@ -26,6 +26,8 @@
 # include "internal.h"
 # include "domain_conf.h"
 # include "threads.h"
+# include "virhash.h"
+# include "viroutputcache.h"
 
 # define VIR_FROM_THIS VIR_FROM_VMWARE
 # define PROGRAM_SENTINAL ((char *)0x1)
@@ -33,6 +35,9 @@
 # define TYPE_PLAYER        0
 # define TYPE_WORKSTATION   1
 
+/* How long the output of "vmrun list" is reused, in milliseconds */
+# define VMWARE_VMRUN_LIST_CACHE_TTL 1000
+
 struct vmware_driver {
     virMutex lock;
     virCapsPtr caps;
@@ -40,8 +45,18 @@ struct vmware_driver {
     virDomainObjList domains;
     int version;
     int type;
+
+    /* vmx path -> vmwareVmxCacheEntry for every running vmx file
+     * that has been matched to a domain in @domains */
+    virHashTablePtr vmxCache;
+
+    virOutputCachePtr vmrunListCache; /* has its own lock */
 };
 
+typedef struct _vmwareVmxCacheEntry {
+    unsigned char uuid[VIR_UUID_BUFLEN];
+} vmwareVmxCacheEntry, *vmwareVmxCacheEntryPtr;
+
 typedef struct _vmwareDomain {
     char *vmxPath;
     bool gui;
@@ -54,6 +69,10 @@ virCapsPtr vmwareCapsInit(void);
 
 int vmwareLoadDomains(struct vmware_driver *driver);
 
+int vmwareGetRunning(struct vmware_driver *driver, char ***paths);
+
+int vmwareIsRunning(struct vmware_driver *driver, const char *vmxPath);
+
 void vmwareSetSentinal(const char **prog, const char *key);
 
 int vmwareExtractVersion(struct vmware_driver *driver);
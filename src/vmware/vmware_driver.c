@@ -27,6 +27,7 @@
 #include "virterror_internal.h"
 #include "datatypes.h"
 #include "virfile.h"
+#include "logging.h"
 #include "memory.h"
 #include "util.h"
 #include "uuid.h"
@@ -72,6 +73,12 @@ vmwareDataFreeFunc(void *data)
     VIR_FREE(dom);
 }
 
+static void
+vmwareVmxCacheFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    VIR_FREE(payload);
+}
+
 static virDrvOpenStatus
 vmwareOpen(virConnectPtr conn,
            virConnectAuthPtr auth ATTRIBUTE_UNUSED,
@@ -125,12 +132,19 @@ vmwareOpen(virConnectPtr conn,
     if (virMutexInit(&driver->lock) < 0)
         goto cleanup;
 
+    if (!(driver->vmrunListCache =
+          virOutputCacheNew(VMWARE_VMRUN_LIST_CACHE_TTL)))
+        goto cleanup;
+
     driver->type = STRNEQ(conn->uri->scheme, "vmwareplayer") ?
       TYPE_WORKSTATION : TYPE_PLAYER;
 
     if (virDomainObjListInit(&driver->domains) < 0)
         goto cleanup;
 
+    if (!(driver->vmxCache = virHashCreate(10, vmwareVmxCacheFree)))
+        goto cleanup;
+
     if (!(driver->caps = vmwareCapsInit()))
         goto cleanup;
 
@@ -184,46 +198,27 @@ vmwareGetVersion(virConnectPtr conn, unsigned long *version)
 static int
 vmwareUpdateVMStatus(struct vmware_driver *driver, virDomainObjPtr vm)
 {
-    virCommandPtr cmd;
-    char *outbuf = NULL;
     char *vmxAbsolutePath = NULL;
-    char *parsedVmxPath = NULL;
-    char *str;
-    char *saveptr = NULL;
-    bool found = false;
     int oldState = virDomainObjGetState(vm, NULL);
     int newState;
+    int running;
     int ret = -1;
 
-    cmd = virCommandNewArgList(VMRUN, "-T", vmw_types[driver->type],
-                               "list", NULL);
-    virCommandSetOutputBuffer(cmd, &outbuf);
-    if (virCommandRun(cmd, NULL) < 0)
-        goto cleanup;
-
     if (virFileResolveAllLinks(((vmwareDomainPtr) vm->privateData)->vmxPath,
                                &vmxAbsolutePath) < 0)
         goto cleanup;
 
-    for (str = outbuf ; (parsedVmxPath = strtok_r(str, "\n", &saveptr)) != NULL;
-         str = NULL) {
-
-        if (parsedVmxPath[0] != '/')
-            continue;
-
-        if (STREQ(parsedVmxPath, vmxAbsolutePath)) {
-            found = true;
-            /* If the vmx path is in the output, the domain is running or
-             * is paused but we have no way to detect if it is paused or not. */
-            if (oldState == VIR_DOMAIN_PAUSED)
-                newState = oldState;
-            else
-                newState = VIR_DOMAIN_RUNNING;
-            break;
-        }
-    }
+    if ((running = vmwareIsRunning(driver, vmxAbsolutePath)) < 0)
+        goto cleanup;
 
-    if (!found) {
+    if (running) {
+        /* If the vmx path is in the output, the domain is running or
+         * is paused but we have no way to detect if it is paused or not. */
+        if (oldState == VIR_DOMAIN_PAUSED)
+            newState = oldState;
+        else
+            newState = VIR_DOMAIN_RUNNING;
+    } else {
         vm->def->id = -1;
         newState = VIR_DOMAIN_SHUTOFF;
     }
@@ -233,8 +228,6 @@ vmwareUpdateVMStatus(struct vmware_driver *driver, virDomainObjPtr vm)
     ret = 0;
 
 cleanup:
-    virCommandFree(cmd);
-    VIR_FREE(outbuf);
     VIR_FREE(vmxAbsolutePath);
     return ret;
 }
@@ -248,13 +241,15 @@ vmwareStopVM(struct vmware_driver *driver,
         VMRUN, "-T", PROGRAM_SENTINAL, "stop",
         PROGRAM_SENTINAL, "soft", NULL
     };
+    int ret;
 
     vmwareSetSentinal(cmd, vmw_types[driver->type]);
     vmwareSetSentinal(cmd, ((vmwareDomainPtr) vm->privateData)->vmxPath);
 
-    if (virRun(cmd, NULL) < 0) {
+    ret = virRun(cmd, NULL);
+    virOutputCacheInvalidate(driver->vmrunListCache);
+    if (ret < 0)
         return -1;
-    }
 
     vm->def->id = -1;
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
@@ -270,6 +265,7 @@ vmwareStartVM(struct vmware_driver *driver, virDomainObjPtr vm)
         PROGRAM_SENTINAL, PROGRAM_SENTINAL, NULL
     };
     const char *vmxPath = ((vmwareDomainPtr) vm->privateData)->vmxPath;
+    int ret;
 
     if (virDomainObjGetState(vm, NULL) != VIR_DOMAIN_SHUTOFF) {
         virReportError(VIR_ERR_OPERATION_INVALID, "%s",
@@ -284,9 +280,10 @@ vmwareStartVM(struct vmware_driver *driver, virDomainObjPtr vm)
     else
         vmwareSetSentinal(cmd, NULL);
 
-    if (virRun(cmd, NULL) < 0) {
+    ret = virRun(cmd, NULL);
+    virOutputCacheInvalidate(driver->vmrunListCache);
+    if (ret < 0)
         return -1;
-    }
 
     if ((vm->def->id = vmwareExtractPid(vmxPath)) < 0) {
         vmwareStopVM(driver, vm, VIR_DOMAIN_SHUTOFF_FAILED);
@@ -953,9 +950,20 @@ static void vmwareDomainObjListUpdateDomain(void *payload, const void *name ATTR
     virDomainObjUnlock(vm);
 }
 
+/*
+ * Pick up VMs started outside of libvirt and refresh the state of all
+ * domains. Both use the same "vmrun list" output, so a listing costs
+ * a single fork however many domains there are.
+ */
 static void
 vmwareDomainObjListUpdateAll(virDomainObjListPtr doms, struct vmware_driver *driver)
 {
+    if (vmwareLoadDomains(driver) < 0) {
+        virErrorPtr err = virGetLastError();
+        VIR_WARN("Failed to load running VMware domains: %s",
+                 err ? err->message : _("unknown error"));
+        virResetLastError();
+    }
     virHashForEach(doms->objs, vmwareDomainObjListUpdateDomain, driver);
 }
 
@@ -1101,16 +1109,19 @@ vmwareListAllDomains(virConnectPtr conn,
 
     vmwareDriverLock(driver);
     vmwareDomainObjListUpdateAll(&driver->domains, driver);
-    ret = virDomainList(conn, driver->domains.objs, domains, flags);
+    ret = virDomainList(conn, &driver->domains, domains, flags);
     vmwareDriverUnlock(driver);
     return ret;
 }
 
 
 
+static const char *vmwareURISchemes[] = { "vmwareplayer", "vmwarews", NULL };
+
 static virDriver vmwareDriver = {
     .no = VIR_DRV_VMWARE,
     .name = "VMWARE",
+    .uriSchemes = vmwareURISchemes,
     .open = vmwareOpen, /* 0.8.7 */
     .close = vmwareClose, /* 0.8.7 */
     .type = vmwareGetType, /* 0.8.7 */
@@ -337,8 +337,16 @@ xenUnifiedOpen(virConnectPtr conn, virConnectAuthPtr auth, unsigned int flags)
         VIR_FREE(priv);
         return VIR_DRV_OPEN_ERROR;
     }
+    if (virMutexInit(&priv->xendLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("cannot initialize mutex"));
+        virMutexDestroy(&priv->lock);
+        VIR_FREE(priv);
+        return VIR_DRV_OPEN_ERROR;
+    }
 
     if (!(priv->domainEvents = virDomainEventStateNew())) {
+        virMutexDestroy(&priv->xendLock);
         virMutexDestroy(&priv->lock);
         VIR_FREE(priv);
         return VIR_DRV_OPEN_ERROR;
@@ -347,6 +355,7 @@ xenUnifiedOpen(virConnectPtr conn, virConnectAuthPtr auth, unsigned int flags)
 
     priv->handle = -1;
     priv->xendConfigVersion = -1;
+    priv->xendFd = -1;
     priv->xshandle = NULL;
 
 
@@ -431,6 +440,9 @@ clean:
     for (i = 0 ; i < XEN_UNIFIED_NR_DRIVERS ; i++)
         if (priv->opened[i])
             drivers[i]->xenClose(conn);
+    /* xend may have been reached without the sub-driver opening */
+    xenDaemonClose(conn);
+    virMutexDestroy(&priv->xendLock);
     virMutexDestroy(&priv->lock);
     VIR_FREE(priv->saveDir);
     VIR_FREE(priv);
@@ -455,6 +467,7 @@ xenUnifiedClose(virConnectPtr conn)
             drivers[i]->xenClose(conn);
 
     VIR_FREE(priv->saveDir);
+    virMutexDestroy(&priv->xendLock);
     virMutexDestroy(&priv->lock);
     VIR_FREE(conn->privateData);
 
@@ -1589,6 +1602,214 @@ xenUnifiedNumOfDefinedDomains(virConnectPtr conn)
     return -1;
 }
 
+#define MATCH(FLAG) (flags & (FLAG))
+static bool
+xenUnifiedDomainMatchState(int state, unsigned int flags)
+{
+    if (!MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE))
+        return true;
+
+    switch (state) {
+    case VIR_DOMAIN_RUNNING:
+        return MATCH(VIR_CONNECT_LIST_DOMAINS_RUNNING);
+    case VIR_DOMAIN_PAUSED:
+        return MATCH(VIR_CONNECT_LIST_DOMAINS_PAUSED);
+    case VIR_DOMAIN_SHUTOFF:
+        return MATCH(VIR_CONNECT_LIST_DOMAINS_SHUTOFF);
+    default:
+        return MATCH(VIR_CONNECT_LIST_DOMAINS_OTHER);
+    }
+}
+
+static int
+xenUnifiedAddDomain(virDomainPtr **doms, size_t *ndoms, virDomainPtr dom)
+{
+    if (VIR_EXPAND_N(*doms, *ndoms, 1) < 0) {
+        virDomainFree(dom);
+        virReportOOMError();
+        return -1;
+    }
+    (*doms)[*ndoms - 1] = dom;
+    return 0;
+}
+
+/*
+ * Collect the running domains. With the hypervisor open, all of
+ * their IDs, UUIDs and states come back from one hypercall and only
+ * the names are read from xenstore; otherwise each domain is looked
+ * up on its own.
+ */
+static int
+xenUnifiedListAllActiveDomains(virConnectPtr conn,
+                               virDomainPtr **doms,
+                               size_t *ndoms,
+                               unsigned int flags)
+{
+    GET_PRIVATE(conn);
+    xenHypervisorDomInfoPtr infos = NULL;
+    int *ids = NULL;
+    int nids;
+    virDomainPtr dom;
+    virDomainInfo info;
+    int i;
+    int ret = -1;
+
+    if (priv->opened[XEN_UNIFIED_HYPERVISOR_OFFSET] &&
+        (nids = xenHypervisorListAllDomInfo(conn, &infos)) >= 0) {
+        for (i = 0 ; i < nids ; i++) {
+            char *name;
+
+            if (!xenUnifiedDomainMatchState(infos[i].info.state, flags))
+                continue;
+
+            xenUnifiedLock(priv);
+            name = xenStoreDomainGetName(conn, infos[i].id);
+            xenUnifiedUnlock(priv);
+            if (!name)
+                continue; /* Gone since we listed it */
+
+            dom = virGetDomain(conn, name, infos[i].uuid);
+            VIR_FREE(name);
+            if (!dom)
+                goto cleanup;
+            dom->id = infos[i].id;
+
+            if (xenUnifiedAddDomain(doms, ndoms, dom) < 0)
+                goto cleanup;
+        }
+
+        ret = 0;
+        goto cleanup;
+    }
+
+    if ((nids = xenUnifiedNumOfDomains(conn)) < 0)
+        goto cleanup;
+    if (VIR_ALLOC_N(ids, nids + 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    if ((nids = xenUnifiedListDomains(conn, ids, nids + 1)) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < nids ; i++) {
+        if (!(dom = xenUnifiedDomainLookupByID(conn, ids[i]))) {
+            virResetLastError();
+            continue;
+        }
+
+        if (MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE) &&
+            (xenUnifiedDomainGetInfo(dom, &info) < 0 ||
+             !xenUnifiedDomainMatchState(info.state, flags))) {
+            virResetLastError();
+            virDomainFree(dom);
+            continue;
+        }
+
+        if (xenUnifiedAddDomain(doms, ndoms, dom) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(infos);
+    VIR_FREE(ids);
+    return ret;
+}
+
+static int
+xenUnifiedListAllInactiveDomains(virConnectPtr conn,
+                                 virDomainPtr **doms,
+                                 size_t *ndoms)
+{
+    char **names = NULL;
+    int nnames;
+    virDomainPtr dom;
+    int i;
+    int ret = -1;
+
+    if ((nnames = xenUnifiedNumOfDefinedDomains(conn)) < 0)
+        return -1;
+    if (nnames == 0)
+        return 0;
+
+    if (VIR_ALLOC_N(names, nnames) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+    if ((nnames = xenUnifiedListDefinedDomains(conn, names, nnames)) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < nnames ; i++) {
+        if (!(dom = xenUnifiedDomainLookupByName(conn, names[i]))) {
+            virResetLastError();
+            continue;
+        }
+
+        if (xenUnifiedAddDomain(doms, ndoms, dom) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    for (i = 0 ; i < nnames ; i++)
+        VIR_FREE(names[i]);
+    VIR_FREE(names);
+    return ret;
+}
+
+static int
+xenUnifiedListAllDomains(virConnectPtr conn,
+                         virDomainPtr **domains,
+                         unsigned int flags)
+{
+    virDomainPtr *doms = NULL;
+    size_t ndoms = 0;
+    int ret = -1;
+    size_t i;
+
+    /* Persistence, autostart and managed save would all need a
+     * round trip to xend per domain, so only the filters that the
+     * hypervisor can answer on its own are supported */
+    virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
+                  VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE, -1);
+
+    if ((!MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE) ||
+         MATCH(VIR_CONNECT_LIST_DOMAINS_ACTIVE)) &&
+        xenUnifiedListAllActiveDomains(conn, &doms, &ndoms, flags) < 0)
+        goto cleanup;
+
+    if ((!MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE) ||
+         MATCH(VIR_CONNECT_LIST_DOMAINS_INACTIVE)) &&
+        (!MATCH(VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE) ||
+         MATCH(VIR_CONNECT_LIST_DOMAINS_SHUTOFF)) &&
+        xenUnifiedListAllInactiveDomains(conn, &doms, &ndoms) < 0)
+        goto cleanup;
+
+    ret = ndoms;
+
+    if (domains) {
+        /* Trailing NULL */
+        if (VIR_EXPAND_N(doms, ndoms, 1) < 0) {
+            virReportOOMError();
+            ret = -1;
+            goto cleanup;
+        }
+        *domains = doms;
+        doms = NULL;
+        ndoms = 0;
+    }
+
+cleanup:
+    for (i = 0 ; i < ndoms ; i++)
+        if (doms[i])
+            virDomainFree(doms[i]);
+    VIR_FREE(doms);
+    return ret;
+}
+#undef MATCH
+
 static int
 xenUnifiedDomainCreateWithFlags(virDomainPtr dom, unsigned int flags)
 {
@@ -2293,10 +2514,13 @@ cleanup:
 }
 /*----- Register with libvirt.c, and initialize Xen drivers. -----*/
 
+static const char *xenUnifiedURISchemes[] = { "xen", "http", NULL };
+
 /* The interface which we export upwards to libvirt.c. */
 static virDriver xenUnifiedDriver = {
     .no = VIR_DRV_XEN_UNIFIED,
     .name = "Xen",
+    .uriSchemes = xenUnifiedURISchemes,
     .open = xenUnifiedOpen, /* 0.0.3 */
     .close = xenUnifiedClose, /* 0.0.3 */
     .supports_feature = xenUnifiedSupportsFeature, /* 0.3.2 */
@@ -2308,6 +2532,7 @@ static virDriver xenUnifiedDriver = {
     .getCapabilities = xenUnifiedGetCapabilities, /* 0.2.1 */
     .listDomains = xenUnifiedListDomains, /* 0.0.3 */
     .numOfDomains = xenUnifiedNumOfDomains, /* 0.0.3 */
+    .listAllDomains = xenUnifiedListAllDomains, /* 1.0.2 */
     .domainCreateXML = xenUnifiedDomainCreateXML, /* 0.0.3 */
     .domainLookupByID = xenUnifiedDomainLookupByID, /* 0.0.3 */
     .domainLookupByUUID = xenUnifiedDomainLookupByUUID, /* 0.0.5 */
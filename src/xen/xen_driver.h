@@ -191,6 +191,12 @@ struct _xenUnifiedPrivate {
     /* A list of active domain name/uuids */
     xenUnifiedDomainInfoListPtr activeDomainList;
 
+    /* Connection kept open to xend, and the domain sexprs it sent
+     * back recently. These are protected by xendLock, not lock */
+    virMutex xendLock;
+    int xendFd;
+    virHashTablePtr xendCache;
+
     /* NUMA topology info cache */
     int nbNodeCells;
     int nbNodeCpus;
@@ -400,6 +400,19 @@ typedef struct xen_v2s5_availheap  xen_v2s5_availheap;
       (void*)(domlist->v2d5) :                     \
       (void*)(domlist->v2))))))
 
+#define XEN_GETDOMAININFOLIST_COPY(domlist, n, dominfo)              \
+    (hv_versions.hypervisor < 2 ?                                  \
+     memcpy(&(dominfo.v0), &domlist.v0[n], sizeof(dominfo.v0)) :   \
+     (hv_versions.dom_interface >= 8 ?                             \
+      memcpy(&(dominfo.v2d8), &domlist.v2d8[n], sizeof(dominfo.v2d8)) : \
+     (hv_versions.dom_interface == 7 ?                             \
+      memcpy(&(dominfo.v2d7), &domlist.v2d7[n], sizeof(dominfo.v2d7)) : \
+     (hv_versions.dom_interface == 6 ?                             \
+      memcpy(&(dominfo.v2d6), &domlist.v2d6[n], sizeof(dominfo.v2d6)) : \
+     (hv_versions.dom_interface == 5 ?                             \
+      memcpy(&(dominfo.v2d5), &domlist.v2d5[n], sizeof(dominfo.v2d5)) : \
+      memcpy(&(dominfo.v2), &domlist.v2[n], sizeof(dominfo.v2)))))))
+
 #define XEN_GETDOMAININFO_SIZE                     \
     (hv_versions.hypervisor < 2 ?                  \
      sizeof(xen_v0_getdomaininfo) :                \
@@ -3157,22 +3170,12 @@ xenHypervisorGetMaxMemory(virDomainPtr domain)
     return xenHypervisorGetDomMaxMemory(domain->conn, domain->id);
 }
 
-/**
- * xenHypervisorGetDomInfo:
- * @conn: connection data
- * @id: the domain ID
- * @info: the place where information should be stored
- *
- * Do a hypervisor call to get the related set of domain information.
- *
- * Returns 0 in case of success, -1 in case of error.
+/*
+ * Convert the hypervisor's view of a domain into a virDomainInfo
  */
-int
-xenHypervisorGetDomInfo(virConnectPtr conn, int id, virDomainInfoPtr info)
+static void
+xenHypervisorFillDomInfo(xen_getdomaininfo *dominfo, virDomainInfoPtr info)
 {
-    xenUnifiedPrivatePtr priv;
-    xen_getdomaininfo dominfo;
-    int ret;
     uint32_t domain_flags, domain_state, domain_shutdown_cause;
 
     if (kb_per_pages == 0) {
@@ -3181,22 +3184,9 @@ xenHypervisorGetDomInfo(virConnectPtr conn, int id, virDomainInfoPtr info)
             kb_per_pages = 4;
     }
 
-    if (conn == NULL)
-        return -1;
-
-    priv = (xenUnifiedPrivatePtr) conn->privateData;
-    if (priv->handle < 0 || info == NULL)
-        return -1;
-
     memset(info, 0, sizeof(virDomainInfo));
-    XEN_GETDOMAININFO_CLEAR(dominfo);
-
-    ret = virXen_getdomaininfo(priv->handle, id, &dominfo);
 
-    if ((ret < 0) || (XEN_GETDOMAININFO_DOMAIN(dominfo) != id))
-        return -1;
-
-    domain_flags = XEN_GETDOMAININFO_FLAGS(dominfo);
+    domain_flags = XEN_GETDOMAININFO_FLAGS((*dominfo));
     domain_flags &= ~DOMFLAGS_HVM; /* Mask out HVM flags */
     domain_state = domain_flags & 0xFF; /* Mask out high bits */
     switch (domain_state) {
@@ -3232,15 +3222,121 @@ xenHypervisorGetDomInfo(virConnectPtr conn, int id, virDomainInfoPtr info)
      * convert to microseconds, same thing convert to
      * kilobytes from page counts
      */
-    info->cpuTime = XEN_GETDOMAININFO_CPUTIME(dominfo);
-    info->memory = XEN_GETDOMAININFO_TOT_PAGES(dominfo) * kb_per_pages;
-    info->maxMem = XEN_GETDOMAININFO_MAX_PAGES(dominfo);
+    info->cpuTime = XEN_GETDOMAININFO_CPUTIME((*dominfo));
+    info->memory = XEN_GETDOMAININFO_TOT_PAGES((*dominfo)) * kb_per_pages;
+    info->maxMem = XEN_GETDOMAININFO_MAX_PAGES((*dominfo));
     if (info->maxMem != UINT_MAX)
         info->maxMem *= kb_per_pages;
-    info->nrVirtCpu = XEN_GETDOMAININFO_CPUCOUNT(dominfo);
+    info->nrVirtCpu = XEN_GETDOMAININFO_CPUCOUNT((*dominfo));
+}
+
+/**
+ * xenHypervisorGetDomInfo:
+ * @conn: connection data
+ * @id: the domain ID
+ * @info: the place where information should be stored
+ *
+ * Do a hypervisor call to get the related set of domain information.
+ *
+ * Returns 0 in case of success, -1 in case of error.
+ */
+int
+xenHypervisorGetDomInfo(virConnectPtr conn, int id, virDomainInfoPtr info)
+{
+    xenUnifiedPrivatePtr priv;
+    xen_getdomaininfo dominfo;
+    int ret;
+
+    if (conn == NULL)
+        return -1;
+
+    priv = (xenUnifiedPrivatePtr) conn->privateData;
+    if (priv->handle < 0 || info == NULL)
+        return -1;
+
+    memset(info, 0, sizeof(virDomainInfo));
+    XEN_GETDOMAININFO_CLEAR(dominfo);
+
+    ret = virXen_getdomaininfo(priv->handle, id, &dominfo);
+
+    if ((ret < 0) || (XEN_GETDOMAININFO_DOMAIN(dominfo) != id))
+        return -1;
+
+    xenHypervisorFillDomInfo(&dominfo, info);
     return 0;
 }
 
+/**
+ * xenHypervisorListAllDomInfo:
+ * @conn: connection data
+ * @infos: filled with a newly allocated array
+ *
+ * Fetch the ID, UUID and information of every active domain with
+ * a single hypercall, rather than one per domain.
+ *
+ * Returns the number of domains in @infos, or -1 in case of error.
+ */
+int
+xenHypervisorListAllDomInfo(virConnectPtr conn,
+                            xenHypervisorDomInfoPtr *infos)
+{
+    xen_getdomaininfolist dominfos;
+    xen_getdomaininfo dominfo;
+    xenUnifiedPrivatePtr priv;
+    static int last_maxids = 2;
+    int maxids = last_maxids;
+    int nids, i;
+
+    *infos = NULL;
+
+    priv = (xenUnifiedPrivatePtr) conn->privateData;
+    if (priv->handle < 0)
+        return -1;
+
+ retry:
+    if (!(XEN_GETDOMAININFOLIST_ALLOC(dominfos, maxids))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    XEN_GETDOMAININFOLIST_CLEAR(dominfos, maxids);
+
+    nids = virXen_getdomaininfolist(priv->handle, 0, maxids, &dominfos);
+
+    if (nids < 0) {
+        XEN_GETDOMAININFOLIST_FREE(dominfos);
+        return -1;
+    }
+
+    /* Same limit as xenHypervisorNumOfDomains */
+    if (nids == maxids) {
+        XEN_GETDOMAININFOLIST_FREE(dominfos);
+        if (maxids < 65000) {
+            last_maxids *= 2;
+            maxids *= 2;
+            goto retry;
+        }
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(*infos, nids) < 0) {
+        XEN_GETDOMAININFOLIST_FREE(dominfos);
+        virReportOOMError();
+        return -1;
+    }
+
+    for (i = 0 ; i < nids ; i++) {
+        XEN_GETDOMAININFOLIST_COPY(dominfos, i, dominfo);
+        (*infos)[i].id = XEN_GETDOMAININFO_DOMAIN(dominfo);
+        memcpy((*infos)[i].uuid, XEN_GETDOMAININFO_UUID(dominfo),
+               VIR_UUID_BUFLEN);
+        xenHypervisorFillDomInfo(&dominfo, &(*infos)[i].info);
+    }
+
+    XEN_GETDOMAININFOLIST_FREE(dominfos);
+    return nids;
+}
+
 /**
  * xenHypervisorGetDomainInfo:
  * @domain: pointer to the domain block
@@ -36,6 +36,15 @@ struct xenHypervisorVersions {
     int dom_interface; /* -1,3,4,5,6,7 */
 };
 
+/* An active domain, as listed by xenHypervisorListAllDomInfo() */
+typedef struct _xenHypervisorDomInfo xenHypervisorDomInfo;
+typedef xenHypervisorDomInfo *xenHypervisorDomInfoPtr;
+struct _xenHypervisorDomInfo {
+    int id;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    virDomainInfo info;
+};
+
 extern struct xenUnifiedDriver xenHypervisorDriver;
 int xenHypervisorInit(struct xenHypervisorVersions *override_versions);
 
@@ -96,6 +105,9 @@ int     xenHypervisorGetDomainState     (virDomainPtr domain,
 int     xenHypervisorGetDomInfo         (virConnectPtr conn,
                                          int id,
                                          virDomainInfoPtr info);
+int     xenHypervisorListAllDomInfo     (virConnectPtr conn,
+                                         xenHypervisorDomInfoPtr *infos)
+          ATTRIBUTE_NONNULL (1) ATTRIBUTE_NONNULL (2);
 int     xenHypervisorSetMaxMemory       (virDomainPtr domain,
                                          unsigned long memory)
           ATTRIBUTE_NONNULL (1);
@@ -47,6 +47,8 @@
 #include "virfile.h"
 #include "viruri.h"
 #include "device_conf.h"
+#include "virhash.h"
+#include "virtime.h"
 
 /* required for cpumap_t */
 #include <xen/dom0_ops.h>
@@ -59,6 +61,16 @@
 
 #define XEND_RCV_BUF_MAX_LEN (256 * 1024)
 
+/* How long a domain sexpr fetched from xend may be reused */
+#define XEND_CACHE_TTL_MS 1000
+
+typedef struct _xenDaemonCacheEntry xenDaemonCacheEntry;
+typedef xenDaemonCacheEntry *xenDaemonCacheEntryPtr;
+struct _xenDaemonCacheEntry {
+    char *content;
+    unsigned long long expires;
+};
+
 static int
 virDomainXMLDevID(virDomainPtr domain,
                   virDomainDeviceDefPtr dev,
@@ -134,7 +146,8 @@ wr_sync(int fd, void *buffer, size_t size, int do_read)
         if (do_read) {
             len = read(fd, ((char *) buffer) + offset, size - offset);
         } else {
-            len = write(fd, ((char *) buffer) + offset, size - offset);
+            len = send(fd, ((char *) buffer) + offset, size - offset,
+                       MSG_NOSIGNAL);
         }
 
         /* recoverable error, retry  */
@@ -260,6 +273,7 @@ istartswith(const char *haystack, const char *needle)
  * xend_req:
  * @fd: the file descriptor
  * @content: the buffer to store the content
+ * @keepalive: set to whether the connection can carry another request
  *
  * Read the HTTP response from a Xen Daemon request.
  * If the response contains content, memory is allocated to
@@ -268,14 +282,18 @@ istartswith(const char *haystack, const char *needle)
  * Returns the HTTP return code and @content is set to the
  * allocated memory containing HTTP content.
  */
-static int ATTRIBUTE_NONNULL(2)
-xend_req(int fd, char **content)
+static int ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+xend_req(int fd, char **content, bool *keepalive)
 {
     char *buffer;
     size_t buffer_size = 4096;
     int content_length = 0;
+    bool has_length = false;
+    bool close_requested = false;
     int retcode = 0;
 
+    *keepalive = false;
+
     if (VIR_ALLOC_N(buffer, buffer_size) < 0) {
         virReportOOMError();
         return -1;
@@ -285,14 +303,22 @@ xend_req(int fd, char **content)
         if (STREQ(buffer, "\r\n"))
             break;
 
-        if (istartswith(buffer, "Content-Length: "))
+        if (istartswith(buffer, "Content-Length: ")) {
             content_length = atoi(buffer + 16);
-        else if (istartswith(buffer, "HTTP/1.1 "))
+            has_length = true;
+        } else if (istartswith(buffer, "HTTP/1.1 ")) {
             retcode = atoi(buffer + 9);
+        } else if (istartswith(buffer, "Connection: close")) {
+            close_requested = true;
+        }
     }
 
     VIR_FREE(buffer);
 
+    /* Without a length, the end of the body is only known once xend
+     * closes the connection, so it can't be used again */
+    *keepalive = retcode > 0 && has_length && !close_requested;
+
     if (content_length > 0) {
         ssize_t ret;
 
@@ -314,13 +340,169 @@ xend_req(int fd, char **content)
         }
 
         ret = sread(fd, *content, content_length);
-        if (ret < 0)
+        if (ret < 0) {
+            *keepalive = false;
             return -1;
+        }
+        if (ret != content_length)
+            *keepalive = false;
     }
 
     return retcode;
 }
 
+
+/*
+ * Drop the connection to xend, if any. Call with xendLock held.
+ */
+static void
+xend_disconnect(xenUnifiedPrivatePtr priv)
+{
+    VIR_FORCE_CLOSE(priv->xendFd);
+}
+
+
+/**
+ * xend_send:
+ * @xend: pointer to the Xen Daemon structure
+ * @request: the HTTP request, headers and body included
+ * @content: the buffer to store the content
+ *
+ * Send a request over the connection kept open to xend, opening it
+ * first if needed, and read the reply. xend may close an idle
+ * connection at any time, so if a connection that served earlier
+ * requests fails before any reply comes back, the request is sent
+ * again over a new one. Call with xendLock held.
+ *
+ * Returns the HTTP return code or -1 in case or error.
+ */
+static int ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+xend_send(virConnectPtr xend, const char *request, char **content)
+{
+    xenUnifiedPrivatePtr priv = (xenUnifiedPrivatePtr) xend->privateData;
+    bool reused;
+    bool keepalive;
+    int ret;
+
+retry:
+    reused = priv->xendFd != -1;
+    if (!reused && (priv->xendFd = do_connect(xend)) < 0)
+        return -1;
+
+    if (swrites(priv->xendFd, request) < 0) {
+        xend_disconnect(priv);
+        if (reused) {
+            virResetLastError();
+            goto retry;
+        }
+        return -1;
+    }
+
+    ret = xend_req(priv->xendFd, content, &keepalive);
+    if (ret == 0 && reused) {
+        /* Closed while idle, before reading the request */
+        xend_disconnect(priv);
+        virResetLastError();
+        goto retry;
+    }
+
+    if (!keepalive)
+        xend_disconnect(priv);
+
+    return ret;
+}
+
+
+static void
+xend_cache_entry_free(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    xenDaemonCacheEntryPtr entry = payload;
+
+    VIR_FREE(entry->content);
+    VIR_FREE(entry);
+}
+
+
+/*
+ * Look for an unexpired reply to GET @path. Call with xendLock held.
+ *
+ * Returns 0 and a copy in @content if found, -1 otherwise
+ */
+static int
+xend_cache_lookup(xenUnifiedPrivatePtr priv, const char *path,
+                  char **content)
+{
+    xenDaemonCacheEntryPtr entry;
+    unsigned long long now;
+
+    if (!priv->xendCache ||
+        !(entry = virHashLookup(priv->xendCache, path)))
+        return -1;
+
+    if (virTimeMillisNow(&now) < 0 || now >= entry->expires) {
+        virHashRemoveEntry(priv->xendCache, path);
+        return -1;
+    }
+
+    if (entry->content && !(*content = strdup(entry->content)))
+        return -1;
+
+    return 0;
+}
+
+
+/*
+ * Remember the reply to GET @path for a short while. This is best
+ * effort, so failures are ignored. Call with xendLock held.
+ */
+static void
+xend_cache_store(xenUnifiedPrivatePtr priv, const char *path,
+                 const char *content)
+{
+    xenDaemonCacheEntryPtr entry = NULL;
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        return;
+
+    if (!priv->xendCache &&
+        !(priv->xendCache = virHashCreate(32, xend_cache_entry_free)))
+        return;
+
+    if (VIR_ALLOC(entry) < 0 ||
+        (content && !(entry->content = strdup(content))))
+        goto error;
+    entry->expires = now + XEND_CACHE_TTL_MS;
+
+    if (virHashUpdateEntry(priv->xendCache, path, entry) < 0)
+        goto error;
+    return;
+
+error:
+    if (entry)
+        xend_cache_entry_free(entry, NULL);
+    virResetLastError();
+}
+
+
+/**
+ * xenDaemonInvalidateCache:
+ * @conn: an existing virtual connection block
+ *
+ * Forget the domain sexprs recently fetched from xend, since domains
+ * have changed since.
+ */
+void
+xenDaemonInvalidateCache(virConnectPtr conn)
+{
+    xenUnifiedPrivatePtr priv = (xenUnifiedPrivatePtr) conn->privateData;
+
+    virMutexLock(&priv->xendLock);
+    if (priv->xendCache)
+        virHashRemoveAll(priv->xendCache);
+    virMutexUnlock(&priv->xendLock);
+}
+
 /**
  * xend_get:
  * @xend: pointer to the Xen Daemon structure
@@ -335,23 +517,32 @@ static int ATTRIBUTE_NONNULL(3)
 xend_get(virConnectPtr xend, const char *path,
          char **content)
 {
+    xenUnifiedPrivatePtr priv = (xenUnifiedPrivatePtr) xend->privateData;
+    /* Only the state of single domains is worth caching */
+    bool cacheable = STRPREFIX(path, "/xend/domain/");
+    char *request = NULL;
     int ret;
-    int s = do_connect(xend);
 
-    if (s == -1)
-        return s;
-
-    swrites(s, "GET ");
-    swrites(s, path);
-    swrites(s, " HTTP/1.1\r\n");
-
-    swrites(s,
-            "Host: localhost:8000\r\n"
-            "Accept-Encoding: identity\r\n"
-            "Content-Type: application/x-www-form-urlencoded\r\n" "\r\n");
+    if (virAsprintf(&request,
+                    "GET %s HTTP/1.1\r\n"
+                    "Host: localhost:8000\r\n"
+                    "Accept-Encoding: identity\r\n"
+                    "Content-Type: application/x-www-form-urlencoded\r\n"
+                    "\r\n", path) < 0) {
+        virReportOOMError();
+        return -1;
+    }
 
-    ret = xend_req(s, content);
-    VIR_FORCE_CLOSE(s);
+    virMutexLock(&priv->xendLock);
+    if (cacheable && xend_cache_lookup(priv, path, content) == 0) {
+        ret = 200;
+    } else {
+        ret = xend_send(xend, request, content);
+        if (ret == 200 && cacheable)
+            xend_cache_store(priv, path, *content);
+    }
+    virMutexUnlock(&priv->xendLock);
+    VIR_FREE(request);
 
     if (ret < 0)
         return ret;
@@ -379,30 +570,30 @@ xend_get(virConnectPtr xend, const char *path,
 static int
 xend_post(virConnectPtr xend, const char *path, const char *ops)
 {
-    char buffer[100];
+    xenUnifiedPrivatePtr priv = (xenUnifiedPrivatePtr) xend->privateData;
+    char *request = NULL;
     char *err_buf = NULL;
     int ret;
-    int s = do_connect(xend);
-
-    if (s == -1)
-        return s;
 
-    swrites(s, "POST ");
-    swrites(s, path);
-    swrites(s, " HTTP/1.1\r\n");
-
-    swrites(s,
-            "Host: localhost:8000\r\n"
-            "Accept-Encoding: identity\r\n"
-            "Content-Type: application/x-www-form-urlencoded\r\n"
-            "Content-Length: ");
-    snprintf(buffer, sizeof(buffer), "%d", (int) strlen(ops));
-    swrites(s, buffer);
-    swrites(s, "\r\n\r\n");
-    swrites(s, ops);
+    if (virAsprintf(&request,
+                    "POST %s HTTP/1.1\r\n"
+                    "Host: localhost:8000\r\n"
+                    "Accept-Encoding: identity\r\n"
+                    "Content-Type: application/x-www-form-urlencoded\r\n"
+                    "Content-Length: %zu\r\n"
+                    "\r\n"
+                    "%s", path, strlen(ops), ops) < 0) {
+        virReportOOMError();
+        return -1;
+    }
 
-    ret = xend_req(s, &err_buf);
-    VIR_FORCE_CLOSE(s);
+    virMutexLock(&priv->xendLock);
+    /* Whatever the request does, cached state may no longer hold */
+    if (priv->xendCache)
+        virHashRemoveAll(priv->xendCache);
+    ret = xend_send(xend, request, &err_buf);
+    virMutexUnlock(&priv->xendLock);
+    VIR_FREE(request);
 
     if ((ret < 0) || (ret >= 300)) {
         virReportError(VIR_ERR_POST_FAILED,
@@ -1339,8 +1530,15 @@ failed:
  * Returns 0 in case of success, -1 in case of error
  */
 int
-xenDaemonClose(virConnectPtr conn ATTRIBUTE_UNUSED)
+xenDaemonClose(virConnectPtr conn)
 {
+    xenUnifiedPrivatePtr priv = (xenUnifiedPrivatePtr) conn->privateData;
+
+    virMutexLock(&priv->xendLock);
+    xend_disconnect(priv);
+    virHashFree(priv->xendCache);
+    priv->xendCache = NULL;
+    virMutexUnlock(&priv->xendLock);
     return 0;
 }
 
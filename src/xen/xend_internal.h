@@ -98,6 +98,7 @@ xenDaemonDomainFetch(virConnectPtr xend,
 virDrvOpenStatus xenDaemonOpen(virConnectPtr conn, virConnectAuthPtr auth,
                                unsigned int flags);
 int xenDaemonClose(virConnectPtr conn);
+void xenDaemonInvalidateCache(virConnectPtr conn);
 int xenDaemonGetVersion(virConnectPtr conn, unsigned long *hvVer);
 int xenDaemonNodeGetInfo(virConnectPtr conn, virNodeInfoPtr info);
 int xenDaemonNodeGetTopology(virConnectPtr conn, virCapsPtr caps);
@@ -50,6 +50,7 @@
 #include "xen_driver.h"
 #include "xs_internal.h"
 #include "xen_hypervisor.h"
+#include "xend_internal.h"
 
 #define VIR_FROM_THIS VIR_FROM_XEN
 
@@ -1337,6 +1338,8 @@ int xenStoreDomainIntroduced(virConnectPtr conn,
 
     xenUnifiedPrivatePtr priv = opaque;
 
+    xenDaemonInvalidateCache(conn);
+
 retry:
     new_domain_cnt = xenStoreNumOfDomains(conn);
     if (new_domain_cnt < 0)
@@ -1418,6 +1421,8 @@ int xenStoreDomainReleased(virConnectPtr conn,
 
     xenUnifiedPrivatePtr priv = (xenUnifiedPrivatePtr) opaque;
 
+    xenDaemonInvalidateCache(conn);
+
     if (!priv->activeDomainList->count) return 0;
 
 retry:
@@ -438,6 +438,47 @@ xenapiGetCapabilities(virConnectPtr conn)
 }
 
 
+/*
+ * xenapiGetAllVMRecords
+ *
+ * Fetches the records of all the VMs of the pool in a single call, rather
+ * than a call per VM, so that listing domains takes one round trip to the
+ * pool master whatever their number
+ * Returns the records or NULL in case of error
+ */
+static xen_vm_xen_vm_record_map *
+xenapiGetAllVMRecords(virConnectPtr conn)
+{
+    xen_vm_xen_vm_record_map *records = NULL;
+    xen_session *session = ((struct _xenapiPrivate *)(conn->privateData))->session;
+
+    if (!xen_vm_get_all_records(session, &records) || records == NULL) {
+        xenapiSessionErrorHandler(conn, VIR_ERR_INTERNAL_ERROR, NULL);
+        if (records)
+            xen_vm_xen_vm_record_map_free(records);
+        return NULL;
+    }
+    return records;
+}
+
+/*
+ * xenapiVMIsResidentOn
+ *
+ * Returns true if the VM of @record runs on @host
+ */
+static bool
+xenapiVMIsResidentOn(xen_vm_record *record, xen_host host)
+{
+    xen_host_record_opt *resident = record->resident_on;
+
+    if (resident == NULL)
+        return false;
+    if (resident->is_record)
+        return resident->u.record != NULL &&
+               STREQ_NULLABLE(resident->u.record->handle, host);
+    return STREQ_NULLABLE(resident->u.handle, host);
+}
+
 /*
  * xenapiListDomains
  *
@@ -449,30 +490,34 @@ xenapiListDomains(virConnectPtr conn, int *ids, int maxids)
 {
     /* vm.list */
     xen_host host;
-    xen_vm_set *result = NULL;
-    int64_t t0;
-    int i;
+    xen_vm_xen_vm_record_map *records = NULL;
+    int i, n = 0;
     xen_session *session = ((struct _xenapiPrivate *)(conn->privateData))->session;
-    if (xen_session_get_this_host(session, &host, session)) {
-        xen_host_get_resident_vms(session, &result, host);
-        xen_host_free(host);
-    } else
+    if (!xen_session_get_this_host(session, &host, session)) {
         xenapiSessionErrorHandler(conn, VIR_ERR_INTERNAL_ERROR, NULL);
-    if (result != NULL) {
-        for (i = 0; (i < (result->size)) && (i < maxids); i++) {
-            xen_vm_get_domid(session, &t0, result->contents[i]);
-            if (t0 > (int64_t)INT_MAX || t0 < (int64_t)INT_MIN) {
-                xenapiSessionErrorHandler(conn, VIR_ERR_INTERNAL_ERROR,
-                                          _("DomainID can't fit in 32 bits"));
-                xen_vm_set_free(result);
-                return -1;
-            }
-            ids[i] = (int)t0;
+        return -1;
+    }
+    if (!(records = xenapiGetAllVMRecords(conn))) {
+        xen_host_free(host);
+        return -1;
+    }
+    for (i = 0; i < records->size && n < maxids; i++) {
+        xen_vm_record *record = records->contents[i].val;
+        if (!xenapiVMIsResidentOn(record, host))
+            continue;
+        if (record->domid > (int64_t)INT_MAX ||
+            record->domid < (int64_t)INT_MIN) {
+            xenapiSessionErrorHandler(conn, VIR_ERR_INTERNAL_ERROR,
+                                      _("DomainID can't fit in 32 bits"));
+            xen_vm_xen_vm_record_map_free(records);
+            xen_host_free(host);
+            return -1;
         }
-        xen_vm_set_free(result);
-        return i;
+        ids[n++] = (int)record->domid;
     }
-    return -1;
+    xen_vm_xen_vm_record_map_free(records);
+    xen_host_free(host);
+    return n;
 }
 
 /*
@@ -566,43 +611,31 @@ static virDomainPtr
 xenapiDomainLookupByID(virConnectPtr conn, int id)
 {
     int i;
-    int64_t domID;
-    char *uuid;
     xen_host host;
-    xen_vm_set *result;
-    xen_vm_record *record;
+    xen_vm_xen_vm_record_map *records;
     unsigned char raw_uuid[VIR_UUID_BUFLEN];
     virDomainPtr domP=NULL;
     xen_session *session = ((struct _xenapiPrivate *)(conn->privateData))->session;
 
     xen_session_get_this_host(session, &host, session);
     if (host != NULL && session->ok) {
-        xen_host_get_resident_vms(session, &result, host);
-        if (result != NULL) {
-            for (i = 0; i < result->size; i++) {
-                xen_vm_get_domid(session, &domID, result->contents[i]);
-                if (domID == id) {
-                    xen_vm_get_record(session, &record, result->contents[i]);
-                    xen_vm_get_uuid(session, &uuid, result->contents[i]);
-                    ignore_value(virUUIDParse(uuid, raw_uuid));
+        if ((records = xenapiGetAllVMRecords(conn)) != NULL) {
+            for (i = 0; i < records->size; i++) {
+                xen_vm_record *record = records->contents[i].val;
+                if (xenapiVMIsResidentOn(record, host) && record->domid == id) {
+                    ignore_value(virUUIDParse(record->uuid, raw_uuid));
                     domP = virGetDomain(conn, record->name_label, raw_uuid);
                     if (domP) {
-                        int64_t domid = -1;
-                        xen_vm_get_domid(session, &domid, result->contents[i]);
-                        domP->id = domid;
+                        domP->id = record->domid;
                     } else {
                         xenapiSessionErrorHandler(conn, VIR_ERR_INTERNAL_ERROR,
                                                   _("Domain Pointer not valid"));
                         domP = NULL;
                     }
-                    xen_uuid_free(uuid);
-                    xen_vm_record_free(record);
                     break;
                 }
             }
-            xen_vm_set_free(result);
-        } else {
-            xenapiSessionErrorHandler(conn, VIR_ERR_NO_DOMAIN, NULL);
+            xen_vm_xen_vm_record_map_free(records);
         }
         xen_host_free(host);
     } else {
@@ -1032,19 +1065,22 @@ xenapiDomainGetInfo(virDomainPtr dom, virDomainInfoPtr info)
             return -1;
         }
         vm = vms->contents[0];
-        xen_vm_get_memory_static_max(session, &maxmem, vm);
-        info->maxMem = (maxmem / 1024);
-        enum xen_vm_power_state state = XEN_VM_POWER_STATE_UNDEFINED;
-        xen_vm_get_power_state(session, &state, vm);
-        info->state = mapPowerState(state);
-        xen_vm_get_record(session, &record, vm);
-        if (record != NULL) {
-            xen_vm_metrics_get_memory_actual(session, &memory, record->metrics->u.handle);
-            info->memory = (memory / 1024);
-            xen_vm_record_free(record);
+        /* The record has everything but the actual memory, get it in
+         * a single call rather than a call per field */
+        if (!xen_vm_get_record(session, &record, vm) || record == NULL) {
+            xenapiSessionErrorHandler(dom->conn, VIR_ERR_INTERNAL_ERROR,
+                                      _("Couldn't get VM record"));
+            xen_vm_set_free(vms);
+            return -1;
         }
-        xen_vm_get_vcpus_max(session, &vcpu, vm);
+        maxmem = record->memory_static_max;
+        info->maxMem = (maxmem / 1024);
+        info->state = mapPowerState(record->power_state);
+        xen_vm_metrics_get_memory_actual(session, &memory, record->metrics->u.handle);
+        info->memory = (memory / 1024);
+        vcpu = record->vcpus_max;
         info->nrVirtCpu = vcpu;
+        xen_vm_record_free(record);
         xen_vm_set_free(vms);
         return 0;
     }
@@ -1539,41 +1575,25 @@ static int
 xenapiListDefinedDomains(virConnectPtr conn, char **const names,
                          int maxnames)
 {
-    int i,j=0,doms;
-    xen_vm_set *result;
-    xen_vm_record *record;
-    xen_session *session = ((struct _xenapiPrivate *)(conn->privateData))->session;
-    xen_vm_get_all(session, &result);
-    if (result != NULL) {
-        for (i = 0; i < result->size && j < maxnames; i++) {
-            xen_vm_get_record(session, &record, result->contents[i]);
-            if (record != NULL) {
-                if (record->is_a_template == 0) {
-                    char *usenames = NULL;
-                    if (!(usenames = strdup(record->name_label))) {
-                        virReportOOMError();
-                        xen_vm_record_free(record);
-                        xen_vm_set_free(result);
-                        while (--j >= 0) VIR_FREE(names[j]);
-                        return -1;
-                    }
-                    names[j++] = usenames;
-                }
-                xen_vm_record_free(record);
-            } else {
-                xenapiSessionErrorHandler(conn, VIR_ERR_INTERNAL_ERROR,
-                                          _("Couldn't get VM record"));
-                xen_vm_set_free(result);
+    int i,j=0;
+    xen_vm_xen_vm_record_map *records;
+    if (!(records = xenapiGetAllVMRecords(conn)))
+        return -1;
+    for (i = 0; i < records->size && j < maxnames; i++) {
+        xen_vm_record *record = records->contents[i].val;
+        if (record->is_a_template == 0) {
+            char *usenames = NULL;
+            if (!(usenames = strdup(record->name_label))) {
+                virReportOOMError();
+                xen_vm_xen_vm_record_map_free(records);
                 while (--j >= 0) VIR_FREE(names[j]);
-                   return -1;
+                return -1;
             }
+            names[j++] = usenames;
         }
-        doms = j;
-        xen_vm_set_free(result);
-        return doms;
     }
-    xenapiSessionErrorHandler(conn, VIR_ERR_INTERNAL_ERROR, NULL);
-    return -1;
+    xen_vm_xen_vm_record_map_free(records);
+    return j;
 }
 
 /*
@@ -1585,28 +1605,16 @@ xenapiListDefinedDomains(virConnectPtr conn, char **const names,
 static int
 xenapiNumOfDefinedDomains(virConnectPtr conn)
 {
-    xen_vm_set *result;
-    xen_vm_record *record;
+    xen_vm_xen_vm_record_map *records;
     int DomNum = 0, i;
-    xen_session *session = ((struct _xenapiPrivate *)(conn->privateData))->session;
-    xen_vm_get_all(session, &result);
-    if (result != NULL) {
-        for (i = 0; i < result->size; i++) {
-            xen_vm_get_record(session, &record, result->contents[i]);
-            if (record == NULL && !session->ok) {
-                xenapiSessionErrorHandler(conn, VIR_ERR_INTERNAL_ERROR, NULL);
-                xen_vm_set_free(result);
-                return -1;
-            }
-            if (record->is_a_template == 0)
-                DomNum++;
-            xen_vm_record_free(record);
-        }
-        xen_vm_set_free(result);
-        return DomNum;
+    if (!(records = xenapiGetAllVMRecords(conn)))
+        return -1;
+    for (i = 0; i < records->size; i++) {
+        if (records->contents[i].val->is_a_template == 0)
+            DomNum++;
     }
-    xenapiSessionErrorHandler(conn, VIR_ERR_INTERNAL_ERROR, NULL);
-    return -1;
+    xen_vm_xen_vm_record_map_free(records);
+    return DomNum;
 }
 
 /*
@@ -1910,10 +1918,13 @@ xenapiIsAlive(virConnectPtr conn)
         return 0;
 }
 
+static const char *xenapiURISchemes[] = { "XenAPI", NULL };
+
 /* The interface which we export upwards to libvirt.c. */
 static virDriver xenapiDriver = {
     .no = VIR_DRV_XENAPI,
     .name = "XenAPI",
+    .uriSchemes = xenapiURISchemes,
     .open = xenapiOpen, /* 0.8.0 */
     .close = xenapiClose, /* 0.8.0 */
     .supports_feature = xenapiSupportsFeature, /* 0.8.0 */
@@ -380,6 +380,20 @@ mymain(void)
 
     resetAll();
 
+    /* Only the soonest of several pending timers should fire,
+     * regardless of the order they were scheduled in */
+    virEventPollUpdateTimeout(timers[5].timer, 1000);
+    virEventPollUpdateTimeout(timers[4].timer, 100);
+    virEventPollUpdateTimeout(timers[6].timer, 500);
+    startJob();
+    if (finishJob("Firing soonest timer", -1, 4) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    virEventPollUpdateTimeout(timers[4].timer, -1);
+    virEventPollUpdateTimeout(timers[5].timer, -1);
+    virEventPollUpdateTimeout(timers[6].timer, -1);
+
+    resetAll();
+
     /* Now lets delete one before starting poll(), and
      * try triggering another timer */
     virEventPollUpdateTimeout(timers[1].timer, 100);
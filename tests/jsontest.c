@@ -54,6 +54,149 @@ cleanup:
 }
 
 
+static bool
+testJSONFilterParent(const char *key,
+                     unsigned int depth ATTRIBUTE_UNUSED,
+                     void *opaque ATTRIBUTE_UNUSED)
+{
+    return STRNEQ(key, "parent") && STRNEQ(key, "junk");
+}
+
+
+static int
+testJSONFromStringFiltered(const void *data)
+{
+    const struct testInfo *info = data;
+    virJSONValuePtr json;
+    virJSONValuePtr dev;
+    unsigned long long val;
+    int ret = -1;
+
+    if (!(json = virJSONValueFromStringFiltered(info->doc,
+                                                testJSONFilterParent,
+                                                NULL))) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "Fail to parse %s\n", info->doc);
+        return -1;
+    }
+
+    if (!(dev = virJSONValueArrayGet(virJSONValueObjectGet(json, "return"), 0)) ||
+        virJSONValueObjectHasKey(dev, "parent") != 0 ||
+        virJSONValueObjectHasKey(dev, "junk") != 0 ||
+        STRNEQ_NULLABLE(virJSONValueObjectGetString(dev, "device"),
+                        "drive-virtio-disk0") ||
+        virJSONValueObjectGetNumberUlong(virJSONValueObjectGet(dev, "stats"),
+                                         "rd_bytes", &val) < 0 ||
+        val != 1024 ||
+        virJSONValueArraySize(virJSONValueObjectGet(json, "return")) != 2 ||
+        STRNEQ_NULLABLE(virJSONValueObjectGetString(json, "id"),
+                        "libvirt-5")) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "Unexpected result of filtering %s\n", info->doc);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virJSONValueFree(json);
+    return ret;
+}
+
+
+static int
+testJSONLookup(const void *data ATTRIBUTE_UNUSED)
+{
+    virJSONValuePtr json;
+    virJSONValueObjectField fields[] = {
+        { "key-39", NULL },
+        { "missing", NULL },
+        { "key-0", NULL },
+    };
+    char key[32];
+    int val;
+    int i;
+    int ret = -1;
+
+    if (!(json = virJSONValueNewObject()))
+        return -1;
+
+    /* Enough keys for lookups to switch to the hashed index half way */
+    for (i = 0; i < 40; i++) {
+        snprintf(key, sizeof(key), "key-%d", i);
+        if (virJSONValueObjectAppendNumberInt(json, key, i) < 0)
+            goto cleanup;
+        if (virJSONValueObjectGetNumberInt(json, key, &val) < 0 || val != i ||
+            virJSONValueObjectHasKey(json, "missing") != 0)
+            goto cleanup;
+    }
+
+    if (virJSONValueObjectAppendNumberInt(json, "key-7", 0) == 0 ||
+        virJSONValueObjectGetNumberInt(json, "key-7", &val) < 0 || val != 7)
+        goto cleanup;
+
+    if (virJSONValueObjectGetFields(json, fields,
+                                    ARRAY_CARDINALITY(fields)) != 2 ||
+        virJSONValueGetNumberInt(fields[0].value, &val) < 0 || val != 39 ||
+        fields[1].value != NULL ||
+        virJSONValueGetNumberInt(fields[2].value, &val) < 0 || val != 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virJSONValueFree(json);
+    return ret;
+}
+
+
+static int
+testJSONRemoveKey(const void *data ATTRIBUTE_UNUSED)
+{
+    virJSONValuePtr json;
+    virJSONValuePtr value = NULL;
+    char key[32];
+    int val;
+    int i;
+    int ret = -1;
+
+    if (!(json = virJSONValueNewObject()))
+        return -1;
+
+    for (i = 0; i < 40; i++) {
+        snprintf(key, sizeof(key), "key-%d", i);
+        if (virJSONValueObjectAppendNumberInt(json, key, i) < 0)
+            goto cleanup;
+    }
+
+    /* Build the index so that it must be kept up to date too */
+    if (virJSONValueObjectHasKey(json, "key-20") != 1)
+        goto cleanup;
+
+    if (virJSONValueObjectRemoveKey(json, "key-20", &value) != 1 ||
+        virJSONValueGetNumberInt(value, &val) < 0 || val != 20 ||
+        virJSONValueObjectRemoveKey(json, "key-0", NULL) != 1 ||
+        virJSONValueObjectRemoveKey(json, "key-20", NULL) != 0 ||
+        virJSONValueObjectHasKey(json, "key-20") != 0 ||
+        virJSONValueObjectHasKey(json, "key-0") != 0 ||
+        virJSONValueObjectKeysNumber(json) != 38 ||
+        virJSONValueObjectGetNumberInt(json, "key-21", &val) < 0 || val != 21)
+        goto cleanup;
+
+    /* The key can be added back once removed */
+    if (virJSONValueObjectAppendNumberInt(json, "key-20", 42) < 0 ||
+        virJSONValueObjectGetNumberInt(json, "key-20", &val) < 0 || val != 42)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virJSONValueFree(value);
+    virJSONValueFree(json);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -105,6 +248,21 @@ mymain(void)
                   "\"query-uuid\"}, {\"name\": \"query-migrate\"}, {\"name\": "
                   "\"query-balloon\"}], \"id\": \"libvirt-2\"}");
 
+    DO_TEST_FULL("Filtered", FromStringFiltered,
+                 "{\"return\": [{\"device\": \"drive-virtio-disk0\", "
+                 "\"parent\": {\"stats\": {\"wr_highest_offset\": 5, "
+                 "\"list\": [1, [2, {\"a\": null}], {}]}}, "
+                 "\"junk\": \"x\", "
+                 "\"stats\": {\"rd_bytes\": 1024, \"wr_bytes\": 0}}, "
+                 "{\"device\": \"drive-ide0-0-0\", \"parent\": true, "
+                 "\"stats\": {}}], \"id\": \"libvirt-5\"}",
+                 true);
+
+    if (virtTestRun("Lookup", 1, testJSONLookup, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("RemoveKey", 1, testJSONRemoveKey, NULL) < 0)
+        ret = -1;
+
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
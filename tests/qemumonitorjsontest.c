@@ -423,6 +423,266 @@ cleanup:
 }
 
 
+static int
+testQemuMonitorJSONGetAllBlockStatsInfo(const void *data)
+{
+    virCapsPtr caps = (virCapsPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNew(true, caps);
+    int ret = -1;
+    virHashTablePtr stats = NULL;
+    qemuBlockStatsPtr entry;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-blockstats",
+                               "{ "
+                               "    \"return\": [ "
+                               "        { "
+                               "            \"device\": \"drive-virtio-disk0\", "
+                               "            \"stats\": { "
+                               "                \"rd_bytes\": 5428736, "
+                               "                \"rd_operations\": 334, "
+                               "                \"rd_total_time_ns\": 84260381, "
+                               "                \"wr_bytes\": 1024, "
+                               "                \"wr_operations\": 2, "
+                               "                \"wr_total_time_ns\": 1000, "
+                               "                \"flush_operations\": 1, "
+                               "                \"flush_total_time_ns\": 500 "
+                               "            } "
+                               "        }, "
+                               "        { "
+                               "            \"device\": \"drive-ide0-1-0\", "
+                               "            \"stats\": { "
+                               "                \"rd_bytes\": 49250, "
+                               "                \"rd_operations\": 16, "
+                               "                \"wr_bytes\": 0, "
+                               "                \"wr_operations\": 0 "
+                               "            } "
+                               "        } "
+                               "    ] "
+                               "}") < 0)
+        goto cleanup;
+
+    if (!(stats = qemuMonitorGetAllBlockStatsInfo(qemuMonitorTestGetMonitor(test))))
+        goto cleanup;
+
+    if (virHashSize(stats) != 2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Unexpected number of devices %zd", virHashSize(stats));
+        goto cleanup;
+    }
+
+    if (!(entry = virHashLookup(stats, "virtio-disk0")) ||
+        entry->rd_bytes != 5428736 || entry->rd_req != 334 ||
+        entry->rd_total_times != 84260381 || entry->wr_bytes != 1024 ||
+        entry->wr_req != 2 || entry->wr_total_times != 1000 ||
+        entry->flush_req != 1 || entry->flush_total_times != 500) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "Unexpected statistics for virtio-disk0");
+        goto cleanup;
+    }
+
+    if (!(entry = virHashLookup(stats, "ide0-1-0")) ||
+        entry->rd_bytes != 49250 || entry->rd_req != 16 ||
+        entry->rd_total_times != -1 || entry->flush_req != -1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "Unexpected statistics for ide0-1-0");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virHashFree(stats);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+
+static int
+testQemuMonitorJSONGetStats(const void *data)
+{
+    virCapsPtr caps = (virCapsPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNew(true, caps);
+    qemuMonitorStats stats;
+    qemuBlockStatsPtr entry;
+    int ret = -1;
+
+    memset(&stats, 0, sizeof(stats));
+
+    if (!test)
+        return -1;
+
+    /* both commands go out in one write and are answered in order */
+    if (qemuMonitorTestAddItem(test, "query-blockstats",
+                               "{ "
+                               "    \"return\": [ "
+                               "        { "
+                               "            \"device\": \"drive-virtio-disk0\", "
+                               "            \"stats\": { "
+                               "                \"rd_bytes\": 4096, "
+                               "                \"rd_operations\": 8, "
+                               "                \"wr_bytes\": 512, "
+                               "                \"wr_operations\": 1 "
+                               "            } "
+                               "        } "
+                               "    ] "
+                               "}") < 0 ||
+        qemuMonitorTestAddItem(test, "query-balloon",
+                               "{ "
+                               "    \"return\": { "
+                               "        \"actual\": 536870912 "
+                               "    } "
+                               "}") < 0)
+        goto cleanup;
+
+    if (qemuMonitorGetStats(qemuMonitorTestGetMonitor(test),
+                            QEMU_MONITOR_STATS_BLOCK |
+                            QEMU_MONITOR_STATS_BALLOON,
+                            &stats) < 0)
+        goto cleanup;
+
+    if (stats.fetched != (QEMU_MONITOR_STATS_BLOCK |
+                          QEMU_MONITOR_STATS_BALLOON)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Unexpected statistics fetched %x", stats.fetched);
+        goto cleanup;
+    }
+
+    if (!(entry = virHashLookup(stats.blockstats, "virtio-disk0")) ||
+        entry->rd_bytes != 4096 || entry->rd_req != 8 ||
+        entry->wr_bytes != 512 || entry->wr_req != 1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "Unexpected statistics for virtio-disk0");
+        goto cleanup;
+    }
+
+    if (stats.balloon != 524288) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Unexpected balloon size %llu", stats.balloon);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    qemuMonitorStatsClear(&stats);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+
+static int
+testQemuMonitorJSONGetMigrationStatus(const void *data)
+{
+    virCapsPtr caps = (virCapsPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNew(true, caps);
+    int ret = -1;
+    qemuMonitorMigrationStatus status;
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-migrate",
+                               "{ "
+                               "  \"return\": { "
+                               "    \"status\": \"active\", "
+                               "    \"ram\": { "
+                               "      \"transferred\": 123, "
+                               "      \"remaining\": 456, "
+                               "      \"total\": 1024 "
+                               "    }, "
+                               "    \"xbzrle-cache\": { "
+                               "      \"cache-size\": 67108864, "
+                               "      \"bytes\": 4096, "
+                               "      \"pages\": 32, "
+                               "      \"cache-miss\": 8, "
+                               "      \"overflow\": 2 "
+                               "    } "
+                               "  } "
+                               "}") < 0)
+        goto cleanup;
+
+    if (qemuMonitorGetMigrationStatus(qemuMonitorTestGetMonitor(test),
+                                      &status) < 0)
+        goto cleanup;
+
+    if (status.status != QEMU_MONITOR_MIGRATION_STATUS_ACTIVE ||
+        status.transferred != 123 ||
+        status.remaining != 456 ||
+        status.total != 1024) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "Unexpected migration progress");
+        goto cleanup;
+    }
+
+    if (!status.xbzrle_set ||
+        status.xbzrle_cache_size != 67108864 ||
+        status.xbzrle_bytes != 4096 ||
+        status.xbzrle_pages != 32 ||
+        status.xbzrle_cache_miss != 8 ||
+        status.xbzrle_overflow != 2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "Unexpected XBZRLE statistics");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+
+static int
+testQemuMonitorJSONGetIOThreads(const void *data)
+{
+    virCapsPtr caps = (virCapsPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNew(true, caps);
+    int ret = -1;
+    int *pids = NULL;
+    int npids;
+
+    if (!test)
+        return -1;
+
+    /* QEMU does not have to report the iothreads in order */
+    if (qemuMonitorTestAddItem(test, "query-iothreads",
+                               "{ "
+                               "  \"return\": [ "
+                               "    { "
+                               "      \"id\": \"iothread2\", "
+                               "      \"thread-id\": 30993 "
+                               "    }, "
+                               "    { "
+                               "      \"id\": \"iothread1\", "
+                               "      \"thread-id\": 30992 "
+                               "    } "
+                               "  ] "
+                               "}") < 0)
+        goto cleanup;
+
+    if ((npids = qemuMonitorGetIOThreads(qemuMonitorTestGetMonitor(test),
+                                         &pids)) < 0)
+        goto cleanup;
+
+    if (npids != 2 || pids[0] != 30992 || pids[1] != 30993) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "Unexpected iothread pids");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(pids);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -446,6 +706,10 @@ mymain(void)
     DO_TEST(GetMachines);
     DO_TEST(GetCPUDefinitions);
     DO_TEST(GetCommands);
+    DO_TEST(GetAllBlockStatsInfo);
+    DO_TEST(GetStats);
+    DO_TEST(GetMigrationStatus);
+    DO_TEST(GetIOThreads);
 
     virCapabilitiesFree(caps);
 
@@ -494,6 +494,7 @@ qemuMonitorTestPtr qemuMonitorTestNew(bool json, virCapsPtr caps)
     if (!(test->mon = qemuMonitorOpen(test->vm,
                                       &src,
                                       json ? 1 : 0,
+                                      NULL,
                                       &qemuCallbacks)))
         goto error;
     qemuMonitorLock(test->mon);
@@ -293,10 +293,15 @@ mymain(void)
         return EXIT_FAILURE;
     if ((driver.stateDir = strdup("/nowhere")) == NULL)
         return EXIT_FAILURE;
-    if ((driver.hugetlbfs_mount = strdup("/dev/hugepages")) == NULL)
+    if (VIR_ALLOC_N(driver.hugetlbfs, 2) < 0)
         return EXIT_FAILURE;
-    if ((driver.hugepage_path = strdup("/dev/hugepages/libvirt/qemu")) == NULL)
+    driver.nhugetlbfs = 2;
+    if (!(driver.hugetlbfs[0].mnt_dir = strdup("/dev/hugepages")) ||
+        !(driver.hugetlbfs[1].mnt_dir = strdup("/dev/hugepages1G")))
         return EXIT_FAILURE;
+    driver.hugetlbfs[0].size = 2048;
+    driver.hugetlbfs[0].deflt = true;
+    driver.hugetlbfs[1].size = 1048576;
     driver.spiceTLS = 1;
     if (!(driver.spiceTLSx509certdir = strdup("/etc/pki/libvirt-spice")))
         return EXIT_FAILURE;
@@ -421,6 +426,10 @@ mymain(void)
     DO_TEST("hyperv", NONE);
 
     DO_TEST("hugepages", QEMU_CAPS_MEM_PATH);
+    DO_TEST("hugepages-numa", QEMU_CAPS_SMP_TOPOLOGY,
+            QEMU_CAPS_OBJECT_MEMORY_RAM, QEMU_CAPS_OBJECT_MEMORY_FILE);
+    DO_TEST_FAILURE("hugepages-numa", QEMU_CAPS_SMP_TOPOLOGY,
+                    QEMU_CAPS_OBJECT_MEMORY_RAM);
     DO_TEST("disk-cdrom", NONE);
     DO_TEST("disk-cdrom-empty", QEMU_CAPS_DRIVE);
     DO_TEST("disk-cdrom-tray",
@@ -822,6 +831,7 @@ mymain(void)
     DO_TEST("memtune", QEMU_CAPS_NAME);
     DO_TEST("blkiotune", QEMU_CAPS_NAME);
     DO_TEST("blkiotune-device", QEMU_CAPS_NAME);
+    DO_TEST("blkiotune-throttle", QEMU_CAPS_NAME);
     DO_TEST("cputune", QEMU_CAPS_NAME);
     DO_TEST("numatune-memory", NONE);
     DO_TEST("numad", NONE);
@@ -868,6 +878,16 @@ mymain(void)
     DO_TEST("disk-blockio",
             QEMU_CAPS_DRIVE, QEMU_CAPS_DEVICE, QEMU_CAPS_NODEFCONFIG,
             QEMU_CAPS_IDE_CD, QEMU_CAPS_BLOCKIO);
+    DO_TEST("disk-iothreads",
+            QEMU_CAPS_DRIVE, QEMU_CAPS_DEVICE, QEMU_CAPS_NODEFCONFIG,
+            QEMU_CAPS_VIRTIO_BLK_SCSI, QEMU_CAPS_OBJECT_IOTHREAD);
+    DO_TEST("disk-iothreads-data-plane",
+            QEMU_CAPS_DRIVE, QEMU_CAPS_DEVICE, QEMU_CAPS_NODEFCONFIG,
+            QEMU_CAPS_DRIVE_CACHE_V2, QEMU_CAPS_DRIVE_AIO,
+            QEMU_CAPS_DRIVE_FORMAT, QEMU_CAPS_VIRTIO_BLK_SCSI,
+            QEMU_CAPS_VIRTIO_BLK_DATA_PLANE);
+    DO_TEST_FAILURE("disk-iothreads", QEMU_CAPS_DRIVE, QEMU_CAPS_DEVICE,
+                    QEMU_CAPS_NODEFCONFIG, QEMU_CAPS_VIRTIO_BLK_SCSI);
 
     DO_TEST("video-device-pciaddr-default",
             QEMU_CAPS_KVM, QEMU_CAPS_VNC,
@@ -875,6 +895,7 @@ mymain(void)
             QEMU_CAPS_DEVICE_QXL, QEMU_CAPS_DEVICE_QXL_VGA);
 
     VIR_FREE(driver.stateDir);
+    virHugeTLBFSArrayFree(driver.hugetlbfs, driver.nhugetlbfs);
     virCapabilitiesFree(driver.caps);
     VIR_FREE(map);
 
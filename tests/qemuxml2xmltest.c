@@ -153,6 +153,7 @@ mymain(void)
     DO_TEST("hyperv");
 
     DO_TEST("hugepages");
+    DO_TEST("hugepages-numa");
     DO_TEST("disk-aio");
     DO_TEST("disk-cdrom");
     DO_TEST("disk-floppy");
@@ -223,7 +224,9 @@ mymain(void)
     DO_TEST_DIFFERENT("memtune");
     DO_TEST("blkiotune");
     DO_TEST("blkiotune-device");
+    DO_TEST("blkiotune-throttle");
     DO_TEST("cputune");
+    DO_TEST("disk-iothreads");
 
     DO_TEST("smp");
     DO_TEST("lease");
@@ -240,6 +243,7 @@ mymain(void)
     DO_TEST("numad-static-vcpu-no-numatune");
 
     DO_TEST("disk-scsi-disk-vpd");
+    DO_TEST("autostart-priority");
 
     /* These tests generate different XML */
     DO_TEST_DIFFERENT("balloon-device-auto");
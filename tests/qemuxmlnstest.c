@@ -205,10 +205,13 @@ mymain(void)
         return EXIT_FAILURE;
     if ((driver.stateDir = strdup("/nowhere")) == NULL)
         return EXIT_FAILURE;
-    if ((driver.hugetlbfs_mount = strdup("/dev/hugepages")) == NULL)
+    if (VIR_ALLOC_N(driver.hugetlbfs, 1) < 0)
         return EXIT_FAILURE;
-    if ((driver.hugepage_path = strdup("/dev/hugepages/libvirt/qemu")) == NULL)
+    driver.nhugetlbfs = 1;
+    if (!(driver.hugetlbfs[0].mnt_dir = strdup("/dev/hugepages")))
         return EXIT_FAILURE;
+    driver.hugetlbfs[0].size = 2048;
+    driver.hugetlbfs[0].deflt = true;
     driver.spiceTLS = 1;
     if (!(driver.spiceTLSx509certdir = strdup("/etc/pki/libvirt-spice")))
         return EXIT_FAILURE;
@@ -261,6 +264,7 @@ mymain(void)
     DO_TEST("qemu-ns-commandline-ns1", false, NONE);
 
     VIR_FREE(driver.stateDir);
+    virHugeTLBFSArrayFree(driver.hugetlbfs, driver.nhugetlbfs);
     virCapabilitiesFree(driver.caps);
     VIR_FREE(map);
 
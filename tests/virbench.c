@@ -0,0 +1,700 @@
+/*
+ * virbench.c: microbenchmarks for hot paths
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Unlike the other programs here this is not a test: it is not run
+ * by "make check", but by "make bench". Each benchmark repeats one
+ * operation for VIR_BENCH_TIME milliseconds (1000 by default) and
+ * prints one JSON object per line on stdout, e.g.
+ *
+ *   {"name": "hash-lookup", "iterations": 4194304, "ns_per_op": 61.2}
+ *
+ * so that results can be compared between builds by a script.
+ * VIR_BENCH_URI selects the connection used by the driver benchmark,
+ * which defaults to the in-process test driver; pointing it at a
+ * libvirtd makes it an end-to-end RPC benchmark.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "util.h"
+#include "virfile.h"
+#include "virhash.h"
+#include "virtime.h"
+#include "event_poll.h"
+#include "json.h"
+#include "memory.h"
+#include "virterror_internal.h"
+#include "rpc/virnetmessage.h"
+#ifdef WITH_REMOTE
+# include "remote/remote_protocol.h"
+#endif
+
+#ifdef WITH_QEMU
+# include "qemu/qemu_conf.h"
+# include "qemu/qemu_domain.h"
+# include "testutilsqemu.h"
+#endif
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define VIR_BENCH_TIME_DEFAULT 1000
+
+static unsigned long long benchTime = VIR_BENCH_TIME_DEFAULT;
+
+typedef struct _virBench virBench;
+struct _virBench {
+    const char *name;
+    int (*op)(void *opaque);    /* one operation, returns -1 on failure */
+    void *opaque;
+};
+
+/* Run @bench->op in batches of doubling size until benchTime has
+ * passed, then report the mean time per operation */
+static int
+benchRun(const void *opaque)
+{
+    const virBench *bench = opaque;
+    unsigned long long start;
+    unsigned long long now;
+    unsigned long long iterations = 0;
+    unsigned long long batch = 1;
+    unsigned long long i;
+
+    /* warm up caches and lazy initialization */
+    if (bench->op(bench->opaque) < 0)
+        return -1;
+
+    if (virTimeMillisNow(&start) < 0)
+        return -1;
+
+    do {
+        for (i = 0; i < batch; i++) {
+            if (bench->op(bench->opaque) < 0)
+                return -1;
+        }
+        iterations += batch;
+        if (batch < 1024 * 1024)
+            batch *= 2;
+
+        if (virTimeMillisNow(&now) < 0)
+            return -1;
+    } while (now - start < benchTime);
+
+    printf("{\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f}\n",
+           bench->name, iterations, (now - start) * 1e6 / iterations);
+    fflush(stdout);
+    return 0;
+}
+
+
+/*
+ * RPC message encoding
+ */
+static virNetMessageError benchError;
+
+static int
+benchMessageEncode(void *opaque)
+{
+    virNetMessagePtr msg = opaque;
+
+    virNetMessageClear(msg);
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_REPLY;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_ERROR;
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageError,
+                                   &benchError) < 0)
+        return -1;
+    return 0;
+}
+
+typedef struct _benchMessageData benchMessageData;
+struct _benchMessageData {
+    virNetMessagePtr msg;
+    char *buffer;
+};
+
+static int
+benchMessageDecode(void *opaque)
+{
+    benchMessageData *data = opaque;
+    virNetMessageError err;
+    int ret;
+
+    virNetMessageClear(data->msg);
+    data->msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+    if (virNetMessageReserveBuffer(data->msg, data->msg->bufferLength) < 0)
+        return -1;
+    memcpy(data->msg->buffer, data->buffer, data->msg->bufferLength);
+
+    /* this resizes the buffer to the length of the whole message */
+    if (virNetMessageDecodeLength(data->msg) < 0)
+        return -1;
+    memcpy(data->msg->buffer, data->buffer, data->msg->bufferLength);
+
+    if (virNetMessageDecodeHeader(data->msg) < 0)
+        return -1;
+
+    memset(&err, 0, sizeof(err));
+    ret = virNetMessageDecodePayload(data->msg,
+                                     (xdrproc_t)xdr_virNetMessageError, &err);
+    xdr_free((xdrproc_t)xdr_virNetMessageError, (void *)&err);
+    return ret;
+}
+
+static int
+benchMessages(void)
+{
+    int ret = 0;
+    benchMessageData data;
+    virNetMessagePtr msg = NULL;
+    char *message = (char *) "Hello World";
+    char *str1 = (char *) "One";
+    char *str2 = (char *) "Two";
+    char *str3 = (char *) "Three";
+    virBench encode = { "rpc-message-encode", benchMessageEncode, NULL };
+    virBench decode = { "rpc-message-decode", benchMessageDecode, &data };
+
+    memset(&data, 0, sizeof(data));
+    memset(&benchError, 0, sizeof(benchError));
+    benchError.code = VIR_ERR_INTERNAL_ERROR;
+    benchError.domain = VIR_FROM_RPC;
+    benchError.level = VIR_ERR_ERROR;
+    benchError.message = &message;
+    benchError.str1 = &str1;
+    benchError.str2 = &str2;
+    benchError.str3 = &str3;
+
+    if (!(msg = virNetMessageNew(true)) ||
+        !(data.msg = virNetMessageNew(true))) {
+        ret = -1;
+        goto cleanup;
+    }
+    encode.opaque = msg;
+
+    if (virtTestRun("rpc-message-encode", 1, benchRun, &encode) < 0)
+        ret = -1;
+
+    /* decode what the encoder produces */
+    if (benchMessageEncode(msg) < 0 ||
+        VIR_ALLOC_N(data.buffer, msg->bufferLength) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+    memcpy(data.buffer, msg->buffer, msg->bufferLength);
+
+    if (virtTestRun("rpc-message-decode", 1, benchRun, &decode) < 0)
+        ret = -1;
+
+cleanup:
+    VIR_FREE(data.buffer);
+    virNetMessageFree(data.msg);
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+#ifdef WITH_REMOTE
+/*
+ * Marshalling of fixed size replies: the routine generated from
+ * remote_protocol.x against the per field calls rpcgen emits
+ */
+static remote_domain_interface_stats_ret benchStats = {
+    123456789, 98765, 1, 2, 987654321, 12345, 3, 4
+};
+
+static bool_t
+benchStatsPerField(XDR *xdrs, remote_domain_interface_stats_ret *objp)
+{
+    return xdr_int64_t(xdrs, &objp->rx_bytes) &&
+        xdr_int64_t(xdrs, &objp->rx_packets) &&
+        xdr_int64_t(xdrs, &objp->rx_errs) &&
+        xdr_int64_t(xdrs, &objp->rx_drop) &&
+        xdr_int64_t(xdrs, &objp->tx_bytes) &&
+        xdr_int64_t(xdrs, &objp->tx_packets) &&
+        xdr_int64_t(xdrs, &objp->tx_errs) &&
+        xdr_int64_t(xdrs, &objp->tx_drop);
+}
+
+typedef struct _benchStatsData benchStatsData;
+struct _benchStatsData {
+    xdrproc_t filter;
+    char buffer[sizeof(benchStats) * 2];
+};
+
+static int
+benchStatsEncode(void *opaque)
+{
+    benchStatsData *data = opaque;
+    XDR xdr;
+    int ret;
+
+    xdrmem_create(&xdr, data->buffer, sizeof(data->buffer), XDR_ENCODE);
+    ret = (*data->filter)(&xdr, &benchStats) ? 0 : -1;
+    xdr_destroy(&xdr);
+    return ret;
+}
+
+static int
+benchStatsDecode(void *opaque)
+{
+    benchStatsData *data = opaque;
+    remote_domain_interface_stats_ret stats;
+    XDR xdr;
+    int ret;
+
+    xdrmem_create(&xdr, data->buffer, sizeof(data->buffer), XDR_DECODE);
+    ret = (*data->filter)(&xdr, &stats) ? 0 : -1;
+    xdr_destroy(&xdr);
+    return ret;
+}
+
+static int
+benchStatsMarshal(void)
+{
+    int ret = 0;
+    benchStatsData generated = {
+        (xdrproc_t)xdr_remote_domain_interface_stats_ret, { 0 }
+    };
+    benchStatsData perField = { (xdrproc_t)benchStatsPerField, { 0 } };
+    virBench benches[] = {
+        { "xdr-stats-encode", benchStatsEncode, &generated },
+        { "xdr-stats-decode", benchStatsDecode, &generated },
+        { "xdr-stats-encode-rpcgen", benchStatsEncode, &perField },
+        { "xdr-stats-decode-rpcgen", benchStatsDecode, &perField },
+    };
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(benches); i++) {
+        if (virtTestRun(benches[i].name, 1, benchRun, &benches[i]) < 0)
+            ret = -1;
+    }
+
+    return ret;
+}
+#endif /* WITH_REMOTE */
+
+
+/*
+ * Hash tables
+ */
+#define BENCH_HASH_KEYS 1000
+
+typedef struct _benchHashData benchHashData;
+struct _benchHashData {
+    virHashTablePtr table;
+    char *keys[BENCH_HASH_KEYS];
+    size_t next;
+};
+
+static int
+benchHashFill(void *opaque)
+{
+    benchHashData *data = opaque;
+    size_t i;
+
+    virHashRemoveAll(data->table);
+    for (i = 0; i < BENCH_HASH_KEYS; i++) {
+        if (virHashAddEntry(data->table, data->keys[i], data->keys[i]) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int
+benchHashLookup(void *opaque)
+{
+    benchHashData *data = opaque;
+    const char *key = data->keys[data->next++ % BENCH_HASH_KEYS];
+
+    return virHashLookup(data->table, key) ? 0 : -1;
+}
+
+static int
+benchHash(void)
+{
+    int ret = 0;
+    benchHashData data;
+    size_t i;
+    virBench fill = { "hash-fill-1000", benchHashFill, &data };
+    virBench lookup = { "hash-lookup", benchHashLookup, &data };
+
+    memset(&data, 0, sizeof(data));
+    if (!(data.table = virHashCreate(BENCH_HASH_KEYS, NULL)))
+        return -1;
+
+    for (i = 0; i < BENCH_HASH_KEYS; i++) {
+        if (virAsprintf(&data.keys[i], "key-%zu", i) < 0) {
+            virReportOOMError();
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    if (virtTestRun("hash-fill-1000", 1, benchRun, &fill) < 0)
+        ret = -1;
+
+    if (benchHashFill(&data) < 0 ||
+        virtTestRun("hash-lookup", 1, benchRun, &lookup) < 0)
+        ret = -1;
+
+cleanup:
+    virHashFree(data.table);
+    for (i = 0; i < BENCH_HASH_KEYS; i++)
+        VIR_FREE(data.keys[i]);
+    return ret;
+}
+
+
+/*
+ * Event loop dispatch: every operation makes all handles readable
+ * and runs the loop until each callback has fired once
+ */
+typedef struct _benchEventData benchEventData;
+struct _benchEventData {
+    size_t nhandles;
+    int (*fds)[2];
+    size_t fired;
+};
+
+static void
+benchEventCallback(int watch ATTRIBUTE_UNUSED,
+                   int fd,
+                   int events ATTRIBUTE_UNUSED,
+                   void *opaque)
+{
+    benchEventData *data = opaque;
+    char c;
+
+    if (saferead(fd, &c, 1) == 1)
+        data->fired++;
+}
+
+static int
+benchEventDispatch(void *opaque)
+{
+    benchEventData *data = opaque;
+    size_t i;
+
+    data->fired = 0;
+    for (i = 0; i < data->nhandles; i++) {
+        if (safewrite(data->fds[i][1], "", 1) != 1)
+            return -1;
+    }
+
+    while (data->fired < data->nhandles) {
+        if (virEventPollRunOnce() < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int
+benchEvents(size_t nhandles)
+{
+    int ret = -1;
+    benchEventData data;
+    int *watches = NULL;
+    char *name = NULL;
+    virBench bench = { NULL, benchEventDispatch, &data };
+    size_t i;
+
+    memset(&data, 0, sizeof(data));
+    if (VIR_ALLOC_N(data.fds, nhandles) < 0 ||
+        VIR_ALLOC_N(watches, nhandles) < 0 ||
+        virAsprintf(&name, "event-dispatch-%zu", nhandles) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (; data.nhandles < nhandles; data.nhandles++) {
+        if (pipe(data.fds[data.nhandles]) < 0)
+            goto cleanup;
+        if ((watches[data.nhandles] =
+             virEventPollAddHandle(data.fds[data.nhandles][0],
+                                   VIR_EVENT_HANDLE_READABLE,
+                                   benchEventCallback, &data, NULL)) < 0) {
+            VIR_FORCE_CLOSE(data.fds[data.nhandles][0]);
+            VIR_FORCE_CLOSE(data.fds[data.nhandles][1]);
+            goto cleanup;
+        }
+    }
+
+    bench.name = name;
+    ret = virtTestRun(name, 1, benchRun, &bench);
+
+cleanup:
+    /* the next run of the loop purges the removed handles */
+    for (i = 0; i < data.nhandles; i++) {
+        virEventPollRemoveHandle(watches[i]);
+        VIR_FORCE_CLOSE(data.fds[i][0]);
+        VIR_FORCE_CLOSE(data.fds[i][1]);
+    }
+    VIR_FREE(data.fds);
+    VIR_FREE(watches);
+    VIR_FREE(name);
+    return ret;
+}
+
+
+#if HAVE_YAJL
+/*
+ * JSON monitor reply parsing
+ */
+static const char benchJSONReply[] =
+    "{\"return\": [{\"device\": \"drive-virtio-disk0\", \"parent\": "
+    "{\"stats\": {\"flush_total_time_ns\": 0, \"wr_highest_offset\": 0, "
+    "\"wr_total_time_ns\": 0, \"wr_bytes\": 0, \"rd_total_time_ns\": 0, "
+    "\"flush_operations\": 0, \"wr_operations\": 0, \"rd_bytes\": 0, "
+    "\"rd_operations\": 0}}, \"stats\": {\"flush_total_time_ns\": "
+    "0, \"wr_highest_offset\": 5256018944, \"wr_total_time_ns\": "
+    "9870203412, \"wr_bytes\": 439728128, \"rd_total_time_ns\": "
+    "288742592, \"flush_operations\": 0, \"wr_operations\": 1340, "
+    "\"rd_bytes\": 9860096, \"rd_operations\": 1210}}, {\"device\": "
+    "\"drive-ide0-1-0\", \"stats\": {\"flush_total_time_ns\": 0, "
+    "\"wr_highest_offset\": 0, \"wr_total_time_ns\": 0, \"wr_bytes\": "
+    "0, \"rd_total_time_ns\": 4528, \"flush_operations\": 0, "
+    "\"wr_operations\": 0, \"rd_bytes\": 49, \"rd_operations\": 1}}], "
+    "\"id\": \"libvirt-11\"}";
+
+static int
+benchJSONParse(void *opaque ATTRIBUTE_UNUSED)
+{
+    virJSONValuePtr reply;
+
+    if (!(reply = virJSONValueFromString(benchJSONReply)))
+        return -1;
+    virJSONValueFree(reply);
+    return 0;
+}
+#endif /* HAVE_YAJL */
+
+
+#ifdef WITH_QEMU
+/*
+ * Domain XML parsing and formatting over the qemuxml2argvdata corpus;
+ * every operation handles the next document
+ */
+typedef struct _benchXMLData benchXMLData;
+struct _benchXMLData {
+    virCapsPtr caps;
+    char **docs;
+    size_t ndocs;
+    size_t next;
+};
+
+static int
+benchXMLParseFormat(void *opaque)
+{
+    benchXMLData *data = opaque;
+    const char *xml = data->docs[data->next++ % data->ndocs];
+    virDomainDefPtr def;
+    char *actual;
+
+    if (!(def = virDomainDefParseString(data->caps, xml,
+                                        QEMU_EXPECTED_VIRT_TYPES,
+                                        VIR_DOMAIN_XML_INACTIVE)))
+        return -1;
+
+    actual = virDomainDefFormat(def, VIR_DOMAIN_XML_SECURE);
+    virDomainDefFree(def);
+    if (!actual)
+        return -1;
+    VIR_FREE(actual);
+    return 0;
+}
+
+static int
+benchXML(void)
+{
+    int ret = -1;
+    benchXMLData data;
+    char *dirname = NULL;
+    char *path = NULL;
+    char *xml = NULL;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    virDomainDefPtr def;
+    size_t i;
+    virBench bench = { "domain-xml-parse-format", benchXMLParseFormat, &data };
+
+    memset(&data, 0, sizeof(data));
+    if (!(data.caps = testQemuCapsInit()))
+        goto cleanup;
+
+    if (virAsprintf(&dirname, "%s/qemuxml2argvdata", abs_srcdir) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    if (!(dir = opendir(dirname)))
+        goto cleanup;
+
+    /* keep the documents which parse with the test capabilities; the
+     * corpus also holds some which are meant to fail */
+    while ((ent = readdir(dir))) {
+        if (!virFileHasSuffix(ent->d_name, ".xml"))
+            continue;
+
+        if (virAsprintf(&path, "%s/%s", dirname, ent->d_name) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        if (virtTestLoadFile(path, &xml) < 0)
+            goto cleanup;
+        VIR_FREE(path);
+
+        if (!(def = virDomainDefParseString(data.caps, xml,
+                                            QEMU_EXPECTED_VIRT_TYPES,
+                                            VIR_DOMAIN_XML_INACTIVE))) {
+            virResetLastError();
+            VIR_FREE(xml);
+            continue;
+        }
+        virDomainDefFree(def);
+
+        if (VIR_APPEND_ELEMENT(data.docs, data.ndocs, xml) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+    }
+
+    if (data.ndocs == 0)
+        goto cleanup;
+
+    ret = virtTestRun("domain-xml-parse-format", 1, benchRun, &bench);
+
+cleanup:
+    if (dir)
+        closedir(dir);
+    for (i = 0; i < data.ndocs; i++)
+        VIR_FREE(data.docs[i]);
+    VIR_FREE(data.docs);
+    VIR_FREE(xml);
+    VIR_FREE(path);
+    VIR_FREE(dirname);
+    virCapabilitiesFree(data.caps);
+    return ret;
+}
+#endif /* WITH_QEMU */
+
+
+/*
+ * Driver calls: list all domains and get the info of each
+ */
+static int
+benchDriverListInfo(void *opaque)
+{
+    virConnectPtr conn = opaque;
+    virDomainPtr *doms = NULL;
+    virDomainInfo info;
+    int ndoms;
+    int ret = 0;
+    int i;
+
+    if ((ndoms = virConnectListAllDomains(conn, &doms, 0)) < 0)
+        return -1;
+
+    for (i = 0; i < ndoms; i++) {
+        if (virDomainGetInfo(doms[i], &info) < 0)
+            ret = -1;
+        virDomainFree(doms[i]);
+    }
+    VIR_FREE(doms);
+    return ret;
+}
+
+static int
+benchDriver(void)
+{
+    const char *uri = getenv("VIR_BENCH_URI");
+    virConnectPtr conn;
+    virBench bench = { "driver-list-info", benchDriverListInfo, NULL };
+    int ret;
+
+    if (!uri)
+        uri = "test:///default";
+
+    if (!(conn = virConnectOpenReadOnly(uri)))
+        return -1;
+    bench.opaque = conn;
+
+    ret = virtTestRun("driver-list-info", 1, benchRun, &bench);
+
+    virConnectClose(conn);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    const char *timestr = getenv("VIR_BENCH_TIME");
+
+    if (timestr &&
+        (virStrToLong_ull(timestr, NULL, 10, &benchTime) < 0 ||
+         benchTime == 0)) {
+        fprintf(stderr, "invalid VIR_BENCH_TIME '%s'\n", timestr);
+        return EXIT_FAILURE;
+    }
+
+    if (virEventPollInit() < 0)
+        return EXIT_FAILURE;
+
+    if (benchMessages() < 0)
+        ret = -1;
+#ifdef WITH_REMOTE
+    if (benchStatsMarshal() < 0)
+        ret = -1;
+#endif
+    if (benchHash() < 0)
+        ret = -1;
+    if (benchEvents(1) < 0 ||
+        benchEvents(64) < 0)
+        ret = -1;
+#if HAVE_YAJL
+    {
+        virBench bench = { "json-reply-parse", benchJSONParse, NULL };
+
+        if (virtTestRun("json-reply-parse", 1, benchRun, &bench) < 0)
+            ret = -1;
+    }
+#endif
+#ifdef WITH_QEMU
+    if (benchXML() < 0)
+        ret = -1;
+#endif
+    if (benchDriver() < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -382,6 +382,54 @@ error:
     return -1;
 }
 
+/* test set operations across word boundaries */
+static int test8(const void *v ATTRIBUTE_UNUSED)
+{
+    virBitmapPtr a = NULL;
+    virBitmapPtr b = NULL;
+    char *str = NULL;
+    int ret = -1;
+
+    if (virBitmapParse("0-70,100-130", 0, &a, 160) != 102 ||
+        virBitmapParse("60-110,^64", 0, &b, 128) != 50)
+        goto cleanup;
+
+    if (!virBitmapOverlaps(a, b) ||
+        virBitmapNextClearBit(a, -1) != 71 ||
+        virBitmapNextClearBit(a, 99) != 131)
+        goto cleanup;
+
+    virBitmapIntersect(a, b);
+    if (!(str = virBitmapFormat(a)) ||
+        STRNEQ(str, "60-63,65-70,100-110"))
+        goto cleanup;
+    VIR_FREE(str);
+
+    virBitmapSubtract(a, b);
+    if (virBitmapCountBits(a) != 0 || virBitmapOverlaps(a, b))
+        goto cleanup;
+
+    if (virBitmapUnion(a, b) < 0 ||
+        !virBitmapEqual(a, b))
+        goto cleanup;
+
+    ignore_value(virBitmapSetBit(a, 150));
+    if (virBitmapUnion(b, a) == 0)
+        goto cleanup;
+
+    virBitmapSetAll(b);
+    if (virBitmapNextClearBit(b, -1) != -1)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(str);
+    virBitmapFree(a);
+    virBitmapFree(b);
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -401,6 +449,8 @@ mymain(void)
         ret = -1;
     if (virtTestRun("test7", 1, test7, NULL) < 0)
         ret = -1;
+    if (virtTestRun("test8", 1, test8, NULL) < 0)
+        ret = -1;
 
 
     return ret;
@@ -195,6 +195,112 @@ cleanup:
     return ret;
 }
 
+static int testBufEscapeFormat(const void *data ATTRIBUTE_UNUSED)
+{
+    virBuffer bufinit = VIR_BUFFER_INITIALIZER;
+    virBufferPtr buf = &bufinit;
+    char *result = NULL;
+    const char *expected = \
+        "  <name>a&lt;b&gt;&amp;&quot;&apos;c</name>\n"
+        "  &amp;\n"
+        "  100% a&amp;b\n"
+        "  x\\'y\n"
+        "  <name>plain</name>\n";
+    int ret = -1;
+    int i;
+
+    virBufferAdjustIndent(buf, 2);
+    virBufferEscapeString(buf, "<name>%s</name>\n", "a<b>&\"'c");
+    virBufferEscapeString(buf, "%s\n", "&");
+    virBufferEscapeString(buf, "100%% %s\n", "a&b");
+    virBufferEscapeSexpr(buf, "%s\n", "x'y");
+    virBufferEscapeString(buf, "<name>%s</name>\n", "plain");
+
+    /* Many small escaped appends must not lose or corrupt data
+     * while the buffer is reallocated underneath them */
+    virBufferAdjustIndent(buf, -2);
+    for (i = 0; i < 10000; i++)
+        virBufferEscapeString(buf, "%s", "&");
+
+    if (virBufferError(buf)) {
+        TEST_ERROR("Buffer had error set");
+        goto cleanup;
+    }
+
+    result = virBufferContentAndReset(buf);
+    if (!result || strlen(result) != strlen(expected) + 10000 * 5 ||
+        STRNEQLEN(result, expected, strlen(expected))) {
+        virtTestDifference(stderr, expected, result);
+        goto cleanup;
+    }
+    for (i = 0; i < 10000; i++) {
+        if (STRNEQLEN(result + strlen(expected) + i * 5, "&amp;", 5)) {
+            TEST_ERROR("Corrupt escape at %d", i);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(buf);
+    VIR_FREE(result);
+    return ret;
+}
+
+static int testBufFormatFast(const void *data ATTRIBUTE_UNUSED)
+{
+    virBuffer bufinit = VIR_BUFFER_INITIALIZER;
+    virBufferPtr buf = &bufinit;
+    char *result = NULL;
+    const char *expected = \
+        "  <a>-2147483648</a>\n"
+        "  <b>18446744073709551615</b>\n"
+        "  <c>-9223372036854775808</c>\n"
+        "  <d>0</d>\n"
+        "  <e>4294967295</e>\n"
+        "  <f>-1</f>\n"
+        "  <g>12345</g>\n"
+        "  <h>text</h>\n"
+        "  <j>   7</j>\n"
+        "  50%\n"
+        "  a\001b&lt;\n";
+    int ret = -1;
+
+    virBufferAdjustIndent(buf, 2);
+    virBufferAsprintf(buf, "<a>%d</a>\n", INT_MIN);
+    virBufferAsprintf(buf, "<b>%llu</b>\n", ULLONG_MAX);
+    virBufferAsprintf(buf, "<c>%lld</c>\n", LLONG_MIN);
+    virBufferAsprintf(buf, "<d>%zu</d>\n", (size_t) 0);
+    virBufferAsprintf(buf, "<e>%u</e>\n", UINT_MAX);
+    virBufferAsprintf(buf, "<f>%ld</f>\n", -1L);
+    virBufferAsprintf(buf, "<g>%lu</g>\n", 12345UL);
+    virBufferAsprintf(buf, "<h>%s</h>\n", "text");
+    /* Not handled by the fast path, must still match vsnprintf */
+    virBufferAsprintf(buf, "<j>%4d</j>\n", 7);
+    virBufferAsprintf(buf, "%d%%\n", 50);
+    /* Control characters are only dropped when escaping */
+    virBufferAsprintf(buf, "%s", "a\001b");
+    virBufferEscapeString(buf, "%s\n", "\002<");
+
+    if (virBufferError(buf)) {
+        TEST_ERROR("Buffer had error set");
+        goto cleanup;
+    }
+
+    result = virBufferContentAndReset(buf);
+    if (!result || STRNEQ(result, expected)) {
+        virtTestDifference(stderr, expected, result);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(buf);
+    VIR_FREE(result);
+    return ret;
+}
 
 static int
 mymain(void)
@@ -213,6 +319,8 @@ mymain(void)
     DO_TEST("VSprintf infinite loop", testBufInfiniteLoop, 0);
     DO_TEST("Auto-indentation", testBufAutoIndent, 0);
     DO_TEST("Trim", testBufTrim, 0);
+    DO_TEST("Escape format", testBufEscapeFormat, 0);
+    DO_TEST("Format fast path", testBufFormatFast, 0);
 
     return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -12,6 +12,7 @@
 #include "memory.h"
 #include "util.h"
 #include "logging.h"
+#include "virtime.h"
 
 
 #define testError(...)                                          \
@@ -659,6 +660,71 @@ cleanup:
 }
 
 
+#define TEST_HASH_LARGE_COUNT 100000
+
+static int
+testHashLarge(const void *data ATTRIBUTE_UNUSED)
+{
+    virHashTablePtr hash;
+    char **keys = NULL;
+    unsigned long long start = 0, added = 0, looked = 0;
+    size_t i, nkeys = 0;
+    int ret = -1;
+
+    if (!(hash = virHashCreate(0, NULL)))
+        return -1;
+
+    if (VIR_ALLOC_N(keys, TEST_HASH_LARGE_COUNT) < 0)
+        goto cleanup;
+
+    for (nkeys = 0; nkeys < TEST_HASH_LARGE_COUNT; nkeys++) {
+        if (virAsprintf(&keys[nkeys], "%08zx-large-key", nkeys) < 0)
+            goto cleanup;
+    }
+
+    ignore_value(virTimeMillisNow(&start));
+    for (i = 0; i < nkeys; i++) {
+        if (virHashAddEntry(hash, keys[i], keys[i]) < 0) {
+            testError("\nfailed to add entry \"%s\"\n", keys[i]);
+            goto cleanup;
+        }
+    }
+    ignore_value(virTimeMillisNow(&added));
+
+    for (i = 0; i < nkeys; i++) {
+        if (virHashLookup(hash, keys[i]) != keys[i]) {
+            testError("\nentry \"%s\" could not be found\n", keys[i]);
+            goto cleanup;
+        }
+    }
+    ignore_value(virTimeMillisNow(&looked));
+
+    if (testHashCheckCount(hash, nkeys) < 0)
+        goto cleanup;
+
+    /* the table used to stop growing at 16384 buckets */
+    if (virHashTableSize(hash) <= 8 * 2048) {
+        testError("\nhash did not grow past %d buckets\n", 8 * 2048);
+        goto cleanup;
+    }
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%zu entries in %zd buckets: "
+                "add %llu ms, lookup %llu ms\n",
+                nkeys, virHashTableSize(hash),
+                added - start, looked - added);
+
+    ret = 0;
+
+cleanup:
+    virHashFree(hash);
+    for (i = 0; i < nkeys; i++)
+        VIR_FREE(keys[i]);
+    VIR_FREE(keys);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -686,6 +752,7 @@ mymain(void)
     DO_TEST_COUNT("Grow", Grow, 1);
     DO_TEST_COUNT("Grow", Grow, 10);
     DO_TEST_COUNT("Grow", Grow, 42);
+    DO_TEST("Grow large", Large);
     DO_TEST("Update", Update);
     DO_TEST("Remove", Remove);
     DO_TEST_DATA("Remove in ForEach", RemoveForEach, Some);
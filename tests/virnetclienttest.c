@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "testutils.h"
+#include "util.h"
+#include "virterror_internal.h"
+#include "memory.h"
+#include "logging.h"
+#include "threads.h"
+#include "virfile.h"
+#include "virtime.h"
+
+#include "rpc/virnetclient.h"
+#include "rpc/virnetsocket.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+#ifdef WIN32
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#else
+
+# define TEST_PROGRAM 0x11223344
+# define TEST_VERSION 1
+# define TEST_TIMEOUT_MS (10 * 1000)
+
+static virThread loopThread;
+static int loopThreadID = -1;
+static bool loopQuit;
+
+
+/* Wakes the event loop up regularly so that it notices loopQuit */
+static void testLoopTick(int timer ATTRIBUTE_UNUSED,
+                         void *opaque ATTRIBUTE_UNUSED)
+{
+}
+
+static void testLoopRun(void *opaque ATTRIBUTE_UNUSED)
+{
+    loopThreadID = virThreadSelfID();
+    while (!loopQuit)
+        virEventRunDefaultImpl();
+}
+
+
+struct testServerData {
+    int fd;
+    size_t ncalls;
+};
+
+/*
+ * Reads @ncalls calls, then replies to all of them in the
+ * order they were received, so that the replies to the first
+ * ones reach the client while it waits for the last one.
+ */
+static void testServerRun(void *opaque)
+{
+    struct testServerData *data = opaque;
+    virNetMessageHeader headers[2];
+    size_t i;
+
+    for (i = 0 ; i < data->ncalls ; i++) {
+        virNetMessage msg;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+        if (virNetMessageReserveBuffer(&msg, msg.bufferLength) < 0 ||
+            saferead(data->fd, msg.buffer, msg.bufferLength) != msg.bufferLength ||
+            virNetMessageDecodeLength(&msg) < 0 ||
+            saferead(data->fd, msg.buffer + VIR_NET_MESSAGE_LEN_MAX,
+                     msg.bufferLength - VIR_NET_MESSAGE_LEN_MAX) !=
+            msg.bufferLength - VIR_NET_MESSAGE_LEN_MAX ||
+            virNetMessageDecodeHeader(&msg) < 0) {
+            virNetMessageClear(&msg);
+            return;
+        }
+        headers[i] = msg.header;
+        virNetMessageClear(&msg);
+    }
+
+    for (i = 0 ; i < data->ncalls ; i++) {
+        virNetMessagePtr msg;
+
+        if (!(msg = virNetMessageNew(false)))
+            return;
+        msg->header = headers[i];
+        msg->header.type = VIR_NET_REPLY;
+        msg->header.status = VIR_NET_OK;
+        if (virNetMessageEncodeHeader(msg) < 0 ||
+            virNetMessageEncodePayloadEmpty(msg) < 0 ||
+            safewrite(data->fd, msg->buffer, msg->bufferLength) != msg->bufferLength) {
+            virNetMessageFree(msg);
+            return;
+        }
+        virNetMessageFree(msg);
+    }
+}
+
+
+struct testAsyncData {
+    virMutex lock;
+    virCond cond;
+    bool done;
+    int status;
+    int threadID;
+};
+
+static void testAsyncReply(virNetClientPtr client ATTRIBUTE_UNUSED,
+                           int status,
+                           virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                           void *opaque)
+{
+    struct testAsyncData *data = opaque;
+
+    virMutexLock(&data->lock);
+    data->done = true;
+    data->status = status;
+    data->threadID = virThreadSelfID();
+    virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+static virNetMessagePtr testCallNew(unsigned int serial)
+{
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetMessageNew(false)))
+        return NULL;
+
+    msg->header.prog = TEST_PROGRAM;
+    msg->header.vers = TEST_VERSION;
+    msg->header.proc = 1;
+    msg->header.type = VIR_NET_CALL;
+    msg->header.serial = serial;
+    msg->header.status = VIR_NET_OK;
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayloadEmpty(msg) < 0) {
+        virNetMessageFree(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+
+/*
+ * The callback of an asynchronous call must only ever run from
+ * the event loop: not from virNetClientSendWithReplyAsync, even
+ * if the reply is already in, and not from a synchronous call
+ * that happens to read the reply.
+ */
+static int testAsyncCall(const void *opaque)
+{
+    bool withSyncCall = *(const bool *)opaque;
+    virNetSocketPtr lsock = NULL;
+    virNetSocketPtr ssock = NULL;
+    virNetClientPtr client = NULL;
+    virNetMessagePtr msg = NULL;
+    virThread serverThread;
+    bool haveServer = false;
+    bool sent = false;
+    struct testServerData server;
+    struct testAsyncData async;
+    unsigned long long then;
+    int ret = -1;
+    char *path = NULL;
+    char *tmpdir;
+    char template[] = "/tmp/libvirt_XXXXXX";
+
+    memset(&async, 0, sizeof(async));
+    if (virMutexInit(&async.lock) < 0 ||
+        virCondInit(&async.cond) < 0)
+        return -1;
+
+    tmpdir = mkdtemp(template);
+    if (tmpdir == NULL) {
+        VIR_WARN("Failed to create temporary directory");
+        goto cleanup;
+    }
+    if (virAsprintf(&path, "%s/test.sock", tmpdir) < 0)
+        goto cleanup;
+
+    if (virNetSocketNewListenUNIX(path, 0700, -1, getgid(), &lsock) < 0 ||
+        virNetSocketListen(lsock, 0) < 0)
+        goto cleanup;
+
+    if (!(client = virNetClientNewUNIX(path, false, NULL)) ||
+        virNetClientRegisterAsyncIO(client) < 0)
+        goto cleanup;
+
+    if (virNetSocketAccept(lsock, &ssock) < 0 || !ssock)
+        goto cleanup;
+
+    server.fd = virNetSocketGetFD(ssock);
+    server.ncalls = withSyncCall ? 2 : 1;
+    if (virSetBlocking(server.fd, true) < 0 ||
+        virThreadCreate(&serverThread, true, testServerRun, &server) < 0)
+        goto cleanup;
+    haveServer = true;
+
+    if (!(msg = testCallNew(1)))
+        goto cleanup;
+
+    if (virNetClientSendWithReplyAsync(client, msg, testAsyncReply, &async) < 0)
+        goto cleanup;
+    sent = true;
+
+    virMutexLock(&async.lock);
+    if (async.done && async.threadID == virThreadSelfID()) {
+        virMutexUnlock(&async.lock);
+        if (virTestGetVerbose())
+            fprintf(stderr, "callback ran from the calling thread\n");
+        goto cleanup;
+    }
+    virMutexUnlock(&async.lock);
+
+    if (withSyncCall) {
+        if (!(msg = testCallNew(2)))
+            goto cleanup;
+        if (virNetClientSendWithReply(client, msg) < 0) {
+            virNetMessageFree(msg);
+            goto cleanup;
+        }
+        virNetMessageFree(msg);
+    }
+
+    if (virTimeMillisNow(&then) < 0)
+        goto cleanup;
+    then += TEST_TIMEOUT_MS;
+
+    virMutexLock(&async.lock);
+    while (!async.done) {
+        if (virCondWaitUntil(&async.cond, &async.lock, then) < 0) {
+            virMutexUnlock(&async.lock);
+            if (virTestGetVerbose())
+                fprintf(stderr, "callback never ran\n");
+            goto cleanup;
+        }
+    }
+    virMutexUnlock(&async.lock);
+
+    if (async.status != 0) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "call failed\n");
+        goto cleanup;
+    }
+
+    if (async.threadID != loopThreadID) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "callback ran from thread %d, not the event loop %d\n",
+                    async.threadID, loopThreadID);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (client)
+        virNetClientClose(client);
+    /* Closing the client fails the call if it is still
+     * pending, and @async must outlive its callback */
+    if (sent) {
+        virMutexLock(&async.lock);
+        while (!async.done)
+            ignore_value(virCondWait(&async.cond, &async.lock));
+        virMutexUnlock(&async.lock);
+    }
+    if (haveServer)
+        virThreadJoin(&serverThread);
+    virObjectUnref(client);
+    virObjectUnref(ssock);
+    virObjectUnref(lsock);
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    if (tmpdir)
+        rmdir(tmpdir);
+    ignore_value(virCondDestroy(&async.cond));
+    virMutexDestroy(&async.lock);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    int timer;
+    bool withSyncCall;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (virEventRegisterDefaultImpl() < 0)
+        return EXIT_FAILURE;
+
+    if ((timer = virEventAddTimeout(100, testLoopTick, NULL, NULL)) < 0)
+        return EXIT_FAILURE;
+
+    if (virThreadCreate(&loopThread, true, testLoopRun, NULL) < 0)
+        return EXIT_FAILURE;
+
+    while (loopThreadID == -1)
+        usleep(1000);
+
+    withSyncCall = false;
+    if (virtTestRun("Async call", 1, testAsyncCall, &withSyncCall) < 0)
+        ret = -1;
+
+    withSyncCall = true;
+    if (virtTestRun("Async call completed by a sync call", 1,
+                    testAsyncCall, &withSyncCall) < 0)
+        ret = -1;
+
+    loopQuit = true;
+    virThreadJoin(&loopThread);
+    virEventRemoveTimeout(timer);
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#endif
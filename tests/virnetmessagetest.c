@@ -47,7 +47,7 @@ static int testMessageHeaderEncode(const void *args ATTRIBUTE_UNUSED)
     };
     /* According to doc to virNetMessageEncodeHeader(&msg):
      * msg->buffer will be this long */
-    unsigned long msg_buf_size = VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX;
+    unsigned long msg_buf_size = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
     int ret = -1;
 
     if (!msg) {
@@ -108,10 +108,8 @@ static int testMessageHeaderDecode(const void *args ATTRIBUTE_UNUSED)
     }
 
     msg->bufferLength = 4;
-    if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0) {
-        virReportOOMError();
+    if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
         goto cleanup;
-    }
     memcpy(msg->buffer, input_buf, msg->bufferLength);
 
     msg->header.prog = 0x11223344;
@@ -340,10 +338,8 @@ static int testMessagePayloadDecode(const void *args ATTRIBUTE_UNUSED)
     int ret = -1;
 
     msg->bufferLength = 4;
-    if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0) {
-        virReportOOMError();
+    if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
         goto cleanup;
-    }
     memcpy(msg->buffer, input_buffer, msg->bufferLength);
     memset(&err, 0, sizeof(err));
 
@@ -526,6 +522,165 @@ cleanup:
     return ret;
 }
 
+static int testMessagePayloadLargeEncode(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessageError err;
+    virNetMessageError decoded;
+    virNetMessagePtr msg = virNetMessageNew(true);
+    char *message = NULL;
+    int ret = -1;
+
+    memset(&err, 0, sizeof(err));
+    memset(&decoded, 0, sizeof(decoded));
+
+    if (!msg) {
+        virReportOOMError();
+        return -1;
+    }
+
+    /* Several times the initial buffer, so encoding has to grow it */
+    if (VIR_ALLOC_N(message, VIR_NET_MESSAGE_INITIAL * 3) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    memset(message, 'x', (VIR_NET_MESSAGE_INITIAL * 3) - 1);
+
+    err.code = VIR_ERR_INTERNAL_ERROR;
+    err.domain = VIR_FROM_RPC;
+    err.level = VIR_ERR_ERROR;
+    err.message = &message;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_MESSAGE;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_ERROR;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &err) < 0)
+        goto cleanup;
+
+    if (msg->bufferLength <= VIR_NET_MESSAGE_INITIAL * 3) {
+        VIR_DEBUG("Expect message length over %d got %zu",
+                  VIR_NET_MESSAGE_INITIAL * 3, msg->bufferLength);
+        goto cleanup;
+    }
+
+    if (msg->bufferAlloc < msg->bufferLength) {
+        VIR_DEBUG("Expect buffer of at least %zu got %zu",
+                  msg->bufferLength, msg->bufferAlloc);
+        goto cleanup;
+    }
+
+    if (virNetMessageDecodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &decoded) < 0)
+        goto cleanup;
+
+    if (decoded.message == NULL ||
+        STRNEQ(*decoded.message, message)) {
+        VIR_DEBUG("Large message did not survive encoding");
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    xdr_free((xdrproc_t)xdr_virNetMessageError, (void*)&decoded);
+    VIR_FREE(message);
+    virNetMessageFree(msg);
+    return ret;
+}
+
+#if HAVE_ZLIB
+static int testMessagePayloadCompress(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessageError err;
+    virNetMessageError decoded;
+    virNetMessagePtr msg = virNetMessageNew(true);
+    char *message = NULL;
+    size_t plainLength;
+    int ret = -1;
+
+    memset(&err, 0, sizeof(err));
+    memset(&decoded, 0, sizeof(decoded));
+
+    if (!msg) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (VIR_ALLOC_N(message, VIR_NET_MESSAGE_COMPRESS_MIN * 4) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    memset(message, 'x', (VIR_NET_MESSAGE_COMPRESS_MIN * 4) - 1);
+
+    err.code = VIR_ERR_INTERNAL_ERROR;
+    err.domain = VIR_FROM_RPC;
+    err.level = VIR_ERR_ERROR;
+    err.message = &message;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_MESSAGE;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_ERROR;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &err) < 0)
+        goto cleanup;
+
+    plainLength = msg->bufferLength;
+
+    if (virNetMessageCompress(msg, VIR_NET_MESSAGE_COMPRESS_MIN) < 0)
+        goto cleanup;
+
+    if (msg->bufferLength >= plainLength) {
+        VIR_DEBUG("Expect message shorter than %zu got %zu",
+                  plainLength, msg->bufferLength);
+        goto cleanup;
+    }
+
+    if (virNetMessageDecodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (msg->header.type != VIR_NET_MESSAGE) {
+        VIR_DEBUG("Expect type %d got %d",
+                  VIR_NET_MESSAGE, msg->header.type);
+        goto cleanup;
+    }
+
+    if (msg->bufferLength != plainLength) {
+        VIR_DEBUG("Expect message length %zu got %zu",
+                  plainLength, msg->bufferLength);
+        goto cleanup;
+    }
+
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &decoded) < 0)
+        goto cleanup;
+
+    if (decoded.message == NULL ||
+        STRNEQ(*decoded.message, message)) {
+        VIR_DEBUG("Message did not survive compression");
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    xdr_free((xdrproc_t)xdr_virNetMessageError, (void*)&decoded);
+    VIR_FREE(message);
+    virNetMessageFree(msg);
+    return ret;
+}
+#endif /* HAVE_ZLIB */
+
 
 static int
 mymain(void)
@@ -549,6 +704,14 @@ mymain(void)
     if (virtTestRun("Message Payload Stream Encode", 1, testMessagePayloadStreamEncode, NULL) < 0)
         ret = -1;
 
+    if (virtTestRun("Message Payload Large Encode", 1, testMessagePayloadLargeEncode, NULL) < 0)
+        ret = -1;
+
+#if HAVE_ZLIB
+    if (virtTestRun("Message Payload Compress", 1, testMessagePayloadCompress, NULL) < 0)
+        ret = -1;
+#endif
+
     return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
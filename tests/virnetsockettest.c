@@ -35,6 +35,7 @@
 #include "virfile.h"
 
 #include "rpc/virnetsocket.h"
+#include "rpc/virnetshmring.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
@@ -451,6 +452,75 @@ cleanup:
 #endif
 
 
+#ifdef HAVE_SYS_EVENTFD_H
+static int testSocketShmRing(const void *data ATTRIBUTE_UNUSED)
+{
+    virNetShmRingPtr cring = NULL;
+    virNetShmRingPtr sring = NULL;
+    int fds[VIR_NET_SHM_RING_FD_LAST];
+    char wbuf[3000];
+    char rbuf[sizeof(wbuf)];
+    size_t i;
+    int ret = -1;
+
+    for (i = 0 ; i < sizeof(wbuf) ; i++)
+        wbuf[i] = i % 251;
+
+    if (!(cring = virNetShmRingNewClient(VIR_NET_SHM_RING_SIZE_MIN)))
+        goto cleanup;
+
+    virNetShmRingGetFDs(cring, fds);
+    for (i = 0 ; i < VIR_NET_SHM_RING_FD_LAST ; i++) {
+        if ((fds[i] = dup(fds[i])) < 0)
+            goto cleanup;
+    }
+
+    if (!(sring = virNetShmRingNewServer(fds, VIR_NET_SHM_RING_FD_LAST,
+                                         VIR_NET_SHM_RING_SIZE_MIN)))
+        goto cleanup;
+
+    if (virNetShmRingRead(sring, rbuf, sizeof(rbuf)) != 0) {
+        VIR_DEBUG("Unexpected data in a new ring");
+        goto cleanup;
+    }
+
+    /* The second round wraps around the end of the ring */
+    for (i = 0 ; i < 2 ; i++) {
+        memset(rbuf, 0, sizeof(rbuf));
+        if (virNetShmRingWrite(cring, wbuf, sizeof(wbuf)) != sizeof(wbuf) ||
+            !virNetShmRingHasData(sring) ||
+            virNetShmRingRead(sring, rbuf, sizeof(rbuf)) != sizeof(rbuf) ||
+            memcmp(wbuf, rbuf, sizeof(wbuf)) != 0) {
+            VIR_DEBUG("Client to server round %zu failed", i);
+            goto cleanup;
+        }
+    }
+
+    /* A full ring only takes what fits */
+    if (virNetShmRingWrite(sring, wbuf, sizeof(wbuf)) != sizeof(wbuf) ||
+        virNetShmRingWrite(sring, wbuf, sizeof(wbuf)) !=
+        VIR_NET_SHM_RING_SIZE_MIN - sizeof(wbuf) ||
+        virNetShmRingWrite(sring, wbuf, sizeof(wbuf)) != 0) {
+        VIR_DEBUG("Unexpected amount written to a full ring");
+        goto cleanup;
+    }
+
+    if (virNetShmRingRead(cring, rbuf, sizeof(rbuf)) != sizeof(rbuf) ||
+        memcmp(wbuf, rbuf, sizeof(wbuf)) != 0) {
+        VIR_DEBUG("Server to client read failed");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virObjectUnref(cring);
+    virObjectUnref(sring);
+    return ret;
+}
+#endif
+
+
 static int
 mymain(void)
 {
@@ -607,6 +677,11 @@ mymain(void)
 
 #endif
 
+#ifdef HAVE_SYS_EVENTFD_H
+    if (virtTestRun("Socket Shared Memory Ring", 1, testSocketShmRing, NULL) < 0)
+        ret = -1;
+#endif
+
     return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
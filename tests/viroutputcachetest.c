@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+#include "util.h"
+#include "memory.h"
+#include "virterror_internal.h"
+#include "viroutputcache.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+struct testFillData {
+    int calls;
+    bool fail;
+};
+
+static char *
+testFill(const char *key, void *opaque)
+{
+    struct testFillData *data = opaque;
+    char *output;
+
+    data->calls++;
+    if (data->fail) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", "fill failed");
+        return NULL;
+    }
+
+    if (virAsprintf(&output, "%s %d", key, data->calls) < 0)
+        return NULL;
+    return output;
+}
+
+static int
+testGet(virOutputCachePtr cache, const char *key,
+        struct testFillData *data, const char *expect)
+{
+    char *output = virOutputCacheGet(cache, key, testFill, data);
+    int ret = -1;
+
+    if (!expect) {
+        if (output) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "expected failure, got '%s'\n", output);
+            goto cleanup;
+        }
+        virResetLastError();
+    } else if (!output || STRNEQ(output, expect)) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "expected '%s', got '%s'\n",
+                    expect, NULLSTR(output));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(output);
+    return ret;
+}
+
+static int
+testCached(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virOutputCachePtr cache;
+    struct testFillData data = { 0, false };
+    int ret = -1;
+
+    /* Long enough to never expire while the test runs */
+    if (!(cache = virOutputCacheNew(3600 * 1000)))
+        return -1;
+
+    if (testGet(cache, "list", &data, "list 1") < 0 ||
+        testGet(cache, "list", &data, "list 1") < 0 ||
+        testGet(cache, "state", &data, "state 2") < 0 ||
+        testGet(cache, "list", &data, "list 1") < 0)
+        goto cleanup;
+
+    virOutputCacheInvalidate(cache);
+
+    if (testGet(cache, "list", &data, "list 3") < 0 ||
+        testGet(cache, "state", &data, "state 4") < 0 ||
+        testGet(cache, "list", &data, "list 3") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virOutputCacheFree(cache);
+    return ret;
+}
+
+static int
+testUncached(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virOutputCachePtr cache;
+    struct testFillData data = { 0, false };
+    int ret = -1;
+
+    if (!(cache = virOutputCacheNew(0)))
+        return -1;
+
+    if (testGet(cache, "list", &data, "list 1") < 0 ||
+        testGet(cache, "list", &data, "list 2") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virOutputCacheFree(cache);
+    return ret;
+}
+
+static int
+testFailure(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virOutputCachePtr cache;
+    struct testFillData data = { 0, true };
+    int ret = -1;
+
+    if (!(cache = virOutputCacheNew(3600 * 1000)))
+        return -1;
+
+    if (testGet(cache, "list", &data, NULL) < 0)
+        goto cleanup;
+
+    /* Failures must not be remembered */
+    data.fail = false;
+    if (testGet(cache, "list", &data, "list 2") < 0 ||
+        testGet(cache, "list", &data, "list 2") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virOutputCacheFree(cache);
+    return ret;
+}
+
+static int
+testCommand(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virOutputCachePtr cache;
+    virCommandPtr cmd = NULL;
+    char *output = NULL;
+    int ret = -1;
+
+    if (!(cache = virOutputCacheNew(3600 * 1000)))
+        return -1;
+
+    cmd = virCommandNewArgList("/bin/echo", "hello", NULL);
+    if (!(output = virOutputCacheRunCommand(cache, cmd)) ||
+        STRNEQ(output, "hello\n"))
+        goto cleanup;
+    VIR_FREE(output);
+    virCommandFree(cmd);
+
+    /* The same command line is answered from the cache, even though
+     * this command could not be run */
+    cmd = virCommandNewArgList("/bin/echo", "hello", NULL);
+    virCommandSetWorkingDirectory(cmd, "/nonexistent");
+    if (!(output = virOutputCacheRunCommand(cache, cmd)) ||
+        STRNEQ(output, "hello\n"))
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(output);
+    virCommandFree(cmd);
+    virOutputCacheFree(cache);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Cached", 1, testCached, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Uncached", 1, testUncached, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Failure", 1, testFailure, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Command", 1, testCommand, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+#include "util.h"
+#include "virstatfile.h"
+
+struct testScanData {
+    const char *buf;
+    unsigned int skip;
+    const char *keys[4];
+    unsigned long long values[4];   /* expected, or ~0 if not found */
+    int nfound;
+};
+
+static int
+testScan(const void *opaque)
+{
+    const struct testScanData *data = opaque;
+    virStatFileField fields[4];
+    size_t nfields = 0;
+    size_t i;
+    int nfound;
+
+    memset(fields, 0, sizeof(fields));
+    while (nfields < ARRAY_CARDINALITY(fields) && data->keys[nfields]) {
+        fields[nfields].key = data->keys[nfields];
+        nfields++;
+    }
+
+    nfound = virStatFileScan(data->buf, data->skip, fields, nfields);
+    if (nfound != data->nfound) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "expected %d fields, found %d\n",
+                    data->nfound, nfound);
+        return -1;
+    }
+    if (nfound < 0)
+        return 0;
+
+    for (i = 0; i < nfields; i++) {
+        bool found = data->values[i] != ~0ULL;
+
+        if (fields[i].found != found ||
+            (found && fields[i].value != data->values[i])) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "wrong value %llu for '%s', expected %llu\n",
+                        fields[i].value, fields[i].key, data->values[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST(name, ...)                                              \
+    do {                                                                \
+        static const struct testScanData data = { __VA_ARGS__ };        \
+        if (virtTestRun("Scan " name, 1, testScan, &data) < 0)          \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("meminfo",
+            "MemTotal:        8063428 kB\n"
+            "MemFree:          611252 kB\n"
+            "Buffers:          274420 kB\n"
+            "Cached:          3772868 kB\n"
+            "SwapCached:        34196 kB\n",
+            0, { "MemTotal", "MemFree", "Cached", "Mlocked" },
+            { 8063428, 611252, 3772868, ~0ULL }, 3);
+
+    DO_TEST("node meminfo",
+            "Node 1 MemTotal:        4194304 kB\n"
+            "Node 1 MemFree:         1048576 kB\n"
+            "Node 1 HugePages_Total:     0\n",
+            2, { "MemTotal", "MemFree", "HugePages_Total", NULL },
+            { 4194304, 1048576, 0 }, 3);
+
+    DO_TEST("memory.stat",
+            "cache 1003520\n"
+            "rss 4096\n"
+            "mapped_file 0\n"
+            "total_cache 1003520",
+            0, { "cache", "rss", "total_rss", NULL },
+            { 1003520, 4096, ~0ULL }, 2);
+
+    DO_TEST("cpuacct.stat",
+            "user 91\nsystem 7\n",
+            0, { "user", "system", NULL },
+            { 91, 7 }, 2);
+
+    DO_TEST("blkio",
+            "8:0 Read 4096\n"
+            "8:0 Write 512\n"
+            "8:16 Read 1024\n"
+            "8:16 Write 0\n"
+            "Total 5632\n",
+            1, { "Read", "Write", NULL },
+            { 5120, 512 }, 2);
+
+    DO_TEST("garbage",
+            "\n  \nfoo\nMemFree: lots kB\n",
+            0, { "MemFree", NULL },
+            { ~0ULL }, -1);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+#include "threadpool.h"
+#include "threads.h"
+#include "buf.h"
+#include "memory.h"
+
+struct testPoolState {
+    virMutex lock;
+    virCond cond;
+    bool started;
+    bool released;
+    size_t ndone;
+    virBuffer order;
+};
+
+static void
+testPoolJob(void *jobdata, void *opaque)
+{
+    struct testPoolState *state = opaque;
+    const char *name = jobdata;
+
+    virMutexLock(&state->lock);
+
+    /* the first job holds up the only worker until all others are queued */
+    if (STREQ(name, "gate")) {
+        state->started = true;
+        virCondBroadcast(&state->cond);
+        while (!state->released)
+            ignore_value(virCondWait(&state->cond, &state->lock));
+    }
+
+    virBufferAsprintf(&state->order, "%s%s", state->ndone ? "," : "", name);
+    state->ndone++;
+    virCondBroadcast(&state->cond);
+    virMutexUnlock(&state->lock);
+}
+
+static int
+testPoolFairness(const void *data ATTRIBUTE_UNUSED)
+{
+    struct testPoolState state;
+    virThreadPoolPtr pool = NULL;
+    virThreadPoolStats stats;
+    const char *expect = "gate,a1,b1,c1,a2,a3";
+    static const char a[] = "a", b[] = "b", c[] = "c";
+    char *order = NULL;
+    int ret = -1;
+
+    memset(&state, 0, sizeof(state));
+    if (virMutexInit(&state.lock) < 0 ||
+        virCondInit(&state.cond) < 0)
+        return -1;
+
+    if (!(pool = virThreadPoolNew(1, 1, 0, testPoolJob, &state)))
+        goto cleanup;
+
+    if (virThreadPoolSendGroupJob(pool, 0, a, (char *)"gate") < 0)
+        goto cleanup;
+
+    virMutexLock(&state.lock);
+    while (!state.started)
+        ignore_value(virCondWait(&state.cond, &state.lock));
+    virMutexUnlock(&state.lock);
+
+    if (virThreadPoolSendGroupJob(pool, 0, a, (char *)"a1") < 0 ||
+        virThreadPoolSendGroupJob(pool, 0, a, (char *)"a2") < 0 ||
+        virThreadPoolSendGroupJob(pool, 0, a, (char *)"a3") < 0 ||
+        virThreadPoolSendGroupJob(pool, 0, b, (char *)"b1") < 0 ||
+        virThreadPoolSendGroupJob(pool, 0, c, (char *)"c1") < 0)
+        goto cleanup;
+
+    virThreadPoolGetStats(pool, &stats);
+    if (stats.jobQueueDepth != 5 || stats.jobGroups != 3) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "expected 5 jobs in 3 groups, got %zu in %zu\n",
+                    stats.jobQueueDepth, stats.jobGroups);
+        goto cleanup;
+    }
+
+    virMutexLock(&state.lock);
+    state.released = true;
+    virCondBroadcast(&state.cond);
+    while (state.ndone < 6)
+        ignore_value(virCondWait(&state.cond, &state.lock));
+    virMutexUnlock(&state.lock);
+
+    if (virBufferError(&state.order))
+        goto cleanup;
+    order = virBufferContentAndReset(&state.order);
+
+    if (STRNEQ(order, expect)) {
+        virtTestDifference(stderr, expect, order);
+        goto cleanup;
+    }
+
+    virThreadPoolGetStats(pool, &stats);
+    if (stats.jobQueueDepth != 0 || stats.jobGroups != 0 ||
+        stats.jobsDone < 5) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "unexpected stats after completion\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virThreadPoolFree(pool);
+    virBufferFreeAndReset(&state.order);
+    VIR_FREE(order);
+    ignore_value(virCondDestroy(&state.cond));
+    virMutexDestroy(&state.lock);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Thread pool fairness", 1,
+                    testPoolFairness, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
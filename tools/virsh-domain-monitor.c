@@ -26,6 +26,7 @@
 #include <config.h>
 #include "virsh-domain-monitor.h"
 
+#include <fnmatch.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
@@ -34,7 +35,9 @@
 #include "internal.h"
 #include "conf/domain_conf.h"
 #include "intprops.h"
+#include "json.h"
 #include "memory.h"
+#include "threads.h"
 #include "virmacaddr.h"
 #include "virsh-domain.h"
 #include "xml.h"
@@ -1511,6 +1514,74 @@ cleanup:
     return list;
 }
 
+/* The virConnectListAllDomains filters virConnectGetAllDomainStats
+ * understands as well */
+#define VSH_DOMAIN_STATS_FILTERS                \
+    (VIR_CONNECT_LIST_DOMAINS_ACTIVE |          \
+     VIR_CONNECT_LIST_DOMAINS_INACTIVE |        \
+     VIR_CONNECT_LIST_DOMAINS_PERSISTENT |      \
+     VIR_CONNECT_LIST_DOMAINS_TRANSIENT |       \
+     VIR_CONNECT_LIST_DOMAINS_RUNNING |         \
+     VIR_CONNECT_LIST_DOMAINS_PAUSED |          \
+     VIR_CONNECT_LIST_DOMAINS_SHUTOFF |         \
+     VIR_CONNECT_LIST_DOMAINS_OTHER)
+
+static int
+vshDomainStatsSorter(const void *a, const void *b)
+{
+    virDomainStatsRecordPtr *ra = (virDomainStatsRecordPtr *) a;
+    virDomainStatsRecordPtr *rb = (virDomainStatsRecordPtr *) b;
+
+    return strcmp(virDomainGetName((*ra)->dom), virDomainGetName((*rb)->dom));
+}
+
+static int
+vshDomainStatsNameCompare(const void *key, const void *elem)
+{
+    virDomainStatsRecordPtr *record = (virDomainStatsRecordPtr *) elem;
+
+    return strcmp(key, virDomainGetName((*record)->dom));
+}
+
+/*
+ * Fetch the statistics groups @stats of all domains matching @flags
+ * in one call, sorted by domain name for vshDomainStatsLookup.
+ * Returns the number of records, or -1 if the server can't provide
+ * them, in which case the caller falls back to per domain calls.
+ */
+static int
+vshDomainStatsCollect(vshControl *ctl, unsigned int stats,
+                      unsigned int flags, virDomainStatsRecordPtr **records)
+{
+    int nrecords;
+
+    *records = NULL;
+    if ((nrecords = virConnectGetAllDomainStats(ctl->conn, stats, records,
+                                                flags &
+                                                VSH_DOMAIN_STATS_FILTERS)) < 0) {
+        vshResetLibvirtError();
+        return -1;
+    }
+
+    if (nrecords > 1)
+        qsort(*records, nrecords, sizeof(**records), vshDomainStatsSorter);
+    return nrecords;
+}
+
+static virDomainStatsRecordPtr
+vshDomainStatsLookup(virDomainStatsRecordPtr *records, int nrecords,
+                     const char *name)
+{
+    virDomainStatsRecordPtr *record;
+
+    if (nrecords <= 0)
+        return NULL;
+
+    record = bsearch(name, records, nrecords, sizeof(*records),
+                     vshDomainStatsNameCompare);
+    return record ? *record : NULL;
+}
+
 static const vshCmdOptDef opts_list[] = {
     {"inactive", VSH_OT_BOOL, 0, N_("list inactive domains")},
     {"all", VSH_OT_BOOL, 0, N_("list inactive & active domains")},
@@ -1561,6 +1632,10 @@ cmdList(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
     char id_buf[INT_BUFSIZE_BOUND(unsigned int)];
     unsigned int id;
     unsigned int flags = VIR_CONNECT_LIST_DOMAINS_ACTIVE;
+    virDomainStatsRecordPtr *records = NULL;
+    virDomainStatsRecordPtr record;
+    virTypedParameterPtr param;
+    int nrecords = -1;
 
     /* construct filter flags */
     if (vshCommandOptBool(cmd, "inactive"))
@@ -1600,6 +1675,12 @@ cmdList(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
     if (!(list = vshDomainListCollect(ctl, flags)))
         goto cleanup;
 
+    /* get the state of every domain in one call rather than one call
+     * per row, where the server supports it */
+    if (optTable)
+        nrecords = vshDomainStatsCollect(ctl, VIR_DOMAIN_STATS_STATE,
+                                         flags, &records);
+
     /* print table header in legacy mode */
     if (optTable) {
         if (optTitle)
@@ -1622,12 +1703,21 @@ cmdList(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
         else
             ignore_value(virStrcpyStatic(id_buf, "-"));
 
-        state = vshDomainState(ctl, dom, NULL);
-        if (optTable && managed && state == VIR_DOMAIN_SHUTOFF &&
-            virDomainHasManagedSaveImage(dom, 0) > 0)
-            state = -2;
-
         if (optTable) {
+            if ((record = vshDomainStatsLookup(records, nrecords,
+                                               virDomainGetName(dom))) &&
+                (param = vshFindTypedParamByName("state.state",
+                                                 record->params,
+                                                 record->nparams)) &&
+                param->type == VIR_TYPED_PARAM_INT)
+                state = param->value.i;
+            else
+                state = vshDomainState(ctl, dom, NULL);
+
+            if (managed && state == VIR_DOMAIN_SHUTOFF &&
+                virDomainHasManagedSaveImage(dom, 0) > 0)
+                state = -2;
+
             if (optTitle) {
                 if (!(title = vshGetDomainDescription(ctl, dom, true, 0)))
                     goto cleanup;
@@ -1656,11 +1746,536 @@ cmdList(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
 
     ret = true;
 cleanup:
+    virDomainStatsRecordListFree(records);
     vshDomainListFree(list);
     return ret;
 }
 #undef FILTER
 
+/*
+ * "foreach" command
+ */
+static const vshCmdInfo info_foreach[] = {
+    {"help", N_("run a domain command on several domains")},
+    {"desc", N_("Runs a command taking a domain for each domain whose name "
+                "matches one of the given names or wildcard patterns, "
+                "several at a time, over the current connection.")},
+    {NULL, NULL}
+};
+
+static const vshCmdOptDef opts_foreach[] = {
+    {"domains", VSH_OT_DATA, VSH_OFLAG_REQ,
+     N_("comma separated list of domain names or wildcard patterns")},
+    {"inactive", VSH_OT_BOOL, 0, N_("match inactive domains")},
+    {"all", VSH_OT_BOOL, 0, N_("match inactive & active domains")},
+    {"jobs", VSH_OT_INT, 0,
+     N_("number of domains to run the command on at once (default 4)")},
+    {"cmd", VSH_OT_ARGV, VSH_OFLAG_REQ,
+     N_("command and its arguments, without the domain")},
+    {NULL, 0, 0, NULL}
+};
+
+#define VSH_FOREACH_JOBS 4
+#define VSH_FOREACH_JOBS_MAX 64
+
+typedef struct _vshForeachData vshForeachData;
+struct _vshForeachData {
+    vshControl *ctl;
+    virMutex lock;
+    const char **names;
+    vshCmd **cmds;
+    size_t ncmds;
+    size_t next;
+    bool ret;
+};
+
+static void
+vshForeachWorker(void *opaque)
+{
+    vshForeachData *data = opaque;
+    vshControl *ctl = data->ctl;
+
+    while (true) {
+        size_t i;
+        bool ok;
+
+        virMutexLock(&data->lock);
+        if (data->next == data->ncmds) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+        i = data->next++;
+        virMutexUnlock(&data->lock);
+
+        vshJobOutputBegin();
+        vshPrintExtra(ctl, _("Domain %s:\n"), data->names[i]);
+        if (!(ok = data->cmds[i]->def->handler(ctl, data->cmds[i])))
+            vshReportError(ctl);
+        vshPrintExtra(ctl, "\n");
+        vshJobOutputEnd();
+
+        if (!ok) {
+            virMutexLock(&data->lock);
+            data->ret = false;
+            virMutexUnlock(&data->lock);
+        }
+    }
+}
+
+static bool
+vshDomainNameMatch(char **patterns, int npatterns, const char *name)
+{
+    int i;
+
+    for (i = 0; i < npatterns; i++) {
+        if (fnmatch(patterns[i], name, 0) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool
+cmdForeach(vshControl *ctl, const vshCmd *cmd)
+{
+    const char *domains = NULL;
+    char **patterns = NULL;
+    int npatterns = 0;
+    int jobs = VSH_FOREACH_JOBS;
+    unsigned int flags = VIR_CONNECT_LIST_DOMAINS_ACTIVE;
+    const vshCmdDef *def;
+    const vshCmdOptDef *opt;
+    const vshCmdOpt *arg = NULL;
+    char **argv = NULL;
+    int nargs = 2;
+    vshDomainListPtr list = NULL;
+    vshForeachData data;
+    virThreadPtr threads = NULL;
+    int nthreads = 0;
+    bool locked = false;
+    int i;
+    bool ret = false;
+
+    memset(&data, 0, sizeof(data));
+    data.ctl = ctl;
+    data.ret = true;
+
+    if (vshCommandOptString(cmd, "domains", &domains) <= 0)
+        return false;
+
+    if (vshCommandOptInt(cmd, "jobs", &jobs) < 0 ||
+        jobs < 1 || jobs > VSH_FOREACH_JOBS_MAX) {
+        vshError(ctl, _("jobs must be between 1 and %d"),
+                 VSH_FOREACH_JOBS_MAX);
+        return false;
+    }
+
+    if (vshCommandOptBool(cmd, "inactive"))
+        flags = VIR_CONNECT_LIST_DOMAINS_INACTIVE;
+
+    if (vshCommandOptBool(cmd, "all"))
+        flags = VIR_CONNECT_LIST_DOMAINS_INACTIVE |
+                VIR_CONNECT_LIST_DOMAINS_ACTIVE;
+
+    /* The inner command is run as "CMD --domain NAME ARGS..." */
+    while ((arg = vshCommandOptArgv(cmd, arg)))
+        nargs++;
+    argv = vshCalloc(ctl, nargs, sizeof(*argv));
+
+    arg = vshCommandOptArgv(cmd, NULL);
+    argv[0] = arg->data;
+    argv[1] = (char *) "--domain";
+    for (i = 3; (arg = vshCommandOptArgv(cmd, arg)); i++)
+        argv[i] = arg->data;
+
+    if (!(def = vshCmddefSearch(argv[0]))) {
+        vshError(ctl, _("unknown command: '%s'"), argv[0]);
+        goto cleanup;
+    }
+    for (opt = def->opts; opt && opt->name; opt++) {
+        if (STREQ(opt->name, "domain"))
+            break;
+    }
+    if (!opt || !opt->name) {
+        vshError(ctl, _("command '%s' does not take a domain"), def->name);
+        goto cleanup;
+    }
+
+    if ((npatterns = vshStringToArray(domains, &patterns)) < 0)
+        goto cleanup;
+
+    if (!(list = vshDomainListCollect(ctl, flags)))
+        goto cleanup;
+
+    data.names = vshCalloc(ctl, list->ndomains, sizeof(*data.names));
+    data.cmds = vshCalloc(ctl, list->ndomains, sizeof(*data.cmds));
+
+    /* Parse every command up front, so that a syntax error is reported
+     * once, before anything has been run */
+    for (i = 0; i < list->ndomains; i++) {
+        const char *name = virDomainGetName(list->domains[i]);
+
+        if (!vshDomainNameMatch(patterns, npatterns, name))
+            continue;
+
+        argv[2] = (char *) name;
+        if (!(data.cmds[data.ncmds] = vshCommandArgvNew(ctl, nargs, argv)))
+            goto cleanup;
+        data.names[data.ncmds++] = name;
+    }
+
+    if (data.ncmds == 0) {
+        vshError(ctl, _("no domain matches '%s'"), domains);
+        goto cleanup;
+    }
+
+    if (virMutexInit(&data.lock) < 0) {
+        vshError(ctl, "%s", _("Failed to initialize mutex"));
+        goto cleanup;
+    }
+    locked = true;
+
+    /* The calling thread is one of the workers */
+    if (jobs > data.ncmds)
+        jobs = data.ncmds;
+    threads = vshCalloc(ctl, jobs - 1, sizeof(*threads));
+    for (nthreads = 0; nthreads < jobs - 1; nthreads++) {
+        if (virThreadCreate(&threads[nthreads], true,
+                            vshForeachWorker, &data) < 0) {
+            vshDebug(ctl, VSH_ERR_WARNING, "%s",
+                     _("Failed to start worker thread"));
+            break;
+        }
+    }
+
+    vshForeachWorker(&data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    ret = data.ret;
+
+cleanup:
+    if (locked)
+        virMutexDestroy(&data.lock);
+    for (i = 0; i < data.ncmds; i++)
+        vshCommandFree(data.cmds[i]);
+    VIR_FREE(data.cmds);
+    VIR_FREE(data.names);
+    VIR_FREE(threads);
+    vshDomainListFree(list);
+    if (patterns) {
+        VIR_FREE(*patterns);
+        VIR_FREE(patterns);
+    }
+    VIR_FREE(argv);
+    return ret;
+}
+
+/*
+ * "domstats" command
+ */
+static const vshCmdInfo info_domstats[] = {
+    {"help", N_("get statistics about one or multiple domains")},
+    {"desc", N_("Gets statistics about one or more (or all) domains "
+                "with a single call to the server.")},
+    {NULL, NULL}
+};
+
+static const vshCmdOptDef opts_domstats[] = {
+    {"state", VSH_OT_BOOL, 0, N_("report domain state")},
+    {"cpu-total", VSH_OT_BOOL, 0, N_("report domain physical cpu usage")},
+    {"balloon", VSH_OT_BOOL, 0, N_("report domain balloon statistics")},
+    {"interface", VSH_OT_BOOL, 0,
+     N_("report domain network interface statistics")},
+    {"block", VSH_OT_BOOL, 0, N_("report domain block device statistics")},
+    {"monitor", VSH_OT_BOOL, 0, N_("report hypervisor monitor latency")},
+    {"vcpu", VSH_OT_BOOL, 0, N_("report domain virtual cpu statistics")},
+    {"job", VSH_OT_BOOL, 0, N_("report domain job state")},
+    {"list-active", VSH_OT_BOOL, 0, N_("list only active domains")},
+    {"list-inactive", VSH_OT_BOOL, 0, N_("list only inactive domains")},
+    {"list-persistent", VSH_OT_BOOL, 0, N_("list only persistent domains")},
+    {"list-transient", VSH_OT_BOOL, 0, N_("list only transient domains")},
+    {"list-running", VSH_OT_BOOL, 0, N_("list only running domains")},
+    {"list-paused", VSH_OT_BOOL, 0, N_("list only paused domains")},
+    {"list-shutoff", VSH_OT_BOOL, 0, N_("list only shutoff domains")},
+    {"list-other", VSH_OT_BOOL, 0, N_("list only domains in other states")},
+    {"enforce", VSH_OT_BOOL, 0,
+     N_("enforce requested stats parameters")},
+    {"format", VSH_OT_STRING, 0,
+     N_("output format: text (default), csv or json")},
+    {"domains", VSH_OT_ARGV, 0,
+     N_("names or wildcard patterns of the domains to report")},
+    {NULL, 0, 0, NULL}
+};
+
+typedef enum {
+    VSH_DOMSTATS_FORMAT_TEXT,
+    VSH_DOMSTATS_FORMAT_CSV,
+    VSH_DOMSTATS_FORMAT_JSON,
+} vshDomstatsFormat;
+
+/* Quote @str as a CSV field if it needs it */
+static void
+vshDomainStatsAddCSVField(virBufferPtr buf, const char *str)
+{
+    const char *p;
+
+    if (!strpbrk(str, ",\"\r\n")) {
+        virBufferAdd(buf, str, -1);
+        return;
+    }
+
+    virBufferAddChar(buf, '"');
+    for (p = str; *p; p++) {
+        if (*p == '"')
+            virBufferAddChar(buf, '"');
+        virBufferAddChar(buf, *p);
+    }
+    virBufferAddChar(buf, '"');
+}
+
+static int
+vshDomainStatsAddCSV(virBufferPtr buf, virDomainStatsRecordPtr record)
+{
+    const char *name = virDomainGetName(record->dom);
+    char *value;
+    int i;
+
+    for (i = 0; i < record->nparams; i++) {
+        virTypedParameterPtr param = record->params + i;
+
+        /* keep booleans locale independent for scripts */
+        if (param->type == VIR_TYPED_PARAM_BOOLEAN)
+            value = vshStrdup(NULL, param->value.b ? "1" : "0");
+        else if (!(value = vshGetTypedParamValue(NULL, param)))
+            return -1;
+
+        vshDomainStatsAddCSVField(buf, name);
+        virBufferAddChar(buf, ',');
+        vshDomainStatsAddCSVField(buf, param->field);
+        virBufferAddChar(buf, ',');
+        vshDomainStatsAddCSVField(buf, value);
+        virBufferAddChar(buf, '\n');
+        VIR_FREE(value);
+    }
+    return 0;
+}
+
+static virJSONValuePtr
+vshDomainStatsToJSON(virDomainStatsRecordPtr record)
+{
+    virJSONValuePtr obj = virJSONValueNewObject();
+    virJSONValuePtr stats = virJSONValueNewObject();
+    int rc = 0;
+    int i;
+
+    if (!obj || !stats)
+        goto error;
+
+    for (i = 0; i < record->nparams && rc == 0; i++) {
+        virTypedParameterPtr param = record->params + i;
+
+        switch (param->type) {
+        case VIR_TYPED_PARAM_INT:
+            rc = virJSONValueObjectAppendNumberInt(stats, param->field,
+                                                   param->value.i);
+            break;
+        case VIR_TYPED_PARAM_UINT:
+            rc = virJSONValueObjectAppendNumberUint(stats, param->field,
+                                                    param->value.ui);
+            break;
+        case VIR_TYPED_PARAM_LLONG:
+            rc = virJSONValueObjectAppendNumberLong(stats, param->field,
+                                                    param->value.l);
+            break;
+        case VIR_TYPED_PARAM_ULLONG:
+            rc = virJSONValueObjectAppendNumberUlong(stats, param->field,
+                                                     param->value.ul);
+            break;
+        case VIR_TYPED_PARAM_DOUBLE:
+            rc = virJSONValueObjectAppendNumberDouble(stats, param->field,
+                                                      param->value.d);
+            break;
+        case VIR_TYPED_PARAM_BOOLEAN:
+            rc = virJSONValueObjectAppendBoolean(stats, param->field,
+                                                 param->value.b);
+            break;
+        case VIR_TYPED_PARAM_STRING:
+            rc = virJSONValueObjectAppendString(stats, param->field,
+                                                param->value.s);
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (rc < 0 ||
+        virJSONValueObjectAppendString(obj, "name",
+                                       virDomainGetName(record->dom)) < 0 ||
+        virJSONValueObjectAppend(obj, "stats", stats) < 0)
+        goto error;
+
+    return obj;
+
+error:
+    virJSONValueFree(stats);
+    virJSONValueFree(obj);
+    return NULL;
+}
+
+static bool
+cmdDomstats(vshControl *ctl, const vshCmd *cmd)
+{
+    unsigned int stats = 0;
+    unsigned int flags = 0;
+    const char *format = NULL;
+    vshDomstatsFormat fmt = VSH_DOMSTATS_FORMAT_TEXT;
+    char **patterns = NULL;
+    int npatterns = 0;
+    const vshCmdOpt *opt = NULL;
+    virDomainStatsRecordPtr *records = NULL;
+    virDomainStatsRecordPtr *next;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virJSONValuePtr json = NULL;
+    virJSONValuePtr entry;
+    char *str = NULL;
+    int i;
+    bool ret = false;
+
+    if (vshCommandOptBool(cmd, "state"))
+        stats |= VIR_DOMAIN_STATS_STATE;
+    if (vshCommandOptBool(cmd, "cpu-total"))
+        stats |= VIR_DOMAIN_STATS_CPU_TOTAL;
+    if (vshCommandOptBool(cmd, "balloon"))
+        stats |= VIR_DOMAIN_STATS_BALLOON;
+    if (vshCommandOptBool(cmd, "interface"))
+        stats |= VIR_DOMAIN_STATS_INTERFACE;
+    if (vshCommandOptBool(cmd, "block"))
+        stats |= VIR_DOMAIN_STATS_BLOCK;
+    if (vshCommandOptBool(cmd, "monitor"))
+        stats |= VIR_DOMAIN_STATS_MONITOR;
+    if (vshCommandOptBool(cmd, "vcpu"))
+        stats |= VIR_DOMAIN_STATS_VCPU;
+    if (vshCommandOptBool(cmd, "job"))
+        stats |= VIR_DOMAIN_STATS_JOB;
+
+    if (vshCommandOptBool(cmd, "list-active"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE;
+    if (vshCommandOptBool(cmd, "list-inactive"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_INACTIVE;
+    if (vshCommandOptBool(cmd, "list-persistent"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_PERSISTENT;
+    if (vshCommandOptBool(cmd, "list-transient"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_TRANSIENT;
+    if (vshCommandOptBool(cmd, "list-running"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_RUNNING;
+    if (vshCommandOptBool(cmd, "list-paused"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_PAUSED;
+    if (vshCommandOptBool(cmd, "list-shutoff"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_SHUTOFF;
+    if (vshCommandOptBool(cmd, "list-other"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_OTHER;
+    if (vshCommandOptBool(cmd, "enforce"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS;
+
+    if (vshCommandOptString(cmd, "format", &format) < 0) {
+        vshError(ctl, "%s", _("malformed format"));
+        return false;
+    }
+    if (!format || STREQ(format, "text")) {
+        fmt = VSH_DOMSTATS_FORMAT_TEXT;
+    } else if (STREQ(format, "csv")) {
+        fmt = VSH_DOMSTATS_FORMAT_CSV;
+    } else if (STREQ(format, "json")) {
+        fmt = VSH_DOMSTATS_FORMAT_JSON;
+    } else {
+        vshError(ctl, _("unknown output format '%s'"), format);
+        return false;
+    }
+
+    while ((opt = vshCommandOptArgv(cmd, opt)))
+        npatterns++;
+    if (npatterns) {
+        patterns = vshCalloc(ctl, npatterns, sizeof(*patterns));
+        for (i = 0; (opt = vshCommandOptArgv(cmd, opt)); i++)
+            patterns[i] = opt->data;
+    }
+
+    if (virConnectGetAllDomainStats(ctl->conn, stats, &records, flags) < 0)
+        goto cleanup;
+
+    if (fmt == VSH_DOMSTATS_FORMAT_JSON &&
+        !(json = virJSONValueNewArray()))
+        goto no_memory;
+    if (fmt == VSH_DOMSTATS_FORMAT_CSV)
+        virBufferAddLit(&buf, "domain,field,value\n");
+
+    for (next = records; *next; next++) {
+        virDomainStatsRecordPtr record = *next;
+        const char *name = virDomainGetName(record->dom);
+
+        if (npatterns && !vshDomainNameMatch(patterns, npatterns, name))
+            continue;
+
+        switch (fmt) {
+        case VSH_DOMSTATS_FORMAT_TEXT:
+            virBufferAsprintf(&buf, "Domain: '%s'\n", name);
+            for (i = 0; i < record->nparams; i++) {
+                if (!(str = vshGetTypedParamValue(ctl, record->params + i)))
+                    goto cleanup;
+                virBufferAsprintf(&buf, "  %s=%s\n",
+                                  record->params[i].field, str);
+                VIR_FREE(str);
+            }
+            virBufferAddChar(&buf, '\n');
+            break;
+
+        case VSH_DOMSTATS_FORMAT_CSV:
+            if (vshDomainStatsAddCSV(&buf, record) < 0)
+                goto cleanup;
+            break;
+
+        case VSH_DOMSTATS_FORMAT_JSON:
+            if (!(entry = vshDomainStatsToJSON(record)))
+                goto no_memory;
+            if (virJSONValueArrayAppend(json, entry) < 0) {
+                virJSONValueFree(entry);
+                goto no_memory;
+            }
+            break;
+        }
+    }
+
+    if (json) {
+        if (!(str = virJSONValueToString(json, true)))
+            goto cleanup;
+        virBufferAdd(&buf, str, -1);
+        virBufferAddChar(&buf, '\n');
+        VIR_FREE(str);
+    }
+
+    if (virBufferError(&buf))
+        goto no_memory;
+
+    /* print everything at once, so the output of a large host isn't
+     * paced by the terminal while the records are formatted */
+    if ((str = virBufferContentAndReset(&buf)))
+        vshPrint(ctl, "%s", str);
+    ret = true;
+
+cleanup:
+    VIR_FREE(str);
+    virBufferFreeAndReset(&buf);
+    virJSONValueFree(json);
+    virDomainStatsRecordListFree(records);
+    VIR_FREE(patterns);
+    return ret;
+
+no_memory:
+    vshError(ctl, "%s", _("Out of memory"));
+    goto cleanup;
+}
+
 const vshCmdDef domMonitoringCmds[] = {
     {"domblkerror", cmdDomBlkError, opts_domblkerror, info_domblkerror, 0},
     {"domblkinfo", cmdDomblkinfo, opts_domblkinfo, info_domblkinfo, 0},
@@ -1673,6 +2288,8 @@ const vshCmdDef domMonitoringCmds[] = {
     {"dominfo", cmdDominfo, opts_dominfo, info_dominfo, 0},
     {"dommemstat", cmdDomMemStat, opts_dommemstat, info_dommemstat, 0},
     {"domstate", cmdDomstate, opts_domstate, info_domstate, 0},
+    {"domstats", cmdDomstats, opts_domstats, info_domstats, 0},
+    {"foreach", cmdForeach, opts_foreach, info_foreach, 0},
     {"list", cmdList, opts_list, info_list, 0},
     {NULL, NULL, NULL, NULL, 0}
 };
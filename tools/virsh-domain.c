@@ -1042,17 +1042,34 @@ static const vshCmdOptDef opts_blkiotune[] = {
      N_("IO Weight in range [100, 1000]")},
     {"device-weights", VSH_OT_STRING, VSH_OFLAG_NONE,
      N_("per-device IO Weights, in the form of /path/to/device,weight,...")},
+    {"device-read-iops-sec", VSH_OT_STRING, VSH_OFLAG_NONE,
+     N_("per-device read I/O limit per second, in the form of /path/to/device,read_iops_sec,...")},
+    {"device-write-iops-sec", VSH_OT_STRING, VSH_OFLAG_NONE,
+     N_("per-device write I/O limit per second, in the form of /path/to/device,write_iops_sec,...")},
+    {"device-read-bytes-sec", VSH_OT_STRING, VSH_OFLAG_NONE,
+     N_("per-device bytes read per second, in the form of /path/to/device,read_bytes_sec,...")},
+    {"device-write-bytes-sec", VSH_OT_STRING, VSH_OFLAG_NONE,
+     N_("per-device bytes wrote per second, in the form of /path/to/device,write_bytes_sec,...")},
     {"config", VSH_OT_BOOL, 0, N_("affect next boot")},
     {"live", VSH_OT_BOOL, 0, N_("affect running domain")},
     {"current", VSH_OT_BOOL, 0, N_("affect current domain")},
     {NULL, 0, 0, NULL}
 };
 
+/* string options of blkiotune and the per-device parameter each sets */
+static const char *const vshBlkiotuneDeviceOpts[][2] = {
+    { "device-weights", VIR_DOMAIN_BLKIO_DEVICE_WEIGHT },
+    { "device-read-iops-sec", VIR_DOMAIN_BLKIO_DEVICE_READ_IOPS },
+    { "device-write-iops-sec", VIR_DOMAIN_BLKIO_DEVICE_WRITE_IOPS },
+    { "device-read-bytes-sec", VIR_DOMAIN_BLKIO_DEVICE_READ_BPS },
+    { "device-write-bytes-sec", VIR_DOMAIN_BLKIO_DEVICE_WRITE_BPS },
+};
+
 static bool
 cmdBlkiotune(vshControl * ctl, const vshCmd * cmd)
 {
     virDomainPtr dom;
-    const char *device_weight = NULL;
+    const char *device_values[ARRAY_CARDINALITY(vshBlkiotuneDeviceOpts)] = { NULL };
     int weight = 0;
     int nparams = 0;
     int rv = 0;
@@ -1094,14 +1111,17 @@ cmdBlkiotune(vshControl * ctl, const vshCmd * cmd)
         }
     }
 
-    rv = vshCommandOptString(cmd, "device-weights", &device_weight);
-    if (rv < 0) {
-        vshError(ctl, "%s",
-                 _("Unable to parse string parameter"));
-        goto cleanup;
-    }
-    if (rv > 0) {
-        nparams++;
+    for (i = 0; i < ARRAY_CARDINALITY(vshBlkiotuneDeviceOpts); i++) {
+        rv = vshCommandOptString(cmd, vshBlkiotuneDeviceOpts[i][0],
+                                 &device_values[i]);
+        if (rv < 0) {
+            vshError(ctl, "%s",
+                     _("Unable to parse string parameter"));
+            goto cleanup;
+        }
+        if (rv > 0) {
+            nparams++;
+        }
     }
 
     if (nparams == 0) {
@@ -1134,24 +1154,25 @@ cmdBlkiotune(vshControl * ctl, const vshCmd * cmd)
         /* set the blkio parameters */
         params = vshCalloc(ctl, nparams, sizeof(*params));
 
-        for (i = 0; i < nparams; i++) {
-            temp = &params[i];
+        temp = params;
+        if (weight) {
             temp->type = VIR_TYPED_PARAM_UINT;
+            temp->value.ui = weight;
+            if (!virStrcpy(temp->field, VIR_DOMAIN_BLKIO_WEIGHT,
+                           sizeof(temp->field)))
+                goto cleanup;
+            temp++;
+        }
 
-            if (weight) {
-                temp->value.ui = weight;
-                if (!virStrcpy(temp->field, VIR_DOMAIN_BLKIO_WEIGHT,
-                               sizeof(temp->field)))
-                    goto cleanup;
-                weight = 0;
-            } else if (device_weight) {
-                temp->value.s = vshStrdup(ctl, device_weight);
-                temp->type = VIR_TYPED_PARAM_STRING;
-                if (!virStrcpy(temp->field, VIR_DOMAIN_BLKIO_DEVICE_WEIGHT,
-                               sizeof(temp->field)))
-                    goto cleanup;
-                device_weight = NULL;
-            }
+        for (i = 0; i < ARRAY_CARDINALITY(vshBlkiotuneDeviceOpts); i++) {
+            if (!device_values[i])
+                continue;
+            temp->type = VIR_TYPED_PARAM_STRING;
+            temp->value.s = vshStrdup(ctl, device_values[i]);
+            if (!virStrcpy(temp->field, vshBlkiotuneDeviceOpts[i][1],
+                           sizeof(temp->field)))
+                goto cleanup;
+            temp++;
         }
 
         if (virDomainSetBlkioParameters(dom, params, nparams, flags) < 0) {
@@ -4269,6 +4290,15 @@ cmdDomjobinfo(vshControl *ctl, const vshCmd *cmd)
             val = vshPrettyCapacity(info.fileTotal, &unit);
             vshPrint(ctl, "%-17s %-.3lf %s\n", _("File total:"), val, unit);
         }
+        if (info.memProcessed && info.timeElapsed) {
+            val = vshPrettyCapacity(info.memProcessed * 1000 / info.timeElapsed,
+                                    &unit);
+            vshPrint(ctl, "%-17s %-.3lf %s/s\n", _("Memory rate:"), val, unit);
+        }
+        if (info.memProcessed && info.fileProcessed) {
+            vshPrint(ctl, "%-17s %-.3lf\n", _("Compression:"),
+                     (double) info.memProcessed / info.fileProcessed);
+        }
     } else {
         ret = false;
     }
@@ -6816,6 +6846,7 @@ static const vshCmdOptDef opts_migrate[] = {
     {"change-protection", VSH_OT_BOOL, 0,
      N_("prevent any configuration changes to domain until migration ends)")},
     {"unsafe", VSH_OT_BOOL, 0, N_("force migration even if it may be unsafe")},
+    {"compressed", VSH_OT_BOOL, 0, N_("compress repeated pages during live migration")},
     {"verbose", VSH_OT_BOOL, 0, N_("display the progress of migration")},
     {"domain", VSH_OT_DATA, VSH_OFLAG_REQ, N_("domain name, id or uuid")},
     {"desturi", VSH_OT_DATA, VSH_OFLAG_REQ, N_("connection URI of the destination host as seen from the client(normal migration) or source(p2p migration)")},
@@ -6889,6 +6920,9 @@ doMigrate(void *opaque)
     if (vshCommandOptBool(cmd, "unsafe"))
         flags |= VIR_MIGRATE_UNSAFE;
 
+    if (vshCommandOptBool(cmd, "compressed"))
+        flags |= VIR_MIGRATE_COMPRESSED;
+
     if (vshCommandOptBool(cmd, "offline")) {
         flags |= VIR_MIGRATE_OFFLINE;
     }
@@ -7127,6 +7161,58 @@ done:
     return ret;
 }
 
+/*
+ * "migrate-compcache" command
+ */
+static const vshCmdInfo info_migrate_compcache[] = {
+    {"help", N_("get/set compression cache size")},
+    {"desc", N_("Get/set size of the cache (in bytes) used for compressing "
+                "repeatedly transferred memory pages during live migration.")},
+    {NULL, NULL}
+};
+
+static const vshCmdOptDef opts_migrate_compcache[] = {
+    {"domain", VSH_OT_DATA, VSH_OFLAG_REQ, N_("domain name, id or uuid")},
+    {"size", VSH_OT_INT, VSH_OFLAG_REQ_OPT,
+     N_("requested size of the cache (in bytes) used for compression")},
+    {NULL, 0, 0, NULL}
+};
+
+static bool
+cmdMigrateCompCache(vshControl *ctl, const vshCmd *cmd)
+{
+    virDomainPtr dom = NULL;
+    unsigned long long size = 0;
+    bool ret = false;
+    const char *unit;
+    double value;
+    int rc;
+
+    if (!(dom = vshCommandOptDomain(ctl, cmd, NULL)))
+        return false;
+
+    rc = vshCommandOptULongLong(cmd, "size", &size);
+    if (rc < 0) {
+        vshError(ctl, "%s", _("Unable to parse size parameter"));
+        goto cleanup;
+    } else if (rc != 0) {
+        if (virDomainMigrateSetCompressionCache(dom, size, 0) < 0)
+            goto cleanup;
+    }
+
+    if (virDomainMigrateGetCompressionCache(dom, &size, 0) < 0)
+        goto cleanup;
+
+    value = vshPrettyCapacity(size, &unit);
+    vshPrint(ctl, _("Compression cache: %.3lf %s\n"), value, unit);
+
+    ret = true;
+
+cleanup:
+    virDomainFree(dom);
+    return ret;
+}
+
 /*
  * "domdisplay" command
  */
@@ -8558,6 +8644,8 @@ const vshCmdDef domManagementCmds[] = {
      opts_migrate_setspeed, info_migrate_setspeed, 0},
     {"migrate-getspeed", cmdMigrateGetMaxSpeed,
      opts_migrate_getspeed, info_migrate_getspeed, 0},
+    {"migrate-compcache", cmdMigrateCompCache,
+     opts_migrate_compcache, info_migrate_compcache, 0},
     {"numatune", cmdNumatune, opts_numatune, info_numatune, 0},
     {"reboot", cmdReboot, opts_reboot, info_reboot, 0},
     {"reset", cmdReset, opts_reset, info_reset, 0},
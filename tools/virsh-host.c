@@ -49,12 +49,22 @@ static const vshCmdInfo info_capabilities[] = {
     {NULL, NULL}
 };
 
+static const vshCmdOptDef opts_capabilities[] = {
+    {"host", VSH_OT_BOOL, 0, N_("only report the host capabilities")},
+    {NULL, 0, 0, NULL}
+};
+
 static bool
-cmdCapabilities(vshControl *ctl, const vshCmd *cmd ATTRIBUTE_UNUSED)
+cmdCapabilities(vshControl *ctl, const vshCmd *cmd)
 {
     char *caps;
 
-    if ((caps = virConnectGetCapabilities(ctl->conn)) == NULL) {
+    if (vshCommandOptBool(cmd, "host"))
+        caps = virConnectGetHostCapabilities(ctl->conn, 0);
+    else
+        caps = virConnectGetCapabilities(ctl->conn);
+
+    if (caps == NULL) {
         vshError(ctl, "%s", _("failed to get capabilities"));
         return false;
     }
@@ -1074,7 +1084,7 @@ error:
 }
 
 const vshCmdDef hostAndHypervisorCmds[] = {
-    {"capabilities", cmdCapabilities, NULL, info_capabilities, 0},
+    {"capabilities", cmdCapabilities, opts_capabilities, info_capabilities, 0},
     {"connect", cmdConnect, opts_connect, info_connect,
      VSH_CMD_FLAG_NOCONNECT},
     {"freecell", cmdFreecell, opts_freecell, info_freecell, 0},
@@ -486,6 +486,8 @@ static const vshCmdInfo info_pool_refresh[] = {
 
 static const vshCmdOptDef opts_pool_refresh[] = {
     {"pool", VSH_OT_DATA, VSH_OFLAG_REQ, N_("pool name or uuid")},
+    {"capacity", VSH_OT_BOOL, 0,
+     N_("only update the size of the pool, not its volumes")},
     {NULL, 0, 0, NULL}
 };
 
@@ -495,11 +497,15 @@ cmdPoolRefresh(vshControl *ctl, const vshCmd *cmd)
     virStoragePoolPtr pool;
     bool ret = true;
     const char *name;
+    unsigned int flags = 0;
+
+    if (vshCommandOptBool(cmd, "capacity"))
+        flags |= VIR_STORAGE_POOL_REFRESH_CAPACITY;
 
     if (!(pool = vshCommandOptPool(ctl, cmd, "pool", &name)))
         return false;
 
-    if (virStoragePoolRefresh(pool, 0) == 0) {
+    if (virStoragePoolRefresh(pool, flags) == 0) {
         vshPrint(ctl, _("Pool %s refreshed\n"), name);
     } else {
         vshError(ctl, _("Failed to refresh pool %s"), name);
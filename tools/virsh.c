@@ -225,7 +225,33 @@ vshStringToArray(const char *str,
     return nstr_tokens;
 }
 
-virErrorPtr last_error;
+/* Each thread keeps its own last error, so that "foreach" workers
+ * don't report each other's failures */
+static virThreadLocal vshLastErrorLocal;
+
+static void
+vshLastErrorFree(void *opaque)
+{
+    virErrorPtr *err = opaque;
+
+    virFreeError(*err);
+    VIR_FREE(err);
+}
+
+virErrorPtr *
+vshLastErrorPtr(void)
+{
+    virErrorPtr *err = virThreadLocalGet(&vshLastErrorLocal);
+
+    if (!err) {
+        err = vshMalloc(NULL, sizeof(*err));
+        if (virThreadLocalSet(&vshLastErrorLocal, err) < 0) {
+            vshError(NULL, "%s", _("Failed to set thread local variable"));
+            exit(EXIT_FAILURE);
+        }
+    }
+    return err;
+}
 
 /*
  * Quieten libvirt until we're done with the command.
@@ -1201,7 +1227,7 @@ vshCommandOptFree(vshCmdOpt * arg)
     }
 }
 
-static void
+void
 vshCommandFree(vshCmd *cmd)
 {
     vshCmd *c = cmd;
@@ -1643,15 +1669,16 @@ struct _vshCommandParser {
 };
 
 static bool
-vshCommandParse(vshControl *ctl, vshCommandParser *parser)
+vshCommandParse(vshControl *ctl, vshCommandParser *parser, vshCmd **result)
 {
     char *tkdata = NULL;
+    vshCmd *chead = NULL;
     vshCmd *clast = NULL;
     vshCmdOpt *first = NULL;
 
-    if (ctl->cmd) {
-        vshCommandFree(ctl->cmd);
-        ctl->cmd = NULL;
+    if (*result) {
+        vshCommandFree(*result);
+        *result = NULL;
     }
 
     while (1) {
@@ -1809,8 +1836,8 @@ get_data:
                 goto syntaxError;
             }
 
-            if (!ctl->cmd)
-                ctl->cmd = c;
+            if (!chead)
+                chead = c;
             if (clast)
                 clast->next = c;
             clast = c;
@@ -1820,13 +1847,11 @@ get_data:
             break;
     }
 
+    *result = chead;
     return true;
 
  syntaxError:
-    if (ctl->cmd) {
-        vshCommandFree(ctl->cmd);
-        ctl->cmd = NULL;
-    }
+    vshCommandFree(chead);
     if (first)
         vshCommandOptFree(first);
     VIR_FREE(tkdata);
@@ -1862,7 +1887,29 @@ vshCommandArgvParse(vshControl *ctl, int nargs, char **argv)
     parser.arg_pos = argv;
     parser.arg_end = argv + nargs;
     parser.getNextArg = vshCommandArgvGetArg;
-    return vshCommandParse(ctl, &parser);
+    return vshCommandParse(ctl, &parser, &ctl->cmd);
+}
+
+/*
+ * Like vshCommandArgvParse, but returns the parsed command rather than
+ * replacing ctl->cmd; used by commands that run other commands.
+ * The result must be freed with vshCommandFree.
+ */
+vshCmd *
+vshCommandArgvNew(vshControl *ctl, int nargs, char **argv)
+{
+    vshCommandParser parser;
+    vshCmd *cmd = NULL;
+
+    if (nargs <= 0)
+        return NULL;
+
+    parser.arg_pos = argv;
+    parser.arg_end = argv + nargs;
+    parser.getNextArg = vshCommandArgvGetArg;
+    if (!vshCommandParse(ctl, &parser, &cmd))
+        return NULL;
+    return cmd;
 }
 
 /* ----------------------
@@ -1940,7 +1987,7 @@ vshCommandStringParse(vshControl *ctl, char *cmdstr)
 
     parser.pos = cmdstr;
     parser.getNextArg = vshCommandStringGetArg;
-    return vshCommandParse(ctl, &parser);
+    return vshCommandParse(ctl, &parser, &ctl->cmd);
 }
 
 /* ---------------
@@ -2043,11 +2090,63 @@ vshFindTypedParamByName(const char *name, virTypedParameterPtr list, int count)
     return NULL;
 }
 
+/*
+ * Commands run by "foreach" workers collect their output per thread,
+ * so that the output for one domain is printed in one piece rather
+ * than interleaved with that of the others.
+ */
+typedef struct _vshJobOutput vshJobOutput;
+struct _vshJobOutput {
+    virBuffer out;
+    virBuffer err;
+};
+
+static virThreadLocal vshJobOutputLocal;
+static virMutex vshJobOutputLock;
+
+void
+vshJobOutputBegin(void)
+{
+    vshJobOutput *output = vshMalloc(NULL, sizeof(*output));
+
+    if (virThreadLocalSet(&vshJobOutputLocal, output) < 0) {
+        vshError(NULL, "%s", _("Failed to set thread local variable"));
+        exit(EXIT_FAILURE);
+    }
+}
+
+void
+vshJobOutputEnd(void)
+{
+    vshJobOutput *output = virThreadLocalGet(&vshJobOutputLocal);
+    char *str;
+
+    if (!output)
+        return;
+    ignore_value(virThreadLocalSet(&vshJobOutputLocal, NULL));
+
+    virMutexLock(&vshJobOutputLock);
+    if ((str = virBufferContentAndReset(&output->out))) {
+        fputs(str, stdout);
+        VIR_FREE(str);
+    }
+    fflush(stdout);
+    if ((str = virBufferContentAndReset(&output->err))) {
+        fputs(str, stderr);
+        VIR_FREE(str);
+    }
+    fflush(stderr);
+    virMutexUnlock(&vshJobOutputLock);
+
+    VIR_FREE(output);
+}
+
 void
 vshDebug(vshControl *ctl, int level, const char *format, ...)
 {
     va_list ap;
     char *str;
+    vshJobOutput *output;
 
     /* Aligning log levels to that of libvirt.
      * Traces with levels >=  user-specified-level
@@ -2067,7 +2166,10 @@ vshDebug(vshControl *ctl, int level, const char *format, ...)
         return;
     }
     va_end(ap);
-    fputs(str, stdout);
+    if ((output = virThreadLocalGet(&vshJobOutputLocal)))
+        virBufferAdd(&output->out, str, -1);
+    else
+        fputs(str, stdout);
     VIR_FREE(str);
 }
 
@@ -2076,6 +2178,7 @@ vshPrintExtra(vshControl *ctl, const char *format, ...)
 {
     va_list ap;
     char *str;
+    vshJobOutput *output;
 
     if (ctl && ctl->quiet)
         return;
@@ -2087,7 +2190,10 @@ vshPrintExtra(vshControl *ctl, const char *format, ...)
         return;
     }
     va_end(ap);
-    fputs(str, stdout);
+    if ((output = virThreadLocalGet(&vshJobOutputLocal)))
+        virBufferAdd(&output->out, str, -1);
+    else
+        fputs(str, stdout);
     VIR_FREE(str);
 }
 
@@ -2097,6 +2203,7 @@ vshError(vshControl *ctl, const char *format, ...)
 {
     va_list ap;
     char *str;
+    vshJobOutput *output;
 
     if (ctl != NULL) {
         va_start(ap, format);
@@ -2104,19 +2211,23 @@ vshError(vshControl *ctl, const char *format, ...)
         va_end(ap);
     }
 
-    /* Most output is to stdout, but if someone ran virsh 2>&1, then
-     * printing to stderr will not interleave correctly with stdout
-     * unless we flush between every transition between streams.  */
-    fflush(stdout);
-    fputs(_("error: "), stderr);
-
     va_start(ap, format);
     /* We can't recursively call vshError on an OOM situation, so ignore
        failure here. */
     ignore_value(virVasprintf(&str, format, ap));
     va_end(ap);
 
-    fprintf(stderr, "%s\n", NULLSTR(str));
+    if ((output = virThreadLocalGet(&vshJobOutputLocal))) {
+        virBufferAsprintf(&output->err, "%s%s\n", _("error: "), NULLSTR(str));
+        VIR_FREE(str);
+        return;
+    }
+
+    /* Most output is to stdout, but if someone ran virsh 2>&1, then
+     * printing to stderr will not interleave correctly with stdout
+     * unless we flush between every transition between streams.  */
+    fflush(stdout);
+    fprintf(stderr, "%s%s\n", _("error: "), NULLSTR(str));
     fflush(stderr);
     VIR_FREE(str);
 }
@@ -2947,6 +3058,12 @@ main(int argc, char **argv)
     ctl->debug = VSH_DEBUG_DEFAULT;
     ctl->escapeChar = "^]";     /* Same default as telnet */
 
+    if (virThreadLocalInit(&vshLastErrorLocal, vshLastErrorFree) < 0 ||
+        virThreadLocalInit(&vshJobOutputLocal, NULL) < 0 ||
+        virMutexInit(&vshJobOutputLock) < 0) {
+        perror("virThreadLocalInit");
+        return EXIT_FAILURE;
+    }
 
     if (!setlocale(LC_ALL, "")) {
         perror("setlocale");
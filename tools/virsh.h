@@ -258,6 +258,8 @@ void vshCloseLogFile(vshControl *ctl);
 const char *vshCmddefGetInfo(const vshCmdDef *cmd, const char *info);
 const vshCmdDef *vshCmddefSearch(const char *cmdname);
 bool vshCmddefHelp(vshControl *ctl, const char *name);
+vshCmd *vshCommandArgvNew(vshControl *ctl, int nargs, char **argv);
+void vshCommandFree(vshCmd *cmd);
 const vshCmdGrp *vshCmdGrpSearch(const char *grpname);
 bool vshCmdGrpHelp(vshControl *ctl, const char *name);
 
@@ -309,6 +311,11 @@ void vshPrintExtra(vshControl *ctl, const char *format, ...)
 void vshDebug(vshControl *ctl, int level, const char *format, ...)
     ATTRIBUTE_FMT_PRINTF(3, 4);
 
+/* Collect the output of the calling thread until vshJobOutputEnd
+ * prints it in one piece */
+void vshJobOutputBegin(void);
+void vshJobOutputEnd(void);
+
 /* XXX: add batch support */
 # define vshPrint(_ctl, ...)   vshPrintExtra(NULL, __VA_ARGS__)
 
@@ -343,7 +350,8 @@ struct _vshCtrlData {
 };
 
 /* error handling */
-extern virErrorPtr last_error;
+virErrorPtr *vshLastErrorPtr(void);
+# define last_error (*vshLastErrorPtr())
 void vshReportError(vshControl *ctl);
 void vshResetLibvirtError(void);
 void vshSaveLibvirtError(void);
@@ -0,0 +1,792 @@
+/*
+ * virt-loadgen.c: Drive a libvirt daemon with a configurable API mix
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <gettext.h>
+#include <getopt.h>
+#include <locale.h>
+
+#include "internal.h"
+#include "configmake.h"
+#include "memory.h"
+#include "threads.h"
+#include "util.h"
+#include "virrandom.h"
+
+/* Don't let a typo open thousands of connections */
+#define VIR_LOADGEN_MAX_CONNECTIONS 4096
+
+enum {
+    VIR_LOADGEN_OP_LOOKUP,
+    VIR_LOADGEN_OP_INFO,
+    VIR_LOADGEN_OP_DUMPXML,
+    VIR_LOADGEN_OP_STATS,
+    VIR_LOADGEN_OP_SUBSCRIBE,
+
+    VIR_LOADGEN_OP_LAST
+};
+
+static const char *const virLoadOpNames[VIR_LOADGEN_OP_LAST] = {
+    "lookup", "info", "dumpxml", "stats", "subscribe",
+};
+
+/* Latencies of one operation, in microseconds */
+typedef struct _virLoadSamples virLoadSamples;
+struct _virLoadSamples {
+    unsigned int *lat;
+    size_t nlat;
+    size_t alloc;
+    size_t errors;
+    char *firstError;
+};
+
+typedef struct _virLoadWorker virLoadWorker;
+struct _virLoadWorker {
+    virThread thread;
+    virConnectPtr conn;
+    virDomainPtr *domains;
+    int ndomains;
+    bool noBulkStats;
+    unsigned long long events;
+    virLoadSamples ops[VIR_LOADGEN_OP_LAST];
+};
+
+typedef struct _virLoadConfig virLoadConfig;
+struct _virLoadConfig {
+    const char *uri;
+    bool readonly;
+    unsigned int connections;
+    unsigned int duration;      /* seconds */
+    unsigned int rate;          /* calls per second per connection, 0 = max */
+    bool listen;
+    unsigned int weights[VIR_LOADGEN_OP_LAST];
+    unsigned int totalWeight;
+    unsigned long long deadline; /* microseconds */
+};
+
+static virLoadConfig config;
+static bool quit;
+
+static void
+show_help(FILE *out, const char *argv0)
+{
+    fprintf(out,
+            _("\n"
+              "syntax: %s [OPTIONS]\n"
+              "\n"
+              " Options:\n"
+              "   -h, --help             Display command line help\n"
+              "   -v, --version          Display command version\n"
+              "   -c, --connect URI      Hypervisor connection URI\n"
+              "   -r, --readonly         Open read-only connections\n"
+              "   -n, --connections N    Number of connections (default 4)\n"
+              "   -d, --duration SECS    Length of the run (default 10)\n"
+              "   -R, --rate N           Calls per second on each connection\n"
+              "                          (default 0, as fast as possible)\n"
+              "   -m, --mix OP=W,...     Weights of lookup, info, dumpxml,\n"
+              "                          stats and subscribe calls\n"
+              "                          (default lookup=1,info=1,dumpxml=1,stats=1)\n"
+              "   -e, --events           Keep a lifecycle event subscription\n"
+              "                          open on every connection\n"
+              "\n"),
+            argv0);
+}
+
+static void
+show_version(FILE *out, const char *argv0)
+{
+    fprintf(out, "version: %s %s\n", argv0, VERSION);
+}
+
+static const struct option argOptions[] = {
+    { "help", 0, NULL, 'h', },
+    { "version", 0, NULL, 'v', },
+    { "connect", 1, NULL, 'c', },
+    { "readonly", 0, NULL, 'r', },
+    { "connections", 1, NULL, 'n', },
+    { "duration", 1, NULL, 'd', },
+    { "rate", 1, NULL, 'R', },
+    { "mix", 1, NULL, 'm', },
+    { "events", 0, NULL, 'e', },
+    { NULL, 0, NULL, '\0', }
+};
+
+static unsigned long long
+virLoadNow(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000ull + tv.tv_usec;
+}
+
+static int
+virLoadParseMix(const char *mix)
+{
+    const char *cur = mix;
+    size_t i;
+
+    memset(config.weights, 0, sizeof(config.weights));
+    config.totalWeight = 0;
+
+    while (*cur) {
+        const char *eq = strchr(cur, '=');
+        char *end;
+        unsigned int weight;
+
+        if (!eq)
+            goto error;
+
+        for (i = 0; i < VIR_LOADGEN_OP_LAST; i++) {
+            if (strlen(virLoadOpNames[i]) == eq - cur &&
+                STREQLEN(cur, virLoadOpNames[i], eq - cur))
+                break;
+        }
+        if (i == VIR_LOADGEN_OP_LAST)
+            goto error;
+
+        if (virStrToLong_ui(eq + 1, &end, 10, &weight) < 0 ||
+            (*end != ',' && *end != '\0'))
+            goto error;
+
+        config.weights[i] = weight;
+        config.totalWeight += weight;
+        cur = *end ? end + 1 : end;
+    }
+
+    if (config.totalWeight == 0)
+        goto error;
+    return 0;
+
+error:
+    fprintf(stderr, _("invalid API mix '%s'\n"), mix);
+    return -1;
+}
+
+static int
+virLoadPickOp(void)
+{
+    uint32_t r = virRandomInt(config.totalWeight);
+    size_t i;
+
+    for (i = 0; i < VIR_LOADGEN_OP_LAST; i++) {
+        if (r < config.weights[i])
+            return i;
+        r -= config.weights[i];
+    }
+    return VIR_LOADGEN_OP_LAST - 1;
+}
+
+static void
+virLoadRecord(virLoadSamples *samples, unsigned long long usec, int rc)
+{
+    if (rc < 0) {
+        samples->errors++;
+        if (!samples->firstError) {
+            virErrorPtr err = virGetLastError();
+            samples->firstError = strdup(err && err->message ?
+                                         err->message : _("unknown error"));
+        }
+        virResetLastError();
+        return;
+    }
+
+    if (samples->nlat == samples->alloc &&
+        VIR_RESIZE_N(samples->lat, samples->alloc, samples->nlat, 1) < 0) {
+        samples->errors++;
+        return;
+    }
+    samples->lat[samples->nlat++] = usec > UINT_MAX ? UINT_MAX : usec;
+}
+
+static int
+virLoadLifecycleEvent(virConnectPtr conn ATTRIBUTE_UNUSED,
+                      virDomainPtr dom ATTRIBUTE_UNUSED,
+                      int event ATTRIBUTE_UNUSED,
+                      int detail ATTRIBUTE_UNUSED,
+                      void *opaque)
+{
+    virLoadWorker *worker = opaque;
+
+    worker->events++;
+    return 0;
+}
+
+/* A separate callback for the "subscribe" call, as registering the
+ * same one twice on a connection fails when --events is used */
+static int
+virLoadSubscribeEvent(virConnectPtr conn ATTRIBUTE_UNUSED,
+                      virDomainPtr dom ATTRIBUTE_UNUSED,
+                      int event ATTRIBUTE_UNUSED,
+                      int detail ATTRIBUTE_UNUSED,
+                      void *opaque ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+/* Fall back to one call per domain on drivers without bulk stats */
+static int
+virLoadStats(virLoadWorker *worker)
+{
+    virDomainStatsRecordPtr *records = NULL;
+    virDomainInfo info;
+    int i;
+
+    if (!worker->noBulkStats) {
+        virErrorPtr err;
+
+        if (virConnectGetAllDomainStats(worker->conn, 0, &records, 0) >= 0) {
+            virDomainStatsRecordListFree(records);
+            return 0;
+        }
+        if (!(err = virGetLastError()) || err->code != VIR_ERR_NO_SUPPORT)
+            return -1;
+        virResetLastError();
+        worker->noBulkStats = true;
+    }
+
+    for (i = 0; i < worker->ndomains; i++) {
+        if (virDomainGetInfo(worker->domains[i], &info) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int
+virLoadRunOp(virLoadWorker *worker, int op)
+{
+    virDomainPtr dom = NULL;
+    virDomainInfo info;
+    char *xml;
+    int id;
+
+    if (op != VIR_LOADGEN_OP_STATS && op != VIR_LOADGEN_OP_SUBSCRIBE)
+        dom = worker->domains[virRandomInt(worker->ndomains)];
+
+    switch (op) {
+    case VIR_LOADGEN_OP_LOOKUP:
+        if (!(dom = virDomainLookupByName(worker->conn,
+                                          virDomainGetName(dom))))
+            return -1;
+        virDomainFree(dom);
+        return 0;
+
+    case VIR_LOADGEN_OP_INFO:
+        return virDomainGetInfo(dom, &info);
+
+    case VIR_LOADGEN_OP_DUMPXML:
+        if (!(xml = virDomainGetXMLDesc(dom, 0)))
+            return -1;
+        VIR_FREE(xml);
+        return 0;
+
+    case VIR_LOADGEN_OP_STATS:
+        return virLoadStats(worker);
+
+    case VIR_LOADGEN_OP_SUBSCRIBE:
+        if ((id = virConnectDomainEventRegisterAny(worker->conn, NULL,
+                                                   VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                                   VIR_DOMAIN_EVENT_CALLBACK(virLoadSubscribeEvent),
+                                                   NULL, NULL)) < 0)
+            return -1;
+        return virConnectDomainEventDeregisterAny(worker->conn, id);
+    }
+
+    return -1;
+}
+
+static void
+virLoadWorkerRun(void *opaque)
+{
+    virLoadWorker *worker = opaque;
+    unsigned long long interval = config.rate ? 1000000ull / config.rate : 0;
+    unsigned long long next = virLoadNow();
+
+    for (;;) {
+        unsigned long long start, now;
+        int op, rc;
+
+        now = virLoadNow();
+        if (now >= config.deadline)
+            break;
+
+        /* With a target rate, latency counts from when the call was
+         * due, so a stalled daemon can't hide behind fewer calls */
+        if (interval) {
+            if (next > now) {
+                if (next >= config.deadline)
+                    break;
+                usleep(next - now);
+            }
+            start = next;
+            next += interval;
+        } else {
+            start = now;
+        }
+
+        op = virLoadPickOp();
+        rc = virLoadRunOp(worker, op);
+        virLoadRecord(&worker->ops[op], virLoadNow() - start, rc);
+    }
+}
+
+static void
+virLoadEventLoop(void *opaque ATTRIBUTE_UNUSED)
+{
+    while (!quit) {
+        if (virEventRunDefaultImpl() < 0)
+            break;
+    }
+}
+
+static void
+virLoadEventTick(int timer ATTRIBUTE_UNUSED, void *opaque ATTRIBUTE_UNUSED)
+{
+    /* Only here to wake the event loop so it notices 'quit' */
+}
+
+static int
+virLoadCompareUInt(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a;
+    unsigned int y = *(const unsigned int *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double
+virLoadPercentile(const virLoadSamples *samples, double pct)
+{
+    size_t idx;
+
+    if (!samples->nlat)
+        return 0;
+    idx = (size_t)(pct / 100 * (samples->nlat - 1) + 0.5);
+    return samples->lat[idx] / 1000.0;
+}
+
+/* Merge every worker's samples into the first worker and print them */
+static void
+virLoadReport(virLoadWorker *workers, unsigned long long elapsed)
+{
+    unsigned long long events = 0;
+    size_t calls = 0, errors = 0;
+    double secs = elapsed / 1000000.0;
+    size_t i, op;
+
+    printf("%-10s %10s %8s %10s %9s %9s %9s %9s\n",
+           "op", "calls", "errors", "calls/s",
+           "p50(ms)", "p90(ms)", "p99(ms)", "max(ms)");
+
+    for (op = 0; op < VIR_LOADGEN_OP_LAST; op++) {
+        virLoadSamples *all = &workers[0].ops[op];
+
+        if (!config.weights[op])
+            continue;
+
+        for (i = 1; i < config.connections; i++) {
+            virLoadSamples *s = &workers[i].ops[op];
+
+            if (VIR_RESIZE_N(all->lat, all->alloc, all->nlat, s->nlat) < 0) {
+                fprintf(stderr, _("out of memory\n"));
+                return;
+            }
+            memcpy(all->lat + all->nlat, s->lat, s->nlat * sizeof(*s->lat));
+            all->nlat += s->nlat;
+            all->errors += s->errors;
+            if (!all->firstError) {
+                all->firstError = s->firstError;
+                s->firstError = NULL;
+            }
+        }
+
+        qsort(all->lat, all->nlat, sizeof(*all->lat), virLoadCompareUInt);
+
+        printf("%-10s %10zu %8zu %10.1f %9.3f %9.3f %9.3f %9.3f\n",
+               virLoadOpNames[op], all->nlat + all->errors, all->errors,
+               (all->nlat + all->errors) / secs,
+               virLoadPercentile(all, 50),
+               virLoadPercentile(all, 90),
+               virLoadPercentile(all, 99),
+               virLoadPercentile(all, 100));
+        calls += all->nlat + all->errors;
+        errors += all->errors;
+    }
+
+    for (i = 0; i < config.connections; i++)
+        events += workers[i].events;
+
+    printf("\n%zu calls, %zu errors (%.2f%%) in %.1fs on %u connections\n",
+           calls, errors, calls ? 100.0 * errors / calls : 0.0,
+           secs, config.connections);
+    if (config.listen)
+        printf("%llu lifecycle events received\n", events);
+
+    for (op = 0; op < VIR_LOADGEN_OP_LAST; op++) {
+        if (workers[0].ops[op].firstError)
+            fprintf(stderr, _("first %s error: %s\n"),
+                    virLoadOpNames[op], workers[0].ops[op].firstError);
+    }
+}
+
+static int
+virLoadWorkerOpen(virLoadWorker *worker)
+{
+    worker->conn = virConnectOpenAuth(config.uri, virConnectAuthPtrDefault,
+                                      config.readonly ? VIR_CONNECT_RO : 0);
+    if (!worker->conn)
+        return -1;
+
+    if ((worker->ndomains = virConnectListAllDomains(worker->conn,
+                                                     &worker->domains, 0)) < 0)
+        return -1;
+
+    if (worker->ndomains == 0 &&
+        (config.weights[VIR_LOADGEN_OP_LOOKUP] ||
+         config.weights[VIR_LOADGEN_OP_INFO] ||
+         config.weights[VIR_LOADGEN_OP_DUMPXML])) {
+        fprintf(stderr, _("no domains to call lookup, info or dumpxml on\n"));
+        return -1;
+    }
+
+    if (config.listen &&
+        virConnectDomainEventRegisterAny(worker->conn, NULL,
+                                         VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                         VIR_DOMAIN_EVENT_CALLBACK(virLoadLifecycleEvent),
+                                         worker, NULL) < 0)
+        return -1;
+
+    return 0;
+}
+
+static void
+virLoadWorkerClose(virLoadWorker *worker)
+{
+    size_t i;
+
+    for (i = 0; i < worker->ndomains; i++)
+        virDomainFree(worker->domains[i]);
+    VIR_FREE(worker->domains);
+    for (i = 0; i < VIR_LOADGEN_OP_LAST; i++) {
+        VIR_FREE(worker->ops[i].lat);
+        VIR_FREE(worker->ops[i].firstError);
+    }
+    if (worker->conn)
+        virConnectClose(worker->conn);
+}
+
+int
+main(int argc, char **argv)
+{
+    virLoadWorker *workers = NULL;
+    virThread eventThread;
+    bool eventLoop = false;
+    int eventTimer = -1;
+    unsigned long long start;
+    size_t i, nstarted = 0;
+    int ret = EXIT_FAILURE;
+    int c;
+
+    if (!setlocale(LC_ALL, "")) {
+        perror("setlocale");
+        /* failure to setup locale is not fatal */
+    }
+    if (!bindtextdomain(PACKAGE, LOCALEDIR)) {
+        perror("bindtextdomain");
+        return EXIT_FAILURE;
+    }
+    if (!textdomain(PACKAGE)) {
+        perror("textdomain");
+        return EXIT_FAILURE;
+    }
+
+    config.connections = 4;
+    config.duration = 10;
+    virLoadParseMix("lookup=1,info=1,dumpxml=1,stats=1");
+
+    while ((c = getopt_long(argc, argv, "hvc:rn:d:R:m:e",
+                            argOptions, NULL)) != -1) {
+        switch (c) {
+        case 'v':
+            show_version(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        case 'h':
+            show_help(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        case 'c':
+            config.uri = optarg;
+            break;
+
+        case 'r':
+            config.readonly = true;
+            break;
+
+        case 'n':
+            if (virStrToLong_ui(optarg, NULL, 10, &config.connections) < 0 ||
+                config.connections == 0 ||
+                config.connections > VIR_LOADGEN_MAX_CONNECTIONS) {
+                fprintf(stderr, _("invalid number of connections '%s'\n"),
+                        optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'd':
+            if (virStrToLong_ui(optarg, NULL, 10, &config.duration) < 0 ||
+                config.duration == 0) {
+                fprintf(stderr, _("invalid duration '%s'\n"), optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'R':
+            if (virStrToLong_ui(optarg, NULL, 10, &config.rate) < 0) {
+                fprintf(stderr, _("invalid rate '%s'\n"), optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'm':
+            if (virLoadParseMix(optarg) < 0)
+                return EXIT_FAILURE;
+            break;
+
+        case 'e':
+            config.listen = true;
+            break;
+
+        case '?':
+        default:
+            show_help(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc) {
+        show_help(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (virInitialize() < 0) {
+        fprintf(stderr, _("failed to initialize libvirt\n"));
+        return EXIT_FAILURE;
+    }
+
+    if (config.listen || config.weights[VIR_LOADGEN_OP_SUBSCRIBE]) {
+        if (virEventRegisterDefaultImpl() < 0 ||
+            (eventTimer = virEventAddTimeout(100, virLoadEventTick,
+                                             NULL, NULL)) < 0 ||
+            virThreadCreate(&eventThread, true, virLoadEventLoop, NULL) < 0) {
+            fprintf(stderr, _("failed to start the event loop\n"));
+            goto cleanup;
+        }
+        eventLoop = true;
+    }
+
+    if (VIR_ALLOC_N(workers, config.connections) < 0) {
+        fprintf(stderr, _("out of memory\n"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < config.connections; i++) {
+        if (virLoadWorkerOpen(&workers[i]) < 0) {
+            virErrorPtr err = virGetLastError();
+            if (err)
+                fprintf(stderr, _("connection %zu: %s\n"), i, err->message);
+            goto cleanup;
+        }
+    }
+
+    start = virLoadNow();
+    config.deadline = start + config.duration * 1000000ull;
+
+    for (i = 0; i < config.connections; i++) {
+        if (virThreadCreate(&workers[i].thread, true,
+                            virLoadWorkerRun, &workers[i]) < 0) {
+            fprintf(stderr, _("failed to start worker thread\n"));
+            config.deadline = 0;
+            break;
+        }
+        nstarted++;
+    }
+
+    for (i = 0; i < nstarted; i++)
+        virThreadJoin(&workers[i].thread);
+
+    if (nstarted == config.connections) {
+        virLoadReport(workers, virLoadNow() - start);
+        ret = EXIT_SUCCESS;
+    }
+
+cleanup:
+    if (workers) {
+        for (i = 0; i < config.connections; i++)
+            virLoadWorkerClose(&workers[i]);
+        VIR_FREE(workers);
+    }
+    if (eventLoop) {
+        quit = true;
+        virThreadJoin(&eventThread);
+    }
+    if (eventTimer >= 0)
+        virEventRemoveTimeout(eventTimer);
+    return ret;
+}
+
+/*
+
+=pod
+
+=head1 NAME
+
+  virt-loadgen - drive a libvirt daemon with a configurable API mix
+
+=head1 SYNOPSIS
+
+  virt-loadgen [OPTIONS...]
+
+=head1 DESCRIPTION
+
+This tool opens a number of connections to a hypervisor, normally one
+managed through C<libvirtd>, and issues a weighted random mix of API
+calls on each of them for a fixed time. It then reports the number of
+calls, errors and latency percentiles for each kind of call.
+
+Each connection runs in its own thread and makes one call at a time,
+so the number of connections is the number of concurrent requests the
+daemon sees. Comparing runs with different numbers of connections and
+different C<max_clients>, C<max_workers> and C<max_requests> settings
+in F<libvirtd.conf> shows where the daemon stops scaling. Pointing it
+at a C<test:///scale> URI, such as
+
+  virt-loadgen -c 'test+unix:///scale?domains=1000&latency=5' -n 64
+
+measures the daemon and RPC layer against a simulated large host
+without needing real guests.
+
+The calls available are
+
+=over 4
+
+=item C<lookup>
+
+Look up a random domain by name
+
+=item C<info>
+
+Fetch the basic info of a random domain
+
+=item C<dumpxml>
+
+Fetch the XML description of a random domain
+
+=item C<stats>
+
+Fetch the stats of every domain in one call, or with one call per
+domain if the driver does not support fetching them in bulk
+
+=item C<subscribe>
+
+Register and then deregister a lifecycle event callback
+
+=back
+
+=head1 OPTIONS
+
+=over 4
+
+=item C<-c>, C<--connect> I<URI>
+
+The hypervisor connection URI to use
+
+=item C<-r>, C<--readonly>
+
+Open read-only connections
+
+=item C<-n>, C<--connections> I<N>
+
+The number of connections to open, 4 by default
+
+=item C<-d>, C<--duration> I<SECS>
+
+How long to issue calls for, 10 seconds by default
+
+=item C<-R>, C<--rate> I<N>
+
+The number of calls per second to make on each connection. By default
+each connection issues its next call as soon as the last one returns.
+With a rate, a call's latency is measured from when it was due rather
+than when it was sent, so a stalled daemon shows up as high latency
+rather than a lower call count.
+
+=item C<-m>, C<--mix> I<OP=WEIGHT,...>
+
+The relative weights of the calls to make, by default
+C<lookup=1,info=1,dumpxml=1,stats=1>
+
+=item C<-e>, C<--events>
+
+Keep a lifecycle event subscription open on every connection for the
+whole run, and report how many events were received
+
+=item C<-v>, C<--version>
+
+Display the command version
+
+=item C<-h>, C<--help>
+
+Display the command line help
+
+=back
+
+=head1 EXIT STATUS
+
+Upon success, an exit status of 0 will be set. If a connection could
+not be opened or set up, a non-zero status will be set. Failed calls
+during the run are reported but do not change the exit status.
+
+=head1 COPYRIGHT
+
+Copyright (C) 2013 by Red Hat, Inc.
+
+=head1 LICENSE
+
+virt-loadgen is distributed under the terms of the GNU LGPL v2.1+.
+This is free software; see the source for copying conditions. There
+is NO warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE
+
+=head1 SEE ALSO
+
+C<virsh(1)>, C<libvirtd(8)>, L<http://libvirt.org/drvtest.html>
+
+=cut
+
+*/
@@ -0,0 +1,357 @@
+/*
+ * virt-trace-decode.c: Turn a binary debug log trace back into text
+ *
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gettext.h>
+#include <getopt.h>
+#include <locale.h>
+
+#include "internal.h"
+#include "configmake.h"
+#include "logging.h"
+#include "memory.h"
+#include "virtime.h"
+
+/* Anything bigger is taken to be a corrupted record */
+#define VIR_TRACE_RECORD_MAX (64 * 1024 * 1024)
+
+typedef struct _virTraceDecoder virTraceDecoder;
+struct _virTraceDecoder {
+    const char *path;
+    FILE *fp;
+    char *buf;
+    size_t bufsize;
+    char **strings; /* indexed by string ID */
+    size_t nstrings;
+};
+
+static void
+show_help(FILE *out, const char *argv0)
+{
+    fprintf(out,
+            _("\n"
+              "syntax: %s [OPTIONS] [FILE...]\n"
+              "\n"
+              " Options:\n"
+              "   -h, --help     Display command line help\n"
+              "   -v, --version  Display command version\n"
+              "\n"),
+            argv0);
+}
+
+static void
+show_version(FILE *out, const char *argv0)
+{
+    fprintf(out, "version: %s %s\n", argv0, VERSION);
+}
+
+static const struct option argOptions[] = {
+    { "help", 0, NULL, 'h', },
+    { "version", 0, NULL, 'v', },
+    { NULL, 0, NULL, '\0', }
+};
+
+static const char *
+virTracePriorityString(unsigned int priority)
+{
+    switch (priority) {
+    case VIR_LOG_DEBUG:
+        return "debug";
+    case VIR_LOG_INFO:
+        return "info";
+    case VIR_LOG_WARN:
+        return "warning";
+    case VIR_LOG_ERROR:
+        return "error";
+    }
+    return "unknown";
+}
+
+static void
+virTraceResetStrings(virTraceDecoder *dec)
+{
+    size_t i;
+
+    for (i = 0; i < dec->nstrings; i++)
+        VIR_FREE(dec->strings[i]);
+    VIR_FREE(dec->strings);
+    dec->nstrings = 0;
+}
+
+static const char *
+virTraceLookupString(virTraceDecoder *dec, uint32_t id)
+{
+    if (id == 0 || id >= dec->nstrings || !dec->strings[id])
+        return "?";
+    return dec->strings[id];
+}
+
+static int
+virTraceAddString(virTraceDecoder *dec, const char *data, size_t len)
+{
+    virLogTraceString rec;
+
+    if (len < sizeof(rec))
+        return -1;
+    memcpy(&rec, data, sizeof(rec));
+    if (rec.id == 0)
+        return -1;
+
+    if (rec.id >= dec->nstrings &&
+        VIR_EXPAND_N(dec->strings, dec->nstrings,
+                     rec.id + 1 - dec->nstrings) < 0)
+        return -1;
+
+    VIR_FREE(dec->strings[rec.id]);
+    if (!(dec->strings[rec.id] = strndup(data + sizeof(rec),
+                                         len - sizeof(rec))))
+        return -1;
+    return 0;
+}
+
+static int
+virTracePrintMessage(virTraceDecoder *dec, const char *data, size_t len)
+{
+    virLogTraceMessage rec;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+
+    if (len < sizeof(rec))
+        return -1;
+    memcpy(&rec, data, sizeof(rec));
+
+    if (virTimeStringThenRaw(rec.usec / 1000, timestamp) < 0)
+        timestamp[0] = '\0';
+
+    printf("%s: %u: %s : %s:%u : %.*s\n",
+           timestamp, rec.thread, virTracePriorityString(rec.priority),
+           virTraceLookupString(dec, rec.func), rec.line,
+           (int) (len - sizeof(rec)), data + sizeof(rec));
+    return 0;
+}
+
+static int
+virTraceDecode(virTraceDecoder *dec)
+{
+    virLogTraceRecord hdr;
+    bool started = false;
+
+    verify(sizeof(hdr) == VIR_LOG_TRACE_MAGIC_LEN);
+
+    for (;;) {
+        size_t got = fread(&hdr, 1, sizeof(hdr), dec->fp);
+        int rc = 0;
+
+        if (got == 0 && feof(dec->fp))
+            return 0;
+        if (got != sizeof(hdr))
+            goto truncated;
+
+        /* Each time libvirt opens the output it starts over */
+        if (memcmp(&hdr, VIR_LOG_TRACE_MAGIC, VIR_LOG_TRACE_MAGIC_LEN) == 0) {
+            virTraceResetStrings(dec);
+            started = true;
+            continue;
+        }
+
+        if (!started) {
+            fprintf(stderr, _("%s: not a libvirt trace file\n"), dec->path);
+            return -1;
+        }
+
+        if (hdr.length > VIR_TRACE_RECORD_MAX) {
+            fprintf(stderr, _("%s: record of %u bytes is too large\n"),
+                    dec->path, hdr.length);
+            return -1;
+        }
+
+        if (hdr.length > dec->bufsize &&
+            VIR_RESIZE_N(dec->buf, dec->bufsize, 0, hdr.length) < 0) {
+            fprintf(stderr, _("%s: out of memory\n"), dec->path);
+            return -1;
+        }
+
+        if (fread(dec->buf, 1, hdr.length, dec->fp) != hdr.length)
+            goto truncated;
+
+        switch (hdr.type) {
+        case VIR_LOG_TRACE_RECORD_STRING:
+            rc = virTraceAddString(dec, dec->buf, hdr.length);
+            break;
+        case VIR_LOG_TRACE_RECORD_MESSAGE:
+            rc = virTracePrintMessage(dec, dec->buf, hdr.length);
+            break;
+        default:
+            /* Skip record types added by later versions */
+            break;
+        }
+
+        if (rc < 0) {
+            fprintf(stderr, _("%s: malformed record of type %u\n"),
+                    dec->path, hdr.type);
+            return -1;
+        }
+    }
+
+truncated:
+    if (ferror(dec->fp))
+        fprintf(stderr, _("%s: read failed: %s\n"), dec->path, strerror(errno));
+    else
+        fprintf(stderr, _("%s: truncated record\n"), dec->path);
+    return -1;
+}
+
+int
+main(int argc, char **argv)
+{
+    virTraceDecoder dec;
+    int c;
+    int i;
+    int ret = EXIT_SUCCESS;
+
+    if (!setlocale(LC_ALL, "")) {
+        perror("setlocale");
+        /* failure to setup locale is not fatal */
+    }
+    if (!bindtextdomain(PACKAGE, LOCALEDIR)) {
+        perror("bindtextdomain");
+        return EXIT_FAILURE;
+    }
+    if (!textdomain(PACKAGE)) {
+        perror("textdomain");
+        return EXIT_FAILURE;
+    }
+
+    while ((c = getopt_long(argc, argv, "hv", argOptions, NULL)) != -1) {
+        switch (c) {
+        case 'v':
+            show_version(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        case 'h':
+            show_help(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        case '?':
+        default:
+            show_help(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    memset(&dec, 0, sizeof(dec));
+
+    if (optind == argc) {
+        dec.path = "-";
+        dec.fp = stdin;
+        if (virTraceDecode(&dec) < 0)
+            ret = EXIT_FAILURE;
+    }
+
+    for (i = optind; i < argc; i++) {
+        dec.path = argv[i];
+        if (STREQ(dec.path, "-")) {
+            dec.fp = stdin;
+        } else if (!(dec.fp = fopen(dec.path, "r"))) {
+            fprintf(stderr, _("%s: cannot open: %s\n"),
+                    dec.path, strerror(errno));
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        if (virTraceDecode(&dec) < 0)
+            ret = EXIT_FAILURE;
+
+        if (dec.fp != stdin)
+            fclose(dec.fp);
+        virTraceResetStrings(&dec);
+    }
+
+    virTraceResetStrings(&dec);
+    VIR_FREE(dec.buf);
+    return ret;
+}
+
+/*
+
+=pod
+
+=head1 NAME
+
+  virt-trace-decode - convert a libvirt binary debug trace into text
+
+=head1 SYNOPSIS
+
+  virt-trace-decode [OPTIONS...] [FILE...]
+
+=head1 DESCRIPTION
+
+This tool reads log files written by a libvirt C<trace> log output,
+such as one configured with
+
+  log_outputs="1:trace:/var/log/libvirt/libvirtd.trace"
+
+and prints the messages they contain in the same format as a C<file>
+log output. If no files are given, or a file is C<->, the trace is
+read from standard input, so a trace can be followed while it is
+being written with C<tail -c +1 -f FILE | virt-trace-decode>.
+
+=head1 OPTIONS
+
+=over 4
+
+=item C<-v>, C<--version>
+
+Display the command version
+
+=item C<-h>, C<--help>
+
+Display the command line help
+
+=back
+
+=head1 EXIT STATUS
+
+Upon success, an exit status of 0 will be set. If a file could not be
+read or is not a valid trace, a non-zero status will be set.
+
+=head1 COPYRIGHT
+
+Copyright (C) 2013 by Red Hat, Inc.
+
+=head1 LICENSE
+
+virt-trace-decode is distributed under the terms of the GNU LGPL v2.1+.
+This is free software; see the source for copying conditions. There
+is NO warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE
+
+=head1 SEE ALSO
+
+C<libvirtd(8)>, L<http://libvirt.org/logging.html>
+
+=cut
+
+*/